@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
+
+
+namespace rj
+{
+	// Non-owning view of elements next to each other in memory. Parameters take one instead of a const std::vector &
+	// so callers can pass a vector with any allocator, a braced list or a plain array without building a vector first.
+	// A view of a braced list is only valid until the end of the full expression, as is the list itself
+	template<typename T>
+	class ArrayView
+	{
+	public:
+		ArrayView() = default;
+		ArrayView(const T *pData, size_t count) : m_pData(pData), m_count(count) {}
+		ArrayView(std::initializer_list<T> list) : m_pData(list.begin()), m_count(list.size()) {}
+		template<typename Allocator>
+		ArrayView(const std::vector<T, Allocator> &vec) : m_pData(vec.data()), m_count(vec.size()) {}
+		template<size_t N>
+		ArrayView(const T(&arr)[N]) : m_pData(arr), m_count(N) {}
+
+		const T *data() const { return m_pData; }
+		size_t size() const { return m_count; }
+		bool empty() const { return m_count == 0; }
+
+		const T *begin() const { return m_pData; }
+		const T *end() const { return m_pData + m_count; }
+		const T &operator[](size_t idx) const { return m_pData[idx]; }
+		const T &back() const { return m_pData[m_count - 1]; }
+
+	private:
+		const T *m_pData = nullptr;
+		size_t m_count = 0;
+	};
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "VManager.h"
+
+
+namespace rj
+{
+	// Forwards binds to VManager unless they would leave the command buffer state unchanged, and counts both.
+	// Use one per command buffer being recorded. State inherited from elsewhere is unknown, so the first bind of each kind is always issued
+	class VBindCache
+	{
+	public:
+		VBindCache(const VManager *pManager, uint32_t cmdBufferName)
+			:
+			m_pManager(pManager),
+			m_cmdBuffer(cmdBufferName)
+		{}
+
+		void bindPipeline(VkPipelineBindPoint bindPoint, uint32_t pipelineName)
+		{
+			auto &state = getBindPointState(bindPoint);
+			if (state.pipeline == pipelineName)
+			{
+				++m_skippedCount;
+				return;
+			}
+
+			m_pManager->cmdBindPipeline(m_cmdBuffer, bindPoint, pipelineName);
+			state.pipeline = pipelineName;
+			++m_issuedCount;
+		}
+
+		// Binds with dynamic offsets are always issued
+		void bindDescriptorSets(VkPipelineBindPoint bindPoint, uint32_t pipelineLayoutName, ArrayView<uint32_t> descriptorSetNames,
+			uint32_t firstSet = 0, ArrayView<uint32_t> dynamicOffsets = {})
+		{
+			auto &state = getBindPointState(bindPoint);
+			const size_t endSet = firstSet + descriptorSetNames.size();
+			if (dynamicOffsets.empty() && state.pipelineLayout == pipelineLayoutName && endSet <= state.sets.size() &&
+				std::equal(descriptorSetNames.begin(), descriptorSetNames.end(), state.sets.begin() + firstSet))
+			{
+				++m_skippedCount;
+				return;
+			}
+
+			m_pManager->cmdBindDescriptorSets(m_cmdBuffer, bindPoint, pipelineLayoutName, descriptorSetNames, firstSet, dynamicOffsets);
+			++m_issuedCount;
+
+			// Sets bound with another layout, or after the ones just bound, may have been disturbed
+			if (state.pipelineLayout != pipelineLayoutName)
+			{
+				state.sets.clear();
+				state.pipelineLayout = pipelineLayoutName;
+			}
+			state.sets.resize(endSet, uint32_t(INVALID_NAME));
+			std::copy(descriptorSetNames.begin(), descriptorSetNames.end(), state.sets.begin() + firstSet);
+			if (!dynamicOffsets.empty())
+			{
+				std::fill(state.sets.begin() + firstSet, state.sets.end(), uint32_t(INVALID_NAME));
+			}
+		}
+
+		void bindVertexBuffers(ArrayView<uint32_t> bufferNames, ArrayView<VkDeviceSize> offsets, uint32_t firstBinding = 0)
+		{
+			if (firstBinding == m_vertexBufferFirstBinding &&
+				std::equal(bufferNames.begin(), bufferNames.end(), m_vertexBuffers.begin(), m_vertexBuffers.end()) &&
+				std::equal(offsets.begin(), offsets.end(), m_vertexBufferOffsets.begin(), m_vertexBufferOffsets.end()))
+			{
+				++m_skippedCount;
+				return;
+			}
+
+			m_pManager->cmdBindVertexBuffers(m_cmdBuffer, bufferNames, offsets, firstBinding);
+			m_vertexBufferFirstBinding = firstBinding;
+			m_vertexBuffers.assign(bufferNames.begin(), bufferNames.end());
+			m_vertexBufferOffsets.assign(offsets.begin(), offsets.end());
+			++m_issuedCount;
+		}
+
+		void bindIndexBuffer(uint32_t indexBufferName, VkIndexType type, VkDeviceSize offset = 0)
+		{
+			if (indexBufferName == m_indexBuffer && type == m_indexType && offset == m_indexBufferOffset)
+			{
+				++m_skippedCount;
+				return;
+			}
+
+			m_pManager->cmdBindIndexBuffer(m_cmdBuffer, indexBufferName, type, offset);
+			m_indexBuffer = indexBufferName;
+			m_indexType = type;
+			m_indexBufferOffset = offset;
+			++m_issuedCount;
+		}
+
+		uint32_t getIssuedCount() const { return m_issuedCount; }
+		uint32_t getSkippedCount() const { return m_skippedCount; }
+
+	protected:
+		static const uint32_t INVALID_NAME = std::numeric_limits<uint32_t>::max();
+
+		struct BindPointState
+		{
+			uint32_t pipeline = INVALID_NAME;
+			uint32_t pipelineLayout = INVALID_NAME;
+			std::vector<uint32_t> sets; // by set index, INVALID_NAME if unknown
+		};
+
+		const VManager *m_pManager;
+		uint32_t m_cmdBuffer;
+
+		BindPointState m_graphicsState;
+		BindPointState m_computeState;
+
+		uint32_t m_vertexBufferFirstBinding = INVALID_NAME;
+		std::vector<uint32_t> m_vertexBuffers;
+		std::vector<VkDeviceSize> m_vertexBufferOffsets;
+
+		uint32_t m_indexBuffer = INVALID_NAME;
+		VkIndexType m_indexType = VK_INDEX_TYPE_MAX_ENUM;
+		VkDeviceSize m_indexBufferOffset = 0;
+
+		uint32_t m_issuedCount = 0;
+		uint32_t m_skippedCount = 0;
+
+		BindPointState &getBindPointState(VkPipelineBindPoint bindPoint)
+		{
+			return bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? m_computeState : m_graphicsState;
+		}
+	};
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "VDevice.h"
+#include "VMemoryAllocator.h"
 
 
 namespace rj
@@ -8,16 +9,32 @@ namespace rj
 	class VBuffer
 	{
 	public:
-		VBuffer(const VDevice &device)
+		// If @pAllocator is null the buffer gets its own VkDeviceMemory
+		VBuffer(const VDevice &device, VMemoryAllocator *pAllocator = nullptr)
 			:
 			m_device(device),
+			m_pAllocator(pAllocator),
 			m_buffer{ m_device, vkDestroyBuffer },
 			m_bufferMemory{ m_device, vkFreeMemory }
 		{}
 
 		void init(VkDeviceSize sizeInBytes, VkBufferUsageFlags usage, VkMemoryPropertyFlags memProps)
 		{
-			createBuffer(m_buffer, m_bufferMemory, m_device, m_device, sizeInBytes, usage, memProps);
+			if (m_pAllocator)
+			{
+				m_allocation.release();
+				createBuffer(m_buffer, m_device, sizeInBytes, usage);
+
+				VkMemoryRequirements memRequirements;
+				vkGetBufferMemoryRequirements(m_device, m_buffer, &memRequirements);
+				m_pAllocator->allocate(&m_allocation, memRequirements, memProps, true, getBufferMemoryCategory(usage));
+
+				vkBindBufferMemory(m_device, m_buffer, m_allocation.memory(), m_allocation.offset());
+			}
+			else
+			{
+				createBuffer(m_buffer, m_bufferMemory, m_device, m_device, sizeInBytes, usage, memProps);
+			}
 
 			m_sizeInBytes = sizeInBytes;
 			m_usage = usage;
@@ -30,6 +47,13 @@ namespace rj
 				== (VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT));
 			assert(offset < m_sizeInBytes && offset + sizeInBytes <= m_sizeInBytes);
 
+			// Sub-allocated host visible memory is persistently mapped by its block
+			if (m_allocation.isvalid())
+			{
+				assert(m_allocation.mapped());
+				return static_cast<char *>(m_allocation.mapped()) + offset;
+			}
+
 			sizeInBytes = sizeInBytes == 0 ? m_sizeInBytes : sizeInBytes;
 			void *mapped = nullptr;
 			vkMapMemory(m_device, m_bufferMemory, offset, sizeInBytes, 0, &mapped);
@@ -38,9 +62,16 @@ namespace rj
 
 		void unmapBuffer() const
 		{
+			if (m_allocation.isvalid()) return;
 			vkUnmapMemory(m_device, m_bufferMemory);
 		}
 
+		// Buffers are accounted by their usage, see getBufferMemoryCategory(). No effect on buffers with memory of their own
+		void setMemoryCategory(MemoryCategory category)
+		{
+			if (m_pAllocator) m_pAllocator->setCategory(&m_allocation, category);
+		}
+
 		operator VkBuffer() const { return m_buffer; }
 
 		VkDeviceSize size() const { return m_sizeInBytes; }
@@ -49,7 +80,10 @@ namespace rj
 
 	protected:
 		const VDevice &m_device;
+		VMemoryAllocator *m_pAllocator;
 
+		// m_allocation is declared before m_buffer so the buffer is destroyed before its memory is recycled
+		VMemoryAllocation m_allocation;
 		VDeleter<VkBuffer> m_buffer;
 		VDeleter<VkDeviceMemory> m_bufferMemory;
 
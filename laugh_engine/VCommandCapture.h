@@ -0,0 +1,294 @@
+#pragma once
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "VArrayView.h"
+
+
+namespace rj
+{
+	// One frame of VManager calls, to run it again without the application: the commands of every command buffer recorded in
+	// the frame, the descriptor sets allocated and written, the submits in order, and the contents of the host visible buffers
+	// once the frame is submitted, which hold its uniform and instance data. Resources are referred to by their VManager names,
+	// so a replay needs a manager that created the same resources under the same names, i.e. the same build, settings and
+	// scene. The signature of every live buffer, image and pipeline is kept to tell whether that is the case.
+	// Commands are recorded from any thread, each command buffer by one thread at a time
+	class VCommandCapture
+	{
+	public:
+		// Packets of a command stream, the arguments follow in the order of the VManager::cmd* parameters
+		enum Command : uint32_t
+		{
+			CMD_BEGIN, // flags
+			CMD_BEGIN_SECONDARY, // render pass, subpass, framebuffer, flags, pipeline statistics
+			CMD_BIND_VERTEX_BUFFERS,
+			CMD_BIND_INDEX_BUFFER,
+			CMD_BEGIN_RENDER_PASS,
+			CMD_END_RENDER_PASS,
+			CMD_NEXT_SUBPASS,
+			CMD_EXECUTE_COMMANDS,
+			CMD_CLEAR_ATTACHMENTS,
+			CMD_BIND_PIPELINE,
+			CMD_BIND_DESCRIPTOR_SETS,
+			CMD_PUSH_DESCRIPTOR_SET,
+			CMD_SET_VIEWPORT, // in pixels, whichever overload recorded it
+			CMD_SET_SCISSOR, // in pixels
+			CMD_DRAW_INDEXED,
+			CMD_DRAW_INDEXED_INDIRECT,
+			CMD_DRAW_MESH_TASKS_INDIRECT,
+			CMD_DRAW,
+			CMD_PUSH_CONSTANTS,
+			CMD_DISPATCH,
+			CMD_MEMORY_BARRIER,
+			CMD_IMAGE_BARRIER,
+			CMD_COPY_IMAGE,
+			CMD_COPY_BUFFER_TO_IMAGE,
+			CMD_RESET_QUERY_POOL,
+			CMD_BEGIN_QUERY,
+			CMD_END_QUERY,
+			CMD_WRITE_TIMESTAMP,
+			CMD_BUILD_TOP_LEVEL_ACCELERATION_STRUCTURE,
+			CMD_SET_DEPTH_BIAS
+		};
+
+		// Packets of the descriptor stream, applied in order before the command buffers are recorded again
+		enum DescriptorCall : uint32_t
+		{
+			DESC_ALLOCATE_TRANSIENT, // allocator, frame, set layout, set. The replay allocates its own set for the name
+			DESC_BUFFERS, // set, binding, type, first array element, DescriptorSetUpdateBufferInfos
+			DESC_IMAGES, // set, binding, type, first array element, DescriptorSetUpdateImageInfos
+			DESC_ACCELERATION_STRUCTURE, // set, binding, acceleration structure
+			DESC_WRITES // set, PushDescriptorWrites
+		};
+
+		enum ResourceType : uint32_t
+		{
+			RESOURCE_BUFFER,
+			RESOURCE_IMAGE,
+			RESOURCE_PIPELINE
+		};
+
+		struct Submit
+		{
+			VkQueueFlags queueType;
+			std::vector<uint32_t> cmdBufferNames;
+		};
+
+		struct BufferContents
+		{
+			uint32_t bufferName;
+			std::vector<char> data;
+		};
+
+		struct Resource
+		{
+			ResourceType type;
+			uint32_t name;
+			uint64_t signature; // of what it was created with
+		};
+
+		// Reads a stream back with the types it was written with
+		class Reader
+		{
+		public:
+			explicit Reader(const std::vector<uint8_t> &bytes) : m_pos(bytes.data()), m_end(bytes.data() + bytes.size()) {}
+
+			bool atEnd() const { return m_pos == m_end || m_failed; }
+			bool failed() const { return m_failed; }
+
+			template<typename T>
+			T read()
+			{
+				T value = {};
+				readBytes(&value, sizeof(T));
+				return value;
+			}
+
+			// The view stays valid until @pScratch is read into again
+			template<typename T>
+			ArrayView<T> readArray(std::vector<T> *pScratch)
+			{
+				pScratch->resize(read<uint32_t>());
+				readBytes(pScratch->data(), pScratch->size() * sizeof(T));
+				return ArrayView<T>(pScratch->data(), m_failed ? 0 : pScratch->size());
+			}
+
+		protected:
+			const uint8_t *m_pos;
+			const uint8_t *m_end;
+			bool m_failed = false;
+
+			void readBytes(void *pDst, size_t size)
+			{
+				if (m_failed || static_cast<size_t>(m_end - m_pos) < size)
+				{
+					m_failed = true;
+					return;
+				}
+				if (size > 0) memcpy(pDst, m_pos, size);
+				m_pos += size;
+			}
+		};
+
+		uint32_t frameIdx = 0; // set by the application, e.g. the swapchain image whose per-frame resources the frame used
+		std::vector<std::vector<uint8_t>> commandStreams; // by command buffer name, empty if it was not recorded in the frame
+		std::vector<uint8_t> descriptorStream;
+		std::vector<Submit> submits;
+		std::vector<BufferContents> bufferContents;
+		std::vector<Resource> resources;
+		uint32_t droppedCommandCount = 0; // left out of the streams, e.g. readbacks into the manager's own buffers
+
+		// Command buffers created later are not captured
+		void begin(uint32_t commandBufferCount)
+		{
+			*this = VCommandCapture();
+			commandStreams.resize(commandBufferCount);
+		}
+
+		void beginCommandBuffer(uint32_t cmdBufferName)
+		{
+			if (cmdBufferName < commandStreams.size()) commandStreams[cmdBufferName].clear();
+		}
+
+		template<typename... Args>
+		void recordCommand(uint32_t cmdBufferName, Command command, const Args &... args)
+		{
+			if (cmdBufferName >= commandStreams.size()) return;
+			auto &stream = commandStreams[cmdBufferName];
+			write(&stream, command);
+			writeAll(&stream, args...);
+		}
+
+		void dropCommand()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++droppedCommandCount;
+		}
+
+		template<typename... Args>
+		void recordDescriptorCall(DescriptorCall call, const Args &... args)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			write(&descriptorStream, call);
+			writeAll(&descriptorStream, args...);
+		}
+
+		void recordSubmit(VkQueueFlags queueType, ArrayView<uint32_t> cmdBufferNames)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			submits.push_back({ queueType, std::vector<uint32_t>(cmdBufferNames.begin(), cmdBufferNames.end()) });
+		}
+
+		bool write(const std::string &fileName) const
+		{
+			std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+			if (!file.is_open()) return false;
+
+			std::vector<uint8_t> bytes;
+			write(&bytes, static_cast<uint32_t>(MAGIC));
+			write(&bytes, static_cast<uint32_t>(VERSION));
+			write(&bytes, frameIdx);
+			write(&bytes, droppedCommandCount);
+			write(&bytes, static_cast<uint32_t>(commandStreams.size()));
+			for (const auto &stream : commandStreams) write(&bytes, ArrayView<uint8_t>(stream));
+			write(&bytes, ArrayView<uint8_t>(descriptorStream));
+			write(&bytes, static_cast<uint32_t>(submits.size()));
+			for (const auto &submit : submits)
+			{
+				write(&bytes, submit.queueType);
+				write(&bytes, ArrayView<uint32_t>(submit.cmdBufferNames));
+			}
+			write(&bytes, static_cast<uint32_t>(bufferContents.size()));
+			for (const auto &contents : bufferContents)
+			{
+				write(&bytes, contents.bufferName);
+				write(&bytes, ArrayView<char>(contents.data));
+			}
+			write(&bytes, ArrayView<Resource>(resources));
+
+			file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+			return file.good();
+		}
+
+		// False if the file is missing, truncated or of another version
+		bool read(const std::string &fileName)
+		{
+			std::ifstream file(fileName, std::ios::binary);
+			if (!file.is_open()) return false;
+			const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+			*this = VCommandCapture();
+			Reader reader(bytes);
+			if (reader.read<uint32_t>() != MAGIC || reader.read<uint32_t>() != VERSION) return false;
+			frameIdx = reader.read<uint32_t>();
+			droppedCommandCount = reader.read<uint32_t>();
+			commandStreams.resize(reader.read<uint32_t>());
+			for (auto &stream : commandStreams) reader.readArray(&stream);
+			reader.readArray(&descriptorStream);
+			submits.resize(reader.read<uint32_t>());
+			for (auto &submit : submits)
+			{
+				submit.queueType = reader.read<VkQueueFlags>();
+				reader.readArray(&submit.cmdBufferNames);
+			}
+			bufferContents.resize(reader.read<uint32_t>());
+			for (auto &contents : bufferContents)
+			{
+				contents.bufferName = reader.read<uint32_t>();
+				reader.readArray(&contents.data);
+			}
+			reader.readArray(&resources);
+			return !reader.failed();
+		}
+
+	protected:
+		static const uint32_t MAGIC = 0x4343454c; // "LECC"
+		static const uint32_t VERSION = 2;
+
+		std::mutex m_mutex; // of everything but the command streams
+
+		VCommandCapture &operator=(VCommandCapture &&other)
+		{
+			frameIdx = other.frameIdx;
+			commandStreams = std::move(other.commandStreams);
+			descriptorStream = std::move(other.descriptorStream);
+			submits = std::move(other.submits);
+			bufferContents = std::move(other.bufferContents);
+			resources = std::move(other.resources);
+			droppedCommandCount = other.droppedCommandCount;
+			return *this;
+		}
+
+		template<typename T>
+		static void write(std::vector<uint8_t> *pBytes, const T &value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "only plain values are captured");
+			const uint8_t *pSrc = reinterpret_cast<const uint8_t *>(&value);
+			pBytes->insert(pBytes->end(), pSrc, pSrc + sizeof(T));
+		}
+
+		template<typename T>
+		static void write(std::vector<uint8_t> *pBytes, ArrayView<T> values)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "only plain values are captured");
+			write(pBytes, static_cast<uint32_t>(values.size()));
+			const uint8_t *pSrc = reinterpret_cast<const uint8_t *>(values.data());
+			if (!values.empty()) pBytes->insert(pBytes->end(), pSrc, pSrc + values.size() * sizeof(T));
+		}
+
+		static void writeAll(std::vector<uint8_t> *) {}
+
+		template<typename T, typename... Args>
+		static void writeAll(std::vector<uint8_t> *pBytes, const T &value, const Args &... args)
+		{
+			write(pBytes, value);
+			writeAll(pBytes, args...);
+		}
+	};
+}
@@ -24,7 +24,7 @@ namespace rj
 			poolInfo.pPoolSizes = poolSizes.data();
 			poolInfo.maxSets = maxNumSets;
 
-			if (vkCreateDescriptorPool(*m_pDevice, &poolInfo, nullptr, m_descriptorPool.replace()) != VK_SUCCESS)
+			if (vkCreateDescriptorPool(*m_pDevice, &poolInfo, helper_functions::getHostAllocationCallbacks(), m_descriptorPool.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create descriptor pool!");
 			}
@@ -1,5 +1,11 @@
 #include "VDevice.h"
 
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
 
 namespace rj
 {
@@ -23,4 +29,47 @@ namespace rj
 			return requiredExtensions.empty();
 		}
 	}
+
+	bool VDevice::sampleCalibratedTimestamps(uint64_t *pDeviceTimestamp, uint64_t *pHostNs) const
+	{
+		if (!m_calibratedTimestampsEnabled) return false;
+
+		VkCalibratedTimestampInfoEXT infos[2] = {};
+		infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+		infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+		infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+		infos[1].timeDomain = HOST_TIME_DOMAIN;
+
+		uint64_t timestamps[2];
+		uint64_t maxDeviation;
+		if (m_pfnGetCalibratedTimestamps(m_device, 2, infos, timestamps, &maxDeviation) != VK_SUCCESS) return false;
+
+		*pDeviceTimestamp = timestamps[0];
+#ifdef _WIN32
+		// Performance counter ticks, steady_clock scales them the same way
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		const uint64_t ticks = timestamps[1];
+		const uint64_t freq = static_cast<uint64_t>(frequency.QuadPart);
+		*pHostNs = ticks / freq * 1000000000ull + ticks % freq * 1000000000ull / freq;
+#else
+		// CLOCK_MONOTONIC is already in nanoseconds
+		*pHostNs = timestamps[1];
+#endif
+		return true;
+	}
+
+	bool VDevice::getMemoryBudget(VkPhysicalDeviceMemoryBudgetPropertiesEXT *pBudget) const
+	{
+		if (!m_memoryBudgetEnabled) return false;
+
+		*pBudget = {};
+		pBudget->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+		VkPhysicalDeviceMemoryProperties2KHR properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+		properties.pNext = pBudget;
+		m_pfnGetMemoryProperties2(m_physicalDevice, &properties);
+		return true;
+	}
 }
\ No newline at end of file
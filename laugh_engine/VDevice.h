@@ -26,11 +26,21 @@ namespace rj
 			const VDeleter<VkInstance> &instance,
 			const VDeleter<VkSurfaceKHR> &surface,
 			const std::vector<const char *> &deviceExtensions,
-			const VkPhysicalDeviceFeatures &enabledFeatures = {})
+			const VkPhysicalDeviceFeatures &enabledFeatures = {},
+			bool physicalDeviceProperties2Enabled = false,
+			bool externalMemoryCapabilitiesEnabled = false,
+			bool debugUtilsEnabled = false,
+			uint32_t instanceApiVersion = VK_API_VERSION_1_0,
+			bool deviceGroupRequested = false)
 			:
 			m_enableValidationLayers(enableValidationLayers), m_validationLayers(layerNames),
 			m_instance(instance), m_surface(surface),
-			m_deviceExtensions(deviceExtensions), m_enabledDeviceFeatures(enabledFeatures)
+			m_deviceExtensions(deviceExtensions), m_enabledDeviceFeatures(enabledFeatures),
+			m_physicalDeviceProperties2Enabled(physicalDeviceProperties2Enabled),
+			m_externalMemoryCapabilitiesEnabled(externalMemoryCapabilitiesEnabled),
+			m_debugUtilsEnabled(debugUtilsEnabled),
+			m_instanceApiVersion(instanceApiVersion),
+			m_deviceGroupRequested(deviceGroupRequested)
 		{
 			pickPhysicalDevice();
 			createLogicalDevice();
@@ -59,6 +69,117 @@ namespace rj
 		VkQueue getGraphicsQueue() const { assert(m_graphicsQueue); return m_graphicsQueue; }
 		VkQueue getComputeQueue() const { assert(m_computeQueue); return m_computeQueue; }
 		VkQueue getPresentQueue() const { assert(m_presentQueue); return m_presentQueue; }
+		VkQueue getTransferQueue() const { assert(m_transferQueue); return m_transferQueue; }
+
+		// Runtime sized, partially bound and non-uniformly indexed sampled image arrays
+		bool isDescriptorIndexingEnabled() const { return m_descriptorIndexingEnabled; }
+
+		// shaderStorageImageMultisample, storage images with more than one sample
+		bool isStorageImageMultisampleEnabled() const { return m_enabledDeviceFeatures.shaderStorageImageMultisample == VK_TRUE; }
+
+		// fragmentStoresAndAtomics, storage buffer and image writes from fragment shaders
+		bool isFragmentStoresEnabled() const { return m_enabledDeviceFeatures.fragmentStoresAndAtomics == VK_TRUE; }
+
+		// sparseBinding and sparseResidencyImage2D, partially resident 2D images whose pages are bound on the graphics queue
+		bool isSparseResidencyEnabled() const
+		{
+			return m_enabledDeviceFeatures.sparseBinding == VK_TRUE && m_enabledDeviceFeatures.sparseResidencyImage2D == VK_TRUE;
+		}
+
+		// VK_KHR_timeline_semaphore. The entry points below are only loaded when it is enabled
+		bool isTimelineSemaphoreEnabled() const { return m_timelineSemaphoreEnabled; }
+		PFN_vkWaitSemaphoresKHR pfnWaitSemaphores = nullptr;
+		PFN_vkSignalSemaphoreKHR pfnSignalSemaphore = nullptr;
+		PFN_vkGetSemaphoreCounterValueKHR pfnGetSemaphoreCounterValue = nullptr;
+
+		// VK_EXT_calibrated_timestamps with the device and the host clock behind std::chrono::steady_clock as time domains
+		bool isCalibratedTimestampsEnabled() const { return m_calibratedTimestampsEnabled; }
+		// Read a device timestamp and the steady_clock time in nanoseconds at the same instant
+		bool sampleCalibratedTimestamps(uint64_t *pDeviceTimestamp, uint64_t *pHostNs) const;
+
+		// VK_EXT_memory_budget, needs VK_KHR_get_physical_device_properties2 on the instance
+		bool isMemoryBudgetEnabled() const { return m_memoryBudgetEnabled; }
+		// Budget and usage of every heap, usage includes memory of other processes and of the driver.
+		// Return false if VK_EXT_memory_budget is not enabled
+		bool getMemoryBudget(VkPhysicalDeviceMemoryBudgetPropertiesEXT *pBudget) const;
+
+		// VK_KHR_push_descriptor, also needs VK_KHR_get_physical_device_properties2 on the instance
+		bool isPushDescriptorEnabled() const { return m_pushDescriptorEnabled; }
+		PFN_vkCmdPushDescriptorSetKHR pfnCmdPushDescriptorSet = nullptr;
+
+		// VK_KHR_descriptor_update_template, sets of a layout written from a block of descriptor infos in one call
+		bool isDescriptorUpdateTemplateEnabled() const { return m_descriptorUpdateTemplateEnabled; }
+		PFN_vkCreateDescriptorUpdateTemplateKHR pfnCreateDescriptorUpdateTemplate = nullptr;
+		PFN_vkDestroyDescriptorUpdateTemplateKHR pfnDestroyDescriptorUpdateTemplate = nullptr;
+		PFN_vkUpdateDescriptorSetWithTemplateKHR pfnUpdateDescriptorSetWithTemplate = nullptr;
+
+		// VK_KHR_present_id and VK_KHR_present_wait, for waiting until a presented image is on screen. Needs
+		// VK_KHR_get_physical_device_properties2 on the instance
+		bool isPresentWaitEnabled() const { return m_presentWaitEnabled; }
+		PFN_vkWaitForPresentKHR pfnWaitForPresent = nullptr;
+
+		// Memory and semaphores exported as POSIX file descriptors with dedicated allocations, e.g. for a video encoder.
+		// Needs the external memory capabilities on the instance and is never enabled on Windows
+		bool isExternalMemoryEnabled() const { return m_externalMemoryEnabled; }
+#ifndef _WIN32
+		PFN_vkGetMemoryFdKHR pfnGetMemoryFd = nullptr;
+		PFN_vkGetSemaphoreFdKHR pfnGetSemaphoreFd = nullptr;
+#endif
+
+		// VK_EXT_mesh_shader with task shaders, needs VK_KHR_get_physical_device_properties2 on the instance
+		bool isMeshShaderEnabled() const { return m_meshShaderEnabled; }
+		PFN_vkCmdDrawMeshTasksIndirectEXT pfnCmdDrawMeshTasksIndirect = nullptr;
+
+		// shaderFloat16 of VK_KHR_shader_float16_int8, half precision arithmetic in shaders. Needs
+		// VK_KHR_get_physical_device_properties2 on the instance to query the feature
+		bool isShaderFloat16Enabled() const { return m_shaderFloat16Enabled; }
+
+		// attachmentFragmentShadingRate of VK_KHR_fragment_shading_rate, shading rate images attached to subpasses. Brings
+		// VK_KHR_create_renderpass2, which such render passes are created with. Needs VK_KHR_get_physical_device_properties2 on the instance
+		bool isFragmentShadingRateEnabled() const { return m_fragmentShadingRateEnabled; }
+		// Texel sizes the shading rate images may have, only valid if the above is enabled
+		const VkPhysicalDeviceFragmentShadingRatePropertiesKHR &getFragmentShadingRateProperties() const { return m_fragmentShadingRateProperties; }
+		PFN_vkCreateRenderPass2KHR pfnCreateRenderPass2 = nullptr;
+
+		// VK_KHR_depth_stencil_resolve, multisampled depth resolved at the end of a subpass. Brings VK_KHR_create_renderpass2, which
+		// such render passes are created with. Needs VK_KHR_get_physical_device_properties2 on the instance
+		bool isDepthStencilResolveEnabled() const { return m_depthStencilResolveEnabled; }
+		// Resolve modes the depth may be resolved with, only valid if the above is enabled
+		const VkPhysicalDeviceDepthStencilResolvePropertiesKHR &getDepthStencilResolveProperties() const { return m_depthStencilResolveProperties; }
+
+		// Subgroup size and operations of Vulkan 1.1, zero without a Vulkan 1.1 instance and device or without
+		// VK_KHR_get_physical_device_properties2 on the instance
+		const VkPhysicalDeviceSubgroupProperties &getSubgroupProperties() const { return m_subgroupProperties; }
+
+		// VK_KHR_ray_query with VK_KHR_acceleration_structure and VK_KHR_buffer_device_address. Needs a Vulkan 1.1 instance with
+		// VK_KHR_get_physical_device_properties2, and descriptor indexing. Memory is then allocated with device addresses
+		bool isRayQueryEnabled() const { return m_rayQueryEnabled; }
+		// Scratch alignment of the builds, only valid if the above is enabled
+		const VkPhysicalDeviceAccelerationStructurePropertiesKHR &getAccelerationStructureProperties() const { return m_accelerationStructureProperties; }
+		PFN_vkGetBufferDeviceAddressKHR pfnGetBufferDeviceAddress = nullptr;
+		PFN_vkCreateAccelerationStructureKHR pfnCreateAccelerationStructure = nullptr;
+		PFN_vkDestroyAccelerationStructureKHR pfnDestroyAccelerationStructure = nullptr;
+		PFN_vkGetAccelerationStructureBuildSizesKHR pfnGetAccelerationStructureBuildSizes = nullptr;
+		PFN_vkGetAccelerationStructureDeviceAddressKHR pfnGetAccelerationStructureDeviceAddress = nullptr;
+		PFN_vkCmdBuildAccelerationStructuresKHR pfnCmdBuildAccelerationStructures = nullptr;
+		PFN_vkCmdWriteAccelerationStructuresPropertiesKHR pfnCmdWriteAccelerationStructuresProperties = nullptr;
+		PFN_vkCmdCopyAccelerationStructureKHR pfnCmdCopyAccelerationStructure = nullptr;
+
+		// VK_EXT_debug_utils, an instance extension. The entry points are only loaded when the instance enabled it
+		bool isDebugUtilsEnabled() const { return m_debugUtilsEnabled; }
+		PFN_vkSetDebugUtilsObjectNameEXT pfnSetDebugUtilsObjectName = nullptr;
+		PFN_vkCmdBeginDebugUtilsLabelEXT pfnCmdBeginDebugUtilsLabel = nullptr;
+		PFN_vkCmdEndDebugUtilsLabelEXT pfnCmdEndDebugUtilsLabel = nullptr;
+		PFN_vkCmdInsertDebugUtilsLabelEXT pfnCmdInsertDebugUtilsLabel = nullptr;
+
+		// Physical devices of the device group the logical device spans, only more than 1 if a group was requested on a Vulkan 1.1
+		// instance. Memory is allocated on all of them, command buffers are recorded for all of them and each submit picks the
+		// ones that execute it
+		uint32_t getDeviceCount() const { return std::max(static_cast<uint32_t>(m_groupDevices.size()), 1u); }
+		// VK_DEVICE_GROUP_PRESENT_MODE_LOCAL_BIT_KHR if every device of the group presents the images it rendered,
+		// VK_DEVICE_GROUP_PRESENT_MODE_REMOTE_BIT_KHR if they are presented through another device, 0 if only device 0 presents
+		VkDeviceGroupPresentModeFlagsKHR getDeviceGroupPresentMode() const { return m_deviceGroupPresentMode; }
+		PFN_vkAcquireNextImage2KHR pfnAcquireNextImage2 = nullptr; // only loaded for a device group
 
 	protected:
 		void pickPhysicalDevice()
@@ -71,6 +192,8 @@ namespace rj
 				throw std::runtime_error("failed to find GPUs with Vulkan support!");
 			}
 
+			if (m_deviceGroupRequested && m_instanceApiVersion >= VK_API_VERSION_1_1 && pickDeviceGroup()) return;
+
 			std::vector<VkPhysicalDevice> devices(deviceCount);
 			vkEnumeratePhysicalDevices(m_instance, &deviceCount, devices.data());
 
@@ -86,16 +209,48 @@ namespace rj
 			throw std::runtime_error("failed to find a suitable GPU!");
 		}
 
+		// The first group of more than one device that is suitable. The devices of a group are the same model, so the queue
+		// families and features of the first one stand for all of them
+		bool pickDeviceGroup()
+		{
+			auto pfnEnumerateGroups = (PFN_vkEnumeratePhysicalDeviceGroups)vkGetInstanceProcAddr(m_instance, "vkEnumeratePhysicalDeviceGroups");
+			if (!pfnEnumerateGroups) return false;
+
+			uint32_t groupCount = 0;
+			pfnEnumerateGroups(m_instance, &groupCount, nullptr);
+			std::vector<VkPhysicalDeviceGroupProperties> groups(groupCount);
+			for (auto &group : groups)
+			{
+				group.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES;
+				group.pNext = nullptr;
+			}
+			pfnEnumerateGroups(m_instance, &groupCount, groups.data());
+
+			for (const auto &group : groups)
+			{
+				if (group.physicalDeviceCount < 2) continue;
+
+				VkPhysicalDeviceProperties properties;
+				vkGetPhysicalDeviceProperties(group.physicalDevices[0], &properties);
+				if (properties.apiVersion < VK_API_VERSION_1_1 || !isDeviceSuitable(group.physicalDevices[0])) continue;
+
+				m_physicalDevice = group.physicalDevices[0];
+				m_groupDevices.assign(group.physicalDevices, group.physicalDevices + group.physicalDeviceCount);
+				return true;
+			}
+			return false;
+		}
+
 		bool isDeviceSuitable(VkPhysicalDevice physicalDevice)
 		{
 			m_queueFamilyIndices.clear();
 			m_queueFamilyIndices.setPhysicalDevice(physicalDevice);
-			m_queueFamilyIndices.findQueueFamilies(VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+			m_queueFamilyIndices.findQueueFamilies(VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
 
 			bool extensionsSupported = checkDeviceExtensionSupport(physicalDevice, m_deviceExtensions);
 
-			bool swapChainAdequate = false;
-			if (extensionsSupported)
+			bool swapChainAdequate = extensionsSupported && static_cast<VkSurfaceKHR>(m_surface) == VK_NULL_HANDLE;
+			if (extensionsSupported && !swapChainAdequate)
 			{
 				SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice, m_surface);
 				swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
@@ -105,7 +260,8 @@ namespace rj
 			{
 				return m_queueFamilyIndices.graphicsFamily >= 0 &&
 					m_queueFamilyIndices.presentFamily >= 0 &&
-					m_queueFamilyIndices.computeFamily >= 0;
+					m_queueFamilyIndices.computeFamily >= 0 &&
+					m_queueFamilyIndices.transferFamily >= 0;
 			};
 
 			return isQueueFamilyIndicesComplete() && extensionsSupported && swapChainAdequate;
@@ -118,7 +274,8 @@ namespace rj
 			{
 				m_queueFamilyIndices.graphicsFamily,
 				m_queueFamilyIndices.computeFamily,
-				m_queueFamilyIndices.presentFamily
+				m_queueFamilyIndices.presentFamily,
+				m_queueFamilyIndices.transferFamily
 			};
 
 			float queuePriority = 1.0f;
@@ -136,10 +293,283 @@ namespace rj
 			createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 			createInfo.pQueueCreateInfos = queueCreateInfos.data();
 			createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+
+			// Texture compression families, multisampled storage images and fragment stores are optional, only keep the ones the device has
+			VkPhysicalDeviceFeatures supportedFeatures;
+			vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+			m_enabledDeviceFeatures.textureCompressionBC &= supportedFeatures.textureCompressionBC;
+			m_enabledDeviceFeatures.textureCompressionASTC_LDR &= supportedFeatures.textureCompressionASTC_LDR;
+			m_enabledDeviceFeatures.textureCompressionETC2 &= supportedFeatures.textureCompressionETC2;
+			m_enabledDeviceFeatures.shaderStorageImageMultisample &= supportedFeatures.shaderStorageImageMultisample;
+			m_enabledDeviceFeatures.fragmentStoresAndAtomics &= supportedFeatures.fragmentStoresAndAtomics;
+			// Sparse pages are bound on the graphics queue, which needs to support it
+			const bool graphicsQueueSparse = m_queueFamilyIndices.graphicsFamilySparseBinding;
+			m_enabledDeviceFeatures.sparseBinding &= supportedFeatures.sparseBinding & graphicsQueueSparse;
+			m_enabledDeviceFeatures.sparseResidencyImage2D &= supportedFeatures.sparseResidencyImage2D & graphicsQueueSparse;
 			createInfo.pEnabledFeatures = &m_enabledDeviceFeatures;
 
-			createInfo.enabledExtensionCount = static_cast<uint32_t>(m_deviceExtensions.size());
-			createInfo.ppEnabledExtensionNames = m_deviceExtensions.data();
+			// Descriptor indexing is optional, enable it whenever the device has it
+			std::vector<const char *> extensions = m_deviceExtensions;
+			const std::vector<const char *> descriptorIndexingExtensions = { VK_KHR_MAINTENANCE3_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME };
+			VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+			descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+			m_descriptorIndexingEnabled = checkDeviceExtensionSupport(m_physicalDevice, descriptorIndexingExtensions);
+			if (m_descriptorIndexingEnabled)
+			{
+				extensions.insert(extensions.end(), descriptorIndexingExtensions.begin(), descriptorIndexingExtensions.end());
+				descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+				descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+				descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+				createInfo.pNext = &descriptorIndexingFeatures;
+			}
+
+			// Timeline semaphores are optional too
+			const std::vector<const char *> timelineSemaphoreExtensions = { VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME };
+			VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {};
+			timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+			m_timelineSemaphoreEnabled = checkDeviceExtensionSupport(m_physicalDevice, timelineSemaphoreExtensions);
+			if (m_timelineSemaphoreEnabled)
+			{
+				extensions.insert(extensions.end(), timelineSemaphoreExtensions.begin(), timelineSemaphoreExtensions.end());
+				timelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+				timelineSemaphoreFeatures.pNext = const_cast<void *>(createInfo.pNext);
+				createInfo.pNext = &timelineSemaphoreFeatures;
+			}
+
+			// Calibrated timestamps only need the extension, and both time domains
+			const std::vector<const char *> calibratedTimestampsExtensions = { VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME };
+			m_calibratedTimestampsEnabled = checkDeviceExtensionSupport(m_physicalDevice, calibratedTimestampsExtensions) &&
+				hasCalibrateableTimeDomains();
+			if (m_calibratedTimestampsEnabled)
+			{
+				extensions.insert(extensions.end(), calibratedTimestampsExtensions.begin(), calibratedTimestampsExtensions.end());
+			}
+
+			// The memory budget is read through vkGetPhysicalDeviceMemoryProperties2KHR
+			const std::vector<const char *> memoryBudgetExtensions = { VK_EXT_MEMORY_BUDGET_EXTENSION_NAME };
+			if (m_physicalDeviceProperties2Enabled)
+			{
+				m_pfnGetMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(m_instance,
+					"vkGetPhysicalDeviceMemoryProperties2KHR");
+			}
+			m_memoryBudgetEnabled = m_pfnGetMemoryProperties2 && checkDeviceExtensionSupport(m_physicalDevice, memoryBudgetExtensions);
+			if (m_memoryBudgetEnabled)
+			{
+				extensions.insert(extensions.end(), memoryBudgetExtensions.begin(), memoryBudgetExtensions.end());
+			}
+
+			// Push descriptors for small sets that change with every draw
+			const std::vector<const char *> pushDescriptorExtensions = { VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME };
+			m_pushDescriptorEnabled = m_physicalDeviceProperties2Enabled && checkDeviceExtensionSupport(m_physicalDevice, pushDescriptorExtensions);
+			if (m_pushDescriptorEnabled)
+			{
+				extensions.insert(extensions.end(), pushDescriptorExtensions.begin(), pushDescriptorExtensions.end());
+			}
+
+			// Templates for the many sets written with the same bindings, e.g. one per mesh
+			const std::vector<const char *> descriptorUpdateTemplateExtensions = { VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME };
+			m_descriptorUpdateTemplateEnabled = checkDeviceExtensionSupport(m_physicalDevice, descriptorUpdateTemplateExtensions);
+			if (m_descriptorUpdateTemplateEnabled)
+			{
+				extensions.insert(extensions.end(), descriptorUpdateTemplateExtensions.begin(), descriptorUpdateTemplateExtensions.end());
+			}
+
+			// Present ids are only useful to wait for, so both or neither are enabled
+			const std::vector<const char *> presentWaitExtensions = { VK_KHR_PRESENT_ID_EXTENSION_NAME, VK_KHR_PRESENT_WAIT_EXTENSION_NAME };
+			VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {};
+			presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+			VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {};
+			presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+			m_presentWaitEnabled = m_physicalDeviceProperties2Enabled && checkDeviceExtensionSupport(m_physicalDevice, presentWaitExtensions);
+			if (m_presentWaitEnabled)
+			{
+				extensions.insert(extensions.end(), presentWaitExtensions.begin(), presentWaitExtensions.end());
+				presentIdFeatures.presentId = VK_TRUE;
+				presentWaitFeatures.presentWait = VK_TRUE;
+				presentWaitFeatures.pNext = &presentIdFeatures;
+				presentIdFeatures.pNext = const_cast<void *>(createInfo.pNext);
+				createInfo.pNext = &presentWaitFeatures;
+			}
+
+			// Mesh shaders are compiled to SPIR-V 1.4
+			const std::vector<const char *> meshShaderExtensions = { VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME, VK_KHR_SPIRV_1_4_EXTENSION_NAME,
+				VK_EXT_MESH_SHADER_EXTENSION_NAME };
+			VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures = {};
+			meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+			m_meshShaderEnabled = m_physicalDeviceProperties2Enabled && checkDeviceExtensionSupport(m_physicalDevice, meshShaderExtensions);
+			if (m_meshShaderEnabled)
+			{
+				extensions.insert(extensions.end(), meshShaderExtensions.begin(), meshShaderExtensions.end());
+				meshShaderFeatures.taskShader = VK_TRUE;
+				meshShaderFeatures.meshShader = VK_TRUE;
+				meshShaderFeatures.pNext = const_cast<void *>(createInfo.pNext);
+				createInfo.pNext = &meshShaderFeatures;
+			}
+
+			// The extension alone does not promise the feature, it has to be queried
+			const std::vector<const char *> shaderFloat16Extensions = { VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME };
+			VkPhysicalDeviceShaderFloat16Int8FeaturesKHR shaderFloat16Features = {};
+			shaderFloat16Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES_KHR;
+			auto pfnGetFeatures2 = m_physicalDeviceProperties2Enabled ?
+				(PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceFeatures2KHR") : nullptr;
+			if (pfnGetFeatures2 && checkDeviceExtensionSupport(m_physicalDevice, shaderFloat16Extensions))
+			{
+				VkPhysicalDeviceFeatures2KHR features2 = {};
+				features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+				features2.pNext = &shaderFloat16Features;
+				pfnGetFeatures2(m_physicalDevice, &features2);
+				m_shaderFloat16Enabled = shaderFloat16Features.shaderFloat16 == VK_TRUE;
+			}
+			if (m_shaderFloat16Enabled)
+			{
+				extensions.insert(extensions.end(), shaderFloat16Extensions.begin(), shaderFloat16Extensions.end());
+				shaderFloat16Features.shaderInt8 = VK_FALSE;
+				shaderFloat16Features.pNext = const_cast<void *>(createInfo.pNext);
+				createInfo.pNext = &shaderFloat16Features;
+			}
+
+			// Only the shading rate attachment is used. Pipeline rates have to be enabled along with it
+			const std::vector<const char *> fragmentShadingRateExtensions = { VK_KHR_MULTIVIEW_EXTENSION_NAME, VK_KHR_MAINTENANCE2_EXTENSION_NAME,
+				VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME, VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME };
+			VkPhysicalDeviceFragmentShadingRateFeaturesKHR fragmentShadingRateFeatures = {};
+			fragmentShadingRateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_FEATURES_KHR;
+			auto pfnGetProperties2 = m_physicalDeviceProperties2Enabled ?
+				(PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceProperties2KHR") : nullptr;
+			if (pfnGetFeatures2 && pfnGetProperties2 && checkDeviceExtensionSupport(m_physicalDevice, fragmentShadingRateExtensions))
+			{
+				VkPhysicalDeviceFeatures2KHR features2 = {};
+				features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+				features2.pNext = &fragmentShadingRateFeatures;
+				pfnGetFeatures2(m_physicalDevice, &features2);
+				m_fragmentShadingRateEnabled = fragmentShadingRateFeatures.attachmentFragmentShadingRate == VK_TRUE;
+
+				m_fragmentShadingRateProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_PROPERTIES_KHR;
+				VkPhysicalDeviceProperties2KHR properties2 = {};
+				properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+				properties2.pNext = &m_fragmentShadingRateProperties;
+				pfnGetProperties2(m_physicalDevice, &properties2);
+				m_fragmentShadingRateProperties.pNext = nullptr;
+			}
+			if (m_fragmentShadingRateEnabled)
+			{
+				extensions.insert(extensions.end(), fragmentShadingRateExtensions.begin(), fragmentShadingRateExtensions.end());
+				fragmentShadingRateFeatures.pipelineFragmentShadingRate = VK_TRUE;
+				fragmentShadingRateFeatures.primitiveFragmentShadingRate = VK_FALSE;
+				fragmentShadingRateFeatures.pNext = const_cast<void *>(createInfo.pNext);
+				createInfo.pNext = &fragmentShadingRateFeatures;
+			}
+
+			// No features, only the resolve modes. The render pass 2 extensions may already be enabled for shading rate images
+			const std::vector<const char *> depthStencilResolveExtensions = { VK_KHR_MULTIVIEW_EXTENSION_NAME, VK_KHR_MAINTENANCE2_EXTENSION_NAME,
+				VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME, VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME };
+			if (pfnGetProperties2 && checkDeviceExtensionSupport(m_physicalDevice, depthStencilResolveExtensions))
+			{
+				m_depthStencilResolveProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DEPTH_STENCIL_RESOLVE_PROPERTIES_KHR;
+				VkPhysicalDeviceProperties2KHR properties2 = {};
+				properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+				properties2.pNext = &m_depthStencilResolveProperties;
+				pfnGetProperties2(m_physicalDevice, &properties2);
+				m_depthStencilResolveProperties.pNext = nullptr;
+				m_depthStencilResolveEnabled = m_depthStencilResolveProperties.supportedDepthResolveModes != 0;
+			}
+			if (m_depthStencilResolveEnabled)
+			{
+				for (const char *extension : depthStencilResolveExtensions)
+				{
+					auto sameName = [extension](const char *name) { return std::string(name) == extension; };
+					if (std::find_if(extensions.begin(), extensions.end(), sameName) == extensions.end()) extensions.push_back(extension);
+				}
+			}
+
+			// Acceleration structures are built from device addresses and bound through descriptor indexing. SPIR-V 1.4 may
+			// already be enabled for mesh shaders, so only the missing extensions are added
+			const std::vector<const char *> rayQueryExtensions = { VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME, VK_KHR_SPIRV_1_4_EXTENSION_NAME,
+				VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME, VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+				VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME, VK_KHR_RAY_QUERY_EXTENSION_NAME };
+			VkPhysicalDeviceBufferDeviceAddressFeaturesKHR bufferDeviceAddressFeatures = {};
+			bufferDeviceAddressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR;
+			VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures = {};
+			accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+			VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures = {};
+			rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+			VkPhysicalDeviceProperties deviceProperties;
+			vkGetPhysicalDeviceProperties(m_physicalDevice, &deviceProperties);
+			// Device addresses across a device group would need bufferDeviceAddressMultiDevice, groups go without ray queries
+			if (pfnGetFeatures2 && pfnGetProperties2 && m_instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1 &&
+				m_groupDevices.size() <= 1 && m_descriptorIndexingEnabled && checkDeviceExtensionSupport(m_physicalDevice, rayQueryExtensions))
+			{
+				VkPhysicalDeviceFeatures2KHR features2 = {};
+				features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+				features2.pNext = &bufferDeviceAddressFeatures;
+				bufferDeviceAddressFeatures.pNext = &accelerationStructureFeatures;
+				accelerationStructureFeatures.pNext = &rayQueryFeatures;
+				pfnGetFeatures2(m_physicalDevice, &features2);
+				m_rayQueryEnabled = bufferDeviceAddressFeatures.bufferDeviceAddress == VK_TRUE &&
+					accelerationStructureFeatures.accelerationStructure == VK_TRUE && rayQueryFeatures.rayQuery == VK_TRUE;
+
+				m_accelerationStructureProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+				VkPhysicalDeviceProperties2KHR properties2 = {};
+				properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+				properties2.pNext = &m_accelerationStructureProperties;
+				pfnGetProperties2(m_physicalDevice, &properties2);
+				m_accelerationStructureProperties.pNext = nullptr;
+			}
+			if (m_rayQueryEnabled)
+			{
+				for (const char *extension : rayQueryExtensions)
+				{
+					auto sameName = [extension](const char *name) { return std::string(name) == extension; };
+					if (std::find_if(extensions.begin(), extensions.end(), sameName) == extensions.end()) extensions.push_back(extension);
+				}
+				bufferDeviceAddressFeatures = {};
+				bufferDeviceAddressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR;
+				bufferDeviceAddressFeatures.bufferDeviceAddress = VK_TRUE;
+				accelerationStructureFeatures = {};
+				accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+				accelerationStructureFeatures.accelerationStructure = VK_TRUE;
+				rayQueryFeatures.pNext = nullptr;
+				bufferDeviceAddressFeatures.pNext = &accelerationStructureFeatures;
+				accelerationStructureFeatures.pNext = &rayQueryFeatures;
+				rayQueryFeatures.pNext = const_cast<void *>(createInfo.pNext);
+				createInfo.pNext = &bufferDeviceAddressFeatures;
+			}
+
+			// Core in Vulkan 1.1, nothing to enable
+			if (pfnGetProperties2 && m_instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1)
+			{
+				m_subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+				VkPhysicalDeviceProperties2KHR properties2 = {};
+				properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+				properties2.pNext = &m_subgroupProperties;
+				pfnGetProperties2(m_physicalDevice, &properties2);
+				m_subgroupProperties.pNext = nullptr;
+			}
+
+#ifndef _WIN32
+			// Exported images get a memory object of their own, which is what importers such as CUDA expect
+			const std::vector<const char *> externalMemoryExtensions = { VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME, VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+				VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME, VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
+				VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME, VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME };
+			m_externalMemoryEnabled = m_externalMemoryCapabilitiesEnabled && checkDeviceExtensionSupport(m_physicalDevice, externalMemoryExtensions);
+			if (m_externalMemoryEnabled)
+			{
+				extensions.insert(extensions.end(), externalMemoryExtensions.begin(), externalMemoryExtensions.end());
+			}
+#endif
+
+			// Every device of the group gets the same queues, extensions and features
+			VkDeviceGroupDeviceCreateInfo deviceGroupInfo = {};
+			deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_DEVICE_CREATE_INFO;
+			if (m_groupDevices.size() > 1)
+			{
+				deviceGroupInfo.physicalDeviceCount = static_cast<uint32_t>(m_groupDevices.size());
+				deviceGroupInfo.pPhysicalDevices = m_groupDevices.data();
+				deviceGroupInfo.pNext = createInfo.pNext;
+				createInfo.pNext = &deviceGroupInfo;
+			}
+
+			createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+			createInfo.ppEnabledExtensionNames = extensions.data();
 
 			if (m_enableValidationLayers)
 			{
@@ -151,7 +581,7 @@ namespace rj
 				createInfo.enabledLayerCount = 0;
 			}
 
-			if (vkCreateDevice(m_physicalDevice, &createInfo, nullptr, m_device.replace()) != VK_SUCCESS)
+			if (vkCreateDevice(m_physicalDevice, &createInfo, helper_functions::getHostAllocationCallbacks(), m_device.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create logical device!");
 			}
@@ -159,6 +589,132 @@ namespace rj
 			vkGetDeviceQueue(m_device, m_queueFamilyIndices.graphicsFamily, 0, &m_graphicsQueue);
 			vkGetDeviceQueue(m_device, m_queueFamilyIndices.presentFamily, 0, &m_presentQueue);
 			vkGetDeviceQueue(m_device, m_queueFamilyIndices.computeFamily, 0, &m_computeQueue);
+			vkGetDeviceQueue(m_device, m_queueFamilyIndices.transferFamily, 0, &m_transferQueue);
+
+			if (m_timelineSemaphoreEnabled)
+			{
+				pfnWaitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(m_device, "vkWaitSemaphoresKHR");
+				pfnSignalSemaphore = (PFN_vkSignalSemaphoreKHR)vkGetDeviceProcAddr(m_device, "vkSignalSemaphoreKHR");
+				pfnGetSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(m_device, "vkGetSemaphoreCounterValueKHR");
+			}
+
+			if (m_calibratedTimestampsEnabled)
+			{
+				m_pfnGetCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(m_device, "vkGetCalibratedTimestampsEXT");
+			}
+
+			if (m_pushDescriptorEnabled)
+			{
+				pfnCmdPushDescriptorSet = (PFN_vkCmdPushDescriptorSetKHR)vkGetDeviceProcAddr(m_device, "vkCmdPushDescriptorSetKHR");
+			}
+
+			if (m_descriptorUpdateTemplateEnabled)
+			{
+				pfnCreateDescriptorUpdateTemplate = (PFN_vkCreateDescriptorUpdateTemplateKHR)vkGetDeviceProcAddr(m_device, "vkCreateDescriptorUpdateTemplateKHR");
+				pfnDestroyDescriptorUpdateTemplate = (PFN_vkDestroyDescriptorUpdateTemplateKHR)vkGetDeviceProcAddr(m_device, "vkDestroyDescriptorUpdateTemplateKHR");
+				pfnUpdateDescriptorSetWithTemplate = (PFN_vkUpdateDescriptorSetWithTemplateKHR)vkGetDeviceProcAddr(m_device, "vkUpdateDescriptorSetWithTemplateKHR");
+			}
+
+			if (m_presentWaitEnabled)
+			{
+				pfnWaitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(m_device, "vkWaitForPresentKHR");
+			}
+
+			if (m_meshShaderEnabled)
+			{
+				pfnCmdDrawMeshTasksIndirect = (PFN_vkCmdDrawMeshTasksIndirectEXT)vkGetDeviceProcAddr(m_device, "vkCmdDrawMeshTasksIndirectEXT");
+			}
+
+			if (m_fragmentShadingRateEnabled || m_depthStencilResolveEnabled)
+			{
+				pfnCreateRenderPass2 = (PFN_vkCreateRenderPass2KHR)vkGetDeviceProcAddr(m_device, "vkCreateRenderPass2KHR");
+			}
+
+			if (m_rayQueryEnabled)
+			{
+				pfnGetBufferDeviceAddress = (PFN_vkGetBufferDeviceAddressKHR)vkGetDeviceProcAddr(m_device, "vkGetBufferDeviceAddressKHR");
+				pfnCreateAccelerationStructure = (PFN_vkCreateAccelerationStructureKHR)vkGetDeviceProcAddr(m_device, "vkCreateAccelerationStructureKHR");
+				pfnDestroyAccelerationStructure = (PFN_vkDestroyAccelerationStructureKHR)vkGetDeviceProcAddr(m_device, "vkDestroyAccelerationStructureKHR");
+				pfnGetAccelerationStructureBuildSizes = (PFN_vkGetAccelerationStructureBuildSizesKHR)vkGetDeviceProcAddr(m_device,
+					"vkGetAccelerationStructureBuildSizesKHR");
+				pfnGetAccelerationStructureDeviceAddress = (PFN_vkGetAccelerationStructureDeviceAddressKHR)vkGetDeviceProcAddr(m_device,
+					"vkGetAccelerationStructureDeviceAddressKHR");
+				pfnCmdBuildAccelerationStructures = (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetDeviceProcAddr(m_device, "vkCmdBuildAccelerationStructuresKHR");
+				pfnCmdWriteAccelerationStructuresProperties = (PFN_vkCmdWriteAccelerationStructuresPropertiesKHR)vkGetDeviceProcAddr(m_device,
+					"vkCmdWriteAccelerationStructuresPropertiesKHR");
+				pfnCmdCopyAccelerationStructure = (PFN_vkCmdCopyAccelerationStructureKHR)vkGetDeviceProcAddr(m_device, "vkCmdCopyAccelerationStructureKHR");
+			}
+
+			if (m_debugUtilsEnabled)
+			{
+				pfnSetDebugUtilsObjectName = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(m_instance, "vkSetDebugUtilsObjectNameEXT");
+				pfnCmdBeginDebugUtilsLabel = (PFN_vkCmdBeginDebugUtilsLabelEXT)vkGetInstanceProcAddr(m_instance, "vkCmdBeginDebugUtilsLabelEXT");
+				pfnCmdEndDebugUtilsLabel = (PFN_vkCmdEndDebugUtilsLabelEXT)vkGetInstanceProcAddr(m_instance, "vkCmdEndDebugUtilsLabelEXT");
+				pfnCmdInsertDebugUtilsLabel = (PFN_vkCmdInsertDebugUtilsLabelEXT)vkGetInstanceProcAddr(m_instance, "vkCmdInsertDebugUtilsLabelEXT");
+				m_debugUtilsEnabled = pfnSetDebugUtilsObjectName && pfnCmdBeginDebugUtilsLabel && pfnCmdEndDebugUtilsLabel && pfnCmdInsertDebugUtilsLabel;
+			}
+
+#ifndef _WIN32
+			if (m_externalMemoryEnabled)
+			{
+				pfnGetMemoryFd = (PFN_vkGetMemoryFdKHR)vkGetDeviceProcAddr(m_device, "vkGetMemoryFdKHR");
+				pfnGetSemaphoreFd = (PFN_vkGetSemaphoreFdKHR)vkGetDeviceProcAddr(m_device, "vkGetSemaphoreFdKHR");
+			}
+#endif
+
+			if (m_groupDevices.size() > 1)
+			{
+				pfnAcquireNextImage2 = (PFN_vkAcquireNextImage2KHR)vkGetDeviceProcAddr(m_device, "vkAcquireNextImage2KHR");
+				if (static_cast<VkSurfaceKHR>(m_surface) != VK_NULL_HANDLE) pickDeviceGroupPresentMode();
+			}
+		}
+
+		// Local presentation if every device can present its own images, otherwise remote presentation if the devices that can
+		// present cover all the others
+		void pickDeviceGroupPresentMode()
+		{
+			auto pfnGetCapabilities = (PFN_vkGetDeviceGroupPresentCapabilitiesKHR)vkGetDeviceProcAddr(m_device, "vkGetDeviceGroupPresentCapabilitiesKHR");
+			auto pfnGetSurfaceModes = (PFN_vkGetDeviceGroupSurfacePresentModesKHR)vkGetDeviceProcAddr(m_device, "vkGetDeviceGroupSurfacePresentModesKHR");
+			if (!pfnAcquireNextImage2 || !pfnGetCapabilities || !pfnGetSurfaceModes) return;
+
+			VkDeviceGroupPresentCapabilitiesKHR capabilities = {};
+			capabilities.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_PRESENT_CAPABILITIES_KHR;
+			VkDeviceGroupPresentModeFlagsKHR surfaceModes = 0;
+			if (pfnGetCapabilities(m_device, &capabilities) != VK_SUCCESS || pfnGetSurfaceModes(m_device, m_surface, &surfaceModes) != VK_SUCCESS) return;
+
+			const uint32_t allDevices = (1u << getDeviceCount()) - 1;
+			uint32_t localMask = 0, remoteMask = 0;
+			for (uint32_t i = 0; i < getDeviceCount(); ++i)
+			{
+				if (capabilities.presentMask[i] & (1u << i)) localMask |= 1u << i;
+				remoteMask |= capabilities.presentMask[i];
+			}
+
+			const VkDeviceGroupPresentModeFlagsKHR modes = capabilities.modes & surfaceModes;
+			if ((modes & VK_DEVICE_GROUP_PRESENT_MODE_LOCAL_BIT_KHR) && localMask == allDevices)
+			{
+				m_deviceGroupPresentMode = VK_DEVICE_GROUP_PRESENT_MODE_LOCAL_BIT_KHR;
+			}
+			else if ((modes & VK_DEVICE_GROUP_PRESENT_MODE_REMOTE_BIT_KHR) && (remoteMask & allDevices) == allDevices)
+			{
+				m_deviceGroupPresentMode = VK_DEVICE_GROUP_PRESENT_MODE_REMOTE_BIT_KHR;
+			}
+		}
+
+		bool hasCalibrateableTimeDomains() const
+		{
+			auto pfnGetTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(m_instance,
+				"vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+			if (!pfnGetTimeDomains) return false;
+
+			uint32_t count = 0;
+			pfnGetTimeDomains(m_physicalDevice, &count, nullptr);
+			std::vector<VkTimeDomainEXT> domains(count);
+			pfnGetTimeDomains(m_physicalDevice, &count, domains.data());
+
+			const VkTimeDomainEXT hostDomain = HOST_TIME_DOMAIN;
+			return std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != domains.end() &&
+				std::find(domains.begin(), domains.end(), hostDomain) != domains.end();
 		}
 
 
@@ -168,6 +724,39 @@ namespace rj
 		const VDeleter<VkSurfaceKHR> &m_surface;
 		std::vector<const char *> m_deviceExtensions;
 		VkPhysicalDeviceFeatures m_enabledDeviceFeatures;
+		bool m_descriptorIndexingEnabled = false;
+		bool m_timelineSemaphoreEnabled = false;
+		bool m_calibratedTimestampsEnabled = false;
+		PFN_vkGetCalibratedTimestampsEXT m_pfnGetCalibratedTimestamps = nullptr;
+		bool m_physicalDeviceProperties2Enabled;
+		bool m_memoryBudgetEnabled = false;
+		bool m_pushDescriptorEnabled = false;
+		bool m_descriptorUpdateTemplateEnabled = false;
+		bool m_presentWaitEnabled = false;
+		bool m_meshShaderEnabled = false;
+		bool m_shaderFloat16Enabled = false;
+		bool m_fragmentShadingRateEnabled = false;
+		VkPhysicalDeviceFragmentShadingRatePropertiesKHR m_fragmentShadingRateProperties = {};
+		bool m_depthStencilResolveEnabled = false;
+		VkPhysicalDeviceDepthStencilResolvePropertiesKHR m_depthStencilResolveProperties = {};
+		VkPhysicalDeviceSubgroupProperties m_subgroupProperties = {};
+		bool m_rayQueryEnabled = false;
+		VkPhysicalDeviceAccelerationStructurePropertiesKHR m_accelerationStructureProperties = {};
+		bool m_externalMemoryCapabilitiesEnabled;
+		bool m_externalMemoryEnabled = false;
+		bool m_debugUtilsEnabled;
+		uint32_t m_instanceApiVersion;
+		bool m_deviceGroupRequested;
+		std::vector<VkPhysicalDevice> m_groupDevices; // empty without a device group, m_physicalDevice is the first
+		VkDeviceGroupPresentModeFlagsKHR m_deviceGroupPresentMode = 0;
+		PFN_vkGetPhysicalDeviceMemoryProperties2KHR m_pfnGetMemoryProperties2 = nullptr;
+
+		// The clock std::chrono::steady_clock reads
+#ifdef _WIN32
+		static const VkTimeDomainEXT HOST_TIME_DOMAIN = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+		static const VkTimeDomainEXT HOST_TIME_DOMAIN = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif
 
 		VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE; // implicitly destroyed when the instance is destroyed
 		VDeleter<VkDevice> m_device{ vkDestroyDevice }; // support only one logical device right now
@@ -177,5 +766,6 @@ namespace rj
 		VkQueue m_graphicsQueue = VK_NULL_HANDLE;
 		VkQueue m_presentQueue = VK_NULL_HANDLE;
 		VkQueue m_computeQueue = VK_NULL_HANDLE;
+		VkQueue m_transferQueue = VK_NULL_HANDLE;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <deque>
+#include <limits>
+#include <algorithm>
+#include "VDevice.h"
+
+
+namespace rj
+{
+	// Device local images whose memory, together with a timeline semaphore, is exported as file descriptors, so another API
+	// such as a hardware video encoder reads the frames without a copy through the host. Each frame copies the final image
+	// into a free image on the GPU and the semaphore reaches the frame's value once the copy is done. The consumer imports
+	// every image and the semaphore once per generation, waits for the value on its side and releases the image when done.
+	// When every image is held by the consumer the frame is dropped instead
+	class VExternalImageSink
+	{
+	public:
+		VExternalImageSink(const VDevice &device)
+			:
+			m_device(device)
+		{}
+
+		~VExternalImageSink()
+		{
+			destroy();
+		}
+
+		// Needs isExternalMemoryEnabled() and isTimelineSemaphoreEnabled(). The device must be idle and the consumer must have
+		// dropped its imports of the previous generation
+		void init(uint32_t imageCount, VkExtent2D extent, VkFormat format)
+		{
+#ifndef _WIN32
+			if (!m_device.isExternalMemoryEnabled() || !m_device.isTimelineSemaphoreEnabled())
+			{
+				throw std::runtime_error("exporting images needs external memory and timeline semaphores");
+			}
+
+			destroy();
+			m_extent = extent;
+			m_format = format;
+			m_images.resize(imageCount);
+			for (uint32_t i = 0; i < imageCount; ++i)
+			{
+				createImage(m_images[i]);
+				m_freeImages.push_back(i);
+			}
+			createSemaphore();
+			++m_generation;
+#else
+			throw std::runtime_error("exporting images is not supported on Windows");
+#endif
+		}
+
+		// Record the copy of @srcImage, which is in @srcLayout before and after the commands, into a free image. @cb must be
+		// submitted as part of frame @frameSerial and followed by submitSignal(). Return the index of the image or
+		// std::numeric_limits<uint32_t>::max() if the consumer holds every image, the frame is dropped then
+		uint32_t cmdCopyImage(VkCommandBuffer cb, VkImage srcImage, VkImageLayout srcLayout, uint64_t frameSerial)
+		{
+			assert(m_semaphore != VK_NULL_HANDLE);
+			if (m_freeImages.empty())
+			{
+				++m_droppedCount;
+				return std::numeric_limits<uint32_t>::max();
+			}
+			const uint32_t imageIdx = m_freeImages.front();
+			m_freeImages.pop_front();
+
+			VkImageMemoryBarrier barriers[2] = {};
+			for (auto &barrier : barriers)
+			{
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			}
+			barriers[0].oldLayout = srcLayout;
+			barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barriers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+			barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barriers[0].image = srcImage;
+			// The consumer released the image, its old contents are not needed
+			barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barriers[1].image = m_images[imageIdx].image;
+			vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+				0, nullptr, 0, nullptr, 2, barriers);
+
+			VkImageCopy region = {};
+			region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			region.dstSubresource = region.srcSubresource;
+			region.extent = { m_extent.width, m_extent.height, 1 };
+			vkCmdCopyImage(cb, srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_images[imageIdx].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1, &region);
+
+			std::swap(barriers[0].oldLayout, barriers[0].newLayout);
+			barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barriers[0].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			// Released to the consumer's API, which acquires it after waiting for the semaphore
+			barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barriers[1].dstAccessMask = 0;
+			barriers[1].srcQueueFamilyIndex = m_device.getQueueFamilyIndices().graphicsFamily;
+			barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_EXTERNAL_KHR;
+			vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+				0, nullptr, 0, nullptr, 2, barriers);
+
+			// Serials start at 0 and the semaphore does too
+			m_pendingSignalValue = frameSerial + 1;
+			return imageIdx;
+		}
+
+		// Value the semaphore reaches once the last copy recorded by cmdCopyImage() is done
+		uint64_t getPendingSignalValue() const { return m_pendingSignalValue; }
+
+		// Signal the semaphore on @queue after everything submitted to it before, i.e. the frame with the last copy
+		void submitSignal(VkQueue queue)
+		{
+			if (m_pendingSignalValue <= m_signaledValue) return;
+
+			VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+			timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+			timelineInfo.signalSemaphoreValueCount = 1;
+			timelineInfo.pSignalSemaphoreValues = &m_pendingSignalValue;
+
+			VkSubmitInfo submitInfo = {};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.pNext = &timelineInfo;
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &m_semaphore;
+			if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to signal the external image semaphore");
+			}
+			m_signaledValue = m_pendingSignalValue;
+		}
+
+		// The consumer is done with image @imageIdx, it may be written again
+		void release(uint32_t imageIdx)
+		{
+			assert(imageIdx < m_images.size());
+			assert(std::find(m_freeImages.begin(), m_freeImages.end(), imageIdx) == m_freeImages.end());
+			m_freeImages.push_back(imageIdx);
+		}
+
+#ifndef _WIN32
+		// A new file descriptor of image @imageIdx's memory, owned by the caller. The image is created with optimal tiling,
+		// @pMemorySize receives the size of its dedicated allocation
+		int exportImageMemory(uint32_t imageIdx, VkDeviceSize *pMemorySize = nullptr) const
+		{
+			VkMemoryGetFdInfoKHR info = {};
+			info.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
+			info.memory = m_images.at(imageIdx).memory;
+			info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+
+			int fd = -1;
+			if (m_device.pfnGetMemoryFd(m_device, &info, &fd) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to export image memory");
+			}
+			if (pMemorySize) *pMemorySize = m_images[imageIdx].memorySize;
+			return fd;
+		}
+
+		// A new file descriptor of the timeline semaphore, owned by the caller
+		int exportSemaphore() const
+		{
+			VkSemaphoreGetFdInfoKHR info = {};
+			info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+			info.semaphore = m_semaphore;
+			info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+
+			int fd = -1;
+			if (m_device.pfnGetSemaphoreFd(m_device, &info, &fd) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to export semaphore");
+			}
+			return fd;
+		}
+#endif
+
+		bool isInitialized() const { return m_semaphore != VK_NULL_HANDLE; }
+		uint32_t getGeneration() const { return m_generation; } // increased by every init()
+		uint32_t getImageCount() const { return static_cast<uint32_t>(m_images.size()); }
+		uint32_t getFreeImageCount() const { return static_cast<uint32_t>(m_freeImages.size()); }
+		VkExtent2D getExtent() const { return m_extent; }
+		VkFormat getFormat() const { return m_format; }
+		uint64_t getDroppedCount() const { return m_droppedCount; }
+
+	protected:
+		struct ExternalImage
+		{
+			VkImage image = VK_NULL_HANDLE;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkDeviceSize memorySize = 0;
+		};
+
+		void destroy()
+		{
+			for (auto &image : m_images)
+			{
+				vkDestroyImage(m_device, image.image, helper_functions::getHostAllocationCallbacks());
+				vkFreeMemory(m_device, image.memory, helper_functions::getHostAllocationCallbacks());
+			}
+			m_images.clear();
+			m_freeImages.clear();
+			if (m_semaphore != VK_NULL_HANDLE) vkDestroySemaphore(m_device, m_semaphore, helper_functions::getHostAllocationCallbacks());
+			m_semaphore = VK_NULL_HANDLE;
+			m_pendingSignalValue = 0;
+			m_signaledValue = 0;
+		}
+
+#ifndef _WIN32
+		void createImage(ExternalImage &image)
+		{
+			VkExternalMemoryImageCreateInfoKHR externalInfo = {};
+			externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO_KHR;
+			externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.pNext = &externalInfo;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = m_format;
+			imageInfo.extent = { m_extent.width, m_extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			if (vkCreateImage(m_device, &imageInfo, helper_functions::getHostAllocationCallbacks(), &image.image) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create external image");
+			}
+
+			VkMemoryRequirements memRequirements;
+			vkGetImageMemoryRequirements(m_device, image.image, &memRequirements);
+
+			VkMemoryDedicatedAllocateInfoKHR dedicatedInfo = {};
+			dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
+			dedicatedInfo.image = image.image;
+
+			VkExportMemoryAllocateInfoKHR exportInfo = {};
+			exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO_KHR;
+			exportInfo.pNext = &dedicatedInfo;
+			exportInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+
+			VkMemoryAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			allocInfo.pNext = &exportInfo;
+			allocInfo.allocationSize = memRequirements.size;
+			allocInfo.memoryTypeIndex = findMemoryType(m_device, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			if (vkAllocateMemory(m_device, &allocInfo, helper_functions::getHostAllocationCallbacks(), &image.memory) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate external image memory");
+			}
+			image.memorySize = memRequirements.size;
+			vkBindImageMemory(m_device, image.image, image.memory, 0);
+		}
+
+		void createSemaphore()
+		{
+			VkExportSemaphoreCreateInfoKHR exportInfo = {};
+			exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO_KHR;
+			exportInfo.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+
+			VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+			typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+			typeInfo.pNext = &exportInfo;
+			typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+
+			VkSemaphoreCreateInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			info.pNext = &typeInfo;
+			if (vkCreateSemaphore(m_device, &info, helper_functions::getHostAllocationCallbacks(), &m_semaphore) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create external semaphore");
+			}
+		}
+#endif
+
+		const VDevice &m_device;
+
+		std::vector<ExternalImage> m_images;
+		std::deque<uint32_t> m_freeImages; // oldest release first, so the consumer has the most time before an image is reused
+		VkSemaphore m_semaphore = VK_NULL_HANDLE;
+		uint64_t m_pendingSignalValue = 0;
+		uint64_t m_signaledValue = 0;
+		VkExtent2D m_extent = {};
+		VkFormat m_format = VK_FORMAT_UNDEFINED;
+		uint32_t m_generation = 0;
+		uint64_t m_droppedCount = 0;
+	};
+}
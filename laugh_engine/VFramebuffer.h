@@ -29,7 +29,7 @@ namespace rj
 			info.layers = layers;
 			info.flags = flags;
 
-			if (vkCreateFramebuffer(*m_pDevice, &info, nullptr, m_framebuffer.replace()) != VK_SUCCESS)
+			if (vkCreateFramebuffer(*m_pDevice, &info, helper_functions::getHostAllocationCallbacks(), m_framebuffer.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create framebuffer!");
 			}
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "VManager.h"
+
+
+namespace rj
+{
+	// Named GPU timing scopes backed by one timestamp query pool per frame in flight.
+	// Scopes nest per command buffer and are named by their path, e.g. "shadow/cascade1". Every path owns a fixed
+	// pair of queries, so command buffers that are recorded once keep writing the same queries every frame.
+	// Results are read without waiting, scopes that were not written in a frame are skipped.
+	// Scopes can also count pipeline statistics, which needs the pipelineStatisticsQuery device feature.
+	// The commands recorded in a scope are counted on the CPU when the scope ends, detached scopes count none.
+	// With debug utils every scope but the detached ones is also a label region of its name, so captures show the same tree.
+	class VGpuProfiler
+	{
+	public:
+		static const uint32_t DEFAULT_MAX_SCOPE_COUNT = 64;
+
+		// Results are written in bit order
+		static const VkQueryPipelineStatisticFlags PIPELINE_STATISTIC_FLAGS =
+			VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+		struct PipelineStatistics
+		{
+			uint64_t vertexInvocations = 0;
+			uint64_t clippingPrimitives = 0; // primitives that reached the rasterizer after clipping
+			uint64_t fragmentInvocations = 0;
+		};
+
+		struct Timings
+		{
+			float minMS = 0.f;
+			float avgMS = 0.f;
+			float maxMS = 0.f;
+		};
+
+		// Raw timestamps of a scope, in device ticks of getTimestampPeriod() nanoseconds
+		struct ScopeTimestamps
+		{
+			std::string path;
+			uint64_t begin;
+			uint64_t end;
+		};
+
+		struct ScopeTimings
+		{
+			std::string name; // last path component
+			uint32_t depth; // 0 for top level scopes
+			Timings timings;
+			bool hasStatistics;
+			PipelineStatistics statistics; // of the last collected frame
+			bool hasCommands;
+			CommandCounters commands; // of the last time the scope was recorded
+		};
+
+		VGpuProfiler(VManager *pManager, uint32_t historyLength = 30)
+			:
+			m_pManager(pManager),
+			m_historyLength(historyLength),
+			m_frameHistory(historyLength)
+		{}
+
+		// Can be called again, e.g. when the swapchain image count changes. Scopes and their timings are kept
+		void init(uint32_t frameCount, uint32_t maxScopeCount = DEFAULT_MAX_SCOPE_COUNT)
+		{
+			destroy();
+
+			VkPhysicalDeviceProperties props;
+			m_pManager->getPhysicalDeviceProperties(&props);
+			m_timestampPeriod = props.limits.timestampPeriod;
+
+			m_maxScopeCount = maxScopeCount;
+			m_queryPools.resize(frameCount);
+			m_statisticsQueryPools.resize(frameCount);
+			for (uint32_t i = 0; i < frameCount; ++i)
+			{
+				m_queryPools[i] = m_pManager->createQueryPool(VK_QUERY_TYPE_TIMESTAMP, 2 * maxScopeCount);
+				m_statisticsQueryPools[i] = m_pManager->createQueryPool(VK_QUERY_TYPE_PIPELINE_STATISTICS, maxScopeCount, PIPELINE_STATISTIC_FLAGS);
+			}
+			m_results.resize(4 * maxScopeCount);
+		}
+
+		void destroy()
+		{
+			for (auto pool : m_queryPools)
+			{
+				m_pManager->destroyQueryPool(pool);
+			}
+			for (auto pool : m_statisticsQueryPools)
+			{
+				m_pManager->destroyQueryPool(pool);
+			}
+			m_queryPools.clear();
+			m_statisticsQueryPools.clear();
+		}
+
+		// Record outside of a render pass, before any scope of @frameIdx is written
+		void cmdResetQueries(uint32_t cmdBufferName, uint32_t frameIdx) const
+		{
+			m_pManager->cmdResetQueryPool(cmdBufferName, m_queryPools[frameIdx]);
+			m_pManager->cmdResetQueryPool(cmdBufferName, m_statisticsQueryPools[frameIdx]);
+		}
+
+		// @name is appended to the path of the scope open on @cmdBufferName.
+		// Statistics queries cannot nest, and have to end inside the render pass instance, or outside of any, they began in.
+		// Secondary command buffers executed within the scope must have inherited PIPELINE_STATISTIC_FLAGS.
+		// The vertex and fragment counters also need a queue with graphics support
+		void beginScope(uint32_t cmdBufferName, uint32_t frameIdx, const std::string &name, bool pipelineStatistics = false)
+		{
+			std::string path;
+			uint32_t scopeIdx;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				auto &stack = m_openScopes[cmdBufferName];
+				assert(!pipelineStatistics || std::none_of(stack.begin(), stack.end(), [](const OpenScope &s) { return s.pipelineStatistics; }));
+				path = stack.empty() ? name : stack.back().path + "/" + name;
+				stack.push_back({ path, pipelineStatistics, m_pManager->getCommandCounters(cmdBufferName) });
+
+				scopeIdx = getScopeLocked(path);
+				m_scopes[scopeIdx].hasStatistics |= pipelineStatistics;
+			}
+
+			m_pManager->cmdBeginDebugLabel(cmdBufferName, name);
+			writeBeginTimestamp(cmdBufferName, frameIdx, scopeIdx);
+			if (pipelineStatistics)
+			{
+				m_pManager->cmdBeginQuery(cmdBufferName, m_statisticsQueryPools[frameIdx], scopeIdx);
+			}
+		}
+
+		void endScope(uint32_t cmdBufferName, uint32_t frameIdx)
+		{
+			OpenScope scope;
+			uint32_t scopeIdx;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				auto &stack = m_openScopes[cmdBufferName];
+				assert(!stack.empty());
+				scope = std::move(stack.back());
+				stack.pop_back();
+
+				scopeIdx = getScopeLocked(scope.path);
+				m_scopes[scopeIdx].hasCommands = true;
+				m_scopes[scopeIdx].commands = m_pManager->getCommandCounters(cmdBufferName) - scope.commandsAtBegin;
+			}
+
+			if (scope.pipelineStatistics)
+			{
+				m_pManager->cmdEndQuery(cmdBufferName, m_statisticsQueryPools[frameIdx], scopeIdx);
+			}
+			writeEndTimestamp(cmdBufferName, frameIdx, scopeIdx);
+			m_pManager->cmdEndDebugLabel(cmdBufferName);
+		}
+
+		// For scopes that begin and end in different command buffers, e.g. a pass split across secondary command buffers.
+		// @path is the full path and does not affect the scopes open on either command buffer. Timings only
+		void beginDetachedScope(uint32_t cmdBufferName, uint32_t frameIdx, const std::string &path)
+		{
+			writeBeginTimestamp(cmdBufferName, frameIdx, getScope(path));
+		}
+
+		void endDetachedScope(uint32_t cmdBufferName, uint32_t frameIdx, const std::string &path)
+		{
+			writeEndTimestamp(cmdBufferName, frameIdx, getScope(path));
+		}
+
+		// Read the timestamps of @frameIdx's last submission. Call once its fence has signaled, before it is submitted again
+		void collect(uint32_t frameIdx)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			m_lastFrameTimeMS = -1.f;
+			m_lastFrameTimestamps.clear();
+			const uint32_t queryCount = 2 * static_cast<uint32_t>(m_scopes.size());
+			if (queryCount == 0) return;
+
+			// Value and availability of every query. VK_NOT_READY only means some scopes were not written
+			VkResult result = m_pManager->getQueryPoolResults(m_queryPools[frameIdx], queryCount * 2 * sizeof(uint64_t), 2 * sizeof(uint64_t),
+				m_results.data(), 0, queryCount, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+			if (result != VK_SUCCESS && result != VK_NOT_READY) return;
+
+			const float ticksToMS = m_timestampPeriod * 1e-6f;
+			uint64_t frameBegin = std::numeric_limits<uint64_t>::max();
+			uint64_t frameEnd = 0;
+			for (uint32_t i = 0; i < m_scopes.size(); ++i)
+			{
+				auto &scope = m_scopes[i];
+				const uint64_t *pBegin = &m_results[4 * i];
+				const uint64_t *pEnd = pBegin + 2;
+				scope.written = pBegin[1] != 0 && pEnd[1] != 0;
+				if (!scope.written) continue;
+
+				scope.history.add(static_cast<float>(pEnd[0] - pBegin[0]) * ticksToMS);
+				m_lastFrameTimestamps.push_back({ scope.path, pBegin[0], pEnd[0] });
+				frameBegin = std::min(frameBegin, pBegin[0]);
+				frameEnd = std::max(frameEnd, pEnd[0]);
+			}
+
+			if (frameBegin < frameEnd)
+			{
+				m_lastFrameTimeMS = static_cast<float>(frameEnd - frameBegin) * ticksToMS;
+				m_frameHistory.add(m_lastFrameTimeMS);
+			}
+
+			// Three counters and availability per scope
+			const uint32_t scopeCount = static_cast<uint32_t>(m_scopes.size());
+			result = m_pManager->getQueryPoolResults(m_statisticsQueryPools[frameIdx], scopeCount * 4 * sizeof(uint64_t), 4 * sizeof(uint64_t),
+				m_results.data(), 0, scopeCount, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+			if (result != VK_SUCCESS && result != VK_NOT_READY) return;
+
+			for (uint32_t i = 0; i < scopeCount; ++i)
+			{
+				const uint64_t *pCounters = &m_results[4 * i];
+				if (!m_scopes[i].hasStatistics || pCounters[3] == 0) continue;
+
+				auto &statistics = m_scopes[i].statistics;
+				statistics.vertexInvocations = pCounters[0];
+				statistics.clippingPrimitives = pCounters[1];
+				statistics.fragmentInvocations = pCounters[2];
+			}
+		}
+
+		// From the first timestamp to the last one of a frame
+		Timings getFrameTimings() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_frameHistory.getTimings();
+		}
+
+		// Scopes written in the last collected frame
+		std::vector<ScopeTimestamps> getLastFrameTimestamps() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_lastFrameTimestamps;
+		}
+
+		float getTimestampPeriod() const { return m_timestampPeriod; }
+
+		// Negative if the last collected frame had no timestamps
+		float getLastFrameTimeMS() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_lastFrameTimeMS;
+		}
+
+		// Scopes written in the last collected frame, parents before their children, siblings in the order they were first recorded
+		std::vector<ScopeTimings> getScopeTimings() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			std::vector<ScopeTimings> timings;
+			std::vector<std::pair<uint32_t, uint32_t>> stack; // scope, depth
+			for (auto it = m_rootScopes.rbegin(); it != m_rootScopes.rend(); ++it) stack.push_back({ *it, 0 });
+
+			while (!stack.empty())
+			{
+				const auto entry = stack.back();
+				stack.pop_back();
+
+				const auto &scope = m_scopes[entry.first];
+				if (scope.written)
+				{
+					timings.push_back({ scope.name, entry.second, scope.history.getTimings(), scope.hasStatistics, scope.statistics, scope.hasCommands, scope.commands });
+				}
+				for (auto it = scope.children.rbegin(); it != scope.children.rend(); ++it) stack.push_back({ *it, entry.second + 1 });
+			}
+			return timings;
+		}
+
+	protected:
+		// Running min / avg / max over the last samples
+		class History
+		{
+		public:
+			History(uint32_t length) : m_samples(length, 0.f) {}
+
+			void add(float ms)
+			{
+				m_samples[m_next] = ms;
+				m_next = (m_next + 1) % m_samples.size();
+				m_count = std::min(m_count + 1, static_cast<uint32_t>(m_samples.size()));
+			}
+
+			Timings getTimings() const
+			{
+				Timings timings;
+				if (m_count == 0) return timings;
+
+				timings.minMS = std::numeric_limits<float>::max();
+				float total = 0.f;
+				for (uint32_t i = 0; i < m_count; ++i)
+				{
+					timings.minMS = std::min(timings.minMS, m_samples[i]);
+					timings.maxMS = std::max(timings.maxMS, m_samples[i]);
+					total += m_samples[i];
+				}
+				timings.avgMS = total / static_cast<float>(m_count);
+				return timings;
+			}
+
+		private:
+			std::vector<float> m_samples;
+			uint32_t m_next = 0;
+			uint32_t m_count = 0;
+		};
+
+		struct Scope
+		{
+			std::string path;
+			std::string name;
+			std::vector<uint32_t> children;
+			History history;
+			bool written; // in the last collected frame
+			bool hasStatistics;
+			PipelineStatistics statistics;
+			bool hasCommands;
+			CommandCounters commands;
+		};
+
+		struct OpenScope
+		{
+			std::string path;
+			bool pipelineStatistics;
+			CommandCounters commandsAtBegin;
+		};
+
+		VManager *m_pManager;
+		uint32_t m_historyLength;
+		uint32_t m_maxScopeCount = 0;
+
+		std::vector<uint32_t> m_queryPools; // one per frame
+		std::vector<uint32_t> m_statisticsQueryPools; // one per frame, query i belongs to scope i
+		std::vector<uint64_t> m_results;
+
+		// Secondary command buffers are recorded on several threads
+		mutable std::mutex m_mutex;
+		std::vector<Scope> m_scopes; // scope i owns queries 2 * i and 2 * i + 1
+		std::vector<uint32_t> m_rootScopes;
+		std::unordered_map<std::string, uint32_t> m_scopeIndices; // by path
+		std::unordered_map<uint32_t, std::vector<OpenScope>> m_openScopes; // by command buffer name
+		History m_frameHistory;
+		float m_lastFrameTimeMS = -1.f;
+		std::vector<ScopeTimestamps> m_lastFrameTimestamps;
+		float m_timestampPeriod = 1.f;
+
+		// Parents are registered first, so children are listed under them even if they are written in other command buffers
+		uint32_t getScope(const std::string &path)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return getScopeLocked(path);
+		}
+
+		uint32_t getScopeLocked(const std::string &path)
+		{
+			auto it = m_scopeIndices.find(path);
+			if (it != m_scopeIndices.end()) return it->second;
+
+			const size_t separator = path.rfind('/');
+			const uint32_t parent = separator == std::string::npos ? std::numeric_limits<uint32_t>::max() : getScopeLocked(path.substr(0, separator));
+
+			if (m_scopes.size() >= m_maxScopeCount)
+			{
+				throw std::runtime_error("VGpuProfiler: too many scopes, raise maxScopeCount");
+			}
+
+			const uint32_t scopeIdx = static_cast<uint32_t>(m_scopes.size());
+			m_scopes.push_back({ path, path.substr(separator + 1), {}, History(m_historyLength), false, false, {}, false, {} });
+			if (parent == std::numeric_limits<uint32_t>::max()) m_rootScopes.push_back(scopeIdx);
+			else m_scopes[parent].children.push_back(scopeIdx);
+			m_scopeIndices[path] = scopeIdx;
+			return scopeIdx;
+		}
+
+		// Start markers are written once the scope's first command starts, not after all earlier work has drained
+		void writeBeginTimestamp(uint32_t cmdBufferName, uint32_t frameIdx, uint32_t scopeIdx) const
+		{
+			m_pManager->cmdWriteTimestamp(cmdBufferName, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPools[frameIdx], 2 * scopeIdx);
+		}
+
+		void writeEndTimestamp(uint32_t cmdBufferName, uint32_t frameIdx, uint32_t scopeIdx) const
+		{
+			m_pManager->cmdWriteTimestamp(cmdBufferName, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPools[frameIdx], 2 * scopeIdx + 1);
+		}
+	};
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace rj
+{
+	namespace helper_functions
+	{
+		// Host allocator every Vulkan object is created and destroyed with, nullptr for the driver's own. A VDeleter has no
+		// room for a pointer of its own and destroying must use the callbacks of the create call, so there is one for the
+		// whole process. Set by VInstance before anything is created
+		inline const VkAllocationCallbacks *&hostAllocationCallbacks()
+		{
+			static const VkAllocationCallbacks *pCallbacks = nullptr;
+			return pCallbacks;
+		}
+
+		inline const VkAllocationCallbacks *getHostAllocationCallbacks() { return hostAllocationCallbacks(); }
+	}
+
+	const uint32_t HOST_ALLOCATION_SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+	inline const char *getHostAllocationScopeName(VkSystemAllocationScope scope)
+	{
+		static const char *names[HOST_ALLOCATION_SCOPE_COUNT] = { "Command", "Object", "Cache", "Device", "Instance" };
+		return scope < HOST_ALLOCATION_SCOPE_COUNT ? names[scope] : "Unknown";
+	}
+
+	// Allocation callbacks that count the driver's host memory by allocation scope, then pass the allocation on to
+	// @pParent (e.g. an arena of the application's) or to malloc. Counters can be read from any thread
+	class VTrackingHostAllocator
+	{
+	public:
+		struct ScopeStats
+		{
+			uint64_t bytes; // in use now
+			uint64_t peakBytes;
+			uint64_t allocationCount; // alive now
+			uint64_t internalBytes; // allocated by the driver itself and only reported to us
+		};
+
+		explicit VTrackingHostAllocator(const VkAllocationCallbacks *pParent = nullptr)
+			:
+			m_pParent(pParent)
+		{
+			m_callbacks.pUserData = this;
+			m_callbacks.pfnAllocation = allocate;
+			m_callbacks.pfnReallocation = reallocate;
+			m_callbacks.pfnFree = free;
+			m_callbacks.pfnInternalAllocation = internalAllocate;
+			m_callbacks.pfnInternalFree = internalFree;
+		}
+
+		VTrackingHostAllocator(const VTrackingHostAllocator &) = delete;
+		VTrackingHostAllocator &operator=(const VTrackingHostAllocator &) = delete;
+
+		~VTrackingHostAllocator()
+		{
+			if (helper_functions::hostAllocationCallbacks() == &m_callbacks) helper_functions::hostAllocationCallbacks() = nullptr;
+		}
+
+		const VkAllocationCallbacks *callbacks() const { return &m_callbacks; }
+
+		ScopeStats getScopeStats(VkSystemAllocationScope scope) const
+		{
+			assert(scope < HOST_ALLOCATION_SCOPE_COUNT);
+			const Counters &c = m_counters[scope];
+			return { c.bytes.load(std::memory_order_relaxed), c.peakBytes.load(std::memory_order_relaxed),
+				c.allocationCount.load(std::memory_order_relaxed), c.internalBytes.load(std::memory_order_relaxed) };
+		}
+
+		// Over all scopes, with the driver's internal allocations
+		uint64_t getTotalBytes() const
+		{
+			uint64_t total = 0;
+			for (const auto &c : m_counters)
+			{
+				total += c.bytes.load(std::memory_order_relaxed) + c.internalBytes.load(std::memory_order_relaxed);
+			}
+			return total;
+		}
+
+	protected:
+		// In front of every allocation we hand out
+		struct Header
+		{
+			void *pBlock; // what the parent or malloc returned
+			size_t size;
+			VkSystemAllocationScope scope;
+		};
+
+		struct Counters
+		{
+			std::atomic<uint64_t> bytes{ 0 };
+			std::atomic<uint64_t> peakBytes{ 0 };
+			std::atomic<uint64_t> allocationCount{ 0 };
+			std::atomic<uint64_t> internalBytes{ 0 };
+		};
+
+		static Header *headerOf(void *pMemory) { return reinterpret_cast<Header *>(pMemory) - 1; }
+
+		void *allocateBlock(size_t size, size_t alignment, VkSystemAllocationScope scope)
+		{
+			// Room for the header and for aligning past it
+			alignment = std::max(alignment, alignof(Header));
+			const size_t blockSize = size + sizeof(Header) + alignment;
+			void *pBlock = m_pParent ?
+				m_pParent->pfnAllocation(m_pParent->pUserData, blockSize, alignof(Header), scope) : std::malloc(blockSize);
+			if (!pBlock) return nullptr;
+
+			uintptr_t address = reinterpret_cast<uintptr_t>(pBlock) + sizeof(Header);
+			address = (address + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+			void *pMemory = reinterpret_cast<void *>(address);
+			*headerOf(pMemory) = { pBlock, size, scope };
+
+			Counters &c = m_counters[scope];
+			const uint64_t bytes = c.bytes.fetch_add(size, std::memory_order_relaxed) + size;
+			uint64_t peak = c.peakBytes.load(std::memory_order_relaxed);
+			while (bytes > peak && !c.peakBytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {}
+			c.allocationCount.fetch_add(1, std::memory_order_relaxed);
+			return pMemory;
+		}
+
+		void freeBlock(void *pMemory)
+		{
+			if (!pMemory) return;
+
+			const Header header = *headerOf(pMemory);
+			Counters &c = m_counters[header.scope];
+			c.bytes.fetch_sub(header.size, std::memory_order_relaxed);
+			c.allocationCount.fetch_sub(1, std::memory_order_relaxed);
+
+			if (m_pParent) m_pParent->pfnFree(m_pParent->pUserData, header.pBlock);
+			else std::free(header.pBlock);
+		}
+
+		static VKAPI_ATTR void *VKAPI_CALL allocate(void *pUserData, size_t size, size_t alignment, VkSystemAllocationScope scope)
+		{
+			return static_cast<VTrackingHostAllocator *>(pUserData)->allocateBlock(size, alignment, scope);
+		}
+
+		static VKAPI_ATTR void *VKAPI_CALL reallocate(void *pUserData, void *pOriginal, size_t size, size_t alignment,
+			VkSystemAllocationScope scope)
+		{
+			auto *pThis = static_cast<VTrackingHostAllocator *>(pUserData);
+			if (!pOriginal) return pThis->allocateBlock(size, alignment, scope);
+			if (size == 0)
+			{
+				pThis->freeBlock(pOriginal);
+				return nullptr;
+			}
+
+			// The original is left untouched if the new allocation fails
+			void *pMemory = pThis->allocateBlock(size, alignment, scope);
+			if (!pMemory) return nullptr;
+			memcpy(pMemory, pOriginal, std::min(size, headerOf(pOriginal)->size));
+			pThis->freeBlock(pOriginal);
+			return pMemory;
+		}
+
+		static VKAPI_ATTR void VKAPI_CALL free(void *pUserData, void *pMemory)
+		{
+			static_cast<VTrackingHostAllocator *>(pUserData)->freeBlock(pMemory);
+		}
+
+		static VKAPI_ATTR void VKAPI_CALL internalAllocate(void *pUserData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope)
+		{
+			static_cast<VTrackingHostAllocator *>(pUserData)->m_counters[scope].internalBytes.fetch_add(size, std::memory_order_relaxed);
+		}
+
+		static VKAPI_ATTR void VKAPI_CALL internalFree(void *pUserData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope)
+		{
+			static_cast<VTrackingHostAllocator *>(pUserData)->m_counters[scope].internalBytes.fetch_sub(size, std::memory_order_relaxed);
+		}
+
+		const VkAllocationCallbacks *m_pParent;
+		VkAllocationCallbacks m_callbacks = {};
+		Counters m_counters[HOST_ALLOCATION_SCOPE_COUNT];
+	};
+}
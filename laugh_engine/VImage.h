@@ -1,6 +1,9 @@
 #pragma once
 
+#include <unordered_map>
 #include "VDevice.h"
+#include "VMemoryAllocator.h"
+#include "VStableTable.h"
 
 
 namespace rj
@@ -8,9 +11,11 @@ namespace rj
 	class VImage
 	{
 	public:
-		VImage(const VDevice &device)
+		// If @pAllocator is null the image gets its own VkDeviceMemory
+		VImage(const VDevice &device, VMemoryAllocator *pAllocator = nullptr)
 			:
 			m_device(device),
+			m_pAllocator(pAllocator),
 			m_image{ m_device, vkDestroyImage },
 			m_imageMemory{ m_device, vkFreeMemory }
 		{}
@@ -19,7 +24,7 @@ namespace rj
 			uint32_t mipLevels = 1, uint32_t arrayLayers = 1, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT,
 			VkImageLayout initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL)
 		{
-			createImage(m_image, m_imageMemory, m_device, m_device, format, VK_IMAGE_TYPE_2D, tiling, usage, memProps, width, height, 1,
+			createImageAndMemory(format, VK_IMAGE_TYPE_2D, tiling, usage, memProps, width, height, 1,
 				mipLevels, arrayLayers, 0, sampleCount, initialLayout);
 
 			m_isCubeImage = false;
@@ -31,14 +36,64 @@ namespace rj
 			m_type = VK_IMAGE_TYPE_2D;
 			m_tiling = tiling;
 			m_usage = usage;
-			m_memoryProperties = memProps;
 			m_curLayout = initialLayout;
 		}
 
+		// Bind to the memory of @memoryOwner, which must outlive this image, if the image fits into it. Otherwise the image gets memory
+		// of its own. Only one of the images sharing memory holds valid contents at a time, so each use of an aliased image has to start
+		// from VK_IMAGE_LAYOUT_UNDEFINED. Return true if the memory is shared
+		bool initAs2DImageAliasing(const VImage &memoryOwner, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage,
+			uint32_t mipLevels = 1, uint32_t arrayLayers = 1, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT,
+			VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL)
+		{
+			assert(m_pAllocator && memoryOwner.m_allocation.isvalid());
+
+			m_allocation.release();
+			m_sparsePages.clear();
+			m_sparsePageExtent = {};
+			createImage(m_image, m_device, format, VK_IMAGE_TYPE_2D, tiling, usage, width, height, 1,
+				mipLevels, arrayLayers, 0, sampleCount, VK_IMAGE_LAYOUT_UNDEFINED);
+
+			VkMemoryRequirements memRequirements;
+			vkGetImageMemoryRequirements(m_device, m_image, &memRequirements);
+
+			// Same tiling as the owner so that the range needs no extra buffer-image granularity padding
+			const auto &ownerAllocation = memoryOwner.m_allocation;
+			m_isAliased = tiling == memoryOwner.m_tiling && memRequirements.size <= ownerAllocation.size() &&
+				(memRequirements.memoryTypeBits & (1 << ownerAllocation.memoryTypeIndex())) &&
+				ownerAllocation.offset() % memRequirements.alignment == 0;
+
+			m_memoryProperties = memoryOwner.m_memoryProperties;
+			if (m_isAliased)
+			{
+				vkBindImageMemory(m_device, m_image, ownerAllocation.memory(), ownerAllocation.offset());
+			}
+			else
+			{
+				m_memoryProperties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+				m_pAllocator->allocate(&m_allocation, memRequirements, m_memoryProperties, tiling == VK_IMAGE_TILING_LINEAR,
+					getImageMemoryCategory(usage));
+				vkBindImageMemory(m_device, m_image, m_allocation.memory(), m_allocation.offset());
+			}
+
+			m_isCubeImage = false;
+			m_extent = { width, height, 1 };
+			m_mipLevelCount = mipLevels;
+			m_arrayLayerCount = arrayLayers;
+			m_sampleCount = sampleCount;
+			m_format = format;
+			m_type = VK_IMAGE_TYPE_2D;
+			m_tiling = tiling;
+			m_usage = usage;
+			m_curLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			return m_isAliased;
+		}
+
 		void initAsCubeImage(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps,
 			uint32_t mipLevels = 1, VkImageLayout initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL)
 		{
-			createImage(m_image, m_imageMemory, m_device, m_device, format, VK_IMAGE_TYPE_2D, tiling, usage, memProps, width, height, 1,
+			createImageAndMemory(format, VK_IMAGE_TYPE_2D, tiling, usage, memProps, width, height, 1,
 				mipLevels, 6, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT, VK_SAMPLE_COUNT_1_BIT, initialLayout);
 
 			m_isCubeImage = true;
@@ -50,10 +105,152 @@ namespace rj
 			m_type = VK_IMAGE_TYPE_2D;
 			m_tiling = tiling;
 			m_usage = usage;
-			m_memoryProperties = memProps;
 			m_curLayout = initialLayout;
 		}
 
+		// Single mip level and layer, e.g. for volume textures
+		void initAs3DImage(uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps,
+			VkImageLayout initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL)
+		{
+			createImageAndMemory(format, VK_IMAGE_TYPE_3D, tiling, usage, memProps, width, height, depth,
+				1, 1, 0, VK_SAMPLE_COUNT_1_BIT, initialLayout);
+
+			m_isCubeImage = false;
+			m_extent = { width, height, depth };
+			m_mipLevelCount = 1;
+			m_arrayLayerCount = 1;
+			m_sampleCount = VK_SAMPLE_COUNT_1_BIT;
+			m_format = format;
+			m_type = VK_IMAGE_TYPE_3D;
+			m_tiling = tiling;
+			m_usage = usage;
+			m_curLayout = initialLayout;
+		}
+
+		// Partially resident, single mip level. Only the mip tail and metadata, if the image has any, get memory here, which
+		// getSparseOpaqueBinds() binds. Pages are bound one by one through bindSparsePage(). Needs an allocator and
+		// VDevice::isSparseResidencyEnabled()
+		void initAs2DSparseImage(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, uint32_t arrayLayers = 1)
+		{
+			assert(m_pAllocator && m_device.isSparseResidencyEnabled());
+			m_isAliased = false;
+			m_allocation.release();
+			m_sparsePages.clear();
+			createImage(m_image, m_device, format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL, usage, width, height, 1,
+				1, arrayLayers, VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT, VK_SAMPLE_COUNT_1_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED);
+
+			// The alignment is the size of a page
+			vkGetImageMemoryRequirements(m_device, m_image, &m_sparseMemoryRequirements);
+			uint32_t count = 0;
+			vkGetImageSparseMemoryRequirements(m_device, m_image, &count, nullptr);
+			std::vector<VkSparseImageMemoryRequirements> sparseRequirements(count);
+			vkGetImageSparseMemoryRequirements(m_device, m_image, &count, sparseRequirements.data());
+
+			// The mip tail, where the level is smaller than a page, and the metadata are bound as one range each
+			m_sparseOpaqueRanges.clear();
+			m_sparsePageExtent = {};
+			for (const auto &requirements : sparseRequirements)
+			{
+				if (requirements.formatProperties.aspectMask & VK_IMAGE_ASPECT_METADATA_BIT)
+				{
+					const uint32_t metadataLayers = (requirements.formatProperties.flags & VK_SPARSE_IMAGE_FORMAT_SINGLE_MIPTAIL_BIT) ? 1 : arrayLayers;
+					for (uint32_t layer = 0; layer < metadataLayers; ++layer)
+					{
+						m_sparseOpaqueRanges.push_back({ requirements.imageMipTailOffset + layer * requirements.imageMipTailStride,
+							requirements.imageMipTailSize, VK_SPARSE_MEMORY_BIND_METADATA_BIT });
+					}
+					continue;
+				}
+				m_sparsePageExtent = requirements.formatProperties.imageGranularity;
+				if (requirements.imageMipTailFirstLod == 0)
+				{
+					const uint32_t tailLayers = (requirements.formatProperties.flags & VK_SPARSE_IMAGE_FORMAT_SINGLE_MIPTAIL_BIT) ? 1 : arrayLayers;
+					for (uint32_t layer = 0; layer < tailLayers; ++layer)
+					{
+						m_sparseOpaqueRanges.push_back({ requirements.imageMipTailOffset + layer * requirements.imageMipTailStride,
+							requirements.imageMipTailSize, 0 });
+					}
+				}
+			}
+			if (m_sparsePageExtent.width == 0)
+			{
+				throw std::runtime_error("the format has no sparse image layout");
+			}
+
+			VkDeviceSize opaqueSize = 0;
+			for (auto &range : m_sparseOpaqueRanges)
+			{
+				range.memoryOffset = opaqueSize;
+				opaqueSize += range.size;
+			}
+			m_memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			m_sparsePageCategory = getImageMemoryCategory(usage);
+			if (opaqueSize > 0)
+			{
+				VkMemoryRequirements opaqueRequirements = m_sparseMemoryRequirements;
+				opaqueRequirements.size = opaqueSize;
+				m_pAllocator->allocate(&m_allocation, opaqueRequirements, m_memoryProperties, false, m_sparsePageCategory);
+			}
+
+			m_isCubeImage = false;
+			m_extent = { width, height, 1 };
+			m_mipLevelCount = 1;
+			m_arrayLayerCount = arrayLayers;
+			m_sampleCount = VK_SAMPLE_COUNT_1_BIT;
+			m_format = format;
+			m_type = VK_IMAGE_TYPE_2D;
+			m_tiling = VK_IMAGE_TILING_OPTIMAL;
+			m_usage = usage;
+			m_curLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+
+		bool isSparse() const { return m_sparsePageExtent.width > 0; }
+		// Texels of a page, only valid for sparse images
+		VkExtent3D sparsePageExtent() const { return m_sparsePageExtent; }
+		uint32_t sparsePageCountX() const { return (m_extent.width + m_sparsePageExtent.width - 1) / m_sparsePageExtent.width; }
+		uint32_t sparsePageCountY() const { return (m_extent.height + m_sparsePageExtent.height - 1) / m_sparsePageExtent.height; }
+		VkDeviceSize sparsePageSize() const { return m_sparseMemoryRequirements.alignment; }
+		uint32_t residentSparsePageCount() const { return static_cast<uint32_t>(m_sparsePages.size()); }
+		bool isSparsePageResident(uint32_t page) const { return m_sparsePages.count(page) > 0; }
+
+		// Append the binds of the mip tail and metadata memory, once after initAs2DSparseImage()
+		void getSparseOpaqueBinds(std::vector<VkSparseMemoryBind> *pBinds) const
+		{
+			for (const auto &range : m_sparseOpaqueRanges)
+			{
+				pBinds->push_back({ range.resourceOffset, range.size, m_allocation.memory(), m_allocation.offset() + range.memoryOffset, range.flags });
+			}
+		}
+
+		// Page (layer * sparsePageCountY() + y) * sparsePageCountX() + x. Allocate its memory and fill @pBind, which is
+		// queued with vkQueueBindSparse(). Return false if the page is resident already
+		bool bindSparsePage(uint32_t page, VkSparseImageMemoryBind *pBind)
+		{
+			if (m_sparsePages.count(page) > 0) return false;
+
+			VkMemoryRequirements pageRequirements = m_sparseMemoryRequirements;
+			pageRequirements.size = m_sparseMemoryRequirements.alignment;
+			VMemoryAllocation &allocation = m_sparsePages[page];
+			m_pAllocator->allocate(&allocation, pageRequirements, m_memoryProperties, false, m_sparsePageCategory);
+
+			fillSparsePageBind(page, allocation.memory(), allocation.offset(), pBind);
+			return true;
+		}
+
+		// Fill @pBind to leave the page without memory and move its memory to @pRetired, which must not be freed before the
+		// unbind has executed and no frame uses the page any more. Return false if the page is not resident
+		bool unbindSparsePage(uint32_t page, VkSparseImageMemoryBind *pBind, VMemoryAllocation *pRetired)
+		{
+			auto it = m_sparsePages.find(page);
+			if (it == m_sparsePages.end()) return false;
+
+			*pRetired = it->second;
+			m_sparsePages.erase(it);
+			fillSparsePageBind(page, VK_NULL_HANDLE, 0, pBind);
+			return true;
+		}
+
 		operator VkImage() const { return m_image; }
 
 		void setLayout(VkImageLayout layout)
@@ -61,6 +258,28 @@ namespace rj
 			m_curLayout = layout;
 		}
 
+		// Images are accounted by their usage, see getImageMemoryCategory(). No effect on aliases or images with memory of their own
+		void setMemoryCategory(MemoryCategory category)
+		{
+			if (!m_pAllocator) return;
+			m_pAllocator->setCategory(&m_allocation, category);
+			m_sparsePageCategory = category;
+			for (auto &page : m_sparsePages)
+			{
+				m_pAllocator->setCategory(&page.second, category);
+			}
+		}
+
+		// Destroy the image and free its memory now instead of at the next init, e.g. so that a retired image no longer holds
+		// memory the allocator is defragmenting. Views of it must not be used anymore
+		void releaseMemory()
+		{
+			m_image.reset();
+			m_imageMemory.reset();
+			m_allocation.release();
+			m_sparsePages.clear();
+		}
+
 		// --- Geters ---
 		bool isCubeImage() const { return m_isCubeImage; }
 
@@ -79,13 +298,19 @@ namespace rj
 		VkImageType type() const { return m_type; }
 		VkImageTiling tiling() const { return m_tiling; }
 		VkImageUsageFlags usage() const { return m_usage; }
-		VkMemoryPropertyFlags memoryProperties() const { return m_memoryProperties; }
+		VkMemoryPropertyFlags memoryProperties() const { return m_memoryProperties; } // as allocated, see createImageAndMemory()
 		VkImageLayout layout() const { return m_curLayout; }
+		bool isAliased() const { return m_isAliased; } // shares the memory of another image
+		const VMemoryAllocation &allocation() const { return m_allocation; } // invalid for images with memory of their own
 		// --- Geters ---
 
 	protected:
 		const VDevice &m_device;
+		VMemoryAllocator *m_pAllocator;
 		
+		// m_allocation is declared before m_image so the image is destroyed before its memory is recycled
+		VMemoryAllocation m_allocation;
+		std::unordered_map<uint32_t, VMemoryAllocation> m_sparsePages; // resident pages of a sparse image, by page index
 		VDeleter<VkImage> m_image;
 		VDeleter<VkDeviceMemory> m_imageMemory;
 
@@ -100,12 +325,82 @@ namespace rj
 		VkImageUsageFlags m_usage;
 		VkMemoryPropertyFlags m_memoryProperties;
 		VkImageLayout m_curLayout;
+		bool m_isAliased = false;
+		// Sparse images only, see initAs2DSparseImage()
+		struct SparseOpaqueRange
+		{
+			VkDeviceSize resourceOffset;
+			VkDeviceSize size;
+			VkSparseMemoryBindFlags flags;
+			VkDeviceSize memoryOffset = 0; // in m_allocation
+		};
+		std::vector<SparseOpaqueRange> m_sparseOpaqueRanges;
+		VkMemoryRequirements m_sparseMemoryRequirements = {};
+		VkExtent3D m_sparsePageExtent = {};
+		MemoryCategory m_sparsePageCategory = MEMORY_CATEGORY_OTHER;
+
+		void fillSparsePageBind(uint32_t page, VkDeviceMemory memory, VkDeviceSize memoryOffset, VkSparseImageMemoryBind *pBind) const
+		{
+			const uint32_t pageCountX = sparsePageCountX();
+			const uint32_t pagesPerLayer = pageCountX * sparsePageCountY();
+			const uint32_t x = page % pagesPerLayer % pageCountX * m_sparsePageExtent.width;
+			const uint32_t y = page % pagesPerLayer / pageCountX * m_sparsePageExtent.height;
+
+			*pBind = {};
+			pBind->subresource = { getSparseAspect(), 0, page / pagesPerLayer };
+			pBind->offset = { static_cast<int32_t>(x), static_cast<int32_t>(y), 0 };
+			pBind->extent = { std::min(m_sparsePageExtent.width, m_extent.width - x), std::min(m_sparsePageExtent.height, m_extent.height - y), 1 };
+			pBind->memory = memory;
+			pBind->memoryOffset = memoryOffset;
+		}
+
+		VkImageAspectFlags getSparseAspect() const
+		{
+			return (m_usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+		}
+
+		// VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT in @memProps is a preference. It is dropped if no memory type
+		// the image can live in has it, which is the case on most desktop GPUs
+		void createImageAndMemory(VkFormat format, VkImageType imageType, VkImageTiling tiling, VkImageUsageFlags usage,
+			VkMemoryPropertyFlags memProps, uint32_t width, uint32_t height, uint32_t depth, uint32_t mipLevels, uint32_t arrayLayers,
+			VkImageCreateFlags flags, VkSampleCountFlagBits sampleCount, VkImageLayout initialLayout)
+		{
+			assert(!(memProps & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) || (usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT));
+			m_isAliased = false;
+			m_sparsePages.clear();
+			m_sparsePageExtent = {};
+
+			if (!m_pAllocator)
+			{
+				m_memoryProperties = memProps & ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+				createImage(m_image, m_imageMemory, m_device, m_device, format, imageType, tiling, usage, m_memoryProperties, width, height, depth,
+					mipLevels, arrayLayers, flags, sampleCount, initialLayout);
+				return;
+			}
+
+			m_allocation.release();
+			createImage(m_image, m_device, format, imageType, tiling, usage, width, height, depth,
+				mipLevels, arrayLayers, flags, sampleCount, initialLayout);
+
+			VkMemoryRequirements memRequirements;
+			vkGetImageMemoryRequirements(m_device, m_image, &memRequirements);
+
+			m_memoryProperties = memProps;
+			if ((memProps & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !m_pAllocator->hasMemoryType(memRequirements.memoryTypeBits, memProps))
+			{
+				m_memoryProperties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+			}
+			m_pAllocator->allocate(&m_allocation, memRequirements, m_memoryProperties, tiling == VK_IMAGE_TILING_LINEAR,
+				getImageMemoryCategory(usage));
+
+			vkBindImageMemory(m_device, m_image, m_allocation.memory(), m_allocation.offset());
+		}
 	};
 
 	class VImageView
 	{
 	public:
-		VImageView(const VDevice &device, const std::vector<VImage> &images)
+		VImageView(const VDevice &device, const VStableTable<VImage> &images)
 			:
 			m_device(device),
 			m_imagePool(images),
@@ -140,7 +435,7 @@ namespace rj
 			viewInfo.subresourceRange.layerCount = layerCount;
 			viewInfo.flags = flags;
 
-			if (vkCreateImageView(m_device, &viewInfo, nullptr, m_imageView.replace()) != VK_SUCCESS)
+			if (vkCreateImageView(m_device, &viewInfo, helper_functions::getHostAllocationCallbacks(), m_imageView.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create texture image view!");
 			}
@@ -172,9 +467,9 @@ namespace rj
 
 	protected:
 		const VDevice &m_device;
-		const std::vector<VImage> &m_imagePool;
+		const VStableTable<VImage> &m_imagePool;
 
-		uint32_t m_imageName; // due to reallocation we cannot store pointer
+		uint32_t m_imageName; // the entry stays in place, but the image may be destroyed and its name reused
 		VDeleter<VkImageView> m_imageView;
 
 		VkImageViewType m_type;
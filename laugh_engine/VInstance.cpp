@@ -35,6 +35,21 @@ namespace rj
 			return true;
 		}
 
+		bool checkInstanceExtensionSupport(const char *extensionName)
+		{
+			uint32_t extensionCount;
+			vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+
+			std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+			vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+
+			for (const auto &extension : availableExtensions)
+			{
+				if (strcmp(extensionName, extension.extensionName) == 0) return true;
+			}
+			return false;
+		}
+
 		VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 			VkDebugReportFlagsEXT flags,
 			VkDebugReportObjectTypeEXT objType,
@@ -66,7 +81,7 @@ namespace rj
 			}
 		}
 
-		void destroyDebugReportCallbackEXT(
+		VKAPI_ATTR void VKAPI_CALL destroyDebugReportCallbackEXT(
 			VkInstance instance,
 			VkDebugReportCallbackEXT callback,
 			const VkAllocationCallbacks* pAllocator)
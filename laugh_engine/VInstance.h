@@ -13,6 +13,9 @@ namespace rj
 		*/
 		bool checkValidationLayerSupport(const std::vector<const char *> &layerNames);
 
+		// Check if the instance extension @extensionName is supported
+		bool checkInstanceExtensionSupport(const char *extensionName);
+
 		VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 			VkDebugReportFlagsEXT flags,
 			VkDebugReportObjectTypeEXT objType,
@@ -29,7 +32,7 @@ namespace rj
 			const VkAllocationCallbacks *pAllocator,
 			VkDebugReportCallbackEXT *pCallback);
 
-		void destroyDebugReportCallbackEXT(
+		VKAPI_ATTR void VKAPI_CALL destroyDebugReportCallbackEXT(
 			VkInstance instance,
 			VkDebugReportCallbackEXT callback,
 			const VkAllocationCallbacks* pAllocator);
@@ -40,19 +43,56 @@ namespace rj
 	class VInstance
 	{
 	public:
+		// @pHostAllocator is used for every Vulkan object of the process from now on, see getHostAllocationCallbacks().
+		// @enableDebugUtils turns on VK_EXT_debug_utils if the loader or a capture layer offers it
 		VInstance(bool enableValidationLayers,
 			const std::vector<const char *> &layerNames,
-			const std::vector<const char *> &extensionNames)
+			const std::vector<const char *> &extensionNames,
+			const VkAllocationCallbacks *pHostAllocator = nullptr,
+			bool enableDebugUtils = false)
 			:
 			m_enableValidationLayers(enableValidationLayers),
 			m_layerNames(layerNames),
 			m_requiredExtensions(extensionNames)
 		{
+			hostAllocationCallbacks() = pHostAllocator;
+
 			if (m_enableValidationLayers)
 			{
 				m_requiredExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 			}
 
+			// Optional, device extensions such as VK_EXT_memory_budget are queried through it
+			m_physicalDeviceProperties2Enabled = checkInstanceExtensionSupport(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+			if (m_physicalDeviceProperties2Enabled)
+			{
+				m_requiredExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+			}
+
+			// Optional, images and semaphores shared with other APIs need them on a Vulkan 1.0 instance
+			m_externalMemoryCapabilitiesEnabled = m_physicalDeviceProperties2Enabled &&
+				checkInstanceExtensionSupport(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME) &&
+				checkInstanceExtensionSupport(VK_KHR_EXTERNAL_SEMAPHORE_CAPABILITIES_EXTENSION_NAME);
+			if (m_externalMemoryCapabilitiesEnabled)
+			{
+				m_requiredExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+				m_requiredExtensions.push_back(VK_KHR_EXTERNAL_SEMAPHORE_CAPABILITIES_EXTENSION_NAME);
+			}
+
+			m_debugUtilsEnabled = enableDebugUtils && checkInstanceExtensionSupport(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+			if (m_debugUtilsEnabled)
+			{
+				m_requiredExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+			}
+
+			// Vulkan 1.1 where the loader has it, device extensions such as VK_KHR_acceleration_structure require it
+			auto pfnEnumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+			uint32_t loaderVersion = VK_API_VERSION_1_0;
+			if (pfnEnumerateInstanceVersion && pfnEnumerateInstanceVersion(&loaderVersion) == VK_SUCCESS && loaderVersion >= VK_API_VERSION_1_1)
+			{
+				m_apiVersion = VK_API_VERSION_1_1;
+			}
+
 			createInstance();
 			setupDebugCallback();
 		}
@@ -62,6 +102,15 @@ namespace rj
 			return m_instance;
 		}
 
+		// VK_KHR_get_physical_device_properties2
+		bool isPhysicalDeviceProperties2Enabled() const { return m_physicalDeviceProperties2Enabled; }
+		// VK_KHR_external_memory_capabilities and VK_KHR_external_semaphore_capabilities
+		bool isExternalMemoryCapabilitiesEnabled() const { return m_externalMemoryCapabilitiesEnabled; }
+		// VK_EXT_debug_utils, object names and command buffer labels for capture tools
+		bool isDebugUtilsEnabled() const { return m_debugUtilsEnabled; }
+		// VK_API_VERSION_1_0 or VK_API_VERSION_1_1
+		uint32_t getApiVersion() const { return m_apiVersion; }
+
 	protected:
 		void createInstance()
 		{
@@ -76,7 +125,7 @@ namespace rj
 			appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 			appInfo.pEngineName = "No Engine";
 			appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-			appInfo.apiVersion = VK_API_VERSION_1_0;
+			appInfo.apiVersion = m_apiVersion;
 
 			VkInstanceCreateInfo createInfo = {};
 			createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -95,7 +144,7 @@ namespace rj
 				createInfo.enabledLayerCount = 0;
 			}
 
-			if (vkCreateInstance(&createInfo, nullptr, m_instance.replace()) != VK_SUCCESS)
+			if (vkCreateInstance(&createInfo, helper_functions::getHostAllocationCallbacks(), m_instance.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create instance!");
 			}
@@ -110,7 +159,7 @@ namespace rj
 			createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
 			createInfo.pfnCallback = debugCallback;
 
-			if (createDebugReportCallbackEXT(m_instance, &createInfo, nullptr, m_debugReportCB.replace()) != VK_SUCCESS)
+			if (createDebugReportCallbackEXT(m_instance, &createInfo, helper_functions::getHostAllocationCallbacks(), m_debugReportCB.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to set up debug callback!");
 			}
@@ -120,6 +169,10 @@ namespace rj
 		bool m_enableValidationLayers;
 		std::vector<const char *> m_layerNames;
 		std::vector<const char *> m_requiredExtensions;
+		bool m_physicalDeviceProperties2Enabled = false;
+		bool m_externalMemoryCapabilitiesEnabled = false;
+		bool m_debugUtilsEnabled = false;
+		uint32_t m_apiVersion = VK_API_VERSION_1_0;
 
 		VDeleter<VkInstance> m_instance{ vkDestroyInstance };
 		VDeleter<VkDebugReportCallbackEXT> m_debugReportCB{ m_instance, destroyDebugReportCallbackEXT };
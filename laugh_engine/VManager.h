@@ -1,9 +1,16 @@
 #pragma once
 
 #include <shared_mutex>
+#include <mutex>
 #include <set>
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <iostream>
 #include "VInstance.h"
 #include "VWindow.h"
 #include "VDevice.h"
@@ -14,7 +21,31 @@
 #include "VSampler.h"
 #include "VFramebuffer.h"
 #include "VDescriptorPool.h"
+#include "VArrayView.h"
+#include "VNamePool.h"
+#include "VStableTable.h"
 #include "VQueryPool.h"
+#include "VMemoryAllocator.h"
+#include "VStagingRing.h"
+#include "VReadbackRing.h"
+#include "VExternalImageSink.h"
+#include "VCommandCapture.h"
+
+// Pipeline cache is loaded from here at startup and written back on shutdown
+#define PIPELINE_CACHE_FILE_NAME "../pipeline_cache.bin"
+// SPIR-V files used by the last run, one per line. Their shader modules are created in parallel at startup
+#define SHADER_LIST_FILE_NAME "../shader_list.txt"
+
+// Capacity of the shared static mesh buffers
+#define GEOMETRY_POOL_VERTEX_CAPACITY (4 * 1024 * 1024) // vertices
+#define GEOMETRY_POOL_INDEX_CAPACITY (16 * 1024 * 1024) // 32 bit indices
+#define GEOMETRY_POOL_INDEX16_CAPACITY (16 * 1024 * 1024) // 16 bit indices of meshes with at most 65536 vertices
+#define ACCELERATION_STRUCTURE_SCRATCH_SIZE (64 * 1024 * 1024) // bytes of scratch memory bottom level builds share per batch
+
+// Compute pass of uploadBatchAddWrittenTexelsExpandedToRgba8
+#define TEXEL_EXPAND_SHADER_FILE_NAME "../shaders/upload/expand_rgba8.comp.spv"
+#define TEXEL_EXPAND_GROUP_SIZE 8 // work groups of 8x8 texels
+#define TEXEL_EXPAND_MAX_SETS 256 // expansions between two waits on the upload batch
 
 
 namespace rj
@@ -28,6 +59,10 @@ namespace rj
 			std::vector<VkAttachmentReference> depthAttachmentRefs; // size must be <= 1
 			std::vector<VkAttachmentReference> inputAttachmentRefs;
 			std::vector<uint32_t> preserveAttachmentRefs;
+			VkAttachmentReference shadingRateAttachmentRef = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+			VkExtent2D shadingRateTexelSize = {};
+			VkAttachmentReference depthResolveAttachmentRef = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+			VkResolveModeFlagBitsKHR depthResolveMode = VK_RESOLVE_MODE_NONE_KHR;
 		};
 
 		struct RenderPassCreateInfo
@@ -42,6 +77,8 @@ namespace rj
 		{
 			std::vector<std::vector<VkSampler>> immutableSamplers;
 			std::vector<VkDescriptorSetLayoutBinding> bindings;
+			std::vector<VkDescriptorBindingFlagsEXT> bindingFlags;
+			VkDescriptorSetLayoutCreateFlags flags = 0;
 		};
 
 		struct PipelineLayoutCreateInfo
@@ -54,7 +91,8 @@ namespace rj
 		{
 			VkComputePipelineCreateInfo pipelineInfo;
 
-			VDeleter<VkShaderModule> computeShaderModule;
+			VkShaderModule computeShaderModule = VK_NULL_HANDLE; // owned by the shader module cache
+			std::string debugName; // shader file name, only with debug utils
 			VkSpecializationInfo computeSpecializationInfo = {};
 			std::vector<char> computeSpecializationData;
 			std::vector<VkSpecializationMapEntry> computeSpecializationMapEntries;
@@ -97,32 +135,39 @@ namespace rj
 			std::vector<VkDynamicState> dynamicStates;
 			VkPipelineDynamicStateCreateInfo dynamicStateInfo;
 
-			VDeleter<VkShaderModule> vertShaderModule;
+			VkShaderModule vertShaderModule = VK_NULL_HANDLE; // owned by the shader module cache
 			VkSpecializationInfo vertSpecializationInfo = {};
 			std::vector<char> vertSpecializationData;
 			std::vector<VkSpecializationMapEntry> vertSpecializationMapEntries;
 
-			VDeleter<VkShaderModule> hullShaderModule;
+			VkShaderModule hullShaderModule = VK_NULL_HANDLE; // owned by the shader module cache
 			VkSpecializationInfo hullSpecializationInfo = {};
 			std::vector<char> hullSpecializationData;
 			std::vector<VkSpecializationMapEntry> hullSpecializationMapEntries;
 
-			VDeleter<VkShaderModule> domainShaderModule;
+			VkShaderModule domainShaderModule = VK_NULL_HANDLE; // owned by the shader module cache
 			VkSpecializationInfo domainSpecializationInfo = {};
 			std::vector<char> domainSpecializationData;
 			std::vector<VkSpecializationMapEntry> domainSpecializationMapEntries;
 			
-			VDeleter<VkShaderModule> geomShaderModule;
+			VkShaderModule geomShaderModule = VK_NULL_HANDLE; // owned by the shader module cache
 			VkSpecializationInfo geomSpecializationInfo = {};
 			std::vector<char> geomSpecializationData;
 			std::vector<VkSpecializationMapEntry> geomSpecializationMapEntries;
 			
-			VDeleter<VkShaderModule> fragShaderModule;
+			VkShaderModule taskShaderModule = VK_NULL_HANDLE; // owned by the shader module cache, no specialization
+			VkShaderModule meshShaderModule = VK_NULL_HANDLE; // owned by the shader module cache, no specialization
+
+			VkShaderModule fragShaderModule = VK_NULL_HANDLE; // owned by the shader module cache
 			VkSpecializationInfo fragSpecializationInfo = {};
 			std::vector<char> fragSpecializationData;
 			std::vector<VkSpecializationMapEntry> fragSpecializationMapEntries;
 			
 			std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+			std::string debugName; // shader file names, only with debug utils
+
+			// Chained to @pipelineInfo in subpasses with a shading rate attachment
+			VkPipelineFragmentShadingRateStateCreateInfoKHR shadingRateInfo = {};
 
 			VkGraphicsPipelineCreateInfo pipelineInfo;
 
@@ -187,19 +232,221 @@ namespace rj
 			std::vector<VkDescriptorPoolSize> poolSizes;
 		};
 
+		// Per frame pools of a transient descriptor allocator. A frame gets another pool whenever the ones it has run out
+		struct TransientDescriptorPools
+		{
+			std::vector<uint32_t> pools;
+			uint32_t curPool = 0; // the one allocated from, the ones before are full
+		};
+
+		struct TransientDescriptorAllocator
+		{
+			uint32_t maxSetsPerPool;
+			std::vector<VkDescriptorPoolSize> poolSizes;
+			std::vector<TransientDescriptorPools> frames;
+		};
+
+		struct AccelerationStructureDescriptorInfo
+		{
+			VkAccelerationStructureKHR handle;
+			VkWriteDescriptorSetAccelerationStructureKHR write; // chained to the descriptor write, points at @handle
+		};
+
 		struct DescriptorSetUpdateInfo
 		{
 			std::unordered_map<uint32_t, std::vector<VkDescriptorBufferInfo>> bufferInfos;
 			std::unordered_map<uint32_t, std::vector<VkDescriptorImageInfo>> imageInfos;
+			std::unordered_map<uint32_t, AccelerationStructureDescriptorInfo> accelerationStructureInfos;
 			std::vector<VkWriteDescriptorSet> writeInfos;
 		};
 
+		// One slot of the data a descriptor update template reads, whichever kind of descriptor its entry writes
+		union TemplateDescriptorInfo
+		{
+			VkDescriptorImageInfo image;
+			VkDescriptorBufferInfo buffer;
+		};
+
+		struct UploadBatchInfo
+		{
+			uint32_t depth = 0;
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			std::vector<VkCommandBuffer> submittedCommandBuffers;
+			std::vector<VBuffer> dedicatedStagingBuffers; // uploads that don't fit in the staging ring
+			VDeleter<VkFence> fence; // signaled by a submit that didn't consume staging ring space
+			bool isFenceInUse = false;
+
+			// Only used with a dedicated transfer queue. @commandBuffer then records the copies on the transfer queue,
+			// and everything it wrote is handed to the graphics queue, which also applies the remaining layout transitions
+			struct TransferredImage
+			{
+				uint32_t imageName;
+				VkImageAspectFlags aspectMask;
+			};
+
+			struct LayoutTransition
+			{
+				uint32_t imageName;
+				VkImageLayout oldLayout;
+				VkImageLayout newLayout;
+			};
+
+			std::vector<VkBuffer> transferredBuffers;
+			std::vector<TransferredImage> transferredImages; // in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+			std::vector<LayoutTransition> deferredLayoutTransitions;
+			std::vector<uint32_t> deferredMipmapGenerations; // images, recorded ahead of @deferredLayoutTransitions
+			std::vector<VkCommandBuffer> submittedTransferCommandBuffers;
+			VDeleter<VkSemaphore> semaphore; // between the transfer and the graphics submit
+
+			// Texel expansion, created on first use. The storage image views live until the command buffer that wrote
+			// through them is done, the sets until the next waitUploadBatch that finds none of them in @commandBuffer
+			uint32_t expansionSetLayout = std::numeric_limits<uint32_t>::max();
+			uint32_t expansionPipelineLayout = std::numeric_limits<uint32_t>::max();
+			uint32_t expansionPipeline = std::numeric_limits<uint32_t>::max();
+			uint32_t expansionPool = std::numeric_limits<uint32_t>::max();
+			uint32_t expansionSetCount = 0; // allocated from @expansionPool since it was last reset
+			std::vector<uint32_t> expansionImageViews; // recorded into @commandBuffer
+			std::vector<uint32_t> submittedExpansionImageViews;
+
+			UploadBatchInfo(const VDeleter<VkDevice> &device)
+				: fence{ device, vkDestroyFence }, semaphore{ device, vkDestroySemaphore }
+			{}
+		};
+
+		// Where a mesh lives in the geometry pool buffers. Indices are relative to @vertexOffset.
+		// @firstIndex counts indices of @indexType in the index buffer of that type
+		struct GeometryRange
+		{
+			uint32_t firstIndex = 0;
+			uint32_t indexCount = 0;
+			int32_t vertexOffset = 0;
+			VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+			// Bytes to the first vertex in the position and attribute buffers, for shaders that fetch the vertices themselves
+			uint32_t positionOffset = 0;
+			uint32_t attributeOffset = 0;
+			uint32_t vertexCount = 0; // the indices address vertices [0, @vertexCount), e.g. for acceleration structure builds
+		};
+
+		struct GeometryPoolInfo
+		{
+			uint32_t positionBuffer = std::numeric_limits<uint32_t>::max();
+			uint32_t attributeBuffer = std::numeric_limits<uint32_t>::max(); // every vertex input but the position
+			uint32_t indexBuffer = std::numeric_limits<uint32_t>::max();
+			uint32_t index16Buffer = std::numeric_limits<uint32_t>::max();
+			uint32_t positionStride = 0; // the largest one with mixed strides
+			uint32_t attributeStride = 0;
+			uint32_t vertexCount = 0; // allocated so far
+			VkDeviceSize positionSize = 0; // bytes allocated so far
+			VkDeviceSize attributeSize = 0;
+			bool mixedStrides = false;
+			uint32_t indexCount = 0;
+			uint32_t index16Count = 0;
+			bool index16Enabled = true;
+			// (first, count) ranges freed by geometryPoolFree, sorted by first and coalesced. Reused first fit before the rest
+			std::vector<std::pair<uint32_t, uint32_t>> freeVertices;
+			std::vector<std::pair<uint32_t, uint32_t>> freeIndices;
+			std::vector<std::pair<uint32_t, uint32_t>> freeIndices16;
+		};
+
+		// Parameters of createSampler. Every member is 4 bytes, so there is no padding to compare or hash
+		struct SamplerDescription
+		{
+			VkFilter magFilter;
+			VkFilter minFilter;
+			VkSamplerMipmapMode mipmapMode;
+			VkSamplerAddressMode addressModeU;
+			VkSamplerAddressMode addressModeV;
+			VkSamplerAddressMode addressModeW;
+			float minLod;
+			float maxLod;
+			float mipLodBias;
+			VkBool32 anisotropyEnable;
+			float maxAnisotropy;
+			VkBool32 compareEnable;
+			VkCompareOp compareOp;
+			VkBorderColor borderColor;
+			VkBool32 unnormalizedCoords;
+			VkSamplerCreateFlags flags;
+
+			bool operator==(const SamplerDescription &other) const { return memcmp(this, &other, sizeof(*this)) == 0; }
+		};
+
+		struct SamplerDescriptionHash
+		{
+			size_t operator()(const SamplerDescription &desc) const
+			{
+				// FNV-1a
+				const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&desc);
+				uint64_t h = 14695981039346656037ull;
+				for (size_t i = 0; i < sizeof(desc); ++i)
+				{
+					h = (h ^ bytes[i]) * 1099511628211ull;
+				}
+				return static_cast<size_t>(h);
+			}
+		};
+
+		// FNV-1a over the fields of a create info that decide what gets created. Only fed with plain values and arrays
+		// of Vulkan structs without pointers or padding
+		struct StateHasher
+		{
+			uint64_t h = 14695981039346656037ull;
+
+			void addBytes(const void *pData, size_t size)
+			{
+				const unsigned char *bytes = reinterpret_cast<const unsigned char *>(pData);
+				for (size_t i = 0; i < size; ++i)
+				{
+					h = (h ^ bytes[i]) * 1099511628211ull;
+				}
+			}
+
+			template<typename T>
+			void add(const T &value) { addBytes(&value, sizeof(value)); }
+
+			template<typename T>
+			void addArray(const T *pValues, uint32_t count)
+			{
+				add(count);
+				if (count > 0) addBytes(pValues, sizeof(T) * count);
+			}
+		};
+
+		// Parameters of createImageView. Every member is 4 bytes, so there is no padding to compare or hash
+		struct ImageViewDescription
+		{
+			uint32_t imageName;
+			VkImageViewType viewType;
+			VkFormat format;
+			VkImageAspectFlags aspectMask;
+			uint32_t baseMipLevel;
+			uint32_t levelCount;
+			uint32_t baseArrayLayer;
+			uint32_t layerCount;
+			VkComponentMapping componentMapping;
+			VkImageViewCreateFlags flags;
+
+			bool operator==(const ImageViewDescription &other) const { return memcmp(this, &other, sizeof(*this)) == 0; }
+		};
+
+		struct ImageViewDescriptionHash
+		{
+			size_t operator()(const ImageViewDescription &desc) const
+			{
+				StateHasher hasher;
+				hasher.add(desc);
+				return static_cast<size_t>(hasher.h);
+			}
+		};
+
 		struct QueueSubmitInfo
 		{
 			std::vector<VkCommandBuffer> cmdBuffers;
 			std::vector<VkPipelineStageFlags> waitStages;
 			std::vector<VkSemaphore> waitSemaphores;
 			std::vector<VkSemaphore> signalSemaphores;
+			std::vector<uint64_t> waitValues; // empty unless a timeline semaphore is waited on
+			std::vector<uint64_t> signalValues; // empty unless a timeline semaphore is signaled
 		};
 	}
 
@@ -219,40 +466,122 @@ namespace rj
 		uint32_t samplerName;
 	};
 
+	// One descriptor of a push descriptor set. @bufferInfo is read for buffer types, @imageInfo for the others
+	struct PushDescriptorWrite
+	{
+		uint32_t binding;
+		VkDescriptorType type;
+		DescriptorSetUpdateBufferInfo bufferInfo;
+		DescriptorSetUpdateImageInfo imageInfo;
+	};
+
+	// Commands recorded into a command buffer, including the secondary command buffers it executes.
+	// Triangles assume triangle lists and are unknown for indirect draws. Bytes are estimated: the attachment loads and
+	// stores of render passes as a tiler makes them, image copies, plus what the recorder counts for sampled and storage images
+	struct CommandCounters
+	{
+		uint32_t draws = 0;
+		uint32_t indirectDraws = 0; // included in @draws
+		uint32_t dispatches = 0;
+		uint32_t pipelineBinds = 0;
+		uint32_t descriptorSetBinds = 0; // calls, not sets
+		uint32_t vertexBufferBinds = 0;
+		uint32_t indexBufferBinds = 0;
+		uint32_t pushConstants = 0;
+		uint64_t triangles = 0;
+		uint64_t bytesRead = 0;
+		uint64_t bytesWritten = 0;
+
+		CommandCounters &operator+=(const CommandCounters &other)
+		{
+			draws += other.draws;
+			indirectDraws += other.indirectDraws;
+			dispatches += other.dispatches;
+			pipelineBinds += other.pipelineBinds;
+			descriptorSetBinds += other.descriptorSetBinds;
+			vertexBufferBinds += other.vertexBufferBinds;
+			indexBufferBinds += other.indexBufferBinds;
+			pushConstants += other.pushConstants;
+			triangles += other.triangles;
+			bytesRead += other.bytesRead;
+			bytesWritten += other.bytesWritten;
+			return *this;
+		}
+
+		CommandCounters operator-(const CommandCounters &other) const
+		{
+			CommandCounters result = *this;
+			result.draws -= other.draws;
+			result.indirectDraws -= other.indirectDraws;
+			result.dispatches -= other.dispatches;
+			result.pipelineBinds -= other.pipelineBinds;
+			result.descriptorSetBinds -= other.descriptorSetBinds;
+			result.vertexBufferBinds -= other.vertexBufferBinds;
+			result.indexBufferBinds -= other.indexBufferBinds;
+			result.pushConstants -= other.pushConstants;
+			result.triangles -= other.triangles;
+			result.bytesRead -= other.bytesRead;
+			result.bytesWritten -= other.bytesWritten;
+			return result;
+		}
+	};
+
 	class VManager
 	{
 	public:
+		// Fills staging memory at the pointer it gets, e.g. by reading a file straight into it
+		typedef std::function<void(void *pDst)> StagingWriter;
+		// Fills staging memory with indices of @indexType, which the geometry pool picks for the mesh
+		typedef std::function<void(void *pDst, VkIndexType indexType)> IndexWriter;
+
 		VManager(void *app,
 			GLFWkeyfun keyfun = nullptr, GLFWmousebuttonfun mousebuttonfun = nullptr,
 			GLFWcursorposfun cursorposfun = nullptr, GLFWscrollfun scrollfun = nullptr, GLFWwindowsizefun windowsizefun = nullptr,
 			uint32_t winWidth = 1920, uint32_t winHeight = 1080, const std::string &winTitle = "",
-			const VkPhysicalDeviceFeatures &enabledFeatures = {})
+			const VkPhysicalDeviceFeatures &enabledFeatures = {}, bool headless = false, const VkAllocationCallbacks *pHostAllocator = nullptr,
+			bool debugUtils = false, bool deviceGroup = false)
 			:
-			m_instance{ m_enableValidationLayers,{ "VK_LAYER_LUNARG_standard_validation" }, VWindow::getRequiredExtensions() },
-			m_window{ m_instance, winWidth, winHeight, winTitle, app, keyfun, mousebuttonfun, cursorposfun, scrollfun, windowsizefun },
-			m_device{ m_enableValidationLayers,{ "VK_LAYER_LUNARG_standard_validation" }, m_instance, m_window,{ VK_KHR_SWAPCHAIN_EXTENSION_NAME }, enabledFeatures },
+			m_instance{ m_enableValidationLayers,{ "VK_LAYER_LUNARG_standard_validation" }, headless ? std::vector<const char *>() : VWindow::getRequiredExtensions(),
+				pHostAllocator, debugUtils },
+			m_window{ m_instance, winWidth, winHeight, winTitle, app, keyfun, mousebuttonfun, cursorposfun, scrollfun, windowsizefun, headless },
+			m_device{ m_enableValidationLayers,{ "VK_LAYER_LUNARG_standard_validation" }, m_instance, m_window,{ VK_KHR_SWAPCHAIN_EXTENSION_NAME }, enabledFeatures,
+				m_instance.isPhysicalDeviceProperties2Enabled(), m_instance.isExternalMemoryCapabilitiesEnabled(), m_instance.isDebugUtilsEnabled(),
+				m_instance.getApiVersion(), deviceGroup },
 			m_swapChain{ m_device, m_window }
 		{
+			m_memoryAllocator.setBudgetCallback([](const MemoryHeapBudget &heapBudget)
+			{
+				std::cerr << "warning: memory heap " << heapBudget.heapIndex << " is over budget, " << (heapBudget.usage >> 20) << " of "
+					<< (heapBudget.budget >> 20) << " MB in use" << std::endl;
+			});
+
+			m_submitDeviceMask = getAllDevicesMask();
 			createPipelineCache();
+			preloadShaderModules(readShaderList());
 			createSingleSubmitCommandPool();
+			createUploadBatchSyncObjects();
+			m_stagingRing.init();
 		}
 
-		virtual ~VManager() {}
+		virtual ~VManager()
+		{
+			savePipelineCache();
+			saveShaderList();
+		}
 
 		// --- Render pass related ---
 		void beginCreateRenderPass()
 		{
 			m_curRenderPassInfo = {};
 
-			if (!m_availableRenderPassNames.empty())
+			m_curRenderPassName = m_renderPassNames.allocate();
+			if (m_curRenderPassName == m_renderPasses.size())
 			{
-				m_curRenderPassName = m_availableRenderPassNames.back();
-				m_availableRenderPassNames.pop_back();
-			}
-			else
-			{
-				m_curRenderPassName = static_cast<uint32_t>(m_renderPasses.size());
 				m_renderPasses.emplace_back(m_device, vkDestroyRenderPass);
+				m_renderPassCompatibilityHashes.push_back(0);
+				m_renderPassDebugNames.emplace_back();
+				m_renderPassShadingRateSubpasses.push_back(0);
+				m_renderPassTraffic.emplace_back();
 			}
 		}
 
@@ -326,6 +655,24 @@ namespace rj
 			m_pCurSubpassInfo->preserveAttachmentRefs.push_back(attachmentIdx);
 		}
 
+		// Each texel of the attachment sets the fragment size of @texelSize pixels, needs isFragmentShadingRateEnabled(). Pipelines
+		// created for the subpass take the rate of the attachment, e.g. 1x1 where sample shading forces it
+		void subpassSetShadingRateAttachmentReference(uint32_t attachmentIdx, VkImageLayout layout, VkExtent2D texelSize)
+		{
+			assert(isFragmentShadingRateEnabled());
+			m_pCurSubpassInfo->shadingRateAttachmentRef = { attachmentIdx, layout };
+			m_pCurSubpassInfo->shadingRateTexelSize = texelSize;
+		}
+
+		// The multisampled depth attachment is resolved into the single sampled one at @attachmentIdx at the end of the subpass,
+		// with @depthMode, one of the supported modes of getDepthStencilResolveProperties(). Needs isDepthStencilResolveEnabled()
+		void subpassSetDepthResolveAttachmentReference(uint32_t attachmentIdx, VkImageLayout layout, VkResolveModeFlagBitsKHR depthMode)
+		{
+			assert(isDepthStencilResolveEnabled());
+			m_pCurSubpassInfo->depthResolveAttachmentRef = { attachmentIdx, layout };
+			m_pCurSubpassInfo->depthResolveMode = depthMode;
+		}
+
 		void endDescribeSubpass(VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS)
 		{
 			m_curRenderPassInfo.subpassDescs.push_back({});
@@ -384,7 +731,8 @@ namespace rj
 			dependency.dependencyFlags = flags;
 		}
 
-		uint32_t endCreateRenderPass()
+		// @debugName labels the render pass instances in captures, see cmdBeginRenderPass
+		uint32_t endCreateRenderPass(const std::string &debugName = std::string())
 		{
 			VkRenderPassCreateInfo renderPassInfo = {};
 			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -395,10 +743,29 @@ namespace rj
 			renderPassInfo.dependencyCount = static_cast<uint32_t>(m_curRenderPassInfo.subpassDependencies.size());
 			renderPassInfo.pDependencies = m_curRenderPassInfo.subpassDependencies.data();
 
-			if (vkCreateRenderPass(m_device, &renderPassInfo, nullptr, m_renderPasses[m_curRenderPassName].replace()) != VK_SUCCESS)
+			uint32_t shadingRateSubpasses = 0;
+			bool hasDepthResolve = false;
+			for (size_t i = 0; i < m_curRenderPassInfo.subpassInfos.size(); ++i)
+			{
+				if (m_curRenderPassInfo.subpassInfos[i].shadingRateAttachmentRef.attachment != VK_ATTACHMENT_UNUSED) shadingRateSubpasses |= 1u << i;
+				if (m_curRenderPassInfo.subpassInfos[i].depthResolveAttachmentRef.attachment != VK_ATTACHMENT_UNUSED) hasDepthResolve = true;
+			}
+
+			// Shading rate and depth resolve attachments can only be given to vkCreateRenderPass2
+			const VkResult result = shadingRateSubpasses != 0 || hasDepthResolve ? createRenderPass2(m_curRenderPassInfo, m_renderPasses[m_curRenderPassName].replace()) :
+				vkCreateRenderPass(m_device, &renderPassInfo, helper_functions::getHostAllocationCallbacks(), m_renderPasses[m_curRenderPassName].replace());
+			if (result != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create render pass!");
 			}
+			m_renderPassCompatibilityHashes[m_curRenderPassName] = hashRenderPassCompatibility(m_curRenderPassInfo);
+			m_renderPassShadingRateSubpasses[m_curRenderPassName] = shadingRateSubpasses;
+			m_renderPassTraffic[m_curRenderPassName] = getAttachmentTraffic(m_curRenderPassInfo);
+			if (isDebugUtilsEnabled())
+			{
+				m_renderPassDebugNames[m_curRenderPassName] = debugName.empty() ? "Render pass " + std::to_string(m_curRenderPassName) : debugName;
+				setObjectDebugName(VK_OBJECT_TYPE_RENDER_PASS, VkRenderPass(m_renderPasses[m_curRenderPassName]), m_renderPassDebugNames[m_curRenderPassName]);
+			}
 
 			m_curRenderPassInfo = {};
 			return m_curRenderPassName;
@@ -407,23 +774,29 @@ namespace rj
 		void destroyRenderPass(uint32_t renderPassName)
 		{
 			assert(renderPassName < m_renderPasses.size());
-			assert(std::find(m_availableRenderPassNames.begin(), m_availableRenderPassNames.end(), renderPassName) == m_availableRenderPassNames.end());
+			assert(m_renderPassNames.isAlive(renderPassName));
 
-			m_availableRenderPassNames.push_back(renderPassName);
+			retireName(m_renderPassNames, renderPassName);
 		}
 		// --- Render pass related ---
 
 		// --- Descriptor set layout creation ---
-		void beginCreateDescriptorSetLayout()
+		// VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR in @flags needs isPushDescriptorEnabled()
+		void beginCreateDescriptorSetLayout(VkDescriptorSetLayoutCreateFlags flags = 0)
 		{
+			assert(!(flags & VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR) || isPushDescriptorEnabled());
 			m_curSetLayoutInfo = {};
+			m_curSetLayoutInfo.flags = flags;
 			m_curSetLayoutName = static_cast<uint32_t>(m_descriptorSetLayouts.size());
 			m_descriptorSetLayouts[m_curSetLayoutName] = VDeleter<VkDescriptorSetLayout>{ m_device, vkDestroyDescriptorSetLayout };
 		}
 
+		// Non-zero @bindingFlags need isDescriptorIndexingEnabled()
 		void setLayoutAddBinding(uint32_t bindingPoint, VkDescriptorType type, VkShaderStageFlags shaderStages,
-			uint32_t count = 1, const std::vector<uint32_t> &immutableSamplerNames = {})
+			uint32_t count = 1, const std::vector<uint32_t> &immutableSamplerNames = {}, VkDescriptorBindingFlagsEXT bindingFlags = 0)
 		{
+			assert(bindingFlags == 0 || isDescriptorIndexingEnabled());
+			m_curSetLayoutInfo.bindingFlags.push_back(bindingFlags);
 			m_curSetLayoutInfo.bindings.push_back({});
 			VkDescriptorSetLayoutBinding &binding = m_curSetLayoutInfo.bindings.back();
 			m_curSetLayoutInfo.immutableSamplers.push_back({});
@@ -460,10 +833,21 @@ namespace rj
 		{
 			VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			layoutInfo.flags = m_curSetLayoutInfo.flags;
 			layoutInfo.bindingCount = static_cast<uint32_t>(m_curSetLayoutInfo.bindings.size());
 			layoutInfo.pBindings = m_curSetLayoutInfo.bindings.data();
 
-			if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, m_descriptorSetLayouts[m_curSetLayoutName].replace()) != VK_SUCCESS)
+			VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo = {};
+			flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+			flagsInfo.bindingCount = static_cast<uint32_t>(m_curSetLayoutInfo.bindingFlags.size());
+			flagsInfo.pBindingFlags = m_curSetLayoutInfo.bindingFlags.data();
+			const auto &flags = m_curSetLayoutInfo.bindingFlags;
+			if (std::any_of(flags.begin(), flags.end(), [](VkDescriptorBindingFlagsEXT f) { return f != 0; }))
+			{
+				layoutInfo.pNext = &flagsInfo;
+			}
+
+			if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, helper_functions::getHostAllocationCallbacks(), m_descriptorSetLayouts[m_curSetLayoutName].replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create descriptor set layout!");
 			}
@@ -478,16 +862,14 @@ namespace rj
 		{
 			m_curPipelineLayoutInfo = {};
 
-			if (!m_availablePipelineLayoutNames.empty())
-			{
-				m_curPipelineLayoutName = m_availablePipelineLayoutNames.back();
-				m_availablePipelineLayoutNames.pop_back();
-			}
-			else
+			m_curPipelineLayoutName = m_pipelineLayoutNames.allocate();
+			if (m_curPipelineLayoutName == m_pipelineLayouts.size())
 			{
-				m_curPipelineLayoutName = static_cast<uint32_t>(m_pipelineLayouts.size());
 				m_pipelineLayouts.emplace_back(m_device, vkDestroyPipelineLayout);
+				m_pipelineLayoutSerials.push_back(0);
 			}
+			// A name reused for a different layout must not match the pipelines of the old one
+			m_pipelineLayoutSerials[m_curPipelineLayoutName] = ++m_pipelineLayoutSerial;
 		}
 
 		void pipelineLayoutAddDescriptorSetLayouts(const std::vector<uint32_t> &setLayoutNames)
@@ -535,7 +917,7 @@ namespace rj
 			info.pushConstantRangeCount = static_cast<uint32_t>(m_curPipelineLayoutInfo.pushConstantRanges.size());
 			info.pPushConstantRanges = m_curPipelineLayoutInfo.pushConstantRanges.data();
 
-			if (vkCreatePipelineLayout(m_device, &info, nullptr, m_pipelineLayouts[m_curPipelineLayoutName].replace()) != VK_SUCCESS)
+			if (vkCreatePipelineLayout(m_device, &info, helper_functions::getHostAllocationCallbacks(), m_pipelineLayouts[m_curPipelineLayoutName].replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create lighting pipeline layout!");
 			}
@@ -547,9 +929,9 @@ namespace rj
 		void destroyPipelineLayout(uint32_t pipelineLayoutName)
 		{
 			assert(pipelineLayoutName < m_pipelineLayouts.size());
-			assert(std::find(m_availablePipelineLayoutNames.begin(), m_availablePipelineLayoutNames.end(), pipelineLayoutName) == m_availablePipelineLayoutNames.end());
+			assert(m_pipelineLayoutNames.isAlive(pipelineLayoutName));
 
-			m_availablePipelineLayoutNames.push_back(pipelineLayoutName);
+			retireName(m_pipelineLayoutNames, pipelineLayoutName);
 		}
 		// --- Pipeline layouts related ---
 
@@ -557,30 +939,33 @@ namespace rj
 		void beginCreateGraphicsPipeline(uint32_t layoutName, uint32_t renderPassName, uint32_t subpassIdx,
 			uint32_t basePipelineName = std::numeric_limits<uint32_t>::max(), VkPipelineCreateFlags flags = 0)
 		{
-			m_curGraphicsPipelineInfo = GraphicsPipelineCreateInfo{};
+			m_pCurGraphicsPipelineInfo.reset(new GraphicsPipelineCreateInfo{});
+			m_curPipelineLayoutSerial = m_pipelineLayoutSerials[layoutName];
+			m_curPipelineRenderPassHash = m_renderPassCompatibilityHashes[renderPassName];
 
-			if (!m_availablePipelineNames.empty())
-			{
-				m_curPipelineName = m_availablePipelineNames.back();
-				m_availablePipelineNames.pop_back();
-			}
-			else
-			{
-				m_curPipelineName = static_cast<uint32_t>(m_pipelines.size());
-				m_pipelines.emplace_back(m_device, vkDestroyPipeline);
-			}
-
-			auto &pipelineInfo = m_curGraphicsPipelineInfo.pipelineInfo;
+			auto &pipelineInfo = m_pCurGraphicsPipelineInfo->pipelineInfo;
 			pipelineInfo.flags = flags;
 			pipelineInfo.layout = m_pipelineLayouts[layoutName];
 			pipelineInfo.renderPass = m_renderPasses[renderPassName];
 			pipelineInfo.subpass = subpassIdx;
 
+			// Keep the 1x1 pipeline rate unless the attachment asks for a coarser one
+			if (m_renderPassShadingRateSubpasses[renderPassName] & (1u << subpassIdx))
+			{
+				auto &shadingRateInfo = m_pCurGraphicsPipelineInfo->shadingRateInfo;
+				shadingRateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_FRAGMENT_SHADING_RATE_STATE_CREATE_INFO_KHR;
+				shadingRateInfo.fragmentSize = { 1, 1 };
+				shadingRateInfo.combinerOps[0] = VK_FRAGMENT_SHADING_RATE_COMBINER_OP_KEEP_KHR;
+				shadingRateInfo.combinerOps[1] = VK_FRAGMENT_SHADING_RATE_COMBINER_OP_REPLACE_KHR;
+				pipelineInfo.pNext = &shadingRateInfo;
+			}
+
 			pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 			if (flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT)
 			{
 				if (basePipelineName < m_pipelines.size() &&
-					std::find(m_availablePipelineNames.begin(), m_availablePipelineNames.end(), basePipelineName) == m_availablePipelineNames.end())
+					m_pipelineNames.isAlive(basePipelineName) &&
+					!isGraphicsPipelinePending(basePipelineName))
 				{
 					pipelineInfo.basePipelineHandle = m_pipelines[basePipelineName];
 					pipelineInfo.basePipelineIndex = -1;
@@ -594,10 +979,15 @@ namespace rj
 
 		void graphicsPipelineAddShaderStage(VkShaderStageFlagBits stage, const std::string &spvFileName, VkPipelineShaderStageCreateFlags flags = 0)
 		{
-			auto shaderByteCode = readFile(spvFileName);
+			VkShaderModule module = getShaderModule(spvFileName);
+			if (isDebugUtilsEnabled())
+			{
+				auto &debugName = m_pCurGraphicsPipelineInfo->debugName;
+				debugName += (debugName.empty() ? "" : " + ") + spvFileName;
+			}
 
-			m_curGraphicsPipelineInfo.shaderStages.push_back({});
-			VkPipelineShaderStageCreateInfo &shaderStageInfo = m_curGraphicsPipelineInfo.shaderStages.back();
+			m_pCurGraphicsPipelineInfo->shaderStages.push_back({});
+			VkPipelineShaderStageCreateInfo &shaderStageInfo = m_pCurGraphicsPipelineInfo->shaderStages.back();
 			shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 			shaderStageInfo.stage = stage;
 			shaderStageInfo.pName = "main";
@@ -606,44 +996,47 @@ namespace rj
 			switch (stage)
 			{
 			case VK_SHADER_STAGE_VERTEX_BIT:
-				m_curGraphicsPipelineInfo.vertShaderModule = VDeleter<VkShaderModule>{ m_device, vkDestroyShaderModule };
-				createShaderModule(m_curGraphicsPipelineInfo.vertShaderModule, m_device, shaderByteCode);
-				shaderStageInfo.module = m_curGraphicsPipelineInfo.vertShaderModule;
+				m_pCurGraphicsPipelineInfo->vertShaderModule = module;
+				shaderStageInfo.module = m_pCurGraphicsPipelineInfo->vertShaderModule;
 				break;
 			case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
-				m_curGraphicsPipelineInfo.hullShaderModule = VDeleter<VkShaderModule>{ m_device, vkDestroyShaderModule };
-				createShaderModule(m_curGraphicsPipelineInfo.hullShaderModule, m_device, shaderByteCode);
-				shaderStageInfo.module = m_curGraphicsPipelineInfo.hullShaderModule;
+				m_pCurGraphicsPipelineInfo->hullShaderModule = module;
+				shaderStageInfo.module = m_pCurGraphicsPipelineInfo->hullShaderModule;
 				break;
 			case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
-				m_curGraphicsPipelineInfo.domainShaderModule = VDeleter<VkShaderModule>{ m_device, vkDestroyShaderModule };
-				createShaderModule(m_curGraphicsPipelineInfo.domainShaderModule, m_device, shaderByteCode);
-				shaderStageInfo.module = m_curGraphicsPipelineInfo.domainShaderModule;
+				m_pCurGraphicsPipelineInfo->domainShaderModule = module;
+				shaderStageInfo.module = m_pCurGraphicsPipelineInfo->domainShaderModule;
 				break;
 			case VK_SHADER_STAGE_GEOMETRY_BIT:
-				m_curGraphicsPipelineInfo.geomShaderModule = VDeleter<VkShaderModule>{ m_device, vkDestroyShaderModule };
-				createShaderModule(m_curGraphicsPipelineInfo.geomShaderModule, m_device, shaderByteCode);
-				shaderStageInfo.module = m_curGraphicsPipelineInfo.geomShaderModule;
+				m_pCurGraphicsPipelineInfo->geomShaderModule = module;
+				shaderStageInfo.module = m_pCurGraphicsPipelineInfo->geomShaderModule;
+				break;
+			case VK_SHADER_STAGE_TASK_BIT_EXT:
+				m_pCurGraphicsPipelineInfo->taskShaderModule = module;
+				shaderStageInfo.module = m_pCurGraphicsPipelineInfo->taskShaderModule;
+				break;
+			case VK_SHADER_STAGE_MESH_BIT_EXT:
+				m_pCurGraphicsPipelineInfo->meshShaderModule = module;
+				shaderStageInfo.module = m_pCurGraphicsPipelineInfo->meshShaderModule;
 				break;
 			case VK_SHADER_STAGE_FRAGMENT_BIT:
-				m_curGraphicsPipelineInfo.fragShaderModule = VDeleter<VkShaderModule>{ m_device, vkDestroyShaderModule };
-				createShaderModule(m_curGraphicsPipelineInfo.fragShaderModule, m_device, shaderByteCode);
-				shaderStageInfo.module = m_curGraphicsPipelineInfo.fragShaderModule;
+				m_pCurGraphicsPipelineInfo->fragShaderModule = module;
+				shaderStageInfo.module = m_pCurGraphicsPipelineInfo->fragShaderModule;
 				break;
 			default:
 				throw std::runtime_error("unknown graphics shader stage");
 			}
 
-			m_curGraphicsPipelineInfo.pipelineInfo.stageCount = static_cast<uint32_t>(m_curGraphicsPipelineInfo.shaderStages.size());
-			m_curGraphicsPipelineInfo.pipelineInfo.pStages = m_curGraphicsPipelineInfo.shaderStages.data();
+			m_pCurGraphicsPipelineInfo->pipelineInfo.stageCount = static_cast<uint32_t>(m_pCurGraphicsPipelineInfo->shaderStages.size());
+			m_pCurGraphicsPipelineInfo->pipelineInfo.pStages = m_pCurGraphicsPipelineInfo->shaderStages.data();
 		}
 
 		void graphicsPipelineAddSpecializationConstant(VkShaderStageFlagBits stage,
 			uint32_t constantID, uint32_t offset, uint32_t size, void *srcData)
 		{
-			auto checkShaderModule = [](const VDeleter<VkShaderModule> &module)
+			auto checkShaderModule = [](VkShaderModule module)
 			{
-				if (!module.isvalid())
+				if (module == VK_NULL_HANDLE)
 				{
 					throw std::runtime_error("try to add specialization constant to shader stage but the stage doesn't exist");
 				}
@@ -659,34 +1052,34 @@ namespace rj
 			switch (stage)
 			{
 			case VK_SHADER_STAGE_VERTEX_BIT:
-				checkShaderModule(m_curGraphicsPipelineInfo.vertShaderModule);
-				mapEntries = &m_curGraphicsPipelineInfo.vertSpecializationMapEntries;
-				data = &m_curGraphicsPipelineInfo.vertSpecializationData;
-				specializationInfo = &m_curGraphicsPipelineInfo.vertSpecializationInfo;
+				checkShaderModule(m_pCurGraphicsPipelineInfo->vertShaderModule);
+				mapEntries = &m_pCurGraphicsPipelineInfo->vertSpecializationMapEntries;
+				data = &m_pCurGraphicsPipelineInfo->vertSpecializationData;
+				specializationInfo = &m_pCurGraphicsPipelineInfo->vertSpecializationInfo;
 				break;
 			case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
-				checkShaderModule(m_curGraphicsPipelineInfo.hullShaderModule);
-				mapEntries = &m_curGraphicsPipelineInfo.hullSpecializationMapEntries;
-				data = &m_curGraphicsPipelineInfo.hullSpecializationData;
-				specializationInfo = &m_curGraphicsPipelineInfo.hullSpecializationInfo;
+				checkShaderModule(m_pCurGraphicsPipelineInfo->hullShaderModule);
+				mapEntries = &m_pCurGraphicsPipelineInfo->hullSpecializationMapEntries;
+				data = &m_pCurGraphicsPipelineInfo->hullSpecializationData;
+				specializationInfo = &m_pCurGraphicsPipelineInfo->hullSpecializationInfo;
 				break;
 			case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
-				checkShaderModule(m_curGraphicsPipelineInfo.domainShaderModule);
-				mapEntries = &m_curGraphicsPipelineInfo.domainSpecializationMapEntries;
-				data = &m_curGraphicsPipelineInfo.domainSpecializationData;
-				specializationInfo = &m_curGraphicsPipelineInfo.domainSpecializationInfo;
+				checkShaderModule(m_pCurGraphicsPipelineInfo->domainShaderModule);
+				mapEntries = &m_pCurGraphicsPipelineInfo->domainSpecializationMapEntries;
+				data = &m_pCurGraphicsPipelineInfo->domainSpecializationData;
+				specializationInfo = &m_pCurGraphicsPipelineInfo->domainSpecializationInfo;
 				break;
 			case VK_SHADER_STAGE_GEOMETRY_BIT:
-				checkShaderModule(m_curGraphicsPipelineInfo.geomShaderModule);
-				mapEntries = &m_curGraphicsPipelineInfo.geomSpecializationMapEntries;
-				data = &m_curGraphicsPipelineInfo.geomSpecializationData;
-				specializationInfo = &m_curGraphicsPipelineInfo.geomSpecializationInfo;
+				checkShaderModule(m_pCurGraphicsPipelineInfo->geomShaderModule);
+				mapEntries = &m_pCurGraphicsPipelineInfo->geomSpecializationMapEntries;
+				data = &m_pCurGraphicsPipelineInfo->geomSpecializationData;
+				specializationInfo = &m_pCurGraphicsPipelineInfo->geomSpecializationInfo;
 				break;
 			case VK_SHADER_STAGE_FRAGMENT_BIT:
-				checkShaderModule(m_curGraphicsPipelineInfo.fragShaderModule);
-				mapEntries = &m_curGraphicsPipelineInfo.fragSpecializationMapEntries;
-				data = &m_curGraphicsPipelineInfo.fragSpecializationData;
-				specializationInfo = &m_curGraphicsPipelineInfo.fragSpecializationInfo;
+				checkShaderModule(m_pCurGraphicsPipelineInfo->fragShaderModule);
+				mapEntries = &m_pCurGraphicsPipelineInfo->fragSpecializationMapEntries;
+				data = &m_pCurGraphicsPipelineInfo->fragSpecializationData;
+				specializationInfo = &m_pCurGraphicsPipelineInfo->fragSpecializationInfo;
 				break;
 			default:
 				throw std::runtime_error("unknown shader stage");
@@ -710,7 +1103,7 @@ namespace rj
 			specializationInfo->pData = data->data();
 
 			VkPipelineShaderStageCreateInfo *shaderStageInfo = nullptr;
-			for (auto &ss : m_curGraphicsPipelineInfo.shaderStages)
+			for (auto &ss : m_pCurGraphicsPipelineInfo->shaderStages)
 			{
 				if (ss.stage == stage)
 				{
@@ -722,38 +1115,38 @@ namespace rj
 
 		void graphicsPipelineAddBindingDescription(uint32_t binding, uint32_t stride, VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX)
 		{
-			m_curGraphicsPipelineInfo.viBindingDescs.push_back({});
-			VkVertexInputBindingDescription &bindingDesc = m_curGraphicsPipelineInfo.viBindingDescs.back();
+			m_pCurGraphicsPipelineInfo->viBindingDescs.push_back({});
+			VkVertexInputBindingDescription &bindingDesc = m_pCurGraphicsPipelineInfo->viBindingDescs.back();
 
 			bindingDesc.binding = binding;
 			bindingDesc.stride = stride;
 			bindingDesc.inputRate = inputRate;
 
-			m_curGraphicsPipelineInfo.vertexInputInfo.vertexBindingDescriptionCount =
-				static_cast<uint32_t>(m_curGraphicsPipelineInfo.viBindingDescs.size());
-			m_curGraphicsPipelineInfo.vertexInputInfo.pVertexBindingDescriptions =
-				m_curGraphicsPipelineInfo.viBindingDescs.data();
+			m_pCurGraphicsPipelineInfo->vertexInputInfo.vertexBindingDescriptionCount =
+				static_cast<uint32_t>(m_pCurGraphicsPipelineInfo->viBindingDescs.size());
+			m_pCurGraphicsPipelineInfo->vertexInputInfo.pVertexBindingDescriptions =
+				m_pCurGraphicsPipelineInfo->viBindingDescs.data();
 		}
 
 		void graphicsPipelineAddAttributeDescription(uint32_t location, uint32_t binding, VkFormat format, uint32_t offset)
 		{
-			m_curGraphicsPipelineInfo.viAttrDescs.push_back({});
-			auto &attrDesc = m_curGraphicsPipelineInfo.viAttrDescs.back();
+			m_pCurGraphicsPipelineInfo->viAttrDescs.push_back({});
+			auto &attrDesc = m_pCurGraphicsPipelineInfo->viAttrDescs.back();
 
 			attrDesc.location = location;
 			attrDesc.binding = binding;
 			attrDesc.format = format;
 			attrDesc.offset = offset;
 
-			m_curGraphicsPipelineInfo.vertexInputInfo.vertexAttributeDescriptionCount =
-				static_cast<uint32_t>(m_curGraphicsPipelineInfo.viAttrDescs.size());
-			m_curGraphicsPipelineInfo.vertexInputInfo.pVertexAttributeDescriptions =
-				m_curGraphicsPipelineInfo.viAttrDescs.data();
+			m_pCurGraphicsPipelineInfo->vertexInputInfo.vertexAttributeDescriptionCount =
+				static_cast<uint32_t>(m_pCurGraphicsPipelineInfo->viAttrDescs.size());
+			m_pCurGraphicsPipelineInfo->vertexInputInfo.pVertexAttributeDescriptions =
+				m_pCurGraphicsPipelineInfo->viAttrDescs.data();
 		}
 
 		void graphicsPipelineConfigureInputAssembly(VkPrimitiveTopology topology, VkBool32 enablePrimitiveRestart = VK_FALSE, VkPipelineInputAssemblyStateCreateFlags flags = 0)
 		{
-			auto &info = m_curGraphicsPipelineInfo.inputAssemblyInfo;
+			auto &info = m_pCurGraphicsPipelineInfo->inputAssemblyInfo;
 
 			info.topology = topology;
 			info.primitiveRestartEnable = enablePrimitiveRestart;
@@ -762,7 +1155,7 @@ namespace rj
 
 		void graphicsPipelineConfigureTessellationState(uint32_t numCPsPerPatch, VkPipelineTessellationStateCreateFlags flags = 0)
 		{
-			auto &info = m_curGraphicsPipelineInfo.tessellationInfo;
+			auto &info = m_pCurGraphicsPipelineInfo->tessellationInfo;
 
 			info.patchControlPoints = numCPsPerPatch;
 			info.flags = flags;
@@ -777,8 +1170,8 @@ namespace rj
 				throw std::invalid_argument("invalid arguments to graphicsPipelineAddViewportAndScissor");
 			}
 
-			m_curGraphicsPipelineInfo.viewports.push_back({});
-			auto &viewport = m_curGraphicsPipelineInfo.viewports.back();
+			m_pCurGraphicsPipelineInfo->viewports.push_back({});
+			auto &viewport = m_pCurGraphicsPipelineInfo->viewports.back();
 
 			viewport.x = viewportX;
 			viewport.y = viewportY;
@@ -787,8 +1180,8 @@ namespace rj
 			viewport.minDepth = minDepth;
 			viewport.maxDepth = maxDepth;
 
-			m_curGraphicsPipelineInfo.scissors.push_back({});
-			auto &scissor = m_curGraphicsPipelineInfo.scissors.back();
+			m_pCurGraphicsPipelineInfo->scissors.push_back({});
+			auto &scissor = m_pCurGraphicsPipelineInfo->scissors.back();
 
 			if (coverEntireViewport)
 			{
@@ -803,11 +1196,11 @@ namespace rj
 				scissor.extent = { scissorWidth, scissorHeight };
 			}
 
-			auto &info = m_curGraphicsPipelineInfo.viewportStateInfo;
-			info.viewportCount = static_cast<uint32_t>(m_curGraphicsPipelineInfo.viewports.size());
-			info.pViewports = m_curGraphicsPipelineInfo.viewports.data();
-			info.scissorCount = static_cast<uint32_t>(m_curGraphicsPipelineInfo.scissors.size());
-			info.pScissors = m_curGraphicsPipelineInfo.scissors.data();
+			auto &info = m_pCurGraphicsPipelineInfo->viewportStateInfo;
+			info.viewportCount = static_cast<uint32_t>(m_pCurGraphicsPipelineInfo->viewports.size());
+			info.pViewports = m_pCurGraphicsPipelineInfo->viewports.data();
+			info.scissorCount = static_cast<uint32_t>(m_pCurGraphicsPipelineInfo->scissors.size());
+			info.pScissors = m_pCurGraphicsPipelineInfo->scissors.data();
 		}
 
 		void graphicsPipelineConfigureRasterizer(VkPolygonMode polygonMode, VkCullModeFlags cullMode, VkFrontFace frontFace, float lineWidth = 1.f,
@@ -815,7 +1208,7 @@ namespace rj
 			VkBool32 depthClampEnable = VK_FALSE, float depthBiasClamp = 0.f,
 			VkBool32 rasterizerDiscardEnable = VK_FALSE, VkPipelineRasterizationStateCreateFlags flags = 0)
 		{
-			auto &info = m_curGraphicsPipelineInfo.rasterizerInfo;
+			auto &info = m_pCurGraphicsPipelineInfo->rasterizerInfo;
 
 			info.polygonMode = polygonMode;
 			info.cullMode = cullMode;
@@ -834,16 +1227,16 @@ namespace rj
 			const std::vector<VkSampleMask> &sampleMask = {}, VkBool32 alphaToCoverageEnable = VK_FALSE, VkBool32 alphaToOneEnable = VK_FALSE,
 			VkPipelineMultisampleStateCreateFlags flags = 0)
 		{
-			auto &info = m_curGraphicsPipelineInfo.multisamplingInfo;
+			auto &info = m_pCurGraphicsPipelineInfo->multisamplingInfo;
 
 			info.rasterizationSamples = sampleCount;
 			info.sampleShadingEnable = perSampleShading;
 			info.minSampleShading = minSampleShadingFraction;
-			m_curGraphicsPipelineInfo.sampleMask = sampleMask;
+			m_pCurGraphicsPipelineInfo->sampleMask = sampleMask;
 			info.pSampleMask = nullptr;
 			if (!sampleMask.empty())
 			{
-				info.pSampleMask = m_curGraphicsPipelineInfo.sampleMask.data();
+				info.pSampleMask = m_pCurGraphicsPipelineInfo->sampleMask.data();
 			}
 			info.alphaToCoverageEnable = alphaToCoverageEnable;
 			info.alphaToOneEnable = alphaToOneEnable;
@@ -852,7 +1245,7 @@ namespace rj
 		void graphicsPipelineConfigureDepthState(VkBool32 depthTestEnable, VkBool32 depthWriteEnable, VkCompareOp depthCompareOp,
 			VkBool32 depthBoundsTestEnable = VK_FALSE, float minDepthBounds = 0.f, float maxDepthBounds = 1.f)
 		{
-			auto &info = m_curGraphicsPipelineInfo.depthStencilInfo;
+			auto &info = m_pCurGraphicsPipelineInfo->depthStencilInfo;
 
 			info.depthTestEnable = depthTestEnable;
 			info.depthWriteEnable = depthWriteEnable;
@@ -867,7 +1260,7 @@ namespace rj
 			uint32_t reference, uint32_t compareMask = 0xffffffff, uint32_t writeMask = 0xffffffff,
 			bool frontOp = true)
 		{
-			auto &info = m_curGraphicsPipelineInfo.depthStencilInfo;
+			auto &info = m_pCurGraphicsPipelineInfo->depthStencilInfo;
 			auto &stencilOpState = frontOp ? info.front : info.back;
 
 			info.stencilTestEnable = stencilTestEnable;
@@ -885,7 +1278,7 @@ namespace rj
 		// For floating point attachments, fragment outputs are pass through without modification.
 		void graphicsPipelineConfigureLogicOp(VkBool32 logicOpEnable, VkLogicOp logicOp)
 		{
-			auto &info = m_curGraphicsPipelineInfo.colorBlendInfo;
+			auto &info = m_pCurGraphicsPipelineInfo->colorBlendInfo;
 
 			info.logicOpEnable = logicOpEnable;
 			info.logicOp = logicOp;
@@ -897,8 +1290,8 @@ namespace rj
 			VkBlendFactor srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA, VkBlendFactor dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO, VkBlendOp alphaBlendOp = VK_BLEND_OP_ADD,
 			VkColorComponentFlags colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT)
 		{
-			m_curGraphicsPipelineInfo.colorBlendAttachmentStates.push_back({});
-			VkPipelineColorBlendAttachmentState &info = m_curGraphicsPipelineInfo.colorBlendAttachmentStates.back();
+			m_pCurGraphicsPipelineInfo->colorBlendAttachmentStates.push_back({});
+			VkPipelineColorBlendAttachmentState &info = m_pCurGraphicsPipelineInfo->colorBlendAttachmentStates.back();
 
 			info.blendEnable = blendEnable;
 			info.srcColorBlendFactor = srcColorBlendFactor;
@@ -909,15 +1302,15 @@ namespace rj
 			info.alphaBlendOp = alphaSameAsColor ? colorBlendOp : alphaBlendOp;
 			info.colorWriteMask = colorWriteMask;
 
-			m_curGraphicsPipelineInfo.colorBlendInfo.attachmentCount =
-				static_cast<uint32_t>(m_curGraphicsPipelineInfo.colorBlendAttachmentStates.size());
-			m_curGraphicsPipelineInfo.colorBlendInfo.pAttachments =
-				m_curGraphicsPipelineInfo.colorBlendAttachmentStates.data();
+			m_pCurGraphicsPipelineInfo->colorBlendInfo.attachmentCount =
+				static_cast<uint32_t>(m_pCurGraphicsPipelineInfo->colorBlendAttachmentStates.size());
+			m_pCurGraphicsPipelineInfo->colorBlendInfo.pAttachments =
+				m_pCurGraphicsPipelineInfo->colorBlendAttachmentStates.data();
 		}
 
 		void graphicsPipelineSetBlendConstant(float R, float G, float B, float A)
 		{
-			float *bc = m_curGraphicsPipelineInfo.colorBlendInfo.blendConstants;
+			float *bc = m_pCurGraphicsPipelineInfo->colorBlendInfo.blendConstants;
 			bc[0] = R;
 			bc[1] = G;
 			bc[2] = B;
@@ -926,62 +1319,207 @@ namespace rj
 
 		void graphicsPipelineAddDynamicState(VkDynamicState dynamicState)
 		{
-			m_curGraphicsPipelineInfo.dynamicStates.push_back(dynamicState);
-			m_curGraphicsPipelineInfo.dynamicStateInfo.dynamicStateCount = static_cast<uint32_t>(m_curGraphicsPipelineInfo.dynamicStates.size());
-			m_curGraphicsPipelineInfo.dynamicStateInfo.pDynamicStates = m_curGraphicsPipelineInfo.dynamicStates.data();
+			m_pCurGraphicsPipelineInfo->dynamicStates.push_back(dynamicState);
+			m_pCurGraphicsPipelineInfo->dynamicStateInfo.dynamicStateCount = static_cast<uint32_t>(m_pCurGraphicsPipelineInfo->dynamicStates.size());
+			m_pCurGraphicsPipelineInfo->dynamicStateInfo.pDynamicStates = m_pCurGraphicsPipelineInfo->dynamicStates.data();
 		}
 
 		uint32_t endCreateGraphicsPipeline()
 		{
-			auto &info = m_curGraphicsPipelineInfo.pipelineInfo;
+			auto &info = m_pCurGraphicsPipelineInfo->pipelineInfo;
 
-			info.stageCount = static_cast<uint32_t>(m_curGraphicsPipelineInfo.shaderStages.size());
-			info.pStages = m_curGraphicsPipelineInfo.shaderStages.data();
-			info.pVertexInputState = &m_curGraphicsPipelineInfo.vertexInputInfo;
-			info.pInputAssemblyState = &m_curGraphicsPipelineInfo.inputAssemblyInfo;
+			info.stageCount = static_cast<uint32_t>(m_pCurGraphicsPipelineInfo->shaderStages.size());
+			info.pStages = m_pCurGraphicsPipelineInfo->shaderStages.data();
+			info.pVertexInputState = &m_pCurGraphicsPipelineInfo->vertexInputInfo;
+			info.pInputAssemblyState = &m_pCurGraphicsPipelineInfo->inputAssemblyInfo;
 			info.pTessellationState = nullptr;
-			if (m_curGraphicsPipelineInfo.tessellationInfo.patchControlPoints > 0)
+			if (m_pCurGraphicsPipelineInfo->tessellationInfo.patchControlPoints > 0)
+			{
+				info.pTessellationState = &m_pCurGraphicsPipelineInfo->tessellationInfo;
+			}
+			info.pViewportState = &m_pCurGraphicsPipelineInfo->viewportStateInfo;
+			info.pRasterizationState = &m_pCurGraphicsPipelineInfo->rasterizerInfo;
+			info.pMultisampleState = &m_pCurGraphicsPipelineInfo->multisamplingInfo;
+			info.pDepthStencilState = &m_pCurGraphicsPipelineInfo->depthStencilInfo;
+			if (!m_pCurGraphicsPipelineInfo->colorBlendAttachmentStates.empty())
 			{
-				info.pTessellationState = &m_curGraphicsPipelineInfo.tessellationInfo;
+				info.pColorBlendState = &m_pCurGraphicsPipelineInfo->colorBlendInfo;
 			}
-			info.pViewportState = &m_curGraphicsPipelineInfo.viewportStateInfo;
-			info.pRasterizationState = &m_curGraphicsPipelineInfo.rasterizerInfo;
-			info.pMultisampleState = &m_curGraphicsPipelineInfo.multisamplingInfo;
-			info.pDepthStencilState = &m_curGraphicsPipelineInfo.depthStencilInfo;
-			if (!m_curGraphicsPipelineInfo.colorBlendAttachmentStates.empty())
+			if (!m_pCurGraphicsPipelineInfo->dynamicStates.empty())
 			{
-				info.pColorBlendState = &m_curGraphicsPipelineInfo.colorBlendInfo;
+				info.pDynamicState = &m_pCurGraphicsPipelineInfo->dynamicStateInfo;
 			}
-			if (!m_curGraphicsPipelineInfo.dynamicStates.empty())
+
+			const uint64_t stateHash = hashGraphicsPipelineState(*m_pCurGraphicsPipelineInfo);
+			if (findRegisteredPipeline(stateHash, &m_curPipelineName))
+			{
+				m_pCurGraphicsPipelineInfo.reset();
+				return m_curPipelineName;
+			}
+			m_curPipelineName = registerPipeline(stateHash);
+
+			if (m_recordingGraphicsPipelineBatch)
 			{
-				info.pDynamicState = &m_curGraphicsPipelineInfo.dynamicStateInfo;
+				m_pendingGraphicsPipelines.push_back({ m_curPipelineName, std::move(m_pCurGraphicsPipelineInfo) });
+				return m_curPipelineName;
 			}
 
-			if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &info, nullptr, m_pipelines[m_curPipelineName].replace()) != VK_SUCCESS)
+			if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &info, helper_functions::getHostAllocationCallbacks(), m_pipelines[m_curPipelineName].replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create pipeline!");
 			}
+			setPipelineDebugName(m_curPipelineName, m_pCurGraphicsPipelineInfo->debugName);
+			m_pCurGraphicsPipelineInfo.reset();
 
 			return m_curPipelineName;
 		}
+
+		// Graphics pipelines ended between beginGraphicsPipelineBatch() and endGraphicsPipelineBatch() are only recorded.
+		// Their names are returned right away, but the pipelines are not usable until endGraphicsPipelineBatch() returns.
+		void beginGraphicsPipelineBatch()
+		{
+			assert(!m_recordingGraphicsPipelineBatch);
+			m_recordingGraphicsPipelineBatch = true;
+		}
+
+		// Compile every recorded pipeline against the shared pipeline cache on @threadCount threads (hardware concurrency if 0).
+		// The recording itself stays single threaded, only vkCreateGraphicsPipelines runs in parallel.
+		void endGraphicsPipelineBatch(uint32_t threadCount = 0)
+		{
+			assert(m_recordingGraphicsPipelineBatch);
+			m_recordingGraphicsPipelineBatch = false;
+
+			std::vector<PendingGraphicsPipeline> batch;
+			batch.swap(m_pendingGraphicsPipelines);
+			if (batch.empty()) return;
+
+			if (threadCount == 0)
+			{
+				threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+			}
+			threadCount = std::min(threadCount, static_cast<uint32_t>(batch.size()));
+
+			// m_pipelines is not resized while the workers run, so each of them can write its own element
+			std::atomic<size_t> nextPipeline{ 0 };
+			std::atomic<bool> failed{ false };
+			auto worker = [&]()
+			{
+				for (size_t i = nextPipeline++; i < batch.size(); i = nextPipeline++)
+				{
+					if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &batch[i].pInfo->pipelineInfo, helper_functions::getHostAllocationCallbacks(),
+						m_pipelines[batch[i].name].replace()) != VK_SUCCESS)
+					{
+						failed = true;
+					}
+				}
+			};
+
+			std::vector<std::thread> workers;
+			for (uint32_t i = 1; i < threadCount; ++i)
+			{
+				workers.emplace_back(worker);
+			}
+			worker();
+			for (auto &w : workers)
+			{
+				w.join();
+			}
+
+			if (failed)
+			{
+				throw std::runtime_error("failed to create pipeline!");
+			}
+
+			for (const auto &pending : batch)
+			{
+				setPipelineDebugName(pending.name, pending.pInfo->debugName);
+			}
+		}
 		// --- Graphics pipeline creation ---
 
-		// --- Compute pipeline creation ---
-		void beginCreateComputePipeline(uint32_t layoutName,
-			uint32_t basePipelineName = std::numeric_limits<uint32_t>::max(), VkPipelineCreateFlags flags = 0)
+		// --- Shader module cache ---
+		// Each SPIR-V file is read and turned into a module once. Modules stay alive until the manager is destroyed,
+		// so pipelines recreated with the swap chain reuse them
+		VkShaderModule getShaderModule(const std::string &spvFileName)
 		{
-			m_curComputePipelineInfo = ComputePipelineCreateInfo{};
+			auto it = m_shaderModules.find(spvFileName);
+			if (it != m_shaderModules.end()) return it->second;
+
+			VDeleter<VkShaderModule> module{ m_device, vkDestroyShaderModule };
+			createShaderModule(module, m_device, readFile(spvFileName));
+			setObjectDebugName(VK_OBJECT_TYPE_SHADER_MODULE, VkShaderModule(module), spvFileName);
+			return m_shaderModules.emplace(spvFileName, std::move(module)).first->second;
+		}
+
+		// Read and create the modules of @spvFileNames on @threadCount threads (hardware concurrency if 0).
+		// Files that are already cached or do not exist are skipped
+		void preloadShaderModules(const std::vector<std::string> &spvFileNames, uint32_t threadCount = 0)
+		{
+			std::vector<std::string> fileNames;
+			for (const auto &fn : spvFileNames)
+			{
+				if (m_shaderModules.find(fn) == m_shaderModules.end() && helper_functions::fileExist(fn)) fileNames.push_back(fn);
+			}
+			if (fileNames.empty()) return;
 
-			if (!m_availablePipelineNames.empty())
+			if (threadCount == 0)
 			{
-				m_curPipelineName = m_availablePipelineNames.back();
-				m_availablePipelineNames.pop_back();
+				threadCount = std::max(std::thread::hardware_concurrency(), 1u);
 			}
-			else
+			threadCount = std::min(threadCount, static_cast<uint32_t>(fileNames.size()));
+
+			// vkCreateShaderModule needs no external synchronization, each worker fills its own elements
+			std::vector<VDeleter<VkShaderModule>> modules;
+			modules.reserve(fileNames.size());
+			for (size_t i = 0; i < fileNames.size(); ++i)
 			{
-				m_curPipelineName = static_cast<uint32_t>(m_pipelines.size());
-				m_pipelines.emplace_back(m_device, vkDestroyPipeline);
+				modules.emplace_back(m_device, vkDestroyShaderModule);
+			}
+			std::atomic<size_t> nextFile{ 0 };
+			auto worker = [&]()
+			{
+				for (size_t i = nextFile++; i < fileNames.size(); i = nextFile++)
+				{
+					try
+					{
+						createShaderModule(modules[i], m_device, readFile(fileNames[i]));
+					}
+					catch (const std::exception &)
+					{
+						// Left to getShaderModule, which reports the error if the file is actually used
+					}
+				}
+			};
+
+			std::vector<std::thread> workers;
+			for (uint32_t i = 1; i < threadCount; ++i)
+			{
+				workers.emplace_back(worker);
+			}
+			worker();
+			for (auto &w : workers)
+			{
+				w.join();
+			}
+
+			for (size_t i = 0; i < fileNames.size(); ++i)
+			{
+				if (!modules[i].isvalid()) continue;
+
+				setObjectDebugName(VK_OBJECT_TYPE_SHADER_MODULE, VkShaderModule(modules[i]), fileNames[i]);
+				m_shaderModules.emplace(fileNames[i], std::move(modules[i]));
 			}
+		}
+
+		uint32_t getShaderModuleCount() const { return static_cast<uint32_t>(m_shaderModules.size()); }
+		// --- Shader module cache ---
+
+		// --- Compute pipeline creation ---
+		void beginCreateComputePipeline(uint32_t layoutName,
+			uint32_t basePipelineName = std::numeric_limits<uint32_t>::max(), VkPipelineCreateFlags flags = 0)
+		{
+			m_curComputePipelineInfo = ComputePipelineCreateInfo{};
+			m_curPipelineLayoutSerial = m_pipelineLayoutSerials[layoutName];
 
 			auto &pipelineInfo = m_curComputePipelineInfo.pipelineInfo;
 			pipelineInfo.flags = flags;
@@ -991,7 +1529,7 @@ namespace rj
 			if (flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT)
 			{
 				if (basePipelineName < m_pipelines.size() &&
-					std::find(m_availablePipelineNames.begin(), m_availablePipelineNames.end(), basePipelineName) == m_availablePipelineNames.end())
+					m_pipelineNames.isAlive(basePipelineName))
 				{
 					pipelineInfo.basePipelineHandle = m_pipelines[basePipelineName];
 					pipelineInfo.basePipelineIndex = -1;
@@ -1005,9 +1543,8 @@ namespace rj
 
 		void computePipelineAddShaderStage(const std::string &spvFileName, VkPipelineShaderStageCreateFlags flags = 0)
 		{
-			auto shaderByteCode = readFile(spvFileName);
-			m_curComputePipelineInfo.computeShaderModule = VDeleter<VkShaderModule>{ m_device, vkDestroyShaderModule };
-			createShaderModule(m_curComputePipelineInfo.computeShaderModule, m_device, shaderByteCode);
+			m_curComputePipelineInfo.computeShaderModule = getShaderModule(spvFileName);
+			if (isDebugUtilsEnabled()) m_curComputePipelineInfo.debugName = spvFileName;
 
 			auto &info = m_curComputePipelineInfo.pipelineInfo.stage;
 			info.module = m_curComputePipelineInfo.computeShaderModule;
@@ -1018,7 +1555,7 @@ namespace rj
 		{
 			if (!srcData) throw std::invalid_argument("data cannot be null");
 			if (size == 0) throw std::invalid_argument("size need to be greater than 0");
-			if (!m_curComputePipelineInfo.computeShaderModule.isvalid()) throw std::runtime_error("Cannot add specialization data to empty compute shader stage");
+			if (m_curComputePipelineInfo.computeShaderModule == VK_NULL_HANDLE) throw std::runtime_error("Cannot add specialization data to empty compute shader stage");
 
 			auto &specializationInfo = m_curComputePipelineInfo.computeSpecializationInfo;
 			auto &mapEntries = m_curComputePipelineInfo.computeSpecializationMapEntries;
@@ -1046,97 +1583,205 @@ namespace rj
 
 		uint32_t endCreateComputePipeline()
 		{
+			const uint64_t stateHash = hashComputePipelineState(m_curComputePipelineInfo);
+			if (findRegisteredPipeline(stateHash, &m_curPipelineName)) return m_curPipelineName;
+			m_curPipelineName = registerPipeline(stateHash);
+
 			if (vkCreateComputePipelines(m_device, m_pipelineCache, 1, &m_curComputePipelineInfo.pipelineInfo,
-				nullptr, m_pipelines[m_curPipelineName].replace()) != VK_SUCCESS)
+				helper_functions::getHostAllocationCallbacks(), m_pipelines[m_curPipelineName].replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create compute pipeline!");
 			}
+			setPipelineDebugName(m_curPipelineName, m_curComputePipelineInfo.debugName);
 
 			return m_curPipelineName;
 		}
 		// --- Compute pipeline creation ---
 
 		// --- Pipeline destruction ---
+		// Like samplers, pipelines are reference counted. The name is only freed once every endCreate*Pipeline that
+		// returned it has been matched
 		void destroyPipeline(uint32_t pipelineName)
 		{
 			assert(pipelineName < m_pipelines.size());
-			assert(std::find(m_availablePipelineNames.begin(), m_availablePipelineNames.end(), pipelineName) == m_availablePipelineNames.end());
+			assert(!isGraphicsPipelinePending(pipelineName));
+			assert(m_pipelineNames.isAlive(pipelineName));
+			assert(m_pipelineRefCounts[pipelineName] > 0);
 
-			m_availablePipelineNames.push_back(pipelineName);
+			if (--m_pipelineRefCounts[pipelineName] > 0) return;
+
+			m_pipelineRegistry.erase(m_pipelineStateHashes[pipelineName]);
+			retireName(m_pipelineNames, pipelineName);
+		}
+
+		// endCreate*Pipeline calls that returned an existing pipeline with the same state, and the ones that created one
+		uint32_t getPipelineRegistryHits() const { return m_pipelineRegistryHits; }
+		uint32_t getPipelineRegistryMisses() const { return m_pipelineRegistryMisses; }
+		uint32_t getPipelineCount() const { return static_cast<uint32_t>(m_pipelineRegistry.size()); }
+
+		bool isGraphicsPipelinePending(uint32_t pipelineName) const
+		{
+			return std::find_if(m_pendingGraphicsPipelines.begin(), m_pendingGraphicsPipelines.end(),
+				[pipelineName](const PendingGraphicsPipeline &p) { return p.name == pipelineName; }) != m_pendingGraphicsPipelines.end();
 		}
 		// --- Pipeline destruction ---
 
 		// --- Image related ---
+		// @memProps may ask for VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT for transient attachments, which falls back
+		// to the remaining properties where the device has no such memory. See getImageMemoryProperties()
 		uint32_t createImage2D(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps,
 			uint32_t mipLevels = 1, uint32_t arrayLayers = 1, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT,
 			VkImageLayout initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL)
 		{
-			uint32_t imageName;
-			if (!m_availableImageNames.empty())
-			{
-				imageName = m_availableImageNames.back();
-				m_availableImageNames.pop_back();
-			}
-			else
-			{
-				imageName = static_cast<uint32_t>(m_images.size());
-				m_images.emplace_back(m_device);
-			}
+			const uint32_t imageName = allocateImageName();
 
 			m_images.at(imageName).initAs2DImage(width, height, format, usage, memProps, mipLevels, arrayLayers, sampleCount, initialLayout, tiling);
 			
 			return imageName;
 		}
 
-		uint32_t createImageCube(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps,
-			uint32_t mipLevels = 1,
-			VkImageLayout initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL)
+		// Share the memory of @memoryOwnerName if the new image fits, see VImage::initAs2DImageAliasing(). Aliases have to be destroyed
+		// together with their owner
+		uint32_t createAliasedImage2D(uint32_t memoryOwnerName, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage,
+			VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT)
 		{
-			uint32_t imageName;
-			if (!m_availableImageNames.empty())
+			const uint32_t imageName = allocateImageName();
+
+			m_images.at(imageName).initAs2DImageAliasing(m_images.at(memoryOwnerName), width, height, format, usage, 1, 1, sampleCount);
+
+			return imageName;
+		}
+
+		// Partially resident with no page bound, see VImage::initAs2DSparseImage(). Needs isSparseResidencyEnabled()
+		uint32_t createSparseImage2D(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, uint32_t arrayLayers = 1)
+		{
+			const uint32_t imageName = allocateImageName();
+
+			VImage &image = m_images.at(imageName);
+			image.initAs2DSparseImage(width, height, format, usage, arrayLayers);
+			std::vector<VkSparseMemoryBind> opaqueBinds;
+			image.getSparseOpaqueBinds(&opaqueBinds);
+			queueSparseBinds(image, opaqueBinds, {});
+
+			return imageName;
+		}
+
+		// Bind memory to the pages @bindPages of a sparse image and take it from @unbindPages, see VImage::bindSparsePage() for
+		// the page indices. Waits for the binds, but not for the frames in flight: they may still sample the unbound pages, which
+		// then read as not resident, and their memory is only reused once those frames are complete. Pages are bound on the graphics
+		// queue, so this must not run while another thread submits
+		void updateSparseImagePages(uint32_t imageName, ArrayView<uint32_t> bindPages, ArrayView<uint32_t> unbindPages)
+		{
+			VImage &image = m_images.at(imageName);
+			thread_local std::vector<VkSparseImageMemoryBind> binds;
+			binds.clear();
+			for (uint32_t page : unbindPages)
 			{
-				imageName = m_availableImageNames.back();
-				m_availableImageNames.pop_back();
+				VkSparseImageMemoryBind bind;
+				VMemoryAllocation retired;
+				if (!image.unbindSparsePage(page, &bind, &retired)) continue;
+				binds.push_back(bind);
+				m_retiredSparsePages.push_back({ m_frameSerial, retired });
 			}
-			else
+			for (uint32_t page : bindPages)
 			{
-				imageName = static_cast<uint32_t>(m_images.size());
-				m_images.emplace_back(m_device);
+				VkSparseImageMemoryBind bind;
+				if (image.bindSparsePage(page, &bind)) binds.push_back(bind);
 			}
+			if (!binds.empty()) queueSparseBinds(image, {}, binds);
+		}
+
+		uint32_t createImageCube(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps,
+			uint32_t mipLevels = 1,
+			VkImageLayout initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL)
+		{
+			const uint32_t imageName = allocateImageName();
 
 			m_images.at(imageName).initAsCubeImage(width, height, format, usage, memProps, mipLevels, initialLayout, tiling);
 			
 			return imageName;
 		}
 
+		uint32_t createImage3D(uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps,
+			VkImageLayout initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL)
+		{
+			const uint32_t imageName = allocateImageName();
+
+			m_images.at(imageName).initAs3DImage(width, height, depth, format, usage, memProps, initialLayout, tiling);
+
+			return imageName;
+		}
+
+		// Views of the image stay valid names until destroyed, but are not handed out by createImageView anymore
 		void destroyImage(uint32_t imageName)
 		{
 			assert(imageName < m_images.size());
-			assert(std::find(m_availableImageNames.begin(), m_availableImageNames.end(), imageName) == m_availableImageNames.end());
+			{
+				std::lock_guard<std::mutex> guard(m_resourceMutex);
+				for (auto it = m_imageViewCache.begin(); it != m_imageViewCache.end();)
+				{
+					if (it->first.imageName == imageName) it = m_imageViewCache.erase(it);
+					else ++it;
+				}
+			}
+			retireName(m_imageNames, imageName);
+		}
+
+		// Keep the generation with the name to tell later whether the image was destroyed and the name reused
+		uint32_t getImageGeneration(uint32_t imageName) const { return m_imageNames.getGeneration(imageName); }
+		bool isImageCurrent(uint32_t imageName, uint32_t generation) const { return m_imageNames.isCurrent(imageName, generation); }
+
+		// Properties of the memory the image was actually allocated from
+		VkMemoryPropertyFlags getImageMemoryProperties(uint32_t imageName) const
+		{
+			return m_images.at(imageName).memoryProperties();
+		}
+
+		// Texels of a page of a sparse image, see createSparseImage2D()
+		VkExtent3D getSparseImagePageExtent(uint32_t imageName) const
+		{
+			return m_images.at(imageName).sparsePageExtent();
+		}
 
-			m_availableImageNames.push_back(imageName);
+		// Account the image's memory to @category instead of the one its usage implies
+		void setImageMemoryCategory(uint32_t imageName, MemoryCategory category)
+		{
+			m_images.at(imageName).setMemoryCategory(category);
 		}
 		// --- Image related ---
 
 		// --- Image view related ---
+		// Equal parameters on the same image return the same view. It is reference counted like samplers,
+		// every createImageView needs its own destroyImageView
 		uint32_t createImageView(uint32_t imageName, VkImageViewType viewType, VkImageAspectFlags aspectMask,
 			uint32_t baseMipLevel = 0, uint32_t levelCount = 1, uint32_t baseArrayLayer = 0, uint32_t layerCount = 1,
 			VkComponentMapping componentMapping = {}, VkImageViewCreateFlags flags = 0)
 		{
-			uint32_t viewName;
-			if (!m_availableImageViewNames.empty())
+			const ImageViewDescription desc = { imageName, viewType, m_images.at(imageName).format(), aspectMask,
+				baseMipLevel, levelCount, baseArrayLayer, layerCount, componentMapping, flags };
+
+			// The view is created under the lock, so another thread never finds it in the cache before it exists
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			auto it = m_imageViewCache.find(desc);
+			if (it != m_imageViewCache.end())
 			{
-				viewName = m_availableImageViewNames.back();
-				m_availableImageViewNames.pop_back();
+				++m_imageViewRefCounts[it->second];
+				return it->second;
 			}
-			else
+
+			const uint32_t viewName = m_imageViewNames.allocate();
+			if (viewName == m_imageViews.size())
 			{
-				viewName = static_cast<uint32_t>(m_imageViews.size());
 				m_imageViews.emplace_back(m_device, m_images);
+				m_imageViewDescriptions.emplace_back();
+				m_imageViewRefCounts.push_back(0);
 			}
 
 			m_imageViews.at(viewName).init(imageName, viewType, aspectMask, baseMipLevel, levelCount, baseArrayLayer, layerCount,
 				componentMapping, flags);
+			m_imageViewDescriptions[viewName] = desc;
+			m_imageViewRefCounts[viewName] = 1;
+			m_imageViewCache[desc] = viewName;
 
 			return viewName;
 		}
@@ -1157,61 +1802,93 @@ namespace rj
 				baseMipLevel, levelCount, baseArrayLayer, 1, componentMapping, flags);
 		}
 
+		// The name is only freed once every createImageView that returned it has been matched
 		void destroyImageView(uint32_t imageViewName)
 		{
 			assert(imageViewName < m_imageViews.size());
-			assert(std::find(m_availableImageViewNames.begin(), m_availableImageViewNames.end(), imageViewName) == m_availableImageViewNames.end());
+			{
+				std::lock_guard<std::mutex> guard(m_resourceMutex);
+				assert(m_imageViewRefCounts[imageViewName] > 0);
+
+				if (--m_imageViewRefCounts[imageViewName] > 0) return;
+
+				// Already gone from the cache if the image was destroyed first
+				auto it = m_imageViewCache.find(m_imageViewDescriptions[imageViewName]);
+				if (it != m_imageViewCache.end() && it->second == imageViewName) m_imageViewCache.erase(it);
+			}
+			retireName(m_imageViewNames, imageViewName);
+		}
 
-			m_availableImageViewNames.push_back(imageViewName);
+		// Distinct views that can still be shared
+		uint32_t getImageViewCount() const
+		{
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			return static_cast<uint32_t>(m_imageViewCache.size());
 		}
+
+		uint32_t getImageViewGeneration(uint32_t imageViewName) const { return m_imageViewNames.getGeneration(imageViewName); }
+		bool isImageViewCurrent(uint32_t imageViewName, uint32_t generation) const { return m_imageViewNames.isCurrent(imageViewName, generation); }
 		// --- Image view related ---
 
 		// --- Image utilities ---
+		// Joins the open upload batch if there is one
 		void transitionImageLayout(uint32_t imageName, VkImageLayout oldLayout, VkImageLayout newLayout)
 		{
-			auto &image = m_images[imageName];
-
-			beginSingleTimeCommands();
-			recordImageLayoutTransitionCommands(m_singleTimeCommandBuffer, image, image.format(), 0, image.levels(),
-				0, image.layers(), oldLayout, newLayout);
-			endSingleTimeCommands();
-
-			image.setLayout(newLayout);
+			beginUploadBatch();
+			uploadBatchAddImageLayoutTransition(imageName, oldLayout, newLayout);
+			endUploadBatch();
 		}
 
+		// Joins the open upload batch if there is one
 		// TODO: Add support for more formats
 		void transferHostDataToImage(uint32_t imageName, VkDeviceSize sizeInBytes, const void *hostData, VkImageAspectFlags aspectMask,
 			VkImageLayout currentLayout, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED)
 		{
-			if (!hostData) throw std::invalid_argument("hostData cannot be null");
-			if (sizeInBytes == 0) throw std::invalid_argument("sizeInBytes cannot be 0");
+			beginUploadBatch();
+			uploadBatchAddImageData(imageName, sizeInBytes, hostData, aspectMask, currentLayout, finalLayout);
+			endUploadBatch();
+		}
 
-			auto &image = m_images.at(imageName);
-
-			transitionImageLayout(imageName, currentLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-			VBuffer stagingBuffer{ m_device };
-			stagingBuffer.init(sizeInBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		// Joins the open upload batch if there is one. @hostData holds level 0 only
+		void transferHostDataToImageAndGenerateMipmaps(uint32_t imageName, VkDeviceSize sizeInBytes, const void *hostData, VkImageLayout currentLayout)
+		{
+			beginUploadBatch();
+			uploadBatchAddImageDataAndGenerateMipmaps(imageName, sizeInBytes, hostData, currentLayout);
+			endUploadBatch();
+		}
 
-			void *mapped = stagingBuffer.mapBuffer();
-			memcpy(mapped, hostData, sizeInBytes);
-			stagingBuffer.unmapBuffer();
-			mapped = nullptr;
+		// Like transferHostDataToImage, but @writeData fills the staging memory itself, e.g. straight from a file
+		void transferWrittenDataToImage(uint32_t imageName, VkDeviceSize sizeInBytes, const StagingWriter &writeData,
+			VkImageAspectFlags aspectMask, VkImageLayout currentLayout, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED)
+		{
+			beginUploadBatch();
+			uploadBatchAddWrittenImageData(imageName, sizeInBytes, writeData, aspectMask, currentLayout, finalLayout);
+			endUploadBatch();
+		}
 
-			beginSingleTimeCommands();
-			recordCopyBufferToImageCommands(m_singleTimeCommandBuffer, stagingBuffer, image, image.format(), aspectMask,
-				image.extent().width, image.extent().height, image.extent().depth, image.levels(), image.layers());
-			endSingleTimeCommands();
+		// Like transferHostDataToImageAndGenerateMipmaps, but @writeData fills the staging memory with level 0
+		void transferWrittenDataToImageAndGenerateMipmaps(uint32_t imageName, VkDeviceSize sizeInBytes, const StagingWriter &writeData,
+			VkImageLayout currentLayout)
+		{
+			beginUploadBatch();
+			uploadBatchAddWrittenImageDataAndGenerateMipmaps(imageName, sizeInBytes, writeData, currentLayout);
+			endUploadBatch();
+		}
 
-			if (finalLayout != VK_IMAGE_LAYOUT_UNDEFINED)
-			{
-				transitionImageLayout(imageName, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout);
-			}
+		// Like transferWrittenDataToImageAndGenerateMipmaps, but @writeData fills the staging memory with 8 bit texels of
+		// @srcChannelCount channels, see uploadBatchAddWrittenTexelsExpandedToRgba8
+		void transferWrittenTexelsExpandedToRgba8(uint32_t imageName, uint32_t srcChannelCount, VkDeviceSize sizeInBytes,
+			const StagingWriter &writeData, VkImageLayout currentLayout)
+		{
+			beginUploadBatch();
+			uploadBatchAddWrittenTexelsExpandedToRgba8(imageName, srcChannelCount, sizeInBytes, writeData, currentLayout);
+			endUploadBatch();
 		}
 
 		void readImage(std::vector<char> &hostBuffer, uint32_t imageName, VkImageAspectFlags aspectMask, VkImageLayout currentLayout)
 		{
+			assert(m_uploadBatch.depth == 0); // the read back has to see every preceding upload
+
 			auto &image = m_images.at(imageName);
 
 			transitionImageLayout(imageName, currentLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
@@ -1262,21 +1939,78 @@ namespace rj
 			stagingBuffer.unmapBuffer();
 			mapped = nullptr;
 		}
+
+		// Asynchronous readbacks. readImage() waits for the GPU, these copy into the buffers of a VReadbackRing at the end of
+		// a frame and call back from the completeFrames() call that reports the frame done. Size the ring before the first one
+		void initReadbackRing(uint32_t bufferCount, VkDeviceSize bufferSize)
+		{
+			m_readbackRing.init(bufferCount, bufferSize);
+		}
+
+		const VReadbackRing &getReadbackRing() const { return m_readbackRing; }
+
+		// Copy level 0 of @imageName, which is in @layout before and after the commands, into a readback buffer. The texels
+		// are tightly packed. Return false if the readback was dropped because every buffer is in flight
+		bool cmdReadImageAsync(uint32_t cmdBufferName, uint32_t imageName, VkImageLayout layout, const VReadbackRing::Callback &callback,
+			VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT)
+		{
+			const auto &image = m_images.at(imageName);
+			const VkExtent3D extent = image.extent(0);
+			if (m_pCommandCapture) m_pCommandCapture->dropCommand();
+			return cmdReadImageAsync(m_commandBuffers.at(cmdBufferName), image, { extent.width, extent.height },
+				g_formatInfoTable.at(image.format()).blockSize, aspectMask, layout, callback);
+		}
+
+		// Same for swapchain image @imageIdx after the pass that leaves it in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+		bool cmdReadSwapChainImageAsync(uint32_t cmdBufferName, uint32_t imageIdx, const VReadbackRing::Callback &callback)
+		{
+			if (!(m_swapChain.imageUsage() & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+			{
+				throw std::runtime_error("swapchain images cannot be copied from on this surface");
+			}
+			if (m_pCommandCapture) m_pCommandCapture->dropCommand();
+			return cmdReadImageAsync(m_commandBuffers.at(cmdBufferName), m_swapChain.images().at(imageIdx), m_swapChain.extent(),
+				g_formatInfoTable.at(m_swapChain.format()).blockSize, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, callback);
+		}
+
+		// Frames handed to another API on the GPU, see VExternalImageSink. The images have the swapchain's extent and format
+		bool isExternalImageSinkSupported() const { return m_device.isExternalMemoryEnabled() && m_device.isTimelineSemaphoreEnabled(); }
+
+		void initExternalImageSink(uint32_t imageCount)
+		{
+			m_externalImageSink.init(imageCount, m_swapChain.extent(), m_swapChain.format());
+		}
+
+		VExternalImageSink &getExternalImageSink() { return m_externalImageSink; }
+
+		// Copy swapchain image @imageIdx after the pass that leaves it in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR into a free external
+		// image. Return its index or std::numeric_limits<uint32_t>::max() if the frame was dropped
+		uint32_t cmdCopySwapChainImageToExternalSink(uint32_t cmdBufferName, uint32_t imageIdx)
+		{
+			if (!(m_swapChain.imageUsage() & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+			{
+				throw std::runtime_error("swapchain images cannot be copied from on this surface");
+			}
+			if (m_pCommandCapture) m_pCommandCapture->dropCommand();
+			return m_externalImageSink.cmdCopyImage(m_commandBuffers.at(cmdBufferName), m_swapChain.images().at(imageIdx),
+				VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, m_frameSerial);
+		}
+
+		// After the frame's last graphics submit, the external semaphore reaches the value of its copy then
+		void submitExternalImageSinkSignal()
+		{
+			if (m_externalImageSink.isInitialized()) m_externalImageSink.submitSignal(m_device.getGraphicsQueue());
+		}
 		// --- Image utilities ---
 
 		// --- Buffer related ---
 		uint32_t createBuffer(VkDeviceSize sizeInBytes, VkBufferUsageFlags usage, VkMemoryPropertyFlags memProps)
 		{
 			uint32_t bufferName;
-			if (!m_availableBufferNames.empty())
-			{
-				bufferName = m_availableBufferNames.back();
-				m_availableBufferNames.pop_back();
-			}
-			else
 			{
-				bufferName = static_cast<uint32_t>(m_buffers.size());
-				m_buffers.emplace_back(m_device);
+				std::lock_guard<std::mutex> guard(m_resourceMutex);
+				bufferName = m_bufferNames.allocate();
+				if (bufferName == m_buffers.size()) m_buffers.emplace_back(m_device, &m_memoryAllocator);
 			}
 
 			m_buffers.at(bufferName).init(sizeInBytes, usage, memProps);
@@ -1285,30 +2019,34 @@ namespace rj
 
 		void destroyBuffer(uint32_t bufferName)
 		{
-			assert(std::find(m_availableBufferNames.begin(), m_availableBufferNames.end(), bufferName) == m_availableBufferNames.end());
 			assert(bufferName < m_buffers.size());
-			m_availableBufferNames.push_back(bufferName);
+			retireName(m_bufferNames, bufferName);
 		}
 
-		void transferHostDataToBuffer(uint32_t bufferName, VkDeviceSize sizeInBytes, const void *hostData, VkDeviceSize dstOffset = 0)
-		{
-			if (!hostData) throw std::invalid_argument("hostData cannot be null");
-			if (sizeInBytes == 0) throw std::invalid_argument("sizeInBytes cannot be 0");
-
-			auto &dstBuffer = m_buffers.at(bufferName);
+		// Keep the generation with the name to tell later whether the buffer was destroyed and the name reused
+		uint32_t getBufferGeneration(uint32_t bufferName) const { return m_bufferNames.getGeneration(bufferName); }
+		bool isBufferCurrent(uint32_t bufferName, uint32_t generation) const { return m_bufferNames.isCurrent(bufferName, generation); }
 
-			VBuffer stagingBuffer{ m_device };
-			stagingBuffer.init(sizeInBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		// Account the buffer's memory to @category instead of the one its usage implies
+		void setBufferMemoryCategory(uint32_t bufferName, MemoryCategory category)
+		{
+			m_buffers.at(bufferName).setMemoryCategory(category);
+		}
 
-			void *mapped = stagingBuffer.mapBuffer();
-			memcpy(mapped, hostData, sizeInBytes);
-			stagingBuffer.unmapBuffer();
-			mapped = nullptr;
+		// Joins the open upload batch if there is one
+		void transferHostDataToBuffer(uint32_t bufferName, VkDeviceSize sizeInBytes, const void *hostData, VkDeviceSize dstOffset = 0)
+		{
+			beginUploadBatch();
+			uploadBatchAddBufferData(bufferName, sizeInBytes, hostData, dstOffset);
+			endUploadBatch();
+		}
 
-			beginSingleTimeCommands();
-			recordCopyBufferToBufferCommands(m_singleTimeCommandBuffer, stagingBuffer, dstBuffer, sizeInBytes, 0, dstOffset);
-			endSingleTimeCommands();
+		// Like transferHostDataToBuffer, but @writeData fills the staging memory itself
+		void transferWrittenDataToBuffer(uint32_t bufferName, VkDeviceSize sizeInBytes, const StagingWriter &writeData, VkDeviceSize dstOffset = 0)
+		{
+			beginUploadBatch();
+			uploadBatchAddWrittenBufferData(bufferName, sizeInBytes, writeData, dstOffset);
+			endUploadBatch();
 		}
 
 		void *mapBuffer(uint32_t bufferName, VkDeviceSize offset = 0, VkDeviceSize sizeInBytes = 0)
@@ -1324,1048 +2062,4372 @@ namespace rj
 		}
 		// --- Buffer related ---
 
-		// --- Sampler related ---
-		uint32_t createSampler(VkFilter magFilter, VkFilter minFilter, VkSamplerMipmapMode mipmapMode,
-			VkSamplerAddressMode addressModeU, VkSamplerAddressMode addressModeV, VkSamplerAddressMode addressModeW,
-			float minLod = 0.f, float maxLod = 0.f, float mipLodBias = 0.f, VkBool32 anisotropyEnable = VK_FALSE,
-			float maxAnisotropy = 0.f, VkBool32 compareEnable = VK_FALSE, VkCompareOp compareOp = VK_COMPARE_OP_NEVER,
-			VkBorderColor borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK, VkBool32 unnormailzedCoords = VK_FALSE,
-			VkSamplerCreateFlags flags = 0)
+		// --- Upload batch ---
+		// Copies and layout transitions added between beginUploadBatch and endUploadBatch are recorded into
+		// a single command buffer and submitted once. Batches nest; only the outermost endUploadBatch submits.
+		// With a dedicated transfer queue the copies run there and the graphics queue acquires the written resources
+		void beginUploadBatch()
 		{
-			uint32_t samplerName;
-			if (!m_availableSamplerNames.empty())
-			{
-				samplerName = m_availableSamplerNames.back();
-				m_availableSamplerNames.pop_back();
-			}
-			else
-			{
-				samplerName = static_cast<uint32_t>(m_samplers.size());
-				m_samplers.emplace_back(m_device);
-			}
+			if (m_uploadBatch.depth++ > 0) return;
 
-			m_samplers.at(samplerName).init(magFilter, minFilter, mipmapMode, addressModeU, addressModeV, addressModeW,
-				minLod, maxLod, mipLodBias, anisotropyEnable, maxAnisotropy, compareEnable, compareOp,
-				borderColor, unnormailzedCoords, flags);
-			
-			return samplerName;
+			waitUploadBatch();
+			beginUploadBatchCommandBuffer();
 		}
 
-		void destroySampler(uint32_t samplerName)
+		void uploadBatchAddBufferData(uint32_t bufferName, VkDeviceSize sizeInBytes, const void *hostData, VkDeviceSize dstOffset = 0)
 		{
-			assert(samplerName < m_samplers.size());
-			assert(std::find(m_availableSamplerNames.begin(), m_availableSamplerNames.end(), samplerName) == m_availableSamplerNames.end());
-
-			m_availableSamplerNames.push_back(samplerName);
+			if (!hostData) throw std::invalid_argument("hostData cannot be null");
+			uploadBatchAddWrittenBufferData(bufferName, sizeInBytes, [=](void *pDst) { memcpy(pDst, hostData, sizeInBytes); }, dstOffset);
 		}
-		// --- Sampler related ---
 
-		// --- Framebuffer related ---
-		uint32_t createFramebuffer(uint32_t renderPassName, const std::vector<uint32_t> &attachmentViewNames)
+		// @writeData fills @sizeInBytes of staging memory at the pointer it gets with what goes to @dstOffset
+		void uploadBatchAddWrittenBufferData(uint32_t bufferName, VkDeviceSize sizeInBytes, const StagingWriter &writeData, VkDeviceSize dstOffset = 0)
 		{
-			VkRenderPass renderPass = m_renderPasses.at(renderPassName);
-			
-			bool first = true;
-			uint32_t width, height, layers;
-			std::vector<VkImageView> attachmentViews;
-			for (auto name : attachmentViewNames)
-			{
-				auto &view = m_imageViews.at(name);
-				VkExtent3D extent = view.image()->extent(view.baseLevel());
+			if (sizeInBytes == 0) throw std::invalid_argument("sizeInBytes cannot be 0");
+			assert(m_uploadBatch.depth > 0);
 
-				if (!first)
-				{
-					if (extent.width != width || extent.height != height || extent.depth != 1 ||
-						view.layers() != layers)
-					{
-						throw std::runtime_error("Image view cannot be used as framebuffer attachment");
-					}
-					first = false;
-				}
+			auto &dstBuffer = m_buffers.at(bufferName);
 
-				width = extent.width;
-				height = extent.height;
-				layers = view.layers();
-				attachmentViews.push_back(view);
-			}
+			VkBuffer srcBuffer;
+			VkDeviceSize srcOffset = uploadBatchStage(sizeInBytes, writeData, 16, &srcBuffer);
 
-			uint32_t fbName;
-			if (!m_availableFramebufferNames.empty())
-			{
-				fbName = m_availableFramebufferNames.back();
-				m_availableFramebufferNames.pop_back();
-			}
-			else
+			recordCopyBufferToBufferCommands(m_uploadBatch.commandBuffer, srcBuffer, dstBuffer, sizeInBytes, srcOffset, dstOffset);
+
+			auto &transferredBuffers = m_uploadBatch.transferredBuffers;
+			if (isTransferQueueDedicated() &&
+				std::find(transferredBuffers.begin(), transferredBuffers.end(), static_cast<VkBuffer>(dstBuffer)) == transferredBuffers.end())
 			{
-				fbName = static_cast<uint32_t>(m_framebuffers.size());
-				m_framebuffers.emplace_back(m_device);
+				transferredBuffers.push_back(dstBuffer);
 			}
+		}
 
-			m_framebuffers[fbName].init(renderPass, attachmentViews, width, height, layers);
-			return fbName;
+		void uploadBatchAddImageData(uint32_t imageName, VkDeviceSize sizeInBytes, const void *hostData, VkImageAspectFlags aspectMask,
+			VkImageLayout currentLayout, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED)
+		{
+			if (!hostData) throw std::invalid_argument("hostData cannot be null");
+			uploadBatchAddWrittenImageData(imageName, sizeInBytes, [=](void *pDst) { memcpy(pDst, hostData, sizeInBytes); },
+				aspectMask, currentLayout, finalLayout);
 		}
 
-		std::vector<uint32_t> createSwapChainFramebuffers(uint32_t renderPassName)
+		// @writeData fills @sizeInBytes of staging memory at the pointer it gets, laid out like @hostData of uploadBatchAddImageData
+		void uploadBatchAddWrittenImageData(uint32_t imageName, VkDeviceSize sizeInBytes, const StagingWriter &writeData,
+			VkImageAspectFlags aspectMask, VkImageLayout currentLayout, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED)
 		{
-			VkRenderPass renderPass = m_renderPasses.at(renderPassName);
+			if (sizeInBytes == 0) throw std::invalid_argument("sizeInBytes cannot be 0");
+			assert(m_uploadBatch.depth > 0);
 
-			if (!m_swapChainFramebufferNames.empty())
-			{
-				m_availableFramebufferNames.insert(m_availableFramebufferNames.end(),
-					m_swapChainFramebufferNames.begin(), m_swapChainFramebufferNames.end());
-				m_swapChainFramebufferNames.clear();
-			}
+			auto &image = m_images.at(imageName);
 
-			const auto &views = m_swapChain.imageViews();
-			VkExtent2D extent = m_swapChain.extent();
+			// bufferOffset must be a multiple of both 4 and the texel block size
+			const uint32_t blockSize = g_formatInfoTable.at(image.format()).blockSize;
+			VkDeviceSize alignment = blockSize;
+			while (alignment % 4 != 0) alignment += blockSize;
 
-			for (const auto &view : views)
-			{
-				uint32_t fbName;
-				if (!m_availableFramebufferNames.empty())
-				{
-					fbName = m_availableFramebufferNames.back();
-					m_availableFramebufferNames.pop_back();
-				}
-				else
-				{
-					fbName = static_cast<uint32_t>(m_framebuffers.size());
-					m_framebuffers.emplace_back(m_device);
-				}
+			VkBuffer srcBuffer;
+			VkDeviceSize srcOffset = uploadBatchStage(sizeInBytes, writeData, alignment, &srcBuffer);
 
-				m_framebuffers.at(fbName).init(renderPass, { view }, extent.width, extent.height, 1);
-				m_swapChainFramebufferNames.push_back(fbName);
+			uploadBatchAddImageLayoutTransition(imageName, currentLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+			recordCopyBufferToImageCommands(m_uploadBatch.commandBuffer, srcBuffer, image, image.format(), aspectMask,
+				image.extent().width, image.extent().height, image.extent().depth, image.levels(), image.layers(), srcOffset);
+
+			if (isTransferQueueDedicated())
+			{
+				m_uploadBatch.transferredImages.push_back({ imageName, aspectMask });
 			}
 
-			return m_swapChainFramebufferNames;
+			if (finalLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+			{
+				uploadBatchAddImageLayoutTransition(imageName, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout);
+			}
 		}
 
-		void destroyFramebuffer(uint32_t framebufferName)
+		// Upload level 0 of every layer from @hostData and fill the other levels on the GPU, see recordGenerateMipmapsCommands.
+		// The image needs VK_IMAGE_USAGE_TRANSFER_SRC_BIT and a format for which canGenerateMipmaps is true.
+		// Ends in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		void uploadBatchAddImageDataAndGenerateMipmaps(uint32_t imageName, VkDeviceSize sizeInBytes, const void *hostData,
+			VkImageLayout currentLayout)
 		{
-			assert(framebufferName < m_framebuffers.size());
-			assert(std::find(m_availableFramebufferNames.begin(), m_availableFramebufferNames.end(), framebufferName) == m_availableFramebufferNames.end());
-			
-			if (std::find(m_swapChainFramebufferNames.begin(), m_swapChainFramebufferNames.end(), framebufferName) != m_swapChainFramebufferNames.end()) return;
-			m_availableFramebufferNames.push_back(framebufferName);
+			if (!hostData) throw std::invalid_argument("hostData cannot be null");
+			uploadBatchAddWrittenImageDataAndGenerateMipmaps(imageName, sizeInBytes,
+				[=](void *pDst) { memcpy(pDst, hostData, sizeInBytes); }, currentLayout);
 		}
 
-		VkExtent2D getFramebufferExtent(uint32_t framebufferName)
+		// @writeData fills @sizeInBytes of staging memory with level 0 of every layer
+		void uploadBatchAddWrittenImageDataAndGenerateMipmaps(uint32_t imageName, VkDeviceSize sizeInBytes, const StagingWriter &writeData,
+			VkImageLayout currentLayout)
 		{
-			auto &framebuffer = m_framebuffers.at(framebufferName);
-			return { framebuffer.width(), framebuffer.height() };
-		}
-		// --- Framebuffer related ---
+			if (sizeInBytes == 0) throw std::invalid_argument("sizeInBytes cannot be 0");
+			assert(m_uploadBatch.depth > 0);
 
-		// --- GPU Queries ---
-		uint32_t createQueryPool(VkQueryType queryType, uint32_t queryCount, VkQueryPipelineStatisticFlags pipelineStatistics = 0)
-		{
-			uint32_t newPoolName;
-			if (m_availableQueryPoolNames.empty())
+			auto &image = m_images.at(imageName);
+
+			const uint32_t blockSize = g_formatInfoTable.at(image.format()).blockSize;
+			VkDeviceSize alignment = blockSize;
+			while (alignment % 4 != 0) alignment += blockSize;
+
+			VkBuffer srcBuffer;
+			VkDeviceSize srcOffset = uploadBatchStage(sizeInBytes, writeData, alignment, &srcBuffer);
+
+			uploadBatchAddImageLayoutTransition(imageName, currentLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+			recordCopyBufferToImageCommands(m_uploadBatch.commandBuffer, srcBuffer, image, image.format(), VK_IMAGE_ASPECT_COLOR_BIT,
+				image.extent().width, image.extent().height, 1, 1, image.layers(), srcOffset);
+
+			// Blits need the graphics queue, so with a dedicated transfer queue they run after the ownership acquire
+			if (isTransferQueueDedicated())
 			{
-				newPoolName = uint32_t(m_queryPools.size());
-				m_queryPools.emplace_back(m_device);
+				m_uploadBatch.transferredImages.push_back({ imageName, VK_IMAGE_ASPECT_COLOR_BIT });
+				m_uploadBatch.deferredMipmapGenerations.push_back(imageName);
 			}
 			else
 			{
-				newPoolName = m_availableQueryPoolNames.back();
-				m_availableQueryPoolNames.pop_back();
+				recordGenerateMipmapsCommands(m_uploadBatch.commandBuffer, image, image.extent().width, image.extent().height,
+					image.levels(), image.layers());
 			}
 
-			m_queryPools[newPoolName].init(queryType, queryCount, pipelineStatistics);
-
-			return newPoolName;
+			image.setLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		}
 
-		VkResult getQueryPoolResults(uint32_t queryPoolName, size_t dataSize, VkDeviceSize stride, void *pData,
-			uint32_t firstQuery = 0, uint32_t queryCount = std::numeric_limits<uint32_t>::max(), VkQueryResultFlags flags = 0)
+		// True if uploadBatchAddWrittenTexelsExpandedToRgba8 can take @sizeInBytes of texels. The expansion runs in compute,
+		// so not on a dedicated transfer queue, and needs the upload shaders
+		bool canExpandTexelsOnUpload(VkDeviceSize sizeInBytes)
 		{
-			assert(queryPoolName < m_queryPools.size());
-			assert(std::find(m_availableQueryPoolNames.begin(), m_availableQueryPoolNames.end(), queryPoolName) == m_availableQueryPoolNames.end());
-
-			const auto &queryPool = m_queryPools[queryPoolName];
-			if (queryCount == std::numeric_limits<uint32_t>::max()) queryCount = queryPool.getQueryCount();
-			assert(firstQuery + queryCount <= queryPool.getQueryCount());
+			if (isTransferQueueDedicated() || !helper_functions::fileExist(TEXEL_EXPAND_SHADER_FILE_NAME) ||
+				!isFormatSupported(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT))
+			{
+				return false;
+			}
 
-			// Return VK_NOT_READY if query results are not ready
-			// Make sure cmdResetQueryPool has been executed on this queryPool on GPU before calling.
-			// Otherwise the availability status is from last query (obsolete)
-			return vkGetQueryPoolResults(m_device, queryPool, firstQuery, queryCount, dataSize, pData, stride, flags);
+			// The bound range starts up to an offset alignment ahead of the texels
+			VkPhysicalDeviceProperties props;
+			getPhysicalDeviceProperties(&props);
+			return sizeInBytes + props.limits.minStorageBufferOffsetAlignment + 4 <= props.limits.maxStorageBufferRange;
 		}
 
-		void destroyQueryPool(uint32_t queryPoolName)
+		// Fill level 0 of @imageName, a VK_FORMAT_R8G8B8A8_UNORM image with VK_IMAGE_USAGE_STORAGE_BIT, from the tightly packed
+		// 8 bit texels of @srcChannelCount (1 to 3) channels @writeData writes. A compute pass expands them to RGBA8 with alpha 1,
+		// so the host only touches the packed texels. Further levels are generated as by uploadBatchAddWrittenImageDataAndGenerateMipmaps,
+		// which then needs its usage and format support. Ends in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. Needs canExpandTexelsOnUpload
+		void uploadBatchAddWrittenTexelsExpandedToRgba8(uint32_t imageName, uint32_t srcChannelCount, VkDeviceSize sizeInBytes,
+			const StagingWriter &writeData, VkImageLayout currentLayout)
 		{
-			assert(queryPoolName < m_queryPools.size());
-			assert(std::find(m_availableQueryPoolNames.begin(), m_availableQueryPoolNames.end(), queryPoolName) == m_availableQueryPoolNames.end());
+			if (sizeInBytes == 0) throw std::invalid_argument("sizeInBytes cannot be 0");
+			if (srcChannelCount < 1 || srcChannelCount > 3) throw std::invalid_argument("srcChannelCount must be 1, 2 or 3");
+			assert(m_uploadBatch.depth > 0 && !isTransferQueueDedicated());
+
+			auto &image = m_images.at(imageName);
+			const uint32_t width = image.extent().width;
+			const uint32_t height = image.extent().height;
+
+			if (m_uploadBatch.expansionPipeline == std::numeric_limits<uint32_t>::max())
+			{
+				createTexelExpansionPipeline();
+			}
+
+			// Out of sets, wait for the ones in flight. Ahead of staging, the wait recycles the ring space staged so far
+			if (m_uploadBatch.expansionSetCount == TEXEL_EXPAND_MAX_SETS)
+			{
+				submitUploadBatchCommandBuffer();
+				waitUploadBatch();
+				beginUploadBatchCommandBuffer();
+			}
+
+			// The shader reads whole words
+			const VkDeviceSize stagedSize = (sizeInBytes + 3) & ~VkDeviceSize(3);
+			VkBuffer srcBuffer;
+			const VkDeviceSize srcOffset = uploadBatchStage(stagedSize, writeData, 4, &srcBuffer);
+
+			VkPhysicalDeviceProperties props;
+			getPhysicalDeviceProperties(&props);
+			const VkDeviceSize offsetAlignment = props.limits.minStorageBufferOffsetAlignment;
+			const VkDeviceSize boundOffset = srcOffset / offsetAlignment * offsetAlignment;
+
+			const uint32_t imageView = createImageView2D(imageName, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1);
+			m_uploadBatch.expansionImageViews.push_back(imageView);
+			const uint32_t setName = allocateDescriptorSets(m_uploadBatch.expansionPool, { m_uploadBatch.expansionSetLayout })[0];
+			++m_uploadBatch.expansionSetCount;
+
+			VkDescriptorBufferInfo bufferInfo = {};
+			bufferInfo.buffer = srcBuffer;
+			bufferInfo.offset = boundOffset;
+			bufferInfo.range = srcOffset - boundOffset + stagedSize;
+
+			VkDescriptorImageInfo imageInfo = {};
+			imageInfo.imageView = m_imageViews.at(imageView);
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			VkWriteDescriptorSet writes[2] = {};
+			for (uint32_t i = 0; i < 2; ++i)
+			{
+				writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[i].dstSet = m_descriptorSets.at(setName);
+				writes[i].dstBinding = i;
+				writes[i].descriptorCount = 1;
+			}
+			writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[0].pBufferInfo = &bufferInfo;
+			writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writes[1].pImageInfo = &imageInfo;
+			vkUpdateDescriptorSets(m_device, 2, writes, 0, nullptr);
+
+			VkCommandBuffer commandBuffer = m_uploadBatch.commandBuffer;
+			const auto &pipelineLayout = m_pipelineLayouts.at(m_uploadBatch.expansionPipelineLayout);
+
+			// Every level goes to GENERAL, the ones the mipmap generation fills leave it with level 0
+			recordTexelExpansionBarrier(commandBuffer, image, 0, VK_ACCESS_SHADER_WRITE_BIT, currentLayout, VK_IMAGE_LAYOUT_GENERAL,
+				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.at(m_uploadBatch.expansionPipeline));
+			const VkDescriptorSet set = m_descriptorSets.at(setName);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+			const uint32_t pushConstants[] = { static_cast<uint32_t>(srcOffset - boundOffset), srcChannelCount, width, height };
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), pushConstants);
+			vkCmdDispatch(commandBuffer, (width + TEXEL_EXPAND_GROUP_SIZE - 1) / TEXEL_EXPAND_GROUP_SIZE,
+				(height + TEXEL_EXPAND_GROUP_SIZE - 1) / TEXEL_EXPAND_GROUP_SIZE, 1);
+
+			const VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+			if (image.levels() > 1)
+			{
+				recordTexelExpansionBarrier(commandBuffer, image, VK_ACCESS_SHADER_WRITE_BIT,
+					VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+				recordGenerateMipmapsCommands(commandBuffer, image, width, height, image.levels(), image.layers());
+			}
+			else
+			{
+				recordTexelExpansionBarrier(commandBuffer, image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+					VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, shaderStages);
+			}
 
-			m_availableQueryPoolNames.push_back(queryPoolName);
+			image.setLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		}
-		// --- GPU Queries ---
 
-		// --- Descriptor pool related ---
-		void beginCreateDescriptorPool(uint32_t maxNumSets)
+		// True if uploadBatchAddImageDataAndGenerateMipmaps can fill the mip chain of optimally tiled images of @format
+		bool canGenerateMipmaps(VkFormat format)
 		{
-			m_curDescriptorPoolInfo = {};
-			m_curDescriptorPoolInfo.maxSetCount = maxNumSets;
-			m_curDescriptorPoolName = static_cast<uint32_t>(m_descriptorPools.size());
-			m_descriptorPools.emplace(std::piecewise_construct, std::forward_as_tuple(m_curDescriptorPoolName),
-				std::forward_as_tuple(m_device));
+			return isFormatSupported(format, VK_IMAGE_TILING_OPTIMAL,
+				VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
 		}
 
-		void descriptorPoolAddDescriptors(VkDescriptorType type, uint32_t count)
+		void uploadBatchAddImageLayoutTransition(uint32_t imageName, VkImageLayout oldLayout, VkImageLayout newLayout)
 		{
-			auto &poolSizes = m_curDescriptorPoolInfo.poolSizes;
-			
-			VkDescriptorPoolSize ps = {};
-			ps.type = type;
-			ps.descriptorCount = count;
-			poolSizes.push_back(ps);
+			assert(m_uploadBatch.depth > 0);
+
+			auto &image = m_images.at(imageName);
+
+			// Only the transitions ahead of a copy run on a dedicated transfer queue, it doesn't support the other stages
+			if (isTransferQueueDedicated() && newLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+			{
+				m_uploadBatch.deferredLayoutTransitions.push_back({ imageName, oldLayout, newLayout });
+			}
+			else
+			{
+				recordImageLayoutTransitionCommands(m_uploadBatch.commandBuffer, image, image.format(), 0, image.levels(),
+					0, image.layers(), oldLayout, newLayout);
+			}
+
+			image.setLayout(newLayout);
 		}
 
-		uint32_t endCreateDescriptorPool()
+		// If @waitForCompletion is false, the batch is waited on by the next beginUploadBatch or waitUploadBatch
+		void endUploadBatch(bool waitForCompletion = true)
 		{
-			uint32_t maxSet = m_curDescriptorPoolInfo.maxSetCount;
-			auto &poolSizes = m_curDescriptorPoolInfo.poolSizes;
-			m_descriptorPools.at(m_curDescriptorPoolName).init(maxSet, poolSizes);
-			
-			m_poolSetTable[m_curDescriptorPoolName] = {};
+			assert(m_uploadBatch.depth > 0);
+			if (--m_uploadBatch.depth > 0) return;
 
-			return m_curDescriptorPoolName;
+			submitUploadBatchCommandBuffer();
+
+			if (waitForCompletion)
+			{
+				waitUploadBatch();
+			}
 		}
 
-		void resetDescriptorPool(uint32_t poolName, VkDescriptorPoolResetFlags flags = 0)
+		void waitUploadBatch()
 		{
-			const auto &pool = m_descriptorPools.at(poolName);
+			if (m_uploadBatch.submittedCommandBuffers.empty()) return;
 
-			if (vkResetDescriptorPool(m_device, pool, flags) != VK_SUCCESS)
+			// Every submit but possibly the last one consumed staging ring space and signals a ring fence
+			m_stagingRing.waitIdle();
+
+			if (m_uploadBatch.isFenceInUse)
 			{
-				throw std::runtime_error("failed to reset descriptor pool");
+				VkFence fence = m_uploadBatch.fence;
+				vkWaitForFences(m_device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+				vkResetFences(m_device, 1, &fence);
+				m_uploadBatch.isFenceInUse = false;
 			}
 
-			auto &poolSets = m_poolSetTable.at(poolName);
-			m_availableDescriptorSetNames.insert(m_availableDescriptorSetNames.end(), poolSets.begin(), poolSets.end());
-			poolSets.clear();
-		}
-		// --- Descriptor pool related ---
+			vkFreeCommandBuffers(m_device, m_commandPools[m_singleSubmitCommandPoolName],
+				static_cast<uint32_t>(m_uploadBatch.submittedCommandBuffers.size()), m_uploadBatch.submittedCommandBuffers.data());
+			m_uploadBatch.submittedCommandBuffers.clear();
 
-		// --- Descriptor sets ---
-		std::vector<uint32_t> allocateDescriptorSets(uint32_t descriptorPoolName, const std::vector<uint32_t> &setLayoutNames)
-		{
-			auto &pool = m_descriptorPools.at(descriptorPoolName);
-			
-			std::vector<VkDescriptorSetLayout> layouts;
-			layouts.reserve(setLayoutNames.size());
-			for (auto name : setLayoutNames)
+			if (!m_uploadBatch.submittedTransferCommandBuffers.empty())
 			{
-				layouts.push_back(m_descriptorSetLayouts.at(name));
+				vkFreeCommandBuffers(m_device, m_commandPools[m_transferCommandPoolName],
+					static_cast<uint32_t>(m_uploadBatch.submittedTransferCommandBuffers.size()), m_uploadBatch.submittedTransferCommandBuffers.data());
+				m_uploadBatch.submittedTransferCommandBuffers.clear();
 			}
+			m_uploadBatch.dedicatedStagingBuffers.clear();
 
-			VkDescriptorSetAllocateInfo allocInfo = {};
-			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-			allocInfo.descriptorPool = pool;
-			allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
-			allocInfo.pSetLayouts = layouts.data();
-
-			std::vector<VkDescriptorSet> sets(layouts.size());
-			if (vkAllocateDescriptorSets(m_device, &allocInfo, sets.data()) != VK_SUCCESS)
+			for (uint32_t imageView : m_uploadBatch.submittedExpansionImageViews)
 			{
-				throw std::runtime_error("failed to allocate descriptor set!");
+				destroyImageView(imageView);
 			}
-
-			std::vector<uint32_t> setNames;
-			setNames.reserve(sets.size());
-			for (auto set : sets)
+			m_uploadBatch.submittedExpansionImageViews.clear();
+			if (m_uploadBatch.expansionSetCount > 0 && m_uploadBatch.expansionImageViews.empty())
 			{
-				uint32_t setName;
-				if (!m_availableDescriptorSetNames.empty())
-				{
-					setName = m_availableDescriptorSetNames.back();
-					m_availableDescriptorSetNames.pop_back();
-				}
-				else
-				{
-					setName = static_cast<uint32_t>(m_descriptorSets.size());
-					m_descriptorSets.push_back(VK_NULL_HANDLE);
-				}
-
-				setNames.push_back(setName);
-				m_descriptorSets[setName] = set;
+				resetDescriptorPool(m_uploadBatch.expansionPool);
+				m_uploadBatch.expansionSetCount = 0;
 			}
-
-			auto &entry = m_poolSetTable[descriptorPoolName];
-			entry.insert(entry.end(), setNames.begin(), setNames.end());
-
-			return setNames;
 		}
-
-		void beginUpdateDescriptorSet(uint32_t setName)
-		{
-			m_curDescriptorSetInfo = {};
-			m_curDescriptorSetName = setName;
+		// --- Upload batch ---
+
+		// --- Geometry pool ---
+		// Static meshes are sub-allocated from one index and two vertex buffers, so draws of different meshes
+		// bind the same buffers and only differ in firstIndex and vertexOffset. Ranges freed by geometryPoolFree are reused.
+		// Positions are a stream of their own, so depth only passes fetch nothing else. Meshes with at most 65536 vertices
+		// get 16 bit indices in a second index buffer unless geometryPoolSetIndex16Enabled turned that off.
+		// Joins the open upload batch if there is one
+		GeometryRange geometryPoolAddMesh(const void *positions, uint32_t positionStride, const void *attributes, uint32_t attributeStride,
+			uint32_t vertexCount, const uint32_t *indices, uint32_t indexCount)
+		{
+			return geometryPoolAddWrittenMesh(
+				positionStride, [=](void *pDst) { memcpy(pDst, positions, static_cast<size_t>(vertexCount) * positionStride); },
+				attributeStride, [=](void *pDst) { memcpy(pDst, attributes, static_cast<size_t>(vertexCount) * attributeStride); },
+				vertexCount, indexCount, [=](void *pDst, VkIndexType indexType) { copyIndices(pDst, indexType, indices, indexCount); });
 		}
 
-		void descriptorSetAddBufferDescriptor(uint32_t binding, VkDescriptorType type, const std::vector<DescriptorSetUpdateBufferInfo> &updateInfos,
-			uint32_t baseArrayElement = 0)
+		// Like geometryPoolAddMesh, but the writers fill the staging memory of the two vertex streams and the indices themselves,
+		// e.g. by decoding a file straight into it
+		GeometryRange geometryPoolAddWrittenMesh(uint32_t positionStride, const StagingWriter &writePositions,
+			uint32_t attributeStride, const StagingWriter &writeAttributes,
+			uint32_t vertexCount, uint32_t indexCount, const IndexWriter &writeIndices)
 		{
-			assert(!updateInfos.empty());
-
-			auto &bufferInfoTable = m_curDescriptorSetInfo.bufferInfos;
-			assert(bufferInfoTable.find(binding) == bufferInfoTable.end());
-			bufferInfoTable[binding] = {};
-			auto &bufferInfos = bufferInfoTable[binding];
+			if (vertexCount == 0 || indexCount == 0) throw std::invalid_argument("mesh cannot be empty");
 
-			bufferInfos.reserve(updateInfos.size());
-			for (const auto &updateInfo : updateInfos)
+			if (m_geometryPool.positionBuffer == std::numeric_limits<uint32_t>::max())
 			{
-				VkDescriptorBufferInfo info = {};
-				info.buffer = m_buffers.at(updateInfo.bufferName);
-				info.offset = updateInfo.offset;
-				info.range = updateInfo.sizeInBytes;
-				bufferInfos.push_back(info);
+				if (!m_geometryPool.mixedStrides)
+				{
+					m_geometryPool.positionStride = positionStride;
+					m_geometryPool.attributeStride = attributeStride;
+				}
+				// Mesh shaders fetch the vertices from storage buffers, the visibility buffer material pass the indices too
+				m_geometryPool.positionBuffer = createBuffer(static_cast<VkDeviceSize>(GEOMETRY_POOL_VERTEX_CAPACITY) * positionStride,
+					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | getGeometryPoolBuildInputUsage(),
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+				m_geometryPool.attributeBuffer = createBuffer(static_cast<VkDeviceSize>(GEOMETRY_POOL_VERTEX_CAPACITY) * attributeStride,
+					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+				m_geometryPool.indexBuffer = createBuffer(static_cast<VkDeviceSize>(GEOMETRY_POOL_INDEX_CAPACITY) * sizeof(uint32_t),
+					VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | getGeometryPoolBuildInputUsage(),
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+				setBufferDebugName(m_geometryPool.positionBuffer, "geometry pool positions");
+				setBufferDebugName(m_geometryPool.attributeBuffer, "geometry pool attributes");
+				setBufferDebugName(m_geometryPool.indexBuffer, "geometry pool indices");
 			}
 
-			auto &writeInfos = m_curDescriptorSetInfo.writeInfos;
-			writeInfos.push_back({});
-			auto &writeInfo = writeInfos.back();
-
-			writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			writeInfo.dstSet = m_descriptorSets[m_curDescriptorSetName];
-			writeInfo.dstBinding = binding;
-			writeInfo.dstArrayElement = baseArrayElement;
-			writeInfo.descriptorType = type;
-			writeInfo.descriptorCount = static_cast<uint32_t>(bufferInfos.size());
-			writeInfo.pBufferInfo = bufferInfos.data();
-		}
-
-		void descriptorSetAddImageDescriptor(uint32_t binding, VkDescriptorType type, const std::vector<DescriptorSetUpdateImageInfo> &updateInfos,
-			uint32_t baseArrayElement = 0)
-		{
-			assert(!updateInfos.empty());
+			GeometryRange base;
+			bool reused = false;
+			if (m_geometryPool.mixedStrides)
+			{
+				if (positionStride > m_geometryPool.positionStride || attributeStride > m_geometryPool.attributeStride)
+				{
+					throw std::invalid_argument("vertex strides exceed the largest ones the geometry pool was set up for");
+				}
 
-			auto &imageInfoTable = m_curDescriptorSetInfo.imageInfos;
-			assert(imageInfoTable.find(binding) == imageInfoTable.end());
-			imageInfoTable[binding] = {};
-			auto &imageInfos = imageInfoTable.at(binding);
+				// Vertex input cannot address meshes of different strides in one buffer, their shaders add the byte offsets.
+				// Those read the streams as 32 bit words
+				base.positionOffset = static_cast<uint32_t>((m_geometryPool.positionSize + 3) & ~VkDeviceSize(3));
+				base.attributeOffset = static_cast<uint32_t>((m_geometryPool.attributeSize + 3) & ~VkDeviceSize(3));
+			}
+			else
+			{
+				if (positionStride != m_geometryPool.positionStride || attributeStride != m_geometryPool.attributeStride)
+				{
+					throw std::invalid_argument("all meshes in the geometry pool must have the same vertex strides");
+				}
 
-			imageInfos.reserve(updateInfos.size());
-			for (const auto &updateInfo : updateInfos)
+				uint32_t firstVertex = m_geometryPool.vertexCount;
+				reused = takeFreeRange(&m_geometryPool.freeVertices, vertexCount, &firstVertex);
+				base.vertexOffset = static_cast<int32_t>(firstVertex);
+				base.positionOffset = firstVertex * positionStride;
+				base.attributeOffset = firstVertex * attributeStride;
+			}
+			base.vertexCount = vertexCount;
+			const VkDeviceSize positionSize = static_cast<VkDeviceSize>(vertexCount) * positionStride;
+			const VkDeviceSize attributeSize = static_cast<VkDeviceSize>(vertexCount) * attributeStride;
+			if (base.positionOffset + positionSize > static_cast<VkDeviceSize>(GEOMETRY_POOL_VERTEX_CAPACITY) * m_geometryPool.positionStride ||
+				base.attributeOffset + attributeSize > static_cast<VkDeviceSize>(GEOMETRY_POOL_VERTEX_CAPACITY) * m_geometryPool.attributeStride)
 			{
-				VkDescriptorImageInfo info = {};
-				info.sampler = updateInfo.samplerName == std::numeric_limits<uint32_t>::max() ? VK_NULL_HANDLE : VkSampler(m_samplers.at(updateInfo.samplerName));
-				info.imageView = m_imageViews.at(updateInfo.imageViewName);
-				info.imageLayout = updateInfo.layout;
-				imageInfos.push_back(info);
+				throw std::runtime_error("geometry pool is full");
 			}
+			base.indexType = m_geometryPool.index16Enabled && vertexCount <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 
-			auto &writeInfos = m_curDescriptorSetInfo.writeInfos;
-			writeInfos.push_back({});
-			auto &writeInfo = writeInfos.back();
+			GeometryRange range = geometryPoolAddWrittenIndices(base, indexCount, writeIndices);
 
-			writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			writeInfo.dstSet = m_descriptorSets[m_curDescriptorSetName];
-			writeInfo.dstBinding = binding;
-			writeInfo.dstArrayElement = baseArrayElement;
-			writeInfo.descriptorType = type;
-			writeInfo.descriptorCount = static_cast<uint32_t>(imageInfos.size());
-			writeInfo.pImageInfo = imageInfos.data();
+			transferWrittenDataToBuffer(m_geometryPool.positionBuffer, positionSize, writePositions, base.positionOffset);
+			transferWrittenDataToBuffer(m_geometryPool.attributeBuffer, attributeSize, writeAttributes, base.attributeOffset);
+			if (reused) return range;
+
+			m_geometryPool.vertexCount += vertexCount;
+			m_geometryPool.positionSize = base.positionOffset + positionSize;
+			m_geometryPool.attributeSize = base.attributeOffset + attributeSize;
+			return range;
 		}
 
-		void endUpdateDescriptorSet()
+		// Add another index range over the vertices of @base, e.g. a coarser level of detail of the same mesh.
+		// It has the index type of @base
+		GeometryRange geometryPoolAddIndices(const GeometryRange &base, const uint32_t *indices, uint32_t indexCount)
 		{
-			vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(m_curDescriptorSetInfo.writeInfos.size()),
-				m_curDescriptorSetInfo.writeInfos.data(), 0, nullptr);
-
-			m_curDescriptorSetName = std::numeric_limits<uint32_t>::max();
-			m_curDescriptorSetInfo = {};
+			return geometryPoolAddWrittenIndices(base, indexCount,
+				[=](void *pDst, VkIndexType indexType) { copyIndices(pDst, indexType, indices, indexCount); });
 		}
-		// --- Descriptor sets ---
 
-		// --- Command pool related ---
-		uint32_t createCommandPool(VkQueueFlagBits submitQueueType, VkCommandPoolCreateFlags flags = 0)
+		GeometryRange geometryPoolAddWrittenIndices(const GeometryRange &base, uint32_t indexCount, const IndexWriter &writeIndices)
 		{
-			uint32_t queueFamilyIndex;
-			const auto &queueFamilyIndices = m_device.getQueueFamilyIndices();
-			switch (submitQueueType)
+			if (indexCount == 0) throw std::invalid_argument("index range cannot be empty");
+			if (m_geometryPool.indexBuffer == std::numeric_limits<uint32_t>::max())
 			{
-			case VK_QUEUE_GRAPHICS_BIT:
-				queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-				break;
-			case VK_QUEUE_COMPUTE_BIT:
-				queueFamilyIndex = queueFamilyIndices.computeFamily;
-				break;
-			case VK_QUEUE_TRANSFER_BIT:
-				queueFamilyIndex = queueFamilyIndices.transferFamily;
-			default:
-				throw std::invalid_argument("unsupported queue type specified during command pool creation");
+				throw std::runtime_error("index ranges can only be added to meshes in the geometry pool");
 			}
 
-			uint32_t newPoolName;
-			newPoolName = static_cast<uint32_t>(m_commandPools.size());
-			m_commandPools.emplace(std::piecewise_construct, std::forward_as_tuple(newPoolName),
-				std::forward_as_tuple(m_device, vkDestroyCommandPool));
-
-			VkCommandPoolCreateInfo poolInfo = {};
-			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-			poolInfo.queueFamilyIndex = queueFamilyIndex;
-			poolInfo.flags = flags;
+			GeometryRange range;
+			range.indexCount = indexCount;
+			range.vertexOffset = base.vertexOffset;
+			range.indexType = base.indexType;
+			range.positionOffset = base.positionOffset;
+			range.attributeOffset = base.attributeOffset;
+			range.vertexCount = base.vertexCount;
+			const VkIndexType indexType = base.indexType;
 
-			auto &pool = m_commandPools[newPoolName];
-			if (vkCreateCommandPool(m_device, &poolInfo, nullptr, pool.replace()) != VK_SUCCESS)
+			if (base.indexType == VK_INDEX_TYPE_UINT16)
 			{
-				throw std::runtime_error("failed to create command pool!");
-			}
+				if (m_geometryPool.index16Buffer == std::numeric_limits<uint32_t>::max())
+				{
+					m_geometryPool.index16Buffer = createBuffer(static_cast<VkDeviceSize>(GEOMETRY_POOL_INDEX16_CAPACITY) * sizeof(uint16_t),
+						VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | getGeometryPoolBuildInputUsage(), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+					setBufferDebugName(m_geometryPool.index16Buffer, "geometry pool 16 bit indices");
+				}
+				if (!takeFreeRange(&m_geometryPool.freeIndices16, indexCount, &range.firstIndex))
+				{
+					if (m_geometryPool.index16Count + indexCount > GEOMETRY_POOL_INDEX16_CAPACITY)
+					{
+						throw std::runtime_error("geometry pool is full");
+					}
+					range.firstIndex = m_geometryPool.index16Count;
+					m_geometryPool.index16Count += indexCount;
+				}
 
+				transferWrittenDataToBuffer(m_geometryPool.index16Buffer, indexCount * sizeof(uint16_t),
+					[&](void *pDst) { writeIndices(pDst, indexType); },
+					static_cast<VkDeviceSize>(range.firstIndex) * sizeof(uint16_t));
+			}
+			else
 			{
-				std::lock_guard<std::shared_mutex> gaurd(g_commandBufferMutex);
-				m_commandBufferTable[newPoolName] = {};
+				if (!takeFreeRange(&m_geometryPool.freeIndices, indexCount, &range.firstIndex))
+				{
+					if (m_geometryPool.indexCount + indexCount > GEOMETRY_POOL_INDEX_CAPACITY)
+					{
+						throw std::runtime_error("geometry pool is full");
+					}
+					range.firstIndex = m_geometryPool.indexCount;
+					m_geometryPool.indexCount += indexCount;
+				}
+
+				transferWrittenDataToBuffer(m_geometryPool.indexBuffer, indexCount * sizeof(uint32_t),
+					[&](void *pDst) { writeIndices(pDst, indexType); },
+					static_cast<VkDeviceSize>(range.firstIndex) * sizeof(uint32_t));
 			}
 
-			return newPoolName;
+			return range;
 		}
 
-		void resetCommandPool(uint32_t commandPoolName, VkCommandPoolResetFlags flags = 0)
+		// Reserve room for @vertexCount more vertices of @base's strides, which are written on the GPU, e.g. by a compute pass,
+		// instead of uploaded. Return @base moved onto them, so the index ranges of @base draw them unchanged
+		GeometryRange geometryPoolAddVertexRange(const GeometryRange &base, uint32_t vertexCount)
 		{
-			std::lock_guard<std::shared_mutex> guard(g_commandBufferMutex); // no command buffer is in-use
-
-			VkCommandPool pool = VK_NULL_HANDLE;
-			pool = m_commandPools.at(commandPoolName);
-
-			if (vkResetCommandPool(m_device, pool, flags) != VK_SUCCESS)
+			if (m_geometryPool.positionBuffer == std::numeric_limits<uint32_t>::max())
 			{
-				throw std::runtime_error("failed to reset command buffer");
+				throw std::runtime_error("vertex ranges can only be added after a mesh");
 			}
-
-			if (flags & VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT)
+			if (m_geometryPool.mixedStrides) throw std::runtime_error("vertex ranges need a geometry pool with one vertex stride");
+
+			GeometryRange range = base;
+			range.vertexCount = vertexCount;
+			range.vertexOffset = static_cast<int32_t>(m_geometryPool.vertexCount);
+			range.positionOffset = static_cast<uint32_t>(m_geometryPool.positionSize);
+			range.attributeOffset = static_cast<uint32_t>(m_geometryPool.attributeSize);
+			if (m_geometryPool.vertexCount + vertexCount > GEOMETRY_POOL_VERTEX_CAPACITY)
 			{
-				auto &cbNames = m_commandBufferTable[commandPoolName];
-				m_commandBufferAvaiableNames.insert(m_commandBufferAvaiableNames.end(), cbNames.begin(), cbNames.end());
-				cbNames.clear();
+				throw std::runtime_error("geometry pool is full");
 			}
+
+			m_geometryPool.vertexCount += vertexCount;
+			m_geometryPool.positionSize += static_cast<VkDeviceSize>(vertexCount) * m_geometryPool.positionStride;
+			m_geometryPool.attributeSize += static_cast<VkDeviceSize>(vertexCount) * m_geometryPool.attributeStride;
+			return range;
 		}
-		// --- Command pool related ---
 
-		// --- Command buffer related ---
-		void beginSingleTimeCommands()
+		// Return the indices of @range to the pool, and its vertices as well if @freeVertices, e.g. with the finest LOD of an
+		// unloaded mesh. Nothing may draw them anymore, on the GPU either. Vertices can only be freed with one vertex stride
+		void geometryPoolFree(const GeometryRange &range, bool freeVertices)
 		{
-			VkCommandBufferAllocateInfo allocInfo = {};
-			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-			allocInfo.commandPool = m_commandPools[m_singleSubmitCommandPoolName];
-			allocInfo.commandBufferCount = 1;
+			addFreeRange(range.indexType == VK_INDEX_TYPE_UINT16 ? &m_geometryPool.freeIndices16 : &m_geometryPool.freeIndices,
+				range.firstIndex, range.indexCount);
+			if (!freeVertices) return;
 
-			vkAllocateCommandBuffers(m_device, &allocInfo, &m_singleTimeCommandBuffer);
+			if (m_geometryPool.mixedStrides) throw std::runtime_error("vertex ranges can only be freed in a geometry pool with one vertex stride");
+			addFreeRange(&m_geometryPool.freeVertices, static_cast<uint32_t>(range.vertexOffset), range.vertexCount);
+		}
 
-			VkCommandBufferBeginInfo beginInfo = {};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		// Multi draw indirect binds one index buffer for all meshes, so it needs every mesh to have 32 bit indices.
+		// Only affects meshes added afterwards
+		void geometryPoolSetIndex16Enabled(bool enabled) { m_geometryPool.index16Enabled = enabled; }
 
-			vkBeginCommandBuffer(m_singleTimeCommandBuffer, &beginInfo);
+		// Let meshes have vertex strides of their own, up to the given ones which size the buffers. Their ranges have no vertex
+		// offset then, the vertices are found by the byte offsets. Must be called before the first mesh is added
+		void geometryPoolSetMixedStrides(uint32_t maxPositionStride, uint32_t maxAttributeStride)
+		{
+			assert(m_geometryPool.positionBuffer == std::numeric_limits<uint32_t>::max());
+			m_geometryPool.mixedStrides = true;
+			m_geometryPool.positionStride = maxPositionStride;
+			m_geometryPool.attributeStride = maxAttributeStride;
 		}
 
-		void endSingleTimeCommands()
+		uint32_t getGeometryPoolPositionBuffer() const { return m_geometryPool.positionBuffer; }
+		uint32_t getGeometryPoolAttributeBuffer() const { return m_geometryPool.attributeBuffer; }
+		uint32_t getGeometryPoolIndexBuffer(VkIndexType indexType = VK_INDEX_TYPE_UINT32) const
 		{
-			vkEndCommandBuffer(m_singleTimeCommandBuffer);
-
-			VkSubmitInfo submitInfo = {};
-			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-			submitInfo.commandBufferCount = 1;
-			submitInfo.pCommandBuffers = &m_singleTimeCommandBuffer;
-
-			vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-			vkQueueWaitIdle(m_device.getGraphicsQueue());
+			return indexType == VK_INDEX_TYPE_UINT16 ? m_geometryPool.index16Buffer : m_geometryPool.indexBuffer;
+		}
+		// --- Geometry pool ---
 
-			vkFreeCommandBuffers(m_device, m_commandPools[m_singleSubmitCommandPoolName], 1, &m_singleTimeCommandBuffer);
+		// --- Acceleration structures ---
+		// Bottom level structures over meshes of the geometry pool, and top level ones over their instances, for ray queries.
+		// Need isRayQueryEnabled()
+		VkDeviceAddress getBufferDeviceAddress(uint32_t bufferName) const
+		{
+			VkBufferDeviceAddressInfoKHR info = {};
+			info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR;
+			info.buffer = m_buffers.at(bufferName);
+			return m_device.pfnGetBufferDeviceAddress(m_device, &info);
+		}
 
-			m_singleTimeCommandBuffer = VK_NULL_HANDLE;
+		// Needs isRayQueryEnabled()
+		VkDeviceAddress getBufferDeviceAddress(const VBuffer &buffer) const
+		{
+			VkBufferDeviceAddressInfoKHR info = {};
+			info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR;
+			info.buffer = buffer;
+			return m_device.pfnGetBufferDeviceAddress(m_device, &info);
 		}
 
-		std::vector<uint32_t> allocateCommandBuffers(uint32_t poolName, uint32_t count,
-			VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+		// One compacted bottom level structure per range, over the positions at the start of each vertex, which have to be
+		// VK_FORMAT_R32G32B32_SFLOAT. Built in batches of at most ACCELERATION_STRUCTURE_SCRATCH_SIZE scratch memory, each with
+		// single time commands for the build and the compaction, so call it where uploads are waited for anyway
+		std::vector<uint32_t> createBottomLevelAccelerationStructures(ArrayView<GeometryRange> ranges)
 		{
-			VkCommandPool pool = VK_NULL_HANDLE;
-			std::vector<VkCommandBuffer> cbs(count);
-			
-			pool = m_commandPools.at(poolName);
+			assert(m_device.isRayQueryEnabled());
 
-			VkCommandBufferAllocateInfo allocInfo = {};
-			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-			allocInfo.level = level;
-			allocInfo.commandPool = pool;
-			allocInfo.commandBufferCount = count;
+			const VkDeviceAddress positionAddress = getBufferDeviceAddress(m_geometryPool.positionBuffer);
+			const VkDeviceSize scratchAlignment = m_device.getAccelerationStructureProperties().minAccelerationStructureScratchOffsetAlignment;
 
-			if (vkAllocateCommandBuffers(m_device, &allocInfo, cbs.data()) != VK_SUCCESS)
+			std::vector<VkAccelerationStructureGeometryKHR> geometries(ranges.size());
+			std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(ranges.size());
+			std::vector<VkAccelerationStructureBuildRangeInfoKHR> buildRanges(ranges.size());
+			std::vector<VkDeviceSize> scratchOffsets(ranges.size());
+			std::vector<uint32_t> names(ranges.size());
+
+			for (size_t i = 0; i < ranges.size(); ++i)
 			{
-				throw std::runtime_error("failed to allocate command buffers!");
+				const GeometryRange &range = ranges[i];
+				if (range.vertexCount == 0) throw std::invalid_argument("acceleration structures need the vertex count of their ranges");
+
+				// The indices are relative to the first vertex of the range, where the vertex data starts
+				auto &geometry = geometries[i];
+				geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+				geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+				geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+				auto &triangles = geometry.geometry.triangles;
+				triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+				triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+				triangles.vertexData.deviceAddress = positionAddress + range.positionOffset;
+				triangles.vertexStride = m_geometryPool.positionStride;
+				triangles.maxVertex = range.vertexCount - 1;
+				triangles.indexType = range.indexType;
+				triangles.indexData.deviceAddress = getBufferDeviceAddress(getGeometryPoolIndexBuffer(range.indexType));
+
+				auto &buildRange = buildRanges[i];
+				buildRange.primitiveCount = range.indexCount / 3;
+				buildRange.primitiveOffset = range.firstIndex * (range.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t));
+
+				auto &buildInfo = buildInfos[i];
+				buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+				buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+				buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+				buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+				buildInfo.geometryCount = 1;
+				buildInfo.pGeometries = &geometry;
 			}
 
-			std::vector<uint32_t> commandBufferNames;
-			commandBufferNames.reserve(count);
+			size_t batchBegin = 0;
+			while (batchBegin < ranges.size())
 			{
-				std::lock_guard<std::shared_mutex> guard(g_commandBufferMutex);
-
-				auto &poolCbs = m_commandBufferTable.at(poolName);
-				for (auto cb : cbs)
+				// Every build of a batch has its own scratch range, so they may run at the same time. A build larger than the
+				// budget gets a batch of its own
+				VkDeviceSize scratchSize = 0;
+				size_t batchEnd = batchBegin;
+				for (; batchEnd < ranges.size(); ++batchEnd)
 				{
-					uint32_t cbName;
+					VkAccelerationStructureBuildSizesInfoKHR sizeInfo = {};
+					sizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+					m_device.pfnGetAccelerationStructureBuildSizes(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+						&buildInfos[batchEnd], &buildRanges[batchEnd].primitiveCount, &sizeInfo);
+
+					const VkDeviceSize scratchOffset = alignUp(scratchSize, scratchAlignment);
+					if (batchEnd > batchBegin && scratchOffset + sizeInfo.buildScratchSize > ACCELERATION_STRUCTURE_SCRATCH_SIZE) break;
+					scratchOffsets[batchEnd] = scratchOffset;
+					scratchSize = scratchOffset + sizeInfo.buildScratchSize;
+
+					names[batchEnd] = createAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, sizeInfo.accelerationStructureSize);
+					buildInfos[batchEnd].dstAccelerationStructure = m_accelerationStructures[names[batchEnd]].handle;
+				}
+				const uint32_t batchSize = static_cast<uint32_t>(batchEnd - batchBegin);
+
+				// The buffer's own address is not aligned for scratch memory
+				const uint32_t scratchBuffer = createBuffer(scratchSize + scratchAlignment,
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+				const VkDeviceAddress scratchAddress = alignUp(getBufferDeviceAddress(scratchBuffer), scratchAlignment);
+				std::vector<const VkAccelerationStructureBuildRangeInfoKHR *> pBuildRanges(batchSize);
+				std::vector<VkAccelerationStructureKHR> handles(batchSize);
+				for (uint32_t i = 0; i < batchSize; ++i)
+				{
+					buildInfos[batchBegin + i].scratchData.deviceAddress = scratchAddress + scratchOffsets[batchBegin + i];
+					pBuildRanges[i] = &buildRanges[batchBegin + i];
+					handles[i] = buildInfos[batchBegin + i].dstAccelerationStructure;
+				}
 
-					if (!m_commandBufferAvaiableNames.empty())
-					{
-						cbName = m_commandBufferAvaiableNames.back();
-						m_commandBufferAvaiableNames.pop_back();
-					}
-					else
-					{
-						cbName = static_cast<uint32_t>(m_commandBuffers.size());
-						m_commandBuffers.push_back(VK_NULL_HANDLE);
-					}
+				const uint32_t queryPool = createQueryPool(VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, batchSize);
+
+				beginSingleTimeCommands();
+				vkCmdResetQueryPool(m_singleTimeCommandBuffer, m_queryPools[queryPool], 0, batchSize);
+				m_device.pfnCmdBuildAccelerationStructures(m_singleTimeCommandBuffer, batchSize, &buildInfos[batchBegin], pBuildRanges.data());
+
+				VkMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+				barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+				vkCmdPipelineBarrier(m_singleTimeCommandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+					VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+				m_device.pfnCmdWriteAccelerationStructuresProperties(m_singleTimeCommandBuffer, batchSize, handles.data(),
+					VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, m_queryPools[queryPool], 0);
+				endSingleTimeCommands();
+
+				std::vector<VkDeviceSize> compactedSizes(batchSize);
+				getQueryPoolResults(queryPool, batchSize * sizeof(VkDeviceSize), sizeof(VkDeviceSize), compactedSizes.data(), 0, batchSize,
+					VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+				// Copy every structure into one of its compacted size, and keep that one under the returned name
+				beginSingleTimeCommands();
+				std::vector<uint32_t> compactedNames(batchSize);
+				for (uint32_t i = 0; i < batchSize; ++i)
+				{
+					compactedNames[i] = createAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, compactedSizes[i]);
+
+					VkCopyAccelerationStructureInfoKHR copyInfo = {};
+					copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+					copyInfo.src = handles[i];
+					copyInfo.dst = m_accelerationStructures[compactedNames[i]].handle;
+					copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+					m_device.pfnCmdCopyAccelerationStructure(m_singleTimeCommandBuffer, &copyInfo);
+				}
+				endSingleTimeCommands();
 
-					m_commandBuffers[cbName] = cb;
-					commandBufferNames.push_back(cbName);
-					poolCbs.push_back(cbName);
+				for (uint32_t i = 0; i < batchSize; ++i)
+				{
+					destroyAccelerationStructure(names[batchBegin + i]);
+					names[batchBegin + i] = compactedNames[i];
 				}
+				destroyQueryPool(queryPool);
+				destroyBuffer(scratchBuffer);
+				batchBegin = batchEnd;
 			}
 
-			return commandBufferNames;
+			return names;
 		}
 
-		// TODO: support secondary command buffer
-		void beginCommandBuffer(uint32_t commandBufferName, VkCommandBufferUsageFlags flags = 0) const
+		// A top level structure of up to @maxInstanceCount instances. It keeps its scratch memory for the builds of every frame
+		uint32_t createTopLevelAccelerationStructure(uint32_t maxInstanceCount)
 		{
-			g_commandBufferMutex.lock_shared(); // some command buffer(s) are in-use
+			assert(m_device.isRayQueryEnabled());
 
-			const auto &commandBuffer = m_commandBuffers.at(commandBufferName);
+			VkAccelerationStructureGeometryKHR geometry = {};
+			VkAccelerationStructureBuildGeometryInfoKHR buildInfo = {};
+			fillTopLevelBuildInfo(&geometry, &buildInfo, 0);
 
-			VkCommandBufferBeginInfo info = {};
-			info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			info.flags = flags;
+			VkAccelerationStructureBuildSizesInfoKHR sizeInfo = {};
+			sizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+			m_device.pfnGetAccelerationStructureBuildSizes(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &maxInstanceCount, &sizeInfo);
 
-			if (vkBeginCommandBuffer(commandBuffer, &info) != VK_SUCCESS)
-			{
-				throw std::runtime_error("Unable to begin command buffer");
-			}
+			const uint32_t name = createAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, sizeInfo.accelerationStructureSize);
+			auto &as = m_accelerationStructures[name];
+			as.scratchBuffer.init(std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize) +
+				m_device.getAccelerationStructureProperties().minAccelerationStructureScratchOffsetAlignment,
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			as.maxInstanceCount = maxInstanceCount;
+			as.builtInstanceCount = 0;
+			return name;
 		}
 
-		void endCommandBuffer(uint32_t commandBufferName) const
+		// Record a build of @tlasName over @instanceCount VkAccelerationStructureInstanceKHR at the start of @instanceBufferName,
+		// which needs VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR and device addresses. With @refit only
+		// the transforms changed since the last build, which is cheaper but traces slower the further the instances moved.
+		// Refits of a different instance count build anew. Shaders and compute passes may query the structure afterwards
+		void cmdBuildTopLevelAccelerationStructure(uint32_t cmdBufferName, uint32_t tlasName, uint32_t instanceBufferName, uint32_t instanceCount,
+			bool refit)
 		{
-			const auto &commandBuffer = m_commandBuffers.at(commandBufferName);
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			auto &as = m_accelerationStructures.at(tlasName);
+			assert(instanceCount <= as.maxInstanceCount);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_BUILD_TOP_LEVEL_ACCELERATION_STRUCTURE, tlasName, instanceBufferName,
+				instanceCount, refit);
+			refit &= instanceCount == as.builtInstanceCount;
+
+			VkAccelerationStructureGeometryKHR geometry = {};
+			VkAccelerationStructureBuildGeometryInfoKHR buildInfo = {};
+			fillTopLevelBuildInfo(&geometry, &buildInfo, getBufferDeviceAddress(instanceBufferName));
+			buildInfo.mode = refit ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+			buildInfo.srcAccelerationStructure = refit ? static_cast<VkAccelerationStructureKHR>(as.handle) : VK_NULL_HANDLE;
+			buildInfo.dstAccelerationStructure = as.handle;
+			buildInfo.scratchData.deviceAddress = alignUp(getBufferDeviceAddress(as.scratchBuffer),
+				m_device.getAccelerationStructureProperties().minAccelerationStructureScratchOffsetAlignment);
+
+			VkAccelerationStructureBuildRangeInfoKHR buildRange = {};
+			buildRange.primitiveCount = instanceCount;
+			const VkAccelerationStructureBuildRangeInfoKHR *pBuildRange = &buildRange;
+			m_device.pfnCmdBuildAccelerationStructures(cmdBuffer, 1, &buildInfo, &pBuildRange);
+			as.builtInstanceCount = instanceCount;
+
+			VkMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+			vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
 
-			if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
-			{
-				throw std::runtime_error("Unable to end command buffer!");
-			}
+		// What instances reference their bottom level structure by
+		VkDeviceAddress getAccelerationStructureAddress(uint32_t accelerationStructureName) const
+		{
+			return m_accelerationStructures.at(accelerationStructureName).address;
+		}
 
-			// std::lock_guard<std::shared_mutex> will unblock for a writer if
-			// all readers have called std::shared_mutex::unlock_shared()
-			g_commandBufferMutex.unlock_shared();
+		void destroyAccelerationStructure(uint32_t accelerationStructureName)
+		{
+			assert(accelerationStructureName < m_accelerationStructures.size());
+			retireName(m_accelerationStructureNames, accelerationStructureName);
 		}
+		// --- Acceleration structures ---
 
-		void cmdBindVertexBuffers(uint32_t cmdBufferName, const std::vector<uint32_t> &bufferNames,
-			const std::vector<VkDeviceSize> &offsets, uint32_t firstBinding = 0) const
+		// --- Sampler related ---
+		// Samplers are immutable, so equal parameters return the same sampler. It is reference counted,
+		// every createSampler needs its own destroySampler
+		uint32_t createSampler(VkFilter magFilter, VkFilter minFilter, VkSamplerMipmapMode mipmapMode,
+			VkSamplerAddressMode addressModeU, VkSamplerAddressMode addressModeV, VkSamplerAddressMode addressModeW,
+			float minLod = 0.f, float maxLod = 0.f, float mipLodBias = 0.f, VkBool32 anisotropyEnable = VK_FALSE,
+			float maxAnisotropy = 0.f, VkBool32 compareEnable = VK_FALSE, VkCompareOp compareOp = VK_COMPARE_OP_NEVER,
+			VkBorderColor borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK, VkBool32 unnormailzedCoords = VK_FALSE,
+			VkSamplerCreateFlags flags = 0)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const SamplerDescription desc = { magFilter, minFilter, mipmapMode, addressModeU, addressModeV, addressModeW,
+				minLod, maxLod, mipLodBias, anisotropyEnable, maxAnisotropy, compareEnable, compareOp,
+				borderColor, unnormailzedCoords, flags };
 
-			uint32_t numVertBuffers = static_cast<uint32_t>(bufferNames.size());
-			std::vector<VkBuffer> vertBuffers;
-			vertBuffers.reserve(numVertBuffers);
-			for (auto name : bufferNames)
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			auto it = m_samplerCache.find(desc);
+			if (it != m_samplerCache.end())
 			{
-				vertBuffers.push_back(m_buffers.at(name));
+				++m_samplerRefCounts[it->second];
+				return it->second;
 			}
 
-			vkCmdBindVertexBuffers(cmdBuffer, firstBinding, numVertBuffers, vertBuffers.data(), offsets.data());
-		}
-
-		void cmdBindIndexBuffer(uint32_t cmdBufferName, uint32_t indexBufferName, VkIndexType type, VkDeviceSize offset = 0) const
-		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
-			const auto &idxBuffer = m_buffers.at(indexBufferName);
+			uint32_t samplerName = m_samplerNames.allocate();
+			if (samplerName == m_samplers.size())
+			{
+				m_samplers.emplace_back(m_device);
+				m_samplerDescriptions.emplace_back();
+				m_samplerRefCounts.push_back(0);
+			}
 
-			vkCmdBindIndexBuffer(cmdBuffer, idxBuffer, offset, type);
+			m_samplers.at(samplerName).init(magFilter, minFilter, mipmapMode, addressModeU, addressModeV, addressModeW,
+				minLod, maxLod, mipLodBias, anisotropyEnable, maxAnisotropy, compareEnable, compareOp,
+				borderColor, unnormailzedCoords, flags);
+			m_samplerDescriptions[samplerName] = desc;
+			m_samplerRefCounts[samplerName] = 1;
+			m_samplerCache[desc] = samplerName;
+			
+			return samplerName;
 		}
 
-		void cmdBeginRenderPass(uint32_t cmdBufferName, uint32_t renderPassName, uint32_t frameBufferName,
-			const std::vector<VkClearValue> &clearValues, VkRect2D renderArea = {}, VkSubpassContents subpassContents = VK_SUBPASS_CONTENTS_INLINE) const
+		// The name is only freed once every createSampler that returned it has been matched
+		void destroySampler(uint32_t samplerName)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
-			const auto &renderPass = m_renderPasses.at(renderPassName);
-			const auto &framebuffer = m_framebuffers.at(frameBufferName);
-
-			renderArea.extent.width = renderArea.extent.width == 0 ? framebuffer.width() : renderArea.extent.width;
-			renderArea.extent.height = renderArea.extent.height == 0 ? framebuffer.height() : renderArea.extent.height;
+			assert(samplerName < m_samplers.size());
+			{
+				std::lock_guard<std::mutex> guard(m_resourceMutex);
+				assert(m_samplerRefCounts[samplerName] > 0);
 
-			VkRenderPassBeginInfo info = {};
-			info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			info.renderPass = renderPass;
-			info.framebuffer = framebuffer;
-			info.renderArea = renderArea;
-			info.clearValueCount = static_cast<uint32_t>(clearValues.size());
-			info.pClearValues = clearValues.size() == 0 ? nullptr : clearValues.data();
+				if (--m_samplerRefCounts[samplerName] > 0) return;
 
-			vkCmdBeginRenderPass(cmdBuffer, &info, subpassContents);
+				// Not found by createSampler anymore, so nothing refers to the name until it is retired
+				m_samplerCache.erase(m_samplerDescriptions[samplerName]);
+			}
+			retireName(m_samplerNames, samplerName);
 		}
 
-		void cmdEndRenderPass(uint32_t cmdBufferName) const
+		// Distinct samplers alive, which count towards maxSamplerAllocationCount
+		uint32_t getSamplerCount() const
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
-
-			vkCmdEndRenderPass(cmdBuffer);
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			return static_cast<uint32_t>(m_samplerCache.size());
 		}
+		// --- Sampler related ---
 
-		void cmdNextSubpass(uint32_t cmdBufferName, VkSubpassContents subpassContents = VK_SUBPASS_CONTENTS_INLINE) const
+		// --- Framebuffer related ---
+		// A shading rate attachment at @shadingRateAttachmentIdx is smaller than the others and does not set the framebuffer extent
+		uint32_t createFramebuffer(uint32_t renderPassName, const std::vector<uint32_t> &attachmentViewNames,
+			uint32_t shadingRateAttachmentIdx = VK_ATTACHMENT_UNUSED)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			VkRenderPass renderPass = m_renderPasses.at(renderPassName);
+			
+			bool first = true;
+			uint32_t width, height, layers;
+			std::vector<VkImageView> attachmentViews;
+			for (auto name : attachmentViewNames)
+			{
+				auto &view = m_imageViews.at(name);
+				if (attachmentViews.size() == shadingRateAttachmentIdx)
+				{
+					attachmentViews.push_back(view);
+					continue;
+				}
+				VkExtent3D extent = view.image()->extent(view.baseLevel());
 
-			vkCmdNextSubpass(cmdBuffer, subpassContents);
-		}
+				if (!first)
+				{
+					if (extent.width != width || extent.height != height || extent.depth != 1 ||
+						view.layers() != layers)
+					{
+						throw std::runtime_error("Image view cannot be used as framebuffer attachment");
+					}
+					first = false;
+				}
 
-		void cmdBindPipeline(uint32_t cmdBufferName, VkPipelineBindPoint pipelineBindPoint, uint32_t pipelineName) const
-		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
-			const auto &pipeline = m_pipelines.at(pipelineName);
+				width = extent.width;
+				height = extent.height;
+				layers = view.layers();
+				attachmentViews.push_back(view);
+			}
 
-			vkCmdBindPipeline(cmdBuffer, pipelineBindPoint, pipeline);
+			uint32_t fbName = m_framebufferNames.allocate();
+			if (fbName == m_framebuffers.size()) m_framebuffers.emplace_back(m_device);
+
+			m_framebuffers[fbName].init(renderPass, attachmentViews, width, height, layers);
+			return fbName;
 		}
 
-		void cmdBindDescriptorSets(uint32_t cmdBufferName, VkPipelineBindPoint pipelineBindPoint, uint32_t pipelineLayoutName,
-			const std::vector<uint32_t> &descriptorSetNames, uint32_t firstSet = 0, const std::vector<uint32_t> &dynamicOffsets = {}) const
+		std::vector<uint32_t> createSwapChainFramebuffers(uint32_t renderPassName)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
-			const auto &pipelineLayout = m_pipelineLayouts.at(pipelineLayoutName);
+			VkRenderPass renderPass = m_renderPasses.at(renderPassName);
 
-			uint32_t numSets = static_cast<uint32_t>(descriptorSetNames.size());
-			std::vector<VkDescriptorSet> sets;
-			sets.reserve(numSets);
-			for (auto name : descriptorSetNames)
+			if (!m_swapChainFramebufferNames.empty())
 			{
-				sets.push_back(m_descriptorSets.at(name));
+				for (uint32_t fbName : m_swapChainFramebufferNames)
+				{
+					retireName(m_framebufferNames, fbName);
+				}
+				m_swapChainFramebufferNames.clear();
 			}
 
-			uint32_t numDynamicOffsets = static_cast<uint32_t>(dynamicOffsets.size());
-
-			vkCmdBindDescriptorSets(cmdBuffer, pipelineBindPoint, pipelineLayout, firstSet, numSets, sets.data(),
-				numDynamicOffsets, numDynamicOffsets == 0 ? nullptr : dynamicOffsets.data());
-		}
-
-		void cmdSetViewport(uint32_t cmdBufferName, uint32_t framebufferName, float topLeftU = 0.f, float topLeftV = 0.f,
-			float width = 1.f, float height = 1.f, float minDepth = 0.f, float maxDepth = 1.f) const
-		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
-			const auto &framebuffer = m_framebuffers.at(framebufferName);
+			const auto &views = m_swapChain.imageViews();
+			VkExtent2D extent = m_swapChain.extent();
 
-			float fbWidth = static_cast<float>(framebuffer.width());
-			float fbHeight = static_cast<float>(framebuffer.height());
+			for (const auto &view : views)
+			{
+				uint32_t fbName = m_framebufferNames.allocate();
+				if (fbName == m_framebuffers.size()) m_framebuffers.emplace_back(m_device);
 
-			VkViewport viewport = {};
-			viewport.x = topLeftU * fbWidth;
-			viewport.y = topLeftV * fbHeight;
-			viewport.width = width * fbWidth;
-			viewport.height = height * fbHeight;
-			viewport.minDepth = minDepth;
-			viewport.maxDepth = maxDepth;
+				m_framebuffers.at(fbName).init(renderPass, { view }, extent.width, extent.height, 1);
+				m_swapChainFramebufferNames.push_back(fbName);
+			}
 
-			vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+			return m_swapChainFramebufferNames;
 		}
 
-		void cmdSetViewport(uint32_t cmdBufferName, float x, float y, float width, float height,
-			float minDepth = 0.f, float maxDepth = 1.f) const
+		void destroyFramebuffer(uint32_t framebufferName)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
-
-			VkViewport viewport = {};
-			viewport.x = x;
-			viewport.y = y;
-			viewport.width = width;
-			viewport.height = height;
-			viewport.minDepth = minDepth;
-			viewport.maxDepth = maxDepth;
-
-			vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+			assert(framebufferName < m_framebuffers.size());
+			assert(m_framebufferNames.isAlive(framebufferName));
+			
+			if (std::find(m_swapChainFramebufferNames.begin(), m_swapChainFramebufferNames.end(), framebufferName) != m_swapChainFramebufferNames.end()) return;
+			retireName(m_framebufferNames, framebufferName);
 		}
 
-		void cmdSetScissor(uint32_t cmdBufferName, uint32_t framebufferName,
-			float topLeftU = 0.f, float topLeftV = 0.f, float width = 1.f, float height = 1.f) const
+		VkExtent2D getFramebufferExtent(uint32_t framebufferName)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
-			const auto &framebuffer = m_framebuffers.at(framebufferName);
-
-			float fbWidth = static_cast<float>(framebuffer.width());
-			float fbHeight = static_cast<float>(framebuffer.height());
+			auto &framebuffer = m_framebuffers.at(framebufferName);
+			return { framebuffer.width(), framebuffer.height() };
+		}
+		// --- Framebuffer related ---
 
-			int32_t x = static_cast<int32_t>(topLeftU * fbWidth);
-			int32_t y = static_cast<int32_t>(topLeftV * fbHeight);
-			uint32_t w = static_cast<uint32_t>(width * fbWidth);
-			uint32_t h = static_cast<uint32_t>(height * fbHeight);
+		// --- GPU Queries ---
+		uint32_t createQueryPool(VkQueryType queryType, uint32_t queryCount, VkQueryPipelineStatisticFlags pipelineStatistics = 0)
+		{
+			uint32_t newPoolName = m_queryPoolNames.allocate();
+			if (newPoolName == m_queryPools.size()) m_queryPools.emplace_back(m_device);
 
-			VkRect2D scissor = {};
-			scissor.offset = { x, y };
-			scissor.extent = { w, h };
+			m_queryPools[newPoolName].init(queryType, queryCount, pipelineStatistics);
 
-			vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+			return newPoolName;
 		}
 
-		void cmdSetScissor(uint32_t cmdBufferName, int32_t x, int32_t y, uint32_t width, uint32_t height) const
+		VkResult getQueryPoolResults(uint32_t queryPoolName, size_t dataSize, VkDeviceSize stride, void *pData,
+			uint32_t firstQuery = 0, uint32_t queryCount = std::numeric_limits<uint32_t>::max(), VkQueryResultFlags flags = 0)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			assert(queryPoolName < m_queryPools.size());
+			assert(m_queryPoolNames.isAlive(queryPoolName));
 
-			VkRect2D scissor = {};
-			scissor.offset = { x, y };
-			scissor.extent = { width, height };
+			const auto &queryPool = m_queryPools[queryPoolName];
+			if (queryCount == std::numeric_limits<uint32_t>::max()) queryCount = queryPool.getQueryCount();
+			assert(firstQuery + queryCount <= queryPool.getQueryCount());
 
-			vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+			// Return VK_NOT_READY if query results are not ready
+			// Make sure cmdResetQueryPool has been executed on this queryPool on GPU before calling.
+			// Otherwise the availability status is from last query (obsolete)
+			return vkGetQueryPoolResults(m_device, queryPool, firstQuery, queryCount, dataSize, pData, stride, flags);
 		}
 
-		void cmdDrawIndexed(uint32_t cmdBufferName, uint32_t indexCount, uint32_t instanceCount = 1, uint32_t firstIndex = 0,
-			int32_t vertexOffset = 0, uint32_t firstInstance = 0) const
+		void destroyQueryPool(uint32_t queryPoolName)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			assert(queryPoolName < m_queryPools.size());
+			assert(m_queryPoolNames.isAlive(queryPoolName));
 
-			vkCmdDrawIndexed(cmdBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+			retireName(m_queryPoolNames, queryPoolName);
 		}
+		// --- GPU Queries ---
 
-		void cmdDraw(uint32_t cmdBufferName, uint32_t vertexCount, uint32_t instanceCount = 1,
-			uint32_t firstVertex = 0, uint32_t firstInstance = 0) const
+		// --- Descriptor pool related ---
+		void beginCreateDescriptorPool(uint32_t maxNumSets)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			m_curDescriptorPoolInfo = {};
+			m_curDescriptorPoolInfo.maxSetCount = maxNumSets;
+			m_curDescriptorPoolName = static_cast<uint32_t>(m_descriptorPools.size());
+			m_descriptorPools.emplace(std::piecewise_construct, std::forward_as_tuple(m_curDescriptorPoolName),
+				std::forward_as_tuple(m_device));
+		}
 
-			vkCmdDraw(cmdBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+		void descriptorPoolAddDescriptors(VkDescriptorType type, uint32_t count)
+		{
+			auto &poolSizes = m_curDescriptorPoolInfo.poolSizes;
+			
+			VkDescriptorPoolSize ps = {};
+			ps.type = type;
+			ps.descriptorCount = count;
+			poolSizes.push_back(ps);
 		}
 
-		void cmdPushConstants(uint32_t cmdBufferName, uint32_t pipelineLayoutName, VkShaderStageFlags shaderStages,
-			uint32_t offset, uint32_t sizeInBytes, const void *pValues) const
+		uint32_t endCreateDescriptorPool()
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
-			const auto &pipelineLayout = m_pipelineLayouts.at(pipelineLayoutName);
+			uint32_t maxSet = m_curDescriptorPoolInfo.maxSetCount;
+			auto &poolSizes = m_curDescriptorPoolInfo.poolSizes;
+			m_descriptorPools.at(m_curDescriptorPoolName).init(maxSet, poolSizes);
+			
+			m_poolSetTable[m_curDescriptorPoolName] = {};
 
-			vkCmdPushConstants(cmdBuffer, pipelineLayout, shaderStages, offset, sizeInBytes, pValues);
+			return m_curDescriptorPoolName;
 		}
 
-		void cmdDispatch(uint32_t cmdBufferName, uint32_t numBlocksX, uint32_t numBlocksY, uint32_t numBlocksZ)
+		void resetDescriptorPool(uint32_t poolName, VkDescriptorPoolResetFlags flags = 0)
 		{
-			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &pool = m_descriptorPools.at(poolName);
 
-			vkCmdDispatch(cmdBuffer, numBlocksX, numBlocksY, numBlocksZ);
+			if (vkResetDescriptorPool(m_device, pool, flags) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to reset descriptor pool");
+			}
+
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			auto &poolSets = m_poolSetTable.at(poolName);
+			for (uint32_t setName : poolSets)
+			{
+				m_descriptorSetNames.release(setName);
+			}
+			poolSets.clear();
 		}
+		// --- Descriptor pool related ---
 
-		void cmdResetQueryPool(uint32_t cmdBufferName, uint32_t queryPoolName,
-			uint32_t firstQuery = 0, uint32_t queryCount = std::numeric_limits<uint32_t>::max())
+		// --- Descriptor sets ---
+		// May be called from any thread. Vulkan pools need external synchronization, so allocations from all pools take turns
+		std::vector<uint32_t> allocateDescriptorSets(uint32_t descriptorPoolName, const std::vector<uint32_t> &setLayoutNames)
 		{
-			assert(queryPoolName < m_queryPools.size());
-			assert(std::find(m_availableQueryPoolNames.begin(), m_availableQueryPoolNames.end(), queryPoolName) == m_availableQueryPoolNames.end());
-
-			const auto &cb = m_commandBuffers[cmdBufferName];
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			auto &pool = m_descriptorPools.at(descriptorPoolName);
+			
+			std::vector<VkDescriptorSetLayout> layouts;
+			layouts.reserve(setLayoutNames.size());
+			for (auto name : setLayoutNames)
+			{
+				layouts.push_back(m_descriptorSetLayouts.at(name));
+			}
+
+			VkDescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = pool;
+			allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+			allocInfo.pSetLayouts = layouts.data();
+
+			std::vector<VkDescriptorSet> sets(layouts.size());
+			if (vkAllocateDescriptorSets(m_device, &allocInfo, sets.data()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate descriptor set!");
+			}
+
+			std::vector<uint32_t> setNames;
+			setNames.reserve(sets.size());
+			for (auto set : sets)
+			{
+				uint32_t setName = m_descriptorSetNames.allocate();
+				if (setName == m_descriptorSets.size()) m_descriptorSets.emplace_back(VK_NULL_HANDLE);
+
+				setNames.push_back(setName);
+				m_descriptorSets[setName] = set;
+			}
+
+			auto &entry = m_poolSetTable[descriptorPoolName];
+			entry.insert(entry.end(), setNames.begin(), setNames.end());
+
+			return setNames;
+		}
+
+		void beginUpdateDescriptorSet(uint32_t setName)
+		{
+			m_curDescriptorSetInfo = {};
+			m_curDescriptorSetName = setName;
+		}
+
+		void descriptorSetAddBufferDescriptor(uint32_t binding, VkDescriptorType type, const std::vector<DescriptorSetUpdateBufferInfo> &updateInfos,
+			uint32_t baseArrayElement = 0)
+		{
+			assert(!updateInfos.empty());
+
+			auto &bufferInfoTable = m_curDescriptorSetInfo.bufferInfos;
+			assert(bufferInfoTable.find(binding) == bufferInfoTable.end());
+			bufferInfoTable[binding] = {};
+			auto &bufferInfos = bufferInfoTable[binding];
+
+			bufferInfos.reserve(updateInfos.size());
+			for (const auto &updateInfo : updateInfos)
+			{
+				VkDescriptorBufferInfo info = {};
+				info.buffer = m_buffers.at(updateInfo.bufferName);
+				info.offset = updateInfo.offset;
+				info.range = updateInfo.sizeInBytes;
+				bufferInfos.push_back(info);
+			}
+
+			auto &writeInfos = m_curDescriptorSetInfo.writeInfos;
+			writeInfos.push_back({});
+			auto &writeInfo = writeInfos.back();
+
+			writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeInfo.dstSet = m_descriptorSets[m_curDescriptorSetName];
+			writeInfo.dstBinding = binding;
+			writeInfo.dstArrayElement = baseArrayElement;
+			writeInfo.descriptorType = type;
+			writeInfo.descriptorCount = static_cast<uint32_t>(bufferInfos.size());
+			writeInfo.pBufferInfo = bufferInfos.data();
+
+			if (m_pCommandCapture)
+			{
+				m_pCommandCapture->recordDescriptorCall(VCommandCapture::DESC_BUFFERS, m_curDescriptorSetName, binding, type, baseArrayElement,
+					ArrayView<DescriptorSetUpdateBufferInfo>(updateInfos));
+			}
+		}
+
+		void descriptorSetAddImageDescriptor(uint32_t binding, VkDescriptorType type, const std::vector<DescriptorSetUpdateImageInfo> &updateInfos,
+			uint32_t baseArrayElement = 0)
+		{
+			assert(!updateInfos.empty());
+
+			auto &imageInfoTable = m_curDescriptorSetInfo.imageInfos;
+			assert(imageInfoTable.find(binding) == imageInfoTable.end());
+			imageInfoTable[binding] = {};
+			auto &imageInfos = imageInfoTable.at(binding);
+
+			imageInfos.reserve(updateInfos.size());
+			for (const auto &updateInfo : updateInfos)
+			{
+				VkDescriptorImageInfo info = {};
+				info.sampler = updateInfo.samplerName == std::numeric_limits<uint32_t>::max() ? VK_NULL_HANDLE : VkSampler(m_samplers.at(updateInfo.samplerName));
+				info.imageView = m_imageViews.at(updateInfo.imageViewName);
+				info.imageLayout = updateInfo.layout;
+				imageInfos.push_back(info);
+			}
+
+			auto &writeInfos = m_curDescriptorSetInfo.writeInfos;
+			writeInfos.push_back({});
+			auto &writeInfo = writeInfos.back();
+
+			writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeInfo.dstSet = m_descriptorSets[m_curDescriptorSetName];
+			writeInfo.dstBinding = binding;
+			writeInfo.dstArrayElement = baseArrayElement;
+			writeInfo.descriptorType = type;
+			writeInfo.descriptorCount = static_cast<uint32_t>(imageInfos.size());
+			writeInfo.pImageInfo = imageInfos.data();
+
+			if (m_pCommandCapture)
+			{
+				m_pCommandCapture->recordDescriptorCall(VCommandCapture::DESC_IMAGES, m_curDescriptorSetName, binding, type, baseArrayElement,
+					ArrayView<DescriptorSetUpdateImageInfo>(updateInfos));
+			}
+		}
+
+		// Needs isRayQueryEnabled()
+		void descriptorSetAddAccelerationStructureDescriptor(uint32_t binding, uint32_t accelerationStructureName)
+		{
+			auto &asInfoTable = m_curDescriptorSetInfo.accelerationStructureInfos;
+			assert(asInfoTable.find(binding) == asInfoTable.end());
+			auto &asInfo = asInfoTable[binding];
+			asInfo.handle = m_accelerationStructures.at(accelerationStructureName).handle;
+			asInfo.write = {};
+			asInfo.write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+			asInfo.write.accelerationStructureCount = 1;
+			asInfo.write.pAccelerationStructures = &asInfo.handle;
+
+			auto &writeInfos = m_curDescriptorSetInfo.writeInfos;
+			writeInfos.push_back({});
+			auto &writeInfo = writeInfos.back();
+
+			writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeInfo.pNext = &asInfo.write;
+			writeInfo.dstSet = m_descriptorSets[m_curDescriptorSetName];
+			writeInfo.dstBinding = binding;
+			writeInfo.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+			writeInfo.descriptorCount = 1;
+
+			if (m_pCommandCapture)
+			{
+				m_pCommandCapture->recordDescriptorCall(VCommandCapture::DESC_ACCELERATION_STRUCTURE, m_curDescriptorSetName, binding,
+					accelerationStructureName);
+			}
+		}
+
+		void endUpdateDescriptorSet()
+		{
+			if (m_descriptorUpdateBatchDepth > 0)
+			{
+				// The write infos point into the tables, whose elements stay in place when the tables are moved
+				m_batchedDescriptorSetInfos.push_back(std::move(m_curDescriptorSetInfo));
+			}
+			else
+			{
+				vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(m_curDescriptorSetInfo.writeInfos.size()),
+					m_curDescriptorSetInfo.writeInfos.data(), 0, nullptr);
+			}
+
+			m_curDescriptorSetName = std::numeric_limits<uint32_t>::max();
+			m_curDescriptorSetInfo = {};
+		}
+
+		// Between these, endUpdateDescriptorSet() only queues the writes of its set, and the end writes all queued sets with
+		// one vkUpdateDescriptorSets call, e.g. for the sets of every swapchain image rewritten on a resize. Batches nest, the
+		// outermost end writes. The queued sets must not be bound or copied before then
+		void beginDescriptorUpdateBatch()
+		{
+			++m_descriptorUpdateBatchDepth;
+		}
+
+		void endDescriptorUpdateBatch()
+		{
+			assert(m_descriptorUpdateBatchDepth > 0);
+			if (--m_descriptorUpdateBatchDepth > 0) return;
+
+			size_t writeCount = 0;
+			for (const auto &info : m_batchedDescriptorSetInfos) writeCount += info.writeInfos.size();
+			std::vector<VkWriteDescriptorSet> writeInfos;
+			writeInfos.reserve(writeCount);
+			for (const auto &info : m_batchedDescriptorSetInfos)
+			{
+				writeInfos.insert(writeInfos.end(), info.writeInfos.begin(), info.writeInfos.end());
+			}
+			if (!writeInfos.empty()) vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writeInfos.size()), writeInfos.data(), 0, nullptr);
+			m_batchedDescriptorSetInfos.clear();
+		}
+
+		// begin/endUpdateDescriptorSet() in one call without the builder state, so it may be called from any thread.
+		// No other thread may write or bind @setName at the same time
+		void writeDescriptorSet(uint32_t setName, ArrayView<PushDescriptorWrite> writes) const
+		{
+			// Sized up front, the write infos point into them
+			thread_local std::vector<VkDescriptorBufferInfo> bufferInfos;
+			thread_local std::vector<VkDescriptorImageInfo> imageInfos;
+			thread_local std::vector<VkWriteDescriptorSet> writeInfos;
+			bufferInfos.resize(writes.size());
+			imageInfos.resize(writes.size());
+			writeInfos.resize(writes.size());
+
+			for (size_t i = 0; i < writes.size(); ++i)
+			{
+				const auto &write = writes[i];
+				auto &writeInfo = writeInfos[i];
+				writeInfo = {};
+				writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writeInfo.dstSet = m_descriptorSets.at(setName);
+				writeInfo.dstBinding = write.binding;
+				writeInfo.descriptorCount = 1;
+				writeInfo.descriptorType = write.type;
+
+				if (isBufferDescriptorType(write.type))
+				{
+					bufferInfos[i] = getDescriptorBufferInfo(write.bufferInfo);
+					writeInfo.pBufferInfo = &bufferInfos[i];
+				}
+				else
+				{
+					imageInfos[i] = getDescriptorImageInfo(write.imageInfo);
+					writeInfo.pImageInfo = &imageInfos[i];
+				}
+			}
+
+			vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writeInfos.size()), writeInfos.data(), 0, nullptr);
+			if (m_pCommandCapture) m_pCommandCapture->recordDescriptorCall(VCommandCapture::DESC_WRITES, setName, writes);
+		}
+
+		bool isDescriptorUpdateTemplateEnabled() const
+		{
+			return m_device.isDescriptorUpdateTemplateEnabled();
+		}
+
+		// Template that writes one descriptor per entry of @entries, of its binding and type, to sets of @setLayoutName. The
+		// descriptors of the entries are not used. Needs isDescriptorUpdateTemplateEnabled(). Templates live as long as the manager
+		uint32_t createDescriptorUpdateTemplate(uint32_t setLayoutName, ArrayView<PushDescriptorWrite> entries)
+		{
+			assert(isDescriptorUpdateTemplateEnabled());
+
+			std::vector<VkDescriptorUpdateTemplateEntryKHR> templateEntries(entries.size());
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				auto &entry = templateEntries[i];
+				entry.dstBinding = entries[i].binding;
+				entry.dstArrayElement = 0;
+				entry.descriptorCount = 1;
+				entry.descriptorType = entries[i].type;
+				entry.offset = i * sizeof(TemplateDescriptorInfo);
+				entry.stride = sizeof(TemplateDescriptorInfo);
+			}
+
+			VkDescriptorUpdateTemplateCreateInfoKHR createInfo = {};
+			createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR;
+			createInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(templateEntries.size());
+			createInfo.pDescriptorUpdateEntries = templateEntries.data();
+			createInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+			createInfo.descriptorSetLayout = m_descriptorSetLayouts.at(setLayoutName);
+
+			DescriptorUpdateTemplate updateTemplate(m_device);
+			if (m_device.pfnCreateDescriptorUpdateTemplate(m_device, &createInfo, helper_functions::getHostAllocationCallbacks(),
+				updateTemplate.handle.replace()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create descriptor update template!");
+			}
+			updateTemplate.types.reserve(entries.size());
+			for (const auto &entry : entries) updateTemplate.types.push_back(entry.type);
+
+			m_descriptorUpdateTemplates.push_back(std::move(updateTemplate));
+			return static_cast<uint32_t>(m_descriptorUpdateTemplates.size() - 1);
+		}
+
+		// writeDescriptorSet() with @templateName, whose entries @writes matches in order. Skips building a write per descriptor
+		// and the driver's parsing of them, for sets of one layout written over and over
+		void writeDescriptorSetWithTemplate(uint32_t setName, uint32_t templateName, ArrayView<PushDescriptorWrite> writes) const
+		{
+			const auto &updateTemplate = m_descriptorUpdateTemplates.at(templateName);
+			assert(writes.size() == updateTemplate.types.size());
+
+			thread_local std::vector<TemplateDescriptorInfo> infos;
+			infos.resize(writes.size());
+			for (size_t i = 0; i < writes.size(); ++i)
+			{
+				assert(writes[i].type == updateTemplate.types[i]);
+				if (isBufferDescriptorType(writes[i].type))
+				{
+					infos[i].buffer = getDescriptorBufferInfo(writes[i].bufferInfo);
+				}
+				else
+				{
+					infos[i].image = getDescriptorImageInfo(writes[i].imageInfo);
+				}
+			}
+
+			m_device.pfnUpdateDescriptorSetWithTemplate(m_device, m_descriptorSets.at(setName), updateTemplate.handle, infos.data());
+			if (m_pCommandCapture) m_pCommandCapture->recordDescriptorCall(VCommandCapture::DESC_WRITES, setName, writes);
+		}
+		// --- Descriptor sets ---
+
+		// --- Transient descriptor sets ---
+		// Descriptor sets that live for one frame, e.g. of culled draw lists or streamed textures. Each of @frameCount frames
+		// allocates from its own pools, which are reset together by beginTransientDescriptorFrame() once the GPU is done with
+		// that frame. Pools hold @maxSetsPerPool sets and @poolSizes descriptors, a frame that needs more gets another pool,
+		// so nothing has to be allocated up front for the worst case. Allocators are never destroyed, like descriptor pools
+		uint32_t createTransientDescriptorAllocator(uint32_t frameCount, uint32_t maxSetsPerPool, ArrayView<VkDescriptorPoolSize> poolSizes)
+		{
+			TransientDescriptorAllocator allocator;
+			allocator.maxSetsPerPool = maxSetsPerPool;
+			allocator.poolSizes.assign(poolSizes.begin(), poolSizes.end());
+			allocator.frames.resize(frameCount);
+			m_transientDescriptorAllocators.push_back(std::move(allocator));
+			return static_cast<uint32_t>(m_transientDescriptorAllocators.size() - 1);
+		}
+
+		// Free the sets @frameIdx allocated last time. Their names are handed out again
+		void beginTransientDescriptorFrame(uint32_t allocatorName, uint32_t frameIdx)
+		{
+			auto &frame = m_transientDescriptorAllocators.at(allocatorName).frames.at(frameIdx);
+			for (uint32_t i = 0; i <= frame.curPool && i < frame.pools.size(); ++i)
+			{
+				resetDescriptorPool(frame.pools[i]);
+			}
+			frame.curPool = 0;
+		}
+
+		// The set is written with begin/endUpdateDescriptorSet() as usual and valid until @frameIdx begins again
+		uint32_t allocateTransientDescriptorSet(uint32_t allocatorName, uint32_t frameIdx, uint32_t setLayoutName)
+		{
+			auto &allocator = m_transientDescriptorAllocators.at(allocatorName);
+			auto &frame = allocator.frames.at(frameIdx);
+
+			VkDescriptorSetLayout layout = m_descriptorSetLayouts.at(setLayoutName);
+			VkDescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &layout;
+
+			VkDescriptorSet set = VK_NULL_HANDLE;
+			while (true)
+			{
+				if (frame.curPool == frame.pools.size())
+				{
+					beginCreateDescriptorPool(allocator.maxSetsPerPool);
+					for (const auto &size : allocator.poolSizes)
+					{
+						descriptorPoolAddDescriptors(size.type, size.descriptorCount);
+					}
+					frame.pools.push_back(endCreateDescriptorPool());
+				}
+
+				const uint32_t poolName = frame.pools[frame.curPool];
+				allocInfo.descriptorPool = m_descriptorPools.at(poolName);
+				const VkResult result = vkAllocateDescriptorSets(m_device, &allocInfo, &set);
+				if (result == VK_SUCCESS)
+				{
+					std::lock_guard<std::mutex> guard(m_resourceMutex);
+					const uint32_t setName = m_descriptorSetNames.allocate();
+					if (setName == m_descriptorSets.size()) m_descriptorSets.emplace_back(VK_NULL_HANDLE);
+					m_descriptorSets[setName] = set;
+					m_poolSetTable[poolName].push_back(setName);
+					if (m_pCommandCapture)
+					{
+						m_pCommandCapture->recordDescriptorCall(VCommandCapture::DESC_ALLOCATE_TRANSIENT, allocatorName, frameIdx, setLayoutName,
+							setName);
+					}
+					return setName;
+				}
+
+				// A set that does not even fit an empty pool never will
+				if ((result != VK_ERROR_OUT_OF_POOL_MEMORY_KHR && result != VK_ERROR_FRAGMENTED_POOL) ||
+					m_poolSetTable[poolName].empty())
+				{
+					throw std::runtime_error("failed to allocate transient descriptor set!");
+				}
+				++frame.curPool;
+			}
+		}
+		// --- Transient descriptor sets ---
+
+		// --- Command pool related ---
+		uint32_t createCommandPool(VkQueueFlagBits submitQueueType, VkCommandPoolCreateFlags flags = 0)
+		{
+			uint32_t queueFamilyIndex;
+			const auto &queueFamilyIndices = m_device.getQueueFamilyIndices();
+			switch (submitQueueType)
+			{
+			case VK_QUEUE_GRAPHICS_BIT:
+				queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+				break;
+			case VK_QUEUE_COMPUTE_BIT:
+				queueFamilyIndex = queueFamilyIndices.computeFamily;
+				break;
+			case VK_QUEUE_TRANSFER_BIT:
+				queueFamilyIndex = queueFamilyIndices.transferFamily;
+				break;
+			default:
+				throw std::invalid_argument("unsupported queue type specified during command pool creation");
+			}
+
+			uint32_t newPoolName;
+			newPoolName = static_cast<uint32_t>(m_commandPools.size());
+			m_commandPools.emplace(std::piecewise_construct, std::forward_as_tuple(newPoolName),
+				std::forward_as_tuple(m_device, vkDestroyCommandPool));
+
+			VkCommandPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.queueFamilyIndex = queueFamilyIndex;
+			poolInfo.flags = flags;
+
+			auto &pool = m_commandPools[newPoolName];
+			if (vkCreateCommandPool(m_device, &poolInfo, helper_functions::getHostAllocationCallbacks(), pool.replace()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create command pool!");
+			}
+
+			{
+				std::lock_guard<std::shared_mutex> gaurd(g_commandBufferMutex);
+				m_commandBufferTable[newPoolName] = {};
+			}
+
+			return newPoolName;
+		}
+
+		void resetCommandPool(uint32_t commandPoolName, VkCommandPoolResetFlags flags = 0)
+		{
+			std::lock_guard<std::shared_mutex> guard(g_commandBufferMutex); // no command buffer is in-use
+
+			VkCommandPool pool = VK_NULL_HANDLE;
+			pool = m_commandPools.at(commandPoolName);
+
+			if (vkResetCommandPool(m_device, pool, flags) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to reset command buffer");
+			}
+
+			if (flags & VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT)
+			{
+				auto &cbNames = m_commandBufferTable[commandPoolName];
+				m_commandBufferAvaiableNames.insert(m_commandBufferAvaiableNames.end(), cbNames.begin(), cbNames.end());
+				cbNames.clear();
+			}
+		}
+
+		// One pool per recording thread and frame, each with @buffersPerPool command buffers allocated up front.
+		// A frame's pools are reset together by resetCommandPoolSet(), after which every thread takes the buffers of its own
+		// pool with acquireCommandBuffer(). Neither takes g_commandBufferMutex, and neither do begin/endCommandBuffer() for
+		// these buffers, so recording threads share no lock. Sets are never destroyed, like pools
+		uint32_t createCommandPoolSet(VkQueueFlagBits submitQueueType, uint32_t threadCount, uint32_t frameCount,
+			uint32_t buffersPerPool, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+		{
+			CommandPoolSet set;
+			set.threadCount = threadCount;
+			set.frameCount = frameCount;
+			set.buffersPerPool = buffersPerPool;
+			set.pools.reserve(threadCount * frameCount);
+			set.buffers.reserve(threadCount * frameCount * buffersPerPool);
+			set.acquiredCounts.reset(new std::atomic<uint32_t>[threadCount * frameCount]);
+
+			for (uint32_t i = 0; i < threadCount * frameCount; ++i)
+			{
+				// Buffers are only ever reset with their pool, which lets the driver skip per buffer bookkeeping
+				const uint32_t pool = createCommandPool(submitQueueType, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+				const auto cbs = allocateCommandBuffers(pool, buffersPerPool, level);
+				set.pools.push_back(pool);
+				set.buffers.insert(set.buffers.end(), cbs.begin(), cbs.end());
+				set.acquiredCounts[i].store(0, std::memory_order_relaxed);
+			}
+
+			{
+				std::lock_guard<std::shared_mutex> guard(g_commandBufferMutex);
+				for (uint32_t cb : set.buffers)
+				{
+					m_lockFreeCommandBuffers[cb] = true;
+				}
+			}
+
+			m_commandPoolSets.push_back(std::move(set));
+			return static_cast<uint32_t>(m_commandPoolSets.size() - 1);
+		}
+
+		// The GPU must be done with @frameIdx's buffers of the set and no thread may be recording into them
+		void resetCommandPoolSet(uint32_t setName, uint32_t frameIdx)
+		{
+			auto &set = m_commandPoolSets.at(setName);
+			for (uint32_t t = 0; t < set.threadCount; ++t)
+			{
+				const uint32_t poolIdx = frameIdx * set.threadCount + t;
+				if (vkResetCommandPool(m_device, m_commandPools.at(set.pools[poolIdx]), 0) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to reset command pool set");
+				}
+				set.acquiredCounts[poolIdx].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		// The next unused command buffer of @threadIdx's pool for @frameIdx. Buffers are handed out in order,
+		// so the n-th one acquired since the reset is getCommandPoolSetBuffer(setName, frameIdx, threadIdx, n)
+		uint32_t acquireCommandBuffer(uint32_t setName, uint32_t frameIdx, uint32_t threadIdx)
+		{
+			auto &set = m_commandPoolSets.at(setName);
+			const uint32_t poolIdx = frameIdx * set.threadCount + threadIdx;
+			const uint32_t idx = set.acquiredCounts[poolIdx].fetch_add(1, std::memory_order_relaxed);
+			if (idx >= set.buffersPerPool)
+			{
+				throw std::runtime_error("command pool set ran out of command buffers");
+			}
+			return set.buffers[poolIdx * set.buffersPerPool + idx];
+		}
+
+		uint32_t getCommandPoolSetBuffer(uint32_t setName, uint32_t frameIdx, uint32_t threadIdx, uint32_t bufferIdx) const
+		{
+			const auto &set = m_commandPoolSets.at(setName);
+			return set.buffers[(frameIdx * set.threadCount + threadIdx) * set.buffersPerPool + bufferIdx];
+		}
+
+		uint32_t getCommandPoolSetFrameCount(uint32_t setName) const
+		{
+			return m_commandPoolSets.at(setName).frameCount;
+		}
+		// --- Command pool related ---
+
+		// --- Command buffer related ---
+		void beginSingleTimeCommands()
+		{
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandPool = m_commandPools[m_singleSubmitCommandPoolName];
+			allocInfo.commandBufferCount = 1;
+
+			vkAllocateCommandBuffers(m_device, &allocInfo, &m_singleTimeCommandBuffer);
+
+			VkCommandBufferBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+			vkBeginCommandBuffer(m_singleTimeCommandBuffer, &beginInfo);
+		}
+
+		// @fence is signaled when the commands complete, e.g. to recycle staging ring segments
+		void endSingleTimeCommands(VkFence fence = VK_NULL_HANDLE)
+		{
+			vkEndCommandBuffer(m_singleTimeCommandBuffer);
+
+			VkSubmitInfo submitInfo = {};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &m_singleTimeCommandBuffer;
+
+			vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, fence);
+			vkQueueWaitIdle(m_device.getGraphicsQueue());
+
+			vkFreeCommandBuffers(m_device, m_commandPools[m_singleSubmitCommandPoolName], 1, &m_singleTimeCommandBuffer);
+
+			m_singleTimeCommandBuffer = VK_NULL_HANDLE;
+		}
+
+		std::vector<uint32_t> allocateCommandBuffers(uint32_t poolName, uint32_t count,
+			VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+		{
+			VkCommandPool pool = VK_NULL_HANDLE;
+			std::vector<VkCommandBuffer> cbs(count);
+			
+			pool = m_commandPools.at(poolName);
+
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.level = level;
+			allocInfo.commandPool = pool;
+			allocInfo.commandBufferCount = count;
+
+			if (vkAllocateCommandBuffers(m_device, &allocInfo, cbs.data()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate command buffers!");
+			}
+
+			std::vector<uint32_t> commandBufferNames;
+			commandBufferNames.reserve(count);
+			{
+				std::lock_guard<std::shared_mutex> guard(g_commandBufferMutex);
+
+				auto &poolCbs = m_commandBufferTable.at(poolName);
+				for (auto cb : cbs)
+				{
+					uint32_t cbName;
+
+					if (!m_commandBufferAvaiableNames.empty())
+					{
+						cbName = m_commandBufferAvaiableNames.back();
+						m_commandBufferAvaiableNames.pop_back();
+					}
+					else
+					{
+						cbName = static_cast<uint32_t>(m_commandBuffers.size());
+						m_commandBuffers.push_back(VK_NULL_HANDLE);
+						m_commandCounters.emplace_back();
+						m_lockFreeCommandBuffers.push_back(false);
+					}
+
+					m_commandBuffers[cbName] = cb;
+					m_lockFreeCommandBuffers[cbName] = false;
+					commandBufferNames.push_back(cbName);
+					poolCbs.push_back(cbName);
+				}
+			}
+
+			return commandBufferNames;
+		}
+
+		void beginCommandBuffer(uint32_t commandBufferName, VkCommandBufferUsageFlags flags = 0) const
+		{
+			if (!m_lockFreeCommandBuffers.at(commandBufferName)) g_commandBufferMutex.lock_shared(); // some command buffer(s) are in-use
+
+			const auto &commandBuffer = m_commandBuffers.at(commandBufferName);
+			m_commandCounters[commandBufferName] = {};
+			if (m_pCommandCapture)
+			{
+				m_pCommandCapture->beginCommandBuffer(commandBufferName);
+				captureCommand(commandBufferName, VCommandCapture::CMD_BEGIN, flags);
+			}
+
+			VkCommandBufferBeginInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			info.flags = flags;
+
+			if (vkBeginCommandBuffer(commandBuffer, &info) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Unable to begin command buffer");
+			}
+		}
+
+		// Begin a secondary command buffer that will be executed inside @subpass of @renderPassName.
+		// Can be called from any thread as long as the pool of @commandBufferName is only used by that thread
+		// @pipelineStatistics: counters of the statistics queries that may be active in the primary command buffer
+		void beginSecondaryCommandBuffer(uint32_t commandBufferName, uint32_t renderPassName, uint32_t subpass,
+			uint32_t framebufferName = std::numeric_limits<uint32_t>::max(), VkCommandBufferUsageFlags flags = 0,
+			VkQueryPipelineStatisticFlags pipelineStatistics = 0) const
+		{
+			if (!m_lockFreeCommandBuffers.at(commandBufferName)) g_commandBufferMutex.lock_shared(); // some command buffer(s) are in-use
+
+			const auto &commandBuffer = m_commandBuffers.at(commandBufferName);
+			m_commandCounters[commandBufferName] = {};
+			if (m_pCommandCapture)
+			{
+				m_pCommandCapture->beginCommandBuffer(commandBufferName);
+				captureCommand(commandBufferName, VCommandCapture::CMD_BEGIN_SECONDARY, renderPassName, subpass, framebufferName, flags,
+					pipelineStatistics);
+			}
+
+			VkCommandBufferInheritanceInfo inheritanceInfo = {};
+			inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+			inheritanceInfo.renderPass = m_renderPasses.at(renderPassName);
+			inheritanceInfo.subpass = subpass;
+			inheritanceInfo.framebuffer = framebufferName == std::numeric_limits<uint32_t>::max() ?
+				VK_NULL_HANDLE : VkFramebuffer(m_framebuffers.at(framebufferName));
+			inheritanceInfo.pipelineStatistics = pipelineStatistics;
+
+			VkCommandBufferBeginInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			info.flags = flags | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+			info.pInheritanceInfo = &inheritanceInfo;
+
+			if (vkBeginCommandBuffer(commandBuffer, &info) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Unable to begin secondary command buffer");
+			}
+		}
+
+		void endCommandBuffer(uint32_t commandBufferName) const
+		{
+			const auto &commandBuffer = m_commandBuffers.at(commandBufferName);
+
+			if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Unable to end command buffer!");
+			}
+
+			// std::lock_guard<std::shared_mutex> will unblock for a writer if
+			// all readers have called std::shared_mutex::unlock_shared()
+			if (!m_lockFreeCommandBuffers[commandBufferName]) g_commandBufferMutex.unlock_shared();
+		}
+
+		// Commands recorded since @commandBufferName began. Read it on the recording thread or once recording has ended
+		const CommandCounters &getCommandCounters(uint32_t commandBufferName) const
+		{
+			return m_commandCounters.at(commandBufferName);
+		}
+
+		void cmdBindVertexBuffers(uint32_t cmdBufferName, ArrayView<uint32_t> bufferNames,
+			ArrayView<VkDeviceSize> offsets, uint32_t firstBinding = 0) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			uint32_t numVertBuffers = static_cast<uint32_t>(bufferNames.size());
+			thread_local std::vector<VkBuffer> vertBuffers; // scratch kept by each recording thread
+			vertBuffers.clear();
+			for (auto name : bufferNames)
+			{
+				vertBuffers.push_back(m_buffers.at(name));
+			}
+
+			vkCmdBindVertexBuffers(cmdBuffer, firstBinding, numVertBuffers, vertBuffers.data(), offsets.data());
+			captureCommand(cmdBufferName, VCommandCapture::CMD_BIND_VERTEX_BUFFERS, bufferNames, offsets, firstBinding);
+			++m_commandCounters[cmdBufferName].vertexBufferBinds;
+		}
+
+		void cmdBindIndexBuffer(uint32_t cmdBufferName, uint32_t indexBufferName, VkIndexType type, VkDeviceSize offset = 0) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &idxBuffer = m_buffers.at(indexBufferName);
+
+			vkCmdBindIndexBuffer(cmdBuffer, idxBuffer, offset, type);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_BIND_INDEX_BUFFER, indexBufferName, type, offset);
+			++m_commandCounters[cmdBufferName].indexBufferBinds;
+		}
+
+		void cmdBeginRenderPass(uint32_t cmdBufferName, uint32_t renderPassName, uint32_t frameBufferName,
+			ArrayView<VkClearValue> clearValues, VkRect2D renderArea = {}, VkSubpassContents subpassContents = VK_SUBPASS_CONTENTS_INLINE) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &renderPass = m_renderPasses.at(renderPassName);
+			const auto &framebuffer = m_framebuffers.at(frameBufferName);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_BEGIN_RENDER_PASS, renderPassName, frameBufferName, clearValues, renderArea,
+				subpassContents);
+
+			renderArea.extent.width = renderArea.extent.width == 0 ? framebuffer.width() : renderArea.extent.width;
+			renderArea.extent.height = renderArea.extent.height == 0 ? framebuffer.height() : renderArea.extent.height;
+
+			const auto &traffic = m_renderPassTraffic[renderPassName];
+			const uint64_t pixelCount = static_cast<uint64_t>(renderArea.extent.width) * renderArea.extent.height * framebuffer.layers();
+			m_commandCounters[cmdBufferName].bytesRead += traffic.bytesReadPerPixel * pixelCount;
+			m_commandCounters[cmdBufferName].bytesWritten += traffic.bytesWrittenPerPixel * pixelCount;
+
+			VkRenderPassBeginInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			info.renderPass = renderPass;
+			info.framebuffer = framebuffer;
+			info.renderArea = renderArea;
+			info.clearValueCount = static_cast<uint32_t>(clearValues.size());
+			info.pClearValues = clearValues.size() == 0 ? nullptr : clearValues.data();
+
+			// Every instance is a label region named after its render pass
+			if (isDebugUtilsEnabled()) cmdBeginDebugLabel(cmdBufferName, m_renderPassDebugNames[renderPassName]);
+			vkCmdBeginRenderPass(cmdBuffer, &info, subpassContents);
+		}
+
+		void cmdEndRenderPass(uint32_t cmdBufferName) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			vkCmdEndRenderPass(cmdBuffer);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_END_RENDER_PASS);
+			if (isDebugUtilsEnabled()) cmdEndDebugLabel(cmdBufferName);
+		}
+
+		// Count the texels of levels [@baseLevel, @baseLevel + @levelCount) of all layers of @imageName as read or written
+		// once, e.g. the inputs and storage output of a full screen pass. Records no command, only the counters
+		void cmdCountImageTraffic(uint32_t cmdBufferName, uint32_t imageName, bool write, uint32_t baseLevel = 0, uint32_t levelCount = 1) const
+		{
+			const auto &image = m_images.at(imageName);
+			const uint64_t bytes = getImageBytes(image, baseLevel, levelCount) * image.layers();
+
+			auto &counters = m_commandCounters[cmdBufferName];
+			(write ? counters.bytesWritten : counters.bytesRead) += bytes;
+		}
+
+		// --- Debug labels and object names ---
+		// VK_EXT_debug_utils, for RenderDoc and Nsight captures. Only enabled when asked for at construction, otherwise
+		// the calls below return right away
+		bool isDebugUtilsEnabled() const { return m_device.isDebugUtilsEnabled(); }
+
+		void cmdBeginDebugLabel(uint32_t cmdBufferName, const std::string &label) const
+		{
+			if (!isDebugUtilsEnabled()) return;
+
+			VkDebugUtilsLabelEXT info = {};
+			info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+			info.pLabelName = label.c_str();
+			m_device.pfnCmdBeginDebugUtilsLabel(m_commandBuffers.at(cmdBufferName), &info);
+		}
+
+		void cmdEndDebugLabel(uint32_t cmdBufferName) const
+		{
+			if (!isDebugUtilsEnabled()) return;
+
+			m_device.pfnCmdEndDebugUtilsLabel(m_commandBuffers.at(cmdBufferName));
+		}
+
+		void cmdInsertDebugLabel(uint32_t cmdBufferName, const std::string &label) const
+		{
+			if (!isDebugUtilsEnabled()) return;
+
+			VkDebugUtilsLabelEXT info = {};
+			info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+			info.pLabelName = label.c_str();
+			m_device.pfnCmdInsertDebugUtilsLabel(m_commandBuffers.at(cmdBufferName), &info);
+		}
+
+		void setBufferDebugName(uint32_t bufferName, const std::string &name) const
+		{
+			setObjectDebugName(VK_OBJECT_TYPE_BUFFER, VkBuffer(m_buffers.at(bufferName)), name);
+		}
+
+		void setImageDebugName(uint32_t imageName, const std::string &name) const
+		{
+			setObjectDebugName(VK_OBJECT_TYPE_IMAGE, VkImage(m_images.at(imageName)), name);
+		}
+
+		// Pipelines are named after their shader files when created. Ones shared through the pipeline registry keep the
+		// last name given
+		void setPipelineDebugName(uint32_t pipelineName, const std::string &name) const
+		{
+			setObjectDebugName(VK_OBJECT_TYPE_PIPELINE, VkPipeline(m_pipelines.at(pipelineName)), name);
+		}
+		// --- Debug labels and object names ---
+
+		void cmdNextSubpass(uint32_t cmdBufferName, VkSubpassContents subpassContents = VK_SUBPASS_CONTENTS_INLINE) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			vkCmdNextSubpass(cmdBuffer, subpassContents);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_NEXT_SUBPASS, subpassContents);
+		}
+
+		void cmdExecuteCommands(uint32_t cmdBufferName, ArrayView<uint32_t> secondaryCmdBufferNames) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			thread_local std::vector<VkCommandBuffer> secondaries;
+			secondaries.clear();
+			for (auto name : secondaryCmdBufferNames)
+			{
+				secondaries.push_back(m_commandBuffers.at(name));
+				m_commandCounters[cmdBufferName] += m_commandCounters[name];
+			}
+
+			vkCmdExecuteCommands(cmdBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+			captureCommand(cmdBufferName, VCommandCapture::CMD_EXECUTE_COMMANDS, secondaryCmdBufferNames);
+		}
+
+		// Must be called inside a render pass
+		void cmdClearAttachments(uint32_t cmdBufferName, ArrayView<VkClearAttachment> attachments, ArrayView<VkClearRect> rects) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			vkCmdClearAttachments(cmdBuffer, static_cast<uint32_t>(attachments.size()), attachments.data(),
+				static_cast<uint32_t>(rects.size()), rects.data());
+			captureCommand(cmdBufferName, VCommandCapture::CMD_CLEAR_ATTACHMENTS, attachments, rects);
+		}
+
+		void cmdBindPipeline(uint32_t cmdBufferName, VkPipelineBindPoint pipelineBindPoint, uint32_t pipelineName) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &pipeline = m_pipelines.at(pipelineName);
+
+			vkCmdBindPipeline(cmdBuffer, pipelineBindPoint, pipeline);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_BIND_PIPELINE, pipelineBindPoint, pipelineName);
+			++m_commandCounters[cmdBufferName].pipelineBinds;
+		}
+
+		void cmdBindDescriptorSets(uint32_t cmdBufferName, VkPipelineBindPoint pipelineBindPoint, uint32_t pipelineLayoutName,
+			ArrayView<uint32_t> descriptorSetNames, uint32_t firstSet = 0, ArrayView<uint32_t> dynamicOffsets = {}) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &pipelineLayout = m_pipelineLayouts.at(pipelineLayoutName);
+
+			uint32_t numSets = static_cast<uint32_t>(descriptorSetNames.size());
+			thread_local std::vector<VkDescriptorSet> sets;
+			sets.clear();
+			for (auto name : descriptorSetNames)
+			{
+				sets.push_back(m_descriptorSets.at(name));
+			}
+
+			uint32_t numDynamicOffsets = static_cast<uint32_t>(dynamicOffsets.size());
+
+			vkCmdBindDescriptorSets(cmdBuffer, pipelineBindPoint, pipelineLayout, firstSet, numSets, sets.data(),
+				numDynamicOffsets, numDynamicOffsets == 0 ? nullptr : dynamicOffsets.data());
+			captureCommand(cmdBufferName, VCommandCapture::CMD_BIND_DESCRIPTOR_SETS, pipelineBindPoint, pipelineLayoutName, descriptorSetNames,
+				firstSet, dynamicOffsets);
+			++m_commandCounters[cmdBufferName].descriptorSetBinds;
+		}
+
+		// Write @writes straight into the command buffer as set @set of the pipeline layout, whose set layout has to be created with
+		// VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR. Bindings not written are undefined afterwards. Needs isPushDescriptorEnabled()
+		void cmdPushDescriptorSet(uint32_t cmdBufferName, VkPipelineBindPoint pipelineBindPoint, uint32_t pipelineLayoutName,
+			uint32_t set, ArrayView<PushDescriptorWrite> writes) const
+		{
+			assert(isPushDescriptorEnabled());
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &pipelineLayout = m_pipelineLayouts.at(pipelineLayoutName);
+
+			// Sized up front, the write infos point into them
+			thread_local std::vector<VkDescriptorBufferInfo> bufferInfos;
+			thread_local std::vector<VkDescriptorImageInfo> imageInfos;
+			thread_local std::vector<VkWriteDescriptorSet> writeInfos;
+			bufferInfos.resize(writes.size());
+			imageInfos.resize(writes.size());
+			writeInfos.resize(writes.size());
+
+			for (size_t i = 0; i < writes.size(); ++i)
+			{
+				const auto &write = writes[i];
+				auto &writeInfo = writeInfos[i];
+				writeInfo = {};
+				writeInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writeInfo.dstBinding = write.binding;
+				writeInfo.descriptorCount = 1;
+				writeInfo.descriptorType = write.type;
+
+				if (isBufferDescriptorType(write.type))
+				{
+					bufferInfos[i] = getDescriptorBufferInfo(write.bufferInfo);
+					writeInfo.pBufferInfo = &bufferInfos[i];
+				}
+				else
+				{
+					imageInfos[i] = getDescriptorImageInfo(write.imageInfo);
+					writeInfo.pImageInfo = &imageInfos[i];
+				}
+			}
+
+			m_device.pfnCmdPushDescriptorSet(cmdBuffer, pipelineBindPoint, pipelineLayout, set,
+				static_cast<uint32_t>(writeInfos.size()), writeInfos.data());
+			captureCommand(cmdBufferName, VCommandCapture::CMD_PUSH_DESCRIPTOR_SET, pipelineBindPoint, pipelineLayoutName, set, writes);
+			++m_commandCounters[cmdBufferName].descriptorSetBinds;
+		}
+
+		void cmdSetViewport(uint32_t cmdBufferName, uint32_t framebufferName, float topLeftU = 0.f, float topLeftV = 0.f,
+			float width = 1.f, float height = 1.f, float minDepth = 0.f, float maxDepth = 1.f) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &framebuffer = m_framebuffers.at(framebufferName);
+
+			float fbWidth = static_cast<float>(framebuffer.width());
+			float fbHeight = static_cast<float>(framebuffer.height());
+
+			VkViewport viewport = {};
+			viewport.x = topLeftU * fbWidth;
+			viewport.y = topLeftV * fbHeight;
+			viewport.width = width * fbWidth;
+			viewport.height = height * fbHeight;
+			viewport.minDepth = minDepth;
+			viewport.maxDepth = maxDepth;
+
+			vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_SET_VIEWPORT, viewport);
+		}
+
+		void cmdSetViewport(uint32_t cmdBufferName, float x, float y, float width, float height,
+			float minDepth = 0.f, float maxDepth = 1.f) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			VkViewport viewport = {};
+			viewport.x = x;
+			viewport.y = y;
+			viewport.width = width;
+			viewport.height = height;
+			viewport.minDepth = minDepth;
+			viewport.maxDepth = maxDepth;
+
+			vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_SET_VIEWPORT, viewport);
+		}
+
+		void cmdSetScissor(uint32_t cmdBufferName, uint32_t framebufferName,
+			float topLeftU = 0.f, float topLeftV = 0.f, float width = 1.f, float height = 1.f) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &framebuffer = m_framebuffers.at(framebufferName);
+
+			float fbWidth = static_cast<float>(framebuffer.width());
+			float fbHeight = static_cast<float>(framebuffer.height());
+
+			int32_t x = static_cast<int32_t>(topLeftU * fbWidth);
+			int32_t y = static_cast<int32_t>(topLeftV * fbHeight);
+			uint32_t w = static_cast<uint32_t>(width * fbWidth);
+			uint32_t h = static_cast<uint32_t>(height * fbHeight);
+
+			VkRect2D scissor = {};
+			scissor.offset = { x, y };
+			scissor.extent = { w, h };
+
+			vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_SET_SCISSOR, scissor);
+		}
+
+		void cmdSetScissor(uint32_t cmdBufferName, int32_t x, int32_t y, uint32_t width, uint32_t height) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			VkRect2D scissor = {};
+			scissor.offset = { x, y };
+			scissor.extent = { width, height };
+
+			vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_SET_SCISSOR, scissor);
+		}
+
+		// Needs a pipeline with VK_DYNAMIC_STATE_DEPTH_BIAS and depth bias enabled, @biasClamp != 0 the depthBiasClamp feature
+		void cmdSetDepthBias(uint32_t cmdBufferName, float constantFactor, float biasClamp, float slopeFactor) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			vkCmdSetDepthBias(cmdBuffer, constantFactor, biasClamp, slopeFactor);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_SET_DEPTH_BIAS, constantFactor, biasClamp, slopeFactor);
+		}
+
+		void cmdDrawIndexed(uint32_t cmdBufferName, uint32_t indexCount, uint32_t instanceCount = 1, uint32_t firstIndex = 0,
+			int32_t vertexOffset = 0, uint32_t firstInstance = 0) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			vkCmdDrawIndexed(cmdBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_DRAW_INDEXED, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+			auto &counters = m_commandCounters[cmdBufferName];
+			++counters.draws;
+			counters.triangles += static_cast<uint64_t>(indexCount / 3) * instanceCount;
+		}
+
+		// @drawCount > 1 needs the multiDrawIndirect feature
+		void cmdDrawIndexedIndirect(uint32_t cmdBufferName, uint32_t bufferName, VkDeviceSize offset, uint32_t drawCount = 1,
+			uint32_t stride = sizeof(VkDrawIndexedIndirectCommand)) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &buffer = m_buffers.at(bufferName);
+
+			vkCmdDrawIndexedIndirect(cmdBuffer, buffer, offset, drawCount, stride);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_DRAW_INDEXED_INDIRECT, bufferName, offset, drawCount, stride);
+			auto &counters = m_commandCounters[cmdBufferName];
+			counters.draws += drawCount;
+			counters.indirectDraws += drawCount;
+		}
+
+		// VkDrawMeshTasksIndirectCommandEXTs, needs isMeshShaderEnabled(). Triangles are not counted, only the GPU knows them
+		void cmdDrawMeshTasksIndirect(uint32_t cmdBufferName, uint32_t bufferName, VkDeviceSize offset, uint32_t drawCount = 1,
+			uint32_t stride = sizeof(VkDrawMeshTasksIndirectCommandEXT)) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &buffer = m_buffers.at(bufferName);
+
+			assert(isMeshShaderEnabled());
+			m_device.pfnCmdDrawMeshTasksIndirect(cmdBuffer, buffer, offset, drawCount, stride);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_DRAW_MESH_TASKS_INDIRECT, bufferName, offset, drawCount, stride);
+			auto &counters = m_commandCounters[cmdBufferName];
+			counters.draws += drawCount;
+			counters.indirectDraws += drawCount;
+		}
+
+		void cmdDraw(uint32_t cmdBufferName, uint32_t vertexCount, uint32_t instanceCount = 1,
+			uint32_t firstVertex = 0, uint32_t firstInstance = 0) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			vkCmdDraw(cmdBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_DRAW, vertexCount, instanceCount, firstVertex, firstInstance);
+			auto &counters = m_commandCounters[cmdBufferName];
+			++counters.draws;
+			counters.triangles += static_cast<uint64_t>(vertexCount / 3) * instanceCount;
+		}
+
+		void cmdPushConstants(uint32_t cmdBufferName, uint32_t pipelineLayoutName, VkShaderStageFlags shaderStages,
+			uint32_t offset, uint32_t sizeInBytes, const void *pValues) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &pipelineLayout = m_pipelineLayouts.at(pipelineLayoutName);
+
+			vkCmdPushConstants(cmdBuffer, pipelineLayout, shaderStages, offset, sizeInBytes, pValues);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_PUSH_CONSTANTS, pipelineLayoutName, shaderStages, offset,
+				ArrayView<uint8_t>(static_cast<const uint8_t *>(pValues), sizeInBytes));
+			++m_commandCounters[cmdBufferName].pushConstants;
+		}
+
+		void cmdDispatch(uint32_t cmdBufferName, uint32_t numBlocksX, uint32_t numBlocksY, uint32_t numBlocksZ)
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			vkCmdDispatch(cmdBuffer, numBlocksX, numBlocksY, numBlocksZ);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_DISPATCH, numBlocksX, numBlocksY, numBlocksZ);
+			++m_commandCounters[cmdBufferName].dispatches;
+		}
+
+		// Global memory barrier. Must be called outside of a render pass
+		void cmdMemoryBarrier(uint32_t cmdBufferName, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages,
+			VkAccessFlags srcAccess, VkAccessFlags dstAccess) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+
+			VkMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = dstAccess;
+
+			vkCmdPipelineBarrier(cmdBuffer, srcStages, dstStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_MEMORY_BARRIER, srcStages, dstStages, srcAccess, dstAccess);
+		}
+
+		// Layout transition of all mip levels and layers. Must be called outside of a render pass.
+		// Different queue families make it one half of an ownership transfer, which has to be recorded on the queues of
+		// both families with the same layouts. The release ignores the destination scopes and the acquire the source ones
+		void cmdImageBarrier(uint32_t cmdBufferName, uint32_t imageName, VkImageLayout oldLayout, VkImageLayout newLayout,
+			VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+			VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			uint32_t srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED, uint32_t dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &image = m_images.at(imageName);
+
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = dstAccess;
+			barrier.oldLayout = oldLayout;
+			barrier.newLayout = newLayout;
+			barrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+			barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+			barrier.image = image;
+			barrier.subresourceRange.aspectMask = aspectMask;
+			barrier.subresourceRange.baseMipLevel = 0;
+			barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+			vkCmdPipelineBarrier(cmdBuffer, srcStages, dstStages, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_IMAGE_BARRIER, imageName, oldLayout, newLayout, srcStages, dstStages,
+				srcAccess, dstAccess, aspectMask, srcQueueFamilyIndex, dstQueueFamilyIndex);
+		}
+
+		// Copy mip level 0 of the first layer. Both images must have the same extent
+		void cmdCopyImage(uint32_t cmdBufferName, uint32_t srcImageName, VkImageLayout srcLayout,
+			uint32_t dstImageName, VkImageLayout dstLayout, VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &srcImage = m_images.at(srcImageName);
+			const auto &dstImage = m_images.at(dstImageName);
+
+			VkImageCopy region = {};
+			region.srcSubresource.aspectMask = aspectMask;
+			region.srcSubresource.layerCount = 1;
+			region.dstSubresource = region.srcSubresource;
+			region.extent = srcImage.extent(0);
+
+			vkCmdCopyImage(cmdBuffer, srcImage, srcLayout, dstImage, dstLayout, 1, &region);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_COPY_IMAGE, srcImageName, srcLayout, dstImageName, dstLayout, aspectMask);
+			m_commandCounters[cmdBufferName].bytesRead += getImageBytes(srcImage, 0, 1);
+			m_commandCounters[cmdBufferName].bytesWritten += getImageBytes(srcImage, 0, 1);
+		}
+
+		// Copy @regions of a buffer into an image in @dstLayout, TRANSFER_DST_OPTIMAL or GENERAL
+		void cmdCopyBufferToImage(uint32_t cmdBufferName, uint32_t srcBufferName, uint32_t dstImageName, VkImageLayout dstLayout,
+			ArrayView<VkBufferImageCopy> regions) const
+		{
+			const auto &cmdBuffer = m_commandBuffers.at(cmdBufferName);
+			const auto &srcBuffer = m_buffers.at(srcBufferName);
+			const auto &dstImage = m_images.at(dstImageName);
+
+			vkCmdCopyBufferToImage(cmdBuffer, srcBuffer, dstImage, dstLayout, static_cast<uint32_t>(regions.size()), regions.data());
+			captureCommand(cmdBufferName, VCommandCapture::CMD_COPY_BUFFER_TO_IMAGE, srcBufferName, dstImageName, dstLayout, regions);
+		}
+
+		void cmdResetQueryPool(uint32_t cmdBufferName, uint32_t queryPoolName,
+			uint32_t firstQuery = 0, uint32_t queryCount = std::numeric_limits<uint32_t>::max())
+		{
+			assert(queryPoolName < m_queryPools.size());
+			assert(m_queryPoolNames.isAlive(queryPoolName));
+
+			const auto &cb = m_commandBuffers[cmdBufferName];
 			const auto &queryPool = m_queryPools[queryPoolName];
 			if (queryCount == std::numeric_limits<uint32_t>::max()) queryCount = queryPool.getQueryCount();
 			assert(firstQuery + queryCount <= queryPool.getQueryCount());
 			vkCmdResetQueryPool(cb, queryPool, firstQuery, queryCount);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_RESET_QUERY_POOL, queryPoolName, firstQuery, queryCount);
+		}
+
+		void cmdBeginQuery(uint32_t cmdBufferName, uint32_t queryPoolName, uint32_t queryIdx, VkQueryControlFlags flags = 0)
+		{
+			assert(queryPoolName < m_queryPools.size());
+			assert(m_queryPoolNames.isAlive(queryPoolName));
+
+			const auto &cb = m_commandBuffers[cmdBufferName];
+			const auto &queryPool = m_queryPools[queryPoolName];
+			assert(queryIdx < queryPool.getQueryCount());
+			vkCmdBeginQuery(cb, queryPool, queryIdx, flags);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_BEGIN_QUERY, queryPoolName, queryIdx, flags);
+		}
+
+		void cmdEndQuery(uint32_t cmdBufferName, uint32_t queryPoolName, uint32_t queryIdx)
+		{
+			assert(queryPoolName < m_queryPools.size());
+			assert(m_queryPoolNames.isAlive(queryPoolName));
+
+			const auto &cb = m_commandBuffers[cmdBufferName];
+			const auto &queryPool = m_queryPools[queryPoolName];
+			assert(queryIdx < queryPool.getQueryCount());
+			vkCmdEndQuery(cb, queryPool, queryIdx);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_END_QUERY, queryPoolName, queryIdx);
+		}
+
+		void cmdWriteTimestamp(uint32_t cmdBufferName, VkPipelineStageFlagBits pipelineStage,
+			uint32_t queryPoolName, uint32_t queryIdx)
+		{
+			assert(queryPoolName < m_queryPools.size());
+			assert(m_queryPoolNames.isAlive(queryPoolName));
+
+			const auto &cb = m_commandBuffers[cmdBufferName];
+			const auto &queryPool = m_queryPools[queryPoolName];
+			assert(queryIdx < queryPool.getQueryCount());
+			vkCmdWriteTimestamp(cb, pipelineStage, queryPool, queryIdx);
+			captureCommand(cmdBufferName, VCommandCapture::CMD_WRITE_TIMESTAMP, pipelineStage, queryPoolName, queryIdx);
+		}
+
+		void queueWaitIdle(VkQueueFlags queueType) const
+		{
+			VkQueue queue = VK_NULL_HANDLE;
+			switch (queueType)
+			{
+			case VK_QUEUE_COMPUTE_BIT:
+				queue = m_device.getComputeQueue();
+				break;
+			default:
+				queue = m_device.getGraphicsQueue();
+				break;
+			}
+			vkQueueWaitIdle(queue);
+		}
+
+		void deviceWaitIdle()
+		{
+			if (vkDeviceWaitIdle(m_device) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to wait for device idle");
+			}
+			completeFrames(m_frameSerial);
+		}
+
+		// --- Deferred destruction ---
+		// destroy*() retires a name instead of freeing it. The resource lives on until its name is handed out again, and a frame
+		// recorded before the destroy call may still use it on the GPU. So names retired while frame getFrameSerial() is current
+		// only return to their free lists once completeFrames() reports that frame done, or after deviceWaitIdle()
+		uint64_t getFrameSerial() const { return m_frameSerial; }
+
+		// The current frame is submitted, destructions from now on belong to the next one. Return the submitted frame's serial
+		uint64_t endFrame()
+		{
+			return m_frameSerial++;
+		}
+
+		// The GPU is done with every frame up to @frameSerial. Queues execute in submission order, so the last one waited on is enough
+		void completeFrames(uint64_t frameSerial)
+		{
+			{
+				std::lock_guard<std::mutex> guard(m_resourceMutex);
+				while (!m_retiredNames.empty() && m_retiredNames.front().frameSerial <= frameSerial)
+				{
+					const auto &retired = m_retiredNames.front();
+					retired.pPool->reclaim(retired.name);
+					// Otherwise the memory would only be freed once the name is handed out again
+					if (retired.pPool == &m_imageNames && m_memoryAllocator.isInDefragmentationSource(m_images[retired.name].allocation()))
+					{
+						m_images[retired.name].releaseMemory();
+					}
+					m_retiredNames.pop_front();
+				}
+			}
+			while (!m_retiredSwapChains.empty() && m_retiredSwapChains.front().frameSerial <= frameSerial)
+			{
+				m_retiredSwapChains.pop_front();
+			}
+			while (!m_retiredSparsePages.empty() && m_retiredSparsePages.front().frameSerial <= frameSerial)
+			{
+				m_retiredSparsePages.pop_front();
+			}
+			m_readbackRing.complete(frameSerial);
+		}
+
+		uint32_t getRetiredNameCount() const
+		{
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			return static_cast<uint32_t>(m_retiredNames.size());
+		}
+		// --- Deferred destruction ---
+
+		void beginQueueSubmit(VkQueueFlags queueType)
+		{
+			m_curQueueSubmitCount = 0;
+			m_curSubmitQueueType = queueType;
+
+			switch (queueType)
+			{
+			case VK_QUEUE_COMPUTE_BIT:
+				m_curSubmitQueue = m_device.getComputeQueue();
+				break;
+			default:
+				m_curSubmitQueue = m_device.getGraphicsQueue();
+				break;
+			}
+		}
+
+		// @waitValues and @signalValues are either empty or hold one value per semaphore. Values of binary semaphores are ignored
+		void queueSubmitNewSubmit(ArrayView<uint32_t> cmdBufferNames,
+			ArrayView<uint32_t> waitSemaphoreNames = {},
+			ArrayView<VkPipelineStageFlags> waitStageMasks = {},
+			ArrayView<uint32_t> signalSemaphoreNames = {},
+			ArrayView<uint64_t> waitValues = {},
+			ArrayView<uint64_t> signalValues = {})
+		{
+			assert(!cmdBufferNames.empty());
+			assert(waitSemaphoreNames.size() == waitStageMasks.size());
+			assert(waitValues.empty() || waitValues.size() == waitSemaphoreNames.size());
+			assert(signalValues.empty() || signalValues.size() == signalSemaphoreNames.size());
+
+			// Entries, and the capacity of their vectors, are kept from earlier submits and reused
+			if (m_curQueueSubmitCount == m_curQueueSubmitInfos.size()) m_curQueueSubmitInfos.push_back({});
+			auto &info = m_curQueueSubmitInfos[m_curQueueSubmitCount++];
+
+			auto &cmdBuffers = info.cmdBuffers;
+			cmdBuffers.clear();
+			for (auto name : cmdBufferNames)
+			{
+				cmdBuffers.push_back(m_commandBuffers.at(name));
+			}
+
+			info.waitStages.assign(waitStageMasks.begin(), waitStageMasks.end());
+
+			auto &waitSemaphores = info.waitSemaphores;
+			waitSemaphores.clear();
+			for (auto name : waitSemaphoreNames)
+			{
+				waitSemaphores.push_back(m_semaphores[name]);
+			}
+
+			auto &signalSemaphores = info.signalSemaphores;
+			signalSemaphores.clear();
+			for (auto name : signalSemaphoreNames)
+			{
+				signalSemaphores.push_back(m_semaphores[name]);
+			}
+
+			info.waitValues.assign(waitValues.begin(), waitValues.end());
+			info.signalValues.assign(signalValues.begin(), signalValues.end());
+
+			if (m_pCommandCapture) m_pCommandCapture->recordSubmit(m_curSubmitQueueType, cmdBufferNames);
+		}
+
+		void endQueueSubmit(uint32_t fenceName = std::numeric_limits<uint32_t>::max(), bool waitForFence = true)
+		{
+			uint32_t numSubmits = static_cast<uint32_t>(m_curQueueSubmitCount);
+			assert(numSubmits > 0);
+			auto &infos = m_submitInfoScratch;
+			auto &timelineInfos = m_timelineSubmitInfoScratch;
+			infos.assign(numSubmits, {});
+			timelineInfos.assign(numSubmits, {});
+
+			for (uint32_t i = 0; i < numSubmits; ++i)
+			{
+				const auto &src = m_curQueueSubmitInfos[i];
+				auto &info = infos[i];
+
+				info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+				info.commandBufferCount = static_cast<uint32_t>(src.cmdBuffers.size());
+				info.pCommandBuffers = src.cmdBuffers.data();
+				info.waitSemaphoreCount = static_cast<uint32_t>(src.waitSemaphores.size());
+				info.pWaitSemaphores = src.waitSemaphores.data();
+				info.pWaitDstStageMask = src.waitStages.data();
+				info.signalSemaphoreCount = static_cast<uint32_t>(src.signalSemaphores.size());
+				info.pSignalSemaphores = src.signalSemaphores.data();
+
+				if (!src.waitValues.empty() || !src.signalValues.empty())
+				{
+					auto &timelineInfo = timelineInfos[i];
+					timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+					timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(src.waitValues.size());
+					timelineInfo.pWaitSemaphoreValues = src.waitValues.data();
+					timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(src.signalValues.size());
+					timelineInfo.pSignalSemaphoreValues = src.signalValues.data();
+					info.pNext = &timelineInfo;
+				}
+			}
+
+			// Every command buffer runs on the devices of the submit mask, semaphores are waited on and signaled by the first of them
+			auto &deviceGroupInfos = m_deviceGroupSubmitInfoScratch;
+			if (getDeviceCount() > 1)
+			{
+				deviceGroupInfos.assign(numSubmits, {});
+				size_t maskCount = 0, indexCount = 0;
+				for (uint32_t i = 0; i < numSubmits; ++i)
+				{
+					maskCount = std::max<size_t>(maskCount, infos[i].commandBufferCount);
+					indexCount = std::max<size_t>(indexCount, std::max(infos[i].waitSemaphoreCount, infos[i].signalSemaphoreCount));
+				}
+				m_deviceMaskScratch.assign(maskCount, m_submitDeviceMask);
+				m_deviceIndexScratch.assign(indexCount, getSubmitDeviceIndex());
+
+				for (uint32_t i = 0; i < numSubmits; ++i)
+				{
+					auto &deviceGroupInfo = deviceGroupInfos[i];
+					deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO;
+					deviceGroupInfo.commandBufferCount = infos[i].commandBufferCount;
+					deviceGroupInfo.pCommandBufferDeviceMasks = m_deviceMaskScratch.data();
+					deviceGroupInfo.waitSemaphoreCount = infos[i].waitSemaphoreCount;
+					deviceGroupInfo.pWaitSemaphoreDeviceIndices = m_deviceIndexScratch.data();
+					deviceGroupInfo.signalSemaphoreCount = infos[i].signalSemaphoreCount;
+					deviceGroupInfo.pSignalSemaphoreDeviceIndices = m_deviceIndexScratch.data();
+					deviceGroupInfo.pNext = infos[i].pNext;
+					infos[i].pNext = &deviceGroupInfo;
+				}
+			}
+
+			assert(m_curSubmitQueue);
+			VkFence fence = fenceName == std::numeric_limits<uint32_t>::max() ? VK_NULL_HANDLE : VkFence(m_fences[fenceName]);
+			if (vkQueueSubmit(m_curSubmitQueue, numSubmits, infos.data(), fence) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to submit");
+			}
+
+			if (fence && waitForFence)
+			{
+				vkWaitForFences(m_device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+			}
+
+			m_curQueueSubmitCount = 0;
+			m_curSubmitQueue = VK_NULL_HANDLE;
+		}
+		// --- Command buffer related ---
+
+		// --- Command capture ---
+		// Record the calls of the frame from now on into @pCapture, see VCommandCapture. The frame has to record anew every
+		// command buffer it submits or executes, and not create command buffers
+		void beginCommandCapture(VCommandCapture *pCapture)
+		{
+			assert(!m_pCommandCapture);
+			pCapture->begin(static_cast<uint32_t>(m_commandBuffers.size()));
+			m_pCommandCapture = pCapture;
+		}
+
+		// Once the frame is submitted. Keeps the contents of the host visible buffers and the signatures of all live resources
+		void endCommandCapture()
+		{
+			assert(m_pCommandCapture);
+			auto &capture = *m_pCommandCapture;
+			m_pCommandCapture = nullptr;
+
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			for (uint32_t name = 0; name < m_buffers.size(); ++name)
+			{
+				if (!m_bufferNames.isAlive(name)) continue;
+				const auto &buffer = m_buffers[name];
+				capture.resources.push_back({ VCommandCapture::RESOURCE_BUFFER, name, getCaptureSignature(buffer) });
+
+				// Staging and readback buffers hold nothing the frame reads
+				const VkMemoryPropertyFlags hostMemory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+				const VkBufferUsageFlags transferUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+				if ((buffer.memoryProperties() & hostMemory) == hostMemory && (buffer.usage() & ~transferUsage))
+				{
+					const char *pData = static_cast<const char *>(buffer.mapBuffer());
+					capture.bufferContents.push_back({ name, std::vector<char>(pData, pData + buffer.size()) });
+					buffer.unmapBuffer();
+				}
+			}
+			for (uint32_t name = 0; name < m_images.size(); ++name)
+			{
+				if (m_imageNames.isAlive(name)) capture.resources.push_back({ VCommandCapture::RESOURCE_IMAGE, name, getCaptureSignature(m_images[name]) });
+			}
+			for (uint32_t name = 0; name < m_pipelines.size(); ++name)
+			{
+				if (m_pipelineNames.isAlive(name)) capture.resources.push_back({ VCommandCapture::RESOURCE_PIPELINE, name, m_pipelineStateHashes[name] });
+			}
+		}
+
+		bool isCommandCaptureActive() const { return m_pCommandCapture != nullptr; }
+
+		// Empty if @capture can be replayed by this manager, otherwise why not
+		std::string checkCommandCapture(const VCommandCapture &capture) const
+		{
+			if (capture.commandStreams.size() > m_commandBuffers.size()) return "the capture has more command buffers";
+
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			for (const auto &resource : capture.resources)
+			{
+				const uint32_t name = resource.name;
+				switch (resource.type)
+				{
+				case VCommandCapture::RESOURCE_BUFFER:
+					if (!m_bufferNames.isAlive(name) || getCaptureSignature(m_buffers[name]) != resource.signature)
+					{
+						return "buffer " + std::to_string(name) + " differs";
+					}
+					break;
+				case VCommandCapture::RESOURCE_IMAGE:
+					if (!m_imageNames.isAlive(name) || getCaptureSignature(m_images[name]) != resource.signature)
+					{
+						return "image " + std::to_string(name) + " differs";
+					}
+					break;
+				default:
+					if (!m_pipelineNames.isAlive(name) || m_pipelineStateHashes[name] != resource.signature)
+					{
+						return "pipeline " + std::to_string(name) + " differs";
+					}
+					break;
+				}
+			}
+			return std::string();
+		}
+
+		// Run the frame of @capture again, which checkCommandCapture() accepts. The GPU must be done with everything it uses.
+		// Restores the buffer contents, applies the descriptor calls with transient sets allocated anew, records the captured
+		// command buffers again and submits in the captured order, then waits for @fenceName. The frame's semaphores are left
+		// out, so submits to another queue wait for the queue before to be idle instead of overlapping with it
+		void replayCommandCapture(const VCommandCapture &capture, uint32_t fenceName)
+		{
+			for (const auto &contents : capture.bufferContents)
+			{
+				const auto &buffer = m_buffers.at(contents.bufferName);
+				memcpy(buffer.mapBuffer(), contents.data.data(), contents.data.size());
+				buffer.unmapBuffer();
+			}
+
+			std::unordered_map<uint32_t, uint32_t> setNames; // captured transient set names to the ones allocated now
+			replayDescriptorCalls(capture, &setNames);
+
+			// Pools are reset when none of their command buffers is submitted as it is, otherwise vkBeginCommandBuffer() resets the
+			// captured ones, which needs VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+			const auto isCaptured = [&capture](uint32_t cbName)
+			{
+				return cbName < capture.commandStreams.size() && !capture.commandStreams[cbName].empty();
+			};
+			std::unordered_set<uint32_t> keptCmdBuffers;
+			for (const auto &submit : capture.submits)
+			{
+				for (uint32_t cbName : submit.cmdBufferNames)
+				{
+					if (!isCaptured(cbName)) keptCmdBuffers.insert(cbName);
+				}
+			}
+			for (const auto &pool : m_commandBufferTable)
+			{
+				const auto &cbNames = pool.second;
+				if (std::any_of(cbNames.begin(), cbNames.end(), isCaptured) &&
+					std::none_of(cbNames.begin(), cbNames.end(), [&keptCmdBuffers](uint32_t cbName) { return keptCmdBuffers.count(cbName) > 0; }))
+				{
+					resetCommandPool(pool.first);
+				}
+			}
+
+			for (uint32_t cbName = 0; cbName < capture.commandStreams.size(); ++cbName)
+			{
+				if (isCaptured(cbName)) replayCommandStream(cbName, capture.commandStreams[cbName], setNames);
+			}
+
+			for (size_t i = 0; i < capture.submits.size(); )
+			{
+				const VkQueueFlags queueType = capture.submits[i].queueType;
+				beginQueueSubmit(queueType);
+				for (; i < capture.submits.size() && capture.submits[i].queueType == queueType; ++i)
+				{
+					queueSubmitNewSubmit(capture.submits[i].cmdBufferNames);
+				}
+
+				if (i == capture.submits.size())
+				{
+					endQueueSubmit(fenceName);
+				}
+				else
+				{
+					endQueueSubmit();
+					queueWaitIdle(queueType);
+				}
+			}
+		}
+		// --- Command capture ---
+
+		// --- Device group ---
+		// 1 unless the device was created over a device group, see VDevice::getDeviceCount()
+		uint32_t getDeviceCount() const { return m_device.getDeviceCount(); }
+		uint32_t getAllDevicesMask() const { return (1u << getDeviceCount()) - 1; }
+		// 0 if only frames rendered on device 0 can be presented. Headless swapchains present nothing, so any device will do
+		VkDeviceGroupPresentModeFlagsKHR getDeviceGroupPresentMode() const { return m_device.getDeviceGroupPresentMode(); }
+
+		// endQueueSubmit(), swapChainNextImageIndex() and queuePresent() run on the devices of @deviceMask until it is set again.
+		// Uploads and the other submits of the manager always run on every device, which keeps resources the same on all of them
+		void setSubmitDeviceMask(uint32_t deviceMask)
+		{
+			assert(deviceMask != 0 && (deviceMask & ~getAllDevicesMask()) == 0);
+			m_submitDeviceMask = deviceMask;
+		}
+
+		// The first device of the submit mask
+		uint32_t getSubmitDeviceIndex() const
+		{
+			uint32_t index = 0;
+			while (!(m_submitDeviceMask & (1u << index))) ++index;
+			return index;
+		}
+		// --- Device group ---
+
+		// --- Synchronization objects ---
+		// VK_SEMAPHORE_TYPE_TIMELINE_KHR needs isTimelineSemaphoreEnabled()
+		uint32_t createSemaphore(VkSemaphoreCreateFlags flags = 0,
+			VkSemaphoreTypeKHR type = VK_SEMAPHORE_TYPE_BINARY_KHR, uint64_t initialValue = 0)
+		{
+			assert(type == VK_SEMAPHORE_TYPE_BINARY_KHR || isTimelineSemaphoreEnabled());
+
+			uint32_t semaphoreName = m_semaphoreNames.allocate();
+			if (semaphoreName == m_semaphores.size()) m_semaphores.emplace_back(m_device, vkDestroySemaphore);
+
+			VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+			typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+			typeInfo.semaphoreType = type;
+			typeInfo.initialValue = initialValue;
+
+			VkSemaphoreCreateInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			info.pNext = type == VK_SEMAPHORE_TYPE_BINARY_KHR ? nullptr : &typeInfo;
+			info.flags = flags;
+
+			if (vkCreateSemaphore(m_device, &info, helper_functions::getHostAllocationCallbacks(), m_semaphores[semaphoreName].replace()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("unable to create semaphore");
+			}
+
+			return semaphoreName;
+		}
+
+		uint32_t createFence(VkFenceCreateFlags flags = 0)
+		{
+			uint32_t fenceName = m_fenceNames.allocate();
+			if (fenceName == m_fences.size()) m_fences.emplace_back(m_device, vkDestroyFence);
+
+			VkFenceCreateInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			info.flags = flags;
+
+			if (vkCreateFence(m_device, &info, helper_functions::getHostAllocationCallbacks(), m_fences[fenceName].replace()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create fence");
+			}
+
+			return fenceName;
+		}
+
+		void waitForFences(ArrayView<uint32_t> fenceNames, VkBool32 waitAll = VK_TRUE,
+			uint64_t timeout = std::numeric_limits<uint64_t>::max())
+		{
+			uint32_t fenceCount = static_cast<uint32_t>(fenceNames.size());
+			thread_local std::vector<VkFence> fences;
+			fences.clear();
+			for (auto name : fenceNames)
+			{
+				fences.push_back(m_fences.at(name));
+			}
+
+			if (vkWaitForFences(m_device, fenceCount, fences.data(), waitAll, timeout) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to wait for fences");
+			}
+		}
+
+		// Whether @fenceName is signaled, without blocking
+		bool isFenceSignaled(uint32_t fenceName) const
+		{
+			VkResult result = vkGetFenceStatus(m_device, m_fences.at(fenceName));
+			if (result != VK_SUCCESS && result != VK_NOT_READY)
+			{
+				throw std::runtime_error("failed to get fence status");
+			}
+			return result == VK_SUCCESS;
+		}
+
+		// Block until timeline semaphore @semaphoreName reaches @value
+		void waitSemaphore(uint32_t semaphoreName, uint64_t value, uint64_t timeout = std::numeric_limits<uint64_t>::max())
+		{
+			assert(isTimelineSemaphoreEnabled());
+
+			VkSemaphore semaphore = m_semaphores.at(semaphoreName);
+
+			VkSemaphoreWaitInfoKHR info = {};
+			info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+			info.semaphoreCount = 1;
+			info.pSemaphores = &semaphore;
+			info.pValues = &value;
+
+			if (m_device.pfnWaitSemaphores(m_device, &info, timeout) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to wait for semaphore");
+			}
+		}
+
+		// Signal timeline semaphore @semaphoreName from the host
+		void signalSemaphore(uint32_t semaphoreName, uint64_t value)
+		{
+			assert(isTimelineSemaphoreEnabled());
+
+			VkSemaphoreSignalInfoKHR info = {};
+			info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO_KHR;
+			info.semaphore = m_semaphores.at(semaphoreName);
+			info.value = value;
+
+			if (m_device.pfnSignalSemaphore(m_device, &info) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to signal semaphore");
+			}
+		}
+
+		uint64_t getSemaphoreCounterValue(uint32_t semaphoreName) const
+		{
+			assert(isTimelineSemaphoreEnabled());
+
+			uint64_t value = 0;
+			if (m_device.pfnGetSemaphoreCounterValue(m_device, m_semaphores.at(semaphoreName), &value) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to get semaphore counter value");
+			}
+			return value;
+		}
+
+		void resetFences(ArrayView<uint32_t> fenceNames)
+		{
+			uint32_t fenceCount = static_cast<uint32_t>(fenceNames.size());
+			thread_local std::vector<VkFence> fences;
+			fences.clear();
+			for (auto name : fenceNames)
+			{
+				fences.push_back(m_fences.at(name));
+			}
+
+			if (vkResetFences(m_device, fenceCount, fences.data()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to reset fences");
+			}
+		}
+		// --- Synchronization objects ---
+
+		// --- Window system ---
+		// The old swapchain is retired like a destroyed resource: it is destroyed once the frame current now has completed,
+		// so the presentation engine keeps showing the frames queued to it in the meantime
+		void recreateSwapChain()
+		{
+			VSwapChain::Retired retired;
+			m_swapChain.recreateSwapChain(&retired);
+			if (retired.swapChain.isvalid()) m_retiredSwapChains.push_back({ m_frameSerial, std::move(retired) });
+		}
+
+		VkExtent2D getSwapChainExtent() const
+		{
+			return m_swapChain.extent();
+		}
+
+		VkFormat getSwapChainImageFormat() const
+		{
+			return m_swapChain.format();
+		}
+
+		std::vector<uint32_t> getSwapChainFramebuffers() const
+		{
+			return m_swapChainFramebufferNames;
+		}
+
+		uint32_t getSwapChainSize() const
+		{
+			return m_swapChain.size();
+		}
+
+		VkResult swapChainNextImageIndex(uint32_t *pIdx, uint32_t signalSemaphoreName, uint32_t waitFenceName,
+			uint64_t timeout = std::numeric_limits<uint64_t>::max())
+		{
+			VkSemaphore semaphore = signalSemaphoreName == std::numeric_limits<uint32_t>::max() ? VK_NULL_HANDLE : VkSemaphore(m_semaphores[signalSemaphoreName]);
+			VkFence fence = waitFenceName == std::numeric_limits<uint32_t>::max() ? VK_NULL_HANDLE : VkFence(m_fences[waitFenceName]);
+
+			if (m_swapChain.isHeadless())
+			{
+				// Offscreen images are handed out in order. An empty submit signals like the presentation engine would
+				*pIdx = m_nextOffscreenImageIdx;
+				m_nextOffscreenImageIdx = (m_nextOffscreenImageIdx + 1) % m_swapChain.size();
+
+				VkSubmitInfo submitInfo = {};
+				submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+				submitInfo.signalSemaphoreCount = semaphore == VK_NULL_HANDLE ? 0 : 1;
+				submitInfo.pSignalSemaphores = &semaphore;
+
+				const uint32_t deviceIndex = getSubmitDeviceIndex();
+				VkDeviceGroupSubmitInfo deviceGroupInfo = {};
+				deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO;
+				deviceGroupInfo.signalSemaphoreCount = submitInfo.signalSemaphoreCount;
+				deviceGroupInfo.pSignalSemaphoreDeviceIndices = &deviceIndex;
+				if (getDeviceCount() > 1) submitInfo.pNext = &deviceGroupInfo;
+				return vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, fence);
+			}
+
+			if (getDeviceCount() > 1 && m_device.pfnAcquireNextImage2)
+			{
+				VkAcquireNextImageInfoKHR acquireInfo = {};
+				acquireInfo.sType = VK_STRUCTURE_TYPE_ACQUIRE_NEXT_IMAGE_INFO_KHR;
+				acquireInfo.swapchain = m_swapChain;
+				acquireInfo.timeout = timeout;
+				acquireInfo.semaphore = semaphore;
+				acquireInfo.fence = fence;
+				acquireInfo.deviceMask = m_submitDeviceMask;
+				return m_device.pfnAcquireNextImage2(m_device, &acquireInfo, pIdx);
+			}
+
+			return vkAcquireNextImageKHR(m_device, m_swapChain, timeout, semaphore, fence, pIdx);
+		}
+
+		// @presentId is waited for by waitForPresent(). 0 or without isPresentWaitEnabled() it is not passed on
+		VkResult queuePresent(ArrayView<uint32_t> waitSemaphoreNames, uint32_t imageIdx, uint64_t presentId = 0)
+		{
+			VkSwapchainKHR swapChain = m_swapChain;
+			thread_local std::vector<VkSemaphore> waitSemaphores;
+			waitSemaphores.clear();
+			for (auto name : waitSemaphoreNames)
+			{
+				waitSemaphores.push_back(m_semaphores[name]);
+			}
+
+			if (m_swapChain.isHeadless())
+			{
+				// Nothing to present. Still consume the semaphores so they can be signaled again
+				const std::vector<VkPipelineStageFlags> waitStages(waitSemaphores.size(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+				VkSubmitInfo submitInfo = {};
+				submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+				submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+				submitInfo.pWaitSemaphores = waitSemaphores.data();
+				submitInfo.pWaitDstStageMask = waitStages.data();
+
+				const std::vector<uint32_t> deviceIndices(waitSemaphores.size(), getSubmitDeviceIndex());
+				VkDeviceGroupSubmitInfo deviceGroupInfo = {};
+				deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO;
+				deviceGroupInfo.waitSemaphoreCount = submitInfo.waitSemaphoreCount;
+				deviceGroupInfo.pWaitSemaphoreDeviceIndices = deviceIndices.data();
+				if (getDeviceCount() > 1) submitInfo.pNext = &deviceGroupInfo;
+				return vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
+			}
+
+			VkPresentInfoKHR info = {};
+			info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+			info.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphoreNames.size());
+			info.pWaitSemaphores = waitSemaphores.data();
+			info.swapchainCount = 1;
+			info.pSwapchains = &swapChain;
+			info.pImageIndices = &imageIdx;
+
+			VkPresentIdKHR presentIdInfo = {};
+			presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+			presentIdInfo.swapchainCount = 1;
+			presentIdInfo.pPresentIds = &presentId;
+			if (presentId != 0 && m_device.isPresentWaitEnabled()) info.pNext = &presentIdInfo;
+
+			// The instance of the image on the first device of the submit mask is presented
+			const uint32_t deviceMask = 1u << getSubmitDeviceIndex();
+			VkDeviceGroupPresentInfoKHR deviceGroupInfo = {};
+			deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_PRESENT_INFO_KHR;
+			deviceGroupInfo.swapchainCount = 1;
+			deviceGroupInfo.pDeviceMasks = &deviceMask;
+			deviceGroupInfo.mode = static_cast<VkDeviceGroupPresentModeFlagBitsKHR>(getDeviceGroupPresentMode());
+			if (deviceGroupInfo.mode != 0)
+			{
+				deviceGroupInfo.pNext = info.pNext;
+				info.pNext = &deviceGroupInfo;
+			}
+
+			return vkQueuePresentKHR(m_device.getPresentQueue(), &info);
+		}
+
+		bool isPresentWaitEnabled() const { return m_device.isPresentWaitEnabled() && !m_swapChain.isHeadless(); }
+
+		// Wait until the image presented with @presentId, or a later one, is on screen. VK_TIMEOUT after @timeout nanoseconds
+		VkResult waitForPresent(uint64_t presentId, uint64_t timeout)
+		{
+			assert(isPresentWaitEnabled());
+			return m_device.pfnWaitForPresent(m_device, m_swapChain, presentId, timeout);
+		}
+
+		// Present mode and image count of the swapchain, used from the next recreateSwapChain() on. Return whether they changed
+		bool setSwapChainPresentConfig(VkPresentModeKHR presentMode, uint32_t imageCount)
+		{
+			return m_swapChain.setPresentConfig(presentMode, imageCount);
+		}
+
+		VkPresentModeKHR getSwapChainPresentMode() const
+		{
+			return m_swapChain.presentMode();
+		}
+
+		// Headless rendering runs until the application stops it
+		bool isHeadless() const
+		{
+			return m_window.isHeadless();
+		}
+
+		int windowShouldClose() const
+		{
+			return m_window.isHeadless() ? 0 : glfwWindowShouldClose(m_window.getWindow());
+		}
+
+		void windowPollEvents() const
+		{
+			if (!m_window.isHeadless()) glfwPollEvents();
+		}
+
+		// Sleep until an event arrives
+		void windowWaitEvents() const
+		{
+			if (!m_window.isHeadless()) glfwWaitEvents();
+		}
+
+		void windowSetTitle(const std::string &title)
+		{
+			m_window.setWindowTitle(title);
+		}
+
+		// The size of the offscreen images made by the next recreateSwapChain()
+		void windowSetHeadlessExtent(uint32_t width, uint32_t height)
+		{
+			m_window.setHeadlessExtent(width, height);
+		}
+		// --- Window system ---
+
+		// --- Device properties ---
+		void getPhysicalDeviceProperties(VkPhysicalDeviceProperties *pProps) const
+		{
+			vkGetPhysicalDeviceProperties(m_device, pProps);
+		}
+
+		bool isDescriptorIndexingEnabled() const
+		{
+			return m_device.isDescriptorIndexingEnabled();
+		}
+
+		bool isStorageImageMultisampleEnabled() const
+		{
+			return m_device.isStorageImageMultisampleEnabled();
+		}
+
+		bool isSparseResidencyEnabled() const
+		{
+			return m_device.isSparseResidencyEnabled();
+		}
+
+		bool isFragmentStoresEnabled() const
+		{
+			return m_device.isFragmentStoresEnabled();
+		}
+
+		bool isTimelineSemaphoreEnabled() const
+		{
+			return m_device.isTimelineSemaphoreEnabled();
+		}
+
+		bool isPushDescriptorEnabled() const
+		{
+			return m_device.isPushDescriptorEnabled();
+		}
+
+		bool isMeshShaderEnabled() const
+		{
+			return m_device.isMeshShaderEnabled();
+		}
+
+		bool isRayQueryEnabled() const
+		{
+			return m_device.isRayQueryEnabled();
+		}
+
+		bool isShaderFloat16Enabled() const
+		{
+			return m_device.isShaderFloat16Enabled();
+		}
+
+		bool isFragmentShadingRateEnabled() const
+		{
+			return m_device.isFragmentShadingRateEnabled();
+		}
+
+		const VkPhysicalDeviceFragmentShadingRatePropertiesKHR &getFragmentShadingRateProperties() const
+		{
+			return m_device.getFragmentShadingRateProperties();
+		}
+
+		bool isDepthStencilResolveEnabled() const
+		{
+			return m_device.isDepthStencilResolveEnabled();
+		}
+
+		const VkPhysicalDeviceDepthStencilResolvePropertiesKHR &getDepthStencilResolveProperties() const
+		{
+			return m_device.getDepthStencilResolveProperties();
+		}
+
+		const VkPhysicalDeviceSubgroupProperties &getSubgroupProperties() const
+		{
+			return m_device.getSubgroupProperties();
+		}
+
+		bool isCalibratedTimestampsEnabled() const
+		{
+			return m_device.isCalibratedTimestampsEnabled();
+		}
+
+		// Device timestamp and std::chrono::steady_clock nanoseconds at the same instant. False without isCalibratedTimestampsEnabled()
+		bool getCalibratedTimestamps(uint64_t *pDeviceTimestamp, uint64_t *pHostNs) const
+		{
+			return m_device.sampleCalibratedTimestamps(pDeviceTimestamp, pHostNs);
+		}
+
+		// Graphics and compute families are the same if the device has no separate compute family
+		const VQueueFamilyIndices &getQueueFamilyIndices() const
+		{
+			return m_device.getQueueFamilyIndices();
+		}
+
+		// Uploads are copied on their own queue, e.g. a DMA engine, instead of the graphics queue
+		bool isTransferQueueDedicated() const
+		{
+			const auto &queueFamilyIndices = m_device.getQueueFamilyIndices();
+			return queueFamilyIndices.transferFamily != queueFamilyIndices.graphicsFamily;
+		}
+
+		// Remember the SPIR-V files of this run for preloadShaderModules in the next one
+		void saveShaderList() const
+		{
+			if (m_shaderModules.empty()) return;
+
+			std::ofstream ofs(SHADER_LIST_FILE_NAME, std::ios::trunc);
+			for (const auto &module : m_shaderModules)
+			{
+				ofs << module.first << "\n";
+			}
+		}
+
+		// Write the pipeline cache to disk so the next run can skip shader compilation
+		void savePipelineCache() const
+		{
+			size_t size = 0;
+			if (vkGetPipelineCacheData(m_device, m_pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) return;
+
+			std::vector<char> data(size);
+			if (vkGetPipelineCacheData(m_device, m_pipelineCache, &size, data.data()) != VK_SUCCESS) return;
+
+			std::ofstream ofs(PIPELINE_CACHE_FILE_NAME, std::ios::binary | std::ios::trunc);
+			ofs.write(data.data(), size);
+		}
+
+		VkFormat chooseSupportedFormatFromCandidates(const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
+		{
+			return findSupportedFormat(m_device, candidates, tiling, features);
+		}
+
+		bool isFormatSupported(VkFormat format, VkImageTiling tiling, VkFormatFeatureFlags features)
+		{
+			return helper_functions::isFormatSupported(m_device, format, tiling, features);
+		}
+
+		// Per memory type usage and fragmentation of the pools buffers and images are sub-allocated from
+		std::vector<MemoryPoolStats> getMemoryPoolStats() const
+		{
+			return m_memoryAllocator.getAllPoolStats();
+		}
+
+		// Usage against budget and usage by category of every memory heap
+		std::vector<MemoryHeapBudget> getMemoryHeapBudgets() const
+		{
+			return m_memoryAllocator.getHeapBudgets();
+		}
+
+		bool isMemoryBudgetEnabled() const { return m_device.isMemoryBudgetEnabled(); }
+
+		// Called when an allocation puts a heap over its budget. By default a warning is printed
+		void setMemoryBudgetCallback(const VMemoryAllocator::BudgetCallback &callback)
+		{
+			m_memoryAllocator.setBudgetCallback(callback);
+		}
+
+		// Empty a little used memory block, see VMemoryAllocator::beginDefragmentation. Its owners move their resources out by
+		// creating them anew and destroying the old ones, whose memory is then freed as soon as no frame uses them
+		bool beginMemoryDefragmentation(uint32_t categoryMask, float maxUsedFraction)
+		{
+			return m_memoryAllocator.beginDefragmentation(categoryMask, maxUsedFraction);
+		}
+		void endMemoryDefragmentation() { m_memoryAllocator.endDefragmentation(); }
+		bool isMemoryDefragmenting() const { return m_memoryAllocator.isDefragmenting(); }
+
+		// True if @imageName has to be moved for the block being emptied to be released
+		bool isImageInDefragmentationSource(uint32_t imageName) const
+		{
+			return m_memoryAllocator.isInDefragmentationSource(m_images[imageName].allocation());
+		}
+		// --- Device properties ---
+
+	protected:
+		static bool isBufferDescriptorType(VkDescriptorType type)
+		{
+			return type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER ||
+				type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		}
+
+		VkDescriptorBufferInfo getDescriptorBufferInfo(const DescriptorSetUpdateBufferInfo &updateInfo) const
+		{
+			VkDescriptorBufferInfo info = {};
+			info.buffer = m_buffers.at(updateInfo.bufferName);
+			info.offset = updateInfo.offset;
+			info.range = updateInfo.sizeInBytes;
+			return info;
+		}
+
+		// Null handles for names that are the uint32 max
+		VkDescriptorImageInfo getDescriptorImageInfo(const DescriptorSetUpdateImageInfo &updateInfo) const
+		{
+			VkDescriptorImageInfo info = {};
+			info.sampler = updateInfo.samplerName == std::numeric_limits<uint32_t>::max() ?
+				VK_NULL_HANDLE : VkSampler(m_samplers.at(updateInfo.samplerName));
+			info.imageView = updateInfo.imageViewName == std::numeric_limits<uint32_t>::max() ?
+				VK_NULL_HANDLE : VkImageView(m_imageViews.at(updateInfo.imageViewName));
+			info.imageLayout = updateInfo.layout;
+			return info;
+		}
+
+		template<typename... Args>
+		void captureCommand(uint32_t cmdBufferName, VCommandCapture::Command command, const Args &... args) const
+		{
+			if (m_pCommandCapture) m_pCommandCapture->recordCommand(cmdBufferName, command, args...);
+		}
+
+		static uint64_t getCaptureSignature(const VBuffer &buffer)
+		{
+			StateHasher hasher;
+			hasher.add(buffer.size());
+			hasher.add(buffer.usage());
+			hasher.add(buffer.memoryProperties());
+			return hasher.h;
+		}
+
+		static uint64_t getCaptureSignature(const VImage &image)
+		{
+			StateHasher hasher;
+			hasher.add(image.format());
+			hasher.add(image.extent(0));
+			hasher.add(image.levels());
+			hasher.add(image.layers());
+			hasher.add(image.sampleCount());
+			hasher.add(image.usage());
+			return hasher.h;
+		}
+
+		void replayDescriptorCalls(const VCommandCapture &capture, std::unordered_map<uint32_t, uint32_t> *pSetNames)
+		{
+			const auto getSetName = [pSetNames](uint32_t setName)
+			{
+				const auto it = pSetNames->find(setName);
+				return it == pSetNames->end() ? setName : it->second;
+			};
+
+			std::vector<std::pair<uint32_t, uint32_t>> transientFrames; // allocator and frame, freed before their first allocation
+			std::vector<DescriptorSetUpdateBufferInfo> bufferInfos;
+			std::vector<DescriptorSetUpdateImageInfo> imageInfos;
+			std::vector<PushDescriptorWrite> writes;
+
+			VCommandCapture::Reader reader(capture.descriptorStream);
+			while (!reader.atEnd())
+			{
+				const auto call = reader.read<VCommandCapture::DescriptorCall>();
+				switch (call)
+				{
+				case VCommandCapture::DESC_ALLOCATE_TRANSIENT:
+				{
+					const uint32_t allocatorName = reader.read<uint32_t>();
+					const uint32_t frameIdx = reader.read<uint32_t>();
+					const uint32_t setLayoutName = reader.read<uint32_t>();
+					const uint32_t setName = reader.read<uint32_t>();
+					const auto frame = std::make_pair(allocatorName, frameIdx);
+					if (std::find(transientFrames.begin(), transientFrames.end(), frame) == transientFrames.end())
+					{
+						beginTransientDescriptorFrame(allocatorName, frameIdx);
+						transientFrames.push_back(frame);
+					}
+					(*pSetNames)[setName] = allocateTransientDescriptorSet(allocatorName, frameIdx, setLayoutName);
+					break;
+				}
+				case VCommandCapture::DESC_BUFFERS:
+				case VCommandCapture::DESC_IMAGES:
+				{
+					const uint32_t setName = getSetName(reader.read<uint32_t>());
+					const uint32_t binding = reader.read<uint32_t>();
+					const VkDescriptorType type = reader.read<VkDescriptorType>();
+					const uint32_t baseArrayElement = reader.read<uint32_t>();
+					beginUpdateDescriptorSet(setName);
+					if (call == VCommandCapture::DESC_BUFFERS)
+					{
+						reader.readArray(&bufferInfos);
+						descriptorSetAddBufferDescriptor(binding, type, bufferInfos, baseArrayElement);
+					}
+					else
+					{
+						reader.readArray(&imageInfos);
+						descriptorSetAddImageDescriptor(binding, type, imageInfos, baseArrayElement);
+					}
+					endUpdateDescriptorSet();
+					break;
+				}
+				case VCommandCapture::DESC_ACCELERATION_STRUCTURE:
+				{
+					const uint32_t setName = getSetName(reader.read<uint32_t>());
+					const uint32_t binding = reader.read<uint32_t>();
+					const uint32_t accelerationStructureName = reader.read<uint32_t>();
+					beginUpdateDescriptorSet(setName);
+					descriptorSetAddAccelerationStructureDescriptor(binding, accelerationStructureName);
+					endUpdateDescriptorSet();
+					break;
+				}
+				case VCommandCapture::DESC_WRITES:
+				{
+					const uint32_t setName = getSetName(reader.read<uint32_t>());
+					writeDescriptorSet(setName, reader.readArray(&writes));
+					break;
+				}
+				default:
+					throw std::runtime_error("corrupt descriptor stream in command capture");
+				}
+			}
+		}
+
+		void replayCommandStream(uint32_t cmdBufferName, const std::vector<uint8_t> &stream, const std::unordered_map<uint32_t, uint32_t> &setNames)
+		{
+			// Views into the scratch vectors stay valid until the next packet
+			thread_local std::vector<uint32_t> names;
+			thread_local std::vector<VkDeviceSize> offsets;
+			thread_local std::vector<VkClearValue> clearValues;
+			thread_local std::vector<VkClearAttachment> attachments;
+			thread_local std::vector<VkClearRect> rects;
+			thread_local std::vector<uint32_t> dynamicOffsets;
+			thread_local std::vector<PushDescriptorWrite> writes;
+			thread_local std::vector<uint8_t> bytes;
+			thread_local std::vector<VkBufferImageCopy> regions;
+
+			VCommandCapture::Reader reader(stream);
+			while (!reader.atEnd())
+			{
+				const auto command = reader.read<VCommandCapture::Command>();
+				switch (command)
+				{
+				case VCommandCapture::CMD_BEGIN:
+					beginCommandBuffer(cmdBufferName, reader.read<VkCommandBufferUsageFlags>());
+					break;
+				case VCommandCapture::CMD_BEGIN_SECONDARY:
+				{
+					const uint32_t renderPassName = reader.read<uint32_t>();
+					const uint32_t subpass = reader.read<uint32_t>();
+					const uint32_t framebufferName = reader.read<uint32_t>();
+					const VkCommandBufferUsageFlags flags = reader.read<VkCommandBufferUsageFlags>();
+					const VkQueryPipelineStatisticFlags pipelineStatistics = reader.read<VkQueryPipelineStatisticFlags>();
+					beginSecondaryCommandBuffer(cmdBufferName, renderPassName, subpass, framebufferName, flags, pipelineStatistics);
+					break;
+				}
+				case VCommandCapture::CMD_BIND_VERTEX_BUFFERS:
+				{
+					const auto bufferNames = reader.readArray(&names);
+					const auto bufferOffsets = reader.readArray(&offsets);
+					cmdBindVertexBuffers(cmdBufferName, bufferNames, bufferOffsets, reader.read<uint32_t>());
+					break;
+				}
+				case VCommandCapture::CMD_BIND_INDEX_BUFFER:
+				{
+					const uint32_t indexBufferName = reader.read<uint32_t>();
+					const VkIndexType type = reader.read<VkIndexType>();
+					cmdBindIndexBuffer(cmdBufferName, indexBufferName, type, reader.read<VkDeviceSize>());
+					break;
+				}
+				case VCommandCapture::CMD_BEGIN_RENDER_PASS:
+				{
+					const uint32_t renderPassName = reader.read<uint32_t>();
+					const uint32_t framebufferName = reader.read<uint32_t>();
+					const auto clears = reader.readArray(&clearValues);
+					const VkRect2D renderArea = reader.read<VkRect2D>();
+					cmdBeginRenderPass(cmdBufferName, renderPassName, framebufferName, clears, renderArea, reader.read<VkSubpassContents>());
+					break;
+				}
+				case VCommandCapture::CMD_END_RENDER_PASS:
+					cmdEndRenderPass(cmdBufferName);
+					break;
+				case VCommandCapture::CMD_NEXT_SUBPASS:
+					cmdNextSubpass(cmdBufferName, reader.read<VkSubpassContents>());
+					break;
+				case VCommandCapture::CMD_EXECUTE_COMMANDS:
+					cmdExecuteCommands(cmdBufferName, reader.readArray(&names));
+					break;
+				case VCommandCapture::CMD_CLEAR_ATTACHMENTS:
+				{
+					const auto clearAttachments = reader.readArray(&attachments);
+					cmdClearAttachments(cmdBufferName, clearAttachments, reader.readArray(&rects));
+					break;
+				}
+				case VCommandCapture::CMD_BIND_PIPELINE:
+				{
+					const VkPipelineBindPoint bindPoint = reader.read<VkPipelineBindPoint>();
+					cmdBindPipeline(cmdBufferName, bindPoint, reader.read<uint32_t>());
+					break;
+				}
+				case VCommandCapture::CMD_BIND_DESCRIPTOR_SETS:
+				{
+					const VkPipelineBindPoint bindPoint = reader.read<VkPipelineBindPoint>();
+					const uint32_t pipelineLayoutName = reader.read<uint32_t>();
+					reader.readArray(&names);
+					for (auto &name : names)
+					{
+						const auto it = setNames.find(name);
+						if (it != setNames.end()) name = it->second;
+					}
+					const uint32_t firstSet = reader.read<uint32_t>();
+					cmdBindDescriptorSets(cmdBufferName, bindPoint, pipelineLayoutName, names, firstSet, reader.readArray(&dynamicOffsets));
+					break;
+				}
+				case VCommandCapture::CMD_PUSH_DESCRIPTOR_SET:
+				{
+					const VkPipelineBindPoint bindPoint = reader.read<VkPipelineBindPoint>();
+					const uint32_t pipelineLayoutName = reader.read<uint32_t>();
+					const uint32_t set = reader.read<uint32_t>();
+					cmdPushDescriptorSet(cmdBufferName, bindPoint, pipelineLayoutName, set, reader.readArray(&writes));
+					break;
+				}
+				case VCommandCapture::CMD_SET_VIEWPORT:
+				{
+					const VkViewport viewport = reader.read<VkViewport>();
+					cmdSetViewport(cmdBufferName, viewport.x, viewport.y, viewport.width, viewport.height, viewport.minDepth, viewport.maxDepth);
+					break;
+				}
+				case VCommandCapture::CMD_SET_SCISSOR:
+				{
+					const VkRect2D scissor = reader.read<VkRect2D>();
+					cmdSetScissor(cmdBufferName, scissor.offset.x, scissor.offset.y, scissor.extent.width, scissor.extent.height);
+					break;
+				}
+				case VCommandCapture::CMD_DRAW_INDEXED:
+				{
+					const uint32_t indexCount = reader.read<uint32_t>();
+					const uint32_t instanceCount = reader.read<uint32_t>();
+					const uint32_t firstIndex = reader.read<uint32_t>();
+					const int32_t vertexOffset = reader.read<int32_t>();
+					cmdDrawIndexed(cmdBufferName, indexCount, instanceCount, firstIndex, vertexOffset, reader.read<uint32_t>());
+					break;
+				}
+				case VCommandCapture::CMD_DRAW_INDEXED_INDIRECT:
+				case VCommandCapture::CMD_DRAW_MESH_TASKS_INDIRECT:
+				{
+					const uint32_t bufferName = reader.read<uint32_t>();
+					const VkDeviceSize offset = reader.read<VkDeviceSize>();
+					const uint32_t drawCount = reader.read<uint32_t>();
+					const uint32_t stride = reader.read<uint32_t>();
+					if (command == VCommandCapture::CMD_DRAW_INDEXED_INDIRECT)
+					{
+						cmdDrawIndexedIndirect(cmdBufferName, bufferName, offset, drawCount, stride);
+					}
+					else
+					{
+						cmdDrawMeshTasksIndirect(cmdBufferName, bufferName, offset, drawCount, stride);
+					}
+					break;
+				}
+				case VCommandCapture::CMD_DRAW:
+				{
+					const uint32_t vertexCount = reader.read<uint32_t>();
+					const uint32_t instanceCount = reader.read<uint32_t>();
+					const uint32_t firstVertex = reader.read<uint32_t>();
+					cmdDraw(cmdBufferName, vertexCount, instanceCount, firstVertex, reader.read<uint32_t>());
+					break;
+				}
+				case VCommandCapture::CMD_PUSH_CONSTANTS:
+				{
+					const uint32_t pipelineLayoutName = reader.read<uint32_t>();
+					const VkShaderStageFlags shaderStages = reader.read<VkShaderStageFlags>();
+					const uint32_t offset = reader.read<uint32_t>();
+					const auto values = reader.readArray(&bytes);
+					cmdPushConstants(cmdBufferName, pipelineLayoutName, shaderStages, offset, static_cast<uint32_t>(values.size()), values.data());
+					break;
+				}
+				case VCommandCapture::CMD_DISPATCH:
+				{
+					const uint32_t numBlocksX = reader.read<uint32_t>();
+					const uint32_t numBlocksY = reader.read<uint32_t>();
+					cmdDispatch(cmdBufferName, numBlocksX, numBlocksY, reader.read<uint32_t>());
+					break;
+				}
+				case VCommandCapture::CMD_MEMORY_BARRIER:
+				{
+					const VkPipelineStageFlags srcStages = reader.read<VkPipelineStageFlags>();
+					const VkPipelineStageFlags dstStages = reader.read<VkPipelineStageFlags>();
+					const VkAccessFlags srcAccess = reader.read<VkAccessFlags>();
+					cmdMemoryBarrier(cmdBufferName, srcStages, dstStages, srcAccess, reader.read<VkAccessFlags>());
+					break;
+				}
+				case VCommandCapture::CMD_IMAGE_BARRIER:
+				{
+					const uint32_t imageName = reader.read<uint32_t>();
+					const VkImageLayout oldLayout = reader.read<VkImageLayout>();
+					const VkImageLayout newLayout = reader.read<VkImageLayout>();
+					const VkPipelineStageFlags srcStages = reader.read<VkPipelineStageFlags>();
+					const VkPipelineStageFlags dstStages = reader.read<VkPipelineStageFlags>();
+					const VkAccessFlags srcAccess = reader.read<VkAccessFlags>();
+					const VkAccessFlags dstAccess = reader.read<VkAccessFlags>();
+					const VkImageAspectFlags aspectMask = reader.read<VkImageAspectFlags>();
+					const uint32_t srcQueueFamilyIndex = reader.read<uint32_t>();
+					cmdImageBarrier(cmdBufferName, imageName, oldLayout, newLayout, srcStages, dstStages, srcAccess, dstAccess, aspectMask,
+						srcQueueFamilyIndex, reader.read<uint32_t>());
+					break;
+				}
+				case VCommandCapture::CMD_COPY_IMAGE:
+				{
+					const uint32_t srcImageName = reader.read<uint32_t>();
+					const VkImageLayout srcLayout = reader.read<VkImageLayout>();
+					const uint32_t dstImageName = reader.read<uint32_t>();
+					const VkImageLayout dstLayout = reader.read<VkImageLayout>();
+					cmdCopyImage(cmdBufferName, srcImageName, srcLayout, dstImageName, dstLayout, reader.read<VkImageAspectFlags>());
+					break;
+				}
+				case VCommandCapture::CMD_COPY_BUFFER_TO_IMAGE:
+				{
+					const uint32_t srcBufferName = reader.read<uint32_t>();
+					const uint32_t dstImageName = reader.read<uint32_t>();
+					const VkImageLayout dstLayout = reader.read<VkImageLayout>();
+					cmdCopyBufferToImage(cmdBufferName, srcBufferName, dstImageName, dstLayout, reader.readArray(&regions));
+					break;
+				}
+				case VCommandCapture::CMD_RESET_QUERY_POOL:
+				{
+					const uint32_t queryPoolName = reader.read<uint32_t>();
+					const uint32_t firstQuery = reader.read<uint32_t>();
+					cmdResetQueryPool(cmdBufferName, queryPoolName, firstQuery, reader.read<uint32_t>());
+					break;
+				}
+				case VCommandCapture::CMD_BEGIN_QUERY:
+				{
+					const uint32_t queryPoolName = reader.read<uint32_t>();
+					const uint32_t queryIdx = reader.read<uint32_t>();
+					cmdBeginQuery(cmdBufferName, queryPoolName, queryIdx, reader.read<VkQueryControlFlags>());
+					break;
+				}
+				case VCommandCapture::CMD_END_QUERY:
+				{
+					const uint32_t queryPoolName = reader.read<uint32_t>();
+					cmdEndQuery(cmdBufferName, queryPoolName, reader.read<uint32_t>());
+					break;
+				}
+				case VCommandCapture::CMD_WRITE_TIMESTAMP:
+				{
+					const VkPipelineStageFlagBits pipelineStage = reader.read<VkPipelineStageFlagBits>();
+					const uint32_t queryPoolName = reader.read<uint32_t>();
+					cmdWriteTimestamp(cmdBufferName, pipelineStage, queryPoolName, reader.read<uint32_t>());
+					break;
+				}
+				case VCommandCapture::CMD_BUILD_TOP_LEVEL_ACCELERATION_STRUCTURE:
+				{
+					const uint32_t tlasName = reader.read<uint32_t>();
+					const uint32_t instanceBufferName = reader.read<uint32_t>();
+					const uint32_t instanceCount = reader.read<uint32_t>();
+					cmdBuildTopLevelAccelerationStructure(cmdBufferName, tlasName, instanceBufferName, instanceCount, reader.read<bool>());
+					break;
+				}
+				case VCommandCapture::CMD_SET_DEPTH_BIAS:
+				{
+					const float constantFactor = reader.read<float>();
+					const float biasClamp = reader.read<float>();
+					cmdSetDepthBias(cmdBufferName, constantFactor, biasClamp, reader.read<float>());
+					break;
+				}
+				default:
+					throw std::runtime_error("corrupt command stream in command capture");
+				}
+			}
+			if (reader.failed()) throw std::runtime_error("corrupt command stream in command capture");
+			endCommandBuffer(cmdBufferName);
+		}
+
+		bool cmdReadImageAsync(VkCommandBuffer cmdBuffer, VkImage image, VkExtent2D extent, uint32_t blockSize, VkImageAspectFlags aspectMask,
+			VkImageLayout layout, const VReadbackRing::Callback &callback)
+		{
+			const VkDeviceSize sizeInBytes = VkDeviceSize(extent.width) * extent.height * blockSize;
+			if (sizeInBytes > m_readbackRing.getBufferSize())
+			{
+				throw std::runtime_error("image is larger than the readback buffers");
+			}
+
+			// Recorded at the end of a frame, so everything before is waited on
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = layout;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange = { aspectMask, 0, 1, 0, 1 };
+			vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+				0, nullptr, 0, nullptr, 1, &barrier);
+
+			VkBufferImageCopy region = {};
+			region.imageSubresource = { aspectMask, 0, 0, 1 };
+			region.imageExtent = { extent.width, extent.height, 1 };
+			const bool queued = m_readbackRing.cmdCopyImage(cmdBuffer, image, region, sizeInBytes, m_frameSerial, callback);
+
+			std::swap(barrier.oldLayout, barrier.newLayout);
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+				0, nullptr, 0, nullptr, 1, &barrier);
+
+			return queued;
+		}
+
+		// Usage the geometry pool buffers need to be read by acceleration structure builds
+		VkBufferUsageFlags getGeometryPoolBuildInputUsage() const
+		{
+			if (!m_device.isRayQueryEnabled()) return 0;
+			return VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR;
+		}
+
+		uint32_t createAccelerationStructure(VkAccelerationStructureTypeKHR type, VkDeviceSize sizeInBytes)
+		{
+			uint32_t name;
+			{
+				std::lock_guard<std::mutex> guard(m_resourceMutex);
+				name = m_accelerationStructureNames.allocate();
+				if (name == m_accelerationStructures.size()) m_accelerationStructures.emplace_back(m_device, &m_memoryAllocator);
+			}
+
+			// A reused name still has the structure of its last life, which goes before its buffer
+			auto &as = m_accelerationStructures.at(name);
+			as.handle.reset();
+			as.buffer.init(sizeInBytes, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+			VkAccelerationStructureCreateInfoKHR createInfo = {};
+			createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+			createInfo.buffer = as.buffer;
+			createInfo.size = sizeInBytes;
+			createInfo.type = type;
+			if (m_device.pfnCreateAccelerationStructure(m_device, &createInfo, nullptr, as.handle.replace()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create acceleration structure!");
+			}
+
+			VkAccelerationStructureDeviceAddressInfoKHR addressInfo = {};
+			addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+			addressInfo.accelerationStructure = as.handle;
+			as.address = m_device.pfnGetAccelerationStructureDeviceAddress(m_device, &addressInfo);
+			return name;
+		}
+
+		// Opaque instances read from @instanceAddress, the mode and structures are left to the caller
+		static void fillTopLevelBuildInfo(VkAccelerationStructureGeometryKHR *pGeometry, VkAccelerationStructureBuildGeometryInfoKHR *pBuildInfo,
+			VkDeviceAddress instanceAddress)
+		{
+			pGeometry->sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+			pGeometry->geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+			pGeometry->flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+			pGeometry->geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+			pGeometry->geometry.instances.arrayOfPointers = VK_FALSE;
+			pGeometry->geometry.instances.data.deviceAddress = instanceAddress;
+
+			pBuildInfo->sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+			pBuildInfo->type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+			pBuildInfo->flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+			pBuildInfo->mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+			pBuildInfo->geometryCount = 1;
+			pBuildInfo->pGeometries = pGeometry;
+		}
+
+		void retireName(VNamePool &pool, uint32_t name)
+		{
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			pool.retire(name);
+			m_retiredNames.push_back({ m_frameSerial, &pool, name });
+		}
+
+		// Pipelines are equal if everything that goes into their create info is, with the render pass reduced to its
+		// compatibility class. Attachment formats and sample counts count, layouts and load and store ops do not
+		static uint64_t hashRenderPassCompatibility(const RenderPassCreateInfo &info)
+		{
+			StateHasher hasher;
+			auto addRefs = [&](const VkAttachmentReference *pRefs, uint32_t count)
+			{
+				hasher.add(count);
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					if (pRefs[i].attachment == VK_ATTACHMENT_UNUSED)
+					{
+						hasher.add(VK_ATTACHMENT_UNUSED);
+						continue;
+					}
+					const auto &desc = info.attachmentDescs[pRefs[i].attachment];
+					hasher.add(desc.format);
+					hasher.add(desc.samples);
+				}
+			};
+
+			hasher.add(static_cast<uint32_t>(info.attachmentDescs.size()));
+			for (const auto &desc : info.attachmentDescs)
+			{
+				hasher.add(desc.flags);
+				hasher.add(desc.format);
+				hasher.add(desc.samples);
+			}
+			hasher.add(static_cast<uint32_t>(info.subpassDescs.size()));
+			for (const auto &subpass : info.subpassDescs)
+			{
+				hasher.add(subpass.flags);
+				hasher.add(subpass.pipelineBindPoint);
+				addRefs(subpass.pInputAttachments, subpass.inputAttachmentCount);
+				addRefs(subpass.pColorAttachments, subpass.colorAttachmentCount);
+				addRefs(subpass.pResolveAttachments, subpass.pResolveAttachments ? subpass.colorAttachmentCount : 0);
+				addRefs(subpass.pDepthStencilAttachment, subpass.pDepthStencilAttachment ? 1 : 0);
+				hasher.addArray(subpass.pPreserveAttachments, subpass.preserveAttachmentCount);
+			}
+			for (const auto &subpassInfo : info.subpassInfos)
+			{
+				addRefs(&subpassInfo.shadingRateAttachmentRef, 1);
+				hasher.add(subpassInfo.shadingRateTexelSize);
+				addRefs(&subpassInfo.depthResolveAttachmentRef, 1);
+				hasher.add(subpassInfo.depthResolveMode);
+			}
+			hasher.addArray(info.subpassDependencies.data(), static_cast<uint32_t>(info.subpassDependencies.size()));
+			return hasher.h;
+		}
+
+		// Of one layer, every sample of it
+		static uint64_t getImageBytes(const VImage &image, uint32_t baseLevel, uint32_t levelCount)
+		{
+			const auto it = g_formatInfoTable.find(image.format());
+			if (it == g_formatInfoTable.end()) return 0;
+
+			const auto &info = it->second;
+			uint64_t bytes = 0;
+			for (uint32_t level = baseLevel; level < std::min(baseLevel + levelCount, image.levels()); ++level)
+			{
+				const VkExtent3D extent = image.extent(level);
+				const uint64_t blockCount = static_cast<uint64_t>((std::max(extent.width, 1u) + info.blockExtent.width - 1) / info.blockExtent.width) *
+					((std::max(extent.height, 1u) + info.blockExtent.height - 1) / info.blockExtent.height) * extent.depth;
+				bytes += blockCount * info.blockSize;
+			}
+			return bytes * image.sampleCount();
+		}
+
+		struct AttachmentTraffic
+		{
+			uint32_t bytesReadPerPixel = 0;
+			uint32_t bytesWrittenPerPixel = 0;
+		};
+
+		// Attachments are read if loaded and written if stored, every sample of them. Depth and stencil count as one texel
+		// if either aspect is loaded or stored. Immediate mode GPUs also go to memory for blending and depth testing, so
+		// there this is a lower bound
+		static AttachmentTraffic getAttachmentTraffic(const RenderPassCreateInfo &info)
+		{
+			AttachmentTraffic traffic;
+			for (const auto &desc : info.attachmentDescs)
+			{
+				const auto it = g_formatInfoTable.find(desc.format);
+				if (it == g_formatInfoTable.end()) continue;
+
+				const uint32_t texelSize = it->second.blockSize * static_cast<uint32_t>(desc.samples);
+				if (desc.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD || desc.stencilLoadOp == VK_ATTACHMENT_LOAD_OP_LOAD) traffic.bytesReadPerPixel += texelSize;
+				if (desc.storeOp == VK_ATTACHMENT_STORE_OP_STORE || desc.stencilStoreOp == VK_ATTACHMENT_STORE_OP_STORE) traffic.bytesWrittenPerPixel += texelSize;
+			}
+			return traffic;
+		}
+
+		// The render pass of @info with the VkRenderPassCreateInfo2 structures, which can chain a shading rate and a depth resolve
+		// attachment to a subpass
+		VkResult createRenderPass2(const RenderPassCreateInfo &info, VkRenderPass *pRenderPass) const
+		{
+			std::vector<VkAttachmentDescription2KHR> attachments(info.attachmentDescs.size());
+			for (size_t i = 0; i < attachments.size(); ++i)
+			{
+				const auto &desc = info.attachmentDescs[i];
+				attachments[i] = { VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2_KHR, nullptr, desc.flags, desc.format, desc.samples, desc.loadOp, desc.storeOp,
+					desc.stencilLoadOp, desc.stencilStoreOp, desc.initialLayout, desc.finalLayout };
+			}
+
+			// Input attachments name the aspect they read, which the first version derived from the format
+			auto getInputAspect = [&](uint32_t attachment) -> VkImageAspectFlags
+			{
+				switch (info.attachmentDescs[attachment].format)
+				{
+				case VK_FORMAT_D16_UNORM:
+				case VK_FORMAT_X8_D24_UNORM_PACK32:
+				case VK_FORMAT_D32_SFLOAT:
+				case VK_FORMAT_D16_UNORM_S8_UINT:
+				case VK_FORMAT_D24_UNORM_S8_UINT:
+				case VK_FORMAT_D32_SFLOAT_S8_UINT:
+					return VK_IMAGE_ASPECT_DEPTH_BIT;
+				case VK_FORMAT_S8_UINT:
+					return VK_IMAGE_ASPECT_STENCIL_BIT;
+				default:
+					return VK_IMAGE_ASPECT_COLOR_BIT;
+				}
+			};
+
+			// Per subpass: input, color, resolve, depth, shading rate and depth resolve references, in this order
+			std::vector<std::vector<VkAttachmentReference2KHR>> refs(info.subpassInfos.size());
+			std::vector<VkFragmentShadingRateAttachmentInfoKHR> shadingRateInfos(info.subpassInfos.size());
+			std::vector<VkSubpassDescriptionDepthStencilResolveKHR> depthResolveInfos(info.subpassInfos.size());
+			std::vector<VkSubpassDescription2KHR> subpasses(info.subpassDescs.size());
+			for (size_t i = 0; i < subpasses.size(); ++i)
+			{
+				const auto &subpassInfo = info.subpassInfos[i];
+				const auto &desc = info.subpassDescs[i];
+				auto &subpassRefs = refs[i];
+				auto addRef = [&](const VkAttachmentReference &ref, VkImageAspectFlags aspectMask)
+				{
+					subpassRefs.push_back({ VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2_KHR, nullptr, ref.attachment, ref.layout, aspectMask });
+				};
+				subpassRefs.reserve(subpassInfo.inputAttachmentRefs.size() + subpassInfo.colorAttachmentRefs.size() +
+					subpassInfo.resolveAttachmentRefs.size() + subpassInfo.depthAttachmentRefs.size() + 2);
+				for (const auto &ref : subpassInfo.inputAttachmentRefs)
+				{
+					addRef(ref, ref.attachment == VK_ATTACHMENT_UNUSED ? 0 : getInputAspect(ref.attachment));
+				}
+				for (const auto *pRefs : { &subpassInfo.colorAttachmentRefs, &subpassInfo.resolveAttachmentRefs, &subpassInfo.depthAttachmentRefs })
+				{
+					for (const auto &ref : *pRefs) addRef(ref, 0);
+				}
+
+				auto &subpass = subpasses[i];
+				subpass = { VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2_KHR };
+				subpass.flags = desc.flags;
+				subpass.pipelineBindPoint = desc.pipelineBindPoint;
+				const VkAttachmentReference2KHR *pRef = subpassRefs.data();
+				subpass.inputAttachmentCount = desc.inputAttachmentCount;
+				subpass.pInputAttachments = desc.inputAttachmentCount > 0 ? pRef : nullptr;
+				pRef += subpassInfo.inputAttachmentRefs.size();
+				subpass.colorAttachmentCount = desc.colorAttachmentCount;
+				subpass.pColorAttachments = desc.colorAttachmentCount > 0 ? pRef : nullptr;
+				pRef += subpassInfo.colorAttachmentRefs.size();
+				subpass.pResolveAttachments = desc.pResolveAttachments ? pRef : nullptr;
+				pRef += subpassInfo.resolveAttachmentRefs.size();
+				subpass.pDepthStencilAttachment = desc.pDepthStencilAttachment ? pRef : nullptr;
+				subpass.preserveAttachmentCount = desc.preserveAttachmentCount;
+				subpass.pPreserveAttachments = desc.pPreserveAttachments;
+
+				if (subpassInfo.shadingRateAttachmentRef.attachment != VK_ATTACHMENT_UNUSED)
+				{
+					addRef(subpassInfo.shadingRateAttachmentRef, 0);
+					auto &shadingRateInfo = shadingRateInfos[i];
+					shadingRateInfo.sType = VK_STRUCTURE_TYPE_FRAGMENT_SHADING_RATE_ATTACHMENT_INFO_KHR;
+					shadingRateInfo.pFragmentShadingRateAttachment = &subpassRefs.back();
+					shadingRateInfo.shadingRateAttachmentTexelSize = subpassInfo.shadingRateTexelSize;
+					subpass.pNext = &shadingRateInfo;
+				}
+
+				if (subpassInfo.depthResolveAttachmentRef.attachment != VK_ATTACHMENT_UNUSED)
+				{
+					addRef(subpassInfo.depthResolveAttachmentRef, 0);
+					auto &depthResolveInfo = depthResolveInfos[i];
+					depthResolveInfo.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_DEPTH_STENCIL_RESOLVE_KHR;
+					depthResolveInfo.pNext = subpass.pNext;
+					depthResolveInfo.depthResolveMode = subpassInfo.depthResolveMode;
+					depthResolveInfo.stencilResolveMode = VK_RESOLVE_MODE_NONE_KHR;
+					depthResolveInfo.pDepthStencilResolveAttachment = &subpassRefs.back();
+					subpass.pNext = &depthResolveInfo;
+				}
+			}
+
+			std::vector<VkSubpassDependency2KHR> dependencies(info.subpassDependencies.size());
+			for (size_t i = 0; i < dependencies.size(); ++i)
+			{
+				const auto &dep = info.subpassDependencies[i];
+				dependencies[i] = { VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2_KHR, nullptr, dep.srcSubpass, dep.dstSubpass, dep.srcStageMask, dep.dstStageMask,
+					dep.srcAccessMask, dep.dstAccessMask, dep.dependencyFlags, 0 };
+			}
+
+			VkRenderPassCreateInfo2KHR renderPassInfo = {};
+			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO_2_KHR;
+			renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+			renderPassInfo.pAttachments = attachments.data();
+			renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+			renderPassInfo.pSubpasses = subpasses.data();
+			renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+			renderPassInfo.pDependencies = dependencies.data();
+			return m_device.pfnCreateRenderPass2(m_device, &renderPassInfo, helper_functions::getHostAllocationCallbacks(), pRenderPass);
+		}
+
+		static void hashShaderStage(StateHasher &hasher, const VkPipelineShaderStageCreateInfo &stage)
+		{
+			// Modules stay alive with the manager, so equal handles are equal code
+			hasher.add(stage.flags);
+			hasher.add(stage.stage);
+			hasher.add(stage.module);
+			hasher.addBytes(stage.pName, strlen(stage.pName));
+			const VkSpecializationInfo *pSpecialization = stage.pSpecializationInfo;
+			if (pSpecialization)
+			{
+				hasher.addArray(pSpecialization->pMapEntries, pSpecialization->mapEntryCount);
+				hasher.addArray(static_cast<const char *>(pSpecialization->pData), static_cast<uint32_t>(pSpecialization->dataSize));
+			}
+			else
+			{
+				hasher.add(0u);
+			}
+		}
+
+		uint64_t hashGraphicsPipelineState(const GraphicsPipelineCreateInfo &info) const
+		{
+			StateHasher hasher;
+			hasher.add(VK_PIPELINE_BIND_POINT_GRAPHICS);
+			hasher.add(info.pipelineInfo.flags);
+			hasher.add(m_curPipelineLayoutSerial);
+			hasher.add(m_curPipelineRenderPassHash);
+			hasher.add(info.pipelineInfo.subpass);
+			hasher.add(info.pipelineInfo.basePipelineHandle);
+
+			hasher.add(static_cast<uint32_t>(info.shaderStages.size()));
+			for (const auto &stage : info.shaderStages) hashShaderStage(hasher, stage);
+
+			hasher.addArray(info.viBindingDescs.data(), static_cast<uint32_t>(info.viBindingDescs.size()));
+			hasher.addArray(info.viAttrDescs.data(), static_cast<uint32_t>(info.viAttrDescs.size()));
+
+			const auto &ia = info.inputAssemblyInfo;
+			hasher.add(ia.flags);
+			hasher.add(ia.topology);
+			hasher.add(ia.primitiveRestartEnable);
+
+			hasher.add(info.pipelineInfo.pTessellationState ? info.tessellationInfo.patchControlPoints : 0u);
+
+			hasher.add(info.viewportStateInfo.viewportCount);
+			hasher.add(info.viewportStateInfo.scissorCount);
+			hasher.addArray(info.viewports.data(), static_cast<uint32_t>(info.viewports.size()));
+			hasher.addArray(info.scissors.data(), static_cast<uint32_t>(info.scissors.size()));
+
+			const auto &rs = info.rasterizerInfo;
+			hasher.add(rs.flags);
+			hasher.add(rs.depthClampEnable);
+			hasher.add(rs.rasterizerDiscardEnable);
+			hasher.add(rs.polygonMode);
+			hasher.add(rs.cullMode);
+			hasher.add(rs.frontFace);
+			hasher.add(rs.depthBiasEnable);
+			hasher.add(rs.depthBiasConstantFactor);
+			hasher.add(rs.depthBiasClamp);
+			hasher.add(rs.depthBiasSlopeFactor);
+			hasher.add(rs.lineWidth);
+
+			const auto &ms = info.multisamplingInfo;
+			hasher.add(ms.flags);
+			hasher.add(ms.rasterizationSamples);
+			hasher.add(ms.sampleShadingEnable);
+			hasher.add(ms.minSampleShading);
+			hasher.add(ms.alphaToCoverageEnable);
+			hasher.add(ms.alphaToOneEnable);
+			hasher.addArray(ms.pSampleMask, ms.pSampleMask ? static_cast<uint32_t>(info.sampleMask.size()) : 0u);
+
+			const auto &ds = info.depthStencilInfo;
+			hasher.add(ds.flags);
+			hasher.add(ds.depthTestEnable);
+			hasher.add(ds.depthWriteEnable);
+			hasher.add(ds.depthCompareOp);
+			hasher.add(ds.depthBoundsTestEnable);
+			hasher.add(ds.stencilTestEnable);
+			hasher.add(ds.front);
+			hasher.add(ds.back);
+			hasher.add(ds.minDepthBounds);
+			hasher.add(ds.maxDepthBounds);
+
+			const auto &cb = info.colorBlendInfo;
+			hasher.add(cb.flags);
+			hasher.add(cb.logicOpEnable);
+			hasher.add(cb.logicOp);
+			hasher.add(cb.blendConstants);
+			hasher.addArray(info.colorBlendAttachmentStates.data(), static_cast<uint32_t>(info.colorBlendAttachmentStates.size()));
+
+			hasher.addArray(info.dynamicStates.data(), static_cast<uint32_t>(info.dynamicStates.size()));
+			return hasher.h;
+		}
+
+		uint64_t hashComputePipelineState(const ComputePipelineCreateInfo &info) const
+		{
+			StateHasher hasher;
+			hasher.add(VK_PIPELINE_BIND_POINT_COMPUTE);
+			hasher.add(info.pipelineInfo.flags);
+			hasher.add(m_curPipelineLayoutSerial);
+			hasher.add(info.pipelineInfo.basePipelineHandle);
+			hashShaderStage(hasher, info.pipelineInfo.stage);
+			return hasher.h;
 		}
 
-		void cmdWriteTimestamp(uint32_t cmdBufferName, VkPipelineStageFlagBits pipelineStage,
-			uint32_t queryPoolName, uint32_t queryIdx)
+		bool findRegisteredPipeline(uint64_t stateHash, uint32_t *pPipelineName)
 		{
-			assert(queryPoolName < m_queryPools.size());
-			assert(std::find(m_availableQueryPoolNames.begin(), m_availableQueryPoolNames.end(), queryPoolName) == m_availableQueryPoolNames.end());
+			auto it = m_pipelineRegistry.find(stateHash);
+			if (it == m_pipelineRegistry.end()) return false;
 
-			const auto &cb = m_commandBuffers[cmdBufferName];
-			const auto &queryPool = m_queryPools[queryPoolName];
-			assert(queryIdx < queryPool.getQueryCount());
-			vkCmdWriteTimestamp(cb, pipelineStage, queryPool, queryIdx);
+			++m_pipelineRefCounts[it->second];
+			++m_pipelineRegistryHits;
+			*pPipelineName = it->second;
+			return true;
 		}
 
-		void queueWaitIdle(VkQueueFlags queueType) const
+		// Name for a pipeline about to be created, found by findRegisteredPipeline from now on
+		uint32_t registerPipeline(uint64_t stateHash)
 		{
-			VkQueue queue = VK_NULL_HANDLE;
-			switch (queueType)
+			const uint32_t pipelineName = m_pipelineNames.allocate();
+			if (pipelineName == m_pipelines.size())
 			{
-			case VK_QUEUE_COMPUTE_BIT:
-				queue = m_device.getComputeQueue();
-				break;
-			default:
-				queue = m_device.getGraphicsQueue();
-				break;
+				m_pipelines.emplace_back(m_device, vkDestroyPipeline);
+				m_pipelineStateHashes.push_back(0);
+				m_pipelineRefCounts.push_back(0);
 			}
-			vkQueueWaitIdle(queue);
+			m_pipelineStateHashes[pipelineName] = stateHash;
+			m_pipelineRefCounts[pipelineName] = 1;
+			m_pipelineRegistry[stateHash] = pipelineName;
+			++m_pipelineRegistryMisses;
+			return pipelineName;
 		}
 
-		void deviceWaitIdle()
+		template<typename T>
+		void setObjectDebugName(VkObjectType objectType, T handle, const std::string &name) const
 		{
-			if (vkDeviceWaitIdle(m_device) != VK_SUCCESS)
+			if (!isDebugUtilsEnabled() || handle == VK_NULL_HANDLE || name.empty()) return;
+
+			VkDebugUtilsObjectNameInfoEXT info = {};
+			info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+			info.objectType = objectType;
+			info.objectHandle = (uint64_t)handle; // a pointer or a 64 bit integer, depending on the platform
+			info.pObjectName = name.c_str();
+			m_device.pfnSetDebugUtilsObjectName(m_device, &info);
+		}
+
+		// The entry is created the first time the name is handed out. Initialized by the caller outside the lock
+		uint32_t allocateImageName()
+		{
+			std::lock_guard<std::mutex> guard(m_resourceMutex);
+			const uint32_t imageName = m_imageNames.allocate();
+			if (imageName == m_images.size()) m_images.emplace_back(m_device, &m_memoryAllocator);
+			return imageName;
+		}
+
+		std::vector<std::string> readShaderList() const
+		{
+			std::vector<std::string> fileNames;
+			std::ifstream ifs(SHADER_LIST_FILE_NAME);
+			std::string line;
+			while (std::getline(ifs, line))
 			{
-				throw std::runtime_error("failed to wait for device idle");
+				if (!line.empty()) fileNames.push_back(line);
 			}
+			return fileNames;
 		}
 
-		void beginQueueSubmit(VkQueueFlags queueType)
+		void createPipelineCache()
 		{
-			m_curQueueSubmitInfos.clear();
+			std::vector<char> initialData;
+			if (helper_functions::fileExist(PIPELINE_CACHE_FILE_NAME))
+			{
+				initialData = helper_functions::readFile(PIPELINE_CACHE_FILE_NAME);
+				if (!isPipelineCacheDataCompatible(initialData)) initialData.clear();
+			}
 
-			switch (queueType)
+			VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+			pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+			pipelineCacheCreateInfo.initialDataSize = initialData.size();
+			pipelineCacheCreateInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+			if (vkCreatePipelineCache(m_device, &pipelineCacheCreateInfo, helper_functions::getHostAllocationCallbacks(), m_pipelineCache.replace()) != VK_SUCCESS)
 			{
-			case VK_QUEUE_COMPUTE_BIT:
-				m_curSubmitQueue = m_device.getComputeQueue();
-				break;
-			default:
-				m_curSubmitQueue = m_device.getGraphicsQueue();
-				break;
+				throw std::runtime_error("failed to create pipeline cache.");
 			}
 		}
 
-		void queueSubmitNewSubmit(const std::vector<uint32_t> &cmdBufferNames,
-			const std::vector<uint32_t> &waitSemaphoreNames = {},
-			const std::vector<VkPipelineStageFlags> &waitStageMasks = {},
-			const std::vector<uint32_t> &signalSemaphoreNames = {})
+		// Drivers should reject foreign cache data themselves but not all of them do.
+		// Check the header against the current device (Vulkan spec, vkGetPipelineCacheData)
+		bool isPipelineCacheDataCompatible(const std::vector<char> &data) const
 		{
-			assert(!cmdBufferNames.empty());
-			assert(waitSemaphoreNames.size() == waitStageMasks.size());
+			struct
+			{
+				uint32_t headerLength;
+				uint32_t headerVersion;
+				uint32_t vendorID;
+				uint32_t deviceID;
+				uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+			} header;
+
+			if (data.size() < sizeof(header)) return false;
+			memcpy(&header, data.data(), sizeof(header));
+
+			VkPhysicalDeviceProperties props;
+			getPhysicalDeviceProperties(&props);
+
+			return header.headerLength >= sizeof(header) &&
+				header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+				header.vendorID == props.vendorID &&
+				header.deviceID == props.deviceID &&
+				memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+		}
 
-			m_curQueueSubmitInfos.push_back({});
-			auto &info = m_curQueueSubmitInfos.back();
+		void createSingleSubmitCommandPool()
+		{
+			createCommandPool(VK_QUEUE_GRAPHICS_BIT, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
 
-			auto &cmdBuffers = info.cmdBuffers;
-			cmdBuffers.reserve(cmdBufferNames.size());
-			for (auto name : cmdBufferNames)
+			if (isTransferQueueDedicated())
 			{
-				cmdBuffers.push_back(m_commandBuffers.at(name));
+				m_transferCommandPoolName = createCommandPool(VK_QUEUE_TRANSFER_BIT, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
 			}
+		}
 
-			info.waitStages.assign(waitStageMasks.begin(), waitStageMasks.end());
-
-			auto &waitSemaphores = info.waitSemaphores;
-			waitSemaphores.reserve(waitSemaphoreNames.size());
-			for (auto name : waitSemaphoreNames)
+		// Sparse binds of @image on the graphics queue, waited for on m_sparseBindFence
+		void queueSparseBinds(const VImage &image, ArrayView<VkSparseMemoryBind> opaqueBinds, ArrayView<VkSparseImageMemoryBind> imageBinds)
+		{
+			if (opaqueBinds.empty() && imageBinds.empty()) return;
+			if (m_sparseBindFence == VK_NULL_HANDLE)
 			{
-				waitSemaphores.push_back(m_semaphores[name]);
+				VkFenceCreateInfo fenceInfo = {};
+				fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+				if (vkCreateFence(m_device, &fenceInfo, helper_functions::getHostAllocationCallbacks(), m_sparseBindFence.replace()) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to create sparse bind fence");
+				}
 			}
 
-			auto &signalSemaphores = info.signalSemaphores;
-			signalSemaphores.reserve(signalSemaphoreNames.size());
-			for (auto name : signalSemaphoreNames)
+			VkSparseImageOpaqueMemoryBindInfo opaqueInfo = { image, static_cast<uint32_t>(opaqueBinds.size()), opaqueBinds.data() };
+			VkSparseImageMemoryBindInfo imageInfo = { image, static_cast<uint32_t>(imageBinds.size()), imageBinds.data() };
+			VkBindSparseInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+			info.imageOpaqueBindCount = opaqueBinds.empty() ? 0 : 1;
+			info.pImageOpaqueBinds = &opaqueInfo;
+			info.imageBindCount = imageBinds.empty() ? 0 : 1;
+			info.pImageBinds = &imageInfo;
+
+			if (vkQueueBindSparse(m_device.getGraphicsQueue(), 1, &info, m_sparseBindFence) != VK_SUCCESS)
 			{
-				signalSemaphores.push_back(m_semaphores[name]);
+				throw std::runtime_error("failed to bind sparse image memory");
 			}
+			VkFence fence = m_sparseBindFence;
+			vkWaitForFences(m_device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+			vkResetFences(m_device, 1, &fence);
 		}
 
-		void endQueueSubmit(uint32_t fenceName = std::numeric_limits<uint32_t>::max(), bool waitForFence = true)
+		void createUploadBatchSyncObjects()
 		{
-			uint32_t numSubmits = static_cast<uint32_t>(m_curQueueSubmitInfos.size());
-			assert(numSubmits > 0);
-			std::vector<VkSubmitInfo> infos(numSubmits, {});
+			VkFenceCreateInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
-			for (uint32_t i = 0; i < numSubmits; ++i)
+			if (vkCreateFence(m_device, &info, helper_functions::getHostAllocationCallbacks(), m_uploadBatch.fence.replace()) != VK_SUCCESS)
 			{
-				const auto &src = m_curQueueSubmitInfos[i];
-				auto &info = infos[i];
-
-				info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-				info.commandBufferCount = static_cast<uint32_t>(src.cmdBuffers.size());
-				info.pCommandBuffers = src.cmdBuffers.data();
-				info.waitSemaphoreCount = static_cast<uint32_t>(src.waitSemaphores.size());
-				info.pWaitSemaphores = src.waitSemaphores.data();
-				info.pWaitDstStageMask = src.waitStages.data();
-				info.signalSemaphoreCount = static_cast<uint32_t>(src.signalSemaphores.size());
-				info.pSignalSemaphores = src.signalSemaphores.data();
+				throw std::runtime_error("failed to create upload batch fence");
 			}
 
-			assert(m_curSubmitQueue);
-			VkFence fence = fenceName == std::numeric_limits<uint32_t>::max() ? VK_NULL_HANDLE : VkFence(m_fences[fenceName]);
-			if (vkQueueSubmit(m_curSubmitQueue, numSubmits, infos.data(), fence) != VK_SUCCESS)
+			if (isTransferQueueDedicated())
 			{
-				throw std::runtime_error("failed to submit");
+				VkSemaphoreCreateInfo semaphoreInfo = {};
+				semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+				if (vkCreateSemaphore(m_device, &semaphoreInfo, helper_functions::getHostAllocationCallbacks(), m_uploadBatch.semaphore.replace()) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to create upload batch semaphore");
+				}
 			}
+		}
 
-			if (fence && waitForFence)
+		VkCommandBuffer beginUploadCommandBuffer(uint32_t poolName)
+		{
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandPool = m_commandPools[poolName];
+			allocInfo.commandBufferCount = 1;
+
+			VkCommandBuffer commandBuffer;
+			if (vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer) != VK_SUCCESS)
 			{
-				vkWaitForFences(m_device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+				throw std::runtime_error("failed to allocate upload batch command buffer");
 			}
 
-			m_curQueueSubmitInfos.clear();
-			m_curSubmitQueue = VK_NULL_HANDLE;
+			VkCommandBufferBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+			vkBeginCommandBuffer(commandBuffer, &beginInfo);
+			return commandBuffer;
 		}
-		// --- Command buffer related ---
 
-		// --- Synchronization objects ---
-		uint32_t createSemaphore(VkSemaphoreCreateFlags flags = 0)
+		void beginUploadBatchCommandBuffer()
 		{
-			uint32_t semaphoreName;
-			if (!m_availableSemaphoreNames.empty())
-			{
-				semaphoreName = m_availableSemaphoreNames.back();
-				m_availableSemaphoreNames.pop_back();
-			}
-			else
+			m_uploadBatch.commandBuffer = beginUploadCommandBuffer(m_transferCommandPoolName);
+		}
+
+		// Release (on the transfer queue) or acquire (on the graphics queue) everything the open batch command buffer wrote
+		void recordUploadBatchOwnershipTransfer(VkCommandBuffer commandBuffer, bool release)
+		{
+			const auto &queueFamilyIndices = m_device.getQueueFamilyIndices();
+			const VkAccessFlags srcAccess = release ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+			const VkAccessFlags dstAccess = release ? 0 : VK_ACCESS_MEMORY_READ_BIT;
+
+			std::vector<VkBufferMemoryBarrier> bufferBarriers;
+			for (VkBuffer buffer : m_uploadBatch.transferredBuffers)
 			{
-				semaphoreName = static_cast<uint32_t>(m_semaphores.size());
-				m_semaphores.emplace_back(m_device, vkDestroySemaphore);
+				VkBufferMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				barrier.srcAccessMask = srcAccess;
+				barrier.dstAccessMask = dstAccess;
+				barrier.srcQueueFamilyIndex = queueFamilyIndices.transferFamily;
+				barrier.dstQueueFamilyIndex = queueFamilyIndices.graphicsFamily;
+				barrier.buffer = buffer;
+				barrier.offset = 0;
+				barrier.size = VK_WHOLE_SIZE;
+				bufferBarriers.push_back(barrier);
 			}
 
-			VkSemaphoreCreateInfo info = {};
-			info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-			info.flags = flags;
-
-			if (vkCreateSemaphore(m_device, &info, nullptr, m_semaphores[semaphoreName].replace()) != VK_SUCCESS)
+			std::vector<VkImageMemoryBarrier> imageBarriers;
+			for (const auto &transferred : m_uploadBatch.transferredImages)
 			{
-				throw std::runtime_error("unable to create semaphore");
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.srcAccessMask = srcAccess;
+				barrier.dstAccessMask = dstAccess;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.srcQueueFamilyIndex = queueFamilyIndices.transferFamily;
+				barrier.dstQueueFamilyIndex = queueFamilyIndices.graphicsFamily;
+				barrier.image = m_images.at(transferred.imageName);
+				barrier.subresourceRange.aspectMask = transferred.aspectMask;
+				barrier.subresourceRange.baseMipLevel = 0;
+				barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+				barrier.subresourceRange.baseArrayLayer = 0;
+				barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+				imageBarriers.push_back(barrier);
 			}
 
-			return semaphoreName;
+			if (bufferBarriers.empty() && imageBarriers.empty()) return;
+
+			vkCmdPipelineBarrier(commandBuffer,
+				release ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+				0, 0, nullptr,
+				static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+				static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
 		}
 
-		uint32_t createFence(VkFenceCreateFlags flags = 0)
+		void submitUploadBatchCommandBuffer()
 		{
-			uint32_t fenceName;
-			if (!m_availableFenceNames.empty())
-			{
-				fenceName = m_availableFenceNames.back();
-				m_availableFenceNames.pop_back();
-			}
-			else
+			const bool dedicatedTransfer = isTransferQueueDedicated();
+			if (dedicatedTransfer)
 			{
-				fenceName = static_cast<uint32_t>(m_fences.size());
-				m_fences.emplace_back(m_device, vkDestroyFence);
+				recordUploadBatchOwnershipTransfer(m_uploadBatch.commandBuffer, true);
 			}
 
-			VkFenceCreateInfo info = {};
-			info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-			info.flags = flags;
+			vkEndCommandBuffer(m_uploadBatch.commandBuffer);
 
-			if (vkCreateFence(m_device, &info, nullptr, m_fences[fenceName].replace()) != VK_SUCCESS)
+			VkFence fence = m_stagingRing.closeSegment();
+			if (fence == VK_NULL_HANDLE)
 			{
-				throw std::runtime_error("failed to create fence");
+				assert(!m_uploadBatch.isFenceInUse);
+				fence = m_uploadBatch.fence;
+				m_uploadBatch.isFenceInUse = true;
 			}
 
-			return fenceName;
-		}
+			VkSubmitInfo submitInfo = {};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &m_uploadBatch.commandBuffer;
 
-		void waitForFences(const std::vector<uint32_t> &fenceNames, VkBool32 waitAll = VK_TRUE,
-			uint64_t timeout = std::numeric_limits<uint64_t>::max())
-		{
-			uint32_t fenceCount = static_cast<uint32_t>(fenceNames.size());
-			std::vector<VkFence> fences;
-			fences.reserve(fenceCount);
-			for (auto name : fenceNames)
+			if (!dedicatedTransfer)
 			{
-				fences.push_back(m_fences.at(name));
+				if (vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, fence) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to submit upload batch");
+				}
+
+				m_uploadBatch.submittedCommandBuffers.push_back(m_uploadBatch.commandBuffer);
+				m_uploadBatch.commandBuffer = VK_NULL_HANDLE;
+				auto &expansionImageViews = m_uploadBatch.expansionImageViews;
+				m_uploadBatch.submittedExpansionImageViews.insert(m_uploadBatch.submittedExpansionImageViews.end(),
+					expansionImageViews.begin(), expansionImageViews.end());
+				expansionImageViews.clear();
+				return;
 			}
 
-			if (vkWaitForFences(m_device, fenceCount, fences.data(), waitAll, timeout) != VK_SUCCESS)
+			// The fence goes on the graphics side, which waits for the copies, so it covers both submits
+			VkCommandBuffer acquireCommandBuffer = beginUploadCommandBuffer(m_singleSubmitCommandPoolName);
+			recordUploadBatchOwnershipTransfer(acquireCommandBuffer, false);
+			for (uint32_t imageName : m_uploadBatch.deferredMipmapGenerations)
 			{
-				throw std::runtime_error("failed to wait for fences");
+				auto &image = m_images.at(imageName);
+				recordGenerateMipmapsCommands(acquireCommandBuffer, image, image.extent().width, image.extent().height,
+					image.levels(), image.layers());
 			}
-		}
+			for (const auto &transition : m_uploadBatch.deferredLayoutTransitions)
+			{
+				auto &image = m_images.at(transition.imageName);
+				recordImageLayoutTransitionCommands(acquireCommandBuffer, image, image.format(), 0, image.levels(),
+					0, image.layers(), transition.oldLayout, transition.newLayout);
+			}
+			vkEndCommandBuffer(acquireCommandBuffer);
 
-		void resetFences(const std::vector<uint32_t> &fenceNames)
-		{
-			uint32_t fenceCount = static_cast<uint32_t>(fenceNames.size());
-			std::vector<VkFence> fences;
-			fences.reserve(fenceCount);
-			for (auto name : fenceNames)
+			VkSemaphore semaphore = m_uploadBatch.semaphore;
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &semaphore;
+
+			if (vkQueueSubmit(m_device.getTransferQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
 			{
-				fences.push_back(m_fences.at(name));
+				throw std::runtime_error("failed to submit upload batch");
 			}
 
-			if (vkResetFences(m_device, fenceCount, fences.data()) != VK_SUCCESS)
+			const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+			VkSubmitInfo acquireSubmitInfo = {};
+			acquireSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			acquireSubmitInfo.waitSemaphoreCount = 1;
+			acquireSubmitInfo.pWaitSemaphores = &semaphore;
+			acquireSubmitInfo.pWaitDstStageMask = &waitStage;
+			acquireSubmitInfo.commandBufferCount = 1;
+			acquireSubmitInfo.pCommandBuffers = &acquireCommandBuffer;
+
+			if (vkQueueSubmit(m_device.getGraphicsQueue(), 1, &acquireSubmitInfo, fence) != VK_SUCCESS)
 			{
-				throw std::runtime_error("failed to reset fences");
+				throw std::runtime_error("failed to submit upload batch ownership acquire");
 			}
-		}
-		// --- Synchronization objects ---
 
-		// --- Window system ---
-		void recreateSwapChain()
-		{
-			m_swapChain.recreateSwapChain();
+			m_uploadBatch.submittedTransferCommandBuffers.push_back(m_uploadBatch.commandBuffer);
+			m_uploadBatch.submittedCommandBuffers.push_back(acquireCommandBuffer);
+			m_uploadBatch.commandBuffer = VK_NULL_HANDLE;
+			m_uploadBatch.transferredBuffers.clear();
+			m_uploadBatch.transferredImages.clear();
+			m_uploadBatch.deferredLayoutTransitions.clear();
+			m_uploadBatch.deferredMipmapGenerations.clear();
 		}
 
-		VkExtent2D getSwapChainExtent() const
+		// Storage buffer of the packed texels at binding 0, the level written as a storage image at binding 1
+		void createTexelExpansionPipeline()
 		{
-			return m_swapChain.extent();
-		}
+			beginCreateDescriptorSetLayout();
+			setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+			setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+			m_uploadBatch.expansionSetLayout = endCreateDescriptorSetLayout();
 
-		VkFormat getSwapChainImageFormat() const
-		{
-			return m_swapChain.format();
-		}
+			beginCreatePipelineLayout();
+			pipelineLayoutAddDescriptorSetLayouts({ m_uploadBatch.expansionSetLayout });
+			pipelineLayoutAddPushConstantRange(0, 4 * sizeof(uint32_t), VK_SHADER_STAGE_COMPUTE_BIT); // byte offset, channel count, extent
+			m_uploadBatch.expansionPipelineLayout = endCreatePipelineLayout();
 
-		std::vector<uint32_t> getSwapChainFramebuffers() const
-		{
-			return m_swapChainFramebufferNames;
-		}
+			beginCreateComputePipeline(m_uploadBatch.expansionPipelineLayout);
+			computePipelineAddShaderStage(TEXEL_EXPAND_SHADER_FILE_NAME);
+			m_uploadBatch.expansionPipeline = endCreateComputePipeline();
 
-		uint32_t getSwapChainSize() const
-		{
-			return m_swapChain.size();
+			beginCreateDescriptorPool(TEXEL_EXPAND_MAX_SETS);
+			descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, TEXEL_EXPAND_MAX_SETS);
+			descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, TEXEL_EXPAND_MAX_SETS);
+			m_uploadBatch.expansionPool = endCreateDescriptorPool();
 		}
 
-		VkResult swapChainNextImageIndex(uint32_t *pIdx, uint32_t signalSemaphoreName, uint32_t waitFenceName,
-			uint64_t timeout = std::numeric_limits<uint64_t>::max())
-		{
-			VkSemaphore semaphore = signalSemaphoreName == std::numeric_limits<uint32_t>::max() ? VK_NULL_HANDLE : VkSemaphore(m_semaphores[signalSemaphoreName]);
-			VkFence fence = waitFenceName == std::numeric_limits<uint32_t>::max() ? VK_NULL_HANDLE : VkFence(m_fences[waitFenceName]);
-
-			return vkAcquireNextImageKHR(m_device, m_swapChain, timeout, semaphore, fence, pIdx);
+		// Every level and layer of @image
+		static void recordTexelExpansionBarrier(VkCommandBuffer commandBuffer, VkImage image, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+			VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages)
+		{
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = dstAccess;
+			barrier.oldLayout = oldLayout;
+			barrier.newLayout = newLayout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			barrier.subresourceRange.baseMipLevel = 0;
+			barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+			vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 		}
 
-		VkResult queuePresent(const std::vector<uint32_t> &waitSemaphoreNames, uint32_t imageIdx)
+		// Cut @count elements from the first free range that holds them. Return false if none does
+		static bool takeFreeRange(std::vector<std::pair<uint32_t, uint32_t>> *pFreeRanges, uint32_t count, uint32_t *pFirst)
 		{
-			VkSwapchainKHR swapChain = m_swapChain;
-			std::vector<VkSemaphore> waitSemaphores;
-			waitSemaphores.reserve(waitSemaphoreNames.size());
-			for (auto name : waitSemaphoreNames)
+			for (auto it = pFreeRanges->begin(); it != pFreeRanges->end(); ++it)
 			{
-				waitSemaphores.push_back(m_semaphores[name]);
-			}
-
-			VkPresentInfoKHR info = {};
-			info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-			info.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphoreNames.size());
-			info.pWaitSemaphores = waitSemaphores.data();
-			info.swapchainCount = 1;
-			info.pSwapchains = &swapChain;
-			info.pImageIndices = &imageIdx;
+				if (it->second < count) continue;
 
-			return vkQueuePresentKHR(m_device.getPresentQueue(), &info);
+				*pFirst = it->first;
+				it->first += count;
+				it->second -= count;
+				if (it->second == 0) pFreeRanges->erase(it);
+				return true;
+			}
+			return false;
 		}
 
-		int windowShouldClose() const
+		// Insert [@first, @first + @count) and merge it with its neighbours
+		static void addFreeRange(std::vector<std::pair<uint32_t, uint32_t>> *pFreeRanges, uint32_t first, uint32_t count)
 		{
-			return glfwWindowShouldClose(m_window.getWindow());
-		}
+			if (count == 0) return;
 
-		void windowPollEvents() const
-		{
-			glfwPollEvents();
+			auto it = std::lower_bound(pFreeRanges->begin(), pFreeRanges->end(), std::make_pair(first, 0u));
+			it = pFreeRanges->insert(it, std::make_pair(first, count));
+			auto next = it + 1;
+			if (next != pFreeRanges->end() && it->first + it->second == next->first)
+			{
+				it->second += next->second;
+				pFreeRanges->erase(next);
+			}
+			if (it != pFreeRanges->begin())
+			{
+				auto prev = it - 1;
+				if (prev->first + prev->second == it->first)
+				{
+					prev->second += it->second;
+					pFreeRanges->erase(it);
+				}
+			}
 		}
 
-		void windowSetTitle(const std::string &title)
+		// Write @indexCount 32 bit @indices to @pDst as @indexType
+		static void copyIndices(void *pDst, VkIndexType indexType, const uint32_t *indices, uint32_t indexCount)
 		{
-			m_window.setWindowTitle(title);
+			if (indexType == VK_INDEX_TYPE_UINT16)
+			{
+				uint16_t *dst = static_cast<uint16_t *>(pDst);
+				for (uint32_t i = 0; i < indexCount; ++i) dst[i] = static_cast<uint16_t>(indices[i]);
+			}
+			else
+			{
+				memcpy(pDst, indices, static_cast<size_t>(indexCount) * sizeof(uint32_t));
+			}
 		}
-		// --- Window system ---
 
-		// --- Device properties ---
-		void getPhysicalDeviceProperties(VkPhysicalDeviceProperties *pProps) const
+		// Let @writeData fill @sizeInBytes of staging memory and return its offset in *@pSrcBuffer
+		VkDeviceSize uploadBatchStage(VkDeviceSize sizeInBytes, const StagingWriter &writeData, VkDeviceSize alignment, VkBuffer *pSrcBuffer)
 		{
-			vkGetPhysicalDeviceProperties(m_device, pProps);
-		}
+			if (!m_stagingRing.canHold(sizeInBytes))
+			{
+				m_uploadBatch.dedicatedStagingBuffers.emplace_back(m_device, &m_memoryAllocator);
+				auto &stagingBuffer = m_uploadBatch.dedicatedStagingBuffers.back();
+				stagingBuffer.init(sizeInBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-		VkFormat chooseSupportedFormatFromCandidates(const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
-		{
-			return findSupportedFormat(m_device, candidates, tiling, features);
-		}
-		// --- Device properties ---
+				void *mapped = stagingBuffer.mapBuffer();
+				writeData(mapped);
+				stagingBuffer.unmapBuffer();
 
-	protected:
-		void createPipelineCache()
-		{
-			VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-			pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-			if (vkCreatePipelineCache(m_device, &pipelineCacheCreateInfo, nullptr, m_pipelineCache.replace()) != VK_SUCCESS)
+				*pSrcBuffer = stagingBuffer;
+				return 0;
+			}
+
+			// The ring can only recycle closed segments, so submit what has been recorded so far
+			// if this batch alone would fill the ring
+			if (m_stagingRing.openSegmentSize() + sizeInBytes + alignment > m_stagingRing.size() / 2)
 			{
-				throw std::runtime_error("failed to create pipeline cache.");
+				submitUploadBatchCommandBuffer();
+				beginUploadBatchCommandBuffer();
 			}
-		}
 
-		void createSingleSubmitCommandPool()
-		{
-			createCommandPool(VK_QUEUE_GRAPHICS_BIT, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+			*pSrcBuffer = m_stagingRing;
+			const VkDeviceSize offset = m_stagingRing.allocate(sizeInBytes, alignment);
+			writeData(m_stagingRing.mappedAt(offset));
+			return offset;
 		}
 
 
@@ -2379,13 +6441,31 @@ namespace rj
 		VWindow m_window;
 		VDevice m_device;
 		VSwapChain m_swapChain;
+		struct RetiredSwapChain
+		{
+			uint64_t frameSerial; // the frame current when it was replaced
+			VSwapChain::Retired resources;
+		};
+		std::deque<RetiredSwapChain> m_retiredSwapChains; // oldest first, destroyed before m_swapChain
+		uint32_t m_nextOffscreenImageIdx = 0; // returned by the next swapChainNextImageIndex() if headless
 		VDeleter<VkPipelineCache> m_pipelineCache{ m_device, vkDestroyPipelineCache };
+		std::unordered_map<std::string, VDeleter<VkShaderModule>> m_shaderModules; // by SPIR-V file name
+		VMemoryAllocator m_memoryAllocator{ m_device }; // must outlive m_buffers and m_images
+		VStagingRing m_stagingRing{ m_device, &m_memoryAllocator };
+		VReadbackRing m_readbackRing{ m_device, &m_memoryAllocator };
+		VExternalImageSink m_externalImageSink{ m_device };
+		UploadBatchInfo m_uploadBatch{ m_device };
+		GeometryPoolInfo m_geometryPool;
 
 		RenderPassCreateInfo m_curRenderPassInfo;
 		uint32_t m_curRenderPassName;
 		SubpassCreateInfo *m_pCurSubpassInfo;
-		std::vector<uint32_t> m_availableRenderPassNames;
+		VNamePool m_renderPassNames;
 		std::vector<VDeleter<VkRenderPass>> m_renderPasses;
+		std::vector<uint64_t> m_renderPassCompatibilityHashes; // by render pass name
+		std::vector<std::string> m_renderPassDebugNames; // by render pass name, only with debug utils
+		std::vector<uint32_t> m_renderPassShadingRateSubpasses; // by render pass name, bit i is set if subpass i has a shading rate attachment
+		std::vector<AttachmentTraffic> m_renderPassTraffic; // by render pass name
 
 		DescriptorSetLayoutCreateInfo m_curSetLayoutInfo;
 		uint32_t m_curSetLayoutName;
@@ -2393,16 +6473,35 @@ namespace rj
 
 		PipelineLayoutCreateInfo m_curPipelineLayoutInfo;
 		uint32_t m_curPipelineLayoutName;
-		std::vector<uint32_t> m_availablePipelineLayoutNames;
+		VNamePool m_pipelineLayoutNames;
 		std::vector<VDeleter<VkPipelineLayout>> m_pipelineLayouts;
+		std::vector<uint64_t> m_pipelineLayoutSerials; // by pipeline layout name, unique over the manager's lifetime
+		uint64_t m_pipelineLayoutSerial = 0;
+
+		struct PendingGraphicsPipeline
+		{
+			uint32_t name;
+			std::unique_ptr<GraphicsPipelineCreateInfo> pInfo;
+		};
 
-		GraphicsPipelineCreateInfo m_curGraphicsPipelineInfo;
+		// Heap allocated so that a pipeline recorded into a batch keeps its create info (and the pointers into it) alive
+		std::unique_ptr<GraphicsPipelineCreateInfo> m_pCurGraphicsPipelineInfo;
+		bool m_recordingGraphicsPipelineBatch = false;
+		std::vector<PendingGraphicsPipeline> m_pendingGraphicsPipelines;
 		ComputePipelineCreateInfo m_curComputePipelineInfo;
 		uint32_t m_curPipelineName;
-		std::vector<uint32_t> m_availablePipelineNames;
+		uint64_t m_curPipelineLayoutSerial = 0;
+		uint64_t m_curPipelineRenderPassHash = 0;
+		VNamePool m_pipelineNames;
 		std::vector<VDeleter<VkPipeline>> m_pipelines;
+		std::vector<uint64_t> m_pipelineStateHashes; // by pipeline name
+		std::vector<uint32_t> m_pipelineRefCounts; // by pipeline name, 0 if available
+		std::unordered_map<uint64_t, uint32_t> m_pipelineRegistry; // state hash to pipeline name
+		uint32_t m_pipelineRegistryHits = 0;
+		uint32_t m_pipelineRegistryMisses = 0;
 
 		const uint32_t m_singleSubmitCommandPoolName = 0;
+		uint32_t m_transferCommandPoolName = 0; // the single submit pool unless the transfer queue is dedicated
 		std::unordered_map<uint32_t, VDeleter<VkCommandPool>> m_commandPools;
 
 		VkCommandBuffer m_singleTimeCommandBuffer;
@@ -2411,43 +6510,124 @@ namespace rj
 		std::vector<uint32_t> m_commandBufferAvaiableNames;
 		std::unordered_map<uint32_t, std::vector<uint32_t>> m_commandBufferTable; // command buffers of each pool
 		std::vector<VkCommandBuffer> m_commandBuffers;
+		// By command buffer name. Only the thread recording a command buffer touches its counters
+		mutable std::vector<CommandCounters> m_commandCounters;
+		// By command buffer name, set for the buffers of command pool sets, which are recorded without g_commandBufferMutex.
+		// Command buffers must not be allocated while those are recorded, that would move the tables above
+		std::vector<bool> m_lockFreeCommandBuffers;
+
+		struct CommandPoolSet
+		{
+			uint32_t threadCount;
+			uint32_t frameCount;
+			uint32_t buffersPerPool;
+			std::vector<uint32_t> pools; // by frame, then thread
+			std::vector<uint32_t> buffers; // @buffersPerPool per pool
+			std::unique_ptr<std::atomic<uint32_t>[]> acquiredCounts; // per pool, since its last reset
+		};
+		std::vector<CommandPoolSet> m_commandPoolSets;
 
-		std::vector<uint32_t> m_availableBufferNames;
-		std::vector<VBuffer> m_buffers;
+		// Buffers, images, image views, samplers and descriptor sets may be created and destroyed from any thread. Their name pools,
+		// the sampler cache, descriptor pools and the retired names are guarded by m_resourceMutex. The tables keep their entries
+		// in place, so an entry is initialized outside of it and read without it
+		mutable std::mutex m_resourceMutex;
 
-		std::vector<uint32_t> m_availableImageNames;
-		std::vector<VImage> m_images;
+		VNamePool m_bufferNames;
+		VStableTable<VBuffer> m_buffers;
 
-		std::vector<uint32_t> m_availableImageViewNames;
-		std::vector<VImageView> m_imageViews;
+		VNamePool m_imageNames;
+		VStableTable<VImage> m_images;
+
+		VNamePool m_imageViewNames;
+		VStableTable<VImageView> m_imageViews;
+		std::vector<ImageViewDescription> m_imageViewDescriptions; // by image view name
+		std::vector<uint32_t> m_imageViewRefCounts; // by image view name, 0 if available
+		std::unordered_map<ImageViewDescription, uint32_t, ImageViewDescriptionHash> m_imageViewCache;
 		
-		std::vector<uint32_t> m_availableSamplerNames;
-		std::vector<VSampler> m_samplers;
+		VNamePool m_samplerNames;
+		VStableTable<VSampler> m_samplers;
+		std::vector<SamplerDescription> m_samplerDescriptions; // by sampler name
+		std::vector<uint32_t> m_samplerRefCounts; // by sampler name, 0 if available
+		std::unordered_map<SamplerDescription, uint32_t, SamplerDescriptionHash> m_samplerCache;
 
 		std::vector<uint32_t> m_swapChainFramebufferNames;
-		std::vector<uint32_t> m_availableFramebufferNames;
+		VNamePool m_framebufferNames;
 		std::vector<VFramebuffer> m_framebuffers;
 
-		std::vector<uint32_t> m_availableQueryPoolNames;
+		VNamePool m_queryPoolNames;
 		std::vector<VQueryPool> m_queryPools;
 
+		struct AccelerationStructureInfo
+		{
+			AccelerationStructureInfo(const VDevice &device, VMemoryAllocator *pAllocator)
+				: buffer(device, pAllocator), handle{ device, device.pfnDestroyAccelerationStructure }, scratchBuffer(device, pAllocator)
+			{}
+
+			VBuffer buffer; // declared before @handle, so the structure is destroyed before its memory
+			VDeleter<VkAccelerationStructureKHR> handle;
+			VkDeviceAddress address = 0;
+			VBuffer scratchBuffer; // only of top level structures
+			uint32_t maxInstanceCount = 0;
+			uint32_t builtInstanceCount = 0; // of the last build, which a refit has to match
+		};
+		VNamePool m_accelerationStructureNames;
+		VStableTable<AccelerationStructureInfo> m_accelerationStructures;
+
 		DescriptorPoolCreateInfo m_curDescriptorPoolInfo;
 		uint32_t m_curDescriptorPoolName;
 		std::unordered_map<uint32_t, VDescriptorPool> m_descriptorPools;
 
 		DescriptorSetUpdateInfo m_curDescriptorSetInfo;
 		uint32_t m_curDescriptorSetName;
-		std::vector<uint32_t> m_availableDescriptorSetNames;
+		uint32_t m_descriptorUpdateBatchDepth = 0;
+		std::vector<DescriptorSetUpdateInfo> m_batchedDescriptorSetInfos; // queued by endUpdateDescriptorSet() in a batch
+
+		struct DescriptorUpdateTemplate
+		{
+			DescriptorUpdateTemplate(const VDevice &device) : handle{ device, device.pfnDestroyDescriptorUpdateTemplate } {}
+
+			VDeleter<VkDescriptorUpdateTemplateKHR> handle;
+			std::vector<VkDescriptorType> types; // of the entries
+		};
+		std::vector<DescriptorUpdateTemplate> m_descriptorUpdateTemplates;
+		VNamePool m_descriptorSetNames;
 		std::unordered_map<uint32_t, std::vector<uint32_t>> m_poolSetTable; // sets from each pool
-		std::vector<VkDescriptorSet> m_descriptorSets;
+		VStableTable<VkDescriptorSet> m_descriptorSets;
+		std::vector<TransientDescriptorAllocator> m_transientDescriptorAllocators;
 
-		std::vector<uint32_t> m_availableSemaphoreNames;
+		VNamePool m_semaphoreNames;
 		std::vector<VDeleter<VkSemaphore>> m_semaphores;
 
-		std::vector<uint32_t> m_availableFenceNames;
+		VNamePool m_fenceNames;
 		std::vector<VDeleter<VkFence>> m_fences;
 
-		std::vector<QueueSubmitInfo> m_curQueueSubmitInfos;
+		struct RetiredName
+		{
+			uint64_t frameSerial; // the frame current when it was retired
+			VNamePool *pPool;
+			uint32_t name;
+		};
+		std::deque<RetiredName> m_retiredNames; // oldest first
+		struct RetiredSparsePage
+		{
+			uint64_t frameSerial; // the frame current when the page was unbound
+			VMemoryAllocation allocation;
+		};
+		std::deque<RetiredSparsePage> m_retiredSparsePages; // oldest first, freed before m_memoryAllocator is destroyed
+		VDeleter<VkFence> m_sparseBindFence{ m_device, vkDestroyFence }; // created with the first sparse bind
+		uint64_t m_frameSerial = 1; // 0 is a frame that completed before the first one
+
+		std::vector<QueueSubmitInfo> m_curQueueSubmitInfos; // the first m_curQueueSubmitCount are in use
+		size_t m_curQueueSubmitCount = 0;
+		std::vector<VkSubmitInfo> m_submitInfoScratch;
+		std::vector<VkTimelineSemaphoreSubmitInfoKHR> m_timelineSubmitInfoScratch;
+		std::vector<VkDeviceGroupSubmitInfo> m_deviceGroupSubmitInfoScratch;
+		std::vector<uint32_t> m_deviceMaskScratch;
+		std::vector<uint32_t> m_deviceIndexScratch;
+		uint32_t m_submitDeviceMask = 1; // set to every device of the group in the constructor
 		VkQueue m_curSubmitQueue;
+		VkQueueFlags m_curSubmitQueueType = VK_QUEUE_GRAPHICS_BIT;
+
+		VCommandCapture *m_pCommandCapture = nullptr; // while a frame is captured
 	};
 }
\ No newline at end of file
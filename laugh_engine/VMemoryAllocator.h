@@ -0,0 +1,675 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include "VDevice.h"
+
+
+namespace rj
+{
+	class VMemoryAllocator;
+
+	// What sub-allocations are used for, to see where device memory goes
+	enum MemoryCategory
+	{
+		MEMORY_CATEGORY_OTHER,
+		MEMORY_CATEGORY_RENDER_TARGETS,	// G-buffers and other attachments or storage images
+		MEMORY_CATEGORY_SHADOW_MAPS,
+		MEMORY_CATEGORY_TEXTURES,
+		MEMORY_CATEGORY_MESHES,
+		MEMORY_CATEGORY_STAGING,
+		MEMORY_CATEGORY_UNIFORMS,
+		MEMORY_CATEGORY_COUNT
+	};
+
+	inline const char *getMemoryCategoryName(MemoryCategory category)
+	{
+		static const char *names[MEMORY_CATEGORY_COUNT] = { "other", "render targets", "shadow maps", "textures", "meshes", "staging", "uniforms" };
+		return names[category];
+	}
+
+	// Images are render targets if they can be rendered or written to, textures if they are only sampled
+	inline MemoryCategory getImageMemoryCategory(VkImageUsageFlags usage)
+	{
+		if (usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT))
+		{
+			return MEMORY_CATEGORY_RENDER_TARGETS;
+		}
+		if (usage & VK_IMAGE_USAGE_SAMPLED_BIT) return MEMORY_CATEGORY_TEXTURES;
+		return MEMORY_CATEGORY_OTHER;
+	}
+
+	inline MemoryCategory getBufferMemoryCategory(VkBufferUsageFlags usage)
+	{
+		if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) return MEMORY_CATEGORY_UNIFORMS;
+		if (usage & (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT)) return MEMORY_CATEGORY_MESHES;
+		if (!(usage & ~(VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT))) return MEMORY_CATEGORY_STAGING;
+		return MEMORY_CATEGORY_OTHER;
+	}
+
+	// Usage of a memory heap against its budget
+	struct MemoryHeapBudget
+	{
+		uint32_t heapIndex = 0;
+		bool isDeviceLocal = false;
+		bool isReportedByDriver = false; // VK_EXT_memory_budget, otherwise the budget is the heap size and the usage that of the allocator
+		VkDeviceSize heapSize = 0;
+		VkDeviceSize budget = 0;
+		VkDeviceSize usage = 0; // of the whole process, including memory not allocated through the allocator
+		VkDeviceSize reservedBytes = 0; // blocks of the allocator
+		VkDeviceSize categoryBytes[MEMORY_CATEGORY_COUNT] = {}; // sub-allocations of the allocator
+
+		bool isOverBudget() const { return usage > budget; }
+	};
+
+	struct MemoryPoolStats
+	{
+		uint32_t memoryTypeIndex = 0;
+		uint32_t blockCount = 0;
+		uint32_t dedicatedBlockCount = 0;
+		uint32_t allocationCount = 0;
+		uint32_t freeRangeCount = 0;
+		VkDeviceSize reservedBytes = 0; // sum of all vkAllocateMemory sizes
+		VkDeviceSize usedBytes = 0;	// sum of sub-allocation sizes including alignment padding
+		VkDeviceSize largestFreeRange = 0;
+
+		// 0 means all free space is contiguous, approaching 1 means free space is scattered into small ranges
+		float fragmentation() const
+		{
+			VkDeviceSize freeBytes = reservedBytes - usedBytes;
+			if (freeBytes == 0) return 0.f;
+			return 1.f - static_cast<float>(largestFreeRange) / static_cast<float>(freeBytes);
+		}
+	};
+
+	namespace helper_functions
+	{
+		struct MemoryChunk
+		{
+			VkDeviceSize size;
+			bool isFree;
+			bool isLinear; // buffers and linear tiling images are linear resources
+			MemoryCategory category; // of the allocation in it, MEMORY_CATEGORY_OTHER where the initializers leave it out
+		};
+
+		struct MemoryBlock
+		{
+			VDeleter<VkDeviceMemory> memory;
+			VkDeviceSize size;
+			void *pMapped = nullptr; // host visible blocks are persistently mapped
+			bool isDedicated = false;
+			bool isDefragmentationSkipped = false; // was a defragmentation source that could not be emptied
+			uint32_t allocationCount = 0;
+			VkDeviceSize usedBytes = 0;
+			std::map<VkDeviceSize, MemoryChunk> chunks; // offset -> chunk, chunks cover the whole block
+
+			MemoryBlock(const VDeleter<VkDevice> &device)
+				: memory{ device, vkFreeMemory }
+			{}
+		};
+
+		inline VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+		{
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+	}
+
+	// Handle to a sub-allocated range of a VkDeviceMemory block. Memory is
+	// returned to its pool on destruction. Has the same copy-steals semantics
+	// as VDeleter<T> so owners can live inside STL containers.
+	class VMemoryAllocation
+	{
+	public:
+		VMemoryAllocation() {}
+
+		VMemoryAllocation(const VMemoryAllocation &other)
+		{
+			steal(const_cast<VMemoryAllocation &>(other));
+		}
+
+		VMemoryAllocation &operator=(const VMemoryAllocation &other)
+		{
+			if (this != &other)
+			{
+				release();
+				steal(const_cast<VMemoryAllocation &>(other));
+			}
+			return *this;
+		}
+
+		virtual ~VMemoryAllocation()
+		{
+			release();
+		}
+
+		inline void release();
+
+		bool isvalid() const { return m_pBlock != nullptr; }
+		VkDeviceMemory memory() const { assert(m_pBlock); return m_pBlock->memory; }
+		VkDeviceSize offset() const { return m_offset; }
+		VkDeviceSize size() const { return m_size; }
+		uint32_t memoryTypeIndex() const { return m_memoryTypeIndex; }
+		MemoryCategory category() const { return m_category; }
+
+		// nullptr if memory is not host visible
+		void *mapped() const
+		{
+			assert(m_pBlock);
+			return m_pBlock->pMapped ? static_cast<char *>(m_pBlock->pMapped) + m_offset : nullptr;
+		}
+
+	private:
+		friend class VMemoryAllocator;
+
+		VMemoryAllocator *m_pAllocator = nullptr;
+		MemoryBlock *m_pBlock = nullptr;
+		uint32_t m_memoryTypeIndex = 0;
+		MemoryCategory m_category = MEMORY_CATEGORY_OTHER;
+		VkDeviceSize m_offset = 0;
+		VkDeviceSize m_size = 0;
+
+		void steal(VMemoryAllocation &other)
+		{
+			m_pAllocator = other.m_pAllocator;
+			m_pBlock = other.m_pBlock;
+			m_memoryTypeIndex = other.m_memoryTypeIndex;
+			m_category = other.m_category;
+			m_offset = other.m_offset;
+			m_size = other.m_size;
+			other.m_pAllocator = nullptr;
+			other.m_pBlock = nullptr;
+		}
+	};
+
+	// Keeps one pool of large VkDeviceMemory blocks per memory type and hands out
+	// sub-ranges of them, so that the number of vkAllocateMemory calls stays far
+	// below maxMemoryAllocationCount.
+	// Sub-allocations are accounted by category and heap. Whenever a new block goes over
+	// the budget of its heap the budget callback is called, e.g. to let texture streaming drop mips.
+	class VMemoryAllocator
+	{
+	public:
+		static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+		// Called without the allocator lock held, so it may free memory
+		using BudgetCallback = std::function<void(const MemoryHeapBudget &heapBudget)>;
+
+		VMemoryAllocator(const VDevice &device)
+			: m_device(device)
+		{
+			vkGetPhysicalDeviceMemoryProperties(m_device, &m_memoryProperties);
+
+			VkPhysicalDeviceProperties props;
+			vkGetPhysicalDeviceProperties(m_device, &props);
+			m_bufferImageGranularity = std::max(props.limits.bufferImageGranularity, VkDeviceSize(1));
+
+			m_pools.resize(m_memoryProperties.memoryTypeCount);
+		}
+
+		void allocate(VMemoryAllocation *pAllocation, const VkMemoryRequirements &requirements,
+			VkMemoryPropertyFlags properties, bool isLinearResource, MemoryCategory category = MEMORY_CATEGORY_OTHER)
+		{
+			assert(pAllocation);
+			assert(requirements.size > 0);
+
+			pAllocation->release();
+
+			uint32_t memoryTypeIndex = findMemoryTypeIndex(requirements.memoryTypeBits, properties);
+			bool createdBlock;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				createdBlock = allocateLocked(pAllocation, requirements, properties, memoryTypeIndex, isLinearResource);
+				pAllocation->m_category = category;
+				pAllocation->m_pBlock->chunks.at(pAllocation->m_offset).category = category;
+				m_categoryBytes[category][heapIndexOf(memoryTypeIndex)] += pAllocation->m_size;
+			}
+
+			// The budget only changes noticeably when blocks are allocated
+			if (createdBlock && m_budgetCallback)
+			{
+				MemoryHeapBudget heapBudget = getHeapBudget(heapIndexOf(memoryTypeIndex));
+				if (heapBudget.isOverBudget()) m_budgetCallback(heapBudget);
+			}
+		}
+
+		// Move @allocation to another category, e.g. to single out shadow maps from other render targets
+		void setCategory(VMemoryAllocation *pAllocation, MemoryCategory category)
+		{
+			if (!pAllocation->isvalid()) return;
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const uint32_t heapIndex = heapIndexOf(pAllocation->m_memoryTypeIndex);
+			m_categoryBytes[pAllocation->m_category][heapIndex] -= pAllocation->m_size;
+			m_categoryBytes[category][heapIndex] += pAllocation->m_size;
+			pAllocation->m_category = category;
+			pAllocation->m_pBlock->chunks.at(pAllocation->m_offset).category = category;
+		}
+
+		void setBudgetCallback(const BudgetCallback &callback) { m_budgetCallback = callback; }
+
+		// Usage against budget of @heapIndex. The driver's numbers if VK_EXT_memory_budget is enabled
+		MemoryHeapBudget getHeapBudget(uint32_t heapIndex) const
+		{
+			assert(heapIndex < m_memoryProperties.memoryHeapCount);
+
+			MemoryHeapBudget heapBudget;
+			heapBudget.heapIndex = heapIndex;
+			heapBudget.isDeviceLocal = (m_memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+			heapBudget.heapSize = m_memoryProperties.memoryHeaps[heapIndex].size;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				heapBudget.reservedBytes = m_heapReservedBytes[heapIndex];
+				for (uint32_t c = 0; c < MEMORY_CATEGORY_COUNT; ++c)
+				{
+					heapBudget.categoryBytes[c] = m_categoryBytes[c][heapIndex];
+				}
+			}
+
+			VkPhysicalDeviceMemoryBudgetPropertiesEXT driverBudget;
+			heapBudget.isReportedByDriver = m_device.getMemoryBudget(&driverBudget);
+			if (heapBudget.isReportedByDriver)
+			{
+				heapBudget.budget = driverBudget.heapBudget[heapIndex];
+				heapBudget.usage = driverBudget.heapUsage[heapIndex];
+			}
+			else
+			{
+				heapBudget.budget = heapBudget.heapSize;
+				heapBudget.usage = heapBudget.reservedBytes;
+			}
+			return heapBudget;
+		}
+
+		std::vector<MemoryHeapBudget> getHeapBudgets() const
+		{
+			std::vector<MemoryHeapBudget> result;
+			for (uint32_t i = 0; i < m_memoryProperties.memoryHeapCount; ++i)
+			{
+				result.push_back(getHeapBudget(i));
+			}
+			return result;
+		}
+
+		// Return true if one of the memory types in @typeBits has all of @properties
+		bool hasMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const
+		{
+			for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; ++i)
+			{
+				if ((typeBits & (1 << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		MemoryPoolStats getPoolStats(uint32_t memoryTypeIndex) const
+		{
+			assert(memoryTypeIndex < m_pools.size());
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			MemoryPoolStats stats;
+			stats.memoryTypeIndex = memoryTypeIndex;
+
+			for (const auto &pBlock : m_pools[memoryTypeIndex])
+			{
+				++stats.blockCount;
+				if (pBlock->isDedicated) ++stats.dedicatedBlockCount;
+				stats.allocationCount += pBlock->allocationCount;
+				stats.reservedBytes += pBlock->size;
+				stats.usedBytes += pBlock->usedBytes;
+
+				for (const auto &offsetChunkPair : pBlock->chunks)
+				{
+					const auto &chunk = offsetChunkPair.second;
+					if (!chunk.isFree) continue;
+
+					++stats.freeRangeCount;
+					stats.largestFreeRange = std::max(stats.largestFreeRange, chunk.size);
+				}
+			}
+
+			return stats;
+		}
+
+		// Stats of all memory types that have at least one block
+		std::vector<MemoryPoolStats> getAllPoolStats() const
+		{
+			std::vector<MemoryPoolStats> result;
+			for (uint32_t i = 0; i < static_cast<uint32_t>(m_pools.size()); ++i)
+			{
+				auto stats = getPoolStats(i);
+				if (stats.blockCount > 0) result.push_back(stats);
+			}
+			return result;
+		}
+
+		VkDeviceSize bufferImageGranularity() const { return m_bufferImageGranularity; }
+
+		// --- Defragmentation ---
+		// A shared block that is little used is emptied by its owners moving what it holds into new allocations, which never
+		// go into it, and freeing the old ones. It is then released like any other empty block.
+		// Pick as the source the least used shared block below @maxUsedFraction whose allocations are all of the categories
+		// in @categoryMask, of a memory type whose other shared blocks have room for them. False if there is none
+		bool beginDefragmentation(uint32_t categoryMask, float maxUsedFraction)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_pDefragmentationSource) return true;
+
+			float bestUsedFraction = maxUsedFraction;
+			for (const auto &pool : m_pools)
+			{
+				VkDeviceSize freeBytes = 0;
+				for (const auto &pBlock : pool)
+				{
+					if (!pBlock->isDedicated) freeBytes += pBlock->size - pBlock->usedBytes;
+				}
+
+				for (const auto &pBlock : pool)
+				{
+					if (pBlock->isDedicated || pBlock->isDefragmentationSkipped || pBlock->allocationCount == 0) continue;
+
+					const float usedFraction = static_cast<float>(pBlock->usedBytes) / static_cast<float>(pBlock->size);
+					const VkDeviceSize otherFreeBytes = freeBytes - (pBlock->size - pBlock->usedBytes);
+					if (usedFraction >= bestUsedFraction || otherFreeBytes < pBlock->usedBytes) continue;
+
+					const bool isMovable = std::all_of(pBlock->chunks.begin(), pBlock->chunks.end(),
+						[categoryMask](const std::pair<const VkDeviceSize, MemoryChunk> &offsetChunkPair)
+					{
+						return offsetChunkPair.second.isFree || (categoryMask & (1u << offsetChunkPair.second.category));
+					});
+					if (!isMovable) continue;
+
+					m_pDefragmentationSource = pBlock.get();
+					bestUsedFraction = usedFraction;
+				}
+			}
+			return m_pDefragmentationSource != nullptr;
+		}
+
+		// The owners have nothing more to move out of the source. If it is still in use, it is not picked again
+		void endDefragmentation()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_pDefragmentationSource) m_pDefragmentationSource->isDefragmentationSkipped = true;
+			m_pDefragmentationSource = nullptr;
+		}
+
+		// False once the source has been released
+		bool isDefragmenting() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_pDefragmentationSource != nullptr;
+		}
+
+		bool isInDefragmentationSource(const VMemoryAllocation &allocation) const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_pDefragmentationSource && allocation.m_pBlock == m_pDefragmentationSource;
+		}
+		// --- Defragmentation ---
+
+	private:
+		friend class VMemoryAllocation;
+
+		const VDevice &m_device;
+		VkPhysicalDeviceMemoryProperties m_memoryProperties;
+		VkDeviceSize m_bufferImageGranularity;
+
+		mutable std::mutex m_mutex;
+		std::vector<std::vector<std::unique_ptr<MemoryBlock>>> m_pools; // one pool per memory type
+		VkDeviceSize m_heapReservedBytes[VK_MAX_MEMORY_HEAPS] = {};
+		VkDeviceSize m_categoryBytes[MEMORY_CATEGORY_COUNT][VK_MAX_MEMORY_HEAPS] = {};
+		BudgetCallback m_budgetCallback;
+		MemoryBlock *m_pDefragmentationSource = nullptr; // gets no new allocations
+
+		uint32_t heapIndexOf(uint32_t memoryTypeIndex) const
+		{
+			return m_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+		}
+
+		// Memory of multi-instance heaps is allocated once per device of a group and cannot be mapped, so mapped memory
+		// comes from a heap all devices share where there is one
+		uint32_t findMemoryTypeIndex(uint32_t typeBits, VkMemoryPropertyFlags properties) const
+		{
+			if (m_device.getDeviceCount() > 1 && (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+			{
+				for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; ++i)
+				{
+					if ((typeBits & (1u << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties &&
+						!(m_memoryProperties.memoryHeaps[heapIndexOf(i)].flags & VK_MEMORY_HEAP_MULTI_INSTANCE_BIT))
+					{
+						return i;
+					}
+				}
+			}
+			return findMemoryType(m_device, typeBits, properties);
+		}
+
+		// Return true if a new block was created
+		bool allocateLocked(VMemoryAllocation *pAllocation, const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+			uint32_t memoryTypeIndex, bool isLinearResource)
+		{
+			VkDeviceSize alignment = std::max(requirements.alignment, VkDeviceSize(1));
+			VkDeviceSize blockSize = preferredBlockSize(memoryTypeIndex);
+
+			auto &pool = m_pools[memoryTypeIndex];
+
+			// Large resources get their own block so that they don't waste the tail of a shared one.
+			// Lazily allocated memory is only committed when a render pass needs it, which is tracked per block
+			if (requirements.size > blockSize / 2 || (properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+			{
+				MemoryBlock *pBlock = createBlock(memoryTypeIndex, requirements.size, true);
+				pBlock->chunks.emplace(0, MemoryChunk{ requirements.size, false, isLinearResource });
+				pBlock->usedBytes = requirements.size;
+				pBlock->allocationCount = 1;
+				fillAllocation(pAllocation, pBlock, memoryTypeIndex, 0, requirements.size);
+				return true;
+			}
+
+			for (auto &pBlock : pool)
+			{
+				if (pBlock->isDedicated || pBlock.get() == m_pDefragmentationSource) continue;
+
+				VkDeviceSize offset;
+				if (tryAllocateFromBlock(pBlock.get(), requirements.size, alignment, isLinearResource, &offset))
+				{
+					fillAllocation(pAllocation, pBlock.get(), memoryTypeIndex, offset, requirements.size);
+					return false;
+				}
+			}
+
+			MemoryBlock *pBlock = createBlock(memoryTypeIndex, blockSize, false);
+			pBlock->chunks.emplace(0, MemoryChunk{ blockSize, true, false });
+
+			VkDeviceSize offset;
+			if (!tryAllocateFromBlock(pBlock, requirements.size, alignment, isLinearResource, &offset))
+			{
+				throw std::runtime_error("VMemoryAllocator: allocation doesn't fit in a new block");
+			}
+			fillAllocation(pAllocation, pBlock, memoryTypeIndex, offset, requirements.size);
+			return true;
+		}
+
+		VkDeviceSize preferredBlockSize(uint32_t memoryTypeIndex) const
+		{
+			uint32_t heapIndex = m_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+			VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[heapIndex].size;
+
+			// Small heaps (e.g. 256MB host visible device local heap) shouldn't be eaten up by a few blocks
+			return std::min(DEFAULT_BLOCK_SIZE, alignUp(heapSize / 8, 1024));
+		}
+
+		MemoryBlock *createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool isDedicated)
+		{
+			std::unique_ptr<MemoryBlock> pBlock(new MemoryBlock{ m_device });
+			pBlock->size = size;
+			pBlock->isDedicated = isDedicated;
+
+			VkMemoryAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			allocInfo.allocationSize = size;
+			allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+			// Any buffer may be an acceleration structure build input, so every block can give out device addresses
+			VkMemoryAllocateFlagsInfoKHR allocFlagsInfo = {};
+			allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
+			allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+			if (m_device.isRayQueryEnabled()) allocInfo.pNext = &allocFlagsInfo;
+
+			if (vkAllocateMemory(m_device, &allocInfo, helper_functions::getHostAllocationCallbacks(), pBlock->memory.replace()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("VMemoryAllocator: failed to allocate device memory block");
+			}
+
+			if (m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+			{
+				if (vkMapMemory(m_device, pBlock->memory, 0, VK_WHOLE_SIZE, 0, &pBlock->pMapped) != VK_SUCCESS)
+				{
+					throw std::runtime_error("VMemoryAllocator: failed to map device memory block");
+				}
+			}
+
+			m_heapReservedBytes[heapIndexOf(memoryTypeIndex)] += size;
+
+			auto &pool = m_pools[memoryTypeIndex];
+			pool.push_back(std::move(pBlock));
+			return pool.back().get();
+		}
+
+		// Linear and non-linear resources must not share a page of size bufferImageGranularity
+		bool onSamePage(VkDeviceSize lastByteOfA, VkDeviceSize firstByteOfB) const
+		{
+			VkDeviceSize pageMask = ~(m_bufferImageGranularity - 1);
+			return (lastByteOfA & pageMask) == (firstByteOfB & pageMask);
+		}
+
+		// First fit over the free chunks of @pBlock
+		bool tryAllocateFromBlock(MemoryBlock *pBlock, VkDeviceSize size, VkDeviceSize alignment,
+			bool isLinearResource, VkDeviceSize *pOffset)
+		{
+			auto &chunks = pBlock->chunks;
+
+			for (auto it = chunks.begin(); it != chunks.end(); ++it)
+			{
+				if (!it->second.isFree || it->second.size < size) continue;
+
+				const VkDeviceSize chunkBegin = it->first;
+				const VkDeviceSize chunkEnd = chunkBegin + it->second.size;
+				VkDeviceSize start = alignUp(chunkBegin, alignment);
+
+				// Free chunks are always merged, so neighbours of a free chunk are in use
+				if (it != chunks.begin())
+				{
+					auto prev = std::prev(it);
+					if (prev->second.isLinear != isLinearResource &&
+						onSamePage(prev->first + prev->second.size - 1, start))
+					{
+						start = alignUp(start, m_bufferImageGranularity);
+					}
+				}
+
+				if (start + size > chunkEnd) continue;
+
+				auto next = std::next(it);
+				if (next != chunks.end() && next->second.isLinear != isLinearResource &&
+					onSamePage(start + size - 1, next->first))
+				{
+					continue;
+				}
+
+				chunks.erase(it);
+				if (start > chunkBegin)
+				{
+					chunks.emplace(chunkBegin, MemoryChunk{ start - chunkBegin, true, false });
+				}
+				chunks.emplace(start, MemoryChunk{ size, false, isLinearResource });
+				if (start + size < chunkEnd)
+				{
+					chunks.emplace(start + size, MemoryChunk{ chunkEnd - start - size, true, false });
+				}
+
+				pBlock->usedBytes += size;
+				++pBlock->allocationCount;
+				*pOffset = start;
+				return true;
+			}
+
+			return false;
+		}
+
+		void fillAllocation(VMemoryAllocation *pAllocation, MemoryBlock *pBlock, uint32_t memoryTypeIndex,
+			VkDeviceSize offset, VkDeviceSize size)
+		{
+			pAllocation->m_pAllocator = this;
+			pAllocation->m_pBlock = pBlock;
+			pAllocation->m_memoryTypeIndex = memoryTypeIndex;
+			pAllocation->m_offset = offset;
+			pAllocation->m_size = size;
+		}
+
+		void free(const VMemoryAllocation &allocation)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			MemoryBlock *pBlock = allocation.m_pBlock;
+			auto &pool = m_pools[allocation.m_memoryTypeIndex];
+
+			auto &chunks = pBlock->chunks;
+			auto it = chunks.find(allocation.m_offset);
+			assert(it != chunks.end() && !it->second.isFree);
+
+			it->second.isFree = true;
+			pBlock->usedBytes -= it->second.size;
+			--pBlock->allocationCount;
+			m_categoryBytes[allocation.m_category][heapIndexOf(allocation.m_memoryTypeIndex)] -= allocation.m_size;
+
+			// Merge with neighbouring free chunks
+			auto next = std::next(it);
+			if (next != chunks.end() && next->second.isFree)
+			{
+				it->second.size += next->second.size;
+				chunks.erase(next);
+			}
+			if (it != chunks.begin())
+			{
+				auto prev = std::prev(it);
+				if (prev->second.isFree)
+				{
+					prev->second.size += it->second.size;
+					chunks.erase(it);
+				}
+			}
+
+			// Dedicated blocks are released right away. Shared blocks are released once empty
+			// as long as another shared block of this memory type is still around.
+			if (pBlock->allocationCount == 0)
+			{
+				bool shouldRelease = pBlock->isDedicated ||
+					std::count_if(pool.begin(), pool.end(),
+						[](const std::unique_ptr<MemoryBlock> &p) { return !p->isDedicated; }) > 1;
+
+				if (shouldRelease)
+				{
+					if (pBlock == m_pDefragmentationSource) m_pDefragmentationSource = nullptr;
+					m_heapReservedBytes[heapIndexOf(allocation.m_memoryTypeIndex)] -= pBlock->size;
+					pool.erase(std::find_if(pool.begin(), pool.end(),
+						[pBlock](const std::unique_ptr<MemoryBlock> &p) { return p.get() == pBlock; }));
+				}
+			}
+		}
+	};
+
+	inline void VMemoryAllocation::release()
+	{
+		if (m_pBlock)
+		{
+			m_pAllocator->free(*this);
+		}
+		m_pAllocator = nullptr;
+		m_pBlock = nullptr;
+	}
+}
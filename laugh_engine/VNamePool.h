@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+
+namespace rj
+{
+	// Names of the entries of one of VManager's resource tables. Released names go on a free list and are handed out again
+	// first, so the tables stay dense. Every name also counts how often it was released: a name kept together with the
+	// generation it had when created tells in O(1) whether it still refers to the same resource or was reused since.
+	// A name may be retired first, which ends its generation but keeps it off the free list until reclaim()
+	class VNamePool
+	{
+	public:
+		// When the name equals the size before the call, the caller appends a new entry to its table
+		uint32_t allocate()
+		{
+			uint32_t name;
+			if (!m_freeNames.empty())
+			{
+				name = m_freeNames.back();
+				m_freeNames.pop_back();
+			}
+			else
+			{
+				name = static_cast<uint32_t>(m_slots.size());
+				m_slots.emplace_back();
+			}
+			m_slots[name].alive = true;
+			return name;
+		}
+
+		void release(uint32_t name)
+		{
+			retire(name);
+			reclaim(name);
+		}
+
+		// The resource is destroyed but the GPU may still use it, so the name must not be handed out yet
+		void retire(uint32_t name)
+		{
+			assert(isAlive(name));
+			m_slots[name].alive = false;
+			m_slots[name].retired = true;
+			++m_slots[name].generation;
+			++m_retiredCount;
+		}
+
+		void reclaim(uint32_t name)
+		{
+			assert(name < m_slots.size() && m_slots[name].retired);
+			m_slots[name].retired = false;
+			--m_retiredCount;
+			m_freeNames.push_back(name);
+		}
+
+		bool isAlive(uint32_t name) const { return name < m_slots.size() && m_slots[name].alive; }
+		uint32_t getGeneration(uint32_t name) const { return m_slots.at(name).generation; }
+		// @name is alive and was not released since @generation was taken
+		bool isCurrent(uint32_t name, uint32_t generation) const { return isAlive(name) && m_slots[name].generation == generation; }
+
+		uint32_t size() const { return static_cast<uint32_t>(m_slots.size()); }
+		uint32_t getAliveCount() const { return static_cast<uint32_t>(m_slots.size() - m_freeNames.size()) - m_retiredCount; }
+		uint32_t getRetiredCount() const { return m_retiredCount; }
+
+	protected:
+		struct Slot
+		{
+			uint32_t generation = 0;
+			bool alive = false;
+			bool retired = false;
+		};
+
+		std::vector<Slot> m_slots;
+		std::vector<uint32_t> m_freeNames;
+		uint32_t m_retiredCount = 0;
+	};
+}
@@ -24,7 +24,7 @@ namespace rj
 			info.queryCount = queryCount;
 			info.pipelineStatistics = pipelineStatistics;
 
-			if (vkCreateQueryPool(*m_pDevice, &info, nullptr, m_queryPool.replace()) != VK_SUCCESS)
+			if (vkCreateQueryPool(*m_pDevice, &info, helper_functions::getHostAllocationCallbacks(), m_queryPool.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("Error: failed to create query pool");
 			}
@@ -19,6 +19,7 @@ namespace rj
 		int presentFamily = -1;
 		int computeFamily = -1;
 		int transferFamily = -1;
+		bool graphicsFamilySparseBinding = false; // whether vkQueueBindSparse may be called on the graphics queue
 
 		VQueueFamilyIndices(
 			VkPhysicalDevice physicalDevice,
@@ -53,6 +54,7 @@ namespace rj
 					if (queueFamily.queueCount > 0 && graphicsFamily < 0 && (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT))
 					{
 						graphicsFamily = i;
+						graphicsFamilySparseBinding = (queueFamily.queueFlags & VK_QUEUE_SPARSE_BINDING_BIT) != 0;
 						break;
 					}
 				}
@@ -61,8 +63,9 @@ namespace rj
 				{
 					const auto &queueFamily = queueFamilies[i];
 
-					VkBool32 presentSupport = false;
-					vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+					// Headless rendering never presents, the graphics queue stands in for the present queue
+					VkBool32 presentSupport = surface == VK_NULL_HANDLE ? i == graphicsFamily : false;
+					if (surface != VK_NULL_HANDLE) vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
 					if (queueFamily.queueCount > 0 && presentFamily < 0 && presentSupport)
 					{
 						presentFamily = i;
@@ -73,6 +76,22 @@ namespace rj
 
 			if (dedicatedCompute)
 			{
+				// A family without graphics support usually maps to the async compute engine, prefer it
+				// over other families that happen to differ from the graphics one
+				for (int i = 0; i < queueFamilies.size(); ++i)
+				{
+					const auto &queueFamily = queueFamilies[i];
+
+					if (queueFamily.queueCount > 0 &&
+						computeFamily < 0 &&
+						!(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+						(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
+					{
+						computeFamily = i;
+						break;
+					}
+				}
+
 				for (int i = 0; i < queueFamilies.size(); ++i)
 				{
 					const auto &queueFamily = queueFamilies[i];
@@ -80,7 +99,7 @@ namespace rj
 					if (queueFamily.queueCount > 0 &&
 						computeFamily < 0 &&
 						i != graphicsFamily && i != presentFamily &&
-						(queueFamily.queueCount & VK_QUEUE_COMPUTE_BIT))
+						(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
 					{
 						computeFamily = i;
 						break;
@@ -101,6 +120,21 @@ namespace rj
 
 			if (dedicatedTransfer)
 			{
+				// A transfer-only family usually maps to a DMA engine, which copies without taking time from the other queues
+				for (int i = 0; i < queueFamilies.size(); ++i)
+				{
+					const auto &queueFamily = queueFamilies[i];
+
+					if (queueFamily.queueCount > 0 &&
+						transferFamily < 0 &&
+						!(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+						(queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT))
+					{
+						transferFamily = i;
+						break;
+					}
+				}
+
 				for (int i = 0; i < queueFamilies.size(); ++i)
 				{
 					const auto &queueFamily = queueFamilies[i];
@@ -108,7 +142,7 @@ namespace rj
 					if (queueFamily.queueCount > 0 &&
 						transferFamily < 0 &&
 						i != graphicsFamily && i != presentFamily && i != computeFamily &&
-						(queueFamily.queueCount & VK_QUEUE_TRANSFER_BIT))
+						(queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT))
 					{
 						transferFamily = i;
 						break;
@@ -148,6 +182,7 @@ namespace rj
 			presentFamily = -1;
 			computeFamily = -1;
 			transferFamily = -1;
+			graphicsFamilySparseBinding = false;
 		}
 
 		void setPhysicalDevice(VkPhysicalDevice pd)
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <functional>
+#include "VBuffer.h"
+
+
+namespace rj
+{
+	// Host cached buffers that images are copied into at the end of a frame. Each readback takes a whole buffer and is handed
+	// to its callback once the frame it was recorded in has completed, so reading frames back never waits for the GPU.
+	// When every buffer is in flight the readback is dropped instead, so keep more buffers than frames in flight
+	class VReadbackRing
+	{
+	public:
+		typedef std::function<void(const char *data, VkDeviceSize sizeInBytes)> Callback;
+
+		VReadbackRing(const VDevice &device, VMemoryAllocator *pAllocator)
+			:
+			m_device(device),
+			m_pAllocator(pAllocator)
+		{}
+
+		// @bufferSize is the largest readback. No readback may be in flight, e.g. after the device has been waited on
+		void init(uint32_t bufferCount, VkDeviceSize bufferSize)
+		{
+			assert(m_inFlight.empty());
+
+			// The CPU reads every byte, which is slow from write combined memory. Coherent memory without caching is the fallback
+			VkMemoryPropertyFlags memProps = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			if (m_pAllocator->hasMemoryType(~0u, memProps | VK_MEMORY_PROPERTY_HOST_CACHED_BIT))
+			{
+				memProps |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+			}
+
+			m_freeBuffers.clear();
+			m_buffers.clear();
+			for (uint32_t i = 0; i < bufferCount; ++i)
+			{
+				m_buffers.emplace_back(new VBuffer(m_device, m_pAllocator));
+				m_buffers.back()->init(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, memProps);
+				m_freeBuffers.push_back(i);
+			}
+			m_bufferSize = bufferSize;
+		}
+
+		// Record the copy of @region of @image, which is in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, into a free buffer. @cb must be
+		// submitted as part of frame @frameSerial. Return false if every buffer is in flight, the readback is dropped then
+		bool cmdCopyImage(VkCommandBuffer cb, VkImage image, const VkBufferImageCopy &region, VkDeviceSize sizeInBytes,
+			uint64_t frameSerial, const Callback &callback)
+		{
+			assert(sizeInBytes <= m_bufferSize);
+			assert(m_inFlight.empty() || m_inFlight.back().frameSerial <= frameSerial);
+
+			if (m_freeBuffers.empty())
+			{
+				++m_droppedCount;
+				return false;
+			}
+			const uint32_t bufferIdx = m_freeBuffers.back();
+			m_freeBuffers.pop_back();
+
+			vkCmdCopyImageToBuffer(cb, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, *m_buffers[bufferIdx], 1, &region);
+
+			// Makes the copy visible to the host once the frame's fence or semaphore has been waited on
+			VkMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+			m_inFlight.push_back({ frameSerial, bufferIdx, sizeInBytes, callback });
+			return true;
+		}
+
+		// Hand the readbacks of every frame up to @frameSerial to their callbacks and recycle their buffers
+		void complete(uint64_t frameSerial)
+		{
+			while (!m_inFlight.empty() && m_inFlight.front().frameSerial <= frameSerial)
+			{
+				const Readback readback = std::move(m_inFlight.front());
+				m_inFlight.pop_front();
+
+				const auto &buffer = *m_buffers[readback.bufferIdx];
+				readback.callback(static_cast<const char *>(buffer.mapBuffer()), readback.sizeInBytes);
+				buffer.unmapBuffer();
+				m_freeBuffers.push_back(readback.bufferIdx);
+			}
+		}
+
+		VkDeviceSize getBufferSize() const { return m_bufferSize; }
+		uint32_t getBufferCount() const { return static_cast<uint32_t>(m_buffers.size()); }
+		uint32_t getInFlightCount() const { return static_cast<uint32_t>(m_inFlight.size()); }
+		uint64_t getDroppedCount() const { return m_droppedCount; }
+
+	protected:
+		struct Readback
+		{
+			uint64_t frameSerial;
+			uint32_t bufferIdx;
+			VkDeviceSize sizeInBytes;
+			Callback callback;
+		};
+
+		const VDevice &m_device;
+		VMemoryAllocator *m_pAllocator;
+
+		std::vector<std::unique_ptr<VBuffer>> m_buffers;
+		std::vector<uint32_t> m_freeBuffers;
+		std::deque<Readback> m_inFlight; // oldest first
+		VkDeviceSize m_bufferSize = 0;
+		uint64_t m_droppedCount = 0;
+	};
+}
@@ -0,0 +1,429 @@
+#pragma once
+
+#include <limits>
+#include <string>
+#include <vector>
+#include "vk_helpers.h"
+
+
+namespace rj
+{
+	// Describes a frame as a list of passes in execution order and the images each pass reads and writes.
+	// compile() culls passes that nothing depends on, works out image lifetimes, lets transient images with
+	// disjoint lifetimes share memory and derives layouts and incoming dependencies for every pass.
+	//
+	// Conventions:
+	// - Transient images only hold valid contents within a frame. Imported images (history, swapchain, ...) keep them across frames
+	//   and are never aliased.
+	// - Images are shared by all frames in flight, so a frame's first access of an image depends on the previous frame's last ones.
+	// - Render passes leave their attachments in the layout of the next access (getFinalLayout()). Images that are sampled or copied
+	//   stay in the layout of that access.
+	// - Execution order is the order of addPass(). Passes are not reordered.
+	class VRenderGraph
+	{
+	public:
+		static const uint32_t INVALID_NAME = std::numeric_limits<uint32_t>::max();
+
+		enum Access
+		{
+			ACCESS_COLOR_ATTACHMENT_WRITE,			// cleared or fully overwritten
+			ACCESS_COLOR_ATTACHMENT_READ_WRITE,		// loaded, e.g. blending onto the previous contents
+			ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE,	// cleared
+			ACCESS_DEPTH_STENCIL_ATTACHMENT_READ,
+			ACCESS_INPUT_ATTACHMENT_READ,
+			ACCESS_SAMPLED_READ,					// by fragment shaders
+			ACCESS_COMPUTE_SAMPLED_READ,
+			ACCESS_TRANSFER_READ,
+			ACCESS_TRANSFER_WRITE,					// fully overwritten
+			ACCESS_COMPUTE_STORAGE_WRITE			// fully overwritten. Like a render pass, the pass moves the image on to getFinalLayout() itself
+		};
+
+		struct AccessInfo
+		{
+			VkPipelineStageFlags stages;
+			VkAccessFlags accessMask;
+			VkImageLayout layout;
+			bool isWrite;
+			bool discardsContents;
+		};
+
+		static AccessInfo getAccessInfo(Access access)
+		{
+			switch (access)
+			{
+			case ACCESS_COLOR_ATTACHMENT_WRITE:
+				return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+					VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, true };
+			case ACCESS_COLOR_ATTACHMENT_READ_WRITE:
+				return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+					VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, false };
+			case ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE:
+				return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+					VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+					VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true, true };
+			case ACCESS_DEPTH_STENCIL_ATTACHMENT_READ:
+				return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+					VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false, false };
+			case ACCESS_INPUT_ATTACHMENT_READ:
+				return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, false };
+			case ACCESS_SAMPLED_READ:
+				return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, false };
+			case ACCESS_COMPUTE_SAMPLED_READ:
+				return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, false };
+			case ACCESS_TRANSFER_READ:
+				return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false, false };
+			case ACCESS_TRANSFER_WRITE:
+				return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true, true };
+			case ACCESS_COMPUTE_STORAGE_WRITE:
+				return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true, true };
+			default:
+				throw std::runtime_error("VRenderGraph: unknown access type");
+			}
+		}
+
+		void clear()
+		{
+			m_images.clear();
+			m_passes.clear();
+			m_isCompiled = false;
+		}
+
+		// --- Graph description ---
+		// An image whose contents only live within a frame. @allowAliasing is false for images that need memory of their own,
+		// e.g. lazily allocated attachments
+		uint32_t addImage(const std::string &name, uint32_t width, uint32_t height, VkFormat format,
+			VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT, bool allowAliasing = true)
+		{
+			ImageNode image;
+			image.name = name;
+			image.sizeEstimate = estimateSize(width, height, format, sampleCount);
+			image.allowAliasing = allowAliasing;
+			m_images.push_back(image);
+			m_isCompiled = false;
+			return static_cast<uint32_t>(m_images.size() - 1);
+		}
+
+		// An image that keeps its contents across frames. It is in @initialLayout when the frame starts and has to be left in @finalLayout
+		uint32_t importImage(const std::string &name, VkImageLayout initialLayout, VkImageLayout finalLayout)
+		{
+			ImageNode image;
+			image.name = name;
+			image.isImported = true;
+			image.initialLayout = initialLayout;
+			image.finalLayout = finalLayout;
+			m_images.push_back(image);
+			m_isCompiled = false;
+			return static_cast<uint32_t>(m_images.size() - 1);
+		}
+
+		// Passes execute in the order they are added. @hasSideEffects keeps the pass even if no image it writes is used,
+		// e.g. because it writes buffers the graph does not know about
+		uint32_t addPass(const std::string &name, bool hasSideEffects = false)
+		{
+			PassNode pass;
+			pass.name = name;
+			pass.hasSideEffects = hasSideEffects;
+			m_passes.push_back(pass);
+			m_isCompiled = false;
+			return static_cast<uint32_t>(m_passes.size() - 1);
+		}
+
+		// An image is accessed at most once per pass
+		void passAddAccess(uint32_t passName, uint32_t imageName, Access access)
+		{
+			assert(imageName < m_images.size());
+			auto &accesses = m_passes.at(passName).accesses;
+			assert(std::find_if(accesses.begin(), accesses.end(),
+				[imageName](const ImageAccess &a) { return a.image == imageName; }) == accesses.end());
+
+			accesses.push_back({ imageName, access });
+			m_isCompiled = false;
+		}
+		// --- Graph description ---
+
+		void compile()
+		{
+			cullPasses();
+			computeLifetimes();
+			assignMemory();
+			m_isCompiled = true;
+		}
+
+		uint32_t getImageCount() const { return static_cast<uint32_t>(m_images.size()); }
+
+		// --- Compile results ---
+		bool isPassCulled(uint32_t passName) const
+		{
+			assert(m_isCompiled);
+			return m_passes.at(passName).isCulled;
+		}
+
+		const std::string &getImageName(uint32_t imageName) const { return m_images.at(imageName).name; }
+
+		// The earlier declared image whose memory @imageName shares, INVALID_NAME if it needs memory of its own
+		uint32_t getAliasedImage(uint32_t imageName) const
+		{
+			assert(m_isCompiled);
+			const auto &image = m_images.at(imageName);
+			return image.memory == imageName ? INVALID_NAME : image.memory;
+		}
+
+		VkImageLayout getLayout(uint32_t passName, uint32_t imageName) const
+		{
+			return getAccessInfo(findAccess(passName, imageName).access).layout;
+		}
+
+		// Layout the image is in when @passName begins. VK_IMAGE_LAYOUT_UNDEFINED if the pass does not need the previous contents
+		VkImageLayout getInitialLayout(uint32_t passName, uint32_t imageName) const
+		{
+			assert(m_isCompiled);
+			const auto &image = m_images.at(imageName);
+			const AccessInfo info = getAccessInfo(findAccess(passName, imageName).access);
+
+			if (info.discardsContents) return VK_IMAGE_LAYOUT_UNDEFINED;
+
+			for (uint32_t p = passName; p-- > 0;)
+			{
+				if (m_passes[p].isCulled) continue;
+				for (const auto &access : m_passes[p].accesses)
+				{
+					if (access.image != imageName) continue;
+					return isAttachmentAccess(access.access) ? info.layout : getAccessInfo(access.access).layout;
+				}
+			}
+
+			return image.isImported ? image.initialLayout : VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+
+		// Layout of the next access in the frame, or the final layout of an imported image. Meant as the final layout of attachments
+		VkImageLayout getFinalLayout(uint32_t passName, uint32_t imageName) const
+		{
+			assert(m_isCompiled);
+			const auto &image = m_images.at(imageName);
+			findAccess(passName, imageName);
+
+			for (uint32_t p = passName + 1; p < m_passes.size(); ++p)
+			{
+				if (m_passes[p].isCulled) continue;
+				for (const auto &access : m_passes[p].accesses)
+				{
+					if (access.image == imageName) return getAccessInfo(access.access).layout;
+				}
+			}
+
+			return image.isImported ? image.finalLayout : getLayout(passName, imageName);
+		}
+
+		// Dependency from earlier work on the memory of every image accessed by @passNames to their first subpass. Covers the
+		// previous frame's accesses and those of images sharing the memory. Several passes may be given if they share a render pass
+		VkSubpassDependency getEntryDependency(const std::vector<uint32_t> &passNames) const
+		{
+			assert(m_isCompiled);
+
+			VkSubpassDependency dependency = {};
+			dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+			dependency.dstSubpass = 0;
+
+			for (uint32_t passName : passNames)
+			{
+				assert(!m_passes.at(passName).isCulled);
+				for (const auto &access : m_passes[passName].accesses)
+				{
+					const AccessInfo dstInfo = getAccessInfo(access.access);
+					dependency.dstStageMask |= dstInfo.stages;
+					dependency.dstAccessMask |= dstInfo.accessMask;
+					addPrecedingAccesses(passName, m_images[access.image].memory, &dependency);
+				}
+			}
+
+			assert(dependency.dstStageMask != 0);
+			if (dependency.srcStageMask == 0)
+			{
+				dependency.srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			}
+			return dependency;
+		}
+		// --- Compile results ---
+
+	protected:
+		struct ImageAccess
+		{
+			uint32_t image;
+			Access access;
+		};
+
+		struct ImageNode
+		{
+			std::string name;
+			VkDeviceSize sizeEstimate = 0; // 0 if the format is unknown, such images are not aliased
+			bool allowAliasing = false;
+			bool isImported = false;
+			VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			// compile results. Lifetime covers the passes that are not culled
+			uint32_t firstPass = INVALID_NAME;
+			uint32_t lastPass = INVALID_NAME;
+			uint32_t memory = INVALID_NAME; // image that owns the memory, itself if not aliased
+		};
+
+		struct PassNode
+		{
+			std::string name;
+			bool hasSideEffects = false;
+			std::vector<ImageAccess> accesses;
+
+			bool isCulled = false;
+		};
+
+		std::vector<ImageNode> m_images;
+		std::vector<PassNode> m_passes;
+		bool m_isCompiled = false;
+
+		static bool isAttachmentAccess(Access access)
+		{
+			return access != ACCESS_SAMPLED_READ && access != ACCESS_COMPUTE_SAMPLED_READ &&
+				access != ACCESS_TRANSFER_READ && access != ACCESS_TRANSFER_WRITE && access != ACCESS_COMPUTE_STORAGE_WRITE;
+		}
+
+		static VkDeviceSize estimateSize(uint32_t width, uint32_t height, VkFormat format, VkSampleCountFlagBits sampleCount)
+		{
+			const auto it = helper_functions::g_formatInfoTable.find(format);
+			if (it == helper_functions::g_formatInfoTable.end()) return 0;
+
+			const auto &info = it->second;
+			const VkDeviceSize blockCount = static_cast<VkDeviceSize>((width + info.blockExtent.width - 1) / info.blockExtent.width) *
+				((height + info.blockExtent.height - 1) / info.blockExtent.height);
+			return blockCount * info.blockSize * static_cast<VkDeviceSize>(sampleCount);
+		}
+
+		const ImageAccess &findAccess(uint32_t passName, uint32_t imageName) const
+		{
+			for (const auto &access : m_passes.at(passName).accesses)
+			{
+				if (access.image == imageName) return access;
+			}
+			throw std::runtime_error("VRenderGraph: pass " + m_passes[passName].name + " does not access image " + m_images.at(imageName).name);
+		}
+
+		// Walk backwards from the last pass. A pass is kept if it has side effects, writes an imported image
+		// or writes an image that a kept later pass reads before overwriting it
+		void cullPasses()
+		{
+			std::vector<bool> isRead(m_images.size(), false);
+
+			for (uint32_t p = static_cast<uint32_t>(m_passes.size()); p-- > 0;)
+			{
+				auto &pass = m_passes[p];
+				bool isNeeded = pass.hasSideEffects;
+				for (const auto &access : pass.accesses)
+				{
+					if (getAccessInfo(access.access).isWrite && (m_images[access.image].isImported || isRead[access.image]))
+					{
+						isNeeded = true;
+					}
+				}
+
+				pass.isCulled = !isNeeded;
+				if (pass.isCulled) continue;
+
+				// Earlier writers only matter to the reads of this pass if it discards the contents
+				for (const auto &access : pass.accesses)
+				{
+					isRead[access.image] = !getAccessInfo(access.access).discardsContents;
+				}
+			}
+		}
+
+		void computeLifetimes()
+		{
+			for (auto &image : m_images)
+			{
+				image.firstPass = INVALID_NAME;
+				image.lastPass = INVALID_NAME;
+			}
+
+			for (uint32_t p = 0; p < m_passes.size(); ++p)
+			{
+				if (m_passes[p].isCulled) continue;
+				for (const auto &access : m_passes[p].accesses)
+				{
+					auto &image = m_images[access.image];
+					if (image.firstPass == INVALID_NAME) image.firstPass = p;
+					image.lastPass = p;
+				}
+			}
+		}
+
+		// In declaration order every aliasable image joins the smallest earlier owner that is at least as large and whose
+		// images are all dead during its lifetime. Owners come first so that callers can create images in declaration order
+		void assignMemory()
+		{
+			std::vector<uint32_t> owners;
+			for (uint32_t i = 0; i < m_images.size(); ++i)
+			{
+				auto &image = m_images[i];
+				image.memory = i;
+
+				const bool canAlias = image.allowAliasing && !image.isImported && image.sizeEstimate > 0 && image.firstPass != INVALID_NAME;
+				if (!canAlias) continue;
+
+				uint32_t bestOwner = INVALID_NAME;
+				for (uint32_t owner : owners)
+				{
+					if (m_images[owner].sizeEstimate < image.sizeEstimate) continue;
+					if (bestOwner != INVALID_NAME && m_images[owner].sizeEstimate >= m_images[bestOwner].sizeEstimate) continue;
+
+					bool overlaps = false;
+					for (uint32_t j = 0; j < i && !overlaps; ++j)
+					{
+						const auto &other = m_images[j];
+						overlaps = other.memory == owner && image.firstPass <= other.lastPass && other.firstPass <= image.lastPass;
+					}
+					if (!overlaps) bestOwner = owner;
+				}
+
+				if (bestOwner != INVALID_NAME)
+				{
+					image.memory = bestOwner;
+				}
+				else
+				{
+					owners.push_back(i);
+				}
+			}
+		}
+
+		// Accumulate the accesses to @memory since its last write into the source of @pDependency, walking backwards from
+		// @passName and wrapping around into the previous frame
+		void addPrecedingAccesses(uint32_t passName, uint32_t memory, VkSubpassDependency *pDependency) const
+		{
+			const uint32_t passCount = static_cast<uint32_t>(m_passes.size());
+			for (uint32_t i = 1; i < passCount; ++i)
+			{
+				const auto &pass = m_passes[(passName + passCount - i) % passCount];
+				if (pass.isCulled) continue;
+
+				bool foundWrite = false;
+				for (const auto &access : pass.accesses)
+				{
+					if (m_images[access.image].memory != memory) continue;
+
+					const AccessInfo info = getAccessInfo(access.access);
+					pDependency->srcStageMask |= info.stages;
+					if (info.isWrite)
+					{
+						pDependency->srcAccessMask |= info.accessMask & (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+							VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+						foundWrite = true;
+					}
+				}
+
+				if (foundWrite) return;
+			}
+		}
+	};
+}
@@ -46,7 +46,7 @@ namespace rj
 			m_info.unnormalizedCoordinates = unnormailzedCoords;
 			m_info.flags = flags;
 
-			if (vkCreateSampler(m_device, &m_info, nullptr, m_sampler.replace()) != VK_SUCCESS)
+			if (vkCreateSampler(m_device, &m_info, helper_functions::getHostAllocationCallbacks(), m_sampler.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create sampler!");
 			}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "VManager.h"
+
+
+namespace rj
+{
+	// Separable blur in compute, one dispatch per axis, for the passes that blur an image twice. The blurred axis runs along the
+	// work groups' x, so in either direction a work group loads a run of @tileSize texels of @rowsPerGroup rows, plus the apron
+	// of the kernel radius on each side, into shared memory once and every tap reads from there instead of the image. Devices
+	// whose subgroups support shuffles in compute and fit a run get the *_subgroup shaders, which take the taps that fall into
+	// the own subgroup from the other invocations' registers and only go to shared memory across subgroups.
+	// Descriptor sets have the source sampled at binding 0 and the destination as a storage image at binding 1, sets of
+	// identically defined layouts may be bound as well. Needs the blur_compute shaders
+	class VSeparableBlur
+	{
+	public:
+		struct KernelInfo
+		{
+			VkFormat format; // of the storage image written
+			bool layered; // 2D array images, a layer per dispatch
+			uint32_t radius; // taps on each side
+			float sigma; // of the Gaussian weights, 0 for a box filter
+			float depthSharpness; // falloff of the weights with the relative difference of the second channel, a view depth. 0 ignores it
+		};
+
+		VSeparableBlur(VManager *pManager, uint32_t tileSize, uint32_t rowsPerGroup)
+			:
+			m_pManager(pManager),
+			m_tileSize(tileSize),
+			m_rowsPerGroup(rowsPerGroup)
+		{
+			m_pManager->beginCreateDescriptorSetLayout();
+			m_pManager->setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+			m_pManager->setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+			m_descriptorSetLayout = m_pManager->endCreateDescriptorSetLayout();
+
+			m_pManager->beginCreatePipelineLayout();
+			m_pManager->pipelineLayoutAddDescriptorSetLayouts({ m_descriptorSetLayout });
+			m_pManager->pipelineLayoutAddPushConstantRange(0, 4 * sizeof(uint32_t), VK_SHADER_STAGE_COMPUTE_BIT); // extent, direction, layer
+			m_pipelineLayout = m_pManager->endCreatePipelineLayout();
+
+			// Subgroups are made of consecutive invocations, so one that divides a run never straddles two rows
+			const VkPhysicalDeviceSubgroupProperties &subgroup = m_pManager->getSubgroupProperties();
+			m_useSubgroupShuffle = (subgroup.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+				(subgroup.supportedOperations & VK_SUBGROUP_FEATURE_SHUFFLE_BIT) &&
+				subgroup.subgroupSize > 0 && m_tileSize % subgroup.subgroupSize == 0;
+		}
+
+		~VSeparableBlur()
+		{
+			for (const auto &kernel : m_kernels)
+			{
+				m_pManager->destroyPipeline(kernel.pipeline);
+			}
+			m_pManager->destroyPipelineLayout(m_pipelineLayout);
+		}
+
+		uint32_t getDescriptorSetLayout() const { return m_descriptorSetLayout; }
+		bool isSubgroupShuffleUsed() const { return m_useSubgroupShuffle; }
+
+		// Pipeline of @info, created on first use. Kernels live as long as the blur
+		uint32_t getKernel(const KernelInfo &info)
+		{
+			for (const auto &kernel : m_kernels)
+			{
+				const KernelInfo &k = kernel.info;
+				if (k.format == info.format && k.layered == info.layered && k.radius == info.radius && k.sigma == info.sigma &&
+					k.depthSharpness == info.depthSharpness)
+				{
+					return kernel.pipeline;
+				}
+			}
+
+			// separable_blur_<format>[_array][_subgroup]
+			std::string fileName = "../shaders/blur_compute/separable_blur_" + getFormatSuffix(info.format);
+			if (info.layered) fileName += "_array";
+			if (m_useSubgroupShuffle) fileName += "_subgroup";
+			fileName += ".comp.spv";
+
+			uint32_t tileSize = m_tileSize;
+			uint32_t rowsPerGroup = m_rowsPerGroup;
+			uint32_t radius = info.radius;
+			float sigma = info.sigma;
+			float depthSharpness = info.depthSharpness;
+			m_pManager->beginCreateComputePipeline(m_pipelineLayout);
+			m_pManager->computePipelineAddShaderStage(fileName);
+			m_pManager->computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &tileSize);
+			m_pManager->computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &rowsPerGroup);
+			m_pManager->computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(uint32_t), &radius);
+			m_pManager->computePipelineAddSpecializationConstant(3, 3 * sizeof(uint32_t), sizeof(float), &sigma);
+			m_pManager->computePipelineAddSpecializationConstant(4, 4 * sizeof(uint32_t), sizeof(float), &depthSharpness);
+
+			Kernel kernel;
+			kernel.info = info;
+			kernel.pipeline = m_pManager->endCreateComputePipeline();
+			m_kernels.push_back(kernel);
+			return kernel.pipeline;
+		}
+
+		void writeDescriptorSet(uint32_t setName, uint32_t srcImageView, uint32_t srcSampler, VkImageLayout srcLayout, uint32_t dstImageView) const
+		{
+			std::vector<DescriptorSetUpdateImageInfo> imageInfos(1);
+			m_pManager->beginUpdateDescriptorSet(setName);
+
+			imageInfos[0].layout = srcLayout;
+			imageInfos[0].imageViewName = srcImageView;
+			imageInfos[0].samplerName = srcSampler;
+			m_pManager->descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+			imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+			imageInfos[0].imageViewName = dstImageView;
+			imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+			m_pManager->descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+
+			m_pManager->endUpdateDescriptorSet();
+		}
+
+		// Blur the top left @width x @height texels of one layer along x for @direction 0, along y for 1. Taps beyond the
+		// extent are clamped to its edge. Synchronization is left to the caller
+		void cmdBlur(uint32_t cmdBufferName, uint32_t kernel, uint32_t setName, uint32_t width, uint32_t height, uint32_t direction,
+			uint32_t layer = 0) const
+		{
+			m_pManager->cmdBindPipeline(cmdBufferName, VK_PIPELINE_BIND_POINT_COMPUTE, kernel);
+			m_pManager->cmdBindDescriptorSets(cmdBufferName, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, { setName });
+
+			const uint32_t pushConstants[] = { width, height, direction, layer };
+			m_pManager->cmdPushConstants(cmdBufferName, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), pushConstants);
+
+			const uint32_t length = direction == 0 ? width : height;
+			const uint32_t rows = direction == 0 ? height : width;
+			m_pManager->cmdDispatch(cmdBufferName, (length + m_tileSize - 1) / m_tileSize, (rows + m_rowsPerGroup - 1) / m_rowsPerGroup, 1);
+		}
+
+	protected:
+		struct Kernel
+		{
+			KernelInfo info;
+			uint32_t pipeline;
+		};
+
+		VManager *m_pManager;
+		uint32_t m_tileSize;
+		uint32_t m_rowsPerGroup;
+		bool m_useSubgroupShuffle;
+		uint32_t m_descriptorSetLayout;
+		uint32_t m_pipelineLayout;
+		std::vector<Kernel> m_kernels;
+
+		// The storage image format qualifier of the shader variant
+		static std::string getFormatSuffix(VkFormat format)
+		{
+			switch (format)
+			{
+			case VK_FORMAT_R16G16B16A16_SFLOAT:
+				return "rgba16f";
+			case VK_FORMAT_R32G32_SFLOAT:
+				return "rg32f";
+			case VK_FORMAT_R32G32B32A32_SFLOAT:
+				return "rgba32f";
+			default:
+				throw std::runtime_error("VSeparableBlur: no shader variant for the format");
+			}
+		}
+	};
+}
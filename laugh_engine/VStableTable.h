@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+
+namespace rj
+{
+	// One of VManager's resource tables. Entries live in fixed size chunks that never move, so references to them stay valid
+	// while the table grows and other threads may read any entry below size() without a lock. Appending needs a lock of the
+	// caller's, entries are only destroyed with the table
+	template<typename T, uint32_t chunkSize = 256, uint32_t maxChunkCount = 1024>
+	class VStableTable
+	{
+	public:
+		VStableTable() = default;
+		VStableTable(const VStableTable &) = delete;
+		VStableTable &operator=(const VStableTable &) = delete;
+
+		~VStableTable()
+		{
+			const uint32_t count = size();
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				(*this)[i].~T();
+			}
+			for (uint32_t c = 0; c < maxChunkCount; ++c)
+			{
+				delete[] m_chunks[c].load(std::memory_order_relaxed);
+			}
+		}
+
+		template<typename... Args>
+		T &emplace_back(Args&&... args)
+		{
+			const uint32_t idx = m_size.load(std::memory_order_relaxed);
+			const uint32_t c = idx / chunkSize;
+			if (c == maxChunkCount) throw std::length_error("VStableTable::emplace_back - table is full.");
+
+			Storage *pChunk = m_chunks[c].load(std::memory_order_relaxed);
+			if (!pChunk)
+			{
+				pChunk = new Storage[chunkSize];
+				m_chunks[c].store(pChunk, std::memory_order_release);
+			}
+			T *pEntry = new (&pChunk[idx % chunkSize]) T(std::forward<Args>(args)...);
+
+			// Readers that see the new size see the constructed entry
+			m_size.store(idx + 1, std::memory_order_release);
+			return *pEntry;
+		}
+
+		uint32_t size() const { return m_size.load(std::memory_order_acquire); }
+
+		T &operator[](uint32_t idx)
+		{
+			assert(idx < size());
+			return *reinterpret_cast<T *>(&m_chunks[idx / chunkSize].load(std::memory_order_acquire)[idx % chunkSize]);
+		}
+
+		const T &operator[](uint32_t idx) const
+		{
+			assert(idx < size());
+			return *reinterpret_cast<const T *>(&m_chunks[idx / chunkSize].load(std::memory_order_acquire)[idx % chunkSize]);
+		}
+
+		T &at(uint32_t idx)
+		{
+			if (idx >= size()) throw std::out_of_range("VStableTable::at - invalid name.");
+			return (*this)[idx];
+		}
+
+		const T &at(uint32_t idx) const
+		{
+			if (idx >= size()) throw std::out_of_range("VStableTable::at - invalid name.");
+			return (*this)[idx];
+		}
+
+	protected:
+		typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+		std::atomic<Storage *> m_chunks[maxChunkCount] = {};
+		std::atomic<uint32_t> m_size{ 0 };
+	};
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <deque>
+#include "VBuffer.h"
+
+
+namespace rj
+{
+	// A persistently mapped host visible buffer that uploads are written into back to back.
+	// Everything written between two closeSegment() calls forms a segment which is recycled
+	// once the fence returned by closeSegment() signals.
+	class VStagingRing
+	{
+	public:
+		static const VkDeviceSize DEFAULT_SIZE = 32 * 1024 * 1024;
+
+		VStagingRing(const VDevice &device, VMemoryAllocator *pAllocator)
+			:
+			m_device(device),
+			m_buffer{ device, pAllocator }
+		{}
+
+		void init(VkDeviceSize sizeInBytes = DEFAULT_SIZE)
+		{
+			// Storage for the upload passes that read the staged data in compute
+			m_buffer.init(sizeInBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			m_mapped = static_cast<char *>(m_buffer.mapBuffer());
+			m_size = sizeInBytes;
+			m_head = 0;
+			m_tail = 0;
+			m_openSegmentSize = 0;
+		}
+
+		// Return false if @sizeInBytes can never fit in the ring. Caller should fall back to a dedicated staging buffer.
+		bool canHold(VkDeviceSize sizeInBytes) const
+		{
+			return sizeInBytes < m_size / 2;
+		}
+
+		// Copy @sizeInBytes of @hostData into the ring and return its offset in the ring buffer.
+		// Blocks on the oldest in-flight segment if the ring is full.
+		VkDeviceSize write(const void *hostData, VkDeviceSize sizeInBytes, VkDeviceSize alignment = 16)
+		{
+			VkDeviceSize offset = allocate(sizeInBytes, alignment);
+			memcpy(m_mapped + offset, hostData, sizeInBytes);
+			return offset;
+		}
+
+		// Reserve @sizeInBytes in the ring. Write through mappedAt(offset).
+		VkDeviceSize allocate(VkDeviceSize sizeInBytes, VkDeviceSize alignment = 16)
+		{
+			assert(m_mapped);
+			assert(canHold(sizeInBytes));
+
+			reclaim();
+
+			VkDeviceSize offset;
+			while (!tryAllocate(sizeInBytes, alignment, &offset))
+			{
+				if (m_segments.empty())
+				{
+					throw std::runtime_error("VStagingRing: out of space, close the open segment before writing more");
+				}
+				waitOldestSegment();
+			}
+
+			m_openSegmentSize += sizeInBytes;
+			return offset;
+		}
+
+		void *mappedAt(VkDeviceSize offset) const
+		{
+			assert(offset < m_size);
+			return m_mapped + offset;
+		}
+
+		// Finish the open segment. The returned fence must be signaled by the submit that consumes
+		// the segment. Return VK_NULL_HANDLE if nothing has been written since the last call.
+		VkFence closeSegment()
+		{
+			if (m_openSegmentSize == 0) return VK_NULL_HANDLE;
+
+			m_segments.push_back({ acquireFence(), m_head });
+			m_openSegmentSize = 0;
+			return m_segments.back().fence;
+		}
+
+		// Recycle segments whose fences have signaled
+		void reclaim()
+		{
+			while (!m_segments.empty() &&
+				vkGetFenceStatus(m_device, m_segments.front().fence) == VK_SUCCESS)
+			{
+				popOldestSegment();
+			}
+		}
+
+		void waitIdle()
+		{
+			while (!m_segments.empty())
+			{
+				waitOldestSegment();
+			}
+		}
+
+		operator VkBuffer() const { return m_buffer; }
+
+		VkDeviceSize size() const { return m_size; }
+		VkDeviceSize openSegmentSize() const { return m_openSegmentSize; }
+
+	protected:
+		struct Segment
+		{
+			VDeleter<VkFence> fence;
+			VkDeviceSize end;
+		};
+
+		const VDevice &m_device;
+
+		VBuffer m_buffer;
+		char *m_mapped = nullptr;
+		VkDeviceSize m_size = 0;
+
+		// In-flight data lives in [m_tail, m_head), wrapping around the end of the buffer
+		VkDeviceSize m_head = 0;
+		VkDeviceSize m_tail = 0;
+		VkDeviceSize m_openSegmentSize = 0;
+		std::deque<Segment> m_segments;
+		std::vector<VDeleter<VkFence>> m_freeFences;
+
+		bool tryAllocate(VkDeviceSize sizeInBytes, VkDeviceSize alignment, VkDeviceSize *pOffset)
+		{
+			if (m_segments.empty() && m_openSegmentSize == 0)
+			{
+				m_head = m_tail = 0;
+			}
+
+			// m_head == m_tail means empty, so an allocation never ends exactly on m_tail.
+			// @alignment is not necessarily a power of two (e.g. 12 for RGB8 texel copies).
+			auto fits = [&](VkDeviceSize begin, VkDeviceSize end)
+			{
+				VkDeviceSize offset = (begin + alignment - 1) / alignment * alignment;
+				if (offset + sizeInBytes > end) return false;
+				*pOffset = offset;
+				m_head = offset + sizeInBytes;
+				return true;
+			};
+
+			if (m_tail <= m_head)
+			{
+				return fits(m_head, m_size) || (m_tail > 0 && fits(0, m_tail - 1));
+			}
+
+			return fits(m_head, m_tail - 1);
+		}
+
+		void waitOldestSegment()
+		{
+			VkFence fence = m_segments.front().fence;
+			vkWaitForFences(m_device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+			popOldestSegment();
+		}
+
+		void popOldestSegment()
+		{
+			auto &segment = m_segments.front();
+			m_tail = segment.end;
+
+			VkFence fence = segment.fence;
+			vkResetFences(m_device, 1, &fence);
+			m_freeFences.push_back(segment.fence);
+
+			m_segments.pop_front();
+		}
+
+		VDeleter<VkFence> acquireFence()
+		{
+			if (m_freeFences.empty())
+			{
+				m_freeFences.emplace_back(m_device, vkDestroyFence);
+
+				VkFenceCreateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+				if (vkCreateFence(m_device, &info, nullptr, m_freeFences.back().replace()) != VK_SUCCESS)
+				{
+					throw std::runtime_error("VStagingRing: failed to create fence");
+				}
+			}
+
+			VDeleter<VkFence> fence = m_freeFences.back();
+			m_freeFences.pop_back();
+			return fence;
+		}
+	};
+}
@@ -18,14 +18,50 @@ namespace rj
 			recreateSwapChain();
 		}
 
-		void recreateSwapChain()
+		// A swapchain replaced by recreateSwapChain() with its image views. Presents to it may still be queued
+		struct Retired
 		{
-			createSwapChain();
+			VDeleter<VkSwapchainKHR> swapChain;
+			std::vector<VDeleter<VkImageView>> imageViews;
+		};
+
+		// The old swapchain is passed as oldSwapchain, so images already queued for presentation are still shown. With @pRetired
+		// it is moved there together with its image views to be destroyed later, otherwise it is destroyed right away
+		void recreateSwapChain(Retired *pRetired = nullptr)
+		{
+			if (m_window.isHeadless())
+			{
+				createOffscreenImages();
+			}
+			else
+			{
+				createSwapChain(pRetired);
+				if (pRetired)
+				{
+					pRetired->imageViews = std::move(m_swapChainImageViews);
+					m_swapChainImageViews.clear();
+				}
+			}
 			createSwapChainImageViews();
 		}
 
+		// VK_NULL_HANDLE if headless
 		operator VkSwapchainKHR() const { return m_swapChain; }
 
+		// The images are not presentable and are handed out in order by VManager::swapChainNextImageIndex
+		bool isHeadless() const { return m_window.isHeadless(); }
+
+		const std::vector<VkImage> &images() const
+		{
+			return m_swapChainImages;
+		}
+
+		// The images can be copied from if VK_IMAGE_USAGE_TRANSFER_SRC_BIT is set
+		VkImageUsageFlags imageUsage() const
+		{
+			return m_imageUsage;
+		}
+
 		const std::vector<VDeleter<VkImageView>> &imageViews() const
 		{
 			return m_swapChainImageViews;
@@ -47,8 +83,25 @@ namespace rj
 			return static_cast<uint32_t>(m_swapChainImages.size());
 		}
 
+		// Used from the next recreateSwapChain() on. @presentMode falls back to FIFO if the surface lacks it. @imageCount 0 asks
+		// for one more image than the surface minimum, other counts are clamped to the surface limits.
+		// Return whether the configuration has changed
+		bool setPresentConfig(VkPresentModeKHR presentMode, uint32_t imageCount)
+		{
+			const bool changed = presentMode != m_requestedPresentMode || imageCount != m_requestedImageCount;
+			m_requestedPresentMode = presentMode;
+			m_requestedImageCount = imageCount;
+			return changed;
+		}
+
+		// The mode the swapchain was created with, FIFO if headless
+		VkPresentModeKHR presentMode() const
+		{
+			return m_presentMode;
+		}
+
 	protected:
-		void createSwapChain()
+		void createSwapChain(Retired *pRetired)
 		{
 			SwapChainSupportDetails swapChainSupport = querySwapChainSupport(m_device, m_window);
 
@@ -56,7 +109,8 @@ namespace rj
 			VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
 			VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
-			uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+			uint32_t imageCount = m_requestedImageCount > 0 ?
+				std::max(m_requestedImageCount, swapChainSupport.capabilities.minImageCount) : swapChainSupport.capabilities.minImageCount + 1;
 			if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
 			{
 				imageCount = swapChainSupport.capabilities.maxImageCount;
@@ -70,7 +124,9 @@ namespace rj
 			createInfo.imageColorSpace = surfaceFormat.colorSpace;
 			createInfo.imageExtent = extent;
 			createInfo.imageArrayLayers = 1; // always 1 for non-stereoscopic 3D applications
-			createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+			// Copies out of the images are only used for frame captures, so they are not required
+			createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+				(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 
 			const VQueueFamilyIndices &indices = m_device.getQueueFamilyIndices();
 			uint32_t queueFamilyIndices[] = { (uint32_t)indices.graphicsFamily, (uint32_t)indices.presentFamily };
@@ -93,16 +149,24 @@ namespace rj
 			createInfo.presentMode = presentMode;
 			createInfo.clipped = VK_TRUE;
 
-			VkSwapchainKHR oldSwapChain = m_swapChain;
+			// Images rendered on any device of a group are presented in the mode the device picked
+			VkDeviceGroupSwapchainCreateInfoKHR deviceGroupInfo = {};
+			deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SWAPCHAIN_CREATE_INFO_KHR;
+			deviceGroupInfo.modes = m_device.getDeviceGroupPresentMode();
+			if (deviceGroupInfo.modes != 0) createInfo.pNext = &deviceGroupInfo;
+
+			// Outlives the creation of its successor, which may reuse its resources
+			VDeleter<VkSwapchainKHR> oldSwapChain = std::move(m_swapChain);
 			createInfo.oldSwapchain = oldSwapChain;
 
 			VkSwapchainKHR newSwapChain;
-			if (vkCreateSwapchainKHR(m_device, &createInfo, nullptr, &newSwapChain) != VK_SUCCESS)
+			if (vkCreateSwapchainKHR(m_device, &createInfo, helper_functions::getHostAllocationCallbacks(), &newSwapChain) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create swap chain!");
 			}
 
 			m_swapChain = newSwapChain;
+			if (pRetired) pRetired->swapChain = std::move(oldSwapChain);
 
 			vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, nullptr);
 			m_swapChainImages.resize(imageCount);
@@ -110,6 +174,34 @@ namespace rj
 
 			m_swapChainImageFormat = surfaceFormat.format;
 			m_swapChainExtent = extent;
+			m_imageUsage = createInfo.imageUsage;
+			m_presentMode = presentMode;
+		}
+
+		// Stand-ins for the swapchain images with the format and image count a typical swapchain would have
+		void createOffscreenImages()
+		{
+			const uint32_t imageCount = m_requestedImageCount > 0 ? m_requestedImageCount : 3;
+
+			m_swapChainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+			m_window.getExtent(&m_swapChainExtent.width, &m_swapChainExtent.height);
+			m_imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+			// Images before the memories bound to them. The elements keep their deleters for the new ones
+			destroyAll(m_offscreenImages);
+			destroyAll(m_offscreenImageMemories);
+			m_offscreenImages.resize(imageCount, VDeleter<VkImage>{ m_device, vkDestroyImage });
+			m_offscreenImageMemories.resize(imageCount, VDeleter<VkDeviceMemory>{ m_device, vkFreeMemory });
+			m_swapChainImages.resize(imageCount);
+
+			for (uint32_t i = 0; i < imageCount; ++i)
+			{
+				createImage(m_offscreenImages[i], m_offscreenImageMemories[i], m_device, m_device,
+					m_swapChainImageFormat, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL,
+					VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					m_swapChainExtent.width, m_swapChainExtent.height, 1, 1, 1, 0, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+				m_swapChainImages[i] = m_offscreenImages[i];
+			}
 		}
 
 		VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
@@ -134,7 +226,7 @@ namespace rj
 		{
 			for (const auto& availablePresentMode : availablePresentModes)
 			{
-				if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+				if (availablePresentMode == m_requestedPresentMode)
 				{
 					return availablePresentMode;
 				}
@@ -181,8 +273,15 @@ namespace rj
 
 		VDeleter<VkSwapchainKHR> m_swapChain{ m_device, vkDestroySwapchainKHR };
 		std::vector<VkImage> m_swapChainImages; // swap chain images will be released when the swap chain is destroyed
+		// Own the images of m_swapChainImages if headless. Memories are declared first so the images are destroyed before them
+		std::vector<VDeleter<VkDeviceMemory>> m_offscreenImageMemories;
+		std::vector<VDeleter<VkImage>> m_offscreenImages;
 		std::vector<VDeleter<VkImageView>> m_swapChainImageViews;
 		VkFormat m_swapChainImageFormat;
 		VkExtent2D m_swapChainExtent;
+		VkImageUsageFlags m_imageUsage = 0;
+		VkPresentModeKHR m_requestedPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+		uint32_t m_requestedImageCount = 0;
+		VkPresentModeKHR m_presentMode = VK_PRESENT_MODE_FIFO_KHR;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "VManager.h"
+
+
+namespace rj
+{
+	// Shares textures between meshes and materials that use the same image, e.g. one trim sheet in several materials.
+	// Keys name the source and whatever changes the uploaded texture, e.g. the file name, or the glTF file, image index and format.
+	// Entries are reference counted, the last release destroys the image, its views and samplers
+	class VTextureCache
+	{
+	public:
+		VTextureCache(VManager *pManager)
+			:
+			m_pManager(pManager)
+		{}
+
+		// If @key is cached, add a reference, copy the texture to @pTexRet and return true
+		bool acquire(const std::string &key, helper_functions::ImageWrapper *pTexRet)
+		{
+			auto it = m_entries.find(key);
+			if (it == m_entries.end()) return false;
+
+			++it->second.refCount;
+			*pTexRet = it->second.texture;
+			++m_hitCount;
+			return true;
+		}
+
+		// Cache a texture that was just created under @key, with a single reference
+		void add(const std::string &key, const helper_functions::ImageWrapper &texture)
+		{
+			if (!m_entries.emplace(key, Entry{ texture, 1 }).second)
+			{
+				throw std::invalid_argument("texture " + key + " is already cached");
+			}
+		}
+
+		// The texture must not be in use by the GPU anymore if this was its last reference
+		void release(const std::string &key)
+		{
+			auto it = m_entries.find(key);
+			if (it == m_entries.end()) throw std::invalid_argument("texture " + key + " is not cached");
+			if (--it->second.refCount > 0) return;
+
+			const auto &texture = it->second.texture;
+			for (auto sampler : texture.samplers)
+			{
+				m_pManager->destroySampler(sampler);
+			}
+			for (auto view : texture.imageViews)
+			{
+				m_pManager->destroyImageView(view);
+			}
+			m_pManager->destroyImage(texture.image);
+			m_entries.erase(it);
+		}
+
+		size_t getTextureCount() const { return m_entries.size(); }
+		uint32_t getHitCount() const { return m_hitCount; } // acquires that found their texture
+
+	protected:
+		struct Entry
+		{
+			helper_functions::ImageWrapper texture;
+			uint32_t refCount;
+		};
+
+		VManager *m_pManager;
+		std::unordered_map<std::string, Entry> m_entries;
+		uint32_t m_hitCount = 0;
+	};
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <deque>
+#include "VManager.h"
+
+
+namespace rj
+{
+	// Keeps the decoded mip chains of streamed textures on the host and only the levels the screen needs in VRAM.
+	// A texture starts with the levels no larger than @minResidentSize resident. Each frame the renderer requests the most
+	// detailed level every texture needs and update() uploads promotions within a per frame byte budget. When the streamed
+	// textures outgrow @poolSize, or a device local heap goes over its budget, textures resident beyond their request are
+	// demoted first and then the most detailed ones. Heap pressure also shrinks the pool to what is left resident, so the
+	// demoted levels don't come straight back. A texture that changes gets a new image holding only its resident
+	// levels, so its views never expose missing levels. The replaced image is destroyed once no frame in flight can use it.
+	// With defragmentation on, update() also moves the textures out of a little used memory block, within the same budget,
+	// so that churned texture memory is given back in whole blocks
+	class VTextureStreamer
+	{
+	public:
+		static const uint32_t INVALID_HANDLE = std::numeric_limits<uint32_t>::max();
+
+		// Replaced images live on for @retireFrameCount calls of update(), enough for every frame that may still sample them
+		VTextureStreamer(VManager *pManager, uint32_t minResidentSize, VkDeviceSize poolSize, VkDeviceSize uploadBytesPerFrame,
+			uint32_t retireFrameCount)
+			:
+			m_pManager(pManager),
+			m_minResidentSize(minResidentSize),
+			m_poolLimit(poolSize),
+			m_uploadBytesPerFrame(uploadBytesPerFrame),
+			m_frameUploadBytes(uploadBytesPerFrame),
+			m_retireFrameCount(retireFrameCount)
+		{}
+
+		~VTextureStreamer()
+		{
+			for (const auto &retired : m_retiredImages)
+			{
+				m_pManager->destroyImageView(retired.imageView);
+				m_pManager->destroyImage(retired.image);
+			}
+		}
+
+		// Stream @host, uploaded as @format, under @key. A key that is already streamed returns its handle instead.
+		// Textures with a single level have nothing to stream and are fully resident
+		uint32_t add(const std::string &key, const gli::texture2d &host, VkFormat format)
+		{
+			auto it = m_handles.find(key);
+			if (it != m_handles.end()) return it->second;
+
+			Entry entry;
+			entry.host = host;
+			entry.levelCount = static_cast<uint32_t>(host.levels());
+			entry.minLevel = 0;
+			while (entry.minLevel + 1 < entry.levelCount && getLevelSize(host, entry.minLevel) > m_minResidentSize)
+			{
+				++entry.minLevel;
+			}
+			entry.requestedLevel = entry.minLevel;
+
+			auto &texture = entry.texture;
+			texture.format = format;
+			texture.depth = 1;
+			texture.layerCount = 1;
+			texture.samplers.push_back(m_pManager->createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR,
+				VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT,
+				0.f, float(entry.levelCount - 1), 0.f, VK_TRUE, 16.f));
+			texture.imageViews.resize(1);
+
+			makeResident(entry, entry.minLevel, false);
+
+			const uint32_t handle = static_cast<uint32_t>(m_entries.size());
+			m_entries.push_back(std::move(entry));
+			m_handles[key] = handle;
+			return handle;
+		}
+
+		const helper_functions::ImageWrapper &getTexture(uint32_t handle) const { return m_entries.at(handle).texture; }
+		uint32_t getTextureCount() const { return static_cast<uint32_t>(m_entries.size()); }
+		uint32_t getResidentLevel(uint32_t handle) const { return m_entries.at(handle).residentLevel; }
+		VkDeviceSize getResidentBytes() const { return m_residentBytes; }
+		VkDeviceSize getPoolLimit() const { return m_poolLimit; } // @poolSize unless heap pressure shrank it
+		VkDeviceSize getLastUploadedBytes() const { return m_lastUploadedBytes; } // by promotions of the last update
+
+		// Bytes of promotions the updates from now on may upload, at most @uploadBytesPerFrame. A texture larger than that only
+		// goes, alone, if @allowOversized. All of @uploadBytesPerFrame and oversized textures until called
+		void setFrameUploadBudget(VkDeviceSize bytes, bool allowOversized)
+		{
+			m_frameUploadBytes = std::min(bytes, m_uploadBytesPerFrame);
+			m_allowOversizedUpload = allowOversized;
+		}
+
+		// Empty memory blocks used below @maxUsedFraction that only hold textures, 0 turns it off. A moved texture gets a new
+		// image like a promoted one, from its host levels
+		void setDefragmentation(float maxUsedFraction) { m_defragmentationMaxUsedFraction = maxUsedFraction; }
+		VkDeviceSize getLastMovedBytes() const { return m_lastMovedBytes; } // by defragmentation in the last update
+
+		// Ask for @level, 0 being full resolution, to be resident. The most detailed level asked for since the last update wins
+		void request(uint32_t handle, uint32_t level)
+		{
+			auto &entry = m_entries.at(handle);
+			entry.requestedLevel = std::min(entry.requestedLevel, level);
+		}
+
+		// The coarsest level with at least one texel per pixel if the whole texture covers @screenSize pixels
+		uint32_t getLevelForScreenSize(uint32_t handle, float screenSize) const
+		{
+			const auto &entry = m_entries.at(handle);
+			if (screenSize < 1.f) return entry.minLevel;
+
+			const float ratio = static_cast<float>(getLevelSize(entry.host, 0)) / screenSize;
+			const uint32_t level = ratio > 1.f ? static_cast<uint32_t>(std::floor(std::log2(ratio))) : 0;
+			return std::min(level, entry.minLevel);
+		}
+
+		// Call once per frame, after the requests of the frame. Return true if the image of any texture changed.
+		// Requests are reset to the minimum resident level
+		bool update()
+		{
+			++m_frame;
+			while (!m_retiredImages.empty() && m_retiredImages.front().frame <= m_frame)
+			{
+				m_pManager->destroyImageView(m_retiredImages.front().imageView);
+				m_pManager->destroyImage(m_retiredImages.front().image);
+				m_retiredImages.pop_front();
+			}
+
+			bool changed = false;
+			m_lastUploadedBytes = 0;
+			m_lastMovedBytes = 0;
+			m_pManager->beginUploadBatch();
+			if (m_residentBytes > m_poolLimit)
+			{
+				changed = demote();
+			}
+			else if (isHeapOverBudget())
+			{
+				changed = demote();
+				m_poolLimit = m_residentBytes;
+			}
+			else
+			{
+				changed = promote();
+				changed = defragment(changed) || changed;
+			}
+			m_pManager->endUploadBatch();
+
+			for (auto &entry : m_entries)
+			{
+				entry.requestedLevel = entry.minLevel;
+			}
+			return changed;
+		}
+
+	protected:
+		struct Entry
+		{
+			gli::texture2d host; // every level, level 0 first
+			helper_functions::ImageWrapper texture; // the resident levels
+			uint32_t levelCount;
+			uint32_t residentLevel; // most detailed level in @texture
+			uint32_t minLevel; // this level and the ones after it are always resident
+			uint32_t requestedLevel;
+		};
+
+		struct RetiredImage
+		{
+			uint32_t image;
+			uint32_t imageView;
+			uint64_t frame; // destroyed by the update of this frame
+		};
+
+		VManager *m_pManager;
+		uint32_t m_minResidentSize;
+		VkDeviceSize m_poolLimit;
+		VkDeviceSize m_uploadBytesPerFrame;
+		VkDeviceSize m_frameUploadBytes;
+		bool m_allowOversizedUpload = true;
+		uint32_t m_retireFrameCount;
+		float m_defragmentationMaxUsedFraction = 0.f;
+		uint32_t m_defragmentationIdleUpdates = 0; // since the last texture in the block being emptied was destroyed
+
+		std::vector<Entry> m_entries;
+		std::unordered_map<std::string, uint32_t> m_handles; // by key
+		std::deque<RetiredImage> m_retiredImages; // oldest first
+		VkDeviceSize m_residentBytes = 0;
+		VkDeviceSize m_lastUploadedBytes = 0;
+		VkDeviceSize m_lastMovedBytes = 0;
+		uint64_t m_frame = 0;
+
+		static uint32_t getLevelSize(const gli::texture2d &host, uint32_t level)
+		{
+			const auto extent = host.extent(level);
+			return static_cast<uint32_t>(std::max(extent.x, extent.y));
+		}
+
+		static VkDeviceSize getBytesFromLevel(const Entry &entry, uint32_t level)
+		{
+			VkDeviceSize bytes = 0;
+			for (uint32_t i = level; i < entry.levelCount; ++i)
+			{
+				bytes += entry.host.size(i);
+			}
+			return bytes;
+		}
+
+		bool isHeapOverBudget() const
+		{
+			if (!m_pManager->isMemoryBudgetEnabled()) return false;
+			for (const auto &heap : m_pManager->getMemoryHeapBudgets())
+			{
+				if (heap.isDeviceLocal && heap.isOverBudget()) return true;
+			}
+			return false;
+		}
+
+		// Replace the image of @entry by one holding the levels from @level on. @retire keeps the old image for the frames in flight
+		void makeResident(Entry &entry, uint32_t level, bool retire)
+		{
+			auto &texture = entry.texture;
+			if (retire)
+			{
+				m_retiredImages.push_back({ texture.image, texture.imageViews[0], m_frame + m_retireFrameCount });
+				m_residentBytes -= getBytesFromLevel(entry, entry.residentLevel);
+			}
+
+			const auto extent = entry.host.extent(level);
+			texture.width = static_cast<uint32_t>(extent.x);
+			texture.height = static_cast<uint32_t>(extent.y);
+			texture.mipLevelCount = entry.levelCount - level;
+
+			const VkDeviceSize bytes = getBytesFromLevel(entry, level);
+			texture.image = m_pManager->createImage2D(texture.width, texture.height, texture.format,
+				VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.mipLevelCount);
+			// The levels of one layer and face are contiguous in gli storage
+			m_pManager->transferHostDataToImage(texture.image, bytes, entry.host.data(0, 0, level),
+				VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			texture.imageViews[0] = m_pManager->createImageView2D(texture.image, VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.mipLevelCount);
+
+			entry.residentLevel = level;
+			m_residentBytes += bytes;
+		}
+
+		// Upload the textures furthest from their request first, as long as the frame's upload budget and the pool allow
+		bool promote()
+		{
+			std::vector<uint32_t> candidates;
+			for (uint32_t i = 0; i < m_entries.size(); ++i)
+			{
+				if (m_entries[i].requestedLevel < m_entries[i].residentLevel) candidates.push_back(i);
+			}
+			std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b)
+			{
+				return m_entries[a].residentLevel - m_entries[a].requestedLevel > m_entries[b].residentLevel - m_entries[b].requestedLevel;
+			});
+
+			VkDeviceSize uploadedBytes = 0;
+			bool changed = false;
+			for (uint32_t i : candidates)
+			{
+				auto &entry = m_entries[i];
+				const VkDeviceSize bytes = getBytesFromLevel(entry, entry.requestedLevel);
+				const VkDeviceSize growth = bytes - getBytesFromLevel(entry, entry.residentLevel);
+				if (m_residentBytes + growth > m_poolLimit) continue;
+				if (uploadedBytes + bytes > m_frameUploadBytes && (changed || !m_allowOversizedUpload)) break;
+
+				makeResident(entry, entry.requestedLevel, true);
+				uploadedBytes += bytes;
+				changed = true;
+			}
+			m_lastUploadedBytes = uploadedBytes;
+			return changed;
+		}
+
+		// Move textures out of the block being emptied with what is left of the frame's upload budget. Once none is left in
+		// it, the block is released when the last retired image is destroyed. If it is still there after the frames in flight,
+		// it holds textures of others and is given up
+		bool defragment(bool changed)
+		{
+			if (m_defragmentationMaxUsedFraction <= 0.f) return false;
+			if (!m_pManager->isMemoryDefragmenting())
+			{
+				m_defragmentationIdleUpdates = 0;
+				if (!m_pManager->beginMemoryDefragmentation(1u << MEMORY_CATEGORY_TEXTURES, m_defragmentationMaxUsedFraction)) return false;
+			}
+
+			bool isSourceEmpty = true;
+			bool moved = false;
+			for (auto &entry : m_entries)
+			{
+				if (!m_pManager->isImageInDefragmentationSource(entry.texture.image)) continue;
+
+				isSourceEmpty = false;
+				const VkDeviceSize bytes = getBytesFromLevel(entry, entry.residentLevel);
+				if (m_lastUploadedBytes + bytes > m_frameUploadBytes && (changed || moved || !m_allowOversizedUpload)) break;
+
+				makeResident(entry, entry.residentLevel, true);
+				m_lastUploadedBytes += bytes;
+				m_lastMovedBytes += bytes;
+				moved = true;
+			}
+
+			// Retired images are still in it until destroyed
+			const bool isRetiredInSource = std::any_of(m_retiredImages.begin(), m_retiredImages.end(),
+				[this](const RetiredImage &retired) { return m_pManager->isImageInDefragmentationSource(retired.image); });
+			if (!isSourceEmpty || isRetiredInSource)
+			{
+				m_defragmentationIdleUpdates = 0;
+			}
+			else if (++m_defragmentationIdleUpdates > m_retireFrameCount)
+			{
+				m_pManager->endMemoryDefragmentation();
+			}
+			return moved;
+		}
+
+		// Drop the levels nobody asked for, or else one level of the most detailed texture
+		bool demote()
+		{
+			bool changed = false;
+			for (auto &entry : m_entries)
+			{
+				if (entry.residentLevel >= entry.requestedLevel) continue;
+				makeResident(entry, entry.requestedLevel, true);
+				changed = true;
+			}
+			if (changed) return true;
+
+			Entry *pFinest = nullptr;
+			for (auto &entry : m_entries)
+			{
+				if (entry.residentLevel >= entry.minLevel) continue;
+				if (!pFinest || getLevelSize(entry.host, entry.residentLevel) > getLevelSize(pFinest->host, pFinest->residentLevel))
+				{
+					pFinest = &entry;
+				}
+			}
+			if (!pFinest) return false;
+
+			makeResident(*pFinest, pFinest->residentLevel + 1, true);
+			return true;
+		}
+	};
+}
@@ -0,0 +1,453 @@
+#pragma once
+
+#include <deque>
+#include "VManager.h"
+
+
+namespace rj
+{
+	// Virtual textures of which only the tiles the screen samples are in device memory. The decoded mip chains stay on the host.
+	// Each level is split into tiles of @tileSize texels, which are copied with a border of @tileBorder texels of their
+	// neighbours into the slots of a physical cache image, one per format. A page table holds one entry per tile of every
+	// texture, pointing at the slot of the tile, or of its closest resident ancestor. The level that fits in a single tile,
+	// the tail, is never evicted. The renderer feeds back the pages the screen sampled, update() writes the missing tiles into
+	// staging memory, coarsest first, for the renderer to copy into the caches, and evicts the slots requested longest ago.
+	// An evicted slot is only reused after @retireFrameCount updates, when no frame in flight samples it through an older table
+	class VVirtualTextureCache
+	{
+	public:
+		static const uint32_t INVALID_HANDLE = std::numeric_limits<uint32_t>::max();
+		static const uint32_t INVALID_ENTRY = std::numeric_limits<uint32_t>::max(); // nothing of the texture is resident yet
+
+		// Copy of one tile from the staging memory of update() into a cache image
+		struct TileCopy
+		{
+			uint32_t image;
+			VkBufferImageCopy region;
+		};
+
+		// Pages requested in the last @keepFrames updates are never evicted. The caches are @cacheSize texels square
+		VVirtualTextureCache(VManager *pManager, uint32_t tileSize, uint32_t tileBorder, uint32_t cacheSize, uint32_t maxPageCount,
+			uint32_t uploadsPerFrame, uint32_t keepFrames, uint32_t retireFrameCount)
+			:
+			m_pManager(pManager),
+			m_tileSize(tileSize),
+			m_tileBorder(tileBorder),
+			m_slotSize(tileSize + 2 * tileBorder),
+			m_slotsPerSide(cacheSize / (tileSize + 2 * tileBorder)),
+			m_cacheSize(cacheSize),
+			m_maxPageCount(maxPageCount),
+			m_uploadsPerFrame(uploadsPerFrame),
+			m_keepFrames(keepFrames),
+			m_retireFrameCount(retireFrameCount)
+		{
+			assert(m_slotsPerSide > 0 && m_slotsPerSide < (1u << ENTRY_SLOT_BITS));
+		}
+
+		~VVirtualTextureCache()
+		{
+			for (const auto &cache : m_caches)
+			{
+				m_pManager->destroySampler(cache.texture.samplers[0]);
+				m_pManager->destroyImageView(cache.texture.imageViews[0]);
+				m_pManager->destroyImage(cache.texture.image);
+			}
+		}
+
+		// Virtualize @host, sampled as @format, under @key. A key that is already virtual returns its handle instead.
+		// Return INVALID_HANDLE for textures that are better left whole: those smaller than a tile, not a power of two in
+		// size, or whose blocks don't divide the tile border, and those that no longer fit the page table
+		uint32_t add(const std::string &key, const gli::texture2d &host, VkFormat format)
+		{
+			auto it = m_handles.find(key);
+			if (it != m_handles.end()) return it->second;
+
+			const gli::extent3d blockExtent = gli::block_extent(host.format());
+			const uint32_t blockWidth = static_cast<uint32_t>(blockExtent.x);
+			const uint32_t blockHeight = static_cast<uint32_t>(blockExtent.y);
+			const uint32_t width = static_cast<uint32_t>(host.extent(0).x);
+			const uint32_t height = static_cast<uint32_t>(host.extent(0).y);
+			auto isPowerOfTwo = [](uint32_t x) { return (x & (x - 1)) == 0; };
+			if (width < m_tileSize || height < m_tileSize || !isPowerOfTwo(width) || !isPowerOfTwo(height) ||
+				width > 0xFFFF || height > 0xFFFF || m_tileBorder % blockWidth != 0 || m_tileBorder % blockHeight != 0)
+			{
+				return INVALID_HANDLE;
+			}
+
+			Texture texture;
+			texture.host = host;
+			texture.width = width;
+			texture.height = height;
+			texture.firstPage = static_cast<uint32_t>(m_pageTable.size());
+			uint32_t pageCount = 0;
+			for (uint32_t level = 0; level < static_cast<uint32_t>(host.levels()); ++level)
+			{
+				const uint32_t levelWidth = std::max(width >> level, 1u);
+				const uint32_t levelHeight = std::max(height >> level, 1u);
+				texture.levelFirstPages.push_back(pageCount);
+				texture.levelTilesX.push_back(std::max(levelWidth / m_tileSize, 1u));
+				texture.levelTilesY.push_back(std::max(levelHeight / m_tileSize, 1u));
+				pageCount += texture.levelTilesX.back() * texture.levelTilesY.back();
+				if (levelWidth <= m_tileSize && levelHeight <= m_tileSize) break;
+			}
+			texture.levelCount = static_cast<uint32_t>(texture.levelFirstPages.size());
+			const uint32_t tailLevel = texture.levelCount - 1;
+			if (std::max(width >> tailLevel, 1u) < blockWidth || std::max(height >> tailLevel, 1u) < blockHeight ||
+				(width >> tailLevel) > m_tileSize || (height >> tailLevel) > m_tileSize || texture.firstPage + pageCount > m_maxPageCount)
+			{
+				return INVALID_HANDLE;
+			}
+			texture.cache = getCache(format, host.format());
+
+			const uint32_t handle = static_cast<uint32_t>(m_textures.size());
+			m_pageTable.resize(texture.firstPage + pageCount, INVALID_ENTRY);
+			m_pages.resize(texture.firstPage + pageCount);
+			for (uint32_t level = 0; level < texture.levelCount; ++level)
+			{
+				for (uint32_t y = 0; y < texture.levelTilesY[level]; ++y)
+				{
+					for (uint32_t x = 0; x < texture.levelTilesX[level]; ++x)
+					{
+						Page &page = m_pages[getPage(texture, level, x, y)];
+						page.texture = handle;
+						page.level = level;
+						page.x = x;
+						page.y = y;
+					}
+				}
+			}
+			// The tail is always wanted and never evicted
+			const uint32_t tailPage = getPage(texture, tailLevel, 0, 0);
+			m_pages[tailPage].lastRequestFrame = std::numeric_limits<uint64_t>::max();
+			m_tailPages.push_back(tailPage);
+
+			m_textures.push_back(std::move(texture));
+			m_handles[key] = handle;
+			++m_pageTableVersion;
+			return handle;
+		}
+
+		// The cache image the texture is sampled from, with a linear sampler clamped to its edges
+		const helper_functions::ImageWrapper &getTexture(uint32_t handle) const { return m_caches.at(m_textures.at(handle).cache).texture; }
+		uint32_t getTextureCount() const { return static_cast<uint32_t>(m_textures.size()); }
+		// Page of the first tile of level 0. The tiles of a level follow row by row, and the levels follow each other
+		uint32_t getFirstPage(uint32_t handle) const { return m_textures.at(handle).firstPage; }
+		// Width in the low and height in the high 16 bits, the shaders derive the tile counts and the tail level from it
+		uint32_t getPackedExtent(uint32_t handle) const { return m_textures.at(handle).width | (m_textures.at(handle).height << 16); }
+
+		// One entry per page: slot x in bits 0-9, slot y in bits 10-19 and the level of the tile in the slot from bit 20,
+		// or INVALID_ENTRY. Changes with getPageTableVersion()
+		const uint32_t *getPageTable() const { return m_pageTable.data(); }
+		uint32_t getPageCount() const { return static_cast<uint32_t>(m_pageTable.size()); }
+		uint64_t getPageTableVersion() const { return m_pageTableVersion; }
+		uint32_t getResidentCount() const { return m_residentCount; }
+
+		// Bytes of staging memory update() may write, for @uploadsPerFrame tiles of up to @maxBlockSize bytes per texel
+		VkDeviceSize getStagingSize(uint32_t maxBlockSize) const
+		{
+			return static_cast<VkDeviceSize>(m_uploadsPerFrame) * (m_slotSize * m_slotSize * maxBlockSize + 16);
+		}
+
+		// Ask for @page, as the feedback of the screen reports it, along with its ancestors. Out of range pages are ignored
+		void request(uint32_t page)
+		{
+			if (page >= m_pages.size()) return;
+
+			const Page &first = m_pages[page];
+			const Texture &texture = m_textures[first.texture];
+			uint32_t x = first.x;
+			uint32_t y = first.y;
+			for (uint32_t level = first.level; level < texture.levelCount; ++level, x >>= 1, y >>= 1)
+			{
+				Page &ancestor = m_pages[getPage(texture, level, x, y)];
+				if (ancestor.lastRequestFrame > m_frame) break; // already requested, and so are the ancestors after it
+				ancestor.lastRequestFrame = m_frame + 1;
+				m_requested.push_back(getPage(texture, level, x, y));
+			}
+		}
+
+		// Call once per frame, after the requests of the frame. Writes the tiles to upload into @pStaging, at most @stagingSize
+		// bytes, and appends their copies. @maxUploads lowers @uploadsPerFrame for this frame, e.g. to what its GPU time
+		// allows. Return true if the page table changed
+		bool update(void *pStaging, VkDeviceSize stagingSize, std::vector<TileCopy> *pCopies,
+			uint32_t maxUploads = std::numeric_limits<uint32_t>::max())
+		{
+			const uint32_t uploadLimit = std::min(m_uploadsPerFrame, maxUploads);
+			++m_frame;
+			for (auto &cache : m_caches)
+			{
+				while (!cache.retiredSlots.empty() && cache.retiredSlots.front().frame <= m_frame)
+				{
+					cache.freeSlots.push_back(cache.retiredSlots.front().slot);
+					cache.retiredSlots.pop_front();
+				}
+			}
+
+			m_missing.clear();
+			for (uint32_t page : m_tailPages)
+			{
+				if (m_pages[page].slot == INVALID_SLOT) m_missing.push_back(page);
+			}
+			for (uint32_t page : m_requested)
+			{
+				if (m_pages[page].slot == INVALID_SLOT && m_pages[page].lastRequestFrame != std::numeric_limits<uint64_t>::max())
+				{
+					m_missing.push_back(page);
+				}
+			}
+			m_requested.clear();
+			std::stable_sort(m_missing.begin(), m_missing.end(), [this](uint32_t a, uint32_t b) { return m_pages[a].level > m_pages[b].level; });
+
+			const uint64_t pageTableVersion = m_pageTableVersion;
+			char *pDst = static_cast<char *>(pStaging);
+			VkDeviceSize offset = 0;
+			uint32_t uploadCount = 0;
+			for (uint32_t page : m_missing)
+			{
+				if (uploadCount >= uploadLimit) break;
+
+				const Texture &texture = m_textures[m_pages[page].texture];
+				Cache &cache = m_caches[texture.cache];
+				if (cache.freeSlots.empty())
+				{
+					// The slot only comes back once the frames that may sample it are done, the page is requested again by then.
+					// Evictions count against the uploads, so a full cache isn't emptied in one go
+					evict(cache);
+					++uploadCount;
+					continue;
+				}
+
+				const VkDeviceSize alignedOffset = (offset + cache.copyAlignment - 1) / cache.copyAlignment * cache.copyAlignment;
+				const VkDeviceSize bytes = static_cast<VkDeviceSize>(m_slotSize / cache.blockWidth) * (m_slotSize / cache.blockHeight) * cache.blockSize;
+				if (alignedOffset + bytes > stagingSize) break;
+
+				const uint32_t slot = cache.freeSlots.back();
+				cache.freeSlots.pop_back();
+				writeTile(texture, cache, m_pages[page], pDst + alignedOffset);
+
+				TileCopy copy = {};
+				copy.image = cache.texture.image;
+				copy.region.bufferOffset = alignedOffset;
+				copy.region.bufferRowLength = m_slotSize;
+				copy.region.bufferImageHeight = m_slotSize;
+				copy.region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+				copy.region.imageOffset = { static_cast<int32_t>(slot % m_slotsPerSide * m_slotSize), static_cast<int32_t>(slot / m_slotsPerSide * m_slotSize), 0 };
+				copy.region.imageExtent = { m_slotSize, m_slotSize, 1 };
+				pCopies->push_back(copy);
+
+				m_pages[page].slot = slot;
+				cache.slotPages[slot] = page;
+				++m_residentCount;
+				updateEntries(page);
+				offset = alignedOffset + bytes;
+				++uploadCount;
+			}
+
+			return m_pageTableVersion != pageTableVersion;
+		}
+
+	protected:
+		static const uint32_t INVALID_SLOT = std::numeric_limits<uint32_t>::max();
+		static const uint32_t ENTRY_SLOT_BITS = 10;
+
+		struct Texture
+		{
+			gli::texture2d host; // every level, level 0 first
+			uint32_t cache;
+			uint32_t width;
+			uint32_t height;
+			uint32_t firstPage;
+			uint32_t levelCount; // levels with pages, the last one is the tail
+			std::vector<uint32_t> levelFirstPages; // relative to @firstPage
+			std::vector<uint32_t> levelTilesX;
+			std::vector<uint32_t> levelTilesY;
+		};
+
+		struct Page
+		{
+			uint32_t texture = 0;
+			uint32_t level = 0;
+			uint32_t x = 0;
+			uint32_t y = 0;
+			uint32_t slot = INVALID_SLOT;
+			uint64_t lastRequestFrame = 0; // update() frame, 0 if never requested. The tails are at the maximum
+		};
+
+		struct RetiredSlot
+		{
+			uint32_t slot;
+			uint64_t frame; // free again from the update of this frame
+		};
+
+		struct Cache
+		{
+			VkFormat format;
+			helper_functions::ImageWrapper texture;
+			uint32_t blockWidth;
+			uint32_t blockHeight;
+			uint32_t blockSize; // bytes
+			VkDeviceSize copyAlignment; // of buffer offsets, a multiple of 4 and of @blockSize
+			std::vector<uint32_t> slotPages; // INVALID_SLOT for free slots
+			std::vector<uint32_t> freeSlots;
+			std::deque<RetiredSlot> retiredSlots; // oldest first
+		};
+
+		VManager *m_pManager;
+		uint32_t m_tileSize;
+		uint32_t m_tileBorder;
+		uint32_t m_slotSize; // tile and border on both sides
+		uint32_t m_slotsPerSide;
+		uint32_t m_cacheSize;
+		uint32_t m_maxPageCount;
+		uint32_t m_uploadsPerFrame;
+		uint32_t m_keepFrames;
+		uint32_t m_retireFrameCount;
+
+		std::vector<Texture> m_textures;
+		std::unordered_map<std::string, uint32_t> m_handles; // by key
+		std::vector<Cache> m_caches;
+		std::vector<Page> m_pages;
+		std::vector<uint32_t> m_pageTable;
+		std::vector<uint32_t> m_tailPages;
+		std::vector<uint32_t> m_requested; // since the last update
+		std::vector<uint32_t> m_missing; // scratch of update(), kept to not allocate per call
+		uint64_t m_pageTableVersion = 0;
+		uint64_t m_frame = 0;
+		uint32_t m_residentCount = 0;
+
+		static uint32_t getPage(const Texture &texture, uint32_t level, uint32_t x, uint32_t y)
+		{
+			return texture.firstPage + texture.levelFirstPages[level] + y * texture.levelTilesX[level] + x;
+		}
+
+		// Create the cache of @format on first use. Its slots are all free and it starts out in SHADER_READ_ONLY_OPTIMAL
+		uint32_t getCache(VkFormat format, gli::format gliFormat)
+		{
+			for (uint32_t i = 0; i < m_caches.size(); ++i)
+			{
+				if (m_caches[i].format == format) return i;
+			}
+
+			Cache cache;
+			cache.format = format;
+			const gli::extent3d blockExtent = gli::block_extent(gliFormat);
+			cache.blockWidth = static_cast<uint32_t>(blockExtent.x);
+			cache.blockHeight = static_cast<uint32_t>(blockExtent.y);
+			cache.blockSize = static_cast<uint32_t>(gli::block_size(gliFormat));
+			cache.copyAlignment = cache.blockSize;
+			while (cache.copyAlignment % 4 != 0) cache.copyAlignment += cache.blockSize;
+
+			const uint32_t slotCount = m_slotsPerSide * m_slotsPerSide;
+			cache.slotPages.assign(slotCount, INVALID_SLOT);
+			for (uint32_t slot = slotCount; slot > 0; --slot)
+			{
+				cache.freeSlots.push_back(slot - 1);
+			}
+
+			auto &texture = cache.texture;
+			texture.format = format;
+			texture.width = m_cacheSize;
+			texture.height = m_cacheSize;
+			texture.image = m_pManager->createImage2D(m_cacheSize, m_cacheSize, format, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, 1, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+			texture.imageViews.push_back(m_pManager->createImageView2D(texture.image, VK_IMAGE_ASPECT_COLOR_BIT));
+			// The borders hold the neighbouring texels, so bilinear filtering never reaches into the next slot
+			texture.samplers.push_back(m_pManager->createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+				VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+				0.f, 0.f, 0.f, VK_FALSE, 1.f));
+
+			m_pManager->beginUploadBatch();
+			m_pManager->uploadBatchAddImageLayoutTransition(texture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			m_pManager->endUploadBatch();
+
+			m_caches.push_back(std::move(cache));
+			return static_cast<uint32_t>(m_caches.size() - 1);
+		}
+
+		// Copy the blocks of the tile and its border into @pDst, wrapping around the edges of the level like a repeating sampler
+		void writeTile(const Texture &texture, const Cache &cache, const Page &page, char *pDst) const
+		{
+			const uint32_t levelWidth = std::max(texture.width >> page.level, 1u);
+			const uint32_t levelHeight = std::max(texture.height >> page.level, 1u);
+			const uint32_t levelBlocksX = (levelWidth + cache.blockWidth - 1) / cache.blockWidth;
+			const uint32_t levelBlocksY = (levelHeight + cache.blockHeight - 1) / cache.blockHeight;
+			const uint32_t slotBlocksX = m_slotSize / cache.blockWidth;
+			const uint32_t slotBlocksY = m_slotSize / cache.blockHeight;
+			// A whole number of levels keeps the origin minus the border from going negative, the modulo below takes it off again
+			const uint32_t originX = page.x * (m_tileSize / cache.blockWidth) + levelBlocksX * slotBlocksX - m_tileBorder / cache.blockWidth;
+			const uint32_t originY = page.y * (m_tileSize / cache.blockHeight) + levelBlocksY * slotBlocksY - m_tileBorder / cache.blockHeight;
+			const char *pSrc = static_cast<const char *>(texture.host.data(0, 0, page.level));
+			const size_t srcRowPitch = static_cast<size_t>(levelBlocksX) * cache.blockSize;
+
+			for (uint32_t row = 0; row < slotBlocksY; ++row)
+			{
+				const char *pSrcRow = pSrc + (originY + row) % levelBlocksY * srcRowPitch;
+				// Runs of blocks that don't wrap are copied at once
+				uint32_t column = 0;
+				while (column < slotBlocksX)
+				{
+					const uint32_t srcX = (originX + column) % levelBlocksX;
+					const uint32_t runLength = std::min(slotBlocksX - column, levelBlocksX - srcX);
+					memcpy(pDst, pSrcRow + static_cast<size_t>(srcX) * cache.blockSize, static_cast<size_t>(runLength) * cache.blockSize);
+					pDst += static_cast<size_t>(runLength) * cache.blockSize;
+					column += runLength;
+				}
+			}
+		}
+
+		// Make room in @cache by evicting the resident page requested longest ago, unless it was requested in the last
+		// @m_keepFrames updates. Tails are never evicted
+		void evict(Cache &cache)
+		{
+			uint32_t oldestSlot = INVALID_SLOT;
+			uint64_t oldestFrame = m_frame > m_keepFrames ? m_frame - m_keepFrames : 0;
+			for (uint32_t slot = 0; slot < cache.slotPages.size(); ++slot)
+			{
+				const uint32_t page = cache.slotPages[slot];
+				if (page == INVALID_SLOT || m_pages[page].lastRequestFrame >= oldestFrame) continue;
+				oldestSlot = slot;
+				oldestFrame = m_pages[page].lastRequestFrame;
+			}
+			if (oldestSlot == INVALID_SLOT) return;
+
+			const uint32_t page = cache.slotPages[oldestSlot];
+			m_pages[page].slot = INVALID_SLOT;
+			cache.slotPages[oldestSlot] = INVALID_SLOT;
+			cache.retiredSlots.push_back({ oldestSlot, m_frame + m_retireFrameCount });
+			--m_residentCount;
+			updateEntries(page);
+		}
+
+		// Point the entries of @page and of the pages below it at their closest resident tile
+		void updateEntries(uint32_t page)
+		{
+			const Page &root = m_pages[page];
+			const Texture &texture = m_textures[root.texture];
+			for (uint32_t level = root.level + 1; level-- > 0;)
+			{
+				const uint32_t shift = root.level - level;
+				const uint32_t x1 = std::min((root.x + 1) << shift, texture.levelTilesX[level]);
+				const uint32_t y1 = std::min((root.y + 1) << shift, texture.levelTilesY[level]);
+				for (uint32_t y = root.y << shift; y < y1; ++y)
+				{
+					for (uint32_t x = root.x << shift; x < x1; ++x)
+					{
+						m_pageTable[getPage(texture, level, x, y)] = findEntry(texture, level, x, y);
+					}
+				}
+			}
+			++m_pageTableVersion;
+		}
+
+		uint32_t findEntry(const Texture &texture, uint32_t level, uint32_t x, uint32_t y) const
+		{
+			for (; level < texture.levelCount; ++level, x >>= 1, y >>= 1)
+			{
+				const uint32_t slot = m_pages[getPage(texture, level, x, y)].slot;
+				if (slot == INVALID_SLOT) continue;
+				return slot % m_slotsPerSide | (slot / m_slotsPerSide) << ENTRY_SLOT_BITS | level << (2 * ENTRY_SLOT_BITS);
+			}
+			return INVALID_ENTRY;
+		}
+	};
+}
@@ -22,7 +22,8 @@ namespace rj
 			GLFWmousebuttonfun onMouseClicked = nullptr,
 			GLFWcursorposfun onCursorMoved = nullptr,
 			GLFWscrollfun onScroll = nullptr,
-			GLFWwindowsizefun onWindowResized = nullptr)
+			GLFWwindowsizefun onWindowResized = nullptr,
+			bool headless = false)
 			:
 			m_instance(inst),
 			m_width(width), m_height(height),
@@ -33,8 +34,12 @@ namespace rj
 			m_onCursorMoved(onCursorMoved),
 			m_onKeyPressed(onKeyPressed),
 			m_onScroll(onScroll),
+			m_headless(headless),
 			m_surface{ m_instance, vkDestroySurfaceKHR }
 		{
+			// Without a window there is nothing to present to, the swapchain renders into offscreen images
+			if (m_headless) return;
+
 			initWindow();
 			createSurface();
 		}
@@ -55,16 +60,27 @@ namespace rj
 			return m_window;
 		}
 
+		// No GLFW window or surface, which also works on machines without a display
+		bool isHeadless() const { return m_headless; }
+
 		void getExtent(uint32_t *pWidth, uint32_t *pHeight) const
 		{
 			*pWidth = m_width;
 			*pHeight = m_height;
 		}
 
+		// A window's extent follows its surface, so only a headless one can be resized
+		void setHeadlessExtent(uint32_t width, uint32_t height)
+		{
+			assert(m_headless);
+			m_width = width;
+			m_height = height;
+		}
+
 		void setWindowTitle(const std::string &title)
 		{
 			m_windowTitle = title;
-			glfwSetWindowTitle(m_window, m_windowTitle.c_str());
+			if (m_window) glfwSetWindowTitle(m_window, m_windowTitle.c_str());
 		}
 
 		static std::vector<const char *> getRequiredExtensions()
@@ -100,7 +116,7 @@ namespace rj
 
 		void createSurface()
 		{
-			if (glfwCreateWindowSurface(m_instance, m_window, nullptr, m_surface.replace()) != VK_SUCCESS)
+			if (glfwCreateWindowSurface(m_instance, m_window, helper_functions::getHostAllocationCallbacks(), m_surface.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create window surface!");
 			}
@@ -120,6 +136,7 @@ namespace rj
 		GLFWkeyfun m_onKeyPressed;
 		GLFWscrollfun m_onScroll;
 
-		VDeleter<VkSurfaceKHR> m_surface;
+		bool m_headless;
+		VDeleter<VkSurfaceKHR> m_surface; // VK_NULL_HANDLE if headless
 	};
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include "ab_experiment.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "frame_statistics.h"
+
+
+namespace
+{
+	// Two-sided 95% quantile of Student's t distribution with @df degrees of freedom
+	double tQuantile95(double df)
+	{
+		static const double table[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+			2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+			2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+		if (df >= 30.0) return 1.96 + 2.4 / df; // close to the exact value from 30 on
+		return table[std::max(static_cast<int>(df), 1) - 1]; // rounding down errs on the wide side
+	}
+
+	void getMeanAndVariance(const std::vector<double> &samples, double *pMean, double *pVariance)
+	{
+		double sum = 0.0;
+		for (double s : samples) sum += s;
+		*pMean = samples.empty() ? 0.0 : sum / samples.size();
+
+		double squares = 0.0;
+		for (double s : samples) squares += (s - *pMean) * (s - *pMean);
+		*pVariance = samples.size() > 1 ? squares / (samples.size() - 1) : 0.0;
+	}
+}
+
+void ABExperiment::start(uint32_t blockFrames, uint32_t settleFrames)
+{
+	running = true;
+	blockFrameCount = std::max(blockFrames, settleFrames + 1);
+	settleFrameCount = settleFrames;
+	block = 0;
+	frameInBlock = 0;
+	metrics.clear();
+}
+
+bool ABExperiment::addFrame(float cpuMS, float gpuMS, const std::vector<std::pair<std::string, float>> &passMS)
+{
+	if (!running) return false;
+
+	if (frameInBlock >= settleFrameCount)
+	{
+		addSample("cpu", cpuMS);
+		if (gpuMS >= 0.f) addSample("gpu", gpuMS);
+		for (const auto &pass : passMS) addSample(pass.first, pass.second);
+	}
+
+	if (++frameInBlock < blockFrameCount) return false;
+
+	endBlock();
+	frameInBlock = 0;
+	++block;
+	return getBlockConfig(block) != getBlockConfig(block - 1);
+}
+
+void ABExperiment::addSample(const std::string &name, float ms)
+{
+	auto it = std::find_if(metrics.begin(), metrics.end(), [&name](const Metric &m) { return m.name == name; });
+	if (it == metrics.end())
+	{
+		metrics.emplace_back();
+		metrics.back().name = name;
+		it = metrics.end() - 1;
+	}
+
+	it->frames[getConfig()].push_back(ms);
+	it->blockSum += ms;
+	++it->blockFrames;
+}
+
+void ABExperiment::endBlock()
+{
+	const uint32_t config = getConfig();
+	for (auto &metric : metrics)
+	{
+		if (metric.blockFrames == 0) continue;
+		metric.blockMeans[config].push_back(metric.blockSum / metric.blockFrames);
+		metric.blockSum = 0.0;
+		metric.blockFrames = 0;
+	}
+}
+
+std::vector<ABExperiment::Comparison> ABExperiment::getComparisons(bool percentiles) const
+{
+	std::vector<Comparison> comparisons;
+	for (const auto &metric : metrics)
+	{
+		Comparison c;
+		c.name = metric.name;
+
+		double variances[2];
+		Stats *stats[2] = { &c.a, &c.b };
+		for (uint32_t config = 0; config < 2; ++config)
+		{
+			Stats &s = *stats[config];
+			s.blockCount = metric.blockMeans[config].size();
+			s.frameCount = metric.frames[config].size();
+			getMeanAndVariance(metric.blockMeans[config], &s.mean, &variances[config]);
+			if (!percentiles) continue;
+			const FrameStatistics::Percentiles p = FrameStatistics::computePercentiles(metric.frames[config]);
+			s.p50 = p.p50;
+			s.p95 = p.p95;
+		}
+		c.delta = c.b.mean - c.a.mean;
+
+		// Welch's t-interval, the two configurations may differ in variance
+		c.ci95 = -1.0;
+		if (c.a.blockCount > 1 && c.b.blockCount > 1)
+		{
+			const double va = variances[0] / c.a.blockCount;
+			const double vb = variances[1] / c.b.blockCount;
+			const double se = std::sqrt(va + vb);
+			const double dfDenominator = va * va / (c.a.blockCount - 1) + vb * vb / (c.b.blockCount - 1);
+			const double df = dfDenominator > 0.0 ? (va + vb) * (va + vb) / dfDenominator : 1e9;
+			c.ci95 = tQuantile95(df) * se;
+		}
+		comparisons.push_back(c);
+	}
+	return comparisons;
+}
+
+bool ABExperiment::saveCsv(const std::string &fileName, const std::string &configA, const std::string &configB) const
+{
+	std::ofstream file(fileName);
+	if (!file.is_open()) return false;
+
+	// Confidence intervals are empty until both configurations have two blocks
+	file << "# A: " << configA << "\n# B: " << configB << "\n";
+	file << "metric,blocks_a,blocks_b,mean_a_ms,mean_b_ms,p50_a_ms,p50_b_ms,p95_a_ms,p95_b_ms,delta_ms,delta_percent,ci95_ms,significant\n";
+	for (const auto &c : getComparisons())
+	{
+		file << c.name << "," << c.a.blockCount << "," << c.b.blockCount << "," << c.a.mean << "," << c.b.mean << "," <<
+			c.a.p50 << "," << c.b.p50 << "," << c.a.p95 << "," << c.b.p95 << "," << c.delta << ",";
+		if (c.a.mean > 0.0) file << 100.0 * c.delta / c.a.mean;
+		file << ",";
+		if (c.ci95 >= 0.0) file << c.ci95;
+		file << "," << (c.isSignificant() ? "yes" : "no") << "\n";
+	}
+
+	return file.good();
+}
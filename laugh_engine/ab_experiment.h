@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Alternates two configurations, A and B, in blocks of frames and compares their frame and pass times. Blocks go
+// A B B A A B B A..., which cancels a linear drift, e.g. of clocks or temperature, between the two. The first frames of
+// a block are left out, their timings still belong to the other configuration. The samples compared are the block means
+// rather than the frames, so the correlation between neighbouring frames does not narrow the confidence intervals
+class ABExperiment
+{
+public:
+	struct Stats
+	{
+		size_t blockCount = 0;
+		size_t frameCount = 0;
+		double mean = 0.0; // of the block means
+		float p50 = 0.f; // of the frames
+		float p95 = 0.f;
+	};
+
+	struct Comparison
+	{
+		std::string name; // "cpu", "gpu" or the path of a GPU scope
+		Stats a, b;
+		double delta = 0.0; // mean of B minus mean of A
+		double ci95 = 0.0; // half width of the 95% confidence interval of @delta, negative until both have two blocks
+
+		bool isSignificant() const { return ci95 >= 0.0 && (delta > ci95 || delta < -ci95); }
+	};
+
+	void start(uint32_t blockFrames, uint32_t settleFrames);
+	void stop() { running = false; }
+	bool isRunning() const { return running; }
+
+	// Configuration the next frame is rendered with, 0 for A and 1 for B
+	uint32_t getConfig() const { return getBlockConfig(block); }
+	uint32_t getBlock() const { return block; }
+
+	// Times of the frame just rendered, @gpuMS negative if unknown. Return true if the next frame switches configurations
+	bool addFrame(float cpuMS, float gpuMS, const std::vector<std::pair<std::string, float>> &passMS);
+
+	// "cpu" and "gpu" first, then the passes in the order they were first seen. Without @percentiles p50 and p95 are left at
+	// zero, which saves sorting every frame so far, e.g. for an overlay updated while the comparison runs
+	std::vector<Comparison> getComparisons(bool percentiles = true) const;
+	bool saveCsv(const std::string &fileName, const std::string &configA, const std::string &configB) const;
+
+protected:
+	struct Metric
+	{
+		std::string name;
+		std::vector<float> frames[2];
+		std::vector<double> blockMeans[2];
+		double blockSum = 0.0; // of the current block
+		uint32_t blockFrames = 0;
+	};
+
+	bool running = false;
+	uint32_t blockFrameCount = 0;
+	uint32_t settleFrameCount = 0;
+	uint32_t block = 0;
+	uint32_t frameInBlock = 0;
+	std::vector<Metric> metrics;
+
+	static uint32_t getBlockConfig(uint32_t block) { return ((block + 1) / 2) % 2; }
+	void addSample(const std::string &name, float ms);
+	void endBlock();
+};
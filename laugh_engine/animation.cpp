@@ -0,0 +1,161 @@
+#include "animation.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include "glm/gtc/matrix_transform.hpp"
+#include "gltf_loader.h"
+
+
+void Animator::load(const rj::GLTFScene &scene)
+{
+	nodes.resize(scene.nodes.size());
+	restWeights.clear();
+	for (size_t i = 0; i < scene.nodes.size(); ++i)
+	{
+		const rj::GLTFNode &src = scene.nodes[i];
+		Node &node = nodes[i];
+		node.parent = src.parent;
+		node.translation = src.translation;
+		node.rotation = src.rotation;
+		node.scale = src.scale;
+		node.firstWeight = src.weights.empty() ? INVALID_INDEX : static_cast<uint32_t>(restWeights.size());
+		node.weightCount = static_cast<uint32_t>(src.weights.size());
+		restWeights.insert(restWeights.end(), src.weights.begin(), src.weights.end());
+	}
+
+	nodeOrder.clear();
+	std::function<void(uint32_t)> visit = [&](uint32_t n)
+	{
+		nodeOrder.push_back(n);
+		for (uint32_t child : scene.nodes[n].children) visit(child);
+	};
+	for (uint32_t n = 0; n < static_cast<uint32_t>(nodes.size()); ++n)
+	{
+		if (nodes[n].parent == INVALID_INDEX) visit(n);
+	}
+
+	jointNodes.clear();
+	inverseBindMatrices.clear();
+	skinFirstJoints.clear();
+	for (const auto &skin : scene.skins)
+	{
+		skinFirstJoints.push_back(static_cast<uint32_t>(jointNodes.size()));
+		jointNodes.insert(jointNodes.end(), skin.joints.begin(), skin.joints.end());
+		inverseBindMatrices.insert(inverseBindMatrices.end(), skin.inverseBindMatrices.begin(), skin.inverseBindMatrices.end());
+	}
+
+	clips.clear();
+	for (const auto &animation : scene.animations)
+	{
+		Clip clip;
+		clip.name = animation.name;
+		clip.duration = animation.duration;
+		for (const auto &s : animation.samplers)
+		{
+			clip.samplers.push_back({ s.times, s.values, static_cast<uint32_t>(s.values.size() / s.times.size()), s.step });
+		}
+		for (const auto &c : animation.channels)
+		{
+			if (c.node >= nodes.size() || c.sampler >= clip.samplers.size())
+			{
+				throw std::runtime_error("Animation channel out of range");
+			}
+			clip.channels.push_back({ c.node, static_cast<uint32_t>(c.path), c.sampler });
+		}
+		clips.push_back(std::move(clip));
+	}
+}
+
+void Animator::resetPose(Pose *pPose) const
+{
+	const size_t count = nodes.size();
+	pPose->translations.resize(count);
+	pPose->rotations.resize(count);
+	pPose->scales.resize(count);
+	pPose->globals.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		pPose->translations[i] = nodes[i].translation;
+		pPose->rotations[i] = nodes[i].rotation;
+		pPose->scales[i] = nodes[i].scale;
+	}
+	pPose->weights = restWeights;
+}
+
+void Animator::sampleChannels(uint32_t clip, float time, uint32_t begin, uint32_t end, Pose *pPose) const
+{
+	const Clip &c = clips[clip];
+	const float t = c.duration > 0.f ? std::fmod(std::max(time, 0.f), c.duration) : 0.f;
+
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		const Channel &channel = c.channels[i];
+		const Sampler &sampler = c.samplers[channel.sampler];
+		const uint32_t n = sampler.componentCount;
+
+		// Keys k0 and k1 around t, blended by alpha
+		const auto it = std::upper_bound(sampler.times.begin(), sampler.times.end(), t);
+		const size_t k1 = std::min(static_cast<size_t>(it - sampler.times.begin()), sampler.times.size() - 1);
+		const size_t k0 = k1 > 0 ? k1 - 1 : 0;
+		float alpha = 0.f;
+		if (k1 != k0 && !sampler.step)
+		{
+			alpha = glm::clamp((t - sampler.times[k0]) / (sampler.times[k1] - sampler.times[k0]), 0.f, 1.f);
+		}
+		else if (k1 != k0 && t >= sampler.times[k1])
+		{
+			alpha = 1.f;
+		}
+		const float *v0 = &sampler.values[k0 * n];
+		const float *v1 = &sampler.values[k1 * n];
+
+		switch (channel.path)
+		{
+		case rj::GLTF_PATH_TRANSLATION:
+			pPose->translations[channel.node] = glm::mix(glm::vec3(v0[0], v0[1], v0[2]), glm::vec3(v1[0], v1[1], v1[2]), alpha);
+			break;
+		case rj::GLTF_PATH_ROTATION:
+			// Keys are stored x, y, z, w
+			pPose->rotations[channel.node] = glm::normalize(glm::slerp(
+				glm::quat(v0[3], v0[0], v0[1], v0[2]), glm::quat(v1[3], v1[0], v1[1], v1[2]), alpha));
+			break;
+		case rj::GLTF_PATH_SCALE:
+			pPose->scales[channel.node] = glm::mix(glm::vec3(v0[0], v0[1], v0[2]), glm::vec3(v1[0], v1[1], v1[2]), alpha);
+			break;
+		case rj::GLTF_PATH_WEIGHTS:
+		{
+			const Node &node = nodes[channel.node];
+			if (node.firstWeight == INVALID_INDEX) break;
+			for (uint32_t w = 0; w < std::min(n, node.weightCount); ++w)
+			{
+				pPose->weights[node.firstWeight + w] = glm::mix(v0[w], v1[w], alpha);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+void Animator::updateGlobals(Pose *pPose) const
+{
+	const glm::mat4 I; // identity
+	for (uint32_t n : nodeOrder)
+	{
+		const glm::mat4 local = glm::translate(I, pPose->translations[n]) * glm::mat4_cast(pPose->rotations[n]) *
+			glm::scale(I, pPose->scales[n]);
+		const uint32_t parent = nodes[n].parent;
+		pPose->globals[n] = parent != INVALID_INDEX ? pPose->globals[parent] * local : local;
+	}
+}
+
+void Animator::computeJointMatrices(const Pose &pose, uint32_t begin, uint32_t end, glm::mat4 *dst) const
+{
+	for (uint32_t j = begin; j < end; ++j)
+	{
+		dst[j - begin] = pose.globals[jointNodes[j]] * inverseBindMatrices[j];
+	}
+}
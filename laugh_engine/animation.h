@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+namespace rj
+{
+	struct GLTFScene;
+}
+
+
+// Skeletons, morph target weights and animation clips of a glTF 2.0 file, sampled on the CPU. load() copies what it needs,
+// so the Animator outlives the file. Nothing is written after load(), the sampled state lives in a Pose, and the functions
+// that fill one work on ranges, so a frame can sample a pose as parallel tasks
+class Animator
+{
+public:
+	static const uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+
+	struct Pose
+	{
+		std::vector<glm::vec3> translations; // local transform of every node
+		std::vector<glm::quat> rotations;
+		std::vector<glm::vec3> scales;
+		std::vector<glm::mat4> globals; // node to scene space, by updateGlobals()
+		std::vector<float> weights; // morph target weights of all nodes, see getFirstWeight
+	};
+
+	void load(const rj::GLTFScene &scene);
+
+	uint32_t getClipCount() const { return static_cast<uint32_t>(clips.size()); }
+	const std::string &getClipName(uint32_t clip) const { return clips[clip].name; }
+	float getClipDuration(uint32_t clip) const { return clips[clip].duration; }
+	uint32_t getChannelCount(uint32_t clip) const { return static_cast<uint32_t>(clips[clip].channels.size()); }
+
+	// Joints of all skins, one skin after the other
+	uint32_t getJointCount() const { return static_cast<uint32_t>(jointNodes.size()); }
+	uint32_t getFirstJoint(uint32_t skin) const { return skinFirstJoints[skin]; }
+	// Morph target weights of all nodes, one node after the other. INVALID_INDEX for nodes without morph targets
+	uint32_t getWeightCount() const { return static_cast<uint32_t>(restWeights.size()); }
+	uint32_t getFirstWeight(uint32_t node) const { return nodes[node].firstWeight; }
+
+	// Size @pPose and set it to the rest pose. Channels of a clip only overwrite what they animate
+	void resetPose(Pose *pPose) const;
+	// Write channels [@begin, @end) of @clip at @time seconds, looped over the clip, to the local transforms or weights of their nodes.
+	// No two channels of a clip have the same target, so disjoint ranges can be sampled at the same time
+	void sampleChannels(uint32_t clip, float time, uint32_t begin, uint32_t end, Pose *pPose) const;
+	// Global matrices of all nodes from their local transforms, parents first
+	void updateGlobals(Pose *pPose) const;
+	// Global matrix times inverse bind matrix of joints [@begin, @end), written to @dst[0] to @dst[@end - @begin - 1]
+	void computeJointMatrices(const Pose &pose, uint32_t begin, uint32_t end, glm::mat4 *dst) const;
+
+protected:
+	struct Node
+	{
+		uint32_t parent;
+		glm::vec3 translation;
+		glm::quat rotation;
+		glm::vec3 scale;
+		uint32_t firstWeight;
+		uint32_t weightCount;
+	};
+
+	struct Sampler
+	{
+		std::vector<float> times;
+		std::vector<float> values; // @componentCount per key
+		uint32_t componentCount;
+		bool step;
+	};
+
+	struct Channel
+	{
+		uint32_t node;
+		uint32_t path; // rj::GLTFAnimationPath
+		uint32_t sampler;
+	};
+
+	struct Clip
+	{
+		std::string name;
+		float duration;
+		std::vector<Channel> channels;
+		std::vector<Sampler> samplers;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> nodeOrder; // parents before their children
+	std::vector<float> restWeights;
+	std::vector<uint32_t> jointNodes;
+	std::vector<glm::mat4> inverseBindMatrices; // one per joint
+	std::vector<uint32_t> skinFirstJoints;
+	std::vector<Clip> clips;
+};
@@ -0,0 +1,189 @@
+#include "asset_pack.h"
+
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <unordered_set>
+
+
+namespace
+{
+	std::vector<std::unique_ptr<AssetPack>> g_mountedPacks; // searched first to last
+
+	std::mutex g_recordingMutex;
+	bool g_recording = false;
+	std::vector<std::string> g_recordedFileNames;
+	std::unordered_set<std::string> g_recordedFileNameSet;
+
+	size_t alignUp(size_t offset)
+	{
+		return (offset + ASSET_PACK_ALIGNMENT - 1) / ASSET_PACK_ALIGNMENT * ASSET_PACK_ALIGNMENT;
+	}
+}
+
+
+AssetPack::AssetPack(const std::string &fileName)
+	:
+	file(fileName)
+{
+	if (!file.isOpen() || file.getSize() < sizeof(Header)) return;
+
+	Header header;
+	memcpy(&header, file.getData(), sizeof(header));
+	if (memcmp(header.magic, "LEPK", 4) != 0 || header.version != version) return;
+
+	const size_t tocSize = size_t(header.fileCount) * sizeof(TocEntry);
+	if (file.getSize() < sizeof(Header) + tocSize + header.nameBytes) return;
+
+	const char *names = file.getData() + sizeof(Header) + tocSize;
+	std::unordered_map<std::string, TocEntry> tocEntries;
+	for (uint32_t i = 0; i < header.fileCount; ++i)
+	{
+		TocEntry entry;
+		memcpy(&entry, file.getData() + sizeof(Header) + i * sizeof(TocEntry), sizeof(entry));
+		if (size_t(entry.nameOffset) + entry.nameLength > header.nameBytes || entry.offset + entry.size > file.getSize()) return;
+		tocEntries.emplace(std::string(names + entry.nameOffset, entry.nameLength), entry);
+	}
+	entries = std::move(tocEntries);
+}
+
+const char *AssetPack::find(const std::string &fileName, size_t *pSize) const
+{
+	auto it = entries.find(fileName);
+	if (it == entries.end()) return nullptr;
+
+	*pSize = static_cast<size_t>(it->second.size);
+	return file.getData() + it->second.offset;
+}
+
+void AssetPack::prefetch(const char *data, size_t length) const
+{
+	file.prefetch(static_cast<size_t>(data - file.getData()), length);
+}
+
+bool AssetPack::write(const std::string &packFileName, const std::vector<std::string> &fileNames)
+{
+	std::vector<std::unique_ptr<MappedFile>> sources;
+	for (const auto &fileName : fileNames)
+	{
+		sources.emplace_back(new MappedFile(fileName));
+		if (sources.back()->isOpen()) continue;
+
+		// Empty files are not mapped but still packed, as an entry of no bytes
+		std::ifstream source(fileName, std::ios::binary | std::ios::ate);
+		if (!source.is_open() || source.tellg() != std::streampos(0)) return false;
+	}
+
+	Header header = {};
+	memcpy(header.magic, "LEPK", 4);
+	header.version = version;
+	header.fileCount = static_cast<uint32_t>(fileNames.size());
+
+	std::vector<TocEntry> toc(fileNames.size());
+	for (size_t i = 0; i < fileNames.size(); ++i)
+	{
+		toc[i].nameOffset = header.nameBytes;
+		toc[i].nameLength = static_cast<uint32_t>(fileNames[i].size());
+		header.nameBytes += toc[i].nameLength;
+	}
+
+	size_t offset = alignUp(sizeof(Header) + toc.size() * sizeof(TocEntry) + header.nameBytes);
+	for (size_t i = 0; i < fileNames.size(); ++i)
+	{
+		toc[i].offset = offset;
+		toc[i].size = sources[i]->getSize();
+		offset = alignUp(offset + sources[i]->getSize());
+	}
+
+	std::ofstream pack(packFileName, std::ios::binary | std::ios::trunc);
+	if (!pack.is_open()) return false;
+
+	pack.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	pack.write(reinterpret_cast<const char *>(toc.data()), toc.size() * sizeof(TocEntry));
+	for (const auto &fileName : fileNames)
+	{
+		pack.write(fileName.data(), fileName.size());
+	}
+
+	// Zeros up to the next file
+	const std::vector<char> padding(ASSET_PACK_ALIGNMENT, 0);
+	for (size_t i = 0; i < fileNames.size(); ++i)
+	{
+		pack.write(padding.data(), static_cast<std::streamsize>(toc[i].offset - static_cast<uint64_t>(pack.tellp())));
+		if (sources[i]->getSize() > 0) pack.write(sources[i]->getData(), sources[i]->getSize());
+	}
+	pack.write(padding.data(), static_cast<std::streamsize>(offset - static_cast<size_t>(pack.tellp())));
+
+	return pack.good();
+}
+
+AssetFile::AssetFile(const std::string &fileName)
+{
+	for (const auto &pack : g_mountedPacks)
+	{
+		data = pack->find(fileName, &size);
+		if (!data) continue;
+
+		// Loaders read the whole file, so have all of it read in one go rather than fault it in a page at a time
+		pack->prefetch(data, size);
+		record(fileName);
+		return;
+	}
+
+	looseFile.reset(new MappedFile(fileName));
+	if (!looseFile->isOpen()) return;
+	data = looseFile->getData();
+	size = looseFile->getSize();
+	record(fileName);
+}
+
+bool AssetFile::exists(const std::string &fileName)
+{
+	return existsInPack(fileName) || std::ifstream(fileName).good();
+}
+
+bool AssetFile::existsInPack(const std::string &fileName)
+{
+	size_t size;
+	for (const auto &pack : g_mountedPacks)
+	{
+		if (pack->find(fileName, &size)) return true;
+	}
+	return false;
+}
+
+bool AssetFile::mount(const std::string &packFileName)
+{
+	std::unique_ptr<AssetPack> pack(new AssetPack(packFileName));
+	if (!pack->isOpen()) return false;
+	g_mountedPacks.push_back(std::move(pack));
+	return true;
+}
+
+void AssetFile::unmountAll()
+{
+	g_mountedPacks.clear();
+}
+
+void AssetFile::startRecording()
+{
+	std::lock_guard<std::mutex> lock(g_recordingMutex);
+	g_recording = true;
+	g_recordedFileNames.clear();
+	g_recordedFileNameSet.clear();
+}
+
+void AssetFile::record(const std::string &fileName)
+{
+	std::lock_guard<std::mutex> lock(g_recordingMutex);
+	if (!g_recording || !g_recordedFileNameSet.insert(fileName).second) return;
+	g_recordedFileNames.push_back(fileName);
+}
+
+std::vector<std::string> AssetFile::stopRecording()
+{
+	std::lock_guard<std::mutex> lock(g_recordingMutex);
+	g_recording = false;
+	g_recordedFileNameSet.clear();
+	return std::move(g_recordedFileNames);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "mapped_file.h"
+
+
+// Files in a pack start at multiples of this, so prefetches and uploads never straddle two files in a page
+#define ASSET_PACK_ALIGNMENT 4096
+
+
+// Read-only archive of asset files: a header, a table of contents with the file names and the files themselves, each
+// aligned to ASSET_PACK_ALIGNMENT. The whole pack is mapped when it is opened, so reading a packed file opens and seeks
+// nothing. Packed files are named by the paths they would have as loose files, e.g. "../textures/Cerberus/A.dds"
+class AssetPack
+{
+public:
+	explicit AssetPack(const std::string &fileName);
+
+	AssetPack(const AssetPack &) = delete;
+	AssetPack &operator=(const AssetPack &) = delete;
+
+	// False if the file is missing, not a pack or truncated
+	bool isOpen() const { return !entries.empty(); }
+	size_t getFileCount() const { return entries.size(); }
+	// Null if @fileName is not in the pack. The data is mapped, pages are read in on first access
+	const char *find(const std::string &fileName, size_t *pSize) const;
+	// Read @length bytes of packed data from @data in the background
+	void prefetch(const char *data, size_t length) const;
+
+	// Pack the loose files @fileNames into @packFileName. Return false if a file cannot be read or the pack cannot be written
+	static bool write(const std::string &packFileName, const std::vector<std::string> &fileNames);
+
+protected:
+	struct Header
+	{
+		char magic[4]; // "LEPK"
+		uint32_t version;
+		uint32_t fileCount;
+		uint32_t nameBytes; // size of the names after the table of contents
+	};
+
+	struct TocEntry
+	{
+		uint64_t offset; // from the start of the pack
+		uint64_t size;
+		uint32_t nameOffset; // in the names after the table of contents
+		uint32_t nameLength;
+	};
+
+	static const uint32_t version = 1;
+
+	MappedFile file;
+	std::unordered_map<std::string, TocEntry> entries;
+};
+
+// A file of a mounted asset pack, or else the loose file mapped. Has the interface of MappedFile, so loaders take either
+class AssetFile
+{
+public:
+	explicit AssetFile(const std::string &fileName);
+
+	AssetFile(const AssetFile &) = delete;
+	AssetFile &operator=(const AssetFile &) = delete;
+
+	bool isOpen() const { return data != nullptr; }
+	const char *getData() const { return data; }
+	size_t getSize() const { return size; }
+
+	// True if @fileName is in a mounted pack or exists as a loose file
+	static bool exists(const std::string &fileName);
+	static bool existsInPack(const std::string &fileName);
+
+	// Search @packFileName for files before the packs mounted after it and the loose files. Return false if it is not a
+	// pack. Mount packs before loading starts, AssetFile may be opened on any thread but mounting is not synchronized
+	static bool mount(const std::string &packFileName);
+	static void unmountAll();
+
+	// Remember the names of the files opened from now on, e.g. to pack what a run loads
+	static void startRecording();
+	static void record(const std::string &fileName); // a file that later runs open but this one wrote, e.g. a cooked mesh
+	static std::vector<std::string> stopRecording(); // in the order they were first opened
+
+protected:
+	std::unique_ptr<MappedFile> looseFile;
+	const char *data = nullptr;
+	size_t size = 0;
+};
@@ -0,0 +1,488 @@
+#include "async_file_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+
+typedef std::vector<std::pair<uint32_t, int64_t>> Completions; // slot, bytes read
+
+
+#ifdef _WIN32
+// Every file is associated with one completion port, a chunk's OVERLAPPED is its slot's
+struct AsyncFileReader::Backend
+{
+	HANDLE port = nullptr;
+	std::vector<OVERLAPPED> overlapped; // by slot
+
+	static Backend *create(uint32_t maxInFlight)
+	{
+		HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+		if (!port) return nullptr;
+
+		Backend *pBackend = new Backend;
+		pBackend->port = port;
+		pBackend->overlapped.resize(maxInFlight);
+		return pBackend;
+	}
+
+	~Backend()
+	{
+		CloseHandle(port);
+	}
+
+	intptr_t open(const std::string &fileName, size_t *pSize)
+	{
+		HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return -1;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || !CreateIoCompletionPort(file, port, 0, 0))
+		{
+			CloseHandle(file);
+			return -1;
+		}
+		*pSize = static_cast<size_t>(fileSize.QuadPart);
+		return reinterpret_cast<intptr_t>(file);
+	}
+
+	void issue(uint32_t slot, const Chunk &chunk, Completions *pFailed)
+	{
+		OVERLAPPED &ov = overlapped[slot];
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = static_cast<DWORD>(chunk.offset);
+		ov.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(chunk.offset) >> 32);
+
+		// Reads that finish right away still post their completion
+		HANDLE file = reinterpret_cast<HANDLE>(chunk.pRequest->file);
+		if (!ReadFile(file, chunk.pRequest->data.data() + chunk.offset, static_cast<DWORD>(chunk.length), nullptr, &ov) &&
+			GetLastError() != ERROR_IO_PENDING)
+		{
+			pFailed->emplace_back(slot, -1);
+		}
+	}
+
+	// Blocks for the first completion unless @pCompletions has some already, then takes whatever else is ready
+	void reap(Completions *pCompletions)
+	{
+		DWORD timeout = pCompletions->empty() ? INFINITE : 0;
+		for (;;)
+		{
+			DWORD bytesRead = 0;
+			ULONG_PTR key;
+			OVERLAPPED *pOverlapped = nullptr;
+			const BOOL succeeded = GetQueuedCompletionStatus(port, &bytesRead, &key, &pOverlapped, timeout);
+			if (!pOverlapped) return; // timed out
+			const uint32_t slot = static_cast<uint32_t>(pOverlapped - overlapped.data());
+			pCompletions->emplace_back(slot, succeeded ? static_cast<int64_t>(bytesRead) : (GetLastError() == ERROR_HANDLE_EOF ? 0 : -1));
+			timeout = 0;
+		}
+	}
+};
+
+static intptr_t openSync(const std::string &fileName, size_t *pSize)
+{
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return -1;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		return -1;
+	}
+	*pSize = static_cast<size_t>(fileSize.QuadPart);
+	return reinterpret_cast<intptr_t>(file);
+}
+
+static void closeFile(intptr_t file)
+{
+	CloseHandle(reinterpret_cast<HANDLE>(file));
+}
+
+int64_t AsyncFileReader::readAt(intptr_t file, size_t offset, size_t length, char *pDst)
+{
+	// The offset of a synchronous handle's read may be given in an OVERLAPPED as well
+	OVERLAPPED ov = {};
+	ov.Offset = static_cast<DWORD>(offset);
+	ov.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(offset) >> 32);
+	DWORD bytesRead = 0;
+	if (!ReadFile(reinterpret_cast<HANDLE>(file), pDst, static_cast<DWORD>(length), &bytesRead, &ov))
+	{
+		return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+	}
+	return bytesRead;
+}
+#else
+// A ring of twice as many completions as submissions, which holds @maxInFlight reads. The thread is its only user, so the
+// indices it owns are written plainly and only those shared with the kernel go through acquire and release
+struct AsyncFileReader::Backend
+{
+	int ringFd = -1;
+	void *pSqRing = MAP_FAILED;
+	size_t sqRingSize = 0;
+	void *pCqRing = MAP_FAILED;
+	size_t cqRingSize = 0;
+	io_uring_sqe *pSqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+	size_t sqesSize = 0;
+
+	unsigned *pSqTail;
+	unsigned sqMask;
+	unsigned *pSqArray;
+	unsigned *pCqHead;
+	unsigned *pCqTail;
+	unsigned cqMask;
+	io_uring_cqe *pCqes;
+
+	unsigned unsubmittedCount = 0; // queued in the ring but not yet passed to io_uring_enter
+	std::vector<iovec> iovecs; // by slot
+
+	static Backend *create(uint32_t maxInFlight)
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		const int fd = static_cast<int>(syscall(__NR_io_uring_setup, maxInFlight, &params));
+		if (fd < 0) return nullptr;
+
+		Backend *pBackend = new Backend;
+		pBackend->ringFd = fd;
+		pBackend->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		pBackend->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			pBackend->sqRingSize = pBackend->cqRingSize = std::max(pBackend->sqRingSize, pBackend->cqRingSize);
+		}
+		pBackend->pSqRing = mmap(nullptr, pBackend->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (pBackend->pSqRing == MAP_FAILED)
+		{
+			delete pBackend;
+			return nullptr;
+		}
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			pBackend->pCqRing = pBackend->pSqRing;
+		}
+		else
+		{
+			pBackend->pCqRing = mmap(nullptr, pBackend->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		}
+		pBackend->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		pBackend->pSqes = static_cast<io_uring_sqe *>(mmap(nullptr, pBackend->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+		if (pBackend->pCqRing == MAP_FAILED || pBackend->pSqes == MAP_FAILED)
+		{
+			delete pBackend;
+			return nullptr;
+		}
+
+		char *pSq = static_cast<char *>(pBackend->pSqRing);
+		char *pCq = static_cast<char *>(pBackend->pCqRing);
+		pBackend->pSqTail = reinterpret_cast<unsigned *>(pSq + params.sq_off.tail);
+		pBackend->sqMask = *reinterpret_cast<unsigned *>(pSq + params.sq_off.ring_mask);
+		pBackend->pSqArray = reinterpret_cast<unsigned *>(pSq + params.sq_off.array);
+		pBackend->pCqHead = reinterpret_cast<unsigned *>(pCq + params.cq_off.head);
+		pBackend->pCqTail = reinterpret_cast<unsigned *>(pCq + params.cq_off.tail);
+		pBackend->cqMask = *reinterpret_cast<unsigned *>(pCq + params.cq_off.ring_mask);
+		pBackend->pCqes = reinterpret_cast<io_uring_cqe *>(pCq + params.cq_off.cqes);
+		pBackend->iovecs.resize(maxInFlight);
+		return pBackend;
+	}
+
+	~Backend()
+	{
+		if (pSqes != MAP_FAILED) munmap(pSqes, sqesSize);
+		if (pCqRing != MAP_FAILED && pCqRing != pSqRing) munmap(pCqRing, cqRingSize);
+		if (pSqRing != MAP_FAILED) munmap(pSqRing, sqRingSize);
+		if (ringFd >= 0) ::close(ringFd);
+	}
+
+	intptr_t open(const std::string &fileName, size_t *pSize);
+
+	void issue(uint32_t slot, const Chunk &chunk, Completions *)
+	{
+		iovec &iov = iovecs[slot];
+		iov.iov_base = chunk.pRequest->data.data() + chunk.offset;
+		iov.iov_len = chunk.length;
+
+		const unsigned tail = *pSqTail;
+		const unsigned index = tail & sqMask;
+		io_uring_sqe &sqe = pSqes[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_READV;
+		sqe.fd = static_cast<int>(chunk.pRequest->file);
+		sqe.off = chunk.offset;
+		sqe.addr = reinterpret_cast<uint64_t>(&iov);
+		sqe.len = 1;
+		sqe.user_data = slot;
+		pSqArray[index] = index;
+		__atomic_store_n(pSqTail, tail + 1, __ATOMIC_RELEASE);
+		++unsubmittedCount;
+	}
+
+	// Submits what is queued and blocks for the first completion unless @pCompletions has some already, then takes whatever
+	// else is ready
+	void reap(Completions *pCompletions)
+	{
+		const unsigned minComplete = pCompletions->empty() ? 1 : 0;
+		for (;;)
+		{
+			const int submitted = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, unsubmittedCount, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0));
+			if (submitted >= 0)
+			{
+				unsubmittedCount -= static_cast<unsigned>(submitted);
+				break;
+			}
+			// Anything else is a misuse of the ring
+			if (errno != EINTR && errno != EAGAIN && errno != EBUSY) break;
+		}
+
+		unsigned head = *pCqHead;
+		const unsigned tail = __atomic_load_n(pCqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head)
+		{
+			const io_uring_cqe &cqe = pCqes[head & cqMask];
+			pCompletions->emplace_back(static_cast<uint32_t>(cqe.user_data), cqe.res);
+		}
+		__atomic_store_n(pCqHead, head, __ATOMIC_RELEASE);
+	}
+};
+
+static intptr_t openSync(const std::string &fileName, size_t *pSize)
+{
+	const int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	*pSize = static_cast<size_t>(fileStat.st_size);
+	return fd;
+}
+
+intptr_t AsyncFileReader::Backend::open(const std::string &fileName, size_t *pSize)
+{
+	return openSync(fileName, pSize);
+}
+
+static void closeFile(intptr_t file)
+{
+	close(static_cast<int>(file));
+}
+
+int64_t AsyncFileReader::readAt(intptr_t file, size_t offset, size_t length, char *pDst)
+{
+	for (;;)
+	{
+		const ssize_t bytesRead = pread(static_cast<int>(file), pDst, length, static_cast<off_t>(offset));
+		if (bytesRead >= 0 || errno != EINTR) return bytesRead;
+	}
+}
+#endif
+
+
+AsyncFileReader::AsyncFileReader(uint32_t maxInFlight, size_t chunkSize)
+	:
+	maxInFlight(std::max(maxInFlight, 1u)),
+	chunkSize(std::max<size_t>(chunkSize, 1))
+{
+	chunks.resize(this->maxInFlight);
+	for (uint32_t i = this->maxInFlight; i > 0; --i) freeChunks.push_back(i - 1);
+	backend = Backend::create(this->maxInFlight);
+	thread = std::thread(&AsyncFileReader::run, this);
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	requestAdded.notify_one();
+	thread.join();
+
+	for (auto &request : requests)
+	{
+		close(&request);
+	}
+	delete backend;
+}
+
+AsyncFileReader::Handle AsyncFileReader::read(const std::string &fileName)
+{
+	Handle handle;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		handle = requests.size();
+		requests.emplace_back();
+		requests.back().fileName = fileName;
+	}
+	requestAdded.notify_one();
+	return handle;
+}
+
+std::vector<char> AsyncFileReader::wait(Handle handle)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (handle >= requests.size()) throw std::runtime_error("AsyncFileReader: invalid handle");
+
+	Request &request = requests[handle];
+	requestDone.wait(lock, [&request]() { return request.done; });
+	if (request.failed) throw std::runtime_error("AsyncFileReader: failed to read " + request.fileName);
+	return std::move(request.data);
+}
+
+bool AsyncFileReader::isDone(Handle handle) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return handle < requests.size() && requests[handle].done;
+}
+
+void AsyncFileReader::run()
+{
+	std::vector<uint32_t> toIssue;
+	Completions completions;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		// Requests that have not started by now are dropped, the ones in flight are waited for as their buffers are written
+		if (!stopping)
+		{
+			while (submitNextChunk()) {}
+		}
+		if (freeChunks.size() == maxInFlight)
+		{
+			if (stopping) break;
+			requestAdded.wait(lock, [this]() { return stopping || nextRequest < requests.size(); });
+			continue;
+		}
+
+		toIssue.swap(submittedSlots);
+		lock.unlock();
+
+		// Slots and their requests' buffers are left alone by the other threads while the chunks are in flight
+		for (uint32_t slot : toIssue)
+		{
+			const Chunk &chunk = chunks[slot];
+			if (backend)
+			{
+				backend->issue(slot, chunk, &completions);
+			}
+			else
+			{
+				completions.emplace_back(slot, readAt(chunk.pRequest->file, chunk.offset, chunk.length, chunk.pRequest->data.data() + chunk.offset));
+			}
+		}
+		toIssue.clear();
+		if (backend) backend->reap(&completions);
+
+		lock.lock();
+		for (const auto &completion : completions)
+		{
+			completeChunk(completion.first, completion.second);
+		}
+		completions.clear();
+	}
+}
+
+bool AsyncFileReader::open(Request *pRequest)
+{
+	size_t size = 0;
+	pRequest->file = backend ? backend->open(pRequest->fileName, &size) : openSync(pRequest->fileName, &size);
+	if (pRequest->file == -1) return false;
+
+	pRequest->data.resize(size);
+	return true;
+}
+
+void AsyncFileReader::close(Request *pRequest)
+{
+	if (pRequest->file == -1) return;
+	closeFile(pRequest->file);
+	pRequest->file = -1;
+}
+
+bool AsyncFileReader::submitNextChunk()
+{
+	while (nextRequest < requests.size())
+	{
+		Request &request = requests[nextRequest];
+		if (!request.started)
+		{
+			request.started = true;
+			if (!open(&request)) request.failed = true;
+		}
+
+		// Done with this one, it finishes with its last chunk in flight, or now if it has none, e.g. an empty file
+		if (request.failed || request.nextOffset == request.data.size())
+		{
+			++nextRequest;
+			if (request.chunksInFlight == 0 && !request.done) finish(&request);
+			continue;
+		}
+
+		if (freeChunks.empty()) return false;
+		const uint32_t slot = freeChunks.back();
+		freeChunks.pop_back();
+
+		Chunk &chunk = chunks[slot];
+		chunk.pRequest = &request;
+		chunk.offset = request.nextOffset;
+		chunk.length = std::min(chunkSize, request.data.size() - request.nextOffset);
+		request.nextOffset += chunk.length;
+		++request.chunksInFlight;
+		submittedSlots.push_back(slot);
+		return true;
+	}
+	return false;
+}
+
+void AsyncFileReader::completeChunk(uint32_t slot, int64_t bytesRead)
+{
+	Chunk &chunk = chunks[slot];
+	Request *pRequest = chunk.pRequest;
+
+	// A read that ends early is continued in the same slot, one that reads nothing hit the end of a file that shrank
+	if (bytesRead > 0 && static_cast<size_t>(bytesRead) < chunk.length && !pRequest->failed)
+	{
+		chunk.offset += static_cast<size_t>(bytesRead);
+		chunk.length -= static_cast<size_t>(bytesRead);
+		submittedSlots.push_back(slot);
+		return;
+	}
+	if (bytesRead <= 0 && chunk.length > 0) pRequest->failed = true;
+
+	freeChunks.push_back(slot);
+	--pRequest->chunksInFlight;
+	if (pRequest->chunksInFlight == 0 && (pRequest->failed || pRequest->nextOffset == pRequest->data.size()))
+	{
+		finish(pRequest);
+	}
+}
+
+void AsyncFileReader::finish(Request *pRequest)
+{
+	close(pRequest);
+	if (pRequest->failed) pRequest->data = std::vector<char>();
+	pRequest->done = true;
+	requestDone.notify_all();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+#define ASYNC_READ_CHUNK_SIZE		(1 << 20) // bytes per read, large files are split into reads of this size
+#define ASYNC_READS_IN_FLIGHT		64 // reads queued to the drive at once, over all files
+
+
+// Reads whole files into host memory in the background, with many reads in flight at once, so a burst of requests keeps
+// the drive's queues full instead of each loader thread blocking on one read at a time. One thread submits the reads and
+// reaps their completions: overlapped reads on an I/O completion port on Windows, io_uring on Linux. Where io_uring is
+// not available, e.g. an older kernel or a sandbox that blocks it, the thread reads one chunk at a time instead.
+// Requests are started in the order they were made. May be used from any thread
+class AsyncFileReader
+{
+public:
+	typedef size_t Handle;
+	static const Handle INVALID_HANDLE = ~Handle(0);
+
+	explicit AsyncFileReader(uint32_t maxInFlight = ASYNC_READS_IN_FLIGHT, size_t chunkSize = ASYNC_READ_CHUNK_SIZE);
+	// Waits for the reads in flight, requests that have not started are dropped
+	~AsyncFileReader();
+
+	AsyncFileReader(const AsyncFileReader &) = delete;
+	AsyncFileReader &operator=(const AsyncFileReader &) = delete;
+
+	// Queue a read of the whole of @fileName, never blocks
+	Handle read(const std::string &fileName);
+	// Block until the read is done and take its contents, which are gone from the reader afterwards. Throws if the file
+	// cannot be opened or read
+	std::vector<char> wait(Handle handle);
+	// True if wait() would return or throw without blocking
+	bool isDone(Handle handle) const;
+
+	bool isAsync() const { return backend != nullptr; } // false if reads fall back to one at a time
+
+protected:
+	struct Request
+	{
+		std::string fileName;
+		std::vector<char> data;
+		size_t nextOffset = 0; // of the next chunk to submit
+		uint32_t chunksInFlight = 0;
+		bool started = false;
+		bool failed = false;
+		bool done = false;
+		intptr_t file = -1; // descriptor or HANDLE while the file is open
+	};
+
+	// One read in flight. Its slot index identifies its completion
+	struct Chunk
+	{
+		Request *pRequest;
+		size_t offset;
+		size_t length;
+	};
+
+	struct Backend;
+
+	uint32_t maxInFlight;
+	size_t chunkSize;
+
+	mutable std::mutex mutex;
+	std::condition_variable requestAdded;
+	mutable std::condition_variable requestDone;
+	std::deque<Request> requests; // by handle, references stay valid while it grows
+	size_t nextRequest = 0; // first request whose chunks are not all submitted
+	std::vector<Chunk> chunks; // @maxInFlight slots
+	std::vector<uint32_t> freeChunks;
+	std::vector<uint32_t> submittedSlots; // chunks to hand to the drive, including the rest of short reads
+	bool stopping = false;
+
+	Backend *backend = nullptr; // null if the reads are synchronous
+	std::thread thread;
+
+	void run();
+	// With @mutex held. Open the file of @pRequest and size its data, false if it fails
+	bool open(Request *pRequest);
+	void close(Request *pRequest);
+	// With @mutex held. Queue the next chunk of the first unfinished request, false if there is none or no free slot
+	bool submitNextChunk();
+	// With @mutex held. A chunk finished with @bytesRead, negative on error. Short reads are submitted again for the rest
+	void completeChunk(uint32_t slot, int64_t bytesRead);
+	void finish(Request *pRequest);
+
+	// Without @mutex held. Synchronous positional read, returns the bytes read or a negative value on error
+	static int64_t readAt(intptr_t file, size_t offset, size_t length, char *pDst);
+};
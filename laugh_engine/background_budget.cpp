@@ -0,0 +1,57 @@
+#include "background_budget.h"
+
+#include <algorithm>
+#include <limits>
+
+
+BackgroundWorkBudget::BackgroundWorkBudget(float targetMS, float headroom, float maxMS, float minMS)
+	:
+	targetMS(targetMS),
+	headroom(headroom),
+	maxMS(maxMS),
+	minMS(minMS)
+{
+}
+
+void BackgroundWorkBudget::setInitialCost(Kind kind, float msPerUnit)
+{
+	if (!isMeasured[kind]) this->msPerUnit[kind] = msPerUnit;
+}
+
+void BackgroundWorkBudget::beginFrame(float gpuMS)
+{
+	// Between the headroom and the target nothing fits without pushing the frame over
+	isOverTarget = gpuMS < 0.f || gpuMS >= targetMS;
+	budgetMS = isOverTarget ? minMS : std::min(std::max(targetMS * headroom - gpuMS, 0.f), maxMS);
+	spentMS = 0.f;
+}
+
+uint64_t BackgroundWorkBudget::getAffordableUnits(Kind kind) const
+{
+	const float leftMS = budgetMS - spentMS;
+	if (leftMS <= 0.f) return 0;
+	if (msPerUnit[kind] <= 0.f) return std::numeric_limits<uint64_t>::max();
+
+	const double units = static_cast<double>(leftMS) / msPerUnit[kind];
+	return units >= static_cast<double>(std::numeric_limits<uint64_t>::max()) ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>(units);
+}
+
+bool BackgroundWorkBudget::canRunOversized() const
+{
+	return spentMS == 0.f && (budgetMS >= maxMS || isOverTarget);
+}
+
+void BackgroundWorkBudget::spend(Kind kind, uint64_t units)
+{
+	spentMS += static_cast<float>(units) * msPerUnit[kind];
+}
+
+void BackgroundWorkBudget::addMeasurement(Kind kind, uint64_t units, float ms)
+{
+	if (units == 0 || ms < 0.f) return;
+
+	// The cost of a unit follows the steps, a single slow one does not stall the work for long
+	const float cost = ms / static_cast<float>(units);
+	msPerUnit[kind] = isMeasured[kind] ? 0.75f * msPerUnit[kind] + 0.25f * cost : cost;
+	isMeasured[kind] = true;
+}
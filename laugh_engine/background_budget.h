@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+
+// Shares out the GPU time a frame leaves under its target among background work, e.g. streaming uploads, virtual texture
+// tile copies and probe prefiltering, so that the work never pushes a frame over the target. A frame's budget is what the
+// last measured frame left under the target, capped at @maxMS. Frames that are over the target anyway, or not measured,
+// get @minMS, so the work still gets done, slowly. Each kind of work has a cost per unit, a guess at first and then
+// smoothed over the measured steps, and a frame only starts the units that fit in what is left of its budget. The others
+// wait for a later frame. A unit that costs more than the cap never fits, it runs alone in a frame with all of the cap left,
+// or in one that is over the target anyway
+class BackgroundWorkBudget
+{
+public:
+	enum Kind
+	{
+		WORK_TEXTURE_UPLOAD, // bytes
+		WORK_VIRTUAL_TILE_COPY, // tiles
+		WORK_PROBE_PREFILTER, // texels
+		WORK_KIND_COUNT
+	};
+
+	BackgroundWorkBudget(float targetMS = 16.6f, float headroom = 0.95f, float maxMS = 2.f, float minMS = 0.25f);
+
+	// Cost of @kind until its first measurement
+	void setInitialCost(Kind kind, float msPerUnit);
+
+	// @gpuMS of the last measured frame without the background work, negative if unknown
+	void beginFrame(float gpuMS);
+
+	// Units of @kind that fit in what is left of this frame's budget
+	uint64_t getAffordableUnits(Kind kind) const;
+	// True while nothing was spent in this frame and it has all of the cap or is over the target anyway, when a unit too
+	// large for any budget may run
+	bool canRunOversized() const;
+	// Charge @units of @kind that were started, whether they fit or not
+	void spend(Kind kind, uint64_t units);
+	// @units of @kind took @ms
+	void addMeasurement(Kind kind, uint64_t units, float ms);
+
+	float getBudgetMS() const { return budgetMS; }
+	float getSpentMS() const { return spentMS; }
+	float getMaxMS() const { return maxMS; }
+
+protected:
+	float targetMS;
+	float headroom; // fraction of the target the frame and its background work stay under, leaves room for noise
+	float maxMS;
+	float minMS;
+
+	float msPerUnit[WORK_KIND_COUNT] = {};
+	bool isMeasured[WORK_KIND_COUNT] = {};
+
+	float budgetMS = 0.f;
+	float spentMS = 0.f;
+	bool isOverTarget = false; // or not measured
+};
@@ -1,4 +1,5 @@
 #include "camera.h"
+#include <algorithm>
 #include "glm/gtc/matrix_transform.hpp"
 
 #define PI 3.14159265358979323846f
@@ -14,33 +15,46 @@ Camera::Camera(
 	thetaLimit(.1f * PI), minDistance(.1f),
 	fovy(fovy), aspectRatio(aspect),
 	zNear(zNear), zFar(zFar),
-	position(position), lookAtPos(lookAtPos),
-	segmentCount(segCount)
+	segmentCount(segCount), activeSegmentCount(segCount)
 {
-	glm::vec3 dir = glm::normalize(position - lookAtPos);
-	float theta = acosf(fmax(-1.f, fmin(1.f, dir.y)));
-	float phi = atan2f(dir.x, dir.z);
-	theta = fmax(thetaLimit, fmin(PI - thetaLimit, theta));
-	phiTheta = glm::vec2(phi, theta);
-
-	float dist = glm::distance(position, lookAtPos);
-	glm::vec3 newDir = glm::vec3(sinf(phi) * sinf(theta), cosf(theta), cosf(phi) * sinf(theta));
-	this->position = this->lookAtPos + newDir * dist;
+	setLookAt(position, lookAtPos);
 
 	// CSM related
+	computeSplits(zNear, zFar);
+}
+
+void Camera::setSegmentCount(uint32_t segCount)
+{
+	assert(segCount > 0 && segCount <= CSM_MAX_SEG_COUNT);
+	segmentCount = segCount;
+	activeSegmentCount = segCount;
+	computeSplits(zNear, zFar);
+}
+
+void Camera::fitSegments(float nearDepth, float farDepth, uint32_t activeCount)
+{
+	activeSegmentCount = std::max(1u, std::min(segmentCount, activeCount));
+	nearDepth = fmax(zNear, fmin(zFar, nearDepth));
+	farDepth = fmax(nearDepth, fmin(zFar, farDepth));
+	computeSplits(nearDepth, farDepth);
+}
+
+void Camera::computeSplits(float nearDepth, float farDepth)
+{
 	memset(farPlaneZs, 0, sizeof(farPlaneZs));
 	memset(normFarPlaneZs, 0, sizeof(normFarPlaneZs));
 
 	const float lambda = 0.5f;
 	glm::mat4 P = glm::perspective(fovy, aspectRatio, zNear, zFar);
+	segmentsNear = nearDepth;
 	
 	for (uint32_t i = 1; i <= segmentCount; ++i)
 	{
-		float frac = float(i) / segmentCount;
-		float logSplit = zNear * std::pow(zFar / zNear, frac);
-		float uniSplit = zNear + (zFar - zNear) * frac;
+		float frac = float(std::min(i, activeSegmentCount)) / activeSegmentCount;
+		float logSplit = nearDepth * std::pow(farDepth / nearDepth, frac);
+		float uniSplit = nearDepth + (farDepth - nearDepth) * frac;
 		float splitDepth = (1.f - lambda) * uniSplit + lambda * logSplit;
-		splitDepth = fmax(zNear, fmin(zFar, splitDepth));
+		splitDepth = fmax(nearDepth, fmin(farDepth, splitDepth));
 		
 		farPlaneZs[i - 1] = -splitDepth;
 		float projectedDepth = (P[2][2] * -splitDepth + P[3][2]) / (P[2][3] * -splitDepth);
@@ -49,6 +63,20 @@ Camera::Camera(
 	}
 }
 
+void Camera::setLookAt(const glm::vec3 &position, const glm::vec3 &lookAtPos)
+{
+	glm::vec3 dir = glm::normalize(position - lookAtPos);
+	float theta = acosf(fmax(-1.f, fmin(1.f, dir.y)));
+	float phi = atan2f(dir.x, dir.z);
+	theta = fmax(thetaLimit, fmin(PI - thetaLimit, theta));
+	phiTheta = glm::vec2(phi, theta);
+
+	float dist = glm::distance(position, lookAtPos);
+	glm::vec3 newDir = glm::vec3(sinf(phi) * sinf(theta), cosf(theta), cosf(phi) * sinf(theta));
+	this->lookAtPos = lookAtPos;
+	this->position = lookAtPos + newDir * dist;
+}
+
 void Camera::getViewProjMatrix(glm::mat4 &V, glm::mat4 &P) const
 {
 	V = glm::lookAt(position, lookAtPos, glm::vec3(0.f, 1.f, 0.f));
@@ -62,19 +90,18 @@ inline void bboxUnion(const glm::vec3 &p, glm::vec3 *pMin, glm::vec3 *pMax)
 	*pMax = glm::max(*pMax, p);
 }
 
-void Camera::getSegmentDepths(std::vector<float> *segDepths) const
+void Camera::getSegmentDepths(float *segDepths) const
 {
 	assert(segDepths);
-	segDepths->resize(segmentCount);
 	for (int i = 0; i < segmentCount; ++i)
 	{
-		float nearClip = i == 0 ? zNear : -farPlaneZs[i - 1];
+		float nearClip = i == 0 ? segmentsNear : -farPlaneZs[i - 1];
 		float farClip = -farPlaneZs[i];
-		(*segDepths)[i] = farClip - nearClip;
+		segDepths[i] = farClip - nearClip;
 	}
 }
 
-void Camera::getCornersWorldSpace(std::vector<glm::vec3> *corners) const
+void Camera::getCornersWorldSpace(glm::vec3 *corners) const
 {
 	assert(corners);
 	const auto f = glm::normalize(lookAtPos - position);
@@ -82,19 +109,17 @@ void Camera::getCornersWorldSpace(std::vector<glm::vec3> *corners) const
 	const auto u = glm::cross(r, f);
 	const float tanHalfFovy = tanf(fovy * 0.5f);
 
-	corners->resize(segmentCount * 4 + 4);
-
 	for (uint32_t i = 0; i <= segmentCount; ++i)
 	{
-		float depth = i == 0 ? zNear : -farPlaneZs[i - 1];
+		float depth = i == 0 ? segmentsNear : -farPlaneZs[i - 1];
 		auto df = depth * f;
 		auto du = depth * tanHalfFovy * u;
 		auto dr = depth * tanHalfFovy * aspectRatio * r;
 
-		(*corners)[4 * i] = position + df + du + dr;
-		(*corners)[4 * i + 1] = position + df + du - dr;
-		(*corners)[4 * i + 2] = position + df - du - dr;
-		(*corners)[4 * i + 3] = position + df - du + dr;
+		corners[4 * i] = position + df + du + dr;
+		corners[4 * i + 1] = position + df + du - dr;
+		corners[4 * i + 2] = position + df - du - dr;
+		corners[4 * i + 3] = position + df - du + dr;
 	}
 }
 
@@ -10,6 +10,14 @@
 class Camera
 {
 public:
+	// Everything addRotation(), addPan() and addZoom() change. Restoring it reproduces the view bit for bit
+	struct State
+	{
+		glm::vec3 position;
+		glm::vec3 lookAtPos;
+		glm::vec2 phiTheta;
+	};
+
 	Camera(
 		const glm::vec3 position,
 		const glm::vec3 lookAtPos,
@@ -22,16 +30,31 @@ public:
 	float getZNear() const { return zNear; }
 	float getZFar() const { return zFar; }
 	const glm::vec3 &getPosition() const { return position; }
+	const glm::vec3 &getLookAtPos() const { return lookAtPos; }
+	float getFovy() const { return fovy; }
 	uint32_t getSegmentCount() const { return segmentCount; }
+	uint32_t getActiveSegmentCount() const { return activeSegmentCount; }
+	float getSegmentsNear() const { return segmentsNear; } // near plane of the first segment
 	float getNormFarPlaneZ(uint32_t segIdx) const { return normFarPlaneZs[segIdx]; }
-	void getSegmentDepths(std::vector<float> *segDepths) const;
-	// On return, @corners contain (segmentCount * 4 + 4) points because
+	// Writes segmentCount depths to @segDepths
+	void getSegmentDepths(float *segDepths) const;
+	// Writes (segmentCount * 4 + 4) points to @corners because
 	// near plane corners are the far plane corners of the previous segment
-	void getCornersWorldSpace(std::vector<glm::vec3> *corners) const;
+	void getCornersWorldSpace(glm::vec3 *corners) const;
+	// Resizes the split arrays, every segment becomes active again over [zNear, zFar]
+	void setSegmentCount(uint32_t segCount);
+	// Splits [nearDepth, farDepth], clamped to [zNear, zFar], into the first @activeCount segments.
+	// The remaining ones are collapsed onto @farDepth so they never contain a visible point
+	void fitSegments(float nearDepth, float farDepth, uint32_t activeCount);
 
 	void addRotation(float phi, float theta);
 	void addPan(float x, float y);
 	void addZoom(float d);
+	// Same clamping as the constructor, so the position may move slightly when looking straight up or down
+	void setLookAt(const glm::vec3 &position, const glm::vec3 &lookAtPos);
+
+	State getState() const { return{ position, lookAtPos, phiTheta }; }
+	void setState(const State &state) { position = state.position; lookAtPos = state.lookAtPos; phiTheta = state.phiTheta; }
 
 	void setAspectRatio(float aspect) { aspectRatio = aspect; }
 
@@ -48,6 +71,10 @@ protected:
 	glm::vec2 phiTheta; // azimuth and zenith angles
 
 	uint32_t segmentCount;
+	uint32_t activeSegmentCount;
+	float segmentsNear;
 	float farPlaneZs[CSM_MAX_SEG_COUNT]; // in camera view space
 	float normFarPlaneZs[CSM_MAX_SEG_COUNT];
+
+	void computeSplits(float nearDepth, float farDepth);
 };
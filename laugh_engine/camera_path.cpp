@@ -0,0 +1,105 @@
+#include "camera_path.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+
+bool CameraPath::load(const std::string &fileName)
+{
+	std::ifstream file(fileName);
+	if (!file.is_open()) return false;
+
+	keyframes.clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#') continue;
+
+		Keyframe keyframe;
+		std::istringstream ss(line);
+		ss >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z
+			>> keyframe.lookAtPos.x >> keyframe.lookAtPos.y >> keyframe.lookAtPos.z;
+		if (ss.fail()) return false;
+
+		keyframes.push_back(keyframe);
+	}
+
+	return !keyframes.empty();
+}
+
+bool CameraPath::appendKeyframe(const std::string &fileName, const Camera &camera)
+{
+	std::ofstream file(fileName, std::ios::app);
+	if (!file.is_open()) return false;
+
+	const glm::vec3 &p = camera.getPosition();
+	const glm::vec3 &l = camera.getLookAtPos();
+	file << p.x << " " << p.y << " " << p.z << " " << l.x << " " << l.y << " " << l.z << "\n";
+
+	return file.good();
+}
+
+void CameraPath::sample(float t, glm::vec3 *pPosition, glm::vec3 *pLookAtPos) const
+{
+	assert(!keyframes.empty());
+
+	const float x = std::max(0.f, std::min(1.f, t)) * (keyframes.size() - 1);
+	const size_t i = std::min(static_cast<size_t>(x), keyframes.size() - 1);
+	const size_t j = std::min(i + 1, keyframes.size() - 1);
+	const float f = x - i;
+
+	*pPosition = glm::mix(keyframes[i].position, keyframes[j].position, f);
+	*pLookAtPos = glm::mix(keyframes[i].lookAtPos, keyframes[j].lookAtPos, f);
+}
+
+bool CameraRecording::beginWrite(const std::string &fileName)
+{
+	endWrite();
+	file.open(fileName, std::ios::trunc);
+	if (!file.is_open()) return false;
+
+	// Enough digits for every float to read back unchanged
+	file << std::setprecision(std::numeric_limits<float>::max_digits10);
+	file << "# px py pz lx ly lz phi theta\n";
+	return true;
+}
+
+void CameraRecording::endWrite()
+{
+	if (file.is_open()) file.close();
+}
+
+void CameraRecording::write(const Camera::State &state)
+{
+	assert(file.is_open());
+	file << state.position.x << " " << state.position.y << " " << state.position.z << " "
+		<< state.lookAtPos.x << " " << state.lookAtPos.y << " " << state.lookAtPos.z << " "
+		<< state.phiTheta.x << " " << state.phiTheta.y << "\n";
+}
+
+bool CameraRecording::load(const std::string &fileName)
+{
+	std::ifstream in(fileName);
+	if (!in.is_open()) return false;
+
+	frames.clear();
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (line.empty() || line[0] == '#') continue;
+
+		Camera::State state;
+		std::istringstream ss(line);
+		ss >> state.position.x >> state.position.y >> state.position.z
+			>> state.lookAtPos.x >> state.lookAtPos.y >> state.lookAtPos.z
+			>> state.phiTheta.x >> state.phiTheta.y;
+		if (ss.fail()) return false;
+
+		frames.push_back(state);
+	}
+
+	return !frames.empty();
+}
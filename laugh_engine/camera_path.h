@@ -0,0 +1,52 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+
+
+// Camera keyframes to replay, e.g. for benchmarks. The file has one "px py pz lx ly lz" line per keyframe,
+// the camera position followed by its look-at point. Lines starting with # are ignored
+class CameraPath
+{
+public:
+	bool load(const std::string &fileName);
+	static bool appendKeyframe(const std::string &fileName, const Camera &camera);
+
+	bool empty() const { return keyframes.empty(); }
+	size_t size() const { return keyframes.size(); }
+
+	// @t in [0, 1] covers the whole path with evenly spaced keyframes, positions are interpolated linearly
+	void sample(float t, glm::vec3 *pPosition, glm::vec3 *pLookAtPos) const;
+
+protected:
+	struct Keyframe
+	{
+		glm::vec3 position;
+		glm::vec3 lookAtPos;
+	};
+
+	std::vector<Keyframe> keyframes;
+};
+
+// The exact camera state of every frame of a run, replayed one state per frame independent of the frame time.
+// Each line holds the position, look-at point and azimuth/zenith angles with enough digits to restore the floats exactly
+class CameraRecording
+{
+public:
+	// Truncate @fileName and add the following frames to it
+	bool beginWrite(const std::string &fileName);
+	void endWrite();
+	bool isWriting() const { return file.is_open(); }
+	void write(const Camera::State &state);
+
+	bool load(const std::string &fileName);
+	size_t size() const { return frames.size(); }
+	const Camera::State &at(size_t frame) const { return frames[frame]; }
+
+protected:
+	std::ofstream file;
+	std::vector<Camera::State> frames;
+};
@@ -0,0 +1,126 @@
+#include "culling_bounds.h"
+
+#include <cassert>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SSE 1
+#else
+#define CULLING_SSE 0
+#endif
+
+
+namespace
+{
+	// A plane with the absolute values of its normal, which scale the extents
+	struct CullingPlane
+	{
+		glm::vec4 plane;
+		glm::vec3 absNormal;
+	};
+}
+
+void CullingBounds::resize(uint32_t newCount)
+{
+	count = newCount;
+	const size_t paddedSize = (newCount + 3) & ~3u;
+	for (auto *pArray : { &centerX, &centerY, &centerZ })
+	{
+		pArray->assign(paddedSize, 0.f);
+	}
+	for (auto *pArray : { &extentX, &extentY, &extentZ })
+	{
+		pArray->assign(paddedSize, -FLT_MAX);
+	}
+}
+
+void CullingBounds::set(uint32_t item, const BBox &box)
+{
+	assert(item < count);
+	const bool empty = glm::any(glm::greaterThan(box.min, box.max));
+	const glm::vec3 center = empty ? glm::vec3(0.f) : 0.5f * (box.min + box.max);
+	const glm::vec3 extent = empty ? glm::vec3(-FLT_MAX) : 0.5f * (box.max - box.min);
+	centerX[item] = center.x;
+	centerY[item] = center.y;
+	centerZ[item] = center.z;
+	extentX[item] = extent.x;
+	extentY[item] = extent.y;
+	extentZ[item] = extent.z;
+}
+
+void CullingBounds::setTransformed(uint32_t item, const BBox &localBox, const glm::mat4 &M)
+{
+	set(item, localBox.getTransformedAABB(M));
+}
+
+void CullingBounds::cull(const Frustum *pFrustums, uint32_t frustumCount, uint32_t nearPlaneMask, uint32_t begin, uint32_t end,
+	uint32_t *pMasks) const
+{
+	assert(frustumCount <= CULLING_MAX_FRUSTUMS && begin % 4 == 0 && end % 4 == 0 && end <= getPaddedSize());
+
+	// The planes each box is tested against, the near plane left out where it is not tested
+	CullingPlane planes[CULLING_MAX_FRUSTUMS * 6];
+	uint32_t planeCounts[CULLING_MAX_FRUSTUMS];
+	uint32_t planeCount = 0;
+	for (uint32_t f = 0; f < frustumCount; ++f)
+	{
+		planeCounts[f] = 0;
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			if (p == 4 && !(nearPlaneMask & (1u << f))) continue;
+			const glm::vec4 &plane = pFrustums[f].planes[p];
+			planes[planeCount++] = { plane, glm::abs(glm::vec3(plane)) };
+			++planeCounts[f];
+		}
+	}
+
+	// A box is outside a plane if its center is further behind it than the box reaches along the normal
+#if CULLING_SSE
+	for (uint32_t i = begin; i < end; i += 4)
+	{
+		const __m128 cx = _mm_loadu_ps(&centerX[i]);
+		const __m128 cy = _mm_loadu_ps(&centerY[i]);
+		const __m128 cz = _mm_loadu_ps(&centerZ[i]);
+		const __m128 ex = _mm_loadu_ps(&extentX[i]);
+		const __m128 ey = _mm_loadu_ps(&extentY[i]);
+		const __m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+		__m128i masks = _mm_setzero_si128();
+		const CullingPlane *pPlane = planes;
+		for (uint32_t f = 0; f < frustumCount; ++f)
+		{
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (uint32_t p = 0; p < planeCounts[f]; ++p, ++pPlane)
+			{
+				const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(pPlane->plane.x)), _mm_mul_ps(cy, _mm_set1_ps(pPlane->plane.y))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(pPlane->plane.z)), _mm_set1_ps(pPlane->plane.w)));
+				const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(pPlane->absNormal.x)), _mm_mul_ps(ey, _mm_set1_ps(pPlane->absNormal.y))),
+					_mm_mul_ps(ez, _mm_set1_ps(pPlane->absNormal.z)));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+			}
+			masks = _mm_or_si128(masks, _mm_and_si128(_mm_castps_si128(inside), _mm_set1_epi32(static_cast<int>(1u << f))));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&pMasks[i]), masks);
+	}
+#else
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		const glm::vec3 center(centerX[i], centerY[i], centerZ[i]);
+		const glm::vec3 extent(extentX[i], extentY[i], extentZ[i]);
+
+		uint32_t mask = 0;
+		const CullingPlane *pPlane = planes;
+		for (uint32_t f = 0; f < frustumCount; ++f)
+		{
+			bool inside = true;
+			for (uint32_t p = 0; p < planeCounts[f]; ++p, ++pPlane)
+			{
+				inside &= glm::dot(glm::vec3(pPlane->plane), center) + pPlane->plane.w + glm::dot(pPlane->absNormal, extent) >= 0.f;
+			}
+			if (inside) mask |= 1u << f;
+		}
+		pMasks[i] = mask;
+	}
+#endif
+}
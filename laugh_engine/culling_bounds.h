@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+#include "vmesh.h"
+
+#define CULLING_MAX_FRUSTUMS 32 // tested in one pass, one bit each in the visibility masks
+#define CULLING_ITEMS_PER_TASK 4096 // boxes a culling task tests, a multiple of 4
+
+
+// World space boxes of the scene items as centers and extents in structure of arrays, padded to a multiple of 4 boxes
+// with empty ones. A plane is tested against 4 boxes at once with SSE2 where it is available
+class CullingBounds
+{
+public:
+	void resize(uint32_t count);
+	uint32_t size() const { return count; }
+	uint32_t getPaddedSize() const { return static_cast<uint32_t>(centerX.size()); }
+
+	// Empty boxes, e.g. of meshes that are still loading, are never visible
+	void set(uint32_t item, const BBox &box);
+	// The box around @localBox transformed by the affine @M
+	void setTransformed(uint32_t item, const BBox &localBox, const glm::mat4 &M);
+
+	// Set bit f of @pMasks[i] if item i intersects @pFrustums[f], clear the others. Covers the items [@begin, @end), both
+	// multiples of 4 up to getPaddedSize(), which is the size of @pMasks. Frustums whose bit is clear in @nearPlaneMask
+	// extend infinitely behind their near plane, as with Frustum::intersects. Ranges may be culled on different threads
+	void cull(const Frustum *pFrustums, uint32_t frustumCount, uint32_t nearPlaneMask, uint32_t begin, uint32_t end, uint32_t *pMasks) const;
+
+protected:
+	uint32_t count = 0;
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ; // half sizes, -FLT_MAX for an empty box
+};
@@ -1,7 +1,26 @@
-#include "deferred_renderer.h"
+﻿#include "deferred_renderer.h"
 
 
-DeferredRenderer::DeferredRenderer()
+// The manager is created by VBaseGraphics, so the options that apply at its construction are passed on
+#ifdef USE_HOST_ALLOCATION_TRACKING
+static const bool TRACK_HOST_ALLOCATIONS = true;
+#else
+static const bool TRACK_HOST_ALLOCATIONS = false;
+#endif
+#ifdef USE_DEBUG_LABELS
+static const bool DEBUG_LABELS = true;
+#else
+static const bool DEBUG_LABELS = false;
+#endif
+#ifdef USE_DEVICE_GROUP
+static const bool DEVICE_GROUP = true;
+#else
+static const bool DEVICE_GROUP = false;
+#endif
+
+DeferredRenderer::DeferredRenderer(bool headless)
+	:
+	VBaseGraphics(headless, TRACK_HOST_ALLOCATIONS, DEBUG_LABELS, DEVICE_GROUP)
 {
 	m_verNumMajor = 0;
 	m_verNumMinor = 1;
@@ -13,2179 +32,14153 @@ DeferredRenderer::DeferredRenderer()
 	m_vulkanManager.getPhysicalDeviceProperties(&props);
 	m_oneTimeUniformHostData.setAlignment(props.limits.minUniformBufferOffsetAlignment);
 	m_perFrameUniformHostData.setAlignment(props.limits.minUniformBufferOffsetAlignment);
+
+	m_supportedSampleCounts = props.limits.framebufferColorSampleCounts & props.limits.framebufferDepthSampleCounts;
+#ifdef USE_VISIBILITY_BUFFER
+	// The material pass writes every sample of the G-buffers as storage images
+	m_supportedSampleCounts &= m_vulkanManager.isStorageImageMultisampleEnabled() ? props.limits.storageImageSampleCounts : VK_SAMPLE_COUNT_1_BIT;
+#endif
+	m_sampleCount = clampSampleCount(DEFAULT_SAMPLE_COUNT);
+	m_requestedSampleCount = m_sampleCount;
+
+	m_redrawFrameCount = ON_DEMAND_REDRAW_FRAMES;
+
+#ifdef USE_DEVICE_GROUP
+	// Frames that are not presented may come from any device
+	if (m_vulkanManager.isHeadless() || m_vulkanManager.getDeviceGroupPresentMode() != 0)
+	{
+		m_frameDeviceCount = m_vulkanManager.getDeviceCount();
+	}
+	m_deviceTemporalStates.resize(m_frameDeviceCount);
+	std::cout << "Rendering alternate frames on " << m_frameDeviceCount << " of " << m_vulkanManager.getDeviceCount() << " GPUs" << std::endl;
+#endif
+
+#ifdef USE_ADAPTIVE_CASCADES
+	// Before any shadow resource is sized by the segment count
+	m_camera.setSegmentCount(CSM_MAX_SEG_COUNT);
+#endif
+
+	m_backgroundBudget.setInitialCost(BackgroundWorkBudget::WORK_TEXTURE_UPLOAD, BACKGROUND_UPLOAD_MS_PER_MB / (1 << 20));
+	m_backgroundBudget.setInitialCost(BackgroundWorkBudget::WORK_VIRTUAL_TILE_COPY, BACKGROUND_TILE_COPY_MS);
+	m_backgroundBudget.setInitialCost(BackgroundWorkBudget::WORK_PROBE_PREFILTER, BACKGROUND_PREFILTER_MS_PER_MTEXEL * 1e-6f);
 }
 
 void DeferredRenderer::run()
 {
 	//system("pause");
+	TraceRecorder::setCurrentThreadName("main thread");
 	initVulkan();
-	prefilterEnvironmentAndComputeBrdfLut();
+	{
+		STARTUP_PHASE("prefilterEnvironmentAndComputeBrdfLut");
+		prefilterEnvironmentAndComputeBrdfLut();
+	}
+#ifdef USE_PROBE_VOLUME
+	{
+		STARTUP_PHASE("bakeProbeVolume");
+		bakeProbeVolume();
+	}
+#endif
+#ifdef USE_IMPOSTORS
+	{
+		STARTUP_PHASE("bakeImpostors");
+		bakeImpostors();
+	}
+#endif
+	reportStartupProfile();
 	mainLoop();
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+	// The window may be closed before it has finished
+	updateIblPrecomputation(true);
+#endif
+	if (m_abExperiment.isRunning()) stopABComparison();
 	savePrecomputationResults();
+	saveFrameStatistics();
 }
 
-void DeferredRenderer::updateUniformHostData()
+void DeferredRenderer::mainLoop()
 {
-	// update final output pass info
-	*m_uDisplayInfo =
+	if (!m_batchJobFileName.empty())
 	{
-		m_displayMode
-	};
-
-	// update transformation matrices
-	glm::mat4 V, P;
-	m_camera.getViewProjMatrix(V, P);
+		runBatch();
+		m_vulkanManager.deviceWaitIdle();
+		return;
+	}
 
-	m_uCameraVP->VP = P * V;
+	if (!m_farmDirectory.empty())
+	{
+		runFarmWorker();
+		m_vulkanManager.deviceWaitIdle();
+		return;
+	}
 
-	// update lighting info
-	m_uLightInfo->eyeWorldPos = m_camera.getPosition();
-	m_uLightInfo->emissiveStrength = 5.f;
-	for (uint32_t i = 0; i < 9; ++i)
+	if (!m_commandReplayFileName.empty())
 	{
-		m_uLightInfo->diffuseSHCoefficients[i] = glm::vec4(m_scene.skybox.diffuseSHCoefficients[i], 0.f);
+		runCommandReplay();
+		m_vulkanManager.deviceWaitIdle();
+		return;
 	}
-	m_uLightInfo->diffuseSHCoefficients[0].w = m_distEnvLightStrength;
-	m_uLightInfo->diracLights[0] =
+
+	if (m_warmUpPipelines)
 	{
-		glm::normalize(-m_scene.shadowLight.getDirection()),
-		0,
-		m_scene.shadowLight.getColor(),
-		0.f
-	};
+		warmUpPipelines();
+		return;
+	}
 
-	// update per model information
-	for (auto &model : m_scene.meshes)
+	if (m_benchmarkFrameCount == 0)
 	{
-		model.updateHostUniformBuffer();
+		VBaseGraphics::mainLoop();
+		return;
 	}
 
-	// shadow light information
-	std::vector<glm::vec3> frustumCornersWS;
-	std::vector<float> frustumSegmentDepths;
-	m_camera.getCornersWorldSpace(&frustumCornersWS);
-	m_camera.getSegmentDepths(&frustumSegmentDepths);
-	m_scene.shadowLight.computeCascadeScalesAndOffsets(frustumCornersWS, frustumSegmentDepths,
-		m_scene.aabbWorldSpace.min, m_scene.aabbWorldSpace.max, SHADOW_MAP_SIZE);
-	
-	m_uLightInfo->normFarPlaneZs = glm::vec4(0.f);
+	runBenchmark();
+	m_vulkanManager.deviceWaitIdle();
+}
 
-	for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
+bool DeferredRenderer::needsFrame() const
+{
+	// Loading, streaming, precomputation and trace captures finish over several frames
+	if (VBaseGraphics::needsFrame() || m_pendingModelCount > 0 || m_traceCaptureRequested || TraceRecorder::get().isCapturing() ||
+		m_abToggleRequested || m_abExperiment.isRunning())
 	{
-		glm::mat4 VP;
-		m_scene.shadowLight.getCascadeViewProjMatrix(i, &VP);
-
-		m_uShadowLightInfos[i]->cascadeVP = VP;
-		m_uLightInfo->normFarPlaneZs[i] = m_camera.getNormFarPlaneZ(i);
-		m_uLightInfo->cascadeVPs[i] = VP;
+		return true;
 	}
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+	if (!m_bakedBrdfReady || !m_scene.skybox.specMapReady) return true;
+#endif
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	// A still view keeps accumulating until it has converged
+	if (m_accumulatedFrameCount < ACCUMULATION_FRAME_COUNT) return true;
+#endif
+	return false;
 }
 
-void DeferredRenderer::updateUniformDeviceData(uint32_t imgIdx)
+void DeferredRenderer::onIdleEnd()
 {
-	void* data = m_vulkanManager.mapBuffer(m_perFrameUniformDeviceData[imgIdx].buffer);
-	memcpy(data, &m_perFrameUniformHostData, m_perFrameUniformDeviceData[imgIdx].size);
-	m_vulkanManager.unmapBuffer(m_perFrameUniformDeviceData[imgIdx].buffer);
+	// The time spent waiting for events is not a frame, so it is neither counted as a hitch nor fed to dynamic resolution
+	m_lastFrameStartTime = std::chrono::high_resolution_clock::time_point();
 }
 
-void DeferredRenderer::updateText(uint32_t imageIdx)
+void DeferredRenderer::waitForFramePacing()
 {
-	m_textOverlay.beginTextUpdate();
-
-	std::stringstream ss;
-	ss << m_windowTitle << " - ver" << m_verNumMajor << "." << m_verNumMinor;
-	m_textOverlay.addText(ss.str(), 5.0f, 5.0f, VTextOverlay::alignLeft);
-
-	ss = std::stringstream();
-	ss << std::fixed << std::setprecision(2) << "Frame Time : " << m_frameTimeCalculator.getAverageTimeMS() << " ms";
-	m_textOverlay.addText(ss.str(), 5.f, 25.f, VTextOverlay::alignLeft);
-
-	ss = std::stringstream();
-	ss << std::fixed << std::setprecision(2) << "Geom Pass Time : " << m_geomPassTimeCalculator.getAverageTimeMS() << " ms";
-	m_textOverlay.addText(ss.str(), 5.f, 45.f, VTextOverlay::alignLeft);
-
-	ss = std::stringstream();
-	ss << std::fixed << std::setprecision(2) << "Shadow Pass Time : " << m_shadowPassTimeCalculator.getAverageTimeMS() << " ms";
-	m_textOverlay.addText(ss.str(), 5.f, 65.f, VTextOverlay::alignLeft);
-
-	ss = std::stringstream();
-	ss << std::fixed << std::setprecision(2) << "Lighting Pass Time : " << m_lightingPassTimeCalculator.getAverageTimeMS() << " ms";
-	m_textOverlay.addText(ss.str(), 5.f, 85.f, VTextOverlay::alignLeft);
+	if (!m_lowLatencyMode) return;
+	TRACE_CPU_SCOPE("wait for frame pacing");
 
-	ss = std::stringstream();
-	ss << std::fixed << std::setprecision(2) << "Bloom Pass Time : " << m_bloomPassTimeCalculator.getAverageTimeMS() << " ms";
-	m_textOverlay.addText(ss.str(), 5.f, 105.f, VTextOverlay::alignLeft);
-
-	ss = std::stringstream();
-	ss << std::fixed << std::setprecision(2) << "Final Ouput Pass Time : " << m_finalOutputPassTimeCalculator.getAverageTimeMS() << " ms";
-	m_textOverlay.addText(ss.str(), 5.f, 125.f, VTextOverlay::alignLeft);
+	// Wait until the previous frame is on screen, or without present wait until it has completed on the GPU. Input is then
+	// sampled as late as possible and at most one frame is queued, which trades throughput for motion-to-photon latency
+	if (m_vulkanManager.isPresentWaitEnabled() && m_presentId > 0)
+	{
+		// Times out while the window is hidden, and the swapchain may be out of date, neither needs handling here
+		m_vulkanManager.waitForPresent(m_presentId, PRESENT_WAIT_TIMEOUT_NS);
+		return;
+	}
 
-	m_textOverlay.endTextUpdate(imageIdx);
+	const auto &prevFrameSync = m_perFrameSyncObjects[(m_currentFrame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT];
+#ifdef USE_TIMELINE_SEMAPHORES
+	m_vulkanManager.waitSemaphore(m_frameTimelineSemaphore, prevFrameSync.m_frameCompleteValue);
+#else
+	m_vulkanManager.waitForFences({ prevFrameSync.m_renderFinishedFence });
+#endif
 }
 
-void DeferredRenderer::drawFrame()
+void DeferredRenderer::runBenchmark()
 {
-	uint32_t imageIndex;
-
-	// acquired image may not be renderable because the presentation engine is still using it
-	// when @m_imageAvailableSemaphore is signaled, presentation is complete and the image can be used for rendering
-	VkResult result = m_vulkanManager.swapChainNextImageIndex(&imageIndex, m_imageAvailableSemaphore, std::numeric_limits<uint32_t>::max());
+	// A recording is replayed exactly, a path is sampled at the fraction of the measured frames done
+	const bool replay = m_cameraPlaybackRequested;
+	m_cameraPlaybackRequested = false;
 
-	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	CameraPath path;
+	if (replay && !m_cameraRecording.load(m_cameraRecordingFileName))
 	{
-		recreateSwapChain();
-		return;
+		throw std::runtime_error("failed to load camera recording " + m_cameraRecordingFileName);
 	}
-	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+	if (!replay && !path.load(m_cameraPathFileName))
 	{
-		throw std::runtime_error("failed to acquire swap chain image!");
+		std::cerr << "Unable to load camera path " << m_cameraPathFileName << ", the benchmark uses the initial camera" << std::endl;
 	}
 
-	// Swapchain image @imageIndex may still be used by the presentation engine but rendering
-	// is done. So it is safe to update the per-frame data for that swapchain image
-	updateUniformDeviceData(imageIndex);
-	updateText(imageIndex);
-
-	// Prevent overwriting render resources (e.g. G-buffers) when the GPU is still rendering
-	// Could have duplicated the resources for each swapchain image but it takes up too much memory
-	m_vulkanManager.waitForFences({ m_renderFinishedFence });
-	m_vulkanManager.resetFences({ m_renderFinishedFence });
-
-	std::vector<uint64_t> timestampsNS(TQI_QUERY_COUNT);
-	if (m_vulkanManager.getQueryPoolResults(m_perFrameQueryPools[imageIndex], TQI_QUERY_COUNT * sizeof(uint64_t),
-		sizeof(uint64_t), &timestampsNS[0], 0, TQI_QUERY_COUNT, VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+	auto moveCamera = [this, replay, &path](uint32_t measuredFrame)
 	{
-		double elapsedTime = static_cast<double>(timestampsNS[TQI_FINAL_OUTPUT_END] - timestampsNS[TQI_GEOM_START]) * 1e-6;
-		m_frameTimeCalculator.addFrameTime(elapsedTime);
-
-		elapsedTime = static_cast<double>(timestampsNS[TQI_GEOM_END] - timestampsNS[TQI_GEOM_START]) * 1e-6;
-		m_geomPassTimeCalculator.addFrameTime(elapsedTime);
-
-		elapsedTime = static_cast<double>(timestampsNS[TQI_SHADOW_END] - timestampsNS[TQI_SHADOW_START]) * 1e-6;
-		m_shadowPassTimeCalculator.addFrameTime(elapsedTime);
+		if (replay)
+		{
+			m_camera.setState(m_cameraRecording.at(measuredFrame % m_cameraRecording.size()));
+			return;
+		}
+		if (path.empty()) return;
 
-		elapsedTime = static_cast<double>(timestampsNS[TQI_LIGHTING_END] - timestampsNS[TQI_LIGHTING_START]) * 1e-6;
-		m_lightingPassTimeCalculator.addFrameTime(elapsedTime);
+		glm::vec3 position, lookAtPos;
+		path.sample(m_benchmarkFrameCount > 1 ? measuredFrame / float(m_benchmarkFrameCount - 1) : 0.f, &position, &lookAtPos);
+		m_camera.setLookAt(position, lookAtPos);
+	};
 
-		elapsedTime = static_cast<double>(timestampsNS[TQI_BLOOM_END] - timestampsNS[TQI_BLOOM_START]) * 1e-6;
-		m_bloomPassTimeCalculator.addFrameTime(elapsedTime);
+	// GPU times are collected a swapchain's worth of frames late, so the first measured ones are from the end of the warm-up
+	std::vector<std::string> passPaths; // in the order the passes were first seen
+	std::unordered_map<std::string, std::vector<float>> passTimes;
+	const float ticksToMS = m_gpuProfiler.getTimestampPeriod() * 1e-6f;
 
-		elapsedTime = static_cast<double>(timestampsNS[TQI_FINAL_OUTPUT_END] - timestampsNS[TQI_FINAL_OUTPUT_START]) * 1e-6;
-		m_finalOutputPassTimeCalculator.addFrameTime(elapsedTime);
-	}
+	const uint32_t frameCount = BENCHMARK_WARMUP_FRAMES + m_benchmarkFrameCount;
+	for (uint32_t i = 0; i < frameCount && !m_vulkanManager.windowShouldClose(); ++i)
+	{
+		const bool measured = i >= BENCHMARK_WARMUP_FRAMES;
+		if (i == BENCHMARK_WARMUP_FRAMES)
+		{
+			m_frameStatistics = FrameStatistics(std::max<uint32_t>(FRAME_STATS_HISTORY_LENGTH, m_benchmarkFrameCount), HITCH_THRESHOLD_MS);
+			resetTemporalState();
+		}
 
-	m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+		waitForFramePacing();
+		m_vulkanManager.windowPollEvents();
+		moveCamera(measured ? i - BENCHMARK_WARMUP_FRAMES : 0);
 
-	m_vulkanManager.queueSubmitNewSubmit({ m_perFrameCommandBuffers[imageIndex].m_geomShadowLightingCommandBuffer },
-		{}, {}, { m_geomAndLightingCompleteSemaphore });
+		updateUniformHostData();
+		drawFrame();
 
-	m_vulkanManager.queueSubmitNewSubmit({ m_perFrameCommandBuffers[imageIndex].m_postEffectCommandBuffer },
-		{ m_geomAndLightingCompleteSemaphore }, { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }, { m_postEffectSemaphore });
+		if (!measured) continue;
+		for (const auto &scope : m_gpuProfiler.getLastFrameTimestamps())
+		{
+			auto &times = passTimes[scope.path];
+			if (times.empty()) passPaths.push_back(scope.path);
+			times.push_back(static_cast<float>(scope.end - scope.begin) * ticksToMS);
+		}
+	}
 
-	m_vulkanManager.queueSubmitNewSubmit({ m_perFrameCommandBuffers[imageIndex].m_presentCommandBuffer },
-		{ m_postEffectSemaphore, m_imageAvailableSemaphore },
-		{ VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }, { m_finalOutputFinishedSemaphore });
+	summarizeBenchmark(passPaths, passTimes);
+	if (!saveBenchmarkResults(passPaths, passTimes))
+	{
+		std::cerr << "Unable to save benchmark results to " << m_benchmarkFileName << std::endl;
+	}
+}
 
-	m_vulkanManager.endQueueSubmit(m_renderFinishedFence, false);
+void DeferredRenderer::summarizeBenchmark(const std::vector<std::string> &passPaths,
+	const std::unordered_map<std::string, std::vector<float>> &passTimes)
+{
+	// Memory is taken at the end, once every frame resource exists
+	m_benchmarkSummary = BenchmarkSummary();
+	m_benchmarkSummary.cpuMS = m_frameStatistics.getCpuPercentiles();
+	m_benchmarkSummary.gpuMS = m_frameStatistics.getGpuPercentiles();
+	for (const auto &path : passPaths)
+	{
+		const auto &times = passTimes.at(path);
+		float sum = 0.f;
+		for (float t : times) sum += t;
+		m_benchmarkSummary.passAvgMS.emplace_back(path, sum / times.size());
+	}
+	for (const auto &heap : m_vulkanManager.getMemoryHeapBudgets())
+	{
+		(heap.isDeviceLocal ? m_benchmarkSummary.deviceLocalBytes : m_benchmarkSummary.hostVisibleBytes) += heap.reservedBytes;
+	}
+	for (const auto &mesh : m_scene.meshes)
+	{
+		if (!mesh.isLoaded()) continue;
+		m_benchmarkSummary.triangleCount += uint64_t(mesh.lods[0].indexCount / 3) * mesh.getInstanceCount();
+	}
+}
 
-	m_textOverlay.submit(imageIndex, { m_finalOutputFinishedSemaphore }, { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT },
-		{ m_renderFinishedSemaphore });
+void DeferredRenderer::runCommandReplay()
+{
+	rj::VCommandCapture capture;
+	if (!capture.read(m_commandReplayFileName))
+	{
+		throw std::runtime_error("failed to read command capture " + m_commandReplayFileName);
+	}
 
-	result = m_vulkanManager.queuePresent({ m_renderFinishedSemaphore }, imageIndex);
+	// The capture refers to resources by the names they had once the scene was loaded, which they get again here
+	for (uint32_t settledFrames = 0; settledFrames <= COMMAND_CAPTURE_SETTLE_FRAMES && !m_vulkanManager.windowShouldClose(); )
+	{
+		settledFrames = m_pendingModelCount > 0 ? 0 : settledFrames + 1;
+		waitForFramePacing();
+		m_vulkanManager.windowPollEvents();
+		updateUniformHostData();
+		drawFrame();
+	}
+	m_vulkanManager.deviceWaitIdle();
 
-	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+	const std::string error = m_vulkanManager.checkCommandCapture(capture);
+	if (!error.empty())
 	{
-		recreateSwapChain();
+		throw std::runtime_error(m_commandReplayFileName + " was not captured with this build, settings and scene: " + error);
 	}
-	else if (result != VK_SUCCESS)
+	if (capture.droppedCommandCount > 0)
 	{
-		throw std::runtime_error("failed to present swap chain image!");
+		std::cerr << capture.droppedCommandCount << " readbacks of the captured frame are not replayed" << std::endl;
 	}
-}
 
-void DeferredRenderer::createQueryPools()
-{
-	if (m_initialized)
+	// Scopes keep their queries from one run to the next, so the profiler reads the replayed frame like one it recorded.
+	// The CPU time is the replay's own, recording and submitting the frame and waiting for it
+	std::vector<std::string> passPaths;
+	std::unordered_map<std::string, std::vector<float>> passTimes;
+	const float ticksToMS = m_gpuProfiler.getTimestampPeriod() * 1e-6f;
+	const uint32_t fence = m_vulkanManager.createFence();
+	const uint32_t frameCount = m_benchmarkFrameCount > 0 ? m_benchmarkFrameCount : COMMAND_REPLAY_FRAMES;
+	m_frameStatistics = FrameStatistics(std::max<uint32_t>(FRAME_STATS_HISTORY_LENGTH, frameCount), HITCH_THRESHOLD_MS);
+
+	for (uint32_t i = 0; i < frameCount && !m_vulkanManager.windowShouldClose(); ++i)
 	{
-		for (auto queryPoolName : m_perFrameQueryPools)
+		m_vulkanManager.windowPollEvents();
+		const auto startTime = std::chrono::high_resolution_clock::now();
+		m_vulkanManager.replayCommandCapture(capture, fence);
+		m_vulkanManager.resetFences({ fence });
+		const float cpuTimeMS = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+		m_gpuProfiler.collect(capture.frameIdx);
+		m_frameStatistics.addFrame(cpuTimeMS, m_gpuProfiler.getLastFrameTimeMS());
+		for (const auto &scope : m_gpuProfiler.getLastFrameTimestamps())
 		{
-			m_vulkanManager.destroyQueryPool(queryPoolName);
+			auto &times = passTimes[scope.path];
+			if (times.empty()) passPaths.push_back(scope.path);
+			times.push_back(static_cast<float>(scope.end - scope.begin) * ticksToMS);
 		}
 	}
-	
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	m_perFrameQueryPools.resize(swapChainImageCount);
 
-	for (uint32_t i = 0; i < swapChainImageCount; ++i)
+	summarizeBenchmark(passPaths, passTimes);
+	if (!saveBenchmarkResults(passPaths, passTimes))
 	{
-		m_perFrameQueryPools[i] = m_vulkanManager.createQueryPool(VK_QUERY_TYPE_TIMESTAMP, TQI_QUERY_COUNT);
+		std::cerr << "Unable to save benchmark results to " << m_benchmarkFileName << std::endl;
 	}
 }
 
-void DeferredRenderer::createRenderPasses()
+void DeferredRenderer::warmUpPipelines()
 {
-	createSpecEnvPrefilterRenderPass();
-	createGeometryRenderPass();
-	createShadowRenderPass();
-	createLightingRenderPass();
-	createBloomRenderPasses();
-	createFinalOutputRenderPass();
-}
+	// initVulkan() has created every pipeline of the startup settings. What the settings can switch to at runtime is the
+	// sample count and the *_fp16 shaders, whose pipelines are rebuilt in parallel batches. Each sample count is visited
+	// with both precisions, as the lighting pipeline depends on both
+	const uint32_t precisionCount = m_vulkanManager.isShaderFloat16Enabled() ? 2 : 1;
 
-void DeferredRenderer::createDescriptorSetLayouts()
-{
-	createBrdfLutDescriptorSetLayout();
-	createSpecEnvPrefilterDescriptorSetLayout();
-	createGeomPassDescriptorSetLayout();
-	createShadowPassDescriptorSetLayout();
-	createLightingPassDescriptorSetLayout();
-	createBloomDescriptorSetLayout();
-	createFinalOutputDescriptorSetLayout();
-}
+	uint32_t configCount = 0;
+	for (uint32_t count = VK_SAMPLE_COUNT_1_BIT; count <= VK_SAMPLE_COUNT_64_BIT; count <<= 1)
+	{
+		const VkSampleCountFlagBits sampleCount = static_cast<VkSampleCountFlagBits>(count);
+		if (clampSampleCount(sampleCount) != sampleCount) continue;
 
-void DeferredRenderer::createComputePipelines()
-{
-	createBrdfLutPipeline();
-}
+		if (sampleCount != m_sampleCount) applySampleCount(sampleCount);
+		// The other precision, which the next sample count then starts with
+		if (precisionCount > 1) applyHalfPrecision(!m_halfPrecisionShaders);
+		configCount += precisionCount;
+	}
+	m_vulkanManager.deviceWaitIdle();
 
-void DeferredRenderer::createGraphicsPipelines()
-{
-	createSpecEnvPrefilterPipeline();
-	createGeomPassPipeline();
-	createShadowPassPipeline();
-	createLightingPassPipeline();
-	createBloomPipelines();
-	createFinalOutputPassPipeline();
+	m_vulkanManager.savePipelineCache();
+	std::cout << "Compiled the pipelines of " << configCount << " configurations into " << PIPELINE_CACHE_FILE_NAME << std::endl;
 }
 
-void DeferredRenderer::createCommandPools()
+void DeferredRenderer::beginRequestedCommandCapture()
 {
-	m_graphicsCommandPool = m_vulkanManager.createCommandPool(VK_QUEUE_GRAPHICS_BIT);
-	m_computeCommandPool = m_vulkanManager.createCommandPool(VK_QUEUE_COMPUTE_BIT);
-}
+	if (m_commandCaptureFileName.empty() || m_pCommandCapture) return;
 
-void DeferredRenderer::createComputeResources()
-{
-	using namespace rj::helper_functions;
+	m_commandCaptureSettledFrames = m_pendingModelCount > 0 ? 0 : m_commandCaptureSettledFrames + 1;
+	if (m_commandCaptureSettledFrames <= COMMAND_CAPTURE_SETTLE_FRAMES) return;
 
-	// BRDF LUT
-	std::string brdfFileName = "";
-	if (fileExist(BRDF_BASE_DIR BRDF_NAME))
+	// A command buffer recorded in an earlier frame would be submitted without its commands in the capture
+	for (auto &cbs : m_perFrameCommandBuffers)
 	{
-		brdfFileName = BRDF_BASE_DIR BRDF_NAME;
+		cbs.m_dirtyMask |= CB_DIRTY_ALL;
 	}
+	m_pCommandCapture.reset(new rj::VCommandCapture());
+	m_vulkanManager.beginCommandCapture(m_pCommandCapture.get());
+}
 
-	m_bakedBRDFs.resize(1, {});
+void DeferredRenderer::finishCommandCapture(uint32_t imgIdx)
+{
+	m_vulkanManager.endCommandCapture();
+	m_pCommandCapture->frameIdx = imgIdx;
 
-	if (brdfFileName != "")
+	if (m_pCommandCapture->write(m_commandCaptureFileName))
 	{
-		// Do not generate mip levels for BRDF LUTs
-		loadTexture2D(&m_bakedBRDFs[0], &m_vulkanManager, brdfFileName, false);
-		m_bakedBRDFs[0].samplers.resize(1);
-		m_bakedBRDFs[0].samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
-			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
-		m_bakedBrdfReady = true;
+		std::cout << "Command capture saved to " << m_commandCaptureFileName << std::endl;
 	}
 	else
 	{
-		m_bakedBRDFs[0].format = VK_FORMAT_R32G32_SFLOAT;
-		m_bakedBRDFs[0].width = BRDF_LUT_SIZE;
-		m_bakedBRDFs[0].height = BRDF_LUT_SIZE;
-		m_bakedBRDFs[0].depth = 1;
-		m_bakedBRDFs[0].mipLevelCount = 1;
-		m_bakedBRDFs[0].layerCount = 1;
+		std::cerr << "Unable to save command capture to " << m_commandCaptureFileName << std::endl;
+	}
+	if (m_pCommandCapture->droppedCommandCount > 0)
+	{
+		std::cerr << m_pCommandCapture->droppedCommandCount << " readbacks are left out of the command capture" << std::endl;
+	}
+	m_commandCaptureFileName.clear();
+	m_pCommandCapture.reset();
+}
 
-		m_bakedBRDFs[0].image = m_vulkanManager.createImage2D(m_bakedBRDFs[0].width, m_bakedBRDFs[0].height, m_bakedBRDFs[0].format,
-			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+std::string DeferredRenderer::checkRenderJobs(const RenderJobList &jobs)
+{
+#ifdef USE_PROBE_SWITCHING
+	const uint32_t probeDirCount = static_cast<uint32_t>(std::vector<std::string>(PROBE_BASE_DIRS).size());
+#else
+	const uint32_t probeDirCount = 0;
+#endif
+	for (size_t n = 0; n < jobs.size(); ++n)
+	{
+		if (jobs.at(n).environment >= static_cast<int32_t>(probeDirCount))
+		{
+			return jobs.at(n).outputFileName + " asks for an environment that is not available, see USE_PROBE_SWITCHING";
+		}
+	}
+	return std::string();
+}
 
-		m_vulkanManager.transitionImageLayout(m_bakedBRDFs[0].image, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_GENERAL);
+void DeferredRenderer::runBatch()
+{
+	assert(m_vulkanManager.isHeadless());
 
-		m_bakedBRDFs[0].imageViews.resize(1);
-		m_bakedBRDFs[0].imageViews[0] = m_vulkanManager.createImageView2D(m_bakedBRDFs[0].image, VK_IMAGE_ASPECT_COLOR_BIT);
+	RenderJobList jobs;
+	if (!jobs.load(m_batchJobFileName))
+	{
+		throw std::runtime_error("failed to load render jobs " + m_batchJobFileName);
+	}
+	const std::string error = checkRenderJobs(jobs);
+	if (!error.empty())
+	{
+		throw std::runtime_error(error);
+	}
 
-		m_bakedBRDFs[0].samplers.resize(1);
-		m_bakedBRDFs[0].samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
-			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	// Declared first so the readbacks still in flight when this returns can hand their frames to it
+	JobPool writers(BATCH_WRITER_THREAD_COUNT);
+	renderJobs(jobs, &writers, nullptr);
 
-		m_shouldSaveBakedBrdf = true;
-	}
+	// Completes the last readbacks, then waits for their files. Rethrows the first failed write
+	m_vulkanManager.deviceWaitIdle();
+	writers.waitAll();
 }
 
-void DeferredRenderer::createDepthResources()
+void DeferredRenderer::runFarmWorker()
 {
-	if (m_initialized)
+	assert(m_vulkanManager.isHeadless());
+
+	RenderFarm farm(m_farmDirectory);
+	if (!farm.init())
 	{
-		m_vulkanManager.destroyImage(m_depthImage.image);
+		throw std::runtime_error("cannot write to the render farm " + m_farmDirectory);
+	}
+	farm.releaseShards(m_farmWorkerName);
+	std::cout << "render farm worker " << m_farmWorkerName << " waiting for shards in " << m_farmDirectory << std::endl;
 
-		for (auto name : m_depthImage.imageViews)
+	// The heartbeat goes on through a shard, which may render for longer than the timeout. Stopped however the loop is left
+	struct Heartbeat
+	{
+		std::mutex mutex;
+		std::condition_variable stopped;
+		bool stop = false;
+		std::thread thread;
+
+		~Heartbeat()
 		{
-			m_vulkanManager.destroyImageView(name);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			stopped.notify_one();
+			if (thread.joinable()) thread.join();
 		}
+	} heartbeat;
+	heartbeat.thread = std::thread([&farm, &heartbeat, this]()
+	{
+		std::unique_lock<std::mutex> lock(heartbeat.mutex);
+		do
+		{
+			farm.heartbeat(m_farmWorkerName);
+		} while (!heartbeat.stopped.wait_for(lock, std::chrono::milliseconds(RENDER_FARM_HEARTBEAT_MS), [&heartbeat]() { return heartbeat.stop; }));
+	});
 
-		for (auto name : m_depthImage.samplers)
+	JobPool writers(BATCH_WRITER_THREAD_COUNT);
+	while (!farm.isStopRequested())
+	{
+		// Shards in these environments render without loading and prefiltering one first
+		std::vector<int32_t> warmEnvironments;
+#ifdef USE_PROBE_SWITCHING
+		for (const auto &probe : m_residentProbes)
 		{
-			m_vulkanManager.destroySampler(name);
+			warmEnvironments.push_back(static_cast<int32_t>(probe.dirIdx));
+			if (probe.dirIdx == 0) warmEnvironments.push_back(-1);
 		}
-
-		m_vulkanManager.destroyImage(m_shadowImage.image);
-
-		for (auto name : m_shadowImage.imageViews)
+#endif
+		RenderFarm::Shard shard;
+		if (!farm.claimShard(m_farmWorkerName, warmEnvironments, &shard))
 		{
-			m_vulkanManager.destroyImageView(name);
+			std::this_thread::sleep_for(std::chrono::milliseconds(RENDER_FARM_POLL_MS));
+			continue;
 		}
 
-		for (auto name : m_shadowImage.samplers)
+		// The coordinator checks the jobs with the same build, this only fails with a mismatched one. The shard is given up
+		// rather than left to the next worker, and its outputs are missing from the coordinator's count
+		RenderJobList jobs;
+		const std::string jobFileName = farm.getShardJobFileName(m_farmWorkerName, shard);
+		const std::string error = jobs.load(jobFileName) ? checkRenderJobs(jobs) : "failed to load render jobs " + jobFileName;
+		if (!error.empty())
 		{
-			m_vulkanManager.destroySampler(name);
+			std::cerr << error << std::endl;
+			farm.shardDone(m_farmWorkerName, shard);
+			continue;
 		}
-	}
 
-	VkExtent2D swapChainExtent = m_vulkanManager.getSwapChainExtent();
-	VkFormat depthFormat = findDepthFormat();
-
-	m_depthImage.format = depthFormat;
-	m_depthImage.width = swapChainExtent.width;
-	m_depthImage.height = swapChainExtent.height;
-	m_depthImage.depth = 1;
-	m_depthImage.mipLevelCount = 1;
-	m_depthImage.layerCount = 1;
-	m_depthImage.sampleCount = SAMPLE_COUNT;
-
-	m_depthImage.image = m_vulkanManager.createImage2D(m_depthImage.width, m_depthImage.height, m_depthImage.format,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, 1, SAMPLE_COUNT);
-
-	m_depthImage.imageViews.resize(1);
-	VkImageAspectFlags aspectMask =
-		rj::helper_functions::hasStencilComponent(depthFormat) ? (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT) : VK_IMAGE_ASPECT_DEPTH_BIT;
-	m_depthImage.imageViews[0] = m_vulkanManager.createImageView2D(m_depthImage.image, aspectMask);
-
-	m_vulkanManager.transitionImageLayout(m_depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-
-	m_depthImage.samplers.resize(1);
-	m_depthImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
-		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
-
-	// Layered image used to store shadow maps
-	m_shadowImage.format = depthFormat;
-	m_shadowImage.width = SHADOW_MAP_SIZE;
-	m_shadowImage.height = SHADOW_MAP_SIZE;
-	m_shadowImage.depth = 1;
-	m_shadowImage.mipLevelCount = 1;
-	m_shadowImage.layerCount = m_camera.getSegmentCount();
-	m_shadowImage.sampleCount = VK_SAMPLE_COUNT_1_BIT;
-
-	m_shadowImage.image = m_vulkanManager.createImage2D(m_shadowImage.width, m_shadowImage.height, m_shadowImage.format,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_shadowImage.mipLevelCount, m_shadowImage.layerCount);
+		std::cout << "shard " << shard.name << std::endl;
+#ifdef USE_PROBE_SWITCHING
+		// The jobs of a shard without an environment expect the one loaded at startup
+		if (shard.environment < 0) m_requestedProbeDir = 0;
+#endif
+		const size_t firstWrite = writers.getJobCount();
+		renderJobs(jobs, &writers, [&farm, shard](const std::string &fileName) { farm.outputWritten(shard, fileName); });
 
-	m_shadowImage.imageViews.resize(m_camera.getSegmentCount() + 1);
-	for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
-	{
-		m_shadowImage.imageViews[i] = m_vulkanManager.createImageView2D(m_shadowImage.image, aspectMask, 0, m_shadowImage.mipLevelCount, i);
+		// The shard is done once its last readbacks are written
+		m_vulkanManager.deviceWaitIdle();
+		writers.wait(firstWrite, writers.getJobCount());
+		farm.shardDone(m_farmWorkerName, shard);
 	}
-	m_shadowImage.imageViews.back() = m_vulkanManager.createImageView(m_shadowImage.image, VK_IMAGE_VIEW_TYPE_2D_ARRAY,
-		aspectMask, 0, m_shadowImage.mipLevelCount, 0, m_shadowImage.layerCount);
-
-	m_vulkanManager.transitionImageLayout(m_shadowImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-
-	m_shadowImage.samplers.resize(1);
-	m_shadowImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
-		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
-		0.f, 0.f, 0.f, VK_FALSE, 0.f, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL, VK_BORDER_COLOR_INT_OPAQUE_WHITE);
 }
 
-void DeferredRenderer::createColorAttachmentResources()
+void DeferredRenderer::renderJobs(const RenderJobList &jobs, JobPool *pWriters, const std::function<void(const std::string &)> &outputWritten)
 {
-	if (m_initialized)
+	// The frame's readback is copied out of the ring buffer on the main thread, encoding and writing it happens on the writers
+	auto keepNextFrame = [this, pWriters, &outputWritten](const std::string &fileName)
 	{
-		for (const auto &image : m_gbufferImages)
+		m_frameCaptureCallback = [pWriters, outputWritten, fileName](const char *data, VkDeviceSize sizeInBytes, uint32_t width, uint32_t height,
+			VkFormat format, uint64_t)
 		{
-			m_vulkanManager.destroyImage(image.image);
-
-			for (auto name : image.imageViews)
+			assert(format == VK_FORMAT_B8G8R8A8_UNORM);
+			std::shared_ptr<std::vector<char>> texels(new std::vector<char>(data, data + sizeInBytes));
+			pWriters->add([texels, outputWritten, fileName, width, height]()
 			{
-				m_vulkanManager.destroyImageView(name);
-			}
+				rj::helper_functions::saveImage2D(fileName, width, height, 4, 1, gli::FORMAT_BGRA8_UNORM_PACK8, texels->data());
+				if (outputWritten) outputWritten(fileName);
+			});
+		};
+	};
 
-			for (auto name : image.samplers)
-			{
-				m_vulkanManager.destroySampler(name);
-			}
-		}
+	auto renderFrame = [this]()
+	{
+		waitForFramePacing();
+		updateUniformHostData();
+		drawFrame();
+	};
 
-		m_vulkanManager.destroyImage(m_lightingResultImage.image);
+	for (size_t n = 0; n < jobs.size(); ++n)
+	{
+		const RenderJob &job = jobs.at(n);
+		std::cout << "job " << n + 1 << " of " << jobs.size() << ": " << job.outputFileName << std::endl;
 
-		for (auto name : m_lightingResultImage.imageViews)
+		const VkExtent2D extent = m_vulkanManager.getSwapChainExtent();
+		if (job.width != extent.width || job.height != extent.height)
 		{
-			m_vulkanManager.destroyImageView(name);
+			m_vulkanManager.windowSetHeadlessExtent(job.width, job.height);
+			recreateSwapChain();
 		}
 
-		for (auto name : m_lightingResultImage.samplers)
-		{
-			m_vulkanManager.destroySampler(name);
-		}
+#ifdef USE_PROBE_SWITCHING
+		if (job.environment >= 0) m_requestedProbeDir = static_cast<uint32_t>(job.environment);
+		const int32_t nextEnvironment = n + 1 < jobs.size() ? jobs.at(n + 1).environment : -1;
+		m_prefetchProbeDir = nextEnvironment >= 0 ? static_cast<uint32_t>(nextEnvironment) : std::numeric_limits<uint32_t>::max();
+#endif
 
-		for (const auto &image : m_postEffectImages)
-		{
-			m_vulkanManager.destroyImage(image.image);
+		glm::vec3 position, lookAtPos;
+		job.getCamera(0, &position, &lookAtPos);
+		m_camera.setLookAt(position, lookAtPos);
+		resetTemporalState();
 
-			for (auto name : image.imageViews)
+		// Frames that are not kept until the scene is complete and the temporal effects have converged on the first camera
+		m_frameCaptureCallback = nullptr;
+		for (uint32_t i = 0; ; ++i)
+		{
+			// Frames alternate between the devices of a group, each of them converges on its own
+			bool settled = i >= BATCH_SETTLE_FRAMES * m_frameDeviceCount && m_pendingModelCount == 0;
+#ifdef USE_PROBE_SWITCHING
+			settled = settled && m_residentProbes[m_currentProbe].dirIdx == m_requestedProbeDir;
+#endif
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+			settled = settled && m_bakedBrdfReady && m_scene.skybox.specMapReady;
+#endif
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+			settled = settled && (job.frameCount > 1 || m_accumulatedFrameCount + 1 >= ACCUMULATION_FRAME_COUNT);
+#ifdef USE_DEVICE_GROUP
+			for (uint32_t d = 0; d < m_frameDeviceCount; ++d)
 			{
-				m_vulkanManager.destroyImageView(name);
+				if (d == m_temporalStateDevice) continue;
+				settled = settled && (job.frameCount > 1 || m_deviceTemporalStates[d].accumulatedFrameCount + 1 >= ACCUMULATION_FRAME_COUNT);
 			}
+#endif
+#endif
+			if (settled) break;
+			renderFrame();
+		}
 
-			for (auto name : image.samplers)
-			{
-				m_vulkanManager.destroySampler(name);
-			}
+		for (uint32_t frame = 0; frame < job.frameCount; ++frame)
+		{
+			job.getCamera(frame, &position, &lookAtPos);
+			m_camera.setLookAt(position, lookAtPos);
+			keepNextFrame(job.getOutputFileName(frame));
+			renderFrame();
 		}
+		m_frameCaptureCallback = nullptr;
 	}
+}
 
-	VkExtent2D swapChainExtent = m_vulkanManager.getSwapChainExtent();
+void DeferredRenderer::updateUniformHostData()
+{
+	TRACE_CPU_SCOPE("updateUniformHostData");
 
-	// Gbuffer images
-	m_gbufferImages.resize(m_numGBuffers);
-	for (uint32_t i = 0; i < m_numGBuffers; ++i)
-	{
-		auto &image = m_gbufferImages[i];
-		image.format = m_gbufferFormats[i];
-		image.width = swapChainExtent.width;
-		image.height = swapChainExtent.height;
-		image.depth = 1;
-		image.mipLevelCount = 1;
-		image.layerCount = 1;
-		image.sampleCount = SAMPLE_COUNT;
+	// Nothing allocated from the arena outlives the frame. The per-frame temporaries below use it, so once the arena
+	// has grown to what a frame needs this path no longer calls the heap
+	m_frameArena.reset();
+	// The previous frame waited for all its tasks before submitting
+	m_frameTasks.reset();
+	beginRequestedCommandCapture();
+	m_backgroundBudget.beginFrame(m_gpuProfiler.getLastFrameTimeMS());
 
-		image.image = m_vulkanManager.createImage2D(image.width, image.height, image.format,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, 1, SAMPLE_COUNT);
+	updateABComparison();
 
-		image.imageViews.resize(1);
-		image.imageViews[0] = m_vulkanManager.createImageView2D(image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+#ifdef USE_STREAMING_ASSETS
+	updateStreamingAssets();
+#endif
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+	updateIblPrecomputation(false);
+#endif
+#ifdef USE_PROBE_SWITCHING
+	updateProbeSwitching();
+#endif
+	updateDrawRecords();
 
-		image.samplers.resize(1);
-		image.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
-			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+#ifdef USE_AUTO_EXPOSURE
+	{
+		// The first frame jumps straight to its target exposure
+		const auto now = std::chrono::high_resolution_clock::now();
+		const bool firstUpdate = m_lastExposureUpdateTime == std::chrono::high_resolution_clock::time_point();
+		m_uAutoExposureInfo->deltaTime = firstUpdate ? 1e6f : std::chrono::duration<float>(now - m_lastExposureUpdateTime).count();
+		m_lastExposureUpdateTime = now;
+#ifdef USE_DEVICE_GROUP
+		// The exposure of each device only adapts in the frames of that device
+		m_uAutoExposureInfo->deltaTime *= m_frameDeviceCount;
+#endif
+		m_perFrameUniformHostData.markDirty(m_uAutoExposureInfo);
 	}
+#endif
 
-	// Lighting result image
-	m_lightingResultImage.format = m_lightingResultImageFormat;
-	m_lightingResultImage.width = swapChainExtent.width;
-	m_lightingResultImage.height = swapChainExtent.height;
-	m_lightingResultImage.depth = 1;
-	m_lightingResultImage.mipLevelCount = 1;
-	m_lightingResultImage.layerCount = 1;
-
-	m_lightingResultImage.image = m_vulkanManager.createImage2D(m_lightingResultImage.width, m_lightingResultImage.height, m_lightingResultImage.format,
-		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	// update final output pass info
+	if (m_uDisplayInfo->displayMode != m_displayMode)
+	{
+		m_uDisplayInfo->displayMode = m_displayMode;
+		m_perFrameUniformHostData.markDirty(m_uDisplayInfo);
+#ifdef USE_COLOR_LUT
+		// The present command buffers bind the pipeline of the display mode
+		for (auto &cbs : m_perFrameCommandBuffers)
+		{
+			cbs.m_dirtyMask |= CB_DIRTY_PRESENT;
+		}
+#endif
+	}
 
-	m_lightingResultImage.imageViews.resize(1);
-	m_lightingResultImage.imageViews[0] = m_vulkanManager.createImageView2D(m_lightingResultImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+#ifdef USE_MULTI_VIEW
+	// Sets the camera's aspect ratio to that of view 0
+	updateViews();
+#endif
 
-	m_lightingResultImage.samplers.resize(1);
-	m_lightingResultImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
-		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	// update transformation matrices
+	glm::mat4 V, P;
+	m_camera.getViewProjMatrix(V, P);
 
-	// post effects - perform post processing on 1/2 resolution for the sake of performance
-	m_postEffectImages.resize(m_numPostEffectImages);
-	for (uint32_t i = 0; i < m_numPostEffectImages; ++i)
+	m_uCameraVP->VP = P * V;
+#ifdef USE_TAA
+#ifdef USE_DEVICE_GROUP
+	selectFrameDeviceState();
+#endif
+	// Offset the projection by a sub-pixel amount that cycles through a Halton(2, 3) sequence
 	{
-		auto &image = m_postEffectImages[i];
-		image.format = m_postEffectImageFormats[i];
-		image.width = swapChainExtent.width >> 1;
-		image.height = swapChainExtent.height >> 1;
-		image.depth = 1;
-		image.mipLevelCount = 1;
-		image.layerCount = 1;
-
-		image.image = m_vulkanManager.createImage2D(image.width, image.height, image.format,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-		image.imageViews.resize(1);
-		image.imageViews[0] = m_vulkanManager.createImageView2D(image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		const VkExtent2D renderExtent = getRenderExtent();
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+		// A still view walks through a longer sequence than the TAA cycle, so the average has more distinct samples
+		const uint64_t sceneVersion = m_materialsVersion + m_iblVersion;
+		const bool still = m_taaHistoryValid && m_uCameraVP->VP == m_prevUnjitteredVP && sceneVersion == m_accumulationSceneVersion;
+		m_accumulationSceneVersion = sceneVersion;
+		m_accumulatedFrameCount = still ? std::min(m_accumulatedFrameCount + 1, static_cast<uint32_t>(ACCUMULATION_FRAME_COUNT)) : 0;
+		const uint32_t jitterIdx = still ? m_accumulatedFrameCount : m_taaFrameIndex % TAA_JITTER_SAMPLE_COUNT + 1;
+#else
+		const uint32_t jitterIdx = m_taaFrameIndex % TAA_JITTER_SAMPLE_COUNT + 1;
+#endif
+		const glm::vec2 jitter = (glm::vec2(rj::helper_functions::halton(jitterIdx, 2), rj::helper_functions::halton(jitterIdx, 3)) - 0.5f) *
+			2.f / glm::vec2(renderExtent.width, renderExtent.height);
+		glm::mat4 jitteredP = P;
+		jitteredP[2][0] += jitter.x;
+		jitteredP[2][1] += jitter.y;
+
+		m_uCameraVP->unjitteredVP = m_uCameraVP->VP;
+		m_uCameraVP->prevUnjitteredVP = m_taaHistoryValid ? m_prevUnjitteredVP : m_uCameraVP->VP;
+		m_uCameraVP->VP = jitteredP * V;
+		m_prevUnjitteredVP = m_uCameraVP->unjitteredVP;
+
+		m_uTaaInfo->jitter = jitter;
+		m_uTaaInfo->historyWeight = m_taaHistoryValid ? TAA_HISTORY_WEIGHT : 0.f;
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+		// Running mean of the frames in the history and this one. A converged history is kept as it is
+		if (still)
+		{
+			m_uTaaInfo->historyWeight = m_accumulatedFrameCount < ACCUMULATION_FRAME_COUNT ?
+				m_accumulatedFrameCount / (m_accumulatedFrameCount + 1.f) : 1.f;
+		}
+		m_uTaaInfo->accumulate = still ? 1.f : 0.f;
+#endif
+		m_perFrameUniformHostData.markDirty(m_uTaaInfo);
 
-		image.samplers.resize(1);
-		image.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
-			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+		// The frame recorded now leaves a valid history behind
+		m_taaHistoryValid = true;
+		++m_taaFrameIndex;
 	}
-}
+#endif
+#ifdef USE_MULTI_VIEW
+	m_views[0].V = V;
+	m_views[0].P = P;
+	m_views[0].eyeWorldPos = m_camera.getPosition();
+	for (uint32_t v = 0; v < m_viewCount; ++v)
+	{
+		const RenderView &view = m_views[v];
+		m_uCameraVP->viewVPs[v] = view.P * view.V;
+		m_uLightInfo->viewEyeWorldPos[v] = glm::vec4(view.eyeWorldPos, 0.f);
+		m_uLightInfo->viewRects[v] = view.rect;
+		m_uLightInfo->viewVP_invs[v] = glm::inverse(m_uCameraVP->viewVPs[v]);
+	}
+#endif
+	m_perFrameUniformHostData.markDirty(m_uCameraVP);
 
-// TODO: implement scene file to allow flexible model loading
-void DeferredRenderer::loadAndPrepareAssets()
-{
-	using namespace rj::helper_functions;
+#ifdef USE_COMPACT_GBUFFER
+	// Positions are reconstructed from depth
+	m_uDisplayInfo->P_inv = glm::inverse(P);
+	m_perFrameUniformHostData.markDirty(m_uDisplayInfo);
+	m_uLightInfo->VP_inv = glm::inverse(m_uCameraVP->VP);
+#endif
 
-	// Skybox
-	std::string skyboxFileName = "../models/sky_sphere.obj";
-	std::string unfilteredProbeFileName = PROBE_BASE_DIR "Unfiltered_HDR.dds";
-	std::string specProbeFileName = "";
-	if (fileExist(PROBE_BASE_DIR "Specular_HDR.dds"))
+	// update lighting info
+	m_uLightInfo->eyeWorldPos = m_camera.getPosition();
+
+	// The static block is rebuilt here but only marked dirty, and so uploaded, when the environment or the lights changed
+	LightingStaticUniformBuffer lightStaticInfo = {};
+	lightStaticInfo.emissiveStrength = 5.f;
+#ifdef USE_PROBE_VOLUME
+	// Maps world positions to the volume's texture coordinates
+	lightStaticInfo.probeVolumeMin = glm::vec4(m_probeVolumeBounds.min, 0.f);
+	lightStaticInfo.probeVolumeInvExtent = glm::vec4(1.f / (m_probeVolumeBounds.max - m_probeVolumeBounds.min), 0.f);
+#endif
+#ifndef USE_GPU_SH_PROJECTION
+	for (uint32_t i = 0; i < 9; ++i)
 	{
-		specProbeFileName = PROBE_BASE_DIR "Specular_HDR.dds";
+		lightStaticInfo.diffuseSHCoefficients[i] = glm::vec4(m_scene.skybox.diffuseSHCoefficients[i], 0.f);
 	}
-	std::string diffuseProbeFileName = "";
-	if (fileExist(PROBE_BASE_DIR "Diffuse_SH.bin"))
+#endif
+	// The coefficients come from @m_diffuseSHBuffer with USE_GPU_SH_PROJECTION, the strength stays here
+	lightStaticInfo.diffuseSHCoefficients[0].w = m_distEnvLightStrength;
+	lightStaticInfo.diracLights[0] =
+	{
+		glm::normalize(-m_scene.shadowLight.getDirection()),
+		0,
+		m_scene.shadowLight.getColor(),
+		0.f
+	};
+	if (memcmp(&lightStaticInfo, m_uLightStaticInfo, sizeof(LightingStaticUniformBuffer)) != 0)
 	{
-		diffuseProbeFileName = PROBE_BASE_DIR "Diffuse_SH.bin";
+		*m_uLightStaticInfo = lightStaticInfo;
+		m_perFrameUniformHostData.markDirty(m_uLightStaticInfo);
 	}
 
-	m_scene.skybox.load(skyboxFileName, unfilteredProbeFileName, specProbeFileName, diffuseProbeFileName);
+#ifdef USE_TILED_LIGHTING
+	const VkExtent2D extent = getRenderExtent();
+	m_uLightCullingInfo->V = V;
+	m_uLightCullingInfo->P = P;
+	m_uLightCullingInfo->P_inv = glm::inverse(P);
+	m_uLightCullingInfo->tileCountAndExtent = glm::uvec4(m_lightTileCountX, m_lightTileCountY, extent.width, extent.height);
+	m_perFrameUniformHostData.markDirty(m_uLightCullingInfo);
+#endif
 
-	// Models
-#ifdef USE_GLTF
-	VMesh::loadFromGLTF(m_scene.meshes, &m_vulkanManager, GLTF_NAME, GLTF_VERSION);
-#else
-	std::vector<std::string> modelNames = MODEL_NAMES;
-	m_scene.meshes.resize(modelNames.size(), { &m_vulkanManager });
+#ifdef USE_SSAO
+	m_uSsaoInfo->V = V;
+	m_uSsaoInfo->P = P;
+	m_uSsaoInfo->P_inv = glm::inverse(P);
+	m_perFrameUniformHostData.markDirty(m_uSsaoInfo);
+#endif
 
-	for (size_t i = 0; i < m_scene.meshes.size(); ++i)
+	// update per model information. Only the meshes whose transforms were rebuilt are marked dirty for upload,
+	// and only their paths in the BVH are refitted
+	m_scene.transforms.update();
+	bool castersMoved = false;
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	FrameVector<BBox> movedCasterBoxes(m_frameArena); // where moved casters were and are, the pages under both are redrawn
+#endif
+	for (uint32_t j = 0; j < static_cast<uint32_t>(m_scene.meshes.size()); ++j)
 	{
-		const std::string &name = modelNames[i];
-
-		std::string modelFileName = "../models/" + name + ".obj";
-		std::string albedoMapName = "../textures/" + name + "/A.dds";
-		std::string normalMapName = "../textures/" + name + "/N.dds";
-		std::string roughnessMapName = "../textures/" + name + "/R.dds";
-		std::string metalnessMapName = "../textures/" + name + "/M.dds";
-		std::string aoMapName = "../textures/" + name + "/AO.dds";
-		if (!fileExist(aoMapName))
+		auto &model = m_scene.meshes[j];
+		if (model.updateHostUniformBuffer())
 		{
-			aoMapName = "";
+			m_perFrameUniformHostData.markDirty(model.uPerModelInfo);
+#ifdef USE_VIRTUAL_SHADOW_MAP
+			movedCasterBoxes.push_back(m_scene.bvh.getItemBox(j));
+			m_scene.refitBVH(j);
+			movedCasterBoxes.push_back(m_scene.bvh.getItemBox(j));
+#else
+			m_scene.refitBVH(j);
+#endif
+			castersMoved = true;
+#ifdef USE_STATIC_SECONDARIES
+			m_meshTransformUpdateCounts.resize(m_scene.meshes.size(), 0);
+			if (m_meshTransformUpdateCounts[j] < 2) ++m_meshTransformUpdateCounts[j];
+#endif
 		}
-		std::string emissiveMapName = "../textures/" + name + "/E.dds";
-		if (!fileExist(emissiveMapName))
+	}
+#ifdef USE_GPU_SKINNING
+	const bool castersAnimated = updateAnimation();
+#else
+	const bool castersAnimated = false;
+#endif
+#ifdef USE_INSTANCING
+	if (castersMoved)
+	{
+		++m_instanceTransformsVersion;
+	}
+#endif
+#ifdef USE_RAY_QUERY_SHADOWS
+	if (castersMoved)
+	{
+		++m_rayQueryInstancesVersion;
+	}
+#endif
+#ifdef USE_GPU_CULLING
+	if (castersMoved)
+	{
+		for (size_t j = 0; j < m_scene.meshes.size(); ++j)
 		{
-			emissiveMapName = "";
+			m_meshInfos[j].M = m_scene.meshes[j].uPerModelInfo->M;
 		}
-
-		m_scene.meshes[i].load(modelFileName, albedoMapName, normalMapName, roughnessMapName, metalnessMapName, aoMapName, emissiveMapName);
-		m_scene.meshes[i].setRotation(glm::quat(glm::vec3(0.f, glm::pi<float>(), 0.f)));
+		++m_meshInfosVersion;
 	}
 #endif
 
-	// Lights
-	m_scene.shadowLight.setPositionAndDirection(glm::vec3(1.f), glm::vec3(-1.f));
-	m_scene.shadowLight.setColor(glm::vec3(2.f));
-	m_scene.shadowLight.setCastShadow(true);
-
-	m_scene.computeAABBWorldSpace();
-}
-
-void DeferredRenderer::createUniformBuffers()
-{
-	// host
-	if (!m_initialized)
+	// shadow light information
+#ifdef USE_ADAPTIVE_CASCADES
+	if (fitCascadesToVisibleDepth())
 	{
-		m_uCubeViews = reinterpret_cast<CubeMapCameraUniformBuffer *>(m_oneTimeUniformHostData.alloc(sizeof(CubeMapCameraUniformBuffer)));
-		m_uCameraVP = reinterpret_cast<TransMatsUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(TransMatsUniformBuffer)));
-		m_uLightInfo = reinterpret_cast<LightingPassUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(LightingPassUniformBuffer)));
-		m_uDisplayInfo = reinterpret_cast<DisplayInfoUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(DisplayInfoUniformBuffer)));
-
-		m_uShadowLightInfos.resize(m_camera.getSegmentCount());
-		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
+		m_shadowCascadeValidMask = 0; // every cascade covers a different depth range now
+		++m_visibilityVersion; // the lighting push constants hold the active cascade count
+	}
+#endif
+	FrameVector<glm::vec3> frustumCornersWS(m_camera.getSegmentCount() * 4 + 4, glm::vec3(0.f), m_frameArena);
+	FrameVector<float> frustumSegmentDepths(m_camera.getSegmentCount(), 0.f, m_frameArena);
+	m_camera.getCornersWorldSpace(frustumCornersWS.data());
+	m_camera.getSegmentDepths(frustumSegmentDepths.data());
+	// With USE_STREAMING_ASSETS no mesh may be loaded yet, the cascades then fit a unit box
+	const bool sceneEmpty = glm::any(glm::greaterThan(m_scene.aabbWorldSpace.min, m_scene.aabbWorldSpace.max));
+	const BBox sceneBounds = sceneEmpty ? BBox(glm::vec3(-1.f), glm::vec3(1.f)) : m_scene.aabbWorldSpace;
+#ifdef USE_SHADOW_ATLAS
+	// Fit the cascades to their current tiles, then size the tiles by the texel density the screen asks for in the middle of
+	// each cascade. Tiles of a new layout hold nothing useful, so it re-renders all cascades
+	const uint32_t atlasTileCount = m_camera.getSegmentCount();
+	if (m_shadowAtlas.getTileCount() != atlasTileCount)
+	{
+		m_shadowAtlas.update(FrameVector<float>(atlasTileCount, static_cast<float>(SHADOW_MAP_SIZE), m_frameArena));
+	}
+	FrameVector<uint32_t> tileSizes(atlasTileCount, 0, m_frameArena);
+	auto fitCascadesToAtlas = [&]()
+	{
+		for (uint32_t i = 0; i < atlasTileCount; ++i)
 		{
-			m_uShadowLightInfos[i] = reinterpret_cast<ShadowLightUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(ShadowLightUniformBuffer)));
+			tileSizes[i] = m_shadowAtlas.getTile(i).size;
 		}
+		m_scene.shadowLight.computeCascadeScalesAndOffsets(frustumCornersWS, frustumSegmentDepths,
+			sceneBounds.min, sceneBounds.max, tileSizes);
+	};
+	fitCascadesToAtlas();
 
-		for (auto &model : m_scene.meshes)
-		{
-			model.uPerModelInfo = reinterpret_cast<PerModelUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(PerModelUniformBuffer)));
-		}
+	// Screen pixels per world unit at unit view depth
+	const float pixelsPerUnit = getRenderExtent().height / (2.f * std::tan(0.5f * m_camera.getFovy()));
+	FrameVector<float> desiredTileSizes(atlasTileCount, 0.f, m_frameArena);
+	float cascadeNear = m_camera.getSegmentsNear();
+	for (uint32_t i = 0; i < atlasTileCount; ++i)
+	{
+		const float middleDepth = cascadeNear + 0.5f * frustumSegmentDepths[i];
+		// Inactive cascades get the smallest tile
+		desiredTileSizes[i] = i < m_camera.getActiveSegmentCount() ?
+			m_scene.shadowLight.getCascadeWidth(i) * pixelsPerUnit / middleDepth : 0.f;
+		cascadeNear += frustumSegmentDepths[i];
 	}
-
-	// device
-	if (!m_initialized)
+	if (m_shadowAtlas.update(desiredTileSizes))
 	{
-		m_oneTimeUniformDeviceData.size = m_oneTimeUniformHostData.size();
-		m_oneTimeUniformDeviceData.offset = 0;
-		m_oneTimeUniformDeviceData.buffer = m_vulkanManager.createBuffer(m_oneTimeUniformDeviceData.size,
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		fitCascadesToAtlas();
+		m_shadowCascadeValidMask = 0;
+		++m_visibilityVersion; // viewports and clear rects are recorded
 	}
+#elif defined(USE_VIRTUAL_SHADOW_MAP)
+	m_scene.shadowLight.computeCascadeScalesAndOffsets(frustumCornersWS, frustumSegmentDepths,
+		sceneBounds.min, sceneBounds.max, m_shadowImage.width);
+#else
+	m_scene.shadowLight.computeCascadeScalesAndOffsets(frustumCornersWS, frustumSegmentDepths,
+		sceneBounds.min, sceneBounds.max, SHADOW_MAP_SIZE);
+#endif
 
-	if (m_initialized)
+	// The near planes above are at the top of the scene bounds. Each cascade only has to reach the casters it draws,
+	// culled as in updateVisibility, which spends its depth range on them. Depth clamping keeps anything in front
+	const glm::mat4 &lightV = m_scene.shadowLight.getViewMatrix();
+	const glm::vec3 lightZRow(lightV[0][2], lightV[1][2], lightV[2][2]);
+	// One task per cascade, each with its own list and near plane
+	const uint32_t activeCascadeCount = m_camera.getActiveSegmentCount();
+	FrameVector<FrameVector<uint32_t>> cascadeCasters(activeCascadeCount, FrameVector<uint32_t>(m_frameArena), m_frameArena);
+	for (auto &casters : cascadeCasters)
 	{
-		for (const auto &b : m_perFrameUniformDeviceData)
-		{
-			m_vulkanManager.destroyBuffer(b.buffer);
-		}
+		casters.reserve(m_scene.meshes.size());
 	}
+	m_frameTasks.wait(m_frameTasks.addParallelFor(activeCascadeCount, 1, [&](uint32_t begin, uint32_t end)
+	{
+		TRACE_CPU_SCOPE("fit cascade near plane");
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			glm::mat4 cascadeVP;
+			m_scene.shadowLight.getCascadeViewProjMatrix(i, &cascadeVP);
+			m_scene.bvh.queryFrustum(Frustum(cascadeVP), false, &cascadeCasters[i]);
+			if (cascadeCasters[i].empty()) continue;
 
-	uint32_t swapchainImageCount = m_vulkanManager.getSwapChainSize();
-	m_perFrameUniformDeviceData.resize(swapchainImageCount);
+			float casterNearZ = -std::numeric_limits<float>::max();
+			for (uint32_t j : cascadeCasters[i])
+			{
+				// The corner of the box nearest to the light
+				const BBox &aabb = m_scene.bvh.getItemBox(j);
+				const glm::vec3 corner(lightZRow.x >= 0.f ? aabb.max.x : aabb.min.x,
+					lightZRow.y >= 0.f ? aabb.max.y : aabb.min.y, lightZRow.z >= 0.f ? aabb.max.z : aabb.min.z);
+				casterNearZ = std::max(casterNearZ, glm::dot(lightZRow, corner) + lightV[3][2]);
+			}
+#ifdef USE_SHADOW_D16
+			// Casters in front of the receivers are clamped to depth 0
+			casterNearZ = std::min(casterNearZ, m_scene.shadowLight.getCascadeReceiverNearZ(i));
+#endif
+			m_scene.shadowLight.fitCascadeNearPlane(i, casterNearZ);
+		}
+	}));
+	
+	m_uLightInfo->normFarPlaneZs = glm::vec4(0.f);
 
-	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	// Decide which cascades to re-render. The texel snapping in computeCascadeScalesAndOffsets keeps
+	// the matrices unchanged for small camera movements, in which case the cached shadow map is reused
+	const uint32_t cascadeCount = m_camera.getSegmentCount();
+	m_shadowCascadeCachedVPs.resize(cascadeCount);
+	FrameVector<glm::mat4> cascadeVPs(cascadeCount, glm::mat4(1.f), m_frameArena);
+	uint32_t invalidMask = 0;
+	uint32_t changedMask = 0;
+	uint32_t onScheduleMask = 0;
+	for (uint32_t i = 0; i < cascadeCount; ++i)
 	{
-		m_perFrameUniformDeviceData[i].size = m_perFrameUniformHostData.size();
-		m_perFrameUniformDeviceData[i].offset = 0;
-		m_perFrameUniformDeviceData[i].buffer = m_vulkanManager.createBuffer(m_perFrameUniformDeviceData[i].size,
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_scene.shadowLight.getCascadeViewProjMatrix(i, &cascadeVPs[i]);
+
+		if ((m_shadowCascadeValidMask & (1u << i)) == 0) invalidMask |= 1u << i;
+		if (castersMoved || castersAnimated || cascadeVPs[i] != m_shadowCascadeCachedVPs[i]) changedMask |= 1u << i;
+		if (SHADOW_CASCADE_UPDATE_PERIOD <= 1 || i < 2 ||
+			m_shadowFrameCounter % SHADOW_CASCADE_UPDATE_PERIOD == (i - 2) % SHADOW_CASCADE_UPDATE_PERIOD)
+		{
+			onScheduleMask |= 1u << i;
+		}
+	}
+
+#ifdef USE_LAYERED_SHADOW_PASS
+	// All layers are drawn by the same draws, so the pass is updated or kept as a whole
+	const bool passOnSchedule = SHADOW_CASCADE_UPDATE_PERIOD <= 1 || m_shadowFrameCounter % SHADOW_CASCADE_UPDATE_PERIOD == 0;
+	uint32_t updateMask = (invalidMask != 0 || (changedMask != 0 && passOnSchedule)) ? (1u << cascadeCount) - 1 : 0;
+#elif defined(USE_VIRTUAL_SHADOW_MAP)
+	// Resident pages keep their depth, only the dirty ones are drawn, every frame. A cascade whose matrix changed is dirty
+	// as a whole, moved casters only dirty the pages under them
+	uint32_t layerChangedMask = invalidMask;
+	for (uint32_t i = 0; i < cascadeCount; ++i)
+	{
+		if (castersAnimated || cascadeVPs[i] != m_shadowCascadeCachedVPs[i]) layerChangedMask |= 1u << i;
+	}
+	uint32_t updateMask = updateVirtualShadowPages(cascadeVPs, layerChangedMask, movedCasterBoxes);
+#else
+	uint32_t updateMask = invalidMask | (changedMask & onScheduleMask);
+#endif
+	updateMask &= (1u << m_camera.getActiveSegmentCount()) - 1;
+#ifdef USE_RAY_QUERY_SHADOWS
+	if (m_useRayQueryShadows) updateMask = 0; // the lighting pass traces the shadows
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	// The pages drawn with an older matrix were all dirtied, the rest have none. Cascades without resident pages are
+	// valid as well, their pages are drawn when they are bound
+	for (uint32_t i = 0; i < m_camera.getActiveSegmentCount(); ++i)
+	{
+		m_shadowCascadeCachedVPs[i] = cascadeVPs[i];
+	}
+	m_shadowCascadeValidMask |= (1u << m_camera.getActiveSegmentCount()) - 1;
+#else
+	for (uint32_t i = 0; i < cascadeCount; ++i)
+	{
+		if (updateMask & (1u << i)) m_shadowCascadeCachedVPs[i] = cascadeVPs[i];
+	}
+	m_shadowCascadeValidMask |= updateMask;
+#endif
+	++m_shadowFrameCounter;
+
+	if (updateMask != m_shadowCascadeUpdateMask)
+	{
+		m_shadowCascadeUpdateMask = updateMask;
+		++m_visibilityVersion;
+	}
+
+	for (uint32_t i = 0; i < cascadeCount; ++i)
+	{
+		// Lighting has to sample each cascade with the matrix it was rendered with
+		const glm::mat4 &VP = m_shadowCascadeCachedVPs[i];
+
+		m_uShadowLightInfos[i]->cascadeVP = VP;
+		m_uLightInfo->normFarPlaneZs[i] = m_camera.getNormFarPlaneZ(i);
+#ifdef USE_SHADOW_ATLAS
+		// Maps the cascade's NDC onto its tile
+		const auto &tile = m_shadowAtlas.getTile(i);
+		const float tileScale = static_cast<float>(tile.size) / SHADOW_ATLAS_SIZE;
+		const glm::vec2 tileCenter = (glm::vec2(tile.x, tile.y) + 0.5f * tile.size) / static_cast<float>(SHADOW_ATLAS_SIZE) * 2.f - 1.f;
+		m_uLightInfo->cascadeVPs[i] = glm::translate(glm::mat4(1.f), glm::vec3(tileCenter, 0.f)) *
+			glm::scale(glm::mat4(1.f), glm::vec3(tileScale, tileScale, 1.f)) * VP;
+#else
+		m_uLightInfo->cascadeVPs[i] = VP;
+#endif
+		m_perFrameUniformHostData.markDirty(m_uShadowLightInfos[i]);
+#ifdef USE_LAYERED_SHADOW_PASS
+		m_uShadowCascades->cascadeVPs[i] = VP;
+#endif
+	}
+#ifdef USE_LAYERED_SHADOW_PASS
+	m_perFrameUniformHostData.markDirty(m_uShadowCascades);
+#endif
+	m_perFrameUniformHostData.markDirty(m_uLightInfo);
+
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	// Each pixel requests the page its shadow lookup lands on
+	const VkExtent2D pageMarkExtent = getRenderExtent();
+	m_uShadowPageMarkInfo->VP_inv = glm::inverse(m_uCameraVP->VP);
+	std::copy(m_uLightInfo->cascadeVPs, m_uLightInfo->cascadeVPs + CSM_MAX_SEG_COUNT, m_uShadowPageMarkInfo->cascadeVPs);
+	m_uShadowPageMarkInfo->normFarPlaneZs = m_uLightInfo->normFarPlaneZs;
+	m_uShadowPageMarkInfo->pageCountAndExtent = glm::uvec4(m_virtualShadowMap->getPageCountX(), m_virtualShadowMap->getPageCountY(),
+		static_cast<uint32_t>(pageMarkExtent.width * m_renderScale), static_cast<uint32_t>(pageMarkExtent.height * m_renderScale));
+	m_uShadowPageMarkInfo->cascadeCountAndWordCount = glm::uvec4(m_camera.getActiveSegmentCount(),
+		m_virtualShadowMap->getRequestWordCount(), 0, 0);
+	m_perFrameUniformHostData.markDirty(m_uShadowPageMarkInfo);
+#endif
+
+#ifdef USE_VIRTUAL_TEXTURING
+	// Each frame a different pixel of every feedback block reports, so the blocks cover their pixels over the frames
+	m_uVirtualTextureInfo->feedbackInfo = glm::uvec4(m_virtualFeedbackCountX, m_virtualFeedbackCountY,
+		VIRTUAL_TEXTURE_FEEDBACK_STRIDE, static_cast<uint32_t>(m_virtualTextureFrame));
+	m_perFrameUniformHostData.markDirty(m_uVirtualTextureInfo);
+#endif
+
+#ifdef USE_GPU_CULLING
+	// Culling happens in recordGpuCulling, only the frustums are needed here
+	Frustum cameraFrustum(m_uCameraVP->VP);
+	std::copy(std::begin(cameraFrustum.planes), std::end(cameraFrustum.planes), m_uGpuCullingInfo->cameraPlanes);
+	for (uint32_t i = 0; i < cascadeCount; ++i)
+	{
+		Frustum cascadeFrustum(m_uShadowLightInfos[i]->cascadeVP);
+		std::copy(std::begin(cascadeFrustum.planes), std::end(cascadeFrustum.planes), m_uGpuCullingInfo->cascadePlanes[i]);
+	}
+	m_uGpuCullingInfo->counts = glm::uvec4(m_scene.meshes.size(), cascadeCount, getShadowSubpassCount(), 0);
+	m_uGpuCullingInfo->lodCamera = glm::vec4(m_camera.getPosition(), std::tan(0.5f * m_camera.getFovy()));
+	for (uint32_t i = 0; i < cascadeCount; ++i)
+	{
+		const glm::mat4 &cascadeVP = m_uShadowLightInfos[i]->cascadeVP;
+		m_uGpuCullingInfo->cascadeLodScales[i] = glm::length(glm::vec3(cascadeVP[0][0], cascadeVP[1][0], cascadeVP[2][0]));
 	}
+	m_uGpuCullingInfo->lodParams = glm::vec4(LOD_COVERAGE_THRESHOLD, SHADOW_LOD_BIAS, 0.f, 0.f);
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	m_uGpuCullingInfo->VP = m_uCameraVP->VP;
+	m_uGpuCullingInfo->hiZInfo = glm::uvec4(m_hiZImage.width, m_hiZImage.height, m_hiZImage.mipLevelCount, 0);
+#endif
+	m_perFrameUniformHostData.markDirty(m_uGpuCullingInfo);
+#else
+	updateVisibility();
+#endif
+
+#ifdef USE_TEXTURE_STREAMING
+	updateTextureStreaming();
+#endif
 }
 
-void DeferredRenderer::createDescriptorPools()
+bool DeferredRenderer::updateAnimation()
 {
-	const uint32_t maxSetCount = 128;
-	const uint32_t maxUBDescCount = 128;
-	const uint32_t maxCISDescCount = 128;
-	const uint32_t maxSIDescCount = 1;
-	m_vulkanManager.beginCreateDescriptorPool(maxSetCount);
+#ifdef USE_GPU_SKINNING
+	if (m_skinnedMeshes.empty() || ANIMATION_CLIP >= m_animator.getClipCount()) return false;
 
-	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, maxUBDescCount);
-	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxCISDescCount);
-	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, maxSIDescCount);
+	TRACE_CPU_SCOPE("animation");
+	const float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - m_animationStartTime).count();
 
-	m_descriptorPool = m_vulkanManager.endCreateDescriptorPool();
+	// Channels of a clip have distinct targets, so they are sampled in parallel. The globals go parents first on one thread
+	m_frameTasks.wait(m_frameTasks.addParallelFor(m_animator.getChannelCount(ANIMATION_CLIP), 16, [&](uint32_t begin, uint32_t end)
+	{
+		m_animator.sampleChannels(ANIMATION_CLIP, time, begin, end, &m_animationPose);
+	}));
+	m_animator.updateGlobals(&m_animationPose);
+	m_frameTasks.wait(m_frameTasks.addParallelFor(m_animator.getJointCount(), SKINNING_JOINTS_PER_TASK, [&](uint32_t begin, uint32_t end)
+	{
+		m_animator.computeJointMatrices(m_animationPose, begin, end, &m_jointMatrices[begin]);
+	}));
+	return true;
+#else
+	return false;
+#endif
 }
 
-void DeferredRenderer::createDescriptorSets()
+bool DeferredRenderer::fitCascadesToVisibleDepth()
 {
-	m_vulkanManager.resetDescriptorPool(m_descriptorPool);
+	// View depth range of the meshes in the camera frustum. Casters outside of it still reach the cascades,
+	// which extend toward the light to the scene bounds
+	const glm::vec3 eye = m_camera.getPosition();
+	const glm::vec3 forward = glm::normalize(m_camera.getLookAtPos() - eye);
+	const Frustum frustum(m_uCameraVP->VP);
+	float nearDepth = std::numeric_limits<float>::max();
+	float farDepth = -std::numeric_limits<float>::max();
+	FrameVector<uint32_t> visibleMeshes(m_frameArena);
+	visibleMeshes.reserve(m_scene.meshes.size());
+	m_scene.bvh.queryFrustum(frustum, true, &visibleMeshes);
+	for (uint32_t j : visibleMeshes)
+	{
+		const BBox &aabb = m_scene.bvh.getItemBox(j);
+		for (uint32_t c = 0; c < 8; ++c)
+		{
+			const glm::vec3 corner((c & 1) ? aabb.max.x : aabb.min.x, (c & 2) ? aabb.max.y : aabb.min.y, (c & 4) ? aabb.max.z : aabb.min.z);
+			const float depth = glm::dot(corner - eye, forward);
+			nearDepth = std::min(nearDepth, depth);
+			farDepth = std::max(farDepth, depth);
+		}
+	}
+	if (farDepth < nearDepth)
+	{
+		// Nothing visible, keep the full range
+		nearDepth = m_camera.getZNear();
+		farDepth = m_camera.getZFar();
+	}
 
-	// create descriptor sets
-	std::vector<uint32_t> layouts;
-	layouts.push_back(m_brdfLutDescriptorSetLayout);
-	layouts.push_back(m_specEnvPrefilterDescriptorSetLayout);
+	// Snapped outward in log space so the range, and with it the cached cascades, only change every few percent of depth
+	nearDepth = std::max(nearDepth, m_camera.getZNear());
+	farDepth = std::max(std::min(farDepth, m_camera.getZFar()), nearDepth);
+	nearDepth = std::exp2(std::floor(std::log2(nearDepth) * CSM_FIT_STEPS_PER_OCTAVE) / CSM_FIT_STEPS_PER_OCTAVE);
+	farDepth = std::exp2(std::ceil(std::log2(farDepth) * CSM_FIT_STEPS_PER_OCTAVE) / CSM_FIT_STEPS_PER_OCTAVE);
+	const uint32_t count = static_cast<uint32_t>(std::ceil(std::log(farDepth / nearDepth) / std::log(CSM_SEGMENT_DEPTH_RATIO)));
+
+	const glm::vec2 range(nearDepth, farDepth);
+	if (range == m_cascadeFitRange && count == m_cascadeFitCount) return false;
+	m_cascadeFitRange = range;
+	m_cascadeFitCount = count;
+	m_camera.fitSegments(nearDepth, farDepth, count); // clamps both to the camera
+	return true;
+}
 
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+void DeferredRenderer::updateDrawRecords()
+{
+	if (m_drawRecordsVersion == m_materialsVersion && m_drawRecords.size() == m_scene.meshes.size()) return;
+
+	m_drawRecords.resize(m_scene.meshes.size());
+	for (size_t j = 0; j < m_scene.meshes.size(); ++j)
 	{
-		layouts.push_back(m_skyboxDescriptorSetLayout);
-		layouts.push_back(m_lightingDescriptorSetLayout);
-		layouts.push_back(m_finalOutputDescriptorSetLayout);
-		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
+		const VMesh &mesh = m_scene.meshes[j];
+		DrawRecord &draw = m_drawRecords[j];
+		draw = DrawRecord();
+		draw.lodCount = static_cast<uint32_t>(mesh.lods.size());
+		for (uint32_t lod = 0; lod < draw.lodCount; ++lod)
 		{
-			layouts.push_back(m_shadowDescriptorSetLayout1);
+			draw.firstIndices[lod] = mesh.lods[lod].firstIndex;
+			draw.indexCounts[lod] = mesh.lods[lod].indexCount;
 		}
-		for (uint32_t i = 0; i < m_scene.meshes.size(); ++i)
+		draw.vertexOffset = mesh.geometry.vertexOffset;
+		draw.indexType = mesh.geometry.indexType;
+		draw.materialKey = getGeomPipelineVariant(mesh);
+#ifdef USE_INSTANCING
+		draw.firstInstance = m_meshFirstInstances[j];
+#endif
+		draw.instanceCount = mesh.getInstanceCount();
+	}
+	m_drawRecordsVersion = m_materialsVersion;
+}
+
+void DeferredRenderer::updateVisibility()
+{
+	const uint32_t numModels = static_cast<uint32_t>(m_scene.meshes.size());
+	const uint32_t numCascades = m_camera.getSegmentCount();
+
+	const std::vector<BBox> &aabbs = m_scene.bvh.getItemBoxes(); // kept up to date by refitBVH
+
+	// Every list below lives in the frame arena. Each one is sized up front: growing it would leave its old storage
+	// behind in the arena, and the tasks filling the lists must not allocate from it as it is not thread safe
+	FrameVector<uint32_t> visibleMeshes(m_frameArena);
+	visibleMeshes.reserve(numModels);
+	FrameVector<uint64_t> sortKeys(numModels, 0, m_frameArena);
+	FrameVector<FrameVector<uint32_t>> visibleShadowCasters(numCascades, FrameVector<uint32_t>(m_frameArena), m_frameArena);
+	for (auto &list : visibleShadowCasters)
+	{
+		list.reserve(numModels);
+	}
+	FrameVector<uint32_t> meshLods(numModels, 0, m_frameArena);
+	FrameVector<FrameVector<uint32_t>> shadowCasterLods(numCascades, FrameVector<uint32_t>(numModels, 0, m_frameArena), m_frameArena);
+
+#ifdef USE_SIMD_CULLING
+	// Frustum 0 is the camera, the cascades follow, then views 1 and up. All of them are tested in one parallel pass,
+	// which sets one bit per frustum in the mask of each mesh. Only the cascades leave out the near plane
+	const CullingBounds &bounds = m_scene.cullingBounds; // kept in sync with the BVH
+	const uint32_t cascadeFrustum = 1;
+	Frustum frustums[CULLING_MAX_FRUSTUMS];
+	uint32_t frustumCount = 0;
+	frustums[frustumCount++] = Frustum(m_uCameraVP->VP);
+	for (uint32_t i = 0; i < numCascades; ++i)
+	{
+#ifdef USE_VIRTUAL_SHADOW_MAP
+		// Only casters over the dirty pages are drawn
+		frustums[frustumCount++] = Frustum(m_shadowCascadeCullVPs[i]);
+#else
+		frustums[frustumCount++] = Frustum(m_uShadowLightInfos[i]->cascadeVP);
+#endif
+	}
+#ifdef USE_MULTI_VIEW
+	const uint32_t viewFrustum = cascadeFrustum + numCascades - 1; // plus the view index, from 1
+	for (uint32_t v = 1; v < m_viewCount; ++v)
+	{
+		frustums[frustumCount++] = Frustum(m_views[v].P * m_views[v].V);
+	}
+#endif
+	const uint32_t nearPlaneMask = ~(((1u << numCascades) - 1) << cascadeFrustum);
+
+	FrameVector<uint32_t> cullMasks(bounds.getPaddedSize(), 0, m_frameArena);
+	const TaskScheduler::TaskHandle cullTask = m_frameTasks.addParallelFor(bounds.getPaddedSize() / 4, CULLING_ITEMS_PER_TASK / 4,
+		[&](uint32_t begin, uint32_t end)
+	{
+		TRACE_CPU_SCOPE("cull bounds");
+		bounds.cull(frustums, frustumCount, nearPlaneMask, 4 * begin, 4 * end, cullMasks.data());
+	});
+	const TaskScheduler::TaskHandle cullDependencies[] = { cullTask };
+
+	// Empty boxes of meshes that are still streaming in are never visible. The lists come out in mesh order
+	auto cull = [&](uint32_t frustum, FrameVector<uint32_t> *pVisible)
+	{
+		const uint32_t bit = 1u << frustum;
+		for (uint32_t j = 0; j < numModels; ++j)
 		{
-			layouts.push_back(m_shadowDescriptorSetLayout2);
+			if (cullMasks[j] & bit) pVisible->push_back(j);
 		}
-		for (uint32_t i = 0; i < m_scene.meshes.size(); ++i)
+	};
+#else
+	auto cull = [&](const glm::mat4 &VP, FrameVector<uint32_t> *pVisible, bool testNearPlane)
+	{
+		// Meshes that are still streaming in have empty boxes, the BVH never reports them.
+		// Sorted so the culled lists keep the mesh order
+		m_scene.bvh.queryFrustum(Frustum(VP), testNearPlane, pVisible);
+		std::sort(pVisible->begin(), pVisible->end());
+	};
+	rj::ArrayView<TaskScheduler::TaskHandle> cullDependencies;
+#endif
+
+	// Geometry pass draw order: pipeline variant, then front to back. Each mesh has its own material set and
+	// all of them share the geometry pool buffers, so neither adds anything to the key
+	auto sortForGeomPass = [&](const glm::vec3 &eyePos, FrameVector<uint32_t> *pVisible, FrameVector<uint64_t> *pSortKeys)
+	{
+		FrameVector<uint64_t> &keys = *pSortKeys;
+		for (uint32_t j : *pVisible)
 		{
-			layouts.push_back(m_geomDescriptorSetLayout);
+			// Positive floats order like their bit patterns
+			const float distance = glm::length(0.5f * (aabbs[j].min + aabbs[j].max) - eyePos);
+			uint32_t distanceBits;
+			memcpy(&distanceBits, &distance, sizeof(float));
+#ifdef USE_PIPELINE_PERMUTATIONS
+			const uint64_t variant = m_drawRecords[j].materialKey;
+#else
+			const uint64_t variant = 0;
+#endif
+			keys[j] = (variant << 32) | distanceBits;
 		}
-		for (uint32_t i = 0; i < 3; ++i)
+		std::sort(pVisible->begin(), pVisible->end(), [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+	};
+
+	// The camera, each cascade and ranges of meshes for the LODs are independent tasks, each writing its own lists
+	const TaskScheduler::TaskHandle cameraTask = m_frameTasks.add([&]()
+	{
+		TRACE_CPU_SCOPE("cull camera");
+#ifdef USE_SIMD_CULLING
+		cull(0, &visibleMeshes);
+#else
+		cull(m_uCameraVP->VP, &visibleMeshes, true);
+#endif
+		sortForGeomPass(m_camera.getPosition(), &visibleMeshes, &sortKeys);
+	}, cullDependencies);
+
+#ifdef USE_MULTI_VIEW
+	// The other views are culled like the camera, each into lists of its own. View 0 is the camera task above
+	FrameVector<FrameVector<uint32_t>> viewMeshes(m_viewCount, FrameVector<uint32_t>(m_frameArena), m_frameArena);
+	for (auto &list : viewMeshes)
+	{
+		list.reserve(numModels);
+	}
+	FrameVector<FrameVector<uint64_t>> viewSortKeys(m_viewCount, FrameVector<uint64_t>(numModels, 0, m_frameArena), m_frameArena);
+	const TaskScheduler::TaskHandle viewTask = m_frameTasks.addParallelFor(m_viewCount, 1, [&](uint32_t begin, uint32_t end)
+	{
+		TRACE_CPU_SCOPE("cull view");
+		for (uint32_t v = std::max(begin, 1u); v < end; ++v)
 		{
-			layouts.push_back(m_bloomDescriptorSetLayout);
+			const RenderView &view = m_views[v];
+#ifdef USE_SIMD_CULLING
+			cull(viewFrustum + v, &viewMeshes[v]);
+#else
+			cull(view.P * view.V, &viewMeshes[v], true);
+#endif
+			sortForGeomPass(view.eyeWorldPos, &viewMeshes[v], &viewSortKeys[v]);
+		}
+	}, cullDependencies);
+#endif
+
+	// Each cascade only draws casters overlapping its light space ortho volume. The near plane is
+	// skipped because casters between the light and the cascade still shadow it. Those that end up
+	// in front of the near plane are kept by depth clamping in the shadow pipeline
+	const TaskScheduler::TaskHandle cascadeTask = m_frameTasks.addParallelFor(numCascades, 1, [&](uint32_t begin, uint32_t end)
+	{
+		TRACE_CPU_SCOPE("cull cascade");
+		for (uint32_t i = begin; i < end; ++i)
+		{
+#ifdef USE_SIMD_CULLING
+			cull(cascadeFrustum + i, &visibleShadowCasters[i]);
+#elif defined(USE_VIRTUAL_SHADOW_MAP)
+			cull(m_shadowCascadeCullVPs[i], &visibleShadowCasters[i], false);
+#else
+			cull(m_uShadowLightInfos[i]->cascadeVP, &visibleShadowCasters[i], false);
+#endif
+		}
+	}, cullDependencies);
+
+	// LODs are picked from the bounding sphere diameter over the screen height, or over the shadow map width for cascades
+	const glm::vec3 &cameraPos = m_camera.getPosition();
+	const float tanHalfFovy = std::tan(0.5f * m_camera.getFovy());
+	const TaskScheduler::TaskHandle lodTask = m_frameTasks.addParallelFor(numModels, FRAME_TASK_MESHES_PER_TASK, [&](uint32_t begin, uint32_t end)
+	{
+		TRACE_CPU_SCOPE("select LODs");
+		for (uint32_t j = begin; j < end; ++j)
+		{
+			const uint32_t lodCount = m_drawRecords[j].lodCount;
+			if (lodCount == 0) continue;
+			const glm::vec3 center = 0.5f * (aabbs[j].min + aabbs[j].max);
+			const float radius = 0.5f * glm::length(aabbs[j].max - aabbs[j].min);
+			const float distance = std::max(glm::length(center - cameraPos), radius);
+			meshLods[j] = selectLod(radius / (distance * tanHalfFovy), lodCount);
+#ifdef USE_IMPOSTORS
+			const bool hasImpostor = m_impostorLayers[j] != std::numeric_limits<uint32_t>::max();
+			if (hasImpostor && radius / (distance * tanHalfFovy) < IMPOSTOR_COVERAGE_THRESHOLD) meshLods[j] = IMPOSTOR_LOD;
+#endif
+
+			for (uint32_t i = 0; i < numCascades; ++i)
+			{
+				// NDC units per world unit of the orthographic cascade projection
+				const glm::mat4 &cascadeVP = m_uShadowLightInfos[i]->cascadeVP;
+				const float scale = glm::length(glm::vec3(cascadeVP[0][0], cascadeVP[1][0], cascadeVP[2][0]));
+				shadowCasterLods[i][j] = std::min(selectLod(radius * scale, lodCount) + SHADOW_LOD_BIAS, lodCount - 1);
+#ifdef USE_IMPOSTORS
+				if (hasImpostor && radius * scale < IMPOSTOR_COVERAGE_THRESHOLD) shadowCasterLods[i][j] = IMPOSTOR_LOD;
+#endif
+			}
 		}
+	});
+
+	// The calling thread runs tasks too until all three are done
+	m_frameTasks.wait(cameraTask);
+	m_frameTasks.wait(cascadeTask);
+	m_frameTasks.wait(lodTask);
+#ifdef USE_MULTI_VIEW
+	m_frameTasks.wait(viewTask);
+#endif
+
+#ifdef USE_LAYERED_SHADOW_PASS
+	// The single layered subpass draws every mesh that casts into at least one cascade
+	FrameVector<uint32_t> casters(m_frameArena);
+	casters.reserve(numCascades * numModels);
+	for (const auto &list : visibleShadowCasters)
+	{
+		casters.insert(casters.end(), list.begin(), list.end());
 	}
+	std::sort(casters.begin(), casters.end());
+	casters.erase(std::unique(casters.begin(), casters.end()), casters.end());
+	visibleShadowCasters.assign(1, std::move(casters));
 
-	std::vector<uint32_t> sets = m_vulkanManager.allocateDescriptorSets(m_descriptorPool, layouts);
+	// It also uses the finest LOD any cascade needs
+	for (uint32_t i = 1; i < numCascades; ++i)
+	{
+		for (uint32_t j = 0; j < numModels; ++j)
+		{
+			shadowCasterLods[0][j] = std::min(shadowCasterLods[0][j], shadowCasterLods[i][j]);
+		}
+	}
+	shadowCasterLods.resize(1);
+#endif
 
-	uint32_t idx = 0;
-	m_brdfLutDescriptorSet = sets[idx++];
-	m_specEnvPrefilterDescriptorSet = sets[idx++];
+#ifdef USE_IMPOSTORS
+	// Meshes marked with IMPOSTOR_LOD move from the draw lists to the impostor lists, both keep their order
+	FrameVector<uint32_t> impostorMeshes(m_frameArena);
+	impostorMeshes.reserve(numModels);
+	FrameVector<FrameVector<uint32_t>> impostorShadowCasters(numCascades, FrameVector<uint32_t>(m_frameArena), m_frameArena);
+	auto splitImpostors = [](const FrameVector<uint32_t> &lods, FrameVector<uint32_t> *pVisible, FrameVector<uint32_t> *pImpostors)
+	{
+		auto isImpostor = [&lods](uint32_t j) { return lods[j] == IMPOSTOR_LOD; };
+		std::copy_if(pVisible->begin(), pVisible->end(), std::back_inserter(*pImpostors), isImpostor);
+		pVisible->erase(std::remove_if(pVisible->begin(), pVisible->end(), isImpostor), pVisible->end());
+	};
+	splitImpostors(meshLods, &visibleMeshes, &impostorMeshes);
+	for (uint32_t i = 0; i < numCascades; ++i)
+	{
+		impostorShadowCasters[i].reserve(numModels);
+		splitImpostors(shadowCasterLods[i], &visibleShadowCasters[i], &impostorShadowCasters[i]);
+	}
+#endif
 
-	m_perFrameDescriptorSets.resize(swapChainImageCount);
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+#ifdef USE_TEXTURE_STREAMING
+	m_meshScreenSizes.assign(numModels, 0.f);
+	for (uint32_t j : visibleMeshes)
 	{
-		m_perFrameDescriptorSets[imgIdx].m_skyboxDescriptorSet = sets[idx++];
-		m_perFrameDescriptorSets[imgIdx].m_lightingDescriptorSet = sets[idx++];
-		m_perFrameDescriptorSets[imgIdx].m_finalOutputDescriptorSet = sets[idx++];
-		m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1.resize(m_camera.getSegmentCount());
-		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
+		const glm::vec3 center = 0.5f * (aabbs[j].min + aabbs[j].max);
+		const float radius = 0.5f * glm::length(aabbs[j].max - aabbs[j].min);
+		const float distance = std::max(glm::length(center - cameraPos), radius);
+		m_meshScreenSizes[j] = radius / (distance * tanHalfFovy) * getRenderExtent().height;
+	}
+#endif
+
+	// The members keep their capacity, so copying into them only allocates while the lists grow
+	auto equalList = [](const FrameVector<uint32_t> &list, const std::vector<uint32_t> &member)
+	{
+		return std::equal(list.begin(), list.end(), member.begin(), member.end());
+	};
+	auto equalLists = [&equalList](const FrameVector<FrameVector<uint32_t>> &lists, const std::vector<std::vector<uint32_t>> &members)
+	{
+		return lists.size() == members.size() &&
+			std::equal(lists.begin(), lists.end(), members.begin(), equalList);
+	};
+	auto assignLists = [](const FrameVector<FrameVector<uint32_t>> &lists, std::vector<std::vector<uint32_t>> *pMembers)
+	{
+		pMembers->resize(lists.size());
+		for (size_t i = 0; i < lists.size(); ++i)
 		{
-			m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[i] = sets[idx++];
+			(*pMembers)[i].assign(lists[i].begin(), lists[i].end());
 		}
-		m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2.resize(m_scene.meshes.size());
-		for (uint32_t i = 0; i < m_scene.meshes.size(); ++i)
+	};
+	if (!equalList(visibleMeshes, m_visibleMeshes) || !equalLists(visibleShadowCasters, m_visibleShadowCasters) ||
+		!equalList(meshLods, m_meshLods) || !equalLists(shadowCasterLods, m_shadowCasterLods))
+	{
+		m_visibleMeshes.assign(visibleMeshes.begin(), visibleMeshes.end());
+		assignLists(visibleShadowCasters, &m_visibleShadowCasters);
+		m_meshLods.assign(meshLods.begin(), meshLods.end());
+		assignLists(shadowCasterLods, &m_shadowCasterLods);
+#ifdef USE_IMPOSTORS
+		// Follow from the lists above, so they only change with them
+		m_impostorMeshes.assign(impostorMeshes.begin(), impostorMeshes.end());
+		assignLists(impostorShadowCasters, &m_impostorShadowCasters);
+#endif
+		++m_visibilityVersion;
+	}
+#ifdef USE_MULTI_VIEW
+	bool viewsChanged = false;
+	for (uint32_t v = 1; v < m_viewCount; ++v)
+	{
+		if (!equalList(viewMeshes[v], m_views[v].visibleMeshes))
 		{
-			m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[i] = sets[idx++];
+			m_views[v].visibleMeshes.assign(viewMeshes[v].begin(), viewMeshes[v].end());
+			viewsChanged = true;
 		}
-		m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets.resize(m_scene.meshes.size());
-		for (uint32_t i = 0; i < m_scene.meshes.size(); ++i)
+	}
+	if (viewsChanged)
+	{
+		++m_visibilityVersion;
+	}
+#endif
+}
+
+#ifdef USE_MULTI_VIEW
+void DeferredRenderer::updateViews()
+{
+	if (m_viewLayoutSwitchRequests > 0)
+	{
+		m_viewCount = (m_viewCount - 1 + m_viewLayoutSwitchRequests) % MAX_VIEW_COUNT + 1;
+		m_viewLayoutSwitchRequests = 0;
+		for (uint32_t v = m_viewCount; v < MAX_VIEW_COUNT; ++v)
 		{
-			m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[i] = sets[idx++];
+			m_views[v].visibleMeshes.clear();
 		}
-		m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets.resize(3);
-		for (uint32_t i = 0; i < 3; ++i)
+		// The viewports are recorded into the scene command buffers
+		++m_visibilityVersion;
+	}
+
+	// One view fills the extent, two are side by side, more take the cells of a 2x2 grid
+	for (uint32_t v = 0; v < m_viewCount; ++v)
+	{
+		m_views[v].rect =
+			m_viewCount == 1 ? glm::vec4(0.f, 0.f, 1.f, 1.f) :
+			m_viewCount == 2 ? glm::vec4(0.5f * v, 0.f, 0.5f, 1.f) :
+			glm::vec4(0.5f * (v % 2), 0.5f * (v / 2), 0.5f, 0.5f);
+	}
+
+	const VkExtent2D extent = getRenderExtent();
+	auto aspectRatio = [&extent](const glm::vec4 &rect)
+	{
+		return rect.z * extent.width / (rect.w * extent.height);
+	};
+	m_camera.setAspectRatio(aspectRatio(m_views[0].rect));
+
+	// Top, front and side views of the whole scene
+	const bool sceneEmpty = glm::any(glm::greaterThan(m_scene.aabbWorldSpace.min, m_scene.aabbWorldSpace.max));
+	const BBox bounds = sceneEmpty ? BBox(glm::vec3(-1.f), glm::vec3(1.f)) : m_scene.aabbWorldSpace;
+	const glm::vec3 center = 0.5f * (bounds.min + bounds.max);
+	const float radius = std::max(0.5f * glm::length(bounds.max - bounds.min), 1e-3f);
+	const glm::vec3 viewDirs[] = { glm::vec3(0.f, -1.f, 0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(-1.f, 0.f, 0.f) };
+	const glm::vec3 viewUps[] = { glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f), glm::vec3(0.f, 1.f, 0.f) };
+	for (uint32_t v = 1; v < m_viewCount; ++v)
+	{
+		RenderView &view = m_views[v];
+		// Outside the bounds. Lighting shades with this as the viewer, so it also sets where the highlights are
+		view.eyeWorldPos = center - 2.f * radius * viewDirs[v - 1];
+		view.V = glm::lookAt(view.eyeWorldPos, center, viewUps[v - 1]);
+
+		// The bounds in view space, widened to the aspect ratio of the view
+		glm::vec3 viewMin(std::numeric_limits<float>::max());
+		glm::vec3 viewMax(-std::numeric_limits<float>::max());
+		for (uint32_t c = 0; c < 8; ++c)
 		{
-			m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[i] = sets[idx++];
+			const glm::vec3 corner((c & 1) ? bounds.max.x : bounds.min.x, (c & 2) ? bounds.max.y : bounds.min.y, (c & 4) ? bounds.max.z : bounds.min.z);
+			const glm::vec3 p = glm::vec3(view.V * glm::vec4(corner, 1.f));
+			viewMin = glm::min(viewMin, p);
+			viewMax = glm::max(viewMax, p);
 		}
+		const glm::vec2 mid = 0.5f * (glm::vec2(viewMin) + glm::vec2(viewMax));
+		glm::vec2 halfSize = glm::max(0.5f * (glm::vec2(viewMax) - glm::vec2(viewMin)), glm::vec2(1e-3f));
+		const float aspect = aspectRatio(view.rect);
+		halfSize = halfSize.x < halfSize.y * aspect ? glm::vec2(halfSize.y * aspect, halfSize.y) : glm::vec2(halfSize.x, halfSize.x / aspect);
+
+		// The view looks down -z. A little depth margin so the nearest and farthest surfaces are not clipped
+		const float margin = 0.01f * radius;
+		view.P = glm::ortho(mid.x - halfSize.x, mid.x + halfSize.x, mid.y - halfSize.y, mid.y + halfSize.y,
+			-viewMax.z - margin, -viewMin.z + margin);
+		view.P[1][1] *= -1.f; // the y-axis of clip space in Vulkan is pointing down
 	}
+}
 
-	createBrdfLutDescriptorSet();
-	createSpecEnvPrefilterDescriptorSet();
-	createGeomPassDescriptorSets();
-	createShadowPassDescriptorSets();
-	createLightingPassDescriptorSets();
-	createBloomDescriptorSets();
-	createFinalOutputPassDescriptorSets();
+void DeferredRenderer::cmdBeginView(uint32_t cb, uint32_t framebuffer, uint32_t pipelineLayout, VkShaderStageFlags stage, uint32_t viewIdx) const
+{
+	const glm::vec4 rect = m_views[viewIdx].rect * m_renderScale;
+	m_vulkanManager.cmdSetViewport(cb, framebuffer, rect.x, rect.y, rect.z, rect.w);
+	m_vulkanManager.cmdSetScissor(cb, framebuffer, rect.x, rect.y, rect.z, rect.w);
+	m_vulkanManager.cmdPushConstants(cb, pipelineLayout, stage, VIEW_PUSH_CONSTANT_OFFSET, sizeof(uint32_t), &viewIdx);
 }
+#endif
 
-void DeferredRenderer::createFramebuffers()
+void DeferredRenderer::updateUniformDeviceData(uint32_t imgIdx)
 {
-	// Used in final output pass
-	m_finalOutputFramebuffers = m_vulkanManager.createSwapChainFramebuffers(m_finalOutputRenderPass);
+	// Only copy what has been written since this buffer was last updated. Each swapchain image
+	// has its own copy so it needs its own stamp.
+	char *mapped = m_perFrameUniformMappedData[imgIdx];
+	const char *host = &m_perFrameUniformHostData;
+	m_perFrameUniformHostData.forEachDirtyRange(m_perFrameUniformSyncedStamps[imgIdx], [&](size_t offset, size_t size)
+	{
+		memcpy(mapped + offset, host + offset, size);
+	});
+	m_perFrameUniformSyncedStamps[imgIdx] = m_perFrameUniformHostData.stamp();
 
-	// Specular irradiance map pass
-	if (!m_scene.skybox.specMapReady)
+#ifdef USE_TILED_LIGHTING
+	if (m_perFrameLightBufferSyncedVersions[imgIdx] != m_pointLightsVersion)
 	{
-		m_specEnvPrefilterFramebuffers.resize(m_scene.skybox.specularIrradianceMap.mipLevelCount);
-		for (uint32_t level = 0; level < m_scene.skybox.specularIrradianceMap.mipLevelCount; ++level)
+		assert(m_pointLights.size() <= MAX_POINT_LIGHTS);
+
+		PointLightBufferHeader header = {};
+		header.lightCount = static_cast<uint32_t>(m_pointLights.size());
+		char *lightData = m_perFrameLightBufferMappedData[imgIdx];
+		memcpy(lightData, &header, sizeof(header));
+		memcpy(lightData + sizeof(header), m_pointLights.data(), m_pointLights.size() * sizeof(DiracLight));
+		m_perFrameLightBufferSyncedVersions[imgIdx] = m_pointLightsVersion;
+	}
+#endif
+
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	// Pages the image's last frame sampled, bound by the next updateUniformHostData(). Cleared for this frame to mark again
+	uint32_t *requests = m_perFrameShadowPageRequestMappedData[imgIdx];
+	m_virtualShadowMap->request(requests);
+	memset(requests, 0, m_perFrameShadowPageRequestBuffers[imgIdx].size);
+#endif
+
+#ifdef USE_GPU_CULLING
+	if (m_perFrameMeshInfoBufferSyncedVersions[imgIdx] != m_meshInfosVersion)
+	{
+		memcpy(m_perFrameMeshInfoBufferMappedData[imgIdx], m_meshInfos.data(), m_meshInfos.size() * sizeof(GpuCullingMeshInfo));
+#ifdef USE_GPU_SKINNING
+		// Animated meshes are drawn from this frame's copy of their vertices
+		GpuCullingMeshInfo *meshInfos = reinterpret_cast<GpuCullingMeshInfo *>(m_perFrameMeshInfoBufferMappedData[imgIdx]);
+		for (const auto &skinned : m_skinnedMeshes)
 		{
-			m_specEnvPrefilterFramebuffers[level] =
-				m_vulkanManager.createFramebuffer(m_specEnvPrefilterRenderPass, { m_scene.skybox.specularIrradianceMap.imageViews[level + 1] });
+			const rj::GeometryRange &geometry = skinned.frameGeometry[imgIdx];
+			meshInfos[skinned.mesh].vertexOffset = geometry.vertexOffset;
+			meshInfos[skinned.mesh].vertexFetch.y = geometry.positionOffset;
+			meshInfos[skinned.mesh].vertexFetch.z = geometry.attributeOffset;
 		}
+#endif
+		m_perFrameMeshInfoBufferSyncedVersions[imgIdx] = m_meshInfosVersion;
 	}
+#endif
 
-	// Geometry pass
+#ifdef USE_GPU_SKINNING
+	if (!m_skinnedMeshes.empty())
 	{
-		if (m_initialized)
+		char *skinningData = m_perFrameSkinningBufferMappedData[imgIdx];
+		memcpy(skinningData, m_jointMatrices.data(), m_jointMatrices.size() * sizeof(glm::mat4));
+		memcpy(skinningData + m_jointMatrices.size() * sizeof(glm::mat4), m_animationPose.weights.data(),
+			m_animationPose.weights.size() * sizeof(float));
+	}
+#endif
+
+#ifdef USE_INSTANCING
+	if (m_perFrameInstanceBufferSyncedVersions[imgIdx] != m_instanceTransformsVersion)
+	{
+		char *instanceData = m_perFrameInstanceBufferMappedData[imgIdx];
+		for (size_t j = 0; j < m_scene.meshes.size(); ++j)
 		{
-			m_vulkanManager.destroyFramebuffer(m_geomFramebuffer);
+			const auto &transforms = m_scene.meshes[j].instanceTransforms;
+			memcpy(instanceData + m_meshFirstInstances[j] * sizeof(PerModelUniformBuffer), transforms.data(),
+				transforms.size() * sizeof(PerModelUniformBuffer));
 		}
+		m_perFrameInstanceBufferSyncedVersions[imgIdx] = m_instanceTransformsVersion;
+	}
+#endif
 
-		std::vector<uint32_t> attachmentViews =
+#ifdef USE_RAY_QUERY_SHADOWS
+	if (m_useRayQueryShadows) updateRayQueryInstances(imgIdx);
+#endif
+
+#ifdef USE_MATERIAL_UPDATES
+	if (m_perFrameMaterialSyncedVersions[imgIdx] != m_materialsVersion)
+	{
+		for (uint32_t i = 0; i < m_scene.meshes.size(); ++i)
 		{
-			m_depthImage.imageViews[0],
-			m_gbufferImages[0].imageViews[0],
-			m_gbufferImages[1].imageViews[0],
-			m_gbufferImages[2].imageViews[0]
-		};
+			writeStaticMeshDescriptorSet(imgIdx, i);
+		}
+		m_perFrameMaterialSyncedVersions[imgIdx] = m_materialsVersion;
+		// Updating a bound descriptor set invalidates the pre-recorded command buffer of this image
+		m_perFrameCommandBuffers[imgIdx].m_dirtyMask |= CB_DIRTY_GEOM_SHADOW_LIGHTING;
+	}
+#endif
+
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+	if (m_perFrameIblSyncedVersions[imgIdx] != m_iblVersion)
+	{
+		writeLightingIblDescriptors(imgIdx);
+#ifdef USE_PROBE_SWITCHING
+		writeSkyboxDescriptorSet(imgIdx);
+#endif
+		m_perFrameIblSyncedVersions[imgIdx] = m_iblVersion;
+		// Also re-records the mip count of the specular map pushed to the lighting pass
+		m_perFrameCommandBuffers[imgIdx].m_dirtyMask |= CB_DIRTY_GEOM_SHADOW_LIGHTING;
+	}
+#endif
+}
+
+void DeferredRenderer::updateText(uint32_t imageIdx)
+{
+	m_textOverlay.beginTextUpdate(imageIdx);
+
+	std::stringstream ss;
+	ss << m_windowTitle << " - ver" << m_verNumMajor << "." << m_verNumMinor;
+	if (m_cameraPlaying) ss << " - camera playback (V) " << m_cameraPlaybackFrame << " / " << m_cameraRecording.size();
+	else if (m_cameraRecording.isWriting()) ss << " - recording camera (C)";
+#ifdef USE_PROBE_SWITCHING
+	{
+		const std::vector<std::string> probeDirs = PROBE_BASE_DIRS;
+		ss << " - environment (E) " << probeDirs[m_residentProbes[m_currentProbe].dirIdx];
+		if (m_requestedProbeDir != m_residentProbes[m_currentProbe].dirIdx) ss << " -> " << probeDirs[m_requestedProbeDir];
+	}
+#endif
+#ifdef USE_SCENE_HOT_SWAP
+	{
+		const std::vector<std::vector<std::string>> scenes = HOT_SWAP_SCENES;
+		ss << " - scene (N) " << scenes[m_currentScene][0];
+		if (m_pendingModelCount > 0) ss << ", " << m_pendingModelCount << " models loading";
+	}
+#endif
+	m_textOverlay.addText(ss.str(), 5.0f, 5.0f, VTextOverlay::alignLeft);
+
+	ss = std::stringstream();
+	ss << "Command Buffers (R) : " << (m_recordCommandBuffersPerFrame ? "recorded per frame" : "pre-recorded");
+	if (m_renderOnDemand) ss << " - rendering on demand (O)";
+	m_textOverlay.addText(ss.str(), 5.f, 25.f, VTextOverlay::alignLeft);
+
+	ss = std::stringstream();
+	ss << "MSAA (M) : " << static_cast<uint32_t>(m_sampleCount) << "x";
+#ifdef USE_DYNAMIC_RESOLUTION
+	ss << std::fixed << std::setprecision(2) << " - render scale " << m_renderScale << " (" << m_resolutionController.getTargetMS() << " ms target)";
+#endif
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	if (m_accumulatedFrameCount > 0) ss << " - accumulated " << m_accumulatedFrameCount << " / " << ACCUMULATION_FRAME_COUNT;
+#endif
+#ifdef USE_VARIABLE_RATE_SHADING
+	static const char *shadingRateModeNames[SHADING_RATE_MODE_COUNT] = { "full", "quality", "performance", "foveated" };
+	ss << " - shading rate (G) " << (m_vulkanManager.isFragmentShadingRateEnabled() ? shadingRateModeNames[m_shadingRateMode] : "unsupported");
+#endif
+	m_textOverlay.addText(ss.str(), 5.f, 45.f, VTextOverlay::alignLeft);
+
+	ss = std::stringstream();
+	ss << "Binds Geom / Shadow : " << m_geomPassBinds.issued.load() << " (" << m_geomPassBinds.skipped.load() << " skipped) / "
+		<< m_shadowPassBinds.issued.load() << " (" << m_shadowPassBinds.skipped.load() << " skipped)";
+	ss << std::fixed << std::setprecision(2) << " - background " << m_backgroundBudget.getSpentMS() << " / " << m_backgroundBudget.getBudgetMS() << " ms";
+	m_textOverlay.addText(ss.str(), 5.f, 65.f, VTextOverlay::alignLeft);
+
+	// The geometry scope includes the pre-pass, compare it with the pre-pass on and off
+	ss = std::stringstream();
+#ifdef USE_FORWARD_PLUS
+	ss << "Depth Pre-pass : always on (forward+)";
+#else
+	ss << "Depth Pre-pass (Z) : " << (m_useDepthPrepass ? "on" : "off");
+#endif
+	ss << " - present " << rj::helper_functions::presentModeName(m_vulkanManager.getSwapChainPresentMode()) << ", " << m_vulkanManager.getSwapChainSize() << " images";
+	if (m_lowLatencyMode) ss << " - low latency (L)";
+	if (m_halfPrecisionShaders) ss << " - fp16";
+#ifdef USE_MULTI_VIEW
+	ss << " - " << m_viewCount << (m_viewCount == 1 ? " view (F)" : " views (F)");
+#endif
+	m_textOverlay.addText(ss.str(), 5.f, 85.f, VTextOverlay::alignLeft);
+
+	// Frame time distribution over the last FRAME_STATS_HISTORY_LENGTH frames
+	auto addPercentiles = [&](const char *label, const FrameStatistics::Percentiles &p, float y)
+	{
+		ss = std::stringstream();
+		ss << std::fixed << std::setprecision(2) << label << " p50 / p95 / p99 / max : "
+			<< p.p50 << " / " << p.p95 << " / " << p.p99 << " / " << p.max << " ms";
+		m_textOverlay.addText(ss.str(), 5.f, y, VTextOverlay::alignLeft);
+	};
+	addPercentiles("CPU", m_frameStatistics.getCpuPercentiles(), 105.f);
+	addPercentiles("GPU", m_frameStatistics.getGpuPercentiles(), 125.f);
+
+	ss = std::stringstream();
+	ss << std::fixed << std::setprecision(1) << "Hitches (> " << m_frameStatistics.getHitchThreshold() << " ms) : " << m_frameStatistics.getHitchCount();
+	if (m_frameStatistics.getHitchCount() > 0)
+	{
+		ss << ", last " << m_frameStatistics.getLastHitchMS() << " ms at frame " << m_frameStatistics.getLastHitchFrame();
+	}
+	m_textOverlay.addText(ss.str(), 5.f, 145.f, VTextOverlay::alignLeft);
+
+	// Memory heaps in use against their budget in the upper right corner, with what the allocator's share is used for
+	{
+		const float x = m_vulkanManager.getSwapChainExtent().width - 5.f;
+		float memoryY = 5.f;
+		for (const auto &heap : m_vulkanManager.getMemoryHeapBudgets())
+		{
+			if (heap.reservedBytes == 0) continue;
+
+			ss = std::stringstream();
+			ss << "Heap " << heap.heapIndex << (heap.isDeviceLocal ? " (device)" : " (host)") << " : " << (heap.usage >> 20) << " / "
+				<< (heap.budget >> 20) << " MB" << (heap.isReportedByDriver ? "" : " (heap size)") << (heap.isOverBudget() ? " OVER BUDGET" : "");
+			m_textOverlay.addText(ss.str(), x, memoryY, VTextOverlay::alignRight);
+			memoryY += 20.f;
+
+			for (uint32_t c = 0; c < rj::MEMORY_CATEGORY_COUNT; ++c)
+			{
+				if (heap.categoryBytes[c] == 0) continue;
+
+				ss = std::stringstream();
+				ss << std::fixed << std::setprecision(1) << rj::getMemoryCategoryName(static_cast<rj::MemoryCategory>(c)) << " : "
+					<< static_cast<double>(heap.categoryBytes[c]) / (1024. * 1024.) << " MB";
+				m_textOverlay.addText(ss.str(), x, memoryY, VTextOverlay::alignRight);
+				memoryY += 20.f;
+			}
+		}
+#ifdef USE_MEMORY_DEFRAGMENTATION
+		if (m_vulkanManager.isMemoryDefragmenting())
+		{
+			ss = std::stringstream();
+			ss << std::fixed << std::setprecision(1) << "Defragmenting textures, "
+				<< static_cast<double>(m_textureStreamer->getLastMovedBytes()) / (1024. * 1024.) << " MB moved last frame";
+			m_textOverlay.addText(ss.str(), x, memoryY, VTextOverlay::alignRight);
+			memoryY += 20.f;
+		}
+#endif
+
+#ifdef USE_HOST_ALLOCATION_TRACKING
+		ss = std::stringstream();
+		ss << std::fixed << std::setprecision(1) << "Driver host memory : " << static_cast<double>(m_hostAllocator.getTotalBytes()) / (1024. * 1024.) << " MB";
+		m_textOverlay.addText(ss.str(), x, memoryY, VTextOverlay::alignRight);
+		memoryY += 20.f;
+
+		for (uint32_t s = 0; s < rj::HOST_ALLOCATION_SCOPE_COUNT; ++s)
+		{
+			const auto scope = static_cast<VkSystemAllocationScope>(s);
+			const auto stats = m_hostAllocator.getScopeStats(scope);
+			if (stats.peakBytes == 0 && stats.internalBytes == 0) continue;
+
+			ss = std::stringstream();
+			ss << rj::getHostAllocationScopeName(scope) << " : " << ((stats.bytes + stats.internalBytes) >> 10) << " KB in "
+				<< stats.allocationCount << " allocations, peak " << (stats.peakBytes >> 10) << " KB";
+			m_textOverlay.addText(ss.str(), x, memoryY, VTextOverlay::alignRight);
+			memoryY += 20.f;
+		}
+#endif
+
+		// Differences of B from A so far, the interval once both have two blocks
+		if (m_abExperiment.isRunning())
+		{
+			ss = std::stringstream();
+			ss << "A/B (B) : block " << m_abExperiment.getBlock() + 1 << ", rendering " << (m_abExperiment.getConfig() == 0 ? "A" : "B");
+			m_textOverlay.addText(ss.str(), x, memoryY + 20.f, VTextOverlay::alignRight);
+			memoryY += 40.f;
+
+			for (const auto &c : m_abExperiment.getComparisons(false))
+			{
+				if (c.name != "cpu" && c.name != "gpu") continue;
+				ss = std::stringstream();
+				ss << std::fixed << std::setprecision(2) << c.name << " : " << c.a.mean << " -> " << c.b.mean << " ms, delta " << c.delta;
+				if (c.ci95 >= 0.0) ss << " +- " << c.ci95;
+				m_textOverlay.addText(ss.str(), x, memoryY, VTextOverlay::alignRight);
+				memoryY += 20.f;
+			}
+		}
+	}
+
+	// CPU frame times of the last frames in the lower left corner, the line is the hitch threshold
+	{
+		const float graphHeight = 80.f;
+		std::vector<float> recentTimes;
+		m_frameStatistics.getRecentCpuTimes(120, &recentTimes);
+		m_textOverlay.addGraph(recentTimes, 5.f, m_vulkanManager.getSwapChainExtent().height - 5.f, 240.f, graphHeight,
+			2.f * m_frameStatistics.getHitchThreshold(), m_frameStatistics.getHitchThreshold());
+	}
+
+	auto addCount = [&](const char *label, uint64_t count)
+	{
+		ss << "  " << label << " ";
+		if (count >= 1000000) ss << static_cast<double>(count) * 1e-6 << "M";
+		else if (count >= 1000) ss << static_cast<double>(count) * 1e-3 << "k";
+		else ss << count;
+	};
+
+	// GPU timings, avg (min - max) over the last frames, then the commands the scope recorded and its estimated memory traffic
+	// in MB read / written, with the bandwidth that takes at the average time. Children are indented under their scope
+	auto addTimings = [&](const std::string &label, const rj::VGpuProfiler::Timings &timings, const rj::CommandCounters *pCommands, float y)
+	{
+		ss = std::stringstream();
+		ss << std::fixed << std::setprecision(2) << label << " : " << timings.avgMS << " ms (" << timings.minMS << " - " << timings.maxMS << ")";
+		if (pCommands)
+		{
+			ss << std::setprecision(1);
+			addCount("draws", pCommands->draws);
+			addCount("pipelines", pCommands->pipelineBinds);
+			addCount("sets", pCommands->descriptorSetBinds);
+			addCount("tris", pCommands->triangles);
+			if (pCommands->indirectDraws > 0) ss << " + indirect";
+			const uint64_t bytes = pCommands->bytesRead + pCommands->bytesWritten;
+			if (bytes > 0)
+			{
+				ss << "  mem " << static_cast<double>(pCommands->bytesRead) * 1e-6 << " / " << static_cast<double>(pCommands->bytesWritten) * 1e-6 << " MB";
+				if (timings.avgMS > 0.f) ss << " " << static_cast<double>(bytes) * 1e-6 / timings.avgMS << " GB/s";
+			}
+		}
+		m_textOverlay.addText(ss.str(), 5.f, y, VTextOverlay::alignLeft);
+	};
+
+	const VkExtent2D renderExtent = getRenderExtent();
+	const double renderPixelCount = static_cast<double>(renderExtent.width) * renderExtent.height;
+
+	const auto scopeTimings = m_gpuProfiler.getScopeTimings();
+	rj::CommandCounters frameCommands;
+	for (const auto &scope : scopeTimings)
+	{
+		if (scope.depth == 0 && scope.hasCommands) frameCommands += scope.commands;
+	}
+
+	float y = 175.f;
+	addTimings("Frame Time", m_gpuProfiler.getFrameTimings(), &frameCommands, y);
+	for (const auto &scope : scopeTimings)
+	{
+		const std::string indent(2 * (scope.depth + 1), ' ');
+		y += 20.f;
+		addTimings(indent + scope.name, scope.timings, scope.hasCommands ? &scope.commands : nullptr, y);
+
+		// Pipeline statistics of the last frame, one line below the timings
+		if (!scope.hasStatistics) continue;
+
+		ss = std::stringstream();
+		ss << std::fixed << std::setprecision(1) << indent;
+		addCount("vs", scope.statistics.vertexInvocations);
+		addCount("prims", scope.statistics.clippingPrimitives);
+		addCount("fs", scope.statistics.fragmentInvocations);
+		// Fragment shader invocations per pixel. Early depth rejected fragments do not count, so the pre-pass lowers it
+		if (scope.depth == 0 && scope.name == "geometry")
+		{
+			ss << "  overdraw " << static_cast<double>(scope.statistics.fragmentInvocations) / renderPixelCount << "x";
+		}
+		y += 20.f;
+		m_textOverlay.addText(ss.str(), 5.f, y, VTextOverlay::alignLeft);
+	}
+
+	m_textOverlay.endTextUpdate(imageIdx);
+}
+
+void DeferredRenderer::drawFrame()
+{
+	if (clampSampleCount(m_requestedSampleCount) != m_sampleCount)
+	{
+		applySampleCount(clampSampleCount(m_requestedSampleCount));
+	}
+	if ((m_useHalfPrecision && m_vulkanManager.isShaderFloat16Enabled()) != m_halfPrecisionShaders)
+	{
+		applyHalfPrecision(!m_halfPrecisionShaders);
+	}
+	if (m_shadingRateSwitchRequests > 0)
+	{
+		m_shadingRateMode = (m_shadingRateMode + m_shadingRateSwitchRequests) % SHADING_RATE_MODE_COUNT;
+		m_shadingRateSwitchRequests = 0;
+	}
+
+	// Everything from the previous drawFrame() on, including waits for the GPU and the swapchain
+	const auto frameStartTime = std::chrono::high_resolution_clock::now();
+	const float cpuFrameTimeMS = std::chrono::duration<float, std::milli>(frameStartTime - m_lastFrameStartTime).count();
+	const bool firstFrame = m_lastFrameStartTime == std::chrono::high_resolution_clock::time_point();
+	m_lastFrameStartTime = frameStartTime;
+
+	startRequestedTraceCapture();
+	TRACE_CPU_SCOPE("drawFrame");
+
+	uint32_t imageIndex;
+	auto &frameSync = m_perFrameSyncObjects[m_currentFrame];
+
+	// Everything from the acquire to the present runs on the frame's device, other submits on all of them
+	m_vulkanManager.setSubmitDeviceMask(1u << m_frameDeviceIndex);
+
+	// CPU may run up to MAX_FRAMES_IN_FLIGHT frames ahead of the GPU. Wait until the last frame
+	// that used this slot's semaphores has finished before reusing them
+	{
+		TRACE_CPU_SCOPE("wait for frame in flight");
+#ifdef USE_TIMELINE_SEMAPHORES
+		m_vulkanManager.waitSemaphore(m_frameTimelineSemaphore, frameSync.m_frameCompleteValue);
+#else
+		m_vulkanManager.waitForFences({ frameSync.m_renderFinishedFence });
+#endif
+		// Resources destroyed up to that frame are out of use, their names can be handed out again
+		m_vulkanManager.completeFrames(frameSync.m_frameSerial);
+	}
+
+	// acquired image may not be renderable because the presentation engine is still using it
+	// when @m_imageAvailableSemaphore is signaled, presentation is complete and the image can be used for rendering
+	VkResult result;
+	{
+		TRACE_CPU_SCOPE("acquire image");
+		result = m_vulkanManager.swapChainNextImageIndex(&imageIndex, frameSync.m_imageAvailableSemaphore, std::numeric_limits<uint32_t>::max());
+	}
+
+	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		// The frame is dropped, a later one is captured instead
+		if (m_pCommandCapture)
+		{
+			m_vulkanManager.endCommandCapture();
+			m_pCommandCapture.reset();
+		}
+		m_vulkanManager.setSubmitDeviceMask(m_vulkanManager.getAllDevicesMask());
+		recreateSwapChain();
+		return;
+	}
+	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+	{
+		throw std::runtime_error("failed to acquire swap chain image!");
+	}
+
+	// Uniform buffers, descriptor sets, command buffers and query pools are duplicated per swapchain image.
+	// An image can be acquired while an older frame in flight is still rendering into it if the swapchain
+	// has fewer images than frames in flight, so wait for that frame too.
+	// Render targets (G-buffers, shadow maps, lighting result etc.) are shared by all frames in flight.
+	// Submissions go to a single queue and the external subpass dependencies of each render pass order
+	// a frame's writes after the previous frame's reads.
+	{
+		TRACE_CPU_SCOPE("wait for image in flight");
+#ifdef USE_TIMELINE_SEMAPHORES
+		// Returns immediately if the frame has already been waited on above
+		m_vulkanManager.waitSemaphore(m_frameTimelineSemaphore, m_imageInFlightValues[imageIndex]);
+		m_frameTimelineBase += FTS_COUNT;
+		frameSync.m_frameCompleteValue = m_frameTimelineBase + FTS_FRAME_COMPLETE;
+		m_imageInFlightValues[imageIndex] = frameSync.m_frameCompleteValue;
+#else
+		uint32_t &imageFence = m_imageInFlightFences[imageIndex];
+		if (imageFence != std::numeric_limits<uint32_t>::max() && imageFence != frameSync.m_renderFinishedFence)
+		{
+			m_vulkanManager.waitForFences({ imageFence });
+		}
+		imageFence = frameSync.m_renderFinishedFence;
+		m_vulkanManager.resetFences({ frameSync.m_renderFinishedFence });
+#endif
+	}
+
+	// Rendering into swapchain image @imageIndex is done. So it is safe to update the per-frame data for that image
+	{
+		TRACE_CPU_SCOPE("updateUniformDeviceData");
+		updateUniformDeviceData(imageIndex);
+	}
+	{
+		TRACE_CPU_SCOPE("updateText");
+		updateText(imageIndex);
+	}
+
+	// This image's previous frame has completed, its timestamps are read from the query pool it is about to reset
+	m_gpuProfiler.collect(imageIndex);
+	addGpuTraceEvents();
+
+	// The GPU time belongs to the frame that last rendered into this image, a few frames behind the CPU time
+	if (!firstFrame)
+	{
+		m_frameStatistics.addFrame(cpuFrameTimeMS, m_gpuProfiler.getLastFrameTimeMS());
+		addABFrame(cpuFrameTimeMS);
+	}
+
+	auto &cbs = m_perFrameCommandBuffers[imageIndex];
+	uint32_t geomShadowLightingCommandBuffer = cbs.m_geomShadowLightingCommandBuffer;
+
+#ifdef USE_DYNAMIC_RESOLUTION
+	// That frame was rendered at the scale this image's command buffers were recorded with. Frames in flight share the
+	// attachments but each one only reads the part it has written, so the scale can change from one frame to the next
+	if (!firstFrame)
+	{
+		m_resolutionController.addFrame(m_gpuProfiler.getLastFrameTimeMS(), cbs.m_recordedRenderScale);
+	}
+	m_renderScale = m_resolutionController.getScale();
+	if (cbs.m_recordedRenderScale != m_renderScale)
+	{
+		cbs.m_recordedRenderScale = m_renderScale;
+		cbs.m_dirtyMask |= CB_DIRTY_ALL;
+	}
+#endif
+
+	if (m_recordCommandBuffersPerFrame)
+	{
+		TRACE_CPU_SCOPE("record command buffers");
+		// The previous frame that used this pool has completed. Reset keeps the command buffer allocated.
+		m_vulkanManager.resetCommandPool(m_perFrameCommandPools[imageIndex]);
+		geomShadowLightingCommandBuffer = m_perFrameTransientCommandBuffers[imageIndex];
+		recordGeomShadowLightingCommandBuffer(imageIndex, geomShadowLightingCommandBuffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		// Secondary command buffers are shared with the pre-recorded primary, which is invalid once they are re-recorded
+		if (SCENE_RECORDING_THREAD_COUNT > 1) cbs.m_dirtyMask |= CB_DIRTY_GEOM_SHADOW_LIGHTING;
+	}
+	else if (cbs.m_recordedVisibilityVersion != m_visibilityVersion || cbs.m_recordedDepthPrepass != m_useDepthPrepass)
+	{
+		// Only re-record when the culling result or the depth pre-pass switch has changed since this image's command buffer was recorded
+		cbs.m_dirtyMask |= CB_DIRTY_GEOM_SHADOW_LIGHTING;
+	}
+#ifdef USE_VARIABLE_RATE_SHADING
+	else if (cbs.m_recordedShadingRateMode != m_shadingRateMode)
+	{
+		// The mode is pushed to the shading rate pass
+		cbs.m_dirtyMask |= CB_DIRTY_GEOM_SHADOW_LIGHTING;
+	}
+#endif
+#ifdef USE_RAY_QUERY_SHADOWS
+	else if (m_useRayQueryShadows && cbs.m_recordedTlasBuild != m_perFrameTlasBuilds[imageIndex])
+	{
+		// A recorded build would run again every frame the instances stay put
+		cbs.m_dirtyMask |= CB_DIRTY_GEOM_SHADOW_LIGHTING;
+	}
+#endif
+#ifdef USE_IMPOSTORS
+	writeImpostorInstances(imageIndex);
+#endif
+	recordDirtyCommandBuffers(imageIndex);
+
+	// The tiles this frame's page table points at are copied before its geometry pass samples them
+	std::vector<uint32_t> geomCommandBuffers;
+#ifdef USE_VIRTUAL_TEXTURING
+	if (updateVirtualTextures(imageIndex))
+	{
+		geomCommandBuffers.push_back(cbs.m_virtualTextureCommandBuffer);
+	}
+#endif
+	geomCommandBuffers.push_back(geomShadowLightingCommandBuffer);
+
+	// The capture copies the final image before the text overlay is drawn onto it
+	std::vector<uint32_t> presentCommandBuffers;
+#ifdef USE_COLOR_LUT
+	if (updateColorLut(imageIndex))
+	{
+		presentCommandBuffers.push_back(cbs.m_colorLutCommandBuffer);
+	}
+#endif
+	presentCommandBuffers.push_back(cbs.m_presentCommandBuffer);
+	if (m_frameCaptureCallback || m_externalFrameCallback)
+	{
+		recordFrameCapture(imageIndex);
+		presentCommandBuffers.push_back(cbs.m_frameCaptureCommandBuffer);
+	}
+	presentCommandBuffers.push_back(m_textOverlay.getCommandBuffer(imageIndex));
+
+	// Sync point: every task of this frame is done before its command buffers are submitted
+	m_frameTasks.waitAll();
+
+	auto &recorder = TraceRecorder::get();
+	const uint64_t submitBeginNs = recorder.isCapturing() ? TraceRecorder::now() : 0;
+
+#ifdef USE_TIMELINE_SEMAPHORES
+	const uint32_t timeline = m_frameTimelineSemaphore;
+	const uint64_t base = m_frameTimelineBase;
+
+	m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+
+	m_vulkanManager.queueSubmitNewSubmit(geomCommandBuffers,
+		{}, {}, { timeline }, {}, { base + FTS_GEOM_SHADOW_LIGHTING });
+
+	m_vulkanManager.queueSubmitNewSubmit({ m_perFrameCommandBuffers[imageIndex].m_postEffectCommandBuffer },
+		{ timeline }, { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }, { timeline },
+		{ base + FTS_GEOM_SHADOW_LIGHTING }, { base + FTS_POST_EFFECT });
+
+#ifdef USE_ASYNC_COMPUTE
+	m_vulkanManager.endQueueSubmit(std::numeric_limits<uint32_t>::max(), false);
+
+	m_vulkanManager.beginQueueSubmit(VK_QUEUE_COMPUTE_BIT);
+	m_vulkanManager.queueSubmitNewSubmit({ m_perFrameCommandBuffers[imageIndex].m_bloomComputeCommandBuffer },
+		{ timeline }, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT }, { timeline },
+		{ base + FTS_POST_EFFECT }, { base + FTS_BLOOM_COMPUTE });
+	m_vulkanManager.endQueueSubmit(std::numeric_limits<uint32_t>::max(), false);
+
+	m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+	m_vulkanManager.queueSubmitNewSubmit(presentCommandBuffers,
+		{ timeline, frameSync.m_imageAvailableSemaphore },
+		{ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }, { frameSync.m_renderFinishedSemaphore, timeline },
+		{ base + FTS_BLOOM_COMPUTE, 0 }, { 0, frameSync.m_frameCompleteValue });
+#else
+	// The text overlay render pass loads the final output, its external dependency orders it after the present command buffer
+	m_vulkanManager.queueSubmitNewSubmit(presentCommandBuffers,
+		{ timeline, frameSync.m_imageAvailableSemaphore },
+		{ VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }, { frameSync.m_renderFinishedSemaphore, timeline },
+		{ base + FTS_POST_EFFECT, 0 }, { 0, frameSync.m_frameCompleteValue });
+#endif
+
+	m_vulkanManager.endQueueSubmit(std::numeric_limits<uint32_t>::max(), false);
+#else
+	m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+
+	m_vulkanManager.queueSubmitNewSubmit(geomCommandBuffers,
+		{}, {}, { frameSync.m_geomAndLightingCompleteSemaphore });
+
+	m_vulkanManager.queueSubmitNewSubmit({ m_perFrameCommandBuffers[imageIndex].m_postEffectCommandBuffer },
+		{ frameSync.m_geomAndLightingCompleteSemaphore }, { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }, { frameSync.m_postEffectSemaphore });
+
+#ifdef USE_ASYNC_COMPUTE
+	// The bloom runs on the compute queue while the graphics queue moves on to the next frame's shadow and geometry passes
+	m_vulkanManager.endQueueSubmit(std::numeric_limits<uint32_t>::max(), false);
+
+	m_vulkanManager.beginQueueSubmit(VK_QUEUE_COMPUTE_BIT);
+	m_vulkanManager.queueSubmitNewSubmit({ m_perFrameCommandBuffers[imageIndex].m_bloomComputeCommandBuffer },
+		{ frameSync.m_postEffectSemaphore }, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT }, { frameSync.m_bloomComputeSemaphore });
+	m_vulkanManager.endQueueSubmit(std::numeric_limits<uint32_t>::max(), false);
+
+	m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+	m_vulkanManager.queueSubmitNewSubmit(presentCommandBuffers,
+		{ frameSync.m_bloomComputeSemaphore, frameSync.m_imageAvailableSemaphore },
+		{ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }, { frameSync.m_renderFinishedSemaphore });
+#else
+	// The text overlay render pass loads the final output, its external dependency orders it after the present command buffer
+	m_vulkanManager.queueSubmitNewSubmit(presentCommandBuffers,
+		{ frameSync.m_postEffectSemaphore, frameSync.m_imageAvailableSemaphore },
+		{ VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }, { frameSync.m_renderFinishedSemaphore });
+#endif
+
+	// The last submit that touches this frame's resources signals the frame fence
+	m_vulkanManager.endQueueSubmit(frameSync.m_renderFinishedFence, false);
+#endif
+	frameSync.m_frameSerial = m_vulkanManager.endFrame();
+	if (m_pCommandCapture) finishCommandCapture(imageIndex);
+
+	if (m_externalImageIdx != std::numeric_limits<uint32_t>::max())
+	{
+		// The encoder waits on the GPU, the copy is not waited for here
+		m_vulkanManager.submitExternalImageSinkSignal();
+		auto &sink = m_vulkanManager.getExternalImageSink();
+		if (m_externalFrameCallback) m_externalFrameCallback(sink, m_externalImageIdx, sink.getPendingSignalValue(), m_frameCaptureIndex - 1);
+		m_externalImageIdx = std::numeric_limits<uint32_t>::max();
+	}
+
+	if (submitBeginNs != 0 && recorder.isCapturing()) recorder.addCpuEvent("submit", submitBeginNs, TraceRecorder::now());
+
+	{
+		TRACE_CPU_SCOPE("queuePresent");
+		result = m_vulkanManager.queuePresent({ frameSync.m_renderFinishedSemaphore }, imageIndex, ++m_presentId);
+	}
+	m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	m_vulkanManager.setSubmitDeviceMask(m_vulkanManager.getAllDevicesMask());
+	m_frameDeviceIndex = (m_frameDeviceIndex + 1) % m_frameDeviceCount;
+
+	if (recorder.endFrame())
+	{
+		std::cout << "Trace saved to " TRACE_FILE_NAME << std::endl;
+	}
+
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+	{
+		recreateSwapChain();
+	}
+	else if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to present swap chain image!");
+	}
+}
+
+void DeferredRenderer::recreateSwapChain()
+{
+	VBaseGraphics::recreateSwapChain();
+
+	// The device is idle after recreation and the image count may have changed. Present ids start over with the new swapchain
+	m_presentId = 0;
+	m_imageInFlightFences.assign(m_vulkanManager.getSwapChainSize(), std::numeric_limits<uint32_t>::max());
+	m_imageInFlightValues.assign(m_vulkanManager.getSwapChainSize(), m_frameTimelineBase);
+}
+
+void DeferredRenderer::resetTemporalState()
+{
+	m_taaFrameIndex = 0;
+	m_taaHistoryValid = false;
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	m_accumulatedFrameCount = 0;
+#endif
+#ifdef USE_DEVICE_GROUP
+	for (auto &state : m_deviceTemporalStates)
+	{
+		state = DeviceTemporalState();
+	}
+#endif
+}
+
+#ifdef USE_DEVICE_GROUP
+void DeferredRenderer::selectFrameDeviceState()
+{
+	if (m_temporalStateDevice == m_frameDeviceIndex) return;
+
+	DeviceTemporalState &prev = m_deviceTemporalStates[m_temporalStateDevice];
+	prev.taaHistoryValid = m_taaHistoryValid;
+	prev.prevUnjitteredVP = m_prevUnjitteredVP;
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	prev.accumulatedFrameCount = m_accumulatedFrameCount;
+	prev.accumulationSceneVersion = m_accumulationSceneVersion;
+#endif
+
+	const DeviceTemporalState &next = m_deviceTemporalStates[m_frameDeviceIndex];
+	m_taaHistoryValid = next.taaHistoryValid;
+	m_prevUnjitteredVP = next.prevUnjitteredVP;
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	m_accumulatedFrameCount = next.accumulatedFrameCount;
+	m_accumulationSceneVersion = next.accumulationSceneVersion;
+#endif
+	m_temporalStateDevice = m_frameDeviceIndex;
+}
+#endif
+
+void DeferredRenderer::applySampleCount(VkSampleCountFlagBits sampleCount)
+{
+	m_vulkanManager.deviceWaitIdle();
+
+	m_sampleCount = sampleCount;
+
+	// Only the geometry pass attachments are multisampled. Passes that resolve them take the
+	// sample count as a specialization constant
+	createGeometryRenderPass();
+	createDepthPrepassRenderPass();
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	createGeometryLateRenderPass();
+#endif
+
+	m_vulkanManager.beginGraphicsPipelineBatch();
+	createGeomPassPipeline();
+#ifndef USE_FORWARD_PLUS
+	createLightingPassPipeline();
+#endif
+#ifdef USE_DEFERRED_SKY
+	createSkyboxPipeline();
+#endif
+#ifdef USE_SKY_STENCIL_MASK
+	createSkyMaskPipeline();
+#endif
+#ifdef USE_MSAA_EDGE_CLASSIFICATION
+	createMsaaClassificationPipeline();
+#endif
+	m_vulkanManager.endGraphicsPipelineBatch();
+#ifdef USE_TILED_LIGHTING
+	createLightCullingPipeline();
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	createShadowPageMarkPipeline();
+#endif
+#ifdef USE_SSAO
+	createSsaoPipelines();
+#endif
+#ifdef USE_VISIBILITY_BUFFER
+	createMaterialPipeline();
+#endif
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	createHiZPipelines();
+#endif
+
+	createDepthImage();
+	// Also recreates the attachments that may share memory with the G-buffers and motion vectors
+	createColorAttachmentResources();
+
+	// Framebuffers, descriptor sets and command buffers reference the new images
+	createFramebuffers();
+	createDescriptorSets();
+	createCommandBuffers();
+
+	m_imageInFlightFences.assign(m_vulkanManager.getSwapChainSize(), std::numeric_limits<uint32_t>::max());
+	m_imageInFlightValues.assign(m_vulkanManager.getSwapChainSize(), m_frameTimelineBase);
+}
+
+void DeferredRenderer::applyHalfPrecision(bool enable)
+{
+	m_vulkanManager.deviceWaitIdle();
+
+	m_halfPrecisionShaders = enable;
+
+	m_vulkanManager.beginGraphicsPipelineBatch();
+#ifndef USE_FORWARD_PLUS
+	createLightingPassPipeline();
+#endif
+#ifdef USE_BLOOM_RENDER_PASSES
+	createBloomPipelines();
+#endif
+	createFinalOutputPassPipeline();
+	m_vulkanManager.endGraphicsPipelineBatch();
+#ifdef USE_COMPUTE_BLOOM
+	createBloomComputePipelines();
+#endif
+
+	// The pre-recorded command buffers bind the old pipelines
+	createCommandBuffers();
+
+	m_imageInFlightFences.assign(m_vulkanManager.getSwapChainSize(), std::numeric_limits<uint32_t>::max());
+	m_imageInFlightValues.assign(m_vulkanManager.getSwapChainSize(), m_frameTimelineBase);
+}
+
+void DeferredRenderer::createQueryPools()
+{
+	// Replaces the previous pools on swapchain recreation, scopes and their timings are kept
+	m_gpuProfiler.init(m_vulkanManager.getSwapChainSize());
+}
+
+void DeferredRenderer::buildRenderGraph()
+{
+	using rj::VRenderGraph;
+
+	const VkExtent2D swapChainExtent = m_vulkanManager.getSwapChainExtent();
+	const VkExtent2D renderExtent = getRenderExtent();
+	auto &names = m_renderGraphNames;
+
+	m_renderGraph.clear();
+
+	// --- Images, in the order they are created so that aliases come after the image whose memory they share.
+	// Shadow maps, the Hi-Z pyramid, the bloom mip chain and attachments that only live inside one render pass are left out.
+	// Depth is imported since the culling passes and the depth pre-pass use it outside of the graph
+	names.depthImage = m_renderGraph.importImage("depth", VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	const bool gbufferAliasing = false; // lazily allocated
+#else
+	const bool gbufferAliasing = true;
+#endif
+#ifdef USE_FORWARD_PLUS
+	// The geometry pass shades into the lighting result, there are no G-buffers
+	names.gbufferImages.clear();
+#else
+	names.gbufferImages.resize(m_numGBuffers);
+#endif
+	for (uint32_t i = 0; i < static_cast<uint32_t>(names.gbufferImages.size()); ++i)
+	{
+		names.gbufferImages[i] = m_renderGraph.addImage("gbuffer " + std::to_string(i), renderExtent.width, renderExtent.height,
+			m_gbufferFormats[i], m_sampleCount, gbufferAliasing);
+	}
+#ifdef USE_TAA
+	names.motionVectorImage = m_renderGraph.addImage("motion vectors", renderExtent.width, renderExtent.height,
+		m_motionVectorImageFormat, m_sampleCount);
+#endif
+#ifdef USE_VISIBILITY_BUFFER
+	names.visibilityImage = m_renderGraph.addImage("visibility", renderExtent.width, renderExtent.height,
+		m_visibilityImageFormat, m_sampleCount);
+#endif
+	names.lightingResultImage = m_renderGraph.addImage("lighting result", renderExtent.width, renderExtent.height, m_lightingResultImageFormat);
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	names.bloomBrightImage = m_renderGraph.addImage("bloom brightness", renderExtent.width, renderExtent.height, m_bloomBrightImageFormat);
+#endif
+#ifdef USE_HALF_RES_LIGHTING
+	const VkExtent2D lightingExtent = getLightingExtent();
+	names.halfResLightingImage = m_renderGraph.addImage("half res lighting", lightingExtent.width, lightingExtent.height,
+		m_lightingResultImageFormat);
+#endif
+#ifdef USE_TAA
+	names.taaResultImage = m_renderGraph.addImage("taa result", swapChainExtent.width, swapChainExtent.height, m_lightingResultImageFormat);
+	names.taaHistoryImage = m_renderGraph.importImage("taa history", VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+#endif
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	names.taaAccumulationImage = m_renderGraph.addImage("taa accumulation", swapChainExtent.width, swapChainExtent.height,
+		m_taaHistoryImageFormat);
+#endif
+#ifndef USE_COMPUTE_BLOOM
+	names.postEffectImages.resize(m_numPostEffectImages);
+	for (uint32_t i = 0; i < m_numPostEffectImages; ++i)
+	{
+		names.postEffectImages[i] = m_renderGraph.addImage("post effect " + std::to_string(i),
+			swapChainExtent.width >> 1, swapChainExtent.height >> 1, m_postEffectImageFormats[i]);
+	}
+#endif
+	names.swapChainImage = m_renderGraph.importImage("swapchain", VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	// --- Passes, in execution order
+	const uint32_t geomPass = m_renderGraph.addPass("geometry");
+#ifdef USE_VISIBILITY_BUFFER
+	m_renderGraph.passAddAccess(geomPass, names.visibilityImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+#else
+	for (uint32_t name : names.gbufferImages)
+	{
+		m_renderGraph.passAddAccess(geomPass, name, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+	}
+#endif
+	m_renderGraph.passAddAccess(geomPass, names.depthImage, VRenderGraph::ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE);
+#ifdef USE_TAA
+	m_renderGraph.passAddAccess(geomPass, names.motionVectorImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+#endif
+
+#ifdef USE_VISIBILITY_BUFFER
+	// Also reads the geometry pool, mesh infos and indirect draws, which nothing in the graph writes
+	names.materialPass = m_renderGraph.addPass("material");
+	m_renderGraph.passAddAccess(names.materialPass, names.visibilityImage, VRenderGraph::ACCESS_COMPUTE_SAMPLED_READ);
+	for (uint32_t name : names.gbufferImages)
+	{
+		m_renderGraph.passAddAccess(names.materialPass, name, VRenderGraph::ACCESS_COMPUTE_STORAGE_WRITE);
+	}
+#endif
+
+#ifdef USE_SSAO
+	// Writes the SSAO images, which recordSsao() and the lighting pass synchronize themselves
+	names.ssaoPass = m_renderGraph.addPass("ssao", true);
+	m_renderGraph.passAddAccess(names.ssaoPass, names.depthImage, VRenderGraph::ACCESS_COMPUTE_SAMPLED_READ);
+#ifdef USE_COMPACT_GBUFFER
+	m_renderGraph.passAddAccess(names.ssaoPass, names.gbufferImages[0], VRenderGraph::ACCESS_COMPUTE_SAMPLED_READ);
+#endif
+#endif
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	// G-buffers and depth are read by the lighting subpass of the same render pass
+	const uint32_t lightingPass = geomPass;
+#elif defined(USE_FORWARD_PLUS)
+	// Resolved into the lighting result at the end of the geometry pass
+	const uint32_t lightingPass = geomPass;
+#else
+	const uint32_t lightingPass = m_renderGraph.addPass("lighting");
+	for (uint32_t name : names.gbufferImages)
+	{
+		m_renderGraph.passAddAccess(lightingPass, name, VRenderGraph::ACCESS_SAMPLED_READ);
+	}
+	m_renderGraph.passAddAccess(lightingPass, names.depthImage, VRenderGraph::ACCESS_SAMPLED_READ);
+#endif
+#ifdef USE_HALF_RES_LIGHTING
+	m_renderGraph.passAddAccess(lightingPass, names.halfResLightingImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+
+	// Compares the depth and normal of each full resolution pixel with those of the half resolution pixels around it
+	names.lightingUpsamplePass = m_renderGraph.addPass("lighting upsample");
+	m_renderGraph.passAddAccess(names.lightingUpsamplePass, names.halfResLightingImage, VRenderGraph::ACCESS_SAMPLED_READ);
+	for (uint32_t name : names.gbufferImages)
+	{
+		m_renderGraph.passAddAccess(names.lightingUpsamplePass, name, VRenderGraph::ACCESS_SAMPLED_READ);
+	}
+	m_renderGraph.passAddAccess(names.lightingUpsamplePass, names.depthImage, VRenderGraph::ACCESS_SAMPLED_READ);
+	m_renderGraph.passAddAccess(names.lightingUpsamplePass, names.lightingResultImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+#else
+	m_renderGraph.passAddAccess(lightingPass, names.lightingResultImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+#endif
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	m_renderGraph.passAddAccess(lightingPass, names.bloomBrightImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+#endif
+
+#ifdef USE_VARIABLE_RATE_SHADING
+	// Writes the shading rate image for the next frame, which recordShadingRate() synchronizes itself
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		names.shadingRatePass = m_renderGraph.addPass("shading rate", true);
+		m_renderGraph.passAddAccess(names.shadingRatePass, names.lightingResultImage, VRenderGraph::ACCESS_COMPUTE_SAMPLED_READ);
+#ifdef USE_TAA
+		m_renderGraph.passAddAccess(names.shadingRatePass, names.motionVectorImage, VRenderGraph::ACCESS_COMPUTE_SAMPLED_READ);
+#endif
+	}
+#endif
+
+#ifdef USE_TAA
+	names.taaPass = m_renderGraph.addPass("taa resolve");
+	m_renderGraph.passAddAccess(names.taaPass, names.lightingResultImage, VRenderGraph::ACCESS_SAMPLED_READ);
+	m_renderGraph.passAddAccess(names.taaPass, names.taaHistoryImage, VRenderGraph::ACCESS_SAMPLED_READ);
+	m_renderGraph.passAddAccess(names.taaPass, names.depthImage, VRenderGraph::ACCESS_SAMPLED_READ);
+	m_renderGraph.passAddAccess(names.taaPass, names.motionVectorImage, VRenderGraph::ACCESS_SAMPLED_READ);
+	m_renderGraph.passAddAccess(names.taaPass, names.taaResultImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	m_renderGraph.passAddAccess(names.taaPass, names.taaAccumulationImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+#endif
+
+	const uint32_t historyCopyPass = m_renderGraph.addPass("taa history copy");
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	m_renderGraph.passAddAccess(historyCopyPass, names.taaAccumulationImage, VRenderGraph::ACCESS_TRANSFER_READ);
+#else
+	m_renderGraph.passAddAccess(historyCopyPass, names.taaResultImage, VRenderGraph::ACCESS_TRANSFER_READ);
+#endif
+	m_renderGraph.passAddAccess(historyCopyPass, names.taaHistoryImage, VRenderGraph::ACCESS_TRANSFER_WRITE);
+
+	const uint32_t sceneColorImage = names.taaResultImage;
+#else
+	const uint32_t sceneColorImage = names.lightingResultImage;
+#endif
+
+#ifdef USE_AUTO_EXPOSURE
+	// The histogram and exposure buffers are synchronized by recordAutoExposure() itself
+	names.autoExposurePass = m_renderGraph.addPass("auto exposure", true);
+	m_renderGraph.passAddAccess(names.autoExposurePass, sceneColorImage, VRenderGraph::ACCESS_COMPUTE_SAMPLED_READ);
+#endif
+
+	// Same order as recordPostEffectCommandBuffer()
+	names.bloomPasses.clear();
+#ifdef USE_COMPUTE_BLOOM
+	// The mip chain pass only writes the bloom mip chain, which recordComputeBloom() synchronizes itself
+	names.bloomPasses.push_back(m_renderGraph.addPass("bloom mip chain", true));
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), sceneColorImage, VRenderGraph::ACCESS_COMPUTE_SAMPLED_READ);
+#else
+	const uint32_t pe0 = names.postEffectImages[0];
+	const uint32_t pe1 = names.postEffectImages[1];
+	names.bloomPasses.push_back(m_renderGraph.addPass("bloom brightness"));
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	// Only downsamples what the lighting pass found bright
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), names.bloomBrightImage, VRenderGraph::ACCESS_SAMPLED_READ);
+#else
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), sceneColorImage, VRenderGraph::ACCESS_SAMPLED_READ);
+#endif
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe0, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+#ifdef USE_COMPUTE_BLUR
+	names.bloomPasses.push_back(m_renderGraph.addPass("bloom horizontal blur"));
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe0, VRenderGraph::ACCESS_COMPUTE_SAMPLED_READ);
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe1, VRenderGraph::ACCESS_COMPUTE_STORAGE_WRITE);
+	names.bloomPasses.push_back(m_renderGraph.addPass("bloom vertical blur"));
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe1, VRenderGraph::ACCESS_COMPUTE_SAMPLED_READ);
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe0, VRenderGraph::ACCESS_COMPUTE_STORAGE_WRITE);
+#else
+	names.bloomPasses.push_back(m_renderGraph.addPass("bloom horizontal blur"));
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe0, VRenderGraph::ACCESS_SAMPLED_READ);
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe1, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+	names.bloomPasses.push_back(m_renderGraph.addPass("bloom vertical blur"));
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe1, VRenderGraph::ACCESS_SAMPLED_READ);
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe0, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+#endif
+#endif
+#ifndef USE_FUSED_BLOOM_MERGE
+	names.bloomPasses.push_back(m_renderGraph.addPass("bloom merge"));
+#ifndef USE_COMPUTE_BLOOM
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), pe0, VRenderGraph::ACCESS_SAMPLED_READ);
+#endif
+	m_renderGraph.passAddAccess(names.bloomPasses.back(), sceneColorImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_READ_WRITE);
+#endif
+
+	const uint32_t finalOutputPass = m_renderGraph.addPass("final output");
+	m_renderGraph.passAddAccess(finalOutputPass, sceneColorImage, VRenderGraph::ACCESS_SAMPLED_READ);
+#if defined(USE_FUSED_BLOOM_MERGE) && !defined(USE_COMPUTE_BLOOM)
+	m_renderGraph.passAddAccess(finalOutputPass, pe0, VRenderGraph::ACCESS_SAMPLED_READ);
+#endif
+#ifndef USE_MERGED_GEOMETRY_LIGHTING
+	// Debug display modes
+	for (uint32_t name : names.gbufferImages)
+	{
+		m_renderGraph.passAddAccess(finalOutputPass, name, VRenderGraph::ACCESS_SAMPLED_READ);
+	}
+#endif
+	m_renderGraph.passAddAccess(finalOutputPass, names.depthImage, VRenderGraph::ACCESS_SAMPLED_READ);
+	m_renderGraph.passAddAccess(finalOutputPass, names.swapChainImage, VRenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+
+	m_renderGraph.compile();
+	m_renderGraphImages.assign(m_renderGraph.getImageCount(), VRenderGraph::INVALID_NAME);
+}
+
+void DeferredRenderer::createRenderPasses()
+{
+	// Render pass dependencies depend on which images share memory
+	buildRenderGraph();
+
+#ifndef USE_COMPUTE_ENV_PREFILTER
+	if (isSpecEnvPrefilterNeeded()) createSpecEnvPrefilterRenderPass();
+#endif
+	createGeometryRenderPass();
+	createDepthPrepassRenderPass();
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	createGeometryLateRenderPass();
+#endif
+	createShadowRenderPass();
+#if !defined(USE_MERGED_GEOMETRY_LIGHTING) && !defined(USE_FORWARD_PLUS)
+	createLightingRenderPass();
+#endif
+#ifdef USE_BLOOM_RENDER_PASSES
+	createBloomRenderPasses();
+#endif
+	createFinalOutputRenderPass();
+#ifdef USE_TAA
+	createTaaRenderPass();
+#endif
+#ifdef USE_HALF_RES_LIGHTING
+	createLightingUpsampleRenderPass();
+#endif
+#ifdef USE_PROBE_VOLUME
+	createProbeCaptureRenderPass();
+#endif
+#ifdef USE_IMPOSTORS
+	if (!m_initialized) createImpostorBakeRenderPass(); // only used by the bake at startup
+#endif
+}
+
+void DeferredRenderer::createDescriptorSetLayouts()
+{
+	createBrdfLutDescriptorSetLayout();
+	createSpecEnvPrefilterDescriptorSetLayout();
+	createGeomPassDescriptorSetLayout();
+	createShadowPassDescriptorSetLayout();
+	createLightingPassDescriptorSetLayout();
+#ifdef USE_BLOOM_RENDER_PASSES
+	createBloomDescriptorSetLayout();
+#endif
+	createFinalOutputDescriptorSetLayout();
+#ifdef USE_TILED_LIGHTING
+	createLightCullingDescriptorSetLayout();
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	createShadowPageMarkDescriptorSetLayout();
+#endif
+#ifdef USE_SSAO
+	createSsaoDescriptorSetLayout();
+#endif
+#ifdef USE_VARIABLE_RATE_SHADING
+	createShadingRateDescriptorSetLayout();
+#endif
+#ifdef USE_TAA
+	createTaaDescriptorSetLayout();
+#endif
+#ifdef USE_HALF_RES_LIGHTING
+	createLightingUpsampleDescriptorSetLayout();
+#endif
+#ifdef USE_GPU_CULLING
+	createGpuCullingDescriptorSetLayout();
+#endif
+#ifdef USE_MESHLETS
+	createMeshletDescriptorSetLayout();
+#endif
+#ifdef USE_VERTEX_PULLING
+	createVertexPullingDescriptorSetLayout();
+#endif
+#ifdef USE_VISIBILITY_BUFFER
+	createMaterialDescriptorSetLayout();
+#endif
+#ifdef USE_GPU_SKINNING
+	createSkinningDescriptorSetLayout();
+#endif
+#ifdef USE_COLOR_LUT
+	createColorLutDescriptorSetLayout();
+#endif
+#ifdef USE_AUTO_EXPOSURE
+	createAutoExposureDescriptorSetLayout();
+#endif
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	createHiZDescriptorSetLayout();
+#endif
+#ifdef USE_COMPUTE_BLOOM
+	createBloomComputeDescriptorSetLayout();
+#endif
+#ifdef USE_GPU_SH_PROJECTION
+	createShProjectionDescriptorSetLayout();
+#endif
+#ifdef USE_PROBE_VOLUME
+	createProbeVolumeDescriptorSetLayouts();
+#endif
+#ifdef USE_IMPOSTORS
+	createImpostorDescriptorSetLayout();
+#endif
+#ifdef USE_EVSM_SHADOWS
+	createShadowMomentDescriptorSetLayout();
+#endif
+#ifdef USE_COMPUTE_BLUR
+	createSeparableBlur();
+#endif
+}
+
+void DeferredRenderer::createComputePipelines()
+{
+	// Picked before the first pipeline with *_fp16 variants, drawFrame() switches later on
+	m_halfPrecisionShaders = m_useHalfPrecision && m_vulkanManager.isShaderFloat16Enabled();
+
+	// The BRDF LUT pipeline is created by createComputeResources() if the LUT is not in the cache
+#ifdef USE_COMPUTE_ENV_PREFILTER
+	if (isSpecEnvPrefilterNeeded()) createSpecEnvPrefilterPipeline();
+#endif
+#ifdef USE_TILED_LIGHTING
+	createLightCullingPipeline();
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	createShadowPageMarkPipeline();
+#endif
+#ifdef USE_SSAO
+	createSsaoPipelines();
+#endif
+#ifdef USE_VARIABLE_RATE_SHADING
+	createShadingRatePipeline();
+#endif
+#ifdef USE_GPU_CULLING
+	createGpuCullingPipeline();
+#endif
+#ifdef USE_VISIBILITY_BUFFER
+	createMaterialPipeline();
+#endif
+#ifdef USE_GPU_SKINNING
+	createSkinningPipeline();
+#endif
+#ifdef USE_COLOR_LUT
+	createColorLutPipeline();
+#endif
+#ifdef USE_AUTO_EXPOSURE
+	createAutoExposurePipelines();
+#endif
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	createHiZPipelines();
+#endif
+#ifdef USE_COMPUTE_BLOOM
+	createBloomComputePipelines();
+#endif
+#ifdef USE_GPU_SH_PROJECTION
+	createShProjectionPipelines();
+#endif
+#ifdef USE_PROBE_VOLUME
+	createProbeProjectionPipeline();
+#endif
+#ifdef USE_EVSM_SHADOWS
+	createShadowMomentPipelines();
+#endif
+}
+
+void DeferredRenderer::createGraphicsPipelines()
+{
+	// Pipelines are only recorded here and compiled together on worker threads
+	m_vulkanManager.beginGraphicsPipelineBatch();
+#ifndef USE_COMPUTE_ENV_PREFILTER
+	if (isSpecEnvPrefilterNeeded()) createSpecEnvPrefilterPipeline();
+#endif
+	createGeomPassPipeline();
+	createShadowPassPipeline();
+#ifndef USE_FORWARD_PLUS
+	createLightingPassPipeline();
+#endif
+#ifdef USE_DEFERRED_SKY
+	createSkyboxPipeline();
+#endif
+#ifdef USE_SKY_STENCIL_MASK
+	createSkyMaskPipeline();
+#endif
+#ifdef USE_MSAA_EDGE_CLASSIFICATION
+	createMsaaClassificationPipeline();
+#endif
+#ifdef USE_BLOOM_RENDER_PASSES
+	createBloomPipelines();
+#endif
+	createFinalOutputPassPipeline();
+#ifdef USE_TAA
+	createTaaPipeline();
+#endif
+#ifdef USE_HALF_RES_LIGHTING
+	createLightingUpsamplePipeline();
+#endif
+#ifdef USE_PROBE_VOLUME
+	createProbeCapturePipeline();
+#endif
+#ifdef USE_IMPOSTORS
+	createImpostorPipelines();
+#endif
+	m_vulkanManager.endGraphicsPipelineBatch();
+}
+
+void DeferredRenderer::createCommandPools()
+{
+	// Geometry and shadow command buffers are re-recorded individually when visibility changes
+	m_graphicsCommandPool = m_vulkanManager.createCommandPool(VK_QUEUE_GRAPHICS_BIT, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	m_computeCommandPool = m_vulkanManager.createCommandPool(VK_QUEUE_COMPUTE_BIT);
+}
+
+void DeferredRenderer::createComputeResources()
+{
+	using namespace rj::helper_functions;
+
+	// BRDF LUT, keyed by its size and storage format
+#ifdef USE_COMPACT_IBL_MAPS
+	const uint32_t compactMaps = 1;
+#else
+	const uint32_t compactMaps = 0;
+#endif
+	const uint32_t brdfLutParams[] = { PRECOMPUTE_CACHE_VERSION, BRDF_LUT_SIZE, compactMaps };
+	m_brdfLutCacheFileName = getPrecomputeCacheFileName(BRDF_NAME, hashFnv1a(brdfLutParams, sizeof(brdfLutParams)), ".dds");
+
+	std::string brdfFileName = "";
+	if (AssetFile::exists(m_brdfLutCacheFileName))
+	{
+		brdfFileName = m_brdfLutCacheFileName;
+	}
+
+	m_bakedBRDFs.resize(1, {});
+
+	if (brdfFileName != "")
+	{
+		// Do not generate mip levels for BRDF LUTs
+		loadTexture2D(&m_bakedBRDFs[0], &m_vulkanManager, brdfFileName, false);
+		m_bakedBRDFs[0].samplers.resize(1);
+		m_bakedBRDFs[0].samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+		m_bakedBrdfReady = true;
+	}
+	else
+	{
+		m_bakedBRDFs[0].format = VK_FORMAT_R32G32_SFLOAT;
+		m_bakedBRDFs[0].width = BRDF_LUT_SIZE;
+		m_bakedBRDFs[0].height = BRDF_LUT_SIZE;
+		m_bakedBRDFs[0].depth = 1;
+		m_bakedBRDFs[0].mipLevelCount = 1;
+		m_bakedBRDFs[0].layerCount = 1;
+
+		m_bakedBRDFs[0].image = m_vulkanManager.createImage2D(m_bakedBRDFs[0].width, m_bakedBRDFs[0].height, m_bakedBRDFs[0].format,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		m_vulkanManager.transitionImageLayout(m_bakedBRDFs[0].image, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_GENERAL);
+
+		m_bakedBRDFs[0].imageViews.resize(1);
+		m_bakedBRDFs[0].imageViews[0] = m_vulkanManager.createImageView2D(m_bakedBRDFs[0].image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		m_bakedBRDFs[0].samplers.resize(1);
+		m_bakedBRDFs[0].samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+
+		m_shouldSaveBakedBrdf = true;
+		createBrdfLutPipeline();
+
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+		// Scale 1 and bias 0, the specular reflectance is F0 until the LUT is ready
+		const uint8_t texel[4] = { 255, 0, 0, 255 };
+		loadTexture2DFromBinaryData(&m_fallbackBrdfLut, &m_vulkanManager, texel, 1, 1, gli::FORMAT_RGBA8_UNORM_PACK8);
+#endif
+	}
+
+#ifdef USE_GPU_SH_PROJECTION
+	// Diffuse SH coefficients, as vec4s
+	const auto &skybox = m_scene.skybox;
+	m_diffuseSHBuffer.offset = 0;
+	m_diffuseSHBuffer.size = 9 * sizeof(glm::vec4);
+	m_diffuseSHBuffer.buffer = m_vulkanManager.createBuffer(m_diffuseSHBuffer.size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (skybox.diffuseSHReady)
+	{
+		// Saved coefficients
+		glm::vec4 coeffs[9];
+		for (uint32_t i = 0; i < 9; ++i)
+		{
+			coeffs[i] = glm::vec4(skybox.diffuseSHCoefficients[i], 0.f);
+		}
+		m_vulkanManager.transferHostDataToBuffer(m_diffuseSHBuffer.buffer, m_diffuseSHBuffer.size, coeffs);
+	}
+	else
+	{
+		m_shProjectionGroupCount = (skybox.radianceMap.width + SH_PROJECTION_GROUP_SIZE - 1) / SH_PROJECTION_GROUP_SIZE;
+
+		m_shPartialSumBuffer.offset = 0;
+		m_shPartialSumBuffer.size = 6 * m_shProjectionGroupCount * m_shProjectionGroupCount * 9 * sizeof(glm::vec4);
+		m_shPartialSumBuffer.buffer = m_vulkanManager.createBuffer(m_shPartialSumBuffer.size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
+#endif
+
+#ifdef USE_PROBE_VOLUME
+	createProbeVolumeResources();
+#endif
+#ifdef USE_IMPOSTORS
+	createImpostorResources();
+#endif
+#ifdef USE_COLOR_LUT
+	createColorLutResources();
+#endif
+#ifdef USE_AUTO_EXPOSURE
+	createAutoExposureResources();
+#endif
+}
+
+void DeferredRenderer::createDepthResources()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyImage(m_shadowImage.image);
+
+		for (auto name : m_shadowImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+
+		for (auto name : m_shadowImage.samplers)
+		{
+			m_vulkanManager.destroySampler(name);
+		}
+
+#ifdef USE_TILED_LIGHTING
+		m_vulkanManager.destroyBuffer(m_lightTileBuffer.buffer);
+#endif
+
+#ifdef USE_VIRTUAL_TEXTURING
+		for (const auto &b : m_perFrameVirtualFeedbackBuffers)
+		{
+			m_vulkanManager.unmapBuffer(b.buffer);
+			m_vulkanManager.destroyBuffer(b.buffer);
+		}
+#endif
+
+#ifdef USE_HIZ_OCCLUSION_CULLING
+		m_vulkanManager.destroyImage(m_hiZImage.image);
+
+		for (auto name : m_hiZImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+
+		for (auto name : m_hiZImage.samplers)
+		{
+			m_vulkanManager.destroySampler(name);
+		}
+#endif
+
+#ifdef USE_EVSM_SHADOWS
+		for (auto *pImage : { &m_shadowMomentImage, &m_shadowMomentBlurImage })
+		{
+			m_vulkanManager.destroyImage(pImage->image);
+
+			for (auto name : pImage->imageViews)
+			{
+				m_vulkanManager.destroyImageView(name);
+			}
+
+			for (auto name : pImage->samplers)
+			{
+				m_vulkanManager.destroySampler(name);
+			}
+		}
+#endif
+	}
+
+	createDepthImage();
+
+	VkFormat depthFormat = findShadowDepthFormat();
+	VkImageAspectFlags aspectMask =
+		rj::helper_functions::hasStencilComponent(depthFormat) ? (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT) : VK_IMAGE_ASPECT_DEPTH_BIT;
+
+	// Layered image used to store shadow maps
+	m_shadowImage.format = depthFormat;
+#ifdef USE_SHADOW_ATLAS
+	// One layer, still viewed as an array for the lighting pass
+	m_shadowImage.width = SHADOW_ATLAS_SIZE;
+	m_shadowImage.height = SHADOW_ATLAS_SIZE;
+	m_shadowImage.layerCount = 1;
+#elif defined(USE_VIRTUAL_SHADOW_MAP)
+	if (!m_vulkanManager.isSparseResidencyEnabled())
+	{
+		throw std::runtime_error("USE_VIRTUAL_SHADOW_MAP needs sparseResidencyImage2D");
+	}
+	// The largest power of two each cascade can be rendered into at once
+	VkPhysicalDeviceProperties props;
+	m_vulkanManager.getPhysicalDeviceProperties(&props);
+	const uint32_t maxVirtualSize = std::min({ static_cast<uint32_t>(VIRTUAL_SHADOW_MAP_SIZE), props.limits.maxImageDimension2D,
+		props.limits.maxFramebufferWidth, props.limits.maxFramebufferHeight, props.limits.maxViewportDimensions[0], props.limits.maxViewportDimensions[1] });
+	m_shadowImage.width = 1;
+	while (m_shadowImage.width * 2 <= maxVirtualSize) m_shadowImage.width *= 2;
+	m_shadowImage.height = m_shadowImage.width;
+	m_shadowImage.layerCount = m_camera.getSegmentCount();
+#else
+	m_shadowImage.width = SHADOW_MAP_SIZE;
+	m_shadowImage.height = SHADOW_MAP_SIZE;
+	m_shadowImage.layerCount = m_camera.getSegmentCount();
+#endif
+	m_shadowImage.depth = 1;
+	m_shadowImage.mipLevelCount = 1;
+	m_shadowImage.sampleCount = VK_SAMPLE_COUNT_1_BIT;
+
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	// No page has memory yet, the page mark pass requests them. Unbound pages read as not resident
+	m_shadowImage.image = m_vulkanManager.createSparseImage2D(m_shadowImage.width, m_shadowImage.height, m_shadowImage.format,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, m_shadowImage.layerCount);
+	const VkExtent3D pageExtent = m_vulkanManager.getSparseImagePageExtent(m_shadowImage.image);
+	m_virtualShadowMap.reset(new VirtualShadowMap((m_shadowImage.width + pageExtent.width - 1) / pageExtent.width,
+		(m_shadowImage.height + pageExtent.height - 1) / pageExtent.height, m_shadowImage.layerCount,
+		VIRTUAL_SHADOW_PAGE_BUDGET, VIRTUAL_SHADOW_PAGE_KEEP_FRAMES));
+	m_shadowCascadeScissors.assign(m_shadowImage.layerCount, {});
+#else
+	m_shadowImage.image = m_vulkanManager.createImage2D(m_shadowImage.width, m_shadowImage.height, m_shadowImage.format,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_shadowImage.mipLevelCount, m_shadowImage.layerCount);
+#endif
+	m_vulkanManager.setImageMemoryCategory(m_shadowImage.image, rj::MEMORY_CATEGORY_SHADOW_MAPS);
+	m_vulkanManager.setImageDebugName(m_shadowImage.image, "shadow cascades");
+
+	m_shadowImage.imageViews.resize(m_shadowImage.layerCount + 1);
+	for (uint32_t i = 0; i < m_shadowImage.layerCount; ++i)
+	{
+		m_shadowImage.imageViews[i] = m_vulkanManager.createImageView2D(m_shadowImage.image, aspectMask, 0, m_shadowImage.mipLevelCount, i);
+	}
+	m_shadowImage.imageViews.back() = m_vulkanManager.createImageView(m_shadowImage.image, VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+		aspectMask, 0, m_shadowImage.mipLevelCount, 0, m_shadowImage.layerCount);
+
+	m_vulkanManager.transitionImageLayout(m_shadowImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	m_shadowCascadeValidMask = 0; // contents of the new image are undefined
+
+	m_shadowImage.samplers.resize(1);
+	m_shadowImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+		0.f, 0.f, 0.f, VK_FALSE, 0.f, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL, VK_BORDER_COLOR_INT_OPAQUE_WHITE);
+
+#ifdef USE_EVSM_SHADOWS
+	// Plain depth reads for the moment generation
+	m_shadowImage.samplers.push_back(m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE));
+
+	// Moments of each cascade with their mip chain, and the intermediate of the separable blur
+	m_shadowMomentImage.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	m_shadowMomentImage.width = SHADOW_MOMENT_MAP_SIZE;
+	m_shadowMomentImage.height = SHADOW_MOMENT_MAP_SIZE;
+	m_shadowMomentImage.depth = 1;
+	m_shadowMomentImage.mipLevelCount = static_cast<uint32_t>(std::floor(std::log2(SHADOW_MOMENT_MAP_SIZE))) + 1;
+	m_shadowMomentImage.layerCount = m_camera.getSegmentCount();
+	m_shadowMomentImage.sampleCount = VK_SAMPLE_COUNT_1_BIT;
+	m_shadowMomentBlurImage = m_shadowMomentImage;
+	m_shadowMomentBlurImage.mipLevelCount = 1;
+
+	for (auto *pImage : { &m_shadowMomentImage, &m_shadowMomentBlurImage })
+	{
+		pImage->image = m_vulkanManager.createImage2D(pImage->width, pImage->height, pImage->format,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pImage->mipLevelCount, pImage->layerCount);
+		m_vulkanManager.setImageMemoryCategory(pImage->image, rj::MEMORY_CATEGORY_SHADOW_MAPS);
+		m_vulkanManager.setImageDebugName(pImage->image, pImage == &m_shadowMomentImage ? "shadow moments" : "shadow moments blur");
+
+		pImage->imageViews.resize(pImage->mipLevelCount + 1);
+		for (uint32_t level = 0; level < pImage->mipLevelCount; ++level)
+		{
+			pImage->imageViews[level] = m_vulkanManager.createImageView(pImage->image, VK_IMAGE_VIEW_TYPE_2D_ARRAY, VK_IMAGE_ASPECT_COLOR_BIT,
+				level, 1, 0, pImage->layerCount);
+		}
+		pImage->imageViews.back() = m_vulkanManager.createImageView(pImage->image, VK_IMAGE_VIEW_TYPE_2D_ARRAY, VK_IMAGE_ASPECT_COLOR_BIT,
+			0, pImage->mipLevelCount, 0, pImage->layerCount);
+
+		m_vulkanManager.transitionImageLayout(pImage->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+		// Trilinear, so the lighting pass can widen the filter by picking a coarser mip
+		pImage->samplers.resize(1);
+		pImage->samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			0.f, static_cast<float>(pImage->mipLevelCount));
+	}
+#endif
+
+#ifdef USE_TILED_LIGHTING
+	// Light lists of the screen tiles, written by the light culling pass and read by the lighting pass
+	VkExtent2D renderExtent = getRenderExtent();
+	m_lightTileCountX = (renderExtent.width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	m_lightTileCountY = (renderExtent.height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	m_lightTileBuffer.offset = 0;
+	m_lightTileBuffer.size = m_lightTileCountX * m_lightTileCountY * (1 + MAX_LIGHTS_PER_TILE) * sizeof(uint32_t);
+	m_lightTileBuffer.buffer = m_vulkanManager.createBuffer(m_lightTileBuffer.size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+#endif
+
+#ifdef USE_VIRTUAL_TEXTURING
+	// One page per feedback block of each swapchain image, written by its geometry pass and read back once its fence is waited on
+	const VkExtent2D feedbackExtent = getRenderExtent();
+	m_virtualFeedbackCountX = (feedbackExtent.width + VIRTUAL_TEXTURE_FEEDBACK_STRIDE - 1) / VIRTUAL_TEXTURE_FEEDBACK_STRIDE;
+	m_virtualFeedbackCountY = (feedbackExtent.height + VIRTUAL_TEXTURE_FEEDBACK_STRIDE - 1) / VIRTUAL_TEXTURE_FEEDBACK_STRIDE;
+	m_perFrameVirtualFeedbackBuffers.resize(m_vulkanManager.getSwapChainSize());
+	m_perFrameVirtualFeedbackMappedData.resize(m_vulkanManager.getSwapChainSize());
+	for (uint32_t i = 0; i < m_vulkanManager.getSwapChainSize(); ++i)
+	{
+		auto &feedbackBuffer = m_perFrameVirtualFeedbackBuffers[i];
+		feedbackBuffer.offset = 0;
+		feedbackBuffer.size = m_virtualFeedbackCountX * m_virtualFeedbackCountY * sizeof(uint32_t);
+		feedbackBuffer.buffer = m_vulkanManager.createBuffer(feedbackBuffer.size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_perFrameVirtualFeedbackMappedData[i] = static_cast<uint32_t *>(m_vulkanManager.mapBuffer(feedbackBuffer.buffer));
+		memset(m_perFrameVirtualFeedbackMappedData[i], 0xFF, feedbackBuffer.size);
+	}
+#endif
+
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	// Farthest depth pyramid. Rounding mip 0 down to a power of two makes every following level an exact 2x2 reduction
+	VkExtent2D hiZExtent = getRenderExtent();
+	m_hiZImage.format = VK_FORMAT_R32_SFLOAT;
+	m_hiZImage.width = 1;
+	m_hiZImage.height = 1;
+	while (m_hiZImage.width * 2 <= hiZExtent.width) m_hiZImage.width *= 2;
+	while (m_hiZImage.height * 2 <= hiZExtent.height) m_hiZImage.height *= 2;
+	m_hiZImage.depth = 1;
+	m_hiZImage.mipLevelCount = static_cast<uint32_t>(std::floor(std::log2(std::max(m_hiZImage.width, m_hiZImage.height)))) + 1;
+	m_hiZImage.layerCount = 1;
+	m_hiZImage.sampleCount = VK_SAMPLE_COUNT_1_BIT;
+
+	m_hiZImage.image = m_vulkanManager.createImage2D(m_hiZImage.width, m_hiZImage.height, m_hiZImage.format,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_hiZImage.mipLevelCount);
+	m_vulkanManager.setImageDebugName(m_hiZImage.image, "hi-z");
+
+	m_hiZImage.imageViews.resize(m_hiZImage.mipLevelCount + 1);
+	for (uint32_t level = 0; level < m_hiZImage.mipLevelCount; ++level)
+	{
+		m_hiZImage.imageViews[level] = m_vulkanManager.createImageView2D(m_hiZImage.image, VK_IMAGE_ASPECT_COLOR_BIT, level);
+	}
+	m_hiZImage.imageViews.back() = m_vulkanManager.createImageView2D(m_hiZImage.image, VK_IMAGE_ASPECT_COLOR_BIT, 0, m_hiZImage.mipLevelCount);
+
+	m_vulkanManager.transitionImageLayout(m_hiZImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+	// Culling reads single texels of the level that matches the projected bounds
+	m_hiZImage.samplers.resize(1);
+	m_hiZImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		0.f, static_cast<float>(m_hiZImage.mipLevelCount));
+#endif
+}
+
+void DeferredRenderer::createDepthImage()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyImage(m_depthImage.image);
+
+		for (auto name : m_depthImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+
+		for (auto name : m_depthImage.samplers)
+		{
+			m_vulkanManager.destroySampler(name);
+		}
+
+		// Not created without MSAA, which may have been switched since
+		for (auto *pImage : { &m_resolvedDepthImage, &m_resolvedDepthMaxImage })
+		{
+			if (pImage->imageViews.empty()) continue;
+			m_vulkanManager.destroyImage(pImage->image);
+			m_vulkanManager.destroyImageView(pImage->imageViews[0]);
+			m_vulkanManager.destroySampler(pImage->samplers[0]);
+			pImage->imageViews.clear();
+			pImage->samplers.clear();
+		}
+	}
+
+	VkExtent2D renderExtent = getRenderExtent();
+	VkFormat depthFormat = findDepthFormat();
+
+	m_depthImage.format = depthFormat;
+	m_depthImage.width = renderExtent.width;
+	m_depthImage.height = renderExtent.height;
+	m_depthImage.depth = 1;
+	m_depthImage.mipLevelCount = 1;
+	m_depthImage.layerCount = 1;
+	m_depthImage.sampleCount = m_sampleCount;
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	// Still stored and sampled after the merged pass, e.g. by TAA
+	const VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+#else
+	const VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+#endif
+	m_depthImage.image = m_vulkanManager.createImage2D(m_depthImage.width, m_depthImage.height, m_depthImage.format,
+		depthUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, 1, m_sampleCount);
+	m_vulkanManager.setImageDebugName(m_depthImage.image, "depth");
+
+	m_depthImage.imageViews.resize(1);
+	VkImageAspectFlags aspectMask =
+		rj::helper_functions::hasStencilComponent(depthFormat) ? (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT) : VK_IMAGE_ASPECT_DEPTH_BIT;
+	m_depthImage.imageViews[0] = m_vulkanManager.createImageView2D(m_depthImage.image, aspectMask);
+
+	m_vulkanManager.transitionImageLayout(m_depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+	m_depthImage.samplers.resize(1);
+	m_depthImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+
+	// Depth only, so the stencil needs no resolve mode of its own
+	const VkResolveModeFlagBitsKHR resolveModes[] = { getDepthResolveMode(), getDepthMaxResolveMode() };
+	rj::helper_functions::ImageWrapper *resolvedImages[] = { &m_resolvedDepthImage, &m_resolvedDepthMaxImage };
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		if (resolveModes[i] == VK_RESOLVE_MODE_NONE_KHR) continue;
+
+		auto &image = *resolvedImages[i];
+		image = m_depthImage;
+		image.format = getResolvedDepthFormat();
+		image.sampleCount = VK_SAMPLE_COUNT_1_BIT;
+		image.image = m_vulkanManager.createImage2D(image.width, image.height, image.format,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		m_vulkanManager.setImageDebugName(image.image, i == 0 ? "resolved depth" : "resolved depth max");
+
+		image.imageViews = { m_vulkanManager.createImageView2D(image.image, VK_IMAGE_ASPECT_DEPTH_BIT) };
+		m_vulkanManager.transitionImageLayout(image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+		image.samplers = { m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE) };
+	}
+}
+
+void DeferredRenderer::createGBufferImages()
+{
+	if (m_initialized)
+	{
+		for (const auto &image : m_gbufferImages)
+		{
+			m_vulkanManager.destroyImage(image.image);
+
+			for (auto name : image.imageViews)
+			{
+				m_vulkanManager.destroyImageView(name);
+			}
+
+			for (auto name : image.samplers)
+			{
+				m_vulkanManager.destroySampler(name);
+			}
+		}
+
+#ifdef USE_TAA
+		m_vulkanManager.destroyImage(m_motionVectorImage.image);
+
+		for (auto name : m_motionVectorImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+
+		for (auto name : m_motionVectorImage.samplers)
+		{
+			m_vulkanManager.destroySampler(name);
+		}
+#endif
+
+#ifdef USE_VISIBILITY_BUFFER
+		m_vulkanManager.destroyImage(m_visibilityImage.image);
+
+		for (auto name : m_visibilityImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+
+		for (auto name : m_visibilityImage.samplers)
+		{
+			m_vulkanManager.destroySampler(name);
+		}
+#endif
+
+#ifdef USE_FORWARD_PLUS
+		if (!m_forwardColorImage.imageViews.empty())
+		{
+			m_vulkanManager.destroyImage(m_forwardColorImage.image);
+			m_vulkanManager.destroyImageView(m_forwardColorImage.imageViews[0]);
+			m_forwardColorImage.imageViews.clear();
+		}
+#endif
+	}
+
+	VkExtent2D renderExtent = getRenderExtent();
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	// Only live inside the merged pass and are never stored
+	const VkImageUsageFlags gbufferUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+	const bool gbufferTransient = true;
+#elif defined(USE_VISIBILITY_BUFFER)
+	// Written by the material pass
+	const VkImageUsageFlags gbufferUsage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	const bool gbufferTransient = false;
+#else
+	const VkImageUsageFlags gbufferUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	const bool gbufferTransient = false;
+#endif
+
+#ifdef USE_FORWARD_PLUS
+	// No G-buffers, the geometry pass shades into the multisampled color, which only lives inside the pass
+	m_gbufferImages.clear();
+	if (m_sampleCount != VK_SAMPLE_COUNT_1_BIT)
+	{
+		m_forwardColorImage.format = m_lightingResultImageFormat;
+		m_forwardColorImage.width = renderExtent.width;
+		m_forwardColorImage.height = renderExtent.height;
+		m_forwardColorImage.depth = 1;
+		m_forwardColorImage.mipLevelCount = 1;
+		m_forwardColorImage.layerCount = 1;
+		m_forwardColorImage.sampleCount = m_sampleCount;
+		m_forwardColorImage.isTransient = true;
+
+		m_forwardColorImage.image = createAttachmentImage2D(m_forwardColorImage, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+
+		m_forwardColorImage.imageViews.resize(1);
+		m_forwardColorImage.imageViews[0] = m_vulkanManager.createImageView2D(m_forwardColorImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	}
+#else
+	// Gbuffer images
+	m_gbufferImages.resize(m_numGBuffers);
+#endif
+	for (uint32_t i = 0; i < static_cast<uint32_t>(m_gbufferImages.size()); ++i)
+	{
+		auto &image = m_gbufferImages[i];
+		image.format = m_gbufferFormats[i];
+		image.width = renderExtent.width;
+		image.height = renderExtent.height;
+		image.depth = 1;
+		image.mipLevelCount = 1;
+		image.layerCount = 1;
+		image.sampleCount = m_sampleCount;
+		image.isTransient = gbufferTransient;
+
+		image.image = createAttachmentImage2D(image, gbufferUsage, m_renderGraphNames.gbufferImages[i]);
+
+		image.imageViews.resize(1);
+		image.imageViews[0] = m_vulkanManager.createImageView2D(image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		image.samplers.resize(1);
+		image.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	}
+
+#ifdef USE_TAA
+	// Motion vectors, written by the geometry pass next to the G-buffers
+	m_motionVectorImage.format = m_motionVectorImageFormat;
+	m_motionVectorImage.width = renderExtent.width;
+	m_motionVectorImage.height = renderExtent.height;
+	m_motionVectorImage.depth = 1;
+	m_motionVectorImage.mipLevelCount = 1;
+	m_motionVectorImage.layerCount = 1;
+	m_motionVectorImage.sampleCount = m_sampleCount;
+
+	m_motionVectorImage.image = createAttachmentImage2D(m_motionVectorImage, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		m_renderGraphNames.motionVectorImage);
+
+	m_motionVectorImage.imageViews.resize(1);
+	m_motionVectorImage.imageViews[0] = m_vulkanManager.createImageView2D(m_motionVectorImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	m_motionVectorImage.samplers.resize(1);
+	m_motionVectorImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+#endif
+
+#ifdef USE_VISIBILITY_BUFFER
+	// Triangle IDs, written by the geometry pass in place of the G-buffers and read by the material pass
+	m_visibilityImage.format = m_visibilityImageFormat;
+	m_visibilityImage.width = renderExtent.width;
+	m_visibilityImage.height = renderExtent.height;
+	m_visibilityImage.depth = 1;
+	m_visibilityImage.mipLevelCount = 1;
+	m_visibilityImage.layerCount = 1;
+	m_visibilityImage.sampleCount = m_sampleCount;
+
+	m_visibilityImage.image = createAttachmentImage2D(m_visibilityImage, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		m_renderGraphNames.visibilityImage);
+
+	m_visibilityImage.imageViews.resize(1);
+	m_visibilityImage.imageViews[0] = m_vulkanManager.createImageView2D(m_visibilityImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	m_visibilityImage.samplers.resize(1);
+	m_visibilityImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+#endif
+}
+
+void DeferredRenderer::createColorAttachmentResources()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyImage(m_lightingResultImage.image);
+
+		for (auto name : m_lightingResultImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+
+		for (auto name : m_lightingResultImage.samplers)
+		{
+			m_vulkanManager.destroySampler(name);
+		}
+
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+		m_vulkanManager.destroyImage(m_bloomBrightImage.image);
+
+		for (auto name : m_bloomBrightImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+
+		for (auto name : m_bloomBrightImage.samplers)
+		{
+			m_vulkanManager.destroySampler(name);
+		}
+#endif
+
+#ifdef USE_HALF_RES_LIGHTING
+		m_vulkanManager.destroyImage(m_halfResLightingImage.image);
+
+		for (auto name : m_halfResLightingImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+
+		for (auto name : m_halfResLightingImage.samplers)
+		{
+			m_vulkanManager.destroySampler(name);
+		}
+#endif
+
+#ifdef USE_LIGHTING_STENCIL
+		m_vulkanManager.destroyImage(m_lightingStencilImage.image);
+
+		for (auto name : m_lightingStencilImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+#endif
+
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+		m_vulkanManager.destroyImage(m_taaAccumulationImage.image);
+
+		for (auto name : m_taaAccumulationImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+#endif
+
+#ifdef USE_TAA
+		for (const auto *pImage : { &m_taaResultImage, &m_taaHistoryImage })
+		{
+			m_vulkanManager.destroyImage(pImage->image);
+
+			for (auto name : pImage->imageViews)
+			{
+				m_vulkanManager.destroyImageView(name);
+			}
+
+			for (auto name : pImage->samplers)
+			{
+				m_vulkanManager.destroySampler(name);
+			}
+		}
+#endif
+
+#ifdef USE_SSAO
+		for (const auto &image : m_ssaoImages)
+		{
+			m_vulkanManager.destroyImage(image.image);
+
+			for (auto name : image.imageViews)
+			{
+				m_vulkanManager.destroyImageView(name);
+			}
+
+			for (auto name : image.samplers)
+			{
+				m_vulkanManager.destroySampler(name);
+			}
+		}
+#endif
+
+#ifdef USE_VARIABLE_RATE_SHADING
+		if (m_vulkanManager.isFragmentShadingRateEnabled())
+		{
+			m_vulkanManager.destroyImage(m_shadingRateImage.image);
+
+			for (auto name : m_shadingRateImage.imageViews)
+			{
+				m_vulkanManager.destroyImageView(name);
+			}
+		}
+#endif
+
+#ifdef USE_COMPUTE_BLOOM
+		m_vulkanManager.destroyImage(m_bloomMipImage.image);
+
+		for (auto name : m_bloomMipImage.imageViews)
+		{
+			m_vulkanManager.destroyImageView(name);
+		}
+
+		for (auto name : m_bloomMipImage.samplers)
+		{
+			m_vulkanManager.destroySampler(name);
+		}
+#else
+		for (const auto &image : m_postEffectImages)
+		{
+			m_vulkanManager.destroyImage(image.image);
+
+			for (auto name : image.imageViews)
+			{
+				m_vulkanManager.destroyImageView(name);
+			}
+
+			for (auto name : image.samplers)
+			{
+				m_vulkanManager.destroySampler(name);
+			}
+		}
+#endif
+	}
+
+	createGBufferImages();
+
+	VkExtent2D swapChainExtent = m_vulkanManager.getSwapChainExtent();
+	VkExtent2D renderExtent = getRenderExtent();
+
+	// Lighting result image
+	m_lightingResultImage.format = m_lightingResultImageFormat;
+	m_lightingResultImage.width = renderExtent.width;
+	m_lightingResultImage.height = renderExtent.height;
+	m_lightingResultImage.depth = 1;
+	m_lightingResultImage.mipLevelCount = 1;
+	m_lightingResultImage.layerCount = 1;
+
+	m_lightingResultImage.image = createAttachmentImage2D(m_lightingResultImage, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		m_renderGraphNames.lightingResultImage);
+
+	m_lightingResultImage.imageViews.resize(1);
+	m_lightingResultImage.imageViews[0] = m_vulkanManager.createImageView2D(m_lightingResultImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	m_lightingResultImage.samplers.resize(1);
+	m_lightingResultImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	// Second lighting pass target. The bloom brightness pass samples it bilinearly at half resolution, 2x2 texels at once
+	m_bloomBrightImage.format = m_bloomBrightImageFormat;
+	m_bloomBrightImage.width = renderExtent.width;
+	m_bloomBrightImage.height = renderExtent.height;
+	m_bloomBrightImage.depth = 1;
+	m_bloomBrightImage.mipLevelCount = 1;
+	m_bloomBrightImage.layerCount = 1;
+
+	m_bloomBrightImage.image = createAttachmentImage2D(m_bloomBrightImage, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		m_renderGraphNames.bloomBrightImage);
+
+	m_bloomBrightImage.imageViews.resize(1);
+	m_bloomBrightImage.imageViews[0] = m_vulkanManager.createImageView2D(m_bloomBrightImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	m_bloomBrightImage.samplers.resize(1);
+	m_bloomBrightImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+#endif
+
+#ifdef USE_HALF_RES_LIGHTING
+	// Lighting pass target. The upsample reads its texels individually
+	m_halfResLightingImage.format = m_lightingResultImageFormat;
+	m_halfResLightingImage.width = getLightingExtent().width;
+	m_halfResLightingImage.height = getLightingExtent().height;
+	m_halfResLightingImage.depth = 1;
+	m_halfResLightingImage.mipLevelCount = 1;
+	m_halfResLightingImage.layerCount = 1;
+
+	m_halfResLightingImage.image = createAttachmentImage2D(m_halfResLightingImage, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		m_renderGraphNames.halfResLightingImage);
+
+	m_halfResLightingImage.imageViews.resize(1);
+	m_halfResLightingImage.imageViews[0] = m_vulkanManager.createImageView2D(m_halfResLightingImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	m_halfResLightingImage.samplers.resize(1);
+	m_halfResLightingImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+#endif
+
+#ifdef USE_LIGHTING_STENCIL
+	// Single sampled stencil of the lighting pass. The MSAA depth stencil of the geometry pass
+	// cannot be attached next to the single sampled lighting result
+	m_lightingStencilImage.format = findStencilFormat();
+	m_lightingStencilImage.width = getLightingExtent().width;
+	m_lightingStencilImage.height = getLightingExtent().height;
+	m_lightingStencilImage.depth = 1;
+	m_lightingStencilImage.mipLevelCount = 1;
+	m_lightingStencilImage.layerCount = 1;
+	m_lightingStencilImage.isTransient = true; // cleared and consumed by the lighting pass
+
+	m_lightingStencilImage.image = createAttachmentImage2D(m_lightingStencilImage, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+
+	const VkImageAspectFlags stencilAspectMask = m_lightingStencilImage.format == VK_FORMAT_S8_UINT ?
+		VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	m_lightingStencilImage.imageViews.resize(1);
+	m_lightingStencilImage.imageViews[0] = m_vulkanManager.createImageView2D(m_lightingStencilImage.image, stencilAspectMask);
+#endif
+
+#ifdef USE_TAA
+	// TAA resolve target and history at swapchain resolution. Bloom is merged into the resolve target
+	const VkImageUsageFlags taaImageUsages[] =
+	{
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT
+	};
+	rj::helper_functions::ImageWrapper *taaImages[] = { &m_taaResultImage, &m_taaHistoryImage };
+	const uint32_t taaGraphImages[] = { m_renderGraphNames.taaResultImage, m_renderGraphNames.taaHistoryImage };
+	const VkFormat taaImageFormats[] = { m_lightingResultImageFormat, m_taaHistoryImageFormat };
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		auto &image = *taaImages[i];
+		image.format = taaImageFormats[i];
+		image.width = swapChainExtent.width;
+		image.height = swapChainExtent.height;
+		image.depth = 1;
+		image.mipLevelCount = 1;
+		image.layerCount = 1;
+
+		image.image = createAttachmentImage2D(image, taaImageUsages[i], taaGraphImages[i]);
+
+		image.imageViews.resize(1);
+		image.imageViews[0] = m_vulkanManager.createImageView2D(image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		image.samplers.resize(1);
+		image.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	}
+
+	// The history is read before the first copy into it
+	m_vulkanManager.transitionImageLayout(m_taaHistoryImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	m_taaHistoryValid = false;
+#ifdef USE_DEVICE_GROUP
+	for (auto &state : m_deviceTemporalStates)
+	{
+		state.taaHistoryValid = false;
+	}
+#endif
+#endif
+
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	m_taaAccumulationImage.format = m_taaHistoryImageFormat;
+	m_taaAccumulationImage.width = swapChainExtent.width;
+	m_taaAccumulationImage.height = swapChainExtent.height;
+	m_taaAccumulationImage.depth = 1;
+	m_taaAccumulationImage.mipLevelCount = 1;
+	m_taaAccumulationImage.layerCount = 1;
+
+	m_taaAccumulationImage.image = createAttachmentImage2D(m_taaAccumulationImage,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, m_renderGraphNames.taaAccumulationImage);
+
+	m_taaAccumulationImage.imageViews.resize(1);
+	m_taaAccumulationImage.imageViews[0] = m_vulkanManager.createImageView2D(m_taaAccumulationImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+#endif
+
+#ifdef USE_SSAO
+	// AO in x and view depth in y for the bilateral weights, at half the render resolution. The blur and the lighting shader
+	// fetch their texels individually
+	m_ssaoImages.resize(2);
+	for (auto &image : m_ssaoImages)
+	{
+		image.format = VK_FORMAT_R32G32_SFLOAT;
+		image.width = (renderExtent.width + 1) >> 1;
+		image.height = (renderExtent.height + 1) >> 1;
+		image.depth = 1;
+		image.mipLevelCount = 1;
+		image.layerCount = 1;
+		image.sampleCount = VK_SAMPLE_COUNT_1_BIT;
+
+		image.image = m_vulkanManager.createImage2D(image.width, image.height, image.format,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		image.imageViews.resize(1);
+		image.imageViews[0] = m_vulkanManager.createImageView2D(image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		m_vulkanManager.transitionImageLayout(image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+		image.samplers.resize(1);
+		image.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	}
+#endif
+
+#ifdef USE_VARIABLE_RATE_SHADING
+	// One rate per texel of getShadingRateTexelSize(), written by the shading rate pass and read by the geometry and lighting
+	// passes of the next frame. Stays in GENERAL, which is valid for both. Starts at 1x1 everywhere
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		const VkExtent2D texelSize = getShadingRateTexelSize();
+		m_shadingRateImage.format = VK_FORMAT_R8_UINT;
+		m_shadingRateImage.width = (renderExtent.width + texelSize.width - 1) / texelSize.width;
+		m_shadingRateImage.height = (renderExtent.height + texelSize.height - 1) / texelSize.height;
+		m_shadingRateImage.depth = 1;
+		m_shadingRateImage.mipLevelCount = 1;
+		m_shadingRateImage.layerCount = 1;
+		m_shadingRateImage.sampleCount = VK_SAMPLE_COUNT_1_BIT;
+
+		m_shadingRateImage.image = m_vulkanManager.createImage2D(m_shadingRateImage.width, m_shadingRateImage.height, m_shadingRateImage.format,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		m_shadingRateImage.imageViews.resize(1);
+		m_shadingRateImage.imageViews[0] = m_vulkanManager.createImageView2D(m_shadingRateImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		const std::vector<uint8_t> fullRates(static_cast<size_t>(m_shadingRateImage.width) * m_shadingRateImage.height, 0);
+		m_vulkanManager.transferHostDataToImage(m_shadingRateImage.image, fullRates.size(), fullRates.data(), VK_IMAGE_ASPECT_COLOR_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+	}
+#endif
+
+#ifdef USE_COMPUTE_BLOOM
+	// Bloom mip chain starting at 1/2 resolution, written and read by compute shaders only
+	m_bloomMipImage.format = m_postEffectImageFormats[0];
+	m_bloomMipImage.width = std::max(swapChainExtent.width >> 1, 1u);
+	m_bloomMipImage.height = std::max(swapChainExtent.height >> 1, 1u);
+	m_bloomMipImage.depth = 1;
+	m_bloomMipImage.mipLevelCount = std::min(static_cast<uint32_t>(BLOOM_MIP_COUNT),
+		static_cast<uint32_t>(std::floor(std::log2(std::min(m_bloomMipImage.width, m_bloomMipImage.height)))) + 1);
+	m_bloomMipImage.layerCount = 1;
+	m_bloomMipImage.sampleCount = VK_SAMPLE_COUNT_1_BIT;
+
+	m_bloomMipImage.image = m_vulkanManager.createImage2D(m_bloomMipImage.width, m_bloomMipImage.height, m_bloomMipImage.format,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_bloomMipImage.mipLevelCount);
+	m_vulkanManager.setImageDebugName(m_bloomMipImage.image, "bloom mips");
+
+	m_bloomMipImage.imageViews.resize(m_bloomMipImage.mipLevelCount);
+	for (uint32_t level = 0; level < m_bloomMipImage.mipLevelCount; ++level)
+	{
+		m_bloomMipImage.imageViews[level] = m_vulkanManager.createImageView2D(m_bloomMipImage.image, VK_IMAGE_ASPECT_COLOR_BIT, level);
+	}
+
+	m_vulkanManager.transitionImageLayout(m_bloomMipImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+	// The downsample and tent filters place their taps between texels
+	m_bloomMipImage.samplers.resize(1);
+	m_bloomMipImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+#else
+	// post effects - perform post processing on 1/2 resolution for the sake of performance
+	m_postEffectImages.resize(m_numPostEffectImages);
+	for (uint32_t i = 0; i < m_numPostEffectImages; ++i)
+	{
+		auto &image = m_postEffectImages[i];
+		image.format = m_postEffectImageFormats[i];
+		image.width = swapChainExtent.width >> 1;
+		image.height = swapChainExtent.height >> 1;
+		image.depth = 1;
+		image.mipLevelCount = 1;
+		image.layerCount = 1;
+
+		// Usually share memory with attachments that are dead by the time bloom runs, see buildRenderGraph()
+#ifdef USE_COMPUTE_BLUR
+		// Written by the blur
+		const VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+#else
+		const VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+#endif
+		image.image = createAttachmentImage2D(image, usage, m_renderGraphNames.postEffectImages[i]);
+
+		image.imageViews.resize(1);
+		image.imageViews[0] = m_vulkanManager.createImageView2D(image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		image.samplers.resize(1);
+		image.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	}
+#endif
+}
+
+// TODO: implement scene file to allow flexible model loading
+void DeferredRenderer::loadAndPrepareAssets()
+{
+	using namespace rj::helper_functions;
+
+#ifdef USE_GPU_CULLING
+	// The culled draws of all meshes are multi draw indirect over a single index buffer
+	m_vulkanManager.geometryPoolSetIndex16Enabled(false);
+#endif
+#ifdef USE_RAY_QUERY_SHADOWS
+	// Picked before any layout or pipeline, other devices keep the shadow maps
+	m_useRayQueryShadows = m_vulkanManager.isRayQueryEnabled();
+#endif
+#if MESH_MIXED_VERTEX_FORMATS
+	m_vulkanManager.geometryPoolSetMixedStrides(offsetof(Vertex, normal), sizeof(Vertex) - offsetof(Vertex, normal));
+#endif
+
+	// Skybox
+	std::string skyboxFileName = "../models/sky_sphere.obj";
+	std::string unfilteredProbeFileName = PROBE_BASE_DIR "Unfiltered_HDR.dds";
+
+	// The specular map and SH coefficients baked from the probe are cached under a hash of its contents and the bake parameters,
+	// so swapping the probe or changing SPEC_IRRADIANCE_MAP_SIZE bakes them again
+	createDirectory(PRECOMPUTE_CACHE_DIR);
+
+	// A snapshot of an earlier startup has the model files with their optional maps probed, the transforms, lights and the
+	// probe hash, so none of that is looked up again
+	SceneFile sceneFile;
+	std::vector<ModelFiles> modelFiles; // by mesh, of the .obj models
+#if !defined(USE_GLTF) && !defined(USE_SYNTHETIC_SCENE)
+	const uint64_t sceneFileKey = getSceneFileKey(skyboxFileName, unfilteredProbeFileName);
+	bool sceneFromFile = false;
+	{
+		STARTUP_PHASE("read " SCENE_FILE_NAME);
+		sceneFromFile = sceneFile.read(SCENE_FILE_NAME, sceneFileKey);
+	}
+	if (sceneFromFile)
+	{
+		skyboxFileName = sceneFile.skyboxFile;
+		unfilteredProbeFileName = sceneFile.probeFile;
+	}
+#endif
+
+	std::string diffuseProbeFileName;
+	{
+		STARTUP_PHASE("hash " + unfilteredProbeFileName);
+		getProbeCacheFileNames(unfilteredProbeFileName, &m_specMapCacheFileName, &diffuseProbeFileName, &sceneFile.probeHash);
+	}
+
+	std::string specProbeFileName = "";
+	if (AssetFile::exists(m_specMapCacheFileName))
+	{
+		specProbeFileName = m_specMapCacheFileName;
+	}
+
+#if !defined(USE_GLTF) && !defined(USE_SYNTHETIC_SCENE)
+	// Reading and decoding the model files goes to the pool first, so it overlaps with the skybox. One job per file
+	std::vector<std::string> modelNames = MODEL_NAMES;
+	// Without a layout every model is at the origin, in a single cell
+	std::vector<glm::vec3> modelPositions(modelNames.size(), glm::vec3(0.f));
+#ifdef USE_WORLD_PARTITION
+	if (!sceneFromFile && AssetFile::exists(WORLD_LAYOUT_FILE_NAME) &&
+		!WorldPartition::loadLayout(WORLD_LAYOUT_FILE_NAME, &modelNames, &modelPositions))
+	{
+		throw std::runtime_error("cannot read the world layout " WORLD_LAYOUT_FILE_NAME);
+	}
+#endif
+	if (sceneFromFile)
+	{
+		for (const auto &mesh : sceneFile.meshes)
+		{
+			modelFiles.push_back({ mesh.modelFile, mesh.mapFiles[0], mesh.mapFiles[1], mesh.mapFiles[2], mesh.mapFiles[3],
+				mesh.mapFiles[4], mesh.mapFiles[5] });
+		}
+	}
+	else
+	{
+		for (const auto &name : modelNames)
+		{
+			modelFiles.push_back(getModelFiles(name));
+		}
+	}
+	std::vector<std::unique_ptr<PendingModel>> pendingModels(modelFiles.size());
+	std::unique_ptr<JobPool> assetJobs(new JobPool(ASSET_LOADING_THREAD_COUNT));
+	if (ASSET_READS_IN_FLIGHT > 0) m_assetReader.reset(new AsyncFileReader(ASSET_READS_IN_FLIGHT));
+	m_scene.meshes.resize(modelFiles.size(), { &m_vulkanManager });
+	m_scene.attachTransforms();
+
+#ifdef USE_STREAMING_ASSETS
+	createPlaceholderMaps();
+#endif
+#ifdef USE_TEXTURE_STREAMING
+	// A replaced image may still be in a material set of another swapchain image or in a frame in flight
+	m_textureStreamer.reset(new rj::VTextureStreamer(&m_vulkanManager, TEXTURE_STREAMING_MIN_RESIDENT_SIZE, TEXTURE_STREAMING_POOL_SIZE,
+		TEXTURE_STREAMING_UPLOAD_BUDGET, m_vulkanManager.getSwapChainSize() + MAX_FRAMES_IN_FLIGHT));
+#ifdef USE_MEMORY_DEFRAGMENTATION
+	m_textureStreamer->setDefragmentation(MEMORY_DEFRAGMENTATION_MAX_USAGE);
+#endif
+#endif
+#ifdef USE_VIRTUAL_TEXTURING
+	if (!m_vulkanManager.isFragmentStoresEnabled())
+	{
+		throw std::runtime_error("USE_VIRTUAL_TEXTURING needs fragmentStoresAndAtomics");
+	}
+	// A feedback block reports each map from each of its pixels once in that many frames, its pages are kept as long. An evicted
+	// slot may still be in the page table of another swapchain image or of a frame in flight
+	m_virtualTextures.reset(new rj::VVirtualTextureCache(&m_vulkanManager, VIRTUAL_TEXTURE_TILE_SIZE, VIRTUAL_TEXTURE_TILE_BORDER,
+		VIRTUAL_TEXTURE_CACHE_SIZE, VIRTUAL_TEXTURE_MAX_PAGES, VIRTUAL_TEXTURE_UPLOADS_PER_FRAME,
+		VIRTUAL_TEXTURE_FEEDBACK_STRIDE * VIRTUAL_TEXTURE_FEEDBACK_STRIDE * VMesh::numMapsPerMesh,
+		m_vulkanManager.getSwapChainSize() + MAX_FRAMES_IN_FLIGHT));
+#endif
+
+	for (size_t i = 0; i < modelFiles.size(); ++i)
+	{
+		const ModelFiles &files = modelFiles[i];
+#ifndef USE_WORLD_PARTITION
+		// Otherwise updateWorldPartition adds the jobs of the cells it loads
+		pendingModels[i] = addModelJobs(files, assetJobs.get());
+#endif
+#ifdef USE_STREAMING_ASSETS
+		setPlaceholderMaps(&m_scene.meshes[i], files);
+#endif
+		VMesh &mesh = m_scene.meshes[i];
+		if (sceneFromFile)
+		{
+			const SceneFile::Mesh &snapshot = sceneFile.meshes[i];
+			mesh.setPosition(snapshot.position);
+			mesh.setRotation(snapshot.rotation);
+			mesh.setScale(snapshot.scale);
+			mesh.materialType = static_cast<MaterialType_t>(snapshot.materialType);
+		}
+		else
+		{
+			mesh.setPosition(modelPositions[i]);
+			mesh.setRotation(glm::quat(glm::vec3(0.f, glm::pi<float>(), 0.f)));
+		}
+	}
+#endif
+
+	{
+		STARTUP_PHASE("skybox");
+#ifdef USE_GPU_SH_PROJECTION
+		// Without saved coefficients createShProjectionCommandBuffer projects the radiance map
+		const bool projectDiffuseSH = false;
+#else
+		const bool projectDiffuseSH = true;
+#endif
+		m_scene.skybox.load(skyboxFileName, unfilteredProbeFileName, specProbeFileName, diffuseProbeFileName, projectDiffuseSH);
+	}
+#if MESH_MIXED_VERTEX_FORMATS
+	if (m_scene.skybox.vertexFormat != VERTEX_FORMAT_QUANTIZED)
+	{
+		throw std::runtime_error("the sky box is drawn with GpuVertex input, raise MESH_QUANTIZE_MAX_STEP");
+	}
+#endif
+
+#ifdef USE_PROBE_SWITCHING
+	// The first probe, prefiltered by prefilterEnvironmentAndComputeBrdfLut. No other one is shown before that is done
+	{
+		const std::vector<std::string> probeDirs = PROBE_BASE_DIRS;
+		auto it = std::find(probeDirs.begin(), probeDirs.end(), PROBE_BASE_DIR);
+		if (it == probeDirs.end())
+		{
+			throw std::runtime_error("PROBE_BASE_DIR is not one of PROBE_BASE_DIRS");
+		}
+
+		ResidentProbe probe;
+		probe.dirIdx = static_cast<uint32_t>(it - probeDirs.begin());
+		probe.radianceMap = m_scene.skybox.radianceMap;
+		probe.specularIrradianceMap = m_scene.skybox.specularIrradianceMap;
+		memcpy(probe.diffuseSHCoefficients, m_scene.skybox.diffuseSHCoefficients, sizeof(probe.diffuseSHCoefficients));
+		probe.specMapReady = true;
+		probe.shouldSaveSpecMap = m_scene.skybox.shouldSaveSpecMap;
+		probe.specMapCacheFileName = m_specMapCacheFileName;
+		m_residentProbes.assign(1, probe);
+		m_currentProbe = 0;
+		m_requestedProbeDir = probe.dirIdx;
+	}
+#endif
+
+	// Models
+#ifdef USE_GLTF
+	{
+		STARTUP_PHASE("glTF " + GLTF_NAME);
+		JobPool decodeJobs(ASSET_LOADING_THREAD_COUNT);
+#ifdef USE_GPU_SKINNING
+		VMesh::loadFromGLTF(m_scene.meshes, &m_vulkanManager, GLTF_NAME, GLTF_VERSION, &m_scene.textureCache, &decodeJobs, &m_animator);
+#else
+		VMesh::loadFromGLTF(m_scene.meshes, &m_vulkanManager, GLTF_NAME, GLTF_VERSION, &m_scene.textureCache, &decodeJobs);
+#endif
+		m_scene.attachTransforms();
+	}
+#elif defined(USE_SYNTHETIC_SCENE)
+	{
+		STARTUP_PHASE("synthetic scene " + m_syntheticScene.toString());
+		loadSyntheticScene();
+	}
+#elif defined(USE_STREAMING_ASSETS)
+	// updateStreamingAssets uploads the models once the first frames are on screen
+	m_pendingModels = std::move(pendingModels);
+#ifndef USE_WORLD_PARTITION
+	m_pendingModelCount = m_pendingModels.size();
+#endif
+	m_assetJobs = std::move(assetJobs);
+#else
+	// Uploads stay on this thread and go in model order, each as soon as the files of its model are decoded.
+	// A failed job rethrows here
+	for (size_t i = 0; i < m_scene.meshes.size(); ++i)
+	{
+		assetJobs->wait(pendingModels[i]->beginJob, pendingModels[i]->endJob);
+		{
+			STARTUP_PHASE("upload model " + modelFiles[i].model);
+			m_scene.meshes[i].upload(pendingModels[i]->data, &m_scene.textureCache, m_textureStreamer.get(), m_virtualTextures.get());
+		}
+		pendingModels[i].reset(); // the decoded files are in device memory now
+	}
+	m_assetReader.reset();
+#endif
+
+#ifdef USE_PIPELINE_PERMUTATIONS
+	// Keep meshes of the same geometry pipeline variant next to each other. Culling preserves the order
+	std::vector<size_t> meshOrder(m_scene.meshes.size());
+	std::iota(meshOrder.begin(), meshOrder.end(), 0);
+	std::stable_sort(meshOrder.begin(), meshOrder.end(), [this](size_t a, size_t b)
+	{
+		return getGeomPipelineVariant(m_scene.meshes[a]) < getGeomPipelineVariant(m_scene.meshes[b]);
+	});
+
+	std::vector<VMesh> sortedMeshes;
+	sortedMeshes.reserve(meshOrder.size());
+	for (size_t i : meshOrder)
+	{
+		sortedMeshes.push_back(std::move(m_scene.meshes[i]));
+	}
+	m_scene.meshes = std::move(sortedMeshes);
+
+#ifdef USE_STREAMING_ASSETS
+	// Pending models follow their meshes. Their jobs write through pointers, which moving the unique_ptrs keeps valid
+	std::vector<std::unique_ptr<PendingModel>> sortedModels;
+	sortedModels.reserve(meshOrder.size());
+	for (size_t i : meshOrder)
+	{
+		sortedModels.push_back(std::move(m_pendingModels[i]));
+	}
+	m_pendingModels = std::move(sortedModels);
+#endif
+	if (!modelFiles.empty())
+	{
+		std::vector<ModelFiles> sortedFiles;
+		sortedFiles.reserve(meshOrder.size());
+		for (size_t i : meshOrder)
+		{
+			sortedFiles.push_back(std::move(modelFiles[i]));
+		}
+		modelFiles = std::move(sortedFiles);
+	}
+#endif
+
+#ifdef USE_WORLD_PARTITION
+	// Meshes are in their final order now
+	m_worldModelFiles = modelFiles;
+	m_worldPartition.reset(new WorldPartition(WORLD_CELL_SIZE, WORLD_EVICTION_RADIUS - WORLD_STREAMING_RADIUS, WORLD_STREAMING_BUDGET,
+		WORLD_MAX_LOADING_CELLS));
+	for (uint32_t i = 0; i < static_cast<uint32_t>(m_scene.meshes.size()); ++i)
+	{
+		m_worldPartition->addMesh(i, m_scene.meshes[i].getPostion());
+	}
+	std::cout << m_scene.meshes.size() << " meshes in " << m_worldPartition->getCellCount() << " world cells" << std::endl;
+#endif
+
+	// Lights
+	if (!sceneFile.lights.empty())
+	{
+		const SceneFile::Light &light = sceneFile.lights[0];
+		m_scene.shadowLight.setPositionAndDirection(light.position, light.direction);
+		m_scene.shadowLight.setColor(light.color);
+		m_scene.shadowLight.setCastShadow(light.castShadow);
+	}
+	else
+	{
+		m_scene.shadowLight.setPositionAndDirection(glm::vec3(1.f), glm::vec3(-1.f));
+		m_scene.shadowLight.setColor(glm::vec3(2.f));
+		m_scene.shadowLight.setCastShadow(true);
+	}
+
+#if !defined(USE_GLTF) && !defined(USE_SYNTHETIC_SCENE)
+	if (!sceneFromFile)
+	{
+		// In the final mesh order, so the next startup sorts them into the same
+		sceneFile.skyboxFile = skyboxFileName;
+		sceneFile.probeFile = unfilteredProbeFileName;
+		sceneFile.meshes.resize(m_scene.meshes.size());
+		for (size_t i = 0; i < m_scene.meshes.size(); ++i)
+		{
+			const VMesh &mesh = m_scene.meshes[i];
+			const ModelFiles &files = modelFiles[i];
+			SceneFile::Mesh &snapshot = sceneFile.meshes[i];
+			snapshot.modelFile = files.model;
+			const std::string *mapFiles[] = { &files.albedoMap, &files.normalMap, &files.roughnessMap, &files.metalnessMap, &files.aoMap, &files.emissiveMap };
+			for (uint32_t m = 0; m < 6; ++m)
+			{
+				snapshot.mapFiles[m] = *mapFiles[m];
+			}
+			snapshot.position = mesh.getPostion();
+			snapshot.rotation = mesh.getRotation();
+			snapshot.scale = mesh.getScale();
+			snapshot.materialType = static_cast<uint32_t>(mesh.materialType);
+		}
+		const DirectionalLight &light = m_scene.shadowLight;
+		sceneFile.lights.assign(1, { light.getPosition(), light.getDirection(), light.getColor(), light.castShadow() });
+
+		if (sceneFile.write(SCENE_FILE_NAME, sceneFileKey))
+		{
+			AssetFile::record(SCENE_FILE_NAME);
+		}
+		else
+		{
+			std::cerr << "cannot write the scene file " SCENE_FILE_NAME << std::endl;
+		}
+	}
+#endif
+#ifdef USE_EVSM_SHADOWS
+	// Cascades are padded by half the PCF kernel, here by the blur footprint in shadow map texels instead
+	m_scene.shadowLight.setPCFKernelSize(2 * SHADOW_MOMENT_BLUR_RADIUS * (SHADOW_MAP_SIZE / SHADOW_MOMENT_MAP_SIZE) + 1);
+#endif
+
+#ifdef USE_INSTANCING
+#ifndef USE_SYNTHETIC_SCENE
+	// Repeat the scene on a grid next to the original. Instance offsets are in the object space of each mesh
+	m_scene.buildBVH();
+	const glm::vec3 sceneSize = m_scene.aabbWorldSpace.max - m_scene.aabbWorldSpace.min;
+	const glm::vec3 gridSpacing(1.1f * sceneSize.x, 0.f, 1.1f * sceneSize.z);
+	for (auto &mesh : m_scene.meshes)
+	{
+		const glm::quat invRotation = glm::inverse(mesh.getRotation());
+		for (uint32_t x = 0; x < TEST_INSTANCE_GRID_SIZE; ++x)
+		{
+			for (uint32_t z = 0; z < TEST_INSTANCE_GRID_SIZE; ++z)
+			{
+				if (x == 0 && z == 0) continue; // the mesh's own instance
+				mesh.addInstance(invRotation * (gridSpacing * glm::vec3(x, 0.f, z)) / mesh.getScale());
+			}
+		}
+	}
+#endif
+
+	m_meshFirstInstances.resize(m_scene.meshes.size());
+	m_totalInstanceCount = 0;
+	for (size_t i = 0; i < m_scene.meshes.size(); ++i)
+	{
+		m_meshFirstInstances[i] = m_totalInstanceCount;
+		m_totalInstanceCount += m_scene.meshes[i].getInstanceCount();
+	}
+	// Transforms are filled in by the first updateUniformHostData
+	++m_instanceTransformsVersion;
+#endif
+#ifdef USE_RAY_QUERY_SHADOWS
+	m_meshBlases.assign(m_scene.meshes.size(), std::numeric_limits<uint32_t>::max());
+	m_rayQueryInstanceCount = 0;
+	for (const auto &mesh : m_scene.meshes) m_rayQueryInstanceCount += mesh.getInstanceCount();
+#endif
+
+#ifdef USE_SCENE_HOT_SWAP
+	// Slots for the largest scene, the uniforms and sets of the meshes are made once for all of them
+	{
+		const std::vector<std::vector<std::string>> scenes = HOT_SWAP_SCENES;
+		const std::vector<std::string> startupModelNames = MODEL_NAMES;
+		auto it = std::find(scenes.begin(), scenes.end(), startupModelNames);
+		if (it == scenes.end())
+		{
+			throw std::runtime_error("MODEL_NAMES is not one of HOT_SWAP_SCENES");
+		}
+		m_currentScene = static_cast<uint32_t>(it - scenes.begin());
+
+		size_t slotCount = 0;
+		for (const auto &scene : scenes) slotCount = std::max(slotCount, scene.size());
+		const size_t startupMeshCount = m_scene.meshes.size();
+		m_scene.meshes.resize(slotCount, { &m_vulkanManager });
+		m_scene.attachTransforms();
+		for (size_t i = startupMeshCount; i < slotCount; ++i)
+		{
+			setPlaceholderMaps(&m_scene.meshes[i], ModelFiles());
+		}
+		m_pendingModels.resize(slotCount);
+	}
+#endif
+
+	m_scene.buildBVH();
+
+#ifdef USE_TILED_LIGHTING
+	// Scatter test point lights over the scene bounds using a Halton sequence
+	const glm::vec3 sceneMin = m_scene.aabbWorldSpace.min;
+	const glm::vec3 sceneExtent = m_scene.aabbWorldSpace.max - m_scene.aabbWorldSpace.min;
+#ifdef USE_SYNTHETIC_SCENE
+	// A light reaches the instances around it whatever the size of the grid, so light count and tile load scale together
+	const float lightRadius = 2.f * SYNTHETIC_INSTANCE_SPACING;
+	const uint32_t pointLightCount = m_syntheticScene.lightCount;
+#else
+	const float lightRadius = 0.1f * glm::length(sceneExtent);
+	const uint32_t pointLightCount = TEST_POINT_LIGHT_COUNT;
+#endif
+	m_pointLights.resize(pointLightCount);
+	for (uint32_t i = 0; i < pointLightCount; ++i)
+	{
+		m_pointLights[i].posOrDir = sceneMin + sceneExtent * glm::vec3(halton(i + 1, 2), halton(i + 1, 3), halton(i + 1, 5));
+		m_pointLights[i].idx = -1; // no shadow map
+		m_pointLights[i].color = glm::vec3(halton(i + 1, 7), halton(i + 1, 11), halton(i + 1, 13)) * 2.f;
+		m_pointLights[i].radius = lightRadius;
+	}
+	++m_pointLightsVersion;
+#endif
+
+#ifdef USE_GPU_SKINNING
+	// After the meshes are sorted, the skinned meshes are found by mesh index
+	createSkinningResources();
+#endif
+
+#ifdef USE_GPU_CULLING
+	const uint32_t meshCount = static_cast<uint32_t>(m_scene.meshes.size());
+	m_meshInfos.resize(meshCount);
+	for (uint32_t i = 0; i < meshCount; ++i)
+	{
+		const auto &bounds = m_scene.meshes[i].getAABBObjectSpace();
+		const auto &lods = m_scene.meshes[i].lods;
+		m_meshInfos[i].aabbMin = glm::vec4(bounds.min, 1.f);
+		m_meshInfos[i].aabbMax = glm::vec4(bounds.max, 1.f);
+		m_meshInfos[i].vertexOffset = lods[0].vertexOffset;
+		m_meshInfos[i].lodCount = static_cast<uint32_t>(lods.size());
+		m_meshInfos[i].vertexFetch = glm::uvec4(m_scene.meshes[i].vertexFormat, lods[0].positionOffset, lods[0].attributeOffset, 0);
+		for (uint32_t lod = 0; lod < lods.size(); ++lod)
+		{
+			m_meshInfos[i].lods[lod] = glm::uvec2(lods[lod].firstIndex, lods[lod].indexCount);
+		}
+#ifdef USE_VISIBILITY_BUFFER
+		// The material pass has no push constants per mesh
+		const auto &mesh = m_scene.meshes[i];
+		m_meshInfos[i].vertexFetch.w = mesh.materialType | (mesh.hasAoMap() ? 1u << 8 : 0u) |
+			(mesh.emissiveMap.image != std::numeric_limits<uint32_t>::max() ? 1u << 9 : 0u);
+		if (lods[0].indexCount / 3 > (1u << VISIBILITY_TRIANGLE_BITS))
+		{
+			throw std::runtime_error("mesh has more triangles than the USE_VISIBILITY_BUFFER IDs can hold");
+		}
+#endif
+	}
+#ifdef USE_VISIBILITY_BUFFER
+	// The last mesh index is left out, its last triangle would make the ID of empty pixels
+	if (meshCount >= (1u << (32 - VISIBILITY_TRIANGLE_BITS)) - 1)
+	{
+		throw std::runtime_error("scene has more meshes than the USE_VISIBILITY_BUFFER IDs can hold");
+	}
+#endif
+
+#ifdef USE_MESHLETS
+	// The meshlets of all meshes go into one set of buffers, rebased onto its vertices and triangles
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> meshletVertices, meshletTriangles;
+	for (uint32_t i = 0; i < meshCount; ++i)
+	{
+		const MeshletData &data = m_scene.meshes[i].meshlets;
+		m_meshInfos[i].firstMeshlet = static_cast<uint32_t>(meshlets.size());
+		m_meshInfos[i].meshletCount = static_cast<uint32_t>(data.meshlets.size());
+		for (Meshlet meshlet : data.meshlets)
+		{
+			meshlet.firstVertex += static_cast<uint32_t>(meshletVertices.size());
+			meshlet.firstTriangle += static_cast<uint32_t>(meshletTriangles.size());
+			meshlets.push_back(meshlet);
+		}
+		meshletVertices.insert(meshletVertices.end(), data.vertices.begin(), data.vertices.end());
+		meshletTriangles.insert(meshletTriangles.end(), data.triangles.begin(), data.triangles.end());
+	}
+	m_meshletCount = static_cast<uint32_t>(meshlets.size());
+	if (meshlets.empty())
+	{
+		throw std::runtime_error("USE_MESHLETS needs meshes with meshlets");
+	}
+
+	auto createMeshletBuffer = [&](rj::helper_functions::BufferWrapper *pBuffer, const void *data, VkDeviceSize size)
+	{
+		pBuffer->size = size;
+		pBuffer->offset = 0;
+		pBuffer->buffer = m_vulkanManager.createBuffer(size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		m_vulkanManager.transferHostDataToBuffer(pBuffer->buffer, size, data);
+	};
+	createMeshletBuffer(&m_meshletBuffer, meshlets.data(), meshlets.size() * sizeof(Meshlet));
+	createMeshletBuffer(&m_meshletVertexBuffer, meshletVertices.data(), meshletVertices.size() * sizeof(uint32_t));
+	createMeshletBuffer(&m_meshletTriangleBuffer, meshletTriangles.data(), meshletTriangles.size() * sizeof(uint32_t));
+
+	m_meshletTaskBuffer.size = getIndirectDrawListCount() * meshCount * sizeof(VkDrawMeshTasksIndirectCommandEXT);
+	m_meshletTaskBuffer.offset = 0;
+	m_meshletTaskBuffer.buffer = m_vulkanManager.createBuffer(m_meshletTaskBuffer.size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (!m_vulkanManager.isMeshShaderEnabled())
+	{
+		m_meshletDrawBuffer.size = getIndirectDrawListCount() * m_meshletCount * sizeof(VkDrawIndexedIndirectCommand);
+		m_meshletDrawBuffer.offset = 0;
+		m_meshletDrawBuffer.buffer = m_vulkanManager.createBuffer(m_meshletDrawBuffer.size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
+#endif
+	// Model matrices are filled in by the first updateUniformHostData
+	++m_meshInfosVersion;
+
+	m_indirectDrawBuffer.size = getIndirectDrawListCount() * meshCount * sizeof(VkDrawIndexedIndirectCommand);
+	m_indirectDrawBuffer.offset = 0;
+	m_indirectDrawBuffer.buffer = m_vulkanManager.createBuffer(m_indirectDrawBuffer.size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+#endif
+
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	// Nothing counts as visible before the first frame, so its early pass is empty and the late pass draws everything
+	std::vector<uint32_t> initialVisibility(meshCount, 0);
+	m_meshVisibilityBuffer.size = meshCount * sizeof(uint32_t);
+	m_meshVisibilityBuffer.offset = 0;
+	m_meshVisibilityBuffer.buffer = m_vulkanManager.createBuffer(m_meshVisibilityBuffer.size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_vulkanManager.transferHostDataToBuffer(m_meshVisibilityBuffer.buffer, m_meshVisibilityBuffer.size, initialVisibility.data());
+#endif
+}
+
+void DeferredRenderer::createSkinningResources()
+{
+#ifdef USE_GPU_SKINNING
+	// The skin vertices and morph deltas of all animated meshes go into one buffer each
+	std::vector<SkinVertex> skinVertices;
+	std::vector<glm::vec4> morphDeltas;
+	m_skinnedMeshes.clear();
+	m_meshSkinnedIndices.assign(m_scene.meshes.size(), Animator::INVALID_INDEX);
+	for (uint32_t j = 0; j < static_cast<uint32_t>(m_scene.meshes.size()); ++j)
+	{
+		const AnimationData &animation = m_scene.meshes[j].animation;
+		if (!m_scene.meshes[j].isAnimated()) continue;
+
+		SkinnedMesh skinned;
+		skinned.mesh = j;
+		skinned.vertexCount = animation.vertexCount;
+		skinned.firstSkinVertex = Animator::INVALID_INDEX;
+		skinned.firstJoint = 0;
+		if (animation.skin != Animator::INVALID_INDEX)
+		{
+			skinned.firstSkinVertex = static_cast<uint32_t>(skinVertices.size());
+			skinned.firstJoint = m_animator.getFirstJoint(animation.skin);
+			skinVertices.insert(skinVertices.end(), animation.skinVertices.begin(), animation.skinVertices.end());
+		}
+		// Morph targets without weights on their node stay at rest
+		skinned.firstWeight = animation.node != Animator::INVALID_INDEX ? m_animator.getFirstWeight(animation.node) : Animator::INVALID_INDEX;
+		skinned.morphTargetCount = skinned.firstWeight != Animator::INVALID_INDEX ? animation.morphTargetCount : 0;
+		skinned.firstMorphDelta = static_cast<uint32_t>(morphDeltas.size() / 2);
+		if (skinned.morphTargetCount > 0)
+		{
+			morphDeltas.insert(morphDeltas.end(), animation.morphDeltas.begin(), animation.morphDeltas.end());
+		}
+		else
+		{
+			skinned.firstWeight = 0;
+		}
+		if (skinned.firstSkinVertex == Animator::INVALID_INDEX && skinned.morphTargetCount == 0) continue;
+
+		m_meshSkinnedIndices[j] = static_cast<uint32_t>(m_skinnedMeshes.size());
+		m_skinnedMeshes.push_back(std::move(skinned));
+	}
+
+	// Storage buffers cannot be empty
+	auto createSkinningBuffer = [&](rj::helper_functions::BufferWrapper *pBuffer, const void *data, VkDeviceSize size)
+	{
+		pBuffer->size = std::max(size, VkDeviceSize(16));
+		pBuffer->offset = 0;
+		pBuffer->buffer = m_vulkanManager.createBuffer(pBuffer->size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		if (size > 0) m_vulkanManager.transferHostDataToBuffer(pBuffer->buffer, size, data);
+	};
+	createSkinningBuffer(&m_skinVertexBuffer, skinVertices.data(), skinVertices.size() * sizeof(SkinVertex));
+	createSkinningBuffer(&m_morphDeltaBuffer, morphDeltas.data(), morphDeltas.size() * sizeof(glm::vec4));
+
+	// The host copies are not needed any more
+	for (auto &mesh : m_scene.meshes)
+	{
+		mesh.animation.skinVertices = std::vector<SkinVertex>();
+		mesh.animation.morphDeltas = std::vector<glm::vec4>();
+	}
+
+	m_animator.resetPose(&m_animationPose);
+	m_jointMatrices.resize(m_animator.getJointCount());
+	m_animationStartTime = std::chrono::high_resolution_clock::now();
+#endif
+}
+
+void DeferredRenderer::createUniformBuffers()
+{
+	// host
+	if (!m_initialized)
+	{
+		m_uCubeViews = reinterpret_cast<CubeMapCameraUniformBuffer *>(m_oneTimeUniformHostData.alloc(sizeof(CubeMapCameraUniformBuffer)));
+
+		// Every mesh takes a whole alignment unit, so the blob grows with the scene instead of capping it at a few hundred meshes
+		m_perFrameUniformHostData.reserve(PER_FRAME_UNIFORM_BLOB_SIZE +
+			m_scene.meshes.size() * m_perFrameUniformHostData.alignedSize(sizeof(PerModelUniformBuffer)));
+
+		m_uCameraVP = reinterpret_cast<TransMatsUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(TransMatsUniformBuffer)));
+		m_uLightInfo = reinterpret_cast<LightingPassUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(LightingPassUniformBuffer)));
+		m_uLightStaticInfo = reinterpret_cast<LightingStaticUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(LightingStaticUniformBuffer)));
+		m_uDisplayInfo = reinterpret_cast<DisplayInfoUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(DisplayInfoUniformBuffer)));
+
+		m_uShadowLightInfos.resize(m_camera.getSegmentCount());
+		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
+		{
+			m_uShadowLightInfos[i] = reinterpret_cast<ShadowLightUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(ShadowLightUniformBuffer)));
+		}
+#ifdef USE_LAYERED_SHADOW_PASS
+		m_uShadowCascades = reinterpret_cast<ShadowCascadesUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(ShadowCascadesUniformBuffer)));
+#endif
+#ifdef USE_TAA
+		m_uTaaInfo = reinterpret_cast<TaaUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(TaaUniformBuffer)));
+#endif
+#ifdef USE_SSAO
+		m_uSsaoInfo = reinterpret_cast<SsaoUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(SsaoUniformBuffer)));
+#endif
+#ifdef USE_AUTO_EXPOSURE
+		m_uAutoExposureInfo = reinterpret_cast<AutoExposureUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(AutoExposureUniformBuffer)));
+#endif
+#ifdef USE_TILED_LIGHTING
+		m_uLightCullingInfo = reinterpret_cast<LightCullingUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(LightCullingUniformBuffer)));
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+		m_uShadowPageMarkInfo = reinterpret_cast<ShadowPageMarkUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(ShadowPageMarkUniformBuffer)));
+#endif
+#ifdef USE_VIRTUAL_TEXTURING
+		m_uVirtualTextureInfo = reinterpret_cast<VirtualTextureUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(VirtualTextureUniformBuffer)));
+#endif
+#ifdef USE_GPU_CULLING
+		m_uGpuCullingInfo = reinterpret_cast<GpuCullingUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(GpuCullingUniformBuffer)));
+#endif
+
+		for (auto &model : m_scene.meshes)
+		{
+			model.uPerModelInfo = reinterpret_cast<PerModelUniformBuffer *>(m_perFrameUniformHostData.alloc(sizeof(PerModelUniformBuffer)));
+		}
+	}
+
+	// device
+	if (!m_initialized)
+	{
+		m_oneTimeUniformDeviceData.size = m_oneTimeUniformHostData.size();
+		m_oneTimeUniformDeviceData.offset = 0;
+		m_oneTimeUniformDeviceData.buffer = m_vulkanManager.createBuffer(m_oneTimeUniformDeviceData.size,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	}
+
+	if (m_initialized)
+	{
+		for (const auto &b : m_perFrameUniformDeviceData)
+		{
+			m_vulkanManager.unmapBuffer(b.buffer);
+			m_vulkanManager.destroyBuffer(b.buffer);
+		}
+	}
+
+	uint32_t swapchainImageCount = m_vulkanManager.getSwapChainSize();
+	m_perFrameUniformDeviceData.resize(swapchainImageCount);
+	m_perFrameUniformMappedData.resize(swapchainImageCount);
+	m_perFrameUniformSyncedStamps.assign(swapchainImageCount, 0);
+
+	// Per-frame buffers stay mapped for their whole lifetime
+	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	{
+		m_perFrameUniformDeviceData[i].size = m_perFrameUniformHostData.size();
+		m_perFrameUniformDeviceData[i].offset = 0;
+		m_perFrameUniformDeviceData[i].buffer = m_vulkanManager.createBuffer(m_perFrameUniformDeviceData[i].size,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_perFrameUniformMappedData[i] = static_cast<char *>(m_vulkanManager.mapBuffer(m_perFrameUniformDeviceData[i].buffer));
+	}
+
+#ifdef USE_TILED_LIGHTING
+	// Lights are rewritten by the host, so every swapchain image gets its own mapped copy
+	if (m_initialized)
+	{
+		for (const auto &b : m_perFrameLightBuffers)
+		{
+			m_vulkanManager.unmapBuffer(b.buffer);
+			m_vulkanManager.destroyBuffer(b.buffer);
+		}
+	}
+
+	m_perFrameLightBuffers.resize(swapchainImageCount);
+	m_perFrameLightBufferMappedData.resize(swapchainImageCount);
+	m_perFrameLightBufferSyncedVersions.assign(swapchainImageCount, std::numeric_limits<uint64_t>::max());
+
+	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	{
+		m_perFrameLightBuffers[i].size = sizeof(PointLightBufferHeader) + MAX_POINT_LIGHTS * sizeof(DiracLight);
+		m_perFrameLightBuffers[i].offset = 0;
+		m_perFrameLightBuffers[i].buffer = m_vulkanManager.createBuffer(m_perFrameLightBuffers[i].size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_perFrameLightBufferMappedData[i] = static_cast<char *>(m_vulkanManager.mapBuffer(m_perFrameLightBuffers[i].buffer));
+	}
+#endif
+
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	// The page mark pass ORs in one bit per requested page, read back once the image's fence is waited on
+	if (m_initialized)
+	{
+		for (const auto &b : m_perFrameShadowPageRequestBuffers)
+		{
+			m_vulkanManager.unmapBuffer(b.buffer);
+			m_vulkanManager.destroyBuffer(b.buffer);
+		}
+	}
+
+	m_perFrameShadowPageRequestBuffers.resize(swapchainImageCount);
+	m_perFrameShadowPageRequestMappedData.resize(swapchainImageCount);
+
+	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	{
+		m_perFrameShadowPageRequestBuffers[i].size = m_virtualShadowMap->getRequestWordCount() * sizeof(uint32_t);
+		m_perFrameShadowPageRequestBuffers[i].offset = 0;
+		m_perFrameShadowPageRequestBuffers[i].buffer = m_vulkanManager.createBuffer(m_perFrameShadowPageRequestBuffers[i].size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_perFrameShadowPageRequestMappedData[i] = static_cast<uint32_t *>(m_vulkanManager.mapBuffer(m_perFrameShadowPageRequestBuffers[i].buffer));
+		memset(m_perFrameShadowPageRequestMappedData[i], 0, m_perFrameShadowPageRequestBuffers[i].size);
+	}
+#endif
+
+#ifdef USE_VIRTUAL_TEXTURING
+	// The page table and the mesh maps are copied from the host like the lights, the tiles the image's frame copies are staged
+	// next to them. The feedback is sized with the render extent in createDepthResources()
+	if (m_initialized)
+	{
+		for (const auto *pBuffers : { &m_perFrameVirtualPageTableBuffers, &m_perFrameVirtualMapBuffers, &m_perFrameVirtualStagingBuffers })
+		{
+			for (const auto &b : *pBuffers)
+			{
+				m_vulkanManager.unmapBuffer(b.buffer);
+				m_vulkanManager.destroyBuffer(b.buffer);
+			}
+		}
+		for (uint32_t pool : m_perFrameVirtualTextureQueryPools)
+		{
+			m_vulkanManager.destroyQueryPool(pool);
+		}
+	}
+
+	m_perFrameVirtualPageTableBuffers.resize(swapchainImageCount);
+	m_perFrameVirtualPageTableMappedData.resize(swapchainImageCount);
+	m_perFrameVirtualPageTableSyncedVersions.assign(swapchainImageCount, std::numeric_limits<uint64_t>::max());
+	m_perFrameVirtualMapBuffers.resize(swapchainImageCount);
+	m_perFrameVirtualMapMappedData.resize(swapchainImageCount);
+	m_perFrameVirtualMapSyncedVersions.assign(swapchainImageCount, std::numeric_limits<uint64_t>::max());
+	m_perFrameVirtualStagingBuffers.resize(swapchainImageCount);
+	m_perFrameVirtualStagingMappedData.resize(swapchainImageCount);
+	m_perFrameVirtualTileCopyCounts.assign(swapchainImageCount, 0);
+
+	auto createMappedBuffer = [this](rj::helper_functions::BufferWrapper *pBuffer, VkDeviceSize size, VkBufferUsageFlags usage)
+	{
+		pBuffer->size = size;
+		pBuffer->offset = 0;
+		pBuffer->buffer = m_vulkanManager.createBuffer(size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		return m_vulkanManager.mapBuffer(pBuffer->buffer);
+	};
+	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	{
+		m_perFrameVirtualPageTableMappedData[i] = static_cast<uint32_t *>(createMappedBuffer(&m_perFrameVirtualPageTableBuffers[i],
+			VIRTUAL_TEXTURE_MAX_PAGES * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+		m_perFrameVirtualMapMappedData[i] = static_cast<uint32_t *>(createMappedBuffer(&m_perFrameVirtualMapBuffers[i],
+			std::max<size_t>(m_scene.meshes.size(), 1) * VMesh::numMapsPerMesh * 2 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+		m_perFrameVirtualStagingMappedData[i] = createMappedBuffer(&m_perFrameVirtualStagingBuffers[i],
+			m_virtualTextures->getStagingSize(VIRTUAL_TEXTURE_MAX_BLOCK_SIZE), VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	}
+	// Timestamps around the tile copies of each image's frame, read once it comes around again
+	m_perFrameVirtualTextureQueryPools.resize(swapchainImageCount);
+	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	{
+		m_perFrameVirtualTextureQueryPools[i] = m_vulkanManager.createQueryPool(VK_QUERY_TYPE_TIMESTAMP, 2);
+	}
+#endif
+
+#ifdef USE_GPU_CULLING
+	// Mesh transforms change from the host like the lights
+	if (m_initialized)
+	{
+		for (const auto &b : m_perFrameMeshInfoBuffers)
+		{
+			m_vulkanManager.unmapBuffer(b.buffer);
+			m_vulkanManager.destroyBuffer(b.buffer);
+		}
+	}
+
+	m_perFrameMeshInfoBuffers.resize(swapchainImageCount);
+	m_perFrameMeshInfoBufferMappedData.resize(swapchainImageCount);
+	m_perFrameMeshInfoBufferSyncedVersions.assign(swapchainImageCount, std::numeric_limits<uint64_t>::max());
+
+	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	{
+		m_perFrameMeshInfoBuffers[i].size = m_meshInfos.size() * sizeof(GpuCullingMeshInfo);
+		m_perFrameMeshInfoBuffers[i].offset = 0;
+		m_perFrameMeshInfoBuffers[i].buffer = m_vulkanManager.createBuffer(m_perFrameMeshInfoBuffers[i].size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_perFrameMeshInfoBufferMappedData[i] = static_cast<char *>(m_vulkanManager.mapBuffer(m_perFrameMeshInfoBuffers[i].buffer));
+	}
+#endif
+
+#ifdef USE_GPU_SKINNING
+	// Joint matrices and morph target weights change every frame
+	if (m_initialized)
+	{
+		for (const auto &b : m_perFrameSkinningBuffers)
+		{
+			m_vulkanManager.unmapBuffer(b.buffer);
+			m_vulkanManager.destroyBuffer(b.buffer);
+		}
+	}
+
+	m_perFrameSkinningBuffers.resize(swapchainImageCount);
+	m_perFrameSkinningBufferMappedData.resize(swapchainImageCount);
+
+	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	{
+		m_perFrameSkinningBuffers[i].size = std::max(VkDeviceSize(16),
+			m_animator.getJointCount() * sizeof(glm::mat4) + m_animator.getWeightCount() * sizeof(float));
+		m_perFrameSkinningBuffers[i].offset = 0;
+		m_perFrameSkinningBuffers[i].buffer = m_vulkanManager.createBuffer(m_perFrameSkinningBuffers[i].size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_perFrameSkinningBufferMappedData[i] = static_cast<char *>(m_vulkanManager.mapBuffer(m_perFrameSkinningBuffers[i].buffer));
+	}
+
+	// One copy of the animated vertices per swapchain image. The geometry pool never frees, so copies of images that
+	// went away on a smaller swapchain are kept for when it grows again
+	for (auto &skinned : m_skinnedMeshes)
+	{
+		while (skinned.frameGeometry.size() < swapchainImageCount)
+		{
+			skinned.frameGeometry.push_back(
+				m_vulkanManager.geometryPoolAddVertexRange(m_scene.meshes[skinned.mesh].geometry, skinned.vertexCount));
+		}
+	}
+#endif
+
+#ifdef USE_INSTANCING
+	if (m_initialized)
+	{
+		for (const auto &b : m_perFrameInstanceBuffers)
+		{
+			m_vulkanManager.unmapBuffer(b.buffer);
+			m_vulkanManager.destroyBuffer(b.buffer);
+		}
+	}
+
+	m_perFrameInstanceBuffers.resize(swapchainImageCount);
+	m_perFrameInstanceBufferMappedData.resize(swapchainImageCount);
+	m_perFrameInstanceBufferSyncedVersions.assign(swapchainImageCount, std::numeric_limits<uint64_t>::max());
+
+	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	{
+		m_perFrameInstanceBuffers[i].size = m_totalInstanceCount * sizeof(PerModelUniformBuffer);
+		m_perFrameInstanceBuffers[i].offset = 0;
+		m_perFrameInstanceBuffers[i].buffer = m_vulkanManager.createBuffer(m_perFrameInstanceBuffers[i].size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_perFrameInstanceBufferMappedData[i] = static_cast<char *>(m_vulkanManager.mapBuffer(m_perFrameInstanceBuffers[i].buffer));
+	}
+#endif
+
+#ifdef USE_RAY_QUERY_SHADOWS
+	if (m_useRayQueryShadows)
+	{
+		if (m_initialized)
+		{
+			for (uint32_t i = 0; i < m_perFrameTlases.size(); ++i)
+			{
+				m_vulkanManager.destroyAccelerationStructure(m_perFrameTlases[i]);
+				m_vulkanManager.unmapBuffer(m_perFrameTlasInstanceBuffers[i].buffer);
+				m_vulkanManager.destroyBuffer(m_perFrameTlasInstanceBuffers[i].buffer);
+			}
+		}
+
+		// Every image's structure is built in full by its first frame
+		m_perFrameTlases.resize(swapchainImageCount);
+		m_perFrameTlasInstanceBuffers.resize(swapchainImageCount);
+		m_perFrameTlasInstanceMappedData.resize(swapchainImageCount);
+		m_perFrameTlasSyncedVersions.assign(swapchainImageCount, std::numeric_limits<uint64_t>::max());
+		m_perFrameTlasInstanceCounts.assign(swapchainImageCount, 0);
+		m_perFrameTlasRefitCounts.assign(swapchainImageCount, 0);
+		m_perFrameTlasBuilds.assign(swapchainImageCount, TLAS_BUILD_FULL);
+
+		for (uint32_t i = 0; i < swapchainImageCount; ++i)
+		{
+			m_perFrameTlases[i] = m_vulkanManager.createTopLevelAccelerationStructure(m_rayQueryInstanceCount);
+			m_perFrameTlasInstanceBuffers[i].size = std::max(1u, m_rayQueryInstanceCount) * sizeof(VkAccelerationStructureInstanceKHR);
+			m_perFrameTlasInstanceBuffers[i].offset = 0;
+			m_perFrameTlasInstanceBuffers[i].buffer = m_vulkanManager.createBuffer(m_perFrameTlasInstanceBuffers[i].size,
+				VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			m_perFrameTlasInstanceMappedData[i] = static_cast<char *>(m_vulkanManager.mapBuffer(m_perFrameTlasInstanceBuffers[i].buffer));
+		}
+	}
+#endif
+
+#ifdef USE_IMPOSTORS
+	if (m_initialized)
+	{
+		for (const auto &b : m_perFrameImpostorInstanceBuffers)
+		{
+			m_vulkanManager.unmapBuffer(b.buffer);
+			m_vulkanManager.destroyBuffer(b.buffer);
+		}
+	}
+
+	m_perFrameImpostorInstanceBuffers.resize(swapchainImageCount);
+	m_perFrameImpostorInstanceMappedData.resize(swapchainImageCount);
+	for (uint32_t i = 0; i < swapchainImageCount; ++i)
+	{
+		m_perFrameImpostorInstanceBuffers[i].size = std::max(1u, m_impostorInstanceCapacity) * sizeof(ImpostorInstance);
+		m_perFrameImpostorInstanceBuffers[i].offset = 0;
+		m_perFrameImpostorInstanceBuffers[i].buffer = m_vulkanManager.createBuffer(m_perFrameImpostorInstanceBuffers[i].size,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_perFrameImpostorInstanceMappedData[i] = static_cast<ImpostorInstance *>(m_vulkanManager.mapBuffer(m_perFrameImpostorInstanceBuffers[i].buffer));
+	}
+#endif
+}
+
+void DeferredRenderer::createDescriptorPools()
+{
+	const uint32_t maxSetCount = 128;
+	const uint32_t maxUBDescCount = 128;
+	const uint32_t maxCISDescCount = 160;
+	const uint32_t maxSIDescCount = 64;
+	const uint32_t maxSBDescCount = 64;
+	const uint32_t maxUBDDescCount = 8;
+	m_vulkanManager.beginCreateDescriptorPool(maxSetCount);
+
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, maxUBDescCount);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, maxUBDDescCount);
+#ifdef USE_BINDLESS_MATERIALS
+	// Each frame's geometry set holds the whole texture array
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		maxCISDescCount + m_vulkanManager.getSwapChainSize() * MAX_BINDLESS_TEXTURES);
+#else
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxCISDescCount);
+#endif
+#ifdef USE_HALF_RES_LIGHTING
+	// Half resolution lighting, G-buffers and depth of each frame's upsample set
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_vulkanManager.getSwapChainSize() * 5);
+#endif
+#ifdef USE_PROBE_VOLUME
+	// The volumes in each frame's lighting set, the capture and radiance maps of the projection set
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_vulkanManager.getSwapChainSize() * 3 + 2);
+#endif
+#ifdef USE_EVSM_SHADOWS
+	// Source and destination of each shadow moment step
+	const uint32_t shadowMomentSetCount = 2 + static_cast<uint32_t>(std::floor(std::log2(SHADOW_MOMENT_MAP_SIZE))) + 1;
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, shadowMomentSetCount);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, shadowMomentSetCount);
+#endif
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, maxSIDescCount);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxSBDescCount);
+#ifdef USE_MESHLETS
+	// Storage buffers of each frame's meshlet set, and its Hi-Z pyramid
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_vulkanManager.getSwapChainSize() * 6);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_vulkanManager.getSwapChainSize());
+#endif
+#ifdef USE_VERTEX_PULLING
+	// Mesh infos and vertex streams of each frame's vertex pulling set
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_vulkanManager.getSwapChainSize() * 3);
+#endif
+#ifdef USE_GPU_SKINNING
+	// Vertex streams, skin vertices, morph deltas and joint matrices of each frame's skinning set
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_vulkanManager.getSwapChainSize() * 5);
+#endif
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	// G-buffers and depth of each frame's lighting set
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, m_vulkanManager.getSwapChainSize() * (m_numGBuffers + 1));
+#endif
+#ifdef USE_COLOR_LUT
+	// The LUT in each frame's final output set and the bake set
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_vulkanManager.getSwapChainSize());
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1);
+#endif
+#ifdef USE_SSAO
+	// Each frame's three SSAO sets, and the AO in its lighting set
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_vulkanManager.getSwapChainSize() * 3);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_vulkanManager.getSwapChainSize() * 10);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, m_vulkanManager.getSwapChainSize() * 3);
+#endif
+#ifdef USE_VARIABLE_RATE_SHADING
+	// The shading rate set
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1);
+#endif
+#ifdef USE_VISIBILITY_BUFFER
+	// Each frame's material set: camera, indirect draws, indices, the visibility buffer, the texture array and the G-buffers
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_vulkanManager.getSwapChainSize());
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_vulkanManager.getSwapChainSize() * 2);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_vulkanManager.getSwapChainSize() * (1 + MAX_BINDLESS_TEXTURES));
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, m_vulkanManager.getSwapChainSize() * m_numGBuffers);
+#endif
+#ifdef USE_RAY_QUERY_SHADOWS
+	// The instances in each frame's lighting set, a type only devices with ray queries know
+	if (m_useRayQueryShadows)
+	{
+		m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, m_vulkanManager.getSwapChainSize());
+	}
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	// Each frame's page mark set: cascades, depth and page requests
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_vulkanManager.getSwapChainSize());
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_vulkanManager.getSwapChainSize());
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_vulkanManager.getSwapChainSize());
+#endif
+#ifdef USE_VIRTUAL_TEXTURING
+	// Page table, mesh maps, feedback and feedback extent of each frame's geometry sets
+	const uint32_t virtualTextureSetCount = m_vulkanManager.getSwapChainSize() * static_cast<uint32_t>(m_scene.meshes.size());
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, virtualTextureSetCount * 3);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, virtualTextureSetCount);
+#endif
+#ifdef USE_IMPOSTORS
+	// Camera, instances and the two atlases of each frame's impostor set
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_vulkanManager.getSwapChainSize());
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_vulkanManager.getSwapChainSize());
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_vulkanManager.getSwapChainSize() * 2);
+#endif
+#ifdef USE_AUTO_EXPOSURE
+	// Each frame's auto exposure set, and the exposure in its bloom and final output sets and the bloom mip chain sets
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_vulkanManager.getSwapChainSize());
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_vulkanManager.getSwapChainSize());
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_vulkanManager.getSwapChainSize() * 6 + 2 * BLOOM_MIP_COUNT);
+#endif
+#ifdef USE_COMPUTE_BLUR
+	// The bloom and SSAO blur sets
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4);
+	m_vulkanManager.descriptorPoolAddDescriptors(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4);
+#endif
+
+	m_descriptorPool = m_vulkanManager.endCreateDescriptorPool();
+}
+
+void DeferredRenderer::createDescriptorSets()
+{
+	m_vulkanManager.resetDescriptorPool(m_descriptorPool);
+
+	// create descriptor sets
+	std::vector<uint32_t> layouts;
+	// The bake sets only until the bakes are done
+	const bool bakeBrdfLut = !m_bakedBrdfReady;
+	const bool prefilterEnv = isSpecEnvPrefilterNeeded();
+	if (bakeBrdfLut) layouts.push_back(m_brdfLutDescriptorSetLayout);
+#ifdef USE_COLOR_LUT
+	layouts.push_back(m_colorLutDescriptorSetLayout);
+#endif
+#ifdef USE_COMPUTE_ENV_PREFILTER
+	// Each mip of the specular map is written through its own storage image view
+	const uint32_t prefilterSetCount = prefilterEnv ? m_scene.skybox.specularIrradianceMap.mipLevelCount : 0;
+	for (uint32_t level = 0; level < prefilterSetCount; ++level)
+	{
+		layouts.push_back(m_specEnvPrefilterDescriptorSetLayout);
+	}
+#else
+	if (prefilterEnv) layouts.push_back(m_specEnvPrefilterDescriptorSetLayout);
+#endif
+#ifdef USE_GPU_SH_PROJECTION
+	layouts.push_back(m_shProjectionDescriptorSetLayout);
+#endif
+#ifdef USE_PROBE_VOLUME
+	layouts.push_back(m_probeCaptureDescriptorSetLayout);
+	layouts.push_back(m_probeProjectionDescriptorSetLayout);
+#endif
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	// The Hi-Z image is shared by all frames
+	for (uint32_t level = 0; level < m_hiZImage.mipLevelCount; ++level)
+	{
+		layouts.push_back(m_hiZDescriptorSetLayout);
+	}
+#endif
+#ifdef USE_VARIABLE_RATE_SHADING
+	// So is the shading rate image
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		layouts.push_back(m_shadingRateDescriptorSetLayout);
+	}
+#endif
+#ifdef USE_EVSM_SHADOWS
+	// So are the shadow moments
+	for (uint32_t i = 0; i < 2 + m_shadowMomentImage.mipLevelCount; ++i)
+	{
+		layouts.push_back(m_shadowMomentDescriptorSetLayout);
+	}
+#endif
+#ifdef USE_COMPUTE_BLUR
+	// So are the images of the separable blurs
+#ifdef USE_COMPUTE_BLOOM
+	const uint32_t bloomBlurSetCount = 0;
+#else
+	const uint32_t bloomBlurSetCount = 2;
+#endif
+#ifdef USE_SSAO
+	const uint32_t ssaoBlurSetCount = 2;
+#else
+	const uint32_t ssaoBlurSetCount = 0;
+#endif
+	for (uint32_t i = 0; i < bloomBlurSetCount + ssaoBlurSetCount; ++i)
+	{
+		layouts.push_back(m_separableBlur->getDescriptorSetLayout());
+	}
+#endif
+#ifdef USE_COMPUTE_BLOOM
+	// So is the bloom mip chain
+	for (uint32_t level = 0; level < 2 * m_bloomMipImage.mipLevelCount - 1; ++level)
+	{
+		layouts.push_back(m_bloomComputeDescriptorSetLayout);
+	}
+#ifdef USE_FUSED_BLOOM_MERGE
+	const uint32_t bloomSetCount = 0; // the final output set samples the mip chain
+#else
+	const uint32_t bloomSetCount = 1;
+#endif
+#else
+	const uint32_t bloomSetCount = 3;
+#endif
+
+	// Shadow draws find their model data through a dynamic offset, or by the instance index with USE_GPU_CULLING and USE_INSTANCING
+	const uint32_t shadowModelSetCount = 1;
+#ifdef USE_BINDLESS_MATERIALS
+	const uint32_t geomSetCount = 1;
+#else
+	const uint32_t geomSetCount = static_cast<uint32_t>(m_scene.meshes.size());
+#endif
+
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		layouts.push_back(m_skyboxDescriptorSetLayout);
+		layouts.push_back(m_lightingDescriptorSetLayout);
+		layouts.push_back(m_finalOutputDescriptorSetLayout);
+		for (uint32_t i = 0; i < getShadowSubpassCount(); ++i)
+		{
+			layouts.push_back(m_shadowDescriptorSetLayout1);
+		}
+		for (uint32_t i = 0; i < shadowModelSetCount; ++i)
+		{
+			layouts.push_back(m_shadowDescriptorSetLayout2);
+		}
+		for (uint32_t i = 0; i < geomSetCount; ++i)
+		{
+			layouts.push_back(m_geomDescriptorSetLayout);
+		}
+		for (uint32_t i = 0; i < bloomSetCount; ++i)
+		{
+			layouts.push_back(m_bloomDescriptorSetLayout);
+		}
+#ifdef USE_TILED_LIGHTING
+		layouts.push_back(m_lightCullingDescriptorSetLayout);
+#endif
+#ifdef USE_TAA
+		layouts.push_back(m_taaDescriptorSetLayout);
+#endif
+#ifdef USE_HALF_RES_LIGHTING
+		layouts.push_back(m_lightingUpsampleDescriptorSetLayout);
+#endif
+#ifdef USE_GPU_CULLING
+		layouts.push_back(m_gpuCullingDescriptorSetLayout);
+#endif
+#ifdef USE_MESHLETS
+		layouts.push_back(m_meshletDescriptorSetLayout);
+#endif
+#ifdef USE_VERTEX_PULLING
+		layouts.push_back(m_vertexPullingDescriptorSetLayout);
+#endif
+#ifdef USE_GPU_SKINNING
+		layouts.push_back(m_skinningDescriptorSetLayout);
+#endif
+#ifdef USE_AUTO_EXPOSURE
+		layouts.push_back(m_autoExposureDescriptorSetLayout);
+#endif
+#ifdef USE_SSAO
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			layouts.push_back(m_ssaoDescriptorSetLayout);
+		}
+#endif
+#ifdef USE_VISIBILITY_BUFFER
+		layouts.push_back(m_materialDescriptorSetLayout);
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+		layouts.push_back(m_shadowPageMarkDescriptorSetLayout);
+#endif
+#ifdef USE_IMPOSTORS
+		layouts.push_back(m_impostorDescriptorSetLayout);
+#endif
+	}
+
+	std::vector<uint32_t> sets = m_vulkanManager.allocateDescriptorSets(m_descriptorPool, layouts);
+
+	uint32_t idx = 0;
+	if (bakeBrdfLut) m_brdfLutDescriptorSet = sets[idx++];
+#ifdef USE_COLOR_LUT
+	m_colorLutDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_COMPUTE_ENV_PREFILTER
+	m_specEnvPrefilterMipDescriptorSets.resize(prefilterSetCount);
+	for (uint32_t level = 0; level < prefilterSetCount; ++level)
+	{
+		m_specEnvPrefilterMipDescriptorSets[level] = sets[idx++];
+	}
+#else
+	if (prefilterEnv) m_specEnvPrefilterDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_GPU_SH_PROJECTION
+	m_shProjectionDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_PROBE_VOLUME
+	m_probeCaptureDescriptorSet = sets[idx++];
+	m_probeProjectionDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	m_hiZDescriptorSets.resize(m_hiZImage.mipLevelCount);
+	for (uint32_t level = 0; level < m_hiZImage.mipLevelCount; ++level)
+	{
+		m_hiZDescriptorSets[level] = sets[idx++];
+	}
+#endif
+#ifdef USE_VARIABLE_RATE_SHADING
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		m_shadingRateDescriptorSet = sets[idx++];
+	}
+#endif
+#ifdef USE_EVSM_SHADOWS
+	m_shadowMomentDescriptorSets.resize(2 + m_shadowMomentImage.mipLevelCount);
+	for (auto &set : m_shadowMomentDescriptorSets)
+	{
+		set = sets[idx++];
+	}
+#endif
+#ifdef USE_COMPUTE_BLUR
+	m_bloomBlurDescriptorSets.resize(bloomBlurSetCount);
+	for (auto &set : m_bloomBlurDescriptorSets)
+	{
+		set = sets[idx++];
+	}
+	m_ssaoBlurDescriptorSets.resize(ssaoBlurSetCount);
+	for (auto &set : m_ssaoBlurDescriptorSets)
+	{
+		set = sets[idx++];
+	}
+#endif
+#ifdef USE_COMPUTE_BLOOM
+	m_bloomDownsampleDescriptorSets.resize(m_bloomMipImage.mipLevelCount);
+	for (uint32_t level = 0; level < m_bloomMipImage.mipLevelCount; ++level)
+	{
+		m_bloomDownsampleDescriptorSets[level] = sets[idx++];
+	}
+	m_bloomUpsampleDescriptorSets.resize(m_bloomMipImage.mipLevelCount - 1);
+	for (uint32_t level = 0; level < m_bloomMipImage.mipLevelCount - 1; ++level)
+	{
+		m_bloomUpsampleDescriptorSets[level] = sets[idx++];
+	}
+#endif
+
+	m_perFrameDescriptorSets.resize(swapChainImageCount);
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		m_perFrameDescriptorSets[imgIdx].m_skyboxDescriptorSet = sets[idx++];
+		m_perFrameDescriptorSets[imgIdx].m_lightingDescriptorSet = sets[idx++];
+		m_perFrameDescriptorSets[imgIdx].m_finalOutputDescriptorSet = sets[idx++];
+		m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1.resize(getShadowSubpassCount());
+		for (uint32_t i = 0; i < getShadowSubpassCount(); ++i)
+		{
+			m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[i] = sets[idx++];
+		}
+		m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2.resize(shadowModelSetCount);
+		for (uint32_t i = 0; i < shadowModelSetCount; ++i)
+		{
+			m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[i] = sets[idx++];
+		}
+		m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets.resize(geomSetCount);
+		for (uint32_t i = 0; i < geomSetCount; ++i)
+		{
+			m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[i] = sets[idx++];
+		}
+		m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets.resize(bloomSetCount);
+		for (uint32_t i = 0; i < bloomSetCount; ++i)
+		{
+			m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[i] = sets[idx++];
+		}
+#ifdef USE_TILED_LIGHTING
+		m_perFrameDescriptorSets[imgIdx].m_lightCullingDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_TAA
+		m_perFrameDescriptorSets[imgIdx].m_taaDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_HALF_RES_LIGHTING
+		m_perFrameDescriptorSets[imgIdx].m_lightingUpsampleDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_GPU_CULLING
+		m_perFrameDescriptorSets[imgIdx].m_gpuCullingDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_MESHLETS
+		m_perFrameDescriptorSets[imgIdx].m_meshletDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_VERTEX_PULLING
+		m_perFrameDescriptorSets[imgIdx].m_vertexPullingDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_GPU_SKINNING
+		m_perFrameDescriptorSets[imgIdx].m_skinningDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_AUTO_EXPOSURE
+		m_perFrameDescriptorSets[imgIdx].m_autoExposureDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_SSAO
+		m_perFrameDescriptorSets[imgIdx].m_ssaoDescriptorSets.resize(3);
+		for (auto &set : m_perFrameDescriptorSets[imgIdx].m_ssaoDescriptorSets)
+		{
+			set = sets[idx++];
+		}
+#endif
+#ifdef USE_VISIBILITY_BUFFER
+		m_perFrameDescriptorSets[imgIdx].m_materialDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+		m_perFrameDescriptorSets[imgIdx].m_shadowPageMarkDescriptorSet = sets[idx++];
+#endif
+#ifdef USE_IMPOSTORS
+		m_perFrameDescriptorSets[imgIdx].m_impostorDescriptorSet = sets[idx++];
+#endif
+	}
+
+	// All sets below are written with one call, rather than one per set and swapchain image
+	m_vulkanManager.beginDescriptorUpdateBatch();
+	createBrdfLutDescriptorSet();
+	createSpecEnvPrefilterDescriptorSet();
+	createGeomPassDescriptorSets();
+	createShadowPassDescriptorSets();
+	createLightingPassDescriptorSets();
+#ifdef USE_BLOOM_RENDER_PASSES
+	createBloomDescriptorSets();
+#endif
+	createFinalOutputPassDescriptorSets();
+#ifdef USE_TILED_LIGHTING
+	createLightCullingDescriptorSets();
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	createShadowPageMarkDescriptorSets();
+#endif
+#ifdef USE_SSAO
+	createSsaoDescriptorSets();
+#endif
+#ifdef USE_VARIABLE_RATE_SHADING
+	createShadingRateDescriptorSet();
+#endif
+#ifdef USE_TAA
+	createTaaDescriptorSets();
+#endif
+#ifdef USE_HALF_RES_LIGHTING
+	createLightingUpsampleDescriptorSets();
+#endif
+#ifdef USE_GPU_CULLING
+	createGpuCullingDescriptorSets();
+#endif
+#ifdef USE_MESHLETS
+	createMeshletDescriptorSets();
+#endif
+#ifdef USE_VERTEX_PULLING
+	createVertexPullingDescriptorSets();
+#endif
+#ifdef USE_VISIBILITY_BUFFER
+	createMaterialDescriptorSets();
+#endif
+#ifdef USE_GPU_SKINNING
+	createSkinningDescriptorSets();
+#endif
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	createHiZDescriptorSets();
+#endif
+#ifdef USE_EVSM_SHADOWS
+	createShadowMomentDescriptorSets();
+#endif
+#ifdef USE_COMPUTE_BLOOM
+	createBloomComputeDescriptorSets();
+#endif
+#ifdef USE_GPU_SH_PROJECTION
+	createShProjectionDescriptorSet();
+#endif
+#ifdef USE_PROBE_VOLUME
+	createProbeVolumeDescriptorSets();
+#endif
+#ifdef USE_IMPOSTORS
+	createImpostorDescriptorSets();
+#endif
+#ifdef USE_COLOR_LUT
+	createColorLutDescriptorSet();
+#endif
+#ifdef USE_AUTO_EXPOSURE
+	createAutoExposureDescriptorSets();
+#endif
+	m_vulkanManager.endDescriptorUpdateBatch();
+}
+
+void DeferredRenderer::createFramebuffers()
+{
+	// Used in final output pass
+	m_finalOutputFramebuffers = m_vulkanManager.createSwapChainFramebuffers(m_finalOutputRenderPass);
+
+#ifndef USE_COMPUTE_ENV_PREFILTER
+	// Specular irradiance map pass. Created once, the prefilter may not have finished when the swapchain is recreated
+	if (!m_scene.skybox.specMapReady && m_specEnvPrefilterFramebuffers.empty())
+	{
+		m_specEnvPrefilterFramebuffers.resize(m_scene.skybox.specularIrradianceMap.mipLevelCount);
+		for (uint32_t level = 0; level < m_scene.skybox.specularIrradianceMap.mipLevelCount; ++level)
+		{
+			m_specEnvPrefilterFramebuffers[level] =
+				m_vulkanManager.createFramebuffer(m_specEnvPrefilterRenderPass, { m_scene.skybox.specularIrradianceMap.imageViews[level + 1] });
+		}
+	}
+#endif
+
+	// Geometry pass
+	{
+		if (m_initialized)
+		{
+			m_vulkanManager.destroyFramebuffer(m_geomFramebuffer);
+		}
+
+#ifdef USE_VISIBILITY_BUFFER
+		std::vector<uint32_t> attachmentViews = { m_depthImage.imageViews[0], m_visibilityImage.imageViews[0] };
+#elif defined(USE_FORWARD_PLUS)
+		// The multisampled color resolves into the lighting result, without MSAA the lighting result is the color attachment
+		std::vector<uint32_t> attachmentViews = { m_depthImage.imageViews[0] };
+		if (!m_forwardColorImage.imageViews.empty())
+		{
+			attachmentViews.push_back(m_forwardColorImage.imageViews[0]);
+		}
+		attachmentViews.push_back(m_lightingResultImage.imageViews[0]);
+#else
+		std::vector<uint32_t> attachmentViews =
+		{
+			m_depthImage.imageViews[0],
+			m_gbufferImages[0].imageViews[0],
+			m_gbufferImages[1].imageViews[0],
+			m_gbufferImages[2].imageViews[0]
+		};
+#endif
+#ifdef USE_TAA
+		attachmentViews.push_back(m_motionVectorImage.imageViews[0]);
+#endif
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+		attachmentViews.push_back(m_lightingResultImage.imageViews[0]);
+#ifdef USE_LIGHTING_STENCIL
+		attachmentViews.push_back(m_lightingStencilImage.imageViews[0]);
+#endif
+#endif
+		// Not created when the depth is not resolved
+		for (const auto *pImage : { &m_resolvedDepthImage, &m_resolvedDepthMaxImage })
+		{
+			if (!pImage->imageViews.empty()) attachmentViews.push_back(pImage->imageViews[0]);
+		}
+
+		uint32_t shadingRateIdx = VK_ATTACHMENT_UNUSED;
+#ifdef USE_VARIABLE_RATE_SHADING
+		if (m_vulkanManager.isFragmentShadingRateEnabled())
+		{
+			shadingRateIdx = static_cast<uint32_t>(attachmentViews.size());
+			attachmentViews.push_back(m_shadingRateImage.imageViews[0]);
+		}
+#endif
+
+		m_geomFramebuffer = m_vulkanManager.createFramebuffer(m_geomRenderPass, attachmentViews, shadingRateIdx);
+	}
+
+	// Depth pre-pass
+	{
+		if (m_initialized)
+		{
+			m_vulkanManager.destroyFramebuffer(m_depthPrepassFramebuffer);
+		}
+
+		m_depthPrepassFramebuffer = m_vulkanManager.createFramebuffer(m_depthPrepassRenderPass, { m_depthImage.imageViews[0] });
+	}
+
+	// Shadow pass
+	{
+		if (m_initialized)
+		{
+			m_vulkanManager.destroyFramebuffer(m_shadowFramebuffer);
+		}
+
+#ifdef USE_LAYERED_SHADOW_PASS
+		// Array view of all cascades, the geometry shader selects the layer
+		std::vector<uint32_t> attachmentViews = { m_shadowImage.imageViews.back() };
+#elif defined(USE_SHADOW_ATLAS)
+		// Every subpass draws into its tile of the atlas
+		std::vector<uint32_t> attachmentViews = { m_shadowImage.imageViews[0] };
+#else
+		std::vector<uint32_t> attachmentViews(m_camera.getSegmentCount());
+		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
+		{
+			attachmentViews[i] = m_shadowImage.imageViews[i];
+		}
+#endif
+		m_shadowFramebuffer = m_vulkanManager.createFramebuffer(m_shadowRenderPass, attachmentViews);
+	}
+
+	// Lighting pass
+#if defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_FORWARD_PLUS)
+	m_lightingFramebuffer = m_geomFramebuffer;
+#else
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyFramebuffer(m_lightingFramebuffer);
+	}
+
+#ifdef USE_HALF_RES_LIGHTING
+	const uint32_t lightingTargetView = m_halfResLightingImage.imageViews[0];
+#else
+	const uint32_t lightingTargetView = m_lightingResultImage.imageViews[0];
+#endif
+	std::vector<uint32_t> lightingViews = { lightingTargetView };
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	lightingViews.push_back(m_bloomBrightImage.imageViews[0]);
+#endif
+#ifdef USE_LIGHTING_STENCIL
+	lightingViews.push_back(m_lightingStencilImage.imageViews[0]);
+#endif
+#ifdef USE_VARIABLE_RATE_SHADING
+	uint32_t shadingRateIdx = VK_ATTACHMENT_UNUSED;
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		shadingRateIdx = static_cast<uint32_t>(lightingViews.size());
+		lightingViews.push_back(m_shadingRateImage.imageViews[0]);
+	}
+	m_lightingFramebuffer = m_vulkanManager.createFramebuffer(m_lightingRenderPass, lightingViews, shadingRateIdx);
+#else
+	m_lightingFramebuffer = m_vulkanManager.createFramebuffer(m_lightingRenderPass, lightingViews);
+#endif
+#endif
+
+#ifdef USE_HALF_RES_LIGHTING
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyFramebuffer(m_lightingUpsampleFramebuffer);
+	}
+	m_lightingUpsampleFramebuffer = m_vulkanManager.createFramebuffer(m_lightingUpsampleRenderPass, { m_lightingResultImage.imageViews[0] });
+#endif
+
+	// Bloom
+	if (m_initialized)
+	{
+		for (auto name : m_postEffectFramebuffers)
+		{
+			m_vulkanManager.destroyFramebuffer(name);
+		}
+	}
+
+	m_postEffectFramebuffers.clear();
+
+#ifndef USE_COMPUTE_BLOOM
+	m_postEffectFramebuffers.push_back(m_vulkanManager.createFramebuffer(m_bloomRenderPasses[0], { m_postEffectImages[0].imageViews[0] }));
+	m_postEffectFramebuffers.push_back(m_vulkanManager.createFramebuffer(m_bloomRenderPasses[0], { m_postEffectImages[1].imageViews[0] }));
+#endif
+#ifndef USE_FUSED_BLOOM_MERGE
+#ifdef USE_TAA
+	m_postEffectFramebuffers.push_back(m_vulkanManager.createFramebuffer(m_bloomRenderPasses.back(), { m_taaResultImage.imageViews[0] }));
+#else
+	m_postEffectFramebuffers.push_back(m_vulkanManager.createFramebuffer(m_bloomRenderPasses.back(), { m_lightingResultImage.imageViews[0] }));
+#endif
+#endif
+
+#ifdef USE_TAA
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyFramebuffer(m_taaFramebuffer);
+	}
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	m_taaFramebuffer = m_vulkanManager.createFramebuffer(m_taaRenderPass, { m_taaResultImage.imageViews[0], m_taaAccumulationImage.imageViews[0] });
+#else
+	m_taaFramebuffer = m_vulkanManager.createFramebuffer(m_taaRenderPass, { m_taaResultImage.imageViews[0] });
+#endif
+#endif
+
+#ifdef USE_PROBE_VOLUME
+	// Created once, the capture images do not depend on the swapchain
+	if (!m_probeVolumeBaked && m_probeCaptureFramebuffer == std::numeric_limits<uint32_t>::max())
+	{
+		m_probeCaptureFramebuffer = m_vulkanManager.createFramebuffer(m_probeCaptureRenderPass,
+			{ m_probeCaptureImage.imageViews[0], m_probeCaptureDepthImage.imageViews[0] });
+	}
+#endif
+
+#ifdef USE_IMPOSTORS
+	// Also created once, all layers share the depth image
+	if (!m_impostorsBaked && m_impostorBakeFramebuffers.empty())
+	{
+		for (uint32_t l = 0; l < m_impostorBounds.size(); ++l)
+		{
+			m_impostorBakeFramebuffers.push_back(m_vulkanManager.createFramebuffer(m_impostorBakeRenderPass,
+				{ m_impostorLayerViews[2 * l], m_impostorLayerViews[2 * l + 1], m_impostorBakeDepthImage.imageViews[0] }));
+		}
+	}
+#endif
+}
+
+void DeferredRenderer::createCommandBuffers()
+{
+	// Allocate graphics command buffers
+	m_vulkanManager.resetCommandPool(m_graphicsCommandPool, VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT);
+
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	m_perFrameCommandBuffers.resize(swapChainImageCount);
+
+	std::vector<uint32_t> commandBuffers = m_vulkanManager.allocateCommandBuffers(m_graphicsCommandPool,
+		static_cast<uint32_t>(m_perFrameCommandBuffers.size() * 6 + 5));
+
+	int idx = 0;
+	for (uint32_t imgIdx = 0; imgIdx < m_perFrameCommandBuffers.size(); ++imgIdx)
+	{
+		m_perFrameCommandBuffers[imgIdx].m_geomShadowLightingCommandBuffer = commandBuffers[idx++];
+		m_perFrameCommandBuffers[imgIdx].m_postEffectCommandBuffer = commandBuffers[idx++];
+		m_perFrameCommandBuffers[imgIdx].m_presentCommandBuffer = commandBuffers[idx++];
+		m_perFrameCommandBuffers[imgIdx].m_frameCaptureCommandBuffer = commandBuffers[idx++];
+		m_perFrameCommandBuffers[imgIdx].m_colorLutCommandBuffer = commandBuffers[idx++];
+		m_perFrameCommandBuffers[imgIdx].m_virtualTextureCommandBuffer = commandBuffers[idx++];
+		m_perFrameCommandBuffers[imgIdx].m_recordedRenderScale = m_renderScale;
+		// Recorded by drawFrame when their image comes up, so recreating the swapchain records nothing up front
+		m_perFrameCommandBuffers[imgIdx].m_dirtyMask = CB_DIRTY_ALL;
+	}
+	m_envPrefilterCommandBuffer = commandBuffers[idx++];
+	m_shProjectionCommandBuffer = commandBuffers[idx++];
+	m_probePrefilterCommandBuffer = commandBuffers[idx++]; // recorded for every step
+	m_probeVolumeCommandBuffer = commandBuffers[idx++];
+	m_impostorBakeCommandBuffer = commandBuffers[idx++];
+
+	// Secondary command buffers for multithreaded recording: one per swapchain image, per task, for
+	// the geometry pass and each shadow cascade subpass. Sets are never destroyed, so only replaced when the swapchain grows
+	if (SCENE_RECORDING_THREAD_COUNT > 1 && (m_sceneCommandPoolSet == std::numeric_limits<uint32_t>::max() ||
+		m_vulkanManager.getCommandPoolSetFrameCount(m_sceneCommandPoolSet) < swapChainImageCount))
+	{
+		m_sceneCommandPoolSet = m_vulkanManager.createCommandPoolSet(VK_QUEUE_GRAPHICS_BIT, SCENE_RECORDING_THREAD_COUNT,
+			swapChainImageCount, 1 + CSM_MAX_SEG_COUNT);
+	}
+#ifdef USE_STATIC_SECONDARIES
+	// The dirty bits set above drop every recorded signature
+	const uint32_t staticFrameCount = swapChainImageCount * (1 + CSM_MAX_SEG_COUNT);
+	if (m_staticSceneCommandPoolSet == std::numeric_limits<uint32_t>::max() ||
+		m_vulkanManager.getCommandPoolSetFrameCount(m_staticSceneCommandPoolSet) < staticFrameCount)
+	{
+		m_staticSceneCommandPoolSet = m_vulkanManager.createCommandPoolSet(VK_QUEUE_GRAPHICS_BIT, SCENE_RECORDING_THREAD_COUNT,
+			staticFrameCount, 1);
+	}
+	m_staticSecondarySignatures.resize(staticFrameCount);
+#endif
+
+	while (m_perFrameCommandPools.size() < swapChainImageCount)
+	{
+		uint32_t pool = m_vulkanManager.createCommandPool(VK_QUEUE_GRAPHICS_BIT, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		m_perFrameCommandPools.push_back(pool);
+		m_perFrameTransientCommandBuffers.push_back(m_vulkanManager.allocateCommandBuffers(pool, 1)[0]);
+	}
+
+	// Create command buffers for different purposes
+	createEnvPrefilterCommandBuffer();
+#ifdef USE_GPU_SH_PROJECTION
+	createShProjectionCommandBuffer();
+#endif
+#ifdef USE_PROBE_VOLUME
+	createProbeVolumeCommandBuffer();
+#endif
+#ifdef USE_IMPOSTORS
+	createImpostorBakeCommandBuffer();
+#endif
+	initVisibleMeshes();
+
+	// compute command buffers
+	m_vulkanManager.resetCommandPool(m_computeCommandPool, VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT);
+
+#ifdef USE_ASYNC_COMPUTE
+	commandBuffers = m_vulkanManager.allocateCommandBuffers(m_computeCommandPool, swapChainImageCount + 1);
+	for (uint32_t i = 0; i < swapChainImageCount; ++i)
+	{
+		m_perFrameCommandBuffers[i].m_bloomComputeCommandBuffer = commandBuffers[i + 1];
+	}
+#else
+	commandBuffers = m_vulkanManager.allocateCommandBuffers(m_computeCommandPool, 1);
+#endif
+	m_brdfLutCommandBuffer = commandBuffers[0];
+
+	createBrdfLutCommandBuffer();
+#ifdef USE_ASYNC_COMPUTE
+	createBloomComputeCommandBuffers();
+#endif
+}
+
+void DeferredRenderer::createSynchronizationObjects()
+{
+	m_perFrameSyncObjects.resize(MAX_FRAMES_IN_FLIGHT);
+
+#ifdef USE_TIMELINE_SEMAPHORES
+	if (!m_vulkanManager.isTimelineSemaphoreEnabled())
+	{
+		throw std::runtime_error("USE_TIMELINE_SEMAPHORES needs VK_KHR_timeline_semaphore");
+	}
+
+	m_frameTimelineBase = 0;
+	m_frameTimelineSemaphore = m_vulkanManager.createSemaphore(0, VK_SEMAPHORE_TYPE_TIMELINE_KHR, m_frameTimelineBase);
+#endif
+
+	for (auto &frameSync : m_perFrameSyncObjects)
+	{
+		frameSync.m_frameSerial = 0;
+		frameSync.m_imageAvailableSemaphore = m_vulkanManager.createSemaphore();
+		frameSync.m_renderFinishedSemaphore = m_vulkanManager.createSemaphore();
+#ifdef USE_TIMELINE_SEMAPHORES
+		frameSync.m_frameCompleteValue = m_frameTimelineBase;
+#else
+		frameSync.m_geomAndLightingCompleteSemaphore = m_vulkanManager.createSemaphore();
+		frameSync.m_postEffectSemaphore = m_vulkanManager.createSemaphore();
+#ifdef USE_ASYNC_COMPUTE
+		frameSync.m_bloomComputeSemaphore = m_vulkanManager.createSemaphore();
+#endif
+		frameSync.m_renderFinishedFence = m_vulkanManager.createFence(VK_FENCE_CREATE_SIGNALED_BIT);
+#endif
+	}
+
+	m_imageInFlightFences.assign(m_vulkanManager.getSwapChainSize(), std::numeric_limits<uint32_t>::max());
+	m_imageInFlightValues.assign(m_vulkanManager.getSwapChainSize(), m_frameTimelineBase);
+
+	m_brdfLutFence = m_vulkanManager.createFence();
+	m_envPrefilterFence = m_vulkanManager.createFence();
+	m_shProjectionFence = m_vulkanManager.createFence();
+	m_probeVolumeFence = m_vulkanManager.createFence();
+	m_impostorBakeFence = m_vulkanManager.createFence();
+#ifdef USE_PROBE_SWITCHING
+	m_probePrefilterFence = m_vulkanManager.createFence();
+	m_probePrefilterQueryPool = m_vulkanManager.createQueryPool(VK_QUERY_TYPE_TIMESTAMP, 2);
+#endif
+}
+
+void DeferredRenderer::createSpecEnvPrefilterRenderPass()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyRenderPass(m_specEnvPrefilterRenderPass);
+	}
+
+	m_vulkanManager.beginCreateRenderPass();
+
+	m_vulkanManager.renderPassAddAttachment(m_scene.skybox.specularIrradianceMap.format,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.endDescribeSubpass();
+
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		0, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+	m_vulkanManager.renderPassAddSubpassDependency(0, VK_SUBPASS_EXTERNAL,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0);
+
+	m_specEnvPrefilterRenderPass = m_vulkanManager.endCreateRenderPass("Specular env prefilter");
+}
+
+void DeferredRenderer::createShadowRenderPass()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyRenderPass(m_shadowRenderPass);
+	}
+
+	m_vulkanManager.beginCreateRenderPass();
+
+	// --- Attachments
+	// Depth of the scene from light's perspective. With layered rendering the one attachment holds every cascade.
+	// Loaded so that cascades which are not re-rendered keep their contents. Updated cascades are cleared in their subpass
+	// With USE_SHADOW_ATLAS the one attachment holds every cascade in its own tile.
+#ifdef USE_SHADOW_ATLAS
+	const uint32_t attachmentCount = 1;
+#else
+	const uint32_t attachmentCount = getShadowSubpassCount();
+#endif
+	for (uint32_t i = 0; i < attachmentCount; ++i)
+	{
+		m_vulkanManager.renderPassAddAttachment(findShadowDepthFormat(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_LOAD);
+	}
+
+	// --- Subpasses
+	for (uint32_t i = 0; i < getShadowSubpassCount(); ++i)
+	{
+		m_vulkanManager.beginDescribeSubpass();
+		m_vulkanManager.subpassAddDepthAttachmentReference(i % attachmentCount, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+		m_vulkanManager.endDescribeSubpass();
+	}
+
+	// --- Subpass dependencies
+	// Shadow maps are shared by all frames in flight. Wait for the previous frame's lighting pass to finish sampling them
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+	for (uint32_t i = 0; i + 1 < getShadowSubpassCount(); ++i)
+	{
+#ifdef USE_SHADOW_ATLAS
+		// Tiles do not overlap, but the subpasses still write the same attachment
+		m_vulkanManager.renderPassAddSubpassDependency(i, i + 1,
+			VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+#else
+		m_vulkanManager.renderPassAddSubpassDependency(i, i + 1,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0);
+#endif
+	}
+
+	m_shadowRenderPass = m_vulkanManager.endCreateRenderPass("Shadow");
+}
+
+void DeferredRenderer::createGeometryRenderPass()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyRenderPass(m_geomRenderPass);
+		m_vulkanManager.destroyRenderPass(m_geomAfterPrepassRenderPass);
+	}
+
+	// @loadDepth: the depth pre-pass has already written depth. Only the depth load op and layout differ,
+	// so both passes are compatible with the geometry framebuffer and pipelines
+	auto createPass = [&](bool loadDepth)
+	{
+		m_vulkanManager.beginCreateRenderPass();
+
+		// --- Attachments used in this render pass
+		// Depth
+		// Clear only happens in the FIRST subpass that uses this attachment
+		// VK_IMAGE_LAYOUT_UNDEFINED as initial layout means that we don't care about the initial layout of this attachment image (content may not be preserved)
+		if (loadDepth)
+		{
+#ifdef USE_FORWARD_PLUS
+			// Sampled by the light culling in between
+			const VkImageLayout prepassDepthLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+#else
+			const VkImageLayout prepassDepthLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+#endif
+			m_vulkanManager.renderPassAddAttachment(findDepthFormat(), prepassDepthLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				m_sampleCount, VK_ATTACHMENT_LOAD_OP_LOAD);
+		}
+		else
+		{
+			m_vulkanManager.renderPassAddAttachment(findDepthFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_sampleCount);
+		}
+
+#ifdef USE_VISIBILITY_BUFFER
+		// Triangle IDs in place of the G-buffers, cleared to ~0u
+		m_vulkanManager.renderPassAddAttachment(m_visibilityImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_sampleCount,
+			VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE);
+#elif defined(USE_FORWARD_PLUS)
+		// Shaded color in place of the G-buffers. With MSAA its samples are resolved into the lighting result and never stored
+		const bool resolveColor = m_sampleCount != VK_SAMPLE_COUNT_1_BIT;
+		if (resolveColor)
+		{
+			m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+				m_sampleCount, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE);
+			m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+		}
+		else
+		{
+			m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		}
+#else
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+		// G-buffers are only read by the lighting subpass and never leave tile memory
+		const VkAttachmentStoreOp gbufferStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+#else
+		const VkAttachmentStoreOp gbufferStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+#endif
+
+		// World space normal + albedo (compact: octahedral encoded normal)
+		// Normal has been perturbed by normal mapping
+		m_vulkanManager.renderPassAddAttachment(m_gbufferFormats[0], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_sampleCount,
+			VK_ATTACHMENT_LOAD_OP_CLEAR, gbufferStoreOp);
+
+		// World postion (compact: albedo, position is reconstructed from depth)
+		m_vulkanManager.renderPassAddAttachment(m_gbufferFormats[1], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_sampleCount,
+			VK_ATTACHMENT_LOAD_OP_CLEAR, gbufferStoreOp);
+
+		// RMAI
+		m_vulkanManager.renderPassAddAttachment(m_gbufferFormats[2], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_sampleCount,
+			VK_ATTACHMENT_LOAD_OP_CLEAR, gbufferStoreOp);
+#endif
+
+#ifdef USE_TAA
+		// Motion vectors
+		m_vulkanManager.renderPassAddAttachment(m_motionVectorImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_sampleCount);
+#endif
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+		// Attachments of the lighting subpass, same as in createLightingRenderPass()
+#ifdef USE_TAA
+		const uint32_t lightingResultIdx = m_numGBuffers + 2;
+#else
+		const uint32_t lightingResultIdx = m_numGBuffers + 1;
+#endif
+		m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+#ifdef USE_LIGHTING_STENCIL
+		m_vulkanManager.renderPassAddAttachment(findStencilFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_DONT_CARE, VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE);
+#endif
+#endif
+
+		const uint32_t resolvedDepthCount = addDepthResolveAttachments();
+
+#ifdef USE_VARIABLE_RATE_SHADING
+		// Shading rate image, last so the framebuffer extent comes from the others
+#ifdef USE_TAA
+		const uint32_t shadingRateIdx = m_numGBuffers + 2 + resolvedDepthCount;
+#else
+		const uint32_t shadingRateIdx = m_numGBuffers + 1 + resolvedDepthCount;
+#endif
+		if (m_vulkanManager.isFragmentShadingRateEnabled())
+		{
+			m_vulkanManager.renderPassAddAttachment(VK_FORMAT_R8_UINT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_SAMPLE_COUNT_1_BIT,
+				VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE);
+		}
+#endif
+
+		// --- Reference to render pass attachments used in each subpass
+		// --- Subpasses
+		// Geometry subpass
+		m_vulkanManager.beginDescribeSubpass();
+		m_vulkanManager.subpassAddColorAttachmentReference(1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+#ifdef USE_FORWARD_PLUS
+		if (resolveColor)
+		{
+			m_vulkanManager.subpassAddResolveAttachmentReference(2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		}
+#elif !defined(USE_VISIBILITY_BUFFER)
+		m_vulkanManager.subpassAddColorAttachmentReference(2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		m_vulkanManager.subpassAddColorAttachmentReference(3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+#endif
+#ifdef USE_TAA
+		m_vulkanManager.subpassAddColorAttachmentReference(4, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+#endif
+		m_vulkanManager.subpassAddDepthAttachmentReference(0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+		if (resolvedDepthCount > 0)
+		{
+			m_vulkanManager.subpassSetDepthResolveAttachmentReference(getResolvedDepthAttachmentIdx(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+				getDepthResolveMode());
+		}
+#ifdef USE_VARIABLE_RATE_SHADING
+		if (m_vulkanManager.isFragmentShadingRateEnabled())
+		{
+			m_vulkanManager.subpassSetShadingRateAttachmentReference(shadingRateIdx, VK_IMAGE_LAYOUT_GENERAL, getShadingRateTexelSize());
+		}
+#endif
+		m_vulkanManager.endDescribeSubpass();
+
+		addDepthMaxResolveSubpass();
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+		// Lighting subpass. Input attachment indices: G-buffers 1 to 3, then depth
+		m_vulkanManager.beginDescribeSubpass();
+		m_vulkanManager.subpassAddColorAttachmentReference(lightingResultIdx, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		m_vulkanManager.subpassAddInputAttachmentReference(1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		m_vulkanManager.subpassAddInputAttachmentReference(2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		m_vulkanManager.subpassAddInputAttachmentReference(3, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		m_vulkanManager.subpassAddInputAttachmentReference(0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+#ifdef USE_LIGHTING_STENCIL
+		m_vulkanManager.subpassAddDepthAttachmentReference(lightingResultIdx + 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+#endif
+		m_vulkanManager.endDescribeSubpass();
+#endif
+
+		// --- Subpass dependencies
+		// G-buffers and depth are shared by all frames in flight. Wait for the previous frame's lighting pass to finish reading them.
+		// After the pre-pass this also waits for its depth writes
+		m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+#ifdef USE_VISIBILITY_BUFFER
+		// And for the previous frame's material pass to finish reading the visibility buffer
+		m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+#endif
+
+#ifdef USE_FORWARD_PLUS
+		// The lighting result is also read by the previous frame's post effect passes. The light tiles and shadow maps are
+		// synchronized by recordLightCulling() and the shadow pass
+		m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+#endif
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+		// Each lighting fragment only reads the G-buffer samples of its own pixel
+		m_vulkanManager.renderPassAddSubpassDependency(0, 1,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+			VK_DEPENDENCY_BY_REGION_BIT);
+
+		// Lighting result is also read by the previous frame's post effect passes
+		m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 1,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+#ifdef USE_LIGHTING_STENCIL
+		m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 1,
+			VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+#endif
+#endif
+
+		// --- Create render pass
+		return m_vulkanManager.endCreateRenderPass(loadDepth ? "Geometry after pre-pass" : "Geometry");
+	};
+
+	m_geomRenderPass = createPass(false);
+	m_geomAfterPrepassRenderPass = createPass(true);
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	m_lightingRenderPass = m_geomRenderPass;
+#endif
+}
+
+void DeferredRenderer::createDepthPrepassRenderPass()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyRenderPass(m_depthPrepassRenderPass);
+	}
+
+	// Depth attachment of the geometry pass only, left for the geometry pass to load
+	m_vulkanManager.beginCreateRenderPass();
+
+#ifdef USE_FORWARD_PLUS
+	// The light culling bins the lights with this depth before the geometry pass
+	const VkImageLayout depthFinalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+#else
+	const VkImageLayout depthFinalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+#endif
+	m_vulkanManager.renderPassAddAttachment(findDepthFormat(), VK_IMAGE_LAYOUT_UNDEFINED, depthFinalLayout, m_sampleCount);
+
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddDepthAttachmentReference(0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.endDescribeSubpass();
+
+	// Depth is shared by all frames in flight. Wait for the previous frame's lighting pass to finish reading it
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+	m_depthPrepassRenderPass = m_vulkanManager.endCreateRenderPass("Depth pre-pass");
+}
+
+void DeferredRenderer::createGeometryLateRenderPass()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyRenderPass(m_geomLateRenderPass);
+	}
+
+	// Same attachments as the geometry pass, loaded so the meshes that passed the occlusion test are added on top
+	// of the early pass. Only load ops and layouts differ, so it is compatible with the geometry framebuffer and pipelines
+	m_vulkanManager.beginCreateRenderPass();
+
+	m_vulkanManager.renderPassAddAttachment(findDepthFormat(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		m_sampleCount, VK_ATTACHMENT_LOAD_OP_LOAD);
+#ifdef USE_VISIBILITY_BUFFER
+	m_vulkanManager.renderPassAddAttachment(m_visibilityImageFormat, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		m_sampleCount, VK_ATTACHMENT_LOAD_OP_LOAD);
+#else
+	for (uint32_t i = 0; i < m_numGBuffers; ++i)
+	{
+		m_vulkanManager.renderPassAddAttachment(m_gbufferFormats[i], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			m_sampleCount, VK_ATTACHMENT_LOAD_OP_LOAD);
+	}
+#endif
+#ifdef USE_TAA
+	m_vulkanManager.renderPassAddAttachment(m_motionVectorImageFormat, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		m_sampleCount, VK_ATTACHMENT_LOAD_OP_LOAD);
+#endif
+	// Resolved again with the meshes of the late pass
+	const uint32_t resolvedDepthCount = addDepthResolveAttachments();
+#ifdef USE_VARIABLE_RATE_SHADING
+#ifdef USE_TAA
+	const uint32_t shadingRateIdx = m_numGBuffers + 2 + resolvedDepthCount;
+#else
+	const uint32_t shadingRateIdx = m_numGBuffers + 1 + resolvedDepthCount;
+#endif
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		m_vulkanManager.renderPassAddAttachment(VK_FORMAT_R8_UINT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_SAMPLE_COUNT_1_BIT,
+			VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE);
+	}
+#endif
+
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddColorAttachmentReference(1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+#ifndef USE_VISIBILITY_BUFFER
+	m_vulkanManager.subpassAddColorAttachmentReference(2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.subpassAddColorAttachmentReference(3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+#endif
+#ifdef USE_TAA
+	m_vulkanManager.subpassAddColorAttachmentReference(4, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+#endif
+	m_vulkanManager.subpassAddDepthAttachmentReference(0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	if (resolvedDepthCount > 0)
+	{
+		m_vulkanManager.subpassSetDepthResolveAttachmentReference(getResolvedDepthAttachmentIdx(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			getDepthResolveMode());
+	}
+#ifdef USE_VARIABLE_RATE_SHADING
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		m_vulkanManager.subpassSetShadingRateAttachmentReference(shadingRateIdx, VK_IMAGE_LAYOUT_GENERAL, getShadingRateTexelSize());
+	}
+#endif
+	m_vulkanManager.endDescribeSubpass();
+
+	addDepthMaxResolveSubpass();
+
+	// Wait for the early pass attachment writes and for the Hi-Z build to finish reading depth
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+	m_geomLateRenderPass = m_vulkanManager.endCreateRenderPass("Geometry late");
+}
+
+uint32_t DeferredRenderer::addDepthResolveAttachments()
+{
+	// Every pixel of the render area is resolved, nothing is loaded
+	uint32_t count = 0;
+	for (const auto mode : { getDepthResolveMode(), getDepthMaxResolveMode() })
+	{
+		if (mode == VK_RESOLVE_MODE_NONE_KHR) continue;
+		m_vulkanManager.renderPassAddAttachment(getResolvedDepthFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_DONT_CARE, VK_ATTACHMENT_STORE_OP_STORE);
+		++count;
+	}
+	return count;
+}
+
+void DeferredRenderer::addDepthMaxResolveSubpass()
+{
+	if (getDepthMaxResolveMode() == VK_RESOLVE_MODE_NONE_KHR) return;
+
+	// A subpass resolves its depth attachment into one image, the second one only takes the depth to resolve it again
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddDepthAttachmentReference(0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.subpassSetDepthResolveAttachmentReference(getResolvedDepthAttachmentIdx() + 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		getDepthMaxResolveMode());
+	m_vulkanManager.endDescribeSubpass();
+
+	m_vulkanManager.renderPassAddSubpassDependency(0, 1,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+		VK_DEPENDENCY_BY_REGION_BIT);
+}
+
+uint32_t DeferredRenderer::getResolvedDepthAttachmentIdx() const
+{
+#ifdef USE_VISIBILITY_BUFFER
+	return 2;
+#elif defined(USE_TAA)
+	return m_numGBuffers + 2;
+#else
+	return m_numGBuffers + 1;
+#endif
+}
+
+void DeferredRenderer::createLightingRenderPass()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyRenderPass(m_lightingRenderPass);
+	}
+
+	m_vulkanManager.beginCreateRenderPass();
+
+	m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	m_vulkanManager.renderPassAddAttachment(m_bloomBrightImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	const uint32_t colorAttachmentCount = 2;
+#else
+	const uint32_t colorAttachmentCount = 1;
+#endif
+
+#ifdef USE_LIGHTING_STENCIL
+	// Pixel classification, only lives during this pass
+	m_vulkanManager.renderPassAddAttachment(findStencilFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_DONT_CARE, VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE);
+#endif
+
+#ifdef USE_VARIABLE_RATE_SHADING
+	// Same shading rate image as the geometry pass
+#ifdef USE_LIGHTING_STENCIL
+	const uint32_t shadingRateIdx = colorAttachmentCount + 1;
+#else
+	const uint32_t shadingRateIdx = colorAttachmentCount;
+#endif
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		m_vulkanManager.renderPassAddAttachment(VK_FORMAT_R8_UINT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_SAMPLE_COUNT_1_BIT,
+			VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE);
+	}
+#endif
+
+	m_vulkanManager.beginDescribeSubpass();
+	for (uint32_t i = 0; i < colorAttachmentCount; ++i)
+	{
+		m_vulkanManager.subpassAddColorAttachmentReference(i, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	}
+#ifdef USE_LIGHTING_STENCIL
+	m_vulkanManager.subpassAddDepthAttachmentReference(colorAttachmentCount, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+#endif
+#ifdef USE_VARIABLE_RATE_SHADING
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		m_vulkanManager.subpassSetShadingRateAttachmentReference(shadingRateIdx, VK_IMAGE_LAYOUT_GENERAL, getShadingRateTexelSize());
+	}
+#endif
+	m_vulkanManager.endDescribeSubpass();
+
+	// Lighting result is also read by the previous frame's post effect passes
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+#ifdef USE_LIGHTING_STENCIL
+	// The stencil image is shared by all frames in flight as well
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+#endif
+
+	m_lightingRenderPass = m_vulkanManager.endCreateRenderPass("Lighting");
+}
+
+void DeferredRenderer::createBloomRenderPasses()
+{
+	if (m_initialized)
+	{
+		for (auto renderPass : m_bloomRenderPasses)
+		{
+			m_vulkanManager.destroyRenderPass(renderPass);
+		}
+	}
+
+	m_bloomRenderPasses.clear();
+
+	// Layouts and incoming dependencies come from m_renderGraph. They also cover the previous users of the memory
+	// the post effect images share
+	const auto &names = m_renderGraphNames;
+	auto addEntryDependency = [&](const std::vector<uint32_t> &graphPasses)
+	{
+		const VkSubpassDependency dependency = m_renderGraph.getEntryDependency(graphPasses);
+		m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0, dependency.srcStageMask, dependency.dstStageMask,
+			dependency.srcAccessMask, dependency.dstAccessMask);
+	};
+
+#ifndef USE_COMPUTE_BLOOM
+	// --- Bloom render pass 1 (brightness and blur passes): will clear framebuffer
+	const uint32_t brightnessPass = names.bloomPasses[0];
+	const uint32_t pe0 = names.postEffectImages[0];
+#ifndef USE_COMPUTE_BLUR
+	const uint32_t pe1 = names.postEffectImages[1];
+	// The blur passes reuse this render pass
+	assert(m_renderGraph.getInitialLayout(names.bloomPasses[1], pe1) == m_renderGraph.getInitialLayout(brightnessPass, pe0) &&
+		m_renderGraph.getInitialLayout(names.bloomPasses[2], pe0) == m_renderGraph.getInitialLayout(brightnessPass, pe0));
+	assert(m_renderGraph.getFinalLayout(names.bloomPasses[1], pe1) == m_renderGraph.getFinalLayout(brightnessPass, pe0) &&
+		m_renderGraph.getFinalLayout(names.bloomPasses[2], pe0) == m_renderGraph.getFinalLayout(brightnessPass, pe0));
+#endif
+
+	m_vulkanManager.beginCreateRenderPass();
+
+	m_vulkanManager.renderPassAddAttachment(m_postEffectImageFormats[0],
+		m_renderGraph.getInitialLayout(brightnessPass, pe0), m_renderGraph.getFinalLayout(brightnessPass, pe0));
+
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.endDescribeSubpass();
+
+#ifdef USE_COMPUTE_BLUR
+	// The blur passes are dispatches of their own
+	addEntryDependency({ brightnessPass });
+#else
+	addEntryDependency({ names.bloomPasses[0], names.bloomPasses[1], names.bloomPasses[2] });
+#endif
+
+	m_bloomRenderPasses.push_back(m_vulkanManager.endCreateRenderPass("Bloom"));
+#endif
+
+#ifndef USE_FUSED_BLOOM_MERGE
+	// --- Bloom render pass 2 (Merge pass): will not clear framebuffer
+#ifdef USE_TAA
+	const uint32_t sceneColorImage = names.taaResultImage;
+#else
+	const uint32_t sceneColorImage = names.lightingResultImage;
+#endif
+	const uint32_t mergePass = names.bloomPasses.back();
+
+	m_vulkanManager.beginCreateRenderPass();
+
+	m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat,
+		m_renderGraph.getInitialLayout(mergePass, sceneColorImage), m_renderGraph.getFinalLayout(mergePass, sceneColorImage),
+		VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_LOAD);
+
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.endDescribeSubpass();
+
+	addEntryDependency({ mergePass });
+
+	m_bloomRenderPasses.push_back(m_vulkanManager.endCreateRenderPass("Bloom merge"));
+#endif
+}
+
+void DeferredRenderer::createFinalOutputRenderPass()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyRenderPass(m_finalOutputRenderPass);
+	}
+
+	m_vulkanManager.beginCreateRenderPass();
+
+	m_vulkanManager.renderPassAddAttachment(m_vulkanManager.getSwapChainImageFormat(),
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.endDescribeSubpass();
+
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+	m_finalOutputRenderPass = m_vulkanManager.endCreateRenderPass("Final output");
+}
+
+void DeferredRenderer::createTaaRenderPass()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyRenderPass(m_taaRenderPass);
+	}
+
+	m_vulkanManager.beginCreateRenderPass();
+
+	// Every pixel is written. The result is copied into the history image right after this pass
+	const uint32_t taaPass = m_renderGraphNames.taaPass;
+	const uint32_t taaResultImage = m_renderGraphNames.taaResultImage;
+	m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat,
+		m_renderGraph.getInitialLayout(taaPass, taaResultImage), m_renderGraph.getFinalLayout(taaPass, taaResultImage),
+		VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	// The same frame in full precision, which is copied into the history instead
+	const uint32_t accumulationImage = m_renderGraphNames.taaAccumulationImage;
+	m_vulkanManager.renderPassAddAttachment(m_taaHistoryImageFormat,
+		m_renderGraph.getInitialLayout(taaPass, accumulationImage), m_renderGraph.getFinalLayout(taaPass, accumulationImage),
+		VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+#endif
+
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	m_vulkanManager.subpassAddColorAttachmentReference(1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+#endif
+	m_vulkanManager.endDescribeSubpass();
+
+	// Resolve target is also read by the previous frame's bloom and final output passes, the history has been written
+	// by the previous frame's copy, and the inputs by this frame's geometry and lighting passes
+	const VkSubpassDependency dependency = m_renderGraph.getEntryDependency({ taaPass });
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0, dependency.srcStageMask, dependency.dstStageMask,
+		dependency.srcAccessMask, dependency.dstAccessMask);
+
+	m_vulkanManager.renderPassAddSubpassDependency(0, VK_SUBPASS_EXTERNAL,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+	m_taaRenderPass = m_vulkanManager.endCreateRenderPass("TAA");
+}
+
+void DeferredRenderer::createLightingUpsampleRenderPass()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyRenderPass(m_lightingUpsampleRenderPass);
+	}
+
+	m_vulkanManager.beginCreateRenderPass();
+
+	// Every pixel is written
+	const uint32_t upsamplePass = m_renderGraphNames.lightingUpsamplePass;
+	const uint32_t lightingResultImage = m_renderGraphNames.lightingResultImage;
+	m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat,
+		m_renderGraph.getInitialLayout(upsamplePass, lightingResultImage), m_renderGraph.getFinalLayout(upsamplePass, lightingResultImage),
+		VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.endDescribeSubpass();
+
+	// Lighting result is also read by the previous frame's post effect passes, the inputs are written by this frame's
+	// geometry and lighting passes
+	const VkSubpassDependency dependency = m_renderGraph.getEntryDependency({ upsamplePass });
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0, dependency.srcStageMask, dependency.dstStageMask,
+		dependency.srcAccessMask, dependency.dstAccessMask);
+
+	m_lightingUpsampleRenderPass = m_vulkanManager.endCreateRenderPass("Lighting upsample");
+}
+
+void DeferredRenderer::createProbeCaptureRenderPass()
+{
+	m_vulkanManager.beginCreateRenderPass();
+
+	// --- Attachments
+	// Radiance of all faces of a batch of probes, cleared to alpha 0 so the projection sees the sky where nothing is hit
+	m_vulkanManager.renderPassAddAttachment(m_probeCaptureFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	m_vulkanManager.renderPassAddAttachment(findDepthFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE);
+
+	// --- Subpasses
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.subpassAddDepthAttachmentReference(1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.endDescribeSubpass();
+
+	// --- Subpass dependencies
+	// The projection of the previous batch has to finish reading the captures, and its draws writing the depth
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+	m_vulkanManager.renderPassAddSubpassDependency(0, VK_SUBPASS_EXTERNAL,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	m_probeCaptureRenderPass = m_vulkanManager.endCreateRenderPass("Probe capture");
+}
+
+void DeferredRenderer::createImpostorBakeRenderPass()
+{
+	m_vulkanManager.beginCreateRenderPass();
+
+	// --- Attachments
+	// Albedo and normal depth layer of one mesh, cleared to zero coverage so the quads discard what the views miss
+	m_vulkanManager.renderPassAddAttachment(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	m_vulkanManager.renderPassAddAttachment(VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	m_vulkanManager.renderPassAddAttachment(findDepthFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE);
+
+	// --- Subpasses
+	m_vulkanManager.beginDescribeSubpass();
+	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.subpassAddColorAttachmentReference(1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.subpassAddDepthAttachmentReference(2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	m_vulkanManager.endDescribeSubpass();
+
+	// --- Subpass dependencies
+	// The depth image is shared by the layers, the previous mesh has to finish writing it
+	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+	m_vulkanManager.renderPassAddSubpassDependency(0, VK_SUBPASS_EXTERNAL,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	m_impostorBakeRenderPass = m_vulkanManager.endCreateRenderPass("Impostor bake");
+}
+
+void DeferredRenderer::createBrdfLutDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_brdfLutDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createColorLutDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_colorLutDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createAutoExposureDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Frame time
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Scene color
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Histogram and exposure
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_autoExposureDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createSpecEnvPrefilterDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+#ifdef USE_COMPUTE_ENV_PREFILTER
+	// HDR probe a.k.a. radiance environment map with mips
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Destination mip, all 6 faces
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+#else
+	// 6 View matrices + projection matrix
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_GEOMETRY_BIT);
+
+	// HDR probe a.k.a. radiance environment map with mips
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+	m_specEnvPrefilterDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createGeomPassDescriptorSetLayout()
+{
+	createStaticMeshDescriptorSetLayout();
+	createSkyboxDescriptorSetLayout();
+}
+
+void DeferredRenderer::createSkyboxDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Transformation matrices
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+
+	// Albedo map
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	m_skyboxDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createStaticMeshDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Transformation matrices
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, getVertexStages());
+
+	// Per model information
+#ifdef USE_INSTANCING
+	// PerModelUniformBuffer of all instances, indexed by the instance index
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+#else
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, getVertexStages());
+#endif
+
+#ifdef USE_BINDLESS_MATERIALS
+	if (!m_vulkanManager.isDescriptorIndexingEnabled())
+	{
+		throw std::runtime_error("USE_BINDLESS_MATERIALS needs VK_EXT_descriptor_indexing");
+	}
+
+	// Albedo, normal, roughness, metalness, AO and emissive map of every mesh, or albedo, normal, ORM and emissive
+	// with MESH_PACK_ORM, indexed through the push constants
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT,
+		MAX_BINDLESS_TEXTURES, {}, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT);
+#else
+	// Albedo map
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// Normal map
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+#if MESH_PACK_ORM
+	// ORM map
+	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// Emissive map
+	m_vulkanManager.setLayoutAddBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#else
+	// Roughness map
+	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// Metalness map
+	m_vulkanManager.setLayoutAddBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// AO map
+	m_vulkanManager.setLayoutAddBinding(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// Emissive map
+	m_vulkanManager.setLayoutAddBinding(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+#endif
+
+#ifdef USE_VIRTUAL_TEXTURING
+	// Page table, first page and extent of every mesh map, the feedback the pixels report into and its extent
+	m_vulkanManager.setLayoutAddBinding(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(10, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(11, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+	m_geomDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createShadowPassDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+	// light View Project Crop Matrix
+#ifdef USE_LAYERED_SHADOW_PASS
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_GEOMETRY_BIT);
+#else
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, getVertexStages());
+#endif
+	m_shadowDescriptorSetLayout1 = m_vulkanManager.endCreateDescriptorSetLayout();
+
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+	// Per model information
+#ifdef USE_GPU_CULLING
+	// GpuCullingMeshInfo of all meshes, indexed by the instance index of the indirect draws
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, getVertexStages());
+#elif defined(USE_INSTANCING)
+	// PerModelUniformBuffer of all instances, indexed by the instance index
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+#else
+	// PerModelUniformBuffer of the drawn mesh, selected with a dynamic offset
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT);
+#endif
+	m_shadowDescriptorSetLayout2 = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createLightingPassDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Per-frame light information
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// Environment and light information, only uploaded when it changes
+	m_vulkanManager.setLayoutAddBinding(15, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	const VkDescriptorType gbufferDescType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+#else
+	const VkDescriptorType gbufferDescType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+#endif
+
+	// With USE_FORWARD_PLUS this set is bound to the geometry pipelines, whose fragments bring their own surface
+#ifndef USE_FORWARD_PLUS
+	// gbuffer 1
+	m_vulkanManager.setLayoutAddBinding(1, gbufferDescType, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// gbuffer 2
+	m_vulkanManager.setLayoutAddBinding(2, gbufferDescType, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// gbuffer 3
+	m_vulkanManager.setLayoutAddBinding(3, gbufferDescType, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// depth image
+	m_vulkanManager.setLayoutAddBinding(4, gbufferDescType, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+	// specular irradiance map (prefiltered environment map)
+	m_vulkanManager.setLayoutAddBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// BRDF LUT
+	m_vulkanManager.setLayoutAddBinding(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// shadow maps
+	m_vulkanManager.setLayoutAddBinding(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+#ifdef USE_TILED_LIGHTING
+	// point lights, light lists of the tiles and tile counts
+	m_vulkanManager.setLayoutAddBinding(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(10, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+#ifdef USE_GPU_SH_PROJECTION
+	// diffuse SH coefficients
+	m_vulkanManager.setLayoutAddBinding(11, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+#ifdef USE_PROBE_VOLUME
+	// red, green and blue SH volumes
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		m_vulkanManager.setLayoutAddBinding(12 + i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	}
+#endif
+
+#ifdef USE_SSAO
+	// half resolution AO and view depth
+	m_vulkanManager.setLayoutAddBinding(16, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+#ifdef USE_RAY_QUERY_SHADOWS
+	// instances the shadow rays are traced against
+	if (m_useRayQueryShadows)
+	{
+		m_vulkanManager.setLayoutAddBinding(17, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_FRAGMENT_BIT);
+	}
+#endif
+
+	m_lightingDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createBloomDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// input image
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+#ifdef USE_AUTO_EXPOSURE
+	// Exposure, the brightness mask thresholds the exposed color
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+	m_bloomDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createFinalOutputDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Final image, gbuffer, depth image
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// Uniform buffer
+	m_vulkanManager.setLayoutAddBinding(5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+#ifdef USE_FUSED_BLOOM_MERGE
+	// Bloom, added onto the final image before tonemapping
+	m_vulkanManager.setLayoutAddBinding(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+#ifdef USE_COLOR_LUT
+	// Color LUT
+	m_vulkanManager.setLayoutAddBinding(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+#ifdef USE_AUTO_EXPOSURE
+	// Exposure
+	m_vulkanManager.setLayoutAddBinding(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+
+	m_finalOutputDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createLightCullingDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// View and projection matrices, tile counts
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// depth image
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// point lights
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// light lists of the tiles
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_lightCullingDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createShadowPageMarkDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Inverse view projection, cascade matrices and splits, page counts
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// depth image
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// one bit per requested page
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_shadowPageMarkDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createSsaoDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// View and projection matrices
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// depth image and gbuffer 1, whose normals are only read with USE_COMPACT_GBUFFER
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Source of the blur, not read by the SSAO pass
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Destination
+	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_ssaoDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createGpuCullingDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Frustum planes and counts
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// mesh bounds, transforms and index ranges
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// indirect draws
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	// mesh visibility of the last occlusion test and the Hi-Z pyramid
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+#endif
+
+#ifdef USE_MESHLETS
+	// meshlet task draws
+	m_vulkanManager.setLayoutAddBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+#endif
+
+	m_gpuCullingDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createMeshletDescriptorSetLayout()
+{
+	// Task and mesh shaders with VK_EXT_mesh_shader, the meshlet culling pass otherwise
+	const bool meshShaders = m_vulkanManager.isMeshShaderEnabled();
+	const VkShaderStageFlags cullingStages = meshShaders ? VK_SHADER_STAGE_TASK_BIT_EXT : VK_SHADER_STAGE_COMPUTE_BIT;
+
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Frustum planes, camera and Hi-Z info
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, cullingStages);
+
+	// mesh infos and meshlets
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, cullingStages | (meshShaders ? VK_SHADER_STAGE_MESH_BIT_EXT : 0));
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, cullingStages | (meshShaders ? VK_SHADER_STAGE_MESH_BIT_EXT : 0));
+
+	if (meshShaders)
+	{
+		// meshlet vertices and triangles, and the vertex streams of the geometry pool
+		m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT);
+		m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT);
+		m_vulkanManager.setLayoutAddBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT);
+		m_vulkanManager.setLayoutAddBinding(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT);
+	}
+	else
+	{
+		// task draws written by GPU culling, and the meshlet draws
+		m_vulkanManager.setLayoutAddBinding(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+		m_vulkanManager.setLayoutAddBinding(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	// Hi-Z pyramid of the early pass
+	m_vulkanManager.setLayoutAddBinding(9, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, cullingStages);
+#endif
+
+	m_meshletDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createVertexPullingDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+#ifdef USE_VISIBILITY_BUFFER
+	// Also the second set of the material pass
+	const VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+#else
+	const VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT;
+#endif
+
+	// GpuCullingMeshInfo of all meshes, indexed by the instance index of the indirect draws
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, stages);
+
+	// Position and attribute streams of the geometry pool
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, stages);
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, stages);
+
+	m_vertexPullingDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createSkinningDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Position and attribute streams of the geometry pool, read at the rest pose and written at the frame's copy
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// SkinVertex and morph deltas of all animated meshes
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Joint matrices, then the morph target weights
+	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_skinningDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createHiZDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Source level: depth image for mip 0, the previous Hi-Z mip otherwise
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Destination level
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_hiZDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createShadingRateDescriptorSetLayout()
+{
+	if (!m_vulkanManager.isFragmentShadingRateEnabled()) return;
+
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Lighting result and motion vectors, only read with USE_TAA
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Shading rate image
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_shadingRateDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createMaterialDescriptorSetLayout()
+{
+	if (!m_vulkanManager.isDescriptorIndexingEnabled())
+	{
+		throw std::runtime_error("USE_VISIBILITY_BUFFER needs VK_EXT_descriptor_indexing");
+	}
+
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Camera matrices, to intersect the pixel rays with the triangles
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Indirect draws, whose first index tells the LOD each mesh was drawn with, and the index buffer of the geometry pool
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Visibility buffer
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Maps of all meshes as in getMaterialTextureInfos(), non-uniformly indexed by the mesh of each pixel
+	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT,
+		MAX_BINDLESS_TEXTURES, {}, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT);
+
+	// G-buffers
+	for (uint32_t i = 0; i < m_numGBuffers; ++i)
+	{
+		m_vulkanManager.setLayoutAddBinding(5 + i, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	m_materialDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createShadowMomentDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Source: shadow map for the generation, the moments or the blur intermediate otherwise
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Destination, all cascades of one mip
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_shadowMomentDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createSeparableBlur()
+{
+	// Brings its own set and pipeline layouts, the passes that blur get their kernels from it with their pipelines
+	m_separableBlur.reset(new rj::VSeparableBlur(&m_vulkanManager, BLUR_TILE_SIZE, BLUR_ROWS_PER_GROUP));
+}
+
+void DeferredRenderer::createBloomComputeDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Source level: scene color for the prefilter, the next larger mip to downsample or the next smaller one to upsample
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Destination level, also read by the upsample
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+
+#ifdef USE_AUTO_EXPOSURE
+	// Exposure, the prefilter thresholds the exposed color
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+#endif
+
+	m_bloomComputeDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createShProjectionDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Radiance map
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Partial sums of the work groups, written by the projection and read by the reduction
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Diffuse SH coefficients
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	m_shProjectionDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createProbeVolumeDescriptorSetLayouts()
+{
+	// Environment SH coefficients the captured surfaces are lit with
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_probeCaptureDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Captures of a batch of probes
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Radiance map, looked up where a capture shows the sky
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	// Red, green and blue SH volumes
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		m_vulkanManager.setLayoutAddBinding(2 + i, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	m_probeProjectionDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createImpostorDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Camera, unused by the shadow pipelines whose cascade comes with the shadow set
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+
+	// ImpostorInstance of the frame's impostors, indexed by the instance index
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+
+	// Albedo and normal depth atlases
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	m_impostorDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createTaaDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Jitter and history weight
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// Lighting result, history, depth image and motion vectors
+	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	m_taaDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createLightingUpsampleDescriptorSetLayout()
+{
+	m_vulkanManager.beginCreateDescriptorSetLayout();
+
+	// Half resolution lighting
+	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	// gbuffers and depth image, at the bindings of the lighting set
+	for (uint32_t i = 1; i <= 4; ++i)
+	{
+		m_vulkanManager.setLayoutAddBinding(i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	}
+
+	m_lightingUpsampleDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+}
+
+void DeferredRenderer::createBrdfLutPipeline()
+{
+	const std::string csFileName = "../shaders/brdf_lut_pass/brdf_lut.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_brdfLutDescriptorSetLayout });
+	m_brdfLutPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateComputePipeline(m_brdfLutPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(csFileName);
+	m_brdfLutPipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createColorLutPipeline()
+{
+	const std::string csFileName = "../shaders/color_lut_pass/color_lut.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_colorLutDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(ColorGrading), VK_SHADER_STAGE_COMPUTE_BIT);
+	m_colorLutPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	// Each texel is the log2 encoded scene color at its center, exposed, graded and tonemapped
+	uint32_t lutSize = COLOR_LUT_SIZE;
+	float evRange[] = { COLOR_LUT_MIN_EV, COLOR_LUT_MAX_EV };
+	uint32_t groupSize = COLOR_LUT_GROUP_SIZE;
+	m_vulkanManager.beginCreateComputePipeline(m_colorLutPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(csFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &lutSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(float), &evRange[0]);
+	m_vulkanManager.computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(float), &evRange[1]);
+	m_vulkanManager.computePipelineAddSpecializationConstant(3, 3 * sizeof(uint32_t), sizeof(uint32_t), &groupSize);
+	m_colorLutPipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createAutoExposurePipelines()
+{
+	const std::string histogramFileName = "../shaders/auto_exposure_pass/luminance_histogram.comp.spv";
+	const std::string adaptFileName = "../shaders/auto_exposure_pass/exposure_adapt.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_autoExposureDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, 2 * sizeof(uint32_t), VK_SHADER_STAGE_COMPUTE_BIT); // rendered extent
+	m_autoExposurePipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	uint32_t binCount = AUTO_EXPOSURE_HISTOGRAM_BINS;
+	float evRange[] = { AUTO_EXPOSURE_MIN_EV, AUTO_EXPOSURE_MAX_EV };
+	uint32_t downsample = AUTO_EXPOSURE_DOWNSAMPLE;
+	uint32_t groupSize = AUTO_EXPOSURE_GROUP_SIZE;
+	float percentiles[] = { AUTO_EXPOSURE_LOW_PERCENTILE, AUTO_EXPOSURE_HIGH_PERCENTILE };
+	float speed = AUTO_EXPOSURE_SPEED;
+
+	// Each work group counts its samples in a shared histogram and adds it to the global one with one atomic per bin
+	m_vulkanManager.beginCreateComputePipeline(m_autoExposurePipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(histogramFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &binCount);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(float), &evRange[0]);
+	m_vulkanManager.computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(float), &evRange[1]);
+	m_vulkanManager.computePipelineAddSpecializationConstant(3, 3 * sizeof(uint32_t), sizeof(uint32_t), &downsample);
+	m_vulkanManager.computePipelineAddSpecializationConstant(4, 4 * sizeof(uint32_t), sizeof(uint32_t), &groupSize);
+	m_luminanceHistogramPipeline = m_vulkanManager.endCreateComputePipeline();
+
+	// One invocation per bin: prefix sum, average between the percentiles, exponential approach of the exposure
+	m_vulkanManager.beginCreateComputePipeline(m_autoExposurePipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(adaptFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &binCount);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(float), &evRange[0]);
+	m_vulkanManager.computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(float), &evRange[1]);
+	m_vulkanManager.computePipelineAddSpecializationConstant(3, 3 * sizeof(uint32_t), sizeof(float), &percentiles[0]);
+	m_vulkanManager.computePipelineAddSpecializationConstant(4, 4 * sizeof(uint32_t), sizeof(float), &percentiles[1]);
+	m_vulkanManager.computePipelineAddSpecializationConstant(5, 5 * sizeof(uint32_t), sizeof(float), &speed);
+	m_exposureAdaptPipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createLightCullingPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_lightCullingPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_lightCullingPipeline);
+	}
+
+	const std::string csFileName = "../shaders/light_culling_pass/light_culling.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_lightCullingDescriptorSetLayout });
+	m_lightCullingPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateComputePipeline(m_lightCullingPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(csFileName);
+
+	// One work group per tile
+	uint32_t tileSize = LIGHT_TILE_SIZE;
+	uint32_t maxLightsPerTile = MAX_LIGHTS_PER_TILE;
+	uint32_t sampleCount = m_sampleCount;
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &tileSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &maxLightsPerTile);
+	m_vulkanManager.computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(uint32_t), &sampleCount);
+
+	m_lightCullingPipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createShadowPageMarkPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_shadowPageMarkPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_shadowPageMarkPipeline);
+	}
+
+	const std::string csFileName = "../shaders/shadow_page_mark_pass/shadow_page_mark.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_shadowPageMarkDescriptorSetLayout });
+	m_shadowPageMarkPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateComputePipeline(m_shadowPageMarkPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(csFileName);
+
+	// One invocation per pixel, each marks the page its depth samples in the cascade it falls into
+	uint32_t groupSize = SHADOW_PAGE_MARK_GROUP_SIZE;
+	uint32_t sampleCount = getDepthResolveMode() != VK_RESOLVE_MODE_NONE_KHR ? 1 : m_sampleCount;
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &sampleCount);
+
+	m_shadowPageMarkPipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createSsaoPipelines()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_ssaoPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_ssaoPipeline);
+#ifndef USE_COMPUTE_BLUR
+		m_vulkanManager.destroyPipeline(m_ssaoBlurPipeline);
+#endif
+	}
+
+#ifdef USE_COMPACT_GBUFFER
+	const std::string ssaoFileName = "../shaders/ssao_pass/ssao_compact.comp.spv";
+#else
+	const std::string ssaoFileName = "../shaders/ssao_pass/ssao.comp.spv";
+#endif
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_ssaoDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, 4 * sizeof(uint32_t), VK_SHADER_STAGE_COMPUTE_BIT); // rendered extent, blur direction
+	m_ssaoPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	uint32_t groupSize = SSAO_GROUP_SIZE;
+
+	// One full resolution depth sample per half resolution pixel, sample 0 of the MSAA depth unless it is resolved
+	uint32_t sampleCount = getDepthResolveMode() != VK_RESOLVE_MODE_NONE_KHR ? 1 : m_sampleCount;
+	uint32_t hemisphereSampleCount = SSAO_SAMPLE_COUNT;
+	float radius = SSAO_RADIUS;
+	float intensity = SSAO_INTENSITY;
+	m_vulkanManager.beginCreateComputePipeline(m_ssaoPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(ssaoFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &sampleCount);
+	m_vulkanManager.computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(uint32_t), &hemisphereSampleCount);
+	m_vulkanManager.computePipelineAddSpecializationConstant(3, 3 * sizeof(uint32_t), sizeof(float), &radius);
+	m_vulkanManager.computePipelineAddSpecializationConstant(4, 4 * sizeof(uint32_t), sizeof(float), &intensity);
+	m_ssaoPipeline = m_vulkanManager.endCreateComputePipeline();
+
+	// Separable, taps whose view depth differs from the center's are weighted down
+#ifdef USE_COMPUTE_BLUR
+	rj::VSeparableBlur::KernelInfo blurInfo = {};
+	blurInfo.format = VK_FORMAT_R32G32_SFLOAT; // of m_ssaoImages, the view depth is the second channel
+	blurInfo.layered = false;
+	blurInfo.radius = SSAO_BLUR_RADIUS;
+	blurInfo.sigma = SSAO_BLUR_SIGMA;
+	blurInfo.depthSharpness = SSAO_BLUR_SHARPNESS;
+	m_ssaoBlurPipeline = m_separableBlur->getKernel(blurInfo);
+#else
+	const std::string blurFileName = "../shaders/ssao_pass/ssao_blur.comp.spv";
+	uint32_t blurRadius = SSAO_BLUR_RADIUS;
+	float sharpness = SSAO_BLUR_SHARPNESS;
+	m_vulkanManager.beginCreateComputePipeline(m_ssaoPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(blurFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &blurRadius);
+	m_vulkanManager.computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(float), &sharpness);
+	m_ssaoBlurPipeline = m_vulkanManager.endCreateComputePipeline();
+#endif
+}
+
+void DeferredRenderer::createGpuCullingPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_gpuCullingPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_gpuCullingPipeline);
+#ifdef USE_HIZ_OCCLUSION_CULLING
+		m_vulkanManager.destroyPipeline(m_gpuCullingLatePipeline);
+#endif
+#ifdef USE_MESHLETS
+		if (!m_vulkanManager.isMeshShaderEnabled())
+		{
+			m_vulkanManager.destroyPipelineLayout(m_meshletCullingPipelineLayout);
+			m_vulkanManager.destroyPipeline(m_meshletCullingPipeline);
+#ifdef USE_HIZ_OCCLUSION_CULLING
+			m_vulkanManager.destroyPipeline(m_meshletCullingLatePipeline);
+#endif
+		}
+#endif
+	}
+
+#ifdef USE_MESHLETS
+	// Also hands LOD 0 draws over to the meshlet task commands
+	const std::string csFileName = "../shaders/gpu_culling_pass/gpu_culling_meshlets.comp.spv";
+#else
+	const std::string csFileName = "../shaders/gpu_culling_pass/gpu_culling.comp.spv";
+#endif
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_gpuCullingDescriptorSetLayout });
+	m_gpuCullingPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateComputePipeline(m_gpuCullingPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(csFileName);
+
+	// One invocation per mesh
+	uint32_t groupSize = GPU_CULLING_GROUP_SIZE;
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	// Early phase: meshes visible in the last occlusion test, frustum culled only
+	uint32_t phase = 0;
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &phase);
+	m_gpuCullingPipeline = m_vulkanManager.endCreateComputePipeline();
+
+	// Late phase: all meshes against the Hi-Z of the early pass. Writes the late draw list and the visibility for the next frame
+	m_vulkanManager.beginCreateComputePipeline(m_gpuCullingPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(csFileName);
+	phase = 1;
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &phase);
+	m_gpuCullingLatePipeline = m_vulkanManager.endCreateComputePipeline();
+#else
+	m_gpuCullingPipeline = m_vulkanManager.endCreateComputePipeline();
+#endif
+
+#ifdef USE_MESHLETS
+	if (m_vulkanManager.isMeshShaderEnabled())
+	{
+		return;
+	}
+
+	const std::string meshletFileName = "../shaders/meshlet_pass/meshlet_culling.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_meshletDescriptorSetLayout });
+	m_meshletCullingPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	// One work group per mesh and draw list
+	uint32_t meshletGroupSize = MESHLET_CULLING_GROUP_SIZE;
+	m_vulkanManager.beginCreateComputePipeline(m_meshletCullingPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(meshletFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &meshletGroupSize);
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	phase = 0;
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &phase);
+	m_meshletCullingPipeline = m_vulkanManager.endCreateComputePipeline();
+
+	m_vulkanManager.beginCreateComputePipeline(m_meshletCullingPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(meshletFileName);
+	phase = 1;
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &meshletGroupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &phase);
+	m_meshletCullingLatePipeline = m_vulkanManager.endCreateComputePipeline();
+#else
+	m_meshletCullingPipeline = m_vulkanManager.endCreateComputePipeline();
+#endif
+#endif
+}
+
+void DeferredRenderer::createSkinningPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_skinningPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_skinningPipeline);
+	}
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_skinningDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(SkinningPushConstants), VK_SHADER_STAGE_COMPUTE_BIT);
+	m_skinningPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateComputePipeline(m_skinningPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage("../shaders/skinning_pass/skinning.comp.spv");
+
+	// One invocation per vertex
+	uint32_t groupSize = SKINNING_GROUP_SIZE;
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_skinningPipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createHiZPipelines()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_hiZPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_hiZDepthReducePipeline);
+		m_vulkanManager.destroyPipeline(m_hiZDownsamplePipeline);
+	}
+
+	// Multisampled depth is reduced to the farthest sample, so a pixel only occludes what is behind all of its samples, unless the
+	// geometry pass resolved it to that already
+	uint32_t sampleCount = getDepthMaxResolveMode() != VK_RESOLVE_MODE_NONE_KHR ? 1 : m_sampleCount;
+	const std::string reduceFileName = sampleCount == 1 ?
+		"../shaders/hiz_pass/hiz_depth_reduce.comp.spv" : "../shaders/hiz_pass/hiz_depth_reduce_ms.comp.spv";
+	const std::string downsampleFileName = "../shaders/hiz_pass/hiz_downsample.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_hiZDescriptorSetLayout });
+	m_hiZPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	uint32_t groupSize = HIZ_GROUP_SIZE;
+
+	m_vulkanManager.beginCreateComputePipeline(m_hiZPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(reduceFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &sampleCount);
+	m_hiZDepthReducePipeline = m_vulkanManager.endCreateComputePipeline();
+
+	// Max of each 2x2 quad of the previous level
+	m_vulkanManager.beginCreateComputePipeline(m_hiZPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(downsampleFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_hiZDownsamplePipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createShadingRatePipeline()
+{
+	if (!m_vulkanManager.isFragmentShadingRateEnabled()) return;
+
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_shadingRatePipelineLayout);
+		m_vulkanManager.destroyPipeline(m_shadingRatePipeline);
+	}
+
+	// Without motion vectors only the contrast and the foveation pick the rate
+#ifdef USE_TAA
+	const std::string fileName = "../shaders/shading_rate_pass/shading_rate_motion.comp.spv";
+#else
+	const std::string fileName = "../shaders/shading_rate_pass/shading_rate.comp.spv";
+#endif
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_shadingRateDescriptorSetLayout });
+	// rendered extent, max rate, contrast and motion thresholds, fovea radius
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, 6 * sizeof(uint32_t), VK_SHADER_STAGE_COMPUTE_BIT);
+	m_shadingRatePipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	VkExtent2D texelSize = getShadingRateTexelSize();
+	uint32_t groupSize = VRS_GROUP_SIZE;
+
+	m_vulkanManager.beginCreateComputePipeline(m_shadingRatePipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(fileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &texelSize.width);
+	m_vulkanManager.computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(uint32_t), &texelSize.height);
+	m_shadingRatePipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createMaterialPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_materialPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_materialPipeline);
+	}
+
+#if MESH_PACK_ORM
+	const std::string fileName = "../shaders/vis_buffer_pass/material_orm.comp.spv";
+#else
+	const std::string fileName = "../shaders/vis_buffer_pass/material.comp.spv";
+#endif
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_materialDescriptorSetLayout, m_vertexPullingDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, 3 * sizeof(uint32_t), VK_SHADER_STAGE_COMPUTE_BIT); // rendered extent, late draw list
+	m_materialPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	// The IDs of all samples are compared, each distinct one is shaded once
+	uint32_t groupSize = MATERIAL_PASS_GROUP_SIZE;
+	uint32_t sampleCount = m_sampleCount;
+	uint32_t triangleBits = VISIBILITY_TRIANGLE_BITS;
+	uint32_t mapsPerMesh = VMesh::numMapsPerMesh;
+	m_vulkanManager.beginCreateComputePipeline(m_materialPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(fileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &sampleCount);
+	m_vulkanManager.computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(uint32_t), &triangleBits);
+	m_vulkanManager.computePipelineAddSpecializationConstant(3, 3 * sizeof(uint32_t), sizeof(uint32_t), &mapsPerMesh);
+	m_materialPipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createShadowMomentPipelines()
+{
+	const std::string generateFileName = "../shaders/shadow_moments/shadow_moments_generate.comp.spv";
+#ifndef USE_COMPUTE_BLUR
+	const std::string blurFileName = "../shaders/shadow_moments/shadow_moments_blur.comp.spv";
+#endif
+	const std::string downsampleFileName = "../shaders/shadow_moments/shadow_moments_downsample.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_shadowMomentDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, 2 * sizeof(uint32_t), VK_SHADER_STAGE_COMPUTE_BIT); // cascade, blur direction
+	m_shadowMomentPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	uint32_t groupSize = SHADOW_MOMENT_GROUP_SIZE;
+	float exponents[] = { EVSM_POSITIVE_EXPONENT, EVSM_NEGATIVE_EXPONENT };
+	uint32_t blurRadius = SHADOW_MOMENT_BLUR_RADIUS;
+
+	// Averages the warped moments of 2x2 shadow map texels, so the blur runs at the lower resolution
+	m_vulkanManager.beginCreateComputePipeline(m_shadowMomentPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(generateFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(float), &exponents[0]);
+	m_vulkanManager.computePipelineAddSpecializationConstant(2, 2 * sizeof(uint32_t), sizeof(float), &exponents[1]);
+	m_shadowMomentGeneratePipeline = m_vulkanManager.endCreateComputePipeline();
+
+#ifdef USE_COMPUTE_BLUR
+	// Box filter, all cascades are blurred by the same kernel
+	rj::VSeparableBlur::KernelInfo blurInfo = {};
+	blurInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	blurInfo.layered = true;
+	blurInfo.radius = blurRadius;
+	blurInfo.sigma = 0.f;
+	blurInfo.depthSharpness = 0.f;
+	m_shadowMomentBlurPipeline = m_separableBlur->getKernel(blurInfo);
+#else
+	m_vulkanManager.beginCreateComputePipeline(m_shadowMomentPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(blurFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &blurRadius);
+	m_shadowMomentBlurPipeline = m_vulkanManager.endCreateComputePipeline();
+#endif
+
+	// Moments stay linear in the depth distribution, so a plain box filter builds the mips
+	m_vulkanManager.beginCreateComputePipeline(m_shadowMomentPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(downsampleFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_shadowMomentDownsamplePipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createBloomComputePipelines()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_bloomComputePipelineLayout);
+		m_vulkanManager.destroyPipeline(m_bloomPrefilterPipeline);
+		m_vulkanManager.destroyPipeline(m_bloomDownsamplePipeline);
+		m_vulkanManager.destroyPipeline(m_bloomUpsamplePipeline);
+	}
+
+#ifdef USE_AUTO_EXPOSURE
+	const std::string prefilterFileName = "../shaders/bloom_compute/bloom_prefilter_auto_exposure" + getPrecisionSuffix() + ".comp.spv";
+#else
+	const std::string prefilterFileName = "../shaders/bloom_compute/bloom_prefilter" + getPrecisionSuffix() + ".comp.spv";
+#endif
+	const std::string downsampleFileName = "../shaders/bloom_compute/bloom_downsample" + getPrecisionSuffix() + ".comp.spv";
+	const std::string upsampleFileName = "../shaders/bloom_compute/bloom_upsample" + getPrecisionSuffix() + ".comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_bloomComputeDescriptorSetLayout });
+	m_bloomComputePipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	uint32_t groupSize = BLOOM_GROUP_SIZE;
+
+	// Brightness mask and the first downsample in one pass
+	m_vulkanManager.beginCreateComputePipeline(m_bloomComputePipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(prefilterFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_bloomPrefilterPipeline = m_vulkanManager.endCreateComputePipeline();
+
+	// Dual filter downsample: bilinear taps at the center and the four corners of each destination texel
+	m_vulkanManager.beginCreateComputePipeline(m_bloomComputePipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(downsampleFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_bloomDownsamplePipeline = m_vulkanManager.endCreateComputePipeline();
+
+	// 3x3 tent filter of the smaller mip added onto the destination
+	m_vulkanManager.beginCreateComputePipeline(m_bloomComputePipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(upsampleFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_bloomUpsamplePipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createShProjectionPipelines()
+{
+	const std::string projectionFileName = "../shaders/sh_projection_pass/sh_projection.comp.spv";
+	const std::string reduceFileName = "../shaders/sh_projection_pass/sh_reduce.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_shProjectionDescriptorSetLayout });
+	m_shProjectionPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	// Both derive the work group count from the radiance map size
+	uint32_t groupSize = SH_PROJECTION_GROUP_SIZE;
+
+	// Each work group weighs the texels of its tile of a face by solid angle and reduces them in shared memory
+	m_vulkanManager.beginCreateComputePipeline(m_shProjectionPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(projectionFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_shProjectionPipeline = m_vulkanManager.endCreateComputePipeline();
+
+	// A single work group adds the partial sums up in a fixed order
+	m_vulkanManager.beginCreateComputePipeline(m_shProjectionPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(reduceFileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_shReducePipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createProbeProjectionPipeline()
+{
+	const std::string fileName = "../shaders/probe_volume/probe_sh_projection.comp.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_probeProjectionDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(uint32_t), VK_SHADER_STAGE_COMPUTE_BIT); // first probe of the batch
+	m_probeProjectionPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	// Each work group weighs the texels of one probe's capture by solid angle and reduces them in shared memory
+	uint32_t captureSize = PROBE_CAPTURE_SIZE;
+	uint32_t gridSize = PROBE_VOLUME_GRID_SIZE;
+	m_vulkanManager.beginCreateComputePipeline(m_probeProjectionPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(fileName);
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &captureSize);
+	m_vulkanManager.computePipelineAddSpecializationConstant(1, sizeof(uint32_t), sizeof(uint32_t), &gridSize);
+	m_probeProjectionPipeline = m_vulkanManager.endCreateComputePipeline();
+}
+
+void DeferredRenderer::createSpecEnvPrefilterPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_specEnvPrefilterPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_specEnvPrefilterPipeline);
+	}
+
+#ifdef USE_COMPUTE_ENV_PREFILTER
+#ifdef USE_PROBE_SWITCHING
+	// Roughness of the mip level and the first face of the dispatch
+	const std::string csFileName = "../shaders/env_prefilter_pass/spec_env_prefilter_faces.comp.spv";
+	const uint32_t pushConstantSize = sizeof(float) + sizeof(uint32_t);
+#else
+	// Roughness of the mip level
+	const std::string csFileName = "../shaders/env_prefilter_pass/spec_env_prefilter.comp.spv";
+	const uint32_t pushConstantSize = sizeof(float);
+#endif
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_specEnvPrefilterDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, pushConstantSize, VK_SHADER_STAGE_COMPUTE_BIT);
+	m_specEnvPrefilterPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateComputePipeline(m_specEnvPrefilterPipelineLayout);
+	m_vulkanManager.computePipelineAddShaderStage(csFileName);
+	uint32_t groupSize = ENV_PREFILTER_GROUP_SIZE;
+	m_vulkanManager.computePipelineAddSpecializationConstant(0, 0, sizeof(uint32_t), &groupSize);
+	m_specEnvPrefilterPipeline = m_vulkanManager.endCreateComputePipeline();
+#else
+	const std::string vsFileName = "../shaders/env_prefilter_pass/env_prefilter.vert.spv";
+	const std::string gsFileName = "../shaders/env_prefilter_pass/env_prefilter.geom.spv";
+	const std::string fsFileName = "../shaders/env_prefilter_pass/spec_env_prefilter.frag.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_specEnvPrefilterDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(float), VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_specEnvPrefilterPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateGraphicsPipeline(m_specEnvPrefilterPipelineLayout, m_specEnvPrefilterRenderPass, 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_GEOMETRY_BIT, gsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+	auto bindingDescs = GpuVertex::getBindingDescriptions();
+	for (const auto &bindingDesc : bindingDescs)
+	{
+		m_vulkanManager.graphicsPipelineAddBindingDescription(bindingDesc.binding, bindingDesc.stride, bindingDesc.inputRate);
+	}
+	auto attrDescs = GpuVertex::getAttributeDescriptions();
+	for (const auto &attrDesc : attrDescs)
+	{
+		m_vulkanManager.graphicsPipelineAddAttributeDescription(attrDesc.location, attrDesc.binding, attrDesc.format, attrDesc.offset);
+	}
+
+	m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_specEnvPrefilterPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+#endif
+}
+
+void DeferredRenderer::createGeomPassPipeline()
+{
+#ifndef USE_DEFERRED_SKY
+	// Otherwise created after the lighting pipeline, whose layout it shares
+	createSkyboxPipeline();
+#endif
+	createStaticMeshPipeline();
+	createDepthPrepassPipeline();
+}
+
+void DeferredRenderer::createSkyboxPipeline()
+{
+#ifdef USE_DEFERRED_SKY
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipeline(m_skyboxPipeline);
+	}
+
+	const std::string vsFileName = "../shaders/skybox_pass/sky_fullscreen.vert.spv";
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	const std::string fsFileName = "../shaders/skybox_pass/sky_fullscreen_merged.frag.spv";
+#elif defined(USE_LIGHTING_BLOOM_BRIGHTNESS)
+	const std::string fsFileName = "../shaders/skybox_pass/sky_fullscreen_bloom_brightness.frag.spv";
+#else
+	const std::string fsFileName = "../shaders/skybox_pass/sky_fullscreen.frag.spv";
+#endif
+
+	// Uses the lighting pipeline layout, whose set 1 is the skybox set. The vertex shader turns the corners of the fullscreen
+	// triangle into view directions with the camera matrices, the fragment shader discards every pixel with a sample in front
+	// of the far plane and writes the radiance map to the rest. Pixels that are only partly sky are left to the lighting shader
+	m_vulkanManager.beginCreateGraphicsPipeline(m_lightingPipelineLayout, m_lightingRenderPass, m_lightingSubpass);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+	uint32_t sampleCount = m_sampleCount;
+	m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 0, 0, sizeof(uint32_t), &sampleCount);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#endif
+
+	m_skyboxPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+#else
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_skyboxPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_skyboxPipeline);
+	}
+
+#ifdef USE_TAA
+	// These variants also write motion vectors
+	const std::string vsFileName = "../shaders/geom_pass/skybox_taa.vert.spv";
+#else
+	const std::string vsFileName = "../shaders/geom_pass/skybox.vert.spv";
+#endif
+#ifdef USE_FORWARD_PLUS
+	// Writes the radiance map instead of the G-buffers
+	std::string fsFileName = "../shaders/forward_pass/skybox";
+#elif defined(USE_COMPACT_GBUFFER)
+	std::string fsFileName = "../shaders/geom_pass/skybox_compact";
+#else
+	std::string fsFileName = "../shaders/geom_pass/skybox";
+#endif
+#ifdef USE_TAA
+	fsFileName += "_taa";
+#endif
+	fsFileName += ".frag.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_skyboxDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(uint32_t), VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_skyboxPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateGraphicsPipeline(m_skyboxPipelineLayout, m_geomRenderPass, 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+	auto bindingDescs = GpuVertex::getBindingDescriptions();
+	for (const auto &bindingDesc : bindingDescs)
+	{
+		m_vulkanManager.graphicsPipelineAddBindingDescription(bindingDesc.binding, bindingDesc.stride, bindingDesc.inputRate);
+	}
+	auto attrDescs = GpuVertex::getAttributeDescriptions();
+	for (const auto &attrDesc : attrDescs)
+	{
+		m_vulkanManager.graphicsPipelineAddAttributeDescription(attrDesc.location, attrDesc.binding, attrDesc.format, attrDesc.offset);
+	}
+
+	m_vulkanManager.graphicsPipelineConfigureMultisampleState(m_sampleCount);
+
+	// Viewport and scissor are set when recording so that the pipeline survives swapchain resizes
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	// Clamp fragment depth to [0, 1] instead of clipping to avoid clipping the sky box
+	m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_FRONT_BIT, VK_FRONT_FACE_CLOCKWISE,
+		1.f, VK_FALSE, 0.f, 0.f, VK_TRUE);
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#ifndef USE_FORWARD_PLUS
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#endif
+#ifdef USE_TAA
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE); // motion vectors
+#endif
+
+	m_skyboxPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+#endif
+}
+
+void DeferredRenderer::createStaticMeshPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_geomPipelineLayout);
+#ifdef USE_PIPELINE_PERMUTATIONS
+		for (const auto &variant : m_geomPipelineVariants)
+		{
+			m_vulkanManager.destroyPipeline(variant.second);
+		}
+		for (const auto &variant : m_geomDepthEqualPipelineVariants)
+		{
+			m_vulkanManager.destroyPipeline(variant.second);
+		}
+		m_geomPipelineVariants.clear();
+		m_geomDepthEqualPipelineVariants.clear();
+#else
+		m_vulkanManager.destroyPipeline(m_geomPipeline);
+		m_vulkanManager.destroyPipeline(m_geomDepthEqualPipeline);
+#endif
+#ifdef USE_MESHLETS
+		if (m_vulkanManager.isMeshShaderEnabled())
+		{
+			m_vulkanManager.destroyPipelineLayout(m_geomMeshletPipelineLayout);
+			m_vulkanManager.destroyPipeline(m_geomMeshletPipeline);
+			m_vulkanManager.destroyPipeline(m_geomDepthEqualMeshletPipeline);
+		}
+#endif
+	}
+
+#ifdef USE_VISIBILITY_BUFFER
+	// Depth and triangle IDs only, the material pass fetches the attributes and samples the maps
+	const std::string vsFileName = "../shaders/vis_buffer_pass/visibility_pull.vert.spv";
+	const std::string fsFileName = "../shaders/vis_buffer_pass/visibility.frag.spv";
+	const uint32_t pushConstantCount = 0;
+#else
+	std::string vsFileName = "../shaders/geom_pass/geom";
+#ifdef USE_TAA
+	// These variants also write motion vectors
+	vsFileName += "_taa";
+#endif
+#ifdef USE_INSTANCING
+	vsFileName += "_instanced";
+#endif
+#ifdef USE_MULTI_VIEW
+	vsFileName += "_multi_view";
+#endif
+#ifdef USE_VERTEX_PULLING
+	vsFileName += "_pull";
+#endif
+#if MESH_TANGENTS
+	// These variants pass the interpolated TBN on instead of deriving it in the fragment shader
+	vsFileName += "_tangent";
+#endif
+	vsFileName += ".vert.spv";
+#ifdef USE_FORWARD_PLUS
+	// Shades the lights of its tile with the lighting set, and writes the color instead of the G-buffers
+	std::string fsFileName = "../shaders/forward_pass/forward";
+#elif defined(USE_COMPACT_GBUFFER)
+	std::string fsFileName = "../shaders/geom_pass/geom_compact";
+#else
+	std::string fsFileName = "../shaders/geom_pass/geom";
+#endif
+#ifdef USE_TAA
+	fsFileName += "_taa";
+#endif
+#if MESH_PACK_ORM
+	fsFileName += "_orm";
+#endif
+#if MESH_TANGENTS
+	fsFileName += "_tangent";
+#endif
+#ifdef USE_PIPELINE_PERMUTATIONS
+	uint32_t pushConstantCount = 0;
+#else
+	uint32_t pushConstantCount = 3;
+#endif
+#ifdef USE_BINDLESS_MATERIALS
+	fsFileName += "_bindless";
+	++pushConstantCount;
+#endif
+#ifdef USE_VIRTUAL_TEXTURING
+	// Samples the virtual maps through the page table and reports the pages it wants, the mesh index picks its maps' entries
+	fsFileName += "_virtual_texture";
+	++pushConstantCount;
+#endif
+#ifdef USE_PIPELINE_PERMUTATIONS
+	fsFileName += "_specialized";
+#endif
+#ifdef USE_FORWARD_PLUS
+	// Same lighting variants as the lighting shader
+#ifdef USE_GPU_SH_PROJECTION
+	fsFileName += "_gpu_sh";
+#endif
+#ifdef USE_PROBE_VOLUME
+	fsFileName += "_probe_volume";
+#endif
+#ifdef USE_EVSM_SHADOWS
+	fsFileName += "_evsm";
+#endif
+#ifdef USE_SHADOW_ATLAS
+	fsFileName += "_atlas";
+#endif
+#endif
+	fsFileName += ".frag.spv";
+#endif
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_geomDescriptorSetLayout });
+#ifdef USE_VERTEX_PULLING
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_vertexPullingDescriptorSetLayout });
+#endif
+#ifdef USE_FORWARD_PLUS
+	// Last, bound by recordGeomPassDraws. The lighting constants follow the material constants
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_lightingDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, FORWARD_PUSH_CONSTANT_OFFSET + sizeof(LightingPushConstants), VK_SHADER_STAGE_FRAGMENT_BIT);
+#else
+	if (pushConstantCount > 0)
+	{
+		m_vulkanManager.pipelineLayoutAddPushConstantRange(0, pushConstantCount * sizeof(uint32_t), VK_SHADER_STAGE_FRAGMENT_BIT);
+	}
+#endif
+#ifdef USE_MULTI_VIEW
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(VIEW_PUSH_CONSTANT_OFFSET, sizeof(uint32_t), VK_SHADER_STAGE_VERTEX_BIT); // view index
+#endif
+	m_geomPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+#ifdef USE_MESHLETS
+	// The task shader culls the meshlets of one mesh in one draw list, the mesh shader reads the same transforms as the vertex shader
+	std::string msFileName = "../shaders/meshlet_pass/geom";
+#ifdef USE_TAA
+	msFileName += "_taa";
+#endif
+	msFileName += ".mesh.spv";
+	if (m_vulkanManager.isMeshShaderEnabled())
+	{
+		m_vulkanManager.beginCreatePipelineLayout();
+		m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_geomDescriptorSetLayout, m_meshletDescriptorSetLayout });
+		m_vulkanManager.pipelineLayoutAddPushConstantRange(0, pushConstantCount * sizeof(uint32_t), VK_SHADER_STAGE_FRAGMENT_BIT);
+		m_vulkanManager.pipelineLayoutAddPushConstantRange(MESHLET_PUSH_CONSTANT_OFFSET, 2 * sizeof(uint32_t), VK_SHADER_STAGE_TASK_BIT_EXT);
+		m_geomMeshletPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+	}
+#endif
+
+	// @variant is only used with USE_PIPELINE_PERMUTATIONS, see getGeomPipelineVariant().
+	// @depthEqual: depth has been laid down by the pre-pass, only shade the fragments that match it.
+	// @meshShaders: the USE_MESHLETS variant, which has no vertex input
+	auto createPipeline = [&](uint32_t variant, bool depthEqual, bool meshShaders)
+	{
+#ifdef USE_MESHLETS
+		if (meshShaders)
+		{
+			m_vulkanManager.beginCreateGraphicsPipeline(m_geomMeshletPipelineLayout, m_geomRenderPass, 0);
+			m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_TASK_BIT_EXT, "../shaders/meshlet_pass/meshlet.task.spv");
+			m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_MESH_BIT_EXT, msFileName);
+		}
+		else
+#endif
+		{
+			m_vulkanManager.beginCreateGraphicsPipeline(m_geomPipelineLayout, m_geomRenderPass, 0);
+			m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+		}
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+#ifdef USE_PIPELINE_PERMUTATIONS
+		uint32_t materialId = variant >> 2;
+		uint32_t hasAoMap = (variant >> 1) & 1;
+		uint32_t hasEmissiveMap = variant & 1;
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 0, 0, sizeof(uint32_t), &materialId);
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 1, sizeof(uint32_t), sizeof(uint32_t), &hasAoMap);
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 2, 2 * sizeof(uint32_t), sizeof(uint32_t), &hasEmissiveMap);
+#endif
+
+#ifndef USE_VERTEX_PULLING
+		if (!meshShaders)
+		{
+			auto bindingDescs = GpuVertex::getBindingDescriptions();
+			for (const auto &bindingDesc : bindingDescs)
+			{
+				m_vulkanManager.graphicsPipelineAddBindingDescription(bindingDesc.binding, bindingDesc.stride, bindingDesc.inputRate);
+			}
+			auto attrDescs = GpuVertex::getAttributeDescriptions();
+			for (const auto &attrDesc : attrDescs)
+			{
+				m_vulkanManager.graphicsPipelineAddAttributeDescription(attrDesc.location, attrDesc.binding, attrDesc.format, attrDesc.offset);
+			}
+		}
+#endif
+
+#ifdef USE_GLTF
+		// temporary hack
+		m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+#endif
+
+#if defined(USE_VISIBILITY_BUFFER) || defined(USE_FORWARD_PLUS)
+		// All samples of a fragment get the same ID, or the same color, which is what makes forward MSAA cheap
+		m_vulkanManager.graphicsPipelineConfigureMultisampleState(m_sampleCount);
+#else
+		m_vulkanManager.graphicsPipelineConfigureMultisampleState(m_sampleCount, VK_TRUE, 0.25f);
+#endif
+
+		if (depthEqual)
+		{
+			m_vulkanManager.graphicsPipelineConfigureDepthState(VK_TRUE, VK_FALSE, VK_COMPARE_OP_EQUAL);
+		}
+
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+		m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#if !defined(USE_VISIBILITY_BUFFER) && !defined(USE_FORWARD_PLUS)
+		m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+		m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#endif
+#ifdef USE_TAA
+		m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE); // motion vectors
+#endif
+
+		return m_vulkanManager.endCreateGraphicsPipeline();
+	};
+
+#ifdef USE_PIPELINE_PERMUTATIONS
+	// Only the variants some mesh of the scene uses, or every one of them when warming up the pipeline cache
+	std::vector<uint32_t> variants;
+	for (const auto &mesh : m_scene.meshes)
+	{
+		variants.push_back(getGeomPipelineVariant(mesh));
+	}
+	for (uint32_t variant = 0; m_warmUpPipelines && variant < (MATERIAL_TYPE_COUNT << 2); ++variant)
+	{
+		variants.push_back(variant);
+	}
+	for (uint32_t variant : variants)
+	{
+		if (m_geomPipelineVariants.find(variant) == m_geomPipelineVariants.end())
+		{
+			m_geomPipelineVariants[variant] = createPipeline(variant, false, false);
+			m_geomDepthEqualPipelineVariants[variant] = createPipeline(variant, true, false);
+		}
+	}
+#else
+	m_geomPipeline = createPipeline(0, false, false);
+	m_geomDepthEqualPipeline = createPipeline(0, true, false);
+#endif
+#ifdef USE_MESHLETS
+	if (m_vulkanManager.isMeshShaderEnabled())
+	{
+		m_geomMeshletPipeline = createPipeline(0, false, true);
+		m_geomDepthEqualMeshletPipeline = createPipeline(0, true, true);
+	}
+#endif
+}
+
+void DeferredRenderer::createDepthPrepassPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipeline(m_depthPrepassPipeline);
+#ifdef USE_MESHLETS
+		if (m_vulkanManager.isMeshShaderEnabled())
+		{
+			m_vulkanManager.destroyPipeline(m_depthPrepassMeshletPipeline);
+		}
+#endif
+	}
+
+	// Position only vertex input like the shadow pass. The vertex shader has to compute gl_Position exactly as the
+	// geometry vertex shader does (invariant) for the equal depth test of the geometry pass
+	std::string vsFileName = "../shaders/geom_pass/depth_prepass";
+#ifdef USE_INSTANCING
+	vsFileName += "_instanced";
+#endif
+#ifdef USE_MULTI_VIEW
+	vsFileName += "_multi_view";
+#endif
+#ifdef USE_VERTEX_PULLING
+	vsFileName += "_pull";
+#endif
+	vsFileName += ".vert.spv";
+
+	// Shares the geometry pass layout so it reads the same transforms
+	m_vulkanManager.beginCreateGraphicsPipeline(m_geomPipelineLayout, m_depthPrepassRenderPass, 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+
+#ifndef USE_VERTEX_PULLING
+	// Only the position stream
+	auto bindingDescs = GpuVertex::getBindingDescriptions();
+	m_vulkanManager.graphicsPipelineAddBindingDescription(bindingDescs[0].binding, bindingDescs[0].stride, bindingDescs[0].inputRate);
+	auto attrDescs = GpuVertex::getAttributeDescriptions();
+	m_vulkanManager.graphicsPipelineAddAttributeDescription(attrDescs[0].location, attrDescs[0].binding, attrDescs[0].format, attrDescs[0].offset);
+#endif
+
+#ifdef USE_GLTF
+	m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+#endif
+
+	m_vulkanManager.graphicsPipelineConfigureMultisampleState(m_sampleCount);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_depthPrepassPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+
+#ifdef USE_MESHLETS
+	// Its mesh shader has to compute gl_Position like the one of the geometry pass
+	if (m_vulkanManager.isMeshShaderEnabled())
+	{
+		m_vulkanManager.beginCreateGraphicsPipeline(m_geomMeshletPipelineLayout, m_depthPrepassRenderPass, 0);
+
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_TASK_BIT_EXT, "../shaders/meshlet_pass/meshlet.task.spv");
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_MESH_BIT_EXT, "../shaders/meshlet_pass/depth_prepass.mesh.spv");
+
+#ifdef USE_GLTF
+		m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+#endif
+
+		m_vulkanManager.graphicsPipelineConfigureMultisampleState(m_sampleCount);
+
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+		m_depthPrepassMeshletPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+	}
+#endif
+}
+
+void DeferredRenderer::createShadowPassPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_shadowPipelineLayout);
+		for (auto p : m_shadowPipelines)
+		{
+			m_vulkanManager.destroyPipeline(p);
+		}
+#ifdef USE_MESHLETS
+		if (m_vulkanManager.isMeshShaderEnabled())
+		{
+			m_vulkanManager.destroyPipelineLayout(m_shadowMeshletPipelineLayout);
+			for (auto p : m_shadowMeshletPipelines)
+			{
+				m_vulkanManager.destroyPipeline(p);
+			}
+		}
+#endif
+	}
+
+#ifdef USE_LAYERED_SHADOW_PASS
+	std::string vsFileName = "../shaders/shadow_pass/shadow_layered";
+	const std::string gsFileName = "../shaders/shadow_pass/shadow_layered.geom.spv";
+#else
+	std::string vsFileName = "../shaders/shadow_pass/shadow";
+#endif
+#ifdef USE_GPU_CULLING
+	vsFileName += "_indirect";
+#endif
+#ifdef USE_INSTANCING
+	vsFileName += "_instanced";
+#endif
+#ifdef USE_VERTEX_PULLING
+	vsFileName += "_pull";
+#endif
+	vsFileName += ".vert.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_shadowDescriptorSetLayout1, m_shadowDescriptorSetLayout2 });
+#ifdef USE_VERTEX_PULLING
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_vertexPullingDescriptorSetLayout });
+#endif
+	m_shadowPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+#ifdef USE_MESHLETS
+	if (m_vulkanManager.isMeshShaderEnabled())
+	{
+		m_vulkanManager.beginCreatePipelineLayout();
+		m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_shadowDescriptorSetLayout1, m_shadowDescriptorSetLayout2, m_meshletDescriptorSetLayout });
+		m_vulkanManager.pipelineLayoutAddPushConstantRange(MESHLET_PUSH_CONSTANT_OFFSET, 2 * sizeof(uint32_t), VK_SHADER_STAGE_TASK_BIT_EXT);
+		m_shadowMeshletPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+	}
+#endif
+
+	// @meshShaders: the USE_MESHLETS variant, which has no vertex input
+	auto createPipeline = [&](uint32_t i, bool meshShaders)
+	{
+#ifdef USE_MESHLETS
+		if (meshShaders)
+		{
+			m_vulkanManager.beginCreateGraphicsPipeline(m_shadowMeshletPipelineLayout, m_shadowRenderPass, i);
+			m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_TASK_BIT_EXT, "../shaders/meshlet_pass/meshlet.task.spv");
+			m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_MESH_BIT_EXT, "../shaders/meshlet_pass/shadow.mesh.spv");
+		}
+		else
+#endif
+		{
+			m_vulkanManager.beginCreateGraphicsPipeline(m_shadowPipelineLayout, m_shadowRenderPass, i);
+			m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+		}
+#ifdef USE_LAYERED_SHADOW_PASS
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_GEOMETRY_BIT, gsFileName);
+
+		// Number of layers the geometry shader emits each triangle to
+		uint32_t cascadeCount = m_camera.getSegmentCount();
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_GEOMETRY_BIT, 0, 0, sizeof(uint32_t), &cascadeCount);
+#endif
+
+#ifndef USE_VERTEX_PULLING
+		// Only the position stream
+		if (!meshShaders)
+		{
+			auto bindingDescs = GpuVertex::getBindingDescriptions();
+			m_vulkanManager.graphicsPipelineAddBindingDescription(bindingDescs[0].binding, bindingDescs[0].stride, bindingDescs[0].inputRate);
+			auto attrDescs = GpuVertex::getAttributeDescriptions();
+			m_vulkanManager.graphicsPipelineAddAttributeDescription(attrDescs[0].location, attrDescs[0].binding, attrDescs[0].format, attrDescs[0].offset);
+		}
+#endif
+
+#if defined(USE_SHADOW_ATLAS) || defined(USE_VIRTUAL_SHADOW_MAP)
+		// Set to the cascade's tile, which moves when the atlas is repacked, or with USE_VIRTUAL_SHADOW_MAP to the layer, whose
+		// size depends on the device, and the dirty pages
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+#else
+		VkExtent2D swapChainExtent = { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE };
+		m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f,
+			static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height));
+#endif
+
+		// Depth clamp flattens casters in front of the cascade's near plane onto it instead of clipping them.
+		// The bias of each cascade is set when its draws are recorded
+#ifdef USE_GLTF
+		m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, SHADOW_CULL_MODE, VK_FRONT_FACE_COUNTER_CLOCKWISE,
+			1.f, VK_TRUE, 0.f, 0.f, VK_TRUE);
+#else
+		m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, SHADOW_CULL_MODE, VK_FRONT_FACE_CLOCKWISE,
+			1.f, VK_TRUE, 0.f, 0.f, VK_TRUE);
+#endif
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_DEPTH_BIAS);
+
+		return m_vulkanManager.endCreateGraphicsPipeline();
+	};
+
+	m_shadowPipelines.resize(getShadowSubpassCount());
+	for (uint32_t i = 0; i < getShadowSubpassCount(); ++i)
+	{
+		m_shadowPipelines[i] = createPipeline(i, false);
+	}
+#ifdef USE_MESHLETS
+	if (m_vulkanManager.isMeshShaderEnabled())
+	{
+		m_shadowMeshletPipelines.resize(getShadowSubpassCount());
+		for (uint32_t i = 0; i < getShadowSubpassCount(); ++i)
+		{
+			m_shadowMeshletPipelines[i] = createPipeline(i, true);
+		}
+	}
+#endif
+}
+
+void DeferredRenderer::createLightingPassPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_lightingPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_lightingPipeline);
+#ifdef USE_MSAA_EDGE_CLASSIFICATION
+		m_vulkanManager.destroyPipeline(m_lightingEdgePipeline);
+#endif
+	}
+
+	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
+#ifdef USE_COMPACT_GBUFFER
+	std::string fsFileName = "../shaders/lighting_pass/lighting_compact";
+#else
+	std::string fsFileName = "../shaders/lighting_pass/lighting";
+#endif
+#ifdef USE_TILED_LIGHTING
+	fsFileName += "_tiled";
+#endif
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	fsFileName += "_merged";
+#endif
+#ifdef USE_GPU_SH_PROJECTION
+	fsFileName += "_gpu_sh";
+#endif
+#ifdef USE_PROBE_VOLUME
+	fsFileName += "_probe_volume";
+#endif
+#ifdef USE_EVSM_SHADOWS
+	fsFileName += "_evsm";
+#endif
+#ifdef USE_SHADOW_ATLAS
+	fsFileName += "_atlas";
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	fsFileName += "_virtual";
+#endif
+#ifdef USE_DEFERRED_SKY
+	fsFileName += "_deferred_sky";
+#endif
+#ifdef USE_SSAO
+	fsFileName += "_ssao";
+#endif
+#ifdef USE_MULTI_VIEW
+	fsFileName += "_multi_view";
+#endif
+#ifdef USE_RAY_QUERY_SHADOWS
+	if (m_useRayQueryShadows) fsFileName += "_ray_query";
+#endif
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	fsFileName += "_bloom_brightness";
+#endif
+	fsFileName += getPrecisionSuffix();
+	fsFileName += ".frag.spv";
+
+	m_vulkanManager.beginCreatePipelineLayout();
+#ifdef USE_DEFERRED_SKY
+	// The lighting shader also samples the radiance map for the sky samples of pixels that are only partly sky
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_lightingDescriptorSetLayout, m_skyboxDescriptorSetLayout });
+#else
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_lightingDescriptorSetLayout });
+#endif
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(LightingPushConstants), VK_SHADER_STAGE_FRAGMENT_BIT);
+#ifdef USE_MULTI_VIEW
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(VIEW_PUSH_CONSTANT_OFFSET, sizeof(uint32_t), VK_SHADER_STAGE_FRAGMENT_BIT); // view index
+#endif
+	m_lightingPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	// @singleSampleShading skips the per sample resolve. Only pixels whose stencil equals @stencilReference are shaded
+	auto createPipeline = [&](uint32_t singleSampleShading, uint32_t stencilReference)
+	{
+		m_vulkanManager.beginCreateGraphicsPipeline(m_lightingPipelineLayout, m_lightingRenderPass, m_lightingSubpass);
+
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+		// Use specialization constants to pass number of lights and samples to the shader
+		uint32_t numLights = NUM_LIGHTS;
+		uint32_t sampleCount = m_sampleCount;
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 0, 0, sizeof(uint32_t), &numLights);
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 1, sizeof(uint32_t), sizeof(uint32_t), &sampleCount);
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 2, 2 * sizeof(uint32_t), sizeof(uint32_t), &singleSampleShading);
+#ifdef USE_PIPELINE_PERMUTATIONS
+		// Both are fixed after startup. Changing the PCF kernel size at runtime needs this pipeline to be rebuilt
+		uint32_t segmentCount = m_camera.getSegmentCount();
+		uint32_t pcfKernelSize = m_scene.shadowLight.getPCFKernlSize();
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 3, 3 * sizeof(uint32_t), sizeof(uint32_t), &segmentCount);
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 4, 4 * sizeof(uint32_t), sizeof(uint32_t), &pcfKernelSize);
+#endif
+#ifdef USE_EVSM_SHADOWS
+		// The receiver depth is warped like the moments
+		float exponents[] = { EVSM_POSITIVE_EXPONENT, EVSM_NEGATIVE_EXPONENT };
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 5, 5 * sizeof(uint32_t), sizeof(float), &exponents[0]);
+		m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 6, 6 * sizeof(uint32_t), sizeof(float), &exponents[1]);
+#endif
+
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+		m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+#ifdef USE_LIGHTING_STENCIL
+		for (bool front : { true, false })
+		{
+			m_vulkanManager.graphicsPipelineConfigureStencilState(VK_TRUE, VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP,
+				VK_COMPARE_OP_EQUAL, stencilReference, LSB_SKY | LSB_MSAA_EDGE, 0, front);
+		}
+#endif
+
+		m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+		m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#endif
+
+		return m_vulkanManager.endCreateGraphicsPipeline();
+	};
+
+#ifdef USE_MSAA_EDGE_CLASSIFICATION
+	m_lightingPipeline = createPipeline(1, 0);
+	m_lightingEdgePipeline = createPipeline(0, LSB_MSAA_EDGE);
+#else
+	m_lightingPipeline = createPipeline(0, 0);
+#endif
+}
+
+void DeferredRenderer::createProbeCapturePipeline()
+{
+	if (m_initialized) return; // only used by the bake at startup
+
+	const std::string vsFileName = "../shaders/probe_volume/probe_capture.vert.spv";
+	const std::string gsFileName = "../shaders/probe_volume/probe_capture.geom.spv";
+	const std::string fsFileName = "../shaders/probe_volume/probe_capture.frag.spv";
+
+	// Shares the model data and albedo maps of the geometry sets
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_geomDescriptorSetLayout, m_probeCaptureDescriptorSetLayout });
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(glm::vec4) + sizeof(uint32_t), VK_SHADER_STAGE_GEOMETRY_BIT);
+	m_probeCapturePipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateGraphicsPipeline(m_probeCapturePipelineLayout, m_probeCaptureRenderPass, 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	// Emits each triangle to the 6 faces of the probe
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_GEOMETRY_BIT, gsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+	auto bindingDescs = GpuVertex::getBindingDescriptions();
+	for (const auto &desc : bindingDescs)
+	{
+		m_vulkanManager.graphicsPipelineAddBindingDescription(desc.binding, desc.stride, desc.inputRate);
+	}
+	auto attrDescs = GpuVertex::getAttributeDescriptions();
+	for (const auto &desc : attrDescs)
+	{
+		m_vulkanManager.graphicsPipelineAddAttributeDescription(desc.location, desc.binding, desc.format, desc.offset);
+	}
+
+	m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f, static_cast<float>(PROBE_CAPTURE_SIZE), static_cast<float>(PROBE_CAPTURE_SIZE));
+
+	// Probes may sit inside meshes, their back faces must still occlude the sky
+	m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+
+	m_probeCapturePipeline = m_vulkanManager.endCreateGraphicsPipeline();
+}
+
+void DeferredRenderer::createImpostorPipelines()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipeline(m_impostorPipeline);
+		for (auto p : m_impostorShadowPipelines)
+		{
+			m_vulkanManager.destroyPipeline(p);
+		}
+	}
+	else
+	{
+		// The bake only runs at startup, the quads are drawn every frame
+		m_vulkanManager.beginCreatePipelineLayout();
+		m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_geomDescriptorSetLayout });
+		m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(glm::mat4), VK_SHADER_STAGE_VERTEX_BIT);
+		m_impostorBakePipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+		m_vulkanManager.beginCreatePipelineLayout();
+		m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_impostorDescriptorSetLayout });
+		m_impostorPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+		m_vulkanManager.beginCreatePipelineLayout();
+		m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_shadowDescriptorSetLayout1, m_impostorDescriptorSetLayout });
+		m_impostorShadowPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+		// Draws the maps of the mesh set with the push constant's object space view projection, ignoring the model matrices
+		m_vulkanManager.beginCreateGraphicsPipeline(m_impostorBakePipelineLayout, m_impostorBakeRenderPass, 0);
+
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, "../shaders/impostor/impostor_bake.vert.spv");
+#if MESH_PACK_ORM
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, "../shaders/impostor/impostor_bake_orm.frag.spv");
+#else
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, "../shaders/impostor/impostor_bake.frag.spv");
+#endif
+
+		auto bindingDescs = GpuVertex::getBindingDescriptions();
+		for (const auto &desc : bindingDescs)
+		{
+			m_vulkanManager.graphicsPipelineAddBindingDescription(desc.binding, desc.stride, desc.inputRate);
+		}
+		auto attrDescs = GpuVertex::getAttributeDescriptions();
+		for (const auto &desc : attrDescs)
+		{
+			m_vulkanManager.graphicsPipelineAddAttributeDescription(desc.location, desc.binding, desc.format, desc.offset);
+		}
+
+		// One cell of the layer per view
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+#ifdef USE_GLTF
+		m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+#endif
+
+		m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+		m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+
+		m_impostorBakePipeline = m_vulkanManager.endCreateGraphicsPipeline();
+	}
+
+	// The quads write the G-buffers like the meshes, blending the three views around the view direction
+	std::string vsFileName = "../shaders/impostor/impostor";
+	std::string fsFileName = "../shaders/impostor/impostor";
+#ifdef USE_TAA
+	vsFileName += "_taa";
+	fsFileName += "_taa";
+#endif
+#ifdef USE_COMPACT_GBUFFER
+	fsFileName += "_compact";
+#endif
+	vsFileName += ".vert.spv";
+	fsFileName += ".frag.spv";
+
+	m_vulkanManager.beginCreateGraphicsPipeline(m_impostorPipelineLayout, m_geomRenderPass, 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+	// Alpha to coverage smooths the edges of the coverage, like the meshes' alpha tested maps
+	m_vulkanManager.graphicsPipelineConfigureMultisampleState(m_sampleCount, VK_TRUE, 0.25f);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#ifdef USE_TAA
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE); // motion vectors
+#endif
+
+	m_impostorPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+
+	// Depth only quads facing the light, discarding by the coverage of the view nearest to the light direction
+	m_impostorShadowPipelines.resize(getShadowSubpassCount());
+	for (uint32_t i = 0; i < getShadowSubpassCount(); ++i)
+	{
+		m_vulkanManager.beginCreateGraphicsPipeline(m_impostorShadowPipelineLayout, m_shadowRenderPass, i);
+
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, "../shaders/impostor/impostor_shadow.vert.spv");
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, "../shaders/impostor/impostor_shadow.frag.spv");
+
+#if defined(USE_SHADOW_ATLAS) || defined(USE_VIRTUAL_SHADOW_MAP)
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+#else
+		m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f, static_cast<float>(SHADOW_MAP_SIZE), static_cast<float>(SHADOW_MAP_SIZE));
+#endif
+
+		// Same bias and clamping as the shadow pipelines
+		m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE,
+			1.f, VK_TRUE, 0.f, 0.f, VK_TRUE);
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_DEPTH_BIAS);
+
+		m_impostorShadowPipelines[i] = m_vulkanManager.endCreateGraphicsPipeline();
+	}
+}
+
+void DeferredRenderer::createSkyMaskPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipeline(m_skyMaskPipeline);
+	}
+
+	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
+#ifdef USE_COMPACT_GBUFFER
+	std::string fsFileName = "../shaders/lighting_pass/sky_mask_compact";
+#else
+	std::string fsFileName = "../shaders/lighting_pass/sky_mask";
+#endif
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	fsFileName += "_merged";
+#endif
+#ifdef USE_MULTI_VIEW
+	fsFileName += "_multi_view";
+#endif
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	fsFileName += "_bloom_brightness";
+#endif
+	fsFileName += ".frag.spv";
+
+	// Shares the layout, descriptor set and push constants of the lighting pipeline. The fragment shader
+	// writes the sky color and discards every pixel that has at least one non sky sample
+	m_vulkanManager.beginCreateGraphicsPipeline(m_lightingPipelineLayout, m_lightingRenderPass, m_lightingSubpass);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+	uint32_t sampleCount = m_sampleCount;
+	m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 0, 0, sizeof(uint32_t), &sampleCount);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+	for (bool front : { true, false })
+	{
+		m_vulkanManager.graphicsPipelineConfigureStencilState(VK_TRUE, VK_STENCIL_OP_KEEP, VK_STENCIL_OP_REPLACE, VK_STENCIL_OP_KEEP,
+			VK_COMPARE_OP_ALWAYS, LSB_SKY, 0xff, LSB_SKY, front);
+	}
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#endif
+
+	m_skyMaskPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+}
+
+void DeferredRenderer::createMsaaClassificationPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipeline(m_msaaClassificationPipeline);
+	}
+
+	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
+#ifdef USE_COMPACT_GBUFFER
+	std::string fsFileName = "../shaders/lighting_pass/msaa_classify_compact";
+#else
+	std::string fsFileName = "../shaders/lighting_pass/msaa_classify";
+#endif
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	fsFileName += "_merged";
+#endif
+	fsFileName += ".frag.spv";
+
+	// Shares the layout and descriptor set of the lighting pipeline. The fragment shader compares the
+	// depth, normal and material ID of all samples and discards the pixel if they match. Color is not written
+	m_vulkanManager.beginCreateGraphicsPipeline(m_lightingPipelineLayout, m_lightingRenderPass, m_lightingSubpass);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+	uint32_t sampleCount = m_sampleCount;
+	m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 0, 0, sizeof(uint32_t), &sampleCount);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+	for (bool front : { true, false })
+	{
+		m_vulkanManager.graphicsPipelineConfigureStencilState(VK_TRUE, VK_STENCIL_OP_KEEP, VK_STENCIL_OP_REPLACE, VK_STENCIL_OP_KEEP,
+			VK_COMPARE_OP_ALWAYS, LSB_MSAA_EDGE, 0xff, LSB_MSAA_EDGE, front);
+	}
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE, VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD,
+		true, VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD, 0);
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE, VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD,
+		true, VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD, 0);
+#endif
+
+	m_msaaClassificationPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+}
+
+void DeferredRenderer::createBloomPipelines()
+{
+	if (m_initialized)
+	{
+		for (auto name : m_bloomPipelineLayouts)
+		{
+			m_vulkanManager.destroyPipelineLayout(name);
+		}
+
+		for (auto name : m_bloomPipelines)
+		{
+			m_vulkanManager.destroyPipeline(name);
+		}
+	}
+
+	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	// The lighting pass already thresholded
+	const std::string fsFileName1 = "../shaders/bloom_pass/bright_downsample" + getPrecisionSuffix() + ".frag.spv";
+#elif defined(USE_AUTO_EXPOSURE)
+	const std::string fsFileName1 = "../shaders/bloom_pass/brightness_mask_auto_exposure" + getPrecisionSuffix() + ".frag.spv";
+#else
+	const std::string fsFileName1 = "../shaders/bloom_pass/brightness_mask" + getPrecisionSuffix() + ".frag.spv";
+#endif
+	const std::string fsFileName2 = "../shaders/bloom_pass/gaussian_blur" + getPrecisionSuffix() + ".frag.spv";
+	const std::string fsFileName3 = "../shaders/bloom_pass/merge" + getPrecisionSuffix() + ".frag.spv";
+
+	// Only the merge pass is left with USE_COMPUTE_BLOOM, it adds bloom mip 0 onto the scene color.
+	// USE_FUSED_BLOOM_MERGE merges in the final output pass instead. USE_COMPUTE_BLUR leaves out the blur pipeline
+#if defined(USE_COMPUTE_BLOOM) || (defined(USE_COMPUTE_BLUR) && defined(USE_FUSED_BLOOM_MERGE))
+	m_bloomPipelineLayouts.resize(1);
+	m_bloomPipelines.resize(1);
+#elif defined(USE_COMPUTE_BLUR)
+	m_bloomPipelineLayouts.resize(1);
+	m_bloomPipelines.resize(2);
+#elif defined(USE_FUSED_BLOOM_MERGE)
+	m_bloomPipelineLayouts.resize(2);
+	m_bloomPipelines.resize(2);
+#else
+	m_bloomPipelineLayouts.resize(2);
+	m_bloomPipelines.resize(3);
+#endif
+
+	// --- Pipeline layouts
+	// brightness_mask and merge
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_bloomDescriptorSetLayout });
+#ifdef USE_DYNAMIC_RESOLUTION
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(float), VK_SHADER_STAGE_FRAGMENT_BIT); // render scale
+#endif
+	m_bloomPipelineLayouts[0] = m_vulkanManager.endCreatePipelineLayout();
+
+#if !defined(USE_COMPUTE_BLOOM) && defined(USE_COMPUTE_BLUR)
+	// The blur is a kernel of the separable blur, which outlives the bloom pipelines
+	rj::VSeparableBlur::KernelInfo blurInfo = {};
+	blurInfo.format = m_postEffectImageFormats[0];
+	blurInfo.layered = false;
+	blurInfo.radius = BLOOM_BLUR_RADIUS;
+	blurInfo.sigma = BLOOM_BLUR_SIGMA;
+	blurInfo.depthSharpness = 0.f;
+	m_bloomBlurPipeline = m_separableBlur->getKernel(blurInfo);
+#elif !defined(USE_COMPUTE_BLOOM)
+	// gaussian blur
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_bloomDescriptorSetLayout });
+#ifdef USE_DYNAMIC_RESOLUTION
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(uint32_t) + sizeof(float), VK_SHADER_STAGE_FRAGMENT_BIT); // direction, render scale
+#else
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(uint32_t), VK_SHADER_STAGE_FRAGMENT_BIT);
+#endif
+	m_bloomPipelineLayouts[1] = m_vulkanManager.endCreatePipelineLayout();
+#endif
+
+#ifndef USE_COMPUTE_BLOOM
+	// --- Pipelines
+	// brightness mask
+	m_vulkanManager.beginCreateGraphicsPipeline(m_bloomPipelineLayouts[0], m_bloomRenderPasses[0], 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName1);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+
+	m_bloomPipelines[0] = m_vulkanManager.endCreateGraphicsPipeline();
+#endif
+
+#if !defined(USE_COMPUTE_BLOOM) && !defined(USE_COMPUTE_BLUR)
+	// gaussian blur
+	m_vulkanManager.beginCreateGraphicsPipeline(m_bloomPipelineLayouts[1], m_bloomRenderPasses[0], 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName2);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+
+	m_bloomPipelines[1] = m_vulkanManager.endCreateGraphicsPipeline();
+#endif
+
+#ifndef USE_FUSED_BLOOM_MERGE
+	// merge
+	m_vulkanManager.beginCreateGraphicsPipeline(m_bloomPipelineLayouts[0], m_bloomRenderPasses.back(), 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName3);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_TRUE, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ONE, VK_BLEND_OP_ADD);
+
+	m_bloomPipelines.back() = m_vulkanManager.endCreateGraphicsPipeline();
+#endif
+}
+
+void DeferredRenderer::createFinalOutputPassPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_finalOutputPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_finalOutputPipeline);
+#ifdef USE_COLOR_LUT
+		m_vulkanManager.destroyPipeline(m_finalOutputDebugPipeline);
+#endif
+	}
+
+	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
+	// final_output[_compact][_bloom][_auto_exposure][_fp16], the LUT variant final_output_lut[_bloom][_auto_exposure][_fp16]
+	std::string fsSuffix;
+#ifdef USE_FUSED_BLOOM_MERGE
+	fsSuffix += "_bloom";
+#endif
+#ifdef USE_AUTO_EXPOSURE
+	fsSuffix += "_auto_exposure";
+#endif
+	fsSuffix += getPrecisionSuffix();
+#ifdef USE_COMPACT_GBUFFER
+	const std::string fsFileName = "../shaders/final_output_pass/final_output_compact" + fsSuffix + ".frag.spv";
+#else
+	const std::string fsFileName = "../shaders/final_output_pass/final_output" + fsSuffix + ".frag.spv";
+#endif
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_finalOutputDescriptorSetLayout });
+#ifdef USE_DYNAMIC_RESOLUTION
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(float), VK_SHADER_STAGE_FRAGMENT_BIT); // render scale
+#endif
+	m_finalOutputPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	// @colorLut fetches the tonemapped color from the LUT, which has no display modes
+	auto createPipeline = [&](const std::string &fragmentFileName, bool colorLut)
+	{
+		m_vulkanManager.beginCreateGraphicsPipeline(m_finalOutputPipelineLayout, m_finalOutputRenderPass, 0);
+
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentFileName);
+
+		uint32_t lutSize = COLOR_LUT_SIZE;
+		float evRange[] = { COLOR_LUT_MIN_EV, COLOR_LUT_MAX_EV };
+		if (colorLut)
+		{
+			m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 0, 0, sizeof(uint32_t), &lutSize);
+			m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 1, sizeof(uint32_t), sizeof(float), &evRange[0]);
+			m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 2, 2 * sizeof(uint32_t), sizeof(float), &evRange[1]);
+		}
+
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+		m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+		m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+
+		m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+
+		return m_vulkanManager.endCreateGraphicsPipeline();
+	};
+
+#ifdef USE_COLOR_LUT
+	// The G-buffer and depth bindings are only read by the debug pipeline
+	m_finalOutputPipeline = createPipeline("../shaders/final_output_pass/final_output_lut" + fsSuffix + ".frag.spv", true);
+	m_finalOutputDebugPipeline = createPipeline(fsFileName, false);
+#else
+	m_finalOutputPipeline = createPipeline(fsFileName, false);
+#endif
+}
+
+void DeferredRenderer::createTaaPipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_taaPipelineLayout);
+		m_vulkanManager.destroyPipeline(m_taaPipeline);
+	}
+
+	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	const std::string fsFileName = "../shaders/taa_pass/taa_resolve_accumulate.frag.spv";
+#else
+	const std::string fsFileName = "../shaders/taa_pass/taa_resolve.frag.spv";
+#endif
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_taaDescriptorSetLayout });
+	m_taaPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateGraphicsPipeline(m_taaPipelineLayout, m_taaRenderPass, 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+#endif
+
+	m_taaPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+}
+
+void DeferredRenderer::createLightingUpsamplePipeline()
+{
+	if (m_initialized)
+	{
+		m_vulkanManager.destroyPipelineLayout(m_lightingUpsamplePipelineLayout);
+		m_vulkanManager.destroyPipeline(m_lightingUpsamplePipeline);
+	}
+
+	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
+#ifdef USE_COMPACT_GBUFFER
+	const std::string fsFileName = "../shaders/lighting_pass/lighting_upsample_compact.frag.spv";
+#else
+	const std::string fsFileName = "../shaders/lighting_pass/lighting_upsample.frag.spv";
+#endif
+
+	m_vulkanManager.beginCreatePipelineLayout();
+	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_lightingUpsampleDescriptorSetLayout });
+#ifdef USE_DYNAMIC_RESOLUTION
+	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(float), VK_SHADER_STAGE_FRAGMENT_BIT); // render scale
+#endif
+	m_lightingUpsamplePipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+
+	m_vulkanManager.beginCreateGraphicsPipeline(m_lightingUpsamplePipelineLayout, m_lightingUpsampleRenderPass, 0);
+
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
+	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+
+	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+
+	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+
+	m_lightingUpsamplePipeline = m_vulkanManager.endCreateGraphicsPipeline();
+}
+
+void DeferredRenderer::createBrdfLutDescriptorSet()
+{
+	if (m_bakedBrdfReady) return;
+
+	std::vector<rj::DescriptorSetUpdateImageInfo> updateInfos(1);
+	updateInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+	updateInfos[0].imageViewName = m_bakedBRDFs[0].imageViews[0];
+	updateInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_brdfLutDescriptorSet);
+	m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, updateInfos);
+	m_vulkanManager.endUpdateDescriptorSet();
+}
+
+void DeferredRenderer::createColorLutDescriptorSet()
+{
+	std::vector<rj::DescriptorSetUpdateImageInfo> updateInfos(1);
+	updateInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+	updateInfos[0].imageViewName = m_colorLutImage.imageViews[0];
+	updateInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_colorLutDescriptorSet);
+	m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, updateInfos);
+	m_vulkanManager.endUpdateDescriptorSet();
+}
+
+void DeferredRenderer::createAutoExposureDescriptorSets()
+{
+#ifdef USE_TAA
+	const auto &sceneColor = m_taaResultImage;
+#else
+	const auto &sceneColor = m_lightingResultImage;
+#endif
+
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_autoExposureDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uAutoExposureInfo));
+		bufferInfos[0].sizeInBytes = sizeof(AutoExposureUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = sceneColor.imageViews[0];
+		imageInfos[0].samplerName = sceneColor.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		bufferInfos[0].bufferName = m_luminanceHistogramBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_luminanceHistogramBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_exposureBuffer.buffer;
+		bufferInfos[0].sizeInBytes = m_exposureBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createSpecEnvPrefilterDescriptorSet()
+{
+	if (m_scene.skybox.specMapReady) return;
+
+#ifdef USE_COMPUTE_ENV_PREFILTER
+	for (uint32_t level = 0; level < m_scene.skybox.specularIrradianceMap.mipLevelCount; ++level)
+	{
+		writeSpecEnvPrefilterMipDescriptorSet(level, m_scene.skybox.radianceMap, m_scene.skybox.specularIrradianceMap);
+	}
+#else
+	std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+	bufferInfos[0].bufferName = m_oneTimeUniformDeviceData.buffer;
+	bufferInfos[0].offset = m_oneTimeUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCubeViews));
+	bufferInfos[0].sizeInBytes = sizeof(CubeMapCameraUniformBuffer);
+
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfos[0].imageViewName = m_scene.skybox.radianceMap.imageViews[0];
+	imageInfos[0].samplerName = m_scene.skybox.radianceMap.samplers[0];
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_specEnvPrefilterDescriptorSet);
+	m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+	m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+	m_vulkanManager.endUpdateDescriptorSet();
+#endif
+}
+
+void DeferredRenderer::writeSpecEnvPrefilterMipDescriptorSet(uint32_t level, const rj::helper_functions::ImageWrapper &radianceMap,
+	const rj::helper_functions::ImageWrapper &specMap)
+{
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_specEnvPrefilterMipDescriptorSets[level]);
+
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfos[0].imageViewName = radianceMap.imageViews[0];
+	imageInfos[0].samplerName = radianceMap.samplers[0];
+	m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+	imageInfos[0].imageViewName = specMap.imageViews[level + 1];
+	imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+	m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+
+	m_vulkanManager.endUpdateDescriptorSet();
+}
+
+void DeferredRenderer::createGeomPassDescriptorSets()
+{
+	createSkyboxDescriptorSet();
+	createStaticMeshDescriptorSet();
+}
+
+void DeferredRenderer::createSkyboxDescriptorSet()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		writeSkyboxDescriptorSet(imgIdx);
+	}
+}
+
+void DeferredRenderer::writeSkyboxDescriptorSet(uint32_t imgIdx)
+{
+	std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+	bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+	bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCameraVP));
+	bufferInfos[0].sizeInBytes = sizeof(DisplayInfoUniformBuffer);
+
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfos[0].imageViewName = m_scene.skybox.radianceMap.imageViews[0];
+	imageInfos[0].samplerName = m_scene.skybox.radianceMap.samplers[0];
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_skyboxDescriptorSet);
+	m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+	m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+	m_vulkanManager.endUpdateDescriptorSet();
+}
+
+void DeferredRenderer::createStaticMeshDescriptorSet()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+#ifdef USE_BINDLESS_MATERIALS
+	const std::vector<rj::DescriptorSetUpdateImageInfo> textureInfos = getMaterialTextureInfos();
+
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[0]);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCameraVP));
+		bufferInfos[0].sizeInBytes = sizeof(TransMatsUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_perFrameInstanceBuffers[imgIdx].buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_perFrameInstanceBuffers[imgIdx].size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+#else
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		for (uint32_t i = 0; i < m_scene.meshes.size(); ++i)
+		{
+			writeStaticMeshDescriptorSet(imgIdx, i);
+		}
+	}
+#endif
+#ifdef USE_MATERIAL_UPDATES
+	m_perFrameMaterialSyncedVersions.assign(swapChainImageCount, m_materialsVersion);
+#endif
+}
+
+std::vector<rj::DescriptorSetUpdateImageInfo> DeferredRenderer::getMaterialTextureInfos() const
+{
+	const uint32_t textureCount = static_cast<uint32_t>(m_scene.meshes.size()) * VMesh::numMapsPerMesh;
+	if (textureCount > MAX_BINDLESS_TEXTURES)
+	{
+		throw std::runtime_error("scene has more material textures than MAX_BINDLESS_TEXTURES");
+	}
+
+	// Meshes without an AO or emissive map reuse their albedo map
+	std::vector<rj::DescriptorSetUpdateImageInfo> textureInfos;
+	textureInfos.reserve(textureCount);
+	for (const auto &mesh : m_scene.meshes)
+	{
+		const auto &emissiveMap = mesh.emissiveMap.image == std::numeric_limits<uint32_t>::max() ? mesh.albedoMap : mesh.emissiveMap;
+#if MESH_PACK_ORM
+		for (const auto *map : { &mesh.albedoMap, &mesh.normalMap, &mesh.ormMap, &emissiveMap })
+#else
+		const auto &aoMap = mesh.hasAoMap() ? mesh.aoMap : mesh.albedoMap;
+		for (const auto *map : { &mesh.albedoMap, &mesh.normalMap, &mesh.roughnessMap, &mesh.metalnessMap, &aoMap, &emissiveMap })
+#endif
+		{
+			textureInfos.push_back({ VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, map->imageViews[0], map->samplers[0] });
+		}
+	}
+	return textureInfos;
+}
+
+void DeferredRenderer::writeStaticMeshDescriptorSet(uint32_t imgIdx, uint32_t meshIdx)
+{
+	const auto &mesh = m_scene.meshes[meshIdx];
+
+	// Every mesh set is written with the same bindings, so with descriptor update templates they all share one
+	rj::PushDescriptorWrite writes[12];
+	uint32_t writeCount = 0;
+	auto addBuffer = [&](uint32_t binding, VkDescriptorType type, uint32_t buffer, VkDeviceSize offset, VkDeviceSize size)
+	{
+		writes[writeCount] = {};
+		writes[writeCount].binding = binding;
+		writes[writeCount].type = type;
+		writes[writeCount].bufferInfo = { buffer, offset, size };
+		++writeCount;
+	};
+	auto addMap = [&](uint32_t binding, const rj::helper_functions::ImageWrapper &map)
+	{
+		writes[writeCount] = {};
+		writes[writeCount].binding = binding;
+		writes[writeCount].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[writeCount].imageInfo = { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, map.imageViews[0], map.samplers[0] };
+		++writeCount;
+	};
+
+	addBuffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_perFrameUniformDeviceData[imgIdx].buffer,
+		m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCameraVP)), sizeof(TransMatsUniformBuffer));
+#ifdef USE_INSTANCING
+	addBuffer(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_perFrameInstanceBuffers[imgIdx].buffer, 0, m_perFrameInstanceBuffers[imgIdx].size);
+#else
+	addBuffer(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_perFrameUniformDeviceData[imgIdx].buffer,
+		m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(mesh.uPerModelInfo)), sizeof(PerModelUniformBuffer));
+#endif
+
+	const auto &emissiveMap = mesh.emissiveMap.image == std::numeric_limits<uint32_t>::max() ? mesh.albedoMap : mesh.emissiveMap;
+	addMap(2, mesh.albedoMap);
+	addMap(3, mesh.normalMap);
+#if MESH_PACK_ORM
+	addMap(4, mesh.ormMap);
+	addMap(5, emissiveMap);
+#else
+	addMap(4, mesh.roughnessMap);
+	addMap(5, mesh.metalnessMap);
+	addMap(6, mesh.hasAoMap() ? mesh.aoMap : mesh.albedoMap);
+	addMap(7, emissiveMap);
+#endif
+
+#ifdef USE_VIRTUAL_TEXTURING
+	for (const auto &binding : { std::make_pair(8u, &m_perFrameVirtualPageTableBuffers[imgIdx]), std::make_pair(9u, &m_perFrameVirtualMapBuffers[imgIdx]),
+		std::make_pair(10u, &m_perFrameVirtualFeedbackBuffers[imgIdx]) })
+	{
+		addBuffer(binding.first, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, binding.second->buffer, 0, binding.second->size);
+	}
+	addBuffer(11, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_perFrameUniformDeviceData[imgIdx].buffer,
+		m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uVirtualTextureInfo)), sizeof(VirtualTextureUniformBuffer));
+#endif
+
+	const uint32_t setName = m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[meshIdx];
+	const rj::ArrayView<rj::PushDescriptorWrite> writeView(writes, writeCount);
+	if (m_vulkanManager.isDescriptorUpdateTemplateEnabled())
+	{
+		if (m_geomDescriptorUpdateTemplate == std::numeric_limits<uint32_t>::max())
+		{
+			m_geomDescriptorUpdateTemplate = m_vulkanManager.createDescriptorUpdateTemplate(m_geomDescriptorSetLayout, writeView);
+		}
+		m_vulkanManager.writeDescriptorSetWithTemplate(setName, m_geomDescriptorUpdateTemplate, writeView);
+	}
+	else
+	{
+		m_vulkanManager.writeDescriptorSet(setName, writeView);
+	}
+}
+
+void DeferredRenderer::createShadowPassDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		for (uint32_t i = 0; i < getShadowSubpassCount(); ++i)
+		{
+			std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+
+			m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[i]);
+
+			bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+#ifdef USE_LAYERED_SHADOW_PASS
+			bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uShadowCascades));
+			bufferInfos[0].sizeInBytes = sizeof(ShadowCascadesUniformBuffer);
+#else
+			bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uShadowLightInfos[i]));
+			bufferInfos[0].sizeInBytes = sizeof(ShadowLightUniformBuffer);
+#endif
+			m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+			m_vulkanManager.endUpdateDescriptorSet();
+		}
+
+#ifdef USE_GPU_CULLING
+		{
+			std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+
+			m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[0]);
+
+			bufferInfos[0].bufferName = m_perFrameMeshInfoBuffers[imgIdx].buffer;
+			bufferInfos[0].offset = 0;
+			bufferInfos[0].sizeInBytes = m_perFrameMeshInfoBuffers[imgIdx].size;
+			m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+			m_vulkanManager.endUpdateDescriptorSet();
+		}
+#elif defined(USE_INSTANCING)
+		{
+			std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+
+			m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[0]);
+
+			bufferInfos[0].bufferName = m_perFrameInstanceBuffers[imgIdx].buffer;
+			bufferInfos[0].offset = 0;
+			bufferInfos[0].sizeInBytes = m_perFrameInstanceBuffers[imgIdx].size;
+			m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+			m_vulkanManager.endUpdateDescriptorSet();
+		}
+#else
+		{
+			std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+
+			m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[0]);
+
+			// The dynamic offset of each draw is added to this
+			bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+			bufferInfos[0].offset = 0;
+			bufferInfos[0].sizeInBytes = sizeof(PerModelUniformBuffer);
+			m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, bufferInfos);
+
+			m_vulkanManager.endUpdateDescriptorSet();
+		}
+#endif
+	}
+}
+
+void DeferredRenderer::createLightingPassDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_lightingDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uLightInfo));
+		bufferInfos[0].sizeInBytes = sizeof(LightingPassUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uLightStaticInfo));
+		bufferInfos[0].sizeInBytes = sizeof(LightingStaticUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(15, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+		// Input attachments in the layouts of the lighting subpass, without samplers
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		for (uint32_t i = 0; i < m_numGBuffers; ++i)
+		{
+			imageInfos[0].imageViewName = m_gbufferImages[i].imageViews[0];
+			imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+			m_vulkanManager.descriptorSetAddImageDescriptor(1 + i, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, imageInfos);
+		}
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = m_depthImage.imageViews[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, imageInfos);
+#elif !defined(USE_FORWARD_PLUS)
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = m_gbufferImages[0].imageViews[0];
+		imageInfos[0].samplerName = m_gbufferImages[0].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_gbufferImages[1].imageViews[0];
+		imageInfos[0].samplerName = m_gbufferImages[1].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_gbufferImages[2].imageViews[0];
+		imageInfos[0].samplerName = m_gbufferImages[2].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_depthImage.imageViews[0];
+		imageInfos[0].samplerName = m_depthImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+#endif
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+#ifndef USE_ASYNC_IBL_PRECOMPUTE
+		imageInfos[0].imageViewName = m_scene.skybox.specularIrradianceMap.imageViews[0];
+		imageInfos[0].samplerName = m_scene.skybox.specularIrradianceMap.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_bakedBRDFs[0].imageViews[0];
+		imageInfos[0].samplerName = m_bakedBRDFs[0].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+#endif
+
+#ifdef USE_EVSM_SHADOWS
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = m_shadowMomentImage.imageViews.back();
+		imageInfos[0].samplerName = m_shadowMomentImage.samplers[0];
+#else
+		imageInfos[0].imageViewName = m_shadowImage.imageViews.back();
+		imageInfos[0].samplerName = m_shadowImage.samplers[0];
+#endif
+		m_vulkanManager.descriptorSetAddImageDescriptor(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+#ifdef USE_TILED_LIGHTING
+		bufferInfos[0].bufferName = m_perFrameLightBuffers[imgIdx].buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_perFrameLightBuffers[imgIdx].size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_lightTileBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_lightTileBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uLightCullingInfo));
+		bufferInfos[0].sizeInBytes = sizeof(LightCullingUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(10, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+#endif
+
+#ifdef USE_GPU_SH_PROJECTION
+		bufferInfos[0].bufferName = m_diffuseSHBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_diffuseSHBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(11, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+#endif
+
+#ifdef USE_PROBE_VOLUME
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			imageInfos[0].imageViewName = m_probeVolumeImages[i].imageViews[0];
+			imageInfos[0].samplerName = m_probeVolumeImages[i].samplers[0];
+			m_vulkanManager.descriptorSetAddImageDescriptor(12 + i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		}
+#endif
+
+#ifdef USE_SSAO
+		// The vertical blur leaves its result in the first image
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = m_ssaoImages[0].imageViews[0];
+		imageInfos[0].samplerName = m_ssaoImages[0].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(16, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+#endif
+
+#ifdef USE_RAY_QUERY_SHADOWS
+		if (m_useRayQueryShadows)
+		{
+			m_vulkanManager.descriptorSetAddAccelerationStructureDescriptor(17, m_perFrameTlases[imgIdx]);
+		}
+#endif
+
+		m_vulkanManager.endUpdateDescriptorSet();
+
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+		writeLightingIblDescriptors(imgIdx);
+#endif
+	}
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+	m_perFrameIblSyncedVersions.assign(swapChainImageCount, m_iblVersion);
+#endif
+}
+
+void DeferredRenderer::writeLightingIblDescriptors(uint32_t imgIdx)
+{
+	// The mips of the radiance map are box filtered, which is close enough for the first frames
+	const auto &specMap = m_scene.skybox.specMapReady ? m_scene.skybox.specularIrradianceMap : m_scene.skybox.radianceMap;
+	const auto &brdfLut = m_bakedBrdfReady ? m_bakedBRDFs[0] : m_fallbackBrdfLut;
+
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_lightingDescriptorSet);
+
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfos[0].imageViewName = specMap.imageViews[0];
+	imageInfos[0].samplerName = specMap.samplers[0];
+	m_vulkanManager.descriptorSetAddImageDescriptor(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+	imageInfos[0].imageViewName = brdfLut.imageViews[0];
+	imageInfos[0].samplerName = brdfLut.samplers[0];
+	m_vulkanManager.descriptorSetAddImageDescriptor(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+	m_vulkanManager.endUpdateDescriptorSet();
+}
+
+void DeferredRenderer::createLightCullingDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_lightCullingDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uLightCullingInfo));
+		bufferInfos[0].sizeInBytes = sizeof(LightCullingUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = m_depthImage.imageViews[0];
+		imageInfos[0].samplerName = m_depthImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		bufferInfos[0].bufferName = m_perFrameLightBuffers[imgIdx].buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_perFrameLightBuffers[imgIdx].size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_lightTileBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_lightTileBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createShadowPageMarkDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_shadowPageMarkDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uShadowPageMarkInfo));
+		bufferInfos[0].sizeInBytes = sizeof(ShadowPageMarkUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		// Resolved to the nearest sample, the farther samples of edge pixels may fall back to a coarser cascade
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = getSampledDepthImage().imageViews[0];
+		imageInfos[0].samplerName = getSampledDepthImage().samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		bufferInfos[0].bufferName = m_perFrameShadowPageRequestBuffers[imgIdx].buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_perFrameShadowPageRequestBuffers[imgIdx].size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createSsaoDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+		// SSAO into image 0, horizontal blur into image 1, vertical blur back into image 0
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			const auto &src = m_ssaoImages[(i + 1) % 2];
+			const auto &dst = m_ssaoImages[i % 2];
+
+			m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_ssaoDescriptorSets[i]);
+
+			bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+			bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uSsaoInfo));
+			bufferInfos[0].sizeInBytes = sizeof(SsaoUniformBuffer);
+			m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+			imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfos[0].imageViewName = getSampledDepthImage().imageViews[0];
+			imageInfos[0].samplerName = getSampledDepthImage().samplers[0];
+			m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+			imageInfos[0].imageViewName = m_gbufferImages[0].imageViews[0];
+			imageInfos[0].samplerName = m_gbufferImages[0].samplers[0];
+			m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+			imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+			imageInfos[0].imageViewName = src.imageViews[0];
+			imageInfos[0].samplerName = src.samplers[0];
+			m_vulkanManager.descriptorSetAddImageDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+			imageInfos[0].imageViewName = dst.imageViews[0];
+			imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+			m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+
+			m_vulkanManager.endUpdateDescriptorSet();
+		}
+	}
+
+#ifdef USE_COMPUTE_BLUR
+	// The blurs of all frames: horizontal into image 1, vertical back into image 0
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		m_separableBlur->writeDescriptorSet(m_ssaoBlurDescriptorSets[i], m_ssaoImages[i].imageViews[0], m_ssaoImages[i].samplers[0],
+			VK_IMAGE_LAYOUT_GENERAL, m_ssaoImages[(i + 1) % 2].imageViews[0]);
+	}
+#endif
+}
+
+void DeferredRenderer::createGpuCullingDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_gpuCullingDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uGpuCullingInfo));
+		bufferInfos[0].sizeInBytes = sizeof(GpuCullingUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_perFrameMeshInfoBuffers[imgIdx].buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_perFrameMeshInfoBuffers[imgIdx].size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_indirectDrawBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_indirectDrawBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+#ifdef USE_HIZ_OCCLUSION_CULLING
+		bufferInfos[0].bufferName = m_meshVisibilityBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_meshVisibilityBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = m_hiZImage.imageViews.back();
+		imageInfos[0].samplerName = m_hiZImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+#endif
+
+#ifdef USE_MESHLETS
+		bufferInfos[0].bufferName = m_meshletTaskBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_meshletTaskBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+#endif
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createMeshletDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		auto addStorageBuffer = [&](uint32_t binding, uint32_t bufferName, VkDeviceSize size)
+		{
+			bufferInfos[0].bufferName = bufferName;
+			bufferInfos[0].offset = 0;
+			bufferInfos[0].sizeInBytes = size;
+			m_vulkanManager.descriptorSetAddBufferDescriptor(binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+		};
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_meshletDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uGpuCullingInfo));
+		bufferInfos[0].sizeInBytes = sizeof(GpuCullingUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		addStorageBuffer(1, m_perFrameMeshInfoBuffers[imgIdx].buffer, m_perFrameMeshInfoBuffers[imgIdx].size);
+		addStorageBuffer(2, m_meshletBuffer.buffer, m_meshletBuffer.size);
+
+		if (m_vulkanManager.isMeshShaderEnabled())
+		{
+			addStorageBuffer(3, m_meshletVertexBuffer.buffer, m_meshletVertexBuffer.size);
+			addStorageBuffer(4, m_meshletTriangleBuffer.buffer, m_meshletTriangleBuffer.size);
+			addStorageBuffer(5, m_vulkanManager.getGeometryPoolPositionBuffer(), VK_WHOLE_SIZE);
+			addStorageBuffer(6, m_vulkanManager.getGeometryPoolAttributeBuffer(), VK_WHOLE_SIZE);
+		}
+		else
+		{
+			addStorageBuffer(7, m_meshletTaskBuffer.buffer, m_meshletTaskBuffer.size);
+			addStorageBuffer(8, m_meshletDrawBuffer.buffer, m_meshletDrawBuffer.size);
+		}
+
+#ifdef USE_HIZ_OCCLUSION_CULLING
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = m_hiZImage.imageViews.back();
+		imageInfos[0].samplerName = m_hiZImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(9, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+#endif
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createVertexPullingDescriptorSets()
+{
+	std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+	bufferInfos[0].offset = 0;
+
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_vertexPullingDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameMeshInfoBuffers[imgIdx].buffer;
+		bufferInfos[0].sizeInBytes = m_perFrameMeshInfoBuffers[imgIdx].size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_vulkanManager.getGeometryPoolPositionBuffer();
+		bufferInfos[0].sizeInBytes = VK_WHOLE_SIZE;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_vulkanManager.getGeometryPoolAttributeBuffer();
+		m_vulkanManager.descriptorSetAddBufferDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createSkinningDescriptorSets()
+{
+	std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+	bufferInfos[0].offset = 0;
+
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_skinningDescriptorSet);
+
+		bufferInfos[0].bufferName = m_vulkanManager.getGeometryPoolPositionBuffer();
+		bufferInfos[0].sizeInBytes = VK_WHOLE_SIZE;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_vulkanManager.getGeometryPoolAttributeBuffer();
+		m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_skinVertexBuffer.buffer;
+		bufferInfos[0].sizeInBytes = m_skinVertexBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_morphDeltaBuffer.buffer;
+		bufferInfos[0].sizeInBytes = m_morphDeltaBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_perFrameSkinningBuffers[imgIdx].buffer;
+		bufferInfos[0].sizeInBytes = m_perFrameSkinningBuffers[imgIdx].size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createHiZDescriptorSets()
+{
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+	for (uint32_t level = 0; level < m_hiZImage.mipLevelCount; ++level)
+	{
+		m_vulkanManager.beginUpdateDescriptorSet(m_hiZDescriptorSets[level]);
+
+		if (level == 0)
+		{
+			imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfos[0].imageViewName = getSampledDepthImage(true).imageViews[0];
+			imageInfos[0].samplerName = getSampledDepthImage(true).samplers[0];
+		}
+		else
+		{
+			imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+			imageInfos[0].imageViewName = m_hiZImage.imageViews[level - 1];
+			imageInfos[0].samplerName = m_hiZImage.samplers[0];
+		}
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = m_hiZImage.imageViews[level];
+		imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createShadingRateDescriptorSet()
+{
+	if (!m_vulkanManager.isFragmentShadingRateEnabled()) return;
+
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_shadingRateDescriptorSet);
+
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfos[0].imageViewName = m_lightingResultImage.imageViews[0];
+	imageInfos[0].samplerName = m_lightingResultImage.samplers[0];
+	m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+	// Any valid image without USE_TAA
+#ifdef USE_TAA
+	imageInfos[0].imageViewName = m_motionVectorImage.imageViews[0];
+	imageInfos[0].samplerName = m_motionVectorImage.samplers[0];
+#endif
+	m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+	imageInfos[0].imageViewName = m_shadingRateImage.imageViews[0];
+	imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+	m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+
+	m_vulkanManager.endUpdateDescriptorSet();
+}
+
+void DeferredRenderer::createMaterialDescriptorSets()
+{
+	const std::vector<rj::DescriptorSetUpdateImageInfo> textureInfos = getMaterialTextureInfos();
+
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_materialDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCameraVP));
+		bufferInfos[0].sizeInBytes = sizeof(TransMatsUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_indirectDrawBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_indirectDrawBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_vulkanManager.getGeometryPoolIndexBuffer();
+		bufferInfos[0].sizeInBytes = VK_WHOLE_SIZE;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = m_visibilityImage.imageViews[0];
+		imageInfos[0].samplerName = m_visibilityImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+		for (uint32_t i = 0; i < m_numGBuffers; ++i)
+		{
+			imageInfos[0].imageViewName = m_gbufferImages[i].imageViews[0];
+			m_vulkanManager.descriptorSetAddImageDescriptor(5 + i, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+		}
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createShadowMomentDescriptorSets()
+{
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+	auto writeSet = [&](uint32_t set, const rj::helper_functions::ImageWrapper &src, uint32_t srcView, uint32_t srcSampler,
+		VkImageLayout srcLayout, const rj::helper_functions::ImageWrapper &dst, uint32_t dstLevel)
+	{
+		m_vulkanManager.beginUpdateDescriptorSet(set);
+
+		imageInfos[0].layout = srcLayout;
+		imageInfos[0].imageViewName = src.imageViews[srcView];
+		imageInfos[0].samplerName = src.samplers[srcSampler];
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = dst.imageViews[dstLevel];
+		imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	};
+
+	const uint32_t shadowArrayView = static_cast<uint32_t>(m_shadowImage.imageViews.size()) - 1;
+	writeSet(m_shadowMomentDescriptorSets[0], m_shadowImage, shadowArrayView, 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_shadowMomentImage, 0);
+	writeSet(m_shadowMomentDescriptorSets[1], m_shadowMomentImage, 0, 0, VK_IMAGE_LAYOUT_GENERAL, m_shadowMomentBlurImage, 0);
+	writeSet(m_shadowMomentDescriptorSets[2], m_shadowMomentBlurImage, 0, 0, VK_IMAGE_LAYOUT_GENERAL, m_shadowMomentImage, 0);
+	for (uint32_t level = 1; level < m_shadowMomentImage.mipLevelCount; ++level)
+	{
+		writeSet(m_shadowMomentDescriptorSets[2 + level], m_shadowMomentImage, level - 1, 0, VK_IMAGE_LAYOUT_GENERAL, m_shadowMomentImage, level);
+	}
+}
+
+void DeferredRenderer::createBloomDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+#ifdef USE_COMPUTE_BLOOM
+		// merge
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[0]);
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = m_bloomMipImage.imageViews[0];
+		imageInfos[0].samplerName = m_bloomMipImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		m_vulkanManager.endUpdateDescriptorSet();
+#else
+		// Bloom runs on the TAA resolved image when TAA is enabled
+#ifdef USE_TAA
+		const auto &bloomInput = m_taaResultImage;
+#else
+		const auto &bloomInput = m_lightingResultImage;
+#endif
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[0]);
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+		imageInfos[0].imageViewName = m_bloomBrightImage.imageViews[0];
+		imageInfos[0].samplerName = m_bloomBrightImage.samplers[0];
+#else
+		imageInfos[0].imageViewName = bloomInput.imageViews[0];
+		imageInfos[0].samplerName = bloomInput.samplers[0];
+#endif
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		m_vulkanManager.endUpdateDescriptorSet();
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[1]);
+		imageInfos[0].imageViewName = m_postEffectImages[0].imageViews[0];
+		imageInfos[0].samplerName = m_postEffectImages[0].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		m_vulkanManager.endUpdateDescriptorSet();
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[2]);
+		imageInfos[0].imageViewName = m_postEffectImages[1].imageViews[0];
+		imageInfos[0].samplerName = m_postEffectImages[1].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		m_vulkanManager.endUpdateDescriptorSet();
+#endif
+
+#ifdef USE_AUTO_EXPOSURE
+		// Only read by the brightness mask, the other bloom shaders leave it unused
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		bufferInfos[0].bufferName = m_exposureBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_exposureBuffer.size;
+		for (auto set : m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets)
+		{
+			m_vulkanManager.beginUpdateDescriptorSet(set);
+			m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+			m_vulkanManager.endUpdateDescriptorSet();
+		}
+#endif
+	}
+
+#if defined(USE_COMPUTE_BLUR) && !defined(USE_COMPUTE_BLOOM)
+	// The blurs of all frames: horizontal into post effect image 1, vertical back into image 0. Each source is in the layout
+	// of its render graph access
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		m_separableBlur->writeDescriptorSet(m_bloomBlurDescriptorSets[i], m_postEffectImages[i].imageViews[0],
+			m_postEffectImages[i].samplers[0], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_postEffectImages[(i + 1) % 2].imageViews[0]);
+	}
+#endif
+}
+
+void DeferredRenderer::createBloomComputeDescriptorSets()
+{
+#ifdef USE_TAA
+	const auto &bloomInput = m_taaResultImage;
+#else
+	const auto &bloomInput = m_lightingResultImage;
+#endif
+
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+	// Downsample: scene color for mip 0, the previous mip otherwise
+	for (uint32_t level = 0; level < m_bloomMipImage.mipLevelCount; ++level)
+	{
+		m_vulkanManager.beginUpdateDescriptorSet(m_bloomDownsampleDescriptorSets[level]);
+
+		if (level == 0)
+		{
+			imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfos[0].imageViewName = bloomInput.imageViews[0];
+			imageInfos[0].samplerName = bloomInput.samplers[0];
+		}
+		else
+		{
+			imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+			imageInfos[0].imageViewName = m_bloomMipImage.imageViews[level - 1];
+			imageInfos[0].samplerName = m_bloomMipImage.samplers[0];
+		}
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = m_bloomMipImage.imageViews[level];
+		imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+
+#ifdef USE_AUTO_EXPOSURE
+		// Only read by the prefilter of level 0, the other levels leave it unused
+		if (level == 0)
+		{
+			std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+			bufferInfos[0].bufferName = m_exposureBuffer.buffer;
+			bufferInfos[0].offset = 0;
+			bufferInfos[0].sizeInBytes = m_exposureBuffer.size;
+			m_vulkanManager.descriptorSetAddBufferDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+		}
+#endif
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+
+	// Upsample: mip level + 1 is filtered and added onto mip level
+	for (uint32_t level = 0; level < m_bloomMipImage.mipLevelCount - 1; ++level)
+	{
+		m_vulkanManager.beginUpdateDescriptorSet(m_bloomUpsampleDescriptorSets[level]);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = m_bloomMipImage.imageViews[level + 1];
+		imageInfos[0].samplerName = m_bloomMipImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_bloomMipImage.imageViews[level];
+		imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createShProjectionDescriptorSet()
+{
+	if (m_scene.skybox.diffuseSHReady) return;
+
+	std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_shProjectionDescriptorSet);
+
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfos[0].imageViewName = m_scene.skybox.radianceMap.imageViews[0];
+	imageInfos[0].samplerName = m_scene.skybox.radianceMap.samplers[0];
+	m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+	bufferInfos[0].bufferName = m_shPartialSumBuffer.buffer;
+	bufferInfos[0].offset = 0;
+	bufferInfos[0].sizeInBytes = m_shPartialSumBuffer.size;
+	m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+	bufferInfos[0].bufferName = m_diffuseSHBuffer.buffer;
+	bufferInfos[0].offset = 0;
+	bufferInfos[0].sizeInBytes = m_diffuseSHBuffer.size;
+	m_vulkanManager.descriptorSetAddBufferDescriptor(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+	m_vulkanManager.endUpdateDescriptorSet();
+}
+
+void DeferredRenderer::createProbeVolumeDescriptorSets()
+{
+	if (m_probeVolumeBaked) return;
+
+	std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_probeCaptureDescriptorSet);
+
+	bufferInfos[0].bufferName = m_probeCaptureSHBuffer.buffer;
+	bufferInfos[0].offset = 0;
+	bufferInfos[0].sizeInBytes = m_probeCaptureSHBuffer.size;
+	m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+	m_vulkanManager.endUpdateDescriptorSet();
+
+	m_vulkanManager.beginUpdateDescriptorSet(m_probeProjectionDescriptorSet);
+
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfos[0].imageViewName = m_probeCaptureImage.imageViews[0];
+	imageInfos[0].samplerName = m_probeCaptureImage.samplers[0];
+	m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+	imageInfos[0].imageViewName = m_scene.skybox.radianceMap.imageViews[0];
+	imageInfos[0].samplerName = m_scene.skybox.radianceMap.samplers[0];
+	m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+	imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+	imageInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		imageInfos[0].imageViewName = m_probeVolumeImages[i].imageViews[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(2 + i, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageInfos);
+	}
+
+	m_vulkanManager.endUpdateDescriptorSet();
+}
+
+void DeferredRenderer::createImpostorDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_impostorDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCameraVP));
+		bufferInfos[0].sizeInBytes = sizeof(TransMatsUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		bufferInfos[0].bufferName = m_perFrameImpostorInstanceBuffers[imgIdx].buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_perFrameImpostorInstanceBuffers[imgIdx].size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = m_impostorAlbedoImage.imageViews[0];
+		imageInfos[0].samplerName = m_impostorAlbedoImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_impostorNormalDepthImage.imageViews[0];
+		imageInfos[0].samplerName = m_impostorNormalDepthImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createFinalOutputPassDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_finalOutputDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uDisplayInfo));
+		bufferInfos[0].sizeInBytes = sizeof(DisplayInfoUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+#ifdef USE_TAA
+		imageInfos[0].imageViewName = m_taaResultImage.imageViews[0];
+		imageInfos[0].samplerName = m_taaResultImage.samplers[0];
+#else
+		imageInfos[0].imageViewName = m_lightingResultImage.imageViews[0];
+		imageInfos[0].samplerName = m_lightingResultImage.samplers[0];
+#endif
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+#if defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_FORWARD_PLUS)
+		// G-buffers are transient and cannot be sampled, or do not exist. The debug display modes show the image of binding 0
+		for (uint32_t i = 0; i < m_numGBuffers; ++i)
+		{
+			m_vulkanManager.descriptorSetAddImageDescriptor(1 + i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		}
+#else
+		imageInfos[0].imageViewName = m_gbufferImages[0].imageViews[0];
+		imageInfos[0].samplerName = m_gbufferImages[0].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_gbufferImages[1].imageViews[0];
+		imageInfos[0].samplerName = m_gbufferImages[1].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_gbufferImages[2].imageViews[0];
+		imageInfos[0].samplerName = m_gbufferImages[2].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+#endif
+
+		imageInfos[0].imageViewName = m_depthImage.imageViews[0];
+		imageInfos[0].samplerName = m_depthImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+#if defined(USE_FUSED_BLOOM_MERGE) && defined(USE_COMPUTE_BLOOM)
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[0].imageViewName = m_bloomMipImage.imageViews[0];
+		imageInfos[0].samplerName = m_bloomMipImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+#elif defined(USE_FUSED_BLOOM_MERGE)
+		imageInfos[0].imageViewName = m_postEffectImages[0].imageViews[0];
+		imageInfos[0].samplerName = m_postEffectImages[0].samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+#endif
+
+#ifdef USE_COLOR_LUT
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = m_colorLutImage.imageViews[0];
+		imageInfos[0].samplerName = m_colorLutImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+#endif
+
+#ifdef USE_AUTO_EXPOSURE
+		bufferInfos[0].bufferName = m_exposureBuffer.buffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].sizeInBytes = m_exposureBuffer.size;
+		m_vulkanManager.descriptorSetAddBufferDescriptor(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferInfos);
+#endif
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createTaaDescriptorSets()
+{
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_taaDescriptorSet);
+
+		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
+		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uTaaInfo));
+		bufferInfos[0].sizeInBytes = sizeof(TaaUniformBuffer);
+		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = m_lightingResultImage.imageViews[0];
+		imageInfos[0].samplerName = m_lightingResultImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_taaHistoryImage.imageViews[0];
+		imageInfos[0].samplerName = m_taaHistoryImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_depthImage.imageViews[0];
+		imageInfos[0].samplerName = m_depthImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		imageInfos[0].imageViewName = m_motionVectorImage.imageViews[0];
+		imageInfos[0].samplerName = m_motionVectorImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
+}
+
+void DeferredRenderer::createBrdfLutCommandBuffer()
+{
+	if (m_bakedBrdfReady) return;
+
+	m_vulkanManager.queueWaitIdle(VK_QUEUE_COMPUTE_BIT);
+
+	m_vulkanManager.beginCommandBuffer(m_brdfLutCommandBuffer);
+
+	m_vulkanManager.cmdBindPipeline(m_brdfLutCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_brdfLutPipeline);
+	m_vulkanManager.cmdBindDescriptorSets(m_brdfLutCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_brdfLutPipelineLayout, { m_brdfLutDescriptorSet });
+
+	const uint32_t bsx = 16, bsy = 16;
+	const uint32_t brdfLutSizeX = BRDF_LUT_SIZE, brdfLutSizeY = BRDF_LUT_SIZE;
+	m_vulkanManager.cmdDispatch(m_brdfLutCommandBuffer, brdfLutSizeX / bsx, brdfLutSizeY / bsy, 1);
+
+	m_vulkanManager.endCommandBuffer(m_brdfLutCommandBuffer);
+}
+
+void DeferredRenderer::createEnvPrefilterCommandBuffer()
+{
+	if (m_scene.skybox.specMapReady) return;
+
+	m_vulkanManager.beginCommandBuffer(m_envPrefilterCommandBuffer);
+
+#ifdef USE_COMPUTE_ENV_PREFILTER
+	const auto &specMap = m_scene.skybox.specularIrradianceMap;
+	m_vulkanManager.cmdImageBarrier(m_envPrefilterCommandBuffer, specMap.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_ACCESS_SHADER_WRITE_BIT);
+
+	m_vulkanManager.cmdBindPipeline(m_envPrefilterCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_specEnvPrefilterPipeline);
+
+	// Mips only read the radiance map, so the dispatches don't wait on each other
+	for (uint32_t level = 0; level < specMap.mipLevelCount; ++level)
+	{
+		recordSpecEnvPrefilterDispatch(m_envPrefilterCommandBuffer, level, specMap.mipLevelCount, specMap.width, 0, 6);
+	}
+
+	m_vulkanManager.cmdImageBarrier(m_envPrefilterCommandBuffer, specMap.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+#else
+	const auto &skyboxGeometry = m_scene.skybox.geometry;
+#if MESH_MIXED_VERTEX_FORMATS
+	m_vulkanManager.cmdBindVertexBuffers(m_envPrefilterCommandBuffer,
+		{ m_vulkanManager.getGeometryPoolPositionBuffer(), m_vulkanManager.getGeometryPoolAttributeBuffer() },
+		{ skyboxGeometry.positionOffset, skyboxGeometry.attributeOffset });
+#else
+	m_vulkanManager.cmdBindVertexBuffers(m_envPrefilterCommandBuffer,
+		{ m_vulkanManager.getGeometryPoolPositionBuffer(), m_vulkanManager.getGeometryPoolAttributeBuffer() }, { 0, 0 });
+#endif
+	m_vulkanManager.cmdBindIndexBuffer(m_envPrefilterCommandBuffer, m_vulkanManager.getGeometryPoolIndexBuffer(skyboxGeometry.indexType),
+		skyboxGeometry.indexType);
+
+	std::vector<VkClearValue> clearValues(1);
+	clearValues[0].color = { { 0.f, 0.f, 0.f, 0.f } };
+
+	// Specular prefitler pass
+	uint32_t mipLevels = m_scene.skybox.specularIrradianceMap.mipLevelCount;
+	float roughness = 0.f;
+	float roughnessDelta = 1.f / static_cast<float>(mipLevels - 1);
+
+	// Layered rendering allows render into multiple layers but only one mip level
+	// In order to render all mips, multiple passes are required
+	for (uint32_t level = 0; level < mipLevels; ++level)
+	{
+		m_vulkanManager.cmdBeginRenderPass(m_envPrefilterCommandBuffer, m_specEnvPrefilterRenderPass, m_specEnvPrefilterFramebuffers[level], clearValues);
+
+		m_vulkanManager.cmdBindPipeline(m_envPrefilterCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_specEnvPrefilterPipeline);
+
+		m_vulkanManager.cmdBindDescriptorSets(m_envPrefilterCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_specEnvPrefilterPipelineLayout, { m_specEnvPrefilterDescriptorSet });
+		m_vulkanManager.cmdPushConstants(m_envPrefilterCommandBuffer, m_specEnvPrefilterPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &roughness);
+
+		m_vulkanManager.cmdSetViewport(m_envPrefilterCommandBuffer, m_specEnvPrefilterFramebuffers[level]);
+		m_vulkanManager.cmdSetScissor(m_envPrefilterCommandBuffer, m_specEnvPrefilterFramebuffers[level]);
+
+		m_vulkanManager.cmdDrawIndexed(m_envPrefilterCommandBuffer, skyboxGeometry.indexCount, 1, skyboxGeometry.firstIndex, skyboxGeometry.vertexOffset);
+
+		m_vulkanManager.cmdEndRenderPass(m_envPrefilterCommandBuffer);
+
+		roughness += roughnessDelta;
+	}
+#endif
+
+	m_vulkanManager.endCommandBuffer(m_envPrefilterCommandBuffer);
+}
+
+void DeferredRenderer::recordSpecEnvPrefilterDispatch(uint32_t cb, uint32_t level, uint32_t mipLevelCount, uint32_t width,
+	uint32_t firstFace, uint32_t faceCount)
+{
+	const float roughness = static_cast<float>(level) / static_cast<float>(mipLevelCount - 1);
+
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_specEnvPrefilterPipelineLayout,
+		{ m_specEnvPrefilterMipDescriptorSets[level] });
+
+#ifdef USE_PROBE_SWITCHING
+	struct
+	{
+		float roughness;
+		uint32_t firstFace;
+	} pushConst = { roughness, firstFace };
+#else
+	assert(firstFace == 0 && faceCount == 6);
+	const float pushConst = roughness;
+#endif
+	m_vulkanManager.cmdPushConstants(cb, m_specEnvPrefilterPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConst), &pushConst);
+
+	const uint32_t size = std::max(width >> level, 1u);
+	const uint32_t groupCount = (size + ENV_PREFILTER_GROUP_SIZE - 1) / ENV_PREFILTER_GROUP_SIZE;
+	m_vulkanManager.cmdDispatch(cb, groupCount, groupCount, faceCount);
+}
+
+void DeferredRenderer::createShProjectionCommandBuffer()
+{
+	if (m_scene.skybox.diffuseSHReady) return;
+
+	m_vulkanManager.beginCommandBuffer(m_shProjectionCommandBuffer);
+
+	m_vulkanManager.cmdBindDescriptorSets(m_shProjectionCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_shProjectionPipelineLayout,
+		{ m_shProjectionDescriptorSet });
+
+	// One partial sum per tile of each face
+	m_vulkanManager.cmdBindPipeline(m_shProjectionCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_shProjectionPipeline);
+	m_vulkanManager.cmdDispatch(m_shProjectionCommandBuffer, m_shProjectionGroupCount, m_shProjectionGroupCount, 6);
+
+	m_vulkanManager.cmdMemoryBarrier(m_shProjectionCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	m_vulkanManager.cmdBindPipeline(m_shProjectionCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_shReducePipeline);
+	m_vulkanManager.cmdDispatch(m_shProjectionCommandBuffer, 1, 1, 1);
+
+	// Read by the lighting pass
+	m_vulkanManager.cmdMemoryBarrier(m_shProjectionCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	m_vulkanManager.endCommandBuffer(m_shProjectionCommandBuffer);
+}
+
+void DeferredRenderer::createProbeVolumeCommandBuffer()
+{
+	if (m_probeVolumeBaked) return;
+
+	const uint32_t cb = m_probeVolumeCommandBuffer;
+	const uint32_t gridSize = PROBE_VOLUME_GRID_SIZE;
+	const uint32_t probeCount = gridSize * gridSize * gridSize;
+	const glm::vec3 cellSize = (m_probeVolumeBounds.max - m_probeVolumeBounds.min) / static_cast<float>(gridSize);
+	// Nothing further away than the diagonal of the volume is captured
+	const float farPlane = glm::length(m_probeVolumeBounds.max - m_probeVolumeBounds.min);
+
+	m_vulkanManager.beginCommandBuffer(cb);
+
+	for (const auto &volume : m_probeVolumeImages)
+	{
+		m_vulkanManager.cmdImageBarrier(cb, volume.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	rj::VBindCache binds(&m_vulkanManager, cb);
+
+	std::vector<VkClearValue> clearValues(2);
+	clearValues[0].color = { { 0.f, 0.f, 0.f, 0.f } };
+	clearValues[1].depthStencil = { 1.f, 0 };
+
+	for (uint32_t firstProbe = 0; firstProbe < probeCount; firstProbe += PROBE_CAPTURE_BATCH_SIZE)
+	{
+		const uint32_t batchSize = std::min<uint32_t>(PROBE_CAPTURE_BATCH_SIZE, probeCount - firstProbe);
+
+		m_vulkanManager.cmdBeginRenderPass(cb, m_probeCaptureRenderPass, m_probeCaptureFramebuffer, clearValues);
+
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_probeCapturePipeline);
+		binds.bindVertexBuffers({ m_vulkanManager.getGeometryPoolPositionBuffer(), m_vulkanManager.getGeometryPoolAttributeBuffer() }, { 0, 0 });
+
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			// Probes sit at the cell centers, x varies fastest
+			const uint32_t p = firstProbe + i;
+			const glm::uvec3 cell(p % gridSize, (p / gridSize) % gridSize, p / (gridSize * gridSize));
+			struct
+			{
+				glm::vec4 position; // w is the far plane
+				uint32_t firstLayer;
+			} pushConst;
+			pushConst.position = glm::vec4(m_probeVolumeBounds.min + (glm::vec3(cell) + 0.5f) * cellSize, farPlane);
+			pushConst.firstLayer = 6 * i;
+			m_vulkanManager.cmdPushConstants(cb, m_probeCapturePipelineLayout, VK_SHADER_STAGE_GEOMETRY_BIT, 0, sizeof(pushConst), &pushConst);
+
+			// The coarsest LOD is plenty for a PROBE_CAPTURE_SIZE capture
+			for (uint32_t j = 0; j < m_scene.meshes.size(); ++j)
+			{
+				const auto &mesh = m_scene.meshes[j];
+				if (!mesh.isLoaded()) continue;
+
+				binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_probeCapturePipelineLayout,
+					{ m_perFrameDescriptorSets[0].m_geomDescriptorSets[j], m_probeCaptureDescriptorSet });
+
+				const auto &geometry = mesh.lods.back();
+				binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(geometry.indexType), geometry.indexType);
+				m_vulkanManager.cmdDrawIndexed(cb, geometry.indexCount, 1, geometry.firstIndex, geometry.vertexOffset);
+			}
+		}
+
+		m_vulkanManager.cmdEndRenderPass(cb);
+
+		// One work group per probe of the batch writes its texel of each volume
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE, m_probeProjectionPipeline);
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE, m_probeProjectionPipelineLayout, { m_probeProjectionDescriptorSet });
+		m_vulkanManager.cmdPushConstants(cb, m_probeProjectionPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &firstProbe);
+		m_vulkanManager.cmdDispatch(cb, batchSize, 1, 1);
+	}
+
+	// Sampled by the lighting pass from now on
+	for (const auto &volume : m_probeVolumeImages)
+	{
+		m_vulkanManager.cmdImageBarrier(cb, volume.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+
+	m_vulkanManager.endCommandBuffer(cb);
+}
+
+void DeferredRenderer::createImpostorBakeCommandBuffer()
+{
+	if (m_impostorsBaked) return;
+
+	const uint32_t cb = m_impostorBakeCommandBuffer;
+	const float viewSize = static_cast<float>(IMPOSTOR_VIEW_SIZE);
+
+	m_vulkanManager.beginCommandBuffer(cb);
+
+	rj::VBindCache binds(&m_vulkanManager, cb);
+
+	std::vector<VkClearValue> clearValues(3);
+	clearValues[0].color = { { 0.f, 0.f, 0.f, 0.f } };
+	clearValues[1].color = { { 0.f, 0.f, 0.f, 1.f } };
+	clearValues[2].depthStencil = { 1.f, 0 };
+
+	for (uint32_t j = 0; j < m_scene.meshes.size(); ++j)
+	{
+		const uint32_t layer = m_impostorLayers[j];
+		if (layer == std::numeric_limits<uint32_t>::max()) continue;
+
+		m_vulkanManager.cmdBeginRenderPass(cb, m_impostorBakeRenderPass, m_impostorBakeFramebuffers[layer], clearValues);
+
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_impostorBakePipeline);
+		binds.bindVertexBuffers({ m_vulkanManager.getGeometryPoolPositionBuffer(), m_vulkanManager.getGeometryPoolAttributeBuffer() }, { 0, 0 });
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_impostorBakePipelineLayout, { m_perFrameDescriptorSets[0].m_geomDescriptorSets[j] });
+
+		// The coarsest LOD is plenty for an IMPOSTOR_VIEW_SIZE view
+		const auto &geometry = m_scene.meshes[j].lods.back();
+		binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(geometry.indexType), geometry.indexType);
+
+		const glm::vec3 center(m_impostorBounds[layer]);
+		const float radius = m_impostorBounds[layer].w;
+		for (uint32_t y = 0; y < IMPOSTOR_VIEWS_PER_SIDE; ++y)
+		{
+			for (uint32_t x = 0; x < IMPOSTOR_VIEWS_PER_SIDE; ++x)
+			{
+				// Octahedral decode of the cell center, the whole sphere of directions over the grid
+				const glm::vec2 f = (glm::vec2(x, y) + 0.5f) / static_cast<float>(IMPOSTOR_VIEWS_PER_SIDE) * 2.f - 1.f;
+				glm::vec3 dir(f.x, f.y, 1.f - std::abs(f.x) - std::abs(f.y));
+				const float t = std::max(-dir.z, 0.f);
+				dir.x += dir.x >= 0.f ? -t : t;
+				dir.y += dir.y >= 0.f ? -t : t;
+				dir = glm::normalize(dir);
+
+				// Orthographic around the bounding sphere, depth 0 at the sphere's near side and 1 at its far side
+				const glm::vec3 up = std::abs(dir.y) > 0.99f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(0.f, 1.f, 0.f);
+				const glm::mat4 V = glm::lookAt(center + dir * radius, center, up);
+				const glm::mat4 VP = glm::ortho(-radius, radius, -radius, radius, 0.f, 2.f * radius) * V;
+				m_vulkanManager.cmdPushConstants(cb, m_impostorBakePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VP), &VP);
+
+				m_vulkanManager.cmdSetViewport(cb, x * viewSize, y * viewSize, viewSize, viewSize);
+				m_vulkanManager.cmdSetScissor(cb, static_cast<int32_t>(x * IMPOSTOR_VIEW_SIZE), static_cast<int32_t>(y * IMPOSTOR_VIEW_SIZE),
+					IMPOSTOR_VIEW_SIZE, IMPOSTOR_VIEW_SIZE);
+				m_vulkanManager.cmdDrawIndexed(cb, geometry.indexCount, 1, geometry.firstIndex, geometry.vertexOffset);
+			}
+		}
+
+		m_vulkanManager.cmdEndRenderPass(cb);
+	}
+
+	m_vulkanManager.endCommandBuffer(cb);
+}
+
+void DeferredRenderer::initVisibleMeshes()
+{
+	updateDrawRecords();
+
+	// Draw everything until the first culling result is available
+	if (m_visibleShadowCasters.size() != getShadowSubpassCount())
+	{
+		m_visibleMeshes.resize(m_scene.meshes.size());
+		for (uint32_t j = 0; j < m_visibleMeshes.size(); ++j) m_visibleMeshes[j] = j;
+		m_visibleShadowCasters.assign(getShadowSubpassCount(), m_visibleMeshes);
+		m_meshLods.assign(m_scene.meshes.size(), 0);
+		m_shadowCasterLods.assign(getShadowSubpassCount(), m_meshLods);
+	}
+}
+
+void DeferredRenderer::recordDirtyCommandBuffers(uint32_t imgIdx)
+{
+	auto &cbs = m_perFrameCommandBuffers[imgIdx];
+	if (cbs.m_dirtyMask == 0) return;
+
+	TRACE_CPU_SCOPE("record command buffers");
+	if ((cbs.m_dirtyMask & CB_DIRTY_GEOM_SHADOW_LIGHTING) && !m_recordCommandBuffersPerFrame)
+	{
+		recordGeomShadowLightingCommandBuffer(imgIdx, cbs.m_geomShadowLightingCommandBuffer, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
+		cbs.m_recordedVisibilityVersion = m_visibilityVersion;
+		cbs.m_recordedDepthPrepass = m_useDepthPrepass;
+		cbs.m_recordedShadingRateMode = m_shadingRateMode;
+#ifdef USE_RAY_QUERY_SHADOWS
+		if (m_useRayQueryShadows) cbs.m_recordedTlasBuild = m_perFrameTlasBuilds[imgIdx];
+#endif
+		cbs.m_dirtyMask &= ~CB_DIRTY_GEOM_SHADOW_LIGHTING;
+	}
+	if (cbs.m_dirtyMask & CB_DIRTY_POST_EFFECT)
+	{
+		recordPostEffectCommandBuffer(imgIdx);
+		cbs.m_dirtyMask &= ~CB_DIRTY_POST_EFFECT;
+	}
+	if (cbs.m_dirtyMask & CB_DIRTY_PRESENT)
+	{
+		recordPresentCommandBuffer(imgIdx);
+		cbs.m_dirtyMask &= ~CB_DIRTY_PRESENT;
+	}
+}
+
+void DeferredRenderer::recordGeomShadowLightingCommandBuffer(uint32_t imgIdx, uint32_t cb, VkCommandBufferUsageFlags usage)
+{
+	m_vulkanManager.beginCommandBuffer(cb, usage);
+
+#ifdef USE_FORWARD_PLUS
+	// Lights are binned against the pre-pass depth
+	const bool depthPrepass = true;
+#else
+	const bool depthPrepass = m_useDepthPrepass;
+#endif
+
+	m_geomPassBinds.reset();
+	m_shadowPassBinds.reset();
+
+	const bool useSecondaries = SCENE_RECORDING_THREAD_COUNT > 1;
+	const VkSubpassContents subpassContents = useSecondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+
+	auto recordShadowPass = [&]()
+	{
+#ifdef USE_RAY_QUERY_SHADOWS
+		// The lighting pass traces against this image's instances instead, which are only built when they changed
+		if (m_useRayQueryShadows)
+		{
+			if (m_perFrameTlasBuilds[imgIdx] != TLAS_BUILD_NONE)
+			{
+				m_gpuProfiler.beginScope(cb, imgIdx, "tlas");
+				m_vulkanManager.cmdBuildTopLevelAccelerationStructure(cb, m_perFrameTlases[imgIdx], m_perFrameTlasInstanceBuffers[imgIdx].buffer,
+					m_perFrameTlasInstanceCounts[imgIdx], m_perFrameTlasBuilds[imgIdx] == TLAS_BUILD_REFIT);
+				m_gpuProfiler.endScope(cb, imgIdx);
+			}
+			return;
+		}
+#endif
+
+		m_gpuProfiler.beginScope(cb, imgIdx, "shadow", true);
+
+		// Shadow maps are loaded, subpasses of cascades that are not updated this frame stay empty
+		m_vulkanManager.cmdBeginRenderPass(cb, m_shadowRenderPass, m_shadowFramebuffer, {}, {}, subpassContents);
+
+		for (uint32_t i = 0; i < getShadowSubpassCount(); ++i)
+		{
+			if (i > 0) m_vulkanManager.cmdNextSubpass(cb, subpassContents);
+
+			// Subpasses with secondary contents take no timestamps, their cascade scopes are written by the secondaries
+			if (useSecondaries)
+			{
+				uint32_t secondaries[2 * SCENE_RECORDING_THREAD_COUNT];
+				const uint32_t secondaryCount = getSceneSecondaryCommandBuffers(imgIdx, i + 1, secondaries);
+				m_vulkanManager.cmdExecuteCommands(cb, rj::ArrayView<uint32_t>(secondaries, secondaryCount));
+				continue;
+			}
+
+			m_gpuProfiler.beginScope(cb, imgIdx, getShadowSubpassScopeName(i));
+			if (isShadowSubpassUpdated(i))
+			{
+				recordShadowPassDraws(cb, imgIdx, i, m_visibleShadowCasters[i].data(), static_cast<uint32_t>(m_visibleShadowCasters[i].size()), true);
+			}
+			m_gpuProfiler.endScope(cb, imgIdx);
+		}
+
+		m_vulkanManager.cmdEndRenderPass(cb);
+
+#ifdef USE_EVSM_SHADOWS
+		m_gpuProfiler.beginScope(cb, imgIdx, "shadow moments");
+		recordShadowMoments(cb);
+		m_gpuProfiler.endScope(cb, imgIdx);
+#endif
+
+		m_gpuProfiler.endScope(cb, imgIdx);
+	};
+
+	m_gpuProfiler.cmdResetQueries(cb, imgIdx);
+
+#ifdef USE_GPU_SKINNING
+	// Every pass below draws the animated vertices of this frame
+	if (!m_skinnedMeshes.empty())
+	{
+		m_gpuProfiler.beginScope(cb, imgIdx, "skinning");
+		recordSkinning(cb, imgIdx);
+		m_gpuProfiler.endScope(cb, imgIdx);
+	}
+#endif
+
+#ifdef USE_GPU_CULLING
+	m_gpuProfiler.beginScope(cb, imgIdx, "culling");
+	recordGpuCulling(cb, imgIdx);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
+
+	// At most depth, three g-buffers, motion vectors, the lighting result and its stencil
+	VkClearValue clearValues[7] = {};
+	uint32_t clearValueCount = 0;
+	clearValues[clearValueCount++].depthStencil = { 1.0f, 0 };
+#ifdef USE_FORWARD_PLUS
+	clearValues[clearValueCount++].color = { { 0.f, 0.f, 0.f, 0.f } }; // lighting result, multisampled with MSAA
+#elif defined(USE_VISIBILITY_BUFFER)
+	clearValues[clearValueCount++].color.uint32[0] = std::numeric_limits<uint32_t>::max(); // visibility buffer, no triangle
+#else
+	clearValues[clearValueCount++].color = { { 0.0f, 0.0f, 0.0f, 0.0f } }; // g-buffer 1
+	clearValues[clearValueCount++].color = { { 0.0f, 0.0f, 0.0f, 0.0f } }; // g-buffer 2
+	clearValues[clearValueCount++].color = { { 0.0f, 0.0f, 0.0f, 0.0f } }; // g-buffer 3
+#endif
+#ifdef USE_TAA
+	clearValues[clearValueCount++].color = { { 0.0f, 0.0f, 0.0f, 0.0f } }; // motion vectors
+#endif
+
+	if (useSecondaries)
+	{
+		recordSceneSecondaryCommandBuffers(imgIdx, depthPrepass);
+	}
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	// The lighting subpass samples the shadow maps, so they have to be rendered before the merged pass
+	recordShadowPass();
+
+	clearValues[clearValueCount++].color = { { 0.f, 0.f, 0.f, 0.f } }; // lighting result
+#ifdef USE_LIGHTING_STENCIL
+	clearValues[clearValueCount++].depthStencil = { 1.0f, 0 };
+#endif
+#endif
+
+	// The merged pass switches from geometry to lighting inside one render pass instance, which statistics queries cannot follow
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	const bool passStatistics = false;
+#else
+	const bool passStatistics = true;
+#endif
+
+	// Depth pre-pass. Always recorded inline, its draws are cheap to record
+	auto recordDepthPrepass = [&]()
+	{
+		m_gpuProfiler.beginScope(cb, imgIdx, "depth prepass");
+		m_vulkanManager.cmdBeginRenderPass(cb, m_depthPrepassRenderPass, m_depthPrepassFramebuffer, { clearValues[0] });
+#ifdef USE_MULTI_VIEW
+		for (uint32_t v = 0; v < m_viewCount; ++v)
+		{
+			const auto &meshes = getViewMeshes(v);
+			recordDepthPrepassDraws(cb, imgIdx, meshes.data(), static_cast<uint32_t>(meshes.size()), v);
+		}
+#else
+		recordDepthPrepassDraws(cb, imgIdx, m_visibleMeshes.data(), static_cast<uint32_t>(m_visibleMeshes.size()));
+#endif
+		m_vulkanManager.cmdEndRenderPass(cb);
+		m_gpuProfiler.endScope(cb, imgIdx);
+	};
+
+#ifdef USE_FORWARD_PLUS
+	// The geometry pass shades with the lights binned against the pre-pass depth and samples the shadow maps
+	recordDepthPrepass();
+
+	m_gpuProfiler.beginScope(cb, imgIdx, "light culling");
+	recordLightCulling(cb, imgIdx);
+	m_gpuProfiler.endScope(cb, imgIdx);
+
+	recordShadowPass();
+
+	m_gpuProfiler.beginScope(cb, imgIdx, "geometry", passStatistics);
+#else
+	m_gpuProfiler.beginScope(cb, imgIdx, "geometry", passStatistics);
+
+	if (depthPrepass) recordDepthPrepass();
+#endif
+
+	m_vulkanManager.cmdBeginRenderPass(cb, depthPrepass ? m_geomAfterPrepassRenderPass : m_geomRenderPass, m_geomFramebuffer,
+		rj::ArrayView<VkClearValue>(clearValues, clearValueCount), {}, subpassContents);
+
+	// Geometry pass
+	if (useSecondaries)
+	{
+		uint32_t secondaries[2 * SCENE_RECORDING_THREAD_COUNT];
+		const uint32_t secondaryCount = getSceneSecondaryCommandBuffers(imgIdx, 0, secondaries);
+		m_vulkanManager.cmdExecuteCommands(cb, rj::ArrayView<uint32_t>(secondaries, secondaryCount));
+	}
+	else
+	{
+#ifdef USE_MULTI_VIEW
+		// The sky box only shows in the perspective view
+		for (uint32_t v = 0; v < m_viewCount; ++v)
+		{
+			const auto &meshes = getViewMeshes(v);
+			recordGeomPassDraws(cb, imgIdx, meshes.data(), static_cast<uint32_t>(meshes.size()), v == 0, 0, depthPrepass, v);
+		}
+#else
+		recordGeomPassDraws(cb, imgIdx, m_visibleMeshes.data(), static_cast<uint32_t>(m_visibleMeshes.size()), true, 0, depthPrepass);
+#endif
+	}
+
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	// Timestamps can only be written in subpasses with inline contents
+	m_vulkanManager.cmdNextSubpass(cb, VK_SUBPASS_CONTENTS_INLINE);
+
+	m_gpuProfiler.endScope(cb, imgIdx);
+	m_gpuProfiler.beginScope(cb, imgIdx, "lighting", passStatistics);
+#else
+	// The subpass that resolves the farthest depth sample draws nothing
+	if (getDepthMaxResolveMode() != VK_RESOLVE_MODE_NONE_KHR) m_vulkanManager.cmdNextSubpass(cb, VK_SUBPASS_CONTENTS_INLINE);
+	m_vulkanManager.cmdEndRenderPass(cb);
+
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	// Test the remaining meshes against the depth of the early pass and draw the ones that became visible.
+	// Secondary command buffers only hold the early pass, the late pass is always recorded inline.
+	// These meshes are not in the pre-pass depth, so they are drawn with the depth writing pipelines
+	m_gpuProfiler.beginScope(cb, imgIdx, "late");
+	recordHiZBuild(cb);
+	recordGpuCulling(cb, imgIdx, true);
+
+	m_vulkanManager.cmdBeginRenderPass(cb, m_geomLateRenderPass, m_geomFramebuffer, {});
+	recordGeomPassDraws(cb, imgIdx, m_visibleMeshes.data(), static_cast<uint32_t>(m_visibleMeshes.size()), false, 1 + CSM_MAX_SEG_COUNT);
+	if (getDepthMaxResolveMode() != VK_RESOLVE_MODE_NONE_KHR) m_vulkanManager.cmdNextSubpass(cb, VK_SUBPASS_CONTENTS_INLINE);
+	m_vulkanManager.cmdEndRenderPass(cb);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
+
+	m_gpuProfiler.endScope(cb, imgIdx);
+
+#ifdef USE_VISIBILITY_BUFFER
+	m_gpuProfiler.beginScope(cb, imgIdx, "material");
+	recordMaterialPass(cb, imgIdx);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
+
+#ifdef USE_SSAO
+	// Nothing in the shadow pass waits for it, so the GPU may run both at the same time
+	m_gpuProfiler.beginScope(cb, imgIdx, "ssao");
+	recordSsao(cb, imgIdx);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
+
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	// Pages requested now are bound a few frames later, when the host has read them back
+	m_gpuProfiler.beginScope(cb, imgIdx, "shadow page mark");
+	recordShadowPageMark(cb, imgIdx);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
+
+#ifndef USE_FORWARD_PLUS
+	// Shadow pass
+	recordShadowPass();
+
+	// Lighting pass
+	m_gpuProfiler.beginScope(cb, imgIdx, "lighting", passStatistics);
+
+#ifdef USE_SSAO
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+#endif
+
+#ifdef USE_TILED_LIGHTING
+	m_gpuProfiler.beginScope(cb, imgIdx, "light culling");
+	recordLightCulling(cb, imgIdx);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
+
+	clearValueCount = 0;
+	clearValues[clearValueCount++].color = { { 0.f, 0.f, 0.f, 0.f } };
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	clearValues[clearValueCount++].color = { { 0.f, 0.f, 0.f, 0.f } };
+#endif
+#ifdef USE_LIGHTING_STENCIL
+	clearValues[clearValueCount++].depthStencil = { 1.0f, 0 };
+#endif
+	m_vulkanManager.cmdBeginRenderPass(cb, m_lightingRenderPass, m_lightingFramebuffer, rj::ArrayView<VkClearValue>(clearValues, clearValueCount));
+#endif
+#endif
+
+#ifndef USE_FORWARD_PLUS
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_lightingPipeline);
+#ifndef USE_MULTI_VIEW
+	m_vulkanManager.cmdSetViewport(cb, m_lightingFramebuffer, 0.f, 0.f, m_renderScale, m_renderScale);
+	m_vulkanManager.cmdSetScissor(cb, m_lightingFramebuffer, 0.f, 0.f, m_renderScale, m_renderScale);
+#endif
+#ifdef USE_DEFERRED_SKY
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_lightingPipelineLayout,
+		{ m_perFrameDescriptorSets[imgIdx].m_lightingDescriptorSet, m_perFrameDescriptorSets[imgIdx].m_skyboxDescriptorSet });
+#else
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_lightingPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_lightingDescriptorSet });
+#endif
+
+	pushLightingConstants(cb, m_lightingPipelineLayout, 0);
+
+#ifndef USE_MERGED_GEOMETRY_LIGHTING
+	// Each G-buffer texel and depth sample is fetched once, whole images even when only the scaled part is lit
+	for (const auto &gbuffer : m_gbufferImages) m_vulkanManager.cmdCountImageTraffic(cb, gbuffer.image, false);
+	m_vulkanManager.cmdCountImageTraffic(cb, m_depthImage.image, false);
+#endif
+
+#ifdef USE_MULTI_VIEW
+	// Each view is lit in its own part of the extent with its own camera
+	for (uint32_t v = 0; v < m_viewCount; ++v)
+	{
+		cmdBeginView(cb, m_lightingFramebuffer, m_lightingPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, v);
+#endif
+
+#ifdef USE_SKY_STENCIL_MASK
+	// Shade and tag sky pixels first. Viewport, scissor, descriptor set and push constants stay bound
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_skyMaskPipeline);
+	m_vulkanManager.cmdDraw(cb, 3);
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_lightingPipeline);
+#endif
+#ifdef USE_MSAA_EDGE_CLASSIFICATION
+	// Tag edge pixels, then shade interior pixels with a single sample and edge pixels per sample
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_msaaClassificationPipeline);
+	m_vulkanManager.cmdDraw(cb, 3);
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_lightingPipeline);
+#endif
+
+	m_vulkanManager.cmdDraw(cb, 3);
+
+#ifdef USE_MSAA_EDGE_CLASSIFICATION
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_lightingEdgePipeline);
+	m_vulkanManager.cmdDraw(cb, 3);
+#if defined(USE_MULTI_VIEW) && !defined(USE_DEFERRED_SKY)
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_lightingPipeline);
+#endif
+#endif
+
+#ifdef USE_DEFERRED_SKY
+	// Fill the pixels the lighting draw skipped. The sky only shows in the perspective view
+#ifdef USE_MULTI_VIEW
+	if (v == 0)
+#endif
+	{
+		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_skyboxPipeline);
+		m_vulkanManager.cmdDraw(cb, 3);
+	}
+#ifdef USE_MULTI_VIEW
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_lightingPipeline);
+#endif
+#endif
+
+#ifdef USE_MULTI_VIEW
+	}
+#endif
+
+	m_vulkanManager.cmdEndRenderPass(cb);
+
+#ifdef USE_HALF_RES_LIGHTING
+	m_gpuProfiler.beginScope(cb, imgIdx, "upsample");
+	recordLightingUpsample(cb, imgIdx);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
+
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif // !USE_FORWARD_PLUS
+
+#ifdef USE_VARIABLE_RATE_SHADING
+	if (m_vulkanManager.isFragmentShadingRateEnabled())
+	{
+		m_gpuProfiler.beginScope(cb, imgIdx, "shading rate");
+		recordShadingRate(cb);
+		m_gpuProfiler.endScope(cb, imgIdx);
+	}
+#endif
+
+	m_vulkanManager.endCommandBuffer(cb);
+}
+
+void DeferredRenderer::recordGeomPassDraws(uint32_t cb, uint32_t imgIdx, const uint32_t *meshes, uint32_t meshCount, bool drawSkybox, uint32_t drawList,
+	bool depthEqual, uint32_t viewIdx)
+{
+	rj::VBindCache binds(&m_vulkanManager, cb);
+
+	// Secondary command buffers don't inherit dynamic state
+#ifdef USE_MULTI_VIEW
+	cmdBeginView(cb, m_geomFramebuffer, m_geomPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, viewIdx);
+#else
+	m_vulkanManager.cmdSetViewport(cb, m_geomFramebuffer, 0.f, 0.f, m_renderScale, m_renderScale);
+	m_vulkanManager.cmdSetScissor(cb, m_geomFramebuffer, 0.f, 0.f, m_renderScale, m_renderScale);
+#endif
+
+	// The skybox and all meshes live in the geometry pool, draws only rebind the index buffer if their index type differs.
+	// With USE_VERTEX_PULLING only the skybox takes vertex input
+#if MESH_MIXED_VERTEX_FORMATS
+	// Its range has no vertex offset, the streams are bound at its first vertex
+	binds.bindVertexBuffers({ m_vulkanManager.getGeometryPoolPositionBuffer(), m_vulkanManager.getGeometryPoolAttributeBuffer() },
+		{ m_scene.skybox.geometry.positionOffset, m_scene.skybox.geometry.attributeOffset });
+#else
+	binds.bindVertexBuffers({ m_vulkanManager.getGeometryPoolPositionBuffer(), m_vulkanManager.getGeometryPoolAttributeBuffer() }, { 0, 0 });
+#endif
+
+#ifdef USE_IMPOSTORS
+	const bool drawImpostors = drawSkybox; // once, with the first chunk
+#endif
+#ifdef USE_DEFERRED_SKY
+	drawSkybox = false; // drawn after the lighting draw
+#endif
+	if (drawSkybox)
+	{
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_skyboxPipeline);
+
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_skyboxPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_skyboxDescriptorSet });
+		m_vulkanManager.cmdPushConstants(cb, m_skyboxPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &m_scene.skybox.materialType);
+
+		const auto &geometry = m_scene.skybox.geometry;
+		binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(geometry.indexType), geometry.indexType);
+		m_vulkanManager.cmdDrawIndexed(cb, geometry.indexCount, 1, geometry.firstIndex, geometry.vertexOffset);
+	}
+
+#ifdef USE_PIPELINE_PERMUTATIONS
+	const auto &pipelineVariants = depthEqual ? m_geomDepthEqualPipelineVariants : m_geomPipelineVariants;
+#else
+	binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, depthEqual ? m_geomDepthEqualPipeline : m_geomPipeline);
+#endif
 
-		m_geomFramebuffer = m_vulkanManager.createFramebuffer(m_geomRenderPass, attachmentViews);
+#ifdef USE_VERTEX_PULLING
+	binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_geomPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_vertexPullingDescriptorSet }, 1);
+#endif
+
+#ifdef USE_BINDLESS_MATERIALS
+	binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_geomPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[0] });
+#endif
+
+#ifdef USE_FORWARD_PLUS
+	// The lights, tiles and shadow maps the meshes are shaded with. The sky box has a layout of its own and needs none of them
+#ifdef USE_VERTEX_PULLING
+	const uint32_t lightingSetIndex = 2;
+#else
+	const uint32_t lightingSetIndex = 1;
+#endif
+	binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_geomPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_lightingDescriptorSet }, lightingSetIndex);
+	pushLightingConstants(cb, m_geomPipelineLayout, FORWARD_PUSH_CONSTANT_OFFSET);
+#endif
+
+#ifdef USE_VISIBILITY_BUFFER
+	// Only the camera of the geometry sets is read and there are no material constants, so the meshes, consecutive with
+	// USE_GPU_CULLING, are one multi draw
+	if (meshCount > 0)
+	{
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_geomPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[0] });
+		binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(), VK_INDEX_TYPE_UINT32);
+		const VkDeviceSize listOffset = drawList * m_scene.meshes.size() * sizeof(VkDrawIndexedIndirectCommand);
+		m_vulkanManager.cmdDrawIndexedIndirect(cb, m_indirectDrawBuffer.buffer,
+			listOffset + meshes[0] * sizeof(VkDrawIndexedIndirectCommand), meshCount);
 	}
+	m_geomPassBinds.add(binds);
+	return;
+#endif
 
-	// Shadow pass
+#if !defined(USE_PIPELINE_PERMUTATIONS) || defined(USE_BINDLESS_MATERIALS)
+	// The fragment push constants are shared with the mesh shader pipelines of USE_MESHLETS
+	auto pushMaterialConstants = [&](uint32_t layout, uint32_t j)
 	{
-		if (m_initialized)
+		struct
 		{
-			m_vulkanManager.destroyFramebuffer(m_shadowFramebuffer);
-		}
+#ifndef USE_PIPELINE_PERMUTATIONS
+			uint32_t materialId;
+			uint32_t hasAoMap;
+			uint32_t hasEmissiveMap;
+#endif
+#ifdef USE_BINDLESS_MATERIALS
+			uint32_t firstTexture; // albedo map of the mesh in the texture array, its other maps follow
+#endif
+#ifdef USE_VIRTUAL_TEXTURING
+			uint32_t meshIndex; // of the mesh's maps in the virtual map buffer
+#endif
+		} pushConst;
+#ifndef USE_PIPELINE_PERMUTATIONS
+		const uint32_t materialKey = m_drawRecords[j].materialKey;
+		pushConst.materialId = materialKey >> 2;
+		pushConst.hasAoMap = (materialKey >> 1) & 1;
+		pushConst.hasEmissiveMap = materialKey & 1;
+#endif
+#ifdef USE_BINDLESS_MATERIALS
+		pushConst.firstTexture = j * VMesh::numMapsPerMesh;
+#endif
+#ifdef USE_VIRTUAL_TEXTURING
+		pushConst.meshIndex = j;
+#endif
 
-		std::vector<uint32_t> attachmentViews(m_camera.getSegmentCount());
-		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
-		{
-			attachmentViews[i] = m_shadowImage.imageViews[i];
-		}
-		m_shadowFramebuffer = m_vulkanManager.createFramebuffer(m_shadowRenderPass, attachmentViews);
-	}
+		m_vulkanManager.cmdPushConstants(cb, layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConst), &pushConst);
+	};
+#endif
 
-	// Lighting pass
-	if (m_initialized)
+	for (uint32_t k = 0; k < meshCount; ++k)
 	{
-		m_vulkanManager.destroyFramebuffer(m_lightingFramebuffer);
-	}
+		const uint32_t j = meshes[k];
+#ifdef USE_PIPELINE_PERMUTATIONS
+		// Draws are sorted by variant, so each pipeline is only bound once
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineVariants.at(m_drawRecords[j].materialKey));
+#endif
+#ifndef USE_BINDLESS_MATERIALS
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_geomPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[j] });
+#endif
 
-	m_lightingFramebuffer = m_vulkanManager.createFramebuffer(m_lightingRenderPass, { m_lightingResultImage.imageViews[0] });
+#if !defined(USE_PIPELINE_PERMUTATIONS) || defined(USE_BINDLESS_MATERIALS)
+		pushMaterialConstants(m_geomPipelineLayout, j);
+#endif
 
-	// Bloom
-	if (m_initialized)
+#ifdef USE_GPU_CULLING
+		// Meshes have their own textures, so each one still gets its own draw
+		const VkDeviceSize listOffset = drawList * m_scene.meshes.size() * sizeof(VkDrawIndexedIndirectCommand);
+		binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(), VK_INDEX_TYPE_UINT32);
+		m_vulkanManager.cmdDrawIndexedIndirect(cb, m_indirectDrawBuffer.buffer, listOffset + j * sizeof(VkDrawIndexedIndirectCommand));
+#ifdef USE_MESHLETS
+		// The meshlets that survived the meshlet culling, in place of the LOD 0 draw
+		const auto &meshInfo = m_meshInfos[j];
+		if (!m_vulkanManager.isMeshShaderEnabled() && meshInfo.meshletCount > 0)
+		{
+			m_vulkanManager.cmdDrawIndexedIndirect(cb, m_meshletDrawBuffer.buffer,
+				(drawList * m_meshletCount + meshInfo.firstMeshlet) * sizeof(VkDrawIndexedIndirectCommand), meshInfo.meshletCount);
+		}
+#endif
+#else
+		const DrawRecord &draw = m_drawRecords[j];
+		const uint32_t lod = m_meshLods[j];
+		binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(draw.indexType), draw.indexType);
+#ifdef USE_INSTANCING
+		m_vulkanManager.cmdDrawIndexed(cb, draw.indexCounts[lod], draw.instanceCount,
+			draw.firstIndices[lod], getDrawVertexOffset(j, draw.vertexOffset, imgIdx), draw.firstInstance);
+#else
+		m_vulkanManager.cmdDrawIndexed(cb, draw.indexCounts[lod], 1, draw.firstIndices[lod], getDrawVertexOffset(j, draw.vertexOffset, imgIdx));
+#endif
+#endif
+	}
+
+#ifdef USE_MESHLETS
+	// One task draw per mesh, empty unless the culling picked LOD 0 for it
+	if (m_vulkanManager.isMeshShaderEnabled())
 	{
-		for (auto name : m_postEffectFramebuffers)
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, depthEqual ? m_geomDepthEqualMeshletPipeline : m_geomMeshletPipeline);
+		for (uint32_t k = 0; k < meshCount; ++k)
 		{
-			m_vulkanManager.destroyFramebuffer(name);
+			const uint32_t j = meshes[k];
+			if (m_meshInfos[j].meshletCount == 0) continue;
+
+#ifdef USE_BINDLESS_MATERIALS
+			const uint32_t geomSet = m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[0];
+#else
+			const uint32_t geomSet = m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[j];
+#endif
+			binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+				m_geomMeshletPipelineLayout, { geomSet, m_perFrameDescriptorSets[imgIdx].m_meshletDescriptorSet });
+			pushMaterialConstants(m_geomMeshletPipelineLayout, j);
+
+			const uint32_t taskConst[] = { j, drawList };
+			m_vulkanManager.cmdPushConstants(cb, m_geomMeshletPipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT,
+				MESHLET_PUSH_CONSTANT_OFFSET, sizeof(taskConst), taskConst);
+			m_vulkanManager.cmdDrawMeshTasksIndirect(cb, m_meshletTaskBuffer.buffer,
+				(drawList * m_scene.meshes.size() + j) * sizeof(VkDrawMeshTasksIndirectCommandEXT));
 		}
 	}
+#endif
 
-	m_postEffectFramebuffers.resize(3);
+#ifdef USE_IMPOSTORS
+	// All impostor quads are one instanced draw, the vertex shader builds each quad from its instance
+	const glm::uvec2 &impostorRange = m_impostorDrawRanges[0];
+	if (drawImpostors && impostorRange.y > 0)
+	{
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_impostorPipeline);
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_impostorPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_impostorDescriptorSet });
+		m_vulkanManager.cmdDraw(cb, 6, impostorRange.y, 0, impostorRange.x);
+	}
+#endif
 
-	m_postEffectFramebuffers[0] = m_vulkanManager.createFramebuffer(m_bloomRenderPasses[0], { m_postEffectImages[0].imageViews[0] });
-	m_postEffectFramebuffers[1] = m_vulkanManager.createFramebuffer(m_bloomRenderPasses[0], { m_postEffectImages[1].imageViews[0] });
-	m_postEffectFramebuffers[2] = m_vulkanManager.createFramebuffer(m_bloomRenderPasses[1], { m_lightingResultImage.imageViews[0] });
+	m_geomPassBinds.add(binds);
 }
 
-void DeferredRenderer::createCommandBuffers()
+void DeferredRenderer::recordDepthPrepassDraws(uint32_t cb, uint32_t imgIdx, const uint32_t *meshes, uint32_t meshCount, uint32_t viewIdx)
 {
-	// Allocate graphics command buffers
-	m_vulkanManager.resetCommandPool(m_graphicsCommandPool, VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT);
+	rj::VBindCache binds(&m_vulkanManager, cb);
 
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	m_perFrameCommandBuffers.resize(swapChainImageCount);
+#ifdef USE_MULTI_VIEW
+	cmdBeginView(cb, m_geomFramebuffer, m_geomPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, viewIdx);
+#else
+	m_vulkanManager.cmdSetViewport(cb, m_geomFramebuffer, 0.f, 0.f, m_renderScale, m_renderScale);
+	m_vulkanManager.cmdSetScissor(cb, m_geomFramebuffer, 0.f, 0.f, m_renderScale, m_renderScale);
+#endif
 
-	std::vector<uint32_t> commandBuffers = m_vulkanManager.allocateCommandBuffers(m_graphicsCommandPool,
-		static_cast<uint32_t>(m_perFrameCommandBuffers.size() * 3 + 1));
+#ifdef USE_VERTEX_PULLING
+	binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_geomPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_vertexPullingDescriptorSet }, 1);
+#else
+	binds.bindVertexBuffers({ m_vulkanManager.getGeometryPoolPositionBuffer() }, { 0 });
+#endif
+	binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_depthPrepassPipeline);
 
-	int idx = 0;
-	for (uint32_t imgIdx = 0; imgIdx < m_perFrameCommandBuffers.size(); ++imgIdx)
+	// The sky box is drawn without depth test in the geometry pass and needs no depth
+	for (uint32_t k = 0; k < meshCount; ++k)
 	{
-		m_perFrameCommandBuffers[imgIdx].m_geomShadowLightingCommandBuffer = commandBuffers[idx++];
-		m_perFrameCommandBuffers[imgIdx].m_postEffectCommandBuffer = commandBuffers[idx++];
-		m_perFrameCommandBuffers[imgIdx].m_presentCommandBuffer = commandBuffers[idx++];
+		const uint32_t j = meshes[k];
+		// Only the transforms are read, so with USE_BINDLESS_MATERIALS every draw uses the same set
+#ifdef USE_BINDLESS_MATERIALS
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_geomPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[0] });
+#else
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_geomPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[j] });
+#endif
+
+		// Same draws as the geometry pass so both produce the same depth
+#ifdef USE_GPU_CULLING
+		binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(), VK_INDEX_TYPE_UINT32);
+		m_vulkanManager.cmdDrawIndexedIndirect(cb, m_indirectDrawBuffer.buffer, j * sizeof(VkDrawIndexedIndirectCommand));
+#ifdef USE_MESHLETS
+		const auto &meshInfo = m_meshInfos[j];
+		if (!m_vulkanManager.isMeshShaderEnabled() && meshInfo.meshletCount > 0)
+		{
+			m_vulkanManager.cmdDrawIndexedIndirect(cb, m_meshletDrawBuffer.buffer,
+				meshInfo.firstMeshlet * sizeof(VkDrawIndexedIndirectCommand), meshInfo.meshletCount);
+		}
+#endif
+#else
+		const DrawRecord &draw = m_drawRecords[j];
+		const uint32_t lod = m_meshLods[j];
+		binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(draw.indexType), draw.indexType);
+#ifdef USE_INSTANCING
+		m_vulkanManager.cmdDrawIndexed(cb, draw.indexCounts[lod], draw.instanceCount,
+			draw.firstIndices[lod], getDrawVertexOffset(j, draw.vertexOffset, imgIdx), draw.firstInstance);
+#else
+		m_vulkanManager.cmdDrawIndexed(cb, draw.indexCounts[lod], 1, draw.firstIndices[lod], getDrawVertexOffset(j, draw.vertexOffset, imgIdx));
+#endif
+#endif
 	}
-	m_envPrefilterCommandBuffer = commandBuffers[idx++];
 
-	// Create command buffers for different purposes
-	createEnvPrefilterCommandBuffer();
-	createGeomShadowLightingCommandBuffers();
-	createPostEffectCommandBuffers();
-	createPresentCommandBuffers();
+#ifdef USE_MESHLETS
+	if (m_vulkanManager.isMeshShaderEnabled())
+	{
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_depthPrepassMeshletPipeline);
+		for (uint32_t k = 0; k < meshCount; ++k)
+		{
+			const uint32_t j = meshes[k];
+			if (m_meshInfos[j].meshletCount == 0) continue;
 
-	// compute command buffers
-	m_vulkanManager.resetCommandPool(m_computeCommandPool, VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT);
+#ifdef USE_BINDLESS_MATERIALS
+			const uint32_t geomSet = m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[0];
+#else
+			const uint32_t geomSet = m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[j];
+#endif
+			binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,
+				m_geomMeshletPipelineLayout, { geomSet, m_perFrameDescriptorSets[imgIdx].m_meshletDescriptorSet });
 
-	commandBuffers = m_vulkanManager.allocateCommandBuffers(m_computeCommandPool, 1);
-	m_brdfLutCommandBuffer = commandBuffers[0];
+			const uint32_t taskConst[] = { j, 0 };
+			m_vulkanManager.cmdPushConstants(cb, m_geomMeshletPipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT,
+				MESHLET_PUSH_CONSTANT_OFFSET, sizeof(taskConst), taskConst);
+			m_vulkanManager.cmdDrawMeshTasksIndirect(cb, m_meshletTaskBuffer.buffer, j * sizeof(VkDrawMeshTasksIndirectCommandEXT));
+		}
+	}
+#endif
 
-	createBrdfLutCommandBuffer();
+	m_geomPassBinds.add(binds);
 }
 
-void DeferredRenderer::createSynchronizationObjects()
+void DeferredRenderer::recordLightCulling(uint32_t cb, uint32_t imgIdx)
 {
-	m_imageAvailableSemaphore = m_vulkanManager.createSemaphore();
-	m_geomAndLightingCompleteSemaphore = m_vulkanManager.createSemaphore();
-	m_postEffectSemaphore = m_vulkanManager.createSemaphore();
-	m_finalOutputFinishedSemaphore = m_vulkanManager.createSemaphore();
-	m_renderFinishedSemaphore = m_vulkanManager.createSemaphore();
+	// The tile buffer is shared by all frames. Wait for the previous lighting pass to finish reading it
+	// and for the depth written by the geometry pass
+	m_vulkanManager.cmdMemoryBarrier(cb,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_lightCullingPipeline);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE,
+		m_lightCullingPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_lightCullingDescriptorSet });
+	m_vulkanManager.cmdDispatch(cb, m_lightTileCountX, m_lightTileCountY, 1);
+
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
 
-	m_brdfLutFence = m_vulkanManager.createFence();
-	m_envPrefilterFence = m_vulkanManager.createFence();
-	m_renderFinishedFence = m_vulkanManager.createFence(VK_FENCE_CREATE_SIGNALED_BIT);
+void DeferredRenderer::recordShadowPageMark(uint32_t cb, uint32_t imgIdx)
+{
+	// Wait for the depth written, or resolved, by the geometry pass. The request buffer is this frame's own, cleared by the host.
+	// Resolves run in the color attachment output stage, also for depth
+	m_vulkanManager.cmdMemoryBarrier(cb,
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	// Only the rendered part of the depth image
+	const VkExtent2D renderExtent = getRenderExtent();
+	const uint32_t width = std::max(static_cast<uint32_t>(renderExtent.width * m_renderScale), 1u);
+	const uint32_t height = std::max(static_cast<uint32_t>(renderExtent.height * m_renderScale), 1u);
+
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_shadowPageMarkPipeline);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE,
+		m_shadowPageMarkPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_shadowPageMarkDescriptorSet });
+	m_vulkanManager.cmdDispatch(cb, (width + SHADOW_PAGE_MARK_GROUP_SIZE - 1) / SHADOW_PAGE_MARK_GROUP_SIZE,
+		(height + SHADOW_PAGE_MARK_GROUP_SIZE - 1) / SHADOW_PAGE_MARK_GROUP_SIZE, 1);
+
+	// Read by updateUniformDeviceData() once the frame's fence is signaled
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT);
 }
 
-void DeferredRenderer::createSpecEnvPrefilterRenderPass()
+void DeferredRenderer::pushLightingConstants(uint32_t cb, uint32_t pipelineLayout, uint32_t offset)
 {
-	if (m_initialized)
+	LightingPushConstants pushConst;
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+	// Of the map bound by writeLightingIblDescriptors()
+	pushConst.specIrradianceMapMipCount = m_scene.skybox.specMapReady ?
+		m_scene.skybox.specularIrradianceMap.mipLevelCount : m_scene.skybox.radianceMap.mipLevelCount;
+#else
+	pushConst.specIrradianceMapMipCount = m_scene.skybox.specularIrradianceMap.mipLevelCount;
+#endif
+	pushConst.frustumSegmentCount = m_camera.getActiveSegmentCount();
+	pushConst.pcfKernelSize = m_scene.shadowLight.getPCFKernlSize();
+#ifdef USE_DYNAMIC_RESOLUTION
+	pushConst.renderScale = m_renderScale;
+#endif
+	m_vulkanManager.cmdPushConstants(cb, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, offset, sizeof(pushConst), &pushConst);
+}
+
+void DeferredRenderer::recordSsao(uint32_t cb, uint32_t imgIdx)
+{
+	// Wait for the depth and normals like a render pass would, and for the previous lighting pass to finish reading the AO
+	const VkSubpassDependency dependency = m_renderGraph.getEntryDependency({ m_renderGraphNames.ssaoPass });
+	m_vulkanManager.cmdMemoryBarrier(cb,
+		dependency.srcStageMask | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		dependency.srcAccessMask, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	// Only the rendered part of the half resolution images
+	const VkExtent2D renderExtent = getRenderExtent();
+	uint32_t pushConstants[] =
 	{
-		m_vulkanManager.destroyRenderPass(m_specEnvPrefilterRenderPass);
+		std::max((static_cast<uint32_t>(renderExtent.width * m_renderScale) + 1) >> 1, 1u),
+		std::max((static_cast<uint32_t>(renderExtent.height * m_renderScale) + 1) >> 1, 1u),
+		0, 0 // blur direction
+	};
+	const uint32_t groupCountX = (pushConstants[0] + SSAO_GROUP_SIZE - 1) / SSAO_GROUP_SIZE;
+	const uint32_t groupCountY = (pushConstants[1] + SSAO_GROUP_SIZE - 1) / SSAO_GROUP_SIZE;
+	const auto &sets = m_perFrameDescriptorSets[imgIdx].m_ssaoDescriptorSets;
+
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_ssaoPipeline);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_ssaoPipelineLayout, { sets[0] });
+	m_vulkanManager.cmdPushConstants(cb, m_ssaoPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), pushConstants);
+	m_vulkanManager.cmdDispatch(cb, groupCountX, groupCountY, 1);
+
+#ifdef USE_COMPUTE_BLUR
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		m_separableBlur->cmdBlur(cb, m_ssaoBlurPipeline, m_ssaoBlurDescriptorSets[i], pushConstants[0], pushConstants[1], i);
 	}
+#else
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_ssaoBlurPipeline);
+	for (uint32_t i = 1; i < 3; ++i)
+	{
+		m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+		pushConstants[2] = i == 1 ? 1 : 0;
+		pushConstants[3] = i == 1 ? 0 : 1;
+		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_ssaoPipelineLayout, { sets[i] });
+		m_vulkanManager.cmdPushConstants(cb, m_ssaoPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), pushConstants);
+		m_vulkanManager.cmdDispatch(cb, groupCountX, groupCountY, 1);
+	}
+#endif
 
-	m_vulkanManager.beginCreateRenderPass();
+	// The lighting pass waits for the result right before it starts
+}
 
-	m_vulkanManager.renderPassAddAttachment(m_scene.skybox.specularIrradianceMap.format,
-		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+void DeferredRenderer::recordShadingRate(uint32_t cb)
+{
+	// Wait for the lighting result like a render pass would, and for this frame's geometry and lighting passes to finish
+	// reading the rates
+	const VkSubpassDependency dependency = m_renderGraph.getEntryDependency({ m_renderGraphNames.shadingRatePass });
+	m_vulkanManager.cmdMemoryBarrier(cb,
+		dependency.srcStageMask | VK_PIPELINE_STAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		dependency.srcAccessMask | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	// log2 of the coarsest fragment side, luminance contrast below which a texel is coarsened, motion in pixels per frame
+	// above which it is, fovea radius relative to the screen height
+	struct ShadingRateTier
+	{
+		uint32_t maxRateLog2;
+		float contrastThreshold;
+		float motionThreshold;
+		float foveaRadius;
+	};
+	static const ShadingRateTier tiers[SHADING_RATE_MODE_COUNT] =
+	{
+		{ 0, 0.f, 0.f, 0.f }, // SHADING_RATE_FULL
+		{ 1, 0.04f, 8.f, 0.f }, // SHADING_RATE_QUALITY
+		{ 2, 0.1f, 4.f, 0.f }, // SHADING_RATE_PERFORMANCE
+		{ 2, 0.f, 0.f, 0.35f } // SHADING_RATE_FOVEATED
+	};
+	const ShadingRateTier &tier = tiers[m_shadingRateMode];
 
-	m_vulkanManager.beginDescribeSubpass();
-	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	m_vulkanManager.endDescribeSubpass();
+	// The rates are (log2 width << 2) | log2 height, clamped to the largest fragment the device supports
+	const VkExtent2D maxFragmentSize = m_vulkanManager.getFragmentShadingRateProperties().maxFragmentSize;
+	uint32_t maxRateLog2 = tier.maxRateLog2;
+	while (maxRateLog2 > 0 && (1u << maxRateLog2) > std::min(maxFragmentSize.width, maxFragmentSize.height)) --maxRateLog2;
 
-	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
-		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-		0, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+	// Only the rendered part of the lighting result
+	const VkExtent2D renderExtent = getRenderExtent();
+	const VkExtent2D texelSize = getShadingRateTexelSize();
+	struct
+	{
+		uint32_t width, height;
+		uint32_t maxRateLog2;
+		float contrastThreshold, motionThreshold, foveaRadius;
+	} pushConstants =
+	{
+		std::max(static_cast<uint32_t>(renderExtent.width * m_renderScale), 1u),
+		std::max(static_cast<uint32_t>(renderExtent.height * m_renderScale), 1u),
+		maxRateLog2, tier.contrastThreshold, tier.motionThreshold, tier.foveaRadius
+	};
+	const uint32_t texelCountX = (pushConstants.width + texelSize.width - 1) / texelSize.width;
+	const uint32_t texelCountY = (pushConstants.height + texelSize.height - 1) / texelSize.height;
 
-	m_vulkanManager.renderPassAddSubpassDependency(0, VK_SUBPASS_EXTERNAL,
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0);
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_shadingRatePipeline);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_shadingRatePipelineLayout, { m_shadingRateDescriptorSet });
+	m_vulkanManager.cmdPushConstants(cb, m_shadingRatePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+	m_vulkanManager.cmdDispatch(cb, (texelCountX + VRS_GROUP_SIZE - 1) / VRS_GROUP_SIZE, (texelCountY + VRS_GROUP_SIZE - 1) / VRS_GROUP_SIZE, 1);
 
-	m_specEnvPrefilterRenderPass = m_vulkanManager.endCreateRenderPass();
+	// Read by the next frame's geometry and lighting passes
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_FRAGMENT_SHADING_RATE_ATTACHMENT_READ_BIT_KHR);
 }
 
-void DeferredRenderer::createShadowRenderPass()
+void DeferredRenderer::recordMaterialPass(uint32_t cb, uint32_t imgIdx)
 {
-	if (m_initialized)
+	// Wait for the visibility buffer like a render pass would, and for earlier readers of the G-buffers, whose previous
+	// contents are discarded
+	const uint32_t materialPass = m_renderGraphNames.materialPass;
+	const VkSubpassDependency dependency = m_renderGraph.getEntryDependency({ materialPass });
+	m_vulkanManager.cmdMemoryBarrier(cb, dependency.srcStageMask, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		dependency.srcAccessMask, VK_ACCESS_SHADER_READ_BIT);
+	for (uint32_t i = 0; i < m_numGBuffers; ++i)
 	{
-		m_vulkanManager.destroyRenderPass(m_shadowRenderPass);
+		m_vulkanManager.cmdImageBarrier(cb, m_gbufferImages[i].image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+			dependency.srcStageMask, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dependency.srcAccessMask, VK_ACCESS_SHADER_WRITE_BIT);
 	}
 
-	m_vulkanManager.beginCreateRenderPass();
+	// Only the rendered part. Meshes the late pass of USE_HIZ_OCCLUSION_CULLING drew are found in its draw list
+	const VkExtent2D renderExtent = getRenderExtent();
+	const uint32_t pushConstants[] =
+	{
+		std::max(static_cast<uint32_t>(renderExtent.width * m_renderScale), 1u),
+		std::max(static_cast<uint32_t>(renderExtent.height * m_renderScale), 1u),
+#ifdef USE_HIZ_OCCLUSION_CULLING
+		1 + CSM_MAX_SEG_COUNT
+#else
+		0
+#endif
+	};
 
-	// --- Attachments
-	// Depth of the scene from light's perspective
-	for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_materialPipeline);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_materialPipelineLayout,
+		{ m_perFrameDescriptorSets[imgIdx].m_materialDescriptorSet, m_perFrameDescriptorSets[imgIdx].m_vertexPullingDescriptorSet });
+	m_vulkanManager.cmdPushConstants(cb, m_materialPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), pushConstants);
+	m_vulkanManager.cmdDispatch(cb, (pushConstants[0] + MATERIAL_PASS_GROUP_SIZE - 1) / MATERIAL_PASS_GROUP_SIZE,
+		(pushConstants[1] + MATERIAL_PASS_GROUP_SIZE - 1) / MATERIAL_PASS_GROUP_SIZE, 1);
+
+	// Leave the G-buffers in the layout of their next access, the lighting and SSAO passes sample them
+	for (uint32_t i = 0; i < m_numGBuffers; ++i)
 	{
-		m_vulkanManager.renderPassAddAttachment(findDepthFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		m_vulkanManager.cmdImageBarrier(cb, m_gbufferImages[i].image, VK_IMAGE_LAYOUT_GENERAL,
+			m_renderGraph.getFinalLayout(materialPass, m_renderGraphNames.gbufferImages[i]),
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
 	}
+}
 
-	// --- Subpasses
-	for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
+void DeferredRenderer::recordGpuCulling(uint32_t cb, uint32_t imgIdx, bool latePhase)
+{
+	// The late phase is ordered after the early one by the Hi-Z build barriers
+	if (!latePhase)
 	{
-		m_vulkanManager.beginDescribeSubpass();
-		m_vulkanManager.subpassAddDepthAttachmentReference(i, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-		m_vulkanManager.endDescribeSubpass();
+		// The indirect buffer is shared by all frames. Wait for the previous frame's draws to finish reading it
+		m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+#ifdef USE_HIZ_OCCLUSION_CULLING
+		// Mesh visibility written by the previous frame's late phase
+		m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+#endif
 	}
 
-	// --- Subpass dependencies
-	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-		0, 0);
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, latePhase ? m_gpuCullingLatePipeline : m_gpuCullingPipeline);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE,
+		m_gpuCullingPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_gpuCullingDescriptorSet });
+
+	const uint32_t meshCount = static_cast<uint32_t>(m_scene.meshes.size());
+	m_vulkanManager.cmdDispatch(cb, (meshCount + GPU_CULLING_GROUP_SIZE - 1) / GPU_CULLING_GROUP_SIZE, 1, 1);
 
-	for (uint32_t i = 0; i < m_camera.getSegmentCount() - 1; ++i)
+#ifdef USE_MESHLETS
+	if (!m_vulkanManager.isMeshShaderEnabled())
 	{
-		m_vulkanManager.renderPassAddSubpassDependency(i, i + 1,
-			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-			VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-			0, 0);
+		// The meshlet culling reads the task commands of the meshes handed over to their meshlets
+		m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+		recordMeshletCulling(cb, imgIdx, latePhase);
 	}
+#endif
 
-	m_shadowRenderPass = m_vulkanManager.endCreateRenderPass();
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
 }
 
-void DeferredRenderer::createGeometryRenderPass()
+void DeferredRenderer::recordMeshletCulling(uint32_t cb, uint32_t imgIdx, bool latePhase)
 {
-	if (m_initialized)
-	{
-		m_vulkanManager.destroyRenderPass(m_geomRenderPass);
-	}
+#ifdef USE_MESHLETS
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, latePhase ? m_meshletCullingLatePipeline : m_meshletCullingPipeline);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE,
+		m_meshletCullingPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_meshletDescriptorSet });
+
+	// One work group per mesh and draw list: the camera list and the cascade lists early, the late camera list late
+	const uint32_t meshCount = static_cast<uint32_t>(m_scene.meshes.size());
+	const uint32_t listCount = latePhase ? 1 : 1 + m_camera.getSegmentCount();
+	m_vulkanManager.cmdDispatch(cb, meshCount, listCount, 1);
+#endif
+}
 
-	m_vulkanManager.beginCreateRenderPass();
+void DeferredRenderer::recordSkinning(uint32_t cb, uint32_t imgIdx)
+{
+#ifdef USE_GPU_SKINNING
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_skinningPipeline);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE,
+		m_skinningPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_skinningDescriptorSet });
 
-	// --- Attachments used in this render pass
-	// Depth
-	// Clear only happens in the FIRST subpass that uses this attachment
-	// VK_IMAGE_LAYOUT_UNDEFINED as initial layout means that we don't care about the initial layout of this attachment image (content may not be preserved)
-	m_vulkanManager.renderPassAddAttachment(findDepthFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, SAMPLE_COUNT);
+	for (const auto &skinned : m_skinnedMeshes)
+	{
+		SkinningPushConstants constants;
+		constants.srcVertexOffset = m_scene.meshes[skinned.mesh].geometry.vertexOffset;
+		constants.dstVertexOffset = skinned.frameGeometry[imgIdx].vertexOffset;
+		constants.vertexCount = skinned.vertexCount;
+		constants.firstSkinVertex = skinned.firstSkinVertex;
+		constants.firstJoint = skinned.firstJoint;
+		constants.firstMorphDelta = skinned.firstMorphDelta;
+		constants.morphTargetCount = skinned.morphTargetCount;
+		constants.firstWeight = m_animator.getJointCount() * 16 + skinned.firstWeight;
+		m_vulkanManager.cmdPushConstants(cb, m_skinningPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		m_vulkanManager.cmdDispatch(cb, (skinned.vertexCount + SKINNING_GROUP_SIZE - 1) / SKINNING_GROUP_SIZE, 1, 1);
+	}
 
-	// World space normal + albedo
-	// Normal has been perturbed by normal mapping
-	m_vulkanManager.renderPassAddAttachment(m_gbufferFormats[0], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, SAMPLE_COUNT);
+	// Drawn as vertex input, or pulled by the vertex shaders with USE_VERTEX_PULLING
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+#endif
+}
 
-	// World postion
-	m_vulkanManager.renderPassAddAttachment(m_gbufferFormats[1], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, SAMPLE_COUNT);
+int32_t DeferredRenderer::getDrawVertexOffset(uint32_t j, int32_t vertexOffset, uint32_t imgIdx) const
+{
+#ifdef USE_GPU_SKINNING
+	if (m_meshSkinnedIndices[j] != Animator::INVALID_INDEX)
+	{
+		return m_skinnedMeshes[m_meshSkinnedIndices[j]].frameGeometry[imgIdx].vertexOffset;
+	}
+#endif
+	return vertexOffset;
+}
 
-	// RMAI
-	m_vulkanManager.renderPassAddAttachment(m_gbufferFormats[2], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, SAMPLE_COUNT);
+void DeferredRenderer::recordHiZBuild(uint32_t cb)
+{
+	// Wait for the early pass depth or its resolve, and for the previous frame's late culling to finish with the Hi-Z image
+	m_vulkanManager.cmdMemoryBarrier(cb,
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 
-	// --- Reference to render pass attachments used in each subpass
-	// --- Subpasses
-	// Geometry subpass
-	m_vulkanManager.beginDescribeSubpass();
-	m_vulkanManager.subpassAddColorAttachmentReference(1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	m_vulkanManager.subpassAddColorAttachmentReference(2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	m_vulkanManager.subpassAddColorAttachmentReference(3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	m_vulkanManager.subpassAddDepthAttachmentReference(0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-	m_vulkanManager.endDescribeSubpass();
+	for (uint32_t level = 0; level < m_hiZImage.mipLevelCount; ++level)
+	{
+		if (level < 2)
+		{
+			m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, level == 0 ? m_hiZDepthReducePipeline : m_hiZDownsamplePipeline);
+		}
+		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_hiZPipelineLayout, { m_hiZDescriptorSets[level] });
 
-	// --- Subpass dependencies
-	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
-		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-		0,
-		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+		const uint32_t width = std::max(m_hiZImage.width >> level, 1u);
+		const uint32_t height = std::max(m_hiZImage.height >> level, 1u);
+		m_vulkanManager.cmdDispatch(cb, (width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
 
-	// --- Create render pass
-	m_geomRenderPass = m_vulkanManager.endCreateRenderPass();
+		// Each level reads the previous one, the late culling phase reads all of them
+		m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
 }
 
-void DeferredRenderer::createLightingRenderPass()
+void DeferredRenderer::recordShadowMoments(uint32_t cb)
 {
-	if (m_initialized)
-	{
-		m_vulkanManager.destroyRenderPass(m_lightingRenderPass);
-	}
+	if (m_shadowCascadeUpdateMask == 0) return;
 
-	m_vulkanManager.beginCreateRenderPass();
+	// Wait for the shadow pass depth, and for the previous frame's lighting pass to finish sampling the moments
+	m_vulkanManager.cmdMemoryBarrier(cb,
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 
-	m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	// One dispatch per updated cascade for each step, each step reads what the previous one wrote
+	auto recordStep = [&](uint32_t pipeline, uint32_t setIdx, uint32_t level, uint32_t direction)
+	{
+		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_shadowMomentPipelineLayout,
+			{ m_shadowMomentDescriptorSets[setIdx] });
 
-	m_vulkanManager.beginDescribeSubpass();
-	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	m_vulkanManager.endDescribeSubpass();
+		const uint32_t size = std::max(m_shadowMomentImage.width >> level, 1u);
+		const uint32_t groupCount = (size + SHADOW_MOMENT_GROUP_SIZE - 1) / SHADOW_MOMENT_GROUP_SIZE;
+		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
+		{
+			if ((m_shadowCascadeUpdateMask & (1u << i)) == 0) continue;
 
-	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+			const uint32_t pushConst[] = { i, direction };
+			m_vulkanManager.cmdPushConstants(cb, m_shadowMomentPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConst), pushConst);
+			m_vulkanManager.cmdDispatch(cb, groupCount, groupCount, 1);
+		}
 
-	m_lightingRenderPass = m_vulkanManager.endCreateRenderPass();
-}
+		m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	};
 
-void DeferredRenderer::createBloomRenderPasses()
-{
-	if (m_initialized)
+	recordStep(m_shadowMomentGeneratePipeline, 0, 0, 0);
+#ifdef USE_COMPUTE_BLUR
+	// The blur sets are bound with the separable blur's pipeline layout, their set layout is the same
+	for (uint32_t direction = 0; direction < 2; ++direction)
 	{
-		for (auto renderPass : m_bloomRenderPasses)
+		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
 		{
-			m_vulkanManager.destroyRenderPass(renderPass);
+			if ((m_shadowCascadeUpdateMask & (1u << i)) == 0) continue;
+			m_separableBlur->cmdBlur(cb, m_shadowMomentBlurPipeline, m_shadowMomentDescriptorSets[1 + direction],
+				m_shadowMomentImage.width, m_shadowMomentImage.height, direction, i);
 		}
+
+		m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	}
+#else
+	recordStep(m_shadowMomentBlurPipeline, 1, 0, 0); // horizontal into the intermediate
+	recordStep(m_shadowMomentBlurPipeline, 2, 0, 1); // vertical back into mip 0
+#endif
+	for (uint32_t level = 1; level < m_shadowMomentImage.mipLevelCount; ++level)
+	{
+		recordStep(m_shadowMomentDownsamplePipeline, 2 + level, level, 0);
 	}
 
-	m_bloomRenderPasses.resize(2);
+	// Sampled by the lighting pass
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
 
-	// --- Bloom render pass 1 (brightness and blur passes): will clear framebuffer
-	m_vulkanManager.beginCreateRenderPass();
+void DeferredRenderer::recordShadowPassDraws(uint32_t cb, uint32_t imgIdx, uint32_t cascadeIdx, const uint32_t *meshes, uint32_t meshCount, bool clear)
+{
+	rj::VBindCache binds(&m_vulkanManager, cb);
+
+#ifdef USE_SHADOW_ATLAS
+	// Secondary command buffers don't inherit dynamic state
+	const auto &tile = m_shadowAtlas.getTile(cascadeIdx);
+	m_vulkanManager.cmdSetViewport(cb, static_cast<float>(tile.x), static_cast<float>(tile.y),
+		static_cast<float>(tile.size), static_cast<float>(tile.size));
+	m_vulkanManager.cmdSetScissor(cb, static_cast<int32_t>(tile.x), static_cast<int32_t>(tile.y), tile.size, tile.size);
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+	const VkRect2D &scissor = m_shadowCascadeScissors[cascadeIdx];
+	m_vulkanManager.cmdSetViewport(cb, 0.f, 0.f, static_cast<float>(m_shadowImage.width), static_cast<float>(m_shadowImage.height));
+	m_vulkanManager.cmdSetScissor(cb, scissor.offset.x, scissor.offset.y, scissor.extent.width, scissor.extent.height);
+#endif
 
-	m_vulkanManager.renderPassAddAttachment(m_postEffectImageFormats[0], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	// Coarser cascades need more bias. The layered pass draws all of them with the first one's
+	const float biasScale = std::pow(SHADOW_DEPTH_BIAS_CASCADE_SCALE, static_cast<float>(cascadeIdx));
+	m_vulkanManager.cmdSetDepthBias(cb, SHADOW_DEPTH_BIAS_CONSTANT * biasScale, 0.f, SHADOW_DEPTH_BIAS_SLOPE * biasScale);
 
-	m_vulkanManager.beginDescribeSubpass();
-	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	m_vulkanManager.endDescribeSubpass();
+	if (clear)
+	{
+		VkClearAttachment clearAttachment = {};
+		clearAttachment.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		clearAttachment.clearValue.depthStencil = { 1.f, 0 };
+
+		VkClearRect clearRect = {};
+#ifdef USE_SHADOW_ATLAS
+		clearRect.rect.offset = { static_cast<int32_t>(tile.x), static_cast<int32_t>(tile.y) };
+		clearRect.rect.extent = { tile.size, tile.size };
+#elif defined(USE_VIRTUAL_SHADOW_MAP)
+		// Only the dirty pages, the others keep their depth
+		clearRect.rect = scissor;
+#else
+		clearRect.rect.extent = { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE };
+#endif
+#ifdef USE_LAYERED_SHADOW_PASS
+		clearRect.layerCount = m_camera.getSegmentCount();
+#else
+		clearRect.layerCount = 1;
+#endif
+		m_vulkanManager.cmdClearAttachments(cb, { clearAttachment }, { clearRect });
+	}
+
+	binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipelines[cascadeIdx]);
+
+#ifdef USE_VERTEX_PULLING
+	binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipelineLayout,
+		{ m_perFrameDescriptorSets[imgIdx].m_vertexPullingDescriptorSet }, 2);
+#else
+	binds.bindVertexBuffers({ m_vulkanManager.getGeometryPoolPositionBuffer() }, { 0 });
+#endif
+
+#ifdef USE_GPU_CULLING
+	binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(), VK_INDEX_TYPE_UINT32);
+	if (meshCount == 0)
+	{
+		m_shadowPassBinds.add(binds);
+		return;
+	}
 
-	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipelineLayout,
+		{ m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[cascadeIdx], m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[0] });
 
-	m_bloomRenderPasses[0] = m_vulkanManager.endCreateRenderPass();
+	// @meshes holds consecutive mesh indices, so the whole range is one multi draw. List 0 is the geometry pass
+	const VkDeviceSize listOffset = (1 + cascadeIdx) * m_scene.meshes.size() * sizeof(VkDrawIndexedIndirectCommand);
+	m_vulkanManager.cmdDrawIndexedIndirect(cb, m_indirectDrawBuffer.buffer,
+		listOffset + meshes[0] * sizeof(VkDrawIndexedIndirectCommand), meshCount);
 
-	// --- Bloom render pass 2 (Merge pass): will not clear framebuffer
-	m_vulkanManager.beginCreateRenderPass();
+#ifdef USE_MESHLETS
+	// The meshlets of consecutive meshes are consecutive too
+	const uint32_t firstMeshlet = m_meshInfos[meshes[0]].firstMeshlet;
+	const uint32_t meshletCount = m_meshInfos[meshes[meshCount - 1]].firstMeshlet + m_meshInfos[meshes[meshCount - 1]].meshletCount - firstMeshlet;
+	if (m_vulkanManager.isMeshShaderEnabled())
+	{
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowMeshletPipelines[cascadeIdx]);
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowMeshletPipelineLayout,
+			{ m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[cascadeIdx], m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[0],
+			m_perFrameDescriptorSets[imgIdx].m_meshletDescriptorSet });
+
+		// The task shader adds the draw index to the first mesh
+		const uint32_t taskConst[] = { meshes[0], 1 + cascadeIdx };
+		m_vulkanManager.cmdPushConstants(cb, m_shadowMeshletPipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT,
+			MESHLET_PUSH_CONSTANT_OFFSET, sizeof(taskConst), taskConst);
+		m_vulkanManager.cmdDrawMeshTasksIndirect(cb, m_meshletTaskBuffer.buffer,
+			((1 + cascadeIdx) * m_scene.meshes.size() + meshes[0]) * sizeof(VkDrawMeshTasksIndirectCommandEXT), meshCount);
+	}
+	else if (meshletCount > 0)
+	{
+		m_vulkanManager.cmdDrawIndexedIndirect(cb, m_meshletDrawBuffer.buffer,
+			((1 + cascadeIdx) * m_meshletCount + firstMeshlet) * sizeof(VkDrawIndexedIndirectCommand), meshletCount);
+	}
+#endif
+#elif defined(USE_INSTANCING)
+	binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipelineLayout,
+		{ m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[cascadeIdx], m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[0] });
 
-	m_vulkanManager.renderPassAddAttachment(m_lightingResultImageFormat, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_LOAD);
+	for (uint32_t k = 0; k < meshCount; ++k)
+	{
+		const uint32_t j = meshes[k];
+		const DrawRecord &draw = m_drawRecords[j];
+		const uint32_t lod = m_shadowCasterLods[cascadeIdx][j];
+		binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(draw.indexType), draw.indexType);
+		m_vulkanManager.cmdDrawIndexed(cb, draw.indexCounts[lod], draw.instanceCount,
+			draw.firstIndices[lod], getDrawVertexOffset(j, draw.vertexOffset, imgIdx), draw.firstInstance);
+	}
+#else
+	binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipelineLayout,
+		{ m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[cascadeIdx] });
 
-	m_vulkanManager.beginDescribeSubpass();
-	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	m_vulkanManager.endDescribeSubpass();
+	for (uint32_t k = 0; k < meshCount; ++k)
+	{
+		const uint32_t j = meshes[k];
+		const uint32_t modelOffset = static_cast<uint32_t>(
+			m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_scene.meshes[j].uPerModelInfo)));
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipelineLayout,
+			{ m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[0] }, 1, { modelOffset });
+
+		const DrawRecord &draw = m_drawRecords[j];
+		const uint32_t lod = m_shadowCasterLods[cascadeIdx][j];
+		binds.bindIndexBuffer(m_vulkanManager.getGeometryPoolIndexBuffer(draw.indexType), draw.indexType);
+		m_vulkanManager.cmdDrawIndexed(cb, draw.indexCounts[lod], 1, draw.firstIndices[lod], getDrawVertexOffset(j, draw.vertexOffset, imgIdx));
+	}
+#endif
 
-	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+#ifdef USE_IMPOSTORS
+	// The cascade's impostors face the light, drawn with the first chunk after the clear
+	const glm::uvec2 &impostorRange = m_impostorDrawRanges[1 + cascadeIdx];
+	if (clear && impostorRange.y > 0)
+	{
+		binds.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_impostorShadowPipelines[cascadeIdx]);
+		binds.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_impostorShadowPipelineLayout,
+			{ m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[cascadeIdx], m_perFrameDescriptorSets[imgIdx].m_impostorDescriptorSet });
+		m_vulkanManager.cmdDraw(cb, 6, impostorRange.y, 0, impostorRange.x);
+	}
+#endif
 
-	m_bloomRenderPasses[1] = m_vulkanManager.endCreateRenderPass();
+	m_shadowPassBinds.add(binds);
 }
 
-void DeferredRenderer::createFinalOutputRenderPass()
+void DeferredRenderer::recordSceneSecondaryCommandBuffers(uint32_t imgIdx, bool depthPrepass)
 {
-	if (m_initialized)
+	const uint32_t threadCount = SCENE_RECORDING_THREAD_COUNT;
+	const uint32_t cascadeCount = getShadowSubpassCount();
+#ifdef USE_MULTI_VIEW
+	const uint32_t viewCount = m_viewCount;
+#else
+	const uint32_t viewCount = 1;
+#endif
+
+	// This image's previous secondaries belong to a primary that is being re-recorded, so the GPU is done with them
+	m_vulkanManager.resetCommandPoolSet(m_sceneCommandPoolSet, imgIdx);
+
+	// What the pool set above records: every visible mesh, or only the dynamic ones with USE_STATIC_SECONDARIES
+	rj::ArrayView<uint32_t> geomLists[MAX_VIEW_COUNT];
+	rj::ArrayView<uint32_t> shadowLists[CSM_MAX_SEG_COUNT];
+#ifdef USE_MULTI_VIEW
+	for (uint32_t v = 0; v < viewCount; ++v) geomLists[v] = getViewMeshes(v);
+#else
+	geomLists[0] = m_visibleMeshes;
+#endif
+	for (uint32_t i = 0; i < cascadeCount; ++i) shadowLists[i] = m_visibleShadowCasters[i];
+
+#ifdef USE_STATIC_SECONDARIES
+	// Static secondaries of the passes whose static draws have changed, recorded below too. Pass 0 is the geometry pass
+	const uint32_t passCount = 1 + CSM_MAX_SEG_COUNT;
+	bool staticStale[passCount] = {};
+	rj::ArrayView<uint32_t> staticGeomLists[MAX_VIEW_COUNT];
+	rj::ArrayView<uint32_t> staticShadowLists[CSM_MAX_SEG_COUNT];
+	auto &cbs = m_perFrameCommandBuffers[imgIdx];
+	if (cbs.m_dirtyMask & CB_DIRTY_STATIC_SECONDARIES)
 	{
-		m_vulkanManager.destroyRenderPass(m_finalOutputRenderPass);
+		for (uint32_t p = 0; p < passCount; ++p) m_staticSecondarySignatures[imgIdx * passCount + p].clear();
+		cbs.m_dirtyMask &= ~CB_DIRTY_STATIC_SECONDARIES;
 	}
 
-	m_vulkanManager.beginCreateRenderPass();
-
-	m_vulkanManager.renderPassAddAttachment(m_vulkanManager.getSwapChainImageFormat(),
-		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	// Split every list in its static and dynamic meshes, keeping their order
+	FrameVector<FrameVector<uint32_t>> staticLists(viewCount + cascadeCount, FrameVector<uint32_t>(m_frameArena), m_frameArena);
+	FrameVector<FrameVector<uint32_t>> dynamicLists(viewCount + cascadeCount, FrameVector<uint32_t>(m_frameArena), m_frameArena);
+	auto split = [&](rj::ArrayView<uint32_t> *pList, rj::ArrayView<uint32_t> *pStaticList, uint32_t listIdx)
+	{
+		for (uint32_t j : *pList)
+		{
+			(isMeshDynamic(j) ? dynamicLists[listIdx] : staticLists[listIdx]).push_back(j);
+		}
+		*pList = dynamicLists[listIdx];
+		*pStaticList = staticLists[listIdx];
+	};
+	for (uint32_t v = 0; v < viewCount; ++v) split(&geomLists[v], &staticGeomLists[v], v);
+	for (uint32_t i = 0; i < cascadeCount; ++i) split(&shadowLists[i], &staticShadowLists[i], viewCount + i);
 
-	m_vulkanManager.beginDescribeSubpass();
-	m_vulkanManager.subpassAddColorAttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	m_vulkanManager.endDescribeSubpass();
+	// The signature of a pass holds everything its static secondaries record that is not covered by CB_DIRTY_STATIC_SECONDARIES.
+	// Cascades that keep their cached shadow maps execute no static secondaries, so they are left as they are
+	FrameVector<uint32_t> signature(m_frameArena);
+	auto addMeshes = [&signature](rj::ArrayView<uint32_t> list, const std::vector<uint32_t> &lods)
+	{
+		signature.push_back(static_cast<uint32_t>(list.size()));
+		for (uint32_t j : list)
+		{
+			signature.push_back(j);
+			signature.push_back(lods[j]);
+		}
+	};
+	for (uint32_t p = 0; p < 1 + cascadeCount; ++p)
+	{
+		signature.clear();
+		if (p == 0)
+		{
+			signature.push_back(depthPrepass);
+			signature.push_back(viewCount);
+			for (uint32_t v = 0; v < viewCount; ++v) addMeshes(staticGeomLists[v], m_meshLods);
+		}
+		else
+		{
+			const uint32_t i = p - 1;
+			if (!isShadowSubpassUpdated(i)) continue;
+			signature.push_back(m_camera.getSegmentCount());
+#ifdef USE_SHADOW_ATLAS
+			const auto &tile = m_shadowAtlas.getTile(i);
+			signature.push_back(tile.x);
+			signature.push_back(tile.y);
+			signature.push_back(tile.size);
+#endif
+#ifdef USE_VIRTUAL_SHADOW_MAP
+			const VkRect2D &scissor = m_shadowCascadeScissors[i];
+			signature.push_back(static_cast<uint32_t>(scissor.offset.x));
+			signature.push_back(static_cast<uint32_t>(scissor.offset.y));
+			signature.push_back(scissor.extent.width);
+			signature.push_back(scissor.extent.height);
+#endif
+			addMeshes(staticShadowLists[i], m_shadowCasterLods[i]);
+		}
 
-	m_vulkanManager.renderPassAddSubpassDependency(VK_SUBPASS_EXTERNAL, 0,
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+		auto &recorded = m_staticSecondarySignatures[imgIdx * passCount + p];
+		if (recorded.size() != signature.size() || !std::equal(signature.begin(), signature.end(), recorded.begin()))
+		{
+			recorded.assign(signature.begin(), signature.end());
+			m_vulkanManager.resetCommandPoolSet(m_staticSceneCommandPoolSet, imgIdx * passCount + p);
+			staticStale[p] = true;
+		}
+	}
+#endif
 
-	m_finalOutputRenderPass = m_vulkanManager.endCreateRenderPass();
-}
+	// Task t records the t-th chunk of every list. Each task owns a command pool
+	// so no two threads allocate from or record into the same pool at once.
+	auto recordChunks = [&](uint32_t t)
+	{
+		TRACE_CPU_SCOPE("record scene secondaries");
 
-void DeferredRenderer::createBrdfLutDescriptorSetLayout()
-{
-	m_vulkanManager.beginCreateDescriptorSetLayout();
+		auto chunk = [threadCount, t](rj::ArrayView<uint32_t> list, const uint32_t **ppBegin, uint32_t *pCount)
+		{
+			const uint32_t size = static_cast<uint32_t>(list.size());
+			const uint32_t begin = size * t / threadCount;
+			const uint32_t end = size * (t + 1) / threadCount;
+			*ppBegin = list.data() + begin;
+			*pCount = end - begin;
+		};
 
-	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+		const uint32_t *meshes;
+		uint32_t meshCount;
 
-	m_brdfLutDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
-}
+		// With static secondaries, the first one of a pass draws the skybox and clears, and those of a cascade begin its
+		// GPU profiler scope, which the last dynamic one ends. Profiler scopes keep their queries, so cached ones stay valid
+		auto recordGeomPass = [&](uint32_t cb, const rj::ArrayView<uint32_t> *lists, bool first)
+		{
+			// Also compatible with the geometry pass that follows the depth pre-pass
+			m_vulkanManager.beginSecondaryCommandBuffer(cb, m_geomRenderPass, 0, m_geomFramebuffer, 0, rj::VGpuProfiler::PIPELINE_STATISTIC_FLAGS);
+			for (uint32_t v = 0; v < viewCount; ++v)
+			{
+				chunk(lists[v], &meshes, &meshCount);
+				// Every view's list is split the same way, the sky box only shows in the perspective view
+				recordGeomPassDraws(cb, imgIdx, meshes, meshCount, first && t == 0 && v == 0, 0, depthPrepass, v);
+			}
+			m_vulkanManager.endCommandBuffer(cb);
+		};
+		auto recordShadowSubpass = [&](uint32_t cb, uint32_t i, rj::ArrayView<uint32_t> list, bool first, bool last)
+		{
+			m_vulkanManager.beginSecondaryCommandBuffer(cb, m_shadowRenderPass, i, m_shadowFramebuffer, 0, rj::VGpuProfiler::PIPELINE_STATISTIC_FLAGS);
 
-void DeferredRenderer::createSpecEnvPrefilterDescriptorSetLayout()
-{
-	m_vulkanManager.beginCreateDescriptorSetLayout();
+			// The cascade's scope spans the chunks of all threads, which are executed in thread order
+			const std::string scopePath = "shadow/" + getShadowSubpassScopeName(i);
+			if (first && t == 0) m_gpuProfiler.beginDetachedScope(cb, imgIdx, scopePath);
+			if (isShadowSubpassUpdated(i))
+			{
+				chunk(list, &meshes, &meshCount);
+				recordShadowPassDraws(cb, imgIdx, i, meshes, meshCount, first && t == 0);
+			}
+			if (last && t == threadCount - 1) m_gpuProfiler.endDetachedScope(cb, imgIdx, scopePath);
 
-	// 6 View matrices + projection matrix
-	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_GEOMETRY_BIT);
+			m_vulkanManager.endCommandBuffer(cb);
+		};
 
-	// HDR probe a.k.a. radiance environment map with mips
-	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#ifdef USE_STATIC_SECONDARIES
+		if (staticStale[0])
+		{
+			recordGeomPass(m_vulkanManager.acquireCommandBuffer(m_staticSceneCommandPoolSet, imgIdx * passCount, t), staticGeomLists, true);
+		}
+		for (uint32_t i = 0; i < cascadeCount; ++i)
+		{
+			if (!staticStale[1 + i]) continue;
+			recordShadowSubpass(m_vulkanManager.acquireCommandBuffer(m_staticSceneCommandPoolSet, imgIdx * passCount + 1 + i, t),
+				i, staticShadowLists[i], true, false);
+		}
+		// Only cascades that are updated execute their static secondaries
+		recordGeomPass(m_vulkanManager.acquireCommandBuffer(m_sceneCommandPoolSet, imgIdx, t), geomLists, false);
+		for (uint32_t i = 0; i < cascadeCount; ++i)
+		{
+			recordShadowSubpass(m_vulkanManager.acquireCommandBuffer(m_sceneCommandPoolSet, imgIdx, t), i, shadowLists[i],
+				!isShadowSubpassUpdated(i), true);
+		}
+#else
+		recordGeomPass(m_vulkanManager.acquireCommandBuffer(m_sceneCommandPoolSet, imgIdx, t), geomLists, true);
+		for (uint32_t i = 0; i < cascadeCount; ++i)
+		{
+			recordShadowSubpass(m_vulkanManager.acquireCommandBuffer(m_sceneCommandPoolSet, imgIdx, t), i, shadowLists[i], true, true);
+		}
+#endif
+	};
 
-	m_specEnvPrefilterDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+	// The frame's task workers record the chunks, this thread joins in while it waits
+	m_frameTasks.wait(m_frameTasks.addParallelFor(threadCount, 1, [&recordChunks](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t t = begin; t < end; ++t)
+		{
+			recordChunks(t);
+		}
+	}));
 }
-
-void DeferredRenderer::createGeomPassDescriptorSetLayout()
+void DeferredRenderer::createLightingUpsampleDescriptorSets()
 {
-	createStaticMeshDescriptorSetLayout();
-	createSkyboxDescriptorSetLayout();
-}
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	{
+		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
 
-void DeferredRenderer::createSkyboxDescriptorSetLayout()
-{
-	m_vulkanManager.beginCreateDescriptorSetLayout();
+		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_lightingUpsampleDescriptorSet);
 
-	// Transformation matrices
-	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageViewName = m_halfResLightingImage.imageViews[0];
+		imageInfos[0].samplerName = m_halfResLightingImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
 
-	// Albedo map
-	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		for (uint32_t i = 0; i < m_numGBuffers; ++i)
+		{
+			imageInfos[0].imageViewName = m_gbufferImages[i].imageViews[0];
+			imageInfos[0].samplerName = m_gbufferImages[i].samplers[0];
+			m_vulkanManager.descriptorSetAddImageDescriptor(1 + i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		}
 
-	m_skyboxDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+		imageInfos[0].imageViewName = m_depthImage.imageViews[0];
+		imageInfos[0].samplerName = m_depthImage.samplers[0];
+		m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+
+		m_vulkanManager.endUpdateDescriptorSet();
+	}
 }
 
-void DeferredRenderer::createStaticMeshDescriptorSetLayout()
+uint32_t DeferredRenderer::getSceneSecondaryCommandBuffers(uint32_t imgIdx, uint32_t passIdx, uint32_t *pCbs) const
 {
-	m_vulkanManager.beginCreateDescriptorSetLayout();
-
-	// Transformation matrices
-	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
-
-	// Per model information
-	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+	uint32_t count = 0;
+#ifdef USE_STATIC_SECONDARIES
+	// Cascades that keep their cached shadow maps only execute the dynamic secondaries, which then hold the profiler scope
+	if (passIdx == 0 || isShadowSubpassUpdated(passIdx - 1))
+	{
+		for (uint32_t t = 0; t < SCENE_RECORDING_THREAD_COUNT; ++t)
+		{
+			pCbs[count++] = m_vulkanManager.getCommandPoolSetBuffer(m_staticSceneCommandPoolSet, imgIdx * (1 + CSM_MAX_SEG_COUNT) + passIdx, t, 0);
+		}
+	}
+#endif
+	for (uint32_t t = 0; t < SCENE_RECORDING_THREAD_COUNT; ++t)
+	{
+		pCbs[count++] = m_vulkanManager.getCommandPoolSetBuffer(m_sceneCommandPoolSet, imgIdx, t, passIdx);
+	}
+	return count;
+}
 
-	// Albedo map
-	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+void DeferredRenderer::recordTaaResolve(uint32_t cb, uint32_t imgIdx)
+{
+	m_vulkanManager.cmdBeginRenderPass(cb, m_taaRenderPass, m_taaFramebuffer, {});
 
-	// Normal map
-	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_taaPipeline);
+	m_vulkanManager.cmdSetViewport(cb, m_taaFramebuffer);
+	m_vulkanManager.cmdSetScissor(cb, m_taaFramebuffer);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_taaPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_taaDescriptorSet });
 
-	// Roughness map
-	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.cmdCountImageTraffic(cb, m_lightingResultImage.image, false);
+	m_vulkanManager.cmdCountImageTraffic(cb, m_taaHistoryImage.image, false);
+	m_vulkanManager.cmdCountImageTraffic(cb, m_motionVectorImage.image, false);
+	m_vulkanManager.cmdDraw(cb, 3);
 
-	// Metalness map
-	m_vulkanManager.setLayoutAddBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_vulkanManager.cmdEndRenderPass(cb);
 
-	// AO map
-	m_vulkanManager.setLayoutAddBinding(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	// Keep the resolved frame without bloom as next frame's history. History and resolve target
+	// are shared by all frames, so one copy works with command buffers that are recorded once
+	m_vulkanManager.cmdImageBarrier(cb, m_taaHistoryImage.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
 
-	// Emissive map
-	m_vulkanManager.setLayoutAddBinding(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	// The resolve target leaves the render pass in the layout of bloom, the graph orders the next frame's write after the copy
+	m_vulkanManager.cmdCopyImage(cb, m_taaAccumulationImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		m_taaHistoryImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-	m_geomDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+	m_vulkanManager.cmdImageBarrier(cb, m_taaHistoryImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+#else
+	m_vulkanManager.cmdCopyImage(cb, m_taaResultImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		m_taaHistoryImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	m_vulkanManager.cmdImageBarrier(cb, m_taaHistoryImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+	m_vulkanManager.cmdImageBarrier(cb, m_taaResultImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+#endif
 }
 
-void DeferredRenderer::createShadowPassDescriptorSetLayout()
+void DeferredRenderer::recordLightingUpsample(uint32_t cb, uint32_t imgIdx)
 {
-	m_vulkanManager.beginCreateDescriptorSetLayout();
-	// light View Project Crop Matrix
-	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
-	m_shadowDescriptorSetLayout1 = m_vulkanManager.endCreateDescriptorSetLayout();
+	m_vulkanManager.cmdBeginRenderPass(cb, m_lightingUpsampleRenderPass, m_lightingUpsampleFramebuffer, {});
+
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_lightingUpsamplePipeline);
+	m_vulkanManager.cmdSetViewport(cb, m_lightingUpsampleFramebuffer, 0.f, 0.f, m_renderScale, m_renderScale);
+	m_vulkanManager.cmdSetScissor(cb, m_lightingUpsampleFramebuffer, 0.f, 0.f, m_renderScale, m_renderScale);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_lightingUpsamplePipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_lightingUpsampleDescriptorSet });
+#ifdef USE_DYNAMIC_RESOLUTION
+	m_vulkanManager.cmdPushConstants(cb, m_lightingUpsamplePipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &m_renderScale);
+#endif
 
-	m_vulkanManager.beginCreateDescriptorSetLayout();
-	// Per model information
-	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
-	m_shadowDescriptorSetLayout2 = m_vulkanManager.endCreateDescriptorSetLayout();
+	m_vulkanManager.cmdDraw(cb, 3);
+
+	m_vulkanManager.cmdEndRenderPass(cb);
 }
 
-void DeferredRenderer::createLightingPassDescriptorSetLayout()
+void DeferredRenderer::recordComputeBloom(uint32_t cb, uint32_t imgIdx)
 {
-	m_vulkanManager.beginCreateDescriptorSetLayout();
-
-	// Light information
-	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
-
-	// gbuffer 1
-	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-
-	// gbuffer 2
-	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#ifdef USE_TAA
+	const uint32_t sceneColorImage = m_taaResultImage.image;
+#else
+	const uint32_t sceneColorImage = m_lightingResultImage.image;
+#endif
 
-	// gbuffer 3
-	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+#ifdef USE_ASYNC_COMPUTE
+	// The semaphore wait covers the graphics queue's writes. Acquire the scene color released by the post effect command buffer.
+	// The mip chain is overwritten, so the previous frame's contents need no acquire
+	recordQueueOwnershipTransfer(cb, sceneColorImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true, false,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+#else
+	// Wait for the scene color like a render pass would, and for the previous frame's merge and upsamples to finish with the mip chain
+	const VkSubpassDependency dependency = m_renderGraph.getEntryDependency({ m_renderGraphNames.bloomPasses[0] });
+	m_vulkanManager.cmdMemoryBarrier(cb,
+		dependency.srcStageMask | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		dependency.srcAccessMask, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+#endif
 
-	// depth image
-	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	auto dispatchLevel = [&](uint32_t level)
+	{
+		const uint32_t width = std::max(m_bloomMipImage.width >> level, 1u);
+		const uint32_t height = std::max(m_bloomMipImage.height >> level, 1u);
+		m_vulkanManager.cmdDispatch(cb, (width + BLOOM_GROUP_SIZE - 1) / BLOOM_GROUP_SIZE, (height + BLOOM_GROUP_SIZE - 1) / BLOOM_GROUP_SIZE, 1);
 
-	// specular irradiance map (prefiltered environment map)
-	m_vulkanManager.setLayoutAddBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		// Each dispatch reads what the previous one wrote. Barriers are all that is left of the render pass boundaries
+		m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	};
 
-	// BRDF LUT
-	m_vulkanManager.setLayoutAddBinding(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	// Downsample chain, level 0 is the prefilter
+	for (uint32_t level = 0; level < m_bloomMipImage.mipLevelCount; ++level)
+	{
+		if (level < 2)
+		{
+			m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, level == 0 ? m_bloomPrefilterPipeline : m_bloomDownsamplePipeline);
+		}
+		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_bloomComputePipelineLayout, { m_bloomDownsampleDescriptorSets[level] });
+		m_gpuProfiler.beginScope(cb, imgIdx, "downsample" + std::to_string(level));
+		m_vulkanManager.cmdCountImageTraffic(cb, level == 0 ? sceneColorImage : m_bloomMipImage.image, false, level == 0 ? 0 : level - 1);
+		m_vulkanManager.cmdCountImageTraffic(cb, m_bloomMipImage.image, true, level);
+		dispatchLevel(level);
+		m_gpuProfiler.endScope(cb, imgIdx);
+	}
 
-	// shadow maps
-	m_vulkanManager.setLayoutAddBinding(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	// Upsample back to mip 0, every level accumulates all smaller ones
+	if (m_bloomMipImage.mipLevelCount > 1)
+	{
+		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_bloomUpsamplePipeline);
+	}
+	for (uint32_t level = m_bloomMipImage.mipLevelCount - 1; level-- > 0;)
+	{
+		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_bloomComputePipelineLayout, { m_bloomUpsampleDescriptorSets[level] });
+		m_gpuProfiler.beginScope(cb, imgIdx, "upsample" + std::to_string(level));
+		m_vulkanManager.cmdCountImageTraffic(cb, m_bloomMipImage.image, false, level, 2);
+		m_vulkanManager.cmdCountImageTraffic(cb, m_bloomMipImage.image, true, level);
+		dispatchLevel(level);
+		m_gpuProfiler.endScope(cb, imgIdx);
+	}
 
-	m_lightingDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+#ifdef USE_ASYNC_COMPUTE
+	// Hand both images back for the final output pass, which acquires them after waiting on @m_bloomComputeSemaphore
+	recordQueueOwnershipTransfer(cb, sceneColorImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, true,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0);
+	recordQueueOwnershipTransfer(cb, m_bloomMipImage.image, VK_IMAGE_LAYOUT_GENERAL, false, true,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+#else
+	// The merge pass, or the final output pass with USE_FUSED_BLOOM_MERGE, samples mip 0
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+#endif
 }
 
-void DeferredRenderer::createBloomDescriptorSetLayout()
+void DeferredRenderer::recordAutoExposure(uint32_t cb, uint32_t imgIdx)
 {
-	m_vulkanManager.beginCreateDescriptorSetLayout();
+	// Wait for the scene color like a render pass would. The previous frame's adaptation wrote the exposure and cleared the
+	// histogram, and its bloom and final output passes read the exposure
+	const VkSubpassDependency dependency = m_renderGraph.getEntryDependency({ m_renderGraphNames.autoExposurePass });
+	m_vulkanManager.cmdMemoryBarrier(cb,
+		dependency.srcStageMask | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		dependency.srcAccessMask | VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_autoExposurePipelineLayout,
+		{ m_perFrameDescriptorSets[imgIdx].m_autoExposureDescriptorSet });
+
+	// Only the rendered part of the scene color is counted
+	const uint32_t extent[] =
+	{
+		std::max(static_cast<uint32_t>(m_lightingResultImage.width * m_renderScale), 1u),
+		std::max(static_cast<uint32_t>(m_lightingResultImage.height * m_renderScale), 1u)
+	};
+	m_vulkanManager.cmdPushConstants(cb, m_autoExposurePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(extent), extent);
 
-	// input image
-	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	const uint32_t texelsPerGroup = AUTO_EXPOSURE_DOWNSAMPLE * AUTO_EXPOSURE_GROUP_SIZE;
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_luminanceHistogramPipeline);
+	m_vulkanManager.cmdDispatch(cb, (extent[0] + texelsPerGroup - 1) / texelsPerGroup, (extent[1] + texelsPerGroup - 1) / texelsPerGroup, 1);
 
-	m_bloomDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
-}
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 
-void DeferredRenderer::createFinalOutputDescriptorSetLayout()
-{
-	m_vulkanManager.beginCreateDescriptorSetLayout();
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_exposureAdaptPipeline);
+	m_vulkanManager.cmdDispatch(cb, 1, 1, 1);
 
-	// Final image, gbuffer, depth image
-	m_vulkanManager.setLayoutAddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_vulkanManager.setLayoutAddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_vulkanManager.setLayoutAddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_vulkanManager.setLayoutAddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_vulkanManager.setLayoutAddBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	// The bloom prefilter or brightness mask and the final output pass read the exposure
+	m_vulkanManager.cmdMemoryBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
 
-	// Uniform buffer
-	m_vulkanManager.setLayoutAddBinding(5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+void DeferredRenderer::recordQueueOwnershipTransfer(uint32_t cb, uint32_t imageName, VkImageLayout layout, bool toCompute, bool release,
+	VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	// With a single family these degenerate to execution barriers, the semaphores between the submits already order everything
+	const auto &families = m_vulkanManager.getQueueFamilyIndices();
+	const uint32_t srcFamily = toCompute ? families.graphicsFamily : families.computeFamily;
+	const uint32_t dstFamily = toCompute ? families.computeFamily : families.graphicsFamily;
 
-	m_finalOutputDescriptorSetLayout = m_vulkanManager.endCreateDescriptorSetLayout();
+	if (release)
+	{
+		m_vulkanManager.cmdImageBarrier(cb, imageName, layout, layout, stages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, access, 0,
+			VK_IMAGE_ASPECT_COLOR_BIT, srcFamily, dstFamily);
+	}
+	else
+	{
+		m_vulkanManager.cmdImageBarrier(cb, imageName, layout, layout, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, stages, 0, access,
+			VK_IMAGE_ASPECT_COLOR_BIT, srcFamily, dstFamily);
+	}
 }
 
-void DeferredRenderer::createBrdfLutPipeline()
+void DeferredRenderer::recordPostEffectCommandBuffer(uint32_t imgIdx)
 {
-	const std::string csFileName = "../shaders/brdf_lut_pass/brdf_lut.comp.spv";
+	uint32_t cb = m_perFrameCommandBuffers[imgIdx].m_postEffectCommandBuffer;
+	m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
 
-	m_vulkanManager.beginCreatePipelineLayout();
-	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_brdfLutDescriptorSetLayout });
-	m_brdfLutPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+#ifdef USE_TAA
+	m_gpuProfiler.beginScope(cb, imgIdx, "taa resolve", true);
+	recordTaaResolve(cb, imgIdx);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
 
-	m_vulkanManager.beginCreateComputePipeline(m_brdfLutPipelineLayout);
-	m_vulkanManager.computePipelineAddShaderStage(csFileName);
-	m_brdfLutPipeline = m_vulkanManager.endCreateComputePipeline();
-}
+#ifdef USE_AUTO_EXPOSURE
+	m_gpuProfiler.beginScope(cb, imgIdx, "auto exposure", true);
+	recordAutoExposure(cb, imgIdx);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
 
-void DeferredRenderer::createSpecEnvPrefilterPipeline()
-{
-	if (m_initialized)
+#if defined(USE_ASYNC_COMPUTE)
+	// The bloom itself, and its scope, is recorded into @m_bloomComputeCommandBuffer
 	{
-		m_vulkanManager.destroyPipelineLayout(m_specEnvPrefilterPipelineLayout);
-		m_vulkanManager.destroyPipeline(m_specEnvPrefilterPipeline);
+#ifdef USE_TAA
+		const uint32_t sceneColorImage = m_taaResultImage.image;
+#else
+		const uint32_t sceneColorImage = m_lightingResultImage.image;
+#endif
+		const VkSubpassDependency dependency = m_renderGraph.getEntryDependency({ m_renderGraphNames.bloomPasses[0] });
+		recordQueueOwnershipTransfer(cb, sceneColorImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true, true,
+			dependency.srcStageMask, dependency.srcAccessMask);
 	}
+#elif defined(USE_COMPUTE_BLOOM)
+	m_gpuProfiler.beginScope(cb, imgIdx, "bloom", true);
+	recordComputeBloom(cb, imgIdx);
+#else
+	m_gpuProfiler.beginScope(cb, imgIdx, "bloom", true);
 
-	const std::string vsFileName = "../shaders/env_prefilter_pass/env_prefilter.vert.spv";
-	const std::string gsFileName = "../shaders/env_prefilter_pass/env_prefilter.geom.spv";
-	const std::string fsFileName = "../shaders/env_prefilter_pass/spec_env_prefilter.frag.spv";
-
-	m_vulkanManager.beginCreatePipelineLayout();
-	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_specEnvPrefilterDescriptorSetLayout });
-	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(float), VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_specEnvPrefilterPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+	// brightness mask
+	m_gpuProfiler.beginScope(cb, imgIdx, "brightness");
+	std::vector<VkClearValue> clearValues(1);
+	clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+	m_vulkanManager.cmdBeginRenderPass(cb, m_bloomRenderPasses[0], m_postEffectFramebuffers[0], clearValues);
+
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_bloomPipelines[0]);
+	m_vulkanManager.cmdSetViewport(cb, m_postEffectFramebuffers[0], 0.f, 0.f, m_renderScale, m_renderScale);
+	m_vulkanManager.cmdSetScissor(cb, m_postEffectFramebuffers[0], 0.f, 0.f, m_renderScale, m_renderScale);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_bloomPipelineLayouts[0], { m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[0] });
+#ifdef USE_DYNAMIC_RESOLUTION
+	m_vulkanManager.cmdPushConstants(cb, m_bloomPipelineLayouts[0], VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &m_renderScale);
+#endif
 
-	m_vulkanManager.beginCreateGraphicsPipeline(m_specEnvPrefilterPipelineLayout, m_specEnvPrefilterRenderPass, 0);
+#ifdef USE_LIGHTING_BLOOM_BRIGHTNESS
+	m_vulkanManager.cmdCountImageTraffic(cb, m_bloomBrightImage.image, false);
+#elif defined(USE_TAA)
+	m_vulkanManager.cmdCountImageTraffic(cb, m_taaResultImage.image, false);
+#else
+	m_vulkanManager.cmdCountImageTraffic(cb, m_lightingResultImage.image, false);
+#endif
+	m_vulkanManager.cmdDraw(cb, 3);
 
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_GEOMETRY_BIT, gsFileName);
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+	m_vulkanManager.cmdEndRenderPass(cb);
+	m_gpuProfiler.endScope(cb, imgIdx);
 
-	auto bindingDesc = Vertex::getBindingDescription();
-	m_vulkanManager.graphicsPipelineAddBindingDescription(bindingDesc.binding, bindingDesc.stride, bindingDesc.inputRate);
-	auto attrDescs = Vertex::getAttributeDescriptions();
-	for (const auto &attrDesc : attrDescs)
+#ifdef USE_COMPUTE_BLUR
+	// gaussian blur, horizontal into post effect image 1 and vertical back into image 0, of the rendered part
+	m_gpuProfiler.beginScope(cb, imgIdx, "blur0");
+	const uint32_t blurWidth = std::max(static_cast<uint32_t>(m_postEffectImages[0].width * m_renderScale), 1u);
+	const uint32_t blurHeight = std::max(static_cast<uint32_t>(m_postEffectImages[0].height * m_renderScale), 1u);
+	for (uint32_t i = 0; i < 2; ++i)
 	{
-		m_vulkanManager.graphicsPipelineAddAttributeDescription(attrDesc.location, attrDesc.binding, attrDesc.format, attrDesc.offset);
+		const uint32_t graphPass = m_renderGraphNames.bloomPasses[1 + i];
+		const auto &src = m_postEffectImages[i];
+		const auto &dst = m_postEffectImages[(i + 1) % 2];
+
+		// Wait like a render pass would. The destination is overwritten
+		const VkSubpassDependency dependency = m_renderGraph.getEntryDependency({ graphPass });
+		m_vulkanManager.cmdMemoryBarrier(cb, dependency.srcStageMask, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			dependency.srcAccessMask, VK_ACCESS_SHADER_READ_BIT);
+		m_vulkanManager.cmdImageBarrier(cb, dst.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+			dependency.srcStageMask, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dependency.srcAccessMask, VK_ACCESS_SHADER_WRITE_BIT);
+
+		m_vulkanManager.cmdCountImageTraffic(cb, src.image, false);
+		m_vulkanManager.cmdCountImageTraffic(cb, dst.image, true);
+		m_separableBlur->cmdBlur(cb, m_bloomBlurPipeline, m_bloomBlurDescriptorSets[i], blurWidth, blurHeight, i);
+
+		// Leave the destination in the layout of its next access, the vertical blur or the merge samples it
+		m_vulkanManager.cmdImageBarrier(cb, dst.image, VK_IMAGE_LAYOUT_GENERAL,
+			m_renderGraph.getFinalLayout(graphPass, m_renderGraphNames.postEffectImages[(i + 1) % 2]),
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
 	}
+	m_gpuProfiler.endScope(cb, imgIdx);
+#else
+	// gaussian blur
+	const uint32_t bloomPassCount = 1;
+	for (uint32_t i = 0; i < bloomPassCount; ++i)
+	{
+		m_gpuProfiler.beginScope(cb, imgIdx, "blur" + std::to_string(i));
 
-	m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
-
-	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+		// horizontal
+		m_vulkanManager.cmdBeginRenderPass(cb, m_bloomRenderPasses[0], m_postEffectFramebuffers[1], clearValues);
 
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_bloomPipelines[1]);
+		m_vulkanManager.cmdSetViewport(cb, m_postEffectFramebuffers[1], 0.f, 0.f, m_renderScale, m_renderScale);
+		m_vulkanManager.cmdSetScissor(cb, m_postEffectFramebuffers[1], 0.f, 0.f, m_renderScale, m_renderScale);
+		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_bloomPipelineLayouts[1], { m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[1] });
+#ifdef USE_DYNAMIC_RESOLUTION
+		// Kept by the vertical pass, which uses the same layout
+		m_vulkanManager.cmdPushConstants(cb, m_bloomPipelineLayouts[1], VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(uint32_t), sizeof(float), &m_renderScale);
+#endif
 
-	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
-	m_vulkanManager.graphicsPipelineAddDynamicState(VK_DYNAMIC_STATE_SCISSOR);
+		uint32_t isHorizontal = VK_TRUE;
+		m_vulkanManager.cmdPushConstants(cb, m_bloomPipelineLayouts[1], VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &isHorizontal);
 
-	m_specEnvPrefilterPipeline = m_vulkanManager.endCreateGraphicsPipeline();
-}
+		m_vulkanManager.cmdCountImageTraffic(cb, m_postEffectImages[0].image, false);
+		m_vulkanManager.cmdDraw(cb, 3);
 
-void DeferredRenderer::createGeomPassPipeline()
-{
-	createSkyboxPipeline();
-	createStaticMeshPipeline();
-}
+		m_vulkanManager.cmdEndRenderPass(cb);
 
-void DeferredRenderer::createSkyboxPipeline()
-{
-	if (m_initialized)
-	{
-		m_vulkanManager.destroyPipelineLayout(m_skyboxPipelineLayout);
-		m_vulkanManager.destroyPipeline(m_skyboxPipeline);
-	}
+		// vertical
+		m_vulkanManager.cmdBeginRenderPass(cb, m_bloomRenderPasses[0], m_postEffectFramebuffers[0], clearValues);
 
-	const std::string vsFileName = "../shaders/geom_pass/skybox.vert.spv";
-	const std::string fsFileName = "../shaders/geom_pass/skybox.frag.spv";
+		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_bloomPipelines[1]);
+		m_vulkanManager.cmdSetViewport(cb, m_postEffectFramebuffers[0], 0.f, 0.f, m_renderScale, m_renderScale);
+		m_vulkanManager.cmdSetScissor(cb, m_postEffectFramebuffers[0], 0.f, 0.f, m_renderScale, m_renderScale);
+		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_bloomPipelineLayouts[1], { m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[2] });
 
-	m_vulkanManager.beginCreatePipelineLayout();
-	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_skyboxDescriptorSetLayout });
-	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(uint32_t), VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_skyboxPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+		isHorizontal = VK_FALSE;
+		m_vulkanManager.cmdPushConstants(cb, m_bloomPipelineLayouts[1], VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &isHorizontal);
 
-	m_vulkanManager.beginCreateGraphicsPipeline(m_skyboxPipelineLayout, m_geomRenderPass, 0);
+		m_vulkanManager.cmdCountImageTraffic(cb, m_postEffectImages[1].image, false);
+		m_vulkanManager.cmdDraw(cb, 3);
 
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+		m_vulkanManager.cmdEndRenderPass(cb);
 
-	auto bindingDesc = Vertex::getBindingDescription();
-	m_vulkanManager.graphicsPipelineAddBindingDescription(bindingDesc.binding, bindingDesc.stride, bindingDesc.inputRate);
-	auto attrDescs = Vertex::getAttributeDescriptions();
-	for (const auto &attrDesc : attrDescs)
-	{
-		m_vulkanManager.graphicsPipelineAddAttributeDescription(attrDesc.location, attrDesc.binding, attrDesc.format, attrDesc.offset);
+		m_gpuProfiler.endScope(cb, imgIdx);
 	}
+#endif
 
-	m_vulkanManager.graphicsPipelineConfigureMultisampleState(SAMPLE_COUNT);
+#endif
 
-	VkExtent2D swapChainExtent = m_vulkanManager.getSwapChainExtent();
-	m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f,
-		static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height));
+#ifndef USE_FUSED_BLOOM_MERGE
+	// merge, the last bloom render pass. Its descriptor set samples bloom mip 0 with USE_COMPUTE_BLOOM
+#ifdef USE_COMPUTE_BLOOM
+	const uint32_t mergeDescriptorSet = 0;
+#else
+	const uint32_t mergeDescriptorSet = 1;
+#endif
+	m_gpuProfiler.beginScope(cb, imgIdx, "merge");
+	m_vulkanManager.cmdBeginRenderPass(cb, m_bloomRenderPasses.back(), m_postEffectFramebuffers.back(), {});
+
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_bloomPipelines.back());
+	m_vulkanManager.cmdSetViewport(cb, m_postEffectFramebuffers.back(), 0.f, 0.f, m_renderScale, m_renderScale);
+	m_vulkanManager.cmdSetScissor(cb, m_postEffectFramebuffers.back(), 0.f, 0.f, m_renderScale, m_renderScale);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_bloomPipelineLayouts[0], { m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[mergeDescriptorSet] });
+#ifdef USE_DYNAMIC_RESOLUTION
+	m_vulkanManager.cmdPushConstants(cb, m_bloomPipelineLayouts[0], VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &m_renderScale);
+#endif
 
-	// Clamp fragment depth to [0, 1] instead of clipping to avoid clipping the sky box
-	m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_FRONT_BIT, VK_FRONT_FACE_CLOCKWISE,
-		1.f, VK_FALSE, 0.f, 0.f, VK_TRUE);
-	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+#ifdef USE_COMPUTE_BLOOM
+	m_vulkanManager.cmdCountImageTraffic(cb, m_bloomMipImage.image, false);
+#else
+	m_vulkanManager.cmdCountImageTraffic(cb, m_postEffectImages[0].image, false);
+#endif
+	m_vulkanManager.cmdDraw(cb, 3);
 
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+	m_vulkanManager.cmdEndRenderPass(cb);
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
 
-	m_skyboxPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+#ifndef USE_ASYNC_COMPUTE
+	m_gpuProfiler.endScope(cb, imgIdx);
+#endif
+
+	m_vulkanManager.endCommandBuffer(cb);
 }
 
-void DeferredRenderer::createStaticMeshPipeline()
+void DeferredRenderer::createBloomComputeCommandBuffers()
 {
-	if (m_initialized)
+	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
 	{
-		m_vulkanManager.destroyPipelineLayout(m_geomPipelineLayout);
-		m_vulkanManager.destroyPipeline(m_geomPipeline);
+		uint32_t cb = m_perFrameCommandBuffers[imgIdx].m_bloomComputeCommandBuffer;
+		m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
+
+		// The query pool was reset on the graphics queue, before the semaphore this submit waits on
+		m_gpuProfiler.beginScope(cb, imgIdx, "bloom");
+		recordComputeBloom(cb, imgIdx);
+		m_gpuProfiler.endScope(cb, imgIdx);
+
+		m_vulkanManager.endCommandBuffer(cb);
 	}
+}
 
-	const std::string vsFileName = "../shaders/geom_pass/geom.vert.spv";
-	const std::string fsFileName = "../shaders/geom_pass/geom.frag.spv";
+void DeferredRenderer::recordPresentCommandBuffer(uint32_t imgIdx)
+{
+	// Final ouput pass
+	std::vector<VkClearValue> clearValues(1);
+	clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
 
-	m_vulkanManager.beginCreatePipelineLayout();
-	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_geomDescriptorSetLayout });
-	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, 3 * sizeof(uint32_t), VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_geomPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+	uint32_t cb = m_perFrameCommandBuffers[imgIdx].m_presentCommandBuffer;
+	m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
 
-	m_vulkanManager.beginCreateGraphicsPipeline(m_geomPipelineLayout, m_geomRenderPass, 0);
+	m_gpuProfiler.beginScope(cb, imgIdx, "final output", true);
 
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+#ifdef USE_ASYNC_COMPUTE
+#ifdef USE_TAA
+	const uint32_t sceneColorImage = m_taaResultImage.image;
+#else
+	const uint32_t sceneColorImage = m_lightingResultImage.image;
+#endif
+	recordQueueOwnershipTransfer(cb, sceneColorImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, false,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	recordQueueOwnershipTransfer(cb, m_bloomMipImage.image, VK_IMAGE_LAYOUT_GENERAL, false, false,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+#endif
 
-	auto bindingDesc = Vertex::getBindingDescription();
-	m_vulkanManager.graphicsPipelineAddBindingDescription(bindingDesc.binding, bindingDesc.stride, bindingDesc.inputRate);
-	auto attrDescs = Vertex::getAttributeDescriptions();
-	for (const auto &attrDesc : attrDescs)
-	{
-		m_vulkanManager.graphicsPipelineAddAttributeDescription(attrDesc.location, attrDesc.binding, attrDesc.format, attrDesc.offset);
-	}
+	m_vulkanManager.cmdBeginRenderPass(cb, m_finalOutputRenderPass, m_finalOutputFramebuffers[imgIdx], clearValues);
 
-#ifdef USE_GLTF
-	// temporary hack
-	m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+#ifdef USE_COLOR_LUT
+	// Re-recorded when the display mode changes
+	const uint32_t finalOutputPipeline = m_displayMode == DISPLAY_MODE_FULL ? m_finalOutputPipeline : m_finalOutputDebugPipeline;
+#else
+	const uint32_t finalOutputPipeline = m_finalOutputPipeline;
+#endif
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, finalOutputPipeline);
+	m_vulkanManager.cmdSetViewport(cb, m_finalOutputFramebuffers[imgIdx]);
+	m_vulkanManager.cmdSetScissor(cb, m_finalOutputFramebuffers[imgIdx]);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_finalOutputPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_finalOutputDescriptorSet });
+#ifdef USE_DYNAMIC_RESOLUTION
+	// Upscales the scaled part of the scene color to the whole swapchain image
+	m_vulkanManager.cmdPushConstants(cb, m_finalOutputPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &m_renderScale);
 #endif
 
-	m_vulkanManager.graphicsPipelineConfigureMultisampleState(SAMPLE_COUNT, VK_TRUE, 0.25f);
+	// The scene color, and with USE_FUSED_BLOOM_MERGE bloom mip 0
+#ifdef USE_TAA
+	m_vulkanManager.cmdCountImageTraffic(cb, m_taaResultImage.image, false);
+#else
+	m_vulkanManager.cmdCountImageTraffic(cb, m_lightingResultImage.image, false);
+#endif
+#ifdef USE_FUSED_BLOOM_MERGE
+	m_vulkanManager.cmdCountImageTraffic(cb, m_bloomMipImage.image, false);
+#endif
+	m_vulkanManager.cmdDraw(cb, 3);
 
-	VkExtent2D swapChainExtent = m_vulkanManager.getSwapChainExtent();
-	m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f,
-		static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height));
+	m_vulkanManager.cmdEndRenderPass(cb);
 
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+	m_gpuProfiler.endScope(cb, imgIdx);
 
-	m_geomPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+	m_vulkanManager.endCommandBuffer(cb);
 }
 
-void DeferredRenderer::createShadowPassPipeline()
+bool DeferredRenderer::updateColorLut(uint32_t imgIdx)
 {
-	if (m_initialized)
-	{
-		m_vulkanManager.destroyPipelineLayout(m_shadowPipelineLayout);
-		for (auto p : m_shadowPipelines)
-		{
-			m_vulkanManager.destroyPipeline(p);
-		}
-	}
+#ifdef USE_DEVICE_GROUP
+	// Every device has its own LUT, baked by the first frame it renders after a change
+	if (!m_colorLutBaked || memcmp(&m_bakedColorGrading, &m_colorGrading, sizeof(ColorGrading)) != 0) m_colorLutBakedDevices = 0;
+	if (m_colorLutBakedDevices & (1u << m_frameDeviceIndex)) return false;
+	m_colorLutBakedDevices |= 1u << m_frameDeviceIndex;
+#else
+	if (m_colorLutBaked && memcmp(&m_bakedColorGrading, &m_colorGrading, sizeof(ColorGrading)) == 0) return false;
+#endif
 
-	const std::string vsFileName = "../shaders/shadow_pass/shadow.vert.spv";
+	m_bakedColorGrading = m_colorGrading;
+	m_colorLutBaked = true;
 
-	m_vulkanManager.beginCreatePipelineLayout();
-	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_shadowDescriptorSetLayout1, m_shadowDescriptorSetLayout2 });
-	m_shadowPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+	// The frame that last submitted this image's command buffer has completed
+	const uint32_t cb = m_perFrameCommandBuffers[imgIdx].m_colorLutCommandBuffer;
+	m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
-	m_shadowPipelines.resize(m_camera.getSegmentCount());
-	for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
-	{
-		m_vulkanManager.beginCreateGraphicsPipeline(m_shadowPipelineLayout, m_shadowRenderPass, i);
+	// Every texel is rewritten, so the old contents are dropped. Frames in flight sample the LUT in final output passes submitted
+	// earlier to the same queue, waiting for their fragment shaders is enough to write after those reads
+	m_vulkanManager.cmdImageBarrier(cb, m_colorLutImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_ACCESS_SHADER_WRITE_BIT);
 
-		m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_colorLutPipeline);
+	m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_colorLutPipelineLayout, { m_colorLutDescriptorSet });
+	m_vulkanManager.cmdPushConstants(cb, m_colorLutPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ColorGrading), &m_bakedColorGrading);
 
-		auto bindingDesc = Vertex::getBindingDescription();
-		m_vulkanManager.graphicsPipelineAddBindingDescription(bindingDesc.binding, bindingDesc.stride, bindingDesc.inputRate);
-		auto attrDescs = Vertex::getAttributeDescriptions();
-		m_vulkanManager.graphicsPipelineAddAttributeDescription(attrDescs[0].location, attrDescs[0].binding, attrDescs[0].format, attrDescs[0].offset);
+	const uint32_t groupCount = (COLOR_LUT_SIZE + COLOR_LUT_GROUP_SIZE - 1) / COLOR_LUT_GROUP_SIZE;
+	m_vulkanManager.cmdDispatch(cb, groupCount, groupCount, groupCount);
 
-		VkExtent2D swapChainExtent = { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE };
-		m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f,
-			static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height));
+	m_vulkanManager.cmdImageBarrier(cb, m_colorLutImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
 
-#ifdef USE_GLTF
-		m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE,
-			1.f, VK_TRUE, 1.f, 1.f);
-#else
-		m_vulkanManager.graphicsPipelineConfigureRasterizer(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_CLOCKWISE,
-			1.f, VK_TRUE, 1.f, 1.f);
-#endif
+	m_vulkanManager.endCommandBuffer(cb);
 
-		m_shadowPipelines[i] = m_vulkanManager.endCreateGraphicsPipeline();
-	}
+	return true;
 }
 
-void DeferredRenderer::createLightingPassPipeline()
+void DeferredRenderer::prefilterEnvironmentAndComputeBrdfLut()
 {
-	if (m_initialized)
-	{
-		m_vulkanManager.destroyPipelineLayout(m_lightingPipelineLayout);
-		m_vulkanManager.destroyPipeline(m_lightingPipeline);
-	}
+	// References:
+	//   [1] http://blog.selfshadow.com/publications/s2013-shading-course/karis/s2013_pbs_epic_notes_v2.pdf
+	//   [2] https://github.com/derkreature/IBLBaker
 
-	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
-	const std::string fsFileName = "../shaders/lighting_pass/lighting.frag.spv";
+	// Set up cube map camera
+	m_uCubeViews->V[0] = glm::lookAt(glm::vec3(0.f), glm::vec3(1.f, 0.f, 0.f), glm::vec3(0.f, -1.f, 0.f));	// +X
+	m_uCubeViews->V[1] = glm::lookAt(glm::vec3(0.f), glm::vec3(-1.f, 0.f, 0.f), glm::vec3(0.f, -1.f, 0.f));	// -X
+	m_uCubeViews->V[2] = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f), glm::vec3(0.f, 0.f, 1.f));	// +Y
+	m_uCubeViews->V[3] = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, -1.f, 0.f), glm::vec3(0.f, 0.f, -1.f));	// -Y
+	m_uCubeViews->V[4] = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, 1.f), glm::vec3(0.f, -1.f, 0.f));	// +Z
+	m_uCubeViews->V[5] = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, -1.f, 0.f));	// -Z
+	m_uCubeViews->P = glm::perspective(glm::radians(90.f), 1.f, 0.1f, 100.f);
 
-	m_vulkanManager.beginCreatePipelineLayout();
-	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_lightingDescriptorSetLayout });
-	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, 3 * sizeof(uint32_t), VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_lightingPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+	void *mapped = m_vulkanManager.mapBuffer(m_oneTimeUniformDeviceData.buffer,
+		m_oneTimeUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCubeViews)), sizeof(CubeMapCameraUniformBuffer));
+	memcpy(mapped, m_uCubeViews, sizeof(CubeMapCameraUniformBuffer));
+	m_vulkanManager.unmapBuffer(m_oneTimeUniformDeviceData.buffer);
 
-	m_vulkanManager.beginCreateGraphicsPipeline(m_lightingPipelineLayout, m_lightingRenderPass, 0);
+	// Bake BRDF terms
+	if (!m_bakedBrdfReady)
+	{
+		m_vulkanManager.beginQueueSubmit(VK_QUEUE_COMPUTE_BIT);
+		m_vulkanManager.queueSubmitNewSubmit({ m_brdfLutCommandBuffer });
+		m_vulkanManager.endQueueSubmit(m_brdfLutFence, false);
+	}
 
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+	// Prefilter radiance map
+	if (!m_scene.skybox.specMapReady)
+	{
+		m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+		m_vulkanManager.queueSubmitNewSubmit({ m_envPrefilterCommandBuffer });
+		m_vulkanManager.endQueueSubmit(m_envPrefilterFence, false);
+	}
 
-	// Use specialization constants to pass number of lights and samples to the shader
-	uint32_t numLights = NUM_LIGHTS;
-	uint32_t sampleCount = SAMPLE_COUNT;
-	m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 0, 0, sizeof(uint32_t), &numLights);
-	m_vulkanManager.graphicsPipelineAddSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, 1, sizeof(uint32_t), sizeof(uint32_t), &sampleCount);
+#ifdef USE_GPU_SH_PROJECTION
+	// Project the radiance map onto the diffuse SH coefficients
+	if (!m_scene.skybox.diffuseSHReady)
+	{
+		m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+		m_vulkanManager.queueSubmitNewSubmit({ m_shProjectionCommandBuffer });
+		m_vulkanManager.endQueueSubmit(m_shProjectionFence, false);
 
-	VkExtent2D swapChainExtent = m_vulkanManager.getSwapChainExtent();
-	m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f,
-		static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height));
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+		// A few dispatches, not worth a fallback
+		m_vulkanManager.waitForFences({ m_shProjectionFence });
+#endif
+	}
+#endif
 
-	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+#ifdef USE_ASYNC_IBL_PRECOMPUTE
+	updateIblPrecomputation(false);
+#else
+	updateIblPrecomputation(true);
+#endif
+}
 
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+bool DeferredRenderer::isSpecEnvPrefilterNeeded() const
+{
+#ifdef USE_PROBE_SWITCHING
+	return true;
+#else
+	return !m_scene.skybox.specMapReady;
+#endif
+}
 
-	m_lightingPipeline = m_vulkanManager.endCreateGraphicsPipeline();
+void DeferredRenderer::destroyBrdfLutBakeResources()
+{
+	// Its set goes with the next reset of the descriptor pool, its command buffer is not recorded again
+	m_vulkanManager.destroyPipeline(m_brdfLutPipeline);
+	m_vulkanManager.destroyPipelineLayout(m_brdfLutPipelineLayout);
 }
 
-void DeferredRenderer::createBloomPipelines()
+void DeferredRenderer::destroySpecEnvPrefilterResources()
 {
-	if (m_initialized)
+	if (isSpecEnvPrefilterNeeded()) return;
+
+	m_vulkanManager.destroyPipeline(m_specEnvPrefilterPipeline);
+	m_vulkanManager.destroyPipelineLayout(m_specEnvPrefilterPipelineLayout);
+#ifndef USE_COMPUTE_ENV_PREFILTER
+	for (uint32_t framebuffer : m_specEnvPrefilterFramebuffers)
 	{
-		for (auto name : m_bloomPipelineLayouts)
-		{
-			m_vulkanManager.destroyPipelineLayout(name);
-		}
+		m_vulkanManager.destroyFramebuffer(framebuffer);
+	}
+	m_specEnvPrefilterFramebuffers.clear();
+	m_vulkanManager.destroyRenderPass(m_specEnvPrefilterRenderPass);
+#endif
+}
 
-		for (auto name : m_bloomPipelines)
-		{
-			m_vulkanManager.destroyPipeline(name);
-		}
+void DeferredRenderer::createProbeVolumeResources()
+{
+	// Flat scenes would collapse the grid, pad such axes to one cell of the longest one
+	const bool sceneEmpty = glm::any(glm::greaterThan(m_scene.aabbWorldSpace.min, m_scene.aabbWorldSpace.max));
+	m_probeVolumeBounds = sceneEmpty ? BBox(glm::vec3(-1.f), glm::vec3(1.f)) : m_scene.aabbWorldSpace;
+	const glm::vec3 extent = m_probeVolumeBounds.max - m_probeVolumeBounds.min;
+	const float minExtent = std::max(std::max(extent.x, std::max(extent.y, extent.z)), 1e-3f) / PROBE_VOLUME_GRID_SIZE;
+	const glm::vec3 padding = glm::max(glm::vec3(minExtent) - extent, glm::vec3(0.f)) * 0.5f;
+	m_probeVolumeBounds.min -= padding;
+	m_probeVolumeBounds.max += padding;
+
+	// L0 and L1 of one color channel per texel
+	m_probeVolumeImages.resize(3);
+	for (auto &volume : m_probeVolumeImages)
+	{
+		volume.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+		volume.width = PROBE_VOLUME_GRID_SIZE;
+		volume.height = PROBE_VOLUME_GRID_SIZE;
+		volume.depth = PROBE_VOLUME_GRID_SIZE;
+		volume.mipLevelCount = 1;
+		volume.layerCount = 1;
+
+		volume.image = m_vulkanManager.createImage3D(volume.width, volume.height, volume.depth, volume.format,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+
+		volume.imageViews.resize(1);
+		volume.imageViews[0] = m_vulkanManager.createImageView(volume.image, VK_IMAGE_VIEW_TYPE_3D, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		// Trilinear interpolation between the probes, clamped at the outermost ones
+		volume.samplers.resize(1);
+		volume.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
 	}
 
-	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
-	const std::string fsFileName1 = "../shaders/bloom_pass/brightness_mask.frag.spv";
-	const std::string fsFileName2 = "../shaders/bloom_pass/gaussian_blur.frag.spv";
-	const std::string fsFileName3 = "../shaders/bloom_pass/merge.frag.spv";
+	// 6 faces for each probe of a batch
+	const uint32_t captureLayerCount = 6 * PROBE_CAPTURE_BATCH_SIZE;
+	m_probeCaptureImage.format = m_probeCaptureFormat;
+	m_probeCaptureImage.width = PROBE_CAPTURE_SIZE;
+	m_probeCaptureImage.height = PROBE_CAPTURE_SIZE;
+	m_probeCaptureImage.depth = 1;
+	m_probeCaptureImage.mipLevelCount = 1;
+	m_probeCaptureImage.layerCount = captureLayerCount;
+	m_probeCaptureImage.image = m_vulkanManager.createImage2D(PROBE_CAPTURE_SIZE, PROBE_CAPTURE_SIZE, m_probeCaptureFormat,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, captureLayerCount);
+	m_probeCaptureImage.imageViews.resize(1);
+	m_probeCaptureImage.imageViews[0] = m_vulkanManager.createImageView(m_probeCaptureImage.image, VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+		VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, captureLayerCount);
+	m_probeCaptureImage.samplers.resize(1);
+	m_probeCaptureImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
 
-	// --- Pipeline layouts
-	m_bloomPipelineLayouts.resize(2);
+	const VkFormat depthFormat = findDepthFormat();
+	m_probeCaptureDepthImage.format = depthFormat;
+	m_probeCaptureDepthImage.width = PROBE_CAPTURE_SIZE;
+	m_probeCaptureDepthImage.height = PROBE_CAPTURE_SIZE;
+	m_probeCaptureDepthImage.depth = 1;
+	m_probeCaptureDepthImage.mipLevelCount = 1;
+	m_probeCaptureDepthImage.layerCount = captureLayerCount;
+	m_probeCaptureDepthImage.image = m_vulkanManager.createImage2D(PROBE_CAPTURE_SIZE, PROBE_CAPTURE_SIZE, depthFormat,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, captureLayerCount);
+	m_probeCaptureDepthImage.imageViews.resize(1);
+	VkImageAspectFlags aspectMask =
+		rj::helper_functions::hasStencilComponent(depthFormat) ? (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT) : VK_IMAGE_ASPECT_DEPTH_BIT;
+	m_probeCaptureDepthImage.imageViews[0] = m_vulkanManager.createImageView(m_probeCaptureDepthImage.image, VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+		aspectMask, 0, 1, 0, captureLayerCount);
 
-	// brightness_mask and merge
-	m_vulkanManager.beginCreatePipelineLayout();
-	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_bloomDescriptorSetLayout });
-	m_bloomPipelineLayouts[0] = m_vulkanManager.endCreatePipelineLayout();
+	// Environment SH the captures are lit with
+#ifdef USE_GPU_SH_PROJECTION
+	m_probeCaptureSHBuffer = m_diffuseSHBuffer;
+#else
+	glm::vec4 coeffs[9];
+	for (uint32_t i = 0; i < 9; ++i)
+	{
+		coeffs[i] = glm::vec4(m_scene.skybox.diffuseSHCoefficients[i], 0.f);
+	}
+	m_probeCaptureSHBuffer.offset = 0;
+	m_probeCaptureSHBuffer.size = sizeof(coeffs);
+	m_probeCaptureSHBuffer.buffer = m_vulkanManager.createBuffer(m_probeCaptureSHBuffer.size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_vulkanManager.transferHostDataToBuffer(m_probeCaptureSHBuffer.buffer, m_probeCaptureSHBuffer.size, coeffs);
+#endif
+}
 
-	// gaussian blur
-	m_vulkanManager.beginCreatePipelineLayout();
-	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_bloomDescriptorSetLayout });
-	m_vulkanManager.pipelineLayoutAddPushConstantRange(0, sizeof(uint32_t), VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_bloomPipelineLayouts[1] = m_vulkanManager.endCreatePipelineLayout();
+void DeferredRenderer::createImpostorResources()
+{
+	// Static meshes get a layer each while there are layers. Animated ones would need a bake per pose
+	m_impostorLayers.assign(m_scene.meshes.size(), std::numeric_limits<uint32_t>::max());
+	m_impostorBounds.clear();
+	uint32_t instanceCount = 0;
+	for (uint32_t j = 0; j < m_scene.meshes.size() && m_impostorBounds.size() < IMPOSTOR_MAX_MESHES; ++j)
+	{
+		const auto &mesh = m_scene.meshes[j];
+		if (!mesh.isLoaded() || mesh.isAnimated() || mesh.lods.empty()) continue;
 
-	// --- Pipelines
-	m_bloomPipelines.resize(3);
+		const BBox &aabb = mesh.getAABBObjectSpace();
+		m_impostorLayers[j] = static_cast<uint32_t>(m_impostorBounds.size());
+		m_impostorBounds.push_back(glm::vec4(0.5f * (aabb.min + aabb.max), std::max(0.5f * glm::length(aabb.max - aabb.min), 1e-3f)));
+		instanceCount += static_cast<uint32_t>(mesh.instanceTransforms.size());
+	}
+	// Every instance may be an impostor for the camera and each cascade at once
+	m_impostorInstanceCapacity = instanceCount * (1 + CSM_MAX_SEG_COUNT);
+	m_impostorDrawRanges.assign(1 + CSM_MAX_SEG_COUNT, glm::uvec2(0));
+
+	const uint32_t layerCount = std::max(1u, static_cast<uint32_t>(m_impostorBounds.size()));
+	const uint32_t atlasSize = IMPOSTOR_VIEWS_PER_SIDE * IMPOSTOR_VIEW_SIZE;
+	m_impostorLayerViews.clear();
+	for (auto *pAtlas : { &m_impostorAlbedoImage, &m_impostorNormalDepthImage })
+	{
+		pAtlas->format = pAtlas == &m_impostorAlbedoImage ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R16G16B16A16_SFLOAT;
+		pAtlas->width = atlasSize;
+		pAtlas->height = atlasSize;
+		pAtlas->depth = 1;
+		pAtlas->mipLevelCount = 1;
+		pAtlas->layerCount = layerCount;
+		pAtlas->image = m_vulkanManager.createImage2D(atlasSize, atlasSize, pAtlas->format,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, layerCount);
+
+		// The whole array is sampled, each layer is an attachment of its mesh's framebuffer
+		pAtlas->imageViews.resize(1);
+		pAtlas->imageViews[0] = m_vulkanManager.createImageView(pAtlas->image, VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+			VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, layerCount);
+
+		// Bilinear within a view, the shaders keep the coordinates half a texel away from the view's edges
+		pAtlas->samplers.resize(1);
+		pAtlas->samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	}
+	for (uint32_t l = 0; l < m_impostorBounds.size(); ++l)
+	{
+		m_impostorLayerViews.push_back(m_vulkanManager.createImageView(m_impostorAlbedoImage.image, VK_IMAGE_VIEW_TYPE_2D,
+			VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, l, 1));
+		m_impostorLayerViews.push_back(m_vulkanManager.createImageView(m_impostorNormalDepthImage.image, VK_IMAGE_VIEW_TYPE_2D,
+			VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, l, 1));
+	}
 
-	// brightness mask
-	m_vulkanManager.beginCreateGraphicsPipeline(m_bloomPipelineLayouts[0], m_bloomRenderPasses[0], 0);
+	const VkFormat depthFormat = findDepthFormat();
+	m_impostorBakeDepthImage.format = depthFormat;
+	m_impostorBakeDepthImage.width = atlasSize;
+	m_impostorBakeDepthImage.height = atlasSize;
+	m_impostorBakeDepthImage.depth = 1;
+	m_impostorBakeDepthImage.mipLevelCount = 1;
+	m_impostorBakeDepthImage.layerCount = 1;
+	m_impostorBakeDepthImage.image = m_vulkanManager.createImage2D(atlasSize, atlasSize, depthFormat,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_impostorBakeDepthImage.imageViews.resize(1);
+	VkImageAspectFlags aspectMask =
+		rj::helper_functions::hasStencilComponent(depthFormat) ? (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT) : VK_IMAGE_ASPECT_DEPTH_BIT;
+	m_impostorBakeDepthImage.imageViews[0] = m_vulkanManager.createImageView(m_impostorBakeDepthImage.image, VK_IMAGE_VIEW_TYPE_2D, aspectMask);
+}
+
+void DeferredRenderer::createColorLutResources()
+{
+	m_colorLutImage.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+	m_colorLutImage.width = COLOR_LUT_SIZE;
+	m_colorLutImage.height = COLOR_LUT_SIZE;
+	m_colorLutImage.depth = COLOR_LUT_SIZE;
+	m_colorLutImage.mipLevelCount = 1;
+	m_colorLutImage.layerCount = 1;
+
+	m_colorLutImage.image = m_vulkanManager.createImage3D(m_colorLutImage.width, m_colorLutImage.height, m_colorLutImage.depth,
+		m_colorLutImage.format, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		VK_IMAGE_LAYOUT_UNDEFINED);
+
+	m_colorLutImage.imageViews.resize(1);
+	m_colorLutImage.imageViews[0] = m_vulkanManager.createImageView(m_colorLutImage.image, VK_IMAGE_VIEW_TYPE_3D, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	// Trilinear between the texel centers, the final output shader offsets its coordinates by half a texel
+	m_colorLutImage.samplers.resize(1);
+	m_colorLutImage.samplers[0] = m_vulkanManager.createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+}
 
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName1);
+void DeferredRenderer::createAutoExposureResources()
+{
+	// Starts out empty, the adaptation clears it again after reading it
+	std::vector<uint32_t> zeros(AUTO_EXPOSURE_HISTOGRAM_BINS, 0);
+	m_luminanceHistogramBuffer.offset = 0;
+	m_luminanceHistogramBuffer.size = AUTO_EXPOSURE_HISTOGRAM_BINS * sizeof(uint32_t);
+	m_luminanceHistogramBuffer.buffer = m_vulkanManager.createBuffer(m_luminanceHistogramBuffer.size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_vulkanManager.transferHostDataToBuffer(m_luminanceHistogramBuffer.buffer, m_luminanceHistogramBuffer.size, zeros.data());
+
+	// Exposure and average log2 luminance. The first frame replaces both, see updateUniformHostData()
+	const float exposure[] = { 1.f, 0.f };
+	m_exposureBuffer.offset = 0;
+	m_exposureBuffer.size = sizeof(exposure);
+	m_exposureBuffer.buffer = m_vulkanManager.createBuffer(m_exposureBuffer.size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_vulkanManager.transferHostDataToBuffer(m_exposureBuffer.buffer, m_exposureBuffer.size, exposure);
+}
 
-	VkExtent2D swapChainExtent = m_vulkanManager.getSwapChainExtent();
-	m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f,
-		static_cast<float>(swapChainExtent.width >> 1), static_cast<float>(swapChainExtent.height >> 1));
+void DeferredRenderer::bakeProbeVolume()
+{
+	// The captures read the model matrices from the first frame's uniform buffer
+	m_scene.transforms.update();
+	for (auto &model : m_scene.meshes)
+	{
+		if (model.updateHostUniformBuffer())
+		{
+			m_perFrameUniformHostData.markDirty(model.uPerModelInfo);
+		}
+	}
+	updateUniformDeviceData(0);
 
-	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+	// Queued behind the SH projection on the same queue, which leaves its result readable by fragment shaders
+	m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+	m_vulkanManager.queueSubmitNewSubmit({ m_probeVolumeCommandBuffer });
+	m_vulkanManager.endQueueSubmit(m_probeVolumeFence, false);
+	m_vulkanManager.waitForFences({ m_probeVolumeFence });
 
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+	m_probeVolumeBaked = true;
+}
 
-	m_bloomPipelines[0] = m_vulkanManager.endCreateGraphicsPipeline();
+void DeferredRenderer::bakeImpostors()
+{
+	m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+	m_vulkanManager.queueSubmitNewSubmit({ m_impostorBakeCommandBuffer });
+	m_vulkanManager.endQueueSubmit(m_impostorBakeFence, false);
+	m_vulkanManager.waitForFences({ m_impostorBakeFence });
 
-	// gaussian blur
-	m_vulkanManager.beginCreateGraphicsPipeline(m_bloomPipelineLayouts[1], m_bloomRenderPasses[0], 0);
+	m_impostorsBaked = true;
+}
 
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName2);
+void DeferredRenderer::writeImpostorInstances(uint32_t imgIdx)
+{
+	// The camera's list, then each cascade's, every instance of each mesh. A mesh that gained instances since
+	// createImpostorResources() keeps the ones that fit
+	ImpostorInstance *pInstances = m_perFrameImpostorInstanceMappedData[imgIdx];
+	uint32_t count = 0;
+	auto writeList = [&](const std::vector<uint32_t> &meshes, uint32_t range)
+	{
+		m_impostorDrawRanges[range].x = count;
+		for (uint32_t j : meshes)
+		{
+			const auto &mesh = m_scene.meshes[j];
+			const uint32_t layer = m_impostorLayers[j];
+			for (const auto &instance : mesh.instanceTransforms)
+			{
+				if (count == m_impostorInstanceCapacity) break;
 
-	m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f,
-		static_cast<float>(swapChainExtent.width >> 1), static_cast<float>(swapChainExtent.height >> 1));
+				ImpostorInstance &dst = pInstances[count++];
+				dst.M = instance.M;
+				dst.boundsCenterRadius = m_impostorBounds[layer];
+				dst.layer = glm::uvec4(layer, 0, 0, 0);
+			}
+		}
+		m_impostorDrawRanges[range].y = count - m_impostorDrawRanges[range].x;
+	};
 
-	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+	writeList(m_impostorMeshes, 0);
+	for (uint32_t i = 0; i < m_impostorShadowCasters.size(); ++i)
+	{
+		writeList(m_impostorShadowCasters[i], 1 + i);
+	}
+}
 
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+void DeferredRenderer::updateIblPrecomputation(bool wait)
+{
+	// Fences of what prefilterEnvironmentAndComputeBrdfLut() has submitted and is not ready yet
+	std::vector<uint32_t> fences;
+	if (!m_bakedBrdfReady) fences.push_back(m_brdfLutFence);
+	if (!m_scene.skybox.specMapReady) fences.push_back(m_envPrefilterFence);
+#ifdef USE_GPU_SH_PROJECTION
+	if (!m_scene.skybox.diffuseSHReady) fences.push_back(m_shProjectionFence);
+#endif
 
-	m_bloomPipelines[1] = m_vulkanManager.endCreateGraphicsPipeline();
+	if (fences.empty()) return;
 
-	// merge
-	m_vulkanManager.beginCreateGraphicsPipeline(m_bloomPipelineLayouts[0], m_bloomRenderPasses[1], 0);
+	if (wait)
+	{
+		m_vulkanManager.waitForFences(fences);
+	}
 
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName3);
+	bool changed = false;
 
-	m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f,
-		static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height));
+	if (!m_bakedBrdfReady && m_vulkanManager.isFenceSignaled(m_brdfLutFence))
+	{
+		m_vulkanManager.resetFences({ m_brdfLutFence });
+		m_vulkanManager.transitionImageLayout(m_bakedBRDFs[0].image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		m_bakedBrdfReady = true;
+		destroyBrdfLutBakeResources();
+		changed = true;
+	}
 
-	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+	if (!m_scene.skybox.specMapReady && m_vulkanManager.isFenceSignaled(m_envPrefilterFence))
+	{
+		m_vulkanManager.resetFences({ m_envPrefilterFence });
+		// The compute prefilter leaves it ready for sampling
+#ifndef USE_COMPUTE_ENV_PREFILTER
+		m_vulkanManager.transitionImageLayout(m_scene.skybox.specularIrradianceMap.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+#endif
+		m_scene.skybox.specMapReady = true;
+		destroySpecEnvPrefilterResources();
+		changed = true;
+	}
 
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_TRUE, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ONE, VK_BLEND_OP_ADD);
+#ifdef USE_GPU_SH_PROJECTION
+	if (!m_scene.skybox.diffuseSHReady && m_vulkanManager.isFenceSignaled(m_shProjectionFence))
+	{
+		m_vulkanManager.resetFences({ m_shProjectionFence });
+		// The coefficients stay in @m_diffuseSHBuffer, nothing is read back
+		m_scene.skybox.diffuseSHReady = true;
+	}
+#endif
 
-	m_bloomPipelines[2] = m_vulkanManager.endCreateGraphicsPipeline();
+	if (changed)
+	{
+		++m_iblVersion;
+		requestRedraw();
+	}
 }
 
-void DeferredRenderer::createFinalOutputPassPipeline()
+void DeferredRenderer::updateProbeSwitching()
 {
-	if (m_initialized)
+	TRACE_CPU_SCOPE("updateProbeSwitching");
+
+	++m_probeFrameCounter;
+	m_residentProbes[m_currentProbe].lastShownFrame = m_probeFrameCounter;
+
+	const std::vector<std::string> probeDirs = PROBE_BASE_DIRS;
+	if (m_environmentSwitchRequests > 0)
 	{
-		m_vulkanManager.destroyPipelineLayout(m_finalOutputPipelineLayout);
-		m_vulkanManager.destroyPipeline(m_finalOutputPipeline);
+		m_requestedProbeDir = (m_requestedProbeDir + m_environmentSwitchRequests) % static_cast<uint32_t>(probeDirs.size());
+		m_environmentSwitchRequests = 0;
 	}
 
-	const std::string vsFileName = "../shaders/fullscreen.vert.spv";
-	const std::string fsFileName = "../shaders/final_output_pass/final_output.frag.spv";
+	// The startup precomputation uses the prefilter sets and the first probe is shown until it is done
+	if (!m_bakedBrdfReady || !m_scene.skybox.specMapReady) return;
 
-	m_vulkanManager.beginCreatePipelineLayout();
-	m_vulkanManager.pipelineLayoutAddDescriptorSetLayouts({ m_finalOutputDescriptorSetLayout });
-	m_finalOutputPipelineLayout = m_vulkanManager.endCreatePipelineLayout();
+	uint32_t requested = std::numeric_limits<uint32_t>::max();
+	uint32_t prefetched = std::numeric_limits<uint32_t>::max();
+	for (uint32_t i = 0; i < m_residentProbes.size(); ++i)
+	{
+		if (m_residentProbes[i].dirIdx == m_requestedProbeDir) requested = i;
+		if (m_residentProbes[i].dirIdx == m_prefetchProbeDir) prefetched = i;
+	}
 
-	m_vulkanManager.beginCreateGraphicsPipeline(m_finalOutputPipelineLayout, m_finalOutputRenderPass, 0);
+	// The requested probe first, then the prefetched one
+	uint32_t loadDir = std::numeric_limits<uint32_t>::max();
+	if (requested == std::numeric_limits<uint32_t>::max())
+	{
+		loadDir = m_requestedProbeDir;
+	}
+	else if (m_prefetchProbeDir != std::numeric_limits<uint32_t>::max() && prefetched == std::numeric_limits<uint32_t>::max())
+	{
+		loadDir = m_prefetchProbeDir;
+	}
 
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_VERTEX_BIT, vsFileName);
-	m_vulkanManager.graphicsPipelineAddShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fsFileName);
+	// One probe at a time is loaded and then prefiltered
+	if (loadDir != std::numeric_limits<uint32_t>::max() && !m_pendingProbe && m_prefilteringProbe == std::numeric_limits<uint32_t>::max())
+	{
+		if (!m_probeJobs) m_probeJobs.reset(new JobPool(1));
 
-	VkExtent2D swapChainExtent = m_vulkanManager.getSwapChainExtent();
-	m_vulkanManager.graphicsPipelineAddViewportAndScissor(0.f, 0.f,
-		static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height));
+		m_pendingProbe.reset(new PendingProbe());
+		PendingProbe *pPending = m_pendingProbe.get();
+		pPending->dirIdx = loadDir;
+		const std::string radianceMapName = probeDirs[loadDir] + "Unfiltered_HDR.dds";
+		pPending->job = m_probeJobs->add([pPending, radianceMapName]()
+		{
+			std::string diffuseSHName;
+			getProbeCacheFileNames(radianceMapName, &pPending->specMapCacheFileName, &diffuseSHName);
 
-	m_vulkanManager.graphicsPipelineConfigureDepthState(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+			pPending->radianceMap = rj::helper_functions::decodeCubemap(radianceMapName);
+			if (AssetFile::exists(pPending->specMapCacheFileName))
+			{
+				pPending->specMap = rj::helper_functions::decodeCubemap(pPending->specMapCacheFileName);
+			}
 
-	m_vulkanManager.graphicsPipeLineAddColorBlendAttachment(VK_FALSE);
+			if (AssetFile::exists(diffuseSHName))
+			{
+				Skybox::loadSHCoefficients(diffuseSHName, pPending->diffuseSHCoefficients);
+			}
+			else
+			{
+				Skybox::computeSHCoefficients(pPending->radianceMap, pPending->diffuseSHCoefficients);
+				Skybox::saveSHCoefficients(diffuseSHName, pPending->diffuseSHCoefficients);
+			}
+		});
+	}
 
-	m_finalOutputPipeline = m_vulkanManager.endCreateGraphicsPipeline();
-}
+	if (m_pendingProbe && m_probeJobs->isDone(m_pendingProbe->job, m_pendingProbe->job + 1))
+	{
+		m_probeJobs->wait(m_pendingProbe->job, m_pendingProbe->job + 1); // rethrows if the probe failed to load
+		makeProbeResident(*m_pendingProbe);
+		m_pendingProbe.reset();
+	}
 
-void DeferredRenderer::createBrdfLutDescriptorSet()
-{
-	if (m_bakedBrdfReady) return;
+	if (m_prefilteringProbe != std::numeric_limits<uint32_t>::max())
+	{
+		updateProbePrefilter();
+	}
 
-	std::vector<rj::DescriptorSetUpdateImageInfo> updateInfos(1);
-	updateInfos[0].layout = VK_IMAGE_LAYOUT_GENERAL;
-	updateInfos[0].imageViewName = m_bakedBRDFs[0].imageViews[0];
-	updateInfos[0].samplerName = std::numeric_limits<uint32_t>::max();
+	for (uint32_t i = 0; i < m_residentProbes.size(); ++i)
+	{
+		if (m_residentProbes[i].dirIdx == m_requestedProbeDir && m_residentProbes[i].specMapReady && i != m_currentProbe)
+		{
+			showProbe(i);
+		}
+	}
 
-	m_vulkanManager.beginUpdateDescriptorSet(m_brdfLutDescriptorSet);
-	m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, updateInfos);
-	m_vulkanManager.endUpdateDescriptorSet();
+	evictProbes();
 }
 
-void DeferredRenderer::createSpecEnvPrefilterDescriptorSet()
+void DeferredRenderer::makeProbeResident(PendingProbe &pending)
 {
-	if (m_scene.skybox.specMapReady) return;
+	TRACE_CPU_SCOPE("upload probe");
 
-	std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
-	bufferInfos[0].bufferName = m_oneTimeUniformDeviceData.buffer;
-	bufferInfos[0].offset = m_oneTimeUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCubeViews));
-	bufferInfos[0].sizeInBytes = sizeof(CubeMapCameraUniformBuffer);
+	ResidentProbe probe;
+	probe.dirIdx = pending.dirIdx;
+	memcpy(probe.diffuseSHCoefficients, pending.diffuseSHCoefficients, sizeof(probe.diffuseSHCoefficients));
+	probe.specMapCacheFileName = pending.specMapCacheFileName;
+	probe.lastShownFrame = m_probeFrameCounter;
 
-	std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
-	imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	imageInfos[0].imageViewName = m_scene.skybox.radianceMap.imageViews[0];
-	imageInfos[0].samplerName = m_scene.skybox.radianceMap.samplers[0];
+	m_vulkanManager.beginUploadBatch();
+	rj::helper_functions::uploadCubemap(&probe.radianceMap, &m_vulkanManager, pending.radianceMap);
+	if (!pending.specMap.empty())
+	{
+		rj::helper_functions::uploadCubemap(&probe.specularIrradianceMap, &m_vulkanManager, pending.specMap);
+		probe.specMapReady = true;
+	}
+	else
+	{
+		Skybox::createSpecularIrradianceMap(&probe.specularIrradianceMap, &m_vulkanManager);
+		probe.shouldSaveSpecMap = true;
+	}
+	m_vulkanManager.endUploadBatch();
 
-	m_vulkanManager.beginUpdateDescriptorSet(m_specEnvPrefilterDescriptorSet);
-	m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
-	m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
-	m_vulkanManager.endUpdateDescriptorSet();
-}
+	m_residentProbes.push_back(std::move(probe));
 
-void DeferredRenderer::createGeomPassDescriptorSets()
-{
-	createSkyboxDescriptorSet();
-	createStaticMeshDescriptorSet();
+	if (!m_residentProbes.back().specMapReady)
+	{
+		m_prefilteringProbe = static_cast<uint32_t>(m_residentProbes.size() - 1);
+		m_probePrefilterNextSlice = 0;
+	}
 }
 
-void DeferredRenderer::createSkyboxDescriptorSet()
+void DeferredRenderer::updateProbePrefilter()
 {
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
+	auto &probe = m_residentProbes[m_prefilteringProbe];
+	const auto &specMap = probe.specularIrradianceMap;
+	const uint32_t sliceCount = 6 * specMap.mipLevelCount;
+	auto getSliceTexels = [&specMap](uint32_t slice)
+	{
+		const uint64_t size = std::max(specMap.width >> (slice / 6), 1u);
+		return size * size;
+	};
 
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	if (m_probePrefilterStepSlices > 0)
 	{
-		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
-		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
-		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCameraVP));
-		bufferInfos[0].sizeInBytes = sizeof(DisplayInfoUniformBuffer);
+		if (!m_vulkanManager.isFenceSignaled(m_probePrefilterFence)) return;
+		m_vulkanManager.resetFences({ m_probePrefilterFence });
 
-		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
-		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfos[0].imageViewName = m_scene.skybox.radianceMap.imageViews[0];
-		imageInfos[0].samplerName = m_scene.skybox.radianceMap.samplers[0];
+		// The cost of a texel follows the steps, so the next one is sized from what the last ones took
+		uint64_t timestamps[2];
+		if (m_vulkanManager.getQueryPoolResults(m_probePrefilterQueryPool, sizeof(timestamps), sizeof(uint64_t), timestamps,
+			0, 2, VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			const float stepMS = static_cast<float>(timestamps[1] - timestamps[0]) * m_gpuProfiler.getTimestampPeriod() * 1e-6f;
+			m_backgroundBudget.addMeasurement(BackgroundWorkBudget::WORK_PROBE_PREFILTER, m_probePrefilterStepTexels, stepMS);
+		}
 
-		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_skyboxDescriptorSet);
-		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
-		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
-		m_vulkanManager.endUpdateDescriptorSet();
+		m_probePrefilterNextSlice += m_probePrefilterStepSlices;
+		m_probePrefilterStepSlices = 0;
+
+		if (m_probePrefilterNextSlice == sliceCount)
+		{
+			probe.specMapReady = true;
+			m_prefilteringProbe = std::numeric_limits<uint32_t>::max();
+			return;
+		}
 	}
-}
 
-void DeferredRenderer::createStaticMeshDescriptorSet()
-{
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	// Slices in mip order while they fit what is left of the frame's background budget. A slice that never fits goes alone
+	const uint64_t affordableTexels = m_backgroundBudget.getAffordableUnits(BackgroundWorkBudget::WORK_PROBE_PREFILTER);
+	uint32_t endSlice = m_probePrefilterNextSlice;
+	uint64_t texels = 0;
+	while (endSlice < sliceCount && texels + getSliceTexels(endSlice) <= affordableTexels)
 	{
-		for (uint32_t i = 0; i < m_scene.meshes.size(); ++i)
-		{
-			std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
-			std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+		texels += getSliceTexels(endSlice);
+		++endSlice;
+	}
+	if (endSlice == m_probePrefilterNextSlice)
+	{
+		if (!m_backgroundBudget.canRunOversized()) return;
+		texels = getSliceTexels(endSlice);
+		++endSlice;
+	}
+	m_backgroundBudget.spend(BackgroundWorkBudget::WORK_PROBE_PREFILTER, texels);
 
-			m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[i]);
+	const uint32_t cb = m_probePrefilterCommandBuffer;
+	m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	m_vulkanManager.cmdResetQueryPool(cb, m_probePrefilterQueryPool, 0, 2);
 
-			bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
-			bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCameraVP));
-			bufferInfos[0].sizeInBytes = sizeof(TransMatsUniformBuffer);
-			m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+	// Steps write disjoint faces, nothing reads the map until the last one is done
+	if (m_probePrefilterNextSlice == 0)
+	{
+		m_vulkanManager.cmdImageBarrier(cb, specMap.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_ACCESS_SHADER_WRITE_BIT);
+	}
 
-			bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_scene.meshes[i].uPerModelInfo));
-			bufferInfos[0].sizeInBytes = sizeof(PerModelUniformBuffer);
-			m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+	m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_probePrefilterQueryPool, 0);
+	m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_specEnvPrefilterPipeline);
 
-			imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageInfos[0].imageViewName = m_scene.meshes[i].albedoMap.imageViews[0];
-			imageInfos[0].samplerName = m_scene.meshes[i].albedoMap.samplers[0];
-			m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+	// One dispatch per mip level touched. The sets of the previous step are no longer in use
+	for (uint32_t slice = m_probePrefilterNextSlice; slice < endSlice; )
+	{
+		const uint32_t level = slice / 6;
+		const uint32_t firstFace = slice % 6;
+		const uint32_t faceCount = std::min(6 - firstFace, endSlice - slice);
 
-			imageInfos[0].imageViewName = m_scene.meshes[i].normalMap.imageViews[0];
-			imageInfos[0].samplerName = m_scene.meshes[i].normalMap.samplers[0];
-			m_vulkanManager.descriptorSetAddImageDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		writeSpecEnvPrefilterMipDescriptorSet(level, probe.radianceMap, specMap);
+		recordSpecEnvPrefilterDispatch(cb, level, specMap.mipLevelCount, specMap.width, firstFace, faceCount);
+		slice += faceCount;
+	}
 
-			imageInfos[0].imageViewName = m_scene.meshes[i].roughnessMap.imageViews[0];
-			imageInfos[0].samplerName = m_scene.meshes[i].roughnessMap.samplers[0];
-			m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+	m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_probePrefilterQueryPool, 1);
 
-			imageInfos[0].imageViewName = m_scene.meshes[i].metalnessMap.imageViews[0];
-			imageInfos[0].samplerName = m_scene.meshes[i].metalnessMap.samplers[0];
-			m_vulkanManager.descriptorSetAddImageDescriptor(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+	if (endSlice == sliceCount)
+	{
+		m_vulkanManager.cmdImageBarrier(cb, specMap.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
 
-			imageInfos[0].imageViewName = m_scene.meshes[i].aoMap.image == std::numeric_limits<uint32_t>::max() ? m_scene.meshes[i].albedoMap.imageViews[0] : m_scene.meshes[i].aoMap.imageViews[0];
-			imageInfos[0].samplerName = m_scene.meshes[i].aoMap.image == std::numeric_limits<uint32_t>::max() ? m_scene.meshes[i].albedoMap.samplers[0] : m_scene.meshes[i].aoMap.samplers[0];
-			m_vulkanManager.descriptorSetAddImageDescriptor(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+	m_vulkanManager.endCommandBuffer(cb);
 
-			imageInfos[0].imageViewName = m_scene.meshes[i].emissiveMap.image == std::numeric_limits<uint32_t>::max() ? m_scene.meshes[i].albedoMap.imageViews[0] : m_scene.meshes[i].emissiveMap.imageViews[0];
-			imageInfos[0].samplerName = m_scene.meshes[i].emissiveMap.image == std::numeric_limits<uint32_t>::max() ? m_scene.meshes[i].albedoMap.samplers[0] : m_scene.meshes[i].emissiveMap.samplers[0];
-			m_vulkanManager.descriptorSetAddImageDescriptor(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+	m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
+	m_vulkanManager.queueSubmitNewSubmit({ cb });
+	m_vulkanManager.endQueueSubmit(m_probePrefilterFence, false);
 
-			m_vulkanManager.endUpdateDescriptorSet();
-		}
-	}
+	m_probePrefilterStepSlices = endSlice - m_probePrefilterNextSlice;
+	m_probePrefilterStepTexels = texels;
 }
 
-void DeferredRenderer::createShadowPassDescriptorSets()
+void DeferredRenderer::showProbe(uint32_t probeIdx)
 {
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
-	{
-		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
-		{
-			std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
-
-			m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[i]);
-
-			bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
-			bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uShadowLightInfos[i]));
-			bufferInfos[0].sizeInBytes = sizeof(ShadowLightUniformBuffer);
-			m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+	m_currentProbe = probeIdx;
+	const auto &probe = m_residentProbes[probeIdx];
+
+	// The lighting info takes the SH coefficients from the skybox every frame
+	auto &skybox = m_scene.skybox;
+	skybox.radianceMap = probe.radianceMap;
+	skybox.specularIrradianceMap = probe.specularIrradianceMap;
+	memcpy(skybox.diffuseSHCoefficients, probe.diffuseSHCoefficients, sizeof(skybox.diffuseSHCoefficients));
+
+	// Rewrites the skybox and lighting sets of each swapchain image before it is rendered again
+	++m_iblVersion;
+	requestRedraw();
+}
 
-			m_vulkanManager.endUpdateDescriptorSet();
-		}
+void DeferredRenderer::evictProbes()
+{
+	// A probe that was shown may still be in the sets of a swapchain image that has not been rendered since, or in a frame in flight
+	const uint64_t retireFrameCount = m_vulkanManager.getSwapChainSize() + MAX_FRAMES_IN_FLIGHT;
 
-		for (uint32_t i = 0; i < m_scene.meshes.size(); ++i)
+	while (m_residentProbes.size() > MAX_RESIDENT_PROBES)
+	{
+		uint32_t victim = std::numeric_limits<uint32_t>::max();
+		for (uint32_t i = 0; i < m_residentProbes.size(); ++i)
 		{
-			std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
+			const auto &probe = m_residentProbes[i];
+			if (i == m_currentProbe || i == m_prefilteringProbe || probe.dirIdx == m_requestedProbeDir || probe.dirIdx == m_prefetchProbeDir ||
+				m_probeFrameCounter - probe.lastShownFrame <= retireFrameCount) continue;
 
-			m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[i]);
+			if (victim == std::numeric_limits<uint32_t>::max() || probe.lastShownFrame < m_residentProbes[victim].lastShownFrame)
+			{
+				victim = i;
+			}
+		}
 
-			bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
-			bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_scene.meshes[i].uPerModelInfo));
-			bufferInfos[0].sizeInBytes = sizeof(PerModelUniformBuffer);
-			m_vulkanManager.descriptorSetAddBufferDescriptor(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+		// Tried again next frame
+		if (victim == std::numeric_limits<uint32_t>::max()) return;
 
-			m_vulkanManager.endUpdateDescriptorSet();
-		}
+		destroyProbe(m_residentProbes[victim]);
+		m_residentProbes.erase(m_residentProbes.begin() + victim);
+		if (m_currentProbe > victim) --m_currentProbe;
+		if (m_prefilteringProbe != std::numeric_limits<uint32_t>::max() && m_prefilteringProbe > victim) --m_prefilteringProbe;
 	}
 }
 
-void DeferredRenderer::createLightingPassDescriptorSets()
+void DeferredRenderer::destroyProbe(ResidentProbe &probe)
 {
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	for (auto *pMap : { &probe.radianceMap, &probe.specularIrradianceMap })
 	{
-		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
-		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
-
-		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_lightingDescriptorSet);
-
-		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
-		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uLightInfo));
-		bufferInfos[0].sizeInBytes = sizeof(LightingPassUniformBuffer);
-		m_vulkanManager.descriptorSetAddBufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
-
-		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfos[0].imageViewName = m_gbufferImages[0].imageViews[0];
-		imageInfos[0].samplerName = m_gbufferImages[0].samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
-
-		imageInfos[0].imageViewName = m_gbufferImages[1].imageViews[0];
-		imageInfos[0].samplerName = m_gbufferImages[1].samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
-
-		imageInfos[0].imageViewName = m_gbufferImages[2].imageViews[0];
-		imageInfos[0].samplerName = m_gbufferImages[2].samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
-
-		imageInfos[0].imageViewName = m_depthImage.imageViews[0];
-		imageInfos[0].samplerName = m_depthImage.samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		for (uint32_t view : pMap->imageViews) m_vulkanManager.destroyImageView(view);
+		for (uint32_t sampler : pMap->samplers) m_vulkanManager.destroySampler(sampler);
+		m_vulkanManager.destroyImage(pMap->image);
+	}
+}
 
-		imageInfos[0].imageViewName = m_scene.skybox.specularIrradianceMap.imageViews[0];
-		imageInfos[0].samplerName = m_scene.skybox.specularIrradianceMap.samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+void DeferredRenderer::reportStartupProfile() const
+{
+	auto &profile = StartupProfile::get();
+	profile.finish();
+	profile.printReport(std::cout);
 
-		imageInfos[0].imageViewName = m_bakedBRDFs[0].imageViews[0];
-		imageInfos[0].samplerName = m_bakedBRDFs[0].samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+	if (!profile.saveJson(STARTUP_PROFILE_FILE_NAME))
+	{
+		std::cerr << "Unable to save the startup profile to " STARTUP_PROFILE_FILE_NAME << std::endl;
+	}
+}
 
-		imageInfos[0].imageViewName = m_shadowImage.imageViews.back();
-		imageInfos[0].samplerName = m_shadowImage.samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+void DeferredRenderer::createPlaceholderMaps()
+{
+	using namespace rj::helper_functions;
 
-		m_vulkanManager.endUpdateDescriptorSet();
+	// Mid grey albedo, flat normal, rough, dielectric, unoccluded, not emissive
+	const uint8_t texels[VMesh::numMapsPerMesh][4] =
+	{
+		{ 128, 128, 128, 255 },
+		{ 128, 128, 255, 255 },
+#if MESH_PACK_ORM
+		{ 255, 255, 0, 255 },
+#else
+		{ 255, 255, 255, 255 },
+		{ 0, 0, 0, 255 },
+		{ 255, 255, 255, 255 },
+#endif
+		{ 0, 0, 0, 255 }
+	};
+
+	m_vulkanManager.beginUploadBatch();
+	for (uint32_t i = 0; i < VMesh::numMapsPerMesh; ++i)
+	{
+		loadTexture2DFromBinaryData(&m_placeholderMaps[i], &m_vulkanManager, texels[i], 1, 1, gli::FORMAT_RGBA8_UNORM_PACK8);
 	}
+	m_vulkanManager.endUploadBatch();
 }
 
-void DeferredRenderer::createBloomDescriptorSets()
+void DeferredRenderer::loadSyntheticScene()
 {
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	const SyntheticSceneParams &params = m_syntheticScene;
+	if (params.lightCount > MAX_POINT_LIGHTS)
 	{
-		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
+		throw std::runtime_error("the synthetic scene has more lights than MAX_POINT_LIGHTS");
+	}
 
-		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[0]);
-		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfos[0].imageViewName = m_lightingResultImage.imageViews[0];
-		imageInfos[0].samplerName = m_lightingResultImage.samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
-		m_vulkanManager.endUpdateDescriptorSet();
+	// Meshes and materials are generated on the pool, one job each
+	std::vector<VMesh::HostData> meshData(params.meshCount);
+	std::vector<VMesh::HostData> materials(params.textureCount);
+	{
+		JobPool jobs(ASSET_LOADING_THREAD_COUNT);
+		for (uint32_t m = 0; m < params.meshCount; ++m)
+		{
+			jobs.add([&params, &meshData, m]() { buildSyntheticMesh(m, params.trianglesPerMesh, &meshData[m]); });
+		}
+		for (uint32_t t = 0; t < params.textureCount; ++t)
+		{
+			jobs.add([&materials, t]() { buildSyntheticMaterial(t, SYNTHETIC_TEXTURE_SIZE, &materials[t]); });
+		}
+		jobs.waitAll();
+	}
 
-		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[1]);
-		imageInfos[0].imageViewName = m_postEffectImages[0].imageViews[0];
-		imageInfos[0].samplerName = m_postEffectImages[0].samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
-		m_vulkanManager.endUpdateDescriptorSet();
+	m_scene.meshes.resize(params.meshCount, { &m_vulkanManager });
+	m_scene.attachTransforms();
 
-		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[2]);
-		imageInfos[0].imageViewName = m_postEffectImages[1].imageViews[0];
-		imageInfos[0].samplerName = m_postEffectImages[1].samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
-		m_vulkanManager.endUpdateDescriptorSet();
+	// Instance i belongs to mesh i % meshCount. The first instance of a mesh is its own transform, the others are
+	// offsets in its object space
+	const uint32_t instanceCount = std::max(params.instanceCount, params.meshCount);
+	for (uint32_t m = 0; m < params.meshCount; ++m)
+	{
+		VMesh::HostData &data = meshData[m];
+		const VMesh::HostData &material = materials[m % params.textureCount];
+		for (uint32_t i = 0; i < VMesh::numMapsPerMesh; ++i)
+		{
+			data.maps[i] = material.maps[i];
+			data.mapNames[i] = material.mapNames[i];
+		}
+
+		VMesh &mesh = m_scene.meshes[m];
+		mesh.upload(data, &m_scene.textureCache);
+		data = VMesh::HostData(); // in device memory now
+
+		glm::vec3 position;
+		glm::quat rotation;
+		float scale;
+		getSyntheticInstance(m, instanceCount, SYNTHETIC_INSTANCE_SPACING, &position, &rotation, &scale);
+		mesh.setPosition(position);
+		mesh.setRotation(rotation);
+		mesh.setScale(scale);
+
+		const glm::quat invRotation = glm::inverse(rotation);
+		for (uint32_t i = m + params.meshCount; i < instanceCount; i += params.meshCount)
+		{
+			glm::vec3 instancePosition;
+			glm::quat instanceRotation;
+			float instanceScale;
+			getSyntheticInstance(i, instanceCount, SYNTHETIC_INSTANCE_SPACING, &instancePosition, &instanceRotation, &instanceScale);
+			mesh.addInstance(invRotation * (instancePosition - position) / scale, invRotation * instanceRotation, instanceScale / scale);
+		}
 	}
 }
 
-void DeferredRenderer::createFinalOutputPassDescriptorSets()
+DeferredRenderer::ModelFiles DeferredRenderer::getModelFiles(const std::string &name)
 {
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	ModelFiles files;
+	files.model = "../models/" + name + ".obj";
+	files.albedoMap = "../textures/" + name + "/A.dds";
+	files.normalMap = "../textures/" + name + "/N.dds";
+	files.roughnessMap = "../textures/" + name + "/R.dds";
+	files.metalnessMap = "../textures/" + name + "/M.dds";
+	files.aoMap = "../textures/" + name + "/AO.dds";
+	if (!AssetFile::exists(files.aoMap))
 	{
-		std::vector<rj::DescriptorSetUpdateBufferInfo> bufferInfos(1);
-		std::vector<rj::DescriptorSetUpdateImageInfo> imageInfos(1);
-
-		m_vulkanManager.beginUpdateDescriptorSet(m_perFrameDescriptorSets[imgIdx].m_finalOutputDescriptorSet);
+		files.aoMap = "";
+	}
+	files.emissiveMap = "../textures/" + name + "/E.dds";
+	if (!AssetFile::exists(files.emissiveMap))
+	{
+		files.emissiveMap = "";
+	}
+	return files;
+}
 
-		bufferInfos[0].bufferName = m_perFrameUniformDeviceData[imgIdx].buffer;
-		bufferInfos[0].offset = m_perFrameUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uDisplayInfo));
-		bufferInfos[0].sizeInBytes = sizeof(DisplayInfoUniformBuffer);
-		m_vulkanManager.descriptorSetAddBufferDescriptor(5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, bufferInfos);
+std::unique_ptr<DeferredRenderer::PendingModel> DeferredRenderer::addModelJobs(const ModelFiles &files, JobPool *pJobs)
+{
+	std::unique_ptr<PendingModel> model(new PendingModel());
+	std::vector<std::function<void()>> jobs;
+	VMesh::addHostDataJobs(&model->data, &jobs, files.model, files.albedoMap, files.normalMap, files.roughnessMap, files.metalnessMap,
+		files.aoMap, files.emissiveMap, m_assetReader.get());
+	model->beginJob = pJobs->getJobCount();
+	for (auto &job : jobs)
+	{
+		pJobs->add(std::move(job));
+	}
+	model->endJob = pJobs->getJobCount();
+	return model;
+}
 
-		imageInfos[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfos[0].imageViewName = m_lightingResultImage.imageViews[0];
-		imageInfos[0].samplerName = m_lightingResultImage.samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+void DeferredRenderer::setPlaceholderMaps(VMesh *pMesh, const ModelFiles &files)
+{
+	// Optional maps get a placeholder only if the model has them, so its pipeline variant doesn't change once it is loaded
+	pMesh->albedoMap = m_placeholderMaps[0];
+	pMesh->normalMap = m_placeholderMaps[1];
+#if MESH_PACK_ORM
+	pMesh->ormMap = m_placeholderMaps[2];
+	if (files.emissiveMap != "") pMesh->emissiveMap = m_placeholderMaps[3];
+#else
+	pMesh->roughnessMap = m_placeholderMaps[2];
+	pMesh->metalnessMap = m_placeholderMaps[3];
+	if (files.aoMap != "") pMesh->aoMap = m_placeholderMaps[4];
+	if (files.emissiveMap != "") pMesh->emissiveMap = m_placeholderMaps[5];
+#endif
+}
 
-		imageInfos[0].imageViewName = m_gbufferImages[0].imageViews[0];
-		imageInfos[0].samplerName = m_gbufferImages[0].samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+void DeferredRenderer::updateStreamingAssets()
+{
+	++m_streamingFrame;
+	freeRetiredMeshes();
+#ifdef USE_WORLD_PARTITION
+	updateWorldPartition();
+#endif
+#ifdef USE_SCENE_HOT_SWAP
+	updateSceneHotSwap();
+#endif
+	if (!m_assetJobs) return;
 
-		imageInfos[0].imageViewName = m_gbufferImages[1].imageViews[0];
-		imageInfos[0].samplerName = m_gbufferImages[1].samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+	// Upload the first model whose files are all decoded. One per frame keeps the upload stalls short
+	for (size_t i = 0; i < m_pendingModels.size(); ++i)
+	{
+		auto &model = m_pendingModels[i];
+		if (!model || !m_assetJobs->isDone(model->beginJob, model->endJob)) continue;
 
-		imageInfos[0].imageViewName = m_gbufferImages[2].imageViews[0];
-		imageInfos[0].samplerName = m_gbufferImages[2].samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		m_assetJobs->wait(model->beginJob, model->endJob); // rethrows if a file failed to load
+		{
+			TRACE_CPU_SCOPE("upload streamed model");
+			m_scene.meshes[i].upload(model->data, &m_scene.textureCache, m_textureStreamer.get(), m_virtualTextures.get());
+		}
+#ifdef USE_WORLD_PARTITION
+		// What the mesh takes in device memory, about. Maps shared with other meshes count for each of them
+		uint64_t meshBytes = model->data.vertices.size() * sizeof(Vertex) + model->data.indices.size() * sizeof(uint32_t);
+		for (uint32_t m = 0; m < VMesh::numMapsPerMesh; ++m)
+		{
+			meshBytes += model->data.maps[m].size();
+			for (size_t levelSize : model->data.mapFiles[m].levelSizes) meshBytes += levelSize;
+		}
+		m_worldPartition->meshLoaded(static_cast<uint32_t>(i), meshBytes);
+#endif
+		model.reset();
 
-		imageInfos[0].imageViewName = m_depthImage.imageViews[0];
-		imageInfos[0].samplerName = m_depthImage.samplers[0];
-		m_vulkanManager.descriptorSetAddImageDescriptor(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos);
+		m_scene.buildBVH();
+		++m_materialsVersion;
+		requestRedraw();
 
-		m_vulkanManager.endUpdateDescriptorSet();
+#if defined(USE_WORLD_PARTITION)
+		--m_pendingModelCount; // the pool stays for the next cells
+#elif defined(USE_SCENE_HOT_SWAP)
+		if (--m_pendingModelCount == 0) // the pool stays for the next scenes
+		{
+			std::cout << "Scene " << m_currentScene << " streamed in" << std::endl;
+		}
+#else
+		if (--m_pendingModelCount == 0)
+		{
+			m_assetJobs.reset();
+			m_assetReader.reset();
+			m_pendingModels.clear();
+			std::cout << "All models streamed in" << std::endl;
+		}
+#endif
+		return;
 	}
 }
 
-void DeferredRenderer::createBrdfLutCommandBuffer()
+void DeferredRenderer::updateWorldPartition()
 {
-	if (m_bakedBrdfReady) return;
+	TRACE_CPU_SCOPE("updateWorldPartition");
+
+	// The camera, and the cascades of the last frame which are small enough to need casters the camera area may miss. The
+	// larger ones reach past the streaming radius anyway
+	FrameVector<WorldPartition::Area> areas(m_frameArena);
+	const glm::vec3 &cameraPos = m_camera.getPosition();
+	areas.push_back({ glm::vec2(cameraPos.x, cameraPos.z), WORLD_STREAMING_RADIUS });
+	for (uint32_t i = 0; i < m_camera.getActiveSegmentCount(); ++i)
+	{
+		glm::mat4 cascadeVP;
+		m_scene.shadowLight.getCascadeViewProjMatrix(i, &cascadeVP);
+		const glm::mat4 invCascadeVP = glm::inverse(cascadeVP);
+		glm::vec2 footprintMin(std::numeric_limits<float>::max());
+		glm::vec2 footprintMax(-std::numeric_limits<float>::max());
+		for (uint32_t c = 0; c < 8; ++c)
+		{
+			glm::vec4 corner = invCascadeVP * glm::vec4(c & 1 ? 1.f : -1.f, c & 2 ? 1.f : -1.f, c & 4 ? 1.f : 0.f, 1.f);
+			corner /= corner.w;
+			footprintMin = glm::min(footprintMin, glm::vec2(corner.x, corner.z));
+			footprintMax = glm::max(footprintMax, glm::vec2(corner.x, corner.z));
+		}
+		const float radius = 0.5f * glm::length(footprintMax - footprintMin);
+		if (radius <= WORLD_STREAMING_RADIUS) areas.push_back({ 0.5f * (footprintMin + footprintMax), radius });
+	}
 
-	m_vulkanManager.queueWaitIdle(VK_QUEUE_COMPUTE_BIT);
+	m_worldLoadCells.clear();
+	m_worldEvictCells.clear();
+	m_worldPartition->update(areas.data(), static_cast<uint32_t>(areas.size()), &m_worldLoadCells, &m_worldEvictCells);
 
-	m_vulkanManager.beginCommandBuffer(m_brdfLutCommandBuffer);
+	for (uint32_t cell : m_worldEvictCells)
+	{
+		for (uint32_t meshIdx : m_worldPartition->getCellMeshes(cell))
+		{
+			evictWorldMesh(meshIdx);
+		}
+	}
+	if (!m_worldEvictCells.empty())
+	{
+		m_scene.buildBVH();
+		++m_materialsVersion;
+		requestRedraw();
+	}
 
-	m_vulkanManager.cmdBindPipeline(m_brdfLutCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_brdfLutPipeline);
-	m_vulkanManager.cmdBindDescriptorSets(m_brdfLutCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_brdfLutPipelineLayout, { m_brdfLutDescriptorSet });
+	// updateStreamingAssets uploads the meshes once their files are decoded
+	for (uint32_t cell : m_worldLoadCells)
+	{
+		for (uint32_t meshIdx : m_worldPartition->getCellMeshes(cell))
+		{
+			m_pendingModels[meshIdx] = addModelJobs(m_worldModelFiles[meshIdx], m_assetJobs.get());
+			++m_pendingModelCount;
+		}
+	}
+}
 
-	const uint32_t bsx = 16, bsy = 16;
-	const uint32_t brdfLutSizeX = BRDF_LUT_SIZE, brdfLutSizeY = BRDF_LUT_SIZE;
-	m_vulkanManager.cmdDispatch(m_brdfLutCommandBuffer, brdfLutSizeX / bsx, brdfLutSizeY / bsy, 1);
+void DeferredRenderer::evictWorldMesh(uint32_t meshIdx)
+{
+	retireMesh(meshIdx);
 
-	m_vulkanManager.endCommandBuffer(m_brdfLutCommandBuffer);
+	// Back to the maps it had before it was loaded
+	setPlaceholderMaps(&m_scene.meshes[meshIdx], m_worldModelFiles[meshIdx]);
 }
 
-void DeferredRenderer::createEnvPrefilterCommandBuffer()
+void DeferredRenderer::retireMesh(uint32_t meshIdx)
 {
-	if (m_scene.skybox.specMapReady) return;
+	RetiredMesh retired;
+	m_scene.meshes[meshIdx].unload(&retired.mapKeys, &retired.lods);
+	retired.frame = m_streamingFrame;
+	m_retiredMeshes.push_back(std::move(retired));
+}
 
-	m_vulkanManager.beginCommandBuffer(m_envPrefilterCommandBuffer);
+void DeferredRenderer::freeRetiredMeshes()
+{
+	// A retired mesh may still be drawn by the command buffer of another swapchain image or by a frame in flight
+	const uint64_t keepFrames = m_vulkanManager.getSwapChainSize() + MAX_FRAMES_IN_FLIGHT;
+	while (!m_retiredMeshes.empty() && m_retiredMeshes.front().frame + keepFrames < m_streamingFrame)
+	{
+		const RetiredMesh &retired = m_retiredMeshes.front();
+		for (const auto &key : retired.mapKeys)
+		{
+			m_scene.textureCache.release(key);
+		}
+		for (size_t i = 0; i < retired.lods.size(); ++i)
+		{
+			m_vulkanManager.geometryPoolFree(retired.lods[i], i == 0); // the LODs share the vertices of the finest one
+		}
+		m_retiredMeshes.pop_front();
+	}
+}
 
-	m_vulkanManager.cmdBindVertexBuffers(m_envPrefilterCommandBuffer, { m_scene.skybox.vertexBuffer.buffer }, { 0 });
-	m_vulkanManager.cmdBindIndexBuffer(m_envPrefilterCommandBuffer, m_scene.skybox.indexBuffer.buffer, VK_INDEX_TYPE_UINT32);
+void DeferredRenderer::updateSceneHotSwap()
+{
+#ifdef USE_SCENE_HOT_SWAP
+	// A job of a model that failed to load is not waited for, so its exception is dropped with the scene
+	m_abandonedModels.erase(std::remove_if(m_abandonedModels.begin(), m_abandonedModels.end(),
+		[this](const std::unique_ptr<PendingModel> &model) { return m_assetJobs->isDone(model->beginJob, model->endJob); }),
+		m_abandonedModels.end());
 
-	std::vector<VkClearValue> clearValues(1);
-	clearValues[0].color = { { 0.f, 0.f, 0.f, 0.f } };
-	const uint32_t numIndices = static_cast<uint32_t>(m_scene.skybox.indexBuffer.size / sizeof(uint32_t));
+	if (m_sceneSwitchRequests > 0)
+	{
+		const std::vector<std::vector<std::string>> scenes = HOT_SWAP_SCENES;
+		const uint32_t sceneIdx = (m_currentScene + m_sceneSwitchRequests) % static_cast<uint32_t>(scenes.size());
+		m_sceneSwitchRequests = 0;
+		loadScene(sceneIdx);
+	}
+#endif
+}
 
-	// Specular prefitler pass
-	uint32_t mipLevels = m_scene.skybox.specularIrradianceMap.mipLevelCount;
-	float roughness = 0.f;
-	float roughnessDelta = 1.f / static_cast<float>(mipLevels - 1);
+bool DeferredRenderer::loadScene(uint32_t sceneIdx)
+{
+#ifdef USE_SCENE_HOT_SWAP
+	TRACE_CPU_SCOPE("loadScene");
 
-	// Layered rendering allows render into multiple layers but only one mip level
-	// In order to render all mips, multiple passes are required
-	for (uint32_t level = 0; level < mipLevels; ++level)
+	const std::vector<std::vector<std::string>> scenes = HOT_SWAP_SCENES;
+	std::vector<ModelFiles> modelFiles;
+	for (const auto &name : scenes.at(sceneIdx))
 	{
-		m_vulkanManager.cmdBeginRenderPass(m_envPrefilterCommandBuffer, m_specEnvPrefilterRenderPass, m_specEnvPrefilterFramebuffers[level], clearValues);
+		modelFiles.push_back(getModelFiles(name));
+		if (!AssetFile::exists(modelFiles.back().model))
+		{
+			std::cerr << "cannot load scene " << sceneIdx << ", " << modelFiles.back().model << " is missing" << std::endl;
+			return false;
+		}
+	}
 
-		m_vulkanManager.cmdBindPipeline(m_envPrefilterCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_specEnvPrefilterPipeline);
+	// Models of the old scene that are still decoding are written into by their jobs
+	for (auto &model : m_pendingModels)
+	{
+		if (model) m_abandonedModels.push_back(std::move(model));
+	}
+	m_pendingModelCount = 0;
 
-		m_vulkanManager.cmdBindDescriptorSets(m_envPrefilterCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			m_specEnvPrefilterPipelineLayout, { m_specEnvPrefilterDescriptorSet });
-		m_vulkanManager.cmdPushConstants(m_envPrefilterCommandBuffer, m_specEnvPrefilterPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &roughness);
+	// Every slot is unloaded, which also drops the optional maps of its old model, and starts over at the origin like the
+	// meshes loaded at startup
+	for (uint32_t i = 0; i < static_cast<uint32_t>(m_scene.meshes.size()); ++i)
+	{
+		retireMesh(i);
+		VMesh &mesh = m_scene.meshes[i];
+		mesh.setPosition(glm::vec3(0.f));
+		mesh.setRotation(glm::quat(glm::vec3(0.f, glm::pi<float>(), 0.f)));
+		mesh.setScale(1.f);
+		mesh.materialType = MATERIAL_TYPE_FSCHLICK_DGGX_GSMITH;
+		if (i < modelFiles.size())
+		{
+			setPlaceholderMaps(&mesh, modelFiles[i]);
+			m_pendingModels[i] = addModelJobs(modelFiles[i], m_assetJobs.get());
+			++m_pendingModelCount;
+		}
+		else
+		{
+			setPlaceholderMaps(&mesh, ModelFiles());
+		}
+	}
+	m_currentScene = sceneIdx;
 
-		m_vulkanManager.cmdSetViewport(m_envPrefilterCommandBuffer, m_specEnvPrefilterFramebuffers[level]);
-		m_vulkanManager.cmdSetScissor(m_envPrefilterCommandBuffer, m_specEnvPrefilterFramebuffers[level]);
+	m_scene.buildBVH();
+	++m_materialsVersion;
+	requestRedraw();
+	return true;
+#else
+	return false;
+#endif
+}
 
-		m_vulkanManager.cmdDrawIndexed(m_envPrefilterCommandBuffer, numIndices);
+void DeferredRenderer::updateTextureStreaming()
+{
+	TRACE_CPU_SCOPE("updateTextureStreaming");
 
-		m_vulkanManager.cmdEndRenderPass(m_envPrefilterCommandBuffer);
+	// Every map of a visible mesh asks for about one texel per pixel of the mesh's projected size
+	for (size_t j = 0; j < m_scene.meshes.size(); ++j)
+	{
+		if (m_meshScreenSizes[j] <= 0.f) continue;
+		for (uint32_t handle : m_scene.meshes[j].streamedMaps)
+		{
+			if (handle == rj::VTextureStreamer::INVALID_HANDLE) continue;
+			m_textureStreamer->request(handle, m_textureStreamer->getLevelForScreenSize(handle, m_meshScreenSizes[j]));
+		}
+	}
 
-		roughness += roughnessDelta;
+	// Promotions within what is left of the frame's background budget. Their cost is the wall time of the update, which
+	// waits for its upload batch, so it bounds the transfer from above
+	const uint64_t uploadBytes = std::min<uint64_t>(m_backgroundBudget.getAffordableUnits(BackgroundWorkBudget::WORK_TEXTURE_UPLOAD),
+		TEXTURE_STREAMING_UPLOAD_BUDGET);
+	m_textureStreamer->setFrameUploadBudget(uploadBytes, m_backgroundBudget.canRunOversized());
+	const auto updateStartTime = std::chrono::high_resolution_clock::now();
+	const bool changed = m_textureStreamer->update();
+	const VkDeviceSize uploadedBytes = m_textureStreamer->getLastUploadedBytes();
+	if (uploadedBytes > 0)
+	{
+		const float updateMS = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - updateStartTime).count();
+		m_backgroundBudget.addMeasurement(BackgroundWorkBudget::WORK_TEXTURE_UPLOAD, uploadedBytes, updateMS);
+		m_backgroundBudget.spend(BackgroundWorkBudget::WORK_TEXTURE_UPLOAD, uploadedBytes);
 	}
+	if (!changed) return;
 
-	m_vulkanManager.endCommandBuffer(m_envPrefilterCommandBuffer);
+	// Promoted or demoted maps are new images, the material sets pick them up with the next version
+	for (auto &mesh : m_scene.meshes)
+	{
+		rj::helper_functions::ImageWrapper *maps[VMesh::numMapsPerMesh];
+		mesh.getMaps(maps);
+		for (uint32_t i = 0; i < VMesh::numMapsPerMesh; ++i)
+		{
+			if (mesh.streamedMaps[i] == rj::VTextureStreamer::INVALID_HANDLE) continue;
+			*maps[i] = m_textureStreamer->getTexture(mesh.streamedMaps[i]);
+		}
+	}
+	++m_materialsVersion;
+	requestRedraw();
 }
 
-void DeferredRenderer::createGeomShadowLightingCommandBuffers()
+void DeferredRenderer::saveFrameStatistics() const
 {
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	if (m_frameStatistics.getFrameCount() == 0) return;
+
+	if (!m_frameStatistics.saveCsv(FRAME_STATS_FILE_NAME ".csv") || !m_frameStatistics.saveJson(FRAME_STATS_FILE_NAME ".json"))
 	{
-		uint32_t cb = m_perFrameCommandBuffers[imgIdx].m_geomShadowLightingCommandBuffer;
-		m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
+		std::cerr << "Unable to save frame statistics to " FRAME_STATS_FILE_NAME ".csv/.json" << std::endl;
+	}
+}
+
+bool DeferredRenderer::saveBenchmarkResults(const std::vector<std::string> &passPaths,
+	const std::unordered_map<std::string, std::vector<float>> &passTimes) const
+{
+	std::ofstream file(m_benchmarkFileName);
+	if (!file.is_open()) return false;
 
-		m_vulkanManager.cmdResetQueryPool(cb, m_perFrameQueryPools[imgIdx], 0, TQI_QUERY_COUNT);
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_GEOM_START);
+	auto writePercentiles = [&file](const FrameStatistics::Percentiles &p)
+	{
+		file << "{ \"p50\": " << p.p50 << ", \"p95\": " << p.p95 << ", \"p99\": " << p.p99 << ", \"max\": " << p.max << " }";
+	};
 
-		std::vector<VkClearValue> clearValues(4);
-		clearValues[0].depthStencil = { 1.0f, 0 };
-		clearValues[1].color = { { 0.0f, 0.0f, 0.0f, 0.0f } }; // g-buffer 1
-		clearValues[2].color = { { 0.0f, 0.0f, 0.0f, 0.0f } }; // g-buffer 2
-		clearValues[3].color = { { 0.0f, 0.0f, 0.0f, 0.0f } }; // g-buffer 3
-		m_vulkanManager.cmdBeginRenderPass(cb, m_geomRenderPass, m_geomFramebuffer, clearValues);
+	const VkExtent2D extent = m_vulkanManager.getSwapChainExtent();
+	file << "{\n";
+	file << "\t\"frameCount\": " << m_frameStatistics.getFrameCount() << ",\n";
+	file << "\t\"width\": " << extent.width << ",\n";
+	file << "\t\"height\": " << extent.height << ",\n";
+	file << "\t\"sampleCount\": " << static_cast<uint32_t>(m_sampleCount) << ",\n";
+	file << "\t\"headless\": " << (m_headless ? "true" : "false") << ",\n";
+	file << "\t\"hitchCount\": " << m_frameStatistics.getHitchCount() << ",\n";
+	file << "\t\"triangles\": " << m_benchmarkSummary.triangleCount << ",\n";
+	file << "\t\"deviceLocalBytes\": " << m_benchmarkSummary.deviceLocalBytes << ",\n";
+	file << "\t\"hostVisibleBytes\": " << m_benchmarkSummary.hostVisibleBytes << ",\n";
+#ifdef USE_SYNTHETIC_SCENE
+	file << "\t\"syntheticScene\": \"" << m_syntheticScene.toString() << "\",\n";
+#endif
+	file << "\t\"cpuMS\": ";
+	writePercentiles(m_frameStatistics.getCpuPercentiles());
+	file << ",\n\t\"gpuMS\": ";
+	writePercentiles(m_frameStatistics.getGpuPercentiles());
+
+	// Per pass average and percentiles, scopes are named by their path, e.g. "shadow/cascade0"
+	file << ",\n\t\"passesMS\": {";
+	for (size_t i = 0; i < passPaths.size(); ++i)
+	{
+		const auto &times = passTimes.at(passPaths[i]);
+		float sum = 0.f;
+		for (float t : times) sum += t;
 
-		// Geometry pass
-		{
-			m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_skyboxPipeline);
+		file << (i > 0 ? ",\n" : "\n") << "\t\t\"" << passPaths[i] << "\": { \"avg\": " << sum / times.size() << ", \"percentiles\": ";
+		writePercentiles(FrameStatistics::computePercentiles(times));
+		file << " }";
+	}
+	file << "\n\t},\n";
 
-			m_vulkanManager.cmdBindVertexBuffers(cb, { m_scene.skybox.vertexBuffer.buffer }, { 0 });
-			m_vulkanManager.cmdBindIndexBuffer(cb, m_scene.skybox.indexBuffer.buffer, VK_INDEX_TYPE_UINT32);
+	std::vector<float> cpuTimes;
+	m_frameStatistics.getRecentCpuTimes(static_cast<uint32_t>(m_frameStatistics.getFrameCount()), &cpuTimes);
+	file << "\t\"cpuFrameTimesMS\": [";
+	for (size_t i = 0; i < cpuTimes.size(); ++i)
+	{
+		file << (i > 0 ? ", " : "") << cpuTimes[i];
+	}
+	file << "]\n}\n";
 
-			m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-				m_skyboxPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_skyboxDescriptorSet });
-			m_vulkanManager.cmdPushConstants(cb, m_skyboxPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &m_scene.skybox.materialType);
+	return file.good();
+}
 
-			const uint32_t numIndices = static_cast<uint32_t>(m_scene.skybox.indexBuffer.size / sizeof(uint32_t));
-			m_vulkanManager.cmdDrawIndexed(cb, numIndices);
-		}
+std::string DeferredRenderer::ABConfig::toString() const
+{
+	std::stringstream ss;
+	ss << "MSAA " << static_cast<uint32_t>(sampleCount) << "x, pre-pass " << (depthPrepass ? "on" : "off") << ", command buffers " <<
+		(recordPerFrame ? "recorded per frame" : "pre-recorded") << ", low latency " << (lowLatency ? "on" : "off") <<
+		", fp16 " << (halfPrecision ? "on" : "off");
+	return ss.str();
+}
 
-		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_geomPipeline);
+bool DeferredRenderer::startABComparison()
+{
+	ABConfig a = { m_sampleCount, m_useDepthPrepass, m_recordCommandBuffersPerFrame, m_lowLatencyMode, m_useHalfPrecision };
+	ABConfig b = a;
 
-		const uint32_t numModels = static_cast<uint32_t>(m_scene.meshes.size());
-		for (uint32_t j = 0; j < numModels; ++j)
+	std::stringstream toggles(m_abToggles);
+	std::string toggle;
+	while (std::getline(toggles, toggle, ','))
+	{
+		if (toggle == "prepass") b.depthPrepass = !b.depthPrepass;
+		else if (toggle == "record") b.recordPerFrame = !b.recordPerFrame;
+		else if (toggle == "low-latency") b.lowLatency = !b.lowLatency;
+		else if (toggle == "fp16")
+		{
+			if (!m_vulkanManager.isShaderFloat16Enabled())
+			{
+				std::cerr << "A/B toggle fp16 needs shaderFloat16 of VK_KHR_shader_float16_int8" << std::endl;
+				return false;
+			}
+			b.halfPrecision = !b.halfPrecision;
+		}
+		else if (toggle.compare(0, 5, "msaa=") == 0 && std::atoi(toggle.c_str() + 5) > 0)
+		{
+			b.sampleCount = clampSampleCount(static_cast<VkSampleCountFlagBits>(std::atoi(toggle.c_str() + 5)));
+		}
+		else
 		{
-			m_vulkanManager.cmdBindVertexBuffers(cb, { m_scene.meshes[j].vertexBuffer.buffer }, { 0 });
-			m_vulkanManager.cmdBindIndexBuffer(cb, m_scene.meshes[j].indexBuffer.buffer, VK_INDEX_TYPE_UINT32);
+			std::cerr << "Unknown A/B toggle " << toggle << std::endl;
+			return false;
+		}
+	}
+	if (a == b)
+	{
+		std::cerr << "A/B toggles " << m_abToggles << " leave B the same as A" << std::endl;
+		return false;
+	}
 
-			m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-				m_geomPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_geomDescriptorSets[j] });
+	m_abConfigs[0] = a;
+	m_abConfigs[1] = b;
+	m_abCamera = m_camera.getState();
 
-			struct
-			{
-				uint32_t materialId;
-				uint32_t hasAoMap;
-				uint32_t hasEmissiveMap;
-			} pushConst;
-			pushConst.materialId = m_scene.meshes[j].materialType;
-			pushConst.hasAoMap = m_scene.meshes[j].aoMap.image != std::numeric_limits<uint32_t>::max();
-			pushConst.hasEmissiveMap = m_scene.meshes[j].emissiveMap.image != std::numeric_limits<uint32_t>::max();
+	// GPU times arrive up to a swapchain's worth of frames late
+	const uint32_t settleFrameCount = std::max<uint32_t>(AB_SETTLE_FRAMES, m_vulkanManager.getSwapChainSize() + MAX_FRAMES_IN_FLIGHT);
+	m_abExperiment.start(AB_BLOCK_FRAMES, settleFrameCount);
+	std::cout << "A/B comparison\n  A: " << a.toString() << "\n  B: " << b.toString() << std::endl;
+	return true;
+}
+
+void DeferredRenderer::stopABComparison()
+{
+	m_abExperiment.stop();
 
-			m_vulkanManager.cmdPushConstants(cb, m_geomPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConst), &pushConst);
+	applyABConfig(m_abConfigs[0]); // the settings it started from
 
-			const uint32_t numIndices = static_cast<uint32_t>(m_scene.meshes[j].indexBuffer.size / sizeof(uint32_t));
-			m_vulkanManager.cmdDrawIndexed(cb, numIndices);
-		}
+	for (const auto &c : m_abExperiment.getComparisons())
+	{
+		if (c.name != "cpu" && c.name != "gpu") continue;
+		std::cout << std::fixed << std::setprecision(3) << "  " << c.name << " : A " << c.a.mean << " ms, B " << c.b.mean << " ms, delta " <<
+			c.delta << " ms";
+		if (c.ci95 >= 0.0) std::cout << " +- " << c.ci95 << (c.isSignificant() ? "" : " (not significant)");
+		std::cout << std::endl;
+	}
+	if (!m_abExperiment.saveCsv(AB_RESULTS_FILE_NAME, m_abConfigs[0].toString(), m_abConfigs[1].toString()))
+	{
+		std::cerr << "Unable to save A/B results to " << AB_RESULTS_FILE_NAME << std::endl;
+	}
+}
 
-		m_vulkanManager.cmdEndRenderPass(cb);
+void DeferredRenderer::updateABComparison()
+{
+	if (m_abToggleRequested)
+	{
+		m_abToggleRequested = false;
+		if (m_abExperiment.isRunning()) stopABComparison();
+		else startABComparison();
+	}
 
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_GEOM_END);
+	// Input and camera paths would change what is measured between blocks
+	if (m_abExperiment.isRunning()) m_camera.setState(m_abCamera);
+}
 
-		// Shadow pass
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_SHADOW_START);
+void DeferredRenderer::addABFrame(float cpuFrameTimeMS)
+{
+	if (!m_abExperiment.isRunning()) return;
 
-		clearValues.resize(m_camera.getSegmentCount());
-		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i) clearValues[i].depthStencil = { 1.f, 0 };
-		m_vulkanManager.cmdBeginRenderPass(cb, m_shadowRenderPass, m_shadowFramebuffer, clearValues);
+	std::vector<std::pair<std::string, float>> passTimes;
+	const float ticksToMS = m_gpuProfiler.getTimestampPeriod() * 1e-6f;
+	for (const auto &scope : m_gpuProfiler.getLastFrameTimestamps())
+	{
+		passTimes.emplace_back(scope.path, static_cast<float>(scope.end - scope.begin) * ticksToMS);
+	}
+	if (!m_abExperiment.addFrame(cpuFrameTimeMS, m_gpuProfiler.getLastFrameTimeMS(), passTimes)) return;
 
-		for (uint32_t i = 0; i < m_camera.getSegmentCount(); ++i)
-		{
-			if (i > 0) m_vulkanManager.cmdNextSubpass(cb);
+	applyABConfig(m_abConfigs[m_abExperiment.getConfig()]);
+}
 
-			m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipelines[i]);
+void DeferredRenderer::applyABConfig(const ABConfig &config)
+{
+	// Taken up by this frame's recording, or by the next drawFrame() for the sample count
+	m_requestedSampleCount = config.sampleCount;
+	m_useDepthPrepass = config.depthPrepass;
+	m_recordCommandBuffersPerFrame = config.recordPerFrame;
+	m_lowLatencyMode = config.lowLatency;
+	m_useHalfPrecision = config.halfPrecision;
+}
 
-			for (uint32_t j = 0; j < numModels; ++j)
-			{
-				m_vulkanManager.cmdBindVertexBuffers(cb, { m_scene.meshes[j].vertexBuffer.buffer }, { 0 });
-				m_vulkanManager.cmdBindIndexBuffer(cb, m_scene.meshes[j].indexBuffer.buffer, VK_INDEX_TYPE_UINT32);
+void DeferredRenderer::startRequestedTraceCapture()
+{
+	if (!m_traceCaptureRequested) return;
+	m_traceCaptureRequested = false;
 
-				m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipelineLayout,
-					{ m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets1[i], m_perFrameDescriptorSets[imgIdx].m_shadowDescriptorSets2[j] });
+	if (!m_vulkanManager.isCalibratedTimestampsEnabled())
+	{
+		std::cerr << "VK_EXT_calibrated_timestamps is not available, the trace only has CPU events" << std::endl;
+	}
+	// The GPU scopes of a frame are read back when its swapchain image is acquired again
+	TraceRecorder::get().beginCapture(m_traceFrameCount, m_vulkanManager.getSwapChainSize(), TRACE_FILE_NAME);
+}
 
-				const uint32_t numIndices = static_cast<uint32_t>(m_scene.meshes[j].indexBuffer.size / sizeof(uint32_t));
-				m_vulkanManager.cmdDrawIndexed(cb, numIndices);
-			}
-		}
+void DeferredRenderer::recordFrameCapture(uint32_t imgIdx)
+{
+	TRACE_CPU_SCOPE("recordFrameCapture");
 
-		m_vulkanManager.cmdEndRenderPass(cb);
+	const VkExtent2D extent = m_vulkanManager.getSwapChainExtent();
+	const VkFormat format = m_vulkanManager.getSwapChainImageFormat();
+	const uint64_t frameIndex = m_frameCaptureIndex++;
 
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_SHADOW_END);
+	const uint32_t cb = m_perFrameCommandBuffers[imgIdx].m_frameCaptureCommandBuffer;
+	m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
-		// Lighting pass
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_LIGHTING_START);
+	if (m_frameCaptureCallback)
+	{
+		const VkDeviceSize frameSize = VkDeviceSize(extent.width) * extent.height * rj::helper_functions::g_formatInfoTable.at(format).blockSize;
+		// Sized at the first capture and when the swapchain grows, whose recreation has waited for every readback
+		if (m_vulkanManager.getReadbackRing().getBufferSize() < frameSize)
+		{
+			m_vulkanManager.initReadbackRing(FRAME_CAPTURE_BUFFER_COUNT, frameSize);
+		}
 
-		clearValues.resize(1);
-		clearValues[0].color = { { 0.f, 0.f, 0.f, 0.f } };
-		m_vulkanManager.cmdBeginRenderPass(cb, m_lightingRenderPass, m_lightingFramebuffer, clearValues);
+		const FrameCaptureCallback callback = m_frameCaptureCallback;
+		auto onReadback = [callback, extent, format, frameIndex](const char *data, VkDeviceSize sizeInBytes)
+		{
+			callback(data, sizeInBytes, extent.width, extent.height, format, frameIndex);
+		};
+		if (!m_vulkanManager.cmdReadSwapChainImageAsync(cb, imgIdx, onReadback))
+		{
+			std::cerr << "frame " << frameIndex << " was dropped from the capture, every readback buffer is in flight" << std::endl;
+		}
+	}
 
-		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_lightingPipeline);
-		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			m_lightingPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_lightingDescriptorSet });
+	if (m_externalFrameCallback)
+	{
+		// Recreated with a new generation after the swapchain has changed, which has waited for the device
+		auto &sink = m_vulkanManager.getExternalImageSink();
+		if (!sink.isInitialized() || sink.getExtent().width != extent.width || sink.getExtent().height != extent.height ||
+			sink.getFormat() != format)
+		{
+			m_vulkanManager.initExternalImageSink(EXTERNAL_FRAME_IMAGE_COUNT);
+		}
 
-		struct
+		m_externalImageIdx = m_vulkanManager.cmdCopySwapChainImageToExternalSink(cb, imgIdx);
+		if (m_externalImageIdx == std::numeric_limits<uint32_t>::max())
 		{
-			uint32_t specIrradianceMapMipCount;
-			int32_t frustumSegmentCount;
-			int32_t pcfKernelSize;
-		} pushConst;
-		pushConst.specIrradianceMapMipCount = m_scene.skybox.specularIrradianceMap.mipLevelCount;
-		pushConst.frustumSegmentCount = m_camera.getSegmentCount();
-		pushConst.pcfKernelSize = m_scene.shadowLight.getPCFKernlSize();
-		m_vulkanManager.cmdPushConstants(cb, m_lightingPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConst), &pushConst);
+			std::cerr << "frame " << frameIndex << " was dropped from the external sink, the encoder holds every image" << std::endl;
+		}
+	}
 
-		m_vulkanManager.cmdDraw(cb, 3);
+	m_vulkanManager.endCommandBuffer(cb);
+}
 
-		m_vulkanManager.cmdEndRenderPass(cb);
+void DeferredRenderer::addGpuTraceEvents()
+{
+	auto &recorder = TraceRecorder::get();
+	if (!recorder.isCapturing() || !m_vulkanManager.isCalibratedTimestampsEnabled()) return;
 
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_LIGHTING_END);
+	uint64_t deviceTimestamp, hostNs;
+	if (!m_vulkanManager.getCalibratedTimestamps(&deviceTimestamp, &hostNs)) return;
 
-		m_vulkanManager.endCommandBuffer(cb);
+	// The scopes ran before the calibration point, map them back from it.
+	// Sampling every frame keeps the drift between the two clocks out of the trace
+	const double period = m_gpuProfiler.getTimestampPeriod();
+	auto toHostNs = [&](uint64_t timestamp)
+	{
+		const double deltaNs = static_cast<double>(static_cast<int64_t>(timestamp - deviceTimestamp)) * period;
+		return static_cast<uint64_t>(static_cast<double>(hostNs) + deltaNs);
+	};
+
+	for (const auto &scope : m_gpuProfiler.getLastFrameTimestamps())
+	{
+		recorder.addGpuEvent(scope.path, toHostNs(scope.begin), toHostNs(scope.end));
 	}
 }
 
-void DeferredRenderer::createPostEffectCommandBuffers()
+void DeferredRenderer::savePrecomputationResults()
 {
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+	// read back computation results and save to disk
+	if (m_shouldSaveBakedBrdf)
 	{
-		uint32_t cb = m_perFrameCommandBuffers[imgIdx].m_postEffectCommandBuffer;
-		m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
-
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_BLOOM_START);
-
-		// brightness mask
-		std::vector<VkClearValue> clearValues(1);
-		clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
-		m_vulkanManager.cmdBeginRenderPass(cb, m_bloomRenderPasses[0], m_postEffectFramebuffers[0], clearValues);
+		std::vector<char> hostData;
+		m_vulkanManager.readImage(hostData, m_bakedBRDFs[0].image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_bloomPipelines[0]);
-		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			m_bloomPipelineLayouts[0], { m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[0] });
+#ifdef USE_COMPACT_IBL_MAPS
+		// Scale and bias are both in [0, 1]
+		const glm::vec2 *pTexels = reinterpret_cast<const glm::vec2 *>(hostData.data());
+		std::vector<uint32_t> packed(hostData.size() / sizeof(glm::vec2));
+		for (size_t i = 0; i < packed.size(); ++i)
+		{
+			packed[i] = glm::packUnorm2x16(pTexels[i]);
+		}
+		rj::helper_functions::saveImage2D(m_brdfLutCacheFileName,
+			BRDF_LUT_SIZE, BRDF_LUT_SIZE, sizeof(uint32_t), 1, gli::FORMAT_RG16_UNORM_PACK16, packed.data());
+#else
+		rj::helper_functions::saveImage2D(m_brdfLutCacheFileName,
+			BRDF_LUT_SIZE, BRDF_LUT_SIZE, sizeof(glm::vec2), 1, gli::FORMAT_RG32_SFLOAT_PACK32, hostData.data());
+#endif
+		AssetFile::record(m_brdfLutCacheFileName);
+	}
 
-		m_vulkanManager.cmdDraw(cb, 3);
+	auto saveSpecMap = [this](const rj::helper_functions::ImageWrapper &specMap, const std::string &fileName)
+	{
+		std::vector<char> hostData;
+		m_vulkanManager.readImage(hostData, specMap.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-		m_vulkanManager.cmdEndRenderPass(cb);
+#ifdef USE_COMPACT_IBL_MAPS
+		// Alpha is unused, radiance is never negative
+		const glm::vec4 *pTexels = reinterpret_cast<const glm::vec4 *>(hostData.data());
+		std::vector<uint32_t> packed(hostData.size() / sizeof(glm::vec4));
+		for (size_t i = 0; i < packed.size(); ++i)
+		{
+			packed[i] = glm::packF2x11_1x10(glm::max(glm::vec3(pTexels[i]), glm::vec3(0.f)));
+		}
+		rj::helper_functions::saveImageCube(fileName,
+			SPEC_IRRADIANCE_MAP_SIZE, SPEC_IRRADIANCE_MAP_SIZE, sizeof(uint32_t),
+			specMap.mipLevelCount, gli::FORMAT_RG11B10_UFLOAT_PACK32, packed.data());
+#else
+		rj::helper_functions::saveImageCube(fileName,
+			SPEC_IRRADIANCE_MAP_SIZE, SPEC_IRRADIANCE_MAP_SIZE, sizeof(glm::vec4),
+			specMap.mipLevelCount, gli::FORMAT_RGBA32_SFLOAT_PACK32, hostData.data());
+#endif
+		AssetFile::record(fileName);
+	};
 
-		// gaussian blur
-		const uint32_t bloomPassCount = 1;
-		for (uint32_t i = 0; i < bloomPassCount; ++i)
+#ifdef USE_PROBE_SWITCHING
+	// The probes still resident, one that is being prefiltered is left out
+	for (const auto &probe : m_residentProbes)
+	{
+		if (probe.shouldSaveSpecMap && probe.specMapReady)
 		{
-			// horizontal
-			m_vulkanManager.cmdBeginRenderPass(cb, m_bloomRenderPasses[0], m_postEffectFramebuffers[1], clearValues);
+			saveSpecMap(probe.specularIrradianceMap, probe.specMapCacheFileName);
+		}
+	}
+#else
+	if (m_scene.skybox.shouldSaveSpecMap)
+	{
+		saveSpecMap(m_scene.skybox.specularIrradianceMap, m_specMapCacheFileName);
+	}
+#endif
 
-			m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_bloomPipelines[1]);
-			m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-				m_bloomPipelineLayouts[1], { m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[1] });
+	m_vulkanManager.deviceWaitIdle();
+}
 
-			uint32_t isHorizontal = VK_TRUE;
-			m_vulkanManager.cmdPushConstants(cb, m_bloomPipelineLayouts[1], VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &isHorizontal);
+std::string DeferredRenderer::getPrecomputeCacheFileName(const std::string &stem, uint64_t key, const std::string &extension)
+{
+	char keyString[17];
+	snprintf(keyString, sizeof(keyString), "%016llx", static_cast<unsigned long long>(key));
+	return PRECOMPUTE_CACHE_DIR + stem + "_" + keyString + extension;
+}
 
-			m_vulkanManager.cmdDraw(cb, 3);
+void DeferredRenderer::getProbeCacheFileNames(const std::string &probeFileName, std::string *pSpecMapFileName, std::string *pDiffuseSHFileName,
+	uint64_t *pProbeHash)
+{
+	uint64_t probeHash = pProbeHash ? *pProbeHash : 0;
+	if (probeHash == 0)
+	{
+		AssetFile probe(probeFileName);
+		if (!probe.isOpen())
+		{
+			throw std::runtime_error("cannot open " + probeFileName);
+		}
+		probeHash = hashFnv1a(probe.getData(), probe.getSize());
+		if (pProbeHash) *pProbeHash = probeHash;
+	}
+#ifdef USE_COMPUTE_ENV_PREFILTER
+	const uint32_t computePrefilter = 1;
+#else
+	const uint32_t computePrefilter = 0;
+#endif
+#ifdef USE_COMPACT_IBL_MAPS
+	const uint32_t compactMaps = 1;
+#else
+	const uint32_t compactMaps = 0;
+#endif
+	const uint32_t specMapParams[] = { PRECOMPUTE_CACHE_VERSION, SPEC_IRRADIANCE_MAP_SIZE, computePrefilter, compactMaps };
+	*pSpecMapFileName = getPrecomputeCacheFileName("Specular_HDR", hashFnv1a(specMapParams, sizeof(specMapParams), probeHash), ".dds");
+	const uint32_t diffuseSHParams[] = { PRECOMPUTE_CACHE_VERSION };
+	*pDiffuseSHFileName = getPrecomputeCacheFileName("Diffuse_SH", hashFnv1a(diffuseSHParams, sizeof(diffuseSHParams), probeHash), ".bin");
+}
 
-			m_vulkanManager.cmdEndRenderPass(cb);
+uint64_t DeferredRenderer::getSceneFileKey(const std::string &skyboxFileName, const std::string &probeFileName)
+{
+	const std::vector<std::string> modelNames = MODEL_NAMES;
+	const uint64_t modelCount = modelNames.size();
+	uint64_t key = hashFnv1a(&modelCount, sizeof(modelCount));
+	// Each name with its terminator, so no two lists hash the same by moving a character
+	auto addName = [&key](const std::string &name) { key = hashFnv1a(name.c_str(), name.size() + 1, key); };
+	auto addFileSize = [&key](const std::string &fileName)
+	{
+		const uint64_t size = AssetFile::exists(fileName) ? AssetFile(fileName).getSize() : 0;
+		key = hashFnv1a(&size, sizeof(size), key);
+	};
 
-			// vertical
-			m_vulkanManager.cmdBeginRenderPass(cb, m_bloomRenderPasses[0], m_postEffectFramebuffers[0], clearValues);
+	for (const auto &name : modelNames)
+	{
+		addName(name);
+	}
+#ifdef USE_WORLD_PARTITION
+	addName(WORLD_LAYOUT_FILE_NAME);
+	addFileSize(WORLD_LAYOUT_FILE_NAME);
+#endif
+	addName(skyboxFileName);
+	addName(probeFileName);
+	addFileSize(probeFileName);
+	return key;
+}
 
-			m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_bloomPipelines[1]);
-			m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-				m_bloomPipelineLayouts[1], { m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[2] });
+VkFormat DeferredRenderer::findDepthFormat()
+{
+	return m_vulkanManager.chooseSupportedFormatFromCandidates(
+	{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
+		VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+}
 
-			isHorizontal = VK_FALSE;
-			m_vulkanManager.cmdPushConstants(cb, m_bloomPipelineLayouts[1], VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &isHorizontal);
+VkSampleCountFlagBits DeferredRenderer::clampSampleCount(VkSampleCountFlagBits sampleCount) const
+{
+#ifdef USE_TAA
+	// TAA replaces MSAA
+	return VK_SAMPLE_COUNT_1_BIT;
+#endif
 
-			m_vulkanManager.cmdDraw(cb, 3);
+	// Highest supported count not above @sampleCount. 1 sample is always supported
+	uint32_t count = static_cast<uint32_t>(sampleCount);
+	while (count > 1 && (m_supportedSampleCounts & count) == 0)
+	{
+		count >>= 1;
+	}
+	return static_cast<VkSampleCountFlagBits>(std::max(count, 1u));
+}
 
-			m_vulkanManager.cmdEndRenderPass(cb);
-		}
+VkExtent2D DeferredRenderer::getRenderExtent() const
+{
+	VkExtent2D extent = m_vulkanManager.getSwapChainExtent();
+#ifdef USE_TAA
+	extent.width = std::max(1u, static_cast<uint32_t>(extent.width * TAA_RENDER_SCALE));
+	extent.height = std::max(1u, static_cast<uint32_t>(extent.height * TAA_RENDER_SCALE));
+#endif
+	return extent;
+}
 
-		// merge
-		m_vulkanManager.cmdBeginRenderPass(cb, m_bloomRenderPasses[1], m_postEffectFramebuffers[2], {});
+VkExtent2D DeferredRenderer::getLightingExtent() const
+{
+	VkExtent2D extent = getRenderExtent();
+#ifdef USE_HALF_RES_LIGHTING
+	// Rounded up, so the half resolution pixels cover every full resolution one
+	extent.width = (extent.width + 1) / 2;
+	extent.height = (extent.height + 1) / 2;
+#endif
+	return extent;
+}
 
-		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_bloomPipelines[2]);
-		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			m_bloomPipelineLayouts[0], { m_perFrameDescriptorSets[imgIdx].m_bloomDescriptorSets[1] });
+VkExtent2D DeferredRenderer::getShadingRateTexelSize() const
+{
+	const auto &properties = m_vulkanManager.getFragmentShadingRateProperties();
+	return
+	{
+		std::min(std::max(static_cast<uint32_t>(VRS_TEXEL_SIZE), properties.minFragmentShadingRateAttachmentTexelSize.width),
+			properties.maxFragmentShadingRateAttachmentTexelSize.width),
+		std::min(std::max(static_cast<uint32_t>(VRS_TEXEL_SIZE), properties.minFragmentShadingRateAttachmentTexelSize.height),
+			properties.maxFragmentShadingRateAttachmentTexelSize.height)
+	};
+}
 
-		m_vulkanManager.cmdDraw(cb, 3);
+VkResolveModeFlagBitsKHR DeferredRenderer::getDepthResolveMode() const
+{
+#ifdef USE_DEPTH_RESOLVE
+	// Sample zero is supported wherever the extension is
+	if (m_sampleCount == VK_SAMPLE_COUNT_1_BIT || !m_vulkanManager.isDepthStencilResolveEnabled()) return VK_RESOLVE_MODE_NONE_KHR;
+	const VkResolveModeFlagsKHR modes = m_vulkanManager.getDepthStencilResolveProperties().supportedDepthResolveModes;
+	return (modes & VK_RESOLVE_MODE_MIN_BIT_KHR) ? VK_RESOLVE_MODE_MIN_BIT_KHR : VK_RESOLVE_MODE_SAMPLE_ZERO_BIT_KHR;
+#else
+	return VK_RESOLVE_MODE_NONE_KHR;
+#endif
+}
 
-		m_vulkanManager.cmdEndRenderPass(cb);
+VkResolveModeFlagBitsKHR DeferredRenderer::getDepthMaxResolveMode() const
+{
+#ifdef USE_DEPTH_RESOLVE_MIN_MAX
+	if (getDepthResolveMode() == VK_RESOLVE_MODE_NONE_KHR) return VK_RESOLVE_MODE_NONE_KHR;
+	const VkResolveModeFlagsKHR modes = m_vulkanManager.getDepthStencilResolveProperties().supportedDepthResolveModes;
+	return (modes & VK_RESOLVE_MODE_MAX_BIT_KHR) ? VK_RESOLVE_MODE_MAX_BIT_KHR : VK_RESOLVE_MODE_NONE_KHR;
+#else
+	return VK_RESOLVE_MODE_NONE_KHR;
+#endif
+}
 
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_BLOOM_END);
+const rj::helper_functions::ImageWrapper &DeferredRenderer::getSampledDepthImage(bool farthest) const
+{
+	if (farthest) return getDepthMaxResolveMode() != VK_RESOLVE_MODE_NONE_KHR ? m_resolvedDepthMaxImage : m_depthImage;
+	return getDepthResolveMode() != VK_RESOLVE_MODE_NONE_KHR ? m_resolvedDepthImage : m_depthImage;
+}
 
-		m_vulkanManager.endCommandBuffer(cb);
+VkFormat DeferredRenderer::getResolvedDepthFormat()
+{
+	// Same depth bits as the attachment, which the resolve requires
+	switch (findDepthFormat())
+	{
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return VK_FORMAT_D32_SFLOAT;
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+		return VK_FORMAT_X8_D24_UNORM_PACK32;
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+		return VK_FORMAT_D16_UNORM;
+	default:
+		return findDepthFormat();
 	}
 }
 
-void DeferredRenderer::createPresentCommandBuffers()
+VkFormat DeferredRenderer::findStencilFormat()
 {
-	// Final ouput pass
-	std::vector<VkClearValue> clearValues(1);
-	clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+	return m_vulkanManager.chooseSupportedFormatFromCandidates(
+	{ VK_FORMAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT },
+		VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+}
 
-	const uint32_t swapChainImageCount = m_vulkanManager.getSwapChainSize();
-	for (uint32_t imgIdx = 0; imgIdx < swapChainImageCount; ++imgIdx)
+VkFormat DeferredRenderer::findShadowDepthFormat()
+{
+#ifdef USE_SHADOW_D16
+	// The comparison sampler of the cascades filters linearly, which is optional for D16_UNORM
+	if (m_vulkanManager.isFormatSupported(VK_FORMAT_D16_UNORM, VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
 	{
-		uint32_t cb = m_perFrameCommandBuffers[imgIdx].m_presentCommandBuffer;
-		m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
+		return VK_FORMAT_D16_UNORM;
+	}
+#endif
+	return findDepthFormat();
+}
 
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_FINAL_OUTPUT_START);
+uint32_t DeferredRenderer::getShadowSubpassCount() const
+{
+#ifdef USE_LAYERED_SHADOW_PASS
+	return 1;
+#else
+	return m_camera.getSegmentCount();
+#endif
+}
 
-		m_vulkanManager.cmdBeginRenderPass(cb, m_finalOutputRenderPass, m_finalOutputFramebuffers[imgIdx], clearValues);
+uint32_t DeferredRenderer::getIndirectDrawListCount() const
+{
+#ifdef USE_HIZ_OCCLUSION_CULLING
+	return 2 + CSM_MAX_SEG_COUNT;
+#else
+	return 1 + CSM_MAX_SEG_COUNT;
+#endif
+}
 
-		m_vulkanManager.cmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_finalOutputPipeline);
-		m_vulkanManager.cmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			m_finalOutputPipelineLayout, { m_perFrameDescriptorSets[imgIdx].m_finalOutputDescriptorSet });
+VkShaderStageFlags DeferredRenderer::getVertexStages() const
+{
+#ifdef USE_MESHLETS
+	if (m_vulkanManager.isMeshShaderEnabled()) return VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT;
+#endif
+	return VK_SHADER_STAGE_VERTEX_BIT;
+}
 
-		m_vulkanManager.cmdDraw(cb, 3);
+bool DeferredRenderer::isShadowSubpassUpdated(uint32_t subpassIdx) const
+{
+#ifdef USE_LAYERED_SHADOW_PASS
+	return m_shadowCascadeUpdateMask != 0;
+#else
+	return (m_shadowCascadeUpdateMask & (1u << subpassIdx)) != 0;
+#endif
+}
 
-		m_vulkanManager.cmdEndRenderPass(cb);
+void DeferredRenderer::updateRayQueryInstances(uint32_t imgIdx)
+{
+	// Meshes get their structure the first frame after they finished loading, in one batch of builds that waits for the device
+	std::vector<rj::GeometryRange> newRanges;
+	std::vector<uint32_t> newMeshes;
+	for (uint32_t j = 0; j < static_cast<uint32_t>(m_scene.meshes.size()); ++j)
+	{
+		if (m_meshBlases[j] != std::numeric_limits<uint32_t>::max() || !m_scene.meshes[j].isLoaded()) continue;
+		newRanges.push_back(m_scene.meshes[j].lods[0]);
+		newMeshes.push_back(j);
+	}
+	if (!newMeshes.empty())
+	{
+		const std::vector<uint32_t> blases = m_vulkanManager.createBottomLevelAccelerationStructures(newRanges);
+		for (size_t i = 0; i < newMeshes.size(); ++i) m_meshBlases[newMeshes[i]] = blases[i];
+		++m_rayQueryInstancesVersion;
+	}
+
+	if (m_perFrameTlasSyncedVersions[imgIdx] == m_rayQueryInstancesVersion)
+	{
+		m_perFrameTlasBuilds[imgIdx] = TLAS_BUILD_NONE;
+		return;
+	}
 
-		m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameQueryPools[imgIdx], TQI_FINAL_OUTPUT_END);
+	auto *pInstances = reinterpret_cast<VkAccelerationStructureInstanceKHR *>(m_perFrameTlasInstanceMappedData[imgIdx]);
+	uint32_t instanceCount = 0;
+	for (uint32_t j = 0; j < static_cast<uint32_t>(m_scene.meshes.size()); ++j)
+	{
+		if (m_meshBlases[j] == std::numeric_limits<uint32_t>::max()) continue;
 
-		m_vulkanManager.endCommandBuffer(cb);
+		const VkDeviceAddress blasAddress = m_vulkanManager.getAccelerationStructureAddress(m_meshBlases[j]);
+		for (const auto &transform : m_scene.meshes[j].instanceTransforms)
+		{
+			VkAccelerationStructureInstanceKHR &instance = pInstances[instanceCount++];
+			instance = {};
+			// The first three rows of M, which glm stores as columns
+			const glm::mat4 rows = glm::transpose(transform.M);
+			memcpy(&instance.transform, &rows, sizeof(instance.transform));
+			instance.instanceCustomIndex = j;
+			instance.mask = 0xFF;
+			instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+			instance.accelerationStructureReference = blasAddress;
+		}
 	}
+
+	// Refits keep the tree of the last full build, which traces slower the further the instances moved since
+	const bool refit = instanceCount == m_perFrameTlasInstanceCounts[imgIdx] &&
+		m_perFrameTlasRefitCounts[imgIdx] < RAY_QUERY_TLAS_REFITS_PER_REBUILD;
+	m_perFrameTlasBuilds[imgIdx] = refit ? TLAS_BUILD_REFIT : TLAS_BUILD_FULL;
+	m_perFrameTlasRefitCounts[imgIdx] = refit ? m_perFrameTlasRefitCounts[imgIdx] + 1 : 0;
+	m_perFrameTlasInstanceCounts[imgIdx] = instanceCount;
+	m_perFrameTlasSyncedVersions[imgIdx] = m_rayQueryInstancesVersion;
 }
 
-void DeferredRenderer::prefilterEnvironmentAndComputeBrdfLut()
+uint32_t DeferredRenderer::updateVirtualShadowPages(rj::ArrayView<glm::mat4> cascadeVPs, uint32_t changedMask, rj::ArrayView<BBox> movedCasterBoxes)
 {
-	// References:
-	//   [1] http://blog.selfshadow.com/publications/s2013-shading-course/karis/s2013_pbs_epic_notes_v2.pdf
-	//   [2] https://github.com/derkreature/IBLBaker
-
-	// Set up cube map camera
-	m_uCubeViews->V[0] = glm::lookAt(glm::vec3(0.f), glm::vec3(1.f, 0.f, 0.f), glm::vec3(0.f, -1.f, 0.f));	// +X
-	m_uCubeViews->V[1] = glm::lookAt(glm::vec3(0.f), glm::vec3(-1.f, 0.f, 0.f), glm::vec3(0.f, -1.f, 0.f));	// -X
-	m_uCubeViews->V[2] = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f), glm::vec3(0.f, 0.f, 1.f));	// +Y
-	m_uCubeViews->V[3] = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, -1.f, 0.f), glm::vec3(0.f, 0.f, -1.f));	// -Y
-	m_uCubeViews->V[4] = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, 1.f), glm::vec3(0.f, -1.f, 0.f));	// +Z
-	m_uCubeViews->V[5] = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, -1.f, 0.f));	// -Z
-	m_uCubeViews->P = glm::perspective(glm::radians(90.f), 1.f, 0.1f, 100.f);
+	// Unbound pages only have their memory reused once the frames that may still sample them are complete
+	m_shadowPageBinds.clear();
+	m_shadowPageUnbinds.clear();
+	m_virtualShadowMap->update(++m_virtualShadowFrame, &m_shadowPageBinds, &m_shadowPageUnbinds);
+	if (!m_shadowPageBinds.empty() || !m_shadowPageUnbinds.empty())
+	{
+		m_vulkanManager.updateSparseImagePages(m_shadowImage.image, m_shadowPageBinds, m_shadowPageUnbinds);
+	}
 
-	void *mapped = m_vulkanManager.mapBuffer(m_oneTimeUniformDeviceData.buffer,
-		m_oneTimeUniformHostData.offsetOf(reinterpret_cast<const char *>(m_uCubeViews)), sizeof(CubeMapCameraUniformBuffer));
-	memcpy(mapped, m_uCubeViews, sizeof(CubeMapCameraUniformBuffer));
-	m_vulkanManager.unmapBuffer(m_oneTimeUniformDeviceData.buffer);
+	const uint32_t activeCascadeCount = m_camera.getActiveSegmentCount();
+	for (uint32_t i = 0; i < activeCascadeCount; ++i)
+	{
+		if (changedMask & (1u << i))
+		{
+			m_virtualShadowMap->invalidateLayer(i);
+			continue;
+		}
 
-	// Bake BRDF terms
-	std::vector<uint32_t> fences;
+		// The light space bounds of the box, with the matrix the cascade's pages were drawn with
+		for (const BBox &box : movedCasterBoxes)
+		{
+			glm::vec2 ndcMin(std::numeric_limits<float>::max());
+			glm::vec2 ndcMax(-std::numeric_limits<float>::max());
+			for (uint32_t c = 0; c < 8; ++c)
+			{
+				const glm::vec3 corner((c & 1) ? box.max.x : box.min.x, (c & 2) ? box.max.y : box.min.y, (c & 4) ? box.max.z : box.min.z);
+				const glm::vec2 ndc(m_shadowCascadeCachedVPs[i] * glm::vec4(corner, 1.f));
+				ndcMin = glm::min(ndcMin, ndc);
+				ndcMax = glm::max(ndcMax, ndc);
+			}
+			m_virtualShadowMap->invalidateRect(i, ndcMin.x * 0.5f + 0.5f, ndcMin.y * 0.5f + 0.5f, ndcMax.x * 0.5f + 0.5f, ndcMax.y * 0.5f + 0.5f);
+		}
+	}
 
-	if (!m_bakedBrdfReady)
+	// Draw the dirty pages of each cascade, culled to them
+	const VkExtent3D pageExtent = m_vulkanManager.getSparseImagePageExtent(m_shadowImage.image);
+	m_shadowCascadeCullVPs.resize(cascadeVPs.size());
+	uint32_t updateMask = 0;
+	bool scissorsChanged = false;
+	for (uint32_t i = 0; i < static_cast<uint32_t>(cascadeVPs.size()); ++i)
 	{
-		m_vulkanManager.beginQueueSubmit(VK_QUEUE_COMPUTE_BIT);
-		m_vulkanManager.queueSubmitNewSubmit({ m_brdfLutCommandBuffer });
-		m_vulkanManager.endQueueSubmit(m_brdfLutFence, false);
+		VkRect2D scissor = {};
+		const VirtualShadowMap::PageRect &dirty = m_virtualShadowMap->getDirtyRect(i);
+		if (i < activeCascadeCount && !dirty.empty())
+		{
+			scissor.offset = { static_cast<int32_t>(dirty.x0 * pageExtent.width), static_cast<int32_t>(dirty.y0 * pageExtent.height) };
+			scissor.extent.width = std::min(dirty.x1 * pageExtent.width, m_shadowImage.width) - scissor.offset.x;
+			scissor.extent.height = std::min(dirty.y1 * pageExtent.height, m_shadowImage.height) - scissor.offset.y;
+			updateMask |= 1u << i;
+		}
+		m_virtualShadowMap->clearDirty(i);
+
+		// Maps the NDC of the scissor onto [-1, 1]
+		const glm::vec2 imageSize(m_shadowImage.width, m_shadowImage.height);
+		const glm::vec2 ndcMin = glm::vec2(scissor.offset.x, scissor.offset.y) / imageSize * 2.f - 1.f;
+		const glm::vec2 ndcSize = glm::vec2(scissor.extent.width, scissor.extent.height) / imageSize * 2.f;
+		m_shadowCascadeCullVPs[i] = (updateMask & (1u << i)) ?
+			glm::translate(glm::mat4(1.f), glm::vec3(-(2.f * ndcMin + ndcSize) / ndcSize, 0.f)) *
+			glm::scale(glm::mat4(1.f), glm::vec3(2.f / ndcSize, 1.f)) * cascadeVPs[i] : cascadeVPs[i];
+
+		VkRect2D &recorded = m_shadowCascadeScissors[i];
+		if (scissor.offset.x != recorded.offset.x || scissor.offset.y != recorded.offset.y ||
+			scissor.extent.width != recorded.extent.width || scissor.extent.height != recorded.extent.height)
+		{
+			recorded = scissor;
+			scissorsChanged = true;
+		}
+	}
+	if (scissorsChanged)
+	{
+		++m_visibilityVersion; // scissors and clear rects are recorded
+	}
+	return updateMask;
+}
 
-		fences.push_back(m_brdfLutFence);
+bool DeferredRenderer::updateVirtualTextures(uint32_t imgIdx)
+{
+	// The frame that last rendered into this image has completed, its feedback is complete and its buffers are free
+	if (m_perFrameVirtualTileCopyCounts[imgIdx] > 0)
+	{
+		uint64_t timestamps[2];
+		if (m_vulkanManager.getQueryPoolResults(m_perFrameVirtualTextureQueryPools[imgIdx], sizeof(timestamps), sizeof(uint64_t), timestamps,
+			0, 2, VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			const float copyMS = static_cast<float>(timestamps[1] - timestamps[0]) * m_gpuProfiler.getTimestampPeriod() * 1e-6f;
+			m_backgroundBudget.addMeasurement(BackgroundWorkBudget::WORK_VIRTUAL_TILE_COPY, m_perFrameVirtualTileCopyCounts[imgIdx], copyMS);
+		}
+		m_perFrameVirtualTileCopyCounts[imgIdx] = 0;
 	}
 
-	// Prefilter radiance map
-	if (!m_scene.skybox.specMapReady)
+	uint32_t *pFeedback = m_perFrameVirtualFeedbackMappedData[imgIdx];
+	const size_t feedbackCount = m_perFrameVirtualFeedbackBuffers[imgIdx].size / sizeof(uint32_t);
+	for (size_t i = 0; i < feedbackCount; ++i)
 	{
-		m_vulkanManager.beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
-		m_vulkanManager.queueSubmitNewSubmit({ m_envPrefilterCommandBuffer });
-		m_vulkanManager.endQueueSubmit(m_envPrefilterFence, false);
+		if (pFeedback[i] != std::numeric_limits<uint32_t>::max()) m_virtualTextures->request(pFeedback[i]);
+	}
+	memset(pFeedback, 0xFF, feedbackCount * sizeof(uint32_t));
 
-		fences.push_back(m_envPrefilterFence);
+	if (m_perFrameVirtualMapSyncedVersions[imgIdx] != m_materialsVersion)
+	{
+		writeVirtualMaps(imgIdx);
+		m_perFrameVirtualMapSyncedVersions[imgIdx] = m_materialsVersion;
 	}
 
-	if (fences.size() > 0)
+	// Tiles that fit what is left of the frame's background budget
+	const uint64_t affordableTiles = m_backgroundBudget.getAffordableUnits(BackgroundWorkBudget::WORK_VIRTUAL_TILE_COPY);
+	m_virtualTileCopies.clear();
+	m_virtualTextures->update(m_perFrameVirtualStagingMappedData[imgIdx], m_perFrameVirtualStagingBuffers[imgIdx].size, &m_virtualTileCopies,
+		static_cast<uint32_t>(std::min<uint64_t>(affordableTiles, VIRTUAL_TEXTURE_UPLOADS_PER_FRAME)));
+	m_backgroundBudget.spend(BackgroundWorkBudget::WORK_VIRTUAL_TILE_COPY, m_virtualTileCopies.size());
+	++m_virtualTextureFrame;
+
+	// Other images copy the table when their frames come around
+	if (m_perFrameVirtualPageTableSyncedVersions[imgIdx] != m_virtualTextures->getPageTableVersion())
 	{
-		m_vulkanManager.waitForFences(fences);
-		m_vulkanManager.resetFences(fences);
+		memcpy(m_perFrameVirtualPageTableMappedData[imgIdx], m_virtualTextures->getPageTable(),
+			m_virtualTextures->getPageCount() * sizeof(uint32_t));
+		m_perFrameVirtualPageTableSyncedVersions[imgIdx] = m_virtualTextures->getPageTableVersion();
+	}
+
+	if (m_virtualTileCopies.empty()) return false;
+
+	// Copies into the same cache are grouped, slots are disjoint so they need no barriers between them
+	std::stable_sort(m_virtualTileCopies.begin(), m_virtualTileCopies.end(),
+		[](const rj::VVirtualTextureCache::TileCopy &a, const rj::VVirtualTextureCache::TileCopy &b) { return a.image < b.image; });
 
-		if (!m_bakedBrdfReady)
+	const uint32_t cb = m_perFrameCommandBuffers[imgIdx].m_virtualTextureCommandBuffer;
+	m_vulkanManager.beginCommandBuffer(cb, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	m_vulkanManager.cmdResetQueryPool(cb, m_perFrameVirtualTextureQueryPools[imgIdx], 0, 2);
+	m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_perFrameVirtualTextureQueryPools[imgIdx], 0);
+
+	std::vector<VkBufferImageCopy> regions;
+	for (size_t first = 0; first < m_virtualTileCopies.size();)
+	{
+		const uint32_t image = m_virtualTileCopies[first].image;
+		regions.clear();
+		size_t last = first;
+		for (; last < m_virtualTileCopies.size() && m_virtualTileCopies[last].image == image; ++last)
 		{
-			m_vulkanManager.transitionImageLayout(m_bakedBRDFs[0].image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-			m_bakedBrdfReady = true;
+			regions.push_back(m_virtualTileCopies[last].region);
 		}
 
-		if (!m_scene.skybox.specMapReady)
+		// Frames in flight sample other slots of the cache, their old tiles are only overwritten once they are retired
+		m_vulkanManager.cmdImageBarrier(cb, image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+		m_vulkanManager.cmdCopyBufferToImage(cb, m_perFrameVirtualStagingBuffers[imgIdx].buffer, image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions);
+		m_vulkanManager.cmdImageBarrier(cb, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+		first = last;
+	}
+
+	m_vulkanManager.cmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_perFrameVirtualTextureQueryPools[imgIdx], 1);
+	m_vulkanManager.endCommandBuffer(cb);
+	m_perFrameVirtualTileCopyCounts[imgIdx] = static_cast<uint32_t>(m_virtualTileCopies.size());
+
+	return true;
+}
+
+void DeferredRenderer::writeVirtualMaps(uint32_t imgIdx)
+{
+	// Per map the first page and the packed extent of its virtual texture, maps bound whole have no first page
+	uint32_t *pMaps = m_perFrameVirtualMapMappedData[imgIdx];
+	for (const auto &mesh : m_scene.meshes)
+	{
+		for (uint32_t i = 0; i < VMesh::numMapsPerMesh; ++i, pMaps += 2)
 		{
-			m_vulkanManager.transitionImageLayout(m_scene.skybox.specularIrradianceMap.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-			m_scene.skybox.specMapReady = true;
+			const uint32_t handle = mesh.virtualMaps[i];
+			const bool isVirtual = handle != rj::VVirtualTextureCache::INVALID_HANDLE;
+			pMaps[0] = isVirtual ? m_virtualTextures->getFirstPage(handle) : std::numeric_limits<uint32_t>::max();
+			pMaps[1] = isVirtual ? m_virtualTextures->getPackedExtent(handle) : 0;
 		}
 	}
 }
 
-void DeferredRenderer::savePrecomputationResults()
+std::string DeferredRenderer::getShadowSubpassScopeName(uint32_t subpassIdx) const
 {
-	// read back computation results and save to disk
-	if (m_shouldSaveBakedBrdf)
+#ifdef USE_LAYERED_SHADOW_PASS
+	return "cascades";
+#else
+	return "cascade" + std::to_string(subpassIdx);
+#endif
+}
+
+uint32_t DeferredRenderer::createAttachmentImage2D(const rj::helper_functions::ImageWrapper &image, VkImageUsageFlags usage, uint32_t graphImage)
+{
+	const uint32_t memoryOwner = graphImage == rj::VRenderGraph::INVALID_NAME ?
+		rj::VRenderGraph::INVALID_NAME : m_renderGraph.getAliasedImage(graphImage);
+	if (memoryOwner != rj::VRenderGraph::INVALID_NAME)
 	{
-		std::vector<char> hostData;
-		m_vulkanManager.readImage(hostData, m_bakedBRDFs[0].image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		assert(!image.isTransient && image.mipLevelCount == 1 && image.layerCount == 1);
+		assert(m_renderGraphImages[memoryOwner] != rj::VRenderGraph::INVALID_NAME);
 
-		rj::helper_functions::saveImage2D(BRDF_BASE_DIR BRDF_NAME,
-			BRDF_LUT_SIZE, BRDF_LUT_SIZE, sizeof(glm::vec2), 1, gli::FORMAT_RG32_SFLOAT_PACK32, hostData.data());
+		m_renderGraphImages[graphImage] = m_vulkanManager.createAliasedImage2D(m_renderGraphImages[memoryOwner],
+			image.width, image.height, image.format, usage, image.sampleCount);
+		m_vulkanManager.setImageDebugName(m_renderGraphImages[graphImage], m_renderGraph.getImageName(graphImage));
+		return m_renderGraphImages[graphImage];
 	}
 
-	if (m_scene.skybox.shouldSaveSpecMap)
+	VkMemoryPropertyFlags memProps = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+	// Transient attachments are loaded with CLEAR or DONT_CARE and stored with DONT_CARE, so on tiled GPUs they
+	// never need backing memory. VManager falls back to plain device local memory elsewhere
+	if (image.isTransient)
 	{
-		std::vector<char> hostData;
-		m_vulkanManager.readImage(hostData, m_scene.skybox.specularIrradianceMap.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		memProps |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+	}
 
-		rj::helper_functions::saveImageCube(PROBE_BASE_DIR "Specular_HDR.dds",
-			SPEC_IRRADIANCE_MAP_SIZE, SPEC_IRRADIANCE_MAP_SIZE, sizeof(glm::vec4),
-			m_scene.skybox.specularIrradianceMap.mipLevelCount, gli::FORMAT_RGBA32_SFLOAT_PACK32, hostData.data());
+	const uint32_t imageName = m_vulkanManager.createImage2D(image.width, image.height, image.format, usage, memProps,
+		image.mipLevelCount, image.layerCount, image.sampleCount);
+	if (graphImage != rj::VRenderGraph::INVALID_NAME)
+	{
+		m_renderGraphImages[graphImage] = imageName;
+		m_vulkanManager.setImageDebugName(imageName, m_renderGraph.getImageName(graphImage));
 	}
+	return imageName;
+}
 
-	m_vulkanManager.deviceWaitIdle();
+uint32_t DeferredRenderer::getGeomPipelineVariant(const VMesh &mesh) const
+{
+	const uint32_t hasAoMap = mesh.hasAoMap();
+	const uint32_t hasEmissiveMap = mesh.emissiveMap.image != std::numeric_limits<uint32_t>::max();
+	return (mesh.materialType << 2) | (hasAoMap << 1) | hasEmissiveMap;
 }
 
-VkFormat DeferredRenderer::findDepthFormat()
+uint32_t DeferredRenderer::selectLod(float coverage, uint32_t lodCount) const
 {
-	return m_vulkanManager.chooseSupportedFormatFromCandidates(
-	{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
-		VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+	uint32_t lod = 0;
+	float threshold = LOD_COVERAGE_THRESHOLD;
+	while (lod + 1 < lodCount && coverage < threshold)
+	{
+		++lod;
+		threshold *= 0.5f;
+	}
+	return lod;
 }
\ No newline at end of file
@@ -47,28 +47,749 @@
 #pragma once
 
 #include <array>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <numeric>
+#include <thread>
 #include "vbase.h"
 #include "vscene.h"
+#include "VBindCache.h"
+#include "VSeparableBlur.h"
+#include "VGpuProfiler.h"
+#include "frame_statistics.h"
+#include "dynamic_resolution.h"
+#include "background_budget.h"
+#include "trace_recorder.h"
+#include "job_pool.h"
+#include "async_file_reader.h"
+#include "asset_pack.h"
+#include "VRenderGraph.h"
+#include "shadow_atlas.h"
+#include "virtual_shadow_map.h"
+#include "world_partition.h"
+#include "scene_file.h"
+#include "frame_arena.h"
+#include "task_scheduler.h"
+#include "render_jobs.h"
+#include "render_farm.h"
+#include "synthetic_scene.h"
+#include "ab_experiment.h"
 
 
 #define BRDF_LUT_SIZE					256
 #define ONE_TIME_UNIFORM_BLOB_SIZE		1024
-#define PER_FRAME_UNIFORM_BLOB_SIZE		(64 * 1024)
+#define PER_FRAME_UNIFORM_BLOB_SIZE		(64 * 1024) // per-frame uniforms besides the per model ones, which are added to it
 #define NUM_LIGHTS						1
 #define MAX_SHADOW_LIGHT_COUNT			2
 #define SHADOW_MAP_SIZE					1024
-#define SAMPLE_COUNT					VK_SAMPLE_COUNT_4_BIT
+#define SHADOW_CULL_MODE				VK_CULL_MODE_BACK_BIT // of the shadow casters, VK_CULL_MODE_FRONT_BIT moves acne onto back faces for closed meshes
+#define SHADOW_DEPTH_BIAS_CONSTANT		1.f // depth bias of the first cascade, set per cascade as dynamic state
+#define SHADOW_DEPTH_BIAS_SLOPE			1.f
+#define SHADOW_DEPTH_BIAS_CASCADE_SCALE	1.5f // each further cascade, with its coarser texels, gets this much more of both
+#define DEFAULT_SAMPLE_COUNT			VK_SAMPLE_COUNT_4_BIT // MSAA sample count at startup, clamped to what the device supports
+#define MAX_FRAMES_IN_FLIGHT			2 // 2 or 3. Number of frames the CPU can record ahead of the GPU
+#define SCENE_RECORDING_THREAD_COUNT	1 // > 1 records geometry and shadow draws into secondary command buffers in this many tasks
+#define FRAME_TASK_THREAD_COUNT			0 // workers running the per-frame tasks next to the main thread, 0 uses one per other hardware thread
+#define FRAME_TASK_MESHES_PER_TASK		256 // meshes per task of the per-mesh loops, e.g. LOD selection
+#define ASSET_LOADING_THREAD_COUNT		0 // threads reading and decoding model files at startup, 0 uses one per hardware thread
+#define ASSET_READS_IN_FLIGHT			64 // reads of loose model and map files queued to the drive at once, 0 lets each loading job read its own
+#define SHADOW_CASCADE_UPDATE_PERIOD	1 // > 1 refreshes cascades after the first two round-robin, one every this many frames
+#define CSM_SEGMENT_DEPTH_RATIO			4.f // with USE_ADAPTIVE_CASCADES a cascade is added whenever far / near of the visible depth range grows by this factor
+#define CSM_FIT_STEPS_PER_OCTAVE		8.f // the fitted depth range snaps to this many steps per doubling of depth, so cached cascades survive small camera moves
+#define MAX_POINT_LIGHTS				1024
+#define LIGHT_TILE_SIZE					16 // in pixels
+#define MAX_LIGHTS_PER_TILE				255 // each tile stores a light count followed by this many light indices
+#define TEST_POINT_LIGHT_COUNT			256 // point lights scattered over the scene with USE_TILED_LIGHTING
+#define TAA_RENDER_SCALE				1.f // < 1 renders the scene at a lower resolution which the TAA resolve upscales
+#define TAA_JITTER_SAMPLE_COUNT			8
+#define TAA_HISTORY_WEIGHT				0.9f
+#define ACCUMULATION_FRAME_COUNT		256 // frames a still view averages with USE_PROGRESSIVE_ACCUMULATION, each with its own jitter
+#define DYNAMIC_RESOLUTION_TARGET_MS	16.6f // GPU frame time USE_DYNAMIC_RESOLUTION holds
+#define DYNAMIC_RESOLUTION_HEADROOM		0.9f // fraction of the target the scale is fitted to, absorbs frame to frame noise
+#define DYNAMIC_RESOLUTION_MIN_SCALE	0.5f
+#define DYNAMIC_RESOLUTION_STEP_COUNT	10 // scales from the minimum to full resolution, command buffers are re-recorded when it changes
+#define DYNAMIC_RESOLUTION_RAISE_FRAMES	30 // frames that would meet the target at the next step before the scale is raised
+#define BACKGROUND_GPU_TARGET_MS		DYNAMIC_RESOLUTION_TARGET_MS // GPU frame time background work keeps frames under
+#define BACKGROUND_GPU_HEADROOM			0.95f // fraction of the target a frame and its background work are fitted to
+#define BACKGROUND_GPU_MAX_MS			2.f // GPU time per frame background work gets at most, however much the frame leaves
+#define BACKGROUND_GPU_MIN_MS			0.25f // what it gets in frames that are over the target anyway, so streaming never stalls
+#define BACKGROUND_UPLOAD_MS_PER_MB		0.5f // guessed cost of streamed texture uploads until the first one is measured
+#define BACKGROUND_TILE_COPY_MS			0.02f // same for a virtual texture tile copy
+#define BACKGROUND_PREFILTER_MS_PER_MTEXEL	20.f // same for a million texels of probe prefiltering
+#define GPU_CULLING_GROUP_SIZE			64 // meshes tested per work group with USE_GPU_CULLING
+#define MESHLET_TASK_GROUP_SIZE			32 // meshlets culled per task shader work group with USE_MESHLETS
+#define MESHLET_CULLING_GROUP_SIZE		64 // invocations sharing the meshlets of a mesh in the compute culling of USE_MESHLETS
+#define SKINNING_GROUP_SIZE				64 // vertices animated per work group with USE_GPU_SKINNING
+#define SKINNING_JOINTS_PER_TASK		64 // joint matrices computed per frame task with USE_GPU_SKINNING
+#define ANIMATION_CLIP					0 // clip of the glTF file USE_GPU_SKINNING plays in a loop
+#define HIZ_GROUP_SIZE					8 // Hi-Z texels written per work group dimension
+#define LOD_COVERAGE_THRESHOLD			0.25f // meshes covering less of the screen height use LOD 1, every further LOD halves it
+#define SHADOW_LOD_BIAS					1 // shadow casters are drawn this many LODs coarser than their footprint in the cascade asks for
+#define IMPOSTOR_COVERAGE_THRESHOLD		0.02f // meshes covering less of the screen height, or of a cascade, are drawn as USE_IMPOSTORS quads
+#define IMPOSTOR_VIEWS_PER_SIDE			8 // the octahedral grid of directions each impostor is baked from
+#define IMPOSTOR_VIEW_SIZE				32 // texels per side of each baked view
+#define IMPOSTOR_MAX_MESHES				256 // layers of the impostor atlases, the meshes after them keep their coarsest LOD
+#define WORLD_LAYOUT_FILE_NAME			"../models/world_layout.txt" // USE_WORLD_PARTITION meshes, lines of "<model name> <x> <y> <z>"
+#define WORLD_CELL_SIZE					32.f // world units per side of the USE_WORLD_PARTITION cells
+#define WORLD_STREAMING_RADIUS			96.f // cells this close to the camera, or to a cascade that small, are loaded
+#define WORLD_EVICTION_RADIUS			160.f // only cells farther than this from all of them are evicted
+#define WORLD_STREAMING_BUDGET			(1024ull << 20) // estimated bytes of device memory the loaded cells may take before evictions
+#define WORLD_MAX_LOADING_CELLS			4 // cells decoded at once, nearest first
+#define TEST_INSTANCE_GRID_SIZE			3 // with USE_INSTANCING the scene is repeated on a grid of this many copies per side
+#define MAX_BINDLESS_TEXTURES			1024 // size of the material texture array with USE_BINDLESS_MATERIALS
+#define BLOOM_MIP_COUNT					6 // levels of the USE_COMPUTE_BLOOM mip chain, mip 0 is at half the swapchain resolution
+#define BLOOM_GROUP_SIZE				8 // bloom texels written per work group dimension with USE_COMPUTE_BLOOM
+#define BLUR_TILE_SIZE					64 // texels along the blurred axis per work group of USE_COMPUTE_BLUR
+#define BLUR_ROWS_PER_GROUP				4 // rows blurred by each of those work groups
+#define BLOOM_BLUR_RADIUS				4 // taps on each side of the USE_COMPUTE_BLUR bloom blur
+#define BLOOM_BLUR_SIGMA				2.f // of its Gaussian weights
+#define SH_PROJECTION_GROUP_SIZE		16 // radiance map texels reduced per work group dimension with USE_GPU_SH_PROJECTION
+#define SHADOW_MOMENT_MAP_SIZE			(SHADOW_MAP_SIZE / 2) // resolution the USE_EVSM_SHADOWS moments are generated and blurred at
+#define SHADOW_MOMENT_BLUR_RADIUS		2 // moment map texels on each side of the separable box blur
+#define SHADOW_MOMENT_GROUP_SIZE		8 // moment map texels written per work group dimension
+#define EVSM_POSITIVE_EXPONENT			40.f // warp of the depth for the positive moments, the largest that fits in 32 bit floats
+#define EVSM_NEGATIVE_EXPONENT			5.f // warp of the depth for the negative moments
+#define SHADOW_ATLAS_SIZE				2048 // texels per side of the USE_SHADOW_ATLAS depth atlas, the memory budget of all shadow views
+#define SHADOW_ATLAS_MIN_TILE_SIZE		128
+#define SHADOW_ATLAS_MAX_TILE_SIZE		2048
+#define VIRTUAL_SHADOW_MAP_SIZE			16384 // texels per side of each USE_VIRTUAL_SHADOW_MAP cascade, clamped to the device limits
+#define VIRTUAL_SHADOW_PAGE_BUDGET		2048 // resident pages of all cascades, 64 KiB each on most devices
+#define VIRTUAL_SHADOW_PAGE_KEEP_FRAMES	8 // pages requested this recently are never evicted, more than the frames in flight
+#define SHADOW_PAGE_MARK_GROUP_SIZE		16 // depth texels read per work group dimension by the page mark pass
+#define RAY_QUERY_TLAS_REFITS_PER_REBUILD	16 // USE_RAY_QUERY_SHADOWS refits a frame's instances this often before building them anew
+#define ENV_PREFILTER_GROUP_SIZE		8 // specular map texels written per work group dimension with USE_COMPUTE_ENV_PREFILTER
+#define FRAME_STATS_HISTORY_LENGTH		1024 // frames kept for the frame time percentiles and the export
+#define HITCH_THRESHOLD_MS				33.3f // frames taking longer on the CPU or the GPU are counted as hitches
+#define FRAME_STATS_FILE_NAME			"frame_stats" // .csv and .json are written on exit
+#define TRACE_FILE_NAME					"trace.json" // Chrome trace of the frames captured with T or --trace
+#define BENCHMARK_WARMUP_FRAMES			60 // rendered at the first camera keyframe before measuring, lets caches and clocks settle
+#define ON_DEMAND_REDRAW_FRAMES			16 // frames rendered after each change in on-demand mode, enough for the TAA history to converge
+#define BENCHMARK_FILE_NAME				"benchmark.json"
+#define AB_BLOCK_FRAMES					64 // frames per block of the A/B comparison, see ABExperiment
+#define AB_SETTLE_FRAMES				8 // left out at the start of each block, at least the frames whose GPU times are still in flight
+#define AB_DEFAULT_TOGGLES				"prepass" // what B changes when the comparison is started with B, see m_abToggles
+#define AB_RESULTS_FILE_NAME			"ab_results.csv" // written when the comparison stops
+#define SYNTHETIC_SWEEP_FILE_NAME		"synthetic_sweep.csv" // one row per scene of a --synthetic sweep
+#define SYNTHETIC_TEXTURE_SIZE			512 // texels per side of the generated maps of USE_SYNTHETIC_SCENE
+#define SYNTHETIC_INSTANCE_SPACING		3.f // between neighbouring instances of USE_SYNTHETIC_SCENE, whose meshes are about 2.3 across
+#define BATCH_SETTLE_FRAMES				16 // rendered before the first kept frame of a batch job, for temporal effects to converge
+#define BATCH_WRITER_THREAD_COUNT		2 // threads encoding and writing batch outputs while the next frames render
+#define RENDER_FARM_SHARD_FRAMES		64 // frames per shard a render farm worker claims, a turntable with more is one shard
+#define RENDER_FARM_POLL_MS				1000 // between looks at the render farm directory of idle workers and the coordinator
+#define RENDER_FARM_WORKER_TIMEOUT_S	600 // a worker's shards are requeued without its heartbeat for this long
+#define RENDER_FARM_HEARTBEAT_MS		10000 // between heartbeats of a worker, also while it renders a shard. Well below the timeout
+#define COMMAND_CAPTURE_SETTLE_FRAMES	16 // rendered once the scene has loaded before a frame is captured or replayed
+#define COMMAND_REPLAY_FRAMES			100 // times a command capture is replayed without --benchmark
+#define PRESENT_WAIT_TIMEOUT_NS			100000000ull // low latency mode stops waiting for the display after this, e.g. while the window is hidden
+#define FRAME_CAPTURE_BUFFER_COUNT		(MAX_FRAMES_IN_FLIGHT + 1) // readback buffers of m_frameCaptureCallback, one more than can be in flight
+#define EXTERNAL_FRAME_IMAGE_COUNT		4 // images of m_externalFrameCallback's sink, an encoder holding all of them drops frames
+#define STARTUP_PROFILE_FILE_NAME		"startup_profile.json" // phase times of the last startup
+#define ASSET_PACK_FILE_NAME			"../assets.pack" // mounted at startup if it exists, see AssetPack
+#define SCENE_FILE_NAME					"../scene.bin" // SceneFile snapshot of the .obj scene, written on the first startup. Delete it after editing assets in place
+#define PRECOMPUTE_CACHE_DIR			"../precompute_cache/" // baked BRDF LUTs, specular maps and SH coefficients, named by a hash of their inputs
+#define PRECOMPUTE_CACHE_VERSION		1 // part of every precompute cache key, bump when the BRDF LUT, prefilter or SH projection shaders change
+#define TEXTURE_STREAMING_MIN_RESIDENT_SIZE	64 // with USE_TEXTURE_STREAMING, mip levels this large or smaller are always resident
+#define TEXTURE_STREAMING_POOL_SIZE		(256ull << 20) // bytes of device memory the streamed mip levels may take
+#define TEXTURE_STREAMING_UPLOAD_BUDGET	(8ull << 20) // bytes of promoted mip levels uploaded per frame
+#define MEMORY_DEFRAGMENTATION_MAX_USAGE	0.5f // USE_MEMORY_DEFRAGMENTATION empties texture memory blocks used below this fraction
+#define VIRTUAL_TEXTURE_TILE_SIZE		128 // texels per side of the tiles of USE_VIRTUAL_TEXTURING, a power of two
+#define VIRTUAL_TEXTURE_TILE_BORDER		4 // texels of the neighbouring tiles copied around each tile for filtering, a block of compressed formats
+#define VIRTUAL_TEXTURE_CACHE_SIZE		4096 // texels per side of the cache image of each format, 900 tiles
+#define VIRTUAL_TEXTURE_MAX_PAGES		(1u << 20) // page table entries, one per tile of every level of every virtual texture
+#define VIRTUAL_TEXTURE_UPLOADS_PER_FRAME	16 // tiles copied into the caches per frame, evictions count as well
+#define VIRTUAL_TEXTURE_FEEDBACK_STRIDE	8 // each block of this many pixels per side reports one page per frame
+#define VIRTUAL_TEXTURE_MAX_BLOCK_SIZE	16 // bytes per texel of the largest virtual format, sizes the staging buffers
 
-#define BRDF_BASE_DIR					"../textures/BRDF_LUTs/"
-#define BRDF_NAME						"FSchlick_DGGX_GSmith.dds"
+#define BRDF_NAME						"FSchlick_DGGX_GSmith" // BRDF baked into the LUT, names its precompute cache file
 
 #define PROBE_BASE_DIR					"../textures/Environment/PaperMill/"
  //#define PROBE_BASE_DIR					"../textures/Environment/Factory/"
  //#define PROBE_BASE_DIR					"../textures/Environment/MonValley/"
  //#define PROBE_BASE_DIR					"../textures/Environment/Canyon/"
+// Environments E cycles through with USE_PROBE_SWITCHING, from PROBE_BASE_DIR on
+#define PROBE_BASE_DIRS					{ "../textures/Environment/PaperMill/", "../textures/Environment/Factory/", \
+										  "../textures/Environment/MonValley/", "../textures/Environment/Canyon/" }
+#define MAX_RESIDENT_PROBES				3 // probes kept with their specular maps and SH, the least recently shown one is evicted
+#define PROBE_VOLUME_GRID_SIZE			8 // probes per axis of the USE_PROBE_VOLUME grid over the scene bounds
+#define PROBE_CAPTURE_SIZE				16 // face size of the cube maps the USE_PROBE_VOLUME probes capture the scene into
+#define PROBE_CAPTURE_BATCH_SIZE		32 // probes captured before one dispatch projects all of them onto SH
+#define COLOR_LUT_SIZE					32 // texels per axis of the USE_COLOR_LUT 3D LUT
+#define COLOR_LUT_MIN_EV				-12.f // log2 of the darkest scene color the USE_COLOR_LUT covers, darker colors clamp to it
+#define COLOR_LUT_MAX_EV				6.f // log2 of the brightest one
+#define COLOR_LUT_GROUP_SIZE			4 // LUT texels baked per work group dimension
+#define AUTO_EXPOSURE_HISTOGRAM_BINS	256 // log2 luminance bins of the USE_AUTO_EXPOSURE histogram, one invocation each when adapting
+#define AUTO_EXPOSURE_MIN_EV			-12.f // log2 luminance of the first bin, darker pixels fall into it
+#define AUTO_EXPOSURE_MAX_EV			8.f // log2 luminance of the end of the last bin, brighter pixels fall into the last one
+#define AUTO_EXPOSURE_DOWNSAMPLE		4 // the histogram reads one pixel of each square of this many pixels per axis
+#define AUTO_EXPOSURE_GROUP_SIZE		16 // histogram samples per work group dimension
+#define AUTO_EXPOSURE_LOW_PERCENTILE	0.5f // fraction of the darkest samples left out of the average luminance
+#define AUTO_EXPOSURE_HIGH_PERCENTILE	0.95f // samples above this fraction are left out as well
+#define AUTO_EXPOSURE_SPEED				1.5f // rate per second at which the exposure approaches its target
+#define SSAO_SAMPLE_COUNT				8 // hemisphere samples per half resolution pixel of USE_SSAO
+#define SSAO_RADIUS						0.5f // view space radius of the sampled hemisphere
+#define SSAO_INTENSITY					1.5f // exponent applied to the unoccluded fraction
+#define SSAO_BLUR_RADIUS				4 // taps on each side of the separable bilateral blur
+#define SSAO_BLUR_SHARPNESS				32.f // falloff of the blur weights with the relative view depth difference
+#define SSAO_BLUR_SIGMA					2.f // of the spatial blur weights with USE_COMPUTE_BLUR
+#define SSAO_GROUP_SIZE					8 // half resolution pixels per work group dimension
+#define VRS_TEXEL_SIZE					16 // pixels per shading rate texel and axis of USE_VARIABLE_RATE_SHADING, clamped to the device's range
+#define VRS_GROUP_SIZE					8 // shading rate texels per work group dimension
+#define VISIBILITY_TRIANGLE_BITS		22 // triangle index bits of the USE_VISIBILITY_BUFFER IDs, the mesh index gets the others
+#define MATERIAL_PASS_GROUP_SIZE		8 // pixels per work group dimension of the USE_VISIBILITY_BUFFER material pass
 
 //#define USE_GLTF
 
+// Compact G-buffer: position is reconstructed from depth, normal is octahedral encoded into RG16
+// and albedo is stored in RGBA8. Needs the *_compact variants of the geometry, lighting and final output shaders
+//#define USE_COMPACT_GBUFFER
+
+// Render all shadow cascades in a single subpass. A geometry shader replicates each triangle into
+// every cascade layer of the shadow map. Needs the shadow_layered shaders
+//#define USE_LAYERED_SHADOW_PASS
+
+// Tiled deferred lighting. A compute pass bins the point lights into screen tiles using the depth range
+// of each tile and the lighting pass only shades the lights of its tile. Needs the light_culling shader
+// and the *_tiled variants of the lighting shaders
+//#define USE_TILED_LIGHTING
+
+// Keep the lighting shader off sky pixels. A cheap fullscreen draw shades the pixels whose samples all
+// hold the HDR probe material and tags them in a stencil attachment of the lighting pass, which the
+// lighting draw then tests out. Needs the sky_mask shaders
+//#define USE_SKY_STENCIL_MASK
+
+// Draw the sky after the lighting draw instead of into the G-buffer. Sky pixels keep the cleared G-buffer and far plane depth,
+// the lighting shader skips pixels whose samples are all at the far plane and a fullscreen draw in the lighting pass samples
+// the radiance map into exactly those pixels. Needs the skybox_pass shaders and the *_deferred_sky variants of the lighting shaders
+//#define USE_DEFERRED_SKY
+
+#if defined(USE_DEFERRED_SKY) && (defined(USE_SKY_STENCIL_MASK) || defined(USE_TAA))
+#error "USE_DEFERRED_SKY cannot be combined with USE_SKY_STENCIL_MASK, which finds sky pixels by their G-buffer material, or with USE_TAA, which needs the motion vectors of the sky box draw"
+#endif
+
+// Cheaper MSAA resolve. A classification draw tags pixels whose samples differ in depth, normal or
+// material in the lighting pass stencil. Interior pixels then shade a single sample and only tagged
+// edge pixels run the per sample, per material resolve. Needs the msaa_classify shaders
+//#define USE_MSAA_EDGE_CLASSIFICATION
+
+// Temporal anti-aliasing instead of MSAA. The scene is rendered single sampled with a jittered projection
+// and writes motion vectors. A resolve pass blends each frame with the reprojected history before bloom
+// and can upscale from TAA_RENDER_SCALE. Needs the taa_pass shaders and the *_taa variants of the geometry shaders
+//#define USE_TAA
+
+// Progressive supersampling on top of USE_TAA. While the camera and the scene stay still, each frame takes the next of
+// ACCUMULATION_FRAME_COUNT Halton jitters and the resolve averages it into a full precision history without reprojecting
+// or clamping it, so a still view converges to a supersampled image. Needs the taa_resolve_accumulate shader
+//#define USE_PROGRESSIVE_ACCUMULATION
+
+#if defined(USE_PROGRESSIVE_ACCUMULATION) && !defined(USE_TAA)
+#error "USE_PROGRESSIVE_ACCUMULATION requires USE_TAA"
+#endif
+
+// Frustum cull on the GPU. A compute pass tests every mesh against the camera and cascade frustums and
+// writes the indirect draws of the geometry and shadow passes, so command buffers no longer change with
+// visibility. Needs the gpu_culling and *_indirect shadow shaders
+//#define USE_GPU_CULLING
+
+// Occlusion culling on top of USE_GPU_CULLING. Meshes visible last frame are drawn first, their depth is
+// reduced into a Hi-Z pyramid, then the remaining meshes are tested against it and drawn in a second geometry
+// pass. Needs the hiz_pass shaders and the occlusion variant of gpu_culling
+//#define USE_HIZ_OCCLUSION_CULLING
+
+#if defined(USE_HIZ_OCCLUSION_CULLING) && !defined(USE_GPU_CULLING)
+#error "USE_HIZ_OCCLUSION_CULLING requires USE_GPU_CULLING"
+#endif
+
+// Dynamic resolution. The geometry, lighting and bloom passes keep their attachments at the full render extent but
+// draw into the top left part of them, scaled by a factor the GPU frame time picks to hold DYNAMIC_RESOLUTION_TARGET_MS.
+// The final output pass upscales that part to the swapchain. Passes that sample the scaled images get the factor
+// as their last push constant, which the lighting, bloom and final output shaders have to declare
+//#define USE_DYNAMIC_RESOLUTION
+
+#if defined(USE_DYNAMIC_RESOLUTION) && (defined(USE_TAA) || defined(USE_TILED_LIGHTING) || defined(USE_HIZ_OCCLUSION_CULLING))
+#error "USE_DYNAMIC_RESOLUTION cannot be combined with USE_TAA, which upscales with a history at a fixed scale, or with the screen tiles of USE_TILED_LIGHTING and the depth pyramid of USE_HIZ_OCCLUSION_CULLING, which cover the whole extent"
+#endif
+
+// Draw all instances of a mesh with a single instanced draw in the geometry and shadow passes. Instance
+// transforms come from a storage buffer indexed by the instance index. Culling and LOD selection work on
+// the bounds of all instances of a mesh. Needs the *_instanced variants of the geometry and shadow shaders
+//#define USE_INSTANCING
+
+#if defined(USE_INSTANCING) && defined(USE_GPU_CULLING)
+#error "USE_INSTANCING does not support USE_GPU_CULLING yet, its indirect draws use the instance index as the mesh index"
+#endif
+#if MESH_KEEP_NODE_INSTANCES && !defined(USE_INSTANCING)
+#error "MESH_KEEP_NODE_INSTANCES requires USE_INSTANCING, other draws only place the first instance of a mesh"
+#endif
+
+// Bind the textures of all materials at once through VK_EXT_descriptor_indexing. The geometry pass uses a
+// single descriptor set per frame and each draw picks its textures with a push constant. Transforms come from
+// the instance buffer of USE_INSTANCING. Needs the *_bindless variant of the geometry fragment shader
+//#define USE_BINDLESS_MATERIALS
+
+#if defined(USE_BINDLESS_MATERIALS) && !defined(USE_INSTANCING)
+#error "USE_BINDLESS_MATERIALS requires USE_INSTANCING"
+#endif
+
+// Bake the material switches of the geometry pass, and the cascade count and PCF kernel size of the lighting pass,
+// into specialization constants instead of branching on push constants. Meshes are sorted so every geometry
+// pipeline variant is bound once per pass. Needs the *_specialized variants of the geometry and lighting fragment shaders
+//#define USE_PIPELINE_PERMUTATIONS
+
+// Geometry and lighting are two subpasses of one render pass. The lighting subpass reads the G-buffers and depth
+// as input attachments, so the G-buffers are transient and never stored. The shadow pass moves in front of the
+// geometry pass and the debug display modes show the lighting result instead of the G-buffers. Needs the *_merged
+// variants of the lighting, sky_mask and msaa_classify shaders
+//#define USE_MERGED_GEOMETRY_LIGHTING
+
+#if defined(USE_MERGED_GEOMETRY_LIGHTING) && (defined(USE_TILED_LIGHTING) || defined(USE_HIZ_OCCLUSION_CULLING))
+#error "USE_MERGED_GEOMETRY_LIGHTING cannot run the compute passes of USE_TILED_LIGHTING or USE_HIZ_OCCLUSION_CULLING between geometry and lighting"
+#endif
+
+// Bloom in compute. The bright parts of the scene color are downsampled into a mip chain, which is then upsampled back
+// to mip 0 with a tent filter, each level added onto the next larger one. Every doubling of the blur radius costs one
+// quarter sized dispatch instead of another blur pass. Needs the bloom_compute shaders
+//#define USE_COMPUTE_BLOOM
+
+// Merge bloom in the final output pass. The final output shader samples the bloom texture next to the scene color and
+// adds it before tonemapping, which saves the merge pass with its full resolution read and write of the scene color.
+// Needs the *_bloom variants of the final output shaders
+//#define USE_FUSED_BLOOM_MERGE
+
+#if !defined(USE_COMPUTE_BLOOM) || !defined(USE_FUSED_BLOOM_MERGE)
+#define USE_BLOOM_RENDER_PASSES
+#endif
+
+// Run the separable blurs with rj::VSeparableBlur: the bloom blur instead of the two gaussian_blur fragment passes, and the
+// SSAO and USE_EVSM_SHADOWS blurs instead of their own shaders. A work group reads its tile and the apron around it into
+// shared memory once for all taps, with subgroup shuffles where the device has them. The post effect images become storage
+// images, and without USE_COMPUTE_BLOOM the bloom blur is two dispatches between the brightness and merge passes. Needs the
+// blur_compute shaders
+//#define USE_COMPUTE_BLUR
+
+// Adapt the exposure to the scene on the GPU. A compute pass builds a log2 luminance histogram of the scene color at
+// 1 / AUTO_EXPOSURE_DOWNSAMPLE resolution in shared memory, a single work group averages it between the percentiles and moves
+// the exposure in a storage buffer towards it. The bloom threshold and the final output read the exposure from there, nothing
+// is read back. Needs the auto_exposure_pass shaders and the *_auto_exposure variants of the bloom and final output shaders
+//#define USE_AUTO_EXPOSURE
+
+#if defined(USE_AUTO_EXPOSURE) && defined(USE_ASYNC_COMPUTE)
+#error "USE_AUTO_EXPOSURE cannot be combined with USE_ASYNC_COMPUTE, the compute queue would need the exposure buffer handed over every frame"
+#endif
+
+// Bake exposure, m_colorGrading and tonemapping into a COLOR_LUT_SIZE^3 LUT, with a compute dispatch in the frame after
+// m_colorGrading changes. The final output shader maps the log2 of the scene color between COLOR_LUT_MIN_EV and COLOR_LUT_MAX_EV
+// into it and fetches once. The debug display modes move to a pipeline of their own, so the one that normally runs has no
+// display mode branch. Needs the color_lut_pass shader and the *_lut variants of the final output shaders
+//#define USE_COLOR_LUT
+
+// Submit the compute bloom to the compute queue, of a dedicated compute family when the device has one, so it can
+// overlap the shadow and geometry passes of the next frame. The scene color and the bloom mip chain are handed
+// between the queue families around it
+//#define USE_ASYNC_COMPUTE
+
+#if defined(USE_ASYNC_COMPUTE) && defined(USE_BLOOM_RENDER_PASSES)
+#error "USE_ASYNC_COMPUTE requires USE_COMPUTE_BLOOM and USE_FUSED_BLOOM_MERGE, which leave no graphics work between bloom and the final output pass"
+#endif
+
+// Order the submits of a frame with one timeline semaphore instead of a binary semaphore per hop, and wait on it
+// from the CPU instead of the frame fences. Needs VK_KHR_timeline_semaphore. Acquire and present stay binary
+//#define USE_TIMELINE_SEMAPHORES
+
+// Project the radiance map onto the diffuse SH coefficients with compute instead of on the CPU. Each work group reduces
+// a tile of a cube face into partial sums and a second dispatch adds those up into a storage buffer that the lighting pass
+// reads, so the coefficients never go through the host. Needs the sh_projection_pass shaders and the *_gpu_sh variants of
+// the lighting shaders
+//#define USE_GPU_SH_PROJECTION
+
+// Prefilter the specular map with compute instead of the layered render passes. Each mip level is one dispatch over all six
+// faces, writing the texels through a storage image view, with the same importance sampling that reads from the filtered mips
+// of the radiance map. Saves the geometry shader and a render pass per mip. Needs the spec_env_prefilter compute shader
+//#define USE_COMPUTE_ENV_PREFILTER
+
+// Start rendering while the BRDF LUT and the specular map are still being computed. Until their fences signal, the lighting
+// pass samples the mips of the unfiltered radiance map by roughness and a constant LUT, and its descriptor sets are rewritten
+// per swapchain image once they are done. The diffuse SH are always waited for
+//#define USE_ASYNC_IBL_PRECOMPUTE
+
+// Switch the environment with E. Up to MAX_RESIDENT_PROBES probes stay resident with their specular maps and SH. A new one is
+// decoded and projected onto SH on a worker thread, prefiltered a few faces at a time within the GPU time the frames leave for
+// background work, and shown once it is done. Needs the spec_env_prefilter_faces compute shader, which offsets the face by a push constant
+//#define USE_PROBE_SWITCHING
+
+// Keep the baked specular maps as B10G11R11_UFLOAT and the BRDF LUT as R16G16_UNORM in the precompute cache, a quarter of the
+// RGBA32F and RG32F they are computed in, and sample them like that once loaded. They are encoded on the CPU when saved, so the
+// run that bakes them still samples the full precision maps. Needs no shader changes
+//#define USE_COMPACT_IBL_MAPS
+
+// Light the diffuse part with a grid of baked SH probes over the scene bounds instead of the single set of the environment. At
+// startup each probe renders the scene into a small cube map, its surfaces lit by the environment SH, with the sky showing through
+// where nothing is hit. Every PROBE_CAPTURE_BATCH_SIZE captures are projected onto L1 SH by one compute dispatch. The coefficients
+// are kept as half floats in three 3D textures, one per color channel, which the lighting pass samples trilinearly. Needs the
+// probe_volume shaders and the *_probe_volume variants of the lighting shaders
+//#define USE_PROBE_VOLUME
+
+#if defined(USE_PROBE_VOLUME) && (defined(USE_INSTANCING) || defined(USE_BINDLESS_MATERIALS) || defined(USE_STREAMING_ASSETS) || defined(USE_PROBE_SWITCHING))
+#error "USE_PROBE_VOLUME is baked once at startup from the meshes loaded by then, drawn with their own geometry sets, and the first environment, so it cannot be combined with USE_INSTANCING, USE_BINDLESS_MATERIALS, USE_STREAMING_ASSETS or USE_PROBE_SWITCHING"
+#endif
+
+#if defined(USE_PROBE_SWITCHING) && (!defined(USE_COMPUTE_ENV_PREFILTER) || !defined(USE_ASYNC_IBL_PRECOMPUTE) || defined(USE_GPU_SH_PROJECTION))
+#error "USE_PROBE_SWITCHING prefilters by compute and rewrites the lighting sets like USE_ASYNC_IBL_PRECOMPUTE, so it needs both, and projects SH on the CPU, so it cannot be combined with USE_GPU_SH_PROJECTION"
+#endif
+
+// Render before the models are loaded. Their files keep decoding on worker threads while frames are drawn, and each model
+// is uploaded and drawn once its files are in. Until then it is culled and its material sets point at 1x1 placeholder maps
+//#define USE_STREAMING_ASSETS
+
+#if defined(USE_STREAMING_ASSETS) && (defined(USE_GLTF) || defined(USE_GPU_CULLING) || defined(USE_INSTANCING) || defined(USE_TILED_LIGHTING))
+#error "USE_STREAMING_ASSETS loads .obj models only and cannot be combined with USE_GPU_CULLING, USE_INSTANCING or USE_TILED_LIGHTING, which set up per mesh data from the loaded bounds at startup"
+#endif
+
+// Place the models of WORLD_LAYOUT_FILE_NAME, or MODEL_NAMES at the origin without one, into WORLD_CELL_SIZE cells by their
+// positions, and stream whole cells instead of loading every model. Cells within WORLD_STREAMING_RADIUS of the camera, or of a
+// cascade no larger than that, are decoded on the asset job pool and uploaded like USE_STREAMING_ASSETS models. Once the
+// loaded meshes exceed WORLD_STREAMING_BUDGET, the cells beyond WORLD_EVICTION_RADIUS are evicted, farthest first: their
+// meshes get the placeholder maps back and leave the BVH, and their maps and geometry pool ranges are freed once no frame in
+// flight draws them, so the pool reuses them for the next cells
+//#define USE_WORLD_PARTITION
+
+#if defined(USE_WORLD_PARTITION) && (!defined(USE_STREAMING_ASSETS) || defined(USE_TEXTURE_STREAMING) || defined(USE_VIRTUAL_TEXTURING) || defined(USE_BINDLESS_MATERIALS) || defined(USE_RAY_QUERY_SHADOWS))
+#error "USE_WORLD_PARTITION requires USE_STREAMING_ASSETS and frees the maps and geometry of evicted meshes, so it cannot be combined with USE_TEXTURE_STREAMING, USE_VIRTUAL_TEXTURING, USE_BINDLESS_MATERIALS or USE_RAY_QUERY_SHADOWS, which keep their own references to them"
+#endif
+#if defined(USE_WORLD_PARTITION) && (MESH_KEEP_NODE_INSTANCES || MESH_MIXED_VERTEX_FORMATS)
+#error "USE_WORLD_PARTITION uploads a mesh again whenever its cell is loaded and frees vertices in a pool of one stride, so it cannot be combined with MESH_KEEP_NODE_INSTANCES or MESH_MIXED_VERTEX_FORMATS"
+#endif
+
+// Switch between the scenes of HOT_SWAP_SCENES at runtime, N for the next one, without restarting. The meshes are slots for
+// the largest scene, so the uniforms, material sets and command buffers are made once. A switch unloads every mesh like an
+// evicted USE_WORLD_PARTITION cell and streams the models of the new scene in like USE_STREAMING_ASSETS. The device,
+// pipelines, shaders and the environment with its precomputed maps stay as they are
+//#define USE_SCENE_HOT_SWAP
+
+#if defined(USE_SCENE_HOT_SWAP) && (!defined(USE_STREAMING_ASSETS) || defined(USE_WORLD_PARTITION) || defined(USE_PIPELINE_PERMUTATIONS))
+#error "USE_SCENE_HOT_SWAP requires USE_STREAMING_ASSETS, and cannot be combined with USE_WORLD_PARTITION, which places the meshes of its own layout, or USE_PIPELINE_PERMUTATIONS, which only creates the geometry pipelines of the startup scene"
+#endif
+#if defined(USE_SCENE_HOT_SWAP) && (defined(USE_TEXTURE_STREAMING) || defined(USE_VIRTUAL_TEXTURING) || defined(USE_BINDLESS_MATERIALS) || defined(USE_RAY_QUERY_SHADOWS) || MESH_KEEP_NODE_INSTANCES || MESH_MIXED_VERTEX_FORMATS)
+#error "USE_SCENE_HOT_SWAP frees the maps and geometry of the old scene like USE_WORLD_PARTITION, so it cannot be combined with the options that cannot"
+#endif
+
+// Replace the models with a generated scene of m_syntheticScene's size, set with --synthetic, to measure how frame times
+// and memory scale with instances, meshes, triangles, lights and textures. Instances are placed on a grid and drawn by
+// USE_INSTANCING, the lights are the point lights of USE_TILED_LIGHTING
+//#define USE_SYNTHETIC_SCENE
+
+#if defined(USE_SYNTHETIC_SCENE) && (!defined(USE_INSTANCING) || defined(USE_GLTF) || defined(USE_STREAMING_ASSETS) || defined(USE_TEXTURE_STREAMING))
+#error "USE_SYNTHETIC_SCENE requires USE_INSTANCING and replaces the model files USE_GLTF, USE_STREAMING_ASSETS and USE_TEXTURE_STREAMING load"
+#endif
+
+// Stream the mip levels of the model maps. Each map starts with its levels up to TEXTURE_STREAMING_MIN_RESIDENT_SIZE
+// resident and is raised to the level the projected size of its visible meshes asks for, within TEXTURE_STREAMING_POOL_SIZE
+// and the memory budget of the device. The decoded maps stay in host memory
+//#define USE_TEXTURE_STREAMING
+
+#if defined(USE_TEXTURE_STREAMING) && (defined(USE_GLTF) || defined(USE_GPU_CULLING) || defined(USE_BINDLESS_MATERIALS))
+#error "USE_TEXTURE_STREAMING streams the maps of .obj models, needs the projected mesh sizes of CPU culling and rewrites per mesh material sets, so it cannot be combined with USE_GPU_CULLING or USE_BINDLESS_MATERIALS"
+#endif
+
+// Give the texture memory streaming churns through back in whole blocks. The allocator picks a block used below
+// MEMORY_DEFRAGMENTATION_MAX_USAGE that only holds textures, and the streamed maps in it get new images elsewhere, uploaded
+// within what is left of the frame's background budget after the promotions. The material sets pick them up like promoted
+// maps, and the block is released once the last old image is out of the frames in flight
+//#define USE_MEMORY_DEFRAGMENTATION
+
+#if defined(USE_MEMORY_DEFRAGMENTATION) && !defined(USE_TEXTURE_STREAMING)
+#error "USE_MEMORY_DEFRAGMENTATION moves the maps of USE_TEXTURE_STREAMING, which keeps the host copies to upload them from"
+#endif
+
+// Filter the shadows with exponential variance shadow maps instead of the PCF loop. After the shadow pass, a compute pass turns
+// the depth of each updated cascade into the 4 EVSM moments at SHADOW_MOMENT_MAP_SIZE, blurs them separably and builds their mip
+// chain, so the lighting pass takes one trilinear lookup per cascade whatever the softness. Needs the shadow_moments shaders and
+// the *_evsm variants of the lighting shaders
+//#define USE_EVSM_SHADOWS
+
+// Fit the cascade splits every frame to the view depth range of the meshes in the camera frustum instead of [zNear, zFar], and use
+// between 1 and CSM_MAX_SEG_COUNT cascades depending on how deep that range is. Resources are allocated for CSM_MAX_SEG_COUNT
+// cascades, the inactive ones are neither rendered nor sampled
+//#define USE_ADAPTIVE_CASCADES
+
+// Render the cascades into tiles of one SHADOW_ATLAS_SIZE depth atlas instead of layers of SHADOW_MAP_SIZE. Each cascade's tile is
+// sized by the shadow map texels per screen pixel at the middle of its depth range, and the atlas is repacked only when a tile
+// size changes, which re-renders all cascades. Lighting finds the tiles through the cascade matrices. Needs the *_atlas variants
+// of the lighting shaders
+//#define USE_SHADOW_ATLAS
+
+#if defined(USE_SHADOW_ATLAS) && (defined(USE_LAYERED_SHADOW_PASS) || defined(USE_EVSM_SHADOWS))
+#error "USE_SHADOW_ATLAS draws each cascade into its own viewport of one layer, so it cannot be combined with USE_LAYERED_SHADOW_PASS or the per layer moments of USE_EVSM_SHADOWS"
+#endif
+
+// Store the cascades as D16_UNORM instead of the 32 bit scene depth format, halving the bandwidth of the shadow pass and of
+// every lookup into it, on devices that filter it for comparisons. To keep the 16 bits of depth where the receivers are,
+// the near plane of a cascade is fitted to the nearest receiver in its slice of the camera frustum instead of the nearest
+// caster. The depth clamp of the shadow pipelines flattens casters in front of it to depth 0, where they still shadow
+// everything behind them
+//#define USE_SHADOW_D16
+
+// Shade the lighting pass at half the render resolution in each dimension. An upsample pass then writes the full resolution
+// lighting result before TAA and bloom from the four nearest half resolution pixels, weighted by how well the depth and
+// normal they were shaded with match those of the full resolution pixel. Needs the lighting_upsample shaders
+//#define USE_HALF_RES_LIGHTING
+
+#if defined(USE_HALF_RES_LIGHTING) && (defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_TILED_LIGHTING))
+#error "USE_HALF_RES_LIGHTING needs a lighting pass of its own, which USE_MERGED_GEOMETRY_LIGHTING folds into the geometry pass, and cannot use the full resolution tiles of USE_TILED_LIGHTING"
+#endif
+
+// Screen space ambient occlusion, multiplied with the material AO in the lighting pass. A compute pass estimates it at half the
+// render resolution from the depth, and the normals of G-buffer 1 with USE_COMPACT_GBUFFER or the depth gradient otherwise. Two
+// bilateral blur passes weighted by view depth smooth it, and the lighting shader upsamples it from the four nearest half
+// resolution texels weighted the same way. The dispatches are recorded between the geometry and shadow passes and only the
+// lighting pass waits for them, so they can overlap the shadow rasterization. Needs the ssao_pass shaders and the *_ssao
+// variants of the lighting shaders
+//#define USE_SSAO
+
+#if defined(USE_SSAO) && (defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_MULTI_VIEW))
+#error "USE_SSAO reads the depth and G-buffers in a compute pass, which USE_MERGED_GEOMETRY_LIGHTING keeps transient, and works with the single camera that USE_MULTI_VIEW replaces"
+#endif
+
+// Split the render extent into up to MAX_VIEW_COUNT views of the same scene, side by side or in a 2x2 grid, F cycles the count.
+// View 0 follows the camera, the others look at the scene bounds from the top, front and side with orthographic projections.
+// All views share the meshes, descriptor sets and render targets, each is culled on its own and drawn into its part of the
+// G-buffers, then lit there. Shadow cascades and LODs stay fitted to view 0. Needs the *_multi_view variants of the geometry,
+// depth prepass, lighting and sky_mask shaders, which pick their view's matrices from the uniform buffers by a push constant
+//#define USE_MULTI_VIEW
+
+#if defined(USE_MULTI_VIEW) && (defined(USE_TAA) || defined(USE_GPU_CULLING) || defined(USE_TILED_LIGHTING))
+#error "USE_MULTI_VIEW cannot be combined with the single camera history of USE_TAA, or with USE_GPU_CULLING and USE_TILED_LIGHTING, which cull against the camera of view 0 only"
+#endif
+
+#define MAX_VIEW_COUNT 4
+#define VIEW_PUSH_CONSTANT_OFFSET 16 // view index, after the largest fragment push constants of the geometry and lighting passes
+
+// Cull the full resolution LOD of meshes per meshlet (see MESH_MESHLETS) on the GPU: against the camera or cascade frustum, against
+// the normal cones in the geometry pass, and against the Hi-Z pyramid in the late phase of USE_HIZ_OCCLUSION_CULLING. GPU culling
+// hands the meshes it picks LOD 0 for over to their meshlets. With VK_EXT_mesh_shader a task shader culls the meshlets of each
+// such draw and a mesh shader emits the survivors. Without it a compute pass writes one indexed indirect draw per meshlet instead.
+// Needs the meshlet_pass shaders and the meshlet variant of gpu_culling
+//#define USE_MESHLETS
+
+#if defined(USE_MESHLETS) && (!defined(USE_GPU_CULLING) || !MESH_MESHLETS || defined(USE_PIPELINE_PERMUTATIONS) || defined(USE_LAYERED_SHADOW_PASS))
+#error "USE_MESHLETS requires USE_GPU_CULLING and MESH_MESHLETS, and has no mesh shader variants for USE_PIPELINE_PERMUTATIONS or USE_LAYERED_SHADOW_PASS"
+#endif
+
+#define MESHLET_PUSH_CONSTANT_OFFSET 16 // first mesh and draw list of the task shaders, after the fragment push constants of the geometry pass
+
+// The vertex shaders of the geometry, depth pre-pass and shadow pipelines fetch their vertices from the geometry pool as storage
+// buffers by gl_VertexIndex, and find the vertex format and byte offsets of their mesh in its GpuCullingMeshInfo by the instance
+// index of the indirect draw. The pipelines have no vertex input, so meshes of both vertex formats of MESH_MIXED_VERTEX_FORMATS
+// share one multi draw. Needs the *_pull variants of those vertex shaders
+//#define USE_VERTEX_PULLING
+
+#if defined(USE_VERTEX_PULLING) && !defined(USE_GPU_CULLING)
+#error "USE_VERTEX_PULLING requires USE_GPU_CULLING, whose mesh infos hold the vertex formats"
+#endif
+
+#if MESH_MIXED_VERTEX_FORMATS && (!defined(USE_VERTEX_PULLING) || defined(USE_PROBE_VOLUME))
+#error "MESH_MIXED_VERTEX_FORMATS requires USE_VERTEX_PULLING, and cannot be combined with USE_PROBE_VOLUME, whose captures take the meshes as vertex input"
+#endif
+
+// Animate the skinned and morph target meshes of the USE_GLTF file. A compute pass writes their animated vertices into a copy of
+// their vertices in the geometry pool, one copy per swapchain image, which the depth pre-pass, the geometry pass and every shadow
+// cascade then draw like static vertices, so no pass skins in its vertex shader. The joint matrices and morph target weights of
+// ANIMATION_CLIP are sampled on the CPU as parallel frame tasks. Needs skinning.comp
+//#define USE_GPU_SKINNING
+
+#if defined(USE_GPU_SKINNING) && (!defined(USE_GLTF) || MESH_QUANTIZE_VERTICES || MESH_MIXED_VERTEX_FORMATS || defined(USE_MESHLETS))
+#error "USE_GPU_SKINNING requires USE_GLTF, writes full precision vertices so cannot be combined with MESH_QUANTIZE_VERTICES or MESH_MIXED_VERTEX_FORMATS, and keeps no meshlet bounds for the animated vertices of USE_MESHLETS"
+#endif
+
+#if MESH_TANGENTS && (defined(USE_VERTEX_PULLING) || defined(USE_MESHLETS) || defined(USE_GPU_SKINNING))
+#error "MESH_TANGENTS has no tangent variants of the vertex pulling, meshlet and skinning shaders, which read or write the vertex layout themselves"
+#endif
+
+// Record the static meshes of the geometry pass and of each shadow cascade into secondary command buffers of their own, kept until
+// the static draws of that pass change. Meshes whose transforms change after their first upload count as dynamic from then on.
+// Their secondaries are recorded with every primary and executed after the static ones, so a moving mesh that changes the
+// visible lists only costs recording the dynamic draws
+//#define USE_STATIC_SECONDARIES
+
+#if defined(USE_STATIC_SECONDARIES) && (SCENE_RECORDING_THREAD_COUNT <= 1 || defined(USE_GPU_CULLING))
+#error "USE_STATIC_SECONDARIES requires SCENE_RECORDING_THREAD_COUNT > 1, and cannot be combined with USE_GPU_CULLING, whose shadow draws are one multi draw over consecutive meshes"
+#endif
+
+// Create every Vulkan object with allocation callbacks that count the driver's host memory by allocation scope, shown under the
+// memory heaps of the overlay. Costs a few atomics per driver allocation
+//#define USE_HOST_ALLOCATION_TRACKING
+
+// Enable VK_EXT_debug_utils when the loader or a capture layer offers it. Render pass instances and GPU profiler scopes become
+// label regions, and render targets, textures, shader modules and pipelines get names in RenderDoc and Nsight captures
+//#define USE_DEBUG_LABELS
+
+// Create the device over a group of linked GPUs (VK_KHR_device_group, core in Vulkan 1.1) and render alternate frames on its
+// devices. Memory is allocated on every device and uploads run on all of them, so meshes, textures and the IBL maps are
+// replicated, while each device renders into its own instance of the render targets and keeps its own TAA history. Frames are
+// presented by the device that rendered them, or through another one with remote presentation; without either, windowed
+// frames stay on device 0. Headless and batch frames alternate regardless, batch jobs settle until every device has
+// converged. Falls back to one GPU without a group
+//#define USE_DEVICE_GROUP
+
+#if defined(USE_DEVICE_GROUP) && (defined(USE_VIRTUAL_TEXTURING) || defined(USE_VIRTUAL_SHADOW_MAP) || defined(USE_RAY_QUERY_SHADOWS))
+#error "USE_DEVICE_GROUP runs every frame on one device, so it cannot be combined with USE_VIRTUAL_TEXTURING or USE_VIRTUAL_SHADOW_MAP, whose tile copies and page binds would only reach that device, or USE_RAY_QUERY_SHADOWS, whose acceleration structures need device addresses across the group"
+#endif
+
+// Cull the camera, every cascade and every view in one pass over the SoA boxes of CullingBounds, 4 boxes per plane test with
+// SSE2, in parallel ranges of CULLING_ITEMS_PER_TASK meshes, instead of walking the scene BVH once per frustum. Scales better
+// with many small meshes, whose BVH nodes rarely cull whole subtrees
+//#define USE_SIMD_CULLING
+
+#if defined(USE_SIMD_CULLING) && 1 + CSM_MAX_SEG_COUNT + MAX_VIEW_COUNT > CULLING_MAX_FRUSTUMS
+#error "USE_SIMD_CULLING tests the camera, the cascades and the views in one pass of at most CULLING_MAX_FRUSTUMS frustums"
+#endif
+
+// Shade the geometry and lighting passes at coarser rates where it does not show, through a VK_KHR_fragment_shading_rate
+// attachment of both. A compute pass after lighting writes one rate per VRS_TEXEL_SIZE square of pixels from the luminance
+// contrast of the lit result and, with USE_TAA, the motion vectors, or from rings around the screen center, as picked by
+// m_shadingRateMode. The next frame is shaded with it. Devices without shading rate attachments shade every pixel. Needs the
+// shading_rate_pass shaders
+//#define USE_VARIABLE_RATE_SHADING
+
+#if defined(USE_VARIABLE_RATE_SHADING) && (defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_HALF_RES_LIGHTING) || defined(USE_MULTI_VIEW))
+#error "USE_VARIABLE_RATE_SHADING reads the lighting result of a lighting pass of its own at full resolution, and centers the foveation on the single camera that USE_MULTI_VIEW replaces"
+#endif
+
+// Rasterize only depth and a 32 bit ID per sample, (mesh index << VISIBILITY_TRIANGLE_BITS) | triangle index, instead of the
+// G-buffers. A compute material pass then finds each pixel's triangle through the mesh infos and the indirect draw of its LOD,
+// interpolates its pulled vertices, samples the maps of its mesh from one texture array and writes the G-buffers as storage
+// images, so each pixel is textured once however much overdraw the geometry pass has. With MSAA it shades every distinct ID of
+// a pixel once for all samples holding it, and the edge classification of the lighting pass works unchanged. Needs
+// VK_EXT_descriptor_indexing, shaderStorageImageMultisample for MSAA, and the vis_buffer_pass shaders
+//#define USE_VISIBILITY_BUFFER
+
+#if defined(USE_VISIBILITY_BUFFER) && (!defined(USE_VERTEX_PULLING) || !defined(USE_COMPACT_GBUFFER) || !defined(USE_DEFERRED_SKY))
+#error "USE_VISIBILITY_BUFFER requires USE_VERTEX_PULLING, whose mesh infos and vertex streams the material pass reads, USE_COMPACT_GBUFFER, whose G-buffers it writes, and USE_DEFERRED_SKY, as the sky box gets no ID"
+#endif
+#if defined(USE_VISIBILITY_BUFFER) && (defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_MESHLETS) || defined(USE_PIPELINE_PERMUTATIONS) || defined(USE_VARIABLE_RATE_SHADING) || defined(USE_STREAMING_ASSETS))
+#error "USE_VISIBILITY_BUFFER writes the G-buffers outside of the geometry render pass, has IDs of whole LOD draws rather than meshlets, a single geometry pipeline, no coarse shading rates for its IDs, and writes its texture array once, so it cannot be combined with USE_MERGED_GEOMETRY_LIGHTING, USE_MESHLETS, USE_PIPELINE_PERMUTATIONS, USE_VARIABLE_RATE_SHADING or USE_STREAMING_ASSETS"
+#endif
+
+// Forward+ instead of deferred shading. The depth pre-pass always runs, the tiles of USE_TILED_LIGHTING are binned from its depth,
+// and the geometry pass shades the meshes and the sky box straight into a multisampled color attachment, which the hardware
+// resolves into the lighting result at the end of the pass. There are no G-buffers or lighting pass, so MSAA costs no per sample
+// resolve shading, and translucent materials can be lit like opaque ones. Scenes are picked at build time with MODEL_NAMES,
+// so the path is picked per scene by building it with this option. Needs the forward_pass shaders
+//#define USE_FORWARD_PLUS
+
+#define FORWARD_PUSH_CONSTANT_OFFSET 16 // lighting constants of the USE_FORWARD_PLUS fragment shaders, after the material constants
+
+#if defined(USE_FORWARD_PLUS) && !defined(USE_TILED_LIGHTING)
+#error "USE_FORWARD_PLUS requires USE_TILED_LIGHTING, whose light tiles it shades with"
+#endif
+#if defined(USE_FORWARD_PLUS) && (defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_VISIBILITY_BUFFER) || defined(USE_HALF_RES_LIGHTING) || defined(USE_SSAO) || defined(USE_TAA) || defined(USE_DEFERRED_SKY) || defined(USE_SKY_STENCIL_MASK) || defined(USE_MSAA_EDGE_CLASSIFICATION))
+#error "USE_FORWARD_PLUS has no G-buffers or lighting pass, so it cannot be combined with USE_MERGED_GEOMETRY_LIGHTING, USE_VISIBILITY_BUFFER, USE_HALF_RES_LIGHTING, USE_SSAO, USE_TAA, USE_DEFERRED_SKY, USE_SKY_STENCIL_MASK or USE_MSAA_EDGE_CLASSIFICATION"
+#endif
+#if defined(USE_FORWARD_PLUS) && (defined(USE_HIZ_OCCLUSION_CULLING) || defined(USE_MESHLETS) || defined(USE_PIPELINE_PERMUTATIONS) || defined(USE_VARIABLE_RATE_SHADING) || defined(USE_MULTI_VIEW))
+#error "USE_FORWARD_PLUS bins the lights before its only geometry pass, shades with a single geometry pipeline and pushes its lighting constants where USE_MULTI_VIEW pushes the view index, so it cannot be combined with the late pass of USE_HIZ_OCCLUSION_CULLING, USE_MESHLETS, USE_PIPELINE_PERMUTATIONS, USE_VARIABLE_RATE_SHADING or USE_MULTI_VIEW"
+#endif
+
+// Shadow the sun with one ray query per lighting pixel instead of the cascaded shadow maps, on devices with VK_KHR_ray_query.
+// Each mesh gets a compacted bottom level acceleration structure over its finest LOD in the geometry pool once it is loaded,
+// and each swapchain image a top level one over all instances, which is refitted when transforms change and built anew when
+// meshes are added or every RAY_QUERY_TLAS_REFITS_PER_REBUILD refits. The shadow pass is not recorded at all. Combined with
+// USE_HALF_RES_LIGHTING the rays are traced at half resolution and the upsample pass filters them with the lighting. Other
+// devices keep the shadow maps. Needs the *_ray_query variants of the lighting shaders
+//#define USE_RAY_QUERY_SHADOWS
+
+#if defined(USE_RAY_QUERY_SHADOWS) && (MESH_QUANTIZE_VERTICES || MESH_MIXED_VERTEX_FORMATS || defined(USE_GPU_SKINNING))
+#error "USE_RAY_QUERY_SHADOWS builds its structures over the static full precision positions of the geometry pool, so it cannot be combined with MESH_QUANTIZE_VERTICES, MESH_MIXED_VERTEX_FORMATS or USE_GPU_SKINNING"
+#endif
+#if defined(USE_RAY_QUERY_SHADOWS) && (defined(USE_EVSM_SHADOWS) || defined(USE_SHADOW_ATLAS) || defined(USE_FORWARD_PLUS))
+#error "USE_RAY_QUERY_SHADOWS traces from the lighting pass, so it cannot be combined with the filtered maps of USE_EVSM_SHADOWS or USE_SHADOW_ATLAS, or with USE_FORWARD_PLUS, which has no lighting pass"
+#endif
+
+// Render each cascade into a layer of VIRTUAL_SHADOW_MAP_SIZE texels per side that only has memory where the screen samples
+// it, on devices with sparse residency. A compute pass after the geometry pass marks the pages the visible pixels project
+// to, the CPU reads the marks back once the frame is complete and binds memory to the missing pages, within
+// VIRTUAL_SHADOW_PAGE_BUDGET, evicting the ones requested longest ago. Pages keep their depth across frames: a cascade whose
+// matrix changes invalidates all of its pages, a moved caster the pages under its old and new bounds, and each cascade is
+// only rendered into the bounds of its dirty pages, drawing the casters culled to them. Other devices throw. Needs the shadow_page_mark shader and the *_virtual variants of the lighting shaders, which fall back
+// to a coarser cascade where a page is not resident
+//#define USE_VIRTUAL_SHADOW_MAP
+
+#if defined(USE_VIRTUAL_SHADOW_MAP) && (defined(USE_SHADOW_ATLAS) || defined(USE_EVSM_SHADOWS) || defined(USE_LAYERED_SHADOW_PASS) || defined(USE_RAY_QUERY_SHADOWS))
+#error "USE_VIRTUAL_SHADOW_MAP renders each cascade into the dirty pages of its own layer, so it cannot be combined with USE_SHADOW_ATLAS, the full layer moments of USE_EVSM_SHADOWS, USE_LAYERED_SHADOW_PASS or USE_RAY_QUERY_SHADOWS"
+#endif
+#if defined(USE_VIRTUAL_SHADOW_MAP) && (defined(USE_FORWARD_PLUS) || defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_MULTI_VIEW))
+#error "USE_VIRTUAL_SHADOW_MAP marks pages from the camera depth between the geometry and lighting passes, so it cannot be combined with USE_FORWARD_PLUS, USE_MERGED_GEOMETRY_LIGHTING or USE_MULTI_VIEW"
+#endif
+
+// Keep only the tiles of the model maps the screen samples in device memory, so VRAM no longer grows with the textures of the
+// scene. Each mip level is split into VIRTUAL_TEXTURE_TILE_SIZE tiles, which are copied with a filtering border into the slots of
+// one cache image per format, and a page table points every tile at the slot of its closest resident ancestor. The geometry
+// pass samples through the table and each block of VIRTUAL_TEXTURE_FEEDBACK_STRIDE pixels reports the page one of its pixels
+// wants. The CPU reads the reports back once the frame is complete, and the missing tiles are copied ahead of the next geometry
+// pass, coarsest first, evicting the ones requested longest ago. The decoded maps stay in host memory. Maps smaller than a tile
+// or not a power of two in size are bound whole. Needs fragmentStoresAndAtomics, other devices throw, and the *_virtual_texture
+// variants of the geometry shaders
+//#define USE_VIRTUAL_TEXTURING
+
+#if defined(USE_VIRTUAL_TEXTURING) && (defined(USE_GLTF) || defined(USE_SYNTHETIC_SCENE) || defined(USE_TEXTURE_STREAMING))
+#error "USE_VIRTUAL_TEXTURING virtualizes the maps of .obj models, so it cannot be combined with USE_GLTF, USE_SYNTHETIC_SCENE or the whole levels of USE_TEXTURE_STREAMING"
+#endif
+#if defined(USE_VIRTUAL_TEXTURING) && (defined(USE_BINDLESS_MATERIALS) || defined(USE_GPU_CULLING) || defined(USE_PIPELINE_PERMUTATIONS) || defined(USE_VISIBILITY_BUFFER) || defined(USE_FORWARD_PLUS))
+#error "USE_VIRTUAL_TEXTURING pushes the mesh index with the material constants of geom.frag, so it cannot be combined with USE_BINDLESS_MATERIALS, USE_GPU_CULLING, USE_PIPELINE_PERMUTATIONS, or USE_VISIBILITY_BUFFER and USE_FORWARD_PLUS, which sample the maps in other shaders"
+#endif
+
+// Draw the instances of meshes covering less than IMPOSTOR_COVERAGE_THRESHOLD of the screen height, or of a cascade, as camera
+// or light facing quads. At startup each static mesh renders its coarsest LOD from IMPOSTOR_VIEWS_PER_SIDE^2 directions on an
+// octahedron into a layer of two atlases, albedo with coverage and object space normal with depth, a one-time offscreen pass like
+// the probe captures. Every frame the instances of the meshes picked as impostors are written into a per-frame buffer and
+// drawn as one instanced draw of quads after the meshes, in the geometry pass and in each cascade. Needs the impostor shaders
+//#define USE_IMPOSTORS
+
+#if defined(USE_IMPOSTORS) && (defined(USE_STREAMING_ASSETS) || defined(USE_TEXTURE_STREAMING) || defined(USE_VIRTUAL_TEXTURING) || defined(USE_BINDLESS_MATERIALS) || MESH_QUANTIZE_VERTICES || MESH_MIXED_VERTEX_FORMATS)
+#error "USE_IMPOSTORS is baked once at startup from the full precision vertices and resident maps of the meshes, drawn with their own geometry sets, so it cannot be combined with USE_STREAMING_ASSETS, USE_TEXTURE_STREAMING, USE_VIRTUAL_TEXTURING, USE_BINDLESS_MATERIALS, MESH_QUANTIZE_VERTICES or MESH_MIXED_VERTEX_FORMATS"
+#endif
+#if defined(USE_IMPOSTORS) && (defined(USE_GPU_CULLING) || defined(USE_MULTI_VIEW) || defined(USE_VISIBILITY_BUFFER) || defined(USE_FORWARD_PLUS) || defined(USE_STATIC_SECONDARIES) || defined(USE_LAYERED_SHADOW_PASS))
+#error "USE_IMPOSTORS picks the impostors with the CPU LODs of the camera and of each cascade and draws them after the meshes of the first chunk, so it cannot be combined with USE_GPU_CULLING, USE_MULTI_VIEW, USE_VISIBILITY_BUFFER, USE_FORWARD_PLUS, USE_STATIC_SECONDARIES or USE_LAYERED_SHADOW_PASS"
+#endif
+
+// Resolve the multisampled depth into a single sampled image at the end of the geometry pass with VK_KHR_depth_stencil_resolve,
+// to the nearest sample, or sample zero where the device cannot take the minimum. SSAO and the shadow page marking read that
+// instead of every sample of the multisampled depth. Without MSAA, or on devices without the extension, they keep reading the depth
+// itself. No shader changes, the passes get a sample count of one
+//#define USE_DEPTH_RESOLVE
+
+// Also resolve to the farthest sample, in a second subpass that draws nothing, so the Hi-Z build reduces a single sampled image
+// instead of the samples of every pixel. Devices that cannot take the maximum only get the nearest sample
+//#define USE_DEPTH_RESOLVE_MIN_MAX
+
+#if defined(USE_DEPTH_RESOLVE) && (defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_FORWARD_PLUS))
+#error "USE_DEPTH_RESOLVE resolves the depth of the G-buffer geometry pass for the passes after it, so it cannot be combined with USE_MERGED_GEOMETRY_LIGHTING, which keeps depth in tile memory, or USE_FORWARD_PLUS"
+#endif
+#if defined(USE_DEPTH_RESOLVE_MIN_MAX) && !defined(USE_DEPTH_RESOLVE)
+#error "USE_DEPTH_RESOLVE_MIN_MAX requires USE_DEPTH_RESOLVE"
+#endif
+
+// Write the bloom source from the lighting pass. The lighting shaders also write the part of each pixel above the bloom
+// threshold into a second attachment, @m_bloomBrightImage, so the bloom brightness pass is left with a 2x2 downsample of that
+// 32 bit image into the half resolution post effect image instead of thresholding the full resolution HDR scene color. Needs
+// the *_bloom_brightness variants of the lighting, sky_mask and deferred sky shaders and the bright_downsample bloom shader
+//#define USE_LIGHTING_BLOOM_BRIGHTNESS
+
+#if defined(USE_LIGHTING_BLOOM_BRIGHTNESS) && (defined(USE_COMPUTE_BLOOM) || defined(USE_TAA) || defined(USE_AUTO_EXPOSURE))
+#error "USE_LIGHTING_BLOOM_BRIGHTNESS feeds the bloom render passes with the lighting result at a fixed exposure, so it cannot be combined with USE_COMPUTE_BLOOM, the TAA resolved color of USE_TAA or the exposure buffer of USE_AUTO_EXPOSURE"
+#endif
+#if defined(USE_LIGHTING_BLOOM_BRIGHTNESS) && (defined(USE_MERGED_GEOMETRY_LIGHTING) || defined(USE_FORWARD_PLUS) || defined(USE_HALF_RES_LIGHTING))
+#error "USE_LIGHTING_BLOOM_BRIGHTNESS needs a lighting pass of its own at render resolution, which USE_MERGED_GEOMETRY_LIGHTING, USE_FORWARD_PLUS and USE_HALF_RES_LIGHTING do not have"
+#endif
+
+#if defined(USE_SKY_STENCIL_MASK) || defined(USE_MSAA_EDGE_CLASSIFICATION)
+#define USE_LIGHTING_STENCIL
+#endif
+
+// The material sets are rewritten whenever a mesh gets new maps
+#if defined(USE_STREAMING_ASSETS) || defined(USE_TEXTURE_STREAMING)
+#define USE_MATERIAL_UPDATES
+#endif
+
 #ifdef USE_GLTF
 //#define GLTF_2_0
 extern std::string GLTF_VERSION;
@@ -82,6 +803,9 @@ extern std::string GLTF_NAME;
 //#define MODEL_NAMES						{ "Bug_Ship" }
 //#define MODEL_NAMES						{ "Knight_Base", "Knight_Helmet", "Knight_Chainmail", "Knight_Skirt", "Knight_Sword", "Knight_Armor" }
 //#define	MODEL_NAMES						{ "Shadow_Test" }
+// Scenes N cycles through with USE_SCENE_HOT_SWAP, from MODEL_NAMES on, which must be one of them
+#define HOT_SWAP_SCENES					{ { "Drone_Body", "Drone_Legs", "Floor" }, { "Cerberus" }, { "Jeep_Wagoneer" }, { "9mm_Pistol" }, \
+										  { "Knight_Base", "Knight_Helmet", "Knight_Chainmail", "Knight_Skirt", "Knight_Sword", "Knight_Armor" } }
 #endif
 
 
@@ -94,6 +818,9 @@ struct CubeMapCameraUniformBuffer
 struct TransMatsUniformBuffer
 {
 	glm::mat4 VP;
+	glm::mat4 unjitteredVP; // only used with USE_TAA
+	glm::mat4 prevUnjitteredVP; // only used with USE_TAA
+	glm::mat4 viewVPs[MAX_VIEW_COUNT]; // only used with USE_MULTI_VIEW, the first one equals VP
 };
 
 struct ShadowLightUniformBuffer
@@ -101,6 +828,12 @@ struct ShadowLightUniformBuffer
 	glm::mat4 cascadeVP;
 };
 
+// All cascades at once for the layered shadow pass
+struct ShadowCascadesUniformBuffer
+{
+	glm::mat4 cascadeVPs[CSM_MAX_SEG_COUNT];
+};
+
 struct DiracLight
 {
 	glm::vec3 posOrDir;
@@ -111,72 +844,444 @@ struct DiracLight
 
 // due to std140 padding for uniform buffer object
 // only use data types that are vec4 or multiple of vec4's
+// Values that change every frame
 struct LightingPassUniformBuffer
 {
 	glm::vec3 eyeWorldPos;
-	float emissiveStrength;
-	glm::vec4 diffuseSHCoefficients[9];
+	float padding;
 	glm::vec4 normFarPlaneZs;
 	glm::mat4 cascadeVPs[CSM_MAX_SEG_COUNT * MAX_SHADOW_LIGHT_COUNT];
+	glm::mat4 VP_inv; // only used with USE_COMPACT_GBUFFER
+	// Only used with USE_MULTI_VIEW
+	glm::vec4 viewEyeWorldPos[MAX_VIEW_COUNT]; // w unused
+	glm::vec4 viewRects[MAX_VIEW_COUNT]; // top left and size as fractions of the render extent
+	glm::mat4 viewVP_invs[MAX_VIEW_COUNT];
+};
+
+// Values that only change with the environment or the lights, uploaded when they do
+struct LightingStaticUniformBuffer
+{
+	glm::vec4 diffuseSHCoefficients[9]; // w of the first one is the distant environment light strength
 	DiracLight diracLights[NUM_LIGHTS];
+	glm::vec4 probeVolumeMin; // only used with USE_PROBE_VOLUME, w unused
+	glm::vec4 probeVolumeInvExtent; // only used with USE_PROBE_VOLUME, w unused
+	float emissiveStrength;
+	float padding[3];
+};
+
+// std430 header of the point light storage buffer, followed by @lightCount DiracLights
+struct PointLightBufferHeader
+{
+	uint32_t lightCount;
+	uint32_t pad[3];
+};
+
+// One quad of USE_IMPOSTORS
+struct ImpostorInstance
+{
+	glm::mat4 M; // of the mesh instance
+	glm::vec4 boundsCenterRadius; // object space bounding sphere the views were baked around
+	glm::uvec4 layer; // x: of the atlases, yzw: unused
+};
+
+struct VirtualTextureUniformBuffer
+{
+	glm::uvec4 feedbackInfo; // xy: feedback blocks per side, z: VIRTUAL_TEXTURE_FEEDBACK_STRIDE, w: frame, picks the reporting pixel and map
+};
+
+struct ShadowPageMarkUniformBuffer
+{
+	glm::mat4 VP_inv;
+	glm::mat4 cascadeVPs[CSM_MAX_SEG_COUNT];
+	glm::vec4 normFarPlaneZs;
+	glm::uvec4 pageCountAndExtent; // xy: pages per cascade side, zw: render extent
+	glm::uvec4 cascadeCountAndWordCount; // x: active cascades, y: words of the request bits
+};
+
+struct LightCullingUniformBuffer
+{
+	glm::mat4 V;
+	glm::mat4 P;
+	glm::mat4 P_inv;
+	glm::uvec4 tileCountAndExtent; // xy: number of tiles, zw: framebuffer size
+};
+
+// std430 element of the mesh storage buffer, read by GPU culling, the indirect shadow pass and the USE_VERTEX_PULLING vertex shaders
+struct GpuCullingMeshInfo
+{
+	glm::mat4 M;
+	glm::vec4 aabbMin; // object space
+	glm::vec4 aabbMax;
+	int32_t vertexOffset; // shared by all LODs
+	uint32_t lodCount;
+	// Meshlets of LOD 0 in the meshlet buffer, only used with USE_MESHLETS. The first one starts at the first triangle of the mesh
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	// x: VertexFormat, y, z: bytes to the first vertex in the position and attribute streams, w: material ID, has AO map << 8 and
+	// has emissive map << 9 for the USE_VISIBILITY_BUFFER material pass
+	glm::uvec4 vertexFetch;
+	glm::uvec2 lods[MESH_LOD_COUNT]; // x: first index, y: index count, finest first
+};
+
+struct GpuCullingUniformBuffer
+{
+	glm::vec4 cameraPlanes[6]; // see Frustum
+	glm::vec4 cascadePlanes[CSM_MAX_SEG_COUNT][6]; // near planes are not tested
+	glm::uvec4 counts; // x: mesh count, y: cascade count, z: shadow draw lists (1 with USE_LAYERED_SHADOW_PASS), w: unused
+	glm::mat4 VP; // camera, only used with USE_HIZ_OCCLUSION_CULLING
+	glm::uvec4 hiZInfo; // xy: size of Hi-Z mip 0, z: Hi-Z mip count, w: unused
+	glm::vec4 lodCamera; // xyz: camera position, also the eye of the USE_MESHLETS cone test, w: tan(fovy / 2)
+	glm::vec4 cascadeLodScales; // NDC units per world unit of each cascade projection
+	glm::vec4 lodParams; // x: LOD_COVERAGE_THRESHOLD, y: SHADOW_LOD_BIAS, zw: unused
+};
+static_assert(CSM_MAX_SEG_COUNT <= 4, "cascadeLodScales holds one scale per cascade");
+
+// Fragment push constants of the lighting pass, and of the geometry pass at FORWARD_PUSH_CONSTANT_OFFSET with USE_FORWARD_PLUS
+struct LightingPushConstants
+{
+	uint32_t specIrradianceMapMipCount;
+	int32_t frustumSegmentCount;
+	int32_t pcfKernelSize; // specialization constants with USE_PIPELINE_PERMUTATIONS
+#ifdef USE_DYNAMIC_RESOLUTION
+	float renderScale;
+#endif
+};
+
+// One dispatch of the skinning pass, which animates one mesh
+struct SkinningPushConstants
+{
+	int32_t srcVertexOffset; // rest pose vertices in the geometry pool
+	int32_t dstVertexOffset; // this frame's copy
+	uint32_t vertexCount;
+	uint32_t firstSkinVertex; // in the skin vertex buffer, ~0u without a skin
+	uint32_t firstJoint; // in the per frame skinning buffer
+	uint32_t firstMorphDelta; // in the morph delta buffer, in vec4 pairs
+	uint32_t morphTargetCount;
+	uint32_t firstWeight; // in floats from the start of the per frame skinning buffer
+};
+
+struct TaaUniformBuffer
+{
+	glm::vec2 jitter; // in NDC
+	float historyWeight; // 0 while the history image holds no valid frame
+	float accumulate; // 1 while USE_PROGRESSIVE_ACCUMULATION averages a still view, the history is neither reprojected nor clamped
+};
+
+struct SsaoUniformBuffer
+{
+	glm::mat4 V; // brings the G-buffer normals to view space
+	glm::mat4 P;
+	glm::mat4 P_inv;
+};
+
+struct AutoExposureUniformBuffer
+{
+	float deltaTime; // seconds since the last frame, for the adaptation
+	float pad[3];
+};
+
+// Applied to the scene color before tonemapping
+struct ColorGrading
+{
+	float exposure = 0.f; // in EV
+	float contrast = 1.f; // around middle grey
+	float saturation = 1.f;
+	float pad = 0.f;
+	glm::vec4 colorFilter = glm::vec4(1.f); // rgb multiplier, w unused
 };
 
 struct DisplayInfoUniformBuffer
 {
 	typedef int DisplayMode_t;
 	DisplayMode_t displayMode;
+	int pad[3];
+	glm::mat4 P_inv; // only used with USE_COMPACT_GBUFFER
 };
 
 
 class DeferredRenderer : public VBaseGraphics
 {
 public:
-	DeferredRenderer();
+	DeferredRenderer(bool headless = false);
 
 	virtual void run();
 
+	// Render this many frames along m_cameraPathFileName, save the GPU pass and CPU frame times to m_benchmarkFileName and exit.
+	// With m_cameraPlaybackRequested the frames replay m_cameraRecordingFileName instead, repeating it if it is shorter.
+	// 0 runs until the window is closed
+	uint32_t m_benchmarkFrameCount = 0;
+	std::string m_benchmarkFileName = BENCHMARK_FILE_NAME;
+
+	// What the benchmark measured, filled in once it is done
+	struct BenchmarkSummary
+	{
+		FrameStatistics::Percentiles cpuMS;
+		FrameStatistics::Percentiles gpuMS;
+		std::vector<std::pair<std::string, float>> passAvgMS; // in the order the passes were first seen
+		VkDeviceSize deviceLocalBytes = 0; // reserved by the memory allocator in device local heaps
+		VkDeviceSize hostVisibleBytes = 0; // and in the other heaps
+		uint64_t triangleCount = 0; // of the scene at LOD 0, over all instances
+	};
+	BenchmarkSummary m_benchmarkSummary;
+
+	// Size of the scene generated with USE_SYNTHETIC_SCENE
+	SyntheticSceneParams m_syntheticScene;
+
+	// Use the *_fp16 variants of the lighting, bloom and final output shaders, which do their math in half precision, where the
+	// device has shaderFloat16. Changes are taken up by the next drawFrame(), which rebuilds those pipelines
+	bool m_useHalfPrecision = true;
+
+	// Rates the USE_VARIABLE_RATE_SHADING pass picks, G cycles them
+	enum ShadingRateMode
+	{
+		SHADING_RATE_FULL, // every pixel shaded
+		SHADING_RATE_QUALITY, // 2x2 where the luminance is flat or moves fast
+		SHADING_RATE_PERFORMANCE, // up to 4x4 with looser thresholds
+		SHADING_RATE_FOVEATED, // coarser with the distance from the screen center, whatever the content
+		SHADING_RATE_MODE_COUNT
+	};
+	uint32_t m_shadingRateMode = SHADING_RATE_QUALITY;
+
+	// What configuration B of the A/B comparison changes from the current settings, which are A. Comma separated toggles of
+	// "msaa=<samples>", "prepass", "record" for command buffers recorded per frame, "low-latency" and "fp16". B or --ab starts the
+	// comparison, which holds the camera, alternates A and B every AB_BLOCK_FRAMES frames and reports the differences in
+	// the frame and pass times. B again stops it and saves the report to AB_RESULTS_FILE_NAME
+	std::string m_abToggles = AB_DEFAULT_TOGGLES;
+
+	// Render the jobs of this RenderJobList file and exit, headless only. The device, pipelines, scene and resident environments
+	// are kept between jobs. The next job's environment loads while the current one renders, and outputs are read back and
+	// written on other threads while the following frames render. Every job renders the scene loaded at startup
+	std::string m_batchJobFileName;
+
+	// Render the shards of the RenderFarm in this directory until it is stopped, headless only. Like a batch, but shards are
+	// claimed while the renderer stays up, preferring the environments that are resident already
+	std::string m_farmDirectory;
+	std::string m_farmWorkerName = RenderFarm::getDefaultWorkerName(); // unique among the workers of the farm
+
+	// Empty if the jobs can be rendered by this build, otherwise why not
+	static std::string checkRenderJobs(const RenderJobList &jobs);
+
+	// Write the VManager calls of one frame to this file once the scene has loaded and settled, see VCommandCapture. Every
+	// command buffer is recorded anew in that frame
+	std::string m_commandCaptureFileName;
+	// Replay the frame captured into this file instead of rendering, m_benchmarkFrameCount times or COMMAND_REPLAY_FRAMES, and
+	// save its pass times to m_benchmarkFileName. Needs the build, settings and scene of the capture
+	std::string m_commandReplayFileName;
+
+	// Compile every pipeline this build can create on this device into the pipeline cache and exit instead of rendering, e.g. at
+	// install time, so the first interactive run finds them all. That is every supported MSAA sample count with and without the
+	// *_fp16 shaders, and with USE_PIPELINE_PERMUTATIONS every geometry variant instead of those of the scene. The final output
+	// pipeline depends on the swapchain format, so warm up with the window rather than headless
+	bool m_warmUpPipelines = false;
+
+	// Switch to this scene of HOT_SWAP_SCENES with USE_SCENE_HOT_SWAP, between frames. Its models are drawn as they stream in.
+	// False if a model file is missing, the current scene is kept then
+	bool loadScene(uint32_t sceneIdx);
+
+	// Set to receive every frame without the text overlay, e.g. for a recording. The texels are in the swapchain format, tightly
+	// packed, and arrive on the main thread once the frame has completed on the GPU. A frame goes to the callback that was set
+	// when it was rendered, frames rendered without one are not read back. The callback must not keep @data
+	typedef std::function<void(const char *data, VkDeviceSize sizeInBytes, uint32_t width, uint32_t height, VkFormat format,
+		uint64_t frameIndex)> FrameCaptureCallback;
+	FrameCaptureCallback m_frameCaptureCallback;
+
+	// Set to hand every frame without the text overlay to another API on the GPU, e.g. a hardware video encoder, instead of
+	// reading it back. Called on the main thread once the frame is submitted: image @imageIdx of @sink holds the frame when
+	// the sink's semaphore reaches @semaphoreValue. Import the images and the semaphore again whenever the sink's generation
+	// changes and call sink.release(@imageIdx) once done with the image. Needs m_vulkanManager.isExternalImageSinkSupported()
+	typedef std::function<void(rj::VExternalImageSink &sink, uint32_t imageIdx, uint64_t semaphoreValue, uint64_t frameIndex)>
+		ExternalFrameCallback;
+	ExternalFrameCallback m_externalFrameCallback;
+
+	// Only used with USE_COLOR_LUT, whose LUT is baked again in the frame after this changes
+	ColorGrading m_colorGrading;
+
 protected:
 	uint32_t m_specEnvPrefilterRenderPass;
 	uint32_t m_shadowRenderPass;
 	uint32_t m_geomRenderPass;
-	uint32_t m_lightingRenderPass;
+	uint32_t m_lightingRenderPass; // the geometry pass with USE_MERGED_GEOMETRY_LIGHTING, see @m_lightingSubpass, not used with USE_FORWARD_PLUS
+	// Blur passes followed by the merge pass. USE_COMPUTE_BLOOM leaves out the blur passes, USE_FUSED_BLOOM_MERGE the merge pass.
+	// The same goes for the bloom pipelines, framebuffers and descriptor sets
 	std::vector<uint32_t> m_bloomRenderPasses;
 	uint32_t m_finalOutputRenderPass;
+	uint32_t m_taaRenderPass;
+	uint32_t m_lightingUpsampleRenderPass; // only used with USE_HALF_RES_LIGHTING
+	uint32_t m_geomLateRenderPass; // loads the early geometry pass attachments, only used with USE_HIZ_OCCLUSION_CULLING
+	uint32_t m_depthPrepassRenderPass; // depth only, see @m_useDepthPrepass
+	uint32_t m_geomAfterPrepassRenderPass; // geometry pass that loads the depth of the pre-pass
+	uint32_t m_probeCaptureRenderPass; // only used with USE_PROBE_VOLUME
+	uint32_t m_impostorBakeRenderPass; // only used with USE_IMPOSTORS
 
 	uint32_t m_brdfLutDescriptorSetLayout;
 	uint32_t m_specEnvPrefilterDescriptorSetLayout;
 	uint32_t m_skyboxDescriptorSetLayout;
 	uint32_t m_geomDescriptorSetLayout;
+	uint32_t m_geomDescriptorUpdateTemplate = std::numeric_limits<uint32_t>::max(); // writes every mesh set, if templates are enabled
 	uint32_t m_shadowDescriptorSetLayout1; // per segment
 	uint32_t m_shadowDescriptorSetLayout2; // per model
 	uint32_t m_lightingDescriptorSetLayout;
 	uint32_t m_bloomDescriptorSetLayout;
 	uint32_t m_finalOutputDescriptorSetLayout;
+	uint32_t m_lightCullingDescriptorSetLayout;
+	uint32_t m_shadowPageMarkDescriptorSetLayout;
+	uint32_t m_taaDescriptorSetLayout;
+	uint32_t m_lightingUpsampleDescriptorSetLayout;
+	uint32_t m_gpuCullingDescriptorSetLayout;
+	uint32_t m_hiZDescriptorSetLayout;
+	uint32_t m_bloomComputeDescriptorSetLayout;
+	uint32_t m_shProjectionDescriptorSetLayout;
+	uint32_t m_probeCaptureDescriptorSetLayout;
+	uint32_t m_probeProjectionDescriptorSetLayout;
+	uint32_t m_impostorDescriptorSetLayout;
+	uint32_t m_shadowMomentDescriptorSetLayout;
+	uint32_t m_meshletDescriptorSetLayout;
+	uint32_t m_vertexPullingDescriptorSetLayout; // mesh infos and the geometry pool streams, the last set of the geometry and shadow pipelines
+	uint32_t m_skinningDescriptorSetLayout;
+	uint32_t m_colorLutDescriptorSetLayout;
+	uint32_t m_autoExposureDescriptorSetLayout;
+	uint32_t m_ssaoDescriptorSetLayout;
+	uint32_t m_shadingRateDescriptorSetLayout;
+	uint32_t m_materialDescriptorSetLayout;
 
 	uint32_t m_brdfLutPipelineLayout;
+	uint32_t m_colorLutPipelineLayout;
+	uint32_t m_autoExposurePipelineLayout; // shared by both auto exposure pipelines
+	uint32_t m_ssaoPipelineLayout; // shared by the SSAO and blur pipelines
+	uint32_t m_shadingRatePipelineLayout;
+	uint32_t m_materialPipelineLayout; // the material set and the vertex pulling set
 	uint32_t m_specEnvPrefilterPipelineLayout;
-	uint32_t m_skyboxPipelineLayout;
+	uint32_t m_skyboxPipelineLayout; // not used with USE_DEFERRED_SKY
 	uint32_t m_geomPipelineLayout;
 	uint32_t m_shadowPipelineLayout;
 	uint32_t m_lightingPipelineLayout;
 	std::vector<uint32_t> m_bloomPipelineLayouts;
 	uint32_t m_finalOutputPipelineLayout;
+	uint32_t m_lightCullingPipelineLayout;
+	uint32_t m_shadowPageMarkPipelineLayout;
+	uint32_t m_taaPipelineLayout;
+	uint32_t m_lightingUpsamplePipelineLayout;
+	uint32_t m_gpuCullingPipelineLayout;
+	uint32_t m_hiZPipelineLayout;
+	uint32_t m_bloomComputePipelineLayout;
+	uint32_t m_shProjectionPipelineLayout; // shared by both SH projection pipelines
+	uint32_t m_probeCapturePipelineLayout; // the geometry set of a mesh and the capture set
+	uint32_t m_probeProjectionPipelineLayout;
+	uint32_t m_impostorBakePipelineLayout; // the geometry set of a mesh
+	uint32_t m_impostorPipelineLayout; // the impostor set
+	uint32_t m_impostorShadowPipelineLayout; // the cascade's shadow set and the impostor set
+	uint32_t m_shadowMomentPipelineLayout; // shared by all shadow moment pipelines
+	uint32_t m_geomMeshletPipelineLayout; // the geometry set and the meshlet set, also used by the mesh shader depth pre-pass
+	uint32_t m_shadowMeshletPipelineLayout; // both shadow sets and the meshlet set
+	uint32_t m_meshletCullingPipelineLayout;
+	uint32_t m_skinningPipelineLayout;
 
 	uint32_t m_brdfLutPipeline;
 	uint32_t m_specEnvPrefilterPipeline;
-	uint32_t m_skyboxPipeline;
+	uint32_t m_skyboxPipeline; // a fullscreen draw in the lighting pass with USE_DEFERRED_SKY
 	uint32_t m_geomPipeline;
+	std::unordered_map<uint32_t, uint32_t> m_geomPipelineVariants; // from getGeomPipelineVariant(), only used with USE_PIPELINE_PERMUTATIONS
+	// Same as above with an equal depth test and no depth writes, used after the depth pre-pass
+	uint32_t m_geomDepthEqualPipeline;
+	std::unordered_map<uint32_t, uint32_t> m_geomDepthEqualPipelineVariants;
+	uint32_t m_depthPrepassPipeline;
 	std::vector<uint32_t> m_shadowPipelines;
+	// Mesh shader variants of the four above, only used with USE_MESHLETS and mesh shaders
+	uint32_t m_geomMeshletPipeline;
+	uint32_t m_geomDepthEqualMeshletPipeline;
+	uint32_t m_depthPrepassMeshletPipeline;
+	std::vector<uint32_t> m_shadowMeshletPipelines;
 	uint32_t m_lightingPipeline;
+	uint32_t m_lightingEdgePipeline; // only used with USE_MSAA_EDGE_CLASSIFICATION
+	uint32_t m_skyMaskPipeline; // only used with USE_SKY_STENCIL_MASK
+	uint32_t m_msaaClassificationPipeline; // only used with USE_MSAA_EDGE_CLASSIFICATION
 	std::vector<uint32_t> m_bloomPipelines;
 	uint32_t m_finalOutputPipeline;
+	uint32_t m_finalOutputDebugPipeline; // the display modes but DISPLAY_MODE_FULL, only used with USE_COLOR_LUT
+	uint32_t m_colorLutPipeline;
+	uint32_t m_luminanceHistogramPipeline;
+	uint32_t m_exposureAdaptPipeline; // one work group, also clears the histogram for the next frame
+	uint32_t m_ssaoPipeline;
+	uint32_t m_ssaoBlurPipeline; // the direction is a push constant. A kernel of @m_separableBlur with USE_COMPUTE_BLUR
+	uint32_t m_shadingRatePipeline;
+	uint32_t m_materialPipeline; // writes the G-buffers from the visibility buffer, only used with USE_VISIBILITY_BUFFER
+	uint32_t m_lightCullingPipeline;
+	uint32_t m_shadowPageMarkPipeline;
+	uint32_t m_taaPipeline;
+	uint32_t m_lightingUpsamplePipeline;
+	uint32_t m_gpuCullingPipeline;
+	uint32_t m_gpuCullingLatePipeline; // only used with USE_HIZ_OCCLUSION_CULLING
+	uint32_t m_meshletCullingPipeline; // only used with USE_MESHLETS without mesh shaders
+	uint32_t m_meshletCullingLatePipeline; // only used with USE_HIZ_OCCLUSION_CULLING too
+	uint32_t m_skinningPipeline;
+	uint32_t m_hiZDepthReducePipeline; // writes Hi-Z mip 0 from the depth image
+	uint32_t m_hiZDownsamplePipeline;
+	uint32_t m_bloomPrefilterPipeline; // writes bloom mip 0 from the bright parts of the scene color
+	uint32_t m_bloomDownsamplePipeline;
+	uint32_t m_bloomUpsamplePipeline; // tent filters a mip and adds it onto the next larger one
+	uint32_t m_shProjectionPipeline; // one partial sum of the 9 SH coefficients per work group
+	uint32_t m_shReducePipeline; // adds the partial sums up into @m_diffuseSHBuffer
+	uint32_t m_probeCapturePipeline; // draws a mesh into all 6 faces of a probe's capture
+	uint32_t m_probeProjectionPipeline; // one work group per probe of a batch
+	uint32_t m_impostorBakePipeline; // draws a mesh into one view of its atlas layers
+	uint32_t m_impostorPipeline; // impostor quads of the geometry pass
+	std::vector<uint32_t> m_impostorShadowPipelines; // one per shadow subpass
+	uint32_t m_shadowMomentGeneratePipeline; // writes mip 0 of a cascade's moments from 2x2 shadow map texels
+	uint32_t m_shadowMomentBlurPipeline; // box blur along the direction in the push constants. A kernel of @m_separableBlur with USE_COMPUTE_BLUR
+	uint32_t m_bloomBlurPipeline; // kernel of @m_separableBlur, only used with USE_COMPUTE_BLUR
+	uint32_t m_shadowMomentDownsamplePipeline;
 
+	VkSampleCountFlagBits m_sampleCount; // sample count of the depth image and G-buffers
+	bool m_halfPrecisionShaders = false; // the lighting, bloom and final output pipelines use the *_fp16 variants, see m_useHalfPrecision
+	VkSampleCountFlags m_supportedSampleCounts; // by both color and depth attachments
 	rj::helper_functions::ImageWrapper m_depthImage;
-	rj::helper_functions::ImageWrapper m_shadowImage;
+	// Depth of the geometry pass resolved to the nearest and, with USE_DEPTH_RESOLVE_MIN_MAX, the farthest sample. Only created while
+	// getDepthResolveMode() and getDepthMaxResolveMode() resolve, in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL after the pass
+	rj::helper_functions::ImageWrapper m_resolvedDepthImage;
+	rj::helper_functions::ImageWrapper m_resolvedDepthMaxImage;
+	// Farthest depth pyramid, only used with USE_HIZ_OCCLUSION_CULLING. Mip 0 is the render extent rounded down to a power of two.
+	// One view per mip followed by a view of all mips. Always in VK_IMAGE_LAYOUT_GENERAL
+	rj::helper_functions::ImageWrapper m_hiZImage;
+	// EVSM moments of each cascade, only used with USE_EVSM_SHADOWS. One array view per mip followed by a view of all mips.
+	// Always in VK_IMAGE_LAYOUT_GENERAL, like the blur intermediate
+	rj::helper_functions::ImageWrapper m_shadowMomentImage;
+	rj::helper_functions::ImageWrapper m_shadowMomentBlurImage;
 
 	const VkFormat m_lightingResultImageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
 	rj::helper_functions::ImageWrapper m_lightingResultImage; // VK_FORMAT_R16G16B16A16_SFLOAT
+	rj::helper_functions::ImageWrapper m_lightingStencilImage; // LightingStencilBits, only used with USE_LIGHTING_STENCIL
+	// Multisampled target of the USE_FORWARD_PLUS geometry pass, resolved into the lighting result. Not created without MSAA,
+	// when the pass renders into the lighting result directly
+	rj::helper_functions::ImageWrapper m_forwardColorImage;
+	// Part of the lighting result above the bloom threshold, written next to it by the lighting pass with USE_LIGHTING_BLOOM_BRIGHTNESS
+	const VkFormat m_bloomBrightImageFormat = VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+	rj::helper_functions::ImageWrapper m_bloomBrightImage;
+	// Target of the lighting pass with USE_HALF_RES_LIGHTING, upsampled into @m_lightingResultImage
+	rj::helper_functions::ImageWrapper m_halfResLightingImage;
+	// AO and view depth at half the render resolution, only used with USE_SSAO. The blur ping-pongs between both, the result
+	// ends up in the first. Written and read by compute shaders and sampled by the lighting pass, always in the general layout
+	std::vector<rj::helper_functions::ImageWrapper> m_ssaoImages;
+	// One fragment size per getShadingRateTexelSize() pixels, only used with USE_VARIABLE_RATE_SHADING on devices with shading rate
+	// attachments. Written by the shading rate pass and attached to the geometry and lighting passes, always in the general layout
+	rj::helper_functions::ImageWrapper m_shadingRateImage;
+	// Triangle IDs written by the geometry pass in place of the G-buffers, ~0u where there is none. Only used with USE_VISIBILITY_BUFFER
+	const VkFormat m_visibilityImageFormat = VK_FORMAT_R32_UINT;
+	rj::helper_functions::ImageWrapper m_visibilityImage;
 	const uint32_t m_numGBuffers = 3;
+#ifdef USE_MERGED_GEOMETRY_LIGHTING
+	const uint32_t m_lightingSubpass = 1; // follows the geometry subpass
+#else
+	const uint32_t m_lightingSubpass = 0;
+#endif
+#ifdef USE_COMPACT_GBUFFER
+	const std::vector<VkFormat> m_gbufferFormats =
+	{
+		VK_FORMAT_R16G16_SFLOAT,
+		VK_FORMAT_R8G8B8A8_UNORM,
+		VK_FORMAT_R8G8B8A8_UNORM
+	};
+	std::vector<rj::helper_functions::ImageWrapper> m_gbufferImages; // GB1: octahedral normal, GB2: albedo, GB3: roughness, metalness, AO, material ID
+#else
 	const std::vector<VkFormat> m_gbufferFormats =
 	{
 		VK_FORMAT_R32G32B32A32_SFLOAT,
@@ -184,6 +1289,7 @@ protected:
 		VK_FORMAT_R8G8B8A8_UNORM
 	};
 	std::vector<rj::helper_functions::ImageWrapper> m_gbufferImages; // GB1: VK_FORMAT_R32G32B32A32_SFLOAT, GB2: VK_FORMAT_R32G32B32A32_SFLOAT, GB3: VK_FORMAT_R8G8B8A8_UNORM
+#endif
 	const uint32_t m_numPostEffectImages = 2;
 	const std::vector<VkFormat> m_postEffectImageFormats =
 	{
@@ -191,85 +1297,611 @@ protected:
 		VK_FORMAT_R16G16B16A16_SFLOAT
 	};
 	std::vector<rj::helper_functions::ImageWrapper> m_postEffectImages; // Image1: VK_FORMAT_R16G16B16A16_SFLOAT, Image2: VK_FORMAT_R16G16B16A16_SFLOAT
+	// Bloom mip chain in the post effect format, replaces @m_postEffectImages with USE_COMPUTE_BLOOM. One view per mip.
+	// Always in VK_IMAGE_LAYOUT_GENERAL
+	rj::helper_functions::ImageWrapper m_bloomMipImage;
+
+	// TAA, only used with USE_TAA
+	const VkFormat m_motionVectorImageFormat = VK_FORMAT_R16G16_SFLOAT;
+	rj::helper_functions::ImageWrapper m_motionVectorImage; // NDC offset from the previous frame, render resolution
+	rj::helper_functions::ImageWrapper m_taaResultImage; // swapchain resolution, in the format of the lighting result
+	rj::helper_functions::ImageWrapper m_taaHistoryImage; // copy of the last resolved frame before bloom
+	bool m_taaHistoryValid = false;
+	uint32_t m_taaFrameIndex = 0;
+	glm::mat4 m_prevUnjitteredVP;
+#ifdef USE_PROGRESSIVE_ACCUMULATION
+	// The mean of hundreds of frames needs more precision than the half floats of the resolve target
+	const VkFormat m_taaHistoryImageFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+	rj::helper_functions::ImageWrapper m_taaAccumulationImage; // second resolve output in the history format, copied into the history
+	uint32_t m_accumulatedFrameCount = 0; // frames in the history since the view stopped, the TAA history it started from counts as one
+	uint64_t m_accumulationSceneVersion = 0; // of the materials and IBL versions, a change restarts the accumulation
+#else
+	const VkFormat m_taaHistoryImageFormat = m_lightingResultImageFormat;
+#endif
+#ifdef USE_DEVICE_GROUP
+	// Every device of the group has its own instance of the history, left by its last frame. The members above describe the
+	// one of m_temporalStateDevice, the others wait here until their device renders again, see selectFrameDeviceState()
+	struct DeviceTemporalState
+	{
+		bool taaHistoryValid = false;
+		glm::mat4 prevUnjitteredVP;
+		uint32_t accumulatedFrameCount = 0;
+		uint64_t accumulationSceneVersion = 0;
+	};
+	std::vector<DeviceTemporalState> m_deviceTemporalStates; // by device
+	uint32_t m_temporalStateDevice = 0;
+#endif
+
+	// Frame described in terms of the attachments above. Gives the post effect passes their layouts and incoming dependencies
+	// and lets transient attachments with disjoint lifetimes share memory. Built with the render passes, see buildRenderGraph()
+	rj::VRenderGraph m_renderGraph;
+	struct RenderGraphNames
+	{
+		std::vector<uint32_t> gbufferImages;
+		std::vector<uint32_t> postEffectImages;
+		uint32_t depthImage;
+		uint32_t motionVectorImage; // only with USE_TAA
+		uint32_t visibilityImage; // only with USE_VISIBILITY_BUFFER
+		uint32_t lightingResultImage;
+		uint32_t halfResLightingImage; // only with USE_HALF_RES_LIGHTING
+		uint32_t bloomBrightImage; // only with USE_LIGHTING_BLOOM_BRIGHTNESS
+		uint32_t taaResultImage; // only with USE_TAA
+		uint32_t taaHistoryImage; // only with USE_TAA
+		uint32_t taaAccumulationImage; // only with USE_PROGRESSIVE_ACCUMULATION
+		uint32_t swapChainImage;
+
+		uint32_t taaPass; // only with USE_TAA
+		uint32_t lightingUpsamplePass; // only with USE_HALF_RES_LIGHTING
+		uint32_t materialPass; // only with USE_VISIBILITY_BUFFER
+		uint32_t ssaoPass; // only with USE_SSAO
+		uint32_t shadingRatePass; // only with USE_VARIABLE_RATE_SHADING
+		uint32_t autoExposurePass; // only with USE_AUTO_EXPOSURE
+		// Brightness, horizontal blur, vertical blur, merge. The mip chain replaces the first three with USE_COMPUTE_BLOOM,
+		// merge is left out with USE_FUSED_BLOOM_MERGE
+		std::vector<uint32_t> bloomPasses;
+	} m_renderGraphNames;
+	std::vector<uint32_t> m_renderGraphImages; // VManager image of each graph image once created
 
 	rj::helper_functions::UniformBlob<ONE_TIME_UNIFORM_BLOB_SIZE> m_oneTimeUniformHostData;
 	rj::helper_functions::UniformBlob<PER_FRAME_UNIFORM_BLOB_SIZE> m_perFrameUniformHostData;
 	CubeMapCameraUniformBuffer *m_uCubeViews = nullptr;
 	TransMatsUniformBuffer *m_uCameraVP = nullptr;
 	std::vector<ShadowLightUniformBuffer *> m_uShadowLightInfos;
+	ShadowCascadesUniformBuffer *m_uShadowCascades = nullptr; // only used with USE_LAYERED_SHADOW_PASS
 	LightingPassUniformBuffer *m_uLightInfo = nullptr;
+	LightingStaticUniformBuffer *m_uLightStaticInfo = nullptr;
 	DisplayInfoUniformBuffer *m_uDisplayInfo = nullptr;
+	LightCullingUniformBuffer *m_uLightCullingInfo = nullptr; // only used with USE_TILED_LIGHTING
+	ShadowPageMarkUniformBuffer *m_uShadowPageMarkInfo = nullptr; // only used with USE_VIRTUAL_SHADOW_MAP
+	VirtualTextureUniformBuffer *m_uVirtualTextureInfo = nullptr; // only used with USE_VIRTUAL_TEXTURING
+	TaaUniformBuffer *m_uTaaInfo = nullptr; // only used with USE_TAA
+	SsaoUniformBuffer *m_uSsaoInfo = nullptr; // only used with USE_SSAO
+	AutoExposureUniformBuffer *m_uAutoExposureInfo = nullptr; // only used with USE_AUTO_EXPOSURE
+	GpuCullingUniformBuffer *m_uGpuCullingInfo = nullptr; // only used with USE_GPU_CULLING
 	rj::helper_functions::BufferWrapper m_oneTimeUniformDeviceData;
 	std::vector<rj::helper_functions::BufferWrapper> m_perFrameUniformDeviceData;
+	std::vector<char *> m_perFrameUniformMappedData;
+	std::vector<uint64_t> m_perFrameUniformSyncedStamps; // stamp of @m_perFrameUniformHostData last copied into each buffer
+
+	// Point lights for tiled lighting. Increment @m_pointLightsVersion after changing @m_pointLights
+	std::vector<DiracLight> m_pointLights;
+	uint64_t m_pointLightsVersion = 0;
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameLightBuffers; // PointLightBufferHeader followed by the lights
+	std::vector<char *> m_perFrameLightBufferMappedData;
+	std::vector<uint64_t> m_perFrameLightBufferSyncedVersions;
+	rj::helper_functions::BufferWrapper m_lightTileBuffer; // per tile: light count, then MAX_LIGHTS_PER_TILE indices
+	uint32_t m_lightTileCountX = 0;
+	uint32_t m_lightTileCountY = 0;
+
+	// GPU culling. Increment @m_meshInfosVersion after changing @m_meshInfos
+	std::vector<GpuCullingMeshInfo> m_meshInfos; // one per mesh of @m_scene
+	uint64_t m_meshInfosVersion = 0;
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameMeshInfoBuffers;
+	std::vector<char *> m_perFrameMeshInfoBufferMappedData;
+	std::vector<uint64_t> m_perFrameMeshInfoBufferSyncedVersions;
+	// (1 + CSM_MAX_SEG_COUNT) lists of one VkDrawIndexedIndirectCommand per mesh: geometry pass, then one per shadow subpass.
+	// USE_HIZ_OCCLUSION_CULLING appends the list of the late geometry pass. Culled meshes get an instance count of 0
+	rj::helper_functions::BufferWrapper m_indirectDrawBuffer;
+	rj::helper_functions::BufferWrapper m_meshVisibilityBuffer; // one uint per mesh, set if the mesh passed the last occlusion test
+
+	// Meshlets of all meshes in mesh order, only used with USE_MESHLETS. Their first vertex and first triangle index the
+	// vertex and triangle buffers of all meshes
+	rj::helper_functions::BufferWrapper m_meshletBuffer;
+	rj::helper_functions::BufferWrapper m_meshletVertexBuffer;
+	rj::helper_functions::BufferWrapper m_meshletTriangleBuffer;
+	uint32_t m_meshletCount = 0;
+	// Lists like those of @m_indirectDrawBuffer with one VkDrawMeshTasksIndirectCommandEXT per mesh. Meshes GPU culling hands over to
+	// their meshlets get a task work group per MESHLET_TASK_GROUP_SIZE meshlets there and no instance in the indexed draw
+	rj::helper_functions::BufferWrapper m_meshletTaskBuffer;
+	// Without mesh shaders, the same lists with one VkDrawIndexedIndirectCommand per meshlet, written by the meshlet culling pass
+	rj::helper_functions::BufferWrapper m_meshletDrawBuffer;
+
+	// Skinning, only used with USE_GPU_SKINNING
+	struct SkinnedMesh
+	{
+		uint32_t mesh; // in @m_scene
+		uint32_t vertexCount;
+		uint32_t firstSkinVertex; // in @m_skinVertexBuffer, Animator::INVALID_INDEX without a skin
+		uint32_t firstJoint; // of its skin
+		uint32_t firstMorphDelta; // in @m_morphDeltaBuffer, in vec4 pairs
+		uint32_t morphTargetCount;
+		uint32_t firstWeight; // of its morph targets
+		std::vector<rj::GeometryRange> frameGeometry; // per swapchain image, the copy of its vertices the skinning pass writes
+	};
+	Animator m_animator;
+	Animator::Pose m_animationPose;
+	std::chrono::high_resolution_clock::time_point m_animationStartTime;
+	std::vector<SkinnedMesh> m_skinnedMeshes;
+	std::vector<uint32_t> m_meshSkinnedIndices; // in @m_skinnedMeshes per mesh, Animator::INVALID_INDEX if the mesh is static
+	std::vector<glm::mat4> m_jointMatrices; // of all skins, sampled by updateAnimation
+	rj::helper_functions::BufferWrapper m_skinVertexBuffer; // SkinVertex of all skinned meshes
+	rj::helper_functions::BufferWrapper m_morphDeltaBuffer; // morph target deltas of all morphed meshes
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameSkinningBuffers; // joint matrices, then the morph target weights
+	std::vector<char *> m_perFrameSkinningBufferMappedData;
+
+	// SH projection on the GPU, only used with USE_GPU_SH_PROJECTION. The coefficients are vec4s read by the lighting pass
+	rj::helper_functions::BufferWrapper m_shPartialSumBuffer; // 9 vec4s per work group of the projection
+	rj::helper_functions::BufferWrapper m_diffuseSHBuffer;
+	uint32_t m_shProjectionGroupCount = 0; // per cube face dimension
+
+	// Probe volume, only used with USE_PROBE_VOLUME. Each texel holds the L0 and the three L1 coefficients of one color channel
+	// of a probe. Written in VK_IMAGE_LAYOUT_GENERAL by the bake, then VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	std::vector<rj::helper_functions::ImageWrapper> m_probeVolumeImages; // red, green and blue
+	BBox m_probeVolumeBounds; // the probes sit at the cell centers of a PROBE_VOLUME_GRID_SIZE grid over it
+	const VkFormat m_probeCaptureFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+	rj::helper_functions::ImageWrapper m_probeCaptureImage; // 6 array layers per probe of a batch, alpha 0 where the sky shows
+	rj::helper_functions::ImageWrapper m_probeCaptureDepthImage;
+	rj::helper_functions::BufferWrapper m_probeCaptureSHBuffer; // 9 vec4s the captures are lit with, @m_diffuseSHBuffer with USE_GPU_SH_PROJECTION
+	bool m_probeVolumeBaked = false;
+
+	// Impostor atlases, only used with USE_IMPOSTORS. One layer per mesh with an impostor, IMPOSTOR_VIEWS_PER_SIDE^2 views of
+	// IMPOSTOR_VIEW_SIZE texels each, view (x, y) looking at the mesh from the octahedral direction at the center of cell (x, y)
+	rj::helper_functions::ImageWrapper m_impostorAlbedoImage; // alpha is the coverage
+	rj::helper_functions::ImageWrapper m_impostorNormalDepthImage; // object space normal, w: depth over the bounding sphere diameter
+	rj::helper_functions::ImageWrapper m_impostorBakeDepthImage; // a single layer, reused by every mesh
+	std::vector<uint32_t> m_impostorLayerViews; // albedo and normal depth view of each layer, the attachments of its framebuffer
+	std::vector<uint32_t> m_impostorLayers; // of every mesh, max() if it has none
+	std::vector<glm::vec4> m_impostorBounds; // object space bounding sphere of every layer
+	uint32_t m_impostorInstanceCapacity = 0; // of each per-frame instance buffer, the instances of all layers once per draw list
+	bool m_impostorsBaked = false;
+
+	// Color LUT, only used with USE_COLOR_LUT. Written in VK_IMAGE_LAYOUT_GENERAL by the bake, then VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	rj::helper_functions::ImageWrapper m_colorLutImage;
+	ColorGrading m_bakedColorGrading; // @m_colorGrading of the last bake
+	bool m_colorLutBaked = false;
+	uint32_t m_colorLutBakedDevices = 0; // with USE_DEVICE_GROUP, the devices whose LUT is of @m_bakedColorGrading
+
+	// Auto exposure, only used with USE_AUTO_EXPOSURE. Both buffers stay on the GPU
+	rj::helper_functions::BufferWrapper m_luminanceHistogramBuffer; // AUTO_EXPOSURE_HISTOGRAM_BINS uints, zero between frames
+	rj::helper_functions::BufferWrapper m_exposureBuffer; // the exposure the scene color is multiplied with, then the average log2 luminance
+	std::chrono::high_resolution_clock::time_point m_lastExposureUpdateTime;
+
+	// Precomputation results are looked up in and saved to PRECOMPUTE_CACHE_DIR under these names, see getPrecomputeCacheFileName()
+	std::string m_brdfLutCacheFileName;
+	std::string m_specMapCacheFileName;
+
+	// Instancing. Increment @m_instanceTransformsVersion after changing the instance transforms of any mesh
+	std::vector<uint32_t> m_meshFirstInstances; // index of the first instance of each mesh in the instance buffers
+	uint32_t m_totalInstanceCount = 0;
+	uint64_t m_instanceTransformsVersion = 0;
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameInstanceBuffers; // PerModelUniformBuffer of every instance
+	std::vector<char *> m_perFrameInstanceBufferMappedData;
+	std::vector<uint64_t> m_perFrameInstanceBufferSyncedVersions;
 
 	uint32_t m_brdfLutDescriptorSet;
+	uint32_t m_colorLutDescriptorSet;
 	uint32_t m_specEnvPrefilterDescriptorSet;
+	std::vector<uint32_t> m_specEnvPrefilterMipDescriptorSets; // one per specular map mip, instead of the above with USE_COMPUTE_ENV_PREFILTER
+	std::vector<uint32_t> m_hiZDescriptorSets; // one per Hi-Z mip
+	uint32_t m_shadingRateDescriptorSet;
+	// Generate, horizontal blur and vertical blur, then one per moment mip but the first
+	std::vector<uint32_t> m_shadowMomentDescriptorSets;
+	std::vector<uint32_t> m_bloomDownsampleDescriptorSets; // one per bloom mip
+	std::vector<uint32_t> m_bloomUpsampleDescriptorSets; // one per bloom mip but the last, written by the upsample of the next smaller mip
+	// Horizontal and vertical blur of @m_separableBlur. The moments blur with their own sets, whose layout is the same
+	std::vector<uint32_t> m_bloomBlurDescriptorSets;
+	std::vector<uint32_t> m_ssaoBlurDescriptorSets;
+	uint32_t m_shProjectionDescriptorSet;
+	uint32_t m_probeCaptureDescriptorSet;
+	uint32_t m_probeProjectionDescriptorSet;
 	typedef struct
 	{
 		uint32_t m_skyboxDescriptorSet;
-		std::vector<uint32_t> m_geomDescriptorSets; // one set per model
+		std::vector<uint32_t> m_geomDescriptorSets; // one set per model, a single one with USE_BINDLESS_MATERIALS
 		std::vector<uint32_t> m_shadowDescriptorSets1; // one set per segment
-		std::vector<uint32_t> m_shadowDescriptorSets2; // one per model
+		std::vector<uint32_t> m_shadowDescriptorSets2; // a single set, each draw selects its model with a dynamic offset or its instance index
 		uint32_t m_lightingDescriptorSet;
 		std::vector<uint32_t> m_bloomDescriptorSets;
 		uint32_t m_finalOutputDescriptorSet;
+		uint32_t m_lightCullingDescriptorSet;
+		uint32_t m_shadowPageMarkDescriptorSet;
+		uint32_t m_taaDescriptorSet;
+		uint32_t m_lightingUpsampleDescriptorSet;
+		uint32_t m_gpuCullingDescriptorSet;
+		uint32_t m_meshletDescriptorSet;
+		uint32_t m_vertexPullingDescriptorSet;
+		uint32_t m_skinningDescriptorSet;
+		uint32_t m_autoExposureDescriptorSet;
+		std::vector<uint32_t> m_ssaoDescriptorSets; // SSAO, horizontal blur, vertical blur
+		uint32_t m_materialDescriptorSet;
+		uint32_t m_impostorDescriptorSet; // camera, the frame's impostor instances and the atlases
 	} PerFrameDescriptorSets;
 	std::vector<PerFrameDescriptorSets> m_perFrameDescriptorSets;
 
 	std::vector<uint32_t> m_specEnvPrefilterFramebuffers;
 	uint32_t m_geomFramebuffer;
+	uint32_t m_depthPrepassFramebuffer;
 	uint32_t m_shadowFramebuffer;
-	uint32_t m_lightingFramebuffer;
-	std::vector<uint32_t> m_postEffectFramebuffers;
+	uint32_t m_lightingFramebuffer; // the geometry framebuffer with USE_MERGED_GEOMETRY_LIGHTING and USE_FORWARD_PLUS
+	std::vector<uint32_t> m_postEffectFramebuffers; // bloom framebuffers
+	uint32_t m_taaFramebuffer;
+	uint32_t m_lightingUpsampleFramebuffer;
+	uint32_t m_probeCaptureFramebuffer = std::numeric_limits<uint32_t>::max(); // all layers of the capture images
+	std::vector<uint32_t> m_impostorBakeFramebuffers; // one per atlas layer
 	std::vector<uint32_t> m_finalOutputFramebuffers; // present framebuffer names
 
-	uint32_t m_imageAvailableSemaphore;
-	uint32_t m_geomAndLightingCompleteSemaphore;
-	uint32_t m_postEffectSemaphore;
-	uint32_t m_finalOutputFinishedSemaphore;
-	uint32_t m_renderFinishedSemaphore;
+	typedef struct
+	{
+		uint32_t m_imageAvailableSemaphore;
+		uint32_t m_geomAndLightingCompleteSemaphore;
+		uint32_t m_postEffectSemaphore;
+		uint32_t m_bloomComputeSemaphore; // only used with USE_ASYNC_COMPUTE
+		uint32_t m_renderFinishedSemaphore;
+		uint32_t m_renderFinishedFence;
+		uint64_t m_frameCompleteValue; // USE_TIMELINE_SEMAPHORES, reached when the last frame in this slot is done
+		uint64_t m_frameSerial; // VManager frame serial of the last frame in this slot, see VManager::completeFrames()
+	} PerFrameSyncObjects;
+	std::vector<PerFrameSyncObjects> m_perFrameSyncObjects; // one per frame in flight
+	std::vector<uint32_t> m_imageInFlightFences; // fence of the frame that last rendered into each swapchain image
+	std::vector<uint64_t> m_imageInFlightValues; // USE_TIMELINE_SEMAPHORES counterpart of @m_imageInFlightFences
+
+	// Every frame advances @m_frameTimelineSemaphore by FTS_COUNT. Each submit signals the base value of its frame plus its step
+	enum FrameTimelineStep
+	{
+		FTS_GEOM_SHADOW_LIGHTING = 1,
+		FTS_POST_EFFECT,
+		FTS_BLOOM_COMPUTE, // only signaled with USE_ASYNC_COMPUTE
+		FTS_FRAME_COMPLETE, // final output and text overlay
+		FTS_COUNT = FTS_FRAME_COMPLETE
+	};
+	uint32_t m_frameTimelineSemaphore;
+	uint64_t m_frameTimelineBase = 0; // of the frame being submitted
+	uint32_t m_currentFrame = 0;
+	uint32_t m_frameDeviceCount = 1; // devices of the group frames alternate between, only more than 1 with USE_DEVICE_GROUP
+	uint32_t m_frameDeviceIndex = 0; // the one the next frame is rendered on
+	uint64_t m_presentId = 0; // of the last present on the current swapchain, 0 if none
 
 	uint32_t m_brdfLutFence;
 	uint32_t m_envPrefilterFence;
-	uint32_t m_renderFinishedFence;
+	uint32_t m_shProjectionFence;
+	uint32_t m_probeVolumeFence;
+	uint32_t m_impostorBakeFence;
 
 	uint32_t m_brdfLutCommandBuffer;
 	uint32_t m_envPrefilterCommandBuffer;
+	uint32_t m_shProjectionCommandBuffer; // graphics queue, so the lighting pass needs no ownership transfer of @m_diffuseSHBuffer
+	uint32_t m_probeVolumeCommandBuffer; // all batches of captures and projections
+	uint32_t m_impostorBakeCommandBuffer; // every view of every impostor
+	// Categories of the pre-recorded command buffers of a swapchain image. Each one is only re-recorded when what it depends on
+	// has changed, and only when its image comes up next, so frames of a static scene record nothing
+	enum CommandBufferDirtyBits
+	{
+		CB_DIRTY_GEOM_SHADOW_LIGHTING = 1 << 0, // bound mesh descriptor sets, besides the visibility version and pre-pass switch
+		CB_DIRTY_POST_EFFECT = 1 << 1, // attachments and render scale
+		CB_DIRTY_PRESENT = 1 << 2, // swapchain framebuffers and render scale
+		CB_DIRTY_STATIC_SECONDARIES = 1 << 3, // everything but their draw lists, only used with USE_STATIC_SECONDARIES
+		CB_DIRTY_ALL = CB_DIRTY_GEOM_SHADOW_LIGHTING | CB_DIRTY_POST_EFFECT | CB_DIRTY_PRESENT | CB_DIRTY_STATIC_SECONDARIES
+	};
 	typedef struct
 	{
 		uint32_t m_geomShadowLightingCommandBuffer;
 		uint32_t m_postEffectCommandBuffer;
+		uint32_t m_bloomComputeCommandBuffer; // from @m_computeCommandPool, only used with USE_ASYNC_COMPUTE
 		uint32_t m_presentCommandBuffer;
+		uint32_t m_frameCaptureCommandBuffer; // recorded every frame while m_frameCaptureCallback or m_externalFrameCallback is set
+		uint32_t m_colorLutCommandBuffer; // recorded when this image's frame bakes the color LUT, only used with USE_COLOR_LUT
+		uint32_t m_virtualTextureCommandBuffer; // recorded when this image's frame copies tiles, only used with USE_VIRTUAL_TEXTURING
+		uint32_t m_dirtyMask; // CommandBufferDirtyBits of the command buffers to re-record before this image is submitted again
+		uint64_t m_recordedVisibilityVersion; // @m_visibilityVersion when m_geomShadowLightingCommandBuffer was recorded
+		bool m_recordedDepthPrepass; // @m_useDepthPrepass when m_geomShadowLightingCommandBuffer was recorded
+		float m_recordedRenderScale; // @m_renderScale when the command buffers were recorded
+		uint32_t m_recordedShadingRateMode; // @m_shadingRateMode when m_geomShadowLightingCommandBuffer was recorded
+		uint32_t m_recordedTlasBuild; // TlasBuild of the image's top level structure when m_geomShadowLightingCommandBuffer was recorded
 	} PerFrameCommandBuffers;
 	std::vector<PerFrameCommandBuffers> m_perFrameCommandBuffers;
+	// Used when @m_recordCommandBuffersPerFrame is set. One transient pool per swapchain image which is reset every frame.
+	// Pools are never destroyed, so they are only added when the swapchain grows.
+	std::vector<uint32_t> m_perFrameCommandPools;
+	std::vector<uint32_t> m_perFrameTransientCommandBuffers;
+	// Secondary command buffers for multithreaded recording, one pool per recording task and swapchain image. Each pool holds
+	// (1 + CSM_MAX_SEG_COUNT) buffers, acquired in order: geometry pass, then one per cascade
+	uint32_t m_sceneCommandPoolSet = std::numeric_limits<uint32_t>::max();
+	// Secondaries of the static meshes with USE_STATIC_SECONDARIES. One frame of the set per swapchain image and pass, so each
+	// pass is reset on its own, with one buffer per recording task
+	uint32_t m_staticSceneCommandPoolSet = std::numeric_limits<uint32_t>::max();
+	// Per swapchain image and pass, what its static secondaries were recorded with, empty if they have to be recorded
+	std::vector<std::vector<uint32_t>> m_staticSecondarySignatures;
+
+	// GPU time of every pass, and of every cascade and bloom level within them
+	rj::VGpuProfiler m_gpuProfiler{ &m_vulkanManager };
+	// CPU time from one drawFrame() to the next, and the GPU frame time once its queries are read back
+	FrameStatistics m_frameStatistics{ FRAME_STATS_HISTORY_LENGTH, HITCH_THRESHOLD_MS };
+	std::chrono::high_resolution_clock::time_point m_lastFrameStartTime;
 
-	enum PassTimestampQueryIndex
+	// Runtime settings the A/B comparison switches between, see m_abToggles
+	struct ABConfig
 	{
-		TQI_GEOM_START = 0,
-		TQI_GEOM_END,
-		TQI_SHADOW_START,
-		TQI_SHADOW_END,
-		TQI_LIGHTING_START,
-		TQI_LIGHTING_END,
-		TQI_BLOOM_START,
-		TQI_BLOOM_END,
-		TQI_FINAL_OUTPUT_START,
-		TQI_FINAL_OUTPUT_END,
-		TQI_QUERY_COUNT
+		VkSampleCountFlagBits sampleCount;
+		bool depthPrepass;
+		bool recordPerFrame;
+		bool lowLatency;
+		bool halfPrecision;
+
+		bool operator==(const ABConfig &other) const
+		{
+			return sampleCount == other.sampleCount && depthPrepass == other.depthPrepass && recordPerFrame == other.recordPerFrame &&
+				lowLatency == other.lowLatency && halfPrecision == other.halfPrecision;
+		}
+		std::string toString() const;
+	};
+	ABExperiment m_abExperiment;
+	ABConfig m_abConfigs[2]; // A, B
+	Camera::State m_abCamera; // held while the comparison runs
+
+	// Fraction of the render extent the geometry, lighting and bloom passes draw into. Only below 1 with USE_DYNAMIC_RESOLUTION,
+	// where @m_resolutionController sets it from the GPU frame times before this frame's command buffers are recorded
+	float m_renderScale = 1.f;
+	DynamicResolutionController m_resolutionController{ DYNAMIC_RESOLUTION_TARGET_MS, DYNAMIC_RESOLUTION_HEADROOM,
+		DYNAMIC_RESOLUTION_MIN_SCALE, DYNAMIC_RESOLUTION_STEP_COUNT, DYNAMIC_RESOLUTION_RAISE_FRAMES };
+	// GPU time of probe prefiltering, streamed texture uploads and virtual texture tile copies, shared out in that order at
+	// the start of updateUniformHostData()
+	BackgroundWorkBudget m_backgroundBudget{ BACKGROUND_GPU_TARGET_MS, BACKGROUND_GPU_HEADROOM, BACKGROUND_GPU_MAX_MS, BACKGROUND_GPU_MIN_MS };
+
+	// Pixel classes tagged in the lighting pass stencil
+	enum LightingStencilBits
+	{
+		LSB_SKY = 0x1,
+		LSB_MSAA_EDGE = 0x2
 	};
-	std::vector<uint32_t> m_perFrameQueryPools;
 
 	VScene m_scene{ &m_vulkanManager };
 
-	rj::helper_functions::FrameTimeCalculator m_frameTimeCalculator;
-	rj::helper_functions::FrameTimeCalculator m_geomPassTimeCalculator;
-	rj::helper_functions::FrameTimeCalculator m_shadowPassTimeCalculator;
-	rj::helper_functions::FrameTimeCalculator m_lightingPassTimeCalculator;
-	rj::helper_functions::FrameTimeCalculator m_bloomPassTimeCalculator;
-	rj::helper_functions::FrameTimeCalculator m_finalOutputPassTimeCalculator;
+	// A model whose files are decoded on the asset job pool, for the mesh of the same index
+	struct PendingModel
+	{
+		VMesh::HostData data;
+		size_t beginJob; // its jobs in the pool
+		size_t endJob;
+	};
+
+	// Streaming assets. Increment @m_materialsVersion after changing the maps of any mesh. @m_assetJobs is
+	// declared after @m_pendingModels and @m_assetReader so it is destroyed first and no job writes into a destroyed model
+	// or waits on a destroyed reader
+	rj::helper_functions::ImageWrapper m_placeholderMaps[VMesh::numMapsPerMesh]; // 1x1, in the map order of VMesh::HostData
+	std::vector<std::unique_ptr<PendingModel>> m_pendingModels; // null once uploaded
+	std::vector<std::unique_ptr<PendingModel>> m_abandonedModels; // of a scene switched away from, kept until their jobs are done
+	size_t m_pendingModelCount = 0;
+	std::unique_ptr<AsyncFileReader> m_assetReader; // reads the files of the jobs ahead, null with ASSET_READS_IN_FLIGHT 0 or once all models are uploaded
+	std::unique_ptr<JobPool> m_assetJobs; // null once all models are uploaded
+	uint64_t m_materialsVersion = 0;
+	std::vector<uint64_t> m_perFrameMaterialSyncedVersions;
+
+	// Files of a model of MODEL_NAMES or of the world layout. Optional maps are empty if the model has none
+	struct ModelFiles
+	{
+		std::string model;
+		std::string albedoMap;
+		std::string normalMap;
+		std::string roughnessMap;
+		std::string metalnessMap;
+		std::string aoMap;
+		std::string emissiveMap;
+	};
+
+	// Maps and geometry of an evicted mesh, freed once no frame in flight draws it
+	struct RetiredMesh
+	{
+		std::vector<std::string> mapKeys; // in m_scene.textureCache
+		std::vector<rj::GeometryRange> lods; // finest first
+		uint64_t frame; // @m_streamingFrame when evicted
+	};
+	std::deque<RetiredMesh> m_retiredMeshes; // oldest first
+	uint64_t m_streamingFrame = 0; // calls of updateStreamingAssets
+
+	// World partition, USE_WORLD_PARTITION only. Meshes of unloaded cells keep their material sets with the placeholder maps
+	std::unique_ptr<WorldPartition> m_worldPartition;
+	std::vector<ModelFiles> m_worldModelFiles; // by mesh
+	std::vector<uint32_t> m_worldLoadCells; // scratch of updateWorldPartition, kept to not allocate per frame
+	std::vector<uint32_t> m_worldEvictCells;
+
+	// Scene hot swap, USE_SCENE_HOT_SWAP only. Mesh slots the current scene does not use stay unloaded with the placeholder maps
+	uint32_t m_currentScene = 0; // into HOT_SWAP_SCENES
+
+	// Precomputation that finishes while frames are rendered, USE_ASYNC_IBL_PRECOMPUTE only. Incremented when
+	// the BRDF LUT or the specular map becomes ready
+	rj::helper_functions::ImageWrapper m_fallbackBrdfLut; // 1x1, stands in for m_bakedBRDFs[0] until it is ready
+	uint64_t m_iblVersion = 0; // also the skybox sets with USE_PROBE_SWITCHING
+	std::vector<uint64_t> m_perFrameIblSyncedVersions;
+
+	// An environment and what the lighting pass needs from it, USE_PROBE_SWITCHING only
+	struct ResidentProbe
+	{
+		uint32_t dirIdx; // into PROBE_BASE_DIRS
+		rj::helper_functions::ImageWrapper radianceMap;
+		rj::helper_functions::ImageWrapper specularIrradianceMap;
+		glm::vec3 diffuseSHCoefficients[9];
+		bool specMapReady = false;
+		bool shouldSaveSpecMap = false; // at exit, an evicted probe is prefiltered again when it is next loaded
+		std::string specMapCacheFileName;
+		uint64_t lastShownFrame = 0; // of @m_probeFrameCounter
+	};
+
+	// Decoded and projected onto SH on @m_probeJobs
+	struct PendingProbe
+	{
+		uint32_t dirIdx;
+		gli::texture_cube radianceMap;
+		gli::texture_cube specMap; // empty if it is not in the precompute cache
+		std::string specMapCacheFileName;
+		glm::vec3 diffuseSHCoefficients[9];
+		size_t job;
+	};
+
+	std::vector<ResidentProbe> m_residentProbes; // mirrored by m_scene.skybox while shown
+	uint32_t m_currentProbe = 0; // into @m_residentProbes
+	uint32_t m_requestedProbeDir = 0; // into PROBE_BASE_DIRS, shown once it is resident and prefiltered
+	uint32_t m_prefetchProbeDir = std::numeric_limits<uint32_t>::max(); // loaded and prefiltered once the requested one is, max if none
+	uint64_t m_probeFrameCounter = 0;
+	std::unique_ptr<PendingProbe> m_pendingProbe; // at most one, declared before @m_probeJobs so the job never outlives it
+	std::unique_ptr<JobPool> m_probeJobs;
+	// Prefiltering in steps of (mip, face) slices in mip order, one step in flight at a time
+	uint32_t m_prefilteringProbe = std::numeric_limits<uint32_t>::max(); // into @m_residentProbes
+	uint32_t m_probePrefilterNextSlice = 0; // mip * 6 + face of the first slice not submitted
+	uint32_t m_probePrefilterStepSlices = 0; // of the step in flight, 0 if there is none
+	uint64_t m_probePrefilterStepTexels = 0;
+	uint32_t m_probePrefilterCommandBuffer;
+	uint32_t m_probePrefilterFence;
+	uint32_t m_probePrefilterQueryPool;
+	std::unique_ptr<rj::VTextureStreamer> m_textureStreamer; // null without USE_TEXTURE_STREAMING
+	std::unique_ptr<rj::VSeparableBlur> m_separableBlur; // null without USE_COMPUTE_BLUR
+
+	// Virtual texturing with USE_VIRTUAL_TEXTURING. Per swapchain image: a copy of the page table, the first page and packed
+	// extent of every mesh map, the pages its geometry pass reported, and staging memory of the tiles its frame copies
+	std::unique_ptr<rj::VVirtualTextureCache> m_virtualTextures; // null without USE_VIRTUAL_TEXTURING
+	uint64_t m_virtualTextureFrame = 0; // frames that have updated the cache
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameVirtualPageTableBuffers;
+	std::vector<uint32_t *> m_perFrameVirtualPageTableMappedData;
+	std::vector<uint64_t> m_perFrameVirtualPageTableSyncedVersions;
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameVirtualMapBuffers; // VMesh::numMapsPerMesh uvec2 per mesh, see writeVirtualMaps()
+	std::vector<uint32_t *> m_perFrameVirtualMapMappedData;
+	std::vector<uint64_t> m_perFrameVirtualMapSyncedVersions; // @m_materialsVersion
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameVirtualFeedbackBuffers; // one page per block, max() if none
+	std::vector<uint32_t *> m_perFrameVirtualFeedbackMappedData;
+	uint32_t m_virtualFeedbackCountX = 0; // feedback blocks per side of the render extent
+	uint32_t m_virtualFeedbackCountY = 0;
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameVirtualStagingBuffers;
+	std::vector<void *> m_perFrameVirtualStagingMappedData;
+	std::vector<rj::VVirtualTextureCache::TileCopy> m_virtualTileCopies; // scratch of updateVirtualTextures()
+	std::vector<uint32_t> m_perFrameVirtualTextureQueryPools; // timestamps around the tile copies
+	std::vector<uint32_t> m_perFrameVirtualTileCopyCounts; // tiles copied by the frame of each image, 0 if none
+	std::vector<float> m_meshScreenSizes; // projected bounding sphere diameter in pixels of every mesh, 0 if culled
+
+	// Scratch memory of updateUniformHostData() and what it calls, reset at its start
+	FrameArena m_frameArena;
+	// Culling, cascade fitting and command recording tasks. Each frame waits for its tasks before it submits
+	TaskScheduler m_frameTasks = TaskScheduler(FRAME_TASK_THREAD_COUNT);
+
+	// Indices into @m_scene.meshes that survived frustum culling. All meshes in order with USE_GPU_CULLING
+	std::vector<uint32_t> m_visibleMeshes;
+	std::vector<std::vector<uint32_t>> m_visibleShadowCasters; // one list per shadow subpass
+	// What the culling, sorting and recording loops read of each mesh of @m_scene, packed so they walk one small array instead
+	// of the VMesh objects with their maps, buffers and transforms. The bounds are the BVH item boxes, the material sets are
+	// @m_perFrameDescriptorSets' lists, both indexed by the mesh as well. Rebuilt by updateDrawRecords() once
+	// @m_materialsVersion changes, which every mesh load, eviction and scene switch increments
+	struct DrawRecord
+	{
+		uint32_t firstIndices[MESH_LOD_COUNT]; // of each LOD, finest first
+		uint32_t indexCounts[MESH_LOD_COUNT];
+		uint32_t lodCount; // 0 until the mesh is loaded
+		int32_t vertexOffset; // the LODs share their vertices and index type
+		VkIndexType indexType;
+		uint32_t materialKey; // see getGeomPipelineVariant()
+		uint32_t firstInstance; // in the instance buffers, only used with USE_INSTANCING
+		uint32_t instanceCount;
+	};
+	std::vector<DrawRecord> m_drawRecords;
+	uint64_t m_drawRecordsVersion = 0; // @m_materialsVersion they were built for
+
+	// LOD of every mesh, selected from its projected size. Not used with USE_GPU_CULLING
+	std::vector<uint32_t> m_meshLods;
+	std::vector<std::vector<uint32_t>> m_shadowCasterLods; // one list per shadow subpass
+	// Meshes drawn as impostors instead, in the camera and in each shadow subpass. Only used with USE_IMPOSTORS
+	std::vector<uint32_t> m_impostorMeshes;
+	std::vector<std::vector<uint32_t>> m_impostorShadowCasters;
+	static const uint32_t IMPOSTOR_LOD = std::numeric_limits<uint32_t>::max(); // marks them in the LOD lists of updateVisibility()
+	uint64_t m_visibilityVersion = 0; // incremented whenever the lists above or @m_shadowCascadeUpdateMask change
+	// Instances of the impostors, written by writeImpostorInstances() for the lists above: the camera's, then each subpass's
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameImpostorInstanceBuffers;
+	std::vector<ImpostorInstance *> m_perFrameImpostorInstanceMappedData;
+	std::vector<glm::uvec2> m_impostorDrawRanges; // first instance and count of each list
+	// Transform rewrites of every mesh, saturating at 2. The first one is its initial upload, meshes with a second are dynamic
+	std::vector<uint8_t> m_meshTransformUpdateCounts;
+	bool isMeshDynamic(uint32_t j) const { return j < m_meshTransformUpdateCounts.size() && m_meshTransformUpdateCounts[j] > 1; }
+
+#ifdef USE_MULTI_VIEW
+	// Part of the render extent and camera of one view. View 0 uses m_camera and the lists above
+	struct RenderView
+	{
+		glm::vec4 rect; // top left and size as fractions of the render extent
+		glm::mat4 V;
+		glm::mat4 P;
+		glm::vec3 eyeWorldPos;
+		std::vector<uint32_t> visibleMeshes; // front to back
+	};
+	RenderView m_views[MAX_VIEW_COUNT];
+	uint32_t m_viewCount = 1;
+
+	void updateViews(); // layout, and the matrices of the orthographic views
+	const std::vector<uint32_t> &getViewMeshes(uint32_t viewIdx) const { return viewIdx == 0 ? m_visibleMeshes : m_views[viewIdx].visibleMeshes; }
+	// Viewport and scissor of the view, scaled by the render scale, and its index for the *_multi_view shaders
+	void cmdBeginView(uint32_t cb, uint32_t framebuffer, uint32_t pipelineLayout, VkShaderStageFlags stage, uint32_t viewIdx) const;
+#endif
+
+	// Shadow map caching. Cascades are kept from previous frames unless their matrix changed or a caster moved
+	std::vector<glm::mat4> m_shadowCascadeCachedVPs; // matrix each cascade was last rendered with
+	uint32_t m_shadowCascadeValidMask = 0; // bit i is set once cascade i has been rendered into the current shadow image
+	uint32_t m_shadowCascadeUpdateMask = 0; // bit i is set if cascade i is rendered this frame
+	ShadowAtlas m_shadowAtlas = ShadowAtlas(SHADOW_ATLAS_SIZE, SHADOW_ATLAS_MIN_TILE_SIZE, SHADOW_ATLAS_MAX_TILE_SIZE); // one tile per cascade
+	uint64_t m_shadowFrameCounter = 0;
+	glm::vec2 m_cascadeFitRange = glm::vec2(0.f); // quantized view depth range the splits were last fitted to with USE_ADAPTIVE_CASCADES
+	uint32_t m_cascadeFitCount = 0;
+
+	// Virtual shadow maps with USE_VIRTUAL_SHADOW_MAP, the cascades are the layers of the sparse @m_shadowImage
+	std::unique_ptr<VirtualShadowMap> m_virtualShadowMap; // its page table, made with the image
+	uint64_t m_virtualShadowFrame = 0; // updates of the page table
+	std::vector<VkRect2D> m_shadowCascadeScissors; // bounds of the dirty pages of each cascade in texels, drawn when it is updated
+	std::vector<glm::mat4> m_shadowCascadeCullVPs; // the cascade matrices narrowed to the scissors, casters are culled against them
+	// One host visible buffer of page request bits per swapchain image, written by its page mark pass
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameShadowPageRequestBuffers;
+	std::vector<uint32_t *> m_perFrameShadowPageRequestMappedData;
+	std::vector<uint32_t> m_shadowPageBinds; // scratch of updateVirtualShadowPages()
+	std::vector<uint32_t> m_shadowPageUnbinds;
+
+	// Ray query shadows with USE_RAY_QUERY_SHADOWS, on devices that have them
+	bool m_useRayQueryShadows = false;
+	enum TlasBuild
+	{
+		TLAS_BUILD_NONE, // the structure is up to date
+		TLAS_BUILD_REFIT,
+		TLAS_BUILD_FULL
+	};
+	std::vector<uint32_t> m_meshBlases; // bottom level structure of each mesh, max() until it is loaded
+	uint64_t m_rayQueryInstancesVersion = 0; // incremented when an instance moves or a mesh gets its structure
+	uint32_t m_rayQueryInstanceCount = 0; // of all meshes, loaded or not
+	// One top level structure and host visible VkAccelerationStructureInstanceKHR buffer per swapchain image
+	std::vector<uint32_t> m_perFrameTlases;
+	std::vector<rj::helper_functions::BufferWrapper> m_perFrameTlasInstanceBuffers;
+	std::vector<char *> m_perFrameTlasInstanceMappedData;
+	std::vector<uint64_t> m_perFrameTlasSyncedVersions;
+	std::vector<uint32_t> m_perFrameTlasInstanceCounts; // instances of loaded meshes written to the buffer
+	std::vector<uint32_t> m_perFrameTlasRefitCounts; // since the last full build
+	std::vector<TlasBuild> m_perFrameTlasBuilds; // recorded into the image's next frame
+
+	// Binds issued and skipped by rj::VBindCache when the scene draws were last recorded. Updated by all recording threads
+	struct BindCounters
+	{
+		std::atomic<uint32_t> issued{ 0 };
+		std::atomic<uint32_t> skipped{ 0 };
+
+		void add(const rj::VBindCache &cache) { issued += cache.getIssuedCount(); skipped += cache.getSkippedCount(); }
+		void reset() { issued = 0; skipped = 0; }
+	};
+	BindCounters m_geomPassBinds;
+	BindCounters m_shadowPassBinds;
 
 
 	virtual void createQueryPools();
+	virtual void buildRenderGraph();
 	virtual void createRenderPasses();
 	virtual void createDescriptorSetLayouts();
 	virtual void createComputePipelines();
@@ -278,6 +1910,8 @@ protected:
 	virtual void createComputeResources();
 	virtual void createDepthResources();
 	virtual void createColorAttachmentResources();
+	virtual void createDepthImage();
+	virtual void createGBufferImages();
 	virtual void loadAndPrepareAssets();
 	virtual void createUniformBuffers();
 	virtual void createDescriptorPools();
@@ -288,16 +1922,45 @@ protected:
 
 	virtual void updateUniformHostData();
 	virtual void updateUniformDeviceData(uint32_t imgIdx);
+	virtual void updateVisibility();
+	void updateDrawRecords(); // rebuild @m_drawRecords if the meshes changed since they were built
+	void createSkinningResources(); // copies of the animated vertices and the buffers the skinning pass reads
+	bool updateAnimation(); // sample the clip into @m_jointMatrices and the pose weights, false if nothing is animated
+	bool fitCascadesToVisibleDepth(); // true if the splits have changed
 	virtual void updateText(uint32_t imageIdx) override;
 	virtual void drawFrame();
+	virtual void recreateSwapChain() override;
+	virtual void resetTemporalState() override;
+#ifdef USE_DEVICE_GROUP
+	void selectFrameDeviceState(); // swap in the temporal state of the device the next frame renders on
+#endif
+	virtual bool needsFrame() const override;
+	virtual void onIdleEnd() override;
+	virtual void waitForFramePacing() override;
+	virtual void applySampleCount(VkSampleCountFlagBits sampleCount); // rebuilds multisampled attachments and the pipelines using them
+	virtual void applyHalfPrecision(bool enable); // rebuilds the pipelines with *_fp16 variants and the command buffers binding them
+	std::string getPrecisionSuffix() const { return m_halfPrecisionShaders ? "_fp16" : ""; }
 
 	// Helpers
 	virtual void createSpecEnvPrefilterRenderPass();
 	virtual void createGeometryRenderPass();
+	virtual void createGeometryLateRenderPass();
+	// Attachments and subpass of USE_DEPTH_RESOLVE shared by the geometry passes, which must stay compatible. Add the resolved
+	// depth images, which come after the G-buffers and motion vectors, and return how many
+	uint32_t addDepthResolveAttachments();
+	// After the geometry subpass, the one that resolves the farthest sample if getDepthMaxResolveMode() does
+	void addDepthMaxResolveSubpass();
+	// Index of the first resolved depth attachment of the geometry passes
+	uint32_t getResolvedDepthAttachmentIdx() const;
+	virtual void createDepthPrepassRenderPass();
 	virtual void createShadowRenderPass();
 	virtual void createLightingRenderPass();
 	virtual void createBloomRenderPasses();
 	virtual void createFinalOutputRenderPass();
+	virtual void createTaaRenderPass();
+	virtual void createLightingUpsampleRenderPass();
+	virtual void createProbeCaptureRenderPass();
+	virtual void createImpostorBakeRenderPass();
 
 	virtual void createBrdfLutDescriptorSetLayout();
 	virtual void createSpecEnvPrefilterDescriptorSetLayout();
@@ -308,16 +1971,57 @@ protected:
 	virtual void createLightingPassDescriptorSetLayout();
 	virtual void createBloomDescriptorSetLayout();
 	virtual void createFinalOutputDescriptorSetLayout();
+	virtual void createLightCullingDescriptorSetLayout();
+	virtual void createShadowPageMarkDescriptorSetLayout();
+	virtual void createSsaoDescriptorSetLayout();
+	virtual void createShadingRateDescriptorSetLayout();
+	virtual void createMaterialDescriptorSetLayout();
+	virtual void createTaaDescriptorSetLayout();
+	virtual void createLightingUpsampleDescriptorSetLayout();
+	virtual void createGpuCullingDescriptorSetLayout();
+	virtual void createHiZDescriptorSetLayout();
+	virtual void createMeshletDescriptorSetLayout();
+	virtual void createVertexPullingDescriptorSetLayout();
+	virtual void createSkinningDescriptorSetLayout();
+	virtual void createColorLutDescriptorSetLayout();
+	virtual void createAutoExposureDescriptorSetLayout();
+	virtual void createShadowMomentDescriptorSetLayout();
+	virtual void createSeparableBlur();
+	virtual void createBloomComputeDescriptorSetLayout();
+	virtual void createShProjectionDescriptorSetLayout();
+	virtual void createProbeVolumeDescriptorSetLayouts();
+	virtual void createImpostorDescriptorSetLayout();
 
 	virtual void createBrdfLutPipeline();
 	virtual void createSpecEnvPrefilterPipeline();
 	virtual void createSkyboxPipeline();
 	virtual void createStaticMeshPipeline();
 	virtual void createGeomPassPipeline();
+	virtual void createDepthPrepassPipeline();
 	virtual void createShadowPassPipeline();
 	virtual void createLightingPassPipeline();
+	virtual void createSkyMaskPipeline();
+	virtual void createMsaaClassificationPipeline();
 	virtual void createBloomPipelines();
 	virtual void createFinalOutputPassPipeline();
+	virtual void createLightCullingPipeline();
+	virtual void createShadowPageMarkPipeline();
+	virtual void createSsaoPipelines();
+	virtual void createShadingRatePipeline();
+	virtual void createMaterialPipeline();
+	virtual void createTaaPipeline();
+	virtual void createLightingUpsamplePipeline();
+	virtual void createGpuCullingPipeline();
+	virtual void createSkinningPipeline();
+	virtual void createColorLutPipeline();
+	virtual void createAutoExposurePipelines();
+	virtual void createHiZPipelines();
+	virtual void createShadowMomentPipelines();
+	virtual void createBloomComputePipelines();
+	virtual void createShProjectionPipelines();
+	virtual void createProbeCapturePipeline();
+	virtual void createImpostorPipelines();
+	virtual void createProbeProjectionPipeline();
 
 	// Descriptor sets cannot be altered once they are bound until execution of all related
 	// commands complete. So each model will need a different descriptor set because they use
@@ -325,22 +2029,192 @@ protected:
 	virtual void createBrdfLutDescriptorSet();
 	virtual void createSpecEnvPrefilterDescriptorSet();
 	virtual void createSkyboxDescriptorSet();
+	void writeSkyboxDescriptorSet(uint32_t imgIdx);
+	// Storage image of mip @level of @specMap and sampled @radianceMap in m_specEnvPrefilterMipDescriptorSets[@level]
+	void writeSpecEnvPrefilterMipDescriptorSet(uint32_t level, const rj::helper_functions::ImageWrapper &radianceMap,
+		const rj::helper_functions::ImageWrapper &specMap);
 	virtual void createStaticMeshDescriptorSet();
+	void writeStaticMeshDescriptorSet(uint32_t imgIdx, uint32_t meshIdx);
 	virtual void createGeomPassDescriptorSets();
 	virtual void createShadowPassDescriptorSets();
 	virtual void createLightingPassDescriptorSets();
 	virtual void createBloomDescriptorSets();
 	virtual void createFinalOutputPassDescriptorSets();
+	virtual void createLightCullingDescriptorSets();
+	virtual void createShadowPageMarkDescriptorSets();
+	virtual void createSsaoDescriptorSets();
+	virtual void createShadingRateDescriptorSet();
+	virtual void createMaterialDescriptorSets();
+	// Maps of all meshes for a texture array, VMesh::numMapsPerMesh per mesh in mesh order. Throws if they exceed MAX_BINDLESS_TEXTURES
+	std::vector<rj::DescriptorSetUpdateImageInfo> getMaterialTextureInfos() const;
+	virtual void createTaaDescriptorSets();
+	virtual void createLightingUpsampleDescriptorSets();
+	virtual void createGpuCullingDescriptorSets();
+	virtual void createHiZDescriptorSets();
+	virtual void createMeshletDescriptorSets();
+	virtual void createVertexPullingDescriptorSets();
+	virtual void createSkinningDescriptorSets();
+	virtual void createShadowMomentDescriptorSets();
+	virtual void createBloomComputeDescriptorSets();
+	virtual void createShProjectionDescriptorSet();
+	virtual void createProbeVolumeDescriptorSets();
+	virtual void createImpostorDescriptorSets();
+	virtual void createColorLutDescriptorSet();
+	virtual void createAutoExposureDescriptorSets();
 
 	virtual void createBrdfLutCommandBuffer();
 	virtual void createEnvPrefilterCommandBuffer();
-	virtual void createGeomShadowLightingCommandBuffers();
-	virtual void createPostEffectCommandBuffers();
-	virtual void createPresentCommandBuffers();
+	// Prefilter @faceCount faces from @firstFace on of mip @level, with the compute prefilter pipeline bound
+	void recordSpecEnvPrefilterDispatch(uint32_t cb, uint32_t level, uint32_t mipLevelCount, uint32_t width, uint32_t firstFace, uint32_t faceCount);
+	virtual void createShProjectionCommandBuffer();
+	virtual void createProbeVolumeCommandBuffer();
+	virtual void createImpostorBakeCommandBuffer();
+	virtual void initVisibleMeshes(); // draw lists that hold every mesh, until the first culling result is available
+	virtual void recordGeomShadowLightingCommandBuffer(uint32_t imgIdx, uint32_t cb, VkCommandBufferUsageFlags usage);
+	// @viewIdx is only used with USE_MULTI_VIEW
+	virtual void recordGeomPassDraws(uint32_t cb, uint32_t imgIdx, const uint32_t *meshes, uint32_t meshCount, bool drawSkybox, uint32_t drawList = 0,
+		bool depthEqual = false, uint32_t viewIdx = 0);
+	virtual void recordDepthPrepassDraws(uint32_t cb, uint32_t imgIdx, const uint32_t *meshes, uint32_t meshCount, uint32_t viewIdx = 0);
+	virtual void recordLightCulling(uint32_t cb, uint32_t imgIdx);
+	virtual void recordShadowPageMark(uint32_t cb, uint32_t imgIdx);
+	// Environment mip count, cascade count and PCF kernel size the lighting, or with USE_FORWARD_PLUS the geometry, fragment shaders take
+	void pushLightingConstants(uint32_t cb, uint32_t pipelineLayout, uint32_t offset);
+	virtual void recordSsao(uint32_t cb, uint32_t imgIdx);
+	virtual void recordShadingRate(uint32_t cb);
+	virtual void recordMaterialPass(uint32_t cb, uint32_t imgIdx);
+	// Pixels per texel of m_shadingRateImage, VRS_TEXEL_SIZE clamped to what the device supports
+	VkExtent2D getShadingRateTexelSize() const;
+	// Modes the geometry pass resolves m_resolvedDepthImage and m_resolvedDepthMaxImage with, VK_RESOLVE_MODE_NONE_KHR if it does not
+	VkResolveModeFlagBitsKHR getDepthResolveMode() const;
+	VkResolveModeFlagBitsKHR getDepthMaxResolveMode() const;
+	// Single sampled depth image the compute passes read, m_depthImage if it is not resolved
+	const rj::helper_functions::ImageWrapper &getSampledDepthImage(bool farthest = false) const;
+	virtual void recordGpuCulling(uint32_t cb, uint32_t imgIdx, bool latePhase = false);
+	virtual void recordMeshletCulling(uint32_t cb, uint32_t imgIdx, bool latePhase);
+	virtual void recordSkinning(uint32_t cb, uint32_t imgIdx);
+	// Vertex offset that draws of mesh @j, whose LODs start at @vertexOffset, use in frame @imgIdx. Animated meshes are drawn
+	// from that frame's copy of their vertices
+	int32_t getDrawVertexOffset(uint32_t j, int32_t vertexOffset, uint32_t imgIdx) const;
+	virtual void recordHiZBuild(uint32_t cb);
+	virtual void recordShadowMoments(uint32_t cb); // of the cascades updated this frame
+	virtual void recordShadowPassDraws(uint32_t cb, uint32_t imgIdx, uint32_t cascadeIdx, const uint32_t *meshes, uint32_t meshCount, bool clear);
+	virtual void recordSceneSecondaryCommandBuffers(uint32_t imgIdx, bool depthPrepass);
+	// One per recording thread, after as many static ones with USE_STATIC_SECONDARIES. Returns their count
+	uint32_t getSceneSecondaryCommandBuffers(uint32_t imgIdx, uint32_t passIdx, uint32_t *pCbs) const;
+	virtual void recordTaaResolve(uint32_t cb, uint32_t imgIdx);
+	virtual void recordLightingUpsample(uint32_t cb, uint32_t imgIdx);
+	virtual void recordComputeBloom(uint32_t cb, uint32_t imgIdx);
+	virtual void recordAutoExposure(uint32_t cb, uint32_t imgIdx);
+	// One half of handing @imageName between the graphics and compute queue families with USE_ASYNC_COMPUTE.
+	// @stages and @access are the source scope of a release and the destination scope of an acquire
+	virtual void recordQueueOwnershipTransfer(uint32_t cb, uint32_t imageName, VkImageLayout layout, bool toCompute, bool release,
+		VkPipelineStageFlags stages, VkAccessFlags access);
+	virtual void recordPostEffectCommandBuffer(uint32_t imgIdx);
+	virtual void createBloomComputeCommandBuffers();
+	virtual void recordPresentCommandBuffer(uint32_t imgIdx);
+	// Record the bake of the color LUT into this image's m_colorLutCommandBuffer if @m_colorGrading has changed since the last one.
+	// Returns true if it has to be submitted ahead of the present command buffer
+	bool updateColorLut(uint32_t imgIdx);
+	// Read back the pages the image's last frame reported, update the cache and the image's copy of the page table, and record the
+	// tiles to copy into this image's m_virtualTextureCommandBuffer. Returns true if it has to be submitted ahead of the geometry pass
+	bool updateVirtualTextures(uint32_t imgIdx);
+	void writeVirtualMaps(uint32_t imgIdx); // first page and packed extent of every mesh map, max() for the maps bound whole
+	// Re-record the pre-recorded command buffers of swapchain image @imgIdx whose dirty bits are set, before it is submitted
+	virtual void recordDirtyCommandBuffers(uint32_t imgIdx);
 
 	virtual void prefilterEnvironmentAndComputeBrdfLut();
+	void updateIblPrecomputation(bool wait); // finish what has completed, or wait for all of it
+	// The pipelines, render pass, framebuffers and descriptor sets of the startup bakes exist only while a bake is to run, none
+	// if the results were loaded from PRECOMPUTE_CACHE_DIR, and are destroyed once it is done
+	bool isSpecEnvPrefilterNeeded() const; // always with USE_PROBE_SWITCHING, which prefilters every probe it loads
+	void destroyBrdfLutBakeResources();
+	void destroySpecEnvPrefilterResources();
+	void createProbeVolumeResources();
+	void createImpostorResources(); // assigns the atlas layers and creates the atlases
+	void createColorLutResources();
+	void createAutoExposureResources();
+	void bakeProbeVolume(); // capture and project all probes, blocks until they are done
+	void bakeImpostors(); // renders every view of every impostor, blocks until they are done
+	void writeImpostorInstances(uint32_t imgIdx); // instances of m_impostorMeshes and m_impostorShadowCasters, sets m_impostorDrawRanges
+	void writeLightingIblDescriptors(uint32_t imgIdx); // specular map and BRDF LUT, or their fallbacks
+	// Specular map and SH cache files of @probeFileName, keyed by a hash of its contents. Opens the file, so it may take a while,
+	// unless *@pProbeHash holds the hash already. Otherwise it is returned there if given
+	static void getProbeCacheFileNames(const std::string &probeFileName, std::string *pSpecMapFileName, std::string *pDiffuseSHFileName,
+		uint64_t *pProbeHash = nullptr);
+	// Key of SCENE_FILE_NAME: the model names and the sizes of the files the scene is described by, which are cheap to get
+	static uint64_t getSceneFileKey(const std::string &skyboxFileName, const std::string &probeFileName);
+	void updateProbeSwitching(); // handle E, load, prefilter, show and evict probes
+	void makeProbeResident(PendingProbe &pending);
+	void updateProbePrefilter(); // finish the step in flight and submit the next one
+	void showProbe(uint32_t probeIdx);
+	void evictProbes();
+	void destroyProbe(ResidentProbe &probe);
 	virtual void savePrecomputationResults();
+	// File of PRECOMPUTE_CACHE_DIR holding @stem baked from the inputs hashed into @key
+	static std::string getPrecomputeCacheFileName(const std::string &stem, uint64_t key, const std::string &extension);
+	virtual void saveFrameStatistics() const;
+	void reportStartupProfile() const; // print and save the phase times once startup is done
+	void createPlaceholderMaps();
+	void loadSyntheticScene(); // generate m_syntheticScene in place of the models
+	bool startABComparison(); // false if m_abToggles is not valid
+	void stopABComparison();
+	void updateABComparison(); // handles the B key and holds the camera, before the frame's uniforms are updated
+	void addABFrame(float cpuFrameTimeMS); // after the frame's GPU times are collected
+	void applyABConfig(const ABConfig &config);
+	void updateStreamingAssets(); // upload a model whose files are decoded, at most one per frame
+	static ModelFiles getModelFiles(const std::string &name); // looks for the optional maps
+	std::unique_ptr<PendingModel> addModelJobs(const ModelFiles &files, JobPool *pJobs);
+	void setPlaceholderMaps(VMesh *pMesh, const ModelFiles &files); // the optional ones only if @files has them
+	void updateWorldPartition(); // load the cells around the camera and the cascades, evict distant ones over the budget
+	void evictWorldMesh(uint32_t meshIdx);
+	void retireMesh(uint32_t meshIdx); // unload it, its maps and geometry are freed once no frame in flight draws it
+	void freeRetiredMeshes();
+	void updateSceneHotSwap(); // handles the N key and drops the abandoned models whose jobs are done
+	void updateTextureStreaming(); // request the mip levels the visible meshes need and apply what the streamer changed
+	virtual void mainLoop();
+	void runBenchmark();
+	void runBatch();
+	void runFarmWorker();
+	void runCommandReplay();
+	void warmUpPipelines(); // see m_warmUpPipelines
+	void beginRequestedCommandCapture();
+	void finishCommandCapture(uint32_t imgIdx);
+	std::unique_ptr<rj::VCommandCapture> m_pCommandCapture; // while a frame is captured
+	uint32_t m_commandCaptureSettledFrames = 0; // rendered since the scene has loaded
+	// m_benchmarkSummary of the pass times of the measured frames and m_frameStatistics
+	void summarizeBenchmark(const std::vector<std::string> &passPaths, const std::unordered_map<std::string, std::vector<float>> &passTimes);
+	// @outputWritten is called by the writer thread after each output file, if set
+	void renderJobs(const RenderJobList &jobs, JobPool *pWriters, const std::function<void(const std::string &)> &outputWritten);
+	bool saveBenchmarkResults(const std::vector<std::string> &passPaths, const std::unordered_map<std::string, std::vector<float>> &passTimes) const;
+	void startRequestedTraceCapture();
+	void recordFrameCapture(uint32_t imgIdx); // copies the final image into a readback buffer and into the external sink
+	uint64_t m_frameCaptureIndex = 0; // of the next captured frame
+	uint32_t m_externalImageIdx = std::numeric_limits<uint32_t>::max(); // written by the last recordFrameCapture(), max if none
+	void addGpuTraceEvents(); // of the frame collected last by m_gpuProfiler, on the CPU timeline
 
 	virtual VkFormat findDepthFormat();
+	// Depth aspect of findDepthFormat(), of the images the depth is resolved into
+	VkFormat getResolvedDepthFormat();
+	virtual VkFormat findStencilFormat();
+	VkFormat findShadowDepthFormat(); // findDepthFormat(), or D16_UNORM with USE_SHADOW_D16 where it is supported
+	VkSampleCountFlagBits clampSampleCount(VkSampleCountFlagBits sampleCount) const;
+	VkExtent2D getRenderExtent() const; // extent of the geometry and lighting passes, smaller than the swapchain with TAA_RENDER_SCALE < 1
+	VkExtent2D getLightingExtent() const; // extent the lighting pass shades at, half the render extent with USE_HALF_RES_LIGHTING
+	uint32_t getShadowSubpassCount() const; // one per cascade, or one in total with USE_LAYERED_SHADOW_PASS
+	uint32_t getIndirectDrawListCount() const; // of @m_indirectDrawBuffer
+	// Stages reading the transforms of the geometry and shadow sets: the vertex shaders, and the mesh shaders of USE_MESHLETS
+	VkShaderStageFlags getVertexStages() const;
+	uint32_t selectLod(float coverage, uint32_t lodCount) const; // @coverage: bounding sphere diameter over the screen height
+	uint32_t getGeomPipelineVariant(const VMesh &mesh) const; // packs the material type and which optional maps @mesh has
+	bool isShadowSubpassUpdated(uint32_t subpassIdx) const; // false if the subpass keeps its cached shadow maps this frame
+	// Build the structures of newly loaded meshes and write the image's instances if they changed, see m_perFrameTlasBuilds
+	void updateRayQueryInstances(uint32_t imgIdx);
+	// Bind the pages requested by the frames read back so far, invalidate the pages of changed cascades and under the
+	// @movedCasterBoxes, and return the mask of the cascades with dirty pages. Sets their scissors and culling matrices
+	uint32_t updateVirtualShadowPages(rj::ArrayView<glm::mat4> cascadeVPs, uint32_t changedMask, rj::ArrayView<BBox> movedCasterBoxes);
+	std::string getShadowSubpassScopeName(uint32_t subpassIdx) const; // GPU profiler scope under "shadow"
+	// Lazily allocated if image.isTransient, aliased if m_renderGraph lets @graphImage share memory
+	uint32_t createAttachmentImage2D(const rj::helper_functions::ImageWrapper &image, VkImageUsageFlags usage,
+		uint32_t graphImage = rj::VRenderGraph::INVALID_NAME);
 };
 
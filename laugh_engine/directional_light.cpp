@@ -19,16 +19,24 @@ DirectionalLight::DirectionalLight(
 }
 
 void DirectionalLight::computeCascadeScalesAndOffsets(
-	const std::vector<glm::vec3>& frustumCorners, const std::vector<float> &cascadeDepths,
+	rj::ArrayView<glm::vec3> frustumCorners, rj::ArrayView<float> cascadeDepths,
 	const glm::vec3 &sceneAABBMin, const glm::vec3 &sceneAABBMax, uint32_t shadowMapDim)
+{
+	computeCascadeScalesAndOffsets(frustumCorners, cascadeDepths, sceneAABBMin, sceneAABBMax,
+		rj::ArrayView<uint32_t>(&shadowMapDim, 1));
+}
+
+void DirectionalLight::computeCascadeScalesAndOffsets(
+	rj::ArrayView<glm::vec3> frustumCorners, rj::ArrayView<float> cascadeDepths,
+	const glm::vec3 &sceneAABBMin, const glm::vec3 &sceneAABBMax, rj::ArrayView<uint32_t> shadowMapDims)
 {
 	assert(frustumCorners.size() >= 8 && (frustumCorners.size() - 4) % 4 == 0);
 	
-	const float fShadowMapDim = static_cast<float>(shadowMapDim);
-	const uint32_t cascadeCount = (frustumCorners.size() - 4) >> 2;
+	const uint32_t cascadeCount = static_cast<uint32_t>(frustumCorners.size() - 4) >> 2;
 	cascadeScales.resize(cascadeCount);
 	cascadeOffsets.resize(cascadeCount);
-	assert(cascadeDepths.size() == cascadeCount);
+	cascadeReceiverNearZs.resize(cascadeCount);
+	assert(cascadeDepths.size() == cascadeCount && (shadowMapDims.size() == 1 || shadowMapDims.size() == cascadeCount));
 
 	glm::vec4 worldSpaceSceneAABBCorners[8] =
 	{
@@ -52,6 +60,8 @@ void DirectionalLight::computeCascadeScalesAndOffsets(
 
 	for (uint32_t cascadeIdx = 0; cascadeIdx < cascadeCount; ++cascadeIdx)
 	{
+		const float fShadowMapDim = static_cast<float>(shadowMapDims[shadowMapDims.size() == 1 ? 0 : cascadeIdx]);
+
 		// Define a AABB of the current cascade in light's view space
 		glm::vec3 lightViewSpaceMin(std::numeric_limits<float>::max());
 		glm::vec3 lightViewSpaceMax(-std::numeric_limits<float>::max());
@@ -77,6 +87,10 @@ void DirectionalLight::computeCascadeScalesAndOffsets(
 		lightViewSpaceMin -= padding;
 		lightViewSpaceMax += padding;
 
+		// In steps of a sixteenth of the fixed size, so that it does not change the matrix for small camera movements either
+		const float receiverStep = diagLen / 16.f;
+		cascadeReceiverNearZs[cascadeIdx] = fmin(std::ceil(lightViewSpaceMax.z / receiverStep) * receiverStep, fZNear);
+
 		// Pad X and Y so that PCF kernel will not sample outside of shadow maps
 		float pcfPaddingTexelCount = static_cast<float>(pcfKernelSize >> 1);
 		glm::vec2 worldUnitsPerTexel = glm::vec2(lightViewSpaceMax - lightViewSpaceMin);
@@ -105,6 +119,21 @@ void DirectionalLight::computeCascadeScalesAndOffsets(
 	}
 }
 
+void DirectionalLight::fitCascadeNearPlane(uint32_t cascadeIdx, float lightViewZ)
+{
+	assert(cascadeIdx < cascadeScales.size());
+
+	auto &scale = cascadeScales[cascadeIdx];
+	auto &offset = cascadeOffsets[cascadeIdx];
+	// Light view z of the near and far planes, which map to 0 and 1
+	const float nearZ = -offset.z / scale.z;
+	const float farZ = nearZ + 1.f / scale.z;
+
+	const float newNearZ = fmax(fmin(lightViewZ, nearZ), farZ + 1e-3f * (nearZ - farZ));
+	scale.z = -1.f / (newNearZ - farZ);
+	offset.z = -newNearZ * scale.z;
+}
+
 void DirectionalLight::setPosition(const glm::vec3 &newPos)
 {
 	setPositionAndDirection(newPos, direction);
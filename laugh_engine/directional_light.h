@@ -4,6 +4,7 @@
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include "glm/glm.hpp"
+#include "VArrayView.h"
 
 
 class DirectionalLight
@@ -19,8 +20,15 @@ public:
 	// In @frustumCorners, corners of a far plane are reused as corners of the near
 	// plane of the next cascade.
 	void computeCascadeScalesAndOffsets(
-		const std::vector<glm::vec3> &frustumCorners, const std::vector<float> &cascadeDepths,
+		rj::ArrayView<glm::vec3> frustumCorners, rj::ArrayView<float> cascadeDepths,
 		const glm::vec3 &sceneAABBMin, const glm::vec3 &sceneAABBMax, uint32_t shadowMapDim);
+	// Same with a shadow map size per cascade, e.g. of its tile in a shadow atlas, or a single one for all of them
+	void computeCascadeScalesAndOffsets(
+		rj::ArrayView<glm::vec3> frustumCorners, rj::ArrayView<float> cascadeDepths,
+		const glm::vec3 &sceneAABBMin, const glm::vec3 &sceneAABBMax, rj::ArrayView<uint32_t> shadowMapDims);
+	// Pull the near plane of a cascade in to light view space depth @lightViewZ, e.g. of the nearest caster it draws.
+	// It never moves out beyond the scene bounds or past the far plane
+	void fitCascadeNearPlane(uint32_t cascadeIdx, float lightViewZ);
 
 	void setPosition(const glm::vec3 &newPos);
 	void setDirection(const glm::vec3 &newDir);
@@ -31,6 +39,10 @@ public:
 
 	const glm::mat4 &getViewMatrix() const { return V; }
 	void getCascadeViewProjMatrix(uint32_t cascadeIdx, glm::mat4 *lightVP) const;
+	float getCascadeWidth(uint32_t cascadeIdx) const { return 2.f / cascadeScales[cascadeIdx].x; } // in world units
+	// Light view space depth of the point of the cascade's frustum slice nearest to the light, snapped outwards in steps
+	float getCascadeReceiverNearZ(uint32_t cascadeIdx) const { return cascadeReceiverNearZs[cascadeIdx]; }
+	const glm::vec3 &getPosition() const { return position; }
 	const glm::vec3 &getColor() const { return color; }
 	const glm::vec3 &getDirection() const { return direction; }
 	bool castShadow() const { return bCastShadow; }
@@ -46,6 +58,7 @@ protected:
 
 	std::vector<glm::vec3> cascadeScales;
 	std::vector<glm::vec3> cascadeOffsets;
+	std::vector<float> cascadeReceiverNearZs;
 
 	void recomputeViewMatrix();
 };
\ No newline at end of file
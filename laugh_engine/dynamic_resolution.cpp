@@ -0,0 +1,59 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+DynamicResolutionController::DynamicResolutionController(float targetMS, float headroom, float minScale, uint32_t stepCount,
+	uint32_t raiseFrameCount)
+	:
+	targetMS(targetMS),
+	headroom(headroom),
+	minScale(minScale),
+	stepCount(std::max(stepCount, 1u)),
+	raiseFrameCount(raiseFrameCount),
+	step(this->stepCount)
+{
+}
+
+bool DynamicResolutionController::addFrame(float gpuMS, float renderedScale)
+{
+	if (gpuMS <= 0.f) return false;
+
+	const uint32_t prevStep = step;
+	const float budgetMS = targetMS * headroom;
+	if (gpuMS > budgetMS)
+	{
+		// Largest step whose pixel count would have fit. Frames still in flight at an older, larger scale ask for
+		// the same or a higher step, so a spike only lowers the scale once
+		const float fitScale = renderedScale * std::sqrt(budgetMS / gpuMS);
+		const float fitStep = std::floor((fitScale - minScale) / (1.f - minScale) * stepCount);
+		step = std::min(step, static_cast<uint32_t>(std::max(fitStep, 0.f)));
+		framesBelowNextStep = 0;
+	}
+	else if (step < stepCount && renderedScale == getScale())
+	{
+		// Only frames at the current scale tell whether the next one fits
+		const float nextScale = stepToScale(step + 1);
+		const float nextMS = gpuMS * (nextScale * nextScale) / (renderedScale * renderedScale);
+		framesBelowNextStep = nextMS <= budgetMS ? framesBelowNextStep + 1 : 0;
+		if (framesBelowNextStep >= raiseFrameCount)
+		{
+			++step;
+			framesBelowNextStep = 0;
+		}
+	}
+
+	return step != prevStep;
+}
+
+void DynamicResolutionController::reset()
+{
+	step = stepCount;
+	framesBelowNextStep = 0;
+}
+
+float DynamicResolutionController::stepToScale(uint32_t s) const
+{
+	return minScale + (1.f - minScale) * static_cast<float>(s) / static_cast<float>(stepCount);
+}
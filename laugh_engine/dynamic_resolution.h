@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+
+// Picks the scale of the render resolution from the measured GPU frame times to keep them under a target. The GPU time
+// is taken to grow with the pixel count, so a frame over the budget lowers the scale at once to what would have met
+// it. The scale only rises by one step after a run of frames that would still meet the budget at the next step, which
+// keeps it from flipping between two steps. Scales are quantized to a few steps so command buffers recorded at one
+// are reused until it changes
+class DynamicResolutionController
+{
+public:
+	DynamicResolutionController(float targetMS = 16.6f, float headroom = 0.9f, float minScale = 0.5f,
+		uint32_t stepCount = 10, uint32_t raiseFrameCount = 30);
+
+	// @gpuMS of a frame rendered at @renderedScale, which lags the current scale by the frames in flight.
+	// A negative @gpuMS marks the time as unknown and is ignored. Return true if the scale has changed
+	bool addFrame(float gpuMS, float renderedScale);
+
+	// Back to full resolution, e.g. after the swapchain was recreated
+	void reset();
+
+	float getScale() const { return stepToScale(step); }
+	float getTargetMS() const { return targetMS; }
+
+protected:
+	float targetMS;
+	float headroom; // fraction of the target aimed at, leaves room for noise
+	float minScale;
+	uint32_t stepCount; // steps above the minimum scale, the last one is full resolution
+	uint32_t raiseFrameCount;
+
+	uint32_t step;
+	uint32_t framesBelowNextStep = 0;
+
+	float stepToScale(uint32_t s) const;
+};
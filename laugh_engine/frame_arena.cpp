@@ -0,0 +1,58 @@
+#include "frame_arena.h"
+#include <algorithm>
+#include <cassert>
+
+
+FrameArena::FrameArena(size_t blockSize)
+{
+	addBlock(blockSize);
+}
+
+void *FrameArena::allocate(size_t size, size_t alignment)
+{
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+	size_t aligned = (offset + alignment - 1) & ~(alignment - 1);
+	if (aligned + size > blocks.back().size)
+	{
+		usedInFullBlocks += offset;
+		addBlock(std::max(size + alignment, blocks.back().size));
+		aligned = 0;
+	}
+	offset = aligned + size;
+	return blocks.back().data.get() + aligned;
+}
+
+void FrameArena::reset()
+{
+	if (blocks.size() > 1)
+	{
+		const size_t capacity = getCapacity();
+		blocks.clear();
+		addBlock(capacity);
+	}
+	offset = 0;
+	usedInFullBlocks = 0;
+}
+
+size_t FrameArena::getCapacity() const
+{
+	size_t capacity = 0;
+	for (const auto &block : blocks)
+	{
+		capacity += block.size;
+	}
+	return capacity;
+}
+
+size_t FrameArena::getUsed() const
+{
+	return usedInFullBlocks + offset;
+}
+
+void FrameArena::addBlock(size_t size)
+{
+	// new char[] is aligned for any fundamental type, which covers every alignment asked for here
+	blocks.push_back({ std::unique_ptr<char[]>(new char[size]), size });
+	offset = 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#define FRAME_ARENA_BLOCK_SIZE (256 * 1024) // bytes of the first block, the arena grows to what a frame needs
+
+
+// Linear allocator for the scratch data of one frame. Allocations are never freed one by one, reset() takes all of them
+// back at once. A frame that outgrows the current block gets more blocks, and the next reset() replaces them by a single
+// block large enough for all, so once the frames settle the arena stops calling the heap. Not thread safe
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t blockSize = FRAME_ARENA_BLOCK_SIZE);
+	FrameArena(const FrameArena &) = delete;
+	FrameArena &operator=(const FrameArena &) = delete;
+
+	void *allocate(size_t size, size_t alignment);
+	// Everything allocated so far must be out of use
+	void reset();
+
+	size_t getCapacity() const; // bytes
+	size_t getUsed() const; // bytes since the last reset()
+
+protected:
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks; // the last one is being filled
+	size_t offset = 0; // into the last block
+	size_t usedInFullBlocks = 0;
+
+	void addBlock(size_t size);
+};
+
+
+// Standard allocator handing out FrameArena memory, for containers that live no longer than the frame.
+// Growing such a container leaves the old storage in the arena until reset(), so reserve() when the size is known
+template<typename T>
+class FrameArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	FrameArenaAllocator(FrameArena &arena) : pArena(&arena) {}
+	template<typename U>
+	FrameArenaAllocator(const FrameArenaAllocator<U> &other) : pArena(other.pArena) {}
+
+	T *allocate(size_t n) { return static_cast<T *>(pArena->allocate(n * sizeof(T), alignof(T))); }
+	void deallocate(T *, size_t) {}
+
+	template<typename U>
+	bool operator==(const FrameArenaAllocator<U> &other) const { return pArena == other.pArena; }
+	template<typename U>
+	bool operator!=(const FrameArenaAllocator<U> &other) const { return pArena != other.pArena; }
+
+	FrameArena *pArena;
+};
+
+template<typename T>
+using FrameVector = std::vector<T, FrameArenaAllocator<T>>;
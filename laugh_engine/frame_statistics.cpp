@@ -0,0 +1,139 @@
+#include "frame_statistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+
+FrameStatistics::FrameStatistics(uint32_t historyLength, float hitchThresholdMS)
+	:
+	hitchThresholdMS(hitchThresholdMS)
+{
+	cpuTimes.samples.resize(historyLength);
+	gpuTimes.samples.resize(historyLength);
+}
+
+bool FrameStatistics::addFrame(float cpuMS, float gpuMS)
+{
+	cpuTimes.add(cpuMS);
+	gpuTimes.add(gpuMS);
+	++frameCount;
+
+	const float ms = std::max(cpuMS, gpuMS);
+	if (ms <= hitchThresholdMS) return false;
+
+	++hitchCount;
+	lastHitchFrame = frameCount - 1;
+	lastHitchMS = ms;
+	return true;
+}
+
+void FrameStatistics::getRecentCpuTimes(uint32_t count, std::vector<float> *times) const
+{
+	count = std::min(count, cpuTimes.count);
+	times->resize(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		(*times)[i] = cpuTimes.at(cpuTimes.count - count + i);
+	}
+}
+
+bool FrameStatistics::saveCsv(const std::string &fileName) const
+{
+	std::ofstream file(fileName);
+	if (!file.is_open()) return false;
+
+	// Frames are numbered from the first one ever added, GPU times are empty if unknown
+	const uint64_t firstFrame = frameCount - cpuTimes.count;
+	file << "frame,cpu_ms,gpu_ms\n";
+	for (uint32_t i = 0; i < cpuTimes.count; ++i)
+	{
+		file << firstFrame + i << "," << cpuTimes.at(i) << ",";
+		if (gpuTimes.at(i) >= 0.f) file << gpuTimes.at(i);
+		file << "\n";
+	}
+
+	return file.good();
+}
+
+bool FrameStatistics::saveJson(const std::string &fileName) const
+{
+	std::ofstream file(fileName);
+	if (!file.is_open()) return false;
+
+	auto writePercentiles = [&file](const char *name, const Percentiles &p)
+	{
+		file << "\t\"" << name << "\": { \"p50\": " << p.p50 << ", \"p95\": " << p.p95 << ", \"p99\": " << p.p99 << ", \"max\": " << p.max << " },\n";
+	};
+
+	auto writeSamples = [&file](const char *name, const Ring &ring, bool last)
+	{
+		file << "\t\"" << name << "\": [";
+		for (uint32_t i = 0; i < ring.count; ++i)
+		{
+			if (i > 0) file << ", ";
+			if (ring.at(i) >= 0.f) file << ring.at(i);
+			else file << "null";
+		}
+		file << "]" << (last ? "\n" : ",\n");
+	};
+
+	file << "{\n";
+	file << "\t\"frameCount\": " << frameCount << ",\n";
+	file << "\t\"hitchThresholdMS\": " << hitchThresholdMS << ",\n";
+	file << "\t\"hitchCount\": " << hitchCount << ",\n";
+	writePercentiles("cpuMS", getCpuPercentiles());
+	writePercentiles("gpuMS", getGpuPercentiles());
+	file << "\t\"firstFrame\": " << frameCount - cpuTimes.count << ",\n";
+	writeSamples("cpuFrameTimesMS", cpuTimes, false);
+	writeSamples("gpuFrameTimesMS", gpuTimes, true);
+	file << "}\n";
+
+	return file.good();
+}
+
+void FrameStatistics::Ring::add(float ms)
+{
+	samples[next] = ms;
+	next = (next + 1) % static_cast<uint32_t>(samples.size());
+	count = std::min(count + 1, static_cast<uint32_t>(samples.size()));
+}
+
+float FrameStatistics::Ring::at(uint32_t i) const
+{
+	const uint32_t size = static_cast<uint32_t>(samples.size());
+	const uint32_t oldest = count < size ? 0 : next;
+	return samples[(oldest + i) % size];
+}
+
+FrameStatistics::Percentiles FrameStatistics::computePercentiles(const Ring &ring) const
+{
+	std::vector<float> samples;
+	samples.reserve(ring.count);
+	for (uint32_t i = 0; i < ring.count; ++i)
+	{
+		if (ring.at(i) >= 0.f) samples.push_back(ring.at(i));
+	}
+	return computePercentiles(std::move(samples));
+}
+
+FrameStatistics::Percentiles FrameStatistics::computePercentiles(std::vector<float> samples)
+{
+	Percentiles p;
+	if (samples.empty()) return p;
+
+	// Nearest rank
+	std::vector<float> &sorted = samples;
+	std::sort(sorted.begin(), sorted.end());
+	auto rank = [&sorted](float percentile)
+	{
+		const size_t idx = static_cast<size_t>(std::ceil(percentile * sorted.size()));
+		return sorted[std::min(std::max(idx, size_t(1)), sorted.size()) - 1];
+	};
+
+	p.p50 = rank(.5f);
+	p.p95 = rank(.95f);
+	p.p99 = rank(.99f);
+	p.max = sorted.back();
+	return p;
+}
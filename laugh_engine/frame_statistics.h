@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+// Keeps the last frame times of the CPU and the GPU and reports their distribution.
+// A frame whose CPU or GPU time exceeds the hitch threshold is counted as a hitch
+class FrameStatistics
+{
+public:
+	struct Percentiles
+	{
+		float p50 = 0.f;
+		float p95 = 0.f;
+		float p99 = 0.f;
+		float max = 0.f;
+	};
+
+	FrameStatistics(uint32_t historyLength = 1024, float hitchThresholdMS = 33.3f);
+
+	// A negative @gpuMS marks the GPU time as unknown, e.g. while the first frames are in flight.
+	// Return true if the frame is a hitch
+	bool addFrame(float cpuMS, float gpuMS);
+
+	void setHitchThreshold(float ms) { hitchThresholdMS = ms; }
+	float getHitchThreshold() const { return hitchThresholdMS; }
+
+	Percentiles getCpuPercentiles() const { return computePercentiles(cpuTimes); }
+	Percentiles getGpuPercentiles() const { return computePercentiles(gpuTimes); }
+	// Nearest rank percentiles of any set of times, e.g. of a single pass
+	static Percentiles computePercentiles(std::vector<float> samples);
+
+	uint64_t getFrameCount() const { return frameCount; }
+	uint64_t getHitchCount() const { return hitchCount; }
+	uint64_t getLastHitchFrame() const { return lastHitchFrame; }
+	float getLastHitchMS() const { return lastHitchMS; }
+
+	// The last @count CPU times, oldest first. Fewer if not that many frames have been added
+	void getRecentCpuTimes(uint32_t count, std::vector<float> *times) const;
+
+	// One row per frame in the history
+	bool saveCsv(const std::string &fileName) const;
+	// Summary and the frames in the history
+	bool saveJson(const std::string &fileName) const;
+
+protected:
+	// Times of the last frames, oldest at @next once the ring is full
+	struct Ring
+	{
+		std::vector<float> samples;
+		uint32_t next = 0;
+		uint32_t count = 0;
+
+		void add(float ms);
+		float at(uint32_t i) const; // i-th oldest
+	};
+
+	float hitchThresholdMS;
+
+	Ring cpuTimes;
+	Ring gpuTimes; // same frames as @cpuTimes, negative if unknown
+
+	uint64_t frameCount = 0;
+	uint64_t hitchCount = 0;
+	uint64_t lastHitchFrame = 0;
+	float lastHitchMS = 0.f;
+
+	Percentiles computePercentiles(const Ring &ring) const;
+};
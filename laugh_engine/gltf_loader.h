@@ -1,11 +1,23 @@
 #pragma once
 
-#include <fstream>
+#include <cstring>
+#include <memory>
 #include <unordered_set>
 
 #define PICOJSON_USE_INT64
 #include "picojson.h"
 #include "gli/gli.hpp"
+#include "asset_pack.h"
+#include "job_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GLTF_DECODE_SSE 1
+#else
+#define GLTF_DECODE_SSE 0
+#endif
+
+#define GLTF_DECODE_BATCH_SIZE 65536 // vertices or indices per job when decoding on a JobPool
 
 #undef max
 #undef min
@@ -18,6 +30,7 @@ namespace rj
 		GLTF_UNSIGNED_BYTE = 5121,
 		GLTF_SHORT = 5122,
 		GLTF_UNSIGNED_SHORT = 5123,
+		GLTF_UNSIGNED_INT = 5125,
 		GLTF_FLOAT = 5126
 	};
 
@@ -38,6 +51,7 @@ namespace rj
 		{ GLTF_UNSIGNED_BYTE, 1 },
 		{ GLTF_SHORT, 2 },
 		{ GLTF_UNSIGNED_SHORT, 2 },
+		{ GLTF_UNSIGNED_INT, 4 },
 		{ GLTF_FLOAT, 4 }
 	};
 
@@ -55,23 +69,37 @@ namespace rj
 		uint32_t buffer;
 		uint32_t byteOffset;
 		uint32_t byteLength;
+		uint32_t byteStride = 0; // 0 if the elements are tightly packed
 	};
 
-	typedef std::vector<char> GLTFBuffer;
-
-	template <typename T>
-	class GLTFBufferIterator
+	// Bytes of a .bin file or of the binary chunk of a .glb, in a mapping owned by GLTFScene::files
+	struct GLTFBuffer
 	{
-	public:
-		GLTFBufferIterator(const T *b, const T *e) : cur(b), end(e) {}
-
-		bool hasNext() const { return cur != end; }
+		const char *data = nullptr;
+		size_t size = 0;
+	};
 
-		T getNext() { return *cur++; }
+	// Elements of an accessor, read straight from the mapped buffer
+	struct GLTFAccessorView
+	{
+		const char *data = nullptr; // first element
+		uint32_t stride = 0; // bytes from one element to the next
+		uint32_t count = 0;
+		GLTFComponentType componentType = GLTF_FLOAT;
+	};
 
-	private:
-		const T *cur = nullptr;
-		const T *end = nullptr;
+	struct GLTFPrimitive
+	{
+		GLTFAccessorView positions; // VEC3 float
+		GLTFAccessorView normals; // VEC3 float
+		GLTFAccessorView texCoords; // VEC2 float
+		GLTFAccessorView indices; // SCALAR unsigned byte, short or int
+		GLTFAccessorView joints; // VEC4 unsigned byte or short, only in skinned meshes
+		GLTFAccessorView weights; // VEC4 float, normalized unsigned byte or short, only in skinned meshes
+		std::vector<GLTFAccessorView> targetPositions; // VEC3 float deltas of every morph target, count 0 if the target has none
+		std::vector<GLTFAccessorView> targetNormals;
+		glm::mat4 T; // of the node, baked into positions and normals when they are decoded. Identity in skinned meshes
+		glm::mat4 Tit;
 	};
 
 	struct GLTFImage
@@ -81,6 +109,7 @@ namespace rj
 		uint32_t component;
 		uint32_t levelCount;
 		std::vector<char> pixels;
+		uint32_t index = std::numeric_limits<uint32_t>::max(); // in the images of the file
 	};
 
 	struct GLTFTexture
@@ -99,13 +128,107 @@ namespace rj
 		uint32_t emissiveTexture = std::numeric_limits<uint32_t>::max();
 	};
 
-	// GLTFMesh is defined as an aggregate of all the geometry of the same material
+	namespace gltf_decode
+	{
+		// Write T * (p, 1) of @count points @srcStride bytes apart from @src to @dst, @dstStride bytes apart, and grow
+		// *@pMin and *@pMax over the results
+		inline void transformPoints(const char *src, size_t srcStride, char *dst, size_t dstStride, uint32_t count,
+			const glm::mat4 &T, glm::vec3 *pMin, glm::vec3 *pMax)
+		{
+#if GLTF_DECODE_SSE
+			const __m128 c0 = _mm_loadu_ps(&T[0][0]);
+			const __m128 c1 = _mm_loadu_ps(&T[1][0]);
+			const __m128 c2 = _mm_loadu_ps(&T[2][0]);
+			const __m128 c3 = _mm_loadu_ps(&T[3][0]);
+			__m128 vMin = _mm_set_ps(0.f, pMin->z, pMin->y, pMin->x);
+			__m128 vMax = _mm_set_ps(0.f, pMax->z, pMax->y, pMax->x);
+
+			for (uint32_t i = 0; i < count; ++i, src += srcStride, dst += dstStride)
+			{
+				float p[3];
+				memcpy(p, src, sizeof(p));
+				__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+					_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3));
+				vMin = _mm_min_ps(vMin, r);
+				vMax = _mm_max_ps(vMax, r);
+
+				float out[4];
+				_mm_storeu_ps(out, r);
+				memcpy(dst, out, 3 * sizeof(float));
+			}
+
+			float m[4];
+			_mm_storeu_ps(m, vMin);
+			*pMin = glm::vec3(m[0], m[1], m[2]);
+			_mm_storeu_ps(m, vMax);
+			*pMax = glm::vec3(m[0], m[1], m[2]);
+#else
+			for (uint32_t i = 0; i < count; ++i, src += srcStride, dst += dstStride)
+			{
+				glm::vec3 pos;
+				memcpy(&pos, src, sizeof(pos));
+				pos = glm::vec3(T * glm::vec4(pos, 1.f));
+				memcpy(dst, &pos, sizeof(pos));
+
+				*pMin = glm::min(*pMin, pos);
+				*pMax = glm::max(*pMax, pos);
+			}
+#endif
+		}
+
+		// Write normalize(T * (n, 0)) of @count normals, like transformPoints
+		inline void transformNormals(const char *src, size_t srcStride, char *dst, size_t dstStride, uint32_t count, const glm::mat4 &T)
+		{
+#if GLTF_DECODE_SSE
+			const __m128 c0 = _mm_loadu_ps(&T[0][0]);
+			const __m128 c1 = _mm_loadu_ps(&T[1][0]);
+			const __m128 c2 = _mm_loadu_ps(&T[2][0]);
+			const __m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+
+			for (uint32_t i = 0; i < count; ++i, src += srcStride, dst += dstStride)
+			{
+				float n[3];
+				memcpy(n, src, sizeof(n));
+				__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n[0])), _mm_mul_ps(c1, _mm_set1_ps(n[1]))),
+					_mm_mul_ps(c2, _mm_set1_ps(n[2])));
+				r = _mm_and_ps(r, xyzMask);
+
+				// Horizontal sum of the squares, in every lane
+				__m128 sq = _mm_mul_ps(r, r);
+				sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+				sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 0, 3, 2)));
+				r = _mm_div_ps(r, _mm_sqrt_ps(sq));
+
+				float out[4];
+				_mm_storeu_ps(out, r);
+				memcpy(dst, out, 3 * sizeof(float));
+			}
+#else
+			for (uint32_t i = 0; i < count; ++i, src += srcStride, dst += dstStride)
+			{
+				glm::vec3 nrm;
+				memcpy(&nrm, src, sizeof(nrm));
+				nrm = glm::normalize(glm::vec3(T * glm::vec4(nrm, 0.f)));
+				memcpy(dst, &nrm, sizeof(nrm));
+			}
+#endif
+		}
+	}
+
+	// GLTFMesh is defined as an aggregate of all the geometry of the same material. Its vertices are not copied out of
+	// the file, the decode functions write them straight to where they are needed, e.g. into staging memory.
+	// Skinned and morphed primitives are only aggregated with those of the same glTF mesh
 	struct GLTFMesh
 	{
-		std::vector<float> positions;
-		std::vector<float> normals;
-		std::vector<float> texCoords;
-		std::vector<uint32_t> indices;
+		std::vector<GLTFPrimitive> primitives;
+		uint32_t vertexCount = 0; // of all primitives
+		uint32_t indexCount = 0;
+
+		uint32_t skin = std::numeric_limits<uint32_t>::max(); // in GLTFScene::skins. Skinned vertices are in the space of the skeleton
+		uint32_t node = std::numeric_limits<uint32_t>::max(); // that instances the glTF mesh, the one whose weights animate the morph targets
+		uint32_t morphTargetCount = 0;
+
+		bool isAnimated() const { return skin != std::numeric_limits<uint32_t>::max() || morphTargetCount > 0; }
 
 		GLTFImage albedoMap;
 		GLTFImage normalMap;
@@ -113,35 +236,319 @@ namespace rj
 		GLTFImage metallicMap;
 		GLTFImage aoMap;
 		GLTFImage emissiveMap;
+
+		// The decode functions split the primitives into batches of GLTF_DECODE_BATCH_SIZE and run them as jobs on @pJobs if given.
+		// Their results are the same either way
+
+		// Write the transformed glm::vec3 position of every vertex @dstStride bytes apart from @dst and grow *@pMin and *@pMax over them
+		void decodePositions(char *dst, size_t dstStride, glm::vec3 *pMin = nullptr, glm::vec3 *pMax = nullptr, JobPool *pJobs = nullptr) const
+		{
+			const auto batches = getBatches(false);
+			std::vector<glm::vec3> mins(batches.size(), glm::vec3(std::numeric_limits<float>::max()));
+			std::vector<glm::vec3> maxs(batches.size(), glm::vec3(-std::numeric_limits<float>::max()));
+
+			runBatches(batches, pJobs, [&](size_t b)
+			{
+				const Batch &batch = batches[b];
+				const GLTFPrimitive &prim = primitives[batch.primitive];
+				gltf_decode::transformPoints(prim.positions.data + size_t(batch.first) * prim.positions.stride, prim.positions.stride,
+					dst + size_t(batch.dstFirst) * dstStride, dstStride, batch.count, prim.T, &mins[b], &maxs[b]);
+			});
+
+			for (size_t b = 0; b < batches.size(); ++b)
+			{
+				if (pMin) *pMin = glm::min(*pMin, mins[b]);
+				if (pMax) *pMax = glm::max(*pMax, maxs[b]);
+			}
+		}
+
+		// Transformed glm::vec3 normals, like decodePositions
+		void decodeNormals(char *dst, size_t dstStride, JobPool *pJobs = nullptr) const
+		{
+			const auto batches = getBatches(false);
+			runBatches(batches, pJobs, [&](size_t b)
+			{
+				const Batch &batch = batches[b];
+				const GLTFPrimitive &prim = primitives[batch.primitive];
+				gltf_decode::transformNormals(prim.normals.data + size_t(batch.first) * prim.normals.stride, prim.normals.stride,
+					dst + size_t(batch.dstFirst) * dstStride, dstStride, batch.count, prim.Tit);
+			});
+		}
+
+		// glm::vec2 texture coordinates, like decodePositions
+		void decodeTexCoords(char *dst, size_t dstStride, JobPool *pJobs = nullptr) const
+		{
+			const auto batches = getBatches(false);
+			runBatches(batches, pJobs, [&](size_t b)
+			{
+				const Batch &batch = batches[b];
+				const GLTFAccessorView &acc = primitives[batch.primitive].texCoords;
+				const char *src = acc.data + size_t(batch.first) * acc.stride;
+				char *out = dst + size_t(batch.dstFirst) * dstStride;
+				for (uint32_t i = 0; i < batch.count; ++i, src += acc.stride, out += dstStride)
+				{
+					memcpy(out, src, sizeof(glm::vec2));
+				}
+			});
+		}
+
+		// Four joint indices of every vertex into the joints of its skin as uint16_t, like decodePositions
+		void decodeJoints(char *dst, size_t dstStride, JobPool *pJobs = nullptr) const
+		{
+			const auto batches = getBatches(false);
+			runBatches(batches, pJobs, [&](size_t b)
+			{
+				const Batch &batch = batches[b];
+				const GLTFAccessorView &acc = primitives[batch.primitive].joints;
+				const char *src = acc.data + size_t(batch.first) * acc.stride;
+				char *out = dst + size_t(batch.dstFirst) * dstStride;
+				for (uint32_t i = 0; i < batch.count; ++i, src += acc.stride, out += dstStride)
+				{
+					uint16_t joints[4];
+					for (uint32_t c = 0; c < 4; ++c)
+					{
+						if (acc.componentType == GLTF_UNSIGNED_BYTE) joints[c] = reinterpret_cast<const uint8_t *>(src)[c];
+						else memcpy(&joints[c], src + c * sizeof(uint16_t), sizeof(uint16_t));
+					}
+					memcpy(out, joints, sizeof(joints));
+				}
+			});
+		}
+
+		// glm::vec4 joint weights of every vertex, rescaled to add up to 1, like decodePositions
+		void decodeWeights(char *dst, size_t dstStride, JobPool *pJobs = nullptr) const
+		{
+			const auto batches = getBatches(false);
+			runBatches(batches, pJobs, [&](size_t b)
+			{
+				const Batch &batch = batches[b];
+				const GLTFAccessorView &acc = primitives[batch.primitive].weights;
+				const char *src = acc.data + size_t(batch.first) * acc.stride;
+				char *out = dst + size_t(batch.dstFirst) * dstStride;
+				for (uint32_t i = 0; i < batch.count; ++i, src += acc.stride, out += dstStride)
+				{
+					glm::vec4 w;
+					if (acc.componentType == GLTF_FLOAT)
+					{
+						memcpy(&w, src, sizeof(w));
+					}
+					else
+					{
+						// Normalized unsigned bytes or shorts
+						for (uint32_t c = 0; c < 4; ++c)
+						{
+							uint16_t v16;
+							if (acc.componentType == GLTF_UNSIGNED_BYTE)
+							{
+								w[c] = reinterpret_cast<const uint8_t *>(src)[c] / 255.f;
+							}
+							else
+							{
+								memcpy(&v16, src + c * sizeof(uint16_t), sizeof(uint16_t));
+								w[c] = v16 / 65535.f;
+							}
+						}
+					}
+					const float sum = w.x + w.y + w.z + w.w;
+					w = sum > 0.f ? w / sum : glm::vec4(1.f, 0.f, 0.f, 0.f);
+					memcpy(out, &w, sizeof(w));
+				}
+			});
+		}
+
+		// glm::vec3 position and normal deltas of morph target @target, transformed like the vertices but not normalized.
+		// Zero for primitives without them. Either destination may be null
+		void decodeMorphTarget(uint32_t target, char *dstPositions, char *dstNormals, size_t dstStride, JobPool *pJobs = nullptr) const
+		{
+			const auto batches = getBatches(false);
+			runBatches(batches, pJobs, [&](size_t b)
+			{
+				const Batch &batch = batches[b];
+				const GLTFPrimitive &prim = primitives[batch.primitive];
+				auto decode = [&](const GLTFAccessorView &acc, const glm::mat3 &M, char *dst)
+				{
+					if (!dst) return;
+					const char *src = acc.data + size_t(batch.first) * acc.stride;
+					char *out = dst + size_t(batch.dstFirst) * dstStride;
+					for (uint32_t i = 0; i < batch.count; ++i, src += acc.stride, out += dstStride)
+					{
+						glm::vec3 delta(0.f);
+						if (acc.count > 0) memcpy(&delta, src, sizeof(delta));
+						delta = M * delta;
+						memcpy(out, &delta, sizeof(delta));
+					}
+				};
+				decode(prim.targetPositions[target], glm::mat3(prim.T), dstPositions);
+				decode(prim.targetNormals[target], glm::mat3(prim.Tit), dstNormals);
+			});
+		}
+
+		// Indices of every primitive, offset to its first vertex in the mesh. T must hold vertexCount - 1
+		template <typename T>
+		void decodeIndices(T *dst, JobPool *pJobs = nullptr) const
+		{
+			const auto batches = getBatches(true);
+			runBatches(batches, pJobs, [&](size_t b)
+			{
+				const Batch &batch = batches[b];
+				const GLTFAccessorView &acc = primitives[batch.primitive].indices;
+				const char *src = acc.data + size_t(batch.first) * acc.stride;
+				T *out = dst + batch.dstFirst;
+				for (uint32_t i = 0; i < batch.count; ++i, src += acc.stride)
+				{
+					uint32_t idx;
+					if (acc.componentType == GLTF_UNSIGNED_BYTE)
+					{
+						idx = *reinterpret_cast<const uint8_t *>(src);
+					}
+					else if (acc.componentType == GLTF_UNSIGNED_SHORT)
+					{
+						uint16_t idx16;
+						memcpy(&idx16, src, sizeof(idx16));
+						idx = idx16;
+					}
+					else
+					{
+						memcpy(&idx, src, sizeof(idx));
+					}
+					*out++ = static_cast<T>(batch.vertexOffset + idx);
+				}
+			});
+		}
+
+	private:
+		struct Batch
+		{
+			uint32_t primitive;
+			uint32_t first; // element in the accessor of the primitive
+			uint32_t count;
+			uint32_t dstFirst; // element in the output of all primitives
+			uint32_t vertexOffset; // first vertex of the primitive in the mesh
+		};
+
+		// Ranges of at most GLTF_DECODE_BATCH_SIZE vertices or @indices, never across primitives
+		std::vector<Batch> getBatches(bool indices) const
+		{
+			std::vector<Batch> batches;
+			uint32_t dstFirst = 0;
+			uint32_t vertexOffset = 0;
+			for (uint32_t p = 0; p < static_cast<uint32_t>(primitives.size()); ++p)
+			{
+				const uint32_t count = indices ? primitives[p].indices.count : primitives[p].positions.count;
+				for (uint32_t first = 0; first < count; first += GLTF_DECODE_BATCH_SIZE)
+				{
+					batches.push_back({ p, first, std::min(count - first, static_cast<uint32_t>(GLTF_DECODE_BATCH_SIZE)), dstFirst + first, vertexOffset });
+				}
+				dstFirst += count;
+				vertexOffset += primitives[p].positions.count;
+			}
+			return batches;
+		}
+
+		// The batches write disjoint outputs, so they need no synchronization
+		template <typename F>
+		static void runBatches(const std::vector<Batch> &batches, JobPool *pJobs, const F &decodeBatch)
+		{
+			if (!pJobs || batches.size() < 2)
+			{
+				for (size_t b = 0; b < batches.size(); ++b) decodeBatch(b);
+				return;
+			}
+
+			size_t beginJob = std::numeric_limits<size_t>::max();
+			size_t endJob = 0;
+			for (size_t b = 0; b < batches.size(); ++b)
+			{
+				endJob = pJobs->add([&decodeBatch, b]() { decodeBatch(b); }) + 1;
+				beginJob = std::min(beginJob, endJob - 1);
+			}
+			pJobs->wait(beginJob, endJob);
+		}
 	};
 
 	struct GLTFNode
 	{
 		std::vector<uint32_t> children;
+		uint32_t parent = std::numeric_limits<uint32_t>::max();
 		uint32_t mesh = std::numeric_limits<uint32_t>::max();
+		uint32_t skin = std::numeric_limits<uint32_t>::max();
+		glm::vec3 translation = glm::vec3(0.f); // rest pose, the channels of an animation replace them
+		glm::quat rotation;
+		glm::vec3 scale = glm::vec3(1.f);
 		glm::mat4 local2parent;
+		std::vector<float> weights; // of the morph targets of @mesh
+	};
+
+	struct GLTFSkin
+	{
+		std::vector<uint32_t> joints; // nodes
+		std::vector<glm::mat4> inverseBindMatrices; // one per joint, identity if the file has none
+	};
+
+	enum GLTFAnimationPath
+	{
+		GLTF_PATH_TRANSLATION,
+		GLTF_PATH_ROTATION,
+		GLTF_PATH_SCALE,
+		GLTF_PATH_WEIGHTS
+	};
+
+	// Keyframes copied out of the file, so clips outlive its mapping
+	struct GLTFAnimationSampler
+	{
+		std::vector<float> times; // seconds, ascending
+		std::vector<float> values; // the components of each key in turn: 3 or 4, or one per morph target of the weights path
+		bool step = false; // STEP interpolation, LINEAR otherwise. CUBICSPLINE keys are reduced to their values and played linearly
+	};
+
+	struct GLTFAnimationChannel
+	{
+		uint32_t node;
+		GLTFAnimationPath path;
+		uint32_t sampler;
+	};
+
+	struct GLTFAnimation
+	{
+		std::string name;
+		std::vector<GLTFAnimationChannel> channels;
+		std::vector<GLTFAnimationSampler> samplers;
+		float duration = 0.f; // last key time of all samplers
 	};
 
 	struct GLTFScene
 	{
 		std::vector<GLTFMesh> meshes;
+		std::vector<GLTFNode> nodes;
+		std::vector<GLTFSkin> skins;
+		std::vector<GLTFAnimation> animations;
+		std::vector<std::unique_ptr<AssetFile>> files; // mappings the accessor views of @meshes point into
 	};
 
 	class GLTFLoader
 	{
 	public:
+		// .gltf with its buffers in .bin files, or .glb with the first buffer in its binary chunk. The files are mapped, not read,
+		// and the meshes keep pointing into the mappings, so @scene must outlive their decoding
 		void load(GLTFScene *scene, const std::string &fn) const
 		{
 			auto baseDir = getBaseDir(fn);
 			auto ext = getExtension(fn);
 
-			if (ext != "gltf") throw std::runtime_error("Not gltf file");
+			if (ext != "gltf" && ext != "glb") throw std::runtime_error("Not gltf file");
+
+			scene->files.emplace_back(new AssetFile(fn));
+			const AssetFile &file = *scene->files.back();
+			if (!file.isOpen()) throw std::runtime_error("file: " + fn + " not found");
 
-			std::ifstream fs(fn);
-			if (!fs.is_open()) throw std::runtime_error("file: " + fn + " not found");
+			const char *json = file.getData();
+			size_t jsonSize = file.getSize();
+			GLTFBuffer binChunk;
+			if (ext == "glb") parseGLBChunks(file, &json, &jsonSize, &binChunk);
 
 			picojson::value rootNode;
-			auto err = picojson::parse(rootNode, fs);
+			std::string err;
+			picojson::parse(rootNode, json, json + jsonSize, &err);
 			if (!err.empty()) throw std::runtime_error(err);
 
 			// Parse accessors
@@ -157,7 +564,7 @@ namespace rj
 			// Parse buffers
 			if (!rootNode.contains("buffers") || !rootNode.get("buffers").is<picojson::array>()) throw std::runtime_error("Invalid buffers");
 			std::vector<GLTFBuffer> buffers;
-			parseBuffers(buffers, rootNode.get("buffers").get<picojson::array>(), baseDir);
+			parseBuffers(buffers, scene->files, rootNode.get("buffers").get<picojson::array>(), baseDir, binChunk);
 
 			// Parse images
 			if (!rootNode.contains("images") || !rootNode.get("images").is<picojson::array>()) throw std::runtime_error("Invalid images");
@@ -177,16 +584,28 @@ namespace rj
 			// Parse scene hierarchy
 			if (!rootNode.contains("nodes") || !rootNode.get("nodes").is<picojson::array>()) throw std::runtime_error("Invalid nodes");
 			std::unordered_map<uint32_t, glm::mat4> meshId2Transform;
-			parseSceneHierarchy(meshId2Transform, rootNode.get("nodes").get<picojson::array>());
+			std::unordered_map<uint32_t, uint32_t> meshId2Node;
+			parseSceneHierarchy(scene->nodes, meshId2Transform, meshId2Node, rootNode.get("nodes").get<picojson::array>());
+
+			// Parse skins and animations, both optional
+			if (rootNode.contains("skins") && rootNode.get("skins").is<picojson::array>())
+			{
+				parseSkins(scene->skins, rootNode.get("skins").get<picojson::array>(), accessors, bufferViews, buffers);
+			}
+			if (rootNode.contains("animations") && rootNode.get("animations").is<picojson::array>())
+			{
+				parseAnimations(scene->animations, rootNode.get("animations").get<picojson::array>(), accessors, bufferViews, buffers);
+			}
 
 			// Parse meshes
 			if (!rootNode.contains("meshes") || !rootNode.get("meshes").is<picojson::array>()) throw std::runtime_error("Invalid meshes");
-			parseMeshes(scene->meshes, rootNode.get("meshes").get<picojson::array>(),
-				accessors, bufferViews, buffers, images, textures, materials, meshId2Transform);
+			parseMeshes(scene->meshes, scene->nodes, rootNode.get("meshes").get<picojson::array>(),
+				accessors, bufferViews, buffers, images, textures, materials, meshId2Transform, meshId2Node);
 		}
 
 	private:
-		void parseSceneHierarchy(std::unordered_map<uint32_t, glm::mat4> &meshId2Transform, const picojson::array &nodes) const
+		void parseSceneHierarchy(std::vector<GLTFNode> &ns, std::unordered_map<uint32_t, glm::mat4> &meshId2Transform,
+			std::unordered_map<uint32_t, uint32_t> &meshId2Node, const picojson::array &nodes) const
 		{
 			std::unordered_set<uint32_t> rootCandidates;
 			for (uint32_t i = 0; i < static_cast<uint32_t>(nodes.size()); ++i)
@@ -194,7 +613,7 @@ namespace rj
 				rootCandidates.insert(i);
 			}
 
-			std::vector<GLTFNode> ns(nodes.size());
+			ns.resize(nodes.size());
 			uint32_t p = 0;
 
 			for (const auto &node : nodes)
@@ -203,6 +622,11 @@ namespace rj
 
 				GLTFNode &n = ns[p++];
 				if (fields.find("mesh") != fields.end()) n.mesh = static_cast<uint32_t>(fields.at("mesh").get<int64_t>());
+				if (fields.find("skin") != fields.end()) n.skin = static_cast<uint32_t>(fields.at("skin").get<int64_t>());
+				if (fields.find("weights") != fields.end())
+				{
+					for (const auto &w : fields.at("weights").get<picojson::array>()) n.weights.push_back(static_cast<float>(w.get<double>()));
+				}
 				
 				glm::vec3 trans(0.f);
 				if (fields.find("translation") != fields.end())
@@ -227,6 +651,9 @@ namespace rj
 
 				glm::mat4 I; // identity
 				n.local2parent = glm::translate(I, trans) * glm::mat4_cast(rot) * glm::scale(I, scale);
+				n.translation = trans;
+				n.rotation = rot;
+				n.scale = scale;
 
 				if (fields.find("children") != fields.end())
 				{
@@ -243,11 +670,20 @@ namespace rj
 				}
 			}
 
-			std::function<void (uint32_t, glm::mat4)> visit = [&visit, &meshId2Transform, &ns](uint32_t root, glm::mat4 T)
+			for (uint32_t i = 0; i < static_cast<uint32_t>(ns.size()); ++i)
+			{
+				for (auto childId : ns[i].children) ns[childId].parent = i;
+			}
+
+			std::function<void (uint32_t, glm::mat4)> visit = [&visit, &meshId2Transform, &meshId2Node, &ns](uint32_t root, glm::mat4 T)
 			{
 				const auto &n = ns[root];
 				T *= n.local2parent;
-				if (n.mesh != std::numeric_limits<uint32_t>::max()) meshId2Transform[n.mesh] = T;
+				if (n.mesh != std::numeric_limits<uint32_t>::max())
+				{
+					meshId2Transform[n.mesh] = T;
+					meshId2Node[n.mesh] = root;
+				}
 				for (auto childId : n.children)
 				{
 					visit(childId, T);
@@ -260,33 +696,50 @@ namespace rj
 			}
 		}
 
-		void parseMeshes(std::vector<GLTFMesh> &ms, const picojson::array &meshes,
+		void parseMeshes(std::vector<GLTFMesh> &ms, std::vector<GLTFNode> &nodes, const picojson::array &meshes,
 			const std::vector<GLTFAccessor> &accessors, const std::vector<GLTFBufferView> &bufferViews,
 			const std::vector<GLTFBuffer> &buffers, const std::vector<GLTFImage> &images,
 			const std::vector<GLTFTexture> &textures, const std::vector<GLTFMaterial> &materials,
-			const std::unordered_map<uint32_t, glm::mat4> &meshId2Transform) const
+			const std::unordered_map<uint32_t, glm::mat4> &meshId2Transform, const std::unordered_map<uint32_t, uint32_t> &meshId2Node) const
 		{
-			std::unordered_map<uint32_t, uint32_t> mat2mesh;
+			// Static primitives are keyed by material alone, animated ones by their glTF mesh too
+			std::unordered_map<uint64_t, uint32_t> mat2mesh;
 
 			for (uint32_t meshId = 0; meshId < meshes.size(); ++meshId)
 			{
 				const auto &mesh = meshes[meshId];
+				const auto &meshFields = mesh.get<picojson::object>();
+
+				const uint32_t node = meshId2Node.find(meshId) != meshId2Node.end() ? meshId2Node.at(meshId) : std::numeric_limits<uint32_t>::max();
+				const uint32_t skin = node != std::numeric_limits<uint32_t>::max() ? nodes[node].skin : std::numeric_limits<uint32_t>::max();
 
-				glm::mat4 T = meshId2Transform.find(meshId) != meshId2Transform.end() ? meshId2Transform.at(meshId) : glm::mat4();
+				// The node transform of a skinned mesh is ignored, its joints place it
+				glm::mat4 T = meshId2Transform.find(meshId) != meshId2Transform.end() && skin == std::numeric_limits<uint32_t>::max() ?
+					meshId2Transform.at(meshId) : glm::mat4();
 				glm::mat4 Tit = glm::transpose(glm::inverse(T));
-				const auto &prims = mesh.get<picojson::object>().at("primitives").get<picojson::array>();
+				const auto &prims = meshFields.at("primitives").get<picojson::array>();
+
+				std::vector<float> weights;
+				if (meshFields.find("weights") != meshFields.end())
+				{
+					for (const auto &w : meshFields.at("weights").get<picojson::array>()) weights.push_back(static_cast<float>(w.get<double>()));
+				}
 
 				for (const auto &prim : prims)
 				{
 					const auto &fields = prim.get<picojson::object>();
 					uint32_t matId = static_cast<uint32_t>(fields.at("material").get<int64_t>());
 
-					if (mat2mesh.find(matId) == mat2mesh.end())
+					const bool hasTargets = fields.find("targets") != fields.end();
+					const uint64_t key = (skin != std::numeric_limits<uint32_t>::max() || hasTargets ? uint64_t(meshId + 1) << 32 : 0) | matId;
+					if (mat2mesh.find(key) == mat2mesh.end())
 					{
-						mat2mesh[matId] = static_cast<uint32_t>(ms.size());
+						mat2mesh[key] = static_cast<uint32_t>(ms.size());
 						ms.resize(ms.size() + 1);
+						ms.back().skin = skin;
+						ms.back().node = node;
 					}
-					uint32_t meshId = mat2mesh[matId];
+					uint32_t meshId = mat2mesh[key];
 					auto &m = ms[meshId];
 
 					const auto &attributes = fields.at("attributes").get<picojson::object>();
@@ -294,81 +747,75 @@ namespace rj
 					uint32_t nrmAccId = static_cast<uint32_t>(attributes.at("NORMAL").get<int64_t>());
 					uint32_t tcAccId = static_cast<uint32_t>(attributes.at("TEXCOORD_0").get<int64_t>());
 					uint32_t idxAccId = static_cast<uint32_t>(fields.at("indices").get<int64_t>());
-					uint32_t idxOffset = static_cast<uint32_t>(m.positions.size()) / 3;
 
-					// Positions
+					GLTFPrimitive p;
+					p.T = T;
+					p.Tit = Tit;
+					p.positions = getAccessorView(accessors[posAccId], bufferViews, buffers);
+					assert(accessors[posAccId].type == "VEC3" && p.positions.componentType == GLTF_FLOAT);
+					p.normals = getAccessorView(accessors[nrmAccId], bufferViews, buffers);
+					assert(accessors[nrmAccId].type == "VEC3" && p.normals.componentType == GLTF_FLOAT);
+					p.texCoords = getAccessorView(accessors[tcAccId], bufferViews, buffers);
+					assert(accessors[tcAccId].type == "VEC2" && p.texCoords.componentType == GLTF_FLOAT);
+					p.indices = getAccessorView(accessors[idxAccId], bufferViews, buffers);
+					assert(accessors[idxAccId].type == "SCALAR" && p.indices.componentType != GLTF_FLOAT);
+					if (p.normals.count != p.positions.count || p.texCoords.count != p.positions.count)
 					{
-						const GLTFAccessor &acc = accessors[posAccId];
-						assert(acc.type == "VEC3" && acc.componentType == GLTF_FLOAT);
-						const GLTFBufferView &bv = bufferViews[acc.bufferView];
-						const GLTFBuffer &buff = buffers[bv.buffer];
-						uint32_t offset = acc.byteOffset + bv.byteOffset;
-						uint32_t compCount = acc.count * g_attrType2CompCnt[acc.type];
-						uint32_t size = compCount * g_compType2ByteSize[acc.componentType];
-
-						uint32_t posStart = static_cast<uint32_t>(m.positions.size());
-						m.positions.resize(m.positions.size() + compCount);
-						memcpy(&m.positions[posStart], &buff[offset], size);
-
-						glm::vec3 *positions = reinterpret_cast<glm::vec3 *>(&m.positions[posStart]);
-						for (uint32_t i = 0; i < acc.count; ++i)
-						{
-							positions[i] = glm::vec3(T * glm::vec4(positions[i], 1.f));
-						}
+						throw std::runtime_error("Vertex attributes of a primitive differ in count");
 					}
-					// Normals
+
+					if (skin != std::numeric_limits<uint32_t>::max())
 					{
-						const GLTFAccessor &acc = accessors[nrmAccId];
-						assert(acc.type == "VEC3" && acc.componentType == GLTF_FLOAT);
-						const GLTFBufferView &bv = bufferViews[acc.bufferView];
-						const GLTFBuffer &buff = buffers[bv.buffer];
-						uint32_t offset = acc.byteOffset + bv.byteOffset;
-						uint32_t compCount = acc.count * g_attrType2CompCnt[acc.type];
-						uint32_t size = compCount * g_compType2ByteSize[acc.componentType];
-
-						uint32_t nrmStart = static_cast<uint32_t>(m.normals.size());
-						m.normals.resize(m.normals.size() + compCount);
-						memcpy(&m.normals[nrmStart], &buff[offset], size);
-
-						glm::vec3 *normals = reinterpret_cast<glm::vec3 *>(&m.normals[nrmStart]);
-						for (uint32_t i = 0; i < acc.count; ++i)
+						if (attributes.find("JOINTS_0") == attributes.end() || attributes.find("WEIGHTS_0") == attributes.end())
 						{
-							normals[i] = glm::normalize(glm::vec3(Tit * glm::vec4(normals[i], 0.f)));
+							throw std::runtime_error("Skinned primitive without JOINTS_0 or WEIGHTS_0");
+						}
+						const GLTFAccessor &jointAcc = accessors[static_cast<uint32_t>(attributes.at("JOINTS_0").get<int64_t>())];
+						const GLTFAccessor &weightAcc = accessors[static_cast<uint32_t>(attributes.at("WEIGHTS_0").get<int64_t>())];
+						p.joints = getAccessorView(jointAcc, bufferViews, buffers);
+						assert(jointAcc.type == "VEC4" && (p.joints.componentType == GLTF_UNSIGNED_BYTE || p.joints.componentType == GLTF_UNSIGNED_SHORT));
+						p.weights = getAccessorView(weightAcc, bufferViews, buffers);
+						assert(weightAcc.type == "VEC4");
+						if (p.joints.count != p.positions.count || p.weights.count != p.positions.count)
+						{
+							throw std::runtime_error("Vertex attributes of a primitive differ in count");
 						}
 					}
-					// Texture coordinates
-					{
-						const GLTFAccessor &acc = accessors[tcAccId];
-						assert(acc.type == "VEC2" && acc.componentType == GLTF_FLOAT);
-						const GLTFBufferView &bv = bufferViews[acc.bufferView];
-						const GLTFBuffer &buff = buffers[bv.buffer];
-						uint32_t offset = acc.byteOffset + bv.byteOffset;
-						uint32_t compCount = acc.count * g_attrType2CompCnt[acc.type];
-						uint32_t size = compCount * g_compType2ByteSize[acc.componentType];
-
-						uint32_t tcStart = static_cast<uint32_t>(m.texCoords.size());
-						m.texCoords.resize(m.texCoords.size() + compCount);
-						memcpy(&m.texCoords[tcStart], &buff[offset], size);
-					}
-					// Indices
+
+					if (hasTargets)
 					{
-						const GLTFAccessor &acc = accessors[idxAccId];
-						assert(acc.type == "SCALAR" && acc.componentType == GLTF_UNSIGNED_SHORT);
-						const GLTFBufferView &bv = bufferViews[acc.bufferView];
-						const GLTFBuffer &buff = buffers[bv.buffer];
-						uint32_t offset = acc.byteOffset + bv.byteOffset;
-						uint32_t compCount = acc.count * g_attrType2CompCnt[acc.type];
-						uint32_t size = compCount * g_compType2ByteSize[acc.componentType];
-
-						GLTFBufferIterator<uint16_t> it(
-							reinterpret_cast<const uint16_t *>(&buff[offset]),
-							reinterpret_cast<const uint16_t *>(&buff[offset]) + compCount);
-						while (it.hasNext())
+						const auto &targets = fields.at("targets").get<picojson::array>();
+						for (const auto &target : targets)
 						{
-							m.indices.push_back(idxOffset + static_cast<uint32_t>(it.getNext()));
+							const auto &targetFields = target.get<picojson::object>();
+							auto getDeltas = [&](const char *name)
+							{
+								if (targetFields.find(name) == targetFields.end()) return GLTFAccessorView();
+								const GLTFAccessor &acc = accessors[static_cast<uint32_t>(targetFields.at(name).get<int64_t>())];
+								GLTFAccessorView view = getAccessorView(acc, bufferViews, buffers);
+								if (acc.type != "VEC3" || view.componentType != GLTF_FLOAT || view.count != p.positions.count)
+								{
+									throw std::runtime_error("Morph targets must be float deltas of every vertex");
+								}
+								return view;
+							};
+							p.targetPositions.push_back(getDeltas("POSITION"));
+							p.targetNormals.push_back(getDeltas("NORMAL"));
 						}
+						if (!m.primitives.empty() && m.morphTargetCount != targets.size())
+						{
+							throw std::runtime_error("Primitives of a mesh differ in morph target count");
+						}
+						m.morphTargetCount = static_cast<uint32_t>(targets.size());
+
+						weights.resize(m.morphTargetCount, 0.f);
+						if (node != std::numeric_limits<uint32_t>::max() && nodes[node].weights.empty()) nodes[node].weights = weights;
 					}
 
+					m.vertexCount += p.positions.count;
+					m.indexCount += p.indices.count;
+					m.primitives.push_back(p);
+
 #define INVALID_VAL std::numeric_limits<uint32_t>::max()
 #define IS_VALID(x) ((x) != INVALID_VAL)
 					const GLTFMaterial &material = materials[matId];
@@ -390,6 +837,108 @@ namespace rj
 			}
 		}
 
+		void parseSkins(std::vector<GLTFSkin> &ss, const picojson::array &skins, const std::vector<GLTFAccessor> &accessors,
+			const std::vector<GLTFBufferView> &bufferViews, const std::vector<GLTFBuffer> &buffers) const
+		{
+			for (const auto &skin : skins)
+			{
+				const auto &fields = skin.get<picojson::object>();
+
+				GLTFSkin s;
+				for (const auto &joint : fields.at("joints").get<picojson::array>())
+				{
+					s.joints.push_back(static_cast<uint32_t>(joint.get<int64_t>()));
+				}
+
+				s.inverseBindMatrices.assign(s.joints.size(), glm::mat4());
+				if (fields.find("inverseBindMatrices") != fields.end())
+				{
+					const GLTFAccessor &acc = accessors[static_cast<uint32_t>(fields.at("inverseBindMatrices").get<int64_t>())];
+					const std::vector<float> values = readFloats(acc, bufferViews, buffers);
+					if (acc.type != "MAT4" || acc.count != s.joints.size()) throw std::runtime_error("Invalid inverse bind matrices");
+					memcpy(s.inverseBindMatrices.data(), values.data(), values.size() * sizeof(float));
+				}
+
+				ss.push_back(std::move(s));
+			}
+		}
+
+		void parseAnimations(std::vector<GLTFAnimation> &as, const picojson::array &animations, const std::vector<GLTFAccessor> &accessors,
+			const std::vector<GLTFBufferView> &bufferViews, const std::vector<GLTFBuffer> &buffers) const
+		{
+			for (const auto &animation : animations)
+			{
+				const auto &fields = animation.get<picojson::object>();
+
+				GLTFAnimation a;
+				if (fields.find("name") != fields.end()) a.name = fields.at("name").get<std::string>();
+
+				for (const auto &sampler : fields.at("samplers").get<picojson::array>())
+				{
+					const auto &samplerFields = sampler.get<picojson::object>();
+					const std::string interpolation = samplerFields.find("interpolation") != samplerFields.end() ?
+						samplerFields.at("interpolation").get<std::string>() : "LINEAR";
+
+					GLTFAnimationSampler s;
+					s.times = readFloats(accessors[static_cast<uint32_t>(samplerFields.at("input").get<int64_t>())], bufferViews, buffers);
+					s.values = readFloats(accessors[static_cast<uint32_t>(samplerFields.at("output").get<int64_t>())], bufferViews, buffers);
+					s.step = interpolation == "STEP";
+					if (s.times.empty() || s.values.size() % s.times.size() != 0) throw std::runtime_error("Invalid animation sampler");
+
+					if (interpolation == "CUBICSPLINE")
+					{
+						// In-tangent, value and out-tangent per key
+						const size_t keySize = s.values.size() / s.times.size() / 3;
+						std::vector<float> values;
+						for (size_t k = 0; k < s.times.size(); ++k)
+						{
+							values.insert(values.end(), s.values.begin() + (3 * k + 1) * keySize, s.values.begin() + (3 * k + 2) * keySize);
+						}
+						s.values = std::move(values);
+					}
+
+					a.duration = std::max(a.duration, s.times.back());
+					a.samplers.push_back(std::move(s));
+				}
+
+				for (const auto &channel : fields.at("channels").get<picojson::array>())
+				{
+					const auto &channelFields = channel.get<picojson::object>();
+					const auto &target = channelFields.at("target").get<picojson::object>();
+					if (target.find("node") == target.end()) continue;
+
+					const std::string path = target.at("path").get<std::string>();
+					GLTFAnimationChannel c;
+					c.node = static_cast<uint32_t>(target.at("node").get<int64_t>());
+					c.sampler = static_cast<uint32_t>(channelFields.at("sampler").get<int64_t>());
+					if (path == "translation") c.path = GLTF_PATH_TRANSLATION;
+					else if (path == "rotation") c.path = GLTF_PATH_ROTATION;
+					else if (path == "scale") c.path = GLTF_PATH_SCALE;
+					else if (path == "weights") c.path = GLTF_PATH_WEIGHTS;
+					else continue;
+					a.channels.push_back(c);
+				}
+
+				as.push_back(std::move(a));
+			}
+		}
+
+		// Every component of @acc, which must be float
+		std::vector<float> readFloats(const GLTFAccessor &acc, const std::vector<GLTFBufferView> &bufferViews,
+			const std::vector<GLTFBuffer> &buffers) const
+		{
+			const GLTFAccessorView view = getAccessorView(acc, bufferViews, buffers);
+			if (view.componentType != GLTF_FLOAT) throw std::runtime_error("Only float animation data is supported");
+
+			const uint32_t componentCount = g_attrType2CompCnt.at(acc.type);
+			std::vector<float> values(size_t(view.count) * componentCount);
+			for (uint32_t i = 0; i < view.count; ++i)
+			{
+				memcpy(&values[size_t(i) * componentCount], view.data + size_t(i) * view.stride, componentCount * sizeof(float));
+			}
+			return values;
+		}
+
 		void parseMaterial(std::vector<GLTFMaterial> &mats, const picojson::array &materials) const
 		{
 			for (const auto &material : materials)
@@ -423,7 +972,7 @@ namespace rj
 
 				GLTFAccessor a;
 				a.bufferView = static_cast<uint32_t>(fields.at("bufferView").get<int64_t>());
-				a.byteOffset = static_cast<uint32_t>(fields.at("byteOffset").get<int64_t>());
+				a.byteOffset = fields.find("byteOffset") != fields.end() ? static_cast<uint32_t>(fields.at("byteOffset").get<int64_t>()) : 0;
 				a.componentType = static_cast<rj::GLTFComponentType>(fields.at("componentType").get<int64_t>());
 				a.count = static_cast<uint32_t>(fields.at("count").get<int64_t>());
 				a.type = fields.at("type").get<std::string>();
@@ -440,26 +989,101 @@ namespace rj
 
 				GLTFBufferView bv;
 				bv.buffer = static_cast<uint32_t>(fields.at("buffer").get<int64_t>());
-				bv.byteOffset = static_cast<uint32_t>(fields.at("byteOffset").get<int64_t>());
+				bv.byteOffset = fields.find("byteOffset") != fields.end() ? static_cast<uint32_t>(fields.at("byteOffset").get<int64_t>()) : 0;
 				bv.byteLength = static_cast<uint32_t>(fields.at("byteLength").get<int64_t>());
+				if (fields.find("byteStride") != fields.end()) bv.byteStride = static_cast<uint32_t>(fields.at("byteStride").get<int64_t>());
 
 				bvs.emplace_back(bv);
 			}
 		}
 
-		void parseBuffers(std::vector<GLTFBuffer> &bs, const picojson::array &buffers, const std::string &baseDir) const
+		// A buffer without uri is the binary chunk of a .glb. The others are mapped and their mappings added to @files
+		void parseBuffers(std::vector<GLTFBuffer> &bs, std::vector<std::unique_ptr<AssetFile>> &files, const picojson::array &buffers,
+			const std::string &baseDir, const GLTFBuffer &binChunk) const
 		{
-			size_t p = bs.size();
-			bs.resize(bs.size() + buffers.size());
-
 			for (const auto &buffer : buffers)
 			{
 				const auto &fields = buffer.get<picojson::object>();
+				const size_t byteLength = static_cast<size_t>(fields.at("byteLength").get<int64_t>());
 
-				auto &b = bs[p++];
-				readEntireFile(b, baseDir + "/" + fields.at("uri").get<std::string>());
-				if (b.size() != static_cast<size_t>(fields.at("byteLength").get<int64_t>())) throw std::runtime_error("Incorrect buffer byte length");
+				GLTFBuffer b = binChunk;
+				if (fields.find("uri") != fields.end())
+				{
+					const std::string fn = baseDir + "/" + fields.at("uri").get<std::string>();
+					files.emplace_back(new AssetFile(fn));
+					if (!files.back()->isOpen()) throw std::runtime_error("file: " + fn + " not found");
+					b.data = files.back()->getData();
+					b.size = files.back()->getSize();
+				}
+
+				// The binary chunk may be padded up to 3 bytes past the buffer
+				if (!b.data || b.size < byteLength) throw std::runtime_error("Incorrect buffer byte length");
+				b.size = byteLength;
+				bs.push_back(b);
+			}
+		}
+
+		// Point @json at the JSON chunk of the .glb @file and @binChunk at its binary chunk, if it has one
+		void parseGLBChunks(const AssetFile &file, const char **json, size_t *jsonSize, GLTFBuffer *binChunk) const
+		{
+			struct ChunkHeader
+			{
+				uint32_t length;
+				uint32_t type;
+			};
+			const uint32_t magic = 0x46546C67; // "glTF"
+			const uint32_t jsonType = 0x4E4F534A; // "JSON"
+			const uint32_t binType = 0x004E4942; // "BIN\0"
+
+			uint32_t header[3]; // magic, version, length
+			if (file.getSize() < sizeof(header) + sizeof(ChunkHeader)) throw std::runtime_error("Truncated glb file");
+			memcpy(header, file.getData(), sizeof(header));
+			if (header[0] != magic || header[1] != 2) throw std::runtime_error("Not a glTF 2.0 glb file");
+			const size_t fileSize = std::min(static_cast<size_t>(header[2]), file.getSize());
+
+			size_t offset = sizeof(header);
+			while (offset + sizeof(ChunkHeader) <= fileSize)
+			{
+				ChunkHeader chunk;
+				memcpy(&chunk, file.getData() + offset, sizeof(chunk));
+				offset += sizeof(chunk);
+				if (offset + chunk.length > fileSize) throw std::runtime_error("Truncated glb file");
+
+				if (chunk.type == jsonType && *json == file.getData())
+				{
+					*json = file.getData() + offset;
+					*jsonSize = chunk.length;
+				}
+				else if (chunk.type == binType && !binChunk->data)
+				{
+					binChunk->data = file.getData() + offset;
+					binChunk->size = chunk.length;
+				}
+				offset += chunk.length;
 			}
+
+			if (*json == file.getData()) throw std::runtime_error("glb file has no JSON chunk");
+		}
+
+		GLTFAccessorView getAccessorView(const GLTFAccessor &acc, const std::vector<GLTFBufferView> &bufferViews,
+			const std::vector<GLTFBuffer> &buffers) const
+		{
+			const GLTFBufferView &bv = bufferViews.at(acc.bufferView);
+			const GLTFBuffer &buff = buffers.at(bv.buffer);
+			const uint32_t elementSize = g_attrType2CompCnt.at(acc.type) * g_compType2ByteSize.at(acc.componentType);
+
+			GLTFAccessorView view;
+			view.data = buff.data + bv.byteOffset + acc.byteOffset;
+			view.stride = bv.byteStride > 0 ? bv.byteStride : elementSize;
+			view.count = acc.count;
+			view.componentType = acc.componentType;
+
+			const size_t end = size_t(bv.byteOffset) + acc.byteOffset + (acc.count > 0 ? size_t(acc.count - 1) * view.stride + elementSize : 0);
+			if (size_t(bv.byteOffset) + bv.byteLength > buff.size || end > size_t(bv.byteOffset) + bv.byteLength)
+			{
+				throw std::runtime_error("Accessor out of the bounds of its buffer");
+			}
+			return view;
 		}
 
 		void parseImages(std::vector<GLTFImage> &imgs, const picojson::array &images, const std::string &baseDir) const
@@ -478,7 +1102,8 @@ namespace rj
 
 				assert(tex2D.format() == gli::FORMAT_RGBA8_UNORM_PACK8);
 
-				auto &img = imgs[p++];
+				auto &img = imgs[p];
+				img.index = p++;
 				img.width = tex2D.extent().x;
 				img.height = tex2D.extent().y;
 				img.component = 4; // must be RGBA8 right now
@@ -515,19 +1140,5 @@ namespace rj
 			if (pos == std::string::npos) return "";
 			return fn.substr(pos + 1);
 		}
-
-		void readEntireFile(std::vector<char> &content, const std::string &fn) const
-		{
-			std::ifstream fs(fn, std::ifstream::binary);
-			if (!fs.is_open()) throw std::runtime_error("file: " + fn + " not found");
-
-			fs.seekg(0, std::ifstream::end);
-			size_t fileSize = static_cast<size_t>(fs.tellg());
-			content.resize(fileSize);
-
-			fs.seekg(0, std::ifstream::beg);
-			fs.read(&content[0], static_cast<std::streamsize>(fileSize));
-			fs.close();
-		}
 	};
 }
\ No newline at end of file
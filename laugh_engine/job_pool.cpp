@@ -0,0 +1,105 @@
+#include "job_pool.h"
+
+#include <algorithm>
+
+
+JobPool::JobPool(uint32_t threadCount)
+{
+	if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+	threads.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		threads.emplace_back(&JobPool::work, this);
+	}
+}
+
+JobPool::~JobPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAdded.notify_all();
+
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+}
+
+size_t JobPool::add(std::function<void()> job)
+{
+	size_t idx;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		idx = jobs.size();
+		jobs.emplace_back();
+		jobs.back().function = std::move(job);
+	}
+	jobAdded.notify_one();
+	return idx;
+}
+
+size_t JobPool::getJobCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return jobs.size();
+}
+
+void JobPool::wait(size_t beginJob, size_t endJob)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	endJob = std::min(endJob, jobs.size());
+
+	for (size_t i = beginJob; i < endJob; ++i)
+	{
+		jobDone.wait(lock, [this, i]() { return jobs[i].done; });
+	}
+	for (size_t i = beginJob; i < endJob; ++i)
+	{
+		if (jobs[i].exception) std::rethrow_exception(jobs[i].exception);
+	}
+}
+
+bool JobPool::isDone(size_t beginJob, size_t endJob) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	endJob = std::min(endJob, jobs.size());
+
+	for (size_t i = beginJob; i < endJob; ++i)
+	{
+		if (!jobs[i].done) return false;
+	}
+	return true;
+}
+
+void JobPool::work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		jobAdded.wait(lock, [this]() { return stopping || nextJob < jobs.size(); });
+		if (stopping) return;
+
+		// @jobs may grow while the job runs, so only the index is kept across the unlock
+		const size_t idx = nextJob++;
+		std::function<void()> function = std::move(jobs[idx].function);
+		lock.unlock();
+
+		std::exception_ptr exception;
+		try
+		{
+			function();
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+
+		lock.lock();
+		jobs[idx].exception = exception;
+		jobs[idx].done = true;
+		jobDone.notify_all();
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Runs jobs on a fixed set of worker threads, in the order they were added. A job that throws does not stop the others,
+// its exception is rethrown by the wait that covers it. Destroying the pool drops the jobs that have not started
+class JobPool
+{
+public:
+	// Zero uses one thread per hardware thread
+	explicit JobPool(uint32_t threadCount = 0);
+	~JobPool();
+
+	JobPool(const JobPool &) = delete;
+	JobPool &operator=(const JobPool &) = delete;
+
+	// Return the index of the job
+	size_t add(std::function<void()> job);
+	size_t getJobCount() const;
+
+	// Block until the jobs [@beginJob, @endJob) are done, then rethrow the first exception among them
+	void wait(size_t beginJob, size_t endJob);
+	void waitAll() { wait(0, getJobCount()); }
+	// True if wait() would return or throw without blocking
+	bool isDone(size_t beginJob, size_t endJob) const;
+
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(threads.size()); }
+
+protected:
+	struct Job
+	{
+		std::function<void()> function;
+		std::exception_ptr exception;
+		bool done = false;
+	};
+
+	mutable std::mutex mutex;
+	std::condition_variable jobAdded;
+	std::condition_variable jobDone;
+	std::vector<Job> jobs;
+	size_t nextJob = 0;
+	bool stopping = false;
+
+	std::vector<std::thread> threads;
+
+	void work();
+};
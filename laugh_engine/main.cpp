@@ -9,6 +9,188 @@ std::string GLTF_NAME;
 
 int main(int argc, char *argv[])
 {
+	// Remove "--name" and its value from argv, the remaining arguments are parsed below.
+	// Return the value, @name itself for options without one, or nullptr if the option isn't given
+	auto takeOption = [&argc, argv](const char *name, bool hasValue) -> const char *
+	{
+		const int argCount = hasValue ? 2 : 1;
+		for (int i = 1; i + argCount <= argc; ++i)
+		{
+			if (strcmp(argv[i], name) != 0) continue;
+
+			const char *value = argv[i + argCount - 1];
+			std::copy(argv + i + argCount, argv + argc, argv + i);
+			argc -= argCount;
+			return value;
+		}
+		return nullptr;
+	};
+
+	// --trace <frames> captures a trace of the first frames
+	const char *traceArg = takeOption("--trace", true);
+	const uint32_t traceFrameCount = traceArg ? static_cast<uint32_t>(std::max(std::atoi(traceArg), 1)) : 0;
+
+	// --benchmark <frames> follows the camera path and saves the timings, --headless renders it without a window
+	const char *benchmarkArg = takeOption("--benchmark", true);
+	const uint32_t benchmarkFrameCount = benchmarkArg ? static_cast<uint32_t>(std::max(std::atoi(benchmarkArg), 1)) : 0;
+	const char *cameraPathArg = takeOption("--camera-path", true);
+	const char *benchmarkOutputArg = takeOption("--benchmark-output", true);
+	// --batch <file> renders the jobs of a RenderJobList file headless and exits
+	const char *batchArg = takeOption("--batch", true);
+	// --farm <dir> with --batch shards the jobs across the workers of the RenderFarm in <dir> instead and follows them until
+	// every output is written. --farm-worker <dir> renders its shards headless, --farm-name <name> if there are several workers
+	// per node, until --farm-stop <dir>. The stop file has to be removed before workers are started again
+	const char *farmArg = takeOption("--farm", true);
+	const char *farmWorkerArg = takeOption("--farm-worker", true);
+	const char *farmNameArg = takeOption("--farm-name", true);
+	const char *farmStopArg = takeOption("--farm-stop", true);
+	const bool headless = takeOption("--headless", false) != nullptr || batchArg || farmWorkerArg;
+	// --replay <file> plays back a camera recording, in the benchmark too
+	const char *replayArg = takeOption("--replay", true);
+	// --on-demand starts with m_renderOnDemand on
+	const bool renderOnDemand = takeOption("--on-demand", false) != nullptr;
+	// --asset-pack <file> reads assets from another pack than ASSET_PACK_FILE_NAME. --write-asset-pack <file> loads the loose
+	// files instead and packs every asset the run opened into <file> on exit
+	const char *assetPackArg = takeOption("--asset-pack", true);
+	const char *writeAssetPackArg = takeOption("--write-asset-pack", true);
+	// --capture <file> writes every frame without the text overlay to <file>, as raw texels in the swapchain format
+	const char *captureArg = takeOption("--capture", true);
+	// --command-capture <file> writes the VManager calls of one frame to <file> once the scene has loaded. --command-replay <file>
+	// replays that frame --benchmark <frames> times, or COMMAND_REPLAY_FRAMES, and saves its pass times like the benchmark
+	const char *commandCaptureArg = takeOption("--command-capture", true);
+	const char *commandReplayArg = takeOption("--command-replay", true);
+	// --warm-pipelines compiles every pipeline of this build and device into the pipeline cache and exits, see
+	// DeferredRenderer::m_warmUpPipelines
+	const bool warmUpPipelines = takeOption("--warm-pipelines", false) != nullptr;
+	// --present-mode <fifo|fifo-relaxed|mailbox|immediate> and --swapchain-images <count> configure the swapchain. --low-latency
+	// starts with m_lowLatencyMode on
+	const char *presentModeArg = takeOption("--present-mode", true);
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+	if (presentModeArg && !rj::helper_functions::parsePresentMode(presentModeArg, &presentMode))
+	{
+		std::cerr << presentModeArg << " is not a present mode" << std::endl;
+		return EXIT_FAILURE;
+	}
+	const char *swapChainImagesArg = takeOption("--swapchain-images", true);
+	const uint32_t swapChainImageCount = swapChainImagesArg ? static_cast<uint32_t>(std::max(std::atoi(swapChainImagesArg), 0)) : 0;
+	const bool lowLatency = takeOption("--low-latency", false) != nullptr;
+	// --fp32 keeps the full precision shaders on devices with shaderFloat16, see DeferredRenderer::m_useHalfPrecision
+	const bool fullPrecision = takeOption("--fp32", false) != nullptr;
+	// --ab <toggles> starts the A/B comparison with the first frame, see DeferredRenderer::m_abToggles. It runs until the
+	// window is closed or the benchmark is done
+	const char *abArg = takeOption("--ab", true);
+	// --synthetic <scene> sets the size of the USE_SYNTHETIC_SCENE scene, e.g. "instances=4096,meshes=64,triangles=2000,lights=256,textures=8".
+	// A key given several values separated by '/' sweeps them: every combination is benchmarked by a renderer of its own, each
+	// saved next to the --benchmark-output file with its number appended, and summarized in SYNTHETIC_SWEEP_FILE_NAME
+	const char *syntheticArg = takeOption("--synthetic", true);
+	std::vector<SyntheticSceneParams> syntheticScenes;
+	if (syntheticArg && !parseSyntheticSweep(syntheticArg, &syntheticScenes))
+	{
+		std::cerr << syntheticArg << " is not a synthetic scene" << std::endl;
+		return EXIT_FAILURE;
+	}
+#ifndef USE_SYNTHETIC_SCENE
+	if (syntheticArg)
+	{
+		std::cerr << "--synthetic requires USE_SYNTHETIC_SCENE" << std::endl;
+		return EXIT_FAILURE;
+	}
+#endif
+	const bool syntheticSweep = syntheticScenes.size() > 1;
+	if (syntheticScenes.empty()) syntheticScenes.resize(1);
+	if (headless && benchmarkFrameCount == 0 && !batchArg && !farmWorkerArg && !commandReplayArg && !warmUpPipelines)
+	{
+		std::cerr << "--headless requires --benchmark <frames>" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if ((batchArg || farmWorkerArg) && (benchmarkFrameCount > 0 || captureArg))
+	{
+		std::cerr << "--batch and --farm-worker cannot be combined with --benchmark or --capture" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if ((farmArg && !batchArg) || (batchArg && farmWorkerArg))
+	{
+		std::cerr << "--farm requires --batch <file>, which a --farm-worker gets from the farm" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (commandReplayArg && (commandCaptureArg || batchArg || farmWorkerArg || syntheticSweep))
+	{
+		std::cerr << "--command-replay cannot be combined with --command-capture, --batch, --farm-worker or a --synthetic sweep" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (warmUpPipelines && (benchmarkFrameCount > 0 || batchArg || farmArg || farmWorkerArg || commandReplayArg || syntheticSweep))
+	{
+		std::cerr << "--warm-pipelines cannot be combined with --benchmark, --batch, --farm, --farm-worker, --command-replay or a --synthetic sweep" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (syntheticSweep && (benchmarkFrameCount == 0 || batchArg || farmWorkerArg))
+	{
+		std::cerr << "a --synthetic sweep requires --benchmark <frames> and cannot be combined with --batch or --farm-worker" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (farmStopArg)
+	{
+		RenderFarm farm(farmStopArg);
+		if (!farm.init() || !farm.requestStop())
+		{
+			std::cerr << "cannot write to the render farm " << farmStopArg << std::endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// The coordinator renders nothing itself, the outputs are written by the workers
+	if (farmArg)
+	{
+		RenderJobList jobs;
+		if (!jobs.load(batchArg))
+		{
+			std::cerr << "failed to load render jobs " << batchArg << std::endl;
+			return EXIT_FAILURE;
+		}
+		const std::string error = DeferredRenderer::checkRenderJobs(jobs);
+		if (!error.empty())
+		{
+			std::cerr << error << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		RenderFarm farm(farmArg);
+		const std::string submission = farm.init() ? farm.submit(jobs, RENDER_FARM_SHARD_FRAMES) : std::string();
+		if (submission.empty())
+		{
+			std::cerr << "cannot write to the render farm " << farmArg << std::endl;
+			return EXIT_FAILURE;
+		}
+		size_t outputCount = 0;
+		for (size_t n = 0; n < jobs.size(); ++n) outputCount += jobs.at(n).frameCount;
+		std::cout << "submitted " << submission << " with " << outputCount << " outputs to " << farmArg << std::endl;
+
+		std::vector<std::string> outputs;
+		for (bool done = false; !done; )
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(RENDER_FARM_POLL_MS));
+			const uint32_t requeuedCount = farm.requeueStaleShards(RENDER_FARM_WORKER_TIMEOUT_S);
+			if (requeuedCount > 0) std::cout << "requeued " << requeuedCount << " shards of workers that stopped responding" << std::endl;
+
+			const size_t reportedCount = outputs.size();
+			done = farm.poll(submission, &outputs);
+			for (size_t i = reportedCount; i < outputs.size(); ++i)
+			{
+				std::cout << "output " << i + 1 << " of " << outputCount << ": " << outputs[i] << "\n";
+			}
+			std::cout << std::flush;
+		}
+
+		if (outputs.size() < outputCount)
+		{
+			std::cerr << outputCount - outputs.size() << " outputs are missing, see the workers' logs" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
 #ifdef USE_GLTF
 	if (argc < 2 || (argc > 2 && strcmp(argv[1], "--gltf_version") != 0))
 	{
@@ -19,11 +201,142 @@ int main(int argc, char *argv[])
 	GLTF_NAME = argv[argc - 1];
 #endif
 
-	DeferredRenderer renderer;
+	if (writeAssetPackArg)
+	{
+		AssetFile::startRecording();
+	}
+	else
+	{
+		const std::string packFileName = assetPackArg ? assetPackArg : ASSET_PACK_FILE_NAME;
+		if (!AssetFile::mount(packFileName) && assetPackArg)
+		{
+			std::cerr << packFileName << " is not an asset pack" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
 
 	try
 	{
-		renderer.run();
+		// Outlives the renderer, whose last frames are read back when it waits for the device
+		std::ofstream captureFile;
+		if (captureArg)
+		{
+			captureFile.open(captureArg, std::ios::binary);
+			if (!captureFile.is_open())
+			{
+				std::cerr << "cannot open the capture file " << captureArg << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+
+		std::ofstream sweepFile;
+		if (syntheticSweep)
+		{
+			sweepFile.open(SYNTHETIC_SWEEP_FILE_NAME);
+			if (!sweepFile.is_open())
+			{
+				std::cerr << "cannot open the sweep file " << SYNTHETIC_SWEEP_FILE_NAME << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		const std::string benchmarkFileName = benchmarkOutputArg ? benchmarkOutputArg : BENCHMARK_FILE_NAME;
+
+		// A sweep starts from scratch for every scene, so each one is measured with a cold device and its own memory
+		std::vector<std::string> sweepPassPaths; // columns of the sweep file, the passes of its first scene
+		for (size_t s = 0; s < syntheticScenes.size(); ++s)
+		{
+			// Construction creates the window and the device, which may fail as well
+			StartupProfile::get().beginPhase("create window and device");
+			DeferredRenderer renderer(headless);
+			StartupProfile::get().endPhase();
+			if (traceFrameCount > 0 && s == 0)
+			{
+				renderer.m_traceFrameCount = traceFrameCount;
+				renderer.m_traceCaptureRequested = true;
+			}
+			renderer.m_benchmarkFrameCount = benchmarkFrameCount;
+			renderer.m_renderOnDemand = renderOnDemand;
+			renderer.m_presentMode = presentMode;
+			renderer.m_swapChainImageCount = swapChainImageCount;
+			renderer.m_lowLatencyMode = lowLatency;
+			renderer.m_useHalfPrecision = !fullPrecision;
+			renderer.m_syntheticScene = syntheticScenes[s];
+			if (abArg)
+			{
+				renderer.m_abToggles = abArg;
+				renderer.m_abToggleRequested = true;
+			}
+			if (captureArg)
+			{
+				renderer.m_frameCaptureCallback = [&captureFile](const char *data, VkDeviceSize sizeInBytes, uint32_t, uint32_t, VkFormat, uint64_t)
+				{
+					captureFile.write(data, static_cast<std::streamsize>(sizeInBytes));
+				};
+			}
+			if (cameraPathArg) renderer.m_cameraPathFileName = cameraPathArg;
+			renderer.m_benchmarkFileName = benchmarkFileName;
+			if (syntheticSweep)
+			{
+				// benchmark.json becomes benchmark_0.json, benchmark_1.json, ...
+				const size_t dot = benchmarkFileName.find_last_of('.');
+				const size_t separator = benchmarkFileName.find_last_of("/\\");
+				const size_t stemEnd = dot != std::string::npos && (separator == std::string::npos || dot > separator) ? dot : benchmarkFileName.size();
+				renderer.m_benchmarkFileName = benchmarkFileName.substr(0, stemEnd) + "_" + std::to_string(s) + benchmarkFileName.substr(stemEnd);
+				std::cout << "synthetic scene " << s + 1 << " of " << syntheticScenes.size() << ": " << syntheticScenes[s].toString() << std::endl;
+			}
+			if (batchArg) renderer.m_batchJobFileName = batchArg;
+			if (farmWorkerArg) renderer.m_farmDirectory = farmWorkerArg;
+			if (farmNameArg) renderer.m_farmWorkerName = farmNameArg;
+			if (commandCaptureArg && s == 0) renderer.m_commandCaptureFileName = commandCaptureArg;
+			if (commandReplayArg) renderer.m_commandReplayFileName = commandReplayArg;
+			renderer.m_warmUpPipelines = warmUpPipelines;
+			if (replayArg)
+			{
+				renderer.m_cameraRecordingFileName = replayArg;
+				renderer.m_cameraPlaybackRequested = true;
+			}
+
+			renderer.run();
+
+			if (!syntheticSweep) continue;
+			const DeferredRenderer::BenchmarkSummary &summary = renderer.m_benchmarkSummary;
+			if (s == 0)
+			{
+				sweepFile << "instances,meshes,trianglesPerMesh,lights,textures,triangles,cpuP50MS,cpuP95MS,gpuP50MS,gpuP95MS,deviceLocalMB,hostVisibleMB";
+				for (const auto &pass : summary.passAvgMS)
+				{
+					sweepPassPaths.push_back(pass.first);
+					sweepFile << "," << pass.first << "MS";
+				}
+				sweepFile << "\n";
+			}
+
+			const SyntheticSceneParams &scene = syntheticScenes[s];
+			sweepFile << scene.instanceCount << "," << scene.meshCount << "," << scene.trianglesPerMesh << "," << scene.lightCount << "," <<
+				scene.textureCount << "," << summary.triangleCount << "," << summary.cpuMS.p50 << "," << summary.cpuMS.p95 << "," <<
+				summary.gpuMS.p50 << "," << summary.gpuMS.p95 << "," << summary.deviceLocalBytes / (1024.0 * 1024.0) << "," <<
+				summary.hostVisibleBytes / (1024.0 * 1024.0);
+			// A pass that is missing from this scene leaves its column empty
+			for (const auto &path : sweepPassPaths)
+			{
+				auto it = std::find_if(summary.passAvgMS.begin(), summary.passAvgMS.end(),
+					[&path](const std::pair<std::string, float> &pass) { return pass.first == path; });
+				sweepFile << ",";
+				if (it != summary.passAvgMS.end()) sweepFile << it->second;
+			}
+			sweepFile << std::endl;
+		}
+
+		if (writeAssetPackArg)
+		{
+			const std::vector<std::string> fileNames = AssetFile::stopRecording();
+			if (!AssetPack::write(writeAssetPackArg, fileNames))
+			{
+				std::cerr << "cannot write the asset pack " << writeAssetPackArg << std::endl;
+				return EXIT_FAILURE;
+			}
+			std::cout << "packed " << fileNames.size() << " files into " << writeAssetPackArg << std::endl;
+		}
 	}
 	catch (const std::runtime_error& e)
 	{
@@ -0,0 +1,86 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string &fileName)
+{
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return;
+	fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+
+	mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mappingHandle) return;
+
+	data = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (data) size = static_cast<size_t>(fileSize.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data) UnmapViewOfFile(data);
+	if (mappingHandle) CloseHandle(mappingHandle);
+	if (fileHandle) CloseHandle(fileHandle);
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const
+{
+	if (!data || offset >= size) return;
+
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<char *>(getData()) + offset;
+	range.NumberOfBytes = std::min(length, size - offset);
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+#else
+MappedFile::MappedFile(const std::string &fileName)
+{
+	const int file = open(fileName.c_str(), O_RDONLY);
+	if (file < 0) return;
+
+	struct stat fileStat;
+	if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+	{
+		void *mapping = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+		if (mapping != MAP_FAILED)
+		{
+			data = mapping;
+			size = static_cast<size_t>(fileStat.st_size);
+		}
+	}
+
+	// The mapping keeps the file referenced
+	close(file);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data) munmap(const_cast<void *>(data), size);
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const
+{
+	if (!data || offset >= size) return;
+
+	// madvise wants a page aligned start
+	const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t begin = offset / pageSize * pageSize;
+	const size_t end = std::min(offset + length, size);
+	madvise(const_cast<char *>(getData()) + begin, end - begin, MADV_WILLNEED);
+}
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+
+// Read-only memory mapping of a whole file. Pages are read in on first access, so touching a part of the file
+// only reads that part. Not open if the file does not exist or is empty
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string &fileName);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool isOpen() const { return data != nullptr; }
+	const char *getData() const { return static_cast<const char *>(data); }
+	size_t getSize() const { return size; }
+
+	// Start reading @length bytes from @offset in the background, in large sequential reads instead of a page fault at a time
+	void prefetch(size_t offset, size_t length) const;
+
+protected:
+	const void *data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void *fileHandle = nullptr;
+	void *mappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,229 @@
+#include "mesh_codec.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define MESH_CODEC_SSSE3 1
+#else
+#define MESH_CODEC_SSSE3 0
+#endif
+
+#if MESH_CODEC_SSSE3 || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MESH_CODEC_SSE2 1
+#else
+#define MESH_CODEC_SSE2 0
+#endif
+
+
+namespace
+{
+	inline uint32_t zigzag(uint32_t v)
+	{
+		return (v << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(v) >> 31);
+	}
+
+	inline uint32_t unzigzag(uint32_t v)
+	{
+		return (v >> 1) ^ (0u - (v & 1));
+	}
+
+	inline uint32_t getByteLength(uint32_t v)
+	{
+		return v < (1u << 8) ? 1 : v < (1u << 16) ? 2 : v < (1u << 24) ? 3 : 4;
+	}
+
+#if MESH_CODEC_SSSE3
+	// Per control byte, where each of the four values takes its bytes from and how many bytes the group takes
+	struct GroupTables
+	{
+		alignas(16) uint8_t shuffles[256][16];
+		uint8_t lengths[256];
+
+		GroupTables()
+		{
+			for (uint32_t control = 0; control < 256; ++control)
+			{
+				uint8_t pos = 0;
+				for (uint32_t i = 0; i < 4; ++i)
+				{
+					const uint32_t length = ((control >> (2 * i)) & 3) + 1;
+					for (uint32_t b = 0; b < 4; ++b)
+					{
+						shuffles[control][4 * i + b] = b < length ? pos++ : 0x80;
+					}
+				}
+				lengths[control] = pos;
+			}
+		}
+	};
+
+	const GroupTables &getGroupTables()
+	{
+		static const GroupTables tables;
+		return tables;
+	}
+#endif
+}
+
+void encodeGroupVarints(const uint32_t *values, size_t count, std::vector<uint8_t> *pOut)
+{
+	const size_t controlBytes = (count + 3) / 4;
+	const size_t base = pOut->size();
+	pOut->resize(base + controlBytes);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint32_t length = getByteLength(values[i]);
+		(*pOut)[base + i / 4] |= static_cast<uint8_t>((length - 1) << (2 * (i % 4)));
+		for (uint32_t b = 0; b < length; ++b)
+		{
+			pOut->push_back(static_cast<uint8_t>(values[i] >> (8 * b)));
+		}
+	}
+}
+
+size_t decodeGroupVarints(const uint8_t *data, size_t size, uint32_t *values, size_t count)
+{
+	const size_t controlBytes = (count + 3) / 4;
+	if (size < controlBytes) return 0;
+	const uint8_t *controls = data;
+	const uint8_t *pos = data + controlBytes;
+	const uint8_t *end = data + size;
+	size_t i = 0;
+
+#if MESH_CODEC_SSSE3
+	// The 16 byte load may run past the group, so the last groups of the stream go through the scalar loop
+	const GroupTables &tables = getGroupTables();
+	for (; i + 4 <= count && end - pos >= 16; i += 4)
+	{
+		const uint8_t control = controls[i / 4];
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+		const __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i *>(tables.shuffles[control]));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(values + i), _mm_shuffle_epi8(bytes, shuffle));
+		pos += tables.lengths[control];
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		const uint32_t length = ((controls[i / 4] >> (2 * (i % 4))) & 3) + 1;
+		if (static_cast<size_t>(end - pos) < length) return 0;
+		uint32_t v = 0;
+		for (uint32_t b = 0; b < length; ++b)
+		{
+			v |= static_cast<uint32_t>(pos[b]) << (8 * b);
+		}
+		values[i] = v;
+		pos += length;
+	}
+	return pos - data;
+}
+
+void encodeFloatStream(const float *values, size_t count, size_t stride, float offset, float step, std::vector<uint8_t> *pOut)
+{
+	const double minQ = std::numeric_limits<int32_t>::min();
+	const double maxQ = std::numeric_limits<int32_t>::max();
+	std::vector<uint32_t> codes(count);
+	uint32_t prev = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		double q = std::floor((static_cast<double>(values[i * stride]) - offset) / step + 0.5);
+		if (!(q >= minQ)) q = minQ;
+		if (q > maxQ) q = maxQ;
+		const uint32_t cur = static_cast<uint32_t>(static_cast<int32_t>(q));
+		codes[i] = zigzag(cur - prev);
+		prev = cur;
+	}
+	encodeGroupVarints(codes.data(), count, pOut);
+}
+
+size_t decodeFloatStream(const uint8_t *data, size_t size, float *values, size_t count, size_t stride, float offset, float step,
+	std::vector<int32_t> *pScratch)
+{
+	pScratch->resize(count);
+	uint32_t *codes = reinterpret_cast<uint32_t *>(pScratch->data());
+	const size_t bytes = decodeGroupVarints(data, size, codes, count);
+	if (bytes == 0 && count > 0) return 0;
+
+	// Undo the zigzag and sum the deltas up in place, then dequantize
+	size_t i = 0;
+	uint32_t prev = 0;
+#if MESH_CODEC_SSE2
+	const __m128i one = _mm_set1_epi32(1);
+	__m128i prev4 = _mm_setzero_si128();
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + i));
+		v = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, one)));
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+		v = _mm_add_epi32(v, prev4);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(codes + i), v);
+		prev4 = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	if (i > 0) prev = codes[i - 1];
+#endif
+	for (; i < count; ++i)
+	{
+		prev += unzigzag(codes[i]);
+		codes[i] = prev;
+	}
+
+	const int32_t *q = pScratch->data();
+	i = 0;
+#if MESH_CODEC_SSE2
+	const __m128 offset4 = _mm_set1_ps(offset);
+	const __m128 step4 = _mm_set1_ps(step);
+	alignas(16) float dequantized[4];
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128 v = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(q + i))), step4), offset4);
+		if (stride == 1)
+		{
+			_mm_storeu_ps(values + i, v);
+			continue;
+		}
+		_mm_store_ps(dequantized, v);
+		for (size_t k = 0; k < 4; ++k)
+		{
+			values[(i + k) * stride] = dequantized[k];
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		values[i * stride] = static_cast<float>(q[i]) * step + offset;
+	}
+	return bytes;
+}
+
+void encodeIndexBuffer(const uint32_t *indices, size_t count, std::vector<uint8_t> *pOut)
+{
+	std::vector<uint32_t> codes(count);
+	uint32_t next = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		codes[i] = zigzag(next - indices[i]);
+		next = std::max(next, indices[i] + 1);
+	}
+	encodeGroupVarints(codes.data(), count, pOut);
+}
+
+size_t decodeIndexBuffer(const uint8_t *data, size_t size, uint32_t *indices, size_t count)
+{
+	const size_t bytes = decodeGroupVarints(data, size, indices, count);
+	if (bytes == 0 && count > 0) return 0;
+
+	// Each index depends on the ones before, this pass is cheap next to the group decoding
+	uint32_t next = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint32_t index = next - unzigzag(indices[i]);
+		indices[i] = index;
+		next = std::max(next, index + 1);
+	}
+	return bytes;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// Byte codec of cooked meshes. Integers are stored in groups of four behind a control byte holding 2 bits per value for its
+// length of 1 to 4 bytes, all control bytes first, so the decoder expands a whole group with one byte shuffle and never
+// branches per value. The shuffle needs SSSE3 (or AVX with MSVC), other builds decode the groups with scalar code
+
+// Append the group coded @values to @pOut
+void encodeGroupVarints(const uint32_t *values, size_t count, std::vector<uint8_t> *pOut);
+// Return the bytes read, 0 if @size is too small for @count values
+size_t decodeGroupVarints(const uint8_t *data, size_t size, uint32_t *values, size_t count);
+
+// Quantize every @stride-th float of @values to a multiple of @step above @offset and code the zigzagged differences of
+// consecutive values, which stay small along a mesh in vertex fetch order. Values beyond the int32 range are clamped
+void encodeFloatStream(const float *values, size_t count, size_t stride, float offset, float step, std::vector<uint8_t> *pOut);
+// @pScratch holds the integers between the passes, kept by the caller to not allocate per stream
+size_t decodeFloatStream(const uint8_t *data, size_t size, float *values, size_t count, size_t stride, float offset, float step,
+	std::vector<int32_t> *pScratch);
+
+// Each index is coded as its zigzagged distance below the next vertex not referenced yet: 0 for the first use of a vertex in
+// fetch order, small for the vertices a vertex cache optimized index buffer reuses shortly after
+void encodeIndexBuffer(const uint32_t *indices, size_t count, std::vector<uint8_t> *pOut);
+size_t decodeIndexBuffer(const uint8_t *data, size_t size, uint32_t *indices, size_t count);
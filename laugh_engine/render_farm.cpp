@@ -0,0 +1,299 @@
+#include "render_farm.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#include "vk_helpers.h"
+
+
+namespace
+{
+	const char *const pendingDir = "pending";
+	const char *const claimedDir = "claimed";
+	const char *const doneDir = "done";
+	const char *const framesDir = "frames";
+	const char *const workersDir = "workers";
+	const char *const submissionsDir = "submissions";
+	const char *const stopFile = "stop";
+
+	int64_t getTime()
+	{
+		return static_cast<int64_t>(std::time(nullptr));
+	}
+
+	bool hasPrefix(const std::string &s, const std::string &prefix)
+	{
+		return s.compare(0, prefix.size(), prefix) == 0;
+	}
+}
+
+bool RenderFarm::init()
+{
+	using rj::helper_functions::createDirectory;
+	return createDirectory(directory) && createDirectory(getPath(pendingDir)) && createDirectory(getPath(claimedDir)) &&
+		createDirectory(getPath(doneDir)) && createDirectory(getPath(framesDir)) && createDirectory(getPath(workersDir)) &&
+		createDirectory(getPath(submissionsDir));
+}
+
+std::string RenderFarm::submit(const RenderJobList &jobs, uint32_t shardFrames)
+{
+	// A job without an environment renders in the one of the job before it, which another node does not know
+	std::vector<RenderJob> resolved;
+	resolved.reserve(jobs.size());
+	int32_t environment = -1;
+	for (size_t n = 0; n < jobs.size(); ++n)
+	{
+		resolved.push_back(jobs.at(n));
+		if (resolved.back().environment >= 0) environment = resolved.back().environment;
+		resolved.back().environment = environment;
+	}
+	std::stable_sort(resolved.begin(), resolved.end(), [](const RenderJob &a, const RenderJob &b) { return a.environment < b.environment; });
+
+	std::string submission = "s" + std::to_string(getTime());
+	for (uint32_t i = 1; std::ifstream(getPath(submissionsDir, submission)).is_open(); ++i)
+	{
+		submission = "s" + std::to_string(getTime()) + "-" + std::to_string(i);
+	}
+
+	// Written to a name workers do not look at, then moved to pending, so no worker claims a shard that is still being written
+	uint32_t shardCount = 0;
+	for (size_t begin = 0; begin < resolved.size(); )
+	{
+		RenderJobList shard;
+		uint32_t frames = 0;
+		size_t end = begin;
+		for (; end < resolved.size() && resolved[end].environment == resolved[begin].environment && (frames == 0 || frames + resolved[end].frameCount <= shardFrames); ++end)
+		{
+			shard.add(resolved[end]);
+			frames += resolved[end].frameCount;
+		}
+
+		std::ostringstream ss;
+		ss << submission << "_" << std::setw(6) << std::setfill('0') << shardCount << "_e" << resolved[begin].environment << ".jobs";
+		const std::string tempFileName = getPath(pendingDir, ss.str() + ".tmp");
+		if (!shard.save(tempFileName) || std::rename(tempFileName.c_str(), getPath(pendingDir, ss.str()).c_str()) != 0)
+		{
+			return std::string();
+		}
+		++shardCount;
+		begin = end;
+	}
+
+	std::ofstream file(getPath(submissionsDir, submission), std::ios::trunc);
+	file << shardCount << "\n";
+	return file.good() ? submission : std::string();
+}
+
+bool RenderFarm::poll(const std::string &submission, std::vector<std::string> *pOutputs)
+{
+	const std::string prefix = submission + "_";
+
+	for (const auto &name : listDirectory(getPath(framesDir)))
+	{
+		if (!hasPrefix(name, prefix)) continue;
+
+		std::ifstream file(getPath(framesDir, name), std::ios::binary);
+		if (!file.is_open()) continue;
+
+		// Only whole lines, the worker may be appending the next one
+		uint64_t &offset = logOffsets[name];
+		file.seekg(static_cast<std::streamoff>(offset));
+		const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		size_t lineBegin = 0;
+		for (size_t lineEnd; (lineEnd = text.find('\n', lineBegin)) != std::string::npos; lineBegin = lineEnd + 1)
+		{
+			const std::string output = text.substr(lineBegin, lineEnd - lineBegin);
+			if (reportedOutputs.insert(output).second) pOutputs->push_back(output);
+		}
+		offset += lineBegin;
+	}
+
+	uint32_t shardCount = 0;
+	std::ifstream file(getPath(submissionsDir, submission));
+	if (!(file >> shardCount)) return false;
+
+	const std::vector<std::string> done = listDirectory(getPath(doneDir));
+	return static_cast<uint32_t>(std::count_if(done.begin(), done.end(), [&prefix](const std::string &name) { return hasPrefix(name, prefix); })) >= shardCount;
+}
+
+uint32_t RenderFarm::requeueStaleShards(int64_t timeoutSeconds)
+{
+	const int64_t now = getTime();
+	uint32_t count = 0;
+	for (const auto &worker : listDirectory(getPath(claimedDir)))
+	{
+		// A heartbeat being rewritten reads as nothing, which is not taken for a stale one
+		std::ifstream file(getPath(workersDir, worker));
+		int64_t lastSeen;
+		if (file.is_open() && (!(file >> lastSeen) || now - lastSeen <= timeoutSeconds)) continue;
+
+		const std::string workerDir = getPath(claimedDir, worker);
+		for (const auto &name : listDirectory(workerDir))
+		{
+			if (std::rename((workerDir + "/" + name).c_str(), getPath(pendingDir, name).c_str()) == 0) ++count;
+		}
+	}
+	return count;
+}
+
+bool RenderFarm::requestStop()
+{
+	std::ofstream file(getPath(stopFile), std::ios::trunc);
+	return file.is_open();
+}
+
+std::string RenderFarm::getDefaultWorkerName()
+{
+#ifdef _WIN32
+	const char *name = std::getenv("COMPUTERNAME");
+	return name ? name : "worker";
+#else
+	char name[256] = {};
+	return gethostname(name, sizeof(name) - 1) == 0 && name[0] ? name : "worker";
+#endif
+}
+
+void RenderFarm::releaseShards(const std::string &worker)
+{
+	const std::string workerDir = getPath(claimedDir, worker);
+	rj::helper_functions::createDirectory(workerDir);
+	for (const auto &name : listDirectory(workerDir))
+	{
+		std::rename((workerDir + "/" + name).c_str(), getPath(pendingDir, name).c_str());
+	}
+}
+
+void RenderFarm::heartbeat(const std::string &worker)
+{
+	std::ofstream file(getPath(workersDir, worker), std::ios::trunc);
+	file << getTime() << "\n";
+}
+
+bool RenderFarm::claimShard(const std::string &worker, const std::vector<int32_t> &warmEnvironments, Shard *pShard)
+{
+	struct Candidate
+	{
+		Shard shard;
+		uint32_t rank; // 0 for a warm environment, 1 for the startup one, 2 for the others
+		size_t order;
+	};
+
+	std::vector<Candidate> candidates;
+	for (const auto &name : listDirectory(getPath(pendingDir)))
+	{
+		Candidate candidate;
+		if (!parseShardName(name, &candidate.shard)) continue;
+
+		const int32_t environment = candidate.shard.environment;
+		candidate.rank = std::find(warmEnvironments.begin(), warmEnvironments.end(), environment) != warmEnvironments.end() ? 0 :
+			environment < 0 ? 1 : 2;
+		candidates.push_back(candidate);
+	}
+	if (candidates.empty()) return false;
+
+	// Warm shards are taken in submission order. Cold workers start at different shards, so they do not all queue up on
+	// the first environment and each of them loads another one
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) { return a.shard.name < b.shard.name; });
+	const size_t start = std::hash<std::string>()(worker) % candidates.size();
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		candidates[i].order = candidates[i].rank < 2 ? i : (i + candidates.size() - start) % candidates.size();
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+	{
+		return a.rank != b.rank ? a.rank < b.rank : a.order < b.order;
+	});
+
+	// Another worker may have renamed it first
+	for (const auto &candidate : candidates)
+	{
+		if (std::rename(getPath(pendingDir, candidate.shard.name).c_str(), getShardJobFileName(worker, candidate.shard).c_str()) == 0)
+		{
+			*pShard = candidate.shard;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::string RenderFarm::getShardJobFileName(const std::string &worker, const Shard &shard) const
+{
+	return getPath(claimedDir, worker + "/" + shard.name);
+}
+
+void RenderFarm::outputWritten(const Shard &shard, const std::string &outputFileName)
+{
+	std::lock_guard<std::mutex> lock(logMutex);
+	std::ofstream file(getPath(framesDir, shard.name + ".log"), std::ios::binary | std::ios::app);
+	file << outputFileName << "\n";
+}
+
+void RenderFarm::shardDone(const std::string &worker, const Shard &shard)
+{
+	// Fails if the shard was requeued meanwhile, whose outputs are then written again
+	std::rename(getShardJobFileName(worker, shard).c_str(), getPath(doneDir, shard.name).c_str());
+}
+
+bool RenderFarm::isStopRequested() const
+{
+	return std::ifstream(getPath(stopFile)).is_open();
+}
+
+std::string RenderFarm::getPath(const char *subdirectory, const std::string &name) const
+{
+	return name.empty() ? directory + "/" + subdirectory : directory + "/" + subdirectory + "/" + name;
+}
+
+std::vector<std::string> RenderFarm::listDirectory(const std::string &dir)
+{
+	std::vector<std::string> names;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE) return names;
+	do
+	{
+		if (strcmp(data.cFileName, ".") != 0 && strcmp(data.cFileName, "..") != 0) names.push_back(data.cFileName);
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR *d = opendir(dir.c_str());
+	if (!d) return names;
+	while (const dirent *entry = readdir(d))
+	{
+		if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) names.push_back(entry->d_name);
+	}
+	closedir(d);
+#endif
+	return names;
+}
+
+bool RenderFarm::parseShardName(const std::string &name, Shard *pShard)
+{
+	// <submission>_<index>_e<environment>.jobs
+	const std::string extension = ".jobs";
+	if (name.size() <= extension.size() || name.compare(name.size() - extension.size(), extension.size(), extension) != 0) return false;
+	const size_t e = name.rfind("_e");
+	if (e == std::string::npos) return false;
+
+	pShard->name = name;
+	pShard->environment = std::atoi(name.c_str() + e + 2);
+	return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "render_jobs.h"
+
+
+// Batch rendering across nodes that share a farm directory, e.g. a network share next to the outputs. A coordinator splits
+// a RenderJobList into shards of one environment each and writes them to pending/. Workers keep their renderer between shards
+// and claim one by renaming it into claimed/<worker>/, which only one of them can do, preferring the environments they have
+// resident. Each output is appended to the shard's log in frames/ as soon as it is written, which the coordinator follows,
+// and the finished shard moves to done/. Workers refresh workers/<worker> with their clock, and the shards of a worker that
+// has stopped doing so go back to pending/, so the nodes' clocks are expected to agree to well within the timeout
+class RenderFarm
+{
+public:
+	struct Shard
+	{
+		std::string name; // of its files in the subdirectories
+		int32_t environment = -1; // of all its jobs, -1 for the one loaded at startup
+	};
+
+	explicit RenderFarm(const std::string &directory) : directory(directory) {}
+
+	// Create the subdirectories, false if the farm directory cannot be written
+	bool init();
+
+	// Coordinator
+
+	// Write @jobs as shards of about @shardFrames frames, a turntable is never split. Return the name of the submission, empty
+	// on failure
+	std::string submit(const RenderJobList &jobs, uint32_t shardFrames);
+	// Append the outputs of @submission written since the last call to @pOutputs, each once even if its shard was requeued.
+	// Return true once all shards of @submission are done
+	bool poll(const std::string &submission, std::vector<std::string> *pOutputs);
+	// Put the shards of workers not heard from for @timeoutSeconds back to pending, return how many
+	uint32_t requeueStaleShards(int64_t timeoutSeconds);
+	// Workers exit once they have finished their current shard
+	bool requestStop();
+
+	// Worker
+
+	// From the environment, unique per node but not per process
+	static std::string getDefaultWorkerName();
+	// Put the shards a previous run of @worker left claimed back to pending
+	void releaseShards(const std::string &worker);
+	void heartbeat(const std::string &worker);
+	// Claim a shard of one of @warmEnvironments if there is one, otherwise of the startup environment, otherwise any.
+	// False if there is none left
+	bool claimShard(const std::string &worker, const std::vector<int32_t> &warmEnvironments, Shard *pShard);
+	std::string getShardJobFileName(const std::string &worker, const Shard &shard) const;
+	// Thread safe, called by the threads writing the outputs
+	void outputWritten(const Shard &shard, const std::string &outputFileName);
+	void shardDone(const std::string &worker, const Shard &shard);
+	bool isStopRequested() const;
+
+protected:
+	std::string directory;
+	std::mutex logMutex;
+
+	// Of the coordinator
+	std::unordered_map<std::string, uint64_t> logOffsets; // bytes of each log read so far
+	std::unordered_set<std::string> reportedOutputs;
+
+	std::string getPath(const char *subdirectory, const std::string &name = std::string()) const;
+	static std::vector<std::string> listDirectory(const std::string &dir);
+	static bool parseShardName(const std::string &name, Shard *pShard);
+};
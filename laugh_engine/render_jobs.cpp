@@ -0,0 +1,82 @@
+#include "render_jobs.h"
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+
+std::string RenderJob::getOutputFileName(uint32_t frame) const
+{
+	if (frameCount == 1) return outputFileName;
+
+	// An extension is a dot after the last directory separator
+	const size_t dot = outputFileName.find_last_of('.');
+	const size_t separator = outputFileName.find_last_of("/\\");
+	const size_t stemEnd = dot != std::string::npos && (separator == std::string::npos || dot > separator) ? dot : outputFileName.size();
+
+	std::ostringstream ss;
+	ss << outputFileName.substr(0, stemEnd) << "_" << std::setw(4) << std::setfill('0') << frame << outputFileName.substr(stemEnd);
+	return ss.str();
+}
+
+void RenderJob::getCamera(uint32_t frame, glm::vec3 *pPosition, glm::vec3 *pLookAtPos) const
+{
+	const float angle = 2.f * 3.14159265f * frame / frameCount;
+	const float c = std::cos(angle);
+	const float s = std::sin(angle);
+	const glm::vec3 offset = position - lookAtPos;
+
+	*pPosition = lookAtPos + glm::vec3(c * offset.x + s * offset.z, offset.y, -s * offset.x + c * offset.z);
+	*pLookAtPos = lookAtPos;
+}
+
+bool RenderJobList::load(const std::string &fileName)
+{
+	std::ifstream file(fileName);
+	if (!file.is_open()) return false;
+
+	jobs.clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#') continue;
+
+		RenderJob job;
+		std::istringstream ss(line);
+		ss >> job.outputFileName >> job.width >> job.height
+			>> job.position.x >> job.position.y >> job.position.z
+			>> job.lookAtPos.x >> job.lookAtPos.y >> job.lookAtPos.z;
+		if (ss.fail() || job.width == 0 || job.height == 0) return false;
+
+		// Both are optional, a failed read would zero them
+		uint32_t frameCount;
+		int32_t environment;
+		if (ss >> frameCount)
+		{
+			if (frameCount == 0) return false;
+			job.frameCount = frameCount;
+			if (ss >> environment) job.environment = environment;
+		}
+
+		jobs.push_back(job);
+	}
+
+	return !jobs.empty();
+}
+
+bool RenderJobList::save(const std::string &fileName) const
+{
+	std::ofstream file(fileName, std::ios::trunc);
+	if (!file.is_open()) return false;
+
+	file << std::setprecision(9);
+	for (const auto &job : jobs)
+	{
+		file << job.outputFileName << " " << job.width << " " << job.height << " "
+			<< job.position.x << " " << job.position.y << " " << job.position.z << " "
+			<< job.lookAtPos.x << " " << job.lookAtPos.y << " " << job.lookAtPos.z << " "
+			<< job.frameCount << " " << job.environment << "\n";
+	}
+	return file.good();
+}
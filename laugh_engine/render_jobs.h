@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+
+// One image, or one turntable of images, rendered by the batch mode
+struct RenderJob
+{
+	std::string outputFileName; // .dds or .ktx, turntable frames get their number appended to the stem
+	uint32_t width, height;
+	glm::vec3 position; // of the camera, the first frame's for a turntable
+	glm::vec3 lookAtPos;
+	uint32_t frameCount = 1; // more than one orbits the camera once around the look-at point about the y-axis
+	int32_t environment = -1; // into PROBE_BASE_DIRS with USE_PROBE_SWITCHING, -1 keeps the previous job's
+
+	std::string getOutputFileName(uint32_t frame) const;
+	void getCamera(uint32_t frame, glm::vec3 *pPosition, glm::vec3 *pLookAtPos) const;
+};
+
+// The file has one "output width height px py pz lx ly lz [frames [environment]]" line per job. Lines starting with # are ignored
+class RenderJobList
+{
+public:
+	bool load(const std::string &fileName);
+	// Every job gets its frame count and environment written out, so the file does not depend on the jobs before it
+	bool save(const std::string &fileName) const;
+
+	void add(const RenderJob &job) { jobs.push_back(job); }
+
+	bool empty() const { return jobs.empty(); }
+	size_t size() const { return jobs.size(); }
+	const RenderJob &at(size_t job) const { return jobs[job]; }
+
+protected:
+	std::vector<RenderJob> jobs;
+};
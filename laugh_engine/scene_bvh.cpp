@@ -0,0 +1,221 @@
+#include "scene_bvh.h"
+#include <algorithm>
+#include <numeric>
+
+
+namespace
+{
+	const uint32_t INVALID_NODE = std::numeric_limits<uint32_t>::max();
+
+	void grow(BBox *pBox, const BBox &other)
+	{
+		pBox->min = glm::min(pBox->min, other.min);
+		pBox->max = glm::max(pBox->max, other.max);
+	}
+
+	float surfaceArea(const BBox &box)
+	{
+		if (SceneBVH::isEmpty(box)) return 0.f;
+		const glm::vec3 d = box.max - box.min;
+		return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	// Distance along the ray to where it enters @box, 0 if it starts inside
+	bool intersectRay(const BBox &box, const glm::vec3 &origin, const glm::vec3 &invDir, float maxDistance, float *pDistance)
+	{
+		const glm::vec3 t0 = (box.min - origin) * invDir;
+		const glm::vec3 t1 = (box.max - origin) * invDir;
+		const glm::vec3 tMin = glm::min(t0, t1);
+		const glm::vec3 tMax = glm::max(t0, t1);
+		const float tEnter = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.f));
+		const float tExit = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxDistance));
+		*pDistance = tEnter;
+		return tEnter <= tExit;
+	}
+}
+
+void SceneBVH::build(const std::vector<BBox> &boxes)
+{
+	itemBoxes = boxes;
+	itemLeaves.assign(boxes.size(), 0);
+	leafItems.resize(boxes.size());
+	std::iota(leafItems.begin(), leafItems.end(), 0);
+
+	nodes.clear();
+	if (boxes.empty()) return;
+	nodes.reserve(2 * boxes.size());
+	nodes.push_back({ BBox(), INVALID_NODE, 0, 0 });
+	buildNode(0, 0, static_cast<uint32_t>(boxes.size()), 0);
+}
+
+void SceneBVH::buildNode(uint32_t nodeIdx, uint32_t first, uint32_t count, uint32_t depth)
+{
+	BBox box, centroidBox;
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		const BBox &itemBox = itemBoxes[leafItems[i]];
+		if (isEmpty(itemBox)) continue;
+		grow(&box, itemBox);
+		const glm::vec3 centroid = 0.5f * (itemBox.min + itemBox.max);
+		grow(&centroidBox, BBox(centroid, centroid));
+	}
+	nodes[nodeIdx].box = box;
+
+	auto makeLeaf = [&]()
+	{
+		nodes[nodeIdx].first = first;
+		nodes[nodeIdx].count = count;
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			itemLeaves[leafItems[i]] = nodeIdx;
+		}
+	};
+
+	// Split along the longest axis of the centroids. Items with coincident centroids, or only empty boxes, stay together
+	const glm::vec3 extent = isEmpty(centroidBox) ? glm::vec3(0.f) : centroidBox.max - centroidBox.min;
+	const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	if (count <= BVH_LEAF_SIZE || extent[axis] <= 0.f || depth + 1 >= BVH_MAX_DEPTH)
+	{
+		makeLeaf();
+		return;
+	}
+
+	const float binScale = BVH_SAH_BIN_COUNT / extent[axis];
+	auto binOf = [&](uint32_t item)
+	{
+		const BBox &itemBox = itemBoxes[item];
+		if (isEmpty(itemBox)) return 0;
+		const float c = 0.5f * (itemBox.min[axis] + itemBox.max[axis]);
+		return std::min(static_cast<int>((c - centroidBox.min[axis]) * binScale), BVH_SAH_BIN_COUNT - 1);
+	};
+
+	BBox binBoxes[BVH_SAH_BIN_COUNT];
+	uint32_t binCounts[BVH_SAH_BIN_COUNT] = {};
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		const int bin = binOf(leafItems[i]);
+		grow(&binBoxes[bin], itemBoxes[leafItems[i]]);
+		++binCounts[bin];
+	}
+
+	// Cost of splitting before bin s is count * area summed over both sides, swept from the right first
+	float rightCosts[BVH_SAH_BIN_COUNT];
+	BBox rightBox;
+	uint32_t rightCount = 0;
+	for (int s = BVH_SAH_BIN_COUNT - 1; s > 0; --s)
+	{
+		grow(&rightBox, binBoxes[s]);
+		rightCount += binCounts[s];
+		rightCosts[s] = rightCount * surfaceArea(rightBox);
+	}
+	BBox leftBox;
+	uint32_t leftCount = 0;
+	int bestSplit = 1;
+	float bestCost = std::numeric_limits<float>::max();
+	for (int s = 1; s < BVH_SAH_BIN_COUNT; ++s)
+	{
+		grow(&leftBox, binBoxes[s - 1]);
+		leftCount += binCounts[s - 1];
+		if (leftCount == 0 || leftCount == count) continue;
+		const float cost = leftCount * surfaceArea(leftBox) + rightCosts[s];
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			bestSplit = s;
+		}
+	}
+
+	uint32_t *pItems = leafItems.data() + first;
+	uint32_t splitCount = static_cast<uint32_t>(std::partition(pItems, pItems + count,
+		[&](uint32_t item) { return binOf(item) < bestSplit; }) - pItems);
+	if (splitCount == 0 || splitCount == count)
+	{
+		// All centroids in one bin, split at the median instead
+		splitCount = count / 2;
+		std::nth_element(pItems, pItems + splitCount, pItems + count, [&](uint32_t a, uint32_t b)
+		{
+			return itemBoxes[a].min[axis] + itemBoxes[a].max[axis] < itemBoxes[b].min[axis] + itemBoxes[b].max[axis];
+		});
+	}
+
+	const uint32_t left = static_cast<uint32_t>(nodes.size());
+	nodes.push_back({ BBox(), nodeIdx, 0, 0 });
+	nodes.push_back({ BBox(), nodeIdx, 0, 0 });
+	nodes[nodeIdx].first = left;
+	nodes[nodeIdx].count = 0;
+	buildNode(left, first, splitCount, depth + 1);
+	buildNode(left + 1, first + splitCount, count - splitCount, depth + 1);
+}
+
+void SceneBVH::refit(uint32_t item, const BBox &box)
+{
+	itemBoxes[item] = box;
+
+	uint32_t nodeIdx = itemLeaves[item];
+	Node &leaf = nodes[nodeIdx];
+	leaf.box = BBox();
+	for (uint32_t i = leaf.first; i < leaf.first + leaf.count; ++i)
+	{
+		if (!isEmpty(itemBoxes[leafItems[i]])) grow(&leaf.box, itemBoxes[leafItems[i]]);
+	}
+
+	for (nodeIdx = leaf.parent; nodeIdx != INVALID_NODE; nodeIdx = nodes[nodeIdx].parent)
+	{
+		Node &node = nodes[nodeIdx];
+		node.box = nodes[node.first].box;
+		grow(&node.box, nodes[node.first + 1].box);
+	}
+}
+
+bool SceneBVH::raycast(const glm::vec3 &origin, const glm::vec3 &dir, uint32_t *pItem, float *pDistance) const
+{
+	if (nodes.empty()) return false;
+
+	const glm::vec3 invDir = 1.f / dir;
+	float nearest = std::numeric_limits<float>::max();
+	bool hit = false;
+	float t;
+
+	// Children are visited nearest first, so most of the far subtrees are pruned by the nearest hit so far.
+	// Sized as in queryFrustum
+	std::pair<uint32_t, float> stack[BVH_MAX_DEPTH + 1];
+	uint32_t stackSize = 0;
+	if (intersectRay(nodes[0].box, origin, invDir, nearest, &t)) stack[stackSize++] = { 0, t };
+	while (stackSize > 0)
+	{
+		const auto entry = stack[--stackSize];
+		if (entry.second > nearest) continue;
+		const Node &node = nodes[entry.first];
+
+		if (node.count == 0)
+		{
+			float tLeft, tRight;
+			const bool hitLeft = intersectRay(nodes[node.first].box, origin, invDir, nearest, &tLeft);
+			const bool hitRight = intersectRay(nodes[node.first + 1].box, origin, invDir, nearest, &tRight);
+			if (hitLeft && hitRight && tLeft < tRight)
+			{
+				stack[stackSize++] = { node.first + 1, tRight };
+				stack[stackSize++] = { node.first, tLeft };
+			}
+			else
+			{
+				if (hitLeft) stack[stackSize++] = { node.first, tLeft };
+				if (hitRight) stack[stackSize++] = { node.first + 1, tRight };
+			}
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.count; ++i)
+		{
+			const uint32_t item = leafItems[i];
+			if (!isEmpty(itemBoxes[item]) && intersectRay(itemBoxes[item], origin, invDir, nearest, &t))
+			{
+				nearest = t;
+				*pItem = item;
+				hit = true;
+			}
+		}
+	}
+
+	if (hit) *pDistance = nearest;
+	return hit;
+}
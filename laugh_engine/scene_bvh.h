@@ -0,0 +1,77 @@
+#pragma once
+
+#include "vmesh.h"
+
+#define BVH_LEAF_SIZE 4 // items per leaf the build stops splitting at
+#define BVH_SAH_BIN_COUNT 16 // centroid bins tested per split
+#define BVH_MAX_DEPTH 64 // deeper subtrees stay one leaf, so queries traverse with a fixed size stack
+
+
+// Bounding volume hierarchy over the world space boxes of scene items, built with the binned surface area heuristic.
+// Items moving afterwards only refit the boxes on the path to the root, the tree itself stays as it was built.
+// Empty boxes, of meshes that are still loading, are kept as items and never reported by a query
+class SceneBVH
+{
+public:
+	void build(const std::vector<BBox> &boxes);
+	void refit(uint32_t item, const BBox &box);
+
+	// Items whose box intersects @frustum, in no particular order. @pItems is a std::vector of uint32_t with any allocator
+	template<typename ItemContainer>
+	void queryFrustum(const Frustum &frustum, bool testNearPlane, ItemContainer *pItems) const;
+	// Nearest item whose box is hit by the ray. Return false if there is none
+	bool raycast(const glm::vec3 &origin, const glm::vec3 &dir, uint32_t *pItem, float *pDistance) const;
+
+	uint32_t getItemCount() const { return static_cast<uint32_t>(itemBoxes.size()); }
+	const BBox &getItemBox(uint32_t item) const { return itemBoxes[item]; }
+	const std::vector<BBox> &getItemBoxes() const { return itemBoxes; }
+	BBox getBounds() const { return nodes.empty() ? BBox() : nodes[0].box; }
+
+	static bool isEmpty(const BBox &box) { return glm::any(glm::greaterThan(box.min, box.max)); }
+
+protected:
+	struct Node
+	{
+		BBox box;
+		uint32_t parent;
+		uint32_t first; // first item in @leafItems for a leaf, left child for an interior node. The right child follows it
+		uint32_t count; // 0 for an interior node
+	};
+
+	std::vector<Node> nodes; // root first
+	std::vector<uint32_t> leafItems; // items of each leaf next to each other
+	std::vector<BBox> itemBoxes;
+	std::vector<uint32_t> itemLeaves; // leaf of every item
+
+	// Split leafItems[first, first + count) into the subtree of @nodeIdx, which is @depth levels below the root
+	void buildNode(uint32_t nodeIdx, uint32_t first, uint32_t count, uint32_t depth);
+};
+
+template<typename ItemContainer>
+void SceneBVH::queryFrustum(const Frustum &frustum, bool testNearPlane, ItemContainer *pItems) const
+{
+	pItems->clear();
+	if (nodes.empty()) return;
+
+	// Popping a node pushes at most its two children, so the stack never holds more than one node per level plus one
+	uint32_t stack[BVH_MAX_DEPTH + 1];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node &node = nodes[stack[--stackSize]];
+		if (isEmpty(node.box) || !frustum.intersects(node.box, testNearPlane)) continue;
+
+		if (node.count == 0)
+		{
+			stack[stackSize++] = node.first;
+			stack[stackSize++] = node.first + 1;
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.count; ++i)
+		{
+			const uint32_t item = leafItems[i];
+			if (!isEmpty(itemBoxes[item]) && frustum.intersects(itemBoxes[item], testNearPlane)) pItems->push_back(item);
+		}
+	}
+}
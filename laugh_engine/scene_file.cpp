@@ -0,0 +1,132 @@
+#include "scene_file.h"
+#include <cstring>
+#include <fstream>
+#include "asset_pack.h"
+
+
+bool SceneFile::read(const std::string &fileName, uint64_t sourceKey)
+{
+	AssetFile file(fileName);
+	if (!file.isOpen() || file.getSize() < sizeof(Header)) return false;
+
+	const char *data = file.getData();
+	Header header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, "LESC", 4) != 0 || header.version != version || header.sourceKey != sourceKey) return false;
+
+	const size_t recordBytes = sizeof(EnvironmentRecord) + header.meshCount * sizeof(MeshRecord) + header.lightCount * sizeof(LightRecord);
+	if (file.getSize() < sizeof(Header) + recordBytes + header.stringBytes) return false;
+	const char *records = data + sizeof(Header);
+	const char *strings = records + recordBytes;
+
+	bool stringsValid = true;
+	auto getString = [&](const StringRef &ref)
+	{
+		if (static_cast<uint64_t>(ref.offset) + ref.length > header.stringBytes)
+		{
+			stringsValid = false;
+			return std::string();
+		}
+		return std::string(strings + ref.offset, ref.length);
+	};
+
+	EnvironmentRecord environment;
+	memcpy(&environment, records, sizeof(environment));
+	records += sizeof(environment);
+	skyboxFile = getString(environment.skyboxFile);
+	probeFile = getString(environment.probeFile);
+	probeHash = header.probeHash;
+
+	meshes.resize(header.meshCount);
+	for (auto &mesh : meshes)
+	{
+		MeshRecord record;
+		memcpy(&record, records, sizeof(record));
+		records += sizeof(record);
+
+		mesh.modelFile = getString(record.files[0]);
+		for (uint32_t i = 0; i < 6; ++i)
+		{
+			mesh.mapFiles[i] = getString(record.files[i + 1]);
+		}
+		mesh.position = glm::vec3(record.position[0], record.position[1], record.position[2]);
+		mesh.rotation = glm::quat(record.rotation[3], record.rotation[0], record.rotation[1], record.rotation[2]);
+		mesh.scale = record.scale;
+		mesh.materialType = record.materialType;
+	}
+
+	lights.resize(header.lightCount);
+	for (auto &light : lights)
+	{
+		LightRecord record;
+		memcpy(&record, records, sizeof(record));
+		records += sizeof(record);
+
+		light.position = glm::vec3(record.position[0], record.position[1], record.position[2]);
+		light.direction = glm::vec3(record.direction[0], record.direction[1], record.direction[2]);
+		light.color = glm::vec3(record.color[0], record.color[1], record.color[2]);
+		light.castShadow = record.castShadow != 0;
+	}
+
+	return stringsValid;
+}
+
+bool SceneFile::write(const std::string &fileName, uint64_t sourceKey) const
+{
+	std::string strings;
+	auto addString = [&strings](const std::string &s)
+	{
+		StringRef ref = { static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(s.size()) };
+		strings += s;
+		return ref;
+	};
+
+	EnvironmentRecord environment;
+	environment.skyboxFile = addString(skyboxFile);
+	environment.probeFile = addString(probeFile);
+
+	std::vector<MeshRecord> meshRecords(meshes.size());
+	for (size_t m = 0; m < meshes.size(); ++m)
+	{
+		const Mesh &mesh = meshes[m];
+		MeshRecord &record = meshRecords[m];
+		record.files[0] = addString(mesh.modelFile);
+		for (uint32_t i = 0; i < 6; ++i)
+		{
+			record.files[i + 1] = addString(mesh.mapFiles[i]);
+		}
+		memcpy(record.position, &mesh.position[0], sizeof(record.position));
+		const float rotation[] = { mesh.rotation.x, mesh.rotation.y, mesh.rotation.z, mesh.rotation.w };
+		memcpy(record.rotation, rotation, sizeof(record.rotation));
+		record.scale = mesh.scale;
+		record.materialType = mesh.materialType;
+	}
+
+	std::vector<LightRecord> lightRecords(lights.size());
+	for (size_t l = 0; l < lights.size(); ++l)
+	{
+		memcpy(lightRecords[l].position, &lights[l].position[0], sizeof(lightRecords[l].position));
+		memcpy(lightRecords[l].direction, &lights[l].direction[0], sizeof(lightRecords[l].direction));
+		memcpy(lightRecords[l].color, &lights[l].color[0], sizeof(lightRecords[l].color));
+		lightRecords[l].castShadow = lights[l].castShadow ? 1 : 0;
+	}
+
+	Header header = {};
+	memcpy(header.magic, "LESC", 4);
+	header.version = version;
+	header.sourceKey = sourceKey;
+	header.probeHash = probeHash;
+	header.meshCount = static_cast<uint32_t>(meshRecords.size());
+	header.lightCount = static_cast<uint32_t>(lightRecords.size());
+	header.stringBytes = static_cast<uint32_t>(strings.size());
+
+	std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) return false;
+
+	file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char *>(&environment), sizeof(environment));
+	file.write(reinterpret_cast<const char *>(meshRecords.data()), meshRecords.size() * sizeof(MeshRecord));
+	file.write(reinterpret_cast<const char *>(lightRecords.data()), lightRecords.size() * sizeof(LightRecord));
+	file.write(strings.data(), strings.size());
+	return file.good();
+}
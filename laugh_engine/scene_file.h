@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+
+// Binary snapshot of the scene a startup would otherwise put together from MODEL_NAMES: the files of every mesh with the
+// optional maps already probed, the transforms, materials, lights and environment, and the content hash of the probe the
+// precompute cache is keyed by. A header, fixed size records and one block of strings the records point into, so it is
+// read from the asset pack or a loose file in one go. A snapshot is only used under the source key it was written with
+class SceneFile
+{
+public:
+	struct Mesh
+	{
+		std::string modelFile;
+		std::string mapFiles[6]; // albedo, normal, roughness, metalness, AO, emissive. Empty if the model has none
+		glm::vec3 position = glm::vec3(0.f);
+		glm::quat rotation;
+		float scale = 1.f;
+		uint32_t materialType = 0; // MaterialType_t
+	};
+
+	struct Light
+	{
+		glm::vec3 position;
+		glm::vec3 direction;
+		glm::vec3 color;
+		bool castShadow;
+	};
+
+	std::vector<Mesh> meshes;
+	std::vector<Light> lights; // the shadow light first
+	std::string skyboxFile;
+	std::string probeFile;
+	uint64_t probeHash = 0; // of the contents of @probeFile
+
+	// False if the file is missing, truncated or was written under another @sourceKey
+	bool read(const std::string &fileName, uint64_t sourceKey);
+	bool write(const std::string &fileName, uint64_t sourceKey) const;
+
+protected:
+	struct Header
+	{
+		char magic[4]; // "LESC"
+		uint32_t version;
+		uint64_t sourceKey;
+		uint64_t probeHash;
+		uint32_t meshCount;
+		uint32_t lightCount;
+		uint32_t stringBytes; // after the records
+		uint32_t padding;
+	};
+
+	// [offset, offset + length) of the strings
+	struct StringRef
+	{
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	struct MeshRecord
+	{
+		StringRef files[7]; // the model, then the maps
+		float position[3];
+		float rotation[4]; // x, y, z, w
+		float scale;
+		uint32_t materialType;
+	};
+
+	struct LightRecord
+	{
+		float position[3];
+		float direction[3];
+		float color[3];
+		uint32_t castShadow;
+	};
+
+	struct EnvironmentRecord
+	{
+		StringRef skyboxFile;
+		StringRef probeFile;
+	};
+
+	static const uint32_t version = 1;
+};
@@ -0,0 +1,85 @@
+#include "shadow_atlas.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+
+ShadowAtlas::ShadowAtlas(uint32_t atlasSize, uint32_t minTileSize, uint32_t maxTileSize)
+	: atlasSize(atlasSize), minTileSize(minTileSize), maxTileSize(std::min(maxTileSize, atlasSize))
+{
+	assert(minTileSize > 0 && (minTileSize & (minTileSize - 1)) == 0);
+	assert((atlasSize & (atlasSize - 1)) == 0 && minTileSize <= this->maxTileSize);
+}
+
+bool ShadowAtlas::update(rj::ArrayView<float> desiredSizes)
+{
+	sizes.resize(desiredSizes.size());
+	for (size_t i = 0; i < sizes.size(); ++i)
+	{
+		const float desiredLog2 = std::log2(std::max(desiredSizes[i], 1.f));
+		if (i < tiles.size() && std::abs(desiredLog2 - std::log2(static_cast<float>(tiles[i].size))) < 0.585f)
+		{
+			sizes[i] = tiles[i].size;
+		}
+		else
+		{
+			sizes[i] = 1u << static_cast<uint32_t>(std::max(std::round(desiredLog2), 0.f));
+		}
+		sizes[i] = std::min(std::max(sizes[i], minTileSize), maxTileSize);
+	}
+
+	// Halve the largest tile until all fit, the first one of equal size is the most important
+	const uint64_t atlasArea = static_cast<uint64_t>(atlasSize) * atlasSize;
+	auto totalArea = [&]()
+	{
+		return std::accumulate(sizes.begin(), sizes.end(), uint64_t(0),
+			[](uint64_t sum, uint32_t size) { return sum + static_cast<uint64_t>(size) * size; });
+	};
+	while (totalArea() > atlasArea)
+	{
+		auto largest = std::max_element(sizes.rbegin(), sizes.rend());
+		if (*largest <= minTileSize) break; // more tiles than the atlas holds, the last ones overlap
+		*largest >>= 1;
+	}
+
+	bool changed = sizes.size() != tiles.size();
+	tiles.resize(sizes.size());
+	for (size_t i = 0; i < sizes.size(); ++i)
+	{
+		changed |= tiles[i].size != sizes[i];
+		tiles[i].size = sizes[i];
+	}
+
+	if (changed) pack();
+	return changed;
+}
+
+void ShadowAtlas::pack()
+{
+	order.resize(tiles.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return tiles[a].size > tiles[b].size; });
+
+	// Every tile starts at a multiple of its own area in min tile cells along the curve, which is an aligned square
+	const uint32_t cellsPerSide = atlasSize / minTileSize;
+	const uint64_t cellCount = static_cast<uint64_t>(cellsPerSide) * cellsPerSide;
+	uint64_t cursor = 0;
+	for (uint32_t idx : order)
+	{
+		auto &tile = tiles[idx];
+		const uint64_t cell = cursor % cellCount;
+
+		uint32_t cx = 0, cy = 0;
+		for (uint32_t bit = 0; (1ull << (2 * bit)) < cellCount; ++bit)
+		{
+			cx |= static_cast<uint32_t>((cell >> (2 * bit)) & 1) << bit;
+			cy |= static_cast<uint32_t>((cell >> (2 * bit + 1)) & 1) << bit;
+		}
+		tile.x = cx * minTileSize;
+		tile.y = cy * minTileSize;
+
+		const uint64_t cellsPerTileSide = tile.size / minTileSize;
+		cursor += cellsPerTileSide * cellsPerTileSide;
+	}
+}
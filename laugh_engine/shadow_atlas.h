@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "VArrayView.h"
+
+
+// Packs square shadow map tiles into one square atlas. Each shadow view asks for a tile: a directional light one per
+// cascade, a spot light one and a point light one per cube face, sized by the texel density the screen asks for.
+// Tile sizes are powers of two, placed largest first along a Z-order curve, which packs them without gaps. While they
+// do not fit, the largest tile is halved. The layout only changes when the size of a tile does
+class ShadowAtlas
+{
+public:
+	struct Tile
+	{
+		uint32_t x = 0; // top left corner in texels
+		uint32_t y = 0;
+		uint32_t size = 0;
+	};
+
+	ShadowAtlas(uint32_t atlasSize, uint32_t minTileSize, uint32_t maxTileSize);
+
+	// One desired size in texels per tile, in any order of importance. A tile keeps its size while the desired one
+	// stays within a factor of 1.5 of it, so views near a power of two do not flip between two sizes.
+	// Return true if the layout has changed
+	bool update(rj::ArrayView<float> desiredSizes);
+
+	uint32_t getAtlasSize() const { return atlasSize; }
+	uint32_t getTileCount() const { return static_cast<uint32_t>(tiles.size()); }
+	const Tile &getTile(uint32_t idx) const { return tiles[idx]; }
+
+protected:
+	uint32_t atlasSize;
+	uint32_t minTileSize;
+	uint32_t maxTileSize;
+	std::vector<Tile> tiles;
+	std::vector<uint32_t> sizes; // scratch of update() and pack(), kept to not allocate per call
+	std::vector<uint32_t> order;
+
+	void pack(); // places @tiles by their sizes
+};
@@ -0,0 +1,135 @@
+#include "startup_profile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+namespace
+{
+	struct OpenPhase
+	{
+		std::string path;
+		uint64_t beginNs;
+		uint64_t childNs;
+	};
+
+	thread_local std::vector<OpenPhase> openPhases;
+
+	void writeString(std::ostream &os, const std::string &s)
+	{
+		os << '"';
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\') os << '\\';
+			os << c;
+		}
+		os << '"';
+	}
+}
+
+
+StartupProfile &StartupProfile::get()
+{
+	static StartupProfile profile;
+	return profile;
+}
+
+void StartupProfile::beginPhase(const std::string &name)
+{
+	if (finished) return;
+
+	const uint64_t beginNs = now();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!started)
+		{
+			startNs = beginNs;
+			started = true;
+		}
+	}
+
+	openPhases.push_back({ openPhases.empty() ? name : openPhases.back().path + "/" + name, beginNs, 0 });
+}
+
+void StartupProfile::endPhase()
+{
+	// Phases that began before finish() are dropped with the rest
+	if (finished || openPhases.empty()) return;
+
+	const uint64_t endNs = now();
+	const OpenPhase phase = openPhases.back();
+	openPhases.pop_back();
+
+	const uint64_t totalNs = endNs - phase.beginNs;
+	if (!openPhases.empty()) openPhases.back().childNs += totalNs;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	phases.push_back({ phase.path, static_cast<uint32_t>(openPhases.size()), (phase.beginNs - startNs) * 1e-6, totalNs * 1e-6,
+		(totalNs - phase.childNs) * 1e-6 });
+}
+
+void StartupProfile::finish()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (finished) return;
+
+	totalMS = started ? (now() - startNs) * 1e-6 : 0.0;
+	finished = true;
+	openPhases.clear();
+}
+
+void StartupProfile::printReport(std::ostream &os) const
+{
+	std::vector<const Phase *> sorted;
+	sorted.reserve(phases.size());
+	for (const auto &phase : phases) sorted.push_back(&phase);
+	std::sort(sorted.begin(), sorted.end(), [](const Phase *a, const Phase *b) { return a->selfMS > b->selfMS; });
+
+	const auto flags = os.flags();
+	os << std::fixed << std::setprecision(1);
+	os << "Startup took " << totalMS << " ms, self (total) ms by phase:" << std::endl;
+	for (const Phase *pPhase : sorted)
+	{
+		const double percent = totalMS > 0.0 ? 100.0 * pPhase->selfMS / totalMS : 0.0;
+		os << std::setw(10) << pPhase->selfMS << " (" << std::setw(10) << pPhase->totalMS << ") " << std::setw(5) << percent << "%  "
+			<< pPhase->path << std::endl;
+	}
+	os.flags(flags);
+}
+
+bool StartupProfile::saveJson(const std::string &fileName) const
+{
+	std::ofstream file(fileName);
+	if (!file.is_open()) return false;
+
+	// Phases in the order they began, so nested ones follow their parent
+	std::vector<const Phase *> ordered;
+	ordered.reserve(phases.size());
+	for (const auto &phase : phases) ordered.push_back(&phase);
+	std::sort(ordered.begin(), ordered.end(), [](const Phase *a, const Phase *b)
+	{
+		return a->beginMS < b->beginMS || (a->beginMS == b->beginMS && a->depth < b->depth);
+	});
+
+	file << std::fixed << std::setprecision(3);
+	file << "{\n";
+	file << "\t\"totalMS\": " << totalMS << ",\n";
+	file << "\t\"phases\": [";
+	for (size_t i = 0; i < ordered.size(); ++i)
+	{
+		const Phase &phase = *ordered[i];
+		file << (i == 0 ? "\n" : ",\n") << "\t\t{ \"path\": ";
+		writeString(file, phase.path);
+		file << ", \"depth\": " << phase.depth << ", \"beginMS\": " << phase.beginMS << ", \"totalMS\": " << phase.totalMS
+			<< ", \"selfMS\": " << phase.selfMS << " }";
+	}
+	file << "\n\t]\n}\n";
+
+	return file.good();
+}
+
+uint64_t StartupProfile::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// Wall-clock times of the startup phases, e.g. the stages of initVulkan and every mesh and texture load.
+// Phases nest per thread and are named by their path, e.g. "initVulkan/loadAndPrepareAssets/texture ../textures/A.dds".
+// Nothing is recorded once finish() has been called, so scopes in code that also runs later cost a flag check
+class StartupProfile
+{
+public:
+	struct Phase
+	{
+		std::string path;
+		uint32_t depth; // 0 for top level phases
+		double beginMS; // since the first phase began
+		double totalMS;
+		double selfMS; // without nested phases
+	};
+
+	static StartupProfile &get();
+
+	void beginPhase(const std::string &name);
+	void endPhase();
+
+	// End of startup. Phases still open are not recorded
+	void finish();
+	bool isFinished() const { return finished; }
+
+	// From the begin of the first phase to finish()
+	double getTotalMS() const { return totalMS; }
+	// In the order they ended
+	const std::vector<Phase> &getPhases() const { return phases; }
+
+	// Phases sorted by their self time, longest first
+	void printReport(std::ostream &os) const;
+	bool saveJson(const std::string &fileName) const;
+
+	// Times the rest of the enclosing block. next() ends the phase and begins another, for sequences of stages
+	class Scope
+	{
+	public:
+		Scope(const std::string &name) { StartupProfile::get().beginPhase(name); }
+		~Scope() { StartupProfile::get().endPhase(); }
+
+		void next(const std::string &name)
+		{
+			auto &profile = StartupProfile::get();
+			profile.endPhase();
+			profile.beginPhase(name);
+		}
+	};
+
+protected:
+	std::atomic<bool> finished{ false };
+	bool started = false;
+	uint64_t startNs = 0;
+	double totalMS = 0.0;
+
+	std::mutex mutex;
+	std::vector<Phase> phases;
+
+	static uint64_t now();
+};
+
+#define STARTUP_CONCAT_IMPL(a, b) a##b
+#define STARTUP_CONCAT(a, b) STARTUP_CONCAT_IMPL(a, b)
+#define STARTUP_PHASE(name) StartupProfile::Scope STARTUP_CONCAT(startupPhase, __LINE__)(name)
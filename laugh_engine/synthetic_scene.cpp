@@ -0,0 +1,246 @@
+#include "synthetic_scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+#include "glm/gtc/constants.hpp"
+
+
+namespace
+{
+	// The field of @params named @key, nullptr if there is none
+	uint32_t *findSyntheticParam(SyntheticSceneParams *pParams, const std::string &key)
+	{
+		if (key == "instances") return &pParams->instanceCount;
+		if (key == "meshes") return &pParams->meshCount;
+		if (key == "triangles") return &pParams->trianglesPerMesh;
+		if (key == "lights") return &pParams->lightCount;
+		if (key == "textures") return &pParams->textureCount;
+		return nullptr;
+	}
+
+	bool parseCount(const std::string &s, uint32_t *pValue)
+	{
+		char *end = nullptr;
+		const unsigned long value = std::strtoul(s.c_str(), &end, 10);
+		if (s.empty() || *end != '\0') return false;
+		*pValue = static_cast<uint32_t>(value);
+		return true;
+	}
+
+	std::vector<std::string> split(const std::string &s, char separator)
+	{
+		std::vector<std::string> parts;
+		std::istringstream ss(s);
+		std::string part;
+		while (std::getline(ss, part, separator)) parts.push_back(part);
+		return parts;
+	}
+}
+
+bool SyntheticSceneParams::parse(const std::string &desc)
+{
+	std::vector<SyntheticSceneParams> scenes;
+	if (!parseSyntheticSweep(desc, &scenes) || scenes.size() != 1) return false;
+	*this = scenes[0];
+	return true;
+}
+
+std::string SyntheticSceneParams::toString() const
+{
+	std::ostringstream ss;
+	ss << "instances=" << instanceCount << ",meshes=" << meshCount << ",triangles=" << trianglesPerMesh <<
+		",lights=" << lightCount << ",textures=" << textureCount;
+	return ss.str();
+}
+
+bool parseSyntheticSweep(const std::string &desc, std::vector<SyntheticSceneParams> *pScenes)
+{
+	std::vector<SyntheticSceneParams> scenes(1);
+	for (const std::string &item : split(desc, ','))
+	{
+		const size_t eq = item.find('=');
+		if (eq == std::string::npos) return false;
+
+		const std::string key = item.substr(0, eq);
+		std::vector<uint32_t> values;
+		for (const std::string &s : split(item.substr(eq + 1), '/'))
+		{
+			uint32_t value;
+			if (!parseCount(s, &value)) return false;
+			values.push_back(value);
+		}
+		if (values.empty()) return false;
+
+		// Every scene so far once per value
+		std::vector<SyntheticSceneParams> expanded;
+		for (const auto &scene : scenes)
+		{
+			for (uint32_t value : values)
+			{
+				expanded.push_back(scene);
+				uint32_t *pField = findSyntheticParam(&expanded.back(), key);
+				if (!pField) return false;
+				*pField = value;
+			}
+		}
+		scenes = std::move(expanded);
+	}
+
+	for (const auto &scene : scenes)
+	{
+		if (scene.meshCount == 0 || scene.textureCount == 0) return false;
+	}
+	pScenes->insert(pScenes->end(), scenes.begin(), scenes.end());
+	return true;
+}
+
+void buildSyntheticMesh(uint32_t meshIdx, uint32_t triangleCount, VMesh::HostData *pData)
+{
+	// A sphere of R rings and 2R segments has 4R(R - 1) triangles, the rings at the poles are fans
+	const uint32_t ringCount = std::max(2u, static_cast<uint32_t>(std::sqrt(static_cast<float>(triangleCount)) * 0.5f + 0.5f));
+	const uint32_t segmentCount = 2 * ringCount;
+
+	// Bumps of a frequency and phase of the mesh's own
+	const float frequency = static_cast<float>(2 + meshIdx % 7);
+	const float phase = rj::helper_functions::halton(meshIdx + 1, 3) * glm::two_pi<float>();
+	const float amplitude = 0.15f;
+
+	auto &vertices = pData->vertices;
+	auto &indices = pData->indices;
+	vertices.clear();
+	indices.clear();
+	pData->bounds = BBox();
+
+	// One column more than segments, the seam has two sets of texture coordinates
+	for (uint32_t r = 0; r <= ringCount; ++r)
+	{
+		const float theta = glm::pi<float>() * r / ringCount;
+		for (uint32_t s = 0; s <= segmentCount; ++s)
+		{
+			const float phi = glm::two_pi<float>() * s / segmentCount;
+			const float radius = 1.f + amplitude * std::sin(frequency * theta) * std::sin(frequency * phi + phase);
+			const glm::vec3 dir(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+
+			Vertex v;
+			v.pos = radius * dir;
+			v.normal = glm::vec3(0.f);
+			v.texCoord = glm::vec2(4.f * s / segmentCount, 2.f * r / ringCount);
+			vertices.push_back(v);
+
+			pData->bounds.min = glm::min(pData->bounds.min, v.pos);
+			pData->bounds.max = glm::max(pData->bounds.max, v.pos);
+		}
+	}
+
+	const uint32_t rowLength = segmentCount + 1;
+	for (uint32_t r = 0; r < ringCount; ++r)
+	{
+		for (uint32_t s = 0; s < segmentCount; ++s)
+		{
+			const uint32_t i0 = r * rowLength + s;
+			const uint32_t i1 = i0 + 1;
+			const uint32_t i2 = i0 + rowLength;
+			const uint32_t i3 = i2 + 1;
+			if (r > 0)
+			{
+				indices.insert(indices.end(), { i0, i1, i2 });
+			}
+			if (r < ringCount - 1)
+			{
+				indices.insert(indices.end(), { i1, i3, i2 });
+			}
+		}
+	}
+
+	// Area weighted face normals
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		Vertex &a = vertices[indices[i]];
+		Vertex &b = vertices[indices[i + 1]];
+		Vertex &c = vertices[indices[i + 2]];
+		const glm::vec3 n = glm::cross(b.pos - a.pos, c.pos - a.pos);
+		a.normal += n;
+		b.normal += n;
+		c.normal += n;
+	}
+	for (auto &v : vertices)
+	{
+		const float length = glm::length(v.normal);
+		v.normal = length > 0.f ? v.normal / length : glm::normalize(v.pos);
+	}
+
+#if MESH_TANGENTS
+	rj::helper_functions::generateTangents(vertices, indices);
+#endif
+}
+
+void buildSyntheticMaterial(uint32_t materialIdx, uint32_t size, VMesh::HostData *pData)
+{
+	using namespace rj::helper_functions;
+
+	const std::string prefix = "synthetic/" + std::to_string(materialIdx) + "/";
+	const gli::extent2d extent(size, size);
+	auto fill = [&extent](const uint8_t texel[4])
+	{
+		gli::texture2d map(gli::FORMAT_RGBA8_UNORM_PACK8, extent, 1);
+		uint8_t *pDst = map.data<uint8_t>(0, 0, 0);
+		for (size_t i = 0; i < map.size(0) / 4; ++i)
+		{
+			std::copy(texel, texel + 4, pDst + 4 * i);
+		}
+		return map;
+	};
+
+	// A checker board of two shades of the material's hue
+	const glm::vec3 hue(halton(materialIdx + 1, 2), halton(materialIdx + 1, 3), halton(materialIdx + 1, 5));
+	gli::texture2d albedo(gli::FORMAT_RGBA8_UNORM_PACK8, extent, 1);
+	uint8_t *pAlbedo = albedo.data<uint8_t>(0, 0, 0);
+	const uint32_t cellSize = std::max(1u, size / 8);
+	for (uint32_t y = 0; y < size; ++y)
+	{
+		for (uint32_t x = 0; x < size; ++x)
+		{
+			const float shade = ((x / cellSize + y / cellSize) & 1) ? 0.9f : 0.5f;
+			uint8_t *pTexel = pAlbedo + 4 * (size_t(y) * size + x);
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				pTexel[c] = static_cast<uint8_t>(255.f * shade * (0.2f + 0.8f * hue[c]));
+			}
+			pTexel[3] = 255;
+		}
+	}
+
+	const uint8_t flatNormal[4] = { 128, 128, 255, 255 };
+	const uint8_t roughnessValue = static_cast<uint8_t>(255.f * (0.2f + 0.7f * halton(materialIdx + 1, 7)));
+	const uint8_t roughness[4] = { roughnessValue, roughnessValue, roughnessValue, 255 };
+	const uint8_t metalnessValue = materialIdx % 3 == 2 ? 255 : 0;
+	const uint8_t metalness[4] = { metalnessValue, metalnessValue, metalnessValue, 255 };
+
+	pData->maps[0] = albedo;
+	pData->mapNames[0] = prefix + "A";
+	pData->maps[1] = fill(flatNormal);
+	pData->mapNames[1] = prefix + "N";
+#if MESH_PACK_ORM
+	pData->maps[2] = packOrmMap(fill(roughness), 0, fill(metalness), 0, gli::texture2d());
+	pData->mapNames[2] = prefix + "ORM";
+#else
+	pData->maps[2] = fill(roughness);
+	pData->mapNames[2] = prefix + "R";
+	pData->maps[3] = fill(metalness);
+	pData->mapNames[3] = prefix + "M";
+#endif
+}
+
+void getSyntheticInstance(uint32_t instanceIdx, uint32_t instanceCount, float spacing, glm::vec3 *pPosition, glm::quat *pRotation, float *pScale)
+{
+	const uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(std::max(instanceCount, 1u)))));
+	const float halfExtent = 0.5f * spacing * (gridSize - 1);
+	*pPosition = glm::vec3(spacing * (instanceIdx % gridSize) - halfExtent, 0.f, spacing * (instanceIdx / gridSize) - halfExtent);
+
+	using rj::helper_functions::halton;
+	*pRotation = glm::angleAxis(glm::two_pi<float>() * halton(instanceIdx + 1, 2), glm::vec3(0.f, 1.f, 0.f));
+	*pScale = 0.75f + 0.5f * halton(instanceIdx + 1, 3);
+}
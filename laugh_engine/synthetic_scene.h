@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "vmesh.h"
+
+
+// Size of a procedurally generated scene for scaling benchmarks
+struct SyntheticSceneParams
+{
+	uint32_t instanceCount = 1024; // over all meshes, at least one per mesh
+	uint32_t meshCount = 16;
+	uint32_t trianglesPerMesh = 2048; // roughly, before LODs
+	uint32_t lightCount = 256; // point lights, with USE_TILED_LIGHTING
+	uint32_t textureCount = 4; // materials, each with its own set of maps. Mesh i uses material i % textureCount
+
+	// "instances=4096,meshes=64,triangles=2000,lights=256,textures=8", keys left out keep their value
+	bool parse(const std::string &desc);
+	std::string toString() const;
+};
+
+// Like SyntheticSceneParams::parse, but a key may take several values separated by '/'. Every combination of them
+// is appended to @pScenes, the first key varying slowest
+bool parseSyntheticSweep(const std::string &desc, std::vector<SyntheticSceneParams> *pScenes);
+
+// The geometry of mesh @meshIdx, a sphere of about @triangleCount triangles with bumps that differ from mesh to mesh.
+// Touches no Vulkan state, so it may run on any thread
+void buildSyntheticMesh(uint32_t meshIdx, uint32_t triangleCount, VMesh::HostData *pData);
+
+// The maps of material @materialIdx, @size texels square with a single level, in the map order of VMesh::HostData.
+// The map names are unique per material, so meshes sharing it share the images through the texture cache
+void buildSyntheticMaterial(uint32_t materialIdx, uint32_t size, VMesh::HostData *pData);
+
+// Where instance @instanceIdx of @instanceCount goes: a square grid in the xz-plane centered on the origin, with
+// @spacing between neighbours, turned about the y-axis and scaled by a per instance amount
+void getSyntheticInstance(uint32_t instanceIdx, uint32_t instanceCount, float spacing, glm::vec3 *pPosition, glm::quat *pRotation, float *pScale);
@@ -0,0 +1,272 @@
+#include "task_scheduler.h"
+#include "trace_recorder.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+
+namespace
+{
+	// Workers know their queue, any other thread uses the shared one
+	thread_local const TaskScheduler *currentScheduler = nullptr;
+	thread_local uint32_t currentWorkerIdx = 0;
+}
+
+
+TaskScheduler::TaskScheduler(uint32_t threadCount)
+{
+	if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+	for (uint32_t i = 0; i <= threadCount; ++i)
+	{
+		queues.emplace_back(new WorkerQueue());
+	}
+	threads.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		threads.emplace_back(&TaskScheduler::work, this, i);
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	taskQueued.notify_all();
+
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+	for (auto &chunk : chunks)
+	{
+		delete[] chunk.load();
+	}
+}
+
+TaskScheduler::TaskHandle TaskScheduler::add(std::function<void()> function, rj::ArrayView<TaskHandle> dependencies)
+{
+	const TaskHandle handle = allocateTask();
+	Task &task = getTask(handle);
+	task.function = std::move(function);
+	task.exception = nullptr;
+	task.dependents.clear();
+	task.done = false;
+	task.pendingCount.store(1); // held until all dependencies are registered, so none of them can start the task early
+	unfinishedCount.fetch_add(1);
+
+	std::exception_ptr failure;
+	for (TaskHandle dependency : dependencies)
+	{
+		Task &other = getTask(dependency);
+		std::lock_guard<std::mutex> lock(other.mutex);
+		if (!other.done)
+		{
+			task.pendingCount.fetch_add(1);
+			other.dependents.push_back(handle);
+		}
+		else if (other.exception && !failure)
+		{
+			failure = other.exception;
+		}
+	}
+	if (failure)
+	{
+		std::lock_guard<std::mutex> lock(task.mutex);
+		if (!task.exception) task.exception = failure;
+	}
+
+	release(handle);
+	return handle;
+}
+
+void TaskScheduler::wait(TaskHandle handle)
+{
+	Task &task = getTask(handle);
+	const uint32_t queueIdx = getQueueIndex();
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(task.mutex);
+			if (task.done)
+			{
+				if (task.exception) std::rethrow_exception(task.exception);
+				return;
+			}
+		}
+		// The task may be running elsewhere, meanwhile help with the others
+		if (!runOne(queueIdx)) std::this_thread::yield();
+	}
+}
+
+void TaskScheduler::waitAll()
+{
+	const uint32_t queueIdx = getQueueIndex();
+	while (unfinishedCount.load() > 0)
+	{
+		if (!runOne(queueIdx)) std::this_thread::yield();
+	}
+
+	const uint32_t count = taskCount.load();
+	for (TaskHandle handle = 0; handle < count; ++handle)
+	{
+		Task &task = getTask(handle);
+		std::lock_guard<std::mutex> lock(task.mutex);
+		if (task.exception) std::rethrow_exception(task.exception);
+	}
+}
+
+void TaskScheduler::reset()
+{
+	if (unfinishedCount.load() != 0)
+	{
+		throw std::runtime_error("task scheduler reset while tasks are unfinished");
+	}
+	taskCount.store(0);
+}
+
+TaskScheduler::TaskHandle TaskScheduler::allocateTask()
+{
+	const TaskHandle handle = taskCount.fetch_add(1);
+	const uint32_t chunkIdx = handle / TASK_CHUNK_SIZE;
+	if (chunkIdx >= TASK_MAX_CHUNK_COUNT)
+	{
+		throw std::runtime_error("too many tasks, raise TASK_MAX_CHUNK_COUNT");
+	}
+
+	if (!chunks[chunkIdx].load(std::memory_order_acquire))
+	{
+		std::lock_guard<std::mutex> lock(chunkMutex);
+		if (!chunks[chunkIdx].load(std::memory_order_relaxed))
+		{
+			chunks[chunkIdx].store(new Task[TASK_CHUNK_SIZE], std::memory_order_release);
+		}
+	}
+	return handle;
+}
+
+uint32_t TaskScheduler::getQueueIndex() const
+{
+	return currentScheduler == this ? currentWorkerIdx : getThreadCount();
+}
+
+void TaskScheduler::release(TaskHandle handle)
+{
+	if (getTask(handle).pendingCount.fetch_sub(1) != 1) return;
+
+	// Counted first, so the count is never below the number of queued tasks
+	queuedCount.fetch_add(1);
+	auto &queue = *queues[getQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(handle);
+	}
+
+	// Taking the lock orders the count above before the check of a worker about to sleep
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	taskQueued.notify_one();
+}
+
+bool TaskScheduler::runOne(uint32_t queueIdx)
+{
+	if (queuedCount.load() == 0) return false;
+
+	TaskHandle handle;
+	bool found = false;
+
+	// Newest of the own queue first, its data is most likely still in cache
+	{
+		auto &queue = *queues[queueIdx];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			handle = queue.tasks.back();
+			queue.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	// Then the oldest of the others, starting after the own queue so thieves spread over the victims
+	const uint32_t queueCount = static_cast<uint32_t>(queues.size());
+	for (uint32_t i = 1; i < queueCount && !found; ++i)
+	{
+		auto &queue = *queues[(queueIdx + i) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			handle = queue.tasks.front();
+			queue.tasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found) return false;
+	queuedCount.fetch_sub(1);
+	run(handle);
+	return true;
+}
+
+void TaskScheduler::run(TaskHandle handle)
+{
+	Task &task = getTask(handle);
+
+	std::exception_ptr exception;
+	{
+		std::lock_guard<std::mutex> lock(task.mutex);
+		exception = task.exception;
+	}
+	if (!exception)
+	{
+		try
+		{
+			task.function();
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+	}
+	task.function = nullptr; // releases what it captured
+
+	{
+		std::lock_guard<std::mutex> lock(task.mutex);
+		task.exception = exception;
+		task.done = true;
+
+		// Dependents are never their own dependencies, so locking them inside cannot deadlock
+		for (TaskHandle dependent : task.dependents)
+		{
+			if (exception)
+			{
+				Task &other = getTask(dependent);
+				std::lock_guard<std::mutex> otherLock(other.mutex);
+				if (!other.exception) other.exception = exception;
+			}
+			release(dependent);
+		}
+
+		// Inside the lock, so whoever sees the task done also sees it counted out and may reset()
+		unfinishedCount.fetch_sub(1);
+	}
+}
+
+void TaskScheduler::work(uint32_t workerIdx)
+{
+	currentScheduler = this;
+	currentWorkerIdx = workerIdx;
+	TraceRecorder::setCurrentThreadName("task worker " + std::to_string(workerIdx));
+
+	while (true)
+	{
+		if (runOne(workerIdx)) continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		taskQueued.wait(lock, [this]() { return stopping || queuedCount.load() > 0; });
+		if (stopping) return;
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "VArrayView.h"
+
+#define TASK_CHUNK_SIZE 1024 // tasks per storage chunk. Chunks never move, so tasks can be added while others run
+#define TASK_MAX_CHUNK_COUNT 256 // at most TASK_CHUNK_SIZE * TASK_MAX_CHUNK_COUNT tasks between two reset() calls
+
+
+// Runs a graph of short tasks on worker threads that steal from each other. Every worker keeps its own queue, runs the
+// tasks it added itself newest first and takes the oldest ones of the others when it runs dry. Threads that are not
+// workers add to a shared queue and run tasks themselves while they wait, so a scheduler without workers still works.
+// A task runs once all its dependencies are done. If one of them threw, it does not run and the wait that covers it
+// rethrows that exception instead. Tasks may add tasks. Handles stay valid until reset()
+class TaskScheduler
+{
+public:
+	typedef uint32_t TaskHandle;
+
+	// Zero uses one worker per hardware thread but the calling one
+	explicit TaskScheduler(uint32_t threadCount = 0);
+	~TaskScheduler();
+
+	TaskScheduler(const TaskScheduler &) = delete;
+	TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+	TaskHandle add(std::function<void()> function, rj::ArrayView<TaskHandle> dependencies = {});
+	// Run @function(begin, end) over [0, @count) split into ranges of @grainSize. The returned task is done once all ranges are
+	template<typename F>
+	TaskHandle addParallelFor(uint32_t count, uint32_t grainSize, F function, rj::ArrayView<TaskHandle> dependencies = {});
+
+	// Run tasks on the calling thread until @task is done, then rethrow the exception that stopped it if any
+	void wait(TaskHandle task);
+	// Same for every task added since the last reset(). Rethrow the first exception among them
+	void waitAll();
+	// Forget all tasks, which have to be done, e.g. by wait() on each. Their storage is kept for the next ones
+	void reset();
+
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(threads.size()); }
+
+protected:
+	struct Task
+	{
+		std::function<void()> function;
+		std::mutex mutex; // guards the members below but @pendingCount
+		std::exception_ptr exception; // of the task, or of a dependency that kept it from running
+		std::vector<TaskHandle> dependents; // to release once this is done
+		bool done = false;
+		std::atomic<uint32_t> pendingCount{ 0 }; // dependencies not done yet, plus one while the task is being added
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<TaskHandle> tasks; // the owner pushes and pops at the back, thieves take from the front
+	};
+
+	std::atomic<Task *> chunks[TASK_MAX_CHUNK_COUNT] = {};
+	std::mutex chunkMutex;
+	std::atomic<uint32_t> taskCount{ 0 };
+	std::atomic<uint32_t> unfinishedCount{ 0 };
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues; // one per worker, then the shared one
+	std::atomic<uint32_t> queuedCount{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable taskQueued;
+	bool stopping = false;
+
+	std::vector<std::thread> threads;
+
+	Task &getTask(TaskHandle handle) { return chunks[handle / TASK_CHUNK_SIZE].load(std::memory_order_acquire)[handle % TASK_CHUNK_SIZE]; }
+	TaskHandle allocateTask();
+	uint32_t getQueueIndex() const; // of the calling thread
+	void release(TaskHandle handle); // one dependency less, queue the task once none are left
+	bool runOne(uint32_t queueIdx); // return false if no task was found
+	void run(TaskHandle handle);
+	void work(uint32_t workerIdx);
+};
+
+template<typename F>
+TaskScheduler::TaskHandle TaskScheduler::addParallelFor(uint32_t count, uint32_t grainSize, F function, rj::ArrayView<TaskHandle> dependencies)
+{
+	grainSize = grainSize == 0 ? 1 : grainSize;
+	thread_local std::vector<TaskHandle> ranges;
+	ranges.clear();
+	for (uint32_t begin = 0; begin < count; begin += grainSize)
+	{
+		const uint32_t end = count - begin < grainSize ? count : begin + grainSize;
+		ranges.push_back(add([function, begin, end]() { function(begin, end); }, dependencies));
+	}
+	if (ranges.empty()) return add([]() {}, dependencies);
+	return ranges.size() == 1 ? ranges[0] : add([]() {}, ranges);
+}
@@ -0,0 +1,134 @@
+#include "trace_recorder.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+namespace
+{
+	thread_local std::string currentThreadName;
+}
+
+
+TraceRecorder &TraceRecorder::get()
+{
+	static TraceRecorder recorder;
+	return recorder;
+}
+
+void TraceRecorder::beginCapture(uint32_t frameCount, uint32_t gpuLatencyFrames, const std::string &fileName)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (capturing || frameCount == 0) return;
+
+	events.clear();
+	this->fileName = fileName;
+	framesLeft = frameCount;
+	gpuFramesLeft = gpuLatencyFrames;
+	cpuFramesDone = false;
+	captureBeginNs = now();
+	capturing = true;
+}
+
+void TraceRecorder::addCpuEvent(const char *name, uint64_t beginNs, uint64_t endNs)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!capturing || cpuFramesDone) return;
+
+	events.push_back({ name, getThreadIndex(), beginNs, endNs });
+}
+
+void TraceRecorder::addGpuEvent(const std::string &name, uint64_t beginNs, uint64_t endNs)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!capturing || beginNs < captureBeginNs) return;
+
+	events.push_back({ name, 0, beginNs, endNs });
+}
+
+bool TraceRecorder::endFrame()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!capturing) return false;
+
+	if (!cpuFramesDone)
+	{
+		cpuFramesDone = --framesLeft == 0;
+		return false;
+	}
+	if (gpuFramesLeft > 0)
+	{
+		--gpuFramesLeft;
+		return false;
+	}
+
+	capturing = false;
+	return save();
+}
+
+void TraceRecorder::setCurrentThreadName(const std::string &name)
+{
+	currentThreadName = name;
+}
+
+uint64_t TraceRecorder::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t TraceRecorder::getThreadIndex()
+{
+	// Small stable ids read better in the viewer than hashed thread ids
+	if (currentThreadName.empty())
+	{
+		currentThreadName = "thread " + std::to_string(unnamedThreadCount++);
+	}
+
+	auto it = threadIndices.find(currentThreadName);
+	if (it != threadIndices.end()) return it->second;
+
+	threadNames.push_back(currentThreadName);
+	const uint32_t index = static_cast<uint32_t>(threadNames.size());
+	threadIndices[currentThreadName] = index;
+	return index;
+}
+
+bool TraceRecorder::save() const
+{
+	std::ofstream file(fileName);
+	if (!file.is_open()) return false;
+
+	auto writeString = [&file](const std::string &s)
+	{
+		file << '"';
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\') file << '\\';
+			file << c;
+		}
+		file << '"';
+	};
+
+	// Complete events in microseconds relative to the capture begin
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+	for (size_t i = 0; i < threadNames.size(); ++i)
+	{
+		file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i + 1 << ",\"args\":{\"name\":";
+		writeString(threadNames[i]);
+		file << "}}";
+	}
+
+	file << std::fixed << std::setprecision(3);
+	for (const auto &event : events)
+	{
+		file << ",\n{\"name\":";
+		writeString(event.name);
+		file << ",\"cat\":\"" << (event.thread == 0 ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+			<< ",\"ts\":" << static_cast<double>(event.beginNs - captureBeginNs) * 1e-3
+			<< ",\"dur\":" << static_cast<double>(event.endNs - event.beginNs) * 1e-3 << "}";
+	}
+	file << "\n]}\n";
+
+	return file.good();
+}
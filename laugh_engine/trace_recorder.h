@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Captures CPU and GPU events of a range of frames and writes them as a Chrome trace_event JSON file,
+// which chrome://tracing, Perfetto and Tracy's importer can open. Times are std::chrono::steady_clock nanoseconds.
+// Events are only kept while a capture runs, TRACE_CPU_SCOPE costs a flag check otherwise
+class TraceRecorder
+{
+public:
+	static TraceRecorder &get();
+
+	// Capture the next @frameCount frames. GPU events arrive a few frames late, so they are collected for @gpuLatencyFrames more frames
+	void beginCapture(uint32_t frameCount, uint32_t gpuLatencyFrames, const std::string &fileName);
+	bool isCapturing() const { return capturing; }
+
+	void addCpuEvent(const char *name, uint64_t beginNs, uint64_t endNs);
+	// Dropped if the event began before the capture, i.e. belongs to a frame that was not captured
+	void addGpuEvent(const std::string &name, uint64_t beginNs, uint64_t endNs);
+
+	// Call once per frame. Write the file once the last captured frame's GPU events are in, return true then
+	bool endFrame();
+
+	// Events of threads with the same name share a row, e.g. worker threads that are recreated every frame
+	static void setCurrentThreadName(const std::string &name);
+
+	static uint64_t now();
+
+	class CpuScope
+	{
+	public:
+		CpuScope(const char *name) : name(name), beginNs(TraceRecorder::get().isCapturing() ? now() : 0) {}
+		~CpuScope()
+		{
+			auto &recorder = TraceRecorder::get();
+			if (beginNs != 0 && recorder.isCapturing()) recorder.addCpuEvent(name, beginNs, now());
+		}
+
+	private:
+		const char *name;
+		uint64_t beginNs;
+	};
+
+protected:
+	struct Event
+	{
+		std::string name;
+		uint32_t thread; // 0 is the GPU
+		uint64_t beginNs;
+		uint64_t endNs;
+	};
+
+	std::atomic<bool> capturing{ false };
+	bool cpuFramesDone = false;
+	uint32_t framesLeft = 0;
+	uint32_t gpuFramesLeft = 0;
+	uint64_t captureBeginNs = 0;
+	std::string fileName;
+
+	std::mutex mutex;
+	std::vector<Event> events;
+	std::vector<std::string> threadNames; // by thread index - 1, in the order threads first recorded an event
+	std::unordered_map<std::string, uint32_t> threadIndices;
+	uint32_t unnamedThreadCount = 0;
+
+	uint32_t getThreadIndex();
+	bool save() const;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// Time the rest of the enclosing block. @name must outlive the capture, e.g. a string literal
+#define TRACE_CPU_SCOPE(name) TraceRecorder::CpuScope TRACE_CONCAT(traceCpuScope, __LINE__)(name)
@@ -0,0 +1,167 @@
+#include "transform_system.h"
+#include <cassert>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORM_UPDATE_SSE 1
+#else
+#define TRANSFORM_UPDATE_SSE 0
+#endif
+
+
+uint32_t TransformSystem::add(uint32_t parent, const glm::vec3 &position, const glm::quat &rotation, float scale)
+{
+	const uint32_t handle = getCount();
+	// Parents come first, so update() can go through the arrays in order
+	assert(parent == INVALID_HANDLE || parent < handle);
+
+	positions.push_back(position);
+	rotations.push_back(rotation);
+	scales.push_back(scale);
+	parents.push_back(parent);
+	dirty.push_back(1);
+	changed.push_back(0);
+	localMatrices.emplace_back(1.f);
+	worldMatrices.emplace_back(1.f);
+	normalMatrices.emplace_back(1.f);
+	worldScales.push_back(1.f);
+	return handle;
+}
+
+void TransformSystem::setPosition(uint32_t handle, const glm::vec3 &position)
+{
+	positions[handle] = position;
+	dirty[handle] = 1;
+}
+
+void TransformSystem::setRotation(uint32_t handle, const glm::quat &rotation)
+{
+	rotations[handle] = rotation;
+	dirty[handle] = 1;
+}
+
+void TransformSystem::setScale(uint32_t handle, float scale)
+{
+	scales[handle] = scale;
+	dirty[handle] = 1;
+}
+
+uint32_t TransformSystem::update()
+{
+	// A transform whose parent moves moves with it
+	updated.clear();
+	for (uint32_t i = 0; i < getCount(); ++i)
+	{
+		if (parents[i] != INVALID_HANDLE && changed[parents[i]]) dirty[i] = 1;
+		changed[i] = dirty[i];
+		dirty[i] = 0;
+		if (changed[i]) updated.push_back(i);
+	}
+	if (updated.empty()) return 0;
+
+	computeLocalMatrices(updated);
+
+	// In order, so parents are final before their children
+	for (uint32_t i : updated)
+	{
+		const uint32_t parent = parents[i];
+		if (parent == INVALID_HANDLE)
+		{
+			worldMatrices[i] = localMatrices[i];
+			worldScales[i] = scales[i];
+		}
+		else
+		{
+			worldMatrices[i] = worldMatrices[parent] * localMatrices[i];
+			worldScales[i] = worldScales[parent] * scales[i];
+		}
+
+		// With a uniform scale the upper 3x3 A is a rotation times s, so A^-T = A / s^2 and no inverse is needed.
+		// The bottom row holds -(A^-1 t) as in glm::transpose(glm::inverse(M))
+		const glm::mat4 &M = worldMatrices[i];
+		const float invScale2 = 1.f / (worldScales[i] * worldScales[i]);
+		const glm::vec3 t(M[3]);
+		glm::mat4 &N = normalMatrices[i];
+		for (int c = 0; c < 3; ++c)
+		{
+			const glm::vec3 axis(M[c]);
+			N[c] = glm::vec4(axis * invScale2, -glm::dot(axis, t) * invScale2);
+		}
+		N[3] = glm::vec4(0.f, 0.f, 0.f, 1.f);
+	}
+	return static_cast<uint32_t>(updated.size());
+}
+
+glm::mat4 TransformSystem::computeWorldMatrix(uint32_t handle) const
+{
+	glm::mat4 M(1.f);
+	for (uint32_t i = handle; i != INVALID_HANDLE; i = parents[i])
+	{
+		glm::mat4 local = glm::mat4_cast(rotations[i]);
+		local[0] *= scales[i];
+		local[1] *= scales[i];
+		local[2] *= scales[i];
+		local[3] = glm::vec4(positions[i], 1.f);
+		M = local * M;
+	}
+	return M;
+}
+
+void TransformSystem::computeLocalMatrices(const std::vector<uint32_t> &handles)
+{
+	size_t k = 0;
+
+#if TRANSFORM_UPDATE_SSE
+	// Four transforms at a time, one per lane. Same terms as glm::mat3_cast
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 two = _mm_set1_ps(2.f);
+	for (; k + 4 <= handles.size(); k += 4)
+	{
+		const uint32_t h0 = handles[k], h1 = handles[k + 1], h2 = handles[k + 2], h3 = handles[k + 3];
+		const __m128 qx = _mm_set_ps(rotations[h3].x, rotations[h2].x, rotations[h1].x, rotations[h0].x);
+		const __m128 qy = _mm_set_ps(rotations[h3].y, rotations[h2].y, rotations[h1].y, rotations[h0].y);
+		const __m128 qz = _mm_set_ps(rotations[h3].z, rotations[h2].z, rotations[h1].z, rotations[h0].z);
+		const __m128 qw = _mm_set_ps(rotations[h3].w, rotations[h2].w, rotations[h1].w, rotations[h0].w);
+		const __m128 s = _mm_set_ps(scales[h3], scales[h2], scales[h1], scales[h0]);
+		const __m128 twoS = _mm_mul_ps(two, s);
+
+		const __m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+		const __m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+		const __m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+
+		// Column major, m[c][r]
+		float m[3][3][4];
+		_mm_storeu_ps(m[0][0], _mm_mul_ps(s, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)))));
+		_mm_storeu_ps(m[0][1], _mm_mul_ps(twoS, _mm_add_ps(xy, wz)));
+		_mm_storeu_ps(m[0][2], _mm_mul_ps(twoS, _mm_sub_ps(xz, wy)));
+		_mm_storeu_ps(m[1][0], _mm_mul_ps(twoS, _mm_sub_ps(xy, wz)));
+		_mm_storeu_ps(m[1][1], _mm_mul_ps(s, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)))));
+		_mm_storeu_ps(m[1][2], _mm_mul_ps(twoS, _mm_add_ps(yz, wx)));
+		_mm_storeu_ps(m[2][0], _mm_mul_ps(twoS, _mm_add_ps(xz, wy)));
+		_mm_storeu_ps(m[2][1], _mm_mul_ps(twoS, _mm_sub_ps(yz, wx)));
+		_mm_storeu_ps(m[2][2], _mm_mul_ps(s, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)))));
+
+		for (uint32_t lane = 0; lane < 4; ++lane)
+		{
+			const uint32_t h = handles[k + lane];
+			glm::mat4 &local = localMatrices[h];
+			for (int c = 0; c < 3; ++c)
+			{
+				local[c] = glm::vec4(m[c][0][lane], m[c][1][lane], m[c][2][lane], 0.f);
+			}
+			local[3] = glm::vec4(positions[h], 1.f);
+		}
+	}
+#endif
+
+	for (; k < handles.size(); ++k)
+	{
+		const uint32_t h = handles[k];
+		glm::mat4 &local = localMatrices[h];
+		local = glm::mat4_cast(rotations[h]);
+		local[0] *= scales[h];
+		local[1] *= scales[h];
+		local[2] *= scales[h];
+		local[3] = glm::vec4(positions[h], 1.f);
+	}
+}
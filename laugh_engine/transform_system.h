@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+
+// Translation, rotation and uniform scale of every object in the scene, stored as separate arrays and addressed by handle.
+// A transform is relative to its parent, which has to be added before it. The setters only mark the transform dirty,
+// update() rebuilds the world and normal matrices of dirty transforms and their descendants, four local matrices at a time
+class TransformSystem
+{
+public:
+	static const uint32_t INVALID_HANDLE = std::numeric_limits<uint32_t>::max();
+
+	uint32_t add(uint32_t parent = INVALID_HANDLE,
+		const glm::vec3 &position = glm::vec3(0.f), const glm::quat &rotation = glm::quat(), float scale = 1.f);
+
+	void setPosition(uint32_t handle, const glm::vec3 &position);
+	void setRotation(uint32_t handle, const glm::quat &rotation);
+	void setScale(uint32_t handle, float scale);
+
+	const glm::vec3 &getPosition(uint32_t handle) const { return positions[handle]; }
+	const glm::quat &getRotation(uint32_t handle) const { return rotations[handle]; }
+	float getScale(uint32_t handle) const { return scales[handle]; }
+	uint32_t getParent(uint32_t handle) const { return parents[handle]; }
+	uint32_t getCount() const { return static_cast<uint32_t>(parents.size()); }
+
+	// Rebuild the matrices of the dirty transforms. Return the number of transforms updated
+	uint32_t update();
+	// True if the matrices of @handle were rebuilt by the last update()
+	bool isChanged(uint32_t handle) const { return changed[handle] != 0; }
+
+	// As of the last update()
+	const glm::mat4 &getWorldMatrix(uint32_t handle) const { return worldMatrices[handle]; }
+	const glm::mat4 &getNormalMatrix(uint32_t handle) const { return normalMatrices[handle]; }
+	// From the current position, rotation and scale of @handle and its ancestors, without waiting for update()
+	glm::mat4 computeWorldMatrix(uint32_t handle) const;
+
+protected:
+	std::vector<glm::vec3> positions;
+	std::vector<glm::quat> rotations;
+	std::vector<float> scales;
+	std::vector<uint32_t> parents;
+	std::vector<uint8_t> dirty;
+	std::vector<uint8_t> changed;
+
+	std::vector<glm::mat4> localMatrices;
+	std::vector<glm::mat4> worldMatrices;
+	std::vector<glm::mat4> normalMatrices; // inverse transpose of the world matrix
+	std::vector<float> worldScales;
+	std::vector<uint32_t> updated; // handles rebuilt by the last update(), kept to not allocate per call
+
+	void computeLocalMatrices(const std::vector<uint32_t> &handles);
+};
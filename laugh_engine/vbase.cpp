@@ -17,35 +17,82 @@ void VBaseGraphics::run()
 
 void VBaseGraphics::initVulkan()
 {
+	STARTUP_PHASE("initVulkan");
+
+	// Nothing uses the swapchain yet, so only the swapchain itself is recreated
+	if (m_vulkanManager.setSwapChainPresentConfig(m_presentMode, m_swapChainImageCount))
+	{
+		m_vulkanManager.recreateSwapChain();
+	}
+
+	StartupProfile::Scope stage("loadAndPrepareAssets");
 	loadAndPrepareAssets();
+	stage.next("createQueryPools");
 	createQueryPools();
+	stage.next("createRenderPasses");
 	createRenderPasses();
+	stage.next("createDescriptorSetLayouts");
 	createDescriptorSetLayouts();
+	stage.next("createComputePipelines");
 	createComputePipelines();
+	stage.next("createGraphicsPipelines");
 	createGraphicsPipelines();
+	stage.next("createCommandPools");
 	createCommandPools();
+	stage.next("createComputeResources");
 	createComputeResources();
+	stage.next("createDepthResources");
 	createDepthResources();
+	stage.next("createColorAttachmentResources");
 	createColorAttachmentResources();
+	stage.next("createFramebuffers");
 	createFramebuffers();
+	stage.next("createUniformBuffers");
 	createUniformBuffers();
+	stage.next("createDescriptorPools");
 	createDescriptorPools();
+	stage.next("createDescriptorSets");
 	createDescriptorSets();
+	stage.next("createCommandBuffers");
 	createCommandBuffers();
+	stage.next("createSynchronizationObjects");
 	createSynchronizationObjects();
+	stage.next("prepare text overlay");
 	m_textOverlay.prepareResources();
 
+	// All pipelines exist now. Save early so a crash later in the run doesn't lose them
+	stage.next("savePipelineCache");
+	m_vulkanManager.savePipelineCache();
+
 	m_initialized = true;
 }
 
 void VBaseGraphics::mainLoop()
 {
+	bool idle = false;
 	while (!m_vulkanManager.windowShouldClose())
 	{
+		if (m_renderOnDemand && !needsFrame())
+		{
+			// Nothing to submit, the last presented image stays on screen
+			m_vulkanManager.windowWaitEvents();
+			idle = true;
+			continue;
+		}
+		if (idle)
+		{
+			onIdleEnd();
+			idle = false;
+		}
+
+		waitForFramePacing();
 		m_vulkanManager.windowPollEvents();
 		
+		updateCameraRecording();
 		updateUniformHostData();
 		drawFrame();
+
+		if (m_pendingRedrawFrames > 0) --m_pendingRedrawFrames;
 	}
 
 	// When the main loop terminate, some commands may still being executed on
@@ -54,6 +101,59 @@ void VBaseGraphics::mainLoop()
 	m_vulkanManager.deviceWaitIdle();
 }
 
+void VBaseGraphics::updateCameraRecording()
+{
+	if (m_cameraRecordingToggleRequested)
+	{
+		m_cameraRecordingToggleRequested = false;
+		if (m_cameraRecording.isWriting())
+		{
+			m_cameraRecording.endWrite();
+			std::cout << "Camera recording saved to " << m_cameraRecordingFileName << std::endl;
+		}
+		else if (m_cameraRecording.beginWrite(m_cameraRecordingFileName))
+		{
+			m_cameraPlaying = false;
+			resetTemporalState();
+		}
+		else
+		{
+			std::cerr << "Unable to record the camera to " << m_cameraRecordingFileName << std::endl;
+		}
+	}
+
+	if (m_cameraPlaybackRequested)
+	{
+		m_cameraPlaybackRequested = false;
+		m_cameraRecording.endWrite();
+		if (m_cameraRecording.load(m_cameraRecordingFileName))
+		{
+			m_cameraPlaying = true;
+			m_cameraPlaybackFrame = 0;
+			resetTemporalState();
+		}
+		else
+		{
+			std::cerr << "Unable to load the camera recording " << m_cameraRecordingFileName << std::endl;
+		}
+	}
+
+	// One recorded frame per rendered frame, mouse input is overridden until the playback ends
+	if (m_cameraPlaying)
+	{
+		m_camera.setState(m_cameraRecording.at(m_cameraPlaybackFrame++));
+		if (m_cameraPlaybackFrame == m_cameraRecording.size())
+		{
+			m_cameraPlaying = false;
+			std::cout << "Camera playback finished after " << m_cameraPlaybackFrame << " frames" << std::endl;
+		}
+	}
+	else if (m_cameraRecording.isWriting())
+	{
+		m_cameraRecording.write(m_camera.getState());
+	}
+}
+
 void VBaseGraphics::recreateSwapChain()
 {
 	auto updateCamera = [this]()
@@ -62,21 +162,43 @@ void VBaseGraphics::recreateSwapChain()
 		m_camera.setAspectRatio(extent.width / static_cast<float>(extent.height));
 	};
 
+	const VkFormat oldFormat = m_vulkanManager.getSwapChainImageFormat();
+	const uint32_t oldImageCount = m_vulkanManager.getSwapChainSize();
+
+	// Attachments, descriptor sets and command buffers shared with the frames in flight are rebuilt below, so those frames
+	// have to complete first. The old swapchain is only retired, the frames queued for presentation stay on screen meanwhile
 	m_vulkanManager.deviceWaitIdle();
 
 	m_vulkanManager.recreateSwapChain();
 	updateCamera();
-	createQueryPools();
-	createRenderPasses();
-	createGraphicsPipelines();
+
+	// Per swapchain image resources only depend on the image count
+	const bool imageCountChanged = m_vulkanManager.getSwapChainSize() != oldImageCount;
+	if (imageCountChanged)
+	{
+		createQueryPools();
+	}
+
+	// Pipelines take viewport and scissor as dynamic state, so render passes and pipelines
+	// only need to be rebuilt if the swapchain format has changed
+	if (m_vulkanManager.getSwapChainImageFormat() != oldFormat)
+	{
+		createRenderPasses();
+		createGraphicsPipelines();
+	}
+
 	createDepthResources();
 	createColorAttachmentResources();
 	createFramebuffers();
-	createUniformBuffers();
+	if (imageCountChanged)
+	{
+		createUniformBuffers();
+	}
 	// Image views of G-buffers and lighting result image has changed so
 	// recreation of descriptor sets is necessary
 	createDescriptorSets();
 	createCommandBuffers();
+	m_textOverlay.handleSwapChainRecreation();
 }
 
 const std::string &VBaseGraphics::getWindowTitle()
@@ -88,7 +210,21 @@ const VkPhysicalDeviceFeatures &VBaseGraphics::getEnabledPhysicalDeviceFeatures(
 {
 	m_physicalDeviceFeatures = {};
 	m_physicalDeviceFeatures.shaderStorageImageExtendedFormats = VK_TRUE;
+	m_physicalDeviceFeatures.shaderStorageImageMultisample = VK_TRUE; // rj::VDevice drops it if the device does not have it
+	m_physicalDeviceFeatures.fragmentStoresAndAtomics = VK_TRUE; // virtual texture feedback, dropped as well
 	m_physicalDeviceFeatures.geometryShader = VK_TRUE;
+	m_physicalDeviceFeatures.depthClamp = VK_TRUE;
+	m_physicalDeviceFeatures.multiDrawIndirect = VK_TRUE;
+	m_physicalDeviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+	m_physicalDeviceFeatures.pipelineStatisticsQuery = VK_TRUE; // rj::VGpuProfiler
+	m_physicalDeviceFeatures.inheritedQueries = VK_TRUE; // statistics queries around secondary command buffers
+	// Block compressed textures, rj::VDevice drops the families the device does not have
+	m_physicalDeviceFeatures.textureCompressionBC = VK_TRUE;
+	m_physicalDeviceFeatures.textureCompressionASTC_LDR = VK_TRUE;
+	m_physicalDeviceFeatures.textureCompressionETC2 = VK_TRUE;
+	// Partially resident shadow maps, dropped as well if the device or its graphics queue cannot bind sparse memory
+	m_physicalDeviceFeatures.sparseBinding = VK_TRUE;
+	m_physicalDeviceFeatures.sparseResidencyImage2D = VK_TRUE;
 
 	return m_physicalDeviceFeatures;
 }
@@ -4,8 +4,11 @@
 #include <algorithm>
 #include <sstream>
 #include <iomanip>
+#include <iostream>
 
 #include "camera.h"
+#include "camera_path.h"
+#include "startup_profile.h"
 #include "vtextoverlay.h"
 
 
@@ -34,6 +37,24 @@ public:
 
 	DisplayMode m_displayMode = DISPLAY_MODE_FULL;
 	float m_distEnvLightStrength = .5f;
+	bool m_recordCommandBuffersPerFrame = false; // re-record scene command buffers every frame instead of replaying pre-recorded ones
+	bool m_useDepthPrepass = false; // lay down depth before the geometry pass so it only shades the visible surface
+	VkSampleCountFlagBits m_requestedSampleCount = VK_SAMPLE_COUNT_4_BIT; // MSAA sample count, the app clamps it to what the device supports
+	bool m_traceCaptureRequested = false; // capture a CPU and GPU trace of the next m_traceFrameCount frames
+	uint32_t m_traceFrameCount = 60;
+	std::string m_cameraPathFileName = "camera_path.txt"; // P appends the current camera as a keyframe
+	std::string m_cameraRecordingFileName = "camera_recording.txt"; // C starts and stops recording every frame's camera, V plays it back
+	bool m_cameraRecordingToggleRequested = false;
+	bool m_cameraPlaybackRequested = false;
+	uint32_t m_environmentSwitchRequests = 0; // E presses not handled yet, each asks for the next environment with USE_PROBE_SWITCHING
+	uint32_t m_sceneSwitchRequests = 0; // N presses not handled yet, each asks for the next scene with USE_SCENE_HOT_SWAP
+	uint32_t m_viewLayoutSwitchRequests = 0; // F presses not handled yet, each asks for one more view with USE_MULTI_VIEW
+	uint32_t m_shadingRateSwitchRequests = 0; // G presses not handled yet, each asks for the next shading rate mode with USE_VARIABLE_RATE_SHADING
+	bool m_renderOnDemand = false; // O toggles, only render after input or a scene change and wait for events in between
+	VkPresentModeKHR m_presentMode = VK_PRESENT_MODE_MAILBOX_KHR; // applied by initVulkan(), FIFO if the surface lacks it
+	uint32_t m_swapChainImageCount = 0; // applied by initVulkan(), 0 for one more than the surface minimum
+	bool m_lowLatencyMode = false; // L toggles, sample input and build each frame only once the previous one is out, see waitForFramePacing()
+	bool m_abToggleRequested = false; // B starts and stops the app's A/B comparison, if it has one
 
 	static bool leftMBDown, middleMBDown;
 	static float lastX, lastY;
@@ -50,6 +71,7 @@ public:
 
 		VBaseGraphics *app = reinterpret_cast<VBaseGraphics *>(glfwGetWindowUserPointer(window));
 		app->recreateSwapChain();
+		app->requestRedraw();
 	}
 
 	static void mouseButtonCB(GLFWwindow* window, int button, int action, int mods)
@@ -62,6 +84,8 @@ public:
 			lastY = static_cast<float>(ypos);
 		};
 
+		reinterpret_cast<VBaseGraphics *>(glfwGetWindowUserPointer(window))->requestRedraw();
+
 		if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && !middleMBDown)
 		{
 			leftMBDown = true;
@@ -95,6 +119,7 @@ public:
 			float dy = static_cast<float>(ypos) - lastY;
 			lastX = static_cast<float>(xpos);
 			lastY = static_cast<float>(ypos);
+			app->requestRedraw();
 			
 			if (leftMBDown)
 			{
@@ -112,24 +137,97 @@ public:
 		VBaseGraphics *app = reinterpret_cast<VBaseGraphics *>(glfwGetWindowUserPointer(window));
 		const float scale = .2f;
 		app->m_camera.addZoom(scale * static_cast<float>(yoffset));
+		app->requestRedraw();
 	}
 
+	VBaseGraphics(bool headless = false, bool trackHostAllocations = false, bool debugLabels = false, bool deviceGroup = false)
+		: m_headless(headless), m_trackHostAllocations(trackHostAllocations), m_debugLabels(debugLabels), m_deviceGroup(deviceGroup) {}
+
 	static void keyCB(GLFWwindow* window, int key, int scancode, int action, int mods)
 	{
 		VBaseGraphics *app = reinterpret_cast<VBaseGraphics *>(glfwGetWindowUserPointer(window));
+		app->requestRedraw();
 
 		if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
 		{
 			app->m_displayMode = static_cast<DisplayMode>((app->m_displayMode + 1) % DISPLAY_MODE_COUNT);
 		}
+		else if (key == GLFW_KEY_R && action == GLFW_PRESS)
+		{
+			app->m_recordCommandBuffersPerFrame = !app->m_recordCommandBuffersPerFrame;
+		}
+		else if (key == GLFW_KEY_Z && action == GLFW_PRESS)
+		{
+			app->m_useDepthPrepass = !app->m_useDepthPrepass;
+		}
+		else if (key == GLFW_KEY_M && action == GLFW_PRESS)
+		{
+			// 1, 2, 4, 8 samples
+			uint32_t count = static_cast<uint32_t>(app->m_requestedSampleCount) << 1;
+			app->m_requestedSampleCount = static_cast<VkSampleCountFlagBits>(count > VK_SAMPLE_COUNT_8_BIT ? VK_SAMPLE_COUNT_1_BIT : count);
+		}
+		else if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		{
+			app->m_traceCaptureRequested = true;
+		}
+		else if (key == GLFW_KEY_C && action == GLFW_PRESS)
+		{
+			app->m_cameraRecordingToggleRequested = true;
+		}
+		else if (key == GLFW_KEY_V && action == GLFW_PRESS)
+		{
+			app->m_cameraPlaybackRequested = true;
+		}
+		else if (key == GLFW_KEY_E && action == GLFW_PRESS)
+		{
+			++app->m_environmentSwitchRequests;
+		}
+		else if (key == GLFW_KEY_N && action == GLFW_PRESS)
+		{
+			++app->m_sceneSwitchRequests;
+		}
+		else if (key == GLFW_KEY_F && action == GLFW_PRESS)
+		{
+			++app->m_viewLayoutSwitchRequests;
+		}
+		else if (key == GLFW_KEY_G && action == GLFW_PRESS)
+		{
+			++app->m_shadingRateSwitchRequests;
+		}
+		else if (key == GLFW_KEY_O && action == GLFW_PRESS)
+		{
+			app->m_renderOnDemand = !app->m_renderOnDemand;
+		}
+		else if (key == GLFW_KEY_L && action == GLFW_PRESS)
+		{
+			app->m_lowLatencyMode = !app->m_lowLatencyMode;
+		}
+		else if (key == GLFW_KEY_B && action == GLFW_PRESS)
+		{
+			app->m_abToggleRequested = true;
+		}
+		else if (key == GLFW_KEY_P && action == GLFW_PRESS)
+		{
+			if (!CameraPath::appendKeyframe(app->m_cameraPathFileName, app->m_camera))
+			{
+				std::cerr << "Unable to append a keyframe to " << app->m_cameraPathFileName << std::endl;
+			}
+		}
 	}
 
 	virtual void run();
 
 protected:
 	VkPhysicalDeviceFeatures m_physicalDeviceFeatures;
+	const bool m_headless; // render into offscreen images without opening a window
+	const bool m_trackHostAllocations; // create every Vulkan object with m_hostAllocator
+	const bool m_debugLabels; // VK_EXT_debug_utils names and labels for capture tools
+	const bool m_deviceGroup; // create the device over a group of linked GPUs if there is one
+	// Outlives the manager, whose objects are destroyed with it
+	rj::VTrackingHostAllocator m_hostAllocator;
 
-	rj::VManager m_vulkanManager{ this, keyCB, mouseButtonCB, cursorPositionCB, scrollCB, onWindowResized, m_width, m_height, getWindowTitle(), getEnabledPhysicalDeviceFeatures() };
+	rj::VManager m_vulkanManager{ this, keyCB, mouseButtonCB, cursorPositionCB, scrollCB, onWindowResized, m_width, m_height, getWindowTitle(), getEnabledPhysicalDeviceFeatures(), m_headless,
+		m_trackHostAllocations ? m_hostAllocator.callbacks() : nullptr, m_debugLabels, m_deviceGroup };
 
 	uint32_t m_descriptorPool;
 
@@ -143,8 +241,16 @@ protected:
 
 	VTextOverlay m_textOverlay{ &m_vulkanManager };
 
+	CameraRecording m_cameraRecording;
+	bool m_cameraPlaying = false;
+	size_t m_cameraPlaybackFrame = 0; // next recorded frame to show
+
 	bool m_initialized = false;
 
+	// On-demand mode renders this many frames after each change, e.g. for temporal effects to converge
+	uint32_t m_redrawFrameCount = 1;
+	uint32_t m_pendingRedrawFrames = 1;
+
 
 	virtual void initVulkan();
 
@@ -152,6 +258,21 @@ protected:
 
 	virtual void recreateSwapChain();
 
+	// Handle the recording requests, then record or play back this frame's camera. Call once per frame before updateUniformHostData()
+	void updateCameraRecording();
+	// Called when a camera recording or playback starts, so both runs render the same frames, e.g. the same TAA jitter
+	virtual void resetTemporalState() {}
+
+	// Input, resizes and scene changes ask on-demand mode for the next m_redrawFrameCount frames
+	void requestRedraw() { m_pendingRedrawFrames = m_redrawFrameCount; }
+	// Whether on-demand mode renders the next frame. Apps add the work they finish over several frames
+	virtual bool needsFrame() const { return m_pendingRedrawFrames > 0 || m_cameraPlaying; }
+	// Called before the first frame rendered after on-demand mode has waited for events
+	virtual void onIdleEnd() {}
+	// Called before the input of every frame is sampled. With m_lowLatencyMode apps wait here for the GPU or the display,
+	// rather than after the input has been read
+	virtual void waitForFramePacing() {}
+
 	// Let the app pick the queue families they need
 	virtual const std::string &getWindowTitle();
 	virtual const VkPhysicalDeviceFeatures &getEnabledPhysicalDeviceFeatures();
@@ -4,8 +4,10 @@
 
 #include <iostream>
 #include <stdexcept>
-#include <functional>
+#include <vector>
+#include <cstdint>
 #include <cassert>
+#include "VHostAllocator.h"
 
 
 namespace rj
@@ -18,35 +20,42 @@ namespace rj
 	// reallocate its internal memory, VDeleter<T>::~VDeleter will be called on
 	// old elements and the copy/move constructed elements will refer to destroyed
 	// Vulkan objects!
+	//
+	// The deleter is a plain Vulkan destroy function plus a pointer to the instance or device handle it takes, which is read
+	// when the object is destroyed since the parent may be created after its children are declared. So a VDeleter is four
+	// pointers in size and creating or destroying one never touches the heap
 	template <typename T>
 	class VDeleter
 	{
 	public:
-		VDeleter() : VDeleter([](T, VkAllocationCallbacks *) {}) {}
+		typedef void (VKAPI_PTR *DestroyFunction)(T, const VkAllocationCallbacks *);
+		typedef void (VKAPI_PTR *InstanceDestroyFunction)(VkInstance, T, const VkAllocationCallbacks *);
+		typedef void (VKAPI_PTR *DeviceDestroyFunction)(VkDevice, T, const VkAllocationCallbacks *);
 
-		VDeleter(std::function<void(T, VkAllocationCallbacks *)> deletef)
+		VDeleter() {}
+
+		VDeleter(DestroyFunction deletef) : kind(Kind::Plain)
 		{
-			this->deleter = [=](T obj) { deletef(obj, nullptr); };
+			function.plain = deletef;
 		}
 
-		VDeleter(const VDeleter<VkInstance> &instance,
-			std::function<void(VkInstance, T, VkAllocationCallbacks *)> deletef)
+		VDeleter(const VDeleter<VkInstance> &instance, InstanceDestroyFunction deletef) : kind(Kind::Instance)
 		{
-			this->deleter = [&instance, deletef](T obj) { deletef(instance, obj, nullptr); };
+			parent.pInstance = &instance.object;
+			function.instance = deletef;
 		}
 
-		VDeleter(const VDeleter<VkDevice> &device, std::function<void(VkDevice, T, VkAllocationCallbacks *)> deletef)
+		VDeleter(const VDeleter<VkDevice> &device, DeviceDestroyFunction deletef) : kind(Kind::Device)
 		{
-			this->deleter = [&device, deletef](T obj) { deletef(device, obj, nullptr); };
+			parent.pDevice = &device.object;
+			function.device = deletef;
 		}
 
 		// TODO: make copy ctor deleted
 		VDeleter(const VDeleter<T> &other)
 		{
 			VDeleter<T> &_other = const_cast<VDeleter<T> &>(other);
-			object = _other.object;
-			deleter = _other.deleter;
-			_other.object = VK_NULL_HANDLE;
+			takeFrom(_other);
 		}
 
 		// TODO: make copy assignment operator deleted
@@ -58,17 +67,13 @@ namespace rj
 			}
 
 			VDeleter<T> &_other = const_cast<VDeleter<T> &>(other);
-			object = _other.object;
-			deleter = _other.deleter;
-			_other.object = VK_NULL_HANDLE;
+			takeFrom(_other);
 			return *this;
 		}
 
 		VDeleter(VDeleter<T> &&other)
 		{
-			object = other.object;
-			deleter = other.deleter;
-			other.object = VK_NULL_HANDLE;
+			takeFrom(other);
 		}
 
 		VDeleter<T> &operator=(VDeleter<T> &&other)
@@ -78,13 +83,11 @@ namespace rj
 				cleanup();
 			}
 
-			object = other.object;
-			deleter = other.deleter;
-			other.object = VK_NULL_HANDLE;
+			takeFrom(other);
 			return *this;
 		}
 
-		virtual ~VDeleter()
+		~VDeleter()
 		{
 			cleanup();
 		}
@@ -100,6 +103,12 @@ namespace rj
 			return &object;
 		}
 
+		// Destroy the object now, the deleter is kept for the next one
+		void reset()
+		{
+			cleanup();
+		}
+
 		operator T() const
 		{
 			return object;
@@ -126,16 +135,70 @@ namespace rj
 		}
 
 	private:
+		template<typename> friend class VDeleter;
+
+		enum class Kind : uint8_t
+		{
+			None,
+			Plain,
+			Instance,
+			Device
+		};
+
 		T object{ VK_NULL_HANDLE };
-		std::function<void(T)> deleter;
+		union
+		{
+			const VkInstance *pInstance;
+			const VkDevice *pDevice;
+		} parent = {};
+		union
+		{
+			DestroyFunction plain;
+			InstanceDestroyFunction instance;
+			DeviceDestroyFunction device;
+		} function = {};
+		Kind kind = Kind::None;
+
+		void takeFrom(VDeleter<T> &other)
+		{
+			object = other.object;
+			parent = other.parent;
+			function = other.function;
+			kind = other.kind;
+			other.object = VK_NULL_HANDLE;
+		}
 
 		void cleanup()
 		{
 			if (object != VK_NULL_HANDLE)
 			{
-				deleter(object);
+				switch (kind)
+				{
+				case Kind::Plain:
+					function.plain(object, helper_functions::getHostAllocationCallbacks());
+					break;
+				case Kind::Instance:
+					function.instance(*parent.pInstance, object, helper_functions::getHostAllocationCallbacks());
+					break;
+				case Kind::Device:
+					function.device(*parent.pDevice, object, helper_functions::getHostAllocationCallbacks());
+					break;
+				default:
+					break;
+				}
 			}
 			object = VK_NULL_HANDLE;
 		}
 	};
+
+	// Destroy every object of @deleters, e.g. a pool of fences or a table of streamed resources, in one pass and keep the
+	// elements with their deleters so they can be filled again without being reconstructed
+	template <typename T>
+	void destroyAll(std::vector<VDeleter<T>> &deleters)
+	{
+		for (auto &deleter : deleters)
+		{
+			deleter.reset();
+		}
+	}
 }
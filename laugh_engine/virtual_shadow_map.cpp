@@ -0,0 +1,123 @@
+#include "virtual_shadow_map.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+
+VirtualShadowMap::VirtualShadowMap(uint32_t pageCountX, uint32_t pageCountY, uint32_t layerCount, uint32_t pageBudget, uint32_t keepFrames)
+	: pageCountX(pageCountX), pageCountY(pageCountY), pageBudget(pageBudget), keepFrames(keepFrames)
+{
+	assert(pageCountX > 0 && pageCountY > 0 && layerCount > 0);
+	const uint32_t pageCount = pageCountX * pageCountY * layerCount;
+	resident.assign(pageCount, 0);
+	lastRequestFrames.assign(pageCount, 0);
+	requestBits.assign((pageCount + 31) / 32, 0);
+	dirtyRects.resize(layerCount);
+}
+
+void VirtualShadowMap::request(const uint32_t *pRequestBits)
+{
+	for (size_t w = 0; w < requestBits.size(); ++w)
+	{
+		requestBits[w] |= pRequestBits[w];
+	}
+}
+
+void VirtualShadowMap::update(uint64_t frame, std::vector<uint32_t> *pBindPages, std::vector<uint32_t> *pUnbindPages)
+{
+	const uint32_t pageCount = static_cast<uint32_t>(resident.size());
+	missing.clear();
+	for (uint32_t w = 0; w < static_cast<uint32_t>(requestBits.size()); ++w)
+	{
+		for (uint32_t bits = requestBits[w]; bits != 0; bits &= bits - 1)
+		{
+			uint32_t bit = 0;
+			while ((bits & (1u << bit)) == 0) ++bit;
+			const uint32_t page = w * 32 + bit;
+			if (page >= pageCount) break;
+
+			lastRequestFrames[page] = frame;
+			if (!resident[page]) missing.push_back(page);
+		}
+		requestBits[w] = 0;
+	}
+
+	// Evict the pages requested longest ago, of those no frame in flight may sample
+	const uint32_t freeCount = pageBudget - std::min(residentCount, pageBudget);
+	if (missing.size() > freeCount)
+	{
+		evictable.clear();
+		for (uint32_t page = 0; page < pageCount; ++page)
+		{
+			if (resident[page] && lastRequestFrames[page] + keepFrames < frame) evictable.push_back(page);
+		}
+		const size_t evictCount = std::min(missing.size() - freeCount, evictable.size());
+		std::partial_sort(evictable.begin(), evictable.begin() + evictCount, evictable.end(),
+			[this](uint32_t a, uint32_t b) { return lastRequestFrames[a] < lastRequestFrames[b]; });
+		for (size_t i = 0; i < evictCount; ++i)
+		{
+			resident[evictable[i]] = 0;
+			pUnbindPages->push_back(evictable[i]);
+		}
+		residentCount -= static_cast<uint32_t>(evictCount);
+	}
+
+	// Pages are in layer order, so finer cascades are bound first. The rest is requested again next frame
+	const uint32_t pagesPerLayer = pageCountX * pageCountY;
+	const size_t bindCount = std::min<size_t>(missing.size(), pageBudget - std::min(residentCount, pageBudget));
+	for (size_t i = 0; i < bindCount; ++i)
+	{
+		const uint32_t page = missing[i];
+		resident[page] = 1;
+		pBindPages->push_back(page);
+
+		const uint32_t x = page % pagesPerLayer % pageCountX;
+		const uint32_t y = page % pagesPerLayer / pageCountX;
+		markDirty(page / pagesPerLayer, { x, y, x + 1, y + 1 });
+	}
+	residentCount += static_cast<uint32_t>(bindCount);
+}
+
+void VirtualShadowMap::invalidateLayer(uint32_t layer)
+{
+	markDirty(layer, { 0, 0, pageCountX, pageCountY });
+}
+
+void VirtualShadowMap::invalidateRect(uint32_t layer, float u0, float v0, float u1, float v1)
+{
+	// Pages are clamped to the layer, the rect may reach outside of it
+	auto toPage = [](float pages, uint32_t count)
+	{
+		return static_cast<uint32_t>(std::min(std::max(pages, 0.f), static_cast<float>(count)));
+	};
+	PageRect rect;
+	rect.x0 = toPage(std::floor(u0 * pageCountX), pageCountX);
+	rect.y0 = toPage(std::floor(v0 * pageCountY), pageCountY);
+	rect.x1 = toPage(std::ceil(u1 * pageCountX), pageCountX);
+	rect.y1 = toPage(std::ceil(v1 * pageCountY), pageCountY);
+	if (!rect.empty()) markDirty(layer, rect);
+}
+
+void VirtualShadowMap::markDirty(uint32_t layer, const PageRect &rect)
+{
+	assert(layer < dirtyRects.size());
+	PageRect &dirty = dirtyRects[layer];
+	const uint32_t layerFirstPage = layer * pageCountX * pageCountY;
+	for (uint32_t y = rect.y0; y < rect.y1; ++y)
+	{
+		for (uint32_t x = rect.x0; x < rect.x1; ++x)
+		{
+			if (!resident[layerFirstPage + y * pageCountX + x]) continue;
+
+			if (dirty.empty())
+			{
+				dirty = { x, y, x + 1, y + 1 };
+				continue;
+			}
+			dirty.x0 = std::min(dirty.x0, x);
+			dirty.y0 = std::min(dirty.y0, y);
+			dirty.x1 = std::max(dirty.x1, x + 1);
+			dirty.y1 = std::max(dirty.y1, y + 1);
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+// Page table of a virtual shadow map with one layer per cascade, each split into pages of which only a budget has memory.
+// The screen requests the pages it samples every frame. Requested pages become resident while the budget lasts, then the
+// ones requested longest ago make room, but never those requested in the last few frames, which frames in flight may still
+// sample. A resident page keeps its depth until it is invalidated, so a cascade only renders where pages are dirty
+class VirtualShadowMap
+{
+public:
+	// [x0, x1) x [y0, y1) in pages of a layer
+	struct PageRect
+	{
+		uint32_t x0 = 0;
+		uint32_t y0 = 0;
+		uint32_t x1 = 0;
+		uint32_t y1 = 0;
+
+		bool empty() const { return x0 >= x1 || y0 >= y1; }
+	};
+
+	// Pages are numbered (layer * pageCountY + y) * pageCountX + x, as by rj::VImage::bindSparsePage(). Pages requested in
+	// the last @keepFrames updates are never evicted
+	VirtualShadowMap(uint32_t pageCountX, uint32_t pageCountY, uint32_t layerCount, uint32_t pageBudget, uint32_t keepFrames);
+
+	// ORs one bit per page into the requests of the next update(), getRequestWordCount() words as the page mark pass writes them
+	void request(const uint32_t *pRequestBits);
+	// Make the requested pages resident as far as the budget allows, finer cascades first. Appends the pages to bind and to
+	// unbind, bound pages are dirty. @frame grows by one per call
+	void update(uint64_t frame, std::vector<uint32_t> *pBindPages, std::vector<uint32_t> *pUnbindPages);
+
+	// Dirty the resident pages of a layer, e.g. when its matrix changed, or those overlapping [u0, u1) x [v0, v1) of it
+	void invalidateLayer(uint32_t layer);
+	void invalidateRect(uint32_t layer, float u0, float v0, float u1, float v1);
+
+	// Bounds of the dirty pages of a layer, which may include clean ones. Everything is clean again after clearDirty()
+	const PageRect &getDirtyRect(uint32_t layer) const { return dirtyRects[layer]; }
+	void clearDirty(uint32_t layer) { dirtyRects[layer] = {}; }
+
+	uint32_t getPageCountX() const { return pageCountX; }
+	uint32_t getPageCountY() const { return pageCountY; }
+	uint32_t getRequestWordCount() const { return static_cast<uint32_t>(requestBits.size()); }
+	uint32_t getResidentCount() const { return residentCount; }
+
+protected:
+	uint32_t pageCountX;
+	uint32_t pageCountY;
+	uint32_t pageBudget;
+	uint32_t keepFrames;
+	uint32_t residentCount = 0;
+	std::vector<uint8_t> resident; // by page
+	std::vector<uint64_t> lastRequestFrames; // by page, 0 if never requested
+	std::vector<uint32_t> requestBits; // pending for the next update()
+	std::vector<PageRect> dirtyRects; // by layer
+	std::vector<uint32_t> missing; // scratch of update(), kept to not allocate per call
+	std::vector<uint32_t> evictable;
+
+	void markDirty(uint32_t layer, const PageRect &rect); // grows the dirty rect by the resident pages in @rect
+};
@@ -1,5 +1,14 @@
+#include <cerrno>
+#include <cstring>
+#include <utility>
 #include "vk_helpers.h"
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 
 namespace rj
 {
@@ -10,9 +19,57 @@ namespace rj
 			{ VK_FORMAT_R8G8B8A8_UNORM,{ 4,{ 1, 1, 1 } } },
 			{ VK_FORMAT_R32G32_SFLOAT,{ 8,{ 1, 1, 1 } } },
 			{ VK_FORMAT_R32G32B32A32_SFLOAT,{ 16,{ 1, 1, 1 } } },
+			{ VK_FORMAT_R16G16_SFLOAT,{ 4,{ 1, 1, 1 } } },
+			{ VK_FORMAT_R16G16B16A16_SFLOAT,{ 8,{ 1, 1, 1 } } },
 			{ VK_FORMAT_BC3_UNORM_BLOCK,{ 16,{ 4, 4, 1 } } },
 			{ VK_FORMAT_R8_UNORM,{ 1,{ 1, 1, 1 } } },
-			{ VK_FORMAT_R8G8B8_UNORM,{ 3,{ 1, 1, 1 } } }
+			{ VK_FORMAT_R8G8B8_UNORM,{ 3,{ 1, 1, 1 } } },
+			{ VK_FORMAT_R8G8B8A8_SRGB,{ 4,{ 1, 1, 1 } } },
+			{ VK_FORMAT_B10G11R11_UFLOAT_PACK32,{ 4,{ 1, 1, 1 } } },
+			{ VK_FORMAT_R16G16_UNORM,{ 4,{ 1, 1, 1 } } },
+			{ VK_FORMAT_BC1_RGB_UNORM_BLOCK,{ 8,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC1_RGB_SRGB_BLOCK,{ 8,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC1_RGBA_UNORM_BLOCK,{ 8,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC1_RGBA_SRGB_BLOCK,{ 8,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC2_UNORM_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC2_SRGB_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC3_SRGB_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC4_UNORM_BLOCK,{ 8,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC4_SNORM_BLOCK,{ 8,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC5_UNORM_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC5_SNORM_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC6H_UFLOAT_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC6H_SFLOAT_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC7_UNORM_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_BC7_SRGB_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_ASTC_4x4_UNORM_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_ASTC_4x4_SRGB_BLOCK,{ 16,{ 4, 4, 1 } } },
+			{ VK_FORMAT_ASTC_5x4_UNORM_BLOCK,{ 16,{ 5, 4, 1 } } },
+			{ VK_FORMAT_ASTC_5x4_SRGB_BLOCK,{ 16,{ 5, 4, 1 } } },
+			{ VK_FORMAT_ASTC_5x5_UNORM_BLOCK,{ 16,{ 5, 5, 1 } } },
+			{ VK_FORMAT_ASTC_5x5_SRGB_BLOCK,{ 16,{ 5, 5, 1 } } },
+			{ VK_FORMAT_ASTC_6x5_UNORM_BLOCK,{ 16,{ 6, 5, 1 } } },
+			{ VK_FORMAT_ASTC_6x5_SRGB_BLOCK,{ 16,{ 6, 5, 1 } } },
+			{ VK_FORMAT_ASTC_6x6_UNORM_BLOCK,{ 16,{ 6, 6, 1 } } },
+			{ VK_FORMAT_ASTC_6x6_SRGB_BLOCK,{ 16,{ 6, 6, 1 } } },
+			{ VK_FORMAT_ASTC_8x5_UNORM_BLOCK,{ 16,{ 8, 5, 1 } } },
+			{ VK_FORMAT_ASTC_8x5_SRGB_BLOCK,{ 16,{ 8, 5, 1 } } },
+			{ VK_FORMAT_ASTC_8x6_UNORM_BLOCK,{ 16,{ 8, 6, 1 } } },
+			{ VK_FORMAT_ASTC_8x6_SRGB_BLOCK,{ 16,{ 8, 6, 1 } } },
+			{ VK_FORMAT_ASTC_8x8_UNORM_BLOCK,{ 16,{ 8, 8, 1 } } },
+			{ VK_FORMAT_ASTC_8x8_SRGB_BLOCK,{ 16,{ 8, 8, 1 } } },
+			{ VK_FORMAT_ASTC_10x5_UNORM_BLOCK,{ 16,{ 10, 5, 1 } } },
+			{ VK_FORMAT_ASTC_10x5_SRGB_BLOCK,{ 16,{ 10, 5, 1 } } },
+			{ VK_FORMAT_ASTC_10x6_UNORM_BLOCK,{ 16,{ 10, 6, 1 } } },
+			{ VK_FORMAT_ASTC_10x6_SRGB_BLOCK,{ 16,{ 10, 6, 1 } } },
+			{ VK_FORMAT_ASTC_10x8_UNORM_BLOCK,{ 16,{ 10, 8, 1 } } },
+			{ VK_FORMAT_ASTC_10x8_SRGB_BLOCK,{ 16,{ 10, 8, 1 } } },
+			{ VK_FORMAT_ASTC_10x10_UNORM_BLOCK,{ 16,{ 10, 10, 1 } } },
+			{ VK_FORMAT_ASTC_10x10_SRGB_BLOCK,{ 16,{ 10, 10, 1 } } },
+			{ VK_FORMAT_ASTC_12x10_UNORM_BLOCK,{ 16,{ 12, 10, 1 } } },
+			{ VK_FORMAT_ASTC_12x10_SRGB_BLOCK,{ 16,{ 12, 10, 1 } } },
+			{ VK_FORMAT_ASTC_12x12_UNORM_BLOCK,{ 16,{ 12, 12, 1 } } },
+			{ VK_FORMAT_ASTC_12x12_SRGB_BLOCK,{ 16,{ 12, 12, 1 } } }
 		};
 
 		std::vector<char> readFile(const std::string& filename)
@@ -52,18 +109,23 @@ namespace rj
 			throw std::runtime_error("failed to find suitable memory type!");
 		}
 
+		bool isFormatSupported(VkPhysicalDevice physicalDevice, VkFormat format, VkImageTiling tiling, VkFormatFeatureFlags features)
+		{
+			VkFormatProperties props;
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+			if (tiling == VK_IMAGE_TILING_LINEAR)
+			{
+				return (props.linearTilingFeatures & features) == features;
+			}
+			return tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features;
+		}
+
 		VkFormat findSupportedFormat(VkPhysicalDevice physicalDevice, const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
 		{
 			for (VkFormat format : candidates)
 			{
-				VkFormatProperties props;
-				vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
-
-				if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features)
-				{
-					return format;
-				}
-				else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features)
+				if (isFormatSupported(physicalDevice, format, tiling, features))
 				{
 					return format;
 				}
@@ -72,6 +134,36 @@ namespace rj
 			throw std::runtime_error("failed to find supported format!");
 		}
 
+		static const std::pair<VkPresentModeKHR, const char *> g_presentModeNames[] =
+		{
+			{ VK_PRESENT_MODE_FIFO_KHR, "fifo" },
+			{ VK_PRESENT_MODE_FIFO_RELAXED_KHR, "fifo-relaxed" },
+			{ VK_PRESENT_MODE_MAILBOX_KHR, "mailbox" },
+			{ VK_PRESENT_MODE_IMMEDIATE_KHR, "immediate" }
+		};
+
+		const char *presentModeName(VkPresentModeKHR mode)
+		{
+			for (const auto &entry : g_presentModeNames)
+			{
+				if (entry.first == mode) return entry.second;
+			}
+			return "unknown";
+		}
+
+		bool parsePresentMode(const char *name, VkPresentModeKHR *pMode)
+		{
+			for (const auto &entry : g_presentModeNames)
+			{
+				if (strcmp(entry.second, name) == 0)
+				{
+					*pMode = entry.first;
+					return true;
+				}
+			}
+			return false;
+		}
+
 		size_t compute2DImageSizeInBytes(uint32_t width, uint32_t height, uint32_t pixelSizeInBytes, uint32_t mipLevelCount, uint32_t layerCount)
 		{
 			size_t size = 0;
@@ -86,6 +178,15 @@ namespace rj
 			return size * layerCount;
 		}
 
+		bool createDirectory(const std::string &dir)
+		{
+#ifdef _WIN32
+			return _mkdir(dir.c_str()) == 0 || errno == EEXIST;
+#else
+			return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+		}
+
 		void saveImage2D(
 			const std::string &fileName,
 			uint32_t width, uint32_t height, uint32_t bytesPerPixel,
@@ -137,7 +238,7 @@ namespace rj
 			createInfo.codeSize = code.size();
 			createInfo.pCode = (uint32_t*)code.data();
 
-			if (vkCreateShaderModule(device, &createInfo, nullptr, shaderModule.replace()) != VK_SUCCESS)
+			if (vkCreateShaderModule(device, &createInfo, helper_functions::getHostAllocationCallbacks(), shaderModule.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create shader module!");
 			}
@@ -163,7 +264,7 @@ namespace rj
 			viewInfo.subresourceRange.layerCount = layerCount;
 			viewInfo.flags = flags;
 
-			if (vkCreateImageView(device, &viewInfo, nullptr, imageView.replace()) != VK_SUCCESS)
+			if (vkCreateImageView(device, &viewInfo, helper_functions::getHostAllocationCallbacks(), imageView.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create texture image view!");
 			}
@@ -176,6 +277,32 @@ namespace rj
 			uint32_t width, uint32_t height, uint32_t depth, uint32_t mipLevels, uint32_t arrayLayers, VkImageCreateFlags flags,
 			VkSampleCountFlagBits sampleCount, VkImageLayout initialLayout,
 			VkSharingMode sharingMode, const std::vector<uint32_t> &queueFamilyIndices)
+		{
+			createImage(image, device, format, imageType, tiling, usage, width, height, depth, mipLevels, arrayLayers, flags,
+				sampleCount, initialLayout, sharingMode, queueFamilyIndices);
+
+			VkMemoryRequirements memRequirements;
+			vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+			VkMemoryAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			allocInfo.allocationSize = memRequirements.size;
+			allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
+
+			if (vkAllocateMemory(device, &allocInfo, helper_functions::getHostAllocationCallbacks(), imageMemory.replace()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate image memory!");
+			}
+
+			vkBindImageMemory(device, image, imageMemory, 0);
+		}
+
+		void createImage(
+			VDeleter<VkImage>& image, VkDevice device,
+			VkFormat format, VkImageType imageType, VkImageTiling tiling, VkImageUsageFlags usage,
+			uint32_t width, uint32_t height, uint32_t depth, uint32_t mipLevels, uint32_t arrayLayers, VkImageCreateFlags flags,
+			VkSampleCountFlagBits sampleCount, VkImageLayout initialLayout,
+			VkSharingMode sharingMode, const std::vector<uint32_t> &queueFamilyIndices)
 		{
 			VkImageCreateInfo imageInfo = {};
 			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -195,25 +322,10 @@ namespace rj
 			imageInfo.pQueueFamilyIndices = queueFamilyIndices.empty() ? nullptr : queueFamilyIndices.data();
 			imageInfo.flags = flags;
 
-			if (vkCreateImage(device, &imageInfo, nullptr, image.replace()) != VK_SUCCESS)
+			if (vkCreateImage(device, &imageInfo, helper_functions::getHostAllocationCallbacks(), image.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to create image!");
 			}
-
-			VkMemoryRequirements memRequirements;
-			vkGetImageMemoryRequirements(device, image, &memRequirements);
-
-			VkMemoryAllocateInfo allocInfo = {};
-			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-			allocInfo.allocationSize = memRequirements.size;
-			allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
-
-			if (vkAllocateMemory(device, &allocInfo, nullptr, imageMemory.replace()) != VK_SUCCESS)
-			{
-				throw std::runtime_error("failed to allocate image memory!");
-			}
-
-			vkBindImageMemory(device, image, imageMemory, 0);
 		}
 
 		void recordImageLayoutTransitionCommands(VkCommandBuffer commandBuffer,
@@ -298,6 +410,11 @@ namespace rj
 				barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
 				barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 			}
+			else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+			{
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			}
 			else
 			{
 				throw std::invalid_argument("unsupported layout transition!");
@@ -318,19 +435,7 @@ namespace rj
 			VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBufferCreateFlags flags,
 			VkSharingMode sharingMode, const std::vector<uint32_t> &queueFamilyIndices)
 		{
-			VkBufferCreateInfo bufferInfo = {};
-			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-			bufferInfo.size = size;
-			bufferInfo.usage = usage;
-			bufferInfo.sharingMode = sharingMode;
-			bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilyIndices.size());
-			bufferInfo.pQueueFamilyIndices = queueFamilyIndices.size() == 0 ? nullptr : queueFamilyIndices.data();
-			bufferInfo.flags = flags;
-
-			if (vkCreateBuffer(device, &bufferInfo, nullptr, buffer.replace()) != VK_SUCCESS)
-			{
-				throw std::runtime_error("failed to create buffer!");
-			}
+			createBuffer(buffer, device, size, usage, flags, sharingMode, queueFamilyIndices);
 
 			VkMemoryRequirements memRequirements;
 			vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
@@ -340,7 +445,7 @@ namespace rj
 			allocInfo.allocationSize = memRequirements.size;
 			allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
 
-			if (vkAllocateMemory(device, &allocInfo, nullptr, bufferMemory.replace()) != VK_SUCCESS)
+			if (vkAllocateMemory(device, &allocInfo, helper_functions::getHostAllocationCallbacks(), bufferMemory.replace()) != VK_SUCCESS)
 			{
 				throw std::runtime_error("failed to allocate buffer memory!");
 			}
@@ -348,6 +453,25 @@ namespace rj
 			vkBindBufferMemory(device, buffer, bufferMemory, 0);
 		}
 
+		void createBuffer(VDeleter<VkBuffer>& buffer, VkDevice device,
+			VkDeviceSize size, VkBufferUsageFlags usage, VkBufferCreateFlags flags,
+			VkSharingMode sharingMode, const std::vector<uint32_t> &queueFamilyIndices)
+		{
+			VkBufferCreateInfo bufferInfo = {};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = size;
+			bufferInfo.usage = usage;
+			bufferInfo.sharingMode = sharingMode;
+			bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilyIndices.size());
+			bufferInfo.pQueueFamilyIndices = queueFamilyIndices.size() == 0 ? nullptr : queueFamilyIndices.data();
+			bufferInfo.flags = flags;
+
+			if (vkCreateBuffer(device, &bufferInfo, helper_functions::getHostAllocationCallbacks(), buffer.replace()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create buffer!");
+			}
+		}
+
 		SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface)
 		{
 			SwapChainSupportDetails details;
@@ -377,7 +501,8 @@ namespace rj
 
 		void recordCopyBufferToImageCommands(VkCommandBuffer commandBuffer,
 			VkBuffer srcBuffer, VkImage dstImage, VkFormat format, VkImageAspectFlags aspectMask,
-			uint32_t width, uint32_t height, uint32_t depth, uint32_t levelCount, uint32_t layerCount)
+			uint32_t width, uint32_t height, uint32_t depth, uint32_t levelCount, uint32_t layerCount,
+			VkDeviceSize srcOffset)
 		{
 			assert(width > 0 && height > 0 && depth > 0);
 			assert(depth == 1 || levelCount == 1 && layerCount == 1);
@@ -390,7 +515,7 @@ namespace rj
 
 			// Copy mip levels from staging buffer
 			std::vector<VkBufferImageCopy> bufferCopyRegions;
-			uint32_t offset = 0;
+			VkDeviceSize offset = srcOffset;
 
 			for (uint32_t layer = 0; layer < layerCount; layer++)
 			{
@@ -437,5 +562,65 @@ namespace rj
 			copyRegion.size = sizeInBytes;
 			vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 		}
+
+		void recordGenerateMipmapsCommands(VkCommandBuffer commandBuffer, VkImage image,
+			uint32_t width, uint32_t height, uint32_t levelCount, uint32_t layerCount)
+		{
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			barrier.subresourceRange.levelCount = 1;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = layerCount;
+
+			const VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+			int32_t srcWidth = static_cast<int32_t>(width);
+			int32_t srcHeight = static_cast<int32_t>(height);
+
+			// Each level is the blit source of the next one once it is written, then it is done
+			for (uint32_t level = 1; level < levelCount; ++level)
+			{
+				barrier.subresourceRange.baseMipLevel = level - 1;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+					0, nullptr, 0, nullptr, 1, &barrier);
+
+				const int32_t dstWidth = std::max(srcWidth / 2, 1);
+				const int32_t dstHeight = std::max(srcHeight / 2, 1);
+
+				VkImageBlit blit = {};
+				blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, layerCount };
+				blit.srcOffsets[1] = { srcWidth, srcHeight, 1 };
+				blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, layerCount };
+				blit.dstOffsets[1] = { dstWidth, dstHeight, 1 };
+				vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					1, &blit, VK_FILTER_LINEAR);
+
+				barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, shaderStages, 0,
+					0, nullptr, 0, nullptr, 1, &barrier);
+
+				srcWidth = dstWidth;
+				srcHeight = dstHeight;
+			}
+
+			// The last level is never read by a blit
+			barrier.subresourceRange.baseMipLevel = levelCount - 1;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, shaderStages, 0,
+				0, nullptr, 0, nullptr, 1, &barrier);
+		}
 	}
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <fstream>
 #include <unordered_map>
 #include <chrono>
+#include <algorithm>
 
 #include "gli/gli.hpp"
 #include "gli/convert.hpp"
@@ -34,6 +35,7 @@ namespace rj
 			uint32_t mipLevelCount = 1;
 			uint32_t layerCount = 1;
 			VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT;
+			bool isTransient = false; // attachment that is never read after its render pass, may be lazily allocated
 		};
 
 		struct BufferWrapper
@@ -43,13 +45,14 @@ namespace rj
 			VkDeviceSize size;
 		};
 
-		// A chunck of memory storing many uniforms
-		template<size_t maxSizeInBytes>
+		// A chunck of memory storing many uniforms. @initialSizeInBytes is the capacity until reserve() is called
+		template<size_t initialSizeInBytes>
 		class UniformBlob
 		{
 		public:
 			UniformBlob(VkDeviceSize alignmentInBytes = std::numeric_limits<VkDeviceSize>::max()) :
-				memory(new char[maxSizeInBytes]),
+				memory(new char[initialSizeInBytes]),
+				maxSizeInBytes(initialSizeInBytes),
 				minAlignment(alignmentInBytes)
 			{}
 
@@ -63,22 +66,74 @@ namespace rj
 				minAlignment = alignmentInBytes;
 			}
 
-			void *alloc(size_t size)
+			// Bytes taken by an allocation of @size, including the padding up to the next aligned offset
+			size_t alignedSize(size_t size) const
 			{
 				assert(minAlignment != std::numeric_limits<VkDeviceSize>::max());
 
+				size_t actualSize = (size / minAlignment) * minAlignment;
+				return actualSize < size ? (actualSize + minAlignment) : actualSize;
+			}
+
+			// Grow the capacity to @sizeInBytes. Allocations hand out pointers into the memory, so it can only move while there are none
+			void reserve(size_t sizeInBytes)
+			{
+				if (sizeInBytes <= maxSizeInBytes) return;
+				if (!allocations.empty()) throw std::runtime_error("UniformBlob::reserve - can't grow after the first allocation.");
+
+				delete[] memory;
+				memory = new char[sizeInBytes];
+				maxSizeInBytes = sizeInBytes;
+			}
+
+			void *alloc(size_t size)
+			{
 				if (size == 0) throw std::runtime_error("UniformBlob::alloc - size can't be zero.");
 
-				size_t actualSize = (size / minAlignment) * minAlignment;
-				actualSize = actualSize < size ? (actualSize + minAlignment) : actualSize;
+				const size_t actualSize = alignedSize(size);
 
 				if (nextStartingByte + actualSize > maxSizeInBytes) throw std::runtime_error("UniformBlob::alloc - out of memory.");
 
 				char *ret = &memory[nextStartingByte];
+				allocations.push_back({ nextStartingByte, actualSize, ++writeStamp });
 				nextStartingByte += actualSize;
 				return ret;
 			}
 
+			// Flag the allocation containing @ptr as written so the next upload picks it up
+			void markDirty(const void *ptr)
+			{
+				size_t offset = offsetOf(static_cast<const char *>(ptr));
+				auto it = std::upper_bound(allocations.begin(), allocations.end(), offset,
+					[](size_t o, const Allocation &a) { return o < a.offset; });
+				assert(it != allocations.begin());
+				(--it)->stamp = ++writeStamp;
+			}
+
+			// Stamp of the latest write. Pass it to forEachDirtyRange next time to get only newer writes.
+			uint64_t stamp() const
+			{
+				return writeStamp;
+			}
+
+			// Call @fn(offset, size) for every allocation written after @sinceStamp. Adjacent ranges are merged.
+			template<typename Fn>
+			void forEachDirtyRange(uint64_t sinceStamp, Fn fn) const
+			{
+				size_t begin = 0, end = 0;
+				for (const auto &a : allocations)
+				{
+					if (a.stamp <= sinceStamp) continue;
+					if (a.offset != end)
+					{
+						if (end > begin) fn(begin, end - begin);
+						begin = a.offset;
+					}
+					end = a.offset + a.size;
+				}
+				if (end > begin) fn(begin, end - begin);
+			}
+
 			size_t size() const
 			{
 				return currentSizeInBytes;
@@ -96,9 +151,19 @@ namespace rj
 			}
 
 		private:
+			struct Allocation
+			{
+				size_t offset;
+				size_t size;
+				uint64_t stamp;
+			};
+
 			char* memory;
+			size_t maxSizeInBytes;
 
 			VkDeviceSize minAlignment;
+			std::vector<Allocation> allocations;
+			uint64_t writeStamp = 0;
 			union
 			{
 				size_t nextStartingByte = 0;
@@ -150,6 +215,17 @@ namespace rj
 			seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
 		}
 
+		// FNV-1a of @size bytes, continuing from @hash to key one thing by several inputs
+		inline uint64_t hashFnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+		{
+			const unsigned char *bytes = static_cast<const unsigned char *>(data);
+			for (size_t i = 0; i < size; ++i)
+			{
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+			return hash;
+		}
+
 		inline std::string getFileExtension(const std::string &fn)
 		{
 			size_t pos = fn.find_last_of('.');
@@ -170,15 +246,37 @@ namespace rj
 			return ifs.good();
 		}
 
+		// False if @dir neither exists nor could be created. Its parent has to exist
+		bool createDirectory(const std::string &dir);
+
 		uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
+		bool isFormatSupported(VkPhysicalDevice physicalDevice, VkFormat format, VkImageTiling tiling, VkFormatFeatureFlags features);
+
 		VkFormat findSupportedFormat(VkPhysicalDevice physicalDevice, const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 
+		// "fifo", "fifo-relaxed", "mailbox" or "immediate", "unknown" for the other modes
+		const char *presentModeName(VkPresentModeKHR mode);
+		// Inverse of presentModeName(). Return false if @name is none of those
+		bool parsePresentMode(const char *name, VkPresentModeKHR *pMode);
+
 		inline bool hasStencilComponent(VkFormat format)
 		{
 			return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
 		}
 
+		// Element @index of the Halton sequence in @base. In [0, 1), index 0 is 0
+		inline float halton(uint32_t index, uint32_t base)
+		{
+			float f = 1.f, r = 0.f;
+			for (; index > 0; index /= base)
+			{
+				f /= base;
+				r += f * (index % base);
+			}
+			return r;
+		}
+
 		size_t compute2DImageSizeInBytes(uint32_t width, uint32_t height, uint32_t pixelSizeInBytes, uint32_t mipLevelCount, uint32_t layerCount);
 
 		// TODO: support compressed format
@@ -218,6 +316,14 @@ namespace rj
 			uint32_t width, uint32_t height, uint32_t depth = 1, uint32_t mipLevels = 1, uint32_t arrayLayers = 1, VkImageCreateFlags flags = 0,
 			VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT, VkImageLayout initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED,
 			VkSharingMode sharingMode = VK_SHARING_MODE_EXCLUSIVE, const std::vector<uint32_t> &queueFamilyIndices = {});
+
+		// Only creates the image object. Memory has to be bound by the caller.
+		void createImage(
+			VDeleter<VkImage>& image, VkDevice device,
+			VkFormat format, VkImageType imageType, VkImageTiling tiling, VkImageUsageFlags usage,
+			uint32_t width, uint32_t height, uint32_t depth = 1, uint32_t mipLevels = 1, uint32_t arrayLayers = 1, VkImageCreateFlags flags = 0,
+			VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT, VkImageLayout initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED,
+			VkSharingMode sharingMode = VK_SHARING_MODE_EXCLUSIVE, const std::vector<uint32_t> &queueFamilyIndices = {});
 		// --- Image creation ---
 
 		// --- Image layout transition ---
@@ -232,6 +338,11 @@ namespace rj
 			VkPhysicalDevice physicalDevice, VkDevice device,
 			VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBufferCreateFlags flags = 0,
 			VkSharingMode sharingMode = VK_SHARING_MODE_EXCLUSIVE, const std::vector<uint32_t> &queueFamilyIndices = {});
+
+		// Only creates the buffer object. Memory has to be bound by the caller.
+		void createBuffer(VDeleter<VkBuffer>& buffer, VkDevice device,
+			VkDeviceSize size, VkBufferUsageFlags usage, VkBufferCreateFlags flags = 0,
+			VkSharingMode sharingMode = VK_SHARING_MODE_EXCLUSIVE, const std::vector<uint32_t> &queueFamilyIndices = {});
 		// --- Buffer creation ---
 
 		// --- Swap chain support ---
@@ -251,11 +362,18 @@ namespace rj
 		// Copy layer by layer. Within each layer, copy level by level.
 		void recordCopyBufferToImageCommands(VkCommandBuffer commandBuffer,
 			VkBuffer srcBuffer, VkImage dstImage, VkFormat format, VkImageAspectFlags aspectMask,
-			uint32_t width, uint32_t height, uint32_t depth = 1, uint32_t levelCount = 1, uint32_t layerCount = 1);
+			uint32_t width, uint32_t height, uint32_t depth = 1, uint32_t levelCount = 1, uint32_t layerCount = 1,
+			VkDeviceSize srcOffset = 0);
 
 		void recordCopyBufferToBufferCommands(VkCommandBuffer commandBuffer,
 			VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize sizeInBytes,
 			VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+
+		// Fill levels 1 to @levelCount - 1 of every layer by halving the level above with a linear blit.
+		// All levels start in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL with level 0 written and end in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+		// Graphics queue only, and the format needs VK_FORMAT_FEATURE_BLIT_SRC_BIT, BLIT_DST_BIT and SAMPLED_IMAGE_FILTER_LINEAR_BIT
+		void recordGenerateMipmapsCommands(VkCommandBuffer commandBuffer, VkImage image,
+			uint32_t width, uint32_t height, uint32_t levelCount, uint32_t layerCount = 1);
 		// --- Data transfer ---
 	}
 }
\ No newline at end of file
@@ -1,4 +1,18 @@
+#include <cstring>
+#include <numeric>
+#include <queue>
 #include "vmesh.h"
+#include "startup_profile.h"
+#include "mapped_file.h"
+#include "asset_pack.h"
+#include "mesh_codec.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SH_PROJECTION_SSE 1
+#else
+#define SH_PROJECTION_SSE 0
+#endif
 
 
 namespace rj
@@ -11,7 +25,54 @@ namespace rj
 			{ gli::FORMAT_RGBA32_SFLOAT_PACK32, VK_FORMAT_R32G32B32A32_SFLOAT },
 			{ gli::FORMAT_RGBA_DXT5_UNORM_BLOCK16, VK_FORMAT_BC3_UNORM_BLOCK },
 			{ gli::FORMAT_RG32_SFLOAT_PACK32, VK_FORMAT_R32G32_SFLOAT },
-			{ gli::FORMAT_RGB8_UNORM_PACK8, VK_FORMAT_R8G8B8_UNORM }
+			{ gli::FORMAT_RGB8_UNORM_PACK8, VK_FORMAT_R8G8B8_UNORM },
+			{ gli::FORMAT_RGBA8_SRGB_PACK8, VK_FORMAT_R8G8B8A8_SRGB },
+			{ gli::FORMAT_RG11B10_UFLOAT_PACK32, VK_FORMAT_B10G11R11_UFLOAT_PACK32 },
+			{ gli::FORMAT_RG16_UNORM_PACK16, VK_FORMAT_R16G16_UNORM },
+			// Block compressed formats are uploaded as they are
+			{ gli::FORMAT_RGB_DXT1_UNORM_BLOCK8, VK_FORMAT_BC1_RGB_UNORM_BLOCK },
+			{ gli::FORMAT_RGB_DXT1_SRGB_BLOCK8, VK_FORMAT_BC1_RGB_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_DXT1_UNORM_BLOCK8, VK_FORMAT_BC1_RGBA_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_DXT1_SRGB_BLOCK8, VK_FORMAT_BC1_RGBA_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_DXT3_UNORM_BLOCK16, VK_FORMAT_BC2_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_DXT3_SRGB_BLOCK16, VK_FORMAT_BC2_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_DXT5_SRGB_BLOCK16, VK_FORMAT_BC3_SRGB_BLOCK },
+			{ gli::FORMAT_R_ATI1N_UNORM_BLOCK8, VK_FORMAT_BC4_UNORM_BLOCK },
+			{ gli::FORMAT_R_ATI1N_SNORM_BLOCK8, VK_FORMAT_BC4_SNORM_BLOCK },
+			{ gli::FORMAT_RG_ATI2N_UNORM_BLOCK16, VK_FORMAT_BC5_UNORM_BLOCK },
+			{ gli::FORMAT_RG_ATI2N_SNORM_BLOCK16, VK_FORMAT_BC5_SNORM_BLOCK },
+			{ gli::FORMAT_RGB_BP_UFLOAT_BLOCK16, VK_FORMAT_BC6H_UFLOAT_BLOCK },
+			{ gli::FORMAT_RGB_BP_SFLOAT_BLOCK16, VK_FORMAT_BC6H_SFLOAT_BLOCK },
+			{ gli::FORMAT_RGBA_BP_UNORM_BLOCK16, VK_FORMAT_BC7_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_BP_SRGB_BLOCK16, VK_FORMAT_BC7_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_4X4_UNORM_BLOCK16, VK_FORMAT_ASTC_4x4_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_4X4_SRGB_BLOCK16, VK_FORMAT_ASTC_4x4_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_5X4_UNORM_BLOCK16, VK_FORMAT_ASTC_5x4_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_5X4_SRGB_BLOCK16, VK_FORMAT_ASTC_5x4_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_5X5_UNORM_BLOCK16, VK_FORMAT_ASTC_5x5_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_5X5_SRGB_BLOCK16, VK_FORMAT_ASTC_5x5_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_6X5_UNORM_BLOCK16, VK_FORMAT_ASTC_6x5_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_6X5_SRGB_BLOCK16, VK_FORMAT_ASTC_6x5_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_6X6_UNORM_BLOCK16, VK_FORMAT_ASTC_6x6_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_6X6_SRGB_BLOCK16, VK_FORMAT_ASTC_6x6_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_8X5_UNORM_BLOCK16, VK_FORMAT_ASTC_8x5_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_8X5_SRGB_BLOCK16, VK_FORMAT_ASTC_8x5_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_8X6_UNORM_BLOCK16, VK_FORMAT_ASTC_8x6_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_8X6_SRGB_BLOCK16, VK_FORMAT_ASTC_8x6_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_8X8_UNORM_BLOCK16, VK_FORMAT_ASTC_8x8_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_8X8_SRGB_BLOCK16, VK_FORMAT_ASTC_8x8_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_10X5_UNORM_BLOCK16, VK_FORMAT_ASTC_10x5_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_10X5_SRGB_BLOCK16, VK_FORMAT_ASTC_10x5_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_10X6_UNORM_BLOCK16, VK_FORMAT_ASTC_10x6_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_10X6_SRGB_BLOCK16, VK_FORMAT_ASTC_10x6_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_10X8_UNORM_BLOCK16, VK_FORMAT_ASTC_10x8_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_10X8_SRGB_BLOCK16, VK_FORMAT_ASTC_10x8_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_10X10_UNORM_BLOCK16, VK_FORMAT_ASTC_10x10_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_10X10_SRGB_BLOCK16, VK_FORMAT_ASTC_10x10_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_12X10_UNORM_BLOCK16, VK_FORMAT_ASTC_12x10_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_12X10_SRGB_BLOCK16, VK_FORMAT_ASTC_12x10_SRGB_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_12X12_UNORM_BLOCK16, VK_FORMAT_ASTC_12x12_UNORM_BLOCK },
+			{ gli::FORMAT_RGBA_ASTC_12X12_SRGB_BLOCK16, VK_FORMAT_ASTC_12x12_SRGB_BLOCK }
 		};
 
 		gli::format chooseFormat(uint32_t componentType, uint32_t componentCount)
@@ -34,29 +95,397 @@ namespace rj
 			throw std::runtime_error("Not able to choose image format");
 		}
 
+		namespace
+		{
+			const uint32_t meshImportFlags =
+				aiProcess_FlipWindingOrder |
+				aiProcess_Triangulate |
+#if !MESH_KEEP_NODE_INSTANCES
+				aiProcess_PreTransformVertices |
+#endif
+				aiProcess_GenSmoothNormals;
+
+			// A cooked mesh file is this header followed by the vertices and the indices, as the geometry pool takes them or
+			// compressed, with MESH_MESHLETS the meshlets, their vertices and triangles, and the node instances. Bump the version
+			// whenever the import or the vertex layout changes
+			const uint32_t meshCacheVersion = 5;
+			const uint32_t vertexComponentCount = sizeof(Vertex) / sizeof(float);
+			static_assert(sizeof(Vertex) % sizeof(float) == 0, "compressed vertices are streams of floats");
+
+			struct MeshCacheHeader
+			{
+				char magic[4]; // "LEMC"
+				uint32_t version;
+				uint64_t sourceHash; // FNV-1a of the source file
+				uint32_t importFlags;
+				uint32_t optimized; // MESH_OPTIMIZE
+				uint32_t vertexStride; // also tells MESH_TANGENTS apart
+				uint32_t vertexCount;
+				uint32_t indexCount;
+				glm::vec3 minPos;
+				glm::vec3 maxPos;
+				uint32_t meshlets; // MESH_MESHLETS
+				uint32_t meshletCount;
+				uint32_t meshletVertexCount; // there is one meshlet triangle per triangle
+				uint32_t instanceCount; // MESH_KEEP_NODE_INSTANCES
+				uint32_t encodedVertexBytes; // with MESH_CACHE_COMPRESSION, 0 for raw vertices and indices
+				uint32_t encodedIndexBytes;
+			};
+
+			// Positions are quantized over the bounds, the other components, all within a few units, with a fixed step
+			void getVertexQuantization(const glm::vec3 &minPos, const glm::vec3 &maxPos, float *offsets, float *steps)
+			{
+				for (uint32_t c = 0; c < vertexComponentCount; ++c)
+				{
+					offsets[c] = 0.f;
+					steps[c] = MESH_CACHE_ATTRIBUTE_STEP;
+				}
+				const uint32_t first = offsetof(Vertex, pos) / sizeof(float);
+				for (uint32_t c = 0; c < 3; ++c)
+				{
+					const float extent = maxPos[c] - minPos[c];
+					offsets[first + c] = extent >= 0.f ? minPos[c] : 0.f;
+					steps[first + c] = extent > 0.f ? extent / float(1 << MESH_CACHE_POSITION_BITS) : 1.f;
+				}
+			}
+
+			// Every component of the vertices is its own stream, so the deltas only ever see one kind of value
+			bool decodeMeshCacheGeometry(const MeshCacheHeader &header, const uint8_t *data, std::vector<Vertex> &hostVerts,
+				std::vector<uint32_t> &hostIndices)
+			{
+				float offsets[vertexComponentCount], steps[vertexComponentCount];
+				getVertexQuantization(header.minPos, header.maxPos, offsets, steps);
+
+				std::vector<int32_t> scratch;
+				float *pFloats = reinterpret_cast<float *>(hostVerts.data());
+				size_t pos = 0;
+				for (uint32_t c = 0; c < vertexComponentCount; ++c)
+				{
+					const size_t bytes = decodeFloatStream(data + pos, header.encodedVertexBytes - pos, pFloats + c, header.vertexCount,
+						vertexComponentCount, offsets[c], steps[c], &scratch);
+					if (bytes == 0 && header.vertexCount > 0) return false;
+					pos += bytes;
+				}
+				if (pos != header.encodedVertexBytes) return false;
+
+				const size_t bytes = decodeIndexBuffer(data + pos, header.encodedIndexBytes, hostIndices.data(), header.indexCount);
+				return bytes == header.encodedIndexBytes || (bytes == 0 && header.indexCount == 0);
+			}
+
+			// False if the file is missing, truncated or was cooked from another source or with other settings.
+			// A null @pSourceHash skips the source check. Cooked instances without @pInstances to take them fail too
+			bool loadMeshCache(const std::string &cacheFileName, const uint64_t *pSourceHash,
+				std::vector<Vertex> &hostVerts, std::vector<uint32_t> &hostIndices, glm::vec3 *minPos, glm::vec3 *maxPos, MeshletData *pMeshlets,
+				std::vector<NodeInstance> *pInstances)
+			{
+				AssetFile file(cacheFileName);
+				if (!file.isOpen() || file.getSize() < sizeof(MeshCacheHeader)) return false;
+
+				MeshCacheHeader header;
+				memcpy(&header, file.getData(), sizeof(header));
+				if (memcmp(header.magic, "LEMC", 4) != 0 || header.version != meshCacheVersion || (pSourceHash && header.sourceHash != *pSourceHash) ||
+					header.importFlags != meshImportFlags || header.optimized != MESH_OPTIMIZE || header.vertexStride != sizeof(Vertex) ||
+					header.meshlets != MESH_MESHLETS || (header.instanceCount > 0 && !pInstances))
+				{
+					return false;
+				}
+
+				const bool compressed = header.encodedVertexBytes > 0 || header.encodedIndexBytes > 0;
+				const size_t vertexBytes = compressed ? header.encodedVertexBytes : size_t(header.vertexCount) * sizeof(Vertex);
+				const size_t indexBytes = compressed ? header.encodedIndexBytes : size_t(header.indexCount) * sizeof(uint32_t);
+				const size_t meshletBytes = size_t(header.meshletCount) * sizeof(Meshlet);
+				const size_t meshletVertexBytes = size_t(header.meshletVertexCount) * sizeof(uint32_t);
+				const size_t meshletTriangleBytes = header.meshlets ? size_t(header.indexCount / 3) * sizeof(uint32_t) : 0;
+				const size_t instanceBytes = size_t(header.instanceCount) * sizeof(NodeInstance);
+				if (file.getSize() != sizeof(header) + vertexBytes + indexBytes + meshletBytes + meshletVertexBytes + meshletTriangleBytes +
+					instanceBytes) return false;
+
+				const char *pData = file.getData() + sizeof(header);
+				hostVerts.resize(header.vertexCount);
+				hostIndices.resize(header.indexCount);
+				if (compressed)
+				{
+					if (!decodeMeshCacheGeometry(header, reinterpret_cast<const uint8_t *>(pData), hostVerts, hostIndices)) return false;
+				}
+				else
+				{
+					memcpy(hostVerts.data(), pData, vertexBytes);
+					memcpy(hostIndices.data(), pData + vertexBytes, indexBytes);
+				}
+				pData += vertexBytes + indexBytes;
+				if (pMeshlets && header.meshlets)
+				{
+					pMeshlets->meshlets.resize(header.meshletCount);
+					pMeshlets->vertices.resize(header.meshletVertexCount);
+					pMeshlets->triangles.resize(header.indexCount / 3);
+					memcpy(pMeshlets->meshlets.data(), pData, meshletBytes);
+					memcpy(pMeshlets->vertices.data(), pData + meshletBytes, meshletVertexBytes);
+					memcpy(pMeshlets->triangles.data(), pData + meshletBytes + meshletVertexBytes, meshletTriangleBytes);
+				}
+				pData += meshletBytes + meshletVertexBytes + meshletTriangleBytes;
+				if (pInstances)
+				{
+					pInstances->resize(header.instanceCount);
+					memcpy(pInstances->data(), pData, instanceBytes);
+				}
+				if (minPos) *minPos = header.minPos;
+				if (maxPos) *maxPos = header.maxPos;
+				return true;
+			}
+
+			// @meshlets is only written with MESH_MESHLETS
+			bool saveMeshCache(const std::string &cacheFileName, uint64_t sourceHash,
+				const std::vector<Vertex> &hostVerts, const std::vector<uint32_t> &hostIndices, const glm::vec3 &minPos, const glm::vec3 &maxPos,
+				const MeshletData &meshlets, const std::vector<NodeInstance> &instances)
+			{
+				MeshCacheHeader header = {};
+				memcpy(header.magic, "LEMC", 4);
+				header.version = meshCacheVersion;
+				header.sourceHash = sourceHash;
+				header.importFlags = meshImportFlags;
+				header.optimized = MESH_OPTIMIZE;
+				header.vertexStride = sizeof(Vertex);
+				header.vertexCount = static_cast<uint32_t>(hostVerts.size());
+				header.indexCount = static_cast<uint32_t>(hostIndices.size());
+				header.minPos = minPos;
+				header.maxPos = maxPos;
+				header.meshlets = MESH_MESHLETS;
+#if MESH_MESHLETS
+				header.meshletCount = static_cast<uint32_t>(meshlets.meshlets.size());
+				header.meshletVertexCount = static_cast<uint32_t>(meshlets.vertices.size());
+#endif
+				header.instanceCount = static_cast<uint32_t>(instances.size());
+
+#if MESH_CACHE_COMPRESSION
+				std::vector<uint8_t> encoded;
+				float offsets[vertexComponentCount], steps[vertexComponentCount];
+				getVertexQuantization(minPos, maxPos, offsets, steps);
+				const float *pFloats = reinterpret_cast<const float *>(hostVerts.data());
+				for (uint32_t c = 0; c < vertexComponentCount; ++c)
+				{
+					encodeFloatStream(pFloats + c, hostVerts.size(), vertexComponentCount, offsets[c], steps[c], &encoded);
+				}
+				header.encodedVertexBytes = static_cast<uint32_t>(encoded.size());
+				encodeIndexBuffer(hostIndices.data(), hostIndices.size(), &encoded);
+				header.encodedIndexBytes = static_cast<uint32_t>(encoded.size()) - header.encodedVertexBytes;
+#endif
+
+				std::ofstream file(cacheFileName, std::ios::binary | std::ios::trunc);
+				if (!file.is_open()) return false;
+				file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+#if MESH_CACHE_COMPRESSION
+				file.write(reinterpret_cast<const char *>(encoded.data()), encoded.size());
+#else
+				file.write(reinterpret_cast<const char *>(hostVerts.data()), hostVerts.size() * sizeof(Vertex));
+				file.write(reinterpret_cast<const char *>(hostIndices.data()), hostIndices.size() * sizeof(uint32_t));
+#endif
+#if MESH_MESHLETS
+				file.write(reinterpret_cast<const char *>(meshlets.meshlets.data()), meshlets.meshlets.size() * sizeof(Meshlet));
+				file.write(reinterpret_cast<const char *>(meshlets.vertices.data()), meshlets.vertices.size() * sizeof(uint32_t));
+				file.write(reinterpret_cast<const char *>(meshlets.triangles.data()), meshlets.triangles.size() * sizeof(uint32_t));
+#endif
+				file.write(reinterpret_cast<const char *>(instances.data()), instances.size() * sizeof(NodeInstance));
+				return file.good();
+			}
+
+			// A mesh of the imported scene and the node transform it is welded with
+			struct MeshPlacement
+			{
+				glm::mat4 transform;
+				uint32_t mesh;
+			};
+
+			// Node to model space of @node and all nodes below it that have meshes, parents first
+			void collectMeshNodes(const aiNode *node, const glm::mat4 &parentTransform, std::vector<std::pair<glm::mat4, const aiNode *>> &nodes)
+			{
+				// aiMatrix4x4 is row major
+				const aiMatrix4x4 &m = node->mTransformation;
+				const glm::mat4 transform = parentTransform * glm::mat4(
+					m.a1, m.b1, m.c1, m.d1,
+					m.a2, m.b2, m.c2, m.d2,
+					m.a3, m.b3, m.c3, m.d3,
+					m.a4, m.b4, m.c4, m.d4);
+				if (node->mNumMeshes > 0) nodes.emplace_back(transform, node);
+				for (uint32_t i = 0; i < node->mNumChildren; ++i)
+				{
+					collectMeshNodes(node->mChildren[i], transform, nodes);
+				}
+			}
+
+			// False if @transform is more than a rotation, a positive uniform scale and a translation
+			bool decomposeNodeInstance(const glm::mat4 &transform, NodeInstance *pInstance)
+			{
+				const glm::vec3 axes[3] = { glm::vec3(transform[0]), glm::vec3(transform[1]), glm::vec3(transform[2]) };
+				const float scale = glm::length(axes[0]);
+				const float tolerance = 1e-4f * scale;
+				if (scale <= 0.f || std::abs(glm::length(axes[1]) - scale) > tolerance || std::abs(glm::length(axes[2]) - scale) > tolerance ||
+					std::abs(glm::dot(axes[0], axes[1])) > tolerance * scale || std::abs(glm::dot(axes[1], axes[2])) > tolerance * scale ||
+					std::abs(glm::dot(axes[0], axes[2])) > tolerance * scale || glm::determinant(glm::mat3(transform)) <= 0.f)
+				{
+					return false;
+				}
+
+				pInstance->position = glm::vec3(transform[3]);
+				pInstance->rotation = glm::normalize(glm::quat_cast(glm::mat3(axes[0] / scale, axes[1] / scale, axes[2] / scale)));
+				pInstance->scale = scale;
+				return true;
+			}
+
+			// All meshes of @scene in model space. With MESH_KEEP_NODE_INSTANCES and @pInstances, the meshes of the first node only if
+			// every node has the same ones, with the other nodes as instances
+			std::vector<MeshPlacement> placeMeshes(const aiScene *scene, std::vector<NodeInstance> *pInstances)
+			{
+				std::vector<MeshPlacement> placements;
+#if MESH_KEEP_NODE_INSTANCES
+				std::vector<std::pair<glm::mat4, const aiNode *>> nodes;
+				collectMeshNodes(scene->mRootNode, glm::mat4(), nodes);
+
+				if (pInstances && nodes.size() > 1)
+				{
+					const aiNode *first = nodes[0].second;
+					const glm::mat4 invFirst = glm::inverse(nodes[0].first);
+					bool instanced = true;
+					for (size_t i = 1; i < nodes.size() && instanced; ++i)
+					{
+						const aiNode *node = nodes[i].second;
+						NodeInstance instance;
+						instanced = node->mNumMeshes == first->mNumMeshes &&
+							std::equal(node->mMeshes, node->mMeshes + node->mNumMeshes, first->mMeshes) &&
+							decomposeNodeInstance(nodes[i].first * invFirst, &instance);
+						pInstances->push_back(instance);
+					}
+
+					if (instanced)
+					{
+						for (uint32_t i = 0; i < first->mNumMeshes; ++i)
+						{
+							placements.push_back({ nodes[0].first, first->mMeshes[i] });
+						}
+						return placements;
+					}
+					pInstances->clear();
+				}
+
+				for (const auto &node : nodes)
+				{
+					for (uint32_t i = 0; i < node.second->mNumMeshes; ++i)
+					{
+						placements.push_back({ node.first, node.second->mMeshes[i] });
+					}
+				}
+#else
+				// Already flattened by aiProcess_PreTransformVertices
+				for (uint32_t i = 0; i < scene->mNumMeshes; ++i)
+				{
+					placements.push_back({ glm::mat4(), i });
+				}
+#endif
+				return placements;
+			}
+		}
+
+		VertexWelder::VertexWelder(size_t maxVertexCount)
+		{
+			// At most half full, so probe sequences stay short
+			size_t slotCount = 16;
+			while (slotCount < 2 * maxVertexCount) slotCount *= 2;
+			slots.assign(slotCount, std::numeric_limits<uint32_t>::max());
+			slotMask = slotCount - 1;
+		}
+
+		uint32_t VertexWelder::weld(const Vertex &vert, std::vector<Vertex> &verts)
+		{
+			for (size_t slot = hash(vert) & slotMask; ; slot = (slot + 1) & slotMask)
+			{
+				const uint32_t idx = slots[slot];
+				if (idx == std::numeric_limits<uint32_t>::max())
+				{
+					assert(verts.size() < slots.size() / 2 && "VertexWelder sized for fewer vertices");
+					slots[slot] = static_cast<uint32_t>(verts.size());
+					verts.push_back(vert);
+					return slots[slot];
+				}
+				if (verts[idx] == vert) return idx;
+			}
+		}
+
+		size_t VertexWelder::hash(const Vertex &vert)
+		{
+			// Bit patterns of the components, with -0 turned into +0 since they compare equal
+			const float components[8] = { vert.pos.x, vert.pos.y, vert.pos.z, vert.normal.x, vert.normal.y, vert.normal.z, vert.texCoord.x, vert.texCoord.y };
+			uint64_t h = 0;
+			for (float c : components)
+			{
+				c += 0.f;
+				uint32_t bits;
+				memcpy(&bits, &c, sizeof(bits));
+				h = (h ^ bits) * 0x9e3779b97f4a7c15ull;
+				h ^= h >> 29;
+			}
+			return static_cast<size_t>(h);
+		}
+
 		void loadMeshIntoHostBuffers(const std::string &modelFileName,
 			std::vector<Vertex> &hostVerts, std::vector<uint32_t> &hostIndices,
-			glm::vec3 *minPos, glm::vec3 *maxPos)
+			glm::vec3 *minPos, glm::vec3 *maxPos, bool useCache, MeshletData *pMeshlets, std::vector<NodeInstance> *pInstances,
+			const std::vector<char> *pSource)
 		{
+			STARTUP_PHASE("mesh " + modelFileName);
+
 			if (minPos) *minPos = glm::vec3(std::numeric_limits<float>::max());
 			if (maxPos) *maxPos = glm::vec3(-std::numeric_limits<float>::max());
 
-			Assimp::Importer meshImporter;
-			const aiScene *scene = nullptr;
+			// Cooked meshes are keyed by the contents of the source, so editing the model cooks it again
+			const std::string cacheFileName = modelFileName + MESH_CACHE_EXTENSION;
+			uint64_t sourceHash = 0;
+			if (useCache)
+			{
+				// Packed meshes were cooked from their sources by the run that wrote the pack, so the source is not read
+				if (AssetFile::existsInPack(cacheFileName) &&
+					loadMeshCache(cacheFileName, nullptr, hostVerts, hostIndices, minPos, maxPos, pMeshlets, pInstances)) return;
 
-			const uint32_t defaultFlags =
-				aiProcess_FlipWindingOrder |
-				aiProcess_Triangulate |
-				aiProcess_PreTransformVertices |
-				aiProcess_GenSmoothNormals;
+				if (pSource)
+				{
+					sourceHash = hashFnv1a(pSource->data(), pSource->size());
+				}
+				else
+				{
+					MappedFile source(modelFileName);
+					if (!source.isOpen())
+					{
+						throw std::runtime_error("cannot open " + modelFileName);
+					}
+					sourceHash = hashFnv1a(source.getData(), source.getSize());
+				}
+
+				if (loadMeshCache(cacheFileName, &sourceHash, hostVerts, hostIndices, minPos, maxPos, pMeshlets, pInstances)) return;
+			}
 
-			scene = meshImporter.ReadFile(modelFileName, defaultFlags);
+			Assimp::Importer meshImporter;
+			const aiScene *scene = meshImporter.ReadFile(modelFileName, meshImportFlags);
+			if (!scene)
+			{
+				throw std::runtime_error("cannot import " + modelFileName + ": " + meshImporter.GetErrorString());
+			}
 
-			std::unordered_map<Vertex, uint32_t> vert2IdxLut;
+			std::vector<NodeInstance> instances;
+			const std::vector<MeshPlacement> placements = placeMeshes(scene, pInstances ? &instances : nullptr);
 
-			for (uint32_t i = 0; i < scene->mNumMeshes; ++i)
+			// Every corner could be a vertex of its own
+			size_t cornerCount = 0;
+			for (const auto &placement : placements)
 			{
-				const aiMesh *mesh = scene->mMeshes[i];
+				cornerCount += 3 * size_t(scene->mMeshes[placement.mesh]->mNumFaces);
+			}
+			VertexWelder welder(hostVerts.size() + cornerCount);
+			hostIndices.reserve(hostIndices.size() + cornerCount);
+
+			for (const auto &placement : placements)
+			{
+				const aiMesh *mesh = scene->mMeshes[placement.mesh];
+				const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(placement.transform)));
+				// Mirroring nodes turn the triangles around
+				const bool flipWinding = glm::determinant(glm::mat3(placement.transform)) < 0.f;
 				const aiVector3D *vertices = mesh->mVertices;
 				const aiVector3D *normals = mesh->mNormals;
 				const aiVector3D *texCoords = mesh->mTextureCoords[0];
@@ -71,61 +500,1001 @@ namespace rj
 				{
 					const aiFace &face = faces[j];
 
-					if (face.mNumIndices != 3) continue;
+					if (face.mNumIndices != 3) continue;
+
+					for (uint32_t k = 0; k < face.mNumIndices; ++k)
+					{
+						uint32_t idx = face.mIndices[flipWinding && k > 0 ? 3 - k : k];
+						const aiVector3D &pos = vertices[idx];
+						const aiVector3D &nrm = normals[idx];
+						const aiVector3D &texCoord = texCoords[idx];
+
+						Vertex vert =
+						{
+							glm::vec3(placement.transform * glm::vec4(pos.x, pos.y, pos.z, 1.f)),
+							glm::normalize(normalMatrix * glm::vec3(nrm.x, nrm.y, nrm.z)),
+							glm::vec2(texCoord.x, 1.f - texCoord.y)
+						};
+
+						if (minPos) *minPos = glm::min(*minPos, vert.pos);
+						if (maxPos) *maxPos = glm::max(*maxPos, vert.pos);
+
+						hostIndices.emplace_back(welder.weld(vert, hostVerts));
+					}
+				}
+			}
+
+#if MESH_TANGENTS
+			generateTangents(hostVerts, hostIndices);
+#endif
+
+#if MESH_OPTIMIZE
+			optimizeMesh(hostVerts, hostIndices);
+#endif
+
+			// Built after the optimization, which reorders the triangles
+			MeshletData meshlets;
+#if MESH_MESHLETS
+			buildMeshlets(hostVerts, hostIndices, &meshlets);
+#endif
+
+			if (useCache)
+			{
+				glm::vec3 boundsMin(std::numeric_limits<float>::max()), boundsMax(-std::numeric_limits<float>::max());
+				for (const auto &vert : hostVerts)
+				{
+					boundsMin = glm::min(boundsMin, vert.pos);
+					boundsMax = glm::max(boundsMax, vert.pos);
+				}
+
+				// Only costs the next launch the import
+				if (!saveMeshCache(cacheFileName, sourceHash, hostVerts, hostIndices, boundsMin, boundsMax, meshlets, instances))
+				{
+					std::cerr << "Unable to save the cooked mesh " << cacheFileName << std::endl;
+				}
+				else
+				{
+					AssetFile::record(cacheFileName);
+				}
+			}
+
+			if (pMeshlets) *pMeshlets = std::move(meshlets);
+			if (pInstances) *pInstances = std::move(instances);
+		}
+
+		namespace
+		{
+			// Sum of the squared distances to a set of planes, as a symmetric 4x4 matrix
+			struct Quadric
+			{
+				double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0, b2 = 0.0, bc = 0.0, bd = 0.0, c2 = 0.0, cd = 0.0, d2 = 0.0;
+
+				// Plane n.p + d = 0 with a unit normal
+				void addPlane(const glm::dvec3 &n, double d)
+				{
+					a2 += n.x * n.x; ab += n.x * n.y; ac += n.x * n.z; ad += n.x * d;
+					b2 += n.y * n.y; bc += n.y * n.z; bd += n.y * d;
+					c2 += n.z * n.z; cd += n.z * d;
+					d2 += d * d;
+				}
+
+				Quadric &operator+=(const Quadric &q)
+				{
+					a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+					b2 += q.b2; bc += q.bc; bd += q.bd;
+					c2 += q.c2; cd += q.cd;
+					d2 += q.d2;
+					return *this;
+				}
+
+				double evaluate(const glm::dvec3 &p) const
+				{
+					return a2 * p.x * p.x + 2.0 * ab * p.x * p.y + 2.0 * ac * p.x * p.z + 2.0 * ad * p.x +
+						b2 * p.y * p.y + 2.0 * bc * p.y * p.z + 2.0 * bd * p.y +
+						c2 * p.z * p.z + 2.0 * cd * p.z + d2;
+				}
+			};
+
+			// Move vertex @from onto vertex @to. Stale once either vertex has changed since it was pushed
+			struct EdgeCollapse
+			{
+				double cost;
+				uint32_t from, to;
+				uint32_t fromStamp, toStamp;
+
+				bool operator>(const EdgeCollapse &other) const { return cost > other.cost; }
+			};
+		}
+
+		void simplifyMesh(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+			uint32_t targetIndexCount, float maxError, std::vector<uint32_t> &simplifiedIndices)
+		{
+			assert(indices.size() % 3 == 0);
+
+			const uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+			const uint32_t faceCount = static_cast<uint32_t>(indices.size() / 3);
+
+			std::vector<uint32_t> faces(indices);
+			std::vector<bool> faceAlive(faceCount, true);
+			std::vector<std::vector<uint32_t>> vertexFaces(vertexCount);
+			std::vector<Quadric> quadrics(vertexCount);
+			std::vector<bool> vertexAlive(vertexCount, true);
+			std::vector<bool> vertexLocked(vertexCount, false);
+			std::vector<uint32_t> stamps(vertexCount, 0);
+
+			auto position = [&vertices](uint32_t v) { return glm::dvec3(vertices[v].pos); };
+			auto edgeKey = [](uint32_t u, uint32_t v) { return (static_cast<uint64_t>(std::min(u, v)) << 32) | std::max(u, v); };
+
+			// Edges used by a single face lie on a border. Vertices are split along UV and normal seams, so seams are borders too
+			std::unordered_map<uint64_t, uint32_t> edgeFaceCounts;
+			for (uint32_t f = 0; f < faceCount; ++f)
+			{
+				const uint32_t *tri = &faces[3 * f];
+				glm::dvec3 n = glm::cross(position(tri[1]) - position(tri[0]), position(tri[2]) - position(tri[0]));
+				const double area2 = glm::length(n);
+				if (area2 > 0.0) n /= area2;
+				const double d = -glm::dot(n, position(tri[0]));
+
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					vertexFaces[tri[k]].push_back(f);
+					quadrics[tri[k]].addPlane(n, d);
+					++edgeFaceCounts[edgeKey(tri[k], tri[(k + 1) % 3])];
+				}
+			}
+
+			for (const auto &edge : edgeFaceCounts)
+			{
+				if (edge.second == 1)
+				{
+					vertexLocked[static_cast<uint32_t>(edge.first >> 32)] = true;
+					vertexLocked[static_cast<uint32_t>(edge.first)] = true;
+				}
+			}
+
+			std::priority_queue<EdgeCollapse, std::vector<EdgeCollapse>, std::greater<EdgeCollapse>> collapses;
+			auto pushCollapse = [&](uint32_t from, uint32_t to)
+			{
+				if (vertexLocked[from]) return;
+				Quadric q = quadrics[from];
+				q += quadrics[to];
+				collapses.push({ q.evaluate(position(to)), from, to, stamps[from], stamps[to] });
+			};
+
+			for (uint32_t f = 0; f < faceCount; ++f)
+			{
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					pushCollapse(faces[3 * f + k], faces[3 * f + (k + 1) % 3]);
+					pushCollapse(faces[3 * f + (k + 1) % 3], faces[3 * f + k]);
+				}
+			}
+
+			// Every plane of the merged quadric is then at most @maxError away from the new position
+			const double maxCost = static_cast<double>(maxError) * maxError;
+			uint32_t indexCount = faceCount * 3;
+
+			while (indexCount > targetIndexCount && !collapses.empty())
+			{
+				const EdgeCollapse c = collapses.top();
+				collapses.pop();
+
+				if (c.cost > maxCost) break;
+				if (!vertexAlive[c.from] || !vertexAlive[c.to] || stamps[c.from] != c.fromStamp || stamps[c.to] != c.toStamp) continue;
+
+				// Reject collapses that flip or squash one of the remaining faces around @from
+				const glm::dvec3 target = position(c.to);
+				bool valid = true;
+				for (uint32_t f : vertexFaces[c.from])
+				{
+					const uint32_t *tri = &faces[3 * f];
+					if (!faceAlive[f] || tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) continue;
+
+					glm::dvec3 p[3], q[3];
+					for (uint32_t k = 0; k < 3; ++k)
+					{
+						p[k] = position(tri[k]);
+						q[k] = tri[k] == c.from ? target : p[k];
+					}
+					const glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+					const glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+					const double beforeLength = glm::length(before);
+					const double afterLength = glm::length(after);
+					if (beforeLength == 0.0) continue;
+
+					if (afterLength == 0.0 || glm::dot(before, after) < 0.2 * beforeLength * afterLength)
+					{
+						valid = false;
+						break;
+					}
+				}
+				if (!valid) continue;
+
+				// Faces sharing the edge disappear, the others move over to @to
+				for (uint32_t f : vertexFaces[c.from])
+				{
+					if (!faceAlive[f]) continue;
+					uint32_t *tri = &faces[3 * f];
+					if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+					{
+						faceAlive[f] = false;
+						indexCount -= 3;
+						continue;
+					}
+
+					for (uint32_t k = 0; k < 3; ++k)
+					{
+						if (tri[k] == c.from) tri[k] = c.to;
+					}
+					vertexFaces[c.to].push_back(f);
+				}
+
+				vertexAlive[c.from] = false;
+				quadrics[c.to] += quadrics[c.from];
+				++stamps[c.to];
+
+				// Only collapses touching @to have changed cost
+				for (uint32_t f : vertexFaces[c.to])
+				{
+					if (!faceAlive[f]) continue;
+					for (uint32_t k = 0; k < 3; ++k)
+					{
+						const uint32_t n = faces[3 * f + k];
+						if (n == c.to) continue;
+						pushCollapse(c.to, n);
+						pushCollapse(n, c.to);
+					}
+				}
+			}
+
+			simplifiedIndices.clear();
+			simplifiedIndices.reserve(indexCount);
+			for (uint32_t f = 0; f < faceCount; ++f)
+			{
+				if (faceAlive[f]) simplifiedIndices.insert(simplifiedIndices.end(), &faces[3 * f], &faces[3 * f] + 3);
+			}
+		}
+
+		namespace
+		{
+			// Forsyth's scoring, "Linear-speed vertex cache optimisation"
+			const uint32_t forsythCacheSize = 32;
+
+			float forsythVertexScore(int32_t cachePos, uint32_t liveTriangleCount)
+			{
+				if (liveTriangleCount == 0) return -1.f;
+
+				float score = 0.f;
+				if (cachePos >= 0)
+				{
+					// The last triangle's vertices get a fixed score, so it isn't favoured to use them again right away
+					if (cachePos < 3) score = 0.75f;
+					else score = std::pow(1.f - float(cachePos - 3) / float(forsythCacheSize - 3), 1.5f);
+				}
+				// Finish off vertices with few triangles left, so they don't linger
+				return score + 2.f / std::sqrt(float(liveTriangleCount));
+			}
+
+			// Triangles, in order, that start a cluster. One starts wherever all three vertices miss a FIFO cache
+			std::vector<uint32_t> findClusterStarts(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+			{
+				std::vector<uint32_t> clusterStarts;
+				std::vector<uint32_t> cacheTimes(vertexCount, 0); // cacheTimes[v] > time - cacheSize if v is cached
+				uint32_t time = cacheSize + 1;
+
+				for (uint32_t t = 0; t < indices.size() / 3; ++t)
+				{
+					uint32_t misses = 0;
+					for (uint32_t k = 0; k < 3; ++k)
+					{
+						const uint32_t v = indices[3 * t + k];
+						if (time - cacheTimes[v] > cacheSize)
+						{
+							cacheTimes[v] = time++;
+							++misses;
+						}
+					}
+					if (t == 0 || misses == 3) clusterStarts.push_back(t);
+				}
+				return clusterStarts;
+			}
+		}
+
+		void optimizeVertexCache(std::vector<uint32_t> &indices, uint32_t vertexCount)
+		{
+			const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+			if (triangleCount == 0) return;
+
+			// Triangles of each vertex. The live ones, which have not been emitted yet, come first
+			std::vector<uint32_t> liveTriangleCounts(vertexCount, 0);
+			for (uint32_t idx : indices)
+			{
+				++liveTriangleCounts[idx];
+			}
+			std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+			for (uint32_t v = 0; v < vertexCount; ++v)
+			{
+				triangleOffsets[v + 1] = triangleOffsets[v] + liveTriangleCounts[v];
+			}
+			std::vector<uint32_t> vertexTriangles(indices.size());
+			{
+				std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+				for (uint32_t i = 0; i < indices.size(); ++i)
+				{
+					vertexTriangles[fill[indices[i]]++] = i / 3;
+				}
+			}
+
+			std::vector<int32_t> cachePositions(vertexCount, -1);
+			std::vector<float> vertexScores(vertexCount);
+			for (uint32_t v = 0; v < vertexCount; ++v)
+			{
+				vertexScores[v] = forsythVertexScore(-1, liveTriangleCounts[v]);
+			}
+			std::vector<float> triangleScores(triangleCount);
+			for (uint32_t t = 0; t < triangleCount; ++t)
+			{
+				triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+			}
+
+			std::vector<bool> emitted(triangleCount, false);
+			std::vector<uint32_t> result;
+			result.reserve(indices.size());
+			std::vector<uint32_t> cache, newCache;
+			cache.reserve(forsythCacheSize + 3);
+			newCache.reserve(forsythCacheSize + 3);
+
+			uint32_t nextTriangle = static_cast<uint32_t>(std::max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin());
+			uint32_t deadEndCursor = 0; // triangles before it are all emitted
+			while (true)
+			{
+				const uint32_t *tri = &indices[3 * nextTriangle];
+				result.insert(result.end(), tri, tri + 3);
+				emitted[nextTriangle] = true;
+
+				// Move the triangle out of the live part of its vertices' lists
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					const uint32_t v = tri[k];
+					uint32_t *begin = &vertexTriangles[triangleOffsets[v]];
+					uint32_t *end = begin + liveTriangleCounts[v];
+					std::swap(*std::find(begin, end, nextTriangle), *(end - 1));
+					--liveTriangleCounts[v];
+				}
+
+				// Its vertices go to the front of the LRU cache
+				newCache.assign(tri, tri + 3);
+				for (uint32_t v : cache)
+				{
+					if (v != tri[0] && v != tri[1] && v != tri[2]) newCache.push_back(v);
+				}
+				for (size_t i = 0; i < newCache.size(); ++i)
+				{
+					cachePositions[newCache[i]] = i < forsythCacheSize ? static_cast<int32_t>(i) : -1;
+				}
+
+				// Rescore the vertices that are or just were in the cache, and their live triangles
+				uint32_t bestTriangle = std::numeric_limits<uint32_t>::max();
+				float bestScore = -1.f;
+				for (uint32_t v : newCache)
+				{
+					vertexScores[v] = forsythVertexScore(cachePositions[v], liveTriangleCounts[v]);
+				}
+				for (uint32_t v : newCache)
+				{
+					for (uint32_t i = 0; i < liveTriangleCounts[v]; ++i)
+					{
+						const uint32_t t = vertexTriangles[triangleOffsets[v] + i];
+						const float score = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+						triangleScores[t] = score;
+						if (score > bestScore)
+						{
+							bestScore = score;
+							bestTriangle = t;
+						}
+					}
+				}
+
+				if (newCache.size() > forsythCacheSize) newCache.resize(forsythCacheSize);
+				std::swap(cache, newCache);
+
+				if (bestTriangle == std::numeric_limits<uint32_t>::max())
+				{
+					// Nothing left around the cache, continue with the next triangle in the input
+					while (deadEndCursor < triangleCount && emitted[deadEndCursor]) ++deadEndCursor;
+					if (deadEndCursor == triangleCount) break;
+					bestTriangle = deadEndCursor;
+				}
+				nextTriangle = bestTriangle;
+			}
+
+			indices = std::move(result);
+		}
+
+		void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices)
+		{
+			const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+			if (triangleCount == 0) return;
+
+			// Clusters are cut where the vertex cache order restarts anyway, so reordering them costs few extra misses
+			std::vector<uint32_t> clusterStarts = findClusterStarts(indices, static_cast<uint32_t>(vertices.size()), 16);
+			clusterStarts.push_back(triangleCount);
+			const size_t clusterCount = clusterStarts.size() - 1;
+			if (clusterCount < 2) return;
+
+			glm::vec3 meshCenter(0.f);
+			for (const auto &vert : vertices)
+			{
+				meshCenter += vert.pos;
+			}
+			meshCenter /= float(vertices.size());
+
+			// Clusters facing away from the mesh center are likely in front of the rest from wherever they are seen, so they go first
+			std::vector<float> sortKeys(clusterCount);
+			for (size_t c = 0; c < clusterCount; ++c)
+			{
+				glm::vec3 center(0.f), normal(0.f);
+				float area = 0.f;
+				for (uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+				{
+					const glm::vec3 &p0 = vertices[indices[3 * t]].pos;
+					const glm::vec3 &p1 = vertices[indices[3 * t + 1]].pos;
+					const glm::vec3 &p2 = vertices[indices[3 * t + 2]].pos;
+					const glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+					const float triangleArea = glm::length(n);
+					center += (p0 + p1 + p2) * (triangleArea / 3.f);
+					normal += n;
+					area += triangleArea;
+				}
+				if (area > 0.f) center /= area;
+				const float normalLength = glm::length(normal);
+				sortKeys[c] = normalLength > 0.f ? glm::dot(center - meshCenter, normal / normalLength) : -std::numeric_limits<float>::max();
+			}
+
+			std::vector<uint32_t> clusterOrder(clusterCount);
+			for (uint32_t c = 0; c < clusterCount; ++c) clusterOrder[c] = c;
+			std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+			std::vector<uint32_t> result;
+			result.reserve(indices.size());
+			for (uint32_t c : clusterOrder)
+			{
+				result.insert(result.end(), indices.begin() + 3 * clusterStarts[c], indices.begin() + 3 * clusterStarts[c + 1]);
+			}
+			indices = std::move(result);
+		}
+
+		void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+		{
+			std::vector<uint32_t> remap(vertices.size(), std::numeric_limits<uint32_t>::max());
+			std::vector<Vertex> reordered;
+			reordered.reserve(vertices.size());
+
+			for (uint32_t &idx : indices)
+			{
+				if (remap[idx] == std::numeric_limits<uint32_t>::max())
+				{
+					remap[idx] = static_cast<uint32_t>(reordered.size());
+					reordered.push_back(vertices[idx]);
+				}
+				idx = remap[idx];
+			}
+
+			vertices = std::move(reordered);
+		}
+
+		void optimizeMesh(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+		{
+			STARTUP_PHASE("optimize mesh");
+
+			optimizeVertexCache(indices, static_cast<uint32_t>(vertices.size()));
+			optimizeOverdraw(indices, vertices);
+			optimizeVertexFetch(vertices, indices);
+		}
+
+#if MESH_TANGENTS
+		void generateTangents(std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+		{
+			STARTUP_PHASE("generate tangents");
+
+			std::vector<glm::vec3> tangents(vertices.size(), glm::vec3(0.f));
+			std::vector<glm::vec3> bitangents(vertices.size(), glm::vec3(0.f));
+			for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			{
+				const uint32_t idx[3] = { indices[i], indices[i + 1], indices[i + 2] };
+				const Vertex &v0 = vertices[idx[0]];
+				const glm::vec3 e1 = vertices[idx[1]].pos - v0.pos;
+				const glm::vec3 e2 = vertices[idx[2]].pos - v0.pos;
+				const glm::vec2 duv1 = vertices[idx[1]].texCoord - v0.texCoord;
+				const glm::vec2 duv2 = vertices[idx[2]].texCoord - v0.texCoord;
+
+				// Directions of growing u and v over the triangle. Only their directions matter, so the UV area is not divided out
+				const float uvArea = duv1.x * duv2.y - duv2.x * duv1.y;
+				if (std::abs(uvArea) < 1e-12f) continue;
+				const float flip = uvArea < 0.f ? -1.f : 1.f;
+				const glm::vec3 faceTangent = flip * (e1 * duv2.y - e2 * duv1.y);
+				const glm::vec3 faceBitangent = flip * (e2 * duv1.x - e1 * duv2.x);
+
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					const Vertex &v = vertices[idx[k]];
+					const glm::vec3 a = vertices[idx[(k + 1) % 3]].pos - v.pos;
+					const glm::vec3 b = vertices[idx[(k + 2) % 3]].pos - v.pos;
+					const float lengths = glm::length(a) * glm::length(b);
+					if (lengths <= 0.f) continue;
+					const float angle = std::acos(glm::clamp(glm::dot(a, b) / lengths, -1.f, 1.f));
+
+					// Projected onto the plane of the vertex normal first, as MikkTSpace does
+					const glm::vec3 t = faceTangent - v.normal * glm::dot(v.normal, faceTangent);
+					const glm::vec3 s = faceBitangent - v.normal * glm::dot(v.normal, faceBitangent);
+					const float tLength = glm::length(t);
+					const float sLength = glm::length(s);
+					if (tLength > 0.f) tangents[idx[k]] += angle / tLength * t;
+					if (sLength > 0.f) bitangents[idx[k]] += angle / sLength * s;
+				}
+			}
+
+			for (size_t i = 0; i < vertices.size(); ++i)
+			{
+				const glm::vec3 &n = vertices[i].normal;
+				glm::vec3 t = tangents[i] - n * glm::dot(n, tangents[i]);
+				if (glm::dot(t, t) < 1e-20f)
+				{
+					// Any direction in the normal plane
+					t = glm::cross(n, std::abs(n.x) < 0.9f ? glm::vec3(1.f, 0.f, 0.f) : glm::vec3(0.f, 1.f, 0.f));
+				}
+				t = glm::normalize(t);
+				const float sign = glm::dot(glm::cross(n, t), bitangents[i]) < 0.f ? -1.f : 1.f;
+				vertices[i].tangent = glm::vec4(t, sign);
+			}
+		}
+#endif
+
+		void buildMeshlets(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, MeshletData *pMeshlets)
+		{
+			STARTUP_PHASE("build meshlets");
+
+			pMeshlets->meshlets.clear();
+			pMeshlets->vertices.clear();
+			pMeshlets->triangles.clear();
+			pMeshlets->triangles.reserve(indices.size() / 3);
+
+			// Index of each vertex in the open meshlet, UINT32_MAX if it is not in there
+			std::vector<uint32_t> localIndices(vertices.size(), std::numeric_limits<uint32_t>::max());
+			Meshlet meshlet = {};
+
+			auto closeMeshlet = [&]()
+			{
+				const uint32_t *meshletVerts = &pMeshlets->vertices[meshlet.firstVertex];
+
+				// Sphere around the center of the bounds, close enough to the smallest one for a few dozen vertices
+				glm::vec3 minPos(std::numeric_limits<float>::max()), maxPos(-std::numeric_limits<float>::max());
+				for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+				{
+					minPos = glm::min(minPos, vertices[meshletVerts[i]].pos);
+					maxPos = glm::max(maxPos, vertices[meshletVerts[i]].pos);
+				}
+				const glm::vec3 center = 0.5f * (minPos + maxPos);
+				float radius = 0.f;
+				for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+				{
+					radius = std::max(radius, glm::length(vertices[meshletVerts[i]].pos - center));
+				}
+				meshlet.boundingSphere = glm::vec4(center, radius);
+
+				// Degenerate triangles have no normal and do not widen the cone
+				glm::vec3 normals[MESHLET_MAX_TRIANGLES];
+				uint32_t normalCount = 0;
+				glm::vec3 axis(0.f);
+				for (uint32_t t = meshlet.firstTriangle; t < meshlet.firstTriangle + meshlet.triangleCount; ++t)
+				{
+					const glm::vec3 &p0 = vertices[indices[3 * t]].pos;
+					const glm::vec3 n = glm::cross(vertices[indices[3 * t + 1]].pos - p0, vertices[indices[3 * t + 2]].pos - p0);
+					const float length = glm::length(n);
+					if (length <= 0.f) continue;
+					normals[normalCount] = n / length;
+					axis += normals[normalCount++];
+				}
+
+				meshlet.cone = glm::vec4(0.f, 0.f, 0.f, 1.f);
+				const float axisLength = glm::length(axis);
+				if (axisLength > 0.f)
+				{
+					axis /= axisLength;
+					float minDot = 1.f;
+					for (uint32_t i = 0; i < normalCount; ++i)
+					{
+						minDot = std::min(minDot, glm::dot(axis, normals[i]));
+					}
+					// Cones of more than about 84 degrees are left untested, they would hardly ever be culled
+					meshlet.cone = glm::vec4(axis, minDot <= 0.1f ? 1.f : std::sqrt(1.f - minDot * minDot));
+				}
+
+				pMeshlets->meshlets.push_back(meshlet);
+				for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+				{
+					localIndices[meshletVerts[i]] = std::numeric_limits<uint32_t>::max();
+				}
+
+				meshlet.firstTriangle += meshlet.triangleCount;
+				meshlet.triangleCount = 0;
+				meshlet.firstVertex = static_cast<uint32_t>(pMeshlets->vertices.size());
+				meshlet.vertexCount = 0;
+			};
+
+			const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+			for (uint32_t t = 0; t < triangleCount; ++t)
+			{
+				const uint32_t *tri = &indices[3 * t];
+				uint32_t newVertexCount = 0;
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					newVertexCount += localIndices[tri[k]] == std::numeric_limits<uint32_t>::max();
+				}
+				if (meshlet.vertexCount + newVertexCount > MESHLET_MAX_VERTICES || meshlet.triangleCount == MESHLET_MAX_TRIANGLES)
+				{
+					closeMeshlet();
+				}
+
+				uint32_t packed = 0;
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					uint32_t &local = localIndices[tri[k]];
+					if (local == std::numeric_limits<uint32_t>::max())
+					{
+						local = meshlet.vertexCount++;
+						pMeshlets->vertices.push_back(tri[k]);
+					}
+					packed |= local << (8 * k);
+				}
+				pMeshlets->triangles.push_back(packed);
+				++meshlet.triangleCount;
+			}
+
+			if (meshlet.triangleCount > 0)
+			{
+				closeMeshlet();
+			}
+		}
+
+		void splitIntoClusters(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+			std::vector<std::vector<uint32_t>> &clusters)
+		{
+			STARTUP_PHASE("split into clusters");
+
+			const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+			std::vector<glm::vec3> centroids(triangleCount);
+			std::vector<uint32_t> triangles(triangleCount);
+			for (uint32_t t = 0; t < triangleCount; ++t)
+			{
+				centroids[t] = (vertices[indices[3 * t]].pos + vertices[indices[3 * t + 1]].pos + vertices[indices[3 * t + 2]].pos) / 3.f;
+				triangles[t] = t;
+			}
+
+			auto getBounds = [&](uint32_t begin, uint32_t end)
+			{
+				BBox box;
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					for (uint32_t k = 0; k < 3; ++k)
+					{
+						box.min = glm::min(box.min, vertices[indices[3 * triangles[i] + k]].pos);
+						box.max = glm::max(box.max, vertices[indices[3 * triangles[i] + k]].pos);
+					}
+				}
+				return box;
+			};
+			const BBox whole = getBounds(0, triangleCount);
+			const float maxExtent = MESH_CLUSTER_MAX_EXTENT * glm::length(whole.max - whole.min);
+
+			// Ranges of @triangles still to split. Each split halves a range, so this ends after log2(triangleCount) levels
+			clusters.clear();
+			std::vector<std::pair<uint32_t, uint32_t>> ranges(1, std::make_pair(0u, triangleCount));
+			while (!ranges.empty())
+			{
+				const uint32_t begin = ranges.back().first, end = ranges.back().second;
+				ranges.pop_back();
+				const uint32_t count = end - begin;
+				if (count == 0) continue;
+
+				const BBox box = getBounds(begin, end);
+				const bool tooLarge = count > 2 * MESH_CLUSTER_MIN_TRIANGLES && glm::length(box.max - box.min) > maxExtent;
+				if (count > MESH_CLUSTER_MAX_TRIANGLES || tooLarge)
+				{
+					BBox centroidBox;
+					for (uint32_t i = begin; i < end; ++i)
+					{
+						centroidBox.min = glm::min(centroidBox.min, centroids[triangles[i]]);
+						centroidBox.max = glm::max(centroidBox.max, centroids[triangles[i]]);
+					}
+					const glm::vec3 extent = centroidBox.max - centroidBox.min;
+					const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+					const uint32_t mid = begin + count / 2;
+					std::nth_element(triangles.begin() + begin, triangles.begin() + mid, triangles.begin() + end,
+						[&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+					ranges.push_back(std::make_pair(begin, mid));
+					ranges.push_back(std::make_pair(mid, end));
+					continue;
+				}
+
+				std::sort(triangles.begin() + begin, triangles.begin() + end);
+				clusters.emplace_back();
+				auto &cluster = clusters.back();
+				cluster.reserve(3 * count);
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					cluster.insert(cluster.end(), &indices[3 * triangles[i]], &indices[3 * triangles[i]] + 3);
+				}
+			}
+		}
+
+		void quantizeVertices(const std::vector<Vertex> &vertices, const BBox &bounds, std::vector<QuantizedVertex> &quantized)
+		{
+			// Project onto the octahedron and fold its lower half over the upper one
+			auto packOctahedral = [](const glm::vec3 &dir, int16_t *pOct)
+			{
+				glm::vec3 n = dir / (std::abs(dir.x) + std::abs(dir.y) + std::abs(dir.z));
+				glm::vec2 oct(n.x, n.y);
+				if (n.z < 0.f)
+				{
+					oct = (1.f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+				}
+				pOct[0] = static_cast<int16_t>(glm::packSnorm1x16(oct.x));
+				pOct[1] = static_cast<int16_t>(glm::packSnorm1x16(oct.y));
+			};
+
+			// Flat axes, e.g. of a plane, would divide by zero
+			const glm::vec3 extent = bounds.max - bounds.min;
+			const glm::vec3 invExtent(extent.x > 0.f ? 1.f / extent.x : 0.f, extent.y > 0.f ? 1.f / extent.y : 0.f,
+				extent.z > 0.f ? 1.f / extent.z : 0.f);
+
+			quantized.resize(vertices.size());
+			for (size_t i = 0; i < vertices.size(); ++i)
+			{
+				const Vertex &vert = vertices[i];
+				QuantizedVertex &q = quantized[i];
+
+				const glm::vec3 p = (vert.pos - bounds.min) * invExtent;
+				q.pos[0] = glm::packUnorm1x16(p.x);
+				q.pos[1] = glm::packUnorm1x16(p.y);
+				q.pos[2] = glm::packUnorm1x16(p.z);
+				q.pos[3] = 0;
+
+				packOctahedral(vert.normal, q.normal);
+
+				q.texCoord[0] = glm::packHalf1x16(vert.texCoord.x);
+				q.texCoord[1] = glm::packHalf1x16(vert.texCoord.y);
+
+#if MESH_TANGENTS
+				packOctahedral(glm::vec3(vert.tangent), q.tangent);
+				q.pos[3] = vert.tangent.w < 0.f ? 0 : 0xffff;
+#endif
+			}
+		}
+
+		VkFormat getVkFormat(gli::format gliformat)
+		{
+			auto it = gliFormat2VkFormatTable.find(gliformat);
+			if (it == gliFormat2VkFormatTable.end())
+			{
+				throw std::runtime_error("texture format " + std::to_string(gliformat) + " is not supported.");
+			}
+			return it->second;
+		}
+
+		// Block compressed families are optional, e.g. desktop GPUs rarely have ASTC and mobile ones BC
+		void checkSampledFormatSupport(VManager *pManager, VkFormat format)
+		{
+			if (!pManager->isFormatSupported(format, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+			{
+				throw std::runtime_error("texture format " + std::to_string(format) + " cannot be sampled on this device, "
+					"compress it to a format the device has.");
+			}
+		}
+
+		void uploadTexture2D(ImageWrapper *pTexRet, VManager *pManager, gli::format gliformat, uint32_t width, uint32_t height,
+			uint32_t mipLevels, VkDeviceSize sizeInBytes, const VManager::StagingWriter &writeData, bool createSampler,
+			uint32_t gpuExpandedChannelCount = 0);
+
+		// Channels of the 8 bit formats that are expanded to RGBA8 without gli, 0 for the others
+		static uint32_t getRgba8ExpansionChannelCount(gli::format gliformat)
+		{
+			switch (gliformat)
+			{
+			case gli::FORMAT_R8_UNORM_PACK8:
+				return 1;
+			case gli::FORMAT_RG8_UNORM_PACK8:
+				return 2;
+			case gli::FORMAT_RGB8_UNORM_PACK8:
+				return 3;
+			default:
+				return 0;
+			}
+		}
+
+		// @texelCount texels of @channelCount 8 bit channels as RGBA8, missing channels 0 and alpha 1
+		static void expandTexelsToRgba8(void *pDst, const void *pSrc, size_t texelCount, uint32_t channelCount)
+		{
+			const uint8_t *src = static_cast<const uint8_t *>(pSrc);
+			uint8_t *dst = static_cast<uint8_t *>(pDst);
+			for (size_t i = 0; i < texelCount; ++i, src += channelCount, dst += 4)
+			{
+				dst[0] = src[0];
+				dst[1] = channelCount > 1 ? src[1] : 0;
+				dst[2] = channelCount > 2 ? src[2] : 0;
+				dst[3] = 255;
+			}
+		}
+
+		void loadTexture2DFromBinaryData(ImageWrapper *pTexRet, VManager *pManager, const void *pixels,
+			uint32_t width, uint32_t height, gli::format gliformat, uint32_t mipLevels, bool createSampler)
+		{
+			STARTUP_PHASE("texture " + std::to_string(width) + "x" + std::to_string(height));
+
+			// Packed 8 bit texels go to the staging memory as they are and are expanded by a compute pass. Where that is not
+			// available, or for a mip chain, they are expanded on their way into the staging memory. No copy either way
+			const uint32_t channelCount = getRgba8ExpansionChannelCount(gliformat);
+			if (channelCount > 0)
+			{
+				const size_t srcSize = compute2DImageSizeInBytes(width, height, channelCount, mipLevels, 1);
+				if (mipLevels == 1 && pManager->canExpandTexelsOnUpload(srcSize))
+				{
+					uploadTexture2D(pTexRet, pManager, gli::FORMAT_RGBA8_UNORM_PACK8, width, height, 1, srcSize,
+						[pixels, srcSize](void *pDst) { memcpy(pDst, pixels, srcSize); }, createSampler, channelCount);
+				}
+				else
+				{
+					const size_t texelCount = srcSize / channelCount;
+					uploadTexture2D(pTexRet, pManager, gli::FORMAT_RGBA8_UNORM_PACK8, width, height, mipLevels, texelCount * 4,
+						[pixels, texelCount, channelCount](void *pDst) { expandTexelsToRgba8(pDst, pixels, texelCount, channelCount); },
+						createSampler);
+				}
+				return;
+			}
+
+			gli::texture2d textureSrc = wrapTexture2D(pixels, width, height, gliformat, mipLevels);
+
+			// gli cannot convert block compressed data, it is uploaded as it is
+			if (gliformat != gli::FORMAT_RGBA8_UNORM_PACK8 && !gli::is_compressed(gliformat))
+			{
+				textureSrc = gli::convert(textureSrc, gli::FORMAT_RGBA8_UNORM_PACK8);
+			}
+
+			uploadTexture2D(pTexRet, pManager, textureSrc, createSampler);
+		}
+
+		gli::texture2d wrapTexture2D(const void *pixels, uint32_t width, uint32_t height, gli::format gliformat, uint32_t mipLevels)
+		{
+			const auto &formatInfo = g_formatInfoTable[getVkFormat(gliformat)];
+
+			gli::extent2d extent = { width, height };
+			gli::texture2d texture{ gliformat, extent, mipLevels };
+			size_t sizeInBytes = gli::is_compressed(gliformat) ? texture.size() :
+				compute2DImageSizeInBytes(width, height, formatInfo.blockSize, mipLevels, 1);
+			memcpy(texture.data(), pixels, sizeInBytes);
+			return texture;
+		}
+
+		gli::texture2d packOrmMap(const gli::texture2d &roughness, uint32_t roughnessChannel,
+			const gli::texture2d &metalness, uint32_t metalnessChannel, const gli::texture2d &ao)
+		{
+			STARTUP_PHASE("ORM map");
+
+			for (const auto *pSrc : { &roughness, &metalness, &ao })
+			{
+				if (pSrc->empty()) continue;
+				if (gli::is_compressed(pSrc->format()))
+				{
+					throw std::runtime_error("cannot pack block compressed maps into an ORM map, use uncompressed sources.");
+				}
+				if (pSrc->extent() != roughness.extent())
+				{
+					throw std::runtime_error("roughness, metalness and AO maps differ in size, cannot pack them into an ORM map.");
+				}
+			}
+
+			// Unpack every source to RGBA8 so each channel is one byte
+			auto toRgba8 = [](const gli::texture2d &src)
+			{
+				return src.format() == gli::FORMAT_RGBA8_UNORM_PACK8 ? src : gli::convert(src, gli::FORMAT_RGBA8_UNORM_PACK8);
+			};
+			const gli::texture2d r = toRgba8(roughness);
+			const gli::texture2d m = toRgba8(metalness);
+			const gli::texture2d o = ao.empty() ? gli::texture2d() : toRgba8(ao);
+
+			size_t levelCount = std::min(r.levels(), m.levels());
+			if (!o.empty()) levelCount = std::min(levelCount, o.levels());
+
+			gli::texture2d orm(gli::FORMAT_RGBA8_UNORM_PACK8, roughness.extent(), levelCount);
+			for (size_t level = 0; level < levelCount; ++level)
+			{
+				const uint8_t *pR = r.data<uint8_t>(0, 0, level);
+				const uint8_t *pM = m.data<uint8_t>(0, 0, level);
+				const uint8_t *pO = o.empty() ? nullptr : o.data<uint8_t>(0, 0, level);
+				uint8_t *pDst = orm.data<uint8_t>(0, 0, level);
+
+				const size_t texelCount = orm.size(level) / 4;
+				for (size_t i = 0; i < texelCount; ++i)
+				{
+					pDst[4 * i] = pO ? pO[4 * i] : 255;
+					pDst[4 * i + 1] = pR[4 * i + roughnessChannel];
+					pDst[4 * i + 2] = pM[4 * i + metalnessChannel];
+					pDst[4 * i + 3] = 255;
+				}
+			}
+
+			return orm;
+		}
+
+		gli::texture2d decodeTexture2D(const std::string &fn)
+		{
+			STARTUP_PHASE("texture " + fn);
+
+			std::string ext = getFileExtension(fn);
+			if (ext != "ktx" && ext != "dds")
+			{
+				throw std::runtime_error("texture type ." + ext + " is not supported.");
+			}
+
+			AssetFile file(fn);
+			if (!file.isOpen())
+			{
+				throw std::runtime_error("cannot open " + fn);
+			}
+			gli::texture2d textureSrc(gli::load(file.getData(), file.getSize()));
+
+			if (textureSrc.empty())
+			{
+				throw std::runtime_error("cannot load texture.");
+			}
+
+			return textureSrc;
+		}
 
-					for (uint32_t k = 0; k < face.mNumIndices; ++k)
-					{
-						uint32_t idx = face.mIndices[k];
-						const aiVector3D &pos = vertices[idx];
-						const aiVector3D &nrm = normals[idx];
-						const aiVector3D &texCoord = texCoords[idx];
+		gli::texture2d decodeTexture2D(const std::string &fn, const std::vector<char> &data)
+		{
+			STARTUP_PHASE("texture " + fn);
 
-						Vertex vert =
-						{
-							glm::vec3(pos.x, pos.y, pos.z),
-							glm::vec3(nrm.x, nrm.y, nrm.z),
-							glm::vec2(texCoord.x, 1.f - texCoord.y)
-						};
+			std::string ext = getFileExtension(fn);
+			if (ext != "ktx" && ext != "dds")
+			{
+				throw std::runtime_error("texture type ." + ext + " is not supported.");
+			}
 
-						if (minPos) *minPos = glm::min(*minPos, vert.pos);
-						if (maxPos) *maxPos = glm::max(*maxPos, vert.pos);
+			gli::texture2d textureSrc(gli::load(data.data(), data.size()));
 
-						const auto searchResult = vert2IdxLut.find(vert);
-						if (searchResult == vert2IdxLut.end())
-						{
-							uint32_t newIdx = static_cast<uint32_t>(hostVerts.size());
-							vert2IdxLut[vert] = newIdx;
-							hostIndices.emplace_back(newIdx);
-							hostVerts.emplace_back(vert);
-						}
-						else
-						{
-							hostIndices.emplace_back(searchResult->second);
-						}
-					}
-				}
+			if (textureSrc.empty())
+			{
+				throw std::runtime_error("cannot load texture.");
 			}
+
+			return textureSrc;
 		}
 
-		void loadTexture2DFromBinaryData(ImageWrapper *pTexRet, VManager *pManager, const void *pixels,
-			uint32_t width, uint32_t height, gli::format gliformat, uint32_t mipLevels, bool createSampler)
+		// Create the texture and let @writeData fill the staging memory with its @mipLevels levels, @sizeInBytes in all. With
+		// @gpuExpandedChannelCount it writes the single level of an RGBA8 texture as 8 bit texels of that many channels instead,
+		// see VManager::uploadBatchAddWrittenTexelsExpandedToRgba8
+		void uploadTexture2D(ImageWrapper *pTexRet, VManager *pManager, gli::format gliformat, uint32_t width, uint32_t height,
+			uint32_t mipLevels, VkDeviceSize sizeInBytes, const VManager::StagingWriter &writeData, bool createSampler,
+			uint32_t gpuExpandedChannelCount)
 		{
-			VkFormat format = gliFormat2VkFormatTable[gliformat];
-			const auto &formatInfo = g_formatInfoTable[format];
-
-			gli::extent2d extent = { width, height };
-			gli::texture2d textureSrc{ gliformat, extent, mipLevels };
-			size_t sizeInBytes = compute2DImageSizeInBytes(width, height, formatInfo.blockSize, mipLevels, 1);
-			memcpy(textureSrc.data(), pixels, sizeInBytes);
+			VkFormat format = getVkFormat(gliformat);
+			checkSampledFormatSupport(pManager, format);
 
-			if (format != VK_FORMAT_R8G8B8A8_UNORM)
+			// Images without a mip chain, e.g. most glTF images, get a full one blitted on the GPU
+			VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			const bool generateMipmaps = TEXTURE_GENERATE_MIPMAPS && mipLevels == 1 && std::max(width, height) > 1 &&
+				pManager->canGenerateMipmaps(format);
+			if (generateMipmaps)
 			{
-				textureSrc = gli::convert(textureSrc, gli::FORMAT_RGBA8_UNORM_PACK8);
-				format = VK_FORMAT_R8G8B8A8_UNORM;
+				mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+				usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			}
+			if (gpuExpandedChannelCount > 0)
+			{
+				usage |= VK_IMAGE_USAGE_STORAGE_BIT;
 			}
-
-			mipLevels = static_cast<uint32_t>(textureSrc.levels());
-			sizeInBytes = textureSrc.size();
 
 			pTexRet->width = width;
 			pTexRet->height = height;
@@ -134,13 +1503,22 @@ namespace rj
 			pTexRet->mipLevelCount = mipLevels;
 			pTexRet->layerCount = 1;
 
-			pTexRet->image = pManager->createImage2D(width, height, format,
-				VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-				mipLevels);
+			pTexRet->image = pManager->createImage2D(width, height, format, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mipLevels);
 
-			pManager->transferHostDataToImage(pTexRet->image, sizeInBytes, textureSrc.data(),
-				VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			if (gpuExpandedChannelCount > 0)
+			{
+				pManager->transferWrittenTexelsExpandedToRgba8(pTexRet->image, gpuExpandedChannelCount, sizeInBytes, writeData,
+					VK_IMAGE_LAYOUT_PREINITIALIZED);
+			}
+			else if (generateMipmaps)
+			{
+				pManager->transferWrittenDataToImageAndGenerateMipmaps(pTexRet->image, sizeInBytes, writeData, VK_IMAGE_LAYOUT_PREINITIALIZED);
+			}
+			else
+			{
+				pManager->transferWrittenDataToImage(pTexRet->image, sizeInBytes, writeData,
+					VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			}
 
 			pTexRet->imageViews.push_back(pManager->createImageView2D(pTexRet->image, VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels));
 
@@ -153,55 +1531,161 @@ namespace rj
 			}
 		}
 
-		void loadTexture2D(ImageWrapper *pTexRet, VManager *pManager, const std::string &fn, bool createSampler)
+		void uploadTexture2D(ImageWrapper *pTexRet, VManager *pManager, const gli::texture2d &textureSrc, bool createSampler)
 		{
-			std::string ext = getFileExtension(fn);
-			if (ext != "ktx" && ext != "dds")
+			const void *data = textureSrc.data();
+			const size_t sizeInBytes = textureSrc.size();
+			uploadTexture2D(pTexRet, pManager, textureSrc.format(),
+				static_cast<uint32_t>(textureSrc.extent().x), static_cast<uint32_t>(textureSrc.extent().y),
+				static_cast<uint32_t>(textureSrc.levels()), sizeInBytes,
+				[data, sizeInBytes](void *pDst) { memcpy(pDst, data, sizeInBytes); }, createSampler);
+		}
+
+		// Levels are tightly packed in gli and Vulkan copy order, the same size formula as gli::texture::size(level)
+		static size_t computeLevelSize(gli::format format, uint32_t width, uint32_t height, uint32_t level)
+		{
+			const gli::extent3d blockExtent = gli::block_extent(format);
+			const size_t blockCountX = (std::max(width >> level, 1u) + blockExtent.x - 1) / blockExtent.x;
+			const size_t blockCountY = (std::max(height >> level, 1u) + blockExtent.y - 1) / blockExtent.y;
+			return blockCountX * blockCountY * gli::block_size(format);
+		}
+
+		bool readTextureFileLayout(const std::string &fn, TextureFileLayout *pLayout)
+		{
+			AssetFile file(fn);
+			if (!file.isOpen()) return false;
+
+			const char *data = file.getData();
+			const size_t fileSize = file.getSize();
+			TextureFileLayout layout;
+			layout.fileName = fn;
+			size_t offset = 0;
+
+			if (fileSize >= sizeof(gli::detail::FOURCC_DDS) + sizeof(gli::detail::dds_header) &&
+				memcmp(data, gli::detail::FOURCC_DDS, sizeof(gli::detail::FOURCC_DDS)) == 0)
 			{
-				throw std::runtime_error("texture type ." + ext + " is not supported.");
+				// Same format detection as gli::load_dds, except for the channel mask formats
+				gli::detail::dds_header header;
+				memcpy(&header, data + sizeof(gli::detail::FOURCC_DDS), sizeof(header));
+				offset = sizeof(gli::detail::FOURCC_DDS) + sizeof(header);
+				if (!(header.Format.flags & gli::dx::DDPF_FOURCC)) return false;
+
+				gli::dx dx;
+				gli::detail::dds_header10 header10;
+				if (header.Format.fourCC == gli::dx::D3DFMT_DX10 || header.Format.fourCC == gli::dx::D3DFMT_GLI1)
+				{
+					if (fileSize < offset + sizeof(header10)) return false;
+					memcpy(&header10, data + offset, sizeof(header10));
+					offset += sizeof(header10);
+					layout.format = dx.find(header.Format.fourCC, header10.Format);
+				}
+				else
+				{
+					layout.format = dx.find(gli::detail::remap_four_cc(header.Format.fourCC));
+				}
+				if (gli::detail::get_target(header, header10) != gli::TARGET_2D) return false;
+
+				layout.width = header.Width;
+				layout.height = header.Height;
+				const uint32_t levelCount = (header.Flags & gli::detail::DDSD_MIPMAPCOUNT) ? std::max(header.MipMapLevels, 1u) : 1;
+
+				// All levels of the single layer follow the header
+				for (uint32_t level = 0; level < levelCount && gli::is_valid(layout.format); ++level)
+				{
+					layout.levelOffsets.push_back(offset);
+					layout.levelSizes.push_back(computeLevelSize(layout.format, layout.width, layout.height, level));
+					offset += layout.levelSizes.back();
+				}
 			}
+			else if (fileSize >= sizeof(gli::detail::FOURCC_KTX10) + sizeof(gli::detail::ktx_header10) &&
+				memcmp(data, gli::detail::FOURCC_KTX10, sizeof(gli::detail::FOURCC_KTX10)) == 0)
+			{
+				gli::detail::ktx_header10 header;
+				memcpy(&header, data + sizeof(gli::detail::FOURCC_KTX10), sizeof(header));
+				if (header.Endianness != 0x04030201) return false; // written on a machine of the other endianness
+				if (gli::detail::get_target(header) != gli::TARGET_2D) return false;
 
-			gli::texture2d textureSrc(gli::load(fn.c_str()));
+				gli::gl gl(gli::gl::PROFILE_KTX);
+				layout.format = gl.find(static_cast<gli::gl::internal_format>(header.GLInternalFormat),
+					static_cast<gli::gl::external_format>(header.GLFormat), static_cast<gli::gl::type_format>(header.GLType));
+				layout.width = header.PixelWidth;
+				layout.height = header.PixelHeight;
+				const uint32_t levelCount = std::max(header.NumberOfMipmapLevels, 1u);
+				offset = sizeof(gli::detail::FOURCC_KTX10) + sizeof(header) + header.BytesOfKeyValueData;
 
-			if (textureSrc.empty())
+				// Every level starts with its size in bytes and is padded to 4 bytes
+				for (uint32_t level = 0; level < levelCount && gli::is_valid(layout.format); ++level)
+				{
+					offset += sizeof(uint32_t);
+					layout.levelOffsets.push_back(offset);
+					layout.levelSizes.push_back(computeLevelSize(layout.format, layout.width, layout.height, level));
+					offset += std::max(static_cast<size_t>(gli::block_size(layout.format)), (layout.levelSizes.back() + 3) / 4 * 4);
+				}
+			}
+			else
 			{
-				throw std::runtime_error("cannot load texture.");
+				return false;
 			}
 
-			VkFormat format = gliFormat2VkFormatTable.at(textureSrc.format());
-
-			uint32_t width = static_cast<uint32_t>(textureSrc.extent().x);
-			uint32_t height = static_cast<uint32_t>(textureSrc.extent().y);
-			uint32_t mipLevels = static_cast<uint32_t>(textureSrc.levels());
-			size_t sizeInBytes = textureSrc.size();
+			if (!gli::is_valid(layout.format) || layout.width == 0 || layout.height == 0) return false;
+			if (layout.levelOffsets.back() + layout.levelSizes.back() > fileSize)
+			{
+				throw std::runtime_error("texture " + fn + " is truncated.");
+			}
 
-			pTexRet->width = width;
-			pTexRet->height = height;
-			pTexRet->depth = 1;
-			pTexRet->format = format;
-			pTexRet->mipLevelCount = mipLevels;
-			pTexRet->layerCount = 1;
+			*pLayout = std::move(layout);
+			return true;
+		}
 
-			pTexRet->image = pManager->createImage2D(width, height, format,
-				VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-				mipLevels);
+		void uploadTexture2DFromFile(ImageWrapper *pTexRet, VManager *pManager, const TextureFileLayout &layout, bool createSampler)
+		{
+			STARTUP_PHASE("texture " + layout.fileName);
 
-			pManager->transferHostDataToImage(pTexRet->image, sizeInBytes, textureSrc.data(),
-				VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			// Pages of the file are read in as the copy into staging memory touches them
+			AssetFile file(layout.fileName);
+			if (!file.isOpen() || file.getSize() < layout.levelOffsets.back() + layout.levelSizes.back())
+			{
+				throw std::runtime_error("texture " + layout.fileName + " changed since its header was read.");
+			}
 
-			pTexRet->imageViews.push_back(pManager->createImageView2D(pTexRet->image, VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels));
+			// A single level is the level 0 of a generated mip chain, either way only the levels of the file are staged
+			const size_t sizeInBytes = std::accumulate(layout.levelSizes.begin(), layout.levelSizes.end(), size_t(0));
+			uploadTexture2D(pTexRet, pManager, layout.format, layout.width, layout.height, layout.levelCount(), sizeInBytes,
+				[&layout, &file](void *pDst)
+			{
+				char *pLevel = static_cast<char *>(pDst);
+				for (uint32_t level = 0; level < layout.levelCount(); ++level)
+				{
+					memcpy(pLevel, file.getData() + layout.levelOffsets[level], layout.levelSizes[level]);
+					pLevel += layout.levelSizes[level];
+				}
+			}, createSampler);
+		}
 
-			if (createSampler)
+		void loadTexture2D(ImageWrapper *pTexRet, VManager *pManager, const std::string &fn, bool createSampler)
+		{
+#if TEXTURE_UPLOAD_FROM_FILE
+			TextureFileLayout layout;
+			if (readTextureFileLayout(fn, &layout))
 			{
-				pTexRet->samplers.resize(1);
-				pTexRet->samplers[0] = pManager->createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR,
-					VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT,
-					0.f, float(mipLevels - 1), 0.f, VK_TRUE, 16.f);
+				uploadTexture2DFromFile(pTexRet, pManager, layout, createSampler);
+				pManager->setImageDebugName(pTexRet->image, fn);
+				return;
 			}
+#endif
+			uploadTexture2D(pTexRet, pManager, decodeTexture2D(fn), createSampler);
+			pManager->setImageDebugName(pTexRet->image, fn);
 		}
 
 		void loadCubemap(ImageWrapper *pTexRet, VManager *pManager, const std::string &fn, bool createSampler)
+		{
+			STARTUP_PHASE("cube map " + fn);
+
+			uploadCubemap(pTexRet, pManager, decodeCubemap(fn), createSampler);
+			pManager->setImageDebugName(pTexRet->image, fn);
+		}
+
+		gli::texture_cube decodeCubemap(const std::string &fn)
 		{
 			std::string ext = getFileExtension(fn);
 			if (ext != "ktx" && ext != "dds")
@@ -209,14 +1693,25 @@ namespace rj
 				throw std::runtime_error("texture type ." + ext + " is not supported.");
 			}
 
-			gli::texture_cube texCube(gli::load(fn.c_str()));
+			AssetFile file(fn);
+			if (!file.isOpen())
+			{
+				throw std::runtime_error("cannot open " + fn);
+			}
+			gli::texture_cube texCube(gli::load(file.getData(), file.getSize()));
 
 			if (texCube.empty())
 			{
 				throw std::runtime_error("cannot load texture.");
 			}
 
-			VkFormat format = gliFormat2VkFormatTable.at(texCube.format());
+			return texCube;
+		}
+
+		void uploadCubemap(ImageWrapper *pTexRet, VManager *pManager, const gli::texture_cube &texCube, bool createSampler)
+		{
+			VkFormat format = getVkFormat(texCube.format());
+			checkSampledFormatSupport(pManager, format);
 
 			uint32_t width = static_cast<uint32_t>(texCube.extent().x);
 			uint32_t height = static_cast<uint32_t>(texCube.extent().y);
@@ -251,63 +1746,485 @@ namespace rj
 
 BBox BBox::getTransformedAABB(const glm::mat4 & T) const
 {
-	glm::vec4 corners[8] =
-	{
-		glm::vec4(max.x, max.y, min.z, 1.f),
-		glm::vec4(min.x, max.y, min.z, 1.f),
-		glm::vec4(min.x, min.y, min.z, 1.f),
-		glm::vec4(max.x, min.y, min.z, 1.f),
-		glm::vec4(max.x, max.y, max.z, 1.f),
-		glm::vec4(min.x, max.y, max.z, 1.f),
-		glm::vec4(min.x, min.y, max.z, 1.f),
-		glm::vec4(max.x, min.y, max.z, 1.f)
-	};
-	
+	if (glm::any(glm::greaterThan(min, max))) return BBox();
+
+	// Arvo: transform the center, each world extent sums the local extents scaled by the absolute matrix row
+	const glm::vec3 center = glm::vec3(T * glm::vec4(0.5f * (min + max), 1.f));
+	const glm::vec3 extent = 0.5f * (max - min);
+	const glm::vec3 worldExtent = glm::abs(glm::vec3(T[0])) * extent.x + glm::abs(glm::vec3(T[1])) * extent.y +
+		glm::abs(glm::vec3(T[2])) * extent.z;
+
 	BBox result;
-	for (uint32_t i = 0; i < 8; ++i)
+	result.min = center - worldExtent;
+	result.max = center + worldExtent;
+	return result;
+}
+
+Frustum::Frustum(const glm::mat4 &VP)
+{
+	// Gribb-Hartmann plane extraction. Clip space depth is [0, 1]
+	auto row = [&VP](int i) { return glm::vec4(VP[0][i], VP[1][i], VP[2][i], VP[3][i]); };
+
+	planes[0] = row(3) + row(0);
+	planes[1] = row(3) - row(0);
+	planes[2] = row(3) + row(1);
+	planes[3] = row(3) - row(1);
+	planes[4] = row(2);
+	planes[5] = row(3) - row(2);
+}
+
+bool Frustum::intersects(const BBox &box, bool testNearPlane) const
+{
+	for (uint32_t i = 0; i < 6; ++i)
 	{
-		auto c = glm::vec3(T * corners[i]);
-		result.min = glm::min(result.min, c);
-		result.max = glm::max(result.max, c);
-	}
+		if (i == 4 && !testNearPlane) continue;
 
-	return result;
+		const glm::vec4 &plane = planes[i];
+
+		// Test the corner furthest along the plane normal
+		glm::vec3 p(
+			plane.x >= 0.f ? box.max.x : box.min.x,
+			plane.y >= 0.f ? box.max.y : box.min.y,
+			plane.z >= 0.f ? box.max.z : box.min.z);
+
+		if (glm::dot(glm::vec3(plane), p) + plane.w < 0.f) return false;
+	}
+	return true;
 }
 
 VMesh::VMesh(rj::VManager * pManager)
 	:
-	pVulkanManager(pManager),
-	scale(1.f)
+	pVulkanManager(pManager)
 {
 	albedoMap.image = std::numeric_limits<uint32_t>::max();
 	normalMap.image = std::numeric_limits<uint32_t>::max();
+#if MESH_PACK_ORM
+	ormMap.image = std::numeric_limits<uint32_t>::max();
+#else
 	roughnessMap.image = std::numeric_limits<uint32_t>::max();
 	metalnessMap.image = std::numeric_limits<uint32_t>::max();
 	aoMap.image = std::numeric_limits<uint32_t>::max();
+#endif
 	emissiveMap.image = std::numeric_limits<uint32_t>::max();
+	std::fill(std::begin(streamedMaps), std::end(streamedMaps), static_cast<uint32_t>(rj::VTextureStreamer::INVALID_HANDLE));
+	std::fill(std::begin(virtualMaps), std::end(virtualMaps), static_cast<uint32_t>(rj::VVirtualTextureCache::INVALID_HANDLE));
+}
+
+void VMesh::attachTransform(TransformSystem *pSystem)
+{
+	assert(!pTransforms);
+	pTransforms = pSystem;
+	transformHandle = pTransforms->add();
+	instanceHandles.assign(1, transformHandle);
 }
 
 void VMesh::setPosition(const glm::vec3 & newPos)
 {
-	worldPosition = newPos;
+	pTransforms->setPosition(transformHandle, newPos);
 }
 
 void VMesh::setRotation(const glm::quat & newRot)
 {
-	worldRotation = newRot;
+	pTransforms->setRotation(transformHandle, newRot);
 }
 
 void VMesh::setScale(float newScale)
 {
-	scale = newScale;
+	pTransforms->setScale(transformHandle, newScale);
+}
+
+void VMesh::addInstance(const glm::vec3 &pos, const glm::quat &rot, float scale)
+{
+	instanceHandles.push_back(pTransforms->add(transformHandle, pos, rot, scale));
+	uniformDataChanged = true;
+}
+
+void VMesh::addGeometry(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+{
+	BBox box;
+	for (const auto &vert : vertices)
+	{
+		box.min = glm::min(box.min, vert.pos);
+		box.max = glm::max(box.max, vert.pos);
+	}
+
+	std::vector<char> positions, attributes;
+	std::vector<VkVertexInputBindingDescription> bindingDescs;
+#if MESH_QUANTIZE_VERTICES
+	vertexFormat = VERTEX_FORMAT_QUANTIZED;
+#if MESH_MIXED_VERTEX_FORMATS
+	const glm::vec3 extent = box.max - box.min;
+	if (std::max(extent.x, std::max(extent.y, extent.z)) > MESH_QUANTIZE_MAX_STEP * 65535.f)
+	{
+		vertexFormat = VERTEX_FORMAT_FULL;
+	}
+#endif
+	if (vertexFormat == VERTEX_FORMAT_QUANTIZED)
+	{
+		// LODs are still simplified from the full precision vertices
+		std::vector<QuantizedVertex> quantized;
+		rj::helper_functions::quantizeVertices(vertices, box, quantized);
+		rj::helper_functions::splitVertexStreams(quantized, positions, attributes);
+		bindingDescs = QuantizedVertex::getBindingDescriptions();
+		quantizationBounds = box;
+		uniformDataChanged = true;
+	}
+	else
+#endif
+	{
+		rj::helper_functions::splitVertexStreams(vertices, positions, attributes);
+		bindingDescs = Vertex::getBindingDescriptions();
+	}
+
+	geometry = pVulkanManager->geometryPoolAddMesh(positions.data(), bindingDescs[0].stride, attributes.data(), bindingDescs[1].stride,
+		static_cast<uint32_t>(vertices.size()), indices.data(), static_cast<uint32_t>(indices.size()));
+	lods.assign(1, geometry);
+
+#if MESH_MESHLETS
+	// Cooked meshes come with theirs
+	if (meshlets.meshlets.empty())
+	{
+		rj::helper_functions::buildMeshlets(vertices, indices, &meshlets);
+	}
+#endif
+
+	// Each LOD is simplified from the previous one. It is selected at half the screen size, so it may have twice the error
+	std::vector<uint32_t> lodIndices = indices;
+	float maxError = MESH_LOD_MAX_ERROR * glm::length(box.max - box.min);
+	while (lods.size() < maxLodCount)
+	{
+		std::vector<uint32_t> simplified;
+		const uint32_t targetIndexCount = static_cast<uint32_t>(lodIndices.size() / 3 * MESH_LOD_REDUCTION) * 3;
+		rj::helper_functions::simplifyMesh(vertices, lodIndices, targetIndexCount, maxError, simplified);
+
+		// Stop once the mesh does not get noticeably simpler
+		if (simplified.empty() || simplified.size() * 10 > lodIndices.size() * 9) break;
+
+#if MESH_OPTIMIZE
+		// LODs share the vertices of the full mesh, so only their triangle order can be optimized
+		rj::helper_functions::optimizeVertexCache(simplified, static_cast<uint32_t>(vertices.size()));
+#endif
+
+		lods.push_back(pVulkanManager->geometryPoolAddIndices(geometry, simplified.data(), static_cast<uint32_t>(simplified.size())));
+		lodIndices = std::move(simplified);
+		maxError *= 2.f;
+	}
+}
+
+#if MESH_SPATIAL_CLUSTERS
+void VMesh::addClusteredGeometry(std::vector<VMesh> &meshes, size_t meshIdx, const std::vector<Vertex> &vertices,
+	const std::vector<uint32_t> &indices)
+{
+	std::vector<std::vector<uint32_t>> clusters;
+	rj::helper_functions::splitIntoClusters(vertices, indices, clusters);
+
+	// Copied before it has any geometry, so the copies only take over its textures and material
+	const VMesh base = meshes[meshIdx];
+
+	// Index of each vertex in the current cluster, UINT32_MAX if it is not in there
+	std::vector<uint32_t> remap(vertices.size(), std::numeric_limits<uint32_t>::max());
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		if (c > 0) meshes.push_back(base);
+		VMesh &mesh = c > 0 ? meshes.back() : meshes[meshIdx];
+
+		std::vector<uint32_t> &clusterIndices = clusters[c];
+		std::vector<Vertex> clusterVertices;
+		std::vector<uint32_t> usedVertices;
+		for (uint32_t &idx : clusterIndices)
+		{
+			if (remap[idx] == std::numeric_limits<uint32_t>::max())
+			{
+				remap[idx] = static_cast<uint32_t>(clusterVertices.size());
+				clusterVertices.push_back(vertices[idx]);
+				usedVertices.push_back(idx);
+			}
+			idx = remap[idx];
+		}
+		for (uint32_t v : usedVertices)
+		{
+			remap[v] = std::numeric_limits<uint32_t>::max();
+		}
+
+#if MESH_OPTIMIZE
+		rj::helper_functions::optimizeMesh(clusterVertices, clusterIndices);
+#endif
+
+		mesh.bounds = BBox();
+		for (const auto &vert : clusterVertices)
+		{
+			mesh.bounds.min = glm::min(mesh.bounds.min, vert.pos);
+			mesh.bounds.max = glm::max(mesh.bounds.max, vert.pos);
+		}
+		mesh.addGeometry(clusterVertices, clusterIndices);
+	}
+}
+#endif
+
+#if GLTF_DECODE_INTO_STAGING
+void VMesh::addGeometry(const rj::GLTFMesh &mesh, JobPool *pJobs)
+{
+	const uint32_t positionStride = offsetof(Vertex, normal);
+	const uint32_t attributeStride = sizeof(Vertex) - positionStride;
+
+	geometry = pVulkanManager->geometryPoolAddWrittenMesh(
+		positionStride, [&](void *pDst)
+		{
+			mesh.decodePositions(static_cast<char *>(pDst), positionStride, &bounds.min, &bounds.max, pJobs);
+		},
+		attributeStride, [&](void *pDst)
+		{
+			mesh.decodeNormals(static_cast<char *>(pDst) + offsetof(Vertex, normal) - positionStride, attributeStride, pJobs);
+			mesh.decodeTexCoords(static_cast<char *>(pDst) + offsetof(Vertex, texCoord) - positionStride, attributeStride, pJobs);
+		},
+		mesh.vertexCount, mesh.indexCount, [&](void *pDst, VkIndexType indexType)
+		{
+			if (indexType == VK_INDEX_TYPE_UINT16) mesh.decodeIndices(static_cast<uint16_t *>(pDst), pJobs);
+			else mesh.decodeIndices(static_cast<uint32_t *>(pDst), pJobs);
+		});
+	lods.assign(1, geometry);
+}
+#endif
+
+void VMesh::addAnimation(const rj::GLTFMesh &mesh, JobPool *pJobs)
+{
+	animation.skin = mesh.skin;
+	animation.node = mesh.node;
+	animation.vertexCount = mesh.vertexCount;
+	animation.morphTargetCount = mesh.morphTargetCount;
+
+	if (mesh.skin != Animator::INVALID_INDEX)
+	{
+		struct Influence
+		{
+			uint16_t joints[4];
+			glm::vec4 weights;
+		};
+		std::vector<Influence> influences(mesh.vertexCount);
+		char *data = reinterpret_cast<char *>(influences.data());
+		mesh.decodeJoints(data + offsetof(Influence, joints), sizeof(Influence), pJobs);
+		mesh.decodeWeights(data + offsetof(Influence, weights), sizeof(Influence), pJobs);
+
+		animation.skinVertices.resize(mesh.vertexCount);
+		for (uint32_t i = 0; i < mesh.vertexCount; ++i)
+		{
+			const Influence &influence = influences[i];
+			SkinVertex &v = animation.skinVertices[i];
+			v.joints = glm::uvec2(influence.joints[0] | influence.joints[1] << 16, influence.joints[2] | influence.joints[3] << 16);
+			v.weights = glm::uvec2(glm::packUnorm2x16(glm::vec2(influence.weights.x, influence.weights.y)),
+				glm::packUnorm2x16(glm::vec2(influence.weights.z, influence.weights.w)));
+		}
+	}
+
+	animation.morphDeltas.resize(size_t(mesh.morphTargetCount) * mesh.vertexCount * 2);
+	for (uint32_t t = 0; t < mesh.morphTargetCount; ++t)
+	{
+		char *dst = reinterpret_cast<char *>(&animation.morphDeltas[size_t(t) * mesh.vertexCount * 2]);
+		mesh.decodeMorphTarget(t, dst, dst + sizeof(glm::vec4), 2 * sizeof(glm::vec4), pJobs);
+	}
+
+	// The skinning pass writes the animated vertices where the culling does not see them
+	const glm::vec3 center = 0.5f * (bounds.min + bounds.max);
+	const glm::vec3 halfExtent = 0.5f * MESH_ANIMATED_BOUNDS_SCALE * (bounds.max - bounds.min);
+	bounds.min = center - halfExtent;
+	bounds.max = center + halfExtent;
 }
 
 BBox VMesh::getAABBWorldSpace() const
 {
-	auto T = glm::mat4_cast(worldRotation);
-	T[0] *= scale;
-	T[1] *= scale;
-	T[2] *= scale;
-	T[3] = glm::vec4(worldPosition, 1.f);
-	return bounds.getTransformedAABB(T);
+	if (!isLoaded()) return BBox();
+
+	BBox box;
+	for (uint32_t handle : instanceHandles)
+	{
+		BBox instanceBox = bounds.getTransformedAABB(pTransforms->computeWorldMatrix(handle));
+		box.min = glm::min(box.min, instanceBox.min);
+		box.max = glm::max(box.max, instanceBox.max);
+	}
+	return box;
+}
+
+namespace
+{
+	// The direction of the texel at (u, v) in [-0.5, 0.5]^2 of a cube face is origin + u * uAxis + v * vAxis.
+	// DDS uses a left-handed system, so z is flipped
+	struct CubeFaceBasis
+	{
+		glm::vec3 origin;
+		glm::vec3 uAxis;
+		glm::vec3 vAxis;
+	};
+
+	const CubeFaceBasis g_cubeFaceBases[6] =
+	{
+		{ { 0.5f, 0.f, 0.f }, { 0.f, 0.f, -1.f }, { 0.f, 1.f, 0.f } }, // +x
+		{ { -0.5f, 0.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 1.f, 0.f } }, // -x
+		{ { 0.f, 0.5f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 0.f, -1.f } }, // +y
+		{ { 0.f, -0.5f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 0.f, 1.f } }, // -y
+		{ { 0.f, 0.f, 0.5f }, { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f } }, // +z
+		{ { 0.f, 0.f, -0.5f }, { -1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f } } // -z
+	};
+
+	// Add the radiance @L from direction @dir, not normalized, weighted by @dwScale / |dir|^3 to the 9 SH @sums
+	void accumulateSHTexel(const glm::vec3 &dir, const glm::vec3 &L, float dwScale, glm::vec3 *sums)
+	{
+		const float dist2 = glm::dot(dir, dir);
+		const float invLen = 1.f / std::sqrt(dist2);
+		const glm::vec3 wi = dir * invLen;
+		const glm::vec3 Ldw = L * (dwScale * invLen * invLen * invLen);
+
+		sums[0] += Ldw * 0.282095f; // l = m = 0
+		sums[1] += Ldw * (0.488603f * wi.y); // l = 1, m = -1
+		sums[2] += Ldw * (0.488603f * wi.z); // l = 1, m = 0
+		sums[3] += Ldw * (0.488603f * wi.x); // l = 1, m = 1
+		sums[4] += Ldw * (1.092548f * wi.x * wi.y); // l = 2, m = -2
+		sums[5] += Ldw * (1.092548f * wi.y * wi.z); // l = 2, m = -1
+		sums[6] += Ldw * (0.315392f * (3.f * wi.z * wi.z - 1.f)); // l = 2, m = 0
+		sums[7] += Ldw * (1.092548f * wi.x * wi.z); // l = 2, m = 1
+		sums[8] += Ldw * (0.546274f * (wi.x * wi.x - wi.y * wi.y)); // l = 2, m = 2
+	}
+
+	// Project rows [@beginRow, @endRow) of face @faceIdx onto the 9 SH basis functions and add them to @sums
+	void projectCubeRowsOntoSH(const glm::vec4 *rgba, uint32_t faceIdx, uint32_t width, uint32_t height,
+		uint32_t beginRow, uint32_t endRow, glm::vec3 *sums)
+	{
+		const CubeFaceBasis &face = g_cubeFaceBases[faceIdx];
+		const float invWidth = 1.f / float(width);
+		const float invHeight = 1.f / float(height);
+		// The differential solid angle of a texel is its area times cos(theta) / |dir|^2, and cos(theta) = 0.5 / |dir|
+		const float dwScale = 0.5f * invWidth * invHeight;
+
+		for (uint32_t py = beginRow; py < endRow; ++py)
+		{
+			const float v = 0.5f - (float(py) + 0.5f) * invHeight;
+			const glm::vec3 rowOrigin = face.origin + v * face.vAxis;
+			const glm::vec4 *row = rgba + size_t(py) * width;
+			uint32_t px = 0;
+
+#if SH_PROJECTION_SSE
+			// Four texels of the row at a time, one per lane
+			__m128 acc[9][3];
+			for (auto &basis : acc)
+			{
+				for (auto &channel : basis) channel = _mm_setzero_ps();
+			}
+
+			const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+			const __m128 vInvWidth = _mm_set1_ps(invWidth);
+			const __m128 half = _mm_set1_ps(0.5f);
+			const __m128 one = _mm_set1_ps(1.f);
+			const __m128 three = _mm_set1_ps(3.f);
+			const __m128 vDwScale = _mm_set1_ps(dwScale);
+
+			for (; px + 4 <= width; px += 4)
+			{
+				const __m128 u = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps(float(px)), laneOffsets), vInvWidth), half);
+				const __m128 x = _mm_add_ps(_mm_set1_ps(rowOrigin.x), _mm_mul_ps(u, _mm_set1_ps(face.uAxis.x)));
+				const __m128 y = _mm_add_ps(_mm_set1_ps(rowOrigin.y), _mm_mul_ps(u, _mm_set1_ps(face.uAxis.y)));
+				const __m128 z = _mm_add_ps(_mm_set1_ps(rowOrigin.z), _mm_mul_ps(u, _mm_set1_ps(face.uAxis.z)));
+
+				const __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+				const __m128 invLen = _mm_div_ps(one, _mm_sqrt_ps(dist2));
+				const __m128 wx = _mm_mul_ps(x, invLen);
+				const __m128 wy = _mm_mul_ps(y, invLen);
+				const __m128 wz = _mm_mul_ps(z, invLen);
+				const __m128 dw = _mm_mul_ps(vDwScale, _mm_mul_ps(invLen, _mm_mul_ps(invLen, invLen)));
+
+				__m128 basis[9];
+				basis[0] = _mm_mul_ps(dw, _mm_set1_ps(0.282095f));
+				basis[1] = _mm_mul_ps(dw, _mm_mul_ps(_mm_set1_ps(0.488603f), wy));
+				basis[2] = _mm_mul_ps(dw, _mm_mul_ps(_mm_set1_ps(0.488603f), wz));
+				basis[3] = _mm_mul_ps(dw, _mm_mul_ps(_mm_set1_ps(0.488603f), wx));
+				basis[4] = _mm_mul_ps(dw, _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(wx, wy)));
+				basis[5] = _mm_mul_ps(dw, _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(wy, wz)));
+				basis[6] = _mm_mul_ps(dw, _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(wz, wz)), one)));
+				basis[7] = _mm_mul_ps(dw, _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(wx, wz)));
+				basis[8] = _mm_mul_ps(dw, _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(wx, wx), _mm_mul_ps(wy, wy))));
+
+				// Four RGBA texels to one register per channel
+				__m128 r = _mm_loadu_ps(&row[px][0]);
+				__m128 g = _mm_loadu_ps(&row[px + 1][0]);
+				__m128 b = _mm_loadu_ps(&row[px + 2][0]);
+				__m128 a = _mm_loadu_ps(&row[px + 3][0]);
+				_MM_TRANSPOSE4_PS(r, g, b, a);
+
+				for (uint32_t i = 0; i < 9; ++i)
+				{
+					acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(r, basis[i]));
+					acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(g, basis[i]));
+					acc[i][2] = _mm_add_ps(acc[i][2], _mm_mul_ps(b, basis[i]));
+				}
+			}
+
+			for (uint32_t i = 0; i < 9; ++i)
+			{
+				for (uint32_t c = 0; c < 3; ++c)
+				{
+					float lanes[4];
+					_mm_storeu_ps(lanes, acc[i][c]);
+					sums[i][c] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+				}
+			}
+#endif
+
+			for (; px < width; ++px)
+			{
+				const float u = (float(px) + 0.5f) * invWidth - 0.5f;
+				accumulateSHTexel(rowOrigin + u * face.uAxis, glm::vec3(row[px]), dwScale, sums);
+			}
+		}
+	}
+}
+
+void Skybox::computeSHCoefficients(const gli::texture_cube &rm, glm::vec3 *diffuseSHCoefficients, JobPool *pJobs)
+{
+	const uint32_t width = rm.extent().x;
+	const uint32_t height = rm.extent().y;
+
+	// Every block of rows has its own partial sums, added up in a fixed order so the result does not depend on the threads
+	struct Block
+	{
+		uint32_t faceIdx;
+		uint32_t beginRow;
+		uint32_t endRow;
+		glm::vec3 sums[9];
+	};
+	std::vector<Block> blocks;
+	for (uint32_t faceIdx = 0; faceIdx < 6; ++faceIdx)
+	{
+		for (uint32_t row = 0; row < height; row += SH_PROJECTION_ROWS_PER_JOB)
+		{
+			blocks.push_back({ faceIdx, row, std::min(row + SH_PROJECTION_ROWS_PER_JOB, height) });
+			std::fill(std::begin(blocks.back().sums), std::end(blocks.back().sums), glm::vec3(0.f));
+		}
+	}
+
+	auto project = [&rm, &blocks, width, height](size_t i)
+	{
+		Block &block = blocks[i];
+		projectCubeRowsOntoSH(reinterpret_cast<const glm::vec4 *>(rm.data(0, block.faceIdx, 0)), block.faceIdx, width, height,
+			block.beginRow, block.endRow, block.sums);
+	};
+
+	if (pJobs)
+	{
+		size_t beginJob = std::numeric_limits<size_t>::max();
+		size_t endJob = 0;
+		for (size_t i = 0; i < blocks.size(); ++i)
+		{
+			endJob = pJobs->add([&project, i]() { project(i); }) + 1;
+			beginJob = std::min(beginJob, endJob - 1);
+		}
+		pJobs->wait(beginJob, endJob);
+	}
+	else
+	{
+		for (size_t i = 0; i < blocks.size(); ++i) project(i);
+	}
+
+	std::fill(diffuseSHCoefficients, diffuseSHCoefficients + 9, glm::vec3(0.f));
+	for (const auto &block : blocks)
+	{
+		for (uint32_t i = 0; i < 9; ++i) diffuseSHCoefficients[i] += block.sums[i];
+	}
 }
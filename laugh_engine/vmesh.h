@@ -5,18 +5,79 @@
 #include "glm/glm.hpp"
 #include "glm/gtx/hash.hpp"
 #include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/packing.hpp"
+#include <cstring>
 
 #include "assimp/Importer.hpp"
 #include "assimp/scene.h"    
 #include "assimp/postprocess.h"
 #include "assimp/cimport.h"
 #include "VManager.h"
+#include "VTextureCache.h"
+#include "VTextureStreamer.h"
+#include "VVirtualTextureCache.h"
+#include "asset_pack.h"
+#include "async_file_reader.h"
+#include "transform_system.h"
+#include "animation.h"
 
 #include "tiny_gltf_loader.h"
 #include "gltf_loader.h"
 
 #define DIFF_IRRADIANCE_MAP_SIZE 32
 #define SPEC_IRRADIANCE_MAP_SIZE 512
+#define SH_PROJECTION_ROWS_PER_JOB 16 // rows of a cube face projected onto SH by one job
+#define TEXTURE_GENERATE_MIPMAPS 1 // 1 blits a full mip chain on the GPU for textures that come with a single level
+// 1 reads only the headers of plain 2D .dds and .ktx files when loading, their pixels are copied from a mapping of the file
+// straight into staging memory at upload. Other files are decoded into host memory by gli first
+#define TEXTURE_UPLOAD_FROM_FILE 1
+#define MESH_LOD_COUNT 4 // levels of the LOD chain, including the full resolution mesh
+#define MESH_LOD_REDUCTION 0.5f // target triangle ratio between consecutive LODs
+#define MESH_LOD_MAX_ERROR 0.005f // quadric error bound of LOD 1 as a fraction of the bounding box diagonal, doubles every LOD
+#define MESH_CACHE_EXTENSION ".cooked" // appended to the model file name for its cooked mesh
+// 1 compresses the vertices and indices of cooked meshes: vertex components are quantized, delta and zigzag coded along the
+// vertex order, indices coded against the next vertex not referenced yet, both packed into group varints the loader threads
+// decode with SIMD (see mesh_codec.h). Cooked meshes of either setting load
+#define MESH_CACHE_COMPRESSION 1
+#define MESH_CACHE_POSITION_BITS 20 // quantization of cooked positions over the bounds of their mesh
+#define MESH_CACHE_ATTRIBUTE_STEP (1.f / 65536.f) // quantization of cooked normals, texture coordinates and tangents
+#define MESH_OPTIMIZE 1 // 1 reorders triangles and vertices of meshes at import for the vertex cache, overdraw and vertex fetch
+// 1 stores meshes in the geometry pool as QuantizedVertex, half the size of Vertex. The vertex shaders dequantize positions
+// with the scale and offset of PerModelUniformBuffer (GPU culled draws with the object space AABB of their mesh info)
+#define MESH_QUANTIZE_VERTICES 0
+// 1 keeps full precision positions for meshes whose quantization step would exceed MESH_QUANTIZE_MAX_STEP, so both vertex formats
+// share the geometry pool (see VMesh::vertexFormat). Vertex input cannot tell them apart, draw the meshes with vertex pulling
+#define MESH_MIXED_VERTEX_FORMATS 0
+#define MESH_QUANTIZE_MAX_STEP 0.0005f // object space units
+// 1 packs the AO, roughness and metalness maps of a mesh into one ORM map at import, R: AO, G: roughness, B: metalness as in
+// glTF 2.0. Materials bind four maps instead of six. Needs the *_orm variants of the geometry fragment shaders
+#define MESH_PACK_ORM 0
+// 1 generates a tangent frame per vertex at import, cooked with the mesh, so the geometry pass interpolates the TBN instead of
+// deriving it per sample from screen space derivatives. Tangents are MikkTSpace style: angle weighted per corner, orthogonal
+// to the normal, with the bitangent sign in w. Needs the *_tangent variants of the geometry vertex and fragment shaders
+#define MESH_TANGENTS 0
+// 1 splits the full resolution LOD of meshes into meshlets at import, each with a bounding sphere and a normal cone for culling
+// on the GPU. Meshlets are cooked with the mesh, see buildMeshlets
+#define MESH_MESHLETS 0
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+// 1 splits the geometry each material gathers from a glTF file into spatially compact clusters at import, one VMesh each
+// sharing the material's textures, so culling and LOD selection do not have to treat a whole building as one mesh.
+// Animated glTF 2.0 meshes stay whole, see splitIntoClusters
+#define MESH_SPATIAL_CLUSTERS 0
+#define MESH_CLUSTER_MAX_TRIANGLES 16384
+#define MESH_CLUSTER_MAX_EXTENT 0.25f // bounds diagonal of a cluster as a fraction of its material's, see MESH_CLUSTER_MIN_TRIANGLES
+#define MESH_CLUSTER_MIN_TRIANGLES 1024 // clusters are not split further for their extent alone once below twice this
+// 1 imports models without flattening their node graph into world space. If every node with geometry references the same
+// meshes, they are welded once in the space of the first such node and every other node becomes an instance of the VMesh,
+// see NodeInstance. Other files, and nodes placed with more than a rotation, uniform scale and translation, are flattened
+#define MESH_KEEP_NODE_INSTANCES 0
+#define MESH_ANIMATED_BOUNDS_SCALE 2.f // skinned and morphed meshes grow their rest pose bounds by this factor around the center
+// 1 decodes the accessors of glTF 2.0 files from their mapping straight into staging memory in the geometry pool layout.
+// Only possible without MESH_OPTIMIZE, MESH_QUANTIZE_VERTICES, MESH_TANGENTS, MESH_MESHLETS, MESH_SPATIAL_CLUSTERS and LODs, which
+// need the vertices on the host. Otherwise they are decoded once into host vertices
+#define GLTF_DECODE_INTO_STAGING (1 && !MESH_OPTIMIZE && !MESH_QUANTIZE_VERTICES && !MESH_TANGENTS && !MESH_MESHLETS && !MESH_SPATIAL_CLUSTERS && \
+	MESH_LOD_COUNT == 1)
 
 
 struct Vertex
@@ -24,6 +85,9 @@ struct Vertex
 	glm::vec3 pos;
 	glm::vec3 normal;
 	glm::vec2 texCoord;
+#if MESH_TANGENTS
+	glm::vec4 tangent; // w: sign of the bitangent cross(normal, tangent). Generated after welding, see generateTangents
+#endif
 
 	bool operator==(const Vertex& other) const
 	{
@@ -32,14 +96,20 @@ struct Vertex
 			texCoord == other.texCoord;
 	}
 
-	static VkVertexInputBindingDescription getBindingDescription()
+	// Binding 0 is the position stream, binding 1 the other attributes, see splitVertexStreams
+	static std::vector<VkVertexInputBindingDescription> getBindingDescriptions()
 	{
-		VkVertexInputBindingDescription bindingDescription = {};
-		bindingDescription.binding = 0;
-		bindingDescription.stride = sizeof(Vertex);
-		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		std::vector<VkVertexInputBindingDescription> bindingDescriptions(2, {});
 
-		return bindingDescription;
+		bindingDescriptions[0].binding = 0;
+		bindingDescriptions[0].stride = offsetof(Vertex, normal);
+		bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		bindingDescriptions[1].binding = 1;
+		bindingDescriptions[1].stride = sizeof(Vertex) - offsetof(Vertex, normal);
+		bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescriptions;
 	}
 
 	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions()
@@ -51,20 +121,150 @@ struct Vertex
 		attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
 		attributeDescriptions[0].offset = offsetof(Vertex, pos);
 
-		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].binding = 1;
 		attributeDescriptions[1].location = 1;
 		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[1].offset = offsetof(Vertex, normal);
+		attributeDescriptions[1].offset = 0;
 
-		attributeDescriptions[2].binding = 0;
+		attributeDescriptions[2].binding = 1;
 		attributeDescriptions[2].location = 2;
 		attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-		attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+		attributeDescriptions[2].offset = offsetof(Vertex, texCoord) - offsetof(Vertex, normal);
+
+#if MESH_TANGENTS
+		attributeDescriptions.push_back({});
+		attributeDescriptions[3].binding = 1;
+		attributeDescriptions[3].location = 3;
+		attributeDescriptions[3].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[3].offset = offsetof(Vertex, tangent) - offsetof(Vertex, normal);
+#endif
+
+		return attributeDescriptions;
+	}
+};
+
+// 16 bytes instead of 32, 20 instead of 48 with MESH_TANGENTS. Positions are unorm16 over the bounds of their mesh, normals
+// and tangents octahedral snorm16 and UVs half floats
+struct QuantizedVertex
+{
+	uint16_t pos[4]; // w: the bitangent sign as 0 or 1 with MESH_TANGENTS, 3 component 16 bit formats are rarely supported as vertex input
+	int16_t normal[2];
+	uint16_t texCoord[2];
+#if MESH_TANGENTS
+	int16_t tangent[2];
+#endif
+
+	// Binding 0 is the position stream, binding 1 the other attributes, see splitVertexStreams
+	static std::vector<VkVertexInputBindingDescription> getBindingDescriptions()
+	{
+		std::vector<VkVertexInputBindingDescription> bindingDescriptions(2, {});
+
+		bindingDescriptions[0].binding = 0;
+		bindingDescriptions[0].stride = offsetof(QuantizedVertex, normal);
+		bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		bindingDescriptions[1].binding = 1;
+		bindingDescriptions[1].stride = sizeof(QuantizedVertex) - offsetof(QuantizedVertex, normal);
+		bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescriptions;
+	}
+
+	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions()
+	{
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(3, {});
+
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+		attributeDescriptions[0].offset = offsetof(QuantizedVertex, pos);
+
+		attributeDescriptions[1].binding = 1;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescriptions[1].offset = 0;
+
+		attributeDescriptions[2].binding = 1;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(QuantizedVertex, texCoord) - offsetof(QuantizedVertex, normal);
+
+#if MESH_TANGENTS
+		attributeDescriptions.push_back({});
+		attributeDescriptions[3].binding = 1;
+		attributeDescriptions[3].location = 3;
+		attributeDescriptions[3].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescriptions[3].offset = offsetof(QuantizedVertex, tangent) - offsetof(QuantizedVertex, normal);
+#endif
 
 		return attributeDescriptions;
 	}
 };
 
+// Layout of the vertices in the geometry pool, which all pipelines drawing meshes take as vertex input
+#if MESH_QUANTIZE_VERTICES
+typedef QuantizedVertex GpuVertex;
+#else
+typedef Vertex GpuVertex;
+#endif
+
+#if MESH_MIXED_VERTEX_FORMATS && !MESH_QUANTIZE_VERTICES
+#error "MESH_MIXED_VERTEX_FORMATS requires MESH_QUANTIZE_VERTICES"
+#endif
+
+// Layout of the vertices of one mesh in the geometry pool, for shaders that fetch them from storage buffers
+enum VertexFormat
+{
+	VERTEX_FORMAT_FULL = 0, // Vertex
+	VERTEX_FORMAT_QUANTIZED // QuantizedVertex
+};
+
+// std430 element of the meshlet storage buffer. A meshlet is a run of consecutive triangles of the full resolution index
+// buffer, so it can be drawn as an index range as well as by a mesh shader
+struct Meshlet
+{
+	glm::vec4 boundingSphere; // object space, w: radius
+	glm::vec4 cone; // xyz: mean of the face normals cross(p1 - p0, p2 - p0), w: sine of the widest deviation from it, 1 never culls
+	uint32_t firstTriangle; // in the full resolution indices of the mesh
+	uint32_t triangleCount;
+	uint32_t firstVertex; // in MeshletData::vertices
+	uint32_t vertexCount;
+};
+
+// Placement of a repeated node of a model in the space of the first one, whose placement is in the vertices.
+// Only filled with MESH_KEEP_NODE_INSTANCES
+struct NodeInstance
+{
+	glm::vec3 position;
+	glm::quat rotation;
+	float scale;
+};
+
+struct MeshletData
+{
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> vertices; // indices into the vertices of the mesh, @vertexCount per meshlet
+	std::vector<uint32_t> triangles; // one per triangle of the mesh, three 8 bit indices into the vertices of its meshlet, x | y << 8 | z << 16
+};
+
+// What the skinning pass reads besides the rest pose vertex
+struct SkinVertex
+{
+	glm::uvec2 joints; // four 16 bit joint indices into the joints of the skin, x: 0 | 1 << 16, y: 2 | 3 << 16
+	glm::uvec2 weights; // four unorm16 weights in the same order
+};
+
+// Skin and morph targets of an animated glTF 2.0 mesh
+struct AnimationData
+{
+	uint32_t skin = Animator::INVALID_INDEX; // in the Animator of the file
+	uint32_t node = Animator::INVALID_INDEX; // whose morph target weights apply
+	uint32_t vertexCount = 0; // of the mesh
+	uint32_t morphTargetCount = 0;
+	std::vector<SkinVertex> skinVertices; // one per vertex, empty without a skin
+	std::vector<glm::vec4> morphDeltas; // position and normal delta of every vertex, one target after the other
+};
+
 // Actually AABB
 struct BBox
 {
@@ -79,6 +279,19 @@ struct BBox
 	BBox getTransformedAABB(const glm::mat4 &T) const;
 };
 
+// Six clip planes extracted from a view projection matrix. Plane normals point inwards
+struct Frustum
+{
+	glm::vec4 planes[6]; // left, right, bottom, top, near, far
+
+	Frustum() = default;
+	explicit Frustum(const glm::mat4 &VP);
+
+	// Conservative, boxes near the frustum corners may be reported as intersecting.
+	// Without @testNearPlane the frustum is treated as extending infinitely behind its near plane
+	bool intersects(const BBox &box, bool testNearPlane = true) const;
+};
+
 namespace std
 {
 	template<> struct hash<Vertex>
@@ -103,16 +316,127 @@ namespace rj
 
 		gli::format chooseFormat(uint32_t componentType, uint32_t componentCount);
 
+		// Merges identical vertices, with the same result as a std::unordered_map<Vertex, uint32_t> from each vertex to its first index.
+		// Open addressing over the indices of the vertices added so far, sized up front for @maxVertexCount so it never grows
+		class VertexWelder
+		{
+		public:
+			explicit VertexWelder(size_t maxVertexCount);
+
+			// Index of the vertex equal to @vert in @verts, which is appended if there is none
+			uint32_t weld(const Vertex &vert, std::vector<Vertex> &verts);
+
+		protected:
+			std::vector<uint32_t> slots; // vertex indices, empty slots hold UINT32_MAX
+			size_t slotMask;
+
+			static size_t hash(const Vertex &vert);
+		};
+
+		// Import with Assimp and merge identical vertices. With @useCache the result is cooked into a binary file next to the
+		// model on the first import and later loads map that file instead, as long as the model is unchanged.
+		// With MESH_MESHLETS the meshlets are cooked too and returned in @pMeshlets if given. With MESH_KEEP_NODE_INSTANCES the
+		// repeated nodes go to @pInstances if given, otherwise every node is flattened into the vertices. @pSource is the model
+		// file already read, e.g. by an AsyncFileReader, to hash in place of mapping it
 		void loadMeshIntoHostBuffers(const std::string &modelFileName,
 			std::vector<Vertex> &hostVerts, std::vector<uint32_t> &hostIndices,
-			glm::vec3 *minPos = nullptr, glm::vec3 *maxPos = nullptr);
+			glm::vec3 *minPos = nullptr, glm::vec3 *maxPos = nullptr, bool useCache = true, MeshletData *pMeshlets = nullptr,
+			std::vector<NodeInstance> *pInstances = nullptr, const std::vector<char> *pSource = nullptr);
+
+		// Quadric error edge collapse. Vertices are only collapsed onto existing ones, so @simplifiedIndices still index @vertices.
+		// Vertices on borders and on UV or normal seams stay in place. Stops at @targetIndexCount or once the cheapest
+		// collapse moves the surface further than @maxError
+		void simplifyMesh(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+			uint32_t targetIndexCount, float maxError, std::vector<uint32_t> &simplifiedIndices);
+
+		// Reorder triangles so vertices are reused while still in the post-transform cache (Forsyth)
+		void optimizeVertexCache(std::vector<uint32_t> &indices, uint32_t vertexCount);
+		// Reorder clusters of the vertex cache order so the ones facing outwards are drawn first. Run after optimizeVertexCache
+		void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices);
+		// Store vertices in the order they are first used and drop the unused ones
+		void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+		// All three of the above, in order
+		void optimizeMesh(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+#if MESH_TANGENTS
+		// Per corner tangents from the UV gradients of its triangle, projected onto the normal plane and weighted by the corner
+		// angle, summed per vertex and orthonormalized against the normal. Vertices whose triangles have no usable UVs get any
+		// tangent orthogonal to the normal. Run after welding, which compares vertices without their tangents
+		void generateTangents(std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
+#endif
+
+		// Split the triangles of @indices into meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles.
+		// Triangles are taken in order, which keeps the vertex cache order and leaves each meshlet a range of @indices
+		void buildMeshlets(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, MeshletData *pMeshlets);
+
+		// Split the triangles of @indices at the median of their centroids along the longest axis until every part has at most
+		// MESH_CLUSTER_MAX_TRIANGLES triangles and spans at most MESH_CLUSTER_MAX_EXTENT of the whole. The parts go to @clusters,
+		// still indexing @vertices, with their triangles in the order of @indices
+		void splitIntoClusters(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+			std::vector<std::vector<uint32_t>> &clusters);
+
+		// Copy the bytes of each vertex before its normal to @positions and the rest to @attributes,
+		// the two vertex streams of the geometry pool
+		template<typename T>
+		void splitVertexStreams(const std::vector<T> &vertices, std::vector<char> &positions, std::vector<char> &attributes)
+		{
+			const size_t positionSize = offsetof(T, normal);
+			const size_t attributeSize = sizeof(T) - positionSize;
+			positions.resize(vertices.size() * positionSize);
+			attributes.resize(vertices.size() * attributeSize);
+			for (size_t i = 0; i < vertices.size(); ++i)
+			{
+				const char *vert = reinterpret_cast<const char *>(&vertices[i]);
+				memcpy(&positions[i * positionSize], vert, positionSize);
+				memcpy(&attributes[i * attributeSize], vert + positionSize, attributeSize);
+			}
+		}
+
+		// Positions are quantized over @bounds, see QuantizedVertex
+		void quantizeVertices(const std::vector<Vertex> &vertices, const BBox &bounds, std::vector<QuantizedVertex> &quantized);
 
 		void loadTexture2DFromBinaryData(ImageWrapper *pTexRet, VManager *pManager, const void *pixels,
 			uint32_t width, uint32_t height, gli::format gliformat, uint32_t mipLevels = 1, bool createSampler = true);
 
+		// Read a .ktx or .dds file. Touches no Vulkan state, so it may run on any thread
+		gli::texture2d decodeTexture2D(const std::string &fn);
+		// The same for the contents of @fn already read into @data
+		gli::texture2d decodeTexture2D(const std::string &fn, const std::vector<char> &data);
+		// Block compressed textures (BC1-7, ASTC) are uploaded as they are, throws if the device cannot sample the format
+		void uploadTexture2D(ImageWrapper *pTexRet, VManager *pManager, const gli::texture2d &texture, bool createSampler = true);
+		// Throws if there is no Vulkan format for @gliformat
+		VkFormat getVkFormat(gli::format gliformat);
+		// Copy of pixel data of any format, as loadTexture2DFromBinaryData takes it
+		gli::texture2d wrapTexture2D(const void *pixels, uint32_t width, uint32_t height, gli::format gliformat, uint32_t mipLevels = 1);
+		// RGBA8 map of channel @roughnessChannel of @roughness in G, @metalnessChannel of @metalness in B and the first channel
+		// of @ao in R, 1 if @ao is empty. Sources must be uncompressed and of the same size, mips are kept if all have them
+		gli::texture2d packOrmMap(const gli::texture2d &roughness, uint32_t roughnessChannel,
+			const gli::texture2d &metalness, uint32_t metalnessChannel, const gli::texture2d &ao);
+		// Where the levels of a 2D texture are in its file, found from the header alone
+		struct TextureFileLayout
+		{
+			std::string fileName; // empty if there is no file
+			gli::format format = gli::FORMAT_UNDEFINED;
+			uint32_t width = 0;
+			uint32_t height = 0;
+			std::vector<size_t> levelOffsets; // file offset of every level, level 0 first
+			std::vector<size_t> levelSizes;
+
+			uint32_t levelCount() const { return static_cast<uint32_t>(levelOffsets.size()); }
+		};
+		// Return false if @fn is not a single layer 2D .dds or .ktx texture with a fourCC or DX10 format, e.g. for
+		// cube maps, arrays or uncompressed DDS formats given by channel masks. Throws if the file is truncated.
+		// Touches no Vulkan state, so it may run on any thread
+		bool readTextureFileLayout(const std::string &fn, TextureFileLayout *pLayout);
+		// Like uploadTexture2D, but the levels are copied from a mapping of the file straight into staging memory
+		void uploadTexture2DFromFile(ImageWrapper *pTexRet, VManager *pManager, const TextureFileLayout &layout, bool createSampler = true);
+		// Upload from the file if TEXTURE_UPLOAD_FROM_FILE and readTextureFileLayout allow, or else decodeTexture2D followed by uploadTexture2D
 		void loadTexture2D(ImageWrapper *pTexRet, VManager *pManager, const std::string &fn, bool createSampler = true);
 
 		void loadCubemap(ImageWrapper *pTexRet, VManager *pManager, const std::string &fn, bool createSampler = true);
+		// Read a .ktx or .dds cube map. Touches no Vulkan state, so it may run on any thread
+		gli::texture_cube decodeCubemap(const std::string &fn);
+		void uploadCubemap(ImageWrapper *pTexRet, VManager *pManager, const gli::texture_cube &texCube, bool createSampler = true);
 	}
 }
 
@@ -129,33 +453,58 @@ struct PerModelUniformBuffer
 {
 	glm::mat4 M;
 	glm::mat4 M_invTrans;
+#if MESH_QUANTIZE_VERTICES
+	glm::vec4 positionScale; // object space position = positionOffset + positionScale * quantized position
+	glm::vec4 positionOffset;
+#endif
 };
 
 class VMesh
 {
 public:
+#if MESH_PACK_ORM
+	const static uint32_t numMapsPerMesh = 4;
+#else
 	const static uint32_t numMapsPerMesh = 6;
+#endif
 
 	rj::VManager *pVulkanManager;
 
 	PerModelUniformBuffer *uPerModelInfo = nullptr;
-	bool uniformDataChanged = true;
+	bool uniformDataChanged = true; // set for changes other than the transforms, which TransformSystem tracks
+	std::vector<PerModelUniformBuffer> instanceTransforms; // world transform of every instance, updated with @uPerModelInfo
 
-	rj::helper_functions::BufferWrapper vertexBuffer;
-	rj::helper_functions::BufferWrapper indexBuffer;
+	rj::GeometryRange geometry; // in the geometry pool buffers of pVulkanManager
+	VertexFormat vertexFormat = VERTEX_FORMAT_FULL; // of @geometry, GpuVertex unless MESH_MIXED_VERTEX_FORMATS
+	std::vector<rj::GeometryRange> lods; // index ranges over the vertices of @geometry, finest first. lods[0] is @geometry. Empty until loaded
+	MeshletData meshlets; // of lods[0], only with MESH_MESHLETS. Kept on the host for the renderer to upload
+	AnimationData animation; // only of animated glTF 2.0 meshes, see isAnimated. Kept on the host for the renderer to upload
 
 	rj::helper_functions::ImageWrapper albedoMap;
 	rj::helper_functions::ImageWrapper normalMap;
+#if MESH_PACK_ORM
+	rj::helper_functions::ImageWrapper ormMap; // AO, roughness and metalness, see MESH_PACK_ORM
+#else
 	rj::helper_functions::ImageWrapper roughnessMap;
 	rj::helper_functions::ImageWrapper metalnessMap;
 	rj::helper_functions::ImageWrapper aoMap;
+#endif
 	rj::helper_functions::ImageWrapper emissiveMap;
+	// Handles in the rj::VTextureStreamer given to upload, in the map order of HostData. INVALID_HANDLE if not streamed
+	uint32_t streamedMaps[numMapsPerMesh];
+	// Handles in the rj::VVirtualTextureCache given to upload, in the map order of HostData. INVALID_HANDLE if bound whole
+	uint32_t virtualMaps[numMapsPerMesh];
+	// Keys of the maps upload() took from or added to its rj::VTextureCache, in the map order of HostData. Empty otherwise
+	std::string cachedMapKeys[numMapsPerMesh];
 
 	MaterialType_t materialType = MATERIAL_TYPE_FSCHLICK_DGGX_GSMITH;
 
 
+	// Images shared by several materials are only uploaded once if @pTextureCache is given.
+	// glTF 2.0 vertices and indices are decoded on @pJobs if given, and its skins and clips go to @pAnimator if given
 	static void loadFromGLTF(std::vector<VMesh> &retMeshes, rj::VManager *pManager, const std::string &gltfFileName,
-		const std::string &version = "1.0")
+		const std::string &version = "1.0", rj::VTextureCache *pTextureCache = nullptr, JobPool *pJobs = nullptr,
+		Animator *pAnimator = nullptr)
 	{
 		using namespace rj::helper_functions;
 
@@ -205,6 +554,9 @@ public:
 				}
 			}
 
+			// All textures and buffers of the scene go into one submission
+			pManager->beginUploadBatch();
+
 			for (const auto &matMeshes : mat2meshes)
 			{
 				retMeshes.emplace_back(pManager);
@@ -212,55 +564,53 @@ public:
 
 				// Textures
 				const auto &material = materials.at(matMeshes.first);
+				auto loadMap = [&](ImageWrapper *pTexRet, const std::string &valueName)
 				{
-					const auto &texName = material.values.at("baseColorTexture").string_value;
-					const auto &tex = textures.at(texName);
+					const auto &tex = textures.at(material.values.at(valueName).string_value);
 					const auto &image = images.at(tex.source);
-
 					auto gliFormat = chooseFormat(tex.type, image.component);
-					loadTexture2DFromBinaryData(&retMesh.albedoMap, pManager, image.image.data(), image.width, image.height, gliFormat, image.levelCount);
-				}
-				{
-					const auto &texName = material.values.at("normalTexture").string_value;
-					const auto &tex = textures.at(texName);
-					const auto &image = images.at(tex.source);
 
-					auto gliFormat = chooseFormat(tex.type, image.component);
-					loadTexture2DFromBinaryData(&retMesh.normalMap, pManager, image.image.data(), image.width, image.height, gliFormat, image.levelCount);
-				}
-				{
-					const auto &texName = material.values.at("roughnessTexture").string_value;
-					const auto &tex = textures.at(texName);
-					const auto &image = images.at(tex.source);
-
-					auto gliFormat = chooseFormat(tex.type, image.component);
-					loadTexture2DFromBinaryData(&retMesh.roughnessMap, pManager, image.image.data(), image.width, image.height, gliFormat, image.levelCount);
-				}
+					const std::string key = gltfFileName + "#" + tex.source + "#" + std::to_string(gliFormat);
+					if (pTextureCache && pTextureCache->acquire(key, pTexRet)) return;
+					loadTexture2DFromBinaryData(pTexRet, pManager, image.image.data(), image.width, image.height, gliFormat, image.levelCount);
+					if (pTextureCache) pTextureCache->add(key, *pTexRet);
+				};
+				loadMap(&retMesh.albedoMap, "baseColorTexture");
+				loadMap(&retMesh.normalMap, "normalTexture");
+#if MESH_PACK_ORM
 				{
-					const auto &texName = material.values.at("metallicTexture").string_value;
-					const auto &tex = textures.at(texName);
-					const auto &image = images.at(tex.source);
-
-					auto gliFormat = chooseFormat(tex.type, image.component);
-					loadTexture2DFromBinaryData(&retMesh.metalnessMap, pManager, image.image.data(), image.width, image.height, gliFormat, image.levelCount);
+					const bool hasAo = material.values.find("aoTexture") != material.values.end();
+					auto getSource = [&](const std::string &valueName)
+					{
+						return textures.at(material.values.at(valueName).string_value).source;
+					};
+					auto wrapMap = [&](const std::string &valueName)
+					{
+						const auto &tex = textures.at(material.values.at(valueName).string_value);
+						const auto &image = images.at(tex.source);
+						return wrapTexture2D(image.image.data(), image.width, image.height, chooseFormat(tex.type, image.component), image.levelCount);
+					};
+
+					const std::string key = gltfFileName + "#" + getSource("roughnessTexture") + "#" + getSource("metallicTexture") +
+						"#" + (hasAo ? getSource("aoTexture") : "") + "#orm";
+					if (!pTextureCache || !pTextureCache->acquire(key, &retMesh.ormMap))
+					{
+						uploadTexture2D(&retMesh.ormMap, pManager, packOrmMap(wrapMap("roughnessTexture"), 0, wrapMap("metallicTexture"), 0,
+							hasAo ? wrapMap("aoTexture") : gli::texture2d()));
+						if (pTextureCache) pTextureCache->add(key, retMesh.ormMap);
+					}
 				}
+#else
+				loadMap(&retMesh.roughnessMap, "roughnessTexture");
+				loadMap(&retMesh.metalnessMap, "metallicTexture");
 				if (material.values.find("aoTexture") != material.values.end())
 				{
-					const auto &texName = material.values.at("aoTexture").string_value;
-					const auto &tex = textures.at(texName);
-					const auto &image = images.at(tex.source);
-
-					auto gliFormat = chooseFormat(tex.type, image.component);
-					loadTexture2DFromBinaryData(&retMesh.aoMap, pManager, image.image.data(), image.width, image.height, gliFormat, image.levelCount);
+					loadMap(&retMesh.aoMap, "aoTexture");
 				}
+#endif
 				if (material.values.find("emissiveTexture") != material.values.end())
 				{
-					const auto &texName = material.values.at("emissiveTexture").string_value;
-					const auto &tex = textures.at(texName);
-					const auto &image = images.at(tex.source);
-
-					auto gliFormat = chooseFormat(tex.type, image.component);
-					loadTexture2DFromBinaryData(&retMesh.emissiveMap, pManager, image.image.data(), image.width, image.height, gliFormat, image.levelCount);
+					loadMap(&retMesh.emissiveMap, "emissiveTexture");
 				}
 
 				// Geometry
@@ -352,28 +702,32 @@ public:
 					indexOffset += numIndices;
 				}
 
-				// create vertex buffer
-				retMesh.vertexBuffer = {};
-				retMesh.vertexBuffer.size = sizeof(hostVertices[0]) * hostVertices.size();
-				retMesh.vertexBuffer.buffer = pManager->createBuffer(retMesh.vertexBuffer.size,
-					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-				pManager->transferHostDataToBuffer(retMesh.vertexBuffer.buffer, retMesh.vertexBuffer.size, hostVertices.data());
+#if MESH_TANGENTS
+				generateTangents(hostVertices, hostIndices);
+#endif
 
-				// create index buffer
-				retMesh.indexBuffer = {};
-				retMesh.indexBuffer.size = sizeof(hostIndices[0]) * hostIndices.size();
-				retMesh.indexBuffer.buffer = pManager->createBuffer(retMesh.indexBuffer.size,
-					VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+#if MESH_SPATIAL_CLUSTERS
+				addClusteredGeometry(retMeshes, retMeshes.size() - 1, hostVertices, hostIndices);
+#else
+#if MESH_OPTIMIZE
+				optimizeMesh(hostVertices, hostIndices);
+#endif
 
-				pManager->transferHostDataToBuffer(retMesh.indexBuffer.buffer, retMesh.indexBuffer.size, hostIndices.data());
+				// vertices and indices go into the geometry pool
+				retMesh.addGeometry(hostVertices, hostIndices);
+#endif
 			}
+
+			pManager->endUploadBatch();
 		}
 		else
 		{
 			rj::GLTFScene scene;
 			rj::GLTFLoader loader;
 			loader.load(&scene, gltfFileName);
+			if (pAnimator) pAnimator->load(scene);
+
+			pManager->beginUploadBatch();
 
 			for (const auto &mesh : scene.meshes)
 			{
@@ -381,68 +735,304 @@ public:
 				auto &retMesh = retMeshes.back();
 				auto gliFormat = gli::FORMAT_RGBA8_UNORM_PACK8;
 
-				// Textures
-				loadTexture2DFromBinaryData(&retMesh.albedoMap, pManager, mesh.albedoMap.pixels.data(),
-					mesh.albedoMap.width, mesh.albedoMap.height, gliFormat, mesh.albedoMap.levelCount);
-
-				loadTexture2DFromBinaryData(&retMesh.normalMap, pManager, mesh.normalMap.pixels.data(),
-					mesh.normalMap.width, mesh.normalMap.height, gliFormat, mesh.normalMap.levelCount);
-
-				loadTexture2DFromBinaryData(&retMesh.roughnessMap, pManager, mesh.roughnessMap.pixels.data(),
-					mesh.roughnessMap.width, mesh.roughnessMap.height, gliFormat, mesh.roughnessMap.levelCount);
-
-				loadTexture2DFromBinaryData(&retMesh.metalnessMap, pManager, mesh.metallicMap.pixels.data(),
-					mesh.metallicMap.width, mesh.metallicMap.height, gliFormat, mesh.metallicMap.levelCount);
+				// Textures. All images are RGBA8, so the image index identifies the texture
+				auto loadMap = [&](ImageWrapper *pTexRet, const rj::GLTFImage &image)
+				{
+					const std::string key = gltfFileName + "#" + std::to_string(image.index);
+					if (pTextureCache && pTextureCache->acquire(key, pTexRet)) return;
+					loadTexture2DFromBinaryData(pTexRet, pManager, image.pixels.data(), image.width, image.height, gliFormat, image.levelCount);
+					if (pTextureCache) pTextureCache->add(key, *pTexRet);
+				};
+				loadMap(&retMesh.albedoMap, mesh.albedoMap);
+				loadMap(&retMesh.normalMap, mesh.normalMap);
+#if MESH_PACK_ORM
+				{
+					// Roughness and metalness come from the G and B channels of the metallicRoughness image
+					const bool hasAo = !mesh.aoMap.pixels.empty();
+					auto wrapMap = [&](const rj::GLTFImage &image)
+					{
+						return wrapTexture2D(image.pixels.data(), image.width, image.height, gliFormat, image.levelCount);
+					};
 
+					const std::string key = gltfFileName + "#" + std::to_string(mesh.roughnessMap.index) + "#" + std::to_string(mesh.metallicMap.index) +
+						"#" + (hasAo ? std::to_string(mesh.aoMap.index) : "") + "#orm";
+					if (!pTextureCache || !pTextureCache->acquire(key, &retMesh.ormMap))
+					{
+						uploadTexture2D(&retMesh.ormMap, pManager, packOrmMap(wrapMap(mesh.roughnessMap), 1, wrapMap(mesh.metallicMap), 2,
+							hasAo ? wrapMap(mesh.aoMap) : gli::texture2d()));
+						if (pTextureCache) pTextureCache->add(key, retMesh.ormMap);
+					}
+				}
+#else
+				loadMap(&retMesh.roughnessMap, mesh.roughnessMap);
+				loadMap(&retMesh.metalnessMap, mesh.metallicMap);
 				if (!mesh.aoMap.pixels.empty())
 				{
-					loadTexture2DFromBinaryData(&retMesh.aoMap, pManager, mesh.aoMap.pixels.data(),
-						mesh.aoMap.width, mesh.aoMap.height, gliFormat, mesh.aoMap.levelCount);
+					loadMap(&retMesh.aoMap, mesh.aoMap);
 				}
-
+#endif
 				if (!mesh.emissiveMap.pixels.empty())
 				{
-					loadTexture2DFromBinaryData(&retMesh.emissiveMap, pManager, mesh.emissiveMap.pixels.data(),
-						mesh.emissiveMap.width, mesh.emissiveMap.height, gliFormat, mesh.emissiveMap.levelCount);
+					loadMap(&retMesh.emissiveMap, mesh.emissiveMap);
 				}
 
 				// Geometry
-				uint32_t vertCount = static_cast<uint32_t>(mesh.positions.size() / 3);
-				std::vector<Vertex> hostVertices(vertCount);
-
-				for (int i = 0; i < vertCount; ++i)
+#if GLTF_DECODE_INTO_STAGING
+				retMesh.addGeometry(mesh, pJobs);
+#else
+				std::vector<Vertex> hostVertices(mesh.vertexCount);
+				std::vector<uint32_t> hostIndices(mesh.indexCount);
+				char *vertexData = reinterpret_cast<char *>(hostVertices.data());
+				mesh.decodePositions(vertexData + offsetof(Vertex, pos), sizeof(Vertex), &retMesh.bounds.min, &retMesh.bounds.max, pJobs);
+				mesh.decodeNormals(vertexData + offsetof(Vertex, normal), sizeof(Vertex), pJobs);
+				mesh.decodeTexCoords(vertexData + offsetof(Vertex, texCoord), sizeof(Vertex), pJobs);
+				mesh.decodeIndices(hostIndices.data(), pJobs);
+#if MESH_TANGENTS
+				generateTangents(hostVertices, hostIndices);
+#endif
+
+#if MESH_SPATIAL_CLUSTERS
+				// Clusters reorder and drop vertices too, which would leave the skins and morph targets of animated meshes behind
+				if (!mesh.isAnimated())
 				{
-					Vertex &vert = hostVertices[i];
-					vert.pos = glm::vec3(mesh.positions[3 * i], mesh.positions[3 * i + 1], mesh.positions[3 * i + 2]);
-					vert.normal = glm::vec3(mesh.normals[3 * i], mesh.normals[3 * i + 1], mesh.normals[3 * i + 2]);
-					vert.texCoord = glm::vec2(mesh.texCoords[i << 1], mesh.texCoords[(i << 1) + 1]);
-
-					retMesh.bounds.max = glm::max(retMesh.bounds.max, vert.pos);
-					retMesh.bounds.min = glm::min(retMesh.bounds.min, vert.pos);
+					addClusteredGeometry(retMeshes, retMeshes.size() - 1, hostVertices, hostIndices);
+					continue;
 				}
+#endif
+#if MESH_OPTIMIZE
+				// Reordering the vertices of animated meshes would leave their skins and morph targets behind
+				if (!mesh.isAnimated()) optimizeMesh(hostVertices, hostIndices);
+#endif
+
+				// vertices and indices go into the geometry pool
+				retMesh.addGeometry(hostVertices, hostIndices);
+#endif
+				if (mesh.isAnimated())
+				{
+					retMesh.addAnimation(mesh, pJobs);
+				}
+			}
+
+			pManager->endUploadBatch();
+		}
+	}
+
+
+	VMesh(rj::VManager *pManager);
+
+	// Everything load() reads from files, decoded but not uploaded yet
+	struct HostData
+	{
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+		BBox bounds;
+		MeshletData meshlets; // only with MESH_MESHLETS
+		std::vector<NodeInstance> instances; // only with MESH_KEEP_NODE_INSTANCES
+#if MESH_PACK_ORM
+		gli::texture2d maps[numMapsPerMesh]; // albedo, normal, ORM, emissive. Empty if not given
+		std::string mapNames[numMapsPerMesh]; // file names of @maps, the keys of the texture cache. The ORM key joins its sources
+#else
+		gli::texture2d maps[numMapsPerMesh]; // albedo, normal, roughness, metalness, AO, emissive. Empty if not given
+		std::string mapNames[numMapsPerMesh]; // file names of @maps, the keys of the texture cache
+#endif
+		// Maps left in their files by TEXTURE_UPLOAD_FROM_FILE, in place of @maps
+		rj::helper_functions::TextureFileLayout mapFiles[numMapsPerMesh];
+	};
+
+	// Append one job per file that fills @pData. The jobs touch no Vulkan state, so they may run on any thread,
+	// but @pData must stay in place until they are done. Map names may be empty.
+	// With @pReader, the loose files the jobs read whole are queued on it now, so the reads of all models are in flight together
+	// and each job only waits for its own. The reader must outlive the jobs
+	static void addHostDataJobs(HostData *pData, std::vector<std::function<void()>> *pJobs,
+		const std::string &modelFileName,
+		const std::string &albedoMapName = "",
+		const std::string &normalMapName = "",
+		const std::string &roughnessMapName = "",
+		const std::string &metalnessMapName = "",
+		const std::string &aoMapName = "",
+		const std::string &emissiveMapName = "",
+		AsyncFileReader *pReader = nullptr)
+	{
+		// Packed files are mapped, the reader only takes loose ones
+		auto readAhead = [pReader](const std::string &fn)
+		{
+			return pReader && fn != "" && !AssetFile::existsInPack(fn) ? pReader->read(fn) : AsyncFileReader::INVALID_HANDLE;
+		};
+		auto decode = [pReader](const std::string &fn, AsyncFileReader::Handle handle)
+		{
+			using namespace rj::helper_functions;
+			return handle != AsyncFileReader::INVALID_HANDLE ? decodeTexture2D(fn, pReader->wait(handle)) : decodeTexture2D(fn);
+		};
+
+#if MESH_PACK_ORM
+		// The ORM map is packed in the job that decodes its sources
+		const std::string ormKey = roughnessMapName + "|" + metalnessMapName + "|" + aoMapName + "#orm";
+		const std::string *mapNames[numMapsPerMesh] = { &albedoMapName, &normalMapName, &ormKey, &emissiveMapName };
+#else
+		const std::string *mapNames[numMapsPerMesh] = { &albedoMapName, &normalMapName, &roughnessMapName, &metalnessMapName, &aoMapName, &emissiveMapName };
+#endif
+		for (uint32_t i = 0; i < numMapsPerMesh; ++i)
+		{
+			if (*mapNames[i] == "") continue;
+			std::string fn = *mapNames[i];
+			pData->mapNames[i] = fn;
+#if MESH_PACK_ORM
+			if (mapNames[i] == &ormKey)
+			{
+				const AsyncFileReader::Handle reads[] = { readAhead(roughnessMapName), readAhead(metalnessMapName), readAhead(aoMapName) };
+				pJobs->push_back([pData, i, roughnessMapName, metalnessMapName, aoMapName, reads, decode]()
+				{
+					pData->maps[i] = rj::helper_functions::packOrmMap(decode(roughnessMapName, reads[0]), 0, decode(metalnessMapName, reads[1]), 0,
+						aoMapName != "" ? decode(aoMapName, reads[2]) : gli::texture2d());
+				});
+				continue;
+			}
+#endif
+#if TEXTURE_UPLOAD_FROM_FILE
+			// Only the headers are read here, the texels go from the file to the staging memory at upload
+			const AsyncFileReader::Handle read = AsyncFileReader::INVALID_HANDLE;
+#else
+			const AsyncFileReader::Handle read = readAhead(fn);
+#endif
+			pJobs->push_back([pData, i, fn, read, decode]()
+			{
+#if TEXTURE_UPLOAD_FROM_FILE
+				if (rj::helper_functions::readTextureFileLayout(fn, &pData->mapFiles[i])) return;
+#endif
+				pData->maps[i] = decode(fn, read);
+			});
+		}
 
-				// create vertex buffer
-				retMesh.vertexBuffer = {};
-				retMesh.vertexBuffer.size = sizeof(hostVertices[0]) * hostVertices.size();
-				retMesh.vertexBuffer.buffer = pManager->createBuffer(retMesh.vertexBuffer.size,
-					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		// The source is only read to be hashed against its cooked mesh, which is not needed if that is packed
+		const AsyncFileReader::Handle modelRead = AssetFile::existsInPack(modelFileName + MESH_CACHE_EXTENSION) ?
+			AsyncFileReader::INVALID_HANDLE : readAhead(modelFileName);
+		pJobs->push_back([pData, modelFileName, pReader, modelRead]()
+		{
+			std::vector<char> source;
+			if (modelRead != AsyncFileReader::INVALID_HANDLE) source = pReader->wait(modelRead);
+			const std::vector<char> *pSource = modelRead != AsyncFileReader::INVALID_HANDLE ? &source : nullptr;
+#if MESH_MESHLETS
+			rj::helper_functions::loadMeshIntoHostBuffers(modelFileName, pData->vertices, pData->indices,
+				&pData->bounds.min, &pData->bounds.max, true, &pData->meshlets, &pData->instances, pSource);
+#else
+			rj::helper_functions::loadMeshIntoHostBuffers(modelFileName, pData->vertices, pData->indices,
+				&pData->bounds.min, &pData->bounds.max, true, nullptr, &pData->instances, pSource);
+#endif
+		});
+	}
 
-				pManager->transferHostDataToBuffer(retMesh.vertexBuffer.buffer, retMesh.vertexBuffer.size, hostVertices.data());
+	// Create the maps and the geometry from decoded files. Must run on the thread that owns pVulkanManager.
+	// With @pTextureCache, maps loaded by an earlier mesh from the same file are shared instead of uploaded again.
+	// With @pTextureStreamer, the maps are streamed instead and only their smallest levels are uploaded now.
+	// With @pVirtualTextures, the maps it takes are virtual and nothing of them is uploaded now
+	void upload(const HostData &data, rj::VTextureCache *pTextureCache = nullptr, rj::VTextureStreamer *pTextureStreamer = nullptr,
+		rj::VVirtualTextureCache *pVirtualTextures = nullptr)
+	{
+		using namespace rj::helper_functions;
 
-				// create index buffer
-				retMesh.indexBuffer = {};
-				retMesh.indexBuffer.size = sizeof(mesh.indices[0]) * mesh.indices.size();
-				retMesh.indexBuffer.buffer = pManager->createBuffer(retMesh.indexBuffer.size,
-					VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		// All maps and buffers of this mesh go into one submission
+		pVulkanManager->beginUploadBatch();
 
-				pManager->transferHostDataToBuffer(retMesh.indexBuffer.buffer, retMesh.indexBuffer.size, mesh.indices.data());
+		ImageWrapper *maps[numMapsPerMesh];
+		getMaps(maps);
+		for (uint32_t i = 0; i < numMapsPerMesh; ++i)
+		{
+			const bool inFile = !data.mapFiles[i].fileName.empty();
+			if (data.maps[i].empty() && !inFile) continue;
+			if (pTextureStreamer)
+			{
+				// The streamer keeps every level on the host, so maps left in their files are decoded after all
+				const gli::texture2d host = inFile ? decodeTexture2D(data.mapFiles[i].fileName) : data.maps[i];
+				streamedMaps[i] = pTextureStreamer->add(data.mapNames[i], host, getVkFormat(host.format()));
+				*maps[i] = pTextureStreamer->getTexture(streamedMaps[i]);
+				continue;
+			}
+			if (pVirtualTextures)
+			{
+				// Kept on the host as well. Maps the cache leaves whole are uploaded below
+				const gli::texture2d host = inFile ? decodeTexture2D(data.mapFiles[i].fileName) : data.maps[i];
+				virtualMaps[i] = pVirtualTextures->add(data.mapNames[i], host, getVkFormat(host.format()));
+				if (virtualMaps[i] != rj::VVirtualTextureCache::INVALID_HANDLE)
+				{
+					*maps[i] = pVirtualTextures->getTexture(virtualMaps[i]);
+					continue;
+				}
+			}
+			if (pTextureCache && pTextureCache->acquire(data.mapNames[i], maps[i])) // replaces a placeholder too
+			{
+				cachedMapKeys[i] = data.mapNames[i];
+				continue;
+			}
+			maps[i]->imageViews.clear(); // may hold a placeholder
+			if (inFile)
+			{
+				uploadTexture2DFromFile(maps[i], pVulkanManager, data.mapFiles[i]);
+			}
+			else
+			{
+				uploadTexture2D(maps[i], pVulkanManager, data.maps[i]);
+			}
+			if (pTextureCache)
+			{
+				pTextureCache->add(data.mapNames[i], *maps[i]);
+				cachedMapKeys[i] = data.mapNames[i];
 			}
 		}
+
+		bounds = data.bounds;
+
+		// vertices and indices go into the geometry pool
+#if MESH_MESHLETS
+		meshlets = data.meshlets;
+#endif
+		addGeometry(data.vertices, data.indices);
+
+		// Repeated nodes of the model, drawn with USE_INSTANCING
+		for (const auto &instance : data.instances)
+		{
+			addInstance(instance.position, instance.rotation, instance.scale);
+		}
+
+		pVulkanManager->endUploadBatch();
 	}
 
+	// Undo upload(), which may be called again afterwards. The mesh is no longer loaded and its maps are empty. Frames in
+	// flight may still draw it, so the cached map keys and the LOD ranges, finest first, are appended to @pMapKeys and @pLods
+	// for the caller to release and free once they are done. Maps upload() did not cache stay allocated
+	void unload(std::vector<std::string> *pMapKeys, std::vector<rj::GeometryRange> *pLods)
+	{
+		rj::helper_functions::ImageWrapper *maps[numMapsPerMesh];
+		getMaps(maps);
+		for (uint32_t i = 0; i < numMapsPerMesh; ++i)
+		{
+			if (!cachedMapKeys[i].empty()) pMapKeys->push_back(cachedMapKeys[i]);
+			cachedMapKeys[i].clear();
+			*maps[i] = rj::helper_functions::ImageWrapper();
+			maps[i]->image = std::numeric_limits<uint32_t>::max();
+		}
 
-	VMesh(rj::VManager *pManager);
+		pLods->insert(pLods->end(), lods.begin(), lods.end());
+		lods.clear();
+		geometry = rj::GeometryRange();
+		bounds = BBox();
+#if MESH_MESHLETS
+		meshlets = MeshletData();
+#endif
+		uniformDataChanged = true;
+	}
 
+	// Pointers to the maps in the map order of HostData
+	void getMaps(rj::helper_functions::ImageWrapper *pMaps[numMapsPerMesh])
+	{
+#if MESH_PACK_ORM
+		rj::helper_functions::ImageWrapper *maps[numMapsPerMesh] = { &albedoMap, &normalMap, &ormMap, &emissiveMap };
+#else
+		rj::helper_functions::ImageWrapper *maps[numMapsPerMesh] = { &albedoMap, &normalMap, &roughnessMap, &metalnessMap, &aoMap, &emissiveMap };
+#endif
+		std::copy(std::begin(maps), std::end(maps), pMaps);
+	}
+
+	// Decode and upload on the calling thread
 	void load(
 		const std::string &modelFileName,
 		const std::string &albedoMapName = "",
@@ -452,82 +1042,100 @@ public:
 		const std::string &aoMapName = "",
 		const std::string &emissiveMapName = "")
 	{
-		using namespace rj::helper_functions;
-
-		// load textures
-		if (albedoMapName != "")
-		{
-			loadTexture2D(&albedoMap, pVulkanManager, albedoMapName);
-		}
-		if (normalMapName != "")
+		HostData data;
+		std::vector<std::function<void()>> jobs;
+		addHostDataJobs(&data, &jobs, modelFileName, albedoMapName, normalMapName, roughnessMapName, metalnessMapName, aoMapName, emissiveMapName);
+		for (auto &job : jobs)
 		{
-			loadTexture2D(&normalMap, pVulkanManager, normalMapName);
+			job();
 		}
-		if (roughnessMapName != "")
+		upload(data);
+	}
+
+	// Return true if @uPerModelInfo was rewritten. Reads the matrices of the last TransformSystem::update()
+	virtual bool updateHostUniformBuffer()
+	{
+		assert(uPerModelInfo && pTransforms);
+		bool transformsChanged = false;
+		for (uint32_t handle : instanceHandles)
 		{
-			loadTexture2D(&roughnessMap, pVulkanManager, roughnessMapName);
+			transformsChanged |= pTransforms->isChanged(handle);
 		}
-		if (metalnessMapName != "")
+		if (!uniformDataChanged && !transformsChanged) return false;
+		uPerModelInfo->M = pTransforms->getWorldMatrix(transformHandle);
+		uPerModelInfo->M_invTrans = pTransforms->getNormalMatrix(transformHandle);
+#if MESH_QUANTIZE_VERTICES
+		if (vertexFormat == VERTEX_FORMAT_QUANTIZED)
 		{
-			loadTexture2D(&metalnessMap, pVulkanManager, metalnessMapName);
+			uPerModelInfo->positionScale = glm::vec4(quantizationBounds.max - quantizationBounds.min, 0.f);
+			uPerModelInfo->positionOffset = glm::vec4(quantizationBounds.min, 1.f);
 		}
-		if (aoMapName != "")
+		else
 		{
-			loadTexture2D(&aoMap, pVulkanManager, aoMapName);
+			uPerModelInfo->positionScale = glm::vec4(1.f, 1.f, 1.f, 0.f);
+			uPerModelInfo->positionOffset = glm::vec4(0.f, 0.f, 0.f, 1.f);
 		}
-		if (emissiveMapName != "")
+#endif
+		instanceTransforms.resize(instanceHandles.size());
+		for (size_t i = 0; i < instanceHandles.size(); ++i)
 		{
-			loadTexture2D(&emissiveMap, pVulkanManager, emissiveMapName);
+			instanceTransforms[i] = *uPerModelInfo;
+			instanceTransforms[i].M = pTransforms->getWorldMatrix(instanceHandles[i]);
+			instanceTransforms[i].M_invTrans = pTransforms->getNormalMatrix(instanceHandles[i]);
 		}
-
-		// load mesh
-		std::vector<Vertex> hostVerts;
-		std::vector<uint32_t> hostIndices;
-		glm::vec3 minPos, maxPos;
-		loadMeshIntoHostBuffers(modelFileName, hostVerts, hostIndices, &minPos, &maxPos);
-		bounds.min = minPos;
-		bounds.max = maxPos;
-
-		// create vertex buffer
-		vertexBuffer = {};
-		vertexBuffer.size = sizeof(hostVerts[0]) * hostVerts.size();
-		vertexBuffer.buffer = pVulkanManager->createBuffer(vertexBuffer.size,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-		pVulkanManager->transferHostDataToBuffer(vertexBuffer.buffer, vertexBuffer.size, hostVerts.data());
-
-		// create index buffer
-		indexBuffer = {};
-		indexBuffer.size = sizeof(hostIndices[0]) * hostIndices.size();
-		indexBuffer.buffer = pVulkanManager->createBuffer(indexBuffer.size,
-			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-		pVulkanManager->transferHostDataToBuffer(indexBuffer.buffer, indexBuffer.size, hostIndices.data());
-	}
-
-	virtual void updateHostUniformBuffer()
-	{
-		assert(uPerModelInfo);
-		if (!uniformDataChanged) return;
-		uPerModelInfo->M = glm::translate(glm::mat4_cast(worldRotation) * glm::scale(glm::mat4(), glm::vec3(scale)), worldPosition);
-		uPerModelInfo->M_invTrans = glm::transpose(glm::inverse(uPerModelInfo->M));
 		uniformDataChanged = false;
+		return true;
 	}
 
+	// Register the mesh in @pSystem, which has to outlive it. Needed before any transform is set or read
+	void attachTransform(TransformSystem *pSystem);
+	bool hasTransform() const { return pTransforms != nullptr; }
+
 	void setPosition(const glm::vec3 &newPos);
 	void setRotation(const glm::quat &newRot);
 	void setScale(float newScale);
 
-	const glm::vec3 &getPostion() const { return worldPosition; }
-	const glm::quat &getRotation() const { return worldRotation; }
-	float getScale() const { return scale; }
-	BBox getAABBWorldSpace() const;
+	// Every mesh starts with a single instance at its own transform. The others are its children in the TransformSystem
+	void addInstance(const glm::vec3 &pos, const glm::quat &rot = glm::quat(), float scale = 1.f);
+	uint32_t getInstanceCount() const { return static_cast<uint32_t>(instanceHandles.size()); }
+
+	const glm::vec3 &getPostion() const { return pTransforms->getPosition(transformHandle); }
+	const glm::quat &getRotation() const { return pTransforms->getRotation(transformHandle); }
+	float getScale() const { return pTransforms->getScale(transformHandle); }
+	const BBox &getAABBObjectSpace() const { return bounds; }
+	bool isAnimated() const { return animation.skin != Animator::INVALID_INDEX || animation.morphTargetCount > 0; }
+	BBox getAABBWorldSpace() const; // bounds of all instances, empty until loaded
+	bool isLoaded() const { return !lods.empty(); }
+#if MESH_PACK_ORM
+	bool hasAoMap() const { return true; } // the ORM map is unoccluded where the mesh has no AO map
+#else
+	bool hasAoMap() const { return aoMap.image != std::numeric_limits<uint32_t>::max(); }
+#endif
 
 protected:
-	glm::vec3 worldPosition;
-	glm::quat worldRotation;
-	float scale;
+	TransformSystem *pTransforms = nullptr;
+	uint32_t transformHandle = TransformSystem::INVALID_HANDLE;
 	BBox bounds;
+	std::vector<uint32_t> instanceHandles; // in @pTransforms, the first one is @transformHandle
+	uint32_t maxLodCount = MESH_LOD_COUNT;
+#if MESH_QUANTIZE_VERTICES
+	BBox quantizationBounds; // of the vertices in the geometry pool
+#endif
+
+	// Add the mesh and its LOD chain to the geometry pool. With MESH_MESHLETS the meshlets are built unless @meshlets already holds them
+	void addGeometry(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
+#if GLTF_DECODE_INTO_STAGING
+	// Decode @mesh into staging memory for the geometry pool, on @pJobs if given, and grow the bounds over it. There are no LODs
+	void addGeometry(const rj::GLTFMesh &mesh, JobPool *pJobs = nullptr);
+#endif
+	// Decode the skin and morph targets of @mesh into @animation and grow the bounds by MESH_ANIMATED_BOUNDS_SCALE
+	void addAnimation(const rj::GLTFMesh &mesh, JobPool *pJobs = nullptr);
+#if MESH_SPATIAL_CLUSTERS
+	// Add the first cluster of @vertices and @indices to @meshes[@meshIdx], which has no geometry yet, and every other one to
+	// a copy of it appended to @meshes. The copies share its textures and material
+	static void addClusteredGeometry(std::vector<VMesh> &meshes, size_t meshIdx, const std::vector<Vertex> &vertices,
+		const std::vector<uint32_t> &indices);
+#endif
 };
 
 class Skybox : public VMesh
@@ -539,21 +1147,26 @@ public:
 
 	bool specMapReady = false;
 	bool shouldSaveSpecMap = false;
+	bool diffuseSHReady = false; // @diffuseSHCoefficients hold the projection of the radiance map
 
 	Skybox(rj::VManager *pManager) :
 		VMesh{ pManager }
 	{
 		materialType = MATERIAL_TYPE_HDR_PROBE;
+		maxLodCount = 1;
 	}
 
 	void load(
 		const std::string &modelFileName,
 		const std::string &radianceMapName,
 		const std::string &specMapName,
-		const std::string &diffuseSHName)
+		const std::string &diffuseSHName, // loaded if the file exists, otherwise the projected coefficients are saved there
+		bool projectDiffuseSH = true) // false leaves the projection to the caller if there are no saved coefficients
 	{
 		using namespace rj::helper_functions;
 
+		pVulkanManager->beginUploadBatch();
+
 		if (radianceMapName != "")
 		{
 			loadCubemap(&radianceMap, pVulkanManager, radianceMapName);
@@ -570,153 +1183,105 @@ public:
 		}
 		else
 		{
-			uint32_t mipLevels = static_cast<uint32_t>(floor(log2f(SPEC_IRRADIANCE_MAP_SIZE) + 0.5f)) + 1;
-
-			specularIrradianceMap.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-			specularIrradianceMap.width = specularIrradianceMap.height = SPEC_IRRADIANCE_MAP_SIZE;
-			specularIrradianceMap.depth = 1;
-			specularIrradianceMap.mipLevelCount = mipLevels;
-			specularIrradianceMap.layerCount = 6;
-
-			specularIrradianceMap.image =
-				pVulkanManager->createImageCube(specularIrradianceMap.width, specularIrradianceMap.height, specularIrradianceMap.format,
-					VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mipLevels);
-
-			// Used for sampling read in shaders
-			specularIrradianceMap.imageViews.resize(mipLevels + 1);
-			specularIrradianceMap.imageViews[0] = pVulkanManager->createImageViewCube(specularIrradianceMap.image, VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels);
-
-			// Used for rendering
-			for (uint32_t level = 0; level < mipLevels; ++level)
-			{
-				specularIrradianceMap.imageViews[level + 1] =
-					pVulkanManager->createImageViewCube(specularIrradianceMap.image, VK_IMAGE_ASPECT_COLOR_BIT, level);
-			}
-
-			specularIrradianceMap.samplers.resize(1);
-			specularIrradianceMap.samplers[0] = pVulkanManager->createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR,
-				VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-				0.f, static_cast<float>(mipLevels - 1), 0.f, VK_TRUE, 16.f);
-
+			createSpecularIrradianceMap(&specularIrradianceMap, pVulkanManager);
 			shouldSaveSpecMap = true;
 		}
 
-		if (diffuseSHName != "")
+		if (diffuseSHName != "" && AssetFile::exists(diffuseSHName))
 		{
-			loadSHCoefficients(diffuseSHName);
+			loadSHCoefficients(diffuseSHName, diffuseSHCoefficients);
+			diffuseSHReady = true;
 		}
-		else
+		else if (projectDiffuseSH)
 		{
-			computeSHCoefficients(radianceMapName, rj::helper_functions::getBaseDir(radianceMapName) + "/Diffuse_SH.bin");
+			computeSHCoefficients(radianceMapName, diffuseSHName);
+			diffuseSHReady = true;
 		}
 
 		VMesh::load(modelFileName);
-	}
 
-private:
-	void computeSHCoefficients(const std::string &radianceMapName, const std::string &saveFileName = "")
-	{
-		gli::texture_cube rm(gli::load(radianceMapName));
-		if (rm.empty()) throw std::runtime_error("Failed to load: " + radianceMapName);
+		pVulkanManager->endUploadBatch();
+	}
 
-		uint32_t width = rm.extent().x;
-		uint32_t height = rm.extent().y;
-		float pixelArea = (1.f / float(width)) * (1.f / float(height));
-		memset(diffuseSHCoefficients, 0, sizeof(diffuseSHCoefficients));
+	// Project the radiance of @rm, an RGBA32F cube map, onto the first 9 SH basis functions.
+	// Blocks of SH_PROJECTION_ROWS_PER_JOB rows run as jobs on @pJobs if given
+	static void computeSHCoefficients(const gli::texture_cube &rm, glm::vec3 *diffuseSHCoefficients, JobPool *pJobs = nullptr);
 
-		for (uint32_t faceIdx = 0; faceIdx < 6; ++faceIdx)
+	// The 9 coefficients as they are in memory
+	static void saveSHCoefficients(const std::string &fn, const glm::vec3 *diffuseSHCoefficients)
+	{
+		std::ofstream fs(fn, std::ofstream::out | std::ofstream::binary);
+		if (fs.is_open())
 		{
-			const glm::vec4 *rgba = reinterpret_cast<const glm::vec4 *>(rm.data(0, faceIdx, 0));
-			glm::vec3 faceNrm = getFaceNormal(faceIdx);
-
-			for (uint32_t py = 0; py < height; ++py)
-			{
-				for (uint32_t px = 0; px < width; ++px)
-				{
-					glm::vec3 wi = getWorldDir(faceIdx, px, py, width, height);
-					float dist2 = glm::dot(wi, wi);
-					wi = glm::normalize(wi);
-					float dw = pixelArea * glm::dot(faceNrm, -wi) / dist2; // differential solid angle
-					glm::vec3 L = glm::vec3(rgba[py * width + px]);
-
-					diffuseSHCoefficients[0] += L * 0.282095f * dw; // l = m = 0
-					diffuseSHCoefficients[1] += L * 0.488603f * wi.y * dw; // l = 1, m = -1
-					diffuseSHCoefficients[2] += L * 0.488603f * wi.z * dw; // l = 1, m = 0
-					diffuseSHCoefficients[3] += L * 0.488603f * wi.x * dw; // l = 1, m = 1
-					diffuseSHCoefficients[4] += L * 1.092548f * wi.x * wi.y * dw; // l = 2, m = -2
-					diffuseSHCoefficients[5] += L * 1.092548f * wi.y * wi.z * dw; // l = 2, m = -1
-					diffuseSHCoefficients[6] += L * 0.315392f * (3.f * wi.z * wi.z - 1.f) * dw; // l = 2, m = 0
-					diffuseSHCoefficients[7] += L * 1.092548f * wi.x * wi.z * dw; // l = 2, m = 1
-					diffuseSHCoefficients[8] += L * 0.546274f * (wi.x * wi.x - wi.y * wi.y) * dw; // l = 2, m = 2
-				}
-			}
+			fs.write(reinterpret_cast<const char *>(diffuseSHCoefficients), 9 * sizeof(glm::vec3));
+			fs.close();
+			AssetFile::record(fn);
 		}
-
-		if (saveFileName != "")
+		else
 		{
-			std::ofstream fs(saveFileName, std::ofstream::out | std::ofstream::binary);
-			if (fs.is_open())
-			{
-				fs.write(reinterpret_cast<const char *>(diffuseSHCoefficients), sizeof(diffuseSHCoefficients));
-				fs.close();
-			}
-			else
-			{
-				throw std::runtime_error("Unable to open file: " + saveFileName);
-			}
+			throw std::runtime_error("Unable to open file: " + fn);
 		}
 	}
 
-	glm::vec3 getFaceNormal(uint32_t faceIdx) const
+	static void loadSHCoefficients(const std::string &fn, glm::vec3 *diffuseSHCoefficients)
 	{
-		glm::vec3 result(0.f);
-		result[faceIdx >> 1] = (faceIdx & 1) ? 1.f : -1.f;
-		return result;
+		AssetFile file(fn);
+
+		if (file.isOpen())
+		{
+			assert(file.getSize() == 9 * sizeof(glm::vec3));
+			memcpy(diffuseSHCoefficients, file.getData(), std::min(file.getSize(), 9 * sizeof(glm::vec3)));
+		}
+		else
+		{
+			throw std::runtime_error("Invalid file name: " + fn);
+		}
 	}
 
-	glm::vec3 getWorldDir(uint32_t faceIdx, uint32_t px, uint32_t py, uint32_t width, uint32_t height) const
+	// Empty SPEC_IRRADIANCE_MAP_SIZE specular map with all its mips, to be prefiltered into
+	static void createSpecularIrradianceMap(rj::helper_functions::ImageWrapper *pMap, rj::VManager *pManager)
 	{
-		glm::vec2 pixelSize = 1.f / glm::vec2(static_cast<float>(width), static_cast<float>(height));
-		glm::vec2 uv = glm::vec2(static_cast<float>(px) + 0.5f, static_cast<float>(py) + 0.5f) * pixelSize;
-		uv.y = 1.f - uv.y;
-		uv -= 0.5f; // [-0.5, 0.5]
+		uint32_t mipLevels = static_cast<uint32_t>(floor(log2f(SPEC_IRRADIANCE_MAP_SIZE) + 0.5f)) + 1;
+
+		pMap->format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		pMap->width = pMap->height = SPEC_IRRADIANCE_MAP_SIZE;
+		pMap->depth = 1;
+		pMap->mipLevelCount = mipLevels;
+		pMap->layerCount = 6;
+
+		// Prefiltered either by rendering or by compute, which writes it as a storage image
+		pMap->image = pManager->createImageCube(pMap->width, pMap->height, pMap->format,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mipLevels);
 
-		switch (faceIdx)
+		// Used for sampling read in shaders
+		pMap->imageViews.resize(mipLevels + 1);
+		pMap->imageViews[0] = pManager->createImageViewCube(pMap->image, VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels);
+
+		// Used for rendering or as storage images
+		for (uint32_t level = 0; level < mipLevels; ++level)
 		{
-		case 0: // +x
-			return glm::vec3(0.5f, uv.y, -uv.x); // DDS uses left-handed system. Need to flip z
-		case 1: // -x
-			return glm::vec3(-0.5f, uv.y, uv.x);
-		case 2: // +y
-			return glm::vec3(uv.x, 0.5f, -uv.y);
-		case 3: // -y
-			return glm::vec3(uv.x, -0.5f, uv.y);
-		case 4: // +z
-			return glm::vec3(uv.x, uv.y, 0.5f);
-		case 5: // -z
-			return glm::vec3(-uv.x, uv.y, -0.5f);
-		default:
-			throw std::runtime_error("Invalid face index");
+			pMap->imageViews[level + 1] = pManager->createImageViewCube(pMap->image, VK_IMAGE_ASPECT_COLOR_BIT, level);
 		}
+
+		pMap->samplers.resize(1);
+		pMap->samplers[0] = pManager->createSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			0.f, static_cast<float>(mipLevels - 1), 0.f, VK_TRUE, 16.f);
 	}
 
-	void loadSHCoefficients(const std::string &fn)
+private:
+	void computeSHCoefficients(const std::string &radianceMapName, const std::string &saveFileName = "")
 	{
-		std::ifstream fs(fn, std::ifstream::in | std::ifstream::binary);
+		gli::texture_cube rm(gli::load(radianceMapName));
+		if (rm.empty()) throw std::runtime_error("Failed to load: " + radianceMapName);
 
-		if (fs.is_open())
-		{
-			fs.seekg(0, std::ifstream::end);
-			size_t fileSize = fs.tellg();
-			assert(fileSize == sizeof(diffuseSHCoefficients));
-			fs.seekg(0, std::ifstream::beg);
-			fs.read(reinterpret_cast<char *>(diffuseSHCoefficients), fileSize);
-			fs.close();
-		}
-		else
+		JobPool jobs;
+		computeSHCoefficients(rm, diffuseSHCoefficients, &jobs);
+
+		if (saveFileName != "")
 		{
-			throw std::runtime_error("Invalid file name: " + fn);
+			saveSHCoefficients(saveFileName, diffuseSHCoefficients);
 		}
 	}
 };
\ No newline at end of file
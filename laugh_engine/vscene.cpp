@@ -2,17 +2,39 @@
 
 
 VScene::VScene(rj::VManager *pManager)
-	: skybox(pManager)
+	: skybox(pManager), textureCache(pManager)
 {
 }
 
-void VScene::computeAABBWorldSpace()
+void VScene::attachTransforms()
 {
-	aabbWorldSpace = BBox();
-	for (const auto &mesh : meshes)
+	for (auto &mesh : meshes)
 	{
-		auto meshAABB = mesh.getAABBWorldSpace();
-		aabbWorldSpace.min = glm::min(aabbWorldSpace.min, meshAABB.min);
-		aabbWorldSpace.max = glm::max(aabbWorldSpace.max, meshAABB.max);
+		if (!mesh.hasTransform()) mesh.attachTransform(&transforms);
 	}
 }
+
+void VScene::buildBVH()
+{
+	std::vector<BBox> boxes(meshes.size());
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		boxes[i] = meshes[i].getAABBWorldSpace();
+	}
+	bvh.build(boxes);
+
+	cullingBounds.resize(static_cast<uint32_t>(boxes.size()));
+	for (uint32_t i = 0; i < cullingBounds.size(); ++i)
+	{
+		cullingBounds.set(i, boxes[i]);
+	}
+	aabbWorldSpace = bvh.getBounds();
+}
+
+void VScene::refitBVH(uint32_t meshIdx)
+{
+	const BBox box = meshes[meshIdx].getAABBWorldSpace();
+	bvh.refit(meshIdx, box);
+	cullingBounds.set(meshIdx, box);
+	aabbWorldSpace = bvh.getBounds();
+}
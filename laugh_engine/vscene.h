@@ -2,6 +2,9 @@
 
 #include "vmesh.h"
 #include "directional_light.h"
+#include "transform_system.h"
+#include "scene_bvh.h"
+#include "culling_bounds.h"
 
 
 class VScene
@@ -9,11 +12,17 @@ class VScene
 public:
 	Skybox skybox;
 	DirectionalLight shadowLight;
+	TransformSystem transforms; // of @meshes and their instances
 	std::vector<VMesh> meshes;
+	rj::VTextureCache textureCache; // maps of @meshes, shared between meshes using the same file
 
-	BBox aabbWorldSpace;
+	SceneBVH bvh; // over the world space AABBs of @meshes, item i is meshes[i]
+	BBox aabbWorldSpace; // bounds of @bvh
+	CullingBounds cullingBounds; // the same boxes as @bvh for testing all of them at once
 
 	VScene(rj::VManager *pManager);
 
-	void computeAABBWorldSpace();
+	void buildBVH(); // after meshes are added, reordered or loaded
+	void refitBVH(uint32_t meshIdx); // after the transform of meshes[@meshIdx] has changed
+	void attachTransforms(); // registers the meshes added since the last call in @transforms
 };
\ No newline at end of file
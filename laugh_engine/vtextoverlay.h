@@ -15,8 +15,8 @@
 #define STB_FIRST_CHAR STB_FONT_consolas_24_latin1_FIRST_CHAR
 #define STB_NUM_CHARS STB_FONT_consolas_24_latin1_NUM_CHARS
 
-// Max. number of chars the text overlay buffer can hold
-#define MAX_CHAR_COUNT 2048
+// Max. number of chars the text overlay buffer can hold. Graph bars take one each
+#define MAX_CHAR_COUNT 4096
 
 
 class VTextOverlay
@@ -35,15 +35,19 @@ public:
 		createCommandPools();
 		createFontTexture();
 		createVertexBuffer();
+		createIndexBuffer();
 		createDescriptorPoolAndSetLayouts();
 		createDescriptorSets();
 		createRenderPasses();
 		createPipelines();
 	}
 
-	void beginTextUpdate()
+	// Each swapchain image owns a region of the vertex buffer so text for one image can be
+	// written while another is still being rendered
+	void beginTextUpdate(uint32_t imageIdx)
 	{
-		mapped = reinterpret_cast<glm::vec4 *>(pManager->mapBuffer(fontQuadVertexBuffer.buffer));
+		assert(imageIdx < imageStates.size());
+		pendingVertices.clear();
 		numLetters = 0;
 	}
 
@@ -51,6 +55,12 @@ public:
 	{
 		assert(mapped != nullptr);
 
+		// Drop what doesn't fit in the swapchain image's region of the vertex buffer
+		if (numLetters + text.size() > MAX_CHAR_COUNT)
+		{
+			text.resize(MAX_CHAR_COUNT - numLetters);
+		}
+
 		auto swapChainExtent = pManager->getSwapChainExtent();
 		float fbW = static_cast<float>(swapChainExtent.width);
 		float fbH = static_cast<float>(swapChainExtent.height);
@@ -84,29 +94,12 @@ public:
 		{
 			stb_fontchar *charData = &fontDescriptors[(uint32_t)letter - STB_FIRST_CHAR];
 
-			mapped->x = (x + (float)charData->x0 * charW);
-			mapped->y = (y + (float)charData->y0 * charH);
-			mapped->z = charData->s0;
-			mapped->w = charData->t0;
-			mapped++;
-
-			mapped->x = (x + (float)charData->x1 * charW);
-			mapped->y = (y + (float)charData->y0 * charH);
-			mapped->z = charData->s1;
-			mapped->w = charData->t0;
-			mapped++;
-
-			mapped->x = (x + (float)charData->x0 * charW);
-			mapped->y = (y + (float)charData->y1 * charH);
-			mapped->z = charData->s0;
-			mapped->w = charData->t1;
-			mapped++;
-
-			mapped->x = (x + (float)charData->x1 * charW);
-			mapped->y = (y + (float)charData->y1 * charH);
-			mapped->z = charData->s1;
-			mapped->w = charData->t1;
-			mapped++;
+			const float t0 = charData->t0 * GLYPH_T_SCALE;
+			const float t1 = charData->t1 * GLYPH_T_SCALE;
+			pendingVertices.emplace_back(x + (float)charData->x0 * charW, y + (float)charData->y0 * charH, charData->s0, t0);
+			pendingVertices.emplace_back(x + (float)charData->x1 * charW, y + (float)charData->y0 * charH, charData->s1, t0);
+			pendingVertices.emplace_back(x + (float)charData->x0 * charW, y + (float)charData->y1 * charH, charData->s0, t1);
+			pendingVertices.emplace_back(x + (float)charData->x1 * charW, y + (float)charData->y1 * charH, charData->s1, t1);
 
 			x += charData->advance * charW;
 
@@ -114,11 +107,90 @@ public:
 		}
 	}
 
+	// Filled rectangle in pixels, @x @y is the upper left corner
+	void addRect(float x, float y, float width, float height)
+	{
+		assert(mapped != nullptr);
+		if (numLetters >= MAX_CHAR_COUNT) return;
+
+		auto swapChainExtent = pManager->getSwapChainExtent();
+		const float x0 = x / swapChainExtent.width * 2.f - 1.f;
+		const float y0 = y / swapChainExtent.height * 2.f - 1.f;
+		const float x1 = (x + width) / swapChainExtent.width * 2.f - 1.f;
+		const float y1 = (y + height) / swapChainExtent.height * 2.f - 1.f;
+
+		// Every corner samples the opaque rows below the glyphs
+		const float s = SOLID_S;
+		const float t = SOLID_T;
+		pendingVertices.emplace_back(x0, y0, s, t);
+		pendingVertices.emplace_back(x1, y0, s, t);
+		pendingVertices.emplace_back(x0, y1, s, t);
+		pendingVertices.emplace_back(x1, y1, s, t);
+
+		numLetters++;
+	}
+
+	// Bar graph of @values in a @width x @height pixel box whose lower left corner is @x @y. @maxValue is at the top.
+	// A line marks @markerValue if it is positive
+	void addGraph(const std::vector<float> &values, float x, float y, float width, float height, float maxValue, float markerValue = 0.f)
+	{
+		if (values.empty() || maxValue <= 0.f) return;
+
+		const float barWidth = width / values.size();
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			const float barHeight = std::max(std::min(values[i] / maxValue, 1.f) * height, 1.f);
+			addRect(x + i * barWidth, y - barHeight, std::max(barWidth - 1.f, 1.f), barHeight);
+		}
+
+		if (markerValue > 0.f && markerValue <= maxValue)
+		{
+			addRect(x, y - markerValue / maxValue * height, width, 1.f);
+		}
+	}
+
+	// The caller must have waited for the last frame that rendered into swapchain image @imageIdx.
+	// Only text that differs from that frame is written, and the command buffer is only re-recorded if the letter count changed
 	void endTextUpdate(uint32_t imageIdx)
 	{
-		pManager->unmapBuffer(fontQuadVertexBuffer.buffer);
-		mapped = nullptr;
-		updateCommandBuffers(imageIdx);
+		auto &state = imageStates[imageIdx];
+
+		if (pendingVertices != state.vertices)
+		{
+			if (!pendingVertices.empty())
+			{
+				memcpy(mapped + imageIdx * VERTICES_PER_IMAGE, pendingVertices.data(), pendingVertices.size() * sizeof(glm::vec4));
+			}
+			state.vertices = pendingVertices;
+		}
+
+		if (state.recordedLetterCount != numLetters)
+		{
+			updateCommandBuffers(imageIdx);
+			state.recordedLetterCount = numLetters;
+		}
+	}
+
+	// Framebuffers, and possibly the swapchain image count, have changed. Everything is written and recorded again
+	void handleSwapChainRecreation()
+	{
+		const uint32_t count = pManager->getSwapChainSize();
+		if (count > commandBuffers.size())
+		{
+			auto cbs = pManager->allocateCommandBuffers(commandPool, count - static_cast<uint32_t>(commandBuffers.size()));
+			commandBuffers.insert(commandBuffers.end(), cbs.begin(), cbs.end());
+		}
+
+		if (count != imageStates.size())
+		{
+			pManager->unmapBuffer(fontQuadVertexBuffer.buffer);
+			pManager->destroyBuffer(fontQuadVertexBuffer.buffer);
+			createVertexBuffer();
+		}
+		else
+		{
+			imageStates.assign(count, {});
+		}
 	}
 
 	void updateCommandBuffers(uint32_t imageIdx)
@@ -136,11 +208,13 @@ public:
 		pManager->cmdBindDescriptorSets(commandBuffers[imageIdx], VK_PIPELINE_BIND_POINT_GRAPHICS,
 			pipelineLayout, { descriptorSet });
 
-		pManager->cmdBindVertexBuffers(commandBuffers[imageIdx], { fontQuadVertexBuffer.buffer }, { 0 });
+		pManager->cmdBindVertexBuffers(commandBuffers[imageIdx], { fontQuadVertexBuffer.buffer }, { imageIdx * fontQuadVertexBuffer.size });
+		pManager->cmdBindIndexBuffer(commandBuffers[imageIdx], fontQuadIndexBuffer.buffer, VK_INDEX_TYPE_UINT16);
 
-		for (uint32_t j = 0; j < numLetters; j++)
+		// All glyph quads in one draw
+		if (numLetters > 0)
 		{
-			pManager->cmdDraw(commandBuffers[imageIdx], 4, 1, j * 4, 0);
+			pManager->cmdDrawIndexed(commandBuffers[imageIdx], numLetters * 6);
 		}
 
 		pManager->cmdEndRenderPass(commandBuffers[imageIdx]);
@@ -154,10 +228,12 @@ public:
 		const std::vector<VkPipelineStageFlags> &waitStages, 
 		const std::vector<uint32_t> &signalSemaphores,
 		uint32_t fence = std::numeric_limits<uint32_t>::max(),
-		bool waitFence = false) const
+		bool waitFence = false,
+		const std::vector<uint64_t> &waitValues = {},
+		const std::vector<uint64_t> &signalValues = {}) const
 	{
 		pManager->beginQueueSubmit(VK_QUEUE_GRAPHICS_BIT);
-		pManager->queueSubmitNewSubmit({ commandBuffers[bufferindex] }, waitSemaphores, waitStages, signalSemaphores);
+		pManager->queueSubmitNewSubmit({ commandBuffers[bufferindex] }, waitSemaphores, waitStages, signalSemaphores, waitValues, signalValues);
 		pManager->endQueueSubmit(fence, waitFence);
 	}
 
@@ -171,6 +247,7 @@ private:
 	const VkFormat fontDeviceTextureFormat = VK_FORMAT_R8_UNORM;
 	rj::helper_functions::ImageWrapper fontDeviceTexture;
 	rj::helper_functions::BufferWrapper fontQuadVertexBuffer;
+	rj::helper_functions::BufferWrapper fontQuadIndexBuffer; // two triangles per quad, shared by all swapchain images
 	uint32_t descriptorSetLayout;
 	uint32_t descriptorPool;
 	uint32_t descriptorSet;
@@ -180,8 +257,24 @@ private:
 	std::vector<uint32_t> commandBuffers;
 
 	stb_fontchar fontDescriptors[STB_NUM_CHARS]; // meta info like x/y offsets to upper left corner of a character window. s/t texture coordinates
-	glm::vec4 *mapped = nullptr;
-	uint32_t numLetters;
+	glm::vec4 *mapped = nullptr; // persistently mapped @fontQuadVertexBuffer
+	uint32_t numLetters = 0;
+
+	static const uint32_t VERTICES_PER_IMAGE = MAX_CHAR_COUNT * 4;
+
+	// Two opaque rows are appended to the font atlas for addRect(). Glyph t coordinates are relative to the atlas without them
+	static const uint32_t FONT_TEXTURE_HEIGHT = STB_FONT_HEIGHT + 2;
+	static constexpr float GLYPH_T_SCALE = float(STB_FONT_HEIGHT) / FONT_TEXTURE_HEIGHT;
+	static constexpr float SOLID_S = .5f;
+	static constexpr float SOLID_T = float(STB_FONT_HEIGHT + 1) / FONT_TEXTURE_HEIGHT; // between the two rows
+
+	struct ImageTextState
+	{
+		std::vector<glm::vec4> vertices; // in the swapchain image's region of the vertex buffer
+		uint32_t recordedLetterCount = std::numeric_limits<uint32_t>::max(); // drawn by the command buffer
+	};
+	std::vector<ImageTextState> imageStates;
+	std::vector<glm::vec4> pendingVertices; // between beginTextUpdate and endTextUpdate
 
 
 	struct TextQuadVertex
@@ -227,22 +320,23 @@ private:
 
 	void createFontTexture()
 	{
-		unsigned char fontTexture[STB_FONT_HEIGHT][STB_FONT_WIDTH]; // a texture atlas containing all the characters
+		unsigned char fontTexture[FONT_TEXTURE_HEIGHT][STB_FONT_WIDTH]; // a texture atlas containing all the characters
 
 		STB_FONT_NAME(fontDescriptors, fontTexture, STB_FONT_HEIGHT);
+		memset(fontTexture[STB_FONT_HEIGHT], 0xff, (FONT_TEXTURE_HEIGHT - STB_FONT_HEIGHT) * STB_FONT_WIDTH);
 
 		fontDeviceTexture.format = fontDeviceTextureFormat;
 		fontDeviceTexture.width = STB_FONT_WIDTH;
-		fontDeviceTexture.height = STB_FONT_HEIGHT;
+		fontDeviceTexture.height = FONT_TEXTURE_HEIGHT;
 		fontDeviceTexture.depth = 1;
 		fontDeviceTexture.mipLevelCount = 1;
 		fontDeviceTexture.layerCount = 1;
 
 		// create device local image
-		fontDeviceTexture.image = pManager->createImage2D(STB_FONT_WIDTH, STB_FONT_HEIGHT, fontDeviceTextureFormat,
+		fontDeviceTexture.image = pManager->createImage2D(STB_FONT_WIDTH, FONT_TEXTURE_HEIGHT, fontDeviceTextureFormat,
 			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-		pManager->transferHostDataToImage(fontDeviceTexture.image, STB_FONT_HEIGHT * STB_FONT_WIDTH * sizeof(unsigned char),
+		pManager->transferHostDataToImage(fontDeviceTexture.image, FONT_TEXTURE_HEIGHT * STB_FONT_WIDTH * sizeof(unsigned char),
 			fontTexture, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 		// create image view
@@ -257,11 +351,35 @@ private:
 
 	void createVertexBuffer()
 	{
+		const uint32_t imageCount = pManager->getSwapChainSize();
+
 		fontQuadVertexBuffer.offset = 0;
-		fontQuadVertexBuffer.size = MAX_CHAR_COUNT * sizeof(glm::vec4); // (x, y, s, t)
+		fontQuadVertexBuffer.size = VERTICES_PER_IMAGE * sizeof(glm::vec4); // (x, y, s, t), size of the region of one swapchain image
 		
-		fontQuadVertexBuffer.buffer = pManager->createBuffer(fontQuadVertexBuffer.size,
+		fontQuadVertexBuffer.buffer = pManager->createBuffer(fontQuadVertexBuffer.size * imageCount,
 			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		mapped = reinterpret_cast<glm::vec4 *>(pManager->mapBuffer(fontQuadVertexBuffer.buffer));
+
+		imageStates.assign(imageCount, {});
+	}
+
+	void createIndexBuffer()
+	{
+		static_assert(VERTICES_PER_IMAGE <= std::numeric_limits<uint16_t>::max(), "glyph quads need 32 bit indices");
+
+		// Vertices of a quad are written in triangle strip order
+		std::vector<uint16_t> indices;
+		indices.reserve(MAX_CHAR_COUNT * 6);
+		for (uint16_t i = 0; i < VERTICES_PER_IMAGE; i += 4)
+		{
+			indices.insert(indices.end(), { i, uint16_t(i + 1), uint16_t(i + 2), uint16_t(i + 2), uint16_t(i + 1), uint16_t(i + 3) });
+		}
+
+		fontQuadIndexBuffer.offset = 0;
+		fontQuadIndexBuffer.size = indices.size() * sizeof(uint16_t);
+		fontQuadIndexBuffer.buffer = pManager->createBuffer(fontQuadIndexBuffer.size,
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		pManager->transferHostDataToBuffer(fontQuadIndexBuffer.buffer, fontQuadIndexBuffer.size, indices.data());
 	}
 
 	void createDescriptorPoolAndSetLayouts()
@@ -299,7 +417,8 @@ private:
 		pManager->beginCreateRenderPass();
 
 		auto swapChainFormat = pManager->getSwapChainImageFormat();
-		pManager->renderPassAddAttachment(swapChainFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		// Loads what the final output pass left in the image, so the contents must not be discarded
+		pManager->renderPassAddAttachment(swapChainFormat, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
 			VK_SAMPLE_COUNT_1_BIT, VK_ATTACHMENT_LOAD_OP_LOAD);
 
 		pManager->beginDescribeSubpass();
@@ -320,7 +439,7 @@ private:
 			VK_ACCESS_MEMORY_READ_BIT,
 			VK_DEPENDENCY_BY_REGION_BIT);
 
-		renderPass = pManager->endCreateRenderPass();
+		renderPass = pManager->endCreateRenderPass("Text overlay");
 	}
 
 	void createPipelines()
@@ -345,7 +464,7 @@ private:
 			pManager->graphicsPipelineAddAttributeDescription(attrDesc.location, attrDesc.binding, attrDesc.format, attrDesc.offset);
 		}
 
-		pManager->graphicsPipelineConfigureInputAssembly(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+		pManager->graphicsPipelineConfigureInputAssembly(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
 
 		pManager->graphicsPipeLineAddColorBlendAttachment(VK_TRUE, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ONE, VK_BLEND_OP_ADD);
 
@@ -0,0 +1,131 @@
+#include "world_partition.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+
+WorldPartition::WorldPartition(float cellSize, float evictionMargin, uint64_t budget, uint32_t maxLoadingCells)
+	: cellSize(cellSize), evictionMargin(evictionMargin), budget(budget), maxLoadingCells(std::max(maxLoadingCells, 1u))
+{
+	assert(cellSize > 0.f);
+}
+
+bool WorldPartition::loadLayout(const std::string &fileName, std::vector<std::string> *pNames, std::vector<glm::vec3> *pPositions)
+{
+	std::ifstream file(fileName);
+	if (!file.is_open()) return false;
+
+	pNames->clear();
+	pPositions->clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#') continue;
+
+		std::string name;
+		glm::vec3 position;
+		std::istringstream ss(line);
+		ss >> name >> position.x >> position.y >> position.z;
+		if (ss.fail()) return false;
+
+		pNames->push_back(name);
+		pPositions->push_back(position);
+	}
+	return true;
+}
+
+uint32_t WorldPartition::addMesh(uint32_t meshIdx, const glm::vec3 &position)
+{
+	assert(meshIdx == meshCells.size());
+	const glm::ivec2 coords(static_cast<int32_t>(std::floor(position.x / cellSize)), static_cast<int32_t>(std::floor(position.z / cellSize)));
+	const uint64_t key = static_cast<uint64_t>(static_cast<uint32_t>(coords.x)) << 32 | static_cast<uint32_t>(coords.y);
+
+	auto it = cellIndices.find(key);
+	if (it == cellIndices.end())
+	{
+		it = cellIndices.emplace(key, static_cast<uint32_t>(cells.size())).first;
+		cells.emplace_back();
+		cells.back().coords = coords;
+	}
+	Cell &cell = cells[it->second];
+	assert(cell.state == CELL_UNLOADED);
+	cell.meshes.push_back(meshIdx);
+	meshCells.push_back(it->second);
+	return it->second;
+}
+
+void WorldPartition::update(const Area *pAreas, uint32_t areaCount, std::vector<uint32_t> *pLoadCells, std::vector<uint32_t> *pEvictCells)
+{
+	const uint32_t cellCount = static_cast<uint32_t>(cells.size());
+	distances.resize(cellCount);
+	for (uint32_t c = 0; c < cellCount; ++c)
+	{
+		distances[c] = getDistance(cells[c], pAreas, areaCount);
+	}
+
+	// Cells that keep loading now would only delay the nearer ones the camera moves towards, so only a few load at once
+	candidates.clear();
+	for (uint32_t c = 0; c < cellCount; ++c)
+	{
+		if (cells[c].state == CELL_UNLOADED && distances[c] <= 0.f) candidates.push_back(c);
+	}
+	const size_t loadCount = std::min<size_t>(candidates.size(), maxLoadingCells - std::min(loadingCellCount, maxLoadingCells));
+	std::partial_sort(candidates.begin(), candidates.begin() + loadCount, candidates.end(),
+		[this](uint32_t a, uint32_t b) { return distances[a] < distances[b]; });
+	for (size_t i = 0; i < loadCount; ++i)
+	{
+		Cell &cell = cells[candidates[i]];
+		cell.state = CELL_LOADING;
+		cell.pendingMeshCount = static_cast<uint32_t>(cell.meshes.size());
+		pLoadCells->push_back(candidates[i]);
+	}
+	loadingCellCount += static_cast<uint32_t>(loadCount);
+
+	if (loadedBytes <= budget) return;
+
+	candidates.clear();
+	for (uint32_t c = 0; c < cellCount; ++c)
+	{
+		if (cells[c].state == CELL_RESIDENT && distances[c] > evictionMargin) candidates.push_back(c);
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b) { return distances[a] > distances[b]; });
+	for (size_t i = 0; i < candidates.size() && loadedBytes > budget; ++i)
+	{
+		Cell &cell = cells[candidates[i]];
+		cell.state = CELL_UNLOADED;
+		loadedBytes -= cell.bytes;
+		cell.bytes = 0;
+		--residentCellCount;
+		pEvictCells->push_back(candidates[i]);
+	}
+}
+
+void WorldPartition::meshLoaded(uint32_t meshIdx, uint64_t bytes)
+{
+	Cell &cell = cells[meshCells[meshIdx]];
+	assert(cell.state == CELL_LOADING && cell.pendingMeshCount > 0);
+	cell.bytes += bytes;
+	loadedBytes += bytes;
+	if (--cell.pendingMeshCount > 0) return;
+
+	cell.state = CELL_RESIDENT;
+	--loadingCellCount;
+	++residentCellCount;
+}
+
+float WorldPartition::getDistance(const Cell &cell, const Area *pAreas, uint32_t areaCount) const
+{
+	const glm::vec2 cellMin = glm::vec2(cell.coords) * cellSize;
+	const glm::vec2 cellMax = cellMin + cellSize;
+	float distance = std::numeric_limits<float>::max();
+	for (uint32_t i = 0; i < areaCount; ++i)
+	{
+		// From the area center to the nearest point of the cell, 0 inside it
+		const glm::vec2 nearest = glm::clamp(pAreas[i].center, cellMin, cellMax);
+		distance = std::min(distance, glm::length(pAreas[i].center - nearest) - pAreas[i].radius);
+	}
+	return distance;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+
+// Square cells on the XZ plane, each holding the meshes whose positions fall into it. Cells overlapping any of the areas
+// given to update() are loaded, nearest first, a few at a time. Resident cells farther than the eviction margin from every
+// area are evicted, farthest first, but only while the meshes in memory exceed the budget, so cells the camera just left
+// stay loaded for a while. Loading and evicting the meshes themselves is up to the caller
+class WorldPartition
+{
+public:
+	enum CellState : uint8_t
+	{
+		CELL_UNLOADED,
+		CELL_LOADING, // until every mesh of the cell reported meshLoaded()
+		CELL_RESIDENT
+	};
+
+	// Circle on the XZ plane whose cells should be resident
+	struct Area
+	{
+		glm::vec2 center;
+		float radius;
+	};
+
+	WorldPartition(float cellSize, float evictionMargin, uint64_t budget, uint32_t maxLoadingCells);
+
+	// Lines of "<model name> <x> <y> <z>", # starts a comment. Return false if the file cannot be read or a line is malformed
+	static bool loadLayout(const std::string &fileName, std::vector<std::string> *pNames, std::vector<glm::vec3> *pPositions);
+
+	// Meshes are numbered by the caller, consecutively from 0. Return the cell of @position
+	uint32_t addMesh(uint32_t meshIdx, const glm::vec3 &position);
+
+	// Append the cells to start loading and those to evict. Their states change right away
+	void update(const Area *pAreas, uint32_t areaCount, std::vector<uint32_t> *pLoadCells, std::vector<uint32_t> *pEvictCells);
+	// Mesh @meshIdx of a loading cell is uploaded and holds about @bytes of device memory
+	void meshLoaded(uint32_t meshIdx, uint64_t bytes);
+
+	const std::vector<uint32_t> &getCellMeshes(uint32_t cell) const { return cells[cell].meshes; }
+	CellState getCellState(uint32_t cell) const { return cells[cell].state; }
+	uint32_t getCellCount() const { return static_cast<uint32_t>(cells.size()); }
+	uint32_t getResidentCellCount() const { return residentCellCount; }
+	uint64_t getLoadedBytes() const { return loadedBytes; } // of loading and resident cells
+
+protected:
+	struct Cell
+	{
+		glm::ivec2 coords;
+		CellState state = CELL_UNLOADED;
+		uint32_t pendingMeshCount = 0; // while loading
+		uint64_t bytes = 0; // of its meshes loaded so far
+		std::vector<uint32_t> meshes;
+	};
+
+	float cellSize;
+	float evictionMargin;
+	uint64_t budget;
+	uint32_t maxLoadingCells;
+	std::vector<Cell> cells;
+	std::unordered_map<uint64_t, uint32_t> cellIndices; // by packed coords
+	std::vector<uint32_t> meshCells; // by mesh
+	uint32_t loadingCellCount = 0;
+	uint32_t residentCellCount = 0;
+	uint64_t loadedBytes = 0;
+	std::vector<float> distances; // scratch of update(), kept to not allocate per call
+	std::vector<uint32_t> candidates;
+
+	float getDistance(const Cell &cell, const Area *pAreas, uint32_t areaCount) const; // to the nearest area edge, < 0 inside
+};
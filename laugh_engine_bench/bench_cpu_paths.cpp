@@ -0,0 +1,334 @@
+#include <cstring>
+
+#include "vmesh.h"
+#include "camera.h"
+#include "directional_light.h"
+#include "task_scheduler.h"
+#include "microbench.h"
+
+// Assets the engine loads by default
+#define BENCH_MODEL_FILE_NAME		"../models/Drone_Body.obj"
+#define BENCH_RADIANCE_MAP_NAME		"../textures/Environment/PaperMill/Unfiltered_HDR.dds"
+#define BENCH_SHADOW_MAP_SIZE		1024 // SHADOW_MAP_SIZE of the engine
+#define BENCH_AABB_COUNT			4096
+#define BENCH_WELD_GRID_SIZE		512 // quads per side of the grid whose triangle corners are welded
+#define BENCH_FRAME_TASK_COUNT		8 // tasks per frame of BM_TaskSchedulerWaitReset, about as many as updateUniformHostData adds
+
+extern std::string g_benchGltfFileName; // BM_GLTFLoad is skipped if empty
+
+
+// Assimp import, vertex welding and the bounds, without the cooked mesh
+static void BM_LoadMeshIntoHostBuffers(benchmark::State &state)
+{
+	if (!rj::helper_functions::fileExist(BENCH_MODEL_FILE_NAME))
+	{
+		state.SkipWithError("missing " BENCH_MODEL_FILE_NAME);
+		return;
+	}
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	for (auto _ : state)
+	{
+		vertices.clear();
+		indices.clear();
+		rj::helper_functions::loadMeshIntoHostBuffers(BENCH_MODEL_FILE_NAME, vertices, indices, nullptr, nullptr, false);
+		benchmark::DoNotOptimize(vertices.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(indices.size()));
+	state.SetLabel(std::to_string(vertices.size()) + " vertices");
+}
+BENCHMARK(BM_LoadMeshIntoHostBuffers);
+
+// Source hash and the copy out of the mapped cooked mesh, cooked before the timed loop if needed
+static void BM_LoadCookedMesh(benchmark::State &state)
+{
+	if (!rj::helper_functions::fileExist(BENCH_MODEL_FILE_NAME))
+	{
+		state.SkipWithError("missing " BENCH_MODEL_FILE_NAME);
+		return;
+	}
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	rj::helper_functions::loadMeshIntoHostBuffers(BENCH_MODEL_FILE_NAME, vertices, indices);
+	for (auto _ : state)
+	{
+		vertices.clear();
+		indices.clear();
+		rj::helper_functions::loadMeshIntoHostBuffers(BENCH_MODEL_FILE_NAME, vertices, indices);
+		benchmark::DoNotOptimize(vertices.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(indices.size()));
+	state.SetLabel(std::to_string(vertices.size()) + " vertices");
+}
+BENCHMARK(BM_LoadCookedMesh);
+
+// Triangle corners of a grid, every inner vertex is shared by six triangles
+static std::vector<Vertex> makeWeldCorners()
+{
+	auto gridVertex = [](uint32_t x, uint32_t y)
+	{
+		const glm::vec2 uv(float(x) / BENCH_WELD_GRID_SIZE, float(y) / BENCH_WELD_GRID_SIZE);
+		return Vertex{ glm::vec3(uv.x, 0.f, uv.y), glm::vec3(0.f, 1.f, 0.f), uv };
+	};
+
+	std::vector<Vertex> corners;
+	corners.reserve(6 * BENCH_WELD_GRID_SIZE * BENCH_WELD_GRID_SIZE);
+	for (uint32_t y = 0; y < BENCH_WELD_GRID_SIZE; ++y)
+	{
+		for (uint32_t x = 0; x < BENCH_WELD_GRID_SIZE; ++x)
+		{
+			for (const auto &corner : { glm::uvec2(0, 0), glm::uvec2(1, 0), glm::uvec2(1, 1), glm::uvec2(0, 0), glm::uvec2(1, 1), glm::uvec2(0, 1) })
+			{
+				corners.push_back(gridVertex(x + corner.x, y + corner.y));
+			}
+		}
+	}
+	return corners;
+}
+
+// What loadMeshIntoHostBuffers used before VertexWelder
+static void weldWithUnorderedMap(const std::vector<Vertex> &corners, std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+	std::unordered_map<Vertex, uint32_t> vert2IdxLut;
+	for (const auto &vert : corners)
+	{
+		const auto searchResult = vert2IdxLut.find(vert);
+		if (searchResult == vert2IdxLut.end())
+		{
+			const uint32_t newIdx = static_cast<uint32_t>(vertices.size());
+			vert2IdxLut[vert] = newIdx;
+			indices.push_back(newIdx);
+			vertices.push_back(vert);
+		}
+		else
+		{
+			indices.push_back(searchResult->second);
+		}
+	}
+}
+
+static void weldWithVertexWelder(const std::vector<Vertex> &corners, std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+	rj::helper_functions::VertexWelder welder(corners.size());
+	indices.reserve(corners.size());
+	for (const auto &vert : corners)
+	{
+		indices.push_back(welder.weld(vert, vertices));
+	}
+}
+
+static void BM_WeldUnorderedMap(benchmark::State &state)
+{
+	const std::vector<Vertex> corners = makeWeldCorners();
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	for (auto _ : state)
+	{
+		vertices.clear();
+		indices.clear();
+		weldWithUnorderedMap(corners, vertices, indices);
+		benchmark::DoNotOptimize(indices.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(corners.size()));
+	state.SetLabel(std::to_string(vertices.size()) + " vertices");
+}
+BENCHMARK(BM_WeldUnorderedMap);
+
+// Fails if the result differs from BM_WeldUnorderedMap's
+static void BM_WeldVertexWelder(benchmark::State &state)
+{
+	const std::vector<Vertex> corners = makeWeldCorners();
+	std::vector<Vertex> vertices, referenceVertices;
+	std::vector<uint32_t> indices, referenceIndices;
+	weldWithUnorderedMap(corners, referenceVertices, referenceIndices);
+	weldWithVertexWelder(corners, vertices, indices);
+	if (vertices != referenceVertices || indices != referenceIndices)
+	{
+		state.SkipWithError("VertexWelder result differs from the std::unordered_map weld");
+		return;
+	}
+
+	for (auto _ : state)
+	{
+		vertices.clear();
+		indices.clear();
+		weldWithVertexWelder(corners, vertices, indices);
+		benchmark::DoNotOptimize(indices.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(corners.size()));
+	state.SetLabel(std::to_string(vertices.size()) + " vertices");
+}
+BENCHMARK(BM_WeldVertexWelder);
+
+// Only the projection, the cube map is loaded once
+static void BM_ComputeSHCoefficients(benchmark::State &state)
+{
+	if (!rj::helper_functions::fileExist(BENCH_RADIANCE_MAP_NAME))
+	{
+		state.SkipWithError("missing " BENCH_RADIANCE_MAP_NAME);
+		return;
+	}
+
+	const gli::texture_cube radianceMap(gli::load(BENCH_RADIANCE_MAP_NAME));
+	glm::vec3 coefficients[9];
+	for (auto _ : state)
+	{
+		Skybox::computeSHCoefficients(radianceMap, coefficients);
+		benchmark::DoNotOptimize(coefficients);
+	}
+
+	state.SetItemsProcessed(state.iterations() * 6 * radianceMap.extent().x * radianceMap.extent().y);
+}
+BENCHMARK(BM_ComputeSHCoefficients);
+
+// The same on a pool with one thread per hardware thread, as Skybox::load runs it
+static void BM_ComputeSHCoefficientsJobs(benchmark::State &state)
+{
+	if (!rj::helper_functions::fileExist(BENCH_RADIANCE_MAP_NAME))
+	{
+		state.SkipWithError("missing " BENCH_RADIANCE_MAP_NAME);
+		return;
+	}
+
+	const gli::texture_cube radianceMap(gli::load(BENCH_RADIANCE_MAP_NAME));
+	JobPool jobs;
+	glm::vec3 coefficients[9];
+	for (auto _ : state)
+	{
+		Skybox::computeSHCoefficients(radianceMap, coefficients, &jobs);
+		benchmark::DoNotOptimize(coefficients);
+	}
+
+	state.SetItemsProcessed(state.iterations() * 6 * radianceMap.extent().x * radianceMap.extent().y);
+	state.SetLabel(std::to_string(jobs.getThreadCount()) + " threads");
+}
+BENCHMARK(BM_ComputeSHCoefficientsJobs);
+
+// The engine's initial camera and shadow light
+static void BM_ComputeCascadeScalesAndOffsets(benchmark::State &state)
+{
+	const Camera camera(
+		glm::vec3(-1.74542487f, 1.01875722f, -2.32838178f),
+		glm::vec3(0.326926917f, 0.0790613592f, -0.198676541f),
+		glm::radians(45.f), 16.f / 9.f, 1.f, 30.f);
+	std::vector<glm::vec3> frustumCorners(camera.getSegmentCount() * 4 + 4);
+	std::vector<float> cascadeDepths(camera.getSegmentCount());
+	camera.getCornersWorldSpace(frustumCorners.data());
+	camera.getSegmentDepths(cascadeDepths.data());
+
+	DirectionalLight light(glm::vec3(1.f), glm::vec3(-1.f), glm::vec3(2.f), true);
+	const glm::vec3 sceneMin(-5.f, 0.f, -5.f), sceneMax(5.f, 3.f, 5.f);
+	for (auto _ : state)
+	{
+		light.computeCascadeScalesAndOffsets(frustumCorners, cascadeDepths, sceneMin, sceneMax, BENCH_SHADOW_MAP_SIZE);
+		benchmark::ClobberMemory();
+	}
+
+	state.SetItemsProcessed(state.iterations() * camera.getSegmentCount());
+}
+BENCHMARK(BM_ComputeCascadeScalesAndOffsets);
+
+// The allocations of a frame's uniforms, into the engine's per-frame blob size
+static void BM_UniformBlobAlloc(benchmark::State &state)
+{
+	const uint32_t allocCount = 256;
+	const size_t allocSize = 200; // rounded up to the 256 byte alignment
+	for (auto _ : state)
+	{
+		rj::helper_functions::UniformBlob<64 * 1024> blob(256);
+		for (uint32_t i = 0; i < allocCount; ++i)
+		{
+			benchmark::DoNotOptimize(blob.alloc(allocSize));
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations() * allocCount);
+}
+BENCHMARK(BM_UniformBlobAlloc);
+
+static void BM_GLTFLoad(benchmark::State &state)
+{
+	if (g_benchGltfFileName.empty())
+	{
+		state.SkipWithError("no --gltf=<file> given");
+		return;
+	}
+
+	rj::GLTFLoader loader;
+	size_t meshCount = 0;
+	for (auto _ : state)
+	{
+		rj::GLTFScene scene;
+		loader.load(&scene, g_benchGltfFileName);
+		meshCount = scene.meshes.size();
+		benchmark::DoNotOptimize(scene.meshes.data());
+	}
+
+	state.SetLabel(std::to_string(meshCount) + " meshes");
+}
+BENCHMARK(BM_GLTFLoad);
+
+// World space bounds of mesh instances
+static void BM_GetTransformedAABB(benchmark::State &state)
+{
+	std::vector<BBox> boxes(BENCH_AABB_COUNT);
+	for (uint32_t i = 0; i < BENCH_AABB_COUNT; ++i)
+	{
+		const glm::vec3 center(float(i % 64), float(i / 64 % 64), float(i / 4096));
+		boxes[i] = BBox(center - glm::vec3(.5f), center + glm::vec3(.5f));
+	}
+	const glm::mat4 T = glm::rotate(glm::translate(glm::mat4(1.f), glm::vec3(1.f, 2.f, 3.f)), .3f, glm::vec3(0.f, 1.f, 0.f));
+
+	for (auto _ : state)
+	{
+		for (const auto &box : boxes)
+		{
+			benchmark::DoNotOptimize(box.getTransformedAABB(T));
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations() * BENCH_AABB_COUNT);
+}
+BENCHMARK(BM_GetTransformedAABB);
+
+// The frame task pattern of updateUniformHostData: add, wait() on each handle, then reset() right away while the workers
+// may still be finishing up. reset() throws if a task was seen done before it was counted out
+static void BM_TaskSchedulerWaitReset(benchmark::State &state)
+{
+	TaskScheduler tasks;
+	TaskScheduler::TaskHandle handles[BENCH_FRAME_TASK_COUNT];
+	std::atomic<uint32_t> sum{ 0 };
+	for (auto _ : state)
+	{
+		for (uint32_t i = 0; i < BENCH_FRAME_TASK_COUNT; ++i)
+		{
+			handles[i] = tasks.add([&sum, i]() { sum.fetch_add(i); }, i == 0 ? rj::ArrayView<TaskScheduler::TaskHandle>() : rj::ArrayView<TaskScheduler::TaskHandle>(&handles[i / 2], 1));
+		}
+		for (auto handle : handles)
+		{
+			tasks.wait(handle);
+		}
+		try
+		{
+			tasks.reset();
+		}
+		catch (const std::exception &e)
+		{
+			state.SkipWithError(e.what());
+			tasks.waitAll();
+			tasks.reset();
+			break;
+		}
+	}
+
+	benchmark::DoNotOptimize(sum.load());
+	state.SetItemsProcessed(state.iterations() * BENCH_FRAME_TASK_COUNT);
+	state.SetLabel(std::to_string(tasks.getThreadCount()) + " threads");
+}
+BENCHMARK(BM_TaskSchedulerWaitReset);
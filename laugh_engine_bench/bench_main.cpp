@@ -0,0 +1,26 @@
+#define TINYGLTF_LOADER_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#include "vmesh.h"
+#include "startup_profile.h"
+#include "microbench.h"
+
+// Defined in vbase.cpp for the engine, which the benchmarks don't link
+std::shared_mutex rj::VManager::g_commandBufferMutex;
+
+std::string g_benchGltfFileName;
+
+
+// Run from this directory, asset paths are relative to it like the engine's.
+// --gltf=<file> selects the glTF scene for BM_GLTFLoad, which is skipped without it
+int main(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "--gltf=", 7) == 0) g_benchGltfFileName = argv[i] + 7;
+	}
+
+	// Loads in the benchmarked paths would otherwise be recorded as startup phases on every iteration
+	StartupProfile::get().finish();
+
+	return benchmark::RunSpecifiedBenchmarks(argc, argv);
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+// The subset of the Google Benchmark API the CPU path benchmarks use, so they can move to the real library
+// by swapping this header. Each benchmark runs until it has taken at least MIN_TIME_S, the iteration count
+// is grown the same way Google Benchmark does
+namespace benchmark
+{
+	class State
+	{
+	public:
+		explicit State(uint64_t iterations) : m_iterations(iterations) {}
+
+		// for (auto _ : state) runs the body max_iterations times, timing only the loop
+		struct Iterator
+		{
+			State *pState;
+			uint64_t remaining;
+
+			bool operator!=(const Iterator &) const
+			{
+				if (remaining != 0) return true;
+				pState->finishTiming();
+				return false;
+			}
+			void operator++() { --remaining; }
+			int operator*() const { return 0; }
+		};
+
+		Iterator begin()
+		{
+			startTiming();
+			return{ this, m_iterations };
+		}
+		Iterator end() { return{ this, 0 }; }
+
+		void PauseTiming() { m_elapsedNs += nowNs() - m_startNs; }
+		void ResumeTiming() { m_startNs = nowNs(); }
+
+		void SetItemsProcessed(int64_t items) { m_itemsProcessed = items; }
+		void SetLabel(const std::string &label) { m_label = label; }
+		void SkipWithError(const char *msg) { m_error = msg; }
+
+		int64_t iterations() const { return static_cast<int64_t>(m_iterations); }
+
+	private:
+		friend struct Runner;
+
+		uint64_t m_iterations;
+		uint64_t m_startNs = 0;
+		uint64_t m_elapsedNs = 0;
+		int64_t m_itemsProcessed = 0;
+		std::string m_label;
+		std::string m_error;
+
+		static uint64_t nowNs()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+		void startTiming() { m_elapsedNs = 0; m_startNs = nowNs(); }
+		void finishTiming() { m_elapsedNs += nowNs() - m_startNs; }
+	};
+
+	// Keep the compiler from optimizing away a result or the computation producing it
+	template<typename T>
+	inline void DoNotOptimize(const T &value)
+	{
+#if defined(_MSC_VER)
+		static const void *volatile sink;
+		sink = &value;
+#else
+		asm volatile("" : : "r,m"(value) : "memory");
+#endif
+	}
+
+	inline void ClobberMemory()
+	{
+#if defined(_MSC_VER)
+		_ReadWriteBarrier();
+#else
+		asm volatile("" : : : "memory");
+#endif
+	}
+
+	typedef void(*Function)(State &);
+
+	struct Registration
+	{
+		const char *name;
+		Function fn;
+	};
+
+	inline std::vector<Registration> &registry()
+	{
+		static std::vector<Registration> benchmarks;
+		return benchmarks;
+	}
+
+	inline int registerBenchmark(const char *name, Function fn)
+	{
+		registry().push_back({ name, fn });
+		return 0;
+	}
+
+	struct Runner
+	{
+		static constexpr double MIN_TIME_S = 0.5;
+		static constexpr uint64_t MAX_ITERATIONS = 1000000000;
+
+		// Supports --benchmark_filter=<substring> and --benchmark_out=<file>, which gets one CSV row per benchmark
+		static int run(int argc, char *argv[])
+		{
+			std::string filter, outFileName;
+			for (int i = 1; i < argc; ++i)
+			{
+				if (strncmp(argv[i], "--benchmark_filter=", 19) == 0) filter = argv[i] + 19;
+				else if (strncmp(argv[i], "--benchmark_out=", 16) == 0) outFileName = argv[i] + 16;
+			}
+
+			std::ofstream out;
+			if (!outFileName.empty())
+			{
+				out.open(outFileName);
+				out << "name,iterations,ns_per_iteration,items_per_second,label,error\n";
+			}
+
+			printf("%-40s %14s %14s %16s\n", "Benchmark", "Time (ns)", "Iterations", "Items/s");
+			for (const auto &b : registry())
+			{
+				if (!filter.empty() && std::string(b.name).find(filter) == std::string::npos) continue;
+
+				State state(1);
+				for (;;)
+				{
+					state = State(state.m_iterations);
+					b.fn(state);
+					const double seconds = state.m_elapsedNs * 1e-9;
+					if (!state.m_error.empty() || seconds >= MIN_TIME_S || state.m_iterations >= MAX_ITERATIONS) break;
+
+					// Aim 40% past the minimum time, at most 10x more iterations per round
+					const double multiplier = seconds <= 0. ? 10. : std::min(10., MIN_TIME_S * 1.4 / seconds);
+					state.m_iterations = std::max(state.m_iterations + 1, static_cast<uint64_t>(state.m_iterations * multiplier));
+				}
+
+				if (!state.m_error.empty())
+				{
+					printf("%-40s ERROR: %s\n", b.name, state.m_error.c_str());
+					if (out.is_open()) out << b.name << ",0,,,," << state.m_error << "\n";
+					continue;
+				}
+
+				const double nsPerIteration = static_cast<double>(state.m_elapsedNs) / state.m_iterations;
+				const double itemsPerSecond = state.m_itemsProcessed * 1e9 / std::max<double>(1., static_cast<double>(state.m_elapsedNs));
+				printf("%-40s %14.0f %14llu %16.0f %s\n", b.name, nsPerIteration, static_cast<unsigned long long>(state.m_iterations),
+					itemsPerSecond, state.m_label.c_str());
+				if (out.is_open())
+				{
+					out << b.name << "," << state.m_iterations << "," << nsPerIteration << "," << itemsPerSecond << "," << state.m_label << ",\n";
+				}
+			}
+
+			return 0;
+		}
+	};
+
+	inline int RunSpecifiedBenchmarks(int argc, char *argv[])
+	{
+		return Runner::run(argc, argv);
+	}
+}
+
+#define BENCHMARK_CONCAT_IMPL(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_IMPL(a, b)
+#define BENCHMARK(fn) static int BENCHMARK_CONCAT(benchmarkRegistration, __LINE__) = benchmark::registerBenchmark(#fn, fn)